@@ -0,0 +1,908 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Benchmark a set of representative gensio stacks.  For each stack an
+ * accepter and a connecter are created in this process, the accepter
+ * echos everything it gets, and the connecter measures:
+ *
+ *  throughput - Push a block of data through and wait for it to all
+ *    come back.  MB/s is for the payload, CPU ns/byte is user+system
+ *    time for both ends divided by the payload size.
+ *  latency - Ping-pong small messages one at a time and report
+ *    percentiles of the round trip time.
+ *  connects - Open and close connections one after the other and
+ *    report the rate.  For ssl and certauth this is the handshake
+ *    rate, for the others it is the accept rate.
+ *  footprint - The memory one open connection holds on the client
+ *    side and the number of gensios for it.
+ *  allocs - With -A, allocations per connect and per latency round
+ *    trip (both ends), and where the round trip ones came from.  A
+ *    stack allocating more than MAX_MSG_ALLOCS per round trip fails,
+ *    so a hot path that starts allocating is caught.
+ *
+ * Everything runs in one thread so the numbers are comparable between
+ * runs on the same machine, they are not meant to be compared between
+ * machines.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_list.h>
+
+struct bench;
+
+struct bconn {
+    struct bench *b;
+    struct gensio *io;
+    struct gensio_link link;
+    unsigned char *buf;		/* Echo data waiting to be written. */
+    gensiods len;
+    gensiods pos;
+};
+
+enum btest { BT_NONE, BT_THROUGHPUT, BT_LATENCY, BT_CONNECT };
+
+struct bench {
+    struct gensio_os_funcs *o;
+    struct gensio_waiter *waiter;
+    struct gensio_accepter *acc;
+    struct gensio_list conns;	/* Server side connections. */
+    char constr[1024];
+
+    enum btest test;
+    int err;
+
+    /* Client side. */
+    struct gensio *io;
+    unsigned char *data;
+    gensiods chunk;
+    gensiods total;
+    gensiods sent;
+    gensiods recvd;
+
+    unsigned int count;
+    unsigned int done;
+    unsigned long long start;
+    unsigned long long *samples;
+};
+
+struct bstack {
+    const char *name;
+    const char *acc;	/* %k is replaced with the key directory. */
+    const char *con;	/* Same, and %p is replaced with the port. */
+    bool keys;		/* Needs the keys from the key directory. */
+    bool lossy;		/* Data may be lost, don't do throughput. */
+    gensiods chunk;
+};
+
+static struct bstack stacks[] = {
+    { "tcp", "tcp,localhost,0", "tcp,localhost,%p", false, false, 16384 },
+    { "ssl", "ssl(key=%k/key.pem,cert=%k/cert.pem),tcp,localhost,0",
+      "ssl(CA=%k/CA.pem),tcp,localhost,%p", true, false, 16384 },
+    { "mux-ssl", "mux,ssl(key=%k/key.pem,cert=%k/cert.pem),tcp,localhost,0",
+      "mux,ssl(CA=%k/CA.pem),tcp,localhost,%p", true, false, 16384 },
+    { "telnet", "telnet,tcp,localhost,0", "telnet,tcp,localhost,%p",
+      false, false, 16384 },
+    { "msgdelim-udp", "msgdelim,udp,localhost,0",
+      "msgdelim,udp,localhost,%p", false, true, 100 },
+    { "relpkt-udp", "relpkt,msgdelim,udp,localhost,0",
+      "relpkt,msgdelim,udp,localhost,%p", false, false, 100 },
+    { "certauth",
+      "certauth(CA=%k/clientcert.pem),"
+      "ssl(key=%k/key.pem,cert=%k/cert.pem),tcp,localhost,0",
+      "certauth(cert=%k/clientcert.pem,key=%k/clientkey.pem,"
+      "username=bench),ssl(CA=%k/CA.pem),tcp,localhost,%p",
+      true, false, 16384 },
+    { "pipe", "pipe,gbench", "pipe,gbench", false, false, 16384 },
+    { NULL }
+};
+
+static gensiods tp_size = 64 * 1024 * 1024;
+static unsigned int lat_count = 10000;
+static unsigned int lat_size = 64;
+static unsigned int conn_count = 200;
+static unsigned int timeout_secs = 60;
+static const char *keydir = "../tests/ca";
+static bool show_layers;
+static bool check_allocs;
+static unsigned int alloc_fails;
+
+static unsigned long long
+now_nsecs(struct bench *b)
+{
+    gensio_time t;
+
+    gensio_os_funcs_get_monotonic_time(b->o, &t);
+    return t.secs * 1000000000ULL + t.nsecs;
+}
+
+static unsigned long long
+cpu_nsecs(void)
+{
+    struct rusage r;
+
+    getrusage(RUSAGE_SELF, &r);
+    return ((r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000000ULL +
+	    (r.ru_utime.tv_usec + r.ru_stime.tv_usec) * 1000ULL);
+}
+
+static void
+bench_done(struct bench *b, int err)
+{
+    if (!b->err)
+	b->err = err;
+    b->test = BT_NONE;
+    gensio_os_funcs_wake(b->o, b->waiter);
+}
+
+static int
+bench_wait(struct bench *b)
+{
+    gensio_time timeout = { timeout_secs, 0 };
+    int rv;
+
+    rv = gensio_os_funcs_wait(b->o, b->waiter, 1, &timeout);
+    if (rv)
+	return rv;
+    return b->err;
+}
+
+/*
+ * Server side, echo everything back.  If the echo can't all be
+ * written, hold it and stop reading until it goes out.
+ */
+static void
+bconn_free(struct bconn *c)
+{
+    gensio_list_rm(&c->b->conns, &c->link);
+    gensio_free(c->io);
+    free(c->buf);
+    free(c);
+}
+
+static void
+bconn_close_done(struct gensio *io, void *close_data)
+{
+    bconn_free(close_data);
+}
+
+static void
+bconn_close(struct bconn *c)
+{
+    gensio_set_read_callback_enable(c->io, false);
+    gensio_set_write_callback_enable(c->io, false);
+    if (gensio_close(c->io, bconn_close_done, c))
+	bconn_free(c);
+}
+
+static int
+bconn_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct bconn *c = user_data;
+    gensiods count;
+    int rv;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    bconn_close(c);
+	    return 0;
+	}
+	rv = gensio_write(io, &count, buf, *buflen, NULL);
+	if (rv) {
+	    bconn_close(c);
+	    return 0;
+	}
+	if (count < *buflen) {
+	    c->buf = malloc(*buflen - count);
+	    if (!c->buf) {
+		bconn_close(c);
+		return 0;
+	    }
+	    memcpy(c->buf, buf + count, *buflen - count);
+	    c->len = *buflen - count;
+	    c->pos = 0;
+	    gensio_set_read_callback_enable(io, false);
+	    gensio_set_write_callback_enable(io, true);
+	}
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	if (!c->buf) {
+	    gensio_set_write_callback_enable(io, false);
+	    return 0;
+	}
+	rv = gensio_write(io, &count, c->buf + c->pos, c->len - c->pos, NULL);
+	if (rv) {
+	    bconn_close(c);
+	    return 0;
+	}
+	c->pos += count;
+	if (c->pos == c->len) {
+	    free(c->buf);
+	    c->buf = NULL;
+	    gensio_set_write_callback_enable(io, false);
+	    gensio_set_read_callback_enable(io, true);
+	}
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+bacc_event(struct gensio_accepter *accepter, void *user_data,
+	   int event, void *data)
+{
+    struct bench *b = user_data;
+    struct bconn *c;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    c = calloc(1, sizeof(*c));
+    if (!c) {
+	gensio_free(data);
+	return 0;
+    }
+    c->b = b;
+    c->io = data;
+    gensio_list_add_tail(&b->conns, &c->link);
+    gensio_set_callback(c->io, bconn_event, c);
+    gensio_set_read_callback_enable(c->io, true);
+    return 0;
+}
+
+/*
+ * Client side.
+ */
+static void
+client_send(struct bench *b)
+{
+    gensiods len, count;
+    int rv;
+
+    while (b->sent < b->total) {
+	len = b->total - b->sent;
+	if (len > b->chunk)
+	    len = b->chunk;
+	rv = gensio_write(b->io, &count, b->data, len, NULL);
+	if (rv) {
+	    bench_done(b, rv);
+	    return;
+	}
+	b->sent += count;
+	if (count < len)
+	    break;
+    }
+    gensio_set_write_callback_enable(b->io, b->sent < b->total);
+}
+
+static void
+latency_next(struct bench *b)
+{
+    b->total = lat_size;
+    b->sent = 0;
+    b->recvd = 0;
+    b->start = now_nsecs(b);
+    client_send(b);
+}
+
+static int
+client_event(struct gensio *io, void *user_data, int event, int err,
+	     unsigned char *buf, gensiods *buflen,
+	     const char *const *auxdata)
+{
+    struct bench *b = user_data;
+    unsigned long long now;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    gensio_set_read_callback_enable(io, false);
+	    if (b->test != BT_NONE)
+		bench_done(b, err);
+	    return 0;
+	}
+	b->recvd += *buflen;
+	if (b->recvd < b->total)
+	    return 0;
+	if (b->test == BT_THROUGHPUT) {
+	    bench_done(b, 0);
+	} else if (b->test == BT_LATENCY) {
+	    now = now_nsecs(b);
+	    b->samples[b->done++] = now - b->start;
+	    if (b->done == b->count)
+		bench_done(b, 0);
+	    else
+		latency_next(b);
+	}
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	if (b->test == BT_NONE)
+	    gensio_set_write_callback_enable(io, false);
+	else
+	    client_send(b);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+client_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct bench *b = open_data;
+
+    if (err)
+	bench_done(b, err);
+    else
+	gensio_os_funcs_wake(b->o, b->waiter);
+}
+
+static void
+client_close_done(struct gensio *io, void *close_data)
+{
+    struct bench *b = close_data;
+
+    gensio_os_funcs_wake(b->o, b->waiter);
+}
+
+static int
+client_open(struct bench *b)
+{
+    int rv;
+
+    rv = str_to_gensio(b->constr, b->o, client_event, b, &b->io);
+    if (rv)
+	return rv;
+    rv = gensio_open(b->io, client_open_done, b);
+    if (!rv)
+	rv = bench_wait(b);
+    if (rv) {
+	gensio_free(b->io);
+	b->io = NULL;
+    }
+    return rv;
+}
+
+static void
+client_close(struct bench *b)
+{
+    gensio_time timeout = { 5, 0 };
+
+    gensio_set_read_callback_enable(b->io, false);
+    gensio_set_write_callback_enable(b->io, false);
+    if (!gensio_close(b->io, client_close_done, b))
+	gensio_os_funcs_wait(b->o, b->waiter, 1, &timeout);
+    gensio_free(b->io);
+    b->io = NULL;
+}
+
+static void
+connect_next(struct bench *b);
+
+static void
+connect_close_done(struct gensio *io, void *close_data)
+{
+    struct bench *b = close_data;
+
+    gensio_free(b->io);
+    b->io = NULL;
+    if (++b->done == b->count)
+	bench_done(b, 0);
+    else
+	connect_next(b);
+}
+
+static void
+connect_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct bench *b = open_data;
+
+    if (!err)
+	err = gensio_close(io, connect_close_done, b);
+    if (err) {
+	gensio_free(b->io);
+	b->io = NULL;
+	bench_done(b, err);
+    }
+}
+
+static void
+connect_next(struct bench *b)
+{
+    int rv;
+
+    rv = str_to_gensio(b->constr, b->o, client_event, b, &b->io);
+    if (rv) {
+	bench_done(b, rv);
+	return;
+    }
+    rv = gensio_open(b->io, connect_open_done, b);
+    if (rv) {
+	gensio_free(b->io);
+	b->io = NULL;
+	bench_done(b, rv);
+    }
+}
+
+/*
+ * The tests.
+ */
+static int
+run_throughput(struct bench *b, struct bstack *s)
+{
+    unsigned long long t, cpu;
+    int rv;
+
+    rv = client_open(b);
+    if (rv)
+	return rv;
+
+    b->data = calloc(1, s->chunk);
+    if (!b->data) {
+	client_close(b);
+	return GE_NOMEM;
+    }
+    b->chunk = s->chunk;
+    b->total = tp_size;
+    b->sent = 0;
+    b->recvd = 0;
+    b->err = 0;
+    b->test = BT_THROUGHPUT;
+
+    cpu = cpu_nsecs();
+    t = now_nsecs(b);
+    gensio_set_read_callback_enable(b->io, true);
+    client_send(b);
+    rv = bench_wait(b);
+    t = now_nsecs(b) - t;
+    cpu = cpu_nsecs() - cpu;
+    b->test = BT_NONE;
+
+    if (!rv)
+	printf("  throughput: %.1f MB/s, %.2f CPU ns/byte\n",
+	       (double) tp_size / ((double) t / 1e9) / 1e6,
+	       (double) cpu / (double) tp_size);
+    client_close(b);
+    free(b->data);
+    b->data = NULL;
+    return rv;
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+pctl(struct bench *b, double p)
+{
+    unsigned int i = (unsigned int) (p / 100.0 * (b->count - 1) + 0.5);
+
+    return b->samples[i] / 1000.0;
+}
+
+/* Print the GENSIO_CONTROL_LATENCY histograms of each client layer. */
+static void
+print_layers(struct bench *b)
+{
+    char buf[8192], *line, *next;
+    gensiods len;
+    unsigned int depth;
+    int rv;
+
+    for (depth = 0; ; depth++) {
+	len = sizeof(buf);
+	rv = gensio_control(b->io, depth, GENSIO_CONTROL_GET,
+			    GENSIO_CONTROL_LATENCY, buf, &len);
+	if (rv == GE_NOTFOUND)
+	    break;
+	if (rv)
+	    continue;
+	printf("  layer %u (%s):\n", depth, gensio_get_type(b->io, depth));
+	for (line = buf; line; line = next) {
+	    next = strchr(line, '\n');
+	    if (next)
+		*next++ = '\0';
+	    printf("    %s\n", line);
+	}
+    }
+}
+
+/*
+ * Print what one open connection costs: the GENSIO_CONTROL_MEMORY sum
+ * of the client stack, and the number of gensios allocated, which is
+ * both ends of the connection.
+ */
+static void
+print_footprint(struct bench *b)
+{
+    char buf[30];
+    gensiods len = sizeof(buf);
+
+    if (gensio_control(b->io, GENSIO_CONTROL_DEPTH_ALL, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_MEMORY, buf, &len))
+	strcpy(buf, "?");
+    printf("  footprint: %s bytes client side, %lu gensios both ends\n",
+	   buf, (unsigned long) gensio_num_alloced());
+}
+
+static const char *alloc_ops[] = { "other", "open", "close", "read", "write" };
+
+#define MAX_ALLOC_ENTRIES 64
+
+/*
+ * The data paths should not allocate, but buffers growing and such
+ * can do an occasional one.
+ */
+#define MAX_MSG_ALLOCS 0.05
+
+/*
+ * Print the allocations since profiling was last reset divided by
+ * per, and with detail where they came from.  Returns the total
+ * divided by per.
+ */
+static double
+print_allocs(struct bench *b, const char *what, unsigned int per,
+	     bool detail)
+{
+    struct gensio_alloc_prof_entry e[MAX_ALLOC_ENTRIES];
+    gensiods i, n = MAX_ALLOC_ENTRIES;
+    unsigned long long total = 0;
+
+    if (gensio_os_funcs_get_alloc_prof(b->o, e, &n))
+	return 0;
+    if (n > MAX_ALLOC_ENTRIES)
+	n = MAX_ALLOC_ENTRIES;
+    for (i = 0; i < n; i++)
+	total += e[i].allocs;
+    printf("  allocs: %.2f per %s\n", (double) total / per, what);
+    for (i = 0; detail && i < n; i++) {
+	if (e[i].allocs)
+	    printf("    %s %s: %.2f\n", e[i].tag ? e[i].tag : "-",
+		   alloc_ops[e[i].op], (double) e[i].allocs / per);
+    }
+    return (double) total / per;
+}
+
+static int
+run_latency(struct bench *b, struct bstack *s)
+{
+    double allocs;
+    int rv;
+
+    rv = client_open(b);
+    if (rv)
+	return rv;
+    print_footprint(b);
+    if (show_layers)
+	gensio_control(b->io, GENSIO_CONTROL_DEPTH_ALL, GENSIO_CONTROL_SET,
+		       GENSIO_CONTROL_LATENCY, "on", NULL);
+
+    b->samples = calloc(lat_count, sizeof(*b->samples));
+    b->data = calloc(1, lat_size);
+    if (!b->samples || !b->data) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    b->chunk = lat_size;
+    b->count = lat_count;
+    b->done = 0;
+    b->err = 0;
+    b->test = BT_LATENCY;
+
+    if (check_allocs)
+	gensio_os_funcs_set_alloc_prof(b->o, true);
+    gensio_set_read_callback_enable(b->io, true);
+    latency_next(b);
+    rv = bench_wait(b);
+    b->test = BT_NONE;
+    if (!rv && check_allocs) {
+	allocs = print_allocs(b, "round trip", b->count, true);
+	if (allocs > MAX_MSG_ALLOCS) {
+	    printf("  allocs: over the budget of %.2f per round trip\n",
+		   MAX_MSG_ALLOCS);
+	    alloc_fails++;
+	}
+    }
+    if (!rv) {
+	qsort(b->samples, b->count, sizeof(*b->samples), cmp_ull);
+	printf("  latency (%u bytes): p50 %.1fus, p99 %.1fus, p99.9 %.1fus,"
+	       " max %.1fus\n", lat_size, pctl(b, 50), pctl(b, 99),
+	       pctl(b, 99.9), b->samples[b->count - 1] / 1000.0);
+	if (show_layers)
+	    print_layers(b);
+    }
+ out:
+    client_close(b);
+    free(b->samples);
+    b->samples = NULL;
+    free(b->data);
+    b->data = NULL;
+    return rv;
+}
+
+static int
+run_connect(struct bench *b, struct bstack *s)
+{
+    unsigned long long t, cpu;
+    int rv;
+
+    b->count = conn_count;
+    b->done = 0;
+    b->err = 0;
+    b->test = BT_CONNECT;
+
+    if (check_allocs)
+	gensio_os_funcs_set_alloc_prof(b->o, true);
+    cpu = cpu_nsecs();
+    t = now_nsecs(b);
+    connect_next(b);
+    rv = bench_wait(b);
+    t = now_nsecs(b) - t;
+    cpu = cpu_nsecs() - cpu;
+    b->test = BT_NONE;
+
+    if (!rv)
+	printf("  connects: %.0f/s, %.1f CPU us/connect\n",
+	       b->count / ((double) t / 1e9),
+	       (double) cpu / b->count / 1000.0);
+    if (!rv && check_allocs)
+	print_allocs(b, "connect", b->count, false);
+    return rv;
+}
+
+static void
+subst(char *out, size_t outlen, const char *in, const char *port)
+{
+    size_t pos = 0;
+    const char *r;
+
+    for (; *in && pos < outlen - 1; in++) {
+	r = NULL;
+	if (in[0] == '%' && in[1] == 'k')
+	    r = keydir;
+	else if (in[0] == '%' && in[1] == 'p')
+	    r = port;
+	if (!r) {
+	    out[pos++] = *in;
+	    continue;
+	}
+	in++;
+	while (*r && pos < outlen - 1)
+	    out[pos++] = *r++;
+    }
+    out[pos] = '\0';
+}
+
+static void
+acc_shutdown_done(struct gensio_accepter *acc, void *shutdown_data)
+{
+    struct bench *b = shutdown_data;
+
+    gensio_os_funcs_wake(b->o, b->waiter);
+}
+
+static int
+run_stack(struct bench *b, struct bstack *s)
+{
+    char accstr[1024], port[16];
+    gensiods len = sizeof(port);
+    gensio_time timeout;
+    struct gensio_link *l, *l2;
+    int rv;
+
+    if (s->keys && access(keydir, R_OK) != 0) {
+	printf("%s: skipped, no keys in %s\n", s->name, keydir);
+	return 0;
+    }
+
+    subst(accstr, sizeof(accstr), s->acc, NULL);
+    rv = str_to_gensio_accepter(accstr, b->o, bacc_event, b, &b->acc);
+    if (rv)
+	goto out_err;
+    rv = gensio_acc_startup(b->acc);
+    if (rv)
+	goto out_err;
+
+    strcpy(port, "0");
+    gensio_acc_control(b->acc, GENSIO_CONTROL_DEPTH_FIRST, true,
+		       GENSIO_ACC_CONTROL_LPORT, port, &len);
+    subst(b->constr, sizeof(b->constr), s->con, port);
+
+    printf("%s:\n", s->name);
+    if (!s->lossy) {
+	rv = run_throughput(b, s);
+	if (rv)
+	    goto out_err;
+    }
+    rv = run_latency(b, s);
+    if (rv)
+	goto out_err;
+    rv = run_connect(b, s);
+
+ out_err:
+    if (rv)
+	printf("%s: error: %s\n", s->name, gensio_err_to_str(rv));
+    gensio_list_for_each_safe(&b->conns, l, l2)
+	bconn_close(gensio_container_of(l, struct bconn, link));
+    timeout.secs = 0;
+    timeout.nsecs = 100000000;
+    while (!gensio_list_empty(&b->conns)) {
+	if (gensio_os_funcs_service(b->o, &timeout) == GE_TIMEDOUT) {
+	    /* Connections that never finish closing, just free them. */
+	    gensio_list_for_each_safe(&b->conns, l, l2)
+		bconn_free(gensio_container_of(l, struct bconn, link));
+	}
+    }
+    if (b->acc) {
+	if (!gensio_acc_shutdown(b->acc, acc_shutdown_done, b))
+	    gensio_os_funcs_wait(b->o, b->waiter, 1, NULL);
+	gensio_acc_free(b->acc);
+	b->acc = NULL;
+    }
+    return rv;
+}
+
+static void
+help(const char *name)
+{
+    struct bstack *s;
+
+    printf("%s [options] [stack ...]\n", name);
+    printf("  -k, --keydir <dir> - Key directory from tests/make_keys\n");
+    printf("  -s, --size <n> - Bytes for the throughput test\n");
+    printf("  -l, --latency-count <n> - Messages for the latency test\n");
+    printf("  -m, --msg-size <n> - Size of latency messages\n");
+    printf("  -c, --connects <n> - Connections for the connect test\n");
+    printf("  -t, --timeout <secs> - Timeout for each test\n");
+    printf("  -L, --layers - Show per-layer latency from the latency test\n");
+    printf("  -A, --allocs - Count allocations, fail if over budget\n");
+    printf("Stacks:");
+    for (s = stacks; s->name; s++)
+	printf(" %s", s->name);
+    printf("\n");
+}
+
+static unsigned long
+get_num(const char *name, const char *arg)
+{
+    char *end;
+    unsigned long v;
+
+    if (!arg) {
+	fprintf(stderr, "No value given for %s\n", name);
+	exit(1);
+    }
+    v = strtoul(arg, &end, 0);
+    if (*end == 'k' || *end == 'K') {
+	v *= 1024;
+	end++;
+    } else if (*end == 'm' || *end == 'M') {
+	v *= 1024 * 1024;
+	end++;
+    }
+    if (*end || v == 0) {
+	fprintf(stderr, "Invalid value for %s: %s\n", name, arg);
+	exit(1);
+    }
+    return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench b;
+    struct bstack *s;
+    int i, j, rv, errs = 0;
+    bool any = false;
+
+    memset(&b, 0, sizeof(b));
+    gensio_list_init(&b.conns);
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+	const char *a = argv[i];
+
+	if (strcmp(a, "-k") == 0 || strcmp(a, "--keydir") == 0) {
+	    keydir = argv[++i];
+	    if (!keydir) {
+		fprintf(stderr, "No value given for %s\n", a);
+		return 1;
+	    }
+	} else if (strcmp(a, "-s") == 0 || strcmp(a, "--size") == 0) {
+	    tp_size = get_num(a, argv[++i]);
+	} else if (strcmp(a, "-l") == 0 ||
+		   strcmp(a, "--latency-count") == 0) {
+	    lat_count = get_num(a, argv[++i]);
+	} else if (strcmp(a, "-m") == 0 || strcmp(a, "--msg-size") == 0) {
+	    lat_size = get_num(a, argv[++i]);
+	} else if (strcmp(a, "-c") == 0 || strcmp(a, "--connects") == 0) {
+	    conn_count = get_num(a, argv[++i]);
+	} else if (strcmp(a, "-t") == 0 || strcmp(a, "--timeout") == 0) {
+	    timeout_secs = get_num(a, argv[++i]);
+	} else if (strcmp(a, "-L") == 0 || strcmp(a, "--layers") == 0) {
+	    show_layers = true;
+	} else if (strcmp(a, "-A") == 0 || strcmp(a, "--allocs") == 0) {
+	    check_allocs = true;
+	} else if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+	    help(argv[0]);
+	    return 0;
+	} else {
+	    fprintf(stderr, "Unknown option: %s\n", a);
+	    help(argv[0]);
+	    return 1;
+	}
+    }
+
+    /* Results show up as they are done even when piped. */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    rv = gensio_default_os_hnd(0, &b.o);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    if (check_allocs) {
+	rv = gensio_os_funcs_set_alloc_prof(b.o, true);
+	if (rv) {
+	    fprintf(stderr, "Could not turn on allocation profiling: %s\n",
+		    gensio_err_to_str(rv));
+	    return 1;
+	}
+    }
+    b.waiter = gensio_os_funcs_alloc_waiter(b.o);
+    if (!b.waiter) {
+	fprintf(stderr, "Could not allocate waiter\n");
+	return 1;
+    }
+
+    for (s = stacks; s->name; s++) {
+	if (i < argc) {
+	    for (j = i; j < argc; j++) {
+		if (strcmp(argv[j], s->name) == 0)
+		    break;
+	    }
+	    if (j == argc)
+		continue;
+	}
+	any = true;
+	if (run_stack(&b, s))
+	    errs++;
+    }
+    if (!any) {
+	fprintf(stderr, "No matching stacks\n");
+	errs++;
+    }
+
+    if (errs)
+	/* A stack that failed may still have things in use, just exit. */
+	return 1;
+    gensio_os_funcs_free_waiter(b.o, b.waiter);
+    gensio_os_funcs_set_alloc_prof(b.o, false);
+    gensio_os_funcs_free(b.o);
+    return alloc_fails ? 1 : 0;
+}
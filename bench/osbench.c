@@ -0,0 +1,640 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Microbenchmarks for the os handler primitives the gensio hot paths
+ * sit on.  Every os handler is run the same way, select it with -o:
+ *
+ *  timers - Start, stop, and start-and-fire cost per timer with 10^3
+ *    timers up to the -N value (10^6 by default) by powers of 10.
+ *  runners - A set of runners that reschedule themselves, measures
+ *    the dispatch rate.
+ *  runlat - Latency from running a runner in one thread to its
+ *    handler being called in a thread waiting in the os handler.
+ *  wakelat - Latency from waking a waiter to the waiting thread
+ *    returning.
+ *  fds - Dispatch rate for -A always readable fds with -I idle fds
+ *    also registered.
+ *
+ * The cross-thread tests are skipped if the os handler can't do
+ * threads.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_GLIB
+#include <gensio/gensio_glib.h>
+#endif
+#ifdef HAVE_TCL
+#include <gensio/gensio_tcl.h>
+#endif
+
+struct osbench {
+    struct gensio_os_funcs *o;
+    const char *osname;
+    bool threads;
+    struct gensio_waiter *waiter;
+    struct gensio_waiter *waiter2;
+    unsigned int count;
+    unsigned int done;
+
+    /* For the cross-thread tests. */
+    unsigned long long stamp;
+    bool stop;
+};
+
+static unsigned int max_timers = 1000000;
+static unsigned int nrunners = 16;
+static unsigned int nruns = 1000000;
+static unsigned int nsamples = 100000;
+static unsigned int nidle = 400;
+static unsigned int nactive = 8;
+
+static unsigned long long
+now_nsecs(struct osbench *b)
+{
+    gensio_time t;
+
+    gensio_os_funcs_get_monotonic_time(b->o, &t);
+    return t.secs * 1000000000ULL + t.nsecs;
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+print_pctl(const char *name, unsigned long long *s, unsigned int n)
+{
+    qsort(s, n, sizeof(*s), cmp_ull);
+    printf("%s (%u): p50 %lluns, p99 %lluns, p99.9 %lluns, max %lluns\n",
+	   name, n, s[(unsigned int) (n * 0.5)], s[(unsigned int) (n * 0.99)],
+	   s[(unsigned int) (n * 0.999)], s[n - 1]);
+}
+
+static void
+timer_handler(struct gensio_timer *t, void *cb_data)
+{
+    struct osbench *b = cb_data;
+
+    if (++b->done == b->count)
+	gensio_os_funcs_wake(b->o, b->waiter);
+}
+
+static int
+bench_timers_n(struct osbench *b, unsigned int ntimers)
+{
+    struct gensio_timer **timers;
+    gensio_time timeout;
+    unsigned long long t, tstart, tstop;
+    unsigned int i;
+    int rv = 0;
+
+    timers = calloc(ntimers, sizeof(*timers));
+    if (!timers)
+	return GE_NOMEM;
+    for (i = 0; i < ntimers; i++) {
+	timers[i] = gensio_os_funcs_alloc_timer(b->o, timer_handler, b);
+	if (!timers[i]) {
+	    rv = GE_NOMEM;
+	    goto out;
+	}
+    }
+
+    /* Spread the timeouts out so the timer structure has some depth. */
+    t = now_nsecs(b);
+    for (i = 0; i < ntimers; i++) {
+	timeout.secs = 100 + i % 1000;
+	timeout.nsecs = (i * 7919) % 1000000000;
+	gensio_os_funcs_start_timer(b->o, timers[i], &timeout);
+    }
+    tstart = now_nsecs(b) - t;
+    t = now_nsecs(b);
+    for (i = 0; i < ntimers; i++)
+	gensio_os_funcs_stop_timer(b->o, timers[i]);
+    tstop = now_nsecs(b) - t;
+
+    b->count = ntimers;
+    b->done = 0;
+    timeout.secs = 0;
+    timeout.nsecs = 0;
+    t = now_nsecs(b);
+    for (i = 0; i < ntimers; i++)
+	gensio_os_funcs_start_timer(b->o, timers[i], &timeout);
+    rv = gensio_os_funcs_wait(b->o, b->waiter, 1, NULL);
+    t = now_nsecs(b) - t;
+    if (!rv)
+	printf("timers (%u): start %.0fns, stop %.0fns, start+fire %.0fns\n",
+	       ntimers, (double) tstart / ntimers, (double) tstop / ntimers,
+	       (double) t / ntimers);
+
+ out:
+    for (i = 0; i < ntimers && timers[i]; i++)
+	gensio_os_funcs_free_timer(b->o, timers[i]);
+    free(timers);
+    return rv;
+}
+
+static int
+bench_timers(struct osbench *b)
+{
+    unsigned int n;
+    int rv = 0;
+
+    for (n = 1000; !rv && n <= max_timers; n *= 10)
+	rv = bench_timers_n(b, n);
+    return rv;
+}
+
+static void
+runner_handler(struct gensio_runner *r, void *cb_data)
+{
+    struct osbench *b = cb_data;
+
+    if (b->done >= b->count)
+	return;
+    if (++b->done == b->count)
+	gensio_os_funcs_wake(b->o, b->waiter);
+    else
+	gensio_os_funcs_run(b->o, r);
+}
+
+static int
+bench_runners(struct osbench *b)
+{
+    struct gensio_runner **runners;
+    unsigned long long t;
+    unsigned int i;
+    int rv = 0;
+
+    runners = calloc(nrunners, sizeof(*runners));
+    if (!runners)
+	return GE_NOMEM;
+    for (i = 0; i < nrunners; i++) {
+	runners[i] = gensio_os_funcs_alloc_runner(b->o, runner_handler, b);
+	if (!runners[i]) {
+	    rv = GE_NOMEM;
+	    goto out;
+	}
+    }
+
+    b->count = nruns;
+    b->done = 0;
+    t = now_nsecs(b);
+    for (i = 0; i < nrunners; i++)
+	gensio_os_funcs_run(b->o, runners[i]);
+    rv = gensio_os_funcs_wait(b->o, b->waiter, 1, NULL);
+    t = now_nsecs(b) - t;
+    if (!rv)
+	printf("runners (%u): %.0f dispatches/s, %.0fns each\n",
+	       nrunners, nruns / ((double) t / 1e9), (double) t / nruns);
+
+ out:
+    /* Let the other runners finish before freeing them. */
+    for (i = 0; i < nrunners; i++) {
+	gensio_time timeout = { 0, 10000000 };
+
+	gensio_os_funcs_service(b->o, &timeout);
+    }
+    for (i = 0; i < nrunners && runners[i]; i++)
+	gensio_os_funcs_free_runner(b->o, runners[i]);
+    free(runners);
+    return rv;
+}
+
+/*
+ * For the cross-thread tests the main thread triggers something and
+ * spins on b->stamp, it doesn't go into the os handler so the other
+ * thread has to do the work.
+ */
+static void
+set_stamp(struct osbench *b)
+{
+    __atomic_store_n(&b->stamp, now_nsecs(b), __ATOMIC_RELEASE);
+}
+
+static unsigned long long
+spin_stamp(struct osbench *b)
+{
+    unsigned long long s;
+
+    while (!(s = __atomic_load_n(&b->stamp, __ATOMIC_ACQUIRE)))
+	;
+    __atomic_store_n(&b->stamp, 0, __ATOMIC_RELAXED);
+    return s;
+}
+
+static void
+service_thread(void *data)
+{
+    struct osbench *b = data;
+
+    gensio_os_funcs_wait(b->o, b->waiter2, 1, NULL);
+}
+
+static void
+runlat_handler(struct gensio_runner *r, void *cb_data)
+{
+    set_stamp(cb_data);
+}
+
+static int
+bench_runlat(struct osbench *b)
+{
+    struct gensio_runner *runner;
+    struct gensio_thread *tid;
+    unsigned long long *s, t;
+    unsigned int i;
+    int rv;
+
+    if (!b->threads) {
+	printf("runlat: skipped, %s can't do threads\n", b->osname);
+	return 0;
+    }
+
+    s = calloc(nsamples, sizeof(*s));
+    if (!s)
+	return GE_NOMEM;
+    runner = gensio_os_funcs_alloc_runner(b->o, runlat_handler, b);
+    b->waiter2 = gensio_os_funcs_alloc_waiter(b->o);
+    if (!runner || !b->waiter2) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    rv = gensio_os_new_thread(b->o, service_thread, b, &tid);
+    if (rv)
+	goto out;
+
+    for (i = 0; i < nsamples; i++) {
+	t = now_nsecs(b);
+	gensio_os_funcs_run(b->o, runner);
+	s[i] = spin_stamp(b) - t;
+    }
+    gensio_os_funcs_wake(b->o, b->waiter2);
+    gensio_os_wait_thread(tid);
+    print_pctl("runlat", s, nsamples);
+
+ out:
+    if (b->waiter2)
+	gensio_os_funcs_free_waiter(b->o, b->waiter2);
+    b->waiter2 = NULL;
+    if (runner)
+	gensio_os_funcs_free_runner(b->o, runner);
+    free(s);
+    return rv;
+}
+
+static void
+wake_thread(void *data)
+{
+    struct osbench *b = data;
+
+    for (;;) {
+	if (gensio_os_funcs_wait(b->o, b->waiter2, 1, NULL))
+	    break;
+	if (b->stop)
+	    break;
+	set_stamp(b);
+    }
+}
+
+static int
+bench_wakelat(struct osbench *b)
+{
+    struct gensio_thread *tid;
+    unsigned long long *s, t;
+    unsigned int i;
+    int rv;
+
+    if (!b->threads) {
+	printf("wakelat: skipped, %s can't do threads\n", b->osname);
+	return 0;
+    }
+
+    s = calloc(nsamples, sizeof(*s));
+    if (!s)
+	return GE_NOMEM;
+    b->waiter2 = gensio_os_funcs_alloc_waiter(b->o);
+    if (!b->waiter2) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    b->stop = false;
+    rv = gensio_os_new_thread(b->o, wake_thread, b, &tid);
+    if (rv)
+	goto out;
+
+    for (i = 0; i < nsamples; i++) {
+	t = now_nsecs(b);
+	gensio_os_funcs_wake(b->o, b->waiter2);
+	s[i] = spin_stamp(b) - t;
+    }
+    b->stop = true;
+    gensio_os_funcs_wake(b->o, b->waiter2);
+    gensio_os_wait_thread(tid);
+    print_pctl("wakelat", s, nsamples);
+
+ out:
+    if (b->waiter2)
+	gensio_os_funcs_free_waiter(b->o, b->waiter2);
+    b->waiter2 = NULL;
+    free(s);
+    return rv;
+}
+
+#ifndef _WIN32
+struct bfd {
+    struct osbench *b;
+    struct gensio_iod *iod;
+    int wfd;
+};
+
+static void
+fd_read_handler(struct gensio_iod *iod, void *cb_data)
+{
+    struct bfd *f = cb_data;
+
+    /* The data is never read, so it is always ready. */
+    f->b->done++;
+}
+
+static void
+fd_cleared_handler(struct gensio_iod *iod, void *cb_data)
+{
+    struct bfd *f = cb_data;
+
+    if (++f->b->count == nidle + nactive)
+	gensio_os_funcs_wake(f->b->o, f->b->waiter);
+}
+
+static int
+bench_fds(struct osbench *b)
+{
+    struct gensio_os_funcs *o = b->o;
+    unsigned int i, n = nidle + nactive, nalloced = 0;
+    struct bfd *fds;
+    unsigned long long t, end;
+    gensio_time timeout;
+    int rv = 0, p[2];
+
+    fds = calloc(n, sizeof(*fds));
+    if (!fds)
+	return GE_NOMEM;
+
+    for (i = 0; i < n; i++) {
+	if (pipe(p) == -1) {
+	    rv = gensio_os_err_to_err(o, errno);
+	    goto out;
+	}
+	fds[i].b = b;
+	fds[i].wfd = p[1];
+	rv = o->add_iod(o, GENSIO_IOD_PIPE, p[0], &fds[i].iod);
+	if (rv) {
+	    close(p[0]);
+	    close(p[1]);
+	    goto out;
+	}
+	rv = o->set_fd_handlers(fds[i].iod, &fds[i], fd_read_handler,
+				NULL, NULL, fd_cleared_handler);
+	if (rv) {
+	    o->close(&fds[i].iod);
+	    close(p[1]);
+	    goto out;
+	}
+	nalloced++;
+	if (i >= nidle && write(p[1], "x", 1) != 1) {
+	    rv = gensio_os_err_to_err(o, errno);
+	    goto out;
+	}
+	o->set_read_handler(fds[i].iod, true);
+    }
+
+    /* Run for a second. */
+    b->done = 0;
+    t = now_nsecs(b);
+    end = t + 1000000000ULL;
+    while (now_nsecs(b) < end) {
+	timeout.secs = 0;
+	timeout.nsecs = 1000000;
+	gensio_os_funcs_service(o, &timeout);
+    }
+    t = now_nsecs(b) - t;
+    printf("fds (%u idle, %u active): %.0f dispatches/s, %.0fns each\n",
+	   nidle, nactive, b->done / ((double) t / 1e9),
+	   b->done ? (double) t / b->done : 0.0);
+
+ out:
+    /* fd_cleared_handler() wakes when the count gets to n. */
+    b->count = n - nalloced;
+    if (nalloced) {
+	for (i = 0; i < nalloced; i++)
+	    o->clear_fd_handlers(fds[i].iod);
+	gensio_os_funcs_wait(o, b->waiter, 1, NULL);
+    }
+    for (i = 0; i < nalloced; i++) {
+	o->close(&fds[i].iod);
+	close(fds[i].wfd);
+    }
+    free(fds);
+    return rv;
+}
+#else
+static int
+bench_fds(struct osbench *b)
+{
+    printf("fds: skipped, not supported on Windows\n");
+    return 0;
+}
+#endif
+
+static struct {
+    const char *name;
+    int (*func)(struct osbench *b);
+} benches[] = {
+    { "timers", bench_timers },
+    { "runners", bench_runners },
+    { "runlat", bench_runlat },
+    { "wakelat", bench_wakelat },
+    { "fds", bench_fds },
+    { NULL }
+};
+
+static void
+help(const char *name)
+{
+    unsigned int i;
+
+    printf("%s [options] [bench ...]\n", name);
+    printf("  -o, --os <name> - The os handler, one of default");
+#ifdef HAVE_GLIB
+    printf(", glib");
+#endif
+#ifdef HAVE_TCL
+    printf(", tcl");
+#endif
+    printf("\n");
+    printf("  -N, --max-timers <n> - Largest number of timers\n");
+    printf("  -r, --runners <n> - Number of runners\n");
+    printf("  -d, --dispatches <n> - Total runner dispatches\n");
+    printf("  -s, --samples <n> - Samples for the latency tests\n");
+    printf("  -I, --idle-fds <n> - Idle fds for the fd test\n");
+    printf("  -A, --active-fds <n> - Active fds for the fd test\n");
+    printf("Benchmarks:");
+    for (i = 0; benches[i].name; i++)
+	printf(" %s", benches[i].name);
+    printf("\n");
+}
+
+static unsigned int
+get_num(const char *name, const char *arg, bool zero_ok)
+{
+    char *end;
+    unsigned long v;
+
+    if (!arg) {
+	fprintf(stderr, "No value given for %s\n", name);
+	exit(1);
+    }
+    v = strtoul(arg, &end, 0);
+    if (*end || (v == 0 && !zero_ok)) {
+	fprintf(stderr, "Invalid value for %s: %s\n", name, arg);
+	exit(1);
+    }
+    return v;
+}
+
+static int
+alloc_os(struct osbench *b)
+{
+    if (strcmp(b->osname, "default") == 0) {
+	b->threads = true;
+	return gensio_default_os_hnd(GENSIO_DEF_WAKE_SIG, &b->o);
+#ifdef HAVE_GLIB
+    } else if (strcmp(b->osname, "glib") == 0) {
+	b->threads = true;
+	return gensio_glib_funcs_alloc(&b->o);
+#endif
+#ifdef HAVE_TCL
+    } else if (strcmp(b->osname, "tcl") == 0) {
+	/* The tcl os handler can only be used from one thread. */
+	b->threads = false;
+	return gensio_tcl_funcs_alloc(&b->o);
+#endif
+    }
+    fprintf(stderr, "Unknown or unavailable os handler: %s\n", b->osname);
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct osbench b;
+    struct gensio_os_proc_data *proc_data = NULL;
+    int i, j, k, rv, errs = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.osname = "default";
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+	const char *a = argv[i];
+
+	if (strcmp(a, "-o") == 0 || strcmp(a, "--os") == 0) {
+	    b.osname = argv[++i];
+	    if (!b.osname) {
+		fprintf(stderr, "No value given for %s\n", a);
+		return 1;
+	    }
+	} else if (strcmp(a, "-N") == 0 || strcmp(a, "--max-timers") == 0) {
+	    max_timers = get_num(a, argv[++i], false);
+	} else if (strcmp(a, "-r") == 0 || strcmp(a, "--runners") == 0) {
+	    nrunners = get_num(a, argv[++i], false);
+	} else if (strcmp(a, "-d") == 0 || strcmp(a, "--dispatches") == 0) {
+	    nruns = get_num(a, argv[++i], false);
+	} else if (strcmp(a, "-s") == 0 || strcmp(a, "--samples") == 0) {
+	    nsamples = get_num(a, argv[++i], false);
+	} else if (strcmp(a, "-I") == 0 || strcmp(a, "--idle-fds") == 0) {
+	    nidle = get_num(a, argv[++i], true);
+	} else if (strcmp(a, "-A") == 0 || strcmp(a, "--active-fds") == 0) {
+	    nactive = get_num(a, argv[++i], true);
+	} else if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+	    help(argv[0]);
+	    return 0;
+	} else {
+	    fprintf(stderr, "Unknown option: %s\n", a);
+	    help(argv[0]);
+	    return 1;
+	}
+    }
+
+#ifndef _WIN32
+    {
+	struct rlimit rl;
+
+	/* The fd test can use a lot of fds. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+	    rl.rlim_cur = rl.rlim_max;
+	    setrlimit(RLIMIT_NOFILE, &rl);
+	}
+    }
+#endif
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    rv = alloc_os(&b);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    rv = gensio_os_proc_setup(b.o, &proc_data);
+    if (rv) {
+	fprintf(stderr, "Could not setup process data: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    b.waiter = gensio_os_funcs_alloc_waiter(b.o);
+    if (!b.waiter) {
+	fprintf(stderr, "Could not allocate waiter\n");
+	return 1;
+    }
+
+    printf("os handler: %s\n", b.osname);
+    for (k = 0; benches[k].name; k++) {
+	if (i < argc) {
+	    for (j = i; j < argc; j++) {
+		if (strcmp(argv[j], benches[k].name) == 0)
+		    break;
+	    }
+	    if (j == argc)
+		continue;
+	}
+	rv = benches[k].func(&b);
+	if (rv) {
+	    printf("%s: error: %s\n", benches[k].name, gensio_err_to_str(rv));
+	    errs++;
+	}
+    }
+
+    gensio_os_funcs_free_waiter(b.o, b.waiter);
+    gensio_os_proc_cleanup(proc_data);
+    gensio_os_funcs_free(b.o);
+    return !!errs;
+}
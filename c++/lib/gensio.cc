@@ -41,8 +41,8 @@ namespace gensios {
 	    try {
 		if (event >= GENSIO_EVENT_USER_MIN &&
 		    event <= GENSIO_EVENT_USER_MAX) {
-		    std::vector<unsigned char> val(buf, buf + *buflen);
-		    return cb->user_event(event, err, val, auxdata);
+		    SimpleUCharVector val(buf, *buflen);
+		    return cb->user_event_view(event, err, val, auxdata);
 		}
 
 		if (event >= SERGENSIO_EVENT_BASE &&
@@ -54,8 +54,8 @@ namespace gensios {
 			return GE_NOTSUP;
 
 		    if (event == GENSIO_EVENT_SER_SIGNATURE) {
-			std::vector<unsigned char> sig(buf, buf + *buflen);
-			scb->signature(sig);
+			SimpleUCharVector sig(buf, *buflen);
+			scb->signature_view(sig);
 			return 0;
 		    }
 
@@ -158,10 +158,8 @@ namespace gensios {
 		    return cb->postcert_verify(err,
 					       auxdata ? auxdata[0] : NULL);
 
-		case GENSIO_EVENT_PASSWORD_VERIFY: {
-		    std::string pwstr((char *) buf);
-		    return cb->password_verify(pwstr);
-		}
+		case GENSIO_EVENT_PASSWORD_VERIFY:
+		    return cb->password_verify_view((char *) buf);
 
 		case GENSIO_EVENT_REQUEST_PASSWORD: {
 		    int rv;
@@ -178,8 +176,8 @@ namespace gensios {
 		}
 
 		case GENSIO_EVENT_2FA_VERIFY: {
-		    std::vector<unsigned char> val(buf, buf + *buflen);
-		    return cb->verify_2fa(val);
+		    SimpleUCharVector val(buf, *buflen);
+		    return cb->verify_2fa_view(val);
 		}
 
 		case GENSIO_EVENT_REQUEST_2FA: {
@@ -447,13 +445,13 @@ namespace gensios {
 	return count;
     }
 
-    gensiods Gensio::write(const std::vector<unsigned char> data,
+    gensiods Gensio::write(const std::vector<unsigned char> &data,
 			   const char *const *auxdata)
     {
 	return write(data.data(), (gensiods) data.size(), auxdata);
     }
 
-    gensiods Gensio::write(const SimpleUCharVector data,
+    gensiods Gensio::write(const SimpleUCharVector &data,
 			   const char *const *auxdata)
     {
 	return write(data.data(), (gensiods) data.size(), auxdata);
@@ -485,13 +483,13 @@ namespace gensios {
 	return 0;
     }
 
-    int Gensio::write_s(gensiods *count, std::vector<unsigned char> data,
+    int Gensio::write_s(gensiods *count, const std::vector<unsigned char> &data,
 			gensio_time *timeout, bool intr)
     {
 	return write_s(count, data.data(), (gensiods) data.size(), timeout, intr);
     }
 
-    int Gensio::write_s(gensiods *count, SimpleUCharVector data,
+    int Gensio::write_s(gensiods *count, const SimpleUCharVector &data,
 			gensio_time *timeout, bool intr)
     {
 	return write_s(count, data.data(), (gensiods) data.size(), timeout, intr);
@@ -1073,9 +1071,8 @@ namespace gensios {
 		case GENSIO_ACC_EVENT_PASSWORD_VERIFY: {
 		    struct gensio_acc_password_verify_data *p =
 			(struct gensio_acc_password_verify_data *) data;
-		    std::string pwstr((char *) p->password);
 		    Gensio g(p->io, a->get_os_funcs());
-		    return cb->password_verify(&g, pwstr);
+		    return cb->password_verify_view(&g, (char *) p->password);
 		}
 
 		case GENSIO_ACC_EVENT_REQUEST_PASSWORD: {
@@ -1098,10 +1095,10 @@ namespace gensios {
 		case GENSIO_ACC_EVENT_2FA_VERIFY: {
 		    struct gensio_acc_password_verify_data *p =
 			(struct gensio_acc_password_verify_data *) data;
-		    std::vector<unsigned char> val(p->password,
-					p->password + p->password_len);
+		    SimpleUCharVector val((unsigned char *) p->password,
+					  p->password_len);
 		    Gensio g(p->io, a->get_os_funcs());
-		    return cb->verify_2fa(&g, val);
+		    return cb->verify_2fa_view(&g, val);
 		}
 
 		case GENSIO_ACC_EVENT_REQUEST_2FA: {
@@ -5,6 +5,9 @@
 //  SPDX-License-Identifier: LGPL-2.1-only
 
 #include <string>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <gensio/gensioosh>
 
 namespace gensios {
@@ -234,4 +237,155 @@ namespace gensios {
 	    throw gensio_error(rv);
 	return 0;
     }
+
+    struct Os_Funcs_Pool::Pool_Runner {
+	Os_Funcs_Pool *pool;
+	struct gensio_runner *runner;
+	std::function<void()> fn;
+    };
+
+    struct Os_Funcs_Pool::Pool_Thread {
+	Os_Funcs_Pool *pool;
+	struct gensio_thread *id;
+	int cpu;
+    };
+
+    static void
+    os_funcs_pool_thread(void *data)
+    {
+	Os_Funcs_Pool::Pool_Thread *t =
+	    static_cast<Os_Funcs_Pool::Pool_Thread *>(data);
+
+#ifdef __linux__
+	if (t->cpu >= 0) {
+	    cpu_set_t set;
+
+	    CPU_ZERO(&set);
+	    CPU_SET(t->cpu, &set);
+	    sched_setaffinity(0, sizeof(set), &set);
+	}
+#endif
+	// Service the os funcs until shutdown() wakes us.
+	while (true) {
+	    try {
+		if (t->pool->get_waiter()->wait(1) == 0)
+		    break;
+	    } catch (gensio_error &e) {
+		t->pool->get_os_funcs().log(GENSIO_LOG_ERR,
+			std::string("Os_Funcs_Pool wait error: ") + e.what());
+		break;
+	    }
+	}
+    }
+
+    Os_Funcs_Pool::Os_Funcs_Pool(Os_Funcs &io, unsigned int nthreads,
+				 const std::vector<int> *cpus)
+	: o(io), waiter(io)
+    {
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < nthreads; i++) {
+	    Pool_Thread *t = new Pool_Thread;
+
+	    t->pool = this;
+	    t->cpu = -1;
+	    if (cpus && !cpus->empty())
+		t->cpu = (*cpus)[i % cpus->size()];
+	    err = gensio_os_new_thread(o, os_funcs_pool_thread, t, &t->id);
+	    if (err) {
+		delete t;
+		shutdown();
+		throw gensio_error(err);
+	    }
+	    threads.push_back(t);
+	}
+    }
+
+    Os_Funcs_Pool::~Os_Funcs_Pool()
+    {
+	shutdown();
+	for (auto r : runners) {
+	    gensio_os_funcs_free_runner(o, r->runner);
+	    delete r;
+	}
+    }
+
+    void
+    Os_Funcs_Pool::shutdown()
+    {
+	std::vector<Pool_Thread *> t;
+
+	{
+	    std::lock_guard<std::mutex> l(lock);
+	    t.swap(threads);
+	}
+	for (unsigned int i = 0; i < t.size(); i++)
+	    waiter.wake();
+	for (auto th : t) {
+	    gensio_os_wait_thread(th->id);
+	    delete th;
+	}
+    }
+
+    static void
+    os_funcs_pool_runner(struct gensio_runner *runner, void *cb_data)
+    {
+	Os_Funcs_Pool::Pool_Runner *r =
+	    static_cast<Os_Funcs_Pool::Pool_Runner *>(cb_data);
+	std::function<void()> fn;
+
+	fn.swap(r->fn);
+	r->pool->release(r);
+	try {
+	    fn();
+	} catch (std::exception &e) {
+	    r->pool->get_os_funcs().log(GENSIO_LOG_ERR,
+		std::string("Received C++ exception in posted function: ")
+		+ e.what());
+	}
+    }
+
+    void
+    Os_Funcs_Pool::release(Pool_Runner *r)
+    {
+	std::lock_guard<std::mutex> l(lock);
+
+	free_runners.push_back(r);
+    }
+
+    void
+    Os_Funcs_Pool::post(std::function<void()> fn)
+    {
+	Pool_Runner *r = NULL;
+	int err;
+
+	{
+	    std::lock_guard<std::mutex> l(lock);
+
+	    if (!free_runners.empty()) {
+		r = free_runners.back();
+		free_runners.pop_back();
+	    }
+	}
+	if (!r) {
+	    r = new Pool_Runner;
+	    r->pool = this;
+	    r->runner = gensio_os_funcs_alloc_runner(o, os_funcs_pool_runner,
+						     r);
+	    if (!r->runner) {
+		delete r;
+		throw std::bad_alloc();
+	    }
+	    std::lock_guard<std::mutex> l(lock);
+	    runners.push_back(r);
+	}
+	r->fn = std::move(fn);
+	err = gensio_os_funcs_run(o, r->runner);
+	if (err) {
+	    r->fn = nullptr;
+	    release(r);
+	    throw gensio_error(err);
+	}
+    }
 }
@@ -198,7 +198,7 @@ static bool check_for_err(int err)
 %}
 
 // We use the pure vector versions for python
-%ignore gensios::Gensio::write(const SimpleUCharVector data,
+%ignore gensios::Gensio::write(const SimpleUCharVector &data,
 			       const char *const *auxdata);
 %ignore gensios::Gensio::read_s(const SimpleUCharVector data,
 				gensio_time *timeout = NULL, bool intr = false);
@@ -252,6 +252,16 @@ static bool check_for_err(int err)
     if (PI_ToUCharVector($1, $input) == -1)
 	SWIG_fail;
 }
+%typemap(typecheck, precedence=SWIG_TYPECHECK_VECTOR)
+		const std::vector<unsigned char> & {
+    $1 = PI_CanBeBytes($input);
+}
+%typemap(in) const std::vector<unsigned char> &
+		(std::vector<unsigned char> temp) {
+    if (PI_ToUCharVector(temp, $input) == -1)
+	SWIG_fail;
+    $1 = &temp;
+}
 // Return value for get_addr
 %typemap(out) std::vector<unsigned char> {
     $result = PI_FromStringAndSize((const char *) $1.data(), $1.size());
@@ -836,7 +846,7 @@ static bool check_for_err(int err)
 %rename("") gensios::Gensio::close;
 %rename("") gensios::Gensio::write_s;
 %rename("") gensios::Gensio::write_s(gensiods *count,
-				const std::vector<unsigned char> data,
+				const std::vector<unsigned char> &data,
 				gensio_time *timeout = NULL, bool intr = false);
 %rename("") gensios::Gensio::set_event_handler;
 %rename("") gensios::Gensio::alloc_channel;
@@ -30,6 +30,12 @@
  * If performance is important, it might be better to put glib on top
  * of gensio os funcs with g_main_context_set_poll_func().  I leave
  * that as an exercise to the reader.
+ *
+ * With many gensios, the per-fd and per-timer sources get expensive
+ * for glib to prepare and check every iteration.  The os funcs from
+ * gensio_glib_funcs_alloc_aggregate() instead put all fds in one
+ * epoll fd and all timers in one heap, both handled by a single
+ * GSource.
  */
 
 #include "config.h"
@@ -61,6 +67,9 @@
 #include <sys/wait.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_EPOLL_PWAIT
+#include <sys/epoll.h>
+#endif
 #endif
 
 struct gensio_data
@@ -77,8 +86,19 @@ struct gensio_data
     struct gensio_memtrack *mtrack;
 
     struct gensio_os_proc_data *pdata;
+
+    /* If non-NULL, fds and timers go in one aggregate source. */
+    struct glib_agg *agg;
 };
 
+static struct glib_agg *
+glib_get_agg(struct gensio_os_funcs *f)
+{
+    struct gensio_data *d = f->user_data;
+
+    return d->agg;
+}
+
 static void *
 gensio_glib_zalloc(struct gensio_os_funcs *f, gensiods size)
 {
@@ -180,12 +200,17 @@ struct gensio_iod_glib {
     struct gensio_unix_termios *termios;
 #endif
 
-    /* For GENSIO_IOD_FILE */
+    /* For GENSIO_IOD_FILE, read/write_enabled are also used in agg mode. */
     struct gensio_runner *runner;
     bool read_enabled;
     bool write_enabled;
     bool in_handler;
 
+    /* For aggregate mode. */
+    bool except_enabled;
+    bool agg_hup; /* Got a HUP with no read or except handler. */
+    unsigned int agg_events; /* What is registered with epoll. */
+
     /* For GENSIO_IOD_PTY */
     const char **argv;
     const char **env;
@@ -195,6 +220,8 @@ struct gensio_iod_glib {
 
 #define i_to_glib(i) gensio_container_of(i, struct gensio_iod_glib, r);
 
+static void glib_agg_update_iod(struct gensio_iod_glib *iod);
+
 static gboolean
 glib_read_handler(GIOChannel *source,
 		  GIOCondition condition,
@@ -323,6 +350,13 @@ gensio_glib_clear_fd_handlers(struct gensio_iod *iiod)
 	iod->r.f->run(iod->runner);
 	goto out_unlock;
     }
+    if (glib_get_agg(iod->r.f)) {
+	/* clear_count stays 1 in agg mode, so this reports via idle. */
+	iod->read_enabled = false;
+	iod->write_enabled = false;
+	iod->except_enabled = false;
+	glib_agg_update_iod(iod);
+    }
     if (iod->read_id) {
 	g_source_remove(iod->read_id);
 	iod->read_id = 0;
@@ -355,6 +389,12 @@ gensio_glib_clear_fd_handlers_norpt(struct gensio_iod *iiod)
     g_mutex_lock(&iod->lock);
     assert(!iod->read_id && !iod->write_id && !iod->except_id &&
 	   !iod->idle_id && iod->clear_count <= 1);
+    if (glib_get_agg(iod->r.f) && iod->type != GENSIO_IOD_FILE) {
+	iod->read_enabled = false;
+	iod->write_enabled = false;
+	iod->except_enabled = false;
+	glib_agg_update_iod(iod);
+    }
     iod->clear_count = 0;
     iod->handlers_set = false;
     g_mutex_unlock(&iod->lock);
@@ -404,6 +444,9 @@ gensio_glib_set_read_handler(struct gensio_iod *iiod, bool enable)
 	    f->run(iod->runner);
 	    iod->in_handler = true;
 	}
+    } else if (glib_get_agg(f)) {
+	iod->read_enabled = enable;
+	glib_agg_update_iod(iod);
     } else if (iod->read_id && !enable) {
 	g_source_remove(iod->read_id);
 	iod->read_id = 0;
@@ -433,6 +476,9 @@ gensio_glib_set_write_handler(struct gensio_iod *iiod, bool enable)
 	    f->run(iod->runner);
 	    iod->in_handler = true;
 	}
+    } else if (glib_get_agg(f)) {
+	iod->write_enabled = enable;
+	glib_agg_update_iod(iod);
     } else if (iod->write_id && !enable) {
 	g_source_remove(iod->write_id);
 	iod->write_id = 0;
@@ -456,7 +502,10 @@ gensio_glib_set_except_handler(struct gensio_iod *iiod, bool enable)
 	return;
 
     g_mutex_lock(&iod->lock);
-    if (iod->except_id && !enable) {
+    if (glib_get_agg(iod->r.f)) {
+	iod->except_enabled = enable;
+	glib_agg_update_iod(iod);
+    } else if (iod->except_id && !enable) {
 	g_source_remove(iod->except_id);
 	iod->except_id = 0;
     } else if (!iod->except_id && enable) {
@@ -491,8 +540,403 @@ struct gensio_timer
 
     void (*done_handler)(struct gensio_timer *t, void *cb_data);
     void *done_cb_data;
+
+    /*
+     * For aggregate mode, where the state is protected by the agg
+     * lock instead of the timer lock.
+     */
+    gint64 expire;
+    unsigned int heap_idx;
+    bool in_heap;
+};
+
+/*
+ * Aggregate source handling.  All fds are in one epoll fd and all
+ * timers in one heap, and a single GSource waits on the epoll fd with
+ * its ready time set to the first timer.
+ */
+#ifdef HAVE_EPOLL_PWAIT
+#define GLIB_AGG_BATCH 64
+#endif
+
+struct glib_agg {
+    struct gensio_os_funcs *o;
+    GSource *source;
+    gpointer fd_tag;
+    int epfd;
+
+    GMutex lock; /* Protects the heap and timer state. */
+    struct gensio_timer **heap;
+    unsigned int heap_len;
+    unsigned int heap_size;
+};
+
+struct glib_agg_source {
+    GSource source;
+    struct glib_agg *agg;
+};
+
+static void
+glib_heap_set(struct glib_agg *agg, unsigned int i, struct gensio_timer *t)
+{
+    agg->heap[i] = t;
+    t->heap_idx = i;
+}
+
+static void
+glib_heap_up(struct glib_agg *agg, unsigned int i)
+{
+    struct gensio_timer *t = agg->heap[i];
+
+    while (i > 0 && agg->heap[(i - 1) / 2]->expire > t->expire) {
+	glib_heap_set(agg, i, agg->heap[(i - 1) / 2]);
+	i = (i - 1) / 2;
+    }
+    glib_heap_set(agg, i, t);
+}
+
+static void
+glib_heap_down(struct glib_agg *agg, unsigned int i)
+{
+    struct gensio_timer *t = agg->heap[i];
+    unsigned int c;
+
+    for (;;) {
+	c = i * 2 + 1;
+	if (c >= agg->heap_len)
+	    break;
+	if (c + 1 < agg->heap_len &&
+		agg->heap[c + 1]->expire < agg->heap[c]->expire)
+	    c++;
+	if (agg->heap[c]->expire >= t->expire)
+	    break;
+	glib_heap_set(agg, i, agg->heap[c]);
+	i = c;
+    }
+    glib_heap_set(agg, i, t);
+}
+
+static void
+glib_agg_update_ready(struct glib_agg *agg)
+{
+    if (agg->heap_len)
+	g_source_set_ready_time(agg->source, agg->heap[0]->expire);
+    else
+	g_source_set_ready_time(agg->source, -1);
+}
+
+static int
+glib_heap_add(struct glib_agg *agg, struct gensio_timer *t)
+{
+    if (agg->heap_len == agg->heap_size) {
+	unsigned int nsize = agg->heap_size ? agg->heap_size * 2 : 16;
+	struct gensio_timer **nheap;
+
+	nheap = g_try_realloc(agg->heap, nsize * sizeof(*nheap));
+	if (!nheap)
+	    return GE_NOMEM;
+	agg->heap = nheap;
+	agg->heap_size = nsize;
+    }
+    glib_heap_set(agg, agg->heap_len++, t);
+    t->in_heap = true;
+    glib_heap_up(agg, t->heap_idx);
+    glib_agg_update_ready(agg);
+    return 0;
+}
+
+static void
+glib_heap_remove(struct glib_agg *agg, struct gensio_timer *t)
+{
+    unsigned int i = t->heap_idx;
+
+    if (!t->in_heap)
+	return;
+    t->in_heap = false;
+    agg->heap_len--;
+    if (i != agg->heap_len) {
+	glib_heap_set(agg, i, agg->heap[agg->heap_len]);
+	if (i > 0 && agg->heap[(i - 1) / 2]->expire > agg->heap[i]->expire)
+	    glib_heap_up(agg, i);
+	else
+	    glib_heap_down(agg, i);
+    }
+    glib_agg_update_ready(agg);
+}
+
+static int
+glib_agg_start_timer(struct glib_agg *agg, struct gensio_timer *t,
+		     gint64 expire)
+{
+    int rv = 0;
+
+    g_mutex_lock(&agg->lock);
+    assert(t->state != GLIB_TIMER_FREE);
+    if (t->state != GLIB_TIMER_STOPPED) {
+	rv = GE_INUSE;
+    } else {
+	t->done_handler = NULL;
+	t->expire = expire;
+	rv = glib_heap_add(agg, t);
+	if (!rv)
+	    t->state = GLIB_TIMER_RUNNING;
+    }
+    g_mutex_unlock(&agg->lock);
+    return rv;
+}
+
+static gboolean
+glib_agg_timer_done(gpointer data)
+{
+    struct gensio_timer *t = data;
+    struct glib_agg *agg = glib_get_agg(t->o);
+    void (*handler)(struct gensio_timer *t, void *cb_data);
+    void *cb_data;
+    unsigned int usecount;
+
+    gensio_glib_did_something(t->o);
+    g_mutex_lock(&agg->lock);
+    handler = t->done_handler;
+    cb_data = t->done_cb_data;
+    t->done_handler = NULL;
+    if (t->state == GLIB_TIMER_IN_STOP)
+	t->state = GLIB_TIMER_STOPPED;
+    usecount = --t->usecount;
+    g_mutex_unlock(&agg->lock);
+
+    if (handler)
+	handler(t, cb_data);
+
+    if (usecount == 0) {
+	g_mutex_clear(&t->lock);
+	t->o->free(t->o, t);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static int
+glib_agg_stop_timer(struct glib_agg *agg, struct gensio_timer *t,
+		    void (*done_handler)(struct gensio_timer *t,
+					 void *cb_data),
+		    void *cb_data)
+{
+    int rv = 0;
+
+    g_mutex_lock(&agg->lock);
+    assert(t->state != GLIB_TIMER_FREE);
+    if (done_handler && t->state == GLIB_TIMER_IN_STOP) {
+	rv = GE_INUSE;
+    } else if (t->state != GLIB_TIMER_RUNNING) {
+	rv = GE_TIMEDOUT;
+    } else {
+	glib_heap_remove(agg, t);
+	if (done_handler) {
+	    /* Report from base context, like the non-agg version. */
+	    t->state = GLIB_TIMER_IN_STOP;
+	    t->done_handler = done_handler;
+	    t->done_cb_data = cb_data;
+	    t->usecount++;
+	    g_idle_add(glib_agg_timer_done, t);
+	} else {
+	    t->state = GLIB_TIMER_STOPPED;
+	}
+    }
+    g_mutex_unlock(&agg->lock);
+    return rv;
+}
+
+static void
+glib_agg_free_timer(struct glib_agg *agg, struct gensio_timer *t)
+{
+    unsigned int usecount;
+
+    g_mutex_lock(&agg->lock);
+    assert(t->state != GLIB_TIMER_FREE);
+    glib_heap_remove(agg, t);
+    t->state = GLIB_TIMER_FREE;
+    usecount = --t->usecount;
+    g_mutex_unlock(&agg->lock);
+
+    if (usecount == 0) {
+	g_mutex_clear(&t->lock);
+	t->o->free(t->o, t);
+    }
+}
+
+static void
+glib_agg_run_timers(struct glib_agg *agg)
+{
+    gint64 now = g_get_monotonic_time();
+    void (*handler)(struct gensio_timer *t, void *cb_data);
+    struct gensio_timer *t;
+    void *cb_data;
+
+    g_mutex_lock(&agg->lock);
+    while (agg->heap_len && agg->heap[0]->expire <= now) {
+	t = agg->heap[0];
+	glib_heap_remove(agg, t);
+	t->state = GLIB_TIMER_STOPPED;
+	handler = t->handler;
+	cb_data = t->cb_data;
+	g_mutex_unlock(&agg->lock);
+	gensio_glib_did_something(agg->o);
+	handler(t, cb_data);
+	g_mutex_lock(&agg->lock);
+    }
+    glib_agg_update_ready(agg);
+    g_mutex_unlock(&agg->lock);
+}
+
+#ifdef HAVE_EPOLL_PWAIT
+/* Must be called with the iod lock held. */
+static void
+glib_agg_update_iod(struct gensio_iod_glib *iod)
+{
+    struct glib_agg *agg = glib_get_agg(iod->r.f);
+    struct epoll_event ev;
+    unsigned int events = 0;
+    int op;
+
+    if (iod->read_enabled || iod->except_enabled)
+	iod->agg_hup = false;
+    if (iod->read_enabled)
+	events |= EPOLLIN;
+    if (iod->write_enabled && !iod->agg_hup)
+	events |= EPOLLOUT;
+    if (iod->except_enabled)
+	events |= EPOLLPRI;
+    if (events == iod->agg_events)
+	return;
+
+    if (!events)
+	op = EPOLL_CTL_DEL;
+    else if (!iod->agg_events)
+	op = EPOLL_CTL_ADD;
+    else
+	op = EPOLL_CTL_MOD;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = iod;
+    if (epoll_ctl(agg->epfd, op, iod->fd, &ev) == 0)
+	iod->agg_events = events;
+}
+
+static void
+glib_agg_handle_fd(struct gensio_iod_glib *iod, unsigned int events)
+{
+    bool rd, wr, ex;
+
+    g_mutex_lock(&iod->lock);
+    if (!iod->handlers_set || iod->in_clear) {
+	g_mutex_unlock(&iod->lock);
+	return;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+	/* Let the read handler see the error. */
+	events |= EPOLLIN;
+	if (!iod->read_enabled && !iod->except_enabled) {
+	    /* epoll always reports these, don't spin on them. */
+	    iod->agg_hup = true;
+	    glib_agg_update_iod(iod);
+	}
+    }
+    rd = iod->read_enabled && (events & EPOLLIN);
+    wr = iod->write_enabled && (events & EPOLLOUT);
+    ex = iod->except_enabled && (events & (EPOLLPRI | EPOLLERR | EPOLLHUP));
+    g_mutex_unlock(&iod->lock);
+
+    gensio_glib_did_something(iod->r.f);
+    if (rd)
+	iod->read_handler(&iod->r, iod->cb_data);
+    if (wr && !iod->in_clear)
+	iod->write_handler(&iod->r, iod->cb_data);
+    if (ex && !iod->in_clear)
+	iod->except_handler(&iod->r, iod->cb_data);
+}
+
+static gboolean
+glib_agg_check(GSource *source)
+{
+    struct glib_agg *agg = ((struct glib_agg_source *) source)->agg;
+
+    /* The ready time for timers is checked by glib itself. */
+    return g_source_query_unix_fd(source, agg->fd_tag) != 0;
+}
+
+static gboolean
+glib_agg_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    struct glib_agg *agg = ((struct glib_agg_source *) source)->agg;
+    struct epoll_event events[GLIB_AGG_BATCH];
+    int i, n;
+
+    n = epoll_wait(agg->epfd, events, GLIB_AGG_BATCH, 0);
+    for (i = 0; i < n; i++)
+	glib_agg_handle_fd(events[i].data.ptr, events[i].events);
+
+    glib_agg_run_timers(agg);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs glib_agg_funcs = {
+    .check = glib_agg_check,
+    .dispatch = glib_agg_dispatch,
 };
 
+static int
+glib_agg_alloc(struct gensio_os_funcs *o)
+{
+    struct gensio_data *d = o->user_data;
+    struct glib_agg *agg;
+    GSource *source;
+
+    agg = calloc(1, sizeof(*agg));
+    if (!agg)
+	return GE_NOMEM;
+    agg->o = o;
+    agg->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (agg->epfd == -1) {
+	int err = gensio_os_err_to_err(o, errno);
+
+	free(agg);
+	return err;
+    }
+    g_mutex_init(&agg->lock);
+
+    source = g_source_new(&glib_agg_funcs, sizeof(struct glib_agg_source));
+    ((struct glib_agg_source *) source)->agg = agg;
+    agg->fd_tag = g_source_add_unix_fd(source, agg->epfd, G_IO_IN);
+    agg->source = source;
+    g_source_attach(source, NULL);
+
+    d->agg = agg;
+    return 0;
+}
+
+static void
+glib_agg_free(struct glib_agg *agg)
+{
+    g_source_destroy(agg->source);
+    g_source_unref(agg->source);
+    close(agg->epfd);
+    g_free(agg->heap);
+    g_mutex_clear(&agg->lock);
+    free(agg);
+}
+#else
+static void
+glib_agg_update_iod(struct gensio_iod_glib *iod)
+{
+}
+
+static void
+glib_agg_free(struct glib_agg *agg)
+{
+}
+#endif
+
 static gboolean
 gensio_glib_timeout_handler(gpointer data)
 {
@@ -583,8 +1027,14 @@ gensio_glib_alloc_timer(struct gensio_os_funcs *o,
 static void
 gensio_glib_free_timer(struct gensio_timer *t)
 {
+    struct glib_agg *agg = glib_get_agg(t->o);
     unsigned int usecount;
 
+    if (agg) {
+	glib_agg_free_timer(agg, t);
+	return;
+    }
+
     g_mutex_lock(&t->lock);
     assert(t->state != GLIB_TIMER_FREE);
     if (t->timer_id) {
@@ -633,12 +1083,23 @@ us_time_to_gensio(gint64 t, gensio_time *gt)
     gt->nsecs = t % 1000000 * 1000;
 }
 
+static gint64
+gensio_time_to_us64(gensio_time *t)
+{
+    return (gint64) t->secs * 1000000 + (t->nsecs + 999) / 1000;
+}
+
 static int
 gensio_glib_start_timer(struct gensio_timer *t, gensio_time *timeout)
 {
+    struct glib_agg *agg = glib_get_agg(t->o);
     guint msec = gensio_time_to_ms(timeout);
     int rv = 0;
 
+    if (agg)
+	return glib_agg_start_timer(agg, t, g_get_monotonic_time() +
+				    gensio_time_to_us64(timeout));
+
     g_mutex_lock(&t->lock);
     assert(t->state != GLIB_TIMER_FREE);
     if (t->state != GLIB_TIMER_STOPPED) {
@@ -661,9 +1122,13 @@ gensio_glib_start_timer(struct gensio_timer *t, gensio_time *timeout)
 static int
 gensio_glib_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
 {
+    struct glib_agg *agg = glib_get_agg(t->o);
     gint64 now, msec;
     int rv = 0;
 
+    if (agg)
+	return glib_agg_start_timer(agg, t, gensio_time_to_us64(timeout));
+
     g_mutex_lock(&t->lock);
     assert(t->state != GLIB_TIMER_FREE);
     if (t->state != GLIB_TIMER_STOPPED) {
@@ -692,8 +1157,12 @@ gensio_glib_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
 static int
 gensio_glib_stop_timer(struct gensio_timer *t)
 {
+    struct glib_agg *agg = glib_get_agg(t->o);
     int rv = 0;
 
+    if (agg)
+	return glib_agg_stop_timer(agg, t, NULL, NULL);
+
     g_mutex_lock(&t->lock);
     assert(t->state != GLIB_TIMER_FREE);
     if (t->state != GLIB_TIMER_RUNNING) {
@@ -713,8 +1182,12 @@ gensio_glib_stop_timer_with_done(struct gensio_timer *t,
 						      void *cb_data),
 				 void *cb_data)
 {
+    struct glib_agg *agg = glib_get_agg(t->o);
     int rv = 0;
 
+    if (agg)
+	return glib_agg_stop_timer(agg, t, done_handler, cb_data);
+
     g_mutex_lock(&t->lock);
     if (t->state == GLIB_TIMER_IN_STOP) {
 	rv = GE_INUSE;
@@ -1918,6 +2391,8 @@ gensio_glib_free_funcs(struct gensio_os_funcs *f)
     }
     g_mutex_unlock(&d->lock);
 
+    if (d->agg)
+	glib_agg_free(d->agg);
     gensio_stdsock_cleanup(f);
     gensio_memtrack_cleanup(d->mtrack);
     g_cond_clear(&d->cond);
@@ -2089,3 +2564,25 @@ gensio_glib_funcs_alloc(struct gensio_os_funcs **ro)
     *ro = o;
     return 0;
 }
+
+int
+gensio_glib_funcs_alloc_aggregate(struct gensio_os_funcs **ro)
+{
+#ifdef HAVE_EPOLL_PWAIT
+    struct gensio_os_funcs *o;
+    int err;
+
+    err = gensio_glib_funcs_alloc(&o);
+    if (err)
+	return err;
+    err = glib_agg_alloc(o);
+    if (err) {
+	o->free_funcs(o);
+	return err;
+    }
+    *ro = o;
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
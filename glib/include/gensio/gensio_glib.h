@@ -21,6 +21,14 @@ extern "C" {
 GENSIOGLIB_DLL_PUBLIC
 int gensio_glib_funcs_alloc(struct gensio_os_funcs **o);
 
+/*
+ * Like the above, but all fds go in one epoll fd and all timers in
+ * one heap, handled by a single GSource.  Returns GE_NOTSUP if epoll
+ * is not available.
+ */
+GENSIOGLIB_DLL_PUBLIC
+int gensio_glib_funcs_alloc_aggregate(struct gensio_os_funcs **o);
+
 #ifdef __cplusplus
 }
 #endif
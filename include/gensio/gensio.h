@@ -59,6 +59,7 @@ extern "C" {
 #define GENSIO_EVENT_REQUEST_PASSWORD	9
 #define GENSIO_EVENT_REQUEST_2FA	10
 #define GENSIO_EVENT_2FA_VERIFY		11
+#define GENSIO_EVENT_READ_BATCH		12
 
 /*
  * Serial callbacks start here and run to 2000.
@@ -100,6 +101,24 @@ int str_to_gensio_child(struct gensio *child, const char *str,
 			gensio_event cb, void *user_data,
 			struct gensio **gensio);
 
+/*
+ * A gensio string parsed once, to allocate the same stack over and
+ * over quickly.  See gensio_template_compile(3).
+ */
+struct gensio_template;
+
+GENSIO_DLL_PUBLIC
+int gensio_template_compile(const char *str, struct gensio_os_funcs *o,
+			    struct gensio_template **tmpl);
+
+GENSIO_DLL_PUBLIC
+int gensio_template_alloc(struct gensio_template *tmpl, const char *terminal,
+			  gensio_event cb, void *user_data,
+			  struct gensio **gensio);
+
+GENSIO_DLL_PUBLIC
+void gensio_template_free(struct gensio_template *tmpl);
+
 GENSIO_DLL_PUBLIC
 void gensio_set_callback(struct gensio *io, gensio_event cb, void *user_data);
 
@@ -119,6 +138,15 @@ int gensio_write_sg(struct gensio *io, gensiods *count,
 		    const struct gensio_sg *sg, gensiods sglen,
 		    const char *const *auxdata);
 
+GENSIO_DLL_PUBLIC
+int gensio_read_into(struct gensio *io, const struct gensio_sg *sg,
+		     gensiods sglen, gensio_read_done done, void *read_data);
+
+GENSIO_DLL_PUBLIC
+int gensio_write_queued(struct gensio *io, const struct gensio_sg *sg,
+			gensiods sglen, gensio_write_queued_done done,
+			void *write_data);
+
 /* DEPRECATED - Do not use this function. */
 GENSIO_DLL_PUBLIC
 int gensio_raddr_to_str(struct gensio *io, gensiods *pos,
@@ -217,6 +245,33 @@ int gensio_write_s_intr(struct gensio *io, gensiods *count,
 			const void *data, gensiods datalen,
 			gensio_time *timeout);
 
+/*
+ * Copy everything read from one gensio to another until the "from"
+ * gensio reports end of file or an error happens.  Both gensios must
+ * be open.  The pump takes over the callbacks of both gensios while
+ * it runs, events other than read and write ready are passed on to
+ * the original callbacks, and read data from "to" is ignored.
+ *
+ * If "from" is a file gensio and "to" is a plain socket, the data is
+ * moved in the kernel with sendfile() where the OS supports it.  If
+ * "from" is a pipe (like stdio) splice() is used the same way.
+ *
+ * done is called once when the pump stops with the original
+ * callbacks already restored.  err is 0 on end of file.  It is ok to
+ * call gensio_pump_free() from done.  Calling gensio_pump_free()
+ * before that stops the pump without calling done.
+ */
+struct gensio_pump;
+typedef void (*gensio_pump_done)(struct gensio_pump *pump, int err,
+				 void *cb_data);
+GENSIO_DLL_PUBLIC
+int gensio_pump_alloc(struct gensio_os_funcs *o,
+		      struct gensio *from, struct gensio *to,
+		      gensio_pump_done done, void *cb_data,
+		      struct gensio_pump **pump);
+GENSIO_DLL_PUBLIC
+void gensio_pump_free(struct gensio_pump *pump);
+
 /*
  * Increment the gensio's refcount.  Internally there are situations
  * where one piece of code passes a gensio into another piece of code,
@@ -279,6 +334,12 @@ struct gensio_acc_postcert_verify_data {
 #define GENSIO_ACC_EVENT_REQUEST_2FA		9
 /* Uses struct gensio_acc_password_verify_data */
 
+#define GENSIO_ACC_EVENT_ADMIT			10
+struct gensio_acc_admit_data {
+    struct gensio *child;
+    int priority;
+};
+
 GENSIO_DLL_PUBLIC
 int str_to_gensio_accepter(const char *str, struct gensio_os_funcs *o,
 			   gensio_accepter_event cb, void *user_data,
@@ -83,7 +83,7 @@ typedef int (*gensio_gensio_acc_cb)(void *acc_data, int op,
 GENSIO_DLL_PUBLIC
 int gensio_gensio_accepter_alloc(struct gensio_accepter *child,
 				 struct gensio_os_funcs *o,
-				 const char *typename,
+				 const char *type_name,
 				 gensio_accepter_event cb, void *user_data,
 				 gensio_gensio_acc_cb acc_cb,
 				 void *acc_data,
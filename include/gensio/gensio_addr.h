@@ -39,6 +39,9 @@ struct gensio_addr_funcs {
 				 int family, int flags);
     void (*addr_getaddr)(const struct gensio_addr *addr,
 			 void *oaddr, gensiods *rlen);
+    /* May be NULL, see gensio_addr_hash(). */
+    unsigned int (*addr_hash)(const struct gensio_addr *addr,
+			      bool use_port);
 };
 
 /*
@@ -156,6 +159,16 @@ bool gensio_addr_equal(const struct gensio_addr *a1,
 		       const struct gensio_addr *a2,
 		       bool compare_ports, bool compare_all);
 
+/*
+ * Return a hash of the current address.  Addresses that are equal per
+ * gensio_addr_equal() with compare_all false (and compare_ports the
+ * same as use_port) return the same hash, so an IPv4-mapped IPv6
+ * address hashes the same as the IPv4 address.  Returns 0 if the
+ * address type does not support hashing.
+ */
+GENSIOOSH_DLL_PUBLIC
+unsigned int gensio_addr_hash(const struct gensio_addr *addr, bool use_port);
+
 /*
  * Create a new address structure with the same addresses.
  */
@@ -13,6 +13,38 @@
 
 struct gensio_filter;
 
+/*
+ * A reference counted buffer, for passing data between layers
+ * without copying it.  A layer that keeps part of a buffer after the
+ * call that passed it returns (to resend it or to finish a partial
+ * write, for instance) takes its own reference with gensio_buf_ref()
+ * and releases it with gensio_buf_deref().  The buffer is freed when
+ * the last reference is released.  Do not touch refcount directly.
+ */
+struct gensio_buf {
+    struct gensio_os_funcs *o;
+    unsigned int refcount;
+    gensiods size;
+    unsigned char *data;
+};
+
+/* A piece of a buffer, data is buf->data + offset. */
+struct gensio_bufseg {
+    struct gensio_buf *buf;
+    gensiods offset;
+    gensiods len;
+};
+
+/* Allocate a buffer with one reference.  Returns NULL on failure. */
+GENSIO_DLL_PUBLIC
+struct gensio_buf *gensio_buf_alloc(struct gensio_os_funcs *o, gensiods size);
+
+GENSIO_DLL_PUBLIC
+void gensio_buf_ref(struct gensio_buf *buf);
+
+GENSIO_DLL_PUBLIC
+void gensio_buf_deref(struct gensio_buf *buf);
+
 typedef int (*gensio_ul_filter_data_handler)(void *cb_data,
 					     gensiods *rcount,
 					     const struct gensio_sg *sg,
@@ -66,6 +98,16 @@ struct gensio_filter_cb_control_data {
  */
 #define GENSIO_FILTER_CB_INPUT_READY	6
 
+/*
+ * Keep the gensio from being freed until a matching
+ * GENSIO_FILTER_CB_DEREF, so work the filter started asynchronously
+ * can safely report back with the other callbacks.  REF must be
+ * called from a filter function the base called, DEREF must be
+ * called without any of the base's or filter's locks held.
+ */
+#define GENSIO_FILTER_CB_REF		7
+#define GENSIO_FILTER_CB_DEREF		8
+
 typedef int (*gensio_filter_cb)(void *cb_data, int func, void *data);
 
 
@@ -262,6 +304,51 @@ bool gensio_filter_ll_write_queued(struct gensio_filter *filter);
 GENSIO_DLL_PUBLIC
 void gensio_filter_io_err(struct gensio_filter *filter, int err);
 
+/*
+ * Like GENSIO_FILTER_FUNC_UL_WRITE_SG, but the data is in reference
+ * counted buffers, so the filter can keep references to data it
+ * holds on to instead of copying it.  The caller keeps its own
+ * references.  This is optional, if the filter returns GE_NOTSUP
+ * gensio_filter_ul_write_chain() does a GENSIO_FILTER_FUNC_UL_WRITE_SG
+ * with the same data (possibly only part of it).
+ *
+ * handler => func
+ * cb_data => data
+ * rcount => count
+ * segs => cbuf
+ * nsegs => buflen
+ */
+#define GENSIO_FILTER_FUNC_UL_WRITE_CHAIN	19
+GENSIO_DLL_PUBLIC
+int gensio_filter_ul_write_chain(struct gensio_filter *filter,
+				 gensio_ul_filter_data_handler handler,
+				 void *cb_data, gensiods *rcount,
+				 const struct gensio_bufseg *segs,
+				 gensiods nsegs,
+				 const char *const *auxdata);
+
+/*
+ * Like GENSIO_FILTER_FUNC_LL_WRITE with reference counted buffers,
+ * see GENSIO_FILTER_FUNC_UL_WRITE_CHAIN.  If the filter returns
+ * GE_NOTSUP, gensio_filter_ll_write_chain() does a
+ * GENSIO_FILTER_FUNC_LL_WRITE for each segment until one is not
+ * completely taken.
+ *
+ * handler => func
+ * cb_data => data
+ * rcount => count
+ * segs => cbuf
+ * nsegs => buflen
+ */
+#define GENSIO_FILTER_FUNC_LL_WRITE_CHAIN	20
+GENSIO_DLL_PUBLIC
+int gensio_filter_ll_write_chain(struct gensio_filter *filter,
+				 gensio_ll_filter_data_handler handler,
+				 void *cb_data, gensiods *rcount,
+				 const struct gensio_bufseg *segs,
+				 gensiods nsegs,
+				 const char *const *auxdata);
+
 typedef int (*gensio_filter_func)(struct gensio_filter *filter, int op,
 				  void *func, void *data,
 				  gensiods *count, void *buf,
@@ -284,6 +371,41 @@ void gensio_filter_free_data(struct gensio_filter *filter);
 GENSIO_DLL_PUBLIC
 void *gensio_filter_get_user_data(struct gensio_filter *filter);
 
+/*
+ * Optional direct entry points for the ops called on every read and
+ * write, so they don't have to go through the filter func and its
+ * argument marshaling.  Each one does the same thing as the
+ * GENSIO_FILTER_FUNC_xxx op of the same name, and any that are NULL
+ * still go through the filter func.  ul_can_write and ll_write_queued
+ * may return GE_NOTSUP like their ops.  The table is not copied, it
+ * must stay around as long as the filter, it's normally static const.
+ */
+struct gensio_filter_ops {
+    bool (*ul_read_pending)(struct gensio_filter *filter);
+    bool (*ll_write_pending)(struct gensio_filter *filter);
+    bool (*ll_read_needed)(struct gensio_filter *filter);
+    int (*ul_can_write)(struct gensio_filter *filter, bool *val);
+    int (*ll_write_queued)(struct gensio_filter *filter, bool *val);
+    int (*ul_write)(struct gensio_filter *filter,
+		    gensio_ul_filter_data_handler handler, void *cb_data,
+		    gensiods *rcount,
+		    const struct gensio_sg *sg, gensiods sglen,
+		    const char *const *auxdata);
+    int (*ll_write)(struct gensio_filter *filter,
+		    gensio_ll_filter_data_handler handler, void *cb_data,
+		    gensiods *rcount,
+		    unsigned char *buf, gensiods buflen,
+		    const char *const *auxdata);
+};
+
+/*
+ * Set the direct ops for the filter, call right after
+ * gensio_filter_alloc_data().
+ */
+GENSIO_DLL_PUBLIC
+void gensio_filter_set_ops(struct gensio_filter *filter,
+			   const struct gensio_filter_ops *ops);
+
 struct gensio_ll;
 
 typedef void (*gensio_ll_open_done)(void *cb_data, int err, void *open_data);
@@ -292,6 +414,12 @@ typedef void (*gensio_ll_close_done)(void *cb_data, void *close_data);
 #define GENSIO_LL_CB_READ		1
 #define GENSIO_LL_CB_WRITE_READY	2
 
+/*
+ * A read posted with GENSIO_LL_FUNC_READ_INTO finished.  The error
+ * is in val and the number of bytes read in buflen.
+ */
+#define GENSIO_LL_CB_READ_INTO_DONE	3
+
 typedef gensiods (*gensio_ll_cb)(void *cb_data, int op, int val,
 				 void *buf, gensiods buflen,
 				 const char *const *auxdata);
@@ -392,6 +520,39 @@ int gensio_ll_control(struct gensio_ll *ll, bool get, int option, char *data,
 GENSIO_DLL_PUBLIC
 void gensio_ll_disable(struct gensio_ll *ll);
 
+/*
+ * Like GENSIO_LL_FUNC_WRITE_SG with reference counted buffers, see
+ * GENSIO_FILTER_FUNC_UL_WRITE_CHAIN.  If the ll returns GE_NOTSUP,
+ * gensio_ll_write_chain() does a GENSIO_LL_FUNC_WRITE_SG.
+ *
+ * rcount => count
+ * segs => cbuf
+ * nsegs => buflen
+ */
+#define GENSIO_LL_FUNC_WRITE_CHAIN		13
+GENSIO_DLL_PUBLIC
+int gensio_ll_write_chain(struct gensio_ll *ll, gensiods *rcount,
+			  const struct gensio_bufseg *segs, gensiods nsegs,
+			  const char *const *auxdata);
+
+/*
+ * Post a read directly into the given buffers, the sg array is
+ * copied, the buffers must stay around until it completes.  If this
+ * returns 0 the ll will report completion exactly once with
+ * GENSIO_LL_CB_READ_INTO_DONE, with GE_LOCALCLOSED if the ll is
+ * closed first.  Data goes there even if read is disabled.  If the
+ * ll can't do this now (it has buffered data, for instance) it
+ * returns GE_NOTSUP and the caller should use normal reads.
+ *
+ * sg => cbuf
+ * sglen => buflen
+ */
+#define GENSIO_LL_FUNC_READ_INTO		14
+#define GENSIO_LL_READ_INTO_MAX_SG		16
+GENSIO_DLL_PUBLIC
+int gensio_ll_read_into(struct gensio_ll *ll,
+			const struct gensio_sg *sg, gensiods sglen);
+
 typedef int (*gensio_ll_func)(struct gensio_ll *ll, int op,
 			      gensiods *count,
 			      void *buf, const void *cbuf,
@@ -419,6 +580,32 @@ GENSIO_DLL_PUBLIC
 void gensio_ll_free_data(struct gensio_ll *ll);
 GENSIO_DLL_PUBLIC
 void *gensio_ll_get_user_data(struct gensio_ll *ll);
+
+/*
+ * Optional direct entry points for the ll, like struct
+ * gensio_filter_ops.  Each does the same as the GENSIO_LL_FUNC_xxx op
+ * of the same name, NULL ones go through the ll func.
+ */
+struct gensio_ll_ops {
+    int (*write)(struct gensio_ll *ll, gensiods *rcount,
+		 const struct gensio_sg *sg, gensiods sglen,
+		 const char *const *auxdata);
+    void (*set_read_callback)(struct gensio_ll *ll, bool enabled);
+    void (*set_write_callback)(struct gensio_ll *ll, bool enabled);
+};
+
+/*
+ * Set the direct ops for the ll, call right after
+ * gensio_ll_alloc_data().
+ */
+GENSIO_DLL_PUBLIC
+void gensio_ll_set_ops(struct gensio_ll *ll, const struct gensio_ll_ops *ops);
+/*
+ * The stats of the gensio the ll is in, for counting system calls.
+ * NULL if the ll is not in a gensio yet.
+ */
+GENSIO_DLL_PUBLIC
+struct gensio_stats *gensio_ll_get_stats(struct gensio_ll *ll);
 GENSIO_DLL_PUBLIC
 struct gensio_ll *base_gensio_get_ll(struct gensio *io);
 
@@ -427,15 +614,23 @@ struct gensio *base_gensio_alloc(struct gensio_os_funcs *o,
 				 struct gensio_ll *ll,
 				 struct gensio_filter *filter,
 				 struct gensio *child,
-				 const char *typename,
+				 const char *type_name,
 				 gensio_event cb, void *user_data);
 
+/*
+ * Never merge this gensio's filter into a parent's, see the "fuse"
+ * default.  For gensios that keep their gensio pointer or add a
+ * class to it.  Call right after base_gensio_alloc().
+ */
+GENSIO_DLL_PUBLIC
+void base_gensio_set_no_fuse(struct gensio *io);
+
 GENSIO_DLL_PUBLIC
 struct gensio *base_gensio_server_alloc(struct gensio_os_funcs *o,
 					struct gensio_ll *ll,
 					struct gensio_filter *filter,
 					struct gensio *child,
-					const char *typename,
+					const char *type_name,
 					gensio_done_err open_done,
 					void *open_data);
 
@@ -552,7 +747,7 @@ int base_gensio_accepter_alloc(struct gensio_accepter *child,
 			       gensio_base_acc_op ops,
 			       void *acc_op_data,
 			       struct gensio_os_funcs *o,
-			       const char *typename,
+			       const char *type_name,
 			       gensio_accepter_event cb, void *user_data,
 			       struct gensio_accepter **accepter);
 
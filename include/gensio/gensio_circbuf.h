@@ -17,6 +17,12 @@
 
 struct gensio_circbuf;
 
+/* Keep the SPSC indexes at least this far apart. */
+#define GENSIO_CIRCBUF_CACHELINE	64
+
+typedef void (*gensio_circbuf_notify)(struct gensio_circbuf *c,
+				      void *notify_data);
+
 /*
  * Return the number of free bytes left in the buffer.
  */
@@ -99,6 +105,40 @@ GENSIOOSH_DLL_PUBLIC
 struct gensio_circbuf *gensio_circbuf_alloc(struct gensio_os_funcs *o,
 					    gensiods size);
 
+/*
+ * Allocate a circbuf whose memory is mapped twice back to back where
+ * the platform supports it (memfd_create() and mmap()).  Then the
+ * read and write areas returned above are never split at the wrap,
+ * they always cover all the data or all the room.  The size is
+ * rounded up to a page.  Otherwise this is the same as
+ * gensio_circbuf_alloc().
+ */
+GENSIOOSH_DLL_PUBLIC
+struct gensio_circbuf *gensio_circbuf_alloc_mirrored(
+				struct gensio_os_funcs *o, gensiods size);
+
+/*
+ * Put an empty circbuf into single-producer/single-consumer mode.
+ * Then one thread may add data (gensio_circbuf_room_left(),
+ * gensio_circbuf_next_write_area(), gensio_circbuf_data_added(),
+ * gensio_circbuf_sg_write()) while another takes it out
+ * (gensio_circbuf_datalen(), gensio_circbuf_next_read_area(),
+ * gensio_circbuf_data_removed(), gensio_circbuf_read()) with no
+ * lock.  gensio_circbuf_reset() must not race with either.
+ *
+ * If notify is not NULL it is called from the producer when it adds
+ * data to a buffer the consumer had emptied, so a consumer can sleep
+ * (on a waiter or an eventfd, for instance) when it finds the buffer
+ * empty.  The consumer must check gensio_circbuf_datalen() again
+ * after arming its wakeup.
+ *
+ * Returns GE_NOTSUP if the platform has no atomics, GE_INUSE if the
+ * buffer is not empty.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_circbuf_set_spsc(struct gensio_circbuf *c,
+			    gensio_circbuf_notify notify, void *notify_data);
+
 /* Free an allocated circbuf. */
 GENSIOOSH_DLL_PUBLIC
 void gensio_circbuf_free(struct gensio_circbuf *c);
@@ -100,6 +100,23 @@ struct gensio_func_alloc_channel_data {
  */
 #define GENSIO_FUNC_OPEN_NOCHILD	14
 
+/*
+ * Following struct in cbuf, see gensio_read_into().
+ */
+struct gensio_func_read_into_data {
+    const struct gensio_sg *sg;
+    gensiods sglen;
+    gensio_read_done done;
+    void *read_data;
+};
+#define GENSIO_FUNC_READ_INTO		15
+
+/*
+ * Used by the base gensio to merge a fusable child into its parent.
+ * Other gensios should return GE_NOTSUP.
+ */
+#define GENSIO_FUNC_FUSE		16
+
 typedef int (*gensio_func)(struct gensio *io, int func, gensiods *count,
 			   const void *cbuf, gensiods buflen, void *buf,
 			   const char *const *auxdata);
@@ -108,7 +125,7 @@ GENSIO_DLL_PUBLIC
 struct gensio *gensio_data_alloc(struct gensio_os_funcs *o,
 				 gensio_event cb, void *user_data,
 				 gensio_func func, struct gensio *child,
-				 const char *typename, void *gensio_data);
+				 const char *type_name, void *gensio_data);
 GENSIO_DLL_PUBLIC
 void gensio_data_free(struct gensio *io);
 GENSIO_DLL_PUBLIC
@@ -133,6 +150,17 @@ GENSIO_DLL_PUBLIC
 void gensio_set_is_message(struct gensio *io, bool is_message);
 GENSIO_DLL_PUBLIC
 void gensio_set_attr_from_child(struct gensio *io, struct gensio *child);
+
+/*
+ * A fusable gensio is held only by whoever created it, so a filter
+ * gensio stacked on top of it may take it apart and merge it into
+ * itself, see the "fuse" default.  str_to_gensio() sets this on
+ * gensios it makes without a callback when "fuse" is on.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_set_fusable(struct gensio *io, bool fusable);
+GENSIO_DLL_PUBLIC
+bool gensio_is_fusable(struct gensio *io);
 GENSIO_DLL_PUBLIC
 gensio_event gensio_get_cb(struct gensio *io);
 GENSIO_DLL_PUBLIC
@@ -155,6 +183,31 @@ int gensio_addclass(struct gensio *io, const char *name, int classops_ver,
 GENSIO_DLL_PUBLIC
 void *gensio_getclass(struct gensio *io, const char *name);
 
+/*
+ * Counters every gensio has, see GENSIO_CONTROL_STATS.  The gensio
+ * implementation updates these with gensio_stats_add(), they may be
+ * read from other threads at any time.  The tx and rx counters are
+ * for data going to and coming from the layer below, the sys
+ * counters are for the system calls done by an fd based gensio.
+ */
+struct gensio_stats {
+    uint64_t rx_bytes;
+    uint64_t rx_events;
+    uint64_t tx_bytes;
+    uint64_t tx_calls;
+    uint64_t tx_partial;
+    uint64_t tx_blocked;
+    uint64_t tx_blocked_nsecs;
+    uint64_t sys_reads;
+    uint64_t sys_reads_empty;
+    uint64_t sys_writes;
+    uint64_t sys_writes_empty;
+};
+#define gensio_stats_add(s, field, v) \
+    __atomic_add_fetch(&(s)->field, (v), __ATOMIC_RELAXED)
+GENSIO_DLL_PUBLIC
+struct gensio_stats *gensio_get_stats(struct gensio *io);
+
 /*
  * Functions for gensio_acc_func...
  */
@@ -209,7 +262,7 @@ GENSIO_DLL_PUBLIC
 struct gensio_accepter *gensio_acc_data_alloc(struct gensio_os_funcs *o,
 		      gensio_accepter_event cb, void *user_data,
 		      gensio_acc_func func, struct gensio_accepter *child,
-		      const char *typename, void *gensio_acc_data);
+		      const char *type_name, void *gensio_acc_data);
 GENSIO_DLL_PUBLIC
 void gensio_acc_data_free(struct gensio_accepter *acc);
 GENSIO_DLL_PUBLIC
@@ -51,6 +51,34 @@
 #define GENSIO_CONTROL_IN_FORMAT		42u
 #define GENSIO_CONTROL_OUT_FORMAT		43u
 #define GENSIO_CONTROL_DRAIN_COUNT		44u
+#define GENSIO_CONTROL_FD			45u
+#define GENSIO_CONTROL_TCP_INFO			46u
+#define GENSIO_CONTROL_SESSION_REUSED		47u
+#define GENSIO_CONTROL_EXPORT_KEYING		48u
+#define GENSIO_CONTROL_ROUND_TRIPS		49u
+#define GENSIO_CONTROL_MUX_PRIORITY		50u
+#define GENSIO_CONTROL_MUX_WEIGHT		51u
+#define GENSIO_CONTROL_MUX_MAX_BURST		52u
+#define GENSIO_CONTROL_RELPKT_INFO		53u
+#define GENSIO_CONTROL_AX25_INFO		54u
+#define GENSIO_CONTROL_READ_SIZE		55u
+#define GENSIO_CONTROL_CORK			56u
+#define GENSIO_CONTROL_READ_LOWAT		57u
+#define GENSIO_CONTROL_READ_BATCH		58u
+#define GENSIO_CONTROL_WRITE_QUEUED		59u
+#define GENSIO_CONTROL_STATS			60u
+#define GENSIO_CONTROL_TRACE_DUMP		61u
+#define GENSIO_CONTROL_LATENCY			62u
+#define GENSIO_CONTROL_TX_TSTAMP		63u
+#define GENSIO_CONTROL_MEMORY			64u
+#define GENSIO_CONTROL_IPMISOL_INFO		65u
+#define GENSIO_CONTROL_SEND_FD			66u
+#define GENSIO_CONTROL_RECV_FD			67u
+#define GENSIO_CONTROL_SCRIPT_INFO		68u
+#define GENSIO_CONTROL_USB_LATENCY		69u
+#define GENSIO_CONTROL_EARLY_DATA		70u
+#define GENSIO_CONTROL_HANDOFF			71u
+#define GENSIO_CONTROL_TX_DRAIN			72u
 
 #define GENSIO_ACC_CONTROL_LADDR	1u
 #define GENSIO_ACC_CONTROL_LPORT	2u
@@ -60,4 +88,22 @@
  */
 #define GENSIO_ACC_CONTROL_TCPDNAME	3u
 
+/*
+ * Get the GENSIO_CONTROL_STATS counters summed over all the gensios
+ * the accepter has made.
+ */
+#define GENSIO_ACC_CONTROL_STATS	4u
+
+/*
+ * Get/set admission control for the handshakes of a filter accepter,
+ * see gensio_acc_control(3).
+ */
+#define GENSIO_ACC_CONTROL_ADMISSION	5u
+
+/*
+ * Get a duplicate of a listening socket's descriptor to hand it to
+ * another process, see gensio_acc_control(3).
+ */
+#define GENSIO_ACC_CONTROL_HANDOFF	6u
+
 #endif /* GENSIO_CONTROL_H */
@@ -0,0 +1,46 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_CRC16_H
+#define GENSIO_CRC16_H
+
+#include <stdint.h>
+#include <gensio/gensio_dllvisibility.h>
+#include <gensio/gensio_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Add the data to a CRC16 using the reflected CCITT polynomial, as
+ * used by HDLC and AX.25.  The caller sets the initial value in *crc
+ * and does any final inversion.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_crc16_ccitt(const unsigned char *buf, gensiods len,
+			uint16_t *crc);
+GENSIO_DLL_PUBLIC
+void gensio_crc16_ccitt_sg(const struct gensio_sg *sg, gensiods sglen,
+			   uint16_t *crc);
+
+/*
+ * Like the above, but with the non-reflected CCITT polynomial,
+ * most significant bit first.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_crc16_msb(const unsigned char *buf, gensiods len,
+		      uint16_t *crc);
+GENSIO_DLL_PUBLIC
+void gensio_crc16_msb_sg(const struct gensio_sg *sg, gensiods sglen,
+			 uint16_t *crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENSIO_CRC16_H */
@@ -21,6 +21,13 @@ struct gensio_iod;
 struct gensio_fd_ll_ops {
     int (*sub_open)(void *handler_data, struct gensio_iod **iod);
 
+    /*
+     * Called when the iod goes writable during an open.  Return 0 if
+     * the open is done, an error to fail (or retry with retry_open).
+     * If this returns GE_INPROGRESS, the open is waiting on
+     * something other than the iod; its handlers are disabled and
+     * gensio_fd_ll_check_open() must be called later to check again.
+     */
     int (*check_open)(void *handler_data, struct gensio_iod *iod);
 
     int (*retry_open)(void *handler_data, struct gensio_iod **iod);
@@ -81,6 +88,40 @@ void gensio_fd_ll_handle_incoming(struct gensio_ll *ll,
 GENSIO_DLL_PUBLIC
 void *gensio_fd_ll_get_handler_data(struct gensio_ll *ll);
 
+/*
+ * Is the ll open with reading enabled and no read data pending?  For
+ * a read_ready() handler that wants to call
+ * gensio_fd_ll_handle_incoming() again without waiting.
+ */
+GENSIO_DLL_PUBLIC
+bool gensio_fd_ll_can_read_again(struct gensio_ll *ll);
+
+/*
+ * If an open is in progress, call check_open() again as if the iod
+ * had gone writable.  For use after check_open() returns
+ * GE_INPROGRESS.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_check_open(struct gensio_ll *ll);
+
+/*
+ * If a close is waiting after check_close() returned GE_INPROGRESS,
+ * call check_close() again now instead of at the timeout.  For when
+ * the close is waiting on something that reports when it is done.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_check_close(struct gensio_ll *ll);
+
+/*
+ * Read buffers are taken from a global pool only while read data is
+ * waiting to be delivered.  This limits the total memory in the pool
+ * to the given number of bytes, 0 (the default) means no limit.  When
+ * the limit is reached, reads on a connection stop until a buffer is
+ * returned.  Call this before allocating any gensios.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_set_read_buf_limit(gensiods limit);
+
 GENSIO_DLL_PUBLIC
 struct gensio_ll *fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 				     struct gensio_iod *iod,
@@ -32,6 +32,10 @@ struct sctp_initmsg;
 struct sctp_sack_info;
 struct sctp_status;
 
+/* See gensio_os_funcs_public.h. */
+struct gensio_memcache;
+struct gensio_memcache_stats;
+
 /* I/O descriptor. */
 struct gensio_iod {
     /*
@@ -116,8 +120,33 @@ struct gensio_opensocks
 #define GENSIO_OPENSOCK_NODELAY		(1 << 4)
 #define GENSIO_SET_OPENSOCK_NODELAY	(1 << 5)
 
+/*
+ * Only for open_listen_sockets().  Set SO_REUSEPORT on the listening
+ * sockets.  If GENSIO_OPENSOCK_SHARDS(n) is also given with n > 1,
+ * the whole set of sockets is opened n times on the same port(s), so
+ * the kernel can spread incoming connections among them.  The
+ * returned array holds all the shards' sockets, shard 0 first.  Each
+ * shard's iods are given to GENSIO_IOD_CONTROL_SHARD so the OS
+ * handler can spread them among its selectors.  Returns GE_NOTSUP if
+ * the platform does not have SO_REUSEPORT.
+ */
+#define GENSIO_OPENSOCK_REUSEPORT	(1 << 6)
+#define GENSIO_OPENSOCK_SHARD_SHIFT	16
+#define GENSIO_OPENSOCK_SHARDS(n)	((unsigned int) (n) << \
+					 GENSIO_OPENSOCK_SHARD_SHIFT)
+#define GENSIO_OPENSOCK_GET_SHARDS(f)	((f) >> GENSIO_OPENSOCK_SHARD_SHIFT)
+
 /* For recv and send */
 #define GENSIO_MSG_OOB 1
+/*
+ * For send only, send the data without copying it (MSG_ZEROCOPY).
+ * The data must not be changed or freed until the send is reported
+ * complete by GENSIO_SOCKCTL_ZEROCOPY_REAP.  Only use this after
+ * GENSIO_SOCKCTL_SET_ZEROCOPY succeeds.  If the kernel is out of
+ * room to pin the buffer, GE_NOMEM is returned and the data should
+ * be sent the normal way.
+ */
+#define GENSIO_MSG_ZEROCOPY 2
 
 /******************************************************************
  * For sock_control()
@@ -182,6 +211,213 @@ struct gensio_opensocks
 #define GENSIO_SOCKCTL_SET_EXTRAINFO	10
 #define GENSIO_SOCKCTL_GET_EXTRAINFO	11
 
+/*
+ * Receive multiple packets from a UDP socket in one call.  data
+ * points to an array of struct gensio_sockmsg with buf, buflen, and
+ * addr (from addr_alloc_recvfrom()) filled in, and datalen points to
+ * the number of entries.  On return datalen is set to the number of
+ * packets received, 0 if none were available, and each received
+ * entry's len and addr are set as recvfrom() would.  This uses
+ * recvmmsg() if available, and may return fewer packets than asked
+ * for even if more are waiting.
+ *
+ * If GRO is enabled on the socket (see GENSIO_SOCKCTL_SET_UDP_GRO), an
+ * entry may hold several datagrams the kernel coalesced.  In that
+ * case segsize is set to the size of each datagram (the last may be
+ * shorter), otherwise segsize is 0.
+ *
+ * rx_sw and rx_hw are set to the kernel's receive timestamps if
+ * timestamping is on (see GENSIO_SOCKCTL_SET_TIMESTAMPING), and are
+ * zero otherwise.  This may also be used on a TCP socket to get the
+ * receive timestamps; addr must be NULL in that case.
+ */
+#define GENSIO_SOCKCTL_RECV_MULTI	12
+
+struct gensio_sockmsg {
+    void *buf;
+    gensiods buflen;
+    gensiods len;
+    gensiods segsize;
+    struct gensio_addr *addr;
+    gensio_time rx_sw;
+    gensio_time rx_hw;
+};
+
+/*
+ * Set UDP generic segmentation offload on the socket.  data points to
+ * an unsigned int with the segment size, 0 to turn it off.  When set,
+ * a single sendto() of more than the segment size is sent by the
+ * kernel as a series of datagrams of that size.  The kernel limits the
+ * number of segments in one send, see GENSIO_UDP_GSO_MAX_SEGS.
+ * Returns GE_NOTSUP if the OS or kernel doesn't support this.
+ */
+#define GENSIO_SOCKCTL_SET_UDP_GSO	13
+#define GENSIO_UDP_GSO_MAX_SEGS		64
+
+/*
+ * Enable UDP generic receive offload on the socket.  data points to a
+ * bool.  Coalesced datagrams are only reported on the
+ * GENSIO_SOCKCTL_RECV_MULTI path, so only use that to receive when
+ * this is enabled.  The buffers should be 65535 bytes to hold a full
+ * coalesced buffer.  Returns GE_NOTSUP if the OS or kernel doesn't
+ * support this.
+ */
+#define GENSIO_SOCKCTL_SET_UDP_GRO	14
+
+/*
+ * Enable zero-copy sends (SO_ZEROCOPY) on a TCP socket so
+ * GENSIO_MSG_ZEROCOPY can be used.  data and datalen are not used.
+ * Returns GE_NOTSUP if the OS or kernel doesn't support this.
+ */
+#define GENSIO_SOCKCTL_SET_ZEROCOPY	15
+
+/*
+ * Collect zero-copy send completions from the socket.  data points
+ * to an unsigned int that is set to the number of successful
+ * GENSIO_MSG_ZEROCOPY sends that have completed since the last call.
+ * Sends complete in order on TCP.  Completions make the socket show
+ * an exception, so the except handler should be enabled while sends
+ * are outstanding.
+ */
+#define GENSIO_SOCKCTL_ZEROCOPY_REAP	16
+
+/*
+ * Enable TCP fast open on a TCP socket that will listen.  data
+ * points to an unsigned int with the maximum number of fast open
+ * connections that may be waiting for their handshake to finish.
+ * This must be done before the listen.  Returns GE_NOTSUP if the OS
+ * doesn't support this.
+ */
+#define GENSIO_SOCKCTL_SET_TCP_FASTOPEN	17
+
+/*
+ * Enable TCP fast open on a TCP socket before it connects.  data and
+ * datalen are not used.  If the kernel has a fast open cookie for the
+ * destination, the connect succeeds at once without sending anything
+ * and the SYN goes out with the first data sent.  Otherwise the
+ * connect happens normally and gets a cookie for next time.  Returns
+ * GE_NOTSUP if the OS doesn't support this.
+ */
+#define GENSIO_SOCKCTL_SET_TCP_FASTOPEN_CONNECT	18
+
+/*
+ * Get the kernel's transport metrics for a connected TCP socket.
+ * data points to a struct gensio_tcp_info and datalen must be its
+ * size.  Anything the OS doesn't report is zero.  Returns GE_NOTSUP
+ * if the OS doesn't have this at all.
+ */
+#define GENSIO_SOCKCTL_GET_TCP_INFO	19
+
+struct gensio_tcp_info {
+    uint32_t rtt;		/* Smoothed round trip time, usecs. */
+    uint32_t rttvar;		/* Round trip time variance, usecs. */
+    uint32_t snd_cwnd;		/* Congestion window, in segments. */
+    uint32_t total_retrans;	/* Retransmitted segments, total. */
+    uint64_t bytes_acked;	/* Bytes sent that the remote end acked. */
+    uint64_t pacing_rate;	/* Bytes/sec. */
+    uint64_t delivery_rate;	/* Bytes/sec, most recent estimate. */
+};
+
+/*
+ * Turn on kernel packet timestamping (SO_TIMESTAMPING) on a UDP or
+ * TCP socket.  data points to an unsigned int with GENSIO_TSTAMP_xxx
+ * flags, 0 turns it off.  Receive timestamps are reported in the
+ * rx_sw and rx_hw fields of GENSIO_SOCKCTL_RECV_MULTI, so only use
+ * that to receive when the RX flags are set.  Transmit timestamps
+ * are queued on the socket's error queue and collected with
+ * GENSIO_SOCKCTL_TSTAMP_REAP; they make the socket show an exception
+ * and read readiness until collected.  Software timestamps are in
+ * CLOCK_REALTIME, hardware timestamps are the NIC's clock, which is
+ * usually synchronized to real time with PTP.  Hardware timestamps
+ * only show up if the NIC has been configured for them (with
+ * SIOCSHWTSTAMP, hwstamp_ctl, ptp4l, etc).  This cannot be used
+ * with zero-copy sends, they share the error queue.  Returns
+ * GE_NOTSUP if the OS doesn't support this.
+ */
+#define GENSIO_SOCKCTL_SET_TIMESTAMPING	20
+#define GENSIO_TSTAMP_RX_SW		(1 << 0)
+#define GENSIO_TSTAMP_RX_HW		(1 << 1)
+#define GENSIO_TSTAMP_TX_SW		(1 << 2)
+#define GENSIO_TSTAMP_TX_HW		(1 << 3)
+
+/*
+ * Collect transmit timestamps from the socket.  data points to an
+ * array of struct gensio_tx_tstamp and *datalen is the number of
+ * entries in the array.  On return *datalen is set to the number of
+ * entries filled in.  id counts sends from 0 on UDP and bytes sent
+ * (the offset of the last byte of the send) on TCP, starting when
+ * timestamping was turned on.  A timestamp that is not available is
+ * zero.
+ */
+#define GENSIO_SOCKCTL_TSTAMP_REAP	21
+
+struct gensio_tx_tstamp {
+    uint32_t id;
+    gensio_time sw;
+    gensio_time hw;
+};
+
+/*
+ * Pass a descriptor over a connected unix socket (SCM_RIGHTS).  data
+ * points to an int holding the descriptor, the caller still owns it
+ * and may close it after this returns.  It is carried by a single
+ * zero byte of data, which the other end sees in its data stream.
+ * Returns GE_INPROGRESS if the socket cannot take it right now, and
+ * GE_NOTSUP if the OS can't pass descriptors.
+ */
+#define GENSIO_SOCKCTL_SEND_FD		22
+
+/*
+ * Receive data from a connected unix socket and accept any
+ * descriptors that come with it.  data points to a single struct
+ * gensio_sockmsg, only buf and buflen are used and len is set to the
+ * number of bytes read (0 if nothing was there).  On return *datalen
+ * is set to the number of descriptors received.  The descriptors are
+ * held on the socket, close-on-exec, until taken with
+ * GENSIO_SOCKCTL_GET_FD; any not taken are closed with the socket.
+ * Returns GE_REMCLOSE if the other end has closed.  A socket from
+ * add_iod() must be set up with GENSIO_SOCKCTL_ADOPT first.
+ */
+#define GENSIO_SOCKCTL_RECV_FDS		23
+
+/*
+ * Take the oldest descriptor received with GENSIO_SOCKCTL_RECV_FDS.
+ * data points to an int that gets it, the caller now owns it.
+ * Returns GE_NOTFOUND if there isn't one.
+ */
+#define GENSIO_SOCKCTL_GET_FD		24
+
+/*
+ * Set up a connected socket that came from add_iod() (from a parent
+ * process or passed with GENSIO_SOCKCTL_SEND_FD, for instance) so the
+ * other socket functions work on it.  The family and protocol are
+ * taken from the socket.  Stream unix, TCP, SCTP, and UDP sockets are
+ * supported.  Doing this on a socket gensio created is harmless.
+ * data and datalen are not used.
+ */
+#define GENSIO_SOCKCTL_ADOPT		25
+
+/*
+ * Have the kernel busy poll the device queue for data on a blocking
+ * or polled receive instead of waiting for an interrupt
+ * (SO_BUSY_POLL), and prefer busy polling to interrupts for the
+ * queue (SO_PREFER_BUSY_POLL, if available).  data points to an
+ * unsigned int time in microseconds, zero turns it off.  Raising
+ * this above the net.core.busy_read sysctl needs CAP_NET_ADMIN,
+ * GE_PERM is returned otherwise.  Returns GE_NOTSUP if the OS
+ * doesn't have this.
+ */
+#define GENSIO_SOCKCTL_SET_BUSY_POLL	26
+
+/*
+ * Get a duplicate of the socket's descriptor, close-on-exec, to hand
+ * the socket to another process (with GENSIO_SOCKCTL_SEND_FD or
+ * exec).  data points to an int that gets it, the caller owns it.
+ * The connection stays up as long as either descriptor is open.
+ * Returns GE_NOTSUP if the OS can't do this.
+ */
+#define GENSIO_SOCKCTL_DUP_FD		27
+
 /******************************************************************
  * For iod_control()
  */
@@ -280,6 +516,54 @@ struct gensio_winsize {
 /* For ptys, will cd to this directory at startup. */
 #define GENSIO_IOD_CONTROL_START_DIR 28
 
+/*
+ * get/set the low latency flag on a serial port as an int, bool.
+ * This is done immediately.  On Linux this is ASYNC_LOW_LATENCY,
+ * GE_NOTSUP if the system or the device doesn't have it.
+ */
+#define GENSIO_IOD_CONTROL_LOW_LATENCY 29
+
+/*
+ * Set only, block until one of the modem lines in val (a
+ * SERGENSIO_MODEMSTATE_[CTS|DSR|RI|CD] bitmask) changes.  This is
+ * TIOCMIWAIT on Linux.  Returns GE_INTERRUPTED if a signal came in,
+ * GE_NOTSUP if the system or the device doesn't have it.  Only call
+ * this from a thread that can block.
+ */
+#define GENSIO_IOD_CONTROL_MODEMWAIT 30
+
+/*
+ * get/set the receive latency timer of a USB serial adapter in
+ * milliseconds as an int.  This is how long the adapter holds
+ * received data before sending a partial packet to the host.  On
+ * Linux this is the latency_timer file in sysfs for the port, which
+ * FTDI adapters have.  GE_NOTSUP if the device doesn't have it.
+ */
+#define GENSIO_IOD_CONTROL_USB_LATENCY 31
+
+/*
+ * Set only, the driver's transfer size in bytes as an int.  On
+ * Windows this is SetupComm(), which the FTDI and other USB drivers
+ * use as the USB transfer size.  Smaller sizes pass data up sooner.
+ * GE_NOTSUP if the system doesn't have it.
+ */
+#define GENSIO_IOD_CONTROL_XFER_SIZE 32
+
+/*
+ * Set only, block until everything written to the serial port has
+ * been transmitted.  This is tcdrain() on Unix, FlushFileBuffers()
+ * on Windows.  Returns GE_INTERRUPTED if a signal came in.  Only
+ * call this from a thread that can block.
+ */
+#define GENSIO_IOD_CONTROL_DRAIN 33
+
+/*
+ * get/set the capacity of a pipe in bytes as an int.  The OS may
+ * round a set up.  This is F_GETPIPE_SZ/F_SETPIPE_SZ on Linux,
+ * GE_NOTSUP if the system doesn't have it.
+ */
+#define GENSIO_IOD_CONTROL_PIPE_SIZE 34
+
 /*
  * These are for communication between the socket code and the iod, so
  * the socket code can store information in the IOD.  It's only for
@@ -287,6 +571,15 @@ struct gensio_winsize {
  */
 #define GENSIO_IOD_CONTROL_SOCKINFO	1000
 
+/*
+ * Set only, for sockets that do not have handlers set yet.  val is a
+ * shard number.  If the OS handler runs more than one selector, the
+ * iod is moved to selector (val % number of selectors) and sockets
+ * accepted from it stay on that selector.  Otherwise this does
+ * nothing.
+ */
+#define GENSIO_IOD_CONTROL_SHARD	1001
+
 /*
  * Operations for PTYs.  See the discussion baove GENSIO_IOD_PTY for
  * details.
@@ -306,6 +599,58 @@ struct gensio_winsize {
  */
 #define GENSIO_CONTROL_SET_PROC_DATA	10001
 
+/*
+ * Get the stats for the object caches the os handler uses
+ * internally.  data points to an array of struct
+ * gensio_memcache_stats, *datalen is the number of entries in the
+ * array.  On return *datalen is set to the number of caches, which
+ * may be larger than the array.
+ */
+#define GENSIO_CONTROL_GET_CACHE_STATS	10002
+
+/*
+ * Event loop stats, see gensio_os_funcs_set_loop_stats().  For set,
+ * data points to an unsigned int long callback threshold in
+ * microseconds, or is NULL to turn the stats off.  For get, data
+ * points to a struct gensio_loop_stats.  datalen is ignored.
+ */
+#define GENSIO_CONTROL_SET_LOOP_STATS	10003
+#define GENSIO_CONTROL_GET_LOOP_STATS	10004
+
+/*
+ * Coarse loop time, see gensio_os_funcs_set_coarse_time().  For
+ * set, data points to an unsigned int timer slack in microseconds,
+ * or is NULL to turn coarse time off.  For get, data points to a
+ * gensio_time.  datalen is ignored.
+ */
+#define GENSIO_CONTROL_SET_COARSE_TIME	10005
+#define GENSIO_CONTROL_GET_LOOP_TIME	10006
+
+/*
+ * Busy polling, see gensio_os_funcs_set_busy_poll().  data points to
+ * an unsigned int spin time in microseconds, zero turns it off.
+ * datalen is ignored.
+ */
+#define GENSIO_CONTROL_SET_BUSY_POLL	10007
+
+/*
+ * NUMA placement, see gensio_os_funcs_set_numa().  For set, data
+ * points to a bool.  For get, data points to an unsigned int that is
+ * set to the calling thread's node, GE_NOTSUP is returned if NUMA
+ * placement is off.  datalen is ignored.
+ */
+#define GENSIO_CONTROL_SET_NUMA		10008
+#define GENSIO_CONTROL_GET_NUMA_NODE	10009
+
+/*
+ * Real-time profile, see gensio_os_funcs_set_realtime().  For set,
+ * data points to an unsigned int SCHED_FIFO priority (zero to leave
+ * the scheduling alone), or is NULL to turn it off.  Get returns 0
+ * if it is on.  datalen is ignored.
+ */
+#define GENSIO_CONTROL_SET_REALTIME	10010
+#define GENSIO_CONTROL_GET_REALTIME	10011
+
 struct gensio_os_funcs {
     /* For use by the code doing the os function translation. */
     void *user_data;
@@ -820,8 +1165,51 @@ struct gensio_os_funcs {
      */
     int (*control)(struct gensio_os_funcs *o, int func, void *data,
 		   gensiods *datalen);
+
+    /****** Object Caches ******/
+    /*
+     * Optional fixed-size object caches for frequently allocated
+     * objects.  These may be NULL, in which case the
+     * gensio_os_funcs_xxx_cache() functions use a generic free-list
+     * cache built on zalloc and alloc_lock.  If set, all of these
+     * must be set.
+     */
+    struct gensio_memcache *(*alloc_cache)(struct gensio_os_funcs *o,
+					    gensiods size, const char *name);
+    void (*free_cache)(struct gensio_memcache *c);
+    void *(*cache_zalloc)(struct gensio_memcache *c);
+    void (*cache_free)(struct gensio_memcache *c, void *data);
+    void (*cache_stats)(struct gensio_memcache *c,
+			struct gensio_memcache_stats *stats);
+
+    /*
+     * Set by gensio_os_funcs_set_alloc_prof(), os handlers must
+     * leave this NULL.
+     */
+    struct gensio_alloc_prof *alloc_prof;
 };
 
+/*
+ * Charge allocations from this thread to the tag and op (a
+ * GENSIO_ALLOC_OP_xxx) until the pop, and count one op for the tag.
+ * These nest, t is normally on the caller's stack.  Only call these
+ * if o->alloc_prof is set, to keep the cost down when profiling is
+ * off.
+ */
+struct gensio_alloc_tag {
+    const char *tag;
+    unsigned int op;
+    bool pushed;
+    struct gensio_alloc_tag *prev;
+};
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_alloc_tag_push(struct gensio_os_funcs *o,
+			   struct gensio_alloc_tag *t,
+			   const char *tag, unsigned int op);
+GENSIOOSH_DLL_PUBLIC
+void gensio_alloc_tag_pop(struct gensio_alloc_tag *t);
+
 /*
  * Called from os handlers, check for any handlers that may need to be
  * called.
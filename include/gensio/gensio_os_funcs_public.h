@@ -53,12 +53,254 @@ int gensio_os_new_thread(struct gensio_os_funcs *o,
 GENSIOOSH_DLL_PUBLIC
 int gensio_os_wait_thread(struct gensio_thread *thread_id);
 
+/*
+ * Send the os funcs wake signal to the thread, so a blocking system
+ * call in it returns with an EINTR if the signal's handler doesn't
+ * restart system calls.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_interrupt_thread(struct gensio_thread *thread_id);
+
+/*
+ * A counting semaphore for threads started with gensio_os_new_thread()
+ * to sleep on.  Unlike a waiter, waiting on it does not run any gensio
+ * work.
+ */
+struct gensio_thread_sem;
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_new_sem(struct gensio_os_funcs *o,
+		      struct gensio_thread_sem **sem);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_free_sem(struct gensio_thread_sem *sem);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_sem_wait(struct gensio_thread_sem *sem);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_sem_post(struct gensio_thread_sem *sem);
+
+/*
+ * Scheduling attributes for a thread.  Zero/NULL fields are left
+ * alone.
+ */
+struct gensio_thread_attr {
+    /* Name shown by debuggers and top.  Linux only uses 15 chars. */
+    const char *name;
+
+    /*
+     * CPUs the thread may run on, CPU n is bit (n % 8) of
+     * cpus[n / 8].  At most GENSIO_THREAD_ATTR_MAX_CPUS CPUs.
+     */
+    const unsigned char *cpus;
+    unsigned int cpus_len;
+
+    /*
+     * Run the thread with realtime (SCHED_FIFO) scheduling at this
+     * priority, 1-99.  This generally needs privileges.
+     */
+    int fifo_priority;
+};
+
+#define GENSIO_THREAD_ATTR_MAX_CPUS 1024
+
+/*
+ * Apply attr to the calling thread.  Call this from the threads that
+ * run service.  If attr is NULL, the helper thread attributes are
+ * applied, this is for the gensio library's own threads.  Everything
+ * that can be applied is, the first error is returned.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_thread_set_attr(struct gensio_os_funcs *o,
+			      const struct gensio_thread_attr *attr);
+
+/*
+ * Set the attributes for threads the gensio library starts for
+ * itself, like the ssl handshake, file I/O, and address lookup
+ * threads (and on Windows, the timer and polling threads).  These
+ * are process-wide and apply to helper threads started after this
+ * (on Windows, the timer thread of o is changed now, too).  NULL
+ * clears them.  The attributes are copied.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_set_helper_thread_attr(struct gensio_os_funcs *o,
+				     const struct gensio_thread_attr *attr);
+
 GENSIOOSH_DLL_PUBLIC
 void *gensio_os_funcs_zalloc(struct gensio_os_funcs *o, gensiods len);
 
 GENSIOOSH_DLL_PUBLIC
 void gensio_os_funcs_zfree(struct gensio_os_funcs *o, void *data);
 
+/*
+ * Fixed-size object caches.  Objects from a cache are zeroed on
+ * allocation and must be returned to the same cache.  All objects
+ * must be freed before the cache is freed.
+ */
+struct gensio_memcache;
+
+struct gensio_memcache_stats {
+    const char *name;
+    gensiods size;		/* Object size. */
+    gensiods in_use;		/* Objects currently allocated. */
+    gensiods max_in_use;	/* High water mark of in_use. */
+    gensiods cached;		/* Free objects held by the cache. */
+    unsigned long allocs;	/* Total allocations. */
+    unsigned long hits;		/* Allocations from the free list. */
+};
+
+GENSIOOSH_DLL_PUBLIC
+struct gensio_memcache *gensio_os_funcs_alloc_cache(struct gensio_os_funcs *o,
+						    gensiods size,
+						    const char *name);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_free_cache(struct gensio_os_funcs *o,
+				struct gensio_memcache *c);
+
+GENSIOOSH_DLL_PUBLIC
+void *gensio_os_funcs_cache_zalloc(struct gensio_os_funcs *o,
+				   struct gensio_memcache *c);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_cache_free(struct gensio_os_funcs *o,
+				struct gensio_memcache *c, void *data);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_cache_stats(struct gensio_os_funcs *o,
+				 struct gensio_memcache *c,
+				 struct gensio_memcache_stats *stats);
+
+/*
+ * A process wide arena for bulk I/O buffers, backed by huge pages if
+ * possible, so the buffers of many connections share a few TLB
+ * entries.  Once set up, gensio_os_funcs_buf_zalloc() takes buffers
+ * from it and falls back to the normal allocator if it is full or
+ * the buffer is too big.  Buffers from gensio_os_funcs_buf_zalloc()
+ * must be freed with gensio_os_funcs_buf_free().  The arena can only
+ * be set up once and is never freed.
+ */
+struct gensio_buf_arena_stats {
+    gensiods size;		/* Bytes in the arena. */
+    bool huge_pages;		/* Mapped with huge pages, else advised. */
+    gensiods chunks;		/* 2MB chunks in the arena. */
+    gensiods chunks_used;	/* Chunks given to a buffer size. */
+    gensiods in_use;		/* Bytes in buffers handed out. */
+    gensiods max_in_use;	/* High water mark of in_use. */
+    unsigned long allocs;	/* Allocations from the arena. */
+    unsigned long fallbacks;	/* Allocations that didn't fit. */
+};
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_buf_arena(struct gensio_os_funcs *o, gensiods size);
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_get_buf_arena_stats(struct gensio_os_funcs *o,
+					struct gensio_buf_arena_stats *stats);
+
+GENSIOOSH_DLL_PUBLIC
+void *gensio_os_funcs_buf_zalloc(struct gensio_os_funcs *o, gensiods size);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_buf_free(struct gensio_os_funcs *o, void *data);
+
+/*
+ * Event loop health.  Times are in nanoseconds.  Not all os handlers
+ * keep these, the others return GE_NOTSUP.
+ */
+#define GENSIO_LOOP_CB_FD	0
+#define GENSIO_LOOP_CB_TIMER	1
+#define GENSIO_LOOP_CB_RUNNER	2
+
+#define GENSIO_LOOP_NR_LONG_CBS	8
+#define GENSIO_LOOP_NR_QUEUES	16
+
+struct gensio_loop_long_cb {
+    int type;			/* GENSIO_LOOP_CB_xxx */
+    void *handler;		/* The handler function that ran long. */
+    void *cb_data;		/* The data passed to it. */
+    unsigned long long nsecs;	/* How long it ran. */
+};
+
+struct gensio_loop_stats {
+    unsigned long long elapsed_nsecs;	/* Since stats were turned on. */
+    unsigned long long wakeups;		/* Returns from waiting. */
+    unsigned long long iterations;	/* Passes through the loop. */
+    unsigned long long iter_nsecs;	/* Total time not waiting. */
+    unsigned long long iter_max_nsecs;
+    unsigned long long callbacks;
+    unsigned long long cb_nsecs;	/* Total time in callbacks. */
+    unsigned long long cb_max_nsecs;
+    unsigned long long long_cb_nsecs;	/* The long callback threshold. */
+    unsigned long long long_cbs;	/* Callbacks over the threshold. */
+    unsigned long long timers;		/* Timers run. */
+    unsigned long long timer_late_nsecs; /* Total time past expiry. */
+    unsigned long long timer_late_max_nsecs;
+    unsigned long long runner_batches;	/* Times runners were waiting. */
+    unsigned long long runners;		/* Runners run. */
+    unsigned long long runner_depth_max; /* Most waiting at once. */
+    unsigned long long runners_stolen;	/* Run by another selector. */
+    unsigned long long busy_poll_hits;	/* Spins that found something. */
+    unsigned long long busy_poll_blocks; /* Spins that had to block. */
+    unsigned long long busy_poll_nsecs;	/* Total time spinning. */
+    unsigned int nr_recent_long;	/* Valid entries below. */
+    struct gensio_loop_long_cb recent_long[GENSIO_LOOP_NR_LONG_CBS];
+    unsigned int nr_queues;		/* Valid entries below. */
+    unsigned int runner_queued[GENSIO_LOOP_NR_QUEUES]; /* Per selector. */
+};
+
+/*
+ * Turn loop stats on (zeroing them) or off.  A callback running at
+ * least long_cb_usecs is counted as long, zero turns that off.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_loop_stats(struct gensio_os_funcs *o, bool enable,
+				   unsigned int long_cb_usecs);
+
+/* Returns GE_NOTREADY if the stats are not on. */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_get_loop_stats(struct gensio_os_funcs *o,
+				   struct gensio_loop_stats *stats);
+
+/*
+ * Allocation profiling.  The operation an allocation is charged to,
+ * the innermost one running in the thread.
+ */
+#define GENSIO_ALLOC_OP_OTHER	0 /* Not in any of the below. */
+#define GENSIO_ALLOC_OP_OPEN	1
+#define GENSIO_ALLOC_OP_CLOSE	2
+#define GENSIO_ALLOC_OP_READ	3 /* Delivering read data to the user. */
+#define GENSIO_ALLOC_OP_WRITE	4
+
+struct gensio_alloc_prof_entry {
+    const char *tag;		/* The gensio type, NULL for OTHER. */
+    unsigned int op;		/* GENSIO_ALLOC_OP_xxx */
+    unsigned long long count;	/* Times the operation was done. */
+    unsigned long long allocs;
+    unsigned long long bytes;	/* Total size of allocs. */
+    unsigned long long frees;
+};
+
+/*
+ * Turn allocation profiling on (zeroing the counts) or off.  This
+ * wraps zalloc and free in the os funcs, so only change it when
+ * nothing else is using them.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_alloc_prof(struct gensio_os_funcs *o, bool enable);
+
+/*
+ * Get the counts for each tag and operation seen.  *nr_entries is
+ * the size of the entries array, on return it is set to the number
+ * of entries there are, which may be larger.  Returns GE_NOTREADY if
+ * profiling is not on.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_get_alloc_prof(struct gensio_os_funcs *o,
+				   struct gensio_alloc_prof_entry *entries,
+				   gensiods *nr_entries);
+
 GENSIOOSH_DLL_PUBLIC
 struct gensio_lock *gensio_os_funcs_alloc_lock(struct gensio_os_funcs *o);
 
@@ -78,6 +320,71 @@ GENSIOOSH_DLL_PUBLIC
 void gensio_os_funcs_get_monotonic_time(struct gensio_os_funcs *o,
 					gensio_time *time);
 
+/*
+ * Get the monotonic time for timer management.  With coarse time on
+ * this is cheaper but lags the real time by up to a few clock ticks,
+ * otherwise it is the same as gensio_os_funcs_get_monotonic_time().
+ * Use the latter for measuring things.
+ */
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_get_loop_time(struct gensio_os_funcs *o,
+				   gensio_time *time);
+
+/*
+ * Turn coarse time on or off.  When on, gensio_os_funcs_get_loop_time()
+ * uses the cheap clock and timers expiring within timer_slack_usecs
+ * after an expiring timer are run in the same pass, possibly that
+ * much early.  Returns GE_NOTSUP if the os handler can't do this.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_coarse_time(struct gensio_os_funcs *o, bool enable,
+				    unsigned int timer_slack_usecs);
+
+/*
+ * Busy polling for low latency.  A service thread about to block
+ * first polls its I/O without waiting for up to usecs microseconds,
+ * burning CPU to handle an event that comes in soon without sleeping.
+ * Zero turns it off.  The busy_poll_xxx loop stats show how often
+ * this pays off.  Returns GE_NOTSUP if the os handler can't do this.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_busy_poll(struct gensio_os_funcs *o,
+				  unsigned int usecs);
+
+/*
+ * NUMA placement for a multi-selector os funcs.  The selectors are
+ * spread over the NUMA nodes, service threads are pinned to the CPUs
+ * of their selector's node, and accepted connections go to a selector
+ * on the node that received them.  Turn this on before any thread
+ * services the os funcs.  Returns GE_NOTSUP if the os handler or
+ * platform can't do this.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_numa(struct gensio_os_funcs *o, bool enable);
+
+/*
+ * The NUMA node of the calling thread, for keeping per-node pools.
+ * Returns 0 if NUMA placement is not on.
+ */
+GENSIOOSH_DLL_PUBLIC
+unsigned int gensio_os_funcs_get_numa_node(struct gensio_os_funcs *o);
+
+/*
+ * Real-time profile for latency critical links.  All process memory
+ * is locked (and so faulted in), gensios opened after this size
+ * their buffers when allocated instead of as data comes in, and if
+ * priority is not zero threads servicing the os funcs run with that
+ * SCHED_FIFO priority.  Returns GE_NOTSUP if the os handler or
+ * platform can't do this, GE_PERM if not allowed.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_realtime(struct gensio_os_funcs *o, bool enable,
+				 unsigned int priority);
+
+/* Is the real-time profile on? */
+GENSIOOSH_DLL_PUBLIC
+bool gensio_os_funcs_is_realtime(struct gensio_os_funcs *o);
+
 GENSIOOSH_DLL_PUBLIC
 struct gensio_timer *gensio_os_funcs_alloc_timer(struct gensio_os_funcs *o,
 				    void (*handler)(struct gensio_timer *t,
@@ -131,6 +438,16 @@ void gensio_os_funcs_set_vlog(struct gensio_os_funcs *o, gensio_vlog_func func);
 GENSIOOSH_DLL_PUBLIC
 gensio_vlog_func *gensio_os_funcs_get_vlog(struct gensio_os_funcs *o);
 
+/*
+ * Queue logs in a ring of size entries and pass them to the vlog
+ * function from a runner, so the logging thread doesn't wait for the
+ * vlog function.  A size of 0 flushes the ring and goes back to
+ * calling vlog directly.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_set_log_ring(struct gensio_os_funcs *o,
+				 unsigned int size);
+
 GENSIOOSH_DLL_PUBLIC
 void gensio_os_funcs_free(struct gensio_os_funcs *o);
 
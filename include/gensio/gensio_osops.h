@@ -37,6 +37,38 @@ GENSIOOSH_DLL_PUBLIC
 int gensio_os_scan_netaddr(struct gensio_os_funcs *o, const char *str,
 			   bool listen, int protocol, struct gensio_addr **rai);
 
+/*
+ * Set how long name lookups are cached, in seconds.  Connecting
+ * addresses with a host name are cached for the whole process, so
+ * reconnecting to the same name does not do a new lookup every time.
+ * ttl is for names that were found, neg_ttl for names that do not
+ * exist.  Lookup failures, like not reaching the name server, are
+ * never cached.  Zero disables caching for that case.  This also
+ * flushes the cache.
+ */
+#define GENSIO_ADDR_CACHE_DEFAULT_TTL		30
+#define GENSIO_ADDR_CACHE_DEFAULT_NEG_TTL	5
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_set_addr_cache(unsigned int ttl, unsigned int neg_ttl);
+
+/*
+ * Like gensio_os_scan_netaddr(), but done in another thread so the
+ * caller doesn't block if the lookup takes a while.  done is called
+ * from a runner with the result; on success the user must free addr
+ * with gensio_addr_free().  If threads are not available, the lookup
+ * is done before this returns, but done is still called from a
+ * runner.  done is always called if this returns success, there is
+ * no way to cancel the lookup.
+ */
+typedef void (*gensio_os_scan_netaddr_done)(struct gensio_os_funcs *o,
+					    int err, struct gensio_addr *addr,
+					    void *cb_data);
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_scan_netaddr_async(struct gensio_os_funcs *o, const char *str,
+				 bool listen, int protocol,
+				 gensio_os_scan_netaddr_done done,
+				 void *cb_data);
+
 /*
  * Call o->open_listen_sockets() then set the I/O handlers with the
  * given data.
@@ -0,0 +1,58 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_SIM_H
+#define GENSIO_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <gensio/gensioosh_dllvisibility.h>
+#include <gensio/gensio_types.h>
+
+/*
+ * Allocate a simulation os funcs.  Time is virtual, it starts at
+ * zero and only moves forward when service() (or a wait) has nothing
+ * left to run but a timer, then it jumps to that timer.  Runners run
+ * in the order they were scheduled and timers that expire at the
+ * same time in the order they were started, and get_random() comes
+ * from a generator started from seed, so a run with the same seed
+ * does the same thing every time.
+ *
+ * Everything must run from one thread.  There are no real I/O
+ * descriptors, so only gensios that don't use the OS (pipe, echo,
+ * and filters on those) work.  Memory, locks and call_once come from
+ * base, so process-wide data shared with other os funcs stays
+ * consistent; a reference is held on base until this is freed.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_sim_funcs_alloc(struct gensio_os_funcs *base, uint64_t seed,
+			   struct gensio_os_funcs **ro);
+
+/*
+ * Counters for a simulation os funcs.  now is the current virtual
+ * time.
+ */
+struct gensio_sim_stats {
+    gensio_time now;
+    unsigned long long runners_run;
+    unsigned long long timers_run;
+    unsigned int timers_pending;
+};
+
+/* Returns GE_INVAL if o is not a simulation os funcs. */
+GENSIOOSH_DLL_PUBLIC
+int gensio_sim_funcs_get_stats(struct gensio_os_funcs *o,
+			       struct gensio_sim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENSIO_SIM_H */
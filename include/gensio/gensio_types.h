@@ -65,6 +65,18 @@ typedef void (*gensio_done)(struct gensio *io, void *open_data);
  */
 typedef void (*gensio_done_err)(struct gensio *io, int err, void *open_data);
 
+/*
+ * Completion of gensio_read_into().
+ */
+typedef void (*gensio_read_done)(struct gensio *io, int err, gensiods count,
+				 void *read_data);
+
+/*
+ * Release of the buffers given to gensio_write_queued().
+ */
+typedef void (*gensio_write_queued_done)(struct gensio *io, int err,
+					 void *write_data);
+
 /*
  * Callbacks for functions that don't give an error (shutdown);
  */
@@ -91,6 +103,15 @@ struct gensio_sg {
     gensiods buflen;
 };
 
+/*
+ * One packet in a GENSIO_EVENT_READ_BATCH, see gensio_event.3.
+ */
+struct gensio_pkt {
+    const unsigned char *buf;
+    gensiods buflen;
+    const char *const *auxdata;
+};
+
 #define gensio_container_of(ptr, type, member)		\
     ((type *)(((char *) ptr) - offsetof(type, member)))
 
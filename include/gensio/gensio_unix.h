@@ -32,6 +32,41 @@ GENSIO_DLL_PUBLIC
 int gensio_unix_funcs_alloc(struct selector_s *sel, int wake_sig,
 			    struct gensio_os_funcs **ro);
 
+/*
+ * Allocate an os funcs with nr_sels independent selectors, so
+ * threads servicing it don't contend on one selector's locks.  Each
+ * thread that calls service() or waits is bound to one selector, the
+ * first time it does so, round-robin.  iods, timers and runners are
+ * allocated on the selector of the thread allocating them, so
+ * everything a gensio allocates from its handlers stays on its
+ * thread.  Sockets returned by accept are put on the least loaded
+ * selector, and the rest of the accepting handler allocates on that
+ * selector, too.
+ *
+ * At least nr_sels threads must be servicing the os funcs, otherwise
+ * some selectors (and whatever is on them) never run.  Only
+ * available with threads, returns GE_NOTSUP otherwise.  An nr_sels
+ * of 1 is the same as gensio_unix_funcs_alloc() with a NULL sel.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_unix_funcs_alloc_multi(unsigned int nr_sels, int wake_sig,
+				  struct gensio_os_funcs **ro);
+
+/*
+ * Run a Unix os funcs from another event loop.  Watch the fd from
+ * gensio_unix_funcs_get_poll_fd() for read, and call service with a
+ * zero timeout when it is readable or when the time from
+ * gensio_unix_funcs_next_timeout() expires.  next_timeout returns
+ * GE_NOTFOUND if no timers or runners are pending.  Both return
+ * GE_NOTSUP for a multi-selector os funcs or if the selector has no
+ * pollable fd.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_unix_funcs_get_poll_fd(struct gensio_os_funcs *o, int *fd);
+GENSIO_DLL_PUBLIC
+int gensio_unix_funcs_next_timeout(struct gensio_os_funcs *o,
+				   gensio_time *timeout);
+
 #ifdef __cplusplus
 }
 #endif
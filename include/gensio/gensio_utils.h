@@ -95,6 +95,14 @@ unsigned int gensio_get_log_mask(void);
 GENSIOOSH_DLL_PUBLIC
 const char *gensio_log_level_to_str(enum gensio_log_levels level);
 
+/*
+ * Returns true if a log at the given level would go anywhere.  Use
+ * this before doing expensive work to build a log.
+ */
+GENSIOOSH_DLL_PUBLIC
+bool gensio_log_enabled(struct gensio_os_funcs *o,
+			enum gensio_log_levels level);
+
 GENSIOOSH_DLL_PUBLIC
 void gensio_vlog(struct gensio_os_funcs *o, enum gensio_log_levels level,
 		 const char *str, va_list args);
@@ -9,6 +9,7 @@
 #define SELECTOR
 #include <sys/time.h> /* For timeval */
 #include <signal.h>
+#include <stdbool.h>
 
 #if defined GENSIO_LINK_STATIC
   #define SEL_DLL_PUBLIC
@@ -69,6 +70,123 @@ int sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 SEL_DLL_PUBLIC
 int sel_alloc_selector_nothread(struct selector_s **new_selector);
 
+/*
+ * Set the maximum number of events the selector will fetch and
+ * process from epoll in one wakeup.  The default is 1, which spreads
+ * events evenly between threads waiting on the selector.  With many
+ * active file descriptors a larger value avoids a system call and
+ * lock round trip per event.  The value may also be set with the
+ * GENSIO_SEL_EPOLL_BATCH environment variable when the selector is
+ * allocated.  The value is capped at an internal maximum (128).  On
+ * BSD and MacOS this applies to kqueue in the same way.  Has no
+ * effect if select() is in use.
+ *
+ * On Linux, if the GENSIO_SEL_IO_URING environment variable is set
+ * to a non-zero value when the selector is allocated, io_uring poll
+ * requests are used in place of epoll.  The rearms done after
+ * handling a batch of events are then submitted with one system call
+ * instead of one per event.  This setting applies to that, too.
+ */
+SEL_DLL_PUBLIC
+int sel_set_epoll_batch(struct selector_s *sel, unsigned int count);
+
+/*
+ * Busy polling, trading CPU for latency.  Before a thread blocks
+ * waiting for something to happen, it polls the file descriptors
+ * without waiting for up to usecs microseconds (or until the next
+ * timer is due, if that is sooner).  An fd going ready during that
+ * time is handled without the cost of sleeping and being woken.
+ * Wakeups from other threads are not seen until the spin ends, so
+ * keep this at a few tens of microseconds.  Zero (the default) turns
+ * it off.  This may also be set with the GENSIO_SEL_BUSY_POLL
+ * environment variable when the selector is allocated.  Returns
+ * ENOSYS if the selector is not using epoll.  The loop stats count
+ * how often spinning found something versus having to block.
+ */
+SEL_DLL_PUBLIC
+int sel_set_busy_poll(struct selector_s *sel, unsigned int usecs);
+
+/*
+ * Keep timers in a hierarchical timer wheel instead of a heap.
+ * Starting and stopping a timer then takes constant time no matter
+ * how many timers are running, which helps when there are a very
+ * large number of them.  Timers will go off up to the given
+ * granularity (in microseconds) late.  Pass in zero to go back to
+ * the heap.  This returns EBUSY if any timers are running, so it
+ * should be called right after the selector is allocated.  This may
+ * also be set by setting GENSIO_SEL_TIMER_WHEEL to the granularity
+ * in the environment.
+ */
+SEL_DLL_PUBLIC
+int sel_set_timer_wheel(struct selector_s *sel, unsigned int granularity_us);
+
+/*
+ * Event loop health statistics.  When turned on, the selector times
+ * every fd, timer and runner callback, how late timers run, how many
+ * runners are waiting when they are run, and how much of each call
+ * to sel_select() is spent doing things instead of waiting.  A
+ * callback taking longer than the long callback threshold is counted
+ * and its handler and callback data are saved in a small ring,
+ * newest first.  All times are in nanoseconds.  With stats off the
+ * cost is one test per loop and per callback.
+ */
+#define SEL_LOOP_CB_FD		0
+#define SEL_LOOP_CB_TIMER	1
+#define SEL_LOOP_CB_RUNNER	2
+
+#define SEL_LOOP_NR_LONG_CBS	8
+
+struct sel_loop_long_cb {
+    int type;			/* SEL_LOOP_CB_xxx */
+    void *handler;		/* The handler function that ran long. */
+    void *cb_data;		/* The data passed to it. */
+    unsigned long long nsecs;	/* How long it ran. */
+};
+
+struct sel_loop_stats {
+    unsigned long long elapsed_nsecs;	/* Since stats were turned on. */
+    unsigned long long wakeups;		/* Returns from the wait. */
+    unsigned long long iterations;	/* Calls to sel_select(). */
+    unsigned long long iter_nsecs;	/* Total time not waiting. */
+    unsigned long long iter_max_nsecs;
+    unsigned long long callbacks;
+    unsigned long long cb_nsecs;	/* Total time in callbacks. */
+    unsigned long long cb_max_nsecs;
+    unsigned long long long_cb_nsecs;	/* The long callback threshold. */
+    unsigned long long long_cbs;	/* Callbacks over the threshold. */
+    unsigned long long timers;		/* Timers run. */
+    unsigned long long timer_late_nsecs; /* Total time past expiry. */
+    unsigned long long timer_late_max_nsecs;
+    unsigned long long runner_batches;	/* Times runners were waiting. */
+    unsigned long long runners;		/* Runners run. */
+    unsigned long long runner_depth_max; /* Most waiting at once. */
+    unsigned long long runners_stolen;	/* Taken from another selector. */
+    unsigned long long runner_queued;	/* Waiting right now. */
+    unsigned long long busy_poll_hits;	/* Spins that found an event. */
+    unsigned long long busy_poll_blocks; /* Spins that had to block. */
+    unsigned long long busy_poll_nsecs;	/* Total time spinning. */
+    unsigned int nr_recent_long;
+    struct sel_loop_long_cb recent_long[SEL_LOOP_NR_LONG_CBS];
+};
+
+/*
+ * Turn loop statistics on or off.  Turning them on (even if they
+ * are already on) zeroes them.  long_cb_usecs is the long callback
+ * threshold, zero means nothing is long.  If the handlers are
+ * wrappers around the real ones, resolve (if not NULL) is called
+ * before each callback with the handler and data the selector has
+ * and should replace them with the ones to report.
+ */
+typedef void (*sel_loop_resolve_cb)(int type, void **handler, void **cb_data);
+SEL_DLL_PUBLIC
+int sel_set_loop_stats(struct selector_s *sel, bool enable,
+		       unsigned int long_cb_usecs,
+		       sel_loop_resolve_cb resolve);
+
+/* Returns EINVAL if the stats are not on. */
+SEL_DLL_PUBLIC
+int sel_get_loop_stats(struct selector_s *sel, struct sel_loop_stats *stats);
+
 /* Used to destroy a selector. */
 SEL_DLL_PUBLIC
 int sel_free_selector(struct selector_s *new_selector);
@@ -150,6 +268,27 @@ int sel_stop_timer_with_done(sel_timer_t *timer,
 SEL_DLL_PUBLIC
 void sel_get_monotonic_time(struct timeval *tv);
 
+/*
+ * Like sel_get_monotonic_time(), but cheaper.  It lags the real time
+ * by up to a few clock ticks, so don't use it to compute timeouts for
+ * sel_start_timer().  Uses CLOCK_MONOTONIC_COARSE if
+ * the system has it, otherwise it is the same as
+ * sel_get_monotonic_time().
+ */
+SEL_DLL_PUBLIC
+void sel_get_coarse_monotonic_time(struct timeval *tv);
+
+/*
+ * When a timer expires, also run every timer that expires within
+ * usecs after it, so timers due close together are handled in one
+ * pass instead of one wakeup each.  So timers may run up to usecs
+ * early.  Zero (the default) turns this off.  A timer that restarts
+ * itself with a time shorter than the slack may run more than once
+ * in a pass, so keep this small.
+ */
+SEL_DLL_PUBLIC
+void sel_set_timer_slack(struct selector_s *sel, unsigned int usecs);
+
 typedef struct sel_runner_s sel_runner_t;
 typedef void (*sel_runner_func_t)(sel_runner_t *runner, void *cb_data);
 SEL_DLL_PUBLIC
@@ -159,6 +298,28 @@ int sel_free_runner(sel_runner_t *runner);
 SEL_DLL_PUBLIC
 int sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data);
 
+/*
+ * Like sel_run(), but queue the runner on sel instead of the
+ * selector it was allocated on.  The runner must not be freed until
+ * sel has run it.
+ */
+SEL_DLL_PUBLIC
+int sel_run_on(struct selector_s *sel, sel_runner_t *runner,
+	       sel_runner_func_t func, void *cb_data);
+
+/* The number of runners waiting on sel. */
+SEL_DLL_PUBLIC
+unsigned int sel_runners_queued(struct selector_s *sel);
+
+/*
+ * Take all the runners waiting on from and run them in the calling
+ * thread as if they were on sel.  For balancing load between
+ * selectors, returns the number run.
+ */
+SEL_DLL_PUBLIC
+unsigned int sel_steal_runners(struct selector_s *sel,
+			       struct selector_s *from);
+
 /* For multi-threaded programs, you will need to wake the selector
    thread if you add a timer to the top of the heap or change the fd
    mask.  This code should send a signal to the thread that calls
@@ -215,6 +376,36 @@ int sel_select_loop(struct selector_s *sel,
 		    long            thread_id,
 		    void            *cb_data);
 
+/*
+ * Thread wakeups using an eventfd instead of a signal.  A thread
+ * allocates one of these and passes sel_wakefd_send_sig as the
+ * send_sig function and the sel_wakefd_t as the cb_data to the
+ * select calls.  Waking the thread is then a write to the eventfd,
+ * and no signal mask has to be swapped in while waiting unless the
+ * user supplies one.  A wakeup causes the select call to fail with
+ * EINTR, just like a signal would.  sel_wakefd_send_sig() may be
+ * called directly to wake the thread.  A thread should only use one
+ * sel_wakefd_t, but it may be used with any selector.  Only
+ * available if sel_wakefd_supported() returns true for the
+ * selector, which requires epoll or kqueue.  With kqueue an
+ * EVFILT_USER event is used in place of the eventfd.
+ *
+ * Of the threads waiting on a selector with a sel_wakefd_t, only
+ * one at a time watches the selector's fd, so an event wakes one
+ * thread, not all of them.  When that thread stops waiting it wakes
+ * another waiting thread to take over.  That is handled inside the
+ * select call, it does not show up as EINTR.
+ */
+typedef struct sel_wakefd_s sel_wakefd_t;
+SEL_DLL_PUBLIC
+int sel_alloc_wakefd(sel_wakefd_t **w);
+SEL_DLL_PUBLIC
+void sel_free_wakefd(sel_wakefd_t *w);
+SEL_DLL_PUBLIC
+void sel_wakefd_send_sig(long thread_id, void *cb_data);
+SEL_DLL_PUBLIC
+bool sel_wakefd_supported(struct selector_s *sel);
+
 /* Wake all threads in all select loops. */
 SEL_DLL_PUBLIC
 void sel_wake_all(struct selector_s *sel);
@@ -224,6 +415,22 @@ SEL_DLL_PUBLIC
 void sel_wake_one(struct selector_s *sel, long thread_id, sel_send_sig_cb killer,
 		  void *cb_data);
 
+/*
+ * For running the selector from a foreign event loop.  Returns the
+ * epoll or kqueue fd, which becomes readable when fd events are
+ * ready, or -1 if the selector isn't using one.
+ */
+SEL_DLL_PUBLIC
+int sel_get_poll_fd(struct selector_s *sel);
+
+/*
+ * Get the time until the selector next needs to be serviced for
+ * timers or runners (zero if now), not counting fd events.  Returns
+ * ENOENT if nothing is pending.
+ */
+SEL_DLL_PUBLIC
+int sel_get_next_timeout(struct selector_s *sel, struct timeval *timeout);
+
 /*
  * If you fork and expect to use the selector in the forked process,
  * you *must* call this function in the forked process or you may
@@ -146,6 +146,30 @@ int sergensio_signature(struct sergensio *sio,
 			const char *sig, unsigned int len,
 			sergensio_done_sig done, void *cb_data);
 
+/*
+ * Set several line settings at once.  Zero fields are not changed.
+ * The changes are applied together (or not at all on an error) and
+ * done is called once with all the current values.  Returns
+ * GE_NOTSUP if the sergensio can't do this, use the individual calls
+ * then.
+ */
+struct sergensio_line_config {
+    unsigned int baud;
+    unsigned int datasize;
+    unsigned int parity;
+    unsigned int stopbits;
+    unsigned int flowcontrol;
+};
+
+typedef void (*sergensio_done_line_config)(struct sergensio *sio, int err,
+				const struct sergensio_line_config *cfg,
+				void *cb_data);
+
+GENSIO_DLL_PUBLIC
+int sergensio_line_config(struct sergensio *sio,
+			  const struct sergensio_line_config *cfg,
+			  sergensio_done_line_config done, void *cb_data);
+
 /*
  * For linestate and modemstate, on a client this sets the mask, on
  * the server this is reporting the current state to the client.
@@ -336,6 +360,12 @@ int sergensio_ri_b_timeout(struct sergensio_b *sbio, int *ri,
 #define GENSIO_EVENT_SER_DTR		(SERGENSIO_EVENT_BASE + 14)
 #define GENSIO_EVENT_SER_RTS		(SERGENSIO_EVENT_BASE + 15)
 
+/*
+ * Everything written before a GENSIO_CONTROL_TX_DRAIN has been
+ * transmitted, err is set if the wait failed.  serialdev only.
+ */
+#define GENSIO_EVENT_SER_TX_DONE	(SERGENSIO_EVENT_BASE + 16)
+
 GENSIO_DLL_PUBLIC
 bool sergensio_is_client(struct sergensio *sio);
 
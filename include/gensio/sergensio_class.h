@@ -31,6 +31,8 @@
 #define SERGENSIO_FUNC_CTS			16
 #define SERGENSIO_FUNC_DCD_DSR			17
 #define SERGENSIO_FUNC_RI			18
+/* buf is a struct sergensio_line_config, done is a line config done. */
+#define SERGENSIO_FUNC_LINE_CONFIG		19
 
 typedef int (*sergensio_func)(struct sergensio *sio, int op, int val, char *buf,
 			      void *done, void *cb_data);
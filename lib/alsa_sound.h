@@ -16,6 +16,14 @@ struct alsa_info {
     struct gensio_iod **iods;
     unsigned int nrfds;
     struct gensio_timer *close_timer;
+
+    bool mmap; /* Access the PCM ring directly. */
+    snd_pcm_uframes_t period; /* Requested period size, 0 for default. */
+    snd_pcm_uframes_t ring_frames; /* Actual PCM buffer size. */
+
+    /* Area handed directly to the user in mmap mode, commit when done. */
+    snd_pcm_uframes_t mmap_offset;
+    snd_pcm_uframes_t mmap_frames;
 };
 
 static void
@@ -40,6 +48,13 @@ gensio_sound_alsa_api_close_dev(struct sound_info *si)
 	snd_pcm_close(a->pcm);
 	a->pcm = NULL;
     }
+    if (si->rbuf) {
+	si->rbuf = NULL;
+	si->len = 0;
+	si->readpos = 0;
+	si->ready = false;
+    }
+    a->mmap_frames = 0;
     if (a->fds) {
 	o->free(o, a->fds);
 	a->fds = NULL;
@@ -147,7 +162,9 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
     }
 
     err = snd_pcm_hw_params_set_access(a->pcm, params,
-				       SND_PCM_ACCESS_RW_INTERLEAVED);
+				       (a->mmap ?
+					SND_PCM_ACCESS_MMAP_INTERLEAVED :
+					SND_PCM_ACCESS_RW_INTERLEAVED));
     if (err < 0) {
 	gensio_log(o, GENSIO_LOG_INFO,
 		   "alsa error from snd_pcm_hw_params_set_access: %s\n",
@@ -215,6 +232,21 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
 		snd_strerror(err));
 	goto out_err;
     }
+    a->ring_frames = frsize;
+
+    if (a->period) {
+	snd_pcm_uframes_t period = a->period;
+	int dir = 0;
+
+	err = snd_pcm_hw_params_set_period_size_near(a->pcm, params,
+						     &period, &dir);
+	if (err < 0) {
+	    gensio_log(o, GENSIO_LOG_INFO,
+		"alsa error from snd_pcm_hw_params_set_period_size_near: %s\n",
+		snd_strerror(err));
+	    goto out_err;
+	}
+    }
 
 #if 0
     {
@@ -350,6 +382,96 @@ gensio_sound_alsa_check_xrun_recovery(struct sound_info *si, int rv)
     return false;
 }
 
+static unsigned char *
+gensio_sound_alsa_area_addr(const snd_pcm_channel_area_t *area,
+			    snd_pcm_uframes_t offset)
+{
+    return ((unsigned char *) area->addr +
+	    (area->first + offset * area->step) / 8);
+}
+
+/*
+ * Pull data straight out of the PCM ring.  If a whole user buffer is
+ * contiguous in the ring and needs no conversion, hand it directly
+ * to the user and commit it in next_read.  Otherwise convert/copy it
+ * into the user buffer.
+ */
+static void
+gensio_sound_alsa_do_mmap_read(struct sound_info *si)
+{
+    struct alsa_info *a = si->pinfo;
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, frames;
+    snd_pcm_sframes_t avail, rv;
+    unsigned char *src;
+
+    if (snd_pcm_state(a->pcm) == SND_PCM_STATE_PREPARED) {
+	rv = snd_pcm_start(a->pcm);
+	if (rv < 0) {
+	    gensio_sound_alsa_check_xrun_recovery(si, rv);
+	    return;
+	}
+    }
+
+    avail = snd_pcm_avail_update(a->pcm);
+    if (avail < 0) {
+	gensio_sound_alsa_check_xrun_recovery(si, avail);
+	return;
+    }
+
+    while (si->len < si->bufsize && avail > 0) {
+	frames = si->bufsize - si->len;
+	rv = snd_pcm_mmap_begin(a->pcm, &areas, &offset, &frames);
+	if (rv < 0) {
+	    gensio_sound_alsa_check_xrun_recovery(si, rv);
+	    return;
+	}
+	if (frames == 0)
+	    break;
+	src = gensio_sound_alsa_area_addr(&areas[0], offset);
+
+	if (si->len == 0 && frames == si->bufsize && !si->cnv.enabled) {
+	    a->mmap_offset = offset;
+	    a->mmap_frames = frames;
+	    si->rbuf = src;
+	    si->len = frames;
+	    si->ready = true;
+	    return;
+	}
+
+	if (si->cnv.enabled)
+	    si->cnv.convin_n(src, si->buf + si->len * si->framesize,
+			     frames * si->chans, &si->cnv);
+	else
+	    memcpy(si->buf + si->len * si->framesize, src,
+		   frames * si->framesize);
+	rv = snd_pcm_mmap_commit(a->pcm, offset, frames);
+	if (rv < 0 || (snd_pcm_uframes_t) rv != frames) {
+	    gensio_sound_alsa_check_xrun_recovery(si, rv < 0 ? rv : -EPIPE);
+	    return;
+	}
+	si->len += frames;
+	avail -= frames;
+    }
+    if (si->len == si->bufsize)
+	si->ready = true;
+}
+
+static void
+gensio_sound_alsa_api_next_read(struct sound_info *si)
+{
+    struct alsa_info *a = si->pinfo;
+    snd_pcm_sframes_t rv;
+
+    if (!si->rbuf)
+	return;
+    si->rbuf = NULL;
+    rv = snd_pcm_mmap_commit(a->pcm, a->mmap_offset, a->mmap_frames);
+    a->mmap_frames = 0;
+    if (rv < 0)
+	gensio_sound_alsa_check_xrun_recovery(si, rv);
+}
+
 static void
 gensio_sound_alsa_do_read(struct sound_info *si)
 {
@@ -361,6 +483,11 @@ gensio_sound_alsa_do_read(struct sound_info *si)
     if (soundll->err)
 	return;
 
+    if (a->mmap) {
+	gensio_sound_alsa_do_mmap_read(si);
+	return;
+    }
+
     if (si->cnv.enabled) {
 	rv = snd_pcm_readi(a->pcm,
 			   si->cnv.buf + (si->len * si->cnv.pframesize),
@@ -378,14 +505,9 @@ gensio_sound_alsa_do_read(struct sound_info *si)
 	si->len += rv;
 	assert(si->len <= si->bufsize);
 	if (si->len == si->bufsize) {
-	    if (si->cnv.enabled) {
-		const unsigned char *ibuf = si->cnv.buf;
-		unsigned char *obuf = si->buf;
-		gensiods i;
-
-		for (i = 0; i < si->bufsize * si->chans; i++)
-		    si->cnv.convin(&ibuf, &obuf, &si->cnv);
-	    }
+	    if (si->cnv.enabled)
+		si->cnv.convin_n(si->cnv.buf, si->buf,
+				 si->bufsize * si->chans, &si->cnv);
 	    si->ready = true;
 	}
     }
@@ -597,6 +719,89 @@ gensio_sound_alsa_api_write(struct sound_info *out, const unsigned char *buf,
     return 0;
 }
 
+/*
+ * Convert/copy user data straight into the PCM ring.
+ */
+static int
+gensio_sound_alsa_mmap_write(struct sound_info *out, gensiods *rcount,
+			     const struct gensio_sg *sg, gensiods sglen)
+{
+    struct alsa_info *a = out->pinfo;
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, frames;
+    snd_pcm_sframes_t avail, rv;
+    const unsigned char *ibuf;
+    gensiods i, ibuflen, count = 0;
+    unsigned char *dst;
+
+ retry:
+    avail = snd_pcm_avail_update(a->pcm);
+    if (avail < 0) {
+	if (gensio_sound_alsa_check_xrun_recovery(out, avail))
+	    goto retry;
+	return out->soundll->err;
+    }
+
+    for (i = 0; i < sglen && avail > 0; i++) {
+	ibuf = sg[i].buf;
+	ibuflen = sg[i].buflen / out->framesize;
+	while (ibuflen > 0 && avail > 0) {
+	    frames = ibuflen;
+	    if (frames > (snd_pcm_uframes_t) avail)
+		frames = avail;
+	    rv = snd_pcm_mmap_begin(a->pcm, &areas, &offset, &frames);
+	    if (rv < 0)
+		goto out_err;
+	    dst = gensio_sound_alsa_area_addr(&areas[0], offset);
+	    if (out->cnv.enabled)
+		out->cnv.convout_n(ibuf, dst, frames * out->chans, &out->cnv);
+	    else
+		memcpy(dst, ibuf, frames * out->framesize);
+	    rv = snd_pcm_mmap_commit(a->pcm, offset, frames);
+	    if (rv < 0)
+		goto out_err;
+	    ibuf += frames * out->framesize;
+	    ibuflen -= frames;
+	    avail -= frames;
+	    count += frames * out->framesize;
+	}
+    }
+    if (avail <= 0)
+	out->ready = false;
+
+    /* Nothing auto-starts an mmap stream, do it once a buffer is queued. */
+    if (snd_pcm_state(a->pcm) == SND_PCM_STATE_PREPARED &&
+	a->ring_frames - avail >= out->bufsize) {
+	rv = snd_pcm_start(a->pcm);
+	if (rv < 0)
+	    goto out_err;
+    }
+
+    if (rcount)
+	*rcount = count;
+    return 0;
+
+ out_err:
+    gensio_sound_alsa_check_xrun_recovery(out, rv);
+    if (out->soundll->err)
+	return out->soundll->err;
+    /* Recovered, the user can retry. */
+    if (rcount)
+	*rcount = count;
+    return 0;
+}
+
+static int
+gensio_sound_alsa_api_write_sg(struct sound_info *out, gensiods *rcount,
+			       const struct gensio_sg *sg, gensiods sglen)
+{
+    struct alsa_info *a = out->pinfo;
+
+    if (a->mmap)
+	return gensio_sound_alsa_mmap_write(out, rcount, sg, sglen);
+    return gensio_sound_api_default_write(out, rcount, sg, sglen);
+}
+
 static int
 gensio_sound_alsa_api_open_dev(struct sound_info *si)
 {
@@ -762,6 +967,8 @@ gensio_sound_alsa_api_setup(struct sound_info *si, struct gensio_sound_info *io)
     if (!si->pinfo)
 	return GE_NOMEM;
     a = si->pinfo;
+    a->mmap = io->mmap;
+    a->period = io->period;
 
     a->close_timer = o->alloc_timer(o, gensio_sound_alsa_timeout, si);
     if (!a->close_timer) {
@@ -794,7 +1001,8 @@ static struct sound_type alsa_sound_type = {
     .open_dev = gensio_sound_alsa_api_open_dev,
     .close_dev = gensio_sound_alsa_api_close_dev,
     .sub_write = gensio_sound_alsa_api_write,
-    .write = gensio_sound_api_default_write,
+    .write = gensio_sound_alsa_api_write_sg,
+    .next_read = gensio_sound_alsa_api_next_read,
     .set_write_enable = gensio_sound_alsa_api_set_write,
     .set_read_enable = gensio_sound_alsa_api_set_read,
     .start_close = gensio_sound_alsa_api_start_close,
@@ -26,6 +26,10 @@
 #include "gensio_net.h"
 
 static void check_flush_sync_io(struct gensio *io);
+static bool gensio_wq_write_ready(struct gensio *io);
+static void gensio_wq_free(struct gensio *io);
+static void gensio_acc_stats_detach(struct gensio *io);
+static int i_gensio_clear_sync(struct gensio *io, bool deliver);
 
 struct gensio_classobj {
     const char *name;
@@ -96,8 +100,23 @@ struct gensio {
     bool is_encrypted;
     bool is_message;
 
+    /* Only the creator holds this, see gensio_set_fusable(). */
+    bool fusable;
+
     struct gensio_sync_io *sync_io;
 
+    /* Reused by the blocking calls, see gensio_get_waiter(). */
+    struct gensio_waiter *cached_waiter;
+
+    /* For gensio_write_queued(), allocated on first use. */
+    struct gensio_write_queue *wq;
+
+    struct gensio_stats stats;
+
+    /* If made by an accepter, the accepter's stats, see below. */
+    struct gensio_acc_stats *acc_stats;
+    struct gensio_link acc_stats_link;
+
     struct gensio_link link;
 };
 
@@ -133,6 +152,45 @@ gensio_base_init(void *cb_data)
 	o_base = o;
 }
 
+/*
+ * The blocking calls keep a waiter in the object so something doing
+ * one blocking call after another doesn't allocate and free one each
+ * time.  If another thread has it, a new one is allocated.  A waiter
+ * may only go back to the cache if it can't have a wake pending, if
+ * not clean it is freed.
+ */
+static struct gensio_waiter *
+gensio_get_waiter(struct gensio_os_funcs *o, struct gensio_lock *lock,
+		  struct gensio_waiter **cache)
+{
+    struct gensio_waiter *waiter;
+
+    o->lock(lock);
+    waiter = *cache;
+    *cache = NULL;
+    o->unlock(lock);
+    if (!waiter)
+	waiter = o->alloc_waiter(o);
+    return waiter;
+}
+
+static void
+gensio_put_waiter(struct gensio_os_funcs *o, struct gensio_lock *lock,
+		  struct gensio_waiter **cache, struct gensio_waiter *waiter,
+		  bool clean)
+{
+    if (clean) {
+	o->lock(lock);
+	if (!*cache) {
+	    *cache = waiter;
+	    waiter = NULL;
+	}
+	o->unlock(lock);
+    }
+    if (waiter)
+	o->free_waiter(waiter);
+}
+
 struct gensio *
 gensio_data_alloc(struct gensio_os_funcs *o,
 		  gensio_event cb, void *user_data,
@@ -191,7 +249,11 @@ gensio_data_free(struct gensio *io)
 {
     assert(gensio_list_empty(&io->waiters));
 
-    gensio_clear_sync(io);
+    i_gensio_clear_sync(io, false);
+    gensio_wq_free(io);
+    gensio_acc_stats_detach(io);
+    if (io->cached_waiter)
+	io->o->free_waiter(io->cached_waiter);
 
     if (io->frdata && io->frdata->freed)
 	io->frdata->freed(io, io->frdata);
@@ -218,25 +280,138 @@ gensio_get_gensio_data(struct gensio *io)
     return io->gensio_data;
 }
 
+struct gensio_stats *
+gensio_get_stats(struct gensio *io)
+{
+    return &io->stats;
+}
+
+static void
+gensio_stats_sum(struct gensio_stats *sum, struct gensio_stats *s)
+{
+    sum->rx_bytes += __atomic_load_n(&s->rx_bytes, __ATOMIC_RELAXED);
+    sum->rx_events += __atomic_load_n(&s->rx_events, __ATOMIC_RELAXED);
+    sum->tx_bytes += __atomic_load_n(&s->tx_bytes, __ATOMIC_RELAXED);
+    sum->tx_calls += __atomic_load_n(&s->tx_calls, __ATOMIC_RELAXED);
+    sum->tx_partial += __atomic_load_n(&s->tx_partial, __ATOMIC_RELAXED);
+    sum->tx_blocked += __atomic_load_n(&s->tx_blocked, __ATOMIC_RELAXED);
+    sum->tx_blocked_nsecs += __atomic_load_n(&s->tx_blocked_nsecs,
+					     __ATOMIC_RELAXED);
+    sum->sys_reads += __atomic_load_n(&s->sys_reads, __ATOMIC_RELAXED);
+    sum->sys_reads_empty += __atomic_load_n(&s->sys_reads_empty,
+					    __ATOMIC_RELAXED);
+    sum->sys_writes += __atomic_load_n(&s->sys_writes, __ATOMIC_RELAXED);
+    sum->sys_writes_empty += __atomic_load_n(&s->sys_writes_empty,
+					     __ATOMIC_RELAXED);
+}
+
+static int
+gensio_stats_print(struct gensio_stats *s, char *data, gensiods len)
+{
+    return snprintf(data, len,
+		    "rx_bytes=%llu rx_events=%llu tx_bytes=%llu"
+		    " tx_calls=%llu tx_partial=%llu tx_blocked=%llu"
+		    " tx_blocked_nsecs=%llu sys_reads=%llu"
+		    " sys_reads_empty=%llu sys_writes=%llu"
+		    " sys_writes_empty=%llu",
+		    (unsigned long long) s->rx_bytes,
+		    (unsigned long long) s->rx_events,
+		    (unsigned long long) s->tx_bytes,
+		    (unsigned long long) s->tx_calls,
+		    (unsigned long long) s->tx_partial,
+		    (unsigned long long) s->tx_blocked,
+		    (unsigned long long) s->tx_blocked_nsecs,
+		    (unsigned long long) s->sys_reads,
+		    (unsigned long long) s->sys_reads_empty,
+		    (unsigned long long) s->sys_writes,
+		    (unsigned long long) s->sys_writes_empty);
+}
+
+static int
+gensio_stats_control(struct gensio *io, bool get,
+		     char *data, gensiods *datalen)
+{
+    struct gensio_stats s;
+
+    if (!get)
+	return GE_NOTSUP;
+    memset(&s, 0, sizeof(s));
+    gensio_stats_sum(&s, &io->stats);
+    *datalen = gensio_stats_print(&s, data, *datalen);
+    return 0;
+}
+
+/* Add up the memory reported by every gensio in the stack. */
+static int
+gensio_memory_control(struct gensio *io, char *data, gensiods *datalen)
+{
+    struct gensio *c;
+    unsigned long size = 0;
+    char buf[30];
+    gensiods len;
+    bool get = true;
+
+    for (c = io; c; c = c->child) {
+	len = sizeof(buf);
+	if (c->func(c, GENSIO_FUNC_CONTROL, &len, &get, GENSIO_CONTROL_MEMORY,
+		    buf, NULL) == 0)
+	    size += strtoul(buf, NULL, 0);
+    }
+    *datalen = snprintf(data, *datalen, "%lu", size);
+    return 0;
+}
+
 gensio_event
 gensio_get_cb(struct gensio *io)
 {
     return io->cb;
 }
 
+/*
+ * Call the gensio's function, charging any allocations to op if
+ * allocation profiling is on.
+ */
+static int
+gensio_func_op(struct gensio *io, unsigned int op, int func,
+	       gensiods *count, const void *cbuf, gensiods buflen, void *buf,
+	       const char *const *auxdata)
+{
+    struct gensio_alloc_tag tag;
+    int rv;
+
+    if (!io->o->alloc_prof)
+	return io->func(io, func, count, cbuf, buflen, buf, auxdata);
+    gensio_alloc_tag_push(io->o, &tag, io->typename, op);
+    rv = io->func(io, func, count, cbuf, buflen, buf, auxdata);
+    gensio_alloc_tag_pop(&tag);
+    return rv;
+}
+
 int
 gensio_cb(struct gensio *io, int event, int err,
 	  unsigned char *buf, gensiods *buflen, const char *const *auxdata)
 {
     struct gensio_os_funcs *o = io->o;
+    struct gensio_alloc_tag tag;
     int rv;
 
+    /* Queued writes go first, the user only sees an empty queue. */
+    if (event == GENSIO_EVENT_WRITE_READY && io->wq &&
+		!gensio_wq_write_ready(io))
+	return 0;
+
     if (!io->cb)
 	return GE_NOTSUP;
     o->lock(io->lock);
     io->cb_count++;
     o->unlock(io->lock);
-    rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
+    if (o->alloc_prof && event == GENSIO_EVENT_READ) {
+	gensio_alloc_tag_push(o, &tag, io->typename, GENSIO_ALLOC_OP_READ);
+	rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
+	gensio_alloc_tag_pop(&tag);
+    } else {
+	rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
+    }
     o->lock(io->lock);
     assert(io->cb_count > 0);
     io->cb_count--;
@@ -319,6 +494,21 @@ gen_acc_getclass(struct gensio_acc_classobj *classes, const char *name)
     return NULL;
 }
 
+/*
+ * Stats for an accepter.  Each gensio the accepter makes is kept in
+ * ios while it is alive, and its counters are added to closed when
+ * it is freed.  This is refcounted by the accepter and its gensios,
+ * since either may go away first.  Everything is protected by lock.
+ */
+struct gensio_acc_stats {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+    uint64_t connections;
+    struct gensio_list ios;
+    struct gensio_stats closed;
+};
+
 struct gensio_accepter {
     struct gensio_os_funcs *o;
 
@@ -348,6 +538,12 @@ struct gensio_accepter {
 
     struct gensio_list waiting_ios;
     struct gensio_list waiting_accepts;
+
+    /* Reused by the blocking calls, see gensio_get_waiter(). */
+    struct gensio_waiter *cached_waiter;
+
+    /* Allocated on the first connection. */
+    struct gensio_acc_stats *stats;
 };
 
 struct gensio_waiting_accept {
@@ -401,6 +597,118 @@ gensio_acc_data_alloc(struct gensio_os_funcs *o,
     return acc;
 }
 
+static void
+gensio_acc_stats_put(struct gensio_acc_stats *as)
+{
+    struct gensio_os_funcs *o = as->o;
+    unsigned int count;
+
+    o->lock(as->lock);
+    count = --as->refcount;
+    o->unlock(as->lock);
+    if (count == 0) {
+	o->free_lock(as->lock);
+	o->free(o, as);
+    }
+}
+
+/*
+ * Count a new connection from the accepter.  If the stats can't be
+ * allocated the gensio is just not counted.
+ */
+static void
+gensio_acc_stats_attach(struct gensio_accepter *acc, struct gensio *io)
+{
+    struct gensio_os_funcs *o = acc->o;
+    struct gensio_acc_stats *as;
+
+    if (io->acc_stats)
+	return;
+
+    o->lock(acc->lock);
+    as = acc->stats;
+    if (!as) {
+	as = o->zalloc(o, sizeof(*as));
+	if (!as)
+	    goto out_unlock;
+	as->lock = o->alloc_lock(o);
+	if (!as->lock) {
+	    o->free(o, as);
+	    as = NULL;
+	    goto out_unlock;
+	}
+	as->o = o;
+	as->refcount = 1;
+	gensio_list_init(&as->ios);
+	acc->stats = as;
+    }
+    o->lock(as->lock);
+    as->refcount++;
+    as->connections++;
+    gensio_list_add_tail(&as->ios, &io->acc_stats_link);
+    io->acc_stats = as;
+    o->unlock(as->lock);
+ out_unlock:
+    o->unlock(acc->lock);
+}
+
+static void
+gensio_acc_stats_detach(struct gensio *io)
+{
+    struct gensio_acc_stats *as = io->acc_stats;
+
+    if (!as)
+	return;
+
+    as->o->lock(as->lock);
+    gensio_list_rm(&as->ios, &io->acc_stats_link);
+    gensio_stats_sum(&as->closed, &io->stats);
+    as->o->unlock(as->lock);
+    io->acc_stats = NULL;
+    gensio_acc_stats_put(as);
+}
+
+static int
+gensio_acc_stats_control(struct gensio_accepter *acc, bool get,
+			 char *data, gensiods *datalen)
+{
+    struct gensio_os_funcs *o = acc->o;
+    struct gensio_acc_stats *as;
+    struct gensio_stats s;
+    struct gensio_link *l;
+    uint64_t connections = 0, open = 0;
+    gensiods pos;
+
+    if (!get)
+	return GE_NOTSUP;
+
+    memset(&s, 0, sizeof(s));
+    o->lock(acc->lock);
+    as = acc->stats;
+    if (as) {
+	o->lock(as->lock);
+	connections = as->connections;
+	gensio_stats_sum(&s, &as->closed);
+	gensio_list_for_each(&as->ios, l) {
+	    struct gensio *io = gensio_container_of(l, struct gensio,
+						    acc_stats_link);
+
+	    gensio_stats_sum(&s, &io->stats);
+	    open++;
+	}
+	o->unlock(as->lock);
+    }
+    o->unlock(acc->lock);
+
+    pos = snprintf(data, *datalen, "connections=%llu open=%llu ",
+		   (unsigned long long) connections,
+		   (unsigned long long) open);
+    pos += gensio_stats_print(&s, pos < *datalen ? data + pos : NULL,
+			      pos < *datalen ? *datalen - pos : 0);
+    *datalen = pos;
+    return 0;
+}
+
 void
 gensio_acc_data_free(struct gensio_accepter *acc)
 {
@@ -415,6 +723,10 @@ gensio_acc_data_free(struct gensio_accepter *acc)
 	acc->classes = c->next;
 	acc->o->free(acc->o, c);
     }
+    if (acc->stats)
+	gensio_acc_stats_put(acc->stats);
+    if (acc->cached_waiter)
+	acc->o->free_waiter(acc->cached_waiter);
     if (acc->lock)
 	acc->o->free_lock(acc->lock);
     acc->o->free(acc->o, acc);
@@ -429,6 +741,9 @@ gensio_acc_get_gensio_data(struct gensio_accepter *acc)
 int
 gensio_acc_cb(struct gensio_accepter *acc, int event, void *data)
 {
+    if (event == GENSIO_ACC_EVENT_NEW_CONNECTION)
+	gensio_acc_stats_attach(acc, data);
+
     if (event == GENSIO_ACC_EVENT_NEW_CONNECTION && acc->sync) {
 	struct gensio *io = data;
 
@@ -567,7 +882,8 @@ gensio_write(struct gensio *io, gensiods *count,
     }
     sg.buf = buf;
     sg.buflen = buflen;
-    return io->func(io, GENSIO_FUNC_WRITE_SG, count, &sg, 1, NULL, auxdata);
+    return gensio_func_op(io, GENSIO_ALLOC_OP_WRITE, GENSIO_FUNC_WRITE_SG,
+			  count, &sg, 1, NULL, auxdata);
 }
 
 int
@@ -580,7 +896,356 @@ gensio_write_sg(struct gensio *io, gensiods *count,
 	    *count = 0;
 	return 0;
     }
-    return io->func(io, GENSIO_FUNC_WRITE_SG, count, sg, sglen, NULL, auxdata);
+    return gensio_func_op(io, GENSIO_ALLOC_OP_WRITE, GENSIO_FUNC_WRITE_SG,
+			  count, sg, sglen, NULL, auxdata);
+}
+
+int
+gensio_read_into(struct gensio *io, const struct gensio_sg *sg,
+		 gensiods sglen, gensio_read_done done, void *read_data)
+{
+    struct gensio_func_read_into_data d;
+
+    if (sglen == 0 || !done)
+	return GE_INVAL;
+    d.sg = sg;
+    d.sglen = sglen;
+    d.done = done;
+    d.read_data = read_data;
+    return io->func(io, GENSIO_FUNC_READ_INTO, NULL, &d, 0, NULL, NULL);
+}
+
+/* Most sg entries handed to the gensio in one queued write. */
+#define GENSIO_WQ_MAX_SG	16
+
+struct gensio_wq_entry {
+    struct gensio_link link;
+    gensio_write_queued_done done;
+    void *write_data;
+    int err;
+
+    /* Not yet written is sg[pos] starting at off, then the rest. */
+    struct gensio_sg *sg;
+    gensiods sglen;
+    gensiods pos;
+    gensiods off;
+};
+
+struct gensio_write_queue {
+    struct gensio_lock *lock;
+
+    /* Entries waiting to be written, then written ones to release. */
+    struct gensio_list entries;
+    struct gensio_list sent;
+    gensiods nbufs;
+    gensiods nbytes;
+
+    bool user_write_enabled;
+    bool in_send;
+
+    /* A write failed, nothing more can be queued. */
+    int err;
+
+    gensio_done close_done;
+    void *close_data;
+};
+
+#define gensio_link_to_wqe(l) \
+    gensio_container_of(l, struct gensio_wq_entry, link)
+
+/* Called with wq->lock held. */
+static void
+gensio_wq_set_write_enable(struct gensio *io, struct gensio_write_queue *wq)
+{
+    bool enabled = wq->user_write_enabled ||
+	!gensio_list_empty(&wq->entries) || !gensio_list_empty(&wq->sent);
+
+    io->func(io, GENSIO_FUNC_SET_WRITE_CALLBACK, NULL, NULL, enabled, NULL,
+	     NULL);
+}
+
+/* Move everything still queued to the sent list with the given error. */
+static void
+gensio_wq_fail(struct gensio_write_queue *wq, int err)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&wq->entries, l, l2) {
+	struct gensio_wq_entry *e = gensio_link_to_wqe(l);
+
+	e->err = err;
+	gensio_list_rm(&wq->entries, l);
+	gensio_list_add_tail(&wq->sent, l);
+    }
+    wq->nbytes = 0;
+}
+
+/*
+ * Write as much of the queue as the gensio will take, gathering
+ * several entries into one write.  Called with wq->lock held.
+ */
+static int
+gensio_wq_send(struct gensio *io, struct gensio_write_queue *wq)
+{
+    struct gensio_sg sg[GENSIO_WQ_MAX_SG];
+    struct gensio_link *l;
+    struct gensio_wq_entry *e;
+    gensiods i, n, count, total, left;
+    int err;
+
+    while (!gensio_list_empty(&wq->entries)) {
+	n = 0;
+	total = 0;
+	gensio_list_for_each(&wq->entries, l) {
+	    e = gensio_link_to_wqe(l);
+	    for (i = e->pos; i < e->sglen && n < GENSIO_WQ_MAX_SG; i++) {
+		sg[n].buf = ((const unsigned char *) e->sg[i].buf) +
+		    (i == e->pos ? e->off : 0);
+		sg[n].buflen = e->sg[i].buflen - (i == e->pos ? e->off : 0);
+		total += sg[n].buflen;
+		n++;
+	    }
+	    if (n == GENSIO_WQ_MAX_SG)
+		break;
+	}
+
+	count = 0;
+	err = gensio_write_sg(io, &count, sg, n, NULL);
+	if (err)
+	    return err;
+	wq->nbytes -= count;
+
+	/* Step past what was written, finished entries are sent. */
+	while (!gensio_list_empty(&wq->entries)) {
+	    l = gensio_list_first(&wq->entries);
+	    e = gensio_link_to_wqe(l);
+	    while (e->pos < e->sglen) {
+		left = e->sg[e->pos].buflen - e->off;
+		if (count < left) {
+		    e->off += count;
+		    count = 0;
+		    break;
+		}
+		count -= left;
+		e->pos++;
+		e->off = 0;
+	    }
+	    if (e->pos < e->sglen)
+		break;
+	    gensio_list_rm(&wq->entries, l);
+	    gensio_list_add_tail(&wq->sent, l);
+	}
+	if (count < total)
+	    break; /* Short write, wait for write ready. */
+    }
+    return 0;
+}
+
+/*
+ * Release the sent entries.  Called with wq->lock held, it is
+ * released while the done callbacks run.
+ */
+static void
+gensio_wq_release(struct gensio *io, struct gensio_write_queue *wq)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_list done;
+    struct gensio_link *l, *l2;
+
+    if (gensio_list_empty(&wq->sent))
+	return;
+    gensio_list_init(&done);
+    gensio_list_for_each_safe(&wq->sent, l, l2) {
+	gensio_list_rm(&wq->sent, l);
+	gensio_list_add_tail(&done, l);
+	wq->nbufs--;
+    }
+    o->unlock(wq->lock);
+    gensio_list_for_each_safe(&done, l, l2) {
+	struct gensio_wq_entry *e = gensio_link_to_wqe(l);
+
+	gensio_list_rm(&done, l);
+	e->done(io, e->err, e->write_data);
+	o->free(o, e);
+    }
+    o->lock(wq->lock);
+}
+
+/*
+ * Handle a write ready for the queue, returns true if the user
+ * should get it, too.
+ */
+static bool
+gensio_wq_write_ready(struct gensio *io)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq = io->wq;
+    bool rv;
+    int err;
+
+    o->lock(wq->lock);
+    if (!wq->in_send) {
+	wq->in_send = true;
+	err = gensio_wq_send(io, wq);
+	if (err) {
+	    wq->err = err;
+	    gensio_wq_fail(wq, err);
+	}
+	wq->in_send = false;
+    }
+    gensio_wq_release(io, wq);
+    rv = wq->user_write_enabled && gensio_list_empty(&wq->entries);
+    gensio_wq_set_write_enable(io, wq);
+    o->unlock(wq->lock);
+    return rv;
+}
+
+static void
+gensio_wq_close_done(struct gensio *io, void *close_data)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq = io->wq;
+    gensio_done close_done;
+
+    o->lock(wq->lock);
+    gensio_wq_fail(wq, GE_LOCALCLOSED);
+    gensio_wq_release(io, wq);
+    close_done = wq->close_done;
+    close_data = wq->close_data;
+    wq->close_done = NULL;
+    o->unlock(wq->lock);
+    if (close_done)
+	close_done(io, close_data);
+}
+
+static void
+gensio_wq_free(struct gensio *io)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq = io->wq;
+
+    if (!wq)
+	return;
+    o->lock(wq->lock);
+    gensio_wq_fail(wq, GE_LOCALCLOSED);
+    gensio_wq_release(io, wq);
+    o->unlock(wq->lock);
+    o->free_lock(wq->lock);
+    o->free(o, wq);
+    io->wq = NULL;
+}
+
+static struct gensio_write_queue *
+gensio_wq_get(struct gensio *io)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq;
+
+    o->lock(io->lock);
+    if (!io->wq) {
+	wq = o->zalloc(o, sizeof(*wq));
+	if (!wq)
+	    goto out_unlock;
+	wq->lock = o->alloc_lock(o);
+	if (!wq->lock) {
+	    o->free(o, wq);
+	    goto out_unlock;
+	}
+	gensio_list_init(&wq->entries);
+	gensio_list_init(&wq->sent);
+	io->wq = wq;
+    }
+ out_unlock:
+    wq = io->wq;
+    o->unlock(io->lock);
+    return wq;
+}
+
+int
+gensio_write_queued(struct gensio *io, const struct gensio_sg *sg,
+		    gensiods sglen, gensio_write_queued_done done,
+		    void *write_data)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq;
+    struct gensio_wq_entry *e;
+    gensiods i, len = 0;
+    int err = 0;
+
+    if (!done)
+	return GE_INVAL;
+    wq = gensio_wq_get(io);
+    if (!wq)
+	return GE_NOMEM;
+
+    e = o->zalloc(o, sizeof(*e) + sizeof(*sg) * sglen);
+    if (!e)
+	return GE_NOMEM;
+    e->sg = (struct gensio_sg *) (e + 1);
+    for (i = 0; i < sglen; i++) {
+	if (sg[i].buflen == 0)
+	    continue;
+	e->sg[e->sglen++] = sg[i];
+	len += sg[i].buflen;
+    }
+    e->done = done;
+    e->write_data = write_data;
+
+    o->lock(wq->lock);
+    if (wq->err) {
+	err = wq->err;
+	goto out_err;
+    }
+    gensio_list_add_tail(&wq->entries, &e->link);
+    wq->nbufs++;
+    wq->nbytes += len;
+    if (!wq->in_send) {
+	/* Start it right away, the release comes from write ready. */
+	wq->in_send = true;
+	err = gensio_wq_send(io, wq);
+	wq->in_send = false;
+	if (err && gensio_list_first(&wq->entries) == &e->link &&
+		e->pos == 0 && e->off == 0) {
+	    /* Nothing of ours went out, give it back. */
+	    gensio_list_rm(&wq->entries, &e->link);
+	    wq->nbufs--;
+	    wq->nbytes -= len;
+	    goto out_err;
+	}
+	if (err) {
+	    wq->err = err;
+	    gensio_wq_fail(wq, err);
+	    err = 0;
+	}
+    }
+    gensio_wq_set_write_enable(io, wq);
+    o->unlock(wq->lock);
+    return 0;
+
+ out_err:
+    o->unlock(wq->lock);
+    o->free(o, e);
+    return err;
+}
+
+static int
+gensio_wq_control(struct gensio *io, bool get, char *data, gensiods *datalen)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_write_queue *wq = io->wq;
+    gensiods nbufs = 0, nbytes = 0;
+
+    if (!get)
+	return GE_NOTSUP;
+    if (wq) {
+	o->lock(wq->lock);
+	nbufs = wq->nbufs;
+	nbytes = wq->nbytes;
+	o->unlock(wq->lock);
+    }
+    *datalen = snprintf(data, *datalen, "bufs=%lu bytes=%lu",
+			(unsigned long) nbufs, (unsigned long) nbytes);
+    return 0;
 }
 
 int
@@ -618,15 +1283,16 @@ gensio_get_raddr(struct gensio *io, void *addr, gensiods *addrlen)
 int
 gensio_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 {
-    return io->func(io, GENSIO_FUNC_OPEN, NULL, open_done, 0, open_data, NULL);
+    return gensio_func_op(io, GENSIO_ALLOC_OP_OPEN, GENSIO_FUNC_OPEN, NULL,
+			  open_done, 0, open_data, NULL);
 }
 
 int
 gensio_open_nochild(struct gensio *io, gensio_done_err open_done,
 		    void *open_data)
 {
-    return io->func(io, GENSIO_FUNC_OPEN_NOCHILD, NULL, open_done, 0,
-		    open_data, NULL);
+    return gensio_func_op(io, GENSIO_ALLOC_OP_OPEN, GENSIO_FUNC_OPEN_NOCHILD,
+			  NULL, open_done, 0, open_data, NULL);
 }
 
 struct gensio_open_s_data {
@@ -655,7 +1321,7 @@ i_gensio_open_s(struct gensio *io,
 
     data.o = o;
     data.err = 0;
-    data.waiter = o->alloc_waiter(o);
+    data.waiter = gensio_get_waiter(o, io->lock, &io->cached_waiter);
     if (!data.waiter)
 	return GE_NOMEM;
     err = func(io, gensio_open_s_done, &data);
@@ -663,7 +1329,7 @@ i_gensio_open_s(struct gensio *io,
 	o->wait(data.waiter, 1, NULL);
 	err = data.err;
     }
-    o->free_waiter(data.waiter);
+    gensio_put_waiter(o, io->lock, &io->cached_waiter, data.waiter, true);
     return err;
 }
 
@@ -703,7 +1369,27 @@ gensio_control(struct gensio *io, int depth, bool get,
 {
     struct gensio *c = io;
 
+    if (option == GENSIO_CONTROL_WRITE_QUEUED &&
+		(depth == 0 || depth == GENSIO_CONTROL_DEPTH_FIRST))
+	return gensio_wq_control(io, get, data, datalen);
+
+    if (option == GENSIO_CONTROL_STATS) {
+	/* Every gensio has stats, depth first is the top. */
+	if (depth == GENSIO_CONTROL_DEPTH_FIRST)
+	    depth = 0;
+	if (depth < 0)
+	    return GE_INVAL;
+	for (; depth > 0; depth--) {
+	    if (!c->child)
+		return GE_NOTFOUND;
+	    c = c->child;
+	}
+	return gensio_stats_control(c, get, data, datalen);
+    }
+
     if (depth == GENSIO_CONTROL_DEPTH_ALL) {
+	if (get && option == GENSIO_CONTROL_MEMORY)
+	    return gensio_memory_control(io, data, datalen);
 	if (get)
 	    return GE_INVAL;
 	while (c) {
@@ -773,10 +1459,20 @@ gensio_get_child(struct gensio *io, unsigned int depth)
 int
 gensio_close(struct gensio *io, gensio_done close_done, void *close_data)
 {
+    struct gensio_write_queue *wq = io->wq;
     int rv;
 
-    rv = io->func(io, GENSIO_FUNC_CLOSE, NULL, close_done, 0, close_data,
-		  NULL);
+    if (wq) {
+	/* Release what's left in the queue when the close finishes. */
+	io->o->lock(wq->lock);
+	wq->close_done = close_done;
+	wq->close_data = close_data;
+	io->o->unlock(wq->lock);
+	close_done = gensio_wq_close_done;
+	close_data = NULL;
+    }
+    rv = gensio_func_op(io, GENSIO_ALLOC_OP_CLOSE, GENSIO_FUNC_CLOSE, NULL,
+			close_done, 0, close_data, NULL);
     if (!rv)
 	check_flush_sync_io(io);
     return rv;
@@ -803,13 +1499,13 @@ gensio_close_s(struct gensio *io)
     int err;
 
     data.o = o;
-    data.waiter = o->alloc_waiter(o);
+    data.waiter = gensio_get_waiter(o, io->lock, &io->cached_waiter);
     if (!data.waiter)
 	return GE_NOMEM;
     err = gensio_close(io, gensio_close_s_done, &data);
     if (!err)
 	o->wait(data.waiter, 1, NULL);
-    o->free_waiter(data.waiter);
+    gensio_put_waiter(o, io->lock, &io->cached_waiter, data.waiter, true);
     return err;
 }
 
@@ -849,6 +1545,15 @@ gensio_set_read_callback_enable(struct gensio *io, bool enabled)
 void
 gensio_set_write_callback_enable(struct gensio *io, bool enabled)
 {
+    struct gensio_write_queue *wq = io->wq;
+
+    if (wq) {
+	io->o->lock(wq->lock);
+	wq->user_write_enabled = enabled;
+	gensio_wq_set_write_enable(io, wq);
+	io->o->unlock(wq->lock);
+	return;
+    }
     io->func(io, GENSIO_FUNC_SET_WRITE_CALLBACK, NULL, NULL, enabled, NULL,
 	     NULL);
 }
@@ -935,6 +1640,18 @@ gensio_set_is_encrypted(struct gensio *io, bool is_encrypted)
     io->is_encrypted = is_encrypted;
 }
 
+void
+gensio_set_fusable(struct gensio *io, bool fusable)
+{
+    io->fusable = fusable;
+}
+
+bool
+gensio_is_fusable(struct gensio *io)
+{
+    return io->fusable;
+}
+
 void
 gensio_set_frdata(struct gensio *io, struct gensio_frdata *frdata)
 {
@@ -1047,13 +1764,13 @@ gensio_acc_shutdown_s(struct gensio_accepter *acc)
     int err;
 
     data.o = o;
-    data.waiter = o->alloc_waiter(o);
+    data.waiter = gensio_get_waiter(o, acc->lock, &acc->cached_waiter);
     if (!data.waiter)
 	return GE_NOMEM;
     err = gensio_acc_shutdown(acc, gensio_acc_shutdown_s_done, &data);
     if (!err)
 	o->wait(data.waiter, 1, NULL);
-    o->free_waiter(data.waiter);
+    gensio_put_waiter(o, acc->lock, &acc->cached_waiter, data.waiter, true);
     return err;
 }
 
@@ -1102,7 +1819,21 @@ gensio_acc_control(struct gensio_accepter *acc, int depth, bool get,
 		return rv;
 	    c = c->child;
 	}
-	return 0;
+	return 0;
+    }
+
+    if (option == GENSIO_ACC_CONTROL_STATS) {
+	/* Handled here for all accepters, depth first is the top. */
+	if (depth == GENSIO_CONTROL_DEPTH_FIRST)
+	    depth = 0;
+	if (depth < 0)
+	    return GE_INVAL;
+	for (; depth > 0; depth--) {
+	    if (!c->child)
+		return GE_NOTFOUND;
+	    c = c->child;
+	}
+	return gensio_acc_stats_control(c, get, data, datalen);
     }
 
     if (depth == GENSIO_CONTROL_DEPTH_FIRST) {
@@ -1170,19 +1901,18 @@ gensio_acc_set_accept_callback_enable_s(struct gensio_accepter *accepter,
     int err;
 
     data.o = accepter->o;
-    data.waiter = data.o->alloc_waiter(data.o);
+    data.waiter = gensio_get_waiter(data.o, accepter->lock,
+				    &accepter->cached_waiter);
     if (!data.waiter)
 	return GE_NOMEM;
     err = gensio_acc_set_accept_callback_enable_cb(accepter, enabled,
 						   acc_cb_enable_done, &data);
-    if (err) {
-	data.o->free_waiter(data.waiter);
-	return err;
-    }
-    data.o->wait(data.waiter, 1, NULL);
-    data.o->free_waiter(data.waiter);
+    if (!err)
+	data.o->wait(data.waiter, 1, NULL);
+    gensio_put_waiter(data.o, accepter->lock, &accepter->cached_waiter,
+		      data.waiter, true);
 
-    return 0;
+    return err;
 }
 
 void
@@ -1246,18 +1976,49 @@ gensio_acc_set_is_message(struct gensio_accepter *accepter, bool is_message)
 
 struct registered_gensio_accepter {
     const char *name;
+    size_t namelen;
     str_to_gensio_acc_handler handler;
     gensio_terminal_acc_alloch terminal_alloc;
     gensio_filter_acc_alloch filter_alloc;
     struct registered_gensio_accepter *next;
+    struct registered_gensio_accepter *hnext;
 };
 
+/*
+ * Registrations are also kept in hash tables by name.  Entries are
+ * only added (at the head of a bucket, so the newest wins) and only
+ * freed at cleanup, so lookups don't need a lock.
+ */
+#define GENSIO_REG_HASH_SIZE 64
+
+static unsigned int
+gensio_reg_hash(const char *name, size_t len)
+{
+    unsigned int hash = 2166136261U;
+
+    while (len--) {
+	hash ^= (unsigned char) *name++;
+	hash *= 16777619;
+    }
+    return hash % GENSIO_REG_HASH_SIZE;
+}
+
+/* The length of the gensio name at the beginning of a gensio string. */
+static size_t
+gensio_reg_namelen(const char *str)
+{
+    return strcspn(str, ",(");
+}
+
 static struct gensio_os_funcs *reg_o;
 
 static struct registered_gensio *reg_gensios;
+static struct registered_gensio *reg_gensio_hash[GENSIO_REG_HASH_SIZE];
 static struct gensio_lock *reg_gensio_lock;
 
 static struct registered_gensio_accepter *reg_gensio_accs;
+static struct registered_gensio_accepter *
+    reg_gensio_acc_hash[GENSIO_REG_HASH_SIZE];
 static struct gensio_lock *reg_gensio_acc_lock;
 
 static struct gensio_class_cleanup *cleanups;
@@ -1271,6 +2032,26 @@ static int reg_gensio_rv;
 #include "builtin_gensios.h"
 #undef INIT_GENSIO
 
+/*
+ * Builtin gensios are initialized the first time a gensio of their
+ * type is looked up and not found, see gensio_loadlib().  So startup
+ * doesn't pay for things (like ssl library init) that aren't used.
+ */
+struct gensio_builtin {
+    const char *name;
+    int (*init)(struct gensio_os_funcs *o);
+    bool initialized;
+};
+
+#define INIT_GENSIO(name) { #name, gensio_init_##name },
+static struct gensio_builtin builtin_gensios[] = {
+#include "builtin_gensios.h"
+    { NULL }
+};
+#undef INIT_GENSIO
+
+static struct gensio_lock *reg_builtin_lock;
+
 static void
 add_default_gensios(void *cb_data)
 {
@@ -1293,15 +2074,38 @@ add_default_gensios(void *cb_data)
 	reg_gensio_rv = GE_NOMEM;
 	return;
     }
+    reg_builtin_lock = o->alloc_lock(o);
+    if (!reg_builtin_lock) {
+	reg_gensio_rv = GE_NOMEM;
+	return;
+    }
+}
 
-#define INIT_GENSIO(name)				\
-    do {						\
-	reg_gensio_rv = gensio_init_##name(o);		\
-	if (reg_gensio_rv)				\
-	    return;					\
-    } while(0)
-#include "builtin_gensios.h"
-#undef INIT_GENSIO
+/*
+ * Initialize the given builtin gensio module if it hasn't been yet.
+ * Returns true if it was initialized here.
+ */
+static bool
+gensio_builtin_init(struct gensio_os_funcs *o, const char *name)
+{
+    struct gensio_builtin *b;
+    bool rv = false;
+
+    for (b = builtin_gensios; b->name; b++) {
+	if (strcmp(b->name, name) == 0)
+	    break;
+    }
+    if (!b->name)
+	return false;
+
+    /* Hold the lock over the init so other users wait for it. */
+    o->lock(reg_builtin_lock);
+    if (!b->initialized) {
+	b->initialized = true;
+	rv = b->init(o) == 0;
+    }
+    o->unlock(reg_builtin_lock);
+    return rv;
 }
 
 int
@@ -1312,6 +2116,7 @@ register_base_gensio_accepter(struct gensio_os_funcs *o,
 			      gensio_filter_acc_alloch filter_alloc)
 {
     struct registered_gensio_accepter *n;
+    unsigned int h;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
     if (reg_gensio_rv)
@@ -1322,16 +2127,33 @@ register_base_gensio_accepter(struct gensio_os_funcs *o,
 	return GE_NOMEM;
 
     n->name = name;
+    n->namelen = strlen(name);
     n->handler = handler;
     n->terminal_alloc = terminal_alloc;
     n->filter_alloc = filter_alloc;
+    h = gensio_reg_hash(name, n->namelen);
     o->lock(reg_gensio_acc_lock);
     n->next = reg_gensio_accs;
     reg_gensio_accs = n;
+    n->hnext = reg_gensio_acc_hash[h];
+    reg_gensio_acc_hash[h] = n;
     o->unlock(reg_gensio_acc_lock);
     return 0;
 }
 
+static struct registered_gensio_accepter *
+gensio_find_acc(const char *name, size_t len)
+{
+    struct registered_gensio_accepter *r;
+
+    r = reg_gensio_acc_hash[gensio_reg_hash(name, len)];
+    for (; r; r = r->hnext) {
+	if (r->namelen == len && strncmp(r->name, name, len) == 0)
+	    return r;
+    }
+    return NULL;
+}
+
 int
 register_filter_gensio_accepter(struct gensio_os_funcs *o,
 				const char *name,
@@ -1364,9 +2186,14 @@ gensio_loadlib(struct gensio_os_funcs *o, const char *str)
 	return false;
     memcpy(name, str, len);
     name[len] = '\0';
-    if (strcmp(name, "tcp") == 0 || strcmp(name, "unix") == 0)
+    if (strcmp(name, "tcp") == 0 || strcmp(name, "unix") == 0 ||
+		strcmp(name, "sockfd") == 0)
 	strcpy(name, "net");
+    else if (strcmp(name, "dtls") == 0)
+	strcpy(name, "ssl");
 
+    if (gensio_builtin_init(o, name))
+	return true;
     return gensio_os_loadlib(o, name);
 }
 
@@ -1381,7 +2208,6 @@ str_to_gensio_accepter(const char *str,
     int protocol = 0;
     const char **args = NULL;
     struct registered_gensio_accepter *r;
-    size_t len;
     bool retried = false;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
@@ -1391,13 +2217,9 @@ str_to_gensio_accepter(const char *str,
     while (isspace(*str))
 	str++;
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
-
-	str += len;
+    r = gensio_find_acc(str, gensio_reg_namelen(str));
+    if (r) {
+	str += r->namelen;
 	err = gensio_scan_args(o, &str, NULL, &args);
 	if (!err) {
 	    while (isspace(*str))
@@ -1458,15 +2280,9 @@ gensio_terminal_acc_alloc(const char *gensiotype, const void *gdata,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
-	if (!r->terminal_alloc)
-	    break;
-
+    r = gensio_find_acc(gensiotype, strlen(gensiotype));
+    if (r && r->terminal_alloc)
 	return r->terminal_alloc(gdata, args, o, cb, user_data, accepter);
-    }
     if (!retried && gensio_loadlib(o, gensiotype)) {
 	retried = true;
 	goto retry;
@@ -1490,15 +2306,9 @@ gensio_filter_acc_alloc(const char *gensiotype,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
-	if (!r->filter_alloc)
-	    break;
-
+    r = gensio_find_acc(gensiotype, strlen(gensiotype));
+    if (r && r->filter_alloc)
 	return r->filter_alloc(child, args, o, cb, user_data, accepter);
-    }
     if (!retried && gensio_loadlib(o, gensiotype)) {
 	retried = true;
 	goto retry;
@@ -1515,7 +2325,6 @@ str_to_gensio_accepter_child(struct gensio_accepter *child,
 {
     int err = GE_INVAL;
     struct registered_gensio_accepter *r;
-    size_t len;
     bool retried = false;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
@@ -1525,15 +2334,11 @@ str_to_gensio_accepter_child(struct gensio_accepter *child,
     while (isspace(*str))
 	str++;
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
+    r = gensio_find_acc(str, gensio_reg_namelen(str));
+    if (r) {
 	const char **args = NULL;
 
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
-
-	str += len;
+	str += r->namelen;
 	err = gensio_scan_args(o, &str, NULL, &args);
 	if (!err)
 	    err = r->filter_alloc(child, args, o, cb, user_data, accepter);
@@ -1551,10 +2356,12 @@ str_to_gensio_accepter_child(struct gensio_accepter *child,
 
 struct registered_gensio {
     const char *name;
+    size_t namelen;
     str_to_gensio_handler handler;
     gensio_terminal_alloch terminal_alloc;
     gensio_filter_alloch filter_alloc;
     struct registered_gensio *next;
+    struct registered_gensio *hnext;
 };
 
 static int
@@ -1565,6 +2372,7 @@ register_base_gensio(struct gensio_os_funcs *o,
 		     gensio_filter_alloch filter_alloc)
 {
     struct registered_gensio *n;
+    unsigned int h;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
     if (reg_gensio_rv)
@@ -1575,16 +2383,32 @@ register_base_gensio(struct gensio_os_funcs *o,
 	return GE_NOMEM;
 
     n->name = name;
+    n->namelen = strlen(name);
     n->handler = handler;
     n->terminal_alloc = terminal_alloc;
     n->filter_alloc = filter_alloc;
+    h = gensio_reg_hash(name, n->namelen);
     o->lock(reg_gensio_lock);
     n->next = reg_gensios;
     reg_gensios = n;
+    n->hnext = reg_gensio_hash[h];
+    reg_gensio_hash[h] = n;
     o->unlock(reg_gensio_lock);
     return 0;
 }
 
+static struct registered_gensio *
+gensio_find(const char *name, size_t len)
+{
+    struct registered_gensio *r;
+
+    for (r = reg_gensio_hash[gensio_reg_hash(name, len)]; r; r = r->hnext) {
+	if (r->namelen == len && strncmp(r->name, name, len) == 0)
+	    return r;
+    }
+    return NULL;
+}
+
 int
 register_filter_gensio(struct gensio_os_funcs *o,
 		       const char *name,
@@ -1612,6 +2436,18 @@ is_serialdev_default_gensio(const char *str)
 #endif
 }
 
+/* A child in a stack being built, see the "fuse" default. */
+static void
+gensio_child_check_fuse(struct gensio_os_funcs *o, struct gensio *child)
+{
+    int ival = 0;
+
+    gensio_get_default(o, NULL, "fuse", false, GENSIO_DEFAULT_BOOL,
+		       NULL, &ival);
+    if (ival)
+	gensio_set_fusable(child, true);
+}
+
 int
 str_to_gensio(const char *str,
 	      struct gensio_os_funcs *o,
@@ -1624,7 +2460,6 @@ str_to_gensio(const char *str,
     int protocol = 0;
     const char **args = NULL;
     struct registered_gensio *r;
-    size_t len;
     bool retried = false;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
@@ -1634,13 +2469,9 @@ str_to_gensio(const char *str,
     while (isspace(*str))
 	str++;
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
-
-	str += len;
+    r = gensio_find(str, gensio_reg_namelen(str));
+    if (r) {
+	str += r->namelen;
 	err = gensio_scan_args(o, &str, NULL, &args);
 	if (!err) {
 	    while (isspace(*str))
@@ -1649,6 +2480,12 @@ str_to_gensio(const char *str,
 	}
 	if (args)
 	    gensio_argv_free(o, args);
+	/*
+	 * With no callback this is a child being made for the gensio
+	 * above it in the string, nothing else has it.
+	 */
+	if (!err && !cb)
+	    gensio_child_check_fuse(o, *gensio);
 	return err;
     }
     if (!retried && gensio_loadlib(o, str)) {
@@ -1710,14 +2547,9 @@ gensio_terminal_alloc(const char *gensiotype, const void *gdata,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
-	if (!r->terminal_alloc)
-	    break;
+    r = gensio_find(gensiotype, strlen(gensiotype));
+    if (r && r->terminal_alloc)
 	return r->terminal_alloc(gdata, args, o, cb, user_data, new_gensio);
-    }
     if (!retried && gensio_loadlib(o, gensiotype)) {
 	retried = true;
 	goto retry;
@@ -1741,14 +2573,9 @@ gensio_filter_alloc(const char *gensiotype,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
-	if (!r->filter_alloc)
-	    break;
+    r = gensio_find(gensiotype, strlen(gensiotype));
+    if (r && r->filter_alloc)
 	return r->filter_alloc(child, args, o, cb, user_data, new_gensio);
-    }
     if (!retried && gensio_loadlib(o, gensiotype)) {
 	retried = true;
 	goto retry;
@@ -1766,22 +2593,17 @@ str_to_gensio_child(struct gensio *child,
     int err = 0;
     const char **args = NULL;
     struct registered_gensio *r;
-    size_t len;
     bool retried = false;
 
     while (isspace(*str))
 	str++;
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != '(' && str[len]))
-	    continue;
-
+    r = gensio_find(str, gensio_reg_namelen(str));
+    if (r && str[r->namelen] != ',') {
 	if (!r->filter_alloc)
 	    return GE_INVAL;
 
-	str += len;
+	str += r->namelen;
 	err = gensio_scan_args(o, &str, NULL, &args);
 	if (!err)
 	    err = r->filter_alloc(child, args, o, cb, user_data, gensio);
@@ -1797,6 +2619,181 @@ str_to_gensio_child(struct gensio *child,
     return GE_NOTSUP;
 }
 
+struct gensio_template_layer {
+    struct registered_gensio *r;
+    const char **args;
+};
+
+struct gensio_template {
+    struct gensio_os_funcs *o;
+
+    /* Filter layers, outermost first. */
+    unsigned int nlayers;
+    struct gensio_template_layer *layers;
+
+    /*
+     * The terminal gensio.  If term is NULL the terminal was not a
+     * registered name (a plain address or serial device) and
+     * term_str is passed to str_to_gensio().
+     */
+    struct registered_gensio *term;
+    const char **term_args;
+    char *term_str;
+};
+
+static struct registered_gensio *
+gensio_template_find(struct gensio_os_funcs *o, const char *str)
+{
+    struct registered_gensio *r;
+    bool retried = false;
+
+ retry:
+    r = gensio_find(str, gensio_reg_namelen(str));
+    if (r)
+	return r;
+    if (!retried && gensio_loadlib(o, str)) {
+	retried = true;
+	goto retry;
+    }
+    return NULL;
+}
+
+void
+gensio_template_free(struct gensio_template *tmpl)
+{
+    struct gensio_os_funcs *o = tmpl->o;
+    unsigned int i;
+
+    for (i = 0; i < tmpl->nlayers; i++) {
+	if (tmpl->layers[i].args)
+	    gensio_argv_free(o, tmpl->layers[i].args);
+    }
+    if (tmpl->layers)
+	o->free(o, tmpl->layers);
+    if (tmpl->term_args)
+	gensio_argv_free(o, tmpl->term_args);
+    if (tmpl->term_str)
+	o->free(o, tmpl->term_str);
+    o->free(o, tmpl);
+}
+
+int
+gensio_template_compile(const char *str, struct gensio_os_funcs *o,
+			struct gensio_template **rtmpl)
+{
+    struct gensio_template *tmpl;
+    struct gensio_template_layer *layers;
+    struct registered_gensio *r;
+    const char **args;
+    int err;
+
+    o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
+    if (reg_gensio_rv)
+	return reg_gensio_rv;
+
+    tmpl = o->zalloc(o, sizeof(*tmpl));
+    if (!tmpl)
+	return GE_NOMEM;
+    tmpl->o = o;
+
+    for (;;) {
+	while (isspace(*str))
+	    str++;
+	r = gensio_template_find(o, str);
+	if (r && !r->filter_alloc) {
+	    /* A registered terminal, keep its args parsed. */
+	    tmpl->term = r;
+	    str += strlen(r->name);
+	    err = gensio_scan_args(o, &str, NULL, &tmpl->term_args);
+	    if (err)
+		goto out_err;
+	    while (isspace(*str))
+		str++;
+	}
+	if (!r || !r->filter_alloc) {
+	    tmpl->term_str = gensio_strdup(o, str);
+	    if (!tmpl->term_str) {
+		err = GE_NOMEM;
+		goto out_err;
+	    }
+	    break;
+	}
+
+	str += strlen(r->name);
+	args = NULL;
+	err = gensio_scan_args(o, &str, NULL, &args);
+	if (err)
+	    goto out_err;
+	layers = o->zalloc(o, sizeof(*layers) * (tmpl->nlayers + 1));
+	if (!layers) {
+	    gensio_argv_free(o, args);
+	    err = GE_NOMEM;
+	    goto out_err;
+	}
+	if (tmpl->layers) {
+	    memcpy(layers, tmpl->layers, sizeof(*layers) * tmpl->nlayers);
+	    o->free(o, tmpl->layers);
+	}
+	tmpl->layers = layers;
+	tmpl->layers[tmpl->nlayers].r = r;
+	tmpl->layers[tmpl->nlayers].args = args;
+	tmpl->nlayers++;
+    }
+
+    *rtmpl = tmpl;
+    return 0;
+
+ out_err:
+    gensio_template_free(tmpl);
+    return err;
+}
+
+int
+gensio_template_alloc(struct gensio_template *tmpl, const char *terminal,
+		      gensio_event cb, void *user_data,
+		      struct gensio **gensio)
+{
+    struct gensio_os_funcs *o = tmpl->o;
+    struct gensio *child, *io;
+    unsigned int i;
+    gensio_event tcb = NULL;
+    void *tuser_data = NULL;
+    int err;
+
+    if (tmpl->nlayers == 0) {
+	tcb = cb;
+	tuser_data = user_data;
+    }
+
+    if (terminal)
+	err = str_to_gensio(terminal, o, tcb, tuser_data, &child);
+    else if (tmpl->term)
+	err = tmpl->term->handler(tmpl->term_str, tmpl->term_args, o,
+				  tcb, tuser_data, &child);
+    else
+	err = str_to_gensio(tmpl->term_str, o, tcb, tuser_data, &child);
+    if (err)
+	return err;
+
+    for (i = tmpl->nlayers; i > 0; i--) {
+	struct gensio_template_layer *l = &tmpl->layers[i - 1];
+
+	gensio_child_check_fuse(o, child);
+	if (i == 1)
+	    err = l->r->filter_alloc(child, l->args, o, cb, user_data, &io);
+	else
+	    err = l->r->filter_alloc(child, l->args, o, NULL, NULL, &io);
+	if (err) {
+	    gensio_free(child);
+	    return err;
+	}
+	child = io;
+    }
+
+    *gensio = child;
+    return 0;
+}
+
 int
 gensio_check_keyvalue(const char *str, const char *key, const char **value)
 {
@@ -2209,6 +3206,8 @@ struct gensio_def_entry {
     const struct gensio_enum_val *enums;
     struct gensio_class_def *classvals;
     struct gensio_def_entry *next;
+    struct gensio_def_entry *hnext;
+    bool builtin;
 };
 
 #if HAVE_OPENIPMI
@@ -2234,6 +3233,11 @@ struct gensio_def_entry builtin_defaults[] = {
     /* UDP only */
     { "mttl",		GENSIO_DEFAULT_INT,	.min = 1, .max = 255,
 						.def.intval = 1 },
+    { "recvbatch",	GENSIO_DEFAULT_INT,	.min = 1, .max = 1024,
+						.def.intval = 1 },
+    { "gso",		GENSIO_DEFAULT_INT,	.min = 0, .max = 65507,
+						.def.intval = 0 },
+    { "gro",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     /* SCTP only */
     { "instreams",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
 						.def.intval = 1 },
@@ -2245,6 +3249,29 @@ struct gensio_def_entry builtin_defaults[] = {
 						.def.intval = 10 },
     /* TCP and SCTP, UDP get added in init as false. */
     { "reuseaddr",	GENSIO_DEFAULT_BOOL,	.def.intval = 1 },
+    /* TCP and UDP accepters */
+    { "reuseport",	GENSIO_DEFAULT_INT,	.min = 0, .max = 1024,
+						.def.intval = 0 },
+    /* TCP only, minimum write size to send with zero copy, 0 is off */
+    { "zerocopy",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* TCP only, TCP fast open */
+    { "tfo",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    /* TCP and UDP, socket busy poll time in usecs, 0 is off */
+    { "busypoll",	GENSIO_DEFAULT_INT,	.min = 0, .max = 1000000,
+						.def.intval = 0 },
+    /* TCP and UDP, kernel packet timestamps */
+    { "rxtstamp",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "txtstamp",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "hwtstamp",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    /* TCP only, ms before trying the next address in a connect, 0 is off */
+    { "stagger",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 250 },
+    /* TCP only, try the address that last connected first */
+    { "affinity",	GENSIO_DEFAULT_BOOL,	.def.intval = 1 },
+    /* TCP and unix accepters */
+    { "acceptbatch",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+						.def.intval = 16 },
     /* serialdev */
     { "xonxoff",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     { "rtscts",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
@@ -2257,6 +3284,14 @@ struct gensio_def_entry builtin_defaults[] = {
 						.def.intval = -1, },
     { "char_drain_wait",GENSIO_DEFAULT_INT,	.min = -1, .max = INT_MAX,
 						.def.intval = 50, },
+    { "lowlatency",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "lowlatency_poll",GENSIO_DEFAULT_INT,	.min = 0, .max = 1000000,
+						.def.intval = 0, },
+    { "modemwait",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "usb_latency",	GENSIO_DEFAULT_INT,	.min = 0, .max = 255,
+						.def.intval = 0, },
+    { "xfer_size",	GENSIO_DEFAULT_INT,	.min = 0, .max = 1 << 20,
+						.def.intval = 0, },
     /* serialdev and SOL */
     { "speed",		GENSIO_DEFAULT_STR,	.def.strval = "9600N81" },
     { "nobreak",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
@@ -2273,15 +3308,46 @@ struct gensio_def_entry builtin_defaults[] = {
 				.def.intval = ipmi_sol_serial_alerts_fail },
     { "deassert-CTS-DCD-DSR-on-connect", GENSIO_DEFAULT_BOOL, .def.intval = 0 },
 #endif
+    /* Filter accepters, handshake admission control, 0 is off */
+    { "max-opening",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "open-queue",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 128 },
+    { "open-queue-time",GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 10000 },
     /* For client/server protocols. */
     { "mode",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     /* For telnet */
     { "rfc2217",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    /* Merge stacked filter gensios into one, see gensio(5). */
+    { "fuse",		GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    /* Telnet and serialdev, free idle buffers. */
+    { "lean",		GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    { "modemstate_holdoff", GENSIO_DEFAULT_INT,	.min = 0, .max = 60000,
+      .def.intval = 0 },
     /* For SSL or other key authentication. */
     { "CA",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "cert",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "key",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "clientauth",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    /* SSL only, worker threads for handshakes, 0 is off */
+    { "handshake-threads", GENSIO_DEFAULT_INT,	.min = 0, .max = 64,
+      .def.intval = 0 },
+    /* SSL only, dynamic record sizing, record-start of 0 is off */
+    { "record-start",	GENSIO_DEFAULT_INT,	.min = 0, .max = 16384,
+      .def.intval = 0 },
+    { "record-grow",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+      .def.intval = 1048576 },
+    { "record-idle",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+      .def.intval = 1000 },
+    /* SSL only, TLS 1.3 0-RTT data size, 0 is off */
+    { "early-data",	GENSIO_DEFAULT_INT,	.min = 0, .max = 16384,
+      .def.intval = 0 },
+    { "early-data-age",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+      .def.intval = 300 },
+    /* DTLS only, the datagram size handed to the lower layer */
+    { "mtu",		GENSIO_DEFAULT_INT,	.min = 256, .max = 65535,
+      .def.intval = 1400 },
     /* General authentication flags. */
     { "allow-authfail",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
     { "username",	GENSIO_DEFAULT_STR,	.def.strval = NULL },
@@ -2289,12 +3355,30 @@ struct gensio_def_entry builtin_defaults[] = {
     { "service",	GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "use-child-auth",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
     { "enable-password",GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    { "fast-auth",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
+    /* certauth only, verified certificate cache, 0 is off */
+    { "verify-cache",	GENSIO_DEFAULT_INT,	.min = 0, .max = 65536,
+      .def.intval = 0 },
+    { "verify-cache-time", GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+      .def.intval = 300 },
     /* For mux */
     { "max-channels",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
 						.def.intval = 1000 },
+    { "window-budget",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 16777216 },
+    { "priority",	GENSIO_DEFAULT_INT,	.min = 0, .max = 7,
+						.def.intval = 0 },
+    { "weight",		GENSIO_DEFAULT_INT,	.min = 1, .max = 256,
+						.def.intval = 1 },
+    { "max-burst",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
     /* For unix (accepter only) */
     { "delsock",	GENSIO_DEFAULT_BOOL,	.def.intval = false },
 
+    /* For script */
+    { "max-scripts",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+
     /* For mdns */
     { "name",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "type",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
@@ -2304,11 +3388,37 @@ struct gensio_def_entry builtin_defaults[] = {
 						.def.intval = -1 },
     { "nettype",	GENSIO_DEFAULT_STR,	.def.strval = "unspec" },
     { "nostack",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "cache",		GENSIO_DEFAULT_BOOL,	.def.intval = 1 },
+    { "cache-time",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 60000 },
     { NULL }
 };
 
 static struct gensio_def_entry *defaults;
 static int gensio_def_init_rv;
+
+/* All defaults, builtin and added, hashed by name.  Under deflock. */
+static struct gensio_def_entry *def_hash[GENSIO_REG_HASH_SIZE];
+
+static void
+gensio_def_hash_add(struct gensio_def_entry *d)
+{
+    unsigned int h = gensio_reg_hash(d->name, strlen(d->name));
+
+    d->hnext = def_hash[h];
+    def_hash[h] = d;
+}
+
+static void
+gensio_def_hash_del(struct gensio_def_entry *d)
+{
+    struct gensio_def_entry **p;
+
+    p = &def_hash[gensio_reg_hash(d->name, strlen(d->name))];
+    while (*p != d)
+	p = &(*p)->hnext;
+    *p = d->hnext;
+}
 static int l_gensio_set_default(struct gensio_os_funcs *o,
 				const char *class, const char *name,
 				const char *strval, int intval);
@@ -2318,6 +3428,16 @@ static void
 gensio_default_init(void *cb_data)
 {
     struct gensio_os_funcs *o = cb_data;
+    struct gensio_def_entry *d;
+    unsigned int i;
+
+    memset(def_hash, 0, sizeof(def_hash));
+    for (i = 0; builtin_defaults[i].name; i++) {
+	builtin_defaults[i].builtin = true;
+	gensio_def_hash_add(&builtin_defaults[i]);
+    }
+    for (d = defaults; d; d = d->next)
+	gensio_def_hash_add(d);
 
     deflock = o->alloc_lock(o);
     if (!deflock)
@@ -2346,6 +3466,7 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
     struct registered_gensio_accepter *n, *n2;
     struct registered_gensio *g, *g2;
     struct gensio_class_cleanup *cl = cleanups;
+    unsigned int i;
 
     if (gensio_base_lock)
 	o->free_lock(gensio_base_lock);
@@ -2368,6 +3489,7 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
 	n = n2;
     }
     reg_gensio_accs = NULL;
+    memset(reg_gensio_acc_hash, 0, sizeof(reg_gensio_acc_hash));
 
     if (reg_gensio_lock)
 	o->free_lock(reg_gensio_lock);
@@ -2380,6 +3502,7 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
 	g = g2;
     }
     reg_gensios = NULL;
+    memset(reg_gensio_hash, 0, sizeof(reg_gensio_hash));
 
     memset(&gensio_default_initialized, 0, sizeof(gensio_default_initialized));
     memset(&gensio_base_initialized, 0, sizeof(gensio_base_initialized));
@@ -2394,6 +3517,12 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
 	o->free_lock(cleanups_lock);
     cleanups_lock = NULL;
 
+    if (reg_builtin_lock)
+	o->free_lock(reg_builtin_lock);
+    reg_builtin_lock = NULL;
+    for (i = 0; builtin_gensios[i].name; i++)
+	builtin_gensios[i].initialized = false;
+
     reg_o = NULL;
 }
 
@@ -2446,30 +3575,14 @@ gensio_reset_defaults(struct gensio_os_funcs *o)
 }
 
 static struct gensio_def_entry *
-gensio_lookup_default(const char *name, struct gensio_def_entry **prev,
-		      bool *isdefault)
+gensio_lookup_default(const char *name)
 {
-    struct gensio_def_entry *d, *p = NULL;
-    unsigned int i;
+    struct gensio_def_entry *d;
 
-    for (i = 0; builtin_defaults[i].name; i++) {
-	if (strcmp(builtin_defaults[i].name, name) == 0) {
-	    if (prev)
-		*prev = NULL;
-	    if (isdefault)
-		*isdefault = true;
-	    return &builtin_defaults[i];
-	}
-    }
-    for (d = defaults; d; d = d->next) {
-	if (strcmp(d->name, name) == 0) {
-	    if (prev)
-		*prev = p;
-	    if (isdefault)
-		*isdefault = false;
+    d = def_hash[gensio_reg_hash(name, strlen(name))];
+    for (; d; d = d->hnext) {
+	if (strcmp(d->name, name) == 0)
 	    return d;
-	}
-	p = d;
     }
     return NULL;
 }
@@ -2508,7 +3621,7 @@ gensio_add_default(struct gensio_os_funcs *o,
 	return gensio_def_init_rv;
 
     o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    d = gensio_lookup_default(name);
     if (d) {
 	err = GE_EXISTS;
 	goto out_unlock;
@@ -2551,6 +3664,7 @@ gensio_add_default(struct gensio_os_funcs *o,
 
     d->next = defaults;
     defaults = d;
+    gensio_def_hash_add(d);
 
  out_unlock:
     o->unlock(deflock);
@@ -2568,7 +3682,7 @@ l_gensio_set_default(struct gensio_os_funcs *o,
     unsigned int i;
 
     o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    d = gensio_lookup_default(name);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -2727,7 +3841,7 @@ gensio_get_default(struct gensio_os_funcs *o,
 	return gensio_def_init_rv;
 
     o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    d = gensio_lookup_default(name);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -2803,9 +3917,8 @@ int
 gensio_del_default(struct gensio_os_funcs *o,
 		   const char *class, const char *name, bool delclasses)
 {
-    struct gensio_def_entry *d, *prev;
+    struct gensio_def_entry *d, **prev;
     struct gensio_class_def *c = NULL, *prevc;
-    bool isdefault;
     int err = 0;
 
     o->call_once(o, &gensio_default_initialized, gensio_default_init, o);
@@ -2813,7 +3926,7 @@ gensio_del_default(struct gensio_os_funcs *o,
 	return gensio_def_init_rv;
 
     o->lock(deflock);
-    d = gensio_lookup_default(name, &prev, &isdefault);
+    d = gensio_lookup_default(name);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -2837,7 +3950,7 @@ gensio_del_default(struct gensio_os_funcs *o,
 	goto out_unlock;
     }
 
-    if (isdefault) {
+    if (d->builtin) {
 	err = GE_NOTSUP;
 	goto out_unlock;
     }
@@ -2847,10 +3960,10 @@ gensio_del_default(struct gensio_os_funcs *o,
 	goto out_unlock;
     }
 
-    if (prev)
-	prev->next = d->next;
-    else
-	defaults = d->next;
+    for (prev = &defaults; *prev != d; prev = &(*prev)->next)
+	;
+    *prev = d->next;
+    gensio_def_hash_del(d);
 
     while (d->classvals) {
 	c = d->classvals;
@@ -2946,6 +4059,13 @@ struct gensio_sync_op {
     struct gensio_link link;
 };
 
+/*
+ * Data that came in a read callback past what the waiting reads
+ * wanted is kept here, up to this much, so the next read can return
+ * it without waiting.
+ */
+#define GENSIO_SYNC_RBUF_SIZE 4096
+
 struct gensio_sync_io {
     gensio_event old_cb;
 
@@ -2953,10 +4073,52 @@ struct gensio_sync_io {
     struct gensio_list writeops;
     int err;
 
+    unsigned char *rbuf; /* Allocated on first use. */
+    gensiods rbuf_pos;
+    gensiods rbuf_len;
+
     struct gensio_lock *lock;
     struct gensio_waiter *close_waiter;
 };
 
+/* Called with the sync_io lock held, returns the amount taken. */
+static gensiods
+gensio_sync_rbuf_add(struct gensio_os_funcs *o,
+		     struct gensio_sync_io *sync_io,
+		     const unsigned char *buf, gensiods len)
+{
+    if (!sync_io->rbuf) {
+	sync_io->rbuf = o->zalloc(o, GENSIO_SYNC_RBUF_SIZE);
+	if (!sync_io->rbuf)
+	    return 0;
+    }
+    if (sync_io->rbuf_pos > 0) {
+	memmove(sync_io->rbuf, sync_io->rbuf + sync_io->rbuf_pos,
+		sync_io->rbuf_len);
+	sync_io->rbuf_pos = 0;
+    }
+    if (len > GENSIO_SYNC_RBUF_SIZE - sync_io->rbuf_len)
+	len = GENSIO_SYNC_RBUF_SIZE - sync_io->rbuf_len;
+    memcpy(sync_io->rbuf + sync_io->rbuf_len, buf, len);
+    sync_io->rbuf_len += len;
+    return len;
+}
+
+/* Called with the sync_io lock held, returns the amount copied. */
+static gensiods
+gensio_sync_rbuf_get(struct gensio_sync_io *sync_io,
+		     unsigned char *buf, gensiods len)
+{
+    if (len > sync_io->rbuf_len)
+	len = sync_io->rbuf_len;
+    memcpy(buf, sync_io->rbuf + sync_io->rbuf_pos, len);
+    sync_io->rbuf_pos += len;
+    sync_io->rbuf_len -= len;
+    if (sync_io->rbuf_len == 0)
+	sync_io->rbuf_pos = 0;
+    return len;
+}
+
 static void
 gensio_sync_flush_waiters(struct gensio_sync_io *sync_io,
 			  struct gensio_os_funcs *o)
@@ -3021,13 +4183,8 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 	    gensio_sync_flush_waiters(sync_io, o);
 	    goto read_unlock;
 	}
-	if (gensio_list_empty(&sync_io->readops)) {
-	    *buflen = 0;
-	    gensio_set_read_callback_enable(io, false);
-	    goto read_unlock;
-	}
 	done_len = *buflen;
-	while (*buflen && !gensio_list_empty(&sync_io->readops)) {
+	while (done_len && !gensio_list_empty(&sync_io->readops)) {
 	    struct gensio_link *l = gensio_list_first(&sync_io->readops);
 	    struct gensio_sync_op *op = gensio_container_of(l,
 							struct gensio_sync_op,
@@ -3041,10 +4198,13 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 	    gensio_list_rm(&sync_io->readops, l);
 	    op->queued = false;
 	    o->wake(op->waiter);
+	    buf += len;
 	    done_len -= len;
 	}
-	*buflen -= done_len;
 	if (done_len > 0)
+	    done_len -= gensio_sync_rbuf_add(o, sync_io, buf, done_len);
+	*buflen -= done_len;
+	if (gensio_list_empty(&sync_io->readops))
 	    gensio_set_read_callback_enable(io, false);
     read_unlock:
 	o->unlock(sync_io->lock);
@@ -3129,8 +4289,8 @@ gensio_set_sync(struct gensio *io)
     return 0;
 }
 
-int
-gensio_clear_sync(struct gensio *io)
+static int
+i_gensio_clear_sync(struct gensio *io, bool deliver)
 {
     struct gensio_os_funcs *o = io->o;
     struct gensio_sync_io *sync_io = io->sync_io;
@@ -3144,14 +4304,39 @@ gensio_clear_sync(struct gensio *io)
 
     io->cb = sync_io->old_cb;
 
+    /*
+     * Anything read ahead was read for the user, give it to the
+     * callback.  If it won't take it there's nowhere to put it.
+     */
+    while (deliver && sync_io->rbuf_len) {
+	gensiods len = sync_io->rbuf_len;
+
+	gensio_cb(io, GENSIO_EVENT_READ, 0, sync_io->rbuf + sync_io->rbuf_pos,
+		  &len, NULL);
+	if (len == 0)
+	    break;
+	if (len > sync_io->rbuf_len)
+	    len = sync_io->rbuf_len;
+	sync_io->rbuf_pos += len;
+	sync_io->rbuf_len -= len;
+    }
+
     o->free_waiter(sync_io->close_waiter);
     o->free_lock(sync_io->lock);
+    if (sync_io->rbuf)
+	o->free(o, sync_io->rbuf);
     o->free(o, sync_io);
     io->sync_io = NULL;
 
     return 0;
 }
 
+int
+gensio_clear_sync(struct gensio *io)
+{
+    return i_gensio_clear_sync(io, true);
+}
+
 static int
 i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen,
 		gensio_time *timeout, bool return_on_intr)
@@ -3160,6 +4345,7 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
     struct gensio_sync_io *sync_io = io->sync_io;
     struct gensio_sync_op op;
     int rv = 0;
+    bool clean = true;
 
     if (!sync_io)
 	return GE_NOTREADY;
@@ -3174,10 +4360,22 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
     op.buf = data;
     op.len = datalen;
     op.err = 0;
-    op.waiter = o->alloc_waiter(o);
-    if (!op.waiter)
-	return GE_NOMEM;
+    op.waiter = NULL;
     o->lock(sync_io->lock);
+    if (!sync_io->rbuf_len && !sync_io->err) {
+	o->unlock(sync_io->lock);
+	op.waiter = gensio_get_waiter(o, io->lock, &io->cached_waiter);
+	if (!op.waiter)
+	    return GE_NOMEM;
+	o->lock(sync_io->lock);
+    }
+    if (sync_io->rbuf_len) {
+	/* Data is already here, no need to wait. */
+	op.len = gensio_sync_rbuf_get(sync_io, data, datalen);
+	if (count)
+	    *count = op.len;
+	goto out_unlock;
+    }
     if (sync_io->err) {
 	rv = sync_io->err;
 	goto out_unlock;
@@ -3191,6 +4389,8 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
     rv = o->wait_intr(op.waiter, 1, timeout);
     if (!return_on_intr && rv == GE_INTERRUPTED)
 	goto retry;
+    /* If the wait didn't take the wake, one may still be coming. */
+    clean = rv == 0;
     if (rv == GE_TIMEDOUT)
 	rv = 0;
     o->lock(sync_io->lock);
@@ -3200,6 +4400,7 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
 	if (count)
 	    *count = 0;
 	gensio_list_rm(&sync_io->readops, &op.link);
+	clean = true;
     } else if (count) {
 	*count = op.len;
     }
@@ -3207,7 +4408,8 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
 	gensio_set_read_callback_enable(io, false);
  out_unlock:
     o->unlock(sync_io->lock);
-    o->free_waiter(op.waiter);
+    if (op.waiter)
+	gensio_put_waiter(o, io->lock, &io->cached_waiter, op.waiter, clean);
 
     return rv;
 }
@@ -3235,7 +4437,8 @@ i_gensio_write_s(struct gensio *io, gensiods *count,
     struct gensio_sync_io *sync_io = io->sync_io;
     struct gensio_sync_op op;
     int rv = 0;
-    gensiods origlen;
+    gensiods origlen, len;
+    bool clean = true;
 
     if (!sync_io)
 	return GE_NOTREADY;
@@ -3251,10 +4454,34 @@ i_gensio_write_s(struct gensio *io, gensiods *count,
     op.buf = (void *) data;
     op.len = datalen;
     op.err = 0;
-    op.waiter = o->alloc_waiter(o);
-    if (!op.waiter)
-	return GE_NOMEM;
+    op.waiter = NULL;
+    o->lock(sync_io->lock);
+    if (sync_io->err) {
+	rv = sync_io->err;
+	goto out_unlock;
+    }
+    if (gensio_list_empty(&sync_io->writeops)) {
+	/* Nothing ahead of us, if it can all go now don't wait. */
+	len = 0;
+	rv = gensio_write(io, &len, op.buf, op.len, NULL);
+	if (rv)
+	    goto out_unlock;
+	op.buf += len;
+	op.len -= len;
+	if (op.len == 0) {
+	    if (count)
+		*count = origlen;
+	    goto out_unlock;
+	}
+    }
+    o->unlock(sync_io->lock);
+
+    op.waiter = gensio_get_waiter(o, io->lock, &io->cached_waiter);
     o->lock(sync_io->lock);
+    if (!op.waiter) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
     if (sync_io->err) {
 	rv = sync_io->err;
 	goto out_unlock;
@@ -3268,11 +4495,15 @@ i_gensio_write_s(struct gensio *io, gensiods *count,
     rv = o->wait_intr(op.waiter, 1, timeout);
     if (!return_on_intr && rv == GE_INTERRUPTED)
 	goto retry;
+    /* If the wait didn't take the wake, one may still be coming. */
+    clean = rv == 0;
     if (rv == GE_TIMEDOUT)
 	rv = 0;
     o->lock(sync_io->lock);
-    if (op.queued)
+    if (op.queued) {
 	gensio_list_rm(&sync_io->writeops, &op.link);
+	clean = true;
+    }
     if (op.err)
 	rv = op.err;
     else if (count)
@@ -3281,7 +4512,8 @@ i_gensio_write_s(struct gensio *io, gensiods *count,
 	gensio_set_write_callback_enable(io, false);
  out_unlock:
     o->unlock(sync_io->lock);
-    o->free_waiter(op.waiter);
+    if (op.waiter)
+	gensio_put_waiter(o, io->lock, &io->cached_waiter, op.waiter, clean);
 
     return rv;
 }
@@ -3319,9 +4551,10 @@ i_gensio_acc_accept_s(struct gensio_accepter *acc, gensio_time *timeout,
     struct gensio_waiting_accept wa;
     struct gensio_link *l;
     int rv = 0;
+    bool clean = true;
 
     memset(&wa, 0, sizeof(wa));
-    wa.waiter = o->alloc_waiter(o);
+    wa.waiter = gensio_get_waiter(o, acc->lock, &acc->cached_waiter);
     if (!wa.waiter)
 	return GE_NOMEM;
 
@@ -3335,10 +4568,13 @@ i_gensio_acc_accept_s(struct gensio_accepter *acc, gensio_time *timeout,
     rv = o->wait_intr(wa.waiter, 1, timeout);
     if (!return_on_intr && rv == GE_INTERRUPTED)
 	goto retry;
+    /* If the wait didn't take the wake, one may still be coming. */
+    clean = rv == 0;
     if (rv == GE_TIMEDOUT)
 	rv = 0;
     o->lock(acc->lock);
     if (wa.queued) {
+	clean = true;
 	rv = GE_TIMEDOUT;
 	gensio_list_rm(&acc->waiting_accepts, &wa.link);
     } else if (gensio_list_empty(&acc->waiting_ios)) {
@@ -3351,7 +4587,7 @@ i_gensio_acc_accept_s(struct gensio_accepter *acc, gensio_time *timeout,
     }
     o->unlock(acc->lock);
 
-    o->free_waiter(wa.waiter);
+    gensio_put_waiter(o, acc->lock, &acc->cached_waiter, wa.waiter, clean);
 
     return rv;
 }
@@ -3478,6 +4714,7 @@ gensio_time_diff_nsecs(gensio_time *t1, gensio_time *t2)
     int64_t v;
 
     v = t1->secs - t2->secs;
+    v *= GENSIO_NSECS_IN_SEC;
     v += (int64_t) t1->nsecs - (int64_t) t2->nsecs;
     return v;
 }
@@ -14,10 +14,22 @@
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
 #include <gensio/gensio_acc_gensio.h>
 #include <gensio/gensio_ll_gensio.h>
 #include <gensio/argvutils.h>
 
+/*
+ * A new connection waiting for a free handshake slot, see
+ * gensna_admit().
+ */
+struct gensna_queued {
+    struct gensio_link link;
+    struct gensio *child;
+    int priority;
+    int64_t deadline;
+};
+
 struct gensna_data {
     struct gensio_accepter *acc;
 
@@ -30,8 +42,30 @@ struct gensna_data {
 
     gensio_gensio_acc_cb acc_cb;
     void *acc_data;
+
+    /*
+     * Admission control for handshakes, see GENSIO_ACC_CONTROL_ADMISSION.
+     * If max_opening is set, at most that many new connections run
+     * their filter open at once.  The rest wait in queue, highest
+     * priority first, for up to queue_time msecs (0 is forever).
+     * Everything here is protected by lock.
+     */
+    struct gensio_lock *lock;
+    unsigned int max_opening;
+    unsigned int queue_max;
+    unsigned int queue_time;
+    unsigned int opening;
+    unsigned int queued;
+    struct gensio_list queue;
+    uint64_t admitted;
+    uint64_t shed;
+    uint64_t expired;
 };
 
+static int gensna_start_child(struct gensna_data *nadata,
+			      struct gensio *child);
+static void gensna_queue_flush(struct gensna_data *nadata);
+
 static int
 gensna_startup(struct gensio_accepter *accepter, struct gensna_data *nadata)
 {
@@ -53,6 +87,7 @@ gensna_shutdown(struct gensio_accepter *accepter,
 		gensio_acc_done shutdown_done)
 {
     nadata->shutdown_done = shutdown_done;
+    gensna_queue_flush(nadata);
     return gensio_acc_shutdown(nadata->child, gensna_child_shutdown, nadata);
 }
 
@@ -79,9 +114,114 @@ gensna_set_accept_callback_enable(struct gensio_accepter *accepter,
 						    ldone, nadata);
 }
 
+static int64_t
+gensna_now(struct gensna_data *nadata)
+{
+    gensio_time t;
+
+    nadata->o->get_monotonic_time(nadata->o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+/* Move the queued connections that are past their time to shed. */
+static void
+gensna_queue_expire(struct gensna_data *nadata, struct gensio_list *shed)
+{
+    struct gensio_link *l, *l2;
+    int64_t now;
+
+    if (!nadata->queue_time || !nadata->queued)
+	return;
+
+    now = gensna_now(nadata);
+    gensio_list_for_each_safe(&nadata->queue, l, l2) {
+	struct gensna_queued *q = gensio_container_of(l, struct gensna_queued,
+						      link);
+
+	if (q->deadline > now)
+	    continue;
+	gensio_list_rm(&nadata->queue, &q->link);
+	gensio_list_add_tail(shed, &q->link);
+	nadata->queued--;
+	nadata->expired++;
+    }
+}
+
+/* Free connections that are not going to be opened, call unlocked. */
+static void
+gensna_free_shed(struct gensna_data *nadata, struct gensio_list *shed)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(shed, l, l2) {
+	struct gensna_queued *q = gensio_container_of(l, struct gensna_queued,
+						      link);
+
+	gensio_list_rm(shed, &q->link);
+	gensio_free(q->child);
+	nadata->o->free(nadata->o, q);
+    }
+}
+
+/*
+ * Start queued connections while there are free slots.  A start that
+ * fails gives its slot back, so just keep going.
+ */
+static void
+gensna_run_queue(struct gensna_data *nadata)
+{
+    struct gensio_list shed;
+    struct gensna_queued *q;
+    struct gensio *child;
+
+    gensio_list_init(&shed);
+    for (;;) {
+	nadata->o->lock(nadata->lock);
+	gensna_queue_expire(nadata, &shed);
+	if (!nadata->queued || (nadata->max_opening &&
+				nadata->opening >= nadata->max_opening)) {
+	    nadata->o->unlock(nadata->lock);
+	    break;
+	}
+	q = gensio_container_of(gensio_list_first(&nadata->queue),
+				struct gensna_queued, link);
+	gensio_list_rm(&nadata->queue, &q->link);
+	nadata->queued--;
+	nadata->opening++;
+	nadata->admitted++;
+	nadata->o->unlock(nadata->lock);
+
+	child = q->child;
+	nadata->o->free(nadata->o, q);
+	gensna_start_child(nadata, child);
+    }
+    gensna_free_shed(nadata, &shed);
+}
+
+/* Drop everything waiting, for shutdown and free. */
+static void
+gensna_queue_flush(struct gensna_data *nadata)
+{
+    struct gensio_list shed;
+    struct gensio_link *l, *l2;
+
+    gensio_list_init(&shed);
+    nadata->o->lock(nadata->lock);
+    gensio_list_for_each_safe(&nadata->queue, l, l2) {
+	gensio_list_rm(&nadata->queue, l);
+	gensio_list_add_tail(&shed, l);
+    }
+    nadata->queued = 0;
+    nadata->o->unlock(nadata->lock);
+    gensna_free_shed(nadata, &shed);
+}
+
 static void
 gensna_free(struct gensio_accepter *accepter, struct gensna_data *nadata)
 {
+    gensna_queue_flush(nadata);
+    if (nadata->lock)
+	nadata->o->free_lock(nadata->lock);
     if (nadata->child)
 	gensio_acc_free(nadata->child);
     if (nadata->acc_cb)
@@ -146,10 +286,69 @@ gensna_str_to_gensio(struct gensio_accepter *accepter,
     return err;
 }
 
+static int
+gensna_admission_control(struct gensna_data *nadata, bool get,
+			 char *data, gensiods *datalen)
+{
+    unsigned int max_opening, queue_max, queue_time;
+    const char **argv;
+    int argc, i, rv;
+
+    if (get) {
+	nadata->o->lock(nadata->lock);
+	*datalen = snprintf(data, *datalen,
+			    "opening=%u queued=%u admitted=%llu shed=%llu"
+			    " expired=%llu max-opening=%u open-queue=%u"
+			    " open-queue-time=%u",
+			    nadata->opening, nadata->queued,
+			    (unsigned long long) nadata->admitted,
+			    (unsigned long long) nadata->shed,
+			    (unsigned long long) nadata->expired,
+			    nadata->max_opening, nadata->queue_max,
+			    nadata->queue_time);
+	nadata->o->unlock(nadata->lock);
+	return 0;
+    }
+
+    rv = gensio_str_to_argv(nadata->o, data, &argc, &argv, " \f\n\r\t\v,");
+    if (rv)
+	return rv;
+
+    nadata->o->lock(nadata->lock);
+    max_opening = nadata->max_opening;
+    queue_max = nadata->queue_max;
+    queue_time = nadata->queue_time;
+    for (i = 0; i < argc; i++) {
+	if (gensio_check_keyuint(argv[i], "max-opening", &max_opening) > 0)
+	    continue;
+	if (gensio_check_keyuint(argv[i], "open-queue", &queue_max) > 0)
+	    continue;
+	if (gensio_check_keyuint(argv[i], "open-queue-time", &queue_time) > 0)
+	    continue;
+	rv = GE_INVAL;
+	break;
+    }
+    if (!rv) {
+	nadata->max_opening = max_opening;
+	nadata->queue_max = queue_max;
+	nadata->queue_time = queue_time;
+    }
+    nadata->o->unlock(nadata->lock);
+    gensio_argv_free(nadata->o, argv);
+
+    /* There may be more room now. */
+    if (!rv)
+	gensna_run_queue(nadata);
+    return rv;
+}
+
 static int
 gensna_control(struct gensio_accepter *accepter, struct gensna_data *nadata,
 	       bool get, unsigned int option, char *data, gensiods *datalen)
 {
+    if (option == GENSIO_ACC_CONTROL_ADMISSION)
+	return gensna_admission_control(nadata, get, data, datalen);
+
     return nadata->acc_cb(nadata->acc_data, GENSIO_GENSIO_ACC_CONTROL,
 			  &get, data, datalen, &option);
 }
@@ -157,6 +356,8 @@ gensna_control(struct gensio_accepter *accepter, struct gensna_data *nadata,
 static void
 gensna_disable(struct gensio_accepter *accepter, struct gensna_data *nadata)
 {
+    gensna_queue_flush(nadata);
+    nadata->opening = 0;
     nadata->acc_cb(nadata->acc_data, GENSIO_GENSIO_ACC_DISABLE,
 		   NULL, NULL, NULL, NULL);
 }
@@ -197,31 +398,41 @@ gensio_gensio_base_acc_op(struct gensio_accepter *acc, int op,
     }
 }
 
+static void
+gensna_open_slot_done(struct gensna_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+    if (nadata->opening)
+	nadata->opening--;
+    nadata->o->unlock(nadata->lock);
+}
+
 static void
 gensna_finish_server_open(struct gensio *net, int err, void *cb_data)
 {
     struct gensna_data *nadata = cb_data;
 
+    gensna_open_slot_done(nadata);
     base_gensio_server_open_done(nadata->acc, net, err);
+    gensna_run_queue(nadata);
 }
 
+/*
+ * Start the filter open on a new connection.  The caller has taken an
+ * open slot for it, it is given back if this fails.  The child is
+ * freed on failure.
+ */
 static int
-gensna_child_event(struct gensio_accepter *accepter, void *user_data,
-		   int event, void *data)
+gensna_start_child(struct gensna_data *nadata, struct gensio *child)
 {
-    struct gensna_data *nadata = user_data;
     struct gensio_os_funcs *o = nadata->o;
     struct gensio_filter *filter = NULL;
     struct gensio_ll *ll = NULL;
-    struct gensio *io = NULL, *child;
+    struct gensio *io = NULL;
     void *finish_data;
     bool base_allocated = true;
     int err;
 
-    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
-	return gensio_acc_cb(nadata->acc, event, data);
-
-    child = data;
     err = base_gensio_accepter_new_child_start(nadata->acc);
     if (err)
 	goto out_err;
@@ -284,6 +495,7 @@ gensna_child_event(struct gensio_accepter *accepter, void *user_data,
  out_err_unlock:
     base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
  out_err:
+    gensna_open_slot_done(nadata);
     if (io) {
 	gensio_free(io);
     } else {
@@ -300,6 +512,122 @@ gensna_child_event(struct gensio_accepter *accepter, void *user_data,
     return err;
 }
 
+/*
+ * Queue a new connection in priority order, oldest first for the same
+ * priority.  If the queue is full the newest of the lowest priority
+ * is shed, which may be this one.
+ */
+static void
+gensna_enqueue(struct gensna_data *nadata, struct gensna_queued *q,
+	       struct gensio_list *shed)
+{
+    struct gensio_link *l;
+
+    gensio_list_for_each(&nadata->queue, l) {
+	struct gensna_queued *q2 = gensio_container_of(l, struct gensna_queued,
+						       link);
+
+	if (q2->priority < q->priority)
+	    break;
+    }
+    if (l == &nadata->queue.link)
+	gensio_list_add_tail(&nadata->queue, &q->link);
+    else
+	gensio_list_add_prev(&nadata->queue, l, &q->link);
+    nadata->queued++;
+
+    if (nadata->queued > nadata->queue_max) {
+	l = gensio_list_last(&nadata->queue);
+	gensio_list_rm(&nadata->queue, l);
+	gensio_list_add_tail(shed, l);
+	nadata->queued--;
+	nadata->shed++;
+    }
+}
+
+/*
+ * Admission control for a new connection.  The user may give it a
+ * priority or refuse it with GENSIO_ACC_EVENT_ADMIT, then it is
+ * started if there is a free slot or queued.
+ */
+static void
+gensna_admit(struct gensna_data *nadata, struct gensio *child)
+{
+    struct gensio_acc_admit_data adm;
+    struct gensna_queued *q;
+    struct gensio_list shed;
+    int err;
+
+    gensio_list_init(&shed);
+
+    memset(&adm, 0, sizeof(adm));
+    adm.child = child;
+    err = gensio_acc_cb(nadata->acc, GENSIO_ACC_EVENT_ADMIT, &adm);
+    if (err && err != GE_NOTSUP) {
+	nadata->o->lock(nadata->lock);
+	nadata->shed++;
+	nadata->o->unlock(nadata->lock);
+	gensio_free(child);
+	return;
+    }
+
+    q = nadata->o->zalloc(nadata->o, sizeof(*q));
+    nadata->o->lock(nadata->lock);
+    gensna_queue_expire(nadata, &shed);
+    if (!nadata->queued && nadata->opening < nadata->max_opening) {
+	/* Room now, no need to queue. */
+	nadata->opening++;
+	nadata->admitted++;
+	nadata->o->unlock(nadata->lock);
+	if (q)
+	    nadata->o->free(nadata->o, q);
+	gensna_free_shed(nadata, &shed);
+	gensna_start_child(nadata, child);
+	return;
+    }
+    if (!q || !nadata->queue_max) {
+	nadata->shed++;
+	nadata->o->unlock(nadata->lock);
+	if (q)
+	    nadata->o->free(nadata->o, q);
+	gensio_free(child);
+	gensna_free_shed(nadata, &shed);
+	return;
+    }
+    q->child = child;
+    q->priority = adm.priority;
+    q->deadline = gensna_now(nadata) +
+	(int64_t) nadata->queue_time * 1000000LL;
+    gensna_enqueue(nadata, q, &shed);
+    nadata->o->unlock(nadata->lock);
+    gensna_free_shed(nadata, &shed);
+}
+
+static int
+gensna_child_event(struct gensio_accepter *accepter, void *user_data,
+		   int event, void *data)
+{
+    struct gensna_data *nadata = user_data;
+    bool limited;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return gensio_acc_cb(nadata->acc, event, data);
+
+    nadata->o->lock(nadata->lock);
+    limited = nadata->max_opening != 0;
+    if (!limited) {
+	nadata->opening++;
+	nadata->admitted++;
+    }
+    nadata->o->unlock(nadata->lock);
+
+    if (limited) {
+	gensna_admit(nadata, data);
+	return 0;
+    }
+    return gensna_start_child(nadata, data);
+}
+
 int
 gensio_gensio_accepter_alloc(struct gensio_accepter *child,
 			     struct gensio_os_funcs *o,
@@ -310,17 +638,35 @@ gensio_gensio_accepter_alloc(struct gensio_accepter *child,
 			     struct gensio_accepter **accepter)
 {
     struct gensna_data *nadata;
-    int rv;
+    int rv, ival = 0;
 
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
 	return GE_NOMEM;
 
     nadata->o = o;
+    gensio_list_init(&nadata->queue);
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock) {
+	o->free(o, nadata);
+	return GE_NOMEM;
+    }
+
+    gensio_get_default(o, typename, "max-opening", false, GENSIO_DEFAULT_INT,
+		       NULL, &ival);
+    nadata->max_opening = ival;
+    gensio_get_default(o, typename, "open-queue", false, GENSIO_DEFAULT_INT,
+		       NULL, &ival);
+    nadata->queue_max = ival;
+    gensio_get_default(o, typename, "open-queue-time", false,
+		       GENSIO_DEFAULT_INT, NULL, &ival);
+    nadata->queue_time = ival;
 
     rv = base_gensio_accepter_alloc(child, gensio_gensio_base_acc_op, nadata,
 				    o, typename, cb, user_data, accepter);
     if (rv) {
+	o->free_lock(nadata->lock);
 	o->free(o, nadata);
 	goto out;
     }
@@ -46,6 +46,14 @@ gensio_addr_to_str_all(const struct gensio_addr *addr,
     return addr->funcs->addr_to_str_all(addr, buf, pos, buflen);
 }
 
+unsigned int
+gensio_addr_hash(const struct gensio_addr *addr, bool use_port)
+{
+    if (!addr->funcs->addr_hash)
+	return 0;
+    return addr->funcs->addr_hash(addr, use_port);
+}
+
 struct gensio_addr *
 gensio_addr_dup(const struct gensio_addr *iaddr)
 {
@@ -36,6 +36,8 @@
 #include <gensio/gensio_addr.h>
 #include <gensio/gensio_err.h>
 #include <gensio/gensio_osops_addrinfo.h>
+#include <gensio/gensio_osops.h>
+#include "pthread_handler.h"
 
 /* For older systems that don't have this. */
 #ifndef AI_V4MAPPED
@@ -50,7 +52,25 @@ struct gensio_addr_addrinfo {
 #if HAVE_GCC_ATOMICS
     int *refcount;
 #endif
-    bool is_getaddrinfo; /* Allocated with getaddrinfo()? */
+    bool is_compact; /* Addrinfo chain is part of this allocation? */
+};
+
+/*
+ * Number of addrinfo entries in a recvfrom address, the source
+ * address plus room for the ifindex and the destination address.
+ */
+#define RECVFROM_NR_AI 3
+
+/*
+ * Addresses used for recvfrom are reused for every packet, and are
+ * only duplicated when something needs to keep them.  Keep the whole
+ * thing in a single allocation so setting up per-socket (or
+ * per-batch-slot) receive storage is one malloc, not seven.
+ */
+struct gensio_addr_addrinfo_recvfrom {
+    struct gensio_addr_addrinfo addr;
+    struct addrinfo ai[RECVFROM_NR_AI];
+    struct sockaddr_storage sa[RECVFROM_NR_AI];
 };
 
 static struct gensio_addr_funcs addrinfo_funcs;
@@ -83,13 +103,42 @@ gensio_addr_addrinfo_set(struct gensio_addr *aaddr,
     addr->curr = ai;
 }
 
+static struct gensio_addr_addrinfo *
+gensio_addrinfo_make_recvfrom(struct gensio_os_funcs *o, unsigned int size)
+{
+    struct gensio_addr_addrinfo_recvfrom *raddr;
+    unsigned int i;
+
+    raddr = o->zalloc(o, sizeof(*raddr));
+    if (!raddr)
+	return NULL;
+
+    for (i = 0; i < RECVFROM_NR_AI; i++) {
+	raddr->ai[i].ai_addr = (struct sockaddr *) &raddr->sa[i];
+	raddr->ai[i].ai_addrlen = size;
+	if (i + 1 < RECVFROM_NR_AI)
+	    raddr->ai[i].ai_next = &raddr->ai[i + 1];
+    }
+    raddr->addr.o = o;
+    raddr->addr.r.funcs = &addrinfo_funcs;
+    raddr->addr.a = raddr->ai;
+    raddr->addr.curr = raddr->ai;
+    raddr->addr.is_compact = true;
+
+    return &raddr->addr;
+}
+
 static struct gensio_addr_addrinfo *
 gensio_addrinfo_make(struct gensio_os_funcs *o, unsigned int size,
 		     bool is_recvfrom)
 {
-    struct gensio_addr_addrinfo *addr = o->zalloc(o, sizeof(*addr));
+    struct gensio_addr_addrinfo *addr;
     struct addrinfo *ai = NULL, *nai;
 
+    if (is_recvfrom && size > 0 && size <= sizeof(struct sockaddr_storage))
+	return gensio_addrinfo_make_recvfrom(o, size);
+
+    addr = o->zalloc(o, sizeof(*addr));
     if (!addr)
 	return NULL;
 
@@ -394,6 +443,75 @@ gensio_addr_addrinfo_equal(const struct gensio_addr *aa1,
     return true;
 }
 
+/* FNV-1a */
+static unsigned int
+hash_bytes(unsigned int hash, const void *data, size_t len)
+{
+    const unsigned char *d = data;
+
+    while (len--) {
+	hash ^= *d++;
+	hash *= 16777619;
+    }
+    return hash;
+}
+
+/* Must match sockaddr_equal(), including IPv4-mapped IPv6 addresses. */
+static unsigned int
+gensio_addr_addrinfo_hash(const struct gensio_addr *aaddr, bool use_port)
+{
+    struct gensio_addr_addrinfo *addr = a_to_info(aaddr);
+    const struct sockaddr *sa = addr->curr->ai_addr;
+    unsigned int hash = 2166136261U;
+    const void *port = NULL;
+
+    switch (sa->sa_family) {
+    case AF_INET:
+	{
+	    const struct sockaddr_in *s4 = (const struct sockaddr_in *) sa;
+
+	    hash = hash_bytes(hash, &s4->sin_addr.s_addr,
+			      sizeof(s4->sin_addr.s_addr));
+	    port = &s4->sin_port;
+	}
+	break;
+
+#ifdef AF_INET6
+    case AF_INET6:
+	{
+	    const struct sockaddr_in6 *s6 = (const struct sockaddr_in6 *) sa;
+
+	    if (IN6_IS_ADDR_V4MAPPED(&s6->sin6_addr))
+		hash = hash_bytes(hash,
+				  ((const uint32_t *) &s6->sin6_addr) + 3,
+				  sizeof(uint32_t));
+	    else
+		hash = hash_bytes(hash, s6->sin6_addr.s6_addr,
+				  sizeof(s6->sin6_addr.s6_addr));
+	    port = &s6->sin6_port;
+	}
+	break;
+#endif
+
+#if HAVE_UNIX
+    case AF_UNIX:
+	{
+	    const struct sockaddr_un *su = (const struct sockaddr_un *) sa;
+
+	    hash = hash_bytes(hash, su->sun_path, strlen(su->sun_path));
+	}
+	break;
+#endif
+
+    default:
+	return 0;
+    }
+
+    if (use_port && port)
+	hash = hash_bytes(hash, port, sizeof(uint16_t));
+    return hash;
+}
+
 static int
 gensio_sockaddr_to_str(const struct sockaddr *addr, int flags,
 		       char *buf, gensiods *pos, gensiods buflen)
@@ -622,29 +740,11 @@ gensio_addr_dedup(struct gensio_os_funcs *o,
     struct gensio_addr_addrinfo *addr = *iaddr;
     struct addrinfo *ai, *ai2, *pai;
 
- restart:
     for (ai = addr->a; ai; ai = ai->ai_next) {
 	for (ai2 = ai->ai_next, pai = ai; ai2; pai = ai2, ai2 = ai2->ai_next) {
 	    if (sockaddr_equal(ai->ai_addr, ai->ai_addrlen,
 			       ai2->ai_addr, ai2->ai_addrlen,
 			       true)) {
-		if (addr->is_getaddrinfo) {
-		    int err;
-
-		    /*
-		     * To delete the dup, we need to convert it into a
-		     * list not allocated by getaddrinfo so we can
-		     * modify it.
-		     */
-		    err = addrinfo_list_dup(o, addr->a, &ai, NULL);
-		    if (err)
-			return err;
-		    freeaddrinfo(addr->a);
-		    addr->is_getaddrinfo = false;
-		    addr->a = ai;
-		    addr->curr = ai;
-		    goto restart;
-		}
 		pai->ai_next = ai2->ai_next;
 		addrinfo_item_free(o, ai2);
 		ai2 = pai;
@@ -656,6 +756,212 @@ gensio_addr_dedup(struct gensio_os_funcs *o,
     return 0;
 }
 
+/*
+ * A cache of name lookups, shared by everything in the process, so
+ * things that reconnect over and over (keepopen, conacc) don't do a
+ * lookup, which may block for a while, each time.  getaddrinfo()
+ * doesn't give us the DNS TTL, so fixed times are used.  Names that
+ * don't exist are cached, too, for a shorter time.  Lookups for
+ * listening and with no name are never cached.
+ *
+ * Entries are allocated with malloc since they are not tied to any
+ * os funcs.  A lookup always gets its own copy of the list.
+ */
+#define ADDRINFO_CACHE_MAX	64
+
+struct addrinfo_cache_ent {
+    struct addrinfo_cache_ent *next;
+    char *host;
+    char *port;
+    int flags;
+    int family;
+    int socktype;
+    int protocol;
+    int rv; /* The getaddrinfo() return. */
+    struct addrinfo *ai; /* The getaddrinfo() result, NULL if rv != 0. */
+    gensio_time expires;
+};
+
+static lock_type addrinfo_cache_lock = LOCK_INITIALIZER;
+static struct addrinfo_cache_ent *addrinfo_cache;
+static unsigned int addrinfo_cache_len;
+static unsigned int addrinfo_cache_ttl = GENSIO_ADDR_CACHE_DEFAULT_TTL;
+static unsigned int addrinfo_cache_neg_ttl = GENSIO_ADDR_CACHE_DEFAULT_NEG_TTL;
+
+static void
+addrinfo_cache_ent_free(struct addrinfo_cache_ent *e)
+{
+    if (e->ai)
+	freeaddrinfo(e->ai);
+    free(e->host);
+    free(e->port);
+    free(e);
+}
+
+/* Call with the lock held. */
+static void
+addrinfo_cache_flush(void)
+{
+    struct addrinfo_cache_ent *e;
+
+    while (addrinfo_cache) {
+	e = addrinfo_cache;
+	addrinfo_cache = e->next;
+	addrinfo_cache_ent_free(e);
+    }
+    addrinfo_cache_len = 0;
+}
+
+void
+gensio_os_set_addr_cache(unsigned int ttl, unsigned int neg_ttl)
+{
+    LOCK(&addrinfo_cache_lock);
+    addrinfo_cache_ttl = ttl;
+    addrinfo_cache_neg_ttl = neg_ttl;
+    addrinfo_cache_flush();
+    UNLOCK(&addrinfo_cache_lock);
+}
+
+/*
+ * Find an entry, drop the expired ones along the way.  A found entry
+ * is moved to the front, so the last one is the least recently used.
+ * Call with the lock held.
+ */
+static struct addrinfo_cache_ent *
+addrinfo_cache_find(const char *host, const char *port,
+		    const struct addrinfo *hints, gensio_time *now)
+{
+    struct addrinfo_cache_ent *e, **pe = &addrinfo_cache;
+
+    while ((e = *pe)) {
+	if (gensio_time_cmp(&e->expires, now) <= 0) {
+	    *pe = e->next;
+	    addrinfo_cache_len--;
+	    addrinfo_cache_ent_free(e);
+	    continue;
+	}
+	if (e->flags == hints->ai_flags && e->family == hints->ai_family &&
+		e->socktype == hints->ai_socktype &&
+		e->protocol == hints->ai_protocol &&
+		strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) {
+	    *pe = e->next;
+	    e->next = addrinfo_cache;
+	    addrinfo_cache = e;
+	    return e;
+	}
+	pe = &e->next;
+    }
+    return NULL;
+}
+
+/*
+ * Add a lookup to the cache.  This takes over ai, it will be freed
+ * if it can't be added.  Call with the lock held.
+ */
+static void
+addrinfo_cache_add(const char *host, const char *port,
+		   const struct addrinfo *hints, int rv, struct addrinfo *ai,
+		   const gensio_time *now)
+{
+    struct addrinfo_cache_ent *e, **pe;
+    unsigned int ttl = rv ? addrinfo_cache_neg_ttl : addrinfo_cache_ttl;
+
+    if (ttl == 0)
+	goto out_free;
+
+    if (addrinfo_cache_len >= ADDRINFO_CACHE_MAX) {
+	/* Drop the least recently used. */
+	for (pe = &addrinfo_cache; (*pe)->next; pe = &(*pe)->next)
+	    ;
+	addrinfo_cache_ent_free(*pe);
+	*pe = NULL;
+	addrinfo_cache_len--;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e)
+	goto out_free;
+    e->host = strdup(host);
+    e->port = strdup(port);
+    if (!e->host || !e->port) {
+	addrinfo_cache_ent_free(e);
+	goto out_free;
+    }
+    e->flags = hints->ai_flags;
+    e->family = hints->ai_family;
+    e->socktype = hints->ai_socktype;
+    e->protocol = hints->ai_protocol;
+    e->rv = rv;
+    e->ai = ai;
+    e->expires.secs = now->secs + ttl;
+    e->expires.nsecs = now->nsecs;
+    e->next = addrinfo_cache;
+    addrinfo_cache = e;
+    addrinfo_cache_len++;
+    return;
+
+ out_free:
+    if (ai)
+	freeaddrinfo(ai);
+}
+
+/*
+ * getaddrinfo() through the cache.  Returns the same values as
+ * getaddrinfo(), but the returned list is allocated with o and must
+ * be freed with addrinfo_list_free().
+ */
+static int
+addrinfo_lookup(struct gensio_os_funcs *o, const char *host, const char *port,
+		const struct addrinfo *hints, struct addrinfo **rai)
+{
+    struct addrinfo_cache_ent *e;
+    struct addrinfo *ai = NULL;
+    gensio_time now;
+    bool use_cache = host && !(hints->ai_flags & AI_PASSIVE);
+    int rv, err = 0;
+
+    if (use_cache) {
+	o->get_monotonic_time(o, &now);
+	LOCK(&addrinfo_cache_lock);
+	e = addrinfo_cache_find(host, port, hints, &now);
+	if (e) {
+	    rv = e->rv;
+	    if (!rv)
+		err = addrinfo_list_dup(o, e->ai, rai, NULL);
+	    UNLOCK(&addrinfo_cache_lock);
+	    return err ? EAI_MEMORY : rv;
+	}
+	UNLOCK(&addrinfo_cache_lock);
+    }
+
+    rv = getaddrinfo(host, port, hints, &ai);
+    if (!rv)
+	err = addrinfo_list_dup(o, ai, rai, NULL);
+
+    switch (rv) {
+    case 0:
+#ifdef EAI_ADDRFAMILY
+    case EAI_ADDRFAMILY:
+#endif
+#ifdef EAI_NODATA
+    case EAI_NODATA:
+#endif
+    case EAI_NONAME:
+	if (use_cache) {
+	    /* Only cache real answers, not failures to get one. */
+	    LOCK(&addrinfo_cache_lock);
+	    addrinfo_cache_add(host, port, hints, rv, ai, &now);
+	    UNLOCK(&addrinfo_cache_lock);
+	    ai = NULL;
+	}
+	break;
+    }
+    if (ai)
+	freeaddrinfo(ai);
+
+    return err ? EAI_MEMORY : rv;
+}
+
 static int
 gensio_addr_addrinfo_scan_ips(struct gensio_os_funcs *o, const char *str,
 			      bool listen, int ifamily,
@@ -816,7 +1122,7 @@ gensio_addr_addrinfo_scan_ips(struct gensio_os_funcs *o, const char *str,
 	hints.ai_family = family;
 	hints.ai_socktype = socktype;
 	hints.ai_protocol = protocol;
-	rv = getaddrinfo(ip, port, &hints, &ai);
+	rv = addrinfo_lookup(o, ip, port, &hints, &ai);
 	if (rv) {
 #ifdef AF_INET6
 	    if (notype && family == AF_INET6) {
@@ -894,25 +1200,13 @@ gensio_addr_addrinfo_scan_ips(struct gensio_os_funcs *o, const char *str,
 	for (ai2 = ai; ai2; ai2 = ai2->ai_next)
 	    ai2->ai_flags = rflags;
 
-	if (!addr->a) {
+	if (!pai)
 	    addr->a = ai;
-	    ai = NULL;
-	    addr->is_getaddrinfo = true;
-	} else {
-	    if (!pai) {
-		rv = addrinfo_list_dup(o, addr->a, &ai2, &pai);
-		if (rv)
-		    goto out_err;
-		freeaddrinfo(addr->a);
-		addr->is_getaddrinfo = false;
-		addr->a = ai2;
-	    }
-	    rv = addrinfo_list_dup(o, ai, NULL, &pai);
-	    freeaddrinfo(ai);
-	    ai = NULL;
-	    if (rv)
-		goto out_err;
-	}
+	else
+	    pai->ai_next = ai;
+	for (pai = ai; pai->ai_next; pai = pai->ai_next)
+	    ;
+	ai = NULL;
 #ifdef AF_INET6
 	if (ip && notype && ifamily == AF_UNSPEC && family == AF_INET6) {
 	    /* See comments above on why this is done.  Yes, it's strange. */
@@ -941,7 +1235,7 @@ gensio_addr_addrinfo_scan_ips(struct gensio_os_funcs *o, const char *str,
 
  out_err:
     if (ai)
-	freeaddrinfo(ai);
+	addrinfo_list_free(o, ai);
     if (rv)
 	gensio_addr_addrinfo_free(&addr->r);
     o->free(o, strtok_buffer);
@@ -970,7 +1264,6 @@ gensio_addr_addrinfo_dup(const struct gensio_addr *iaaddr)
     if (iaddr->refcount) {
 	addr->refcount = iaddr->refcount;
 	addr->a = iaddr->a;
-	addr->is_getaddrinfo = iaddr->is_getaddrinfo;
 	__atomic_add_fetch(addr->refcount, 1, __ATOMIC_SEQ_CST);
     } else {
 #endif
@@ -1070,12 +1363,8 @@ gensio_addr_addrinfo_free(struct gensio_addr *aaddr)
 	o->free(o, addr->refcount);
     }
 #endif
-    if (addr->a) {
-	if (addr->is_getaddrinfo)
-	    freeaddrinfo(addr->a);
-	else
-	    addrinfo_list_free(o, addr->a);
-    }
+    if (addr->a && !addr->is_compact)
+	addrinfo_list_free(o, addr->a);
     o->free(o, addr);
 }
 
@@ -1148,7 +1437,8 @@ static struct gensio_addr_funcs addrinfo_funcs = {
     .addr_rewind = gensio_addr_addrinfo_rewind,
     .addr_get_nettype = gensio_addr_addrinfo_get_nettype,
     .addr_family_supports = gensio_addr_addrinfo_family_supports,
-    .addr_getaddr = gensio_addr_addrinfo_getaddr
+    .addr_getaddr = gensio_addr_addrinfo_getaddr,
+    .addr_hash = gensio_addr_addrinfo_hash
 };
 
 void
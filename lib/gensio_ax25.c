@@ -32,9 +32,10 @@
  *   byte 2 - The lower 8 bits of the maximum message size.
  *   byte 3 - Unused flags, should all be zero.
  *
- * This code does not currently send an SREJ.  That's pretty
- * complicated, but could be valuable in some situations.  This may be
- * added in the future.  It will handle a received SREJ.
+ * If extended2 is negotiated, out of order I frames that fit in the
+ * receive buffer are saved and an SREJ is sent for each missing
+ * frame, so a single loss doesn't cost the whole window.  Otherwise
+ * a REJ is sent as usual.  A received SREJ is always handled.
  *
  * Flow-control enable/disable is not done immediately, it is delayed
  * until an ack is sent.  That way momentary enable/disable operations
@@ -123,60 +124,13 @@
 #include <gensio/gensio_time.h>
 #include <gensio/gensio_acc_gensio.h>
 #include <gensio/gensio_ax25_addr.h>
+#include <gensio/gensio_crc16.h>
 
 #ifdef DEBUG_DATA
 #define ENABLE_PRBUF 1
 #include "utils.h"
 #endif
 
-/* See rfc1549 */
-static const unsigned short ccitt_table[256] = {
-   0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-   0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-   0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-   0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-   0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-   0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-   0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-   0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-   0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-   0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-   0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-   0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-   0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-   0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-   0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-   0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-   0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-   0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-   0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-   0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-   0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-   0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-   0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-   0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-   0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-   0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-   0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-   0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-   0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-   0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-   0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-   0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
-
-static void
-crc16_ccitt(const unsigned char *buf, unsigned int len, uint16_t *icrc)
-{
-	unsigned int i;
-	unsigned short crc = *icrc;
-
-	for (i = 0; i < len; i++)
-	    crc = (crc >> 8) ^ ccitt_table[(crc ^ buf[i]) & 0xff];
-
-	*icrc = crc;
-}
-
 enum x25_cmds {
     X25_SABME = 0x6f,
     X25_SABM = 0x2f,
@@ -193,7 +147,7 @@ enum x25_cmds {
     X25_RR = 0x01,
     X25_RNR = 0x05,
     X25_REJ = 0x09,
-    X25_SREJ = 0x0d /* Receive side implemented. */
+    X25_SREJ = 0x0d
 };
 
 enum ax25_base_state {
@@ -466,6 +420,7 @@ static void i_ax25_base_add_other(struct ax25_base *base,
 struct ax25_base_cmdrsp {
     unsigned char addr[AX25_ADDR_MAX_ENCODED_LEN];
     uint8_t addrlen;
+    uint8_t tnc_port;
     uint8_t cr;
     uint8_t crlen;
     uint8_t extra_data_size;
@@ -473,6 +428,9 @@ struct ax25_base_cmdrsp {
 };
 #define AX25_BASE_MAX_CMDRSP 16
 
+/* Number of buckets for looking up channels by address, power of 2. */
+#define AX25_ADDR_HASH_SIZE 64
+
 struct ax25_conf_data {
     gensiods max_read_size;
     gensiods max_write_size;
@@ -485,6 +443,7 @@ struct ax25_conf_data {
     unsigned int extended;
     bool do_crc;
     bool ignore_embedded_ua;
+    bool srej;
     struct gensio_ax25_subaddr *my_addrs;
     unsigned int num_my_addrs;
     struct gensio_addr *addr;
@@ -520,6 +479,12 @@ struct ax25_base {
     /* Channels in all other states, they can receive messages. */
     struct gensio_list chans;
 
+    /*
+     * Channels in chans or chans_waiting_open that have an address
+     * are also in here, hashlink element, for fast lookup.
+     */
+    struct gensio_list addr_hash[AX25_ADDR_HASH_SIZE];
+
     /*
      * If a channel has data to write, it will be in this, linksend element.
      */
@@ -553,11 +518,13 @@ struct ax25_data {
     uint8_t seq;
     uint8_t present;
     uint8_t pid;
+    uint8_t srej; /* Receive side, an SREJ has been sent for this frame. */
 };
 
 struct ax25_ui_data {
     struct gensio_link link;
     uint16_t len;
+    uint8_t tnc_port;
 };
 
 #define AX25_CHAN_MAX_CMDRSP_EXTRA	32
@@ -566,6 +533,7 @@ struct ax25_chan_cmdrsp {
     uint8_t pf;
     uint8_t is_cmd;
     uint8_t extra_data_size;
+    uint8_t nr; /* The frame requested by an SREJ. */
     unsigned char extra_data[AX25_CHAN_MAX_CMDRSP_EXTRA];
 };
 #define AX25_CHAN_MAX_CMDRSP 8
@@ -678,6 +646,9 @@ struct ax25_chan {
     /* Link for list of things waiting to write. */
     struct gensio_link sendlink;
 
+    /* Link for the base's address hash table. */
+    struct gensio_link hashlink;
+
     enum ax25_chan_state state;
 
     /*
@@ -696,10 +667,9 @@ struct ax25_chan {
     uint8_t ack_pending; /* Number of rcv packets that haven't been acked. */
     bool poll_pending; /* Timer recovery state. */
 
-    /*
-     * SREJ is not currently implemented on the send side, just the receive.
-     * uint8_t srej_count;
-     */
+    /* Number of SREJs sent and out of order frames saved. */
+    unsigned long srej_sent;
+    unsigned long srej_saved;
 
     struct ax25_conf_data conf;
 
@@ -1270,6 +1240,46 @@ ax25_base_child_close(struct ax25_base *base)
 	ax25_base_set_state(base, AX25_BASE_IN_CHILD_CLOSE);
 }
 
+/*
+ * Hash the fields that ax25 address comparison (with ports, without
+ * the digipeater path) uses.
+ */
+static unsigned int
+ax25_addr_hash(struct gensio_addr *addr)
+{
+    struct gensio_ax25_addr *a = addr_to_ax25(addr);
+    uint32_t h = 2166136261U;
+    unsigned int i;
+
+    h = (h ^ a->tnc_port) * 16777619U;
+    for (i = 0; a->dest.addr[i]; i++)
+	h = (h ^ (unsigned char) a->dest.addr[i]) * 16777619U;
+    h = (h ^ a->dest.ssid) * 16777619U;
+    for (i = 0; a->src.addr[i]; i++)
+	h = (h ^ (unsigned char) a->src.addr[i]) * 16777619U;
+    h = (h ^ a->src.ssid) * 16777619U;
+
+    return (h ^ (h >> 16)) & (AX25_ADDR_HASH_SIZE - 1);
+}
+
+/* Must hold the base lock to call this. */
+static void
+ax25_base_hash_chan(struct ax25_base *base, struct ax25_chan *chan)
+{
+    if (!chan->conf.addr || gensio_list_link_inlist(&chan->hashlink))
+	return;
+    gensio_list_add_tail(&base->addr_hash[ax25_addr_hash(chan->conf.addr)],
+			 &chan->hashlink);
+}
+
+/* Must hold the base lock to call this. */
+static void
+ax25_base_unhash_chan(struct ax25_chan *chan)
+{
+    if (gensio_list_link_inlist(&chan->hashlink))
+	gensio_list_rm(chan->hashlink.list, &chan->hashlink);
+}
+
 static void
 ax25_chan_move_to_closed(struct ax25_chan *chan, struct gensio_list *old_list)
 {
@@ -1278,6 +1288,7 @@ ax25_chan_move_to_closed(struct ax25_chan *chan, struct gensio_list *old_list)
     ax25_stop_timer(chan);
     ax25_base_lock_and_ref(base);
     gensio_list_rm(old_list, &chan->link);
+    ax25_base_unhash_chan(chan);
     gensio_list_add_tail(&base->chans_closed, &chan->link);
     if (base->state == AX25_BASE_OPEN) {
 	if (gensio_list_empty(&base->chans)) {
@@ -1506,24 +1517,21 @@ ax25_chan_sched_deferred_op(struct ax25_chan *chan)
     }
 }
 
-/* Must hold the base lock to call this. */
+/*
+ * Must hold the base lock to call this.  Only finds channels in
+ * chans or chans_waiting_open, since those are the only ones hashed.
+ */
 static struct ax25_chan *
 ax25_base_lookup_chan_by_addr(struct ax25_base *base, struct gensio_addr *addr)
 {
+    struct gensio_list *list = &base->addr_hash[ax25_addr_hash(addr)];
     struct gensio_link *l;
 
-    gensio_list_for_each(&base->chans, l) {
-	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan, link);
-
-	if (chan->conf.addr &&
-		gensio_addr_equal(addr, chan->conf.addr, true, false))
-	    return chan;
-    }
-    gensio_list_for_each(&base->chans_waiting_open, l) {
-	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan, link);
+    gensio_list_for_each(list, l) {
+	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan,
+						     hashlink);
 
-	if (chan->conf.addr &&
-		gensio_addr_equal(addr, chan->conf.addr, true, false))
+	if (gensio_addr_equal(addr, chan->conf.addr, true, false))
 	    return chan;
     }
     return NULL;
@@ -1709,6 +1717,8 @@ static void
 ax25_proto_err(struct ax25_base *base, struct ax25_chan *chan,
 	       const char *errstr)
 {
+    if (!gensio_log_enabled(base->o, GENSIO_LOG_ERR))
+	return;
     if (chan && chan->conf.addr) {
 	char addrstr[100] = "<none>", subaddrstr[10] = "<none>";
 
@@ -1727,6 +1737,8 @@ ax25_proto_err(struct ax25_base *base, struct ax25_chan *chan,
 static void
 ax25_chan_reset_data(struct ax25_chan *chan)
 {
+    unsigned int i;
+
     chan->vs = 0;
     chan->va = 0;
     chan->vr = 0;
@@ -1743,6 +1755,10 @@ ax25_chan_reset_data(struct ax25_chan *chan)
     chan->ack_pending = 0;
     chan->poll_pending = false;
     chan->retry_count = 0;
+    for (i = 0; chan->read_data && i < chan->conf.readwindow; i++) {
+	chan->read_data[i].present = false;
+	chan->read_data[i].srej = 0;
+    }
     chan->srt = chan->conf.srtv;
     if (chan->conf.addr) {
 	struct gensio_ax25_addr *aaddr = addr_to_ax25(chan->conf.addr);
@@ -1796,6 +1812,7 @@ ax25_base_send_rsp(struct ax25_base *base, struct gensio_addr *addr,
 	cr = &(base->cmdrsp[pos]);
 	cr->cr = rsp | (pf << 4);
 	cr->addrlen = ax25_addr_encode(cr->addr, addr);
+	cr->tnc_port = addr_to_ax25(addr)->tnc_port;
 	/* Set C/R bits to response. */
 	cr->addr[6] &= ~0x80;
 	cr->addr[13] |= 0x80;
@@ -1844,6 +1861,32 @@ ax25_chan_send_rsp(struct ax25_chan *chan, uint8_t rsp, uint8_t pf)
     ax25_chan_send_cr(chan, rsp, pf, false, NULL, 0);
 }
 
+/* Returns false if the SREJ could not be queued. */
+static bool
+ax25_chan_send_srej(struct ax25_chan *chan, uint8_t nr)
+{
+    struct ax25_base *base = chan->base;
+    struct ax25_chan_cmdrsp *cr;
+    unsigned int pos;
+    bool rv = false;
+
+    ax25_base_lock(base);
+    if (chan->cmdrsp_len < AX25_CHAN_MAX_CMDRSP) {
+	pos = (chan->cmdrsp_pos + chan->cmdrsp_len) % AX25_CHAN_MAX_CMDRSP;
+	cr = &(chan->cmdrsp[pos]);
+	cr->cr = X25_SREJ;
+	cr->pf = 0;
+	cr->is_cmd = false;
+	cr->extra_data_size = 0;
+	cr->nr = nr;
+	chan->cmdrsp_len++;
+	i_ax25_chan_schedule_write(chan);
+	rv = true;
+    }
+    ax25_base_unlock(base);
+    return rv;
+}
+
 static void
 ax25_chan_send_sabm(struct ax25_chan *chan)
 {
@@ -1923,7 +1966,7 @@ ax25_get_abs_timeout(struct gensio_os_funcs *o, unsigned int val,
 {
     int64_t v;
 
-    o->get_monotonic_time(o, now);
+    gensio_os_funcs_get_loop_time(o, now);
     v = gensio_time_to_msecs(now);
     v += val;
     return v;
@@ -1996,7 +2039,7 @@ ax25_chan_recalc_t1(struct ax25_chan *chan, bool t1_expiry)
     int64_t diff;
 
     /* Calculate how much time is left on t1. */
-    o->get_monotonic_time(o, &now);
+    gensio_os_funcs_get_loop_time(o, &now);
     diff = gensio_time_to_msecs(&now);
     diff = chan->t1 - diff;
     if (diff < 0)
@@ -2124,7 +2167,7 @@ ax25_chan_timeout(struct gensio_timer *timer, void *cb_data)
     gensio_time t;
     int64_t now;
 
-    o->get_monotonic_time(o, &t);
+    gensio_os_funcs_get_loop_time(o, &t);
     now = gensio_time_to_msecs(&t);
 
     ax25_chan_lock(chan);
@@ -2457,6 +2500,9 @@ ax25_chan_handle_sabm(struct ax25_base *base, struct ax25_chan *chan,
 		ax25_chan_report_open(chan);
 		return NULL;
 	    }
+	    ax25_base_lock(base);
+	    ax25_base_hash_chan(base, chan);
+	    ax25_base_unlock(base);
 	    chan->encoded_addr_len = ax25_addr_encode(chan->encoded_addr,
 						      chan->conf.addr);
 	    ax25_chan_set_extended(chan, extended, data, len);
@@ -2946,13 +2992,70 @@ ax25_chan_seq_in_range(struct ax25_chan *chan, uint8_t nr)
     return true;
 }
 
+/*
+ * Return the receive buffer slot for sequence ns, or NULL if it is
+ * outside the window or there's no room to hold it yet.
+ */
+static struct ax25_data *
+ax25_chan_rcv_slot(struct ax25_chan *chan, uint8_t ns)
+{
+    uint8_t k = sub_seq(ns, chan->vr, chan->modulo);
+
+    if (k >= chan->readwindow ||
+		chan->read_len + k >= chan->conf.readwindow)
+	return NULL;
+    return &(chan->read_data[add_seq(chan->read_pos, chan->read_len + k,
+				     chan->conf.readwindow)]);
+}
+
+/* Should an SREJ for nr still be sent? */
+static bool
+ax25_chan_srej_needed(struct ax25_chan *chan, uint8_t nr)
+{
+    struct ax25_data *d = ax25_chan_rcv_slot(chan, nr);
+
+    return d && !d->present;
+}
+
+/*
+ * Save an out of order frame and request everything missing before
+ * it.
+ */
+static void
+ax25_chan_save_ooo(struct ax25_chan *chan, struct ax25_data *d, uint8_t ns,
+		   uint8_t pid, unsigned char *data, unsigned int len)
+{
+    uint8_t seq;
+
+    if (!d->present) {
+	memcpy(d->data, data, len);
+	d->pid = pid;
+	d->len = len;
+	d->pos = 0;
+	d->seq = ns;
+	d->present = true;
+	d->srej = 0;
+	chan->srej_saved++;
+    }
+
+    for (seq = chan->vr; seq != ns; seq = add_seq(seq, 1, chan->modulo)) {
+	d = ax25_chan_rcv_slot(chan, seq);
+	if (d->present || d->srej)
+	    continue;
+	if (!ax25_chan_send_srej(chan, seq))
+	    break; /* Queue full, T1 recovery will handle the rest. */
+	d->srej = 1;
+	chan->srej_sent++;
+    }
+}
+
 static int
 ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
 		      unsigned char *data, unsigned int len)
 {
     uint8_t pos = add_seq(chan->read_pos, chan->read_len, chan->conf.readwindow);
     struct ax25_data *d;
-    uint8_t pid;
+    uint8_t pid, nfilled = 0;
 
     if (chan->own_rcv_bsy) {
 	if (pf)
@@ -2983,15 +3086,28 @@ ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
 	d->pos = 0;
 	d->seq = ns;
 	d->present = true;
-	chan->read_len++;
+	d->srej = 0;
+
+	/* Pull in any following frames saved while waiting on an SREJ. */
+	do {
+	    chan->read_len++;
+	    chan->vr = add_seq(chan->vr, 1, chan->modulo);
+	    pos = add_seq(pos, 1, chan->conf.readwindow);
+	    d = &(chan->read_data[pos]);
+	    nfilled++;
+	} while (chan->read_len < chan->conf.readwindow &&
+		 d->present && d->seq == chan->vr);
 	ax25_chan_deliver_read(chan);
-	chan->vr = add_seq(chan->vr, 1, chan->modulo);
 
 	/* We got some data, handle acks. */
 	if (pf) {
 	    ax25_chan_send_ack(chan, pf, false);
-	} else if (chan->ack_pending > (chan->readwindow / 2)) {
-	    /* More than half the window is used, send an ack now. */
+	} else if (nfilled > 1 ||
+		   chan->ack_pending > (chan->readwindow / 2)) {
+	    /*
+	     * A gap was filled or more than half the window is used,
+	     * send an ack now.
+	     */
 	    ax25_chan_send_ack(chan, 0, false);
 	} else {
 	    if (!chan->ack_pending)
@@ -3007,7 +3123,12 @@ ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
 	 * everything else.
 	 */
 	if (seq_in_range(chan->vr, end, ns, chan->modulo)) {
-	    if (chan->in_rej) {
+	    if (chan->extended == 2 && chan->conf.srej &&
+			(d = ax25_chan_rcv_slot(chan, ns))) {
+		ax25_chan_save_ooo(chan, d, ns, pid, data, len);
+		if (pf)
+		    ax25_chan_send_ack(chan, pf, false);
+	    } else if (chan->in_rej) {
 		if (pf)
 		    ax25_chan_send_ack(chan, pf, false);
 	    } else {
@@ -3454,7 +3575,7 @@ ax25_child_read(struct ax25_base *base, int ierr,
 	    return 0;
 	msgcrc = (buf[buflen - 1] << 8) | buf[buflen - 2];
 	crc = 0xffff;
-	crc16_ccitt(buf, buflen - 2, &crc);
+	gensio_crc16_ccitt(buf, buflen - 2, &crc);
 	crc ^= 0xffff;
 	if (msgcrc != crc)
 	    return 0;
@@ -3636,10 +3757,8 @@ static void
 crc16_sg(const struct gensio_sg *sg, gensiods sglen, unsigned char *outcrc)
 {
     uint16_t crc = 0xffff;
-    gensiods i;
 
-    for (i = 0; i < sglen; i++)
-	crc16_ccitt(sg[i].buf, sg[i].buflen, &crc);
+    gensio_crc16_ccitt_sg(sg, sglen, &crc);
     crc ^= 0xffff;
     outcrc[0] = crc & 0xff;
     outcrc[1] = (crc >> 8) & 0xff;
@@ -3662,6 +3781,31 @@ ax25_chan_in_writable_state(struct ax25_chan *chan)
     }
 }
 
+/*
+ * A KISS child takes the TNC port to send on in the auxdata.  Don't
+ * pass anything for port 0 so children that don't know about ports
+ * still work.
+ */
+#define AX25_PORT_AUXDATA_LEN 10
+static const char *const *
+ax25_port_auxdata(uint8_t port, char *buf, const char **auxdata)
+{
+    if (!port)
+	return NULL;
+    snprintf(buf, AX25_PORT_AUXDATA_LEN, "tnc:%u", port);
+    auxdata[0] = buf;
+    auxdata[1] = NULL;
+    return auxdata;
+}
+
+static uint8_t
+ax25_chan_port(struct ax25_chan *chan)
+{
+    if (!chan->conf.addr)
+	return 0;
+    return addr_to_ax25(chan->conf.addr)->tnc_port;
+}
+
 static int
 ax25_child_write_ready(struct ax25_base *base)
 {
@@ -3674,6 +3818,8 @@ ax25_child_write_ready(struct ax25_base *base)
     unsigned char crv[3], crc[2], xid[AX25_XID_SIZE];
     struct gensio_sg sg[4];
     gensiods sglen, len, sendcnt;
+    char portstr[AX25_PORT_AUXDATA_LEN];
+    const char *portaux[2];
     int rv;
 
     ax25_base_lock_and_ref(base);
@@ -3706,7 +3852,7 @@ ax25_child_write_ready(struct ax25_base *base)
 	    len = sg[0].buflen;
 	    sg[1].buf = crv;
 	    if ((ccr->cr & 0x3) == 0x1) {
-		uint8_t cmd = ccr->cr;
+		uint8_t cmd = ccr->cr, nr;
 
 		/*
 		 * Wait until the last possible moment to decide to
@@ -3720,14 +3866,22 @@ ax25_child_write_ready(struct ax25_base *base)
 		 */
 		else if (ccr->cr == X25_REJ && !chan->in_rej)
 		    goto skip_cmdrsp;
+		/* Same for an SREJ if the frame has shown up. */
+		else if (ccr->cr == X25_SREJ &&
+			 !ax25_chan_srej_needed(chan, ccr->nr))
+		    goto skip_cmdrsp;
 
-		/* Supervisory message, put ack value into it. */
+		/*
+		 * Supervisory message, put ack value into it, or the
+		 * requested frame for SREJ.
+		 */
+		nr = ccr->cr == X25_SREJ ? ccr->nr : chan->vr;
 		if (chan->extended) {
 		    crv[0] = cmd;
-		    crv[1] = (chan->vr << 1) | ccr->pf;
+		    crv[1] = (nr << 1) | ccr->pf;
 		    sg[1].buflen = 2;
 		} else {
-		    crv[0] = (chan->vr << 5) | (ccr->pf << 4) | cmd;
+		    crv[0] = (nr << 5) | (ccr->pf << 4) | cmd;
 		    sg[1].buflen = 1;
 		}
 	    } else {
@@ -3757,7 +3911,9 @@ ax25_child_write_ready(struct ax25_base *base)
 		sglen++;
 		len += 2;
 	    }
-	    rv = gensio_write_sg(base->child, &sendcnt, sg, sglen, NULL);
+	    rv = gensio_write_sg(base->child, &sendcnt, sg, sglen,
+				 ax25_port_auxdata(ax25_chan_port(chan),
+						   portstr, portaux));
 	    if (rv)
 		goto out_err_chan;
 	    if (sendcnt == 0)
@@ -3832,7 +3988,9 @@ ax25_child_write_ready(struct ax25_base *base)
 		chan->curr_drop = 0;
 		sendcnt = len;
 	    } else {
-		rv = gensio_write_sg(base->child, &sendcnt, sg, sglen, NULL);
+		rv = gensio_write_sg(base->child, &sendcnt, sg, sglen,
+				     ax25_port_auxdata(ax25_chan_port(chan),
+						       portstr, portaux));
 		chan->curr_drop++;
 	    }
 	    if (rv)
@@ -3862,7 +4020,9 @@ ax25_child_write_ready(struct ax25_base *base)
 	    l = gensio_list_first(&chan->uis);
 	    ui = gensio_container_of(l, struct ax25_ui_data, link);
 	    buf = ((unsigned char *) ui) + sizeof(*ui);
-	    rv = gensio_write(base->child, &sendcnt, buf, ui->len, NULL);
+	    rv = gensio_write(base->child, &sendcnt, buf, ui->len,
+			      ax25_port_auxdata(ui->tnc_port,
+						portstr, portaux));
 	    if (rv)
 		goto out_err_chan;
 	    if (sendcnt == 0)
@@ -3909,7 +4069,8 @@ ax25_child_write_ready(struct ax25_base *base)
 	    sglen++;
 	    len += 2;
 	}
-	rv = gensio_write_sg(base->child, &sendcnt, sg, sglen, NULL);
+	rv = gensio_write_sg(base->child, &sendcnt, sg, sglen,
+			     ax25_port_auxdata(bcr->tnc_port, portstr, portaux));
 	if (rv)
 	    goto out_err_base;
 	if (sendcnt == 0)
@@ -3983,7 +4144,7 @@ ax25_add_crc(unsigned char *buf, gensiods len)
 {
     uint16_t crc = 0xffff;
 
-    crc16_ccitt(buf, len, &crc);
+    gensio_crc16_ccitt(buf, len, &crc);
     crc ^= 0xffff;
     buf[len++] = crc & 0xff;
     buf[len++] = (crc >> 8) & 0xff;
@@ -4024,6 +4185,7 @@ ax25_chan_send_ui(struct ax25_chan *chan, struct gensio_addr *addr,
     if (chan->base->conf.do_crc)
 	pos = ax25_add_crc(buf, pos);
     ui->len = pos;
+    ui->tnc_port = addr_to_ax25(addr)->tnc_port;
 
     ax25_base_lock(chan->base);
     gensio_list_add_tail(&chan->uis, &ui->link);
@@ -4166,6 +4328,7 @@ i_ax25_chan_open(struct ax25_chan *chan,
 	ax25_chan_set_stateb(chan, AX25_CHAN_WAITING_OPEN);
 	gensio_list_rm(&base->chans_closed, &chan->link);
 	gensio_list_add_tail(&base->chans_waiting_open, &chan->link);
+	ax25_base_hash_chan(base, chan);
 	break;
 
     case AX25_BASE_CLOSED:
@@ -4177,11 +4340,13 @@ i_ax25_chan_open(struct ax25_chan *chan,
 	ax25_chan_set_stateb(chan, AX25_CHAN_WAITING_OPEN);
 	gensio_list_rm(&base->chans_closed, &chan->link);
 	gensio_list_add_tail(&base->chans_waiting_open, &chan->link);
+	ax25_base_hash_chan(base, chan);
 	break;
 
     case AX25_BASE_OPEN:
 	gensio_list_rm(&base->chans_closed, &chan->link);
 	gensio_list_add_tail(&base->chans, &chan->link);
+	ax25_base_hash_chan(base, chan);
 	ax25_chan_prestart_connect(chan);
 	ax25_base_unlock(base);
 	ax25_chan_start_connect(chan);
@@ -4479,6 +4644,13 @@ ax25_chan_control(struct ax25_chan *chan, bool get, int option,
 	gensio_addr_getaddr(chan->conf.addr, data, datalen);
 	break;
 
+    case GENSIO_CONTROL_AX25_INFO:
+	if (!get)
+	    return GE_NOTSUP;
+	*datalen = snprintf(data, *datalen, "srej_sent=%lu srej_saved=%lu",
+			    chan->srej_sent, chan->srej_saved);
+	break;
+
     default:
 	rv = GE_NOTSUP;
 	break;
@@ -4620,6 +4792,8 @@ ax25_readconf(struct gensio_os_funcs *o, bool firstchan, bool noaddr,
 	if (gensio_check_keybool(args[i], "ign_emb_ua",
 				 &conf->ignore_embedded_ua))
 	    continue;
+	if (gensio_check_keybool(args[i], "srej", &conf->srej) > 0)
+	    continue;
 	if (gensio_check_keyuint(args[i], "srt", &conf->srtv) > 0)
 	    continue;
 	if (gensio_check_keyuint(args[i], "t2", &conf->t2v) > 0)
@@ -4662,6 +4836,7 @@ ax25_defconf(struct ax25_conf_data *conf)
     conf->writewindow = 7;
     conf->extended = 1;
     conf->ignore_embedded_ua = true;
+    conf->srej = true;
     conf->srtv = 4000; /* 4 seconds (t1 is 8 seconds). */
     conf->t2v = 2000; /* 2 seconds. */
     conf->t3v = 300000; /* 300 seconds. */
@@ -4776,6 +4951,8 @@ ax25_chan_alloc(struct ax25_base *base, const char *const args[],
 	gensio_list_add_tail(&base->chans_closed, &chan->link);
     else
 	gensio_list_add_tail(&base->chans, &chan->link);
+    if (start_state != AX25_CHAN_CLOSED)
+	ax25_base_hash_chan(base, chan);
     ax25_base_unlock(base);
 
     *rchan = chan;
@@ -4803,7 +4980,7 @@ ax25_gensio_alloc_base(struct gensio *child, const char *const args[],
     struct ax25_base *base;
     struct ax25_chan *chan;
     struct gensio_ax25_subaddr *my_addrs = NULL;
-    unsigned int num_my_addrs = 0;
+    unsigned int num_my_addrs = 0, i;
 
     base = o->zalloc(o, sizeof(*base));
     if (!base)
@@ -4815,6 +4992,8 @@ ax25_gensio_alloc_base(struct gensio *child, const char *const args[],
     gensio_list_init(&base->chans_waiting_open);
     gensio_list_init(&base->chans_closed);
     gensio_list_init(&base->send_list);
+    for (i = 0; i < AX25_ADDR_HASH_SIZE; i++)
+	gensio_list_init(&base->addr_hash[i]);
     base->refcount = 1;
     base->conf = *conf;
     if (conf->my_addrs) {
@@ -17,6 +17,8 @@
 #include <gensio/gensio_base.h>
 #include <gensio/gensio_os_funcs.h>
 
+#include "gensio_probes.h"
+
 #ifdef DEBUG_DATA
 #define ENABLE_PRBUF 1
 #include "utils.h"
@@ -144,32 +146,125 @@ static void i_basen_add_trace(struct basen_data *ndata,
 #define i_basen_add_trace(ndata, new_state, line)
 #endif
 
-struct basen_data {
-    struct gensio *io;
-    struct gensio *child;
+/*
+ * Latency instrumentation, see GENSIO_CONTROL_LATENCY.  Each metric
+ * is a histogram with power of two nanosecond buckets, bucket n
+ * holds values from 2^n up to 2^(n+1).
+ */
+enum basen_lat_metric {
+    BASEN_LAT_WR_TOTAL,		/* basen_write() entry to return. */
+    BASEN_LAT_WR_PROC,		/* basen_write() entry to the ll write. */
+    BASEN_LAT_WR_LL,		/* Time in the ll write. */
+    BASEN_LAT_WR_QUEUE,		/* Write data held in this layer. */
+    BASEN_LAT_RD_PROC,		/* ll read to the user callback. */
+    BASEN_LAT_RD_QUEUE,		/* Read data held in this layer. */
+    BASEN_LAT_RD_USER,		/* Time in the user read callback. */
+    BASEN_LAT_RD_GAP,		/* Between new data from the ll. */
+    BASEN_LAT_NR
+};
 
-    struct gensio_os_funcs *o;
-    struct gensio_filter *filter;
-    struct gensio_ll *ll;
+static const char *basen_lat_names[BASEN_LAT_NR] = {
+    "wr_total", "wr_proc", "wr_ll", "wr_queue",
+    "rd_proc", "rd_queue", "rd_user", "rd_gap"
+};
 
-    struct gensio_lock *lock;
-    struct gensio_timer *timer;
-    bool timer_start_pending;
-    gensio_time pending_timer;
+#define BASEN_LAT_BUCKETS 48
 
-    unsigned int refcount;
+struct basen_lat_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[BASEN_LAT_BUCKETS];
+};
 
-    enum basen_state state;
+/*
+ * The write side times are protected by write_lock, the read side by
+ * lock.  A time of zero means not set.
+ */
+struct basen_latency {
+    struct basen_lat_hist h[BASEN_LAT_NR];
+    int64_t wr_entry;		/* In basen_write(), and not to the ll yet. */
+    int64_t wr_queued;		/* Oldest write data held in this layer. */
+    int64_t rd_arrive;		/* In basen_ll_read(), when it was called. */
+    int64_t rd_queued;		/* Oldest read data held in this layer. */
+    int64_t rd_last;		/* When new data last came from the ll. */
+    bool rd_more;		/* The ll still has data we didn't take. */
+};
+
+/*
+ * Things only used for open, close, timers and setup.  These are kept
+ * at the end of struct basen_data, out of the cache lines the read and
+ * write paths touch.
+ */
+struct basen_cold {
+    struct gensio *child;
 
     gensio_done_err open_done;
     void *open_data;
 
+    /*
+     * Transfer data to the deferred open.
+     */
+    int open_err;
+
     gensio_done close_done;
     void *close_data;
-    bool close_requested;
-    bool ll_want_close;
+
+    struct gensio_timer *timer;
+    bool timer_start_pending;
+    gensio_time pending_timer;
+
+    /*
+     * Used to run user callbacks from the selector to avoid running
+     * it directly from user calls.
+     */
+    struct gensio_runner *deferred_op_runner;
+
+    /* See cork_buf and rbuf. */
+    gensio_time cork_timeout;
+    struct gensio_timer *cork_timer;
+    gensio_time read_max_delay;
+    struct gensio_timer *read_timer;
+
+    /* See rinto_done. */
+    struct gensio_sg rinto_sg[GENSIO_LL_READ_INTO_MAX_SG];
+    gensiods rinto_sglen;
+    void *rinto_data;
+
+    /* Don't merge this into a parent, see base_gensio_set_no_fuse(). */
+    bool no_fuse;
+
+#ifdef DEBUG_STATE
+    /* Allocated separately, it's big. */
+    struct basen_state_trace *state_trace;
+    unsigned int state_trace_pos;
+#endif
+};
+
+/*
+ * The fields used on every read and write come first so they share as
+ * few cache lines as possible, with the flags together.  The flags
+ * stay separate bools, not bitfields, as some are protected by
+ * write_lock and the rest by lock.
+ */
+struct basen_data {
+    struct gensio_lock *lock;
+    struct gensio_os_funcs *o;
+    struct gensio *io;
+    struct gensio_filter *filter;
+    struct gensio_ll *ll;
+
+    enum basen_state state;
+    unsigned int refcount;
     unsigned int in_write_count;
 
+    /*
+     * We got an error from the lower layer, it's probably not working
+     * any more.
+     */
+    int ll_err;
+
     bool read_enabled;
     bool in_read;
 
@@ -178,39 +273,97 @@ struct basen_data {
     bool redo_xmit_ready;
     bool ll_can_write;
 
-    /*
-     * We got an error from the lower layer, it's probably not working
-     * any more.
-     */
-    int ll_err;
-
-    /*
-     * Transfer data to the deferred open.
-     */
-    int open_err;
+    bool close_requested;
+    bool ll_want_close;
 
     /*
-     * Used to run user callbacks from the selector to avoid running
-     * it directly from user calls.
+     * deferred_op_pending is set while the deferred op runner is
+     * scheduled.  sched_inline is set while an os or ll callback,
+     * with no user callback running on its stack, holds the lock.
+     * basen_sched_deferred_op() then just sets deferred_op_inline and
+     * the callback runs the ops itself, skipping the runner.
      */
     bool deferred_op_pending;
-    struct gensio_runner *deferred_op_runner;
+    bool sched_inline;
+    bool deferred_op_inline;
 
     bool deferred_read;
     bool deferred_write;
     bool deferred_open;
     bool deferred_close;
 
-#ifdef DEBUG_STATE
-    struct basen_state_trace state_trace[STATE_TRACE_LEN];
-    unsigned int state_trace_pos;
-#endif
+    bool cork_timer_running;
+    bool rbuf_ready;
+    bool read_idle;
+    bool read_timer_running;
+    bool rinto_ll;
+
+    /*
+     * Serializes writes to the lower layer.  Without a filter or
+     * corking, basen_write() holds only this across the ll write so
+     * reads are not held up by writes.  Take it after lock, never the
+     * other way around.  write_unlocked is set while that is going
+     * on, and write_blocked then records a short write so it can be
+     * applied to ll_can_write once lock is held again.
+     */
+    struct gensio_lock *write_lock;
+    bool write_unlocked;
+    bool write_blocked;
+
+    /*
+     * Counters for GENSIO_CONTROL_STATS.  tx_blocked_since is the
+     * monotonic time in nanoseconds the lower layer last took a
+     * short write, zero if it is not blocked.
+     */
+    struct gensio_stats *stats;
+    int64_t tx_blocked_since;
+
+    /*
+     * Latency histograms, NULL unless turned on with
+     * GENSIO_CONTROL_LATENCY.  Changing this takes lock and
+     * write_lock.
+     */
+    struct basen_latency *lat;
+
+    /*
+     * Write coalescing, see GENSIO_CONTROL_CORK.  While open, small
+     * writes out of the filter are gathered in cork_buf and written
+     * to the ll when it fills, when cork_timeout passes, or on a
+     * flush.
+     */
+    unsigned char *cork_buf;
+    gensiods cork_size;
+    gensiods cork_len;
+
+    /*
+     * Read coalescing, see GENSIO_CONTROL_READ_LOWAT.  Read data is
+     * held in rbuf until there are read_lowat bytes or
+     * read_max_delay passes (rbuf_ready is then set), then it is
+     * delivered in one callback.  With read_idle set, data that
+     * arrives after read_max_delay with nothing delivered (so
+     * interactive echo) goes straight up, read_quiet_at is the
+     * monotonic nsec time that happens.
+     */
+    unsigned char *rbuf;
+    gensiods read_lowat;
+    gensiods rbuf_len;
+    int64_t read_quiet_at;
+
+    /*
+     * A read posted with gensio_read_into().  If rinto_ll is set the
+     * ll took it and will complete it, otherwise read data is copied
+     * into it in place of the read callback.
+     */
+    gensio_read_done rinto_done;
+
+    struct basen_cold cold;
 };
 
 struct gensio_ll {
     struct gensio_os_funcs *o;
     struct basen_data  *ndata;
     gensio_ll_func func;
+    const struct gensio_ll_ops *ops;
     void *user_data;
 };
 
@@ -218,6 +371,7 @@ struct gensio_filter {
     struct gensio_os_funcs *o;
     struct basen_data  *ndata;
     gensio_filter_func func;
+    const struct gensio_filter_ops *ops;
     void *user_data;
 };
 
@@ -246,6 +400,18 @@ i_basen_unlock(struct basen_data *ndata)
 	i_basen_unlock((ndata));					\
     } while(false)
 
+static void
+basen_write_lock(struct basen_data *ndata)
+{
+    ndata->o->lock(ndata->write_lock);
+}
+
+static void
+basen_write_unlock(struct basen_data *ndata)
+{
+    ndata->o->unlock(ndata->write_lock);
+}
+
 static void
 basen_finish_free(struct basen_data *ndata)
 {
@@ -253,10 +419,26 @@ basen_finish_free(struct basen_data *ndata)
 	gensio_data_free(ndata->io);
     if (ndata->lock)
 	ndata->o->free_lock(ndata->lock);
-    if (ndata->timer)
-	ndata->o->free_timer(ndata->timer);
-    if (ndata->deferred_op_runner)
-	ndata->o->free_runner(ndata->deferred_op_runner);
+    if (ndata->write_lock)
+	ndata->o->free_lock(ndata->write_lock);
+    if (ndata->cold.timer)
+	ndata->o->free_timer(ndata->cold.timer);
+    if (ndata->cold.cork_timer)
+	ndata->o->free_timer(ndata->cold.cork_timer);
+    if (ndata->cork_buf)
+	ndata->o->free(ndata->o, ndata->cork_buf);
+    if (ndata->lat)
+	ndata->o->free(ndata->o, ndata->lat);
+    if (ndata->cold.read_timer)
+	ndata->o->free_timer(ndata->cold.read_timer);
+    if (ndata->rbuf)
+	ndata->o->free(ndata->o, ndata->rbuf);
+    if (ndata->cold.deferred_op_runner)
+	ndata->o->free_runner(ndata->cold.deferred_op_runner);
+#ifdef DEBUG_STATE
+    if (ndata->cold.state_trace)
+	ndata->o->free(ndata->o, ndata->cold.state_trace);
+#endif
     if (ndata->filter)
 	gensio_filter_free(ndata->filter);
     if (ndata->ll)
@@ -311,14 +493,14 @@ i_basen_deref_and_unlock(struct basen_data *ndata, int line)
 static void
 basen_start_timer(struct basen_data *ndata, gensio_time *timeout)
 {
-    if (ndata->o->start_timer(ndata->timer, timeout) == 0)
+    if (ndata->o->start_timer(ndata->cold.timer, timeout) == 0)
 	basen_ref(ndata);
 }
 
 static void
 basen_stop_timer(struct basen_data *ndata)
 {
-    if (ndata->o->stop_timer(ndata->timer) == 0)
+    if (ndata->o->stop_timer(ndata->cold.timer) == 0)
 	basen_deref(ndata);
 }
 
@@ -327,18 +509,23 @@ static void
 i_basen_add_trace(struct basen_data *ndata,
 		  enum basen_state new_state, int line)
 {
-    ndata->state_trace[ndata->state_trace_pos].old_state = ndata->state;
-    ndata->state_trace[ndata->state_trace_pos].new_state = new_state;
-    ndata->state_trace[ndata->state_trace_pos].line = line;
-    if (ndata->state_trace_pos == STATE_TRACE_LEN - 1)
-	ndata->state_trace_pos = 0;
+    struct basen_cold *c = &ndata->cold;
+
+    if (!c->state_trace)
+	return;
+    c->state_trace[c->state_trace_pos].old_state = ndata->state;
+    c->state_trace[c->state_trace_pos].new_state = new_state;
+    c->state_trace[c->state_trace_pos].line = line;
+    if (c->state_trace_pos == STATE_TRACE_LEN - 1)
+	c->state_trace_pos = 0;
     else
-	ndata->state_trace_pos++;
+	c->state_trace_pos++;
 }
 
 static void
 i_basen_set_state(struct basen_data *ndata, enum basen_state state, int line)
 {
+    GENSIO_PROBE3(basen_state, ndata, ndata->state, state);
     i_basen_add_trace(ndata, state, line);
     ndata->state = state;
 }
@@ -349,6 +536,7 @@ i_basen_set_state(struct basen_data *ndata, enum basen_state state, int line)
 static void
 basen_set_state(struct basen_data *ndata, enum basen_state state)
 {
+    GENSIO_PROBE3(basen_state, ndata, ndata->state, state);
     ndata->state = state;
 }
 #endif
@@ -361,6 +549,61 @@ filter_ul_read_pending(struct basen_data *ndata)
     return false;
 }
 
+/* Is there data for the user, in the filter or ready in rbuf? */
+static bool
+basen_ul_read_pending(struct basen_data *ndata)
+{
+    if (ndata->rbuf_len && (ndata->rbuf_ready || ndata->ll_err))
+	return true;
+    return filter_ul_read_pending(ndata);
+}
+
+/* Is a read_into posted that we have to copy data into? */
+static bool
+basen_rinto_copy(struct basen_data *ndata)
+{
+    return ndata->rinto_done && !ndata->rinto_ll;
+}
+
+/* Does the user want read data, from the callback or a read_into? */
+static bool
+basen_read_wanted(struct basen_data *ndata)
+{
+    return ndata->read_enabled || basen_rinto_copy(ndata);
+}
+
+/* Complete a posted read_into.  Called and returns locked. */
+static void
+basen_rinto_complete(struct basen_data *ndata, int err, gensiods count)
+{
+    gensio_read_done done = ndata->rinto_done;
+    void *read_data = ndata->cold.rinto_data;
+
+    ndata->rinto_done = NULL;
+    ndata->rinto_ll = false;
+    basen_unlock(ndata);
+    done(ndata->io, err, count, read_data);
+    basen_lock(ndata);
+}
+
+/* Copy data into a posted read_into and complete it. */
+static gensiods
+basen_rinto_fill(struct basen_data *ndata, const unsigned char *buf,
+		 gensiods len)
+{
+    gensiods i, n, count = 0;
+
+    for (i = 0; i < ndata->cold.rinto_sglen && count < len; i++) {
+	n = ndata->cold.rinto_sg[i].buflen;
+	if (n > len - count)
+	    n = len - count;
+	memcpy((void *) ndata->cold.rinto_sg[i].buf, buf + count, n);
+	count += n;
+    }
+    basen_rinto_complete(ndata, 0, count);
+    return count;
+}
+
 static bool
 filter_ll_write_pending(struct basen_data *ndata)
 {
@@ -470,12 +713,276 @@ filter_cleanup(struct basen_data *ndata)
 }
 
 
+static int64_t
+basen_now_nsecs(struct basen_data *ndata)
+{
+    gensio_time t;
+
+    ndata->o->get_monotonic_time(ndata->o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+static void
+basen_count_write(struct basen_data *ndata, gensiods count,
+		  const struct gensio_sg *sg, gensiods sglen)
+{
+    struct gensio_stats *stats = ndata->stats;
+    gensiods i, total = 0;
+    int64_t zero = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    gensio_stats_add(stats, tx_calls, 1);
+    gensio_stats_add(stats, tx_bytes, count);
+    if (count >= total)
+	return;
+    gensio_stats_add(stats, tx_partial, 1);
+    if (__atomic_compare_exchange_n(&ndata->tx_blocked_since, &zero,
+				    basen_now_nsecs(ndata), false,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	gensio_stats_add(stats, tx_blocked, 1);
+}
+
+static void
+basen_count_unblocked(struct basen_data *ndata)
+{
+    int64_t since;
+
+    since = __atomic_exchange_n(&ndata->tx_blocked_since, 0,
+				__ATOMIC_RELAXED);
+    if (since)
+	gensio_stats_add(ndata->stats, tx_blocked_nsecs,
+			 basen_now_nsecs(ndata) - since);
+}
+
+static void
+basen_lat_add(struct basen_latency *lat, enum basen_lat_metric m,
+	      int64_t nsecs)
+{
+    struct basen_lat_hist *h = &lat->h[m];
+    uint64_t v = nsecs > 0 ? nsecs : 0;
+    unsigned int b = 0;
+
+    while (b < BASEN_LAT_BUCKETS - 1 && (v >> (b + 1)))
+	b++;
+    h->buckets[b]++;
+    if (!h->count || v < h->min)
+	h->min = v;
+    if (v > h->max)
+	h->max = v;
+    h->count++;
+    h->sum += v;
+}
+
+/* Is write data held in this layer?  Call with the lock held. */
+static bool
+basen_wr_held(struct basen_data *ndata)
+{
+    return filter_ll_write_pending(ndata) || ndata->cork_len;
+}
+
+/*
+ * Start or finish timing write data held in this layer.  Call with
+ * the lock held.
+ */
+static void
+basen_lat_check_wr_queue(struct basen_data *ndata)
+{
+    struct basen_latency *lat = ndata->lat;
+
+    if (!lat)
+	return;
+    if (basen_wr_held(ndata)) {
+	if (!lat->wr_queued)
+	    lat->wr_queued = basen_now_nsecs(ndata);
+    } else if (lat->wr_queued) {
+	basen_lat_add(lat, BASEN_LAT_WR_QUEUE,
+		      basen_now_nsecs(ndata) - lat->wr_queued);
+	lat->wr_queued = 0;
+    }
+}
+
+/* Is read data held in this layer?  Call with the lock held. */
+static bool
+basen_rd_held(struct basen_data *ndata)
+{
+    return filter_ul_read_pending(ndata) || ndata->rbuf_len;
+}
+
+/*
+ * Read data is about to go to the user.  Returns the time to pass to
+ * basen_lat_rd_done(), zero if not timing.  Call with the lock held.
+ */
+static int64_t
+basen_lat_rd_deliver(struct basen_data *ndata)
+{
+    struct basen_latency *lat = ndata->lat;
+    int64_t now;
+
+    if (!lat)
+	return 0;
+    now = basen_now_nsecs(ndata);
+    if (lat->rd_queued)
+	basen_lat_add(lat, BASEN_LAT_RD_QUEUE, now - lat->rd_queued);
+    else if (lat->rd_arrive)
+	basen_lat_add(lat, BASEN_LAT_RD_PROC, now - lat->rd_arrive);
+    return now;
+}
+
+/* The user read callback returned.  Call with the lock held. */
+static void
+basen_lat_rd_done(struct basen_data *ndata, int64_t start)
+{
+    if (!ndata->lat || !start)
+	return;
+    basen_lat_add(ndata->lat, BASEN_LAT_RD_USER,
+		  basen_now_nsecs(ndata) - start);
+    if (!basen_rd_held(ndata))
+	ndata->lat->rd_queued = 0;
+}
+
+static uint64_t
+basen_lat_pctl(struct basen_lat_hist *h, unsigned int per1000)
+{
+    uint64_t want = (h->count * per1000 + 999) / 1000, n = 0, v;
+    unsigned int b;
+
+    for (b = 0; b < BASEN_LAT_BUCKETS; b++) {
+	n += h->buckets[b];
+	if (n >= want)
+	    break;
+    }
+    /* Report the top of the bucket, but never more than the max. */
+    v = (2ULL << b) - 1;
+    if (v > h->max)
+	v = h->max;
+    if (v < h->min)
+	v = h->min;
+    return v;
+}
+
+/*
+ * Memory held by this gensio, its own data plus what the filter and
+ * ll report.
+ */
+static int
+basen_memory_control(struct basen_data *ndata, bool get, char *data,
+		     gensiods *datalen)
+{
+    char buf[30];
+    gensiods len, size;
+
+    if (!get)
+	return GE_NOTSUP;
+
+    basen_lock(ndata);
+    size = sizeof(*ndata) + ndata->cork_size + ndata->read_lowat;
+    if (ndata->lat)
+	size += sizeof(*ndata->lat);
+    basen_unlock(ndata);
+
+    if (ndata->filter) {
+	len = sizeof(buf);
+	if (gensio_filter_control(ndata->filter, true, GENSIO_CONTROL_MEMORY,
+				  buf, &len) == 0)
+	    size += strtoul(buf, NULL, 0);
+    }
+    len = sizeof(buf);
+    if (gensio_ll_control(ndata->ll, true, GENSIO_CONTROL_MEMORY,
+			  buf, &len) == 0)
+	size += strtoul(buf, NULL, 0);
+
+    *datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+    return 0;
+}
+
+static int
+basen_latency_control(struct basen_data *ndata, bool get, char *data,
+		      gensiods *datalen)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct basen_lat_hist *h;
+    gensiods pos = 0;
+    unsigned int i, b;
+    int rv = 0;
+
+    basen_lock(ndata);
+    basen_write_lock(ndata);
+    if (!get) {
+	if (strcmp(data, "on") == 0) {
+	    if (!ndata->lat) {
+		ndata->lat = o->zalloc(o, sizeof(*ndata->lat));
+		if (!ndata->lat)
+		    rv = GE_NOMEM;
+	    }
+	} else if (strcmp(data, "off") == 0) {
+	    if (ndata->lat)
+		o->free(o, ndata->lat);
+	    ndata->lat = NULL;
+	} else if (strcmp(data, "reset") == 0) {
+	    if (ndata->lat) {
+		memset(ndata->lat->h, 0, sizeof(ndata->lat->h));
+		ndata->lat->rd_last = 0;
+	    }
+	} else {
+	    rv = GE_INVAL;
+	}
+	goto out_unlock;
+    }
+
+    if (!ndata->lat) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+    for (i = 0; i < BASEN_LAT_NR; i++) {
+	h = &ndata->lat->h[i];
+	gensio_pos_snprintf(data, *datalen, &pos, "%s%s count=%llu",
+			    i ? "\n" : "", basen_lat_names[i],
+			    (unsigned long long) h->count);
+	if (!h->count)
+	    continue;
+	gensio_pos_snprintf(data, *datalen, &pos,
+			    " min=%llu mean=%llu p50=%llu p99=%llu"
+			    " p99.9=%llu max=%llu hist=",
+			    (unsigned long long) h->min,
+			    (unsigned long long) (h->sum / h->count),
+			    (unsigned long long) basen_lat_pctl(h, 500),
+			    (unsigned long long) basen_lat_pctl(h, 990),
+			    (unsigned long long) basen_lat_pctl(h, 999),
+			    (unsigned long long) h->max);
+	for (b = 0; b < BASEN_LAT_BUCKETS; b++) {
+	    if (!h->buckets[b])
+		continue;
+	    gensio_pos_snprintf(data, *datalen, &pos, "%s%llu:%llu",
+				data[pos - 1] == '=' ? "" : ",",
+				(unsigned long long) (1ULL << b),
+				(unsigned long long) h->buckets[b]);
+	}
+    }
+    *datalen = pos;
+
+ out_unlock:
+    basen_write_unlock(ndata);
+    basen_unlock(ndata);
+    return rv;
+}
+
 static int
 ll_write(struct basen_data *ndata, gensiods *rcount,
 	 const struct gensio_sg *sg, gensiods sglen, const char *const *auxdata)
 {
+    struct basen_latency *lat = ndata->lat;
+    gensiods count = 0;
+    int64_t start = 0;
     int rv;
 
+    if (lat) {
+	start = basen_now_nsecs(ndata);
+	if (lat->wr_entry) {
+	    basen_lat_add(lat, BASEN_LAT_WR_PROC, start - lat->wr_entry);
+	    lat->wr_entry = 0;
+	}
+    }
 #ifdef DEBUG_DATA
     printf("LL write:");
     do {
@@ -484,7 +991,13 @@ ll_write(struct basen_data *ndata, gensiods *rcount,
 	    prbuf(sg[i].buf, sg[i].buflen);
     } while (false);
 #endif
-    rv = gensio_ll_write(ndata->ll, rcount, sg, sglen, auxdata);
+    rv = gensio_ll_write(ndata->ll, &count, sg, sglen, auxdata);
+    if (start)
+	basen_lat_add(lat, BASEN_LAT_WR_LL, basen_now_nsecs(ndata) - start);
+    if (!rv)
+	basen_count_write(ndata, count, sg, sglen);
+    if (rcount)
+	*rcount = count;
 #ifdef DEBUG_DATA
     printf("LL write returned %d accepted %ld\n", rv, rcount ? *rcount : 0);
 #endif
@@ -502,6 +1015,8 @@ ll_open(struct basen_data *ndata, gensio_ll_open_done done, void *open_data)
 }
 
 static void basen_sched_deferred_op(struct basen_data *ndata);
+static void basen_inline_begin(struct basen_data *ndata);
+static void basen_inline_end(struct basen_data *ndata);
 
 static void
 basen_ll_close_done(void *cb_data, void *close_data)
@@ -529,7 +1044,7 @@ basen_ll_close_done(void *cb_data, void *close_data)
 	 * failture.  So if open_done is set, we are in filter open,
 	 * and know to deliver the open failure.
 	 */
-	if (ndata->open_done) {
+	if (ndata->cold.open_done) {
 	    ndata->deferred_open = true;
 	    basen_sched_deferred_op(ndata);
 	}
@@ -568,6 +1083,7 @@ basen_set_ll_enables(struct basen_data *ndata)
 {
     bool enabled;
 
+    basen_lat_check_wr_queue(ndata);
     if (ndata->state == BASEN_CLOSED || ndata->ll_err) {
 	ll_set_write_callback_enable(ndata, false);
 	ll_set_read_callback_enable(ndata, false);
@@ -587,12 +1103,12 @@ basen_set_ll_enables(struct basen_data *ndata)
 	break;
 
     case BASEN_OPEN:
-	if (filter_ul_read_pending(ndata) && ndata->read_enabled) {
+	if (basen_ul_read_pending(ndata) && basen_read_wanted(ndata)) {
 	    ndata->deferred_read = true;
 	    basen_sched_deferred_op(ndata);
 	    enabled = false;
 	} else {
-	    enabled = ndata->read_enabled;
+	    enabled = basen_read_wanted(ndata);
 	}
 	/* Fallthrough */
     case BASEN_CLOSE_WAIT_DRAIN:
@@ -611,22 +1127,241 @@ basen_set_ll_enables(struct basen_data *ndata)
     ll_set_read_callback_enable(ndata, enabled);
 }
 
+/* Max sg entries sent along with corked data in one write. */
+#define BASEN_CORK_MAX_SG	16
+
+/* Default time to hold corked data, in microseconds. */
+#define BASEN_CORK_DEFAULT_USECS	200
+
+static void
+basen_cork_stop_timer(struct basen_data *ndata)
+{
+    if (ndata->cork_timer_running &&
+		ndata->o->stop_timer(ndata->cold.cork_timer) == 0) {
+	ndata->cork_timer_running = false;
+	basen_deref(ndata);
+    }
+}
+
+/* Write out as much corked data as the ll will take. */
 static int
-basen_write_data_handler(void *cb_data, gensiods *rcount,
-			 const struct gensio_sg *sg, gensiods sglen,
-			 const char *const *auxdata)
+basen_cork_flush(struct basen_data *ndata)
 {
-    struct basen_data *ndata = cb_data;
+    struct gensio_sg sg;
+    gensiods count = 0;
     int rv;
-    gensiods i, total = 0, count = 0;
 
-    for (i = 0; i < sglen; i++)
-	total += sg[i].buflen;
-    rv = ll_write(ndata, &count, sg, sglen, auxdata);
-    if (!rv && count < total)
-	ndata->ll_can_write = false;
-    if (rcount)
-	*rcount = count;
+    if (ndata->ll_err) {
+	/* It's not going anywhere. */
+	ndata->cork_len = 0;
+	basen_cork_stop_timer(ndata);
+    }
+    if (!ndata->cork_len)
+	return 0;
+
+    sg.buf = ndata->cork_buf;
+    sg.buflen = ndata->cork_len;
+    rv = ll_write(ndata, &count, &sg, 1, NULL);
+    if (rv)
+	return rv;
+    if (count < ndata->cork_len) {
+	memmove(ndata->cork_buf, ndata->cork_buf + count,
+		ndata->cork_len - count);
+	ndata->ll_can_write = false;
+    }
+    ndata->cork_len -= count;
+    if (!ndata->cork_len)
+	basen_cork_stop_timer(ndata);
+    return 0;
+}
+
+static void
+basen_cork_timeout(struct gensio_timer *timer, void *cb_data)
+{
+    struct basen_data *ndata = cb_data;
+    int err;
+
+    basen_lock(ndata);
+    ndata->cork_timer_running = false;
+    err = basen_cork_flush(ndata);
+    if (err)
+	handle_ioerr(ndata, err);
+    basen_inline_begin(ndata);
+    basen_set_ll_enables(ndata);
+    basen_inline_end(ndata);
+    basen_deref_and_unlock(ndata);
+}
+
+/*
+ * Add the data to the cork buffer if it fits.  If not, write the
+ * corked data and the new data together.
+ */
+static int
+basen_cork_write(struct basen_data *ndata, gensiods *rcount,
+		 const struct gensio_sg *sg, gensiods sglen, gensiods total)
+{
+    struct gensio_sg csg[BASEN_CORK_MAX_SG + 1];
+    gensiods i, n = 0, count = 0, wtotal = 0;
+    int rv;
+
+    if (ndata->cork_len + total < ndata->cork_size) {
+	if (!ndata->cork_len && !ndata->cork_timer_running &&
+		ndata->o->start_timer(ndata->cold.cork_timer,
+				      &ndata->cold.cork_timeout) == 0) {
+	    ndata->cork_timer_running = true;
+	    basen_ref(ndata);
+	}
+	for (i = 0; i < sglen; i++) {
+	    memcpy(ndata->cork_buf + ndata->cork_len, sg[i].buf,
+		   sg[i].buflen);
+	    ndata->cork_len += sg[i].buflen;
+	}
+	count = total;
+	goto out;
+    }
+
+    if (ndata->cork_len) {
+	csg[n].buf = ndata->cork_buf;
+	csg[n++].buflen = ndata->cork_len;
+    }
+    for (i = 0; i < sglen && n < BASEN_CORK_MAX_SG + 1; i++) {
+	csg[n] = sg[i];
+	wtotal += sg[i].buflen;
+	n++;
+    }
+    rv = ll_write(ndata, &count, csg, n, NULL);
+    if (rv)
+	return rv;
+    if (count < ndata->cork_len) {
+	memmove(ndata->cork_buf, ndata->cork_buf + count,
+		ndata->cork_len - count);
+	ndata->cork_len -= count;
+	count = 0;
+	ndata->ll_can_write = false;
+    } else {
+	count -= ndata->cork_len;
+	ndata->cork_len = 0;
+	basen_cork_stop_timer(ndata);
+	if (count < wtotal)
+	    ndata->ll_can_write = false;
+    }
+ out:
+    if (rcount)
+	*rcount = count;
+    return 0;
+}
+
+static int
+basen_cork_control(struct basen_data *ndata, bool get, char *data,
+		   gensiods *datalen)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    unsigned long size, usecs = BASEN_CORK_DEFAULT_USECS;
+    unsigned char *buf = NULL;
+    char *end;
+    int rv = 0;
+
+    /* Holding the write lock keeps corking from changing under a write. */
+    basen_lock(ndata);
+    basen_write_lock(ndata);
+    if (get) {
+	*datalen = snprintf(data, *datalen, "size=%lu usecs=%lu queued=%lu",
+			    (unsigned long) ndata->cork_size,
+			    (unsigned long)
+			    (ndata->cold.cork_timeout.secs * 1000000
+			     + ndata->cold.cork_timeout.nsecs / 1000),
+			    (unsigned long) ndata->cork_len);
+	goto out_unlock;
+    }
+
+    rv = basen_cork_flush(ndata);
+    if (rv)
+	goto out_err;
+    if (strcmp(data, "flush") == 0)
+	goto out_unlock;
+
+    size = strtoul(data, &end, 0);
+    if (*end == ',')
+	usecs = strtoul(end + 1, &end, 0);
+    if (*end || end == data) {
+	rv = GE_INVAL;
+	goto out_unlock;
+    }
+    if (ndata->cork_len) {
+	/* The ll couldn't take it all, can't change the buffer now. */
+	rv = GE_INPROGRESS;
+	goto out_unlock;
+    }
+    if (size && !ndata->cold.cork_timer) {
+	ndata->cold.cork_timer = o->alloc_timer(o, basen_cork_timeout, ndata);
+	if (!ndata->cold.cork_timer) {
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    if (size && size != ndata->cork_size) {
+	buf = o->zalloc(o, size);
+	if (!buf) {
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    if (size != ndata->cork_size) {
+	if (ndata->cork_buf)
+	    o->free(o, ndata->cork_buf);
+	ndata->cork_buf = buf;
+	ndata->cork_size = size;
+    }
+    ndata->cold.cork_timeout.secs = usecs / 1000000;
+    ndata->cold.cork_timeout.nsecs = (usecs % 1000000) * 1000;
+    goto out_unlock;
+
+ out_err:
+    handle_ioerr(ndata, rv);
+ out_unlock:
+    basen_write_unlock(ndata);
+    basen_set_ll_enables(ndata);
+    basen_unlock(ndata);
+    return rv;
+}
+
+static int
+basen_write_data_handler(void *cb_data, gensiods *rcount,
+			 const struct gensio_sg *sg, gensiods sglen,
+			 const char *const *auxdata)
+{
+    struct basen_data *ndata = cb_data;
+    int rv;
+    gensiods i, total = 0, count = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    /* Auxdata can't be merged with other writes, and only cork if open. */
+    if (ndata->cork_size && ndata->state == BASEN_OPEN && !auxdata)
+	return basen_cork_write(ndata, rcount, sg, sglen, total);
+
+    /* Corked data has to go first. */
+    if (ndata->cork_len) {
+	rv = basen_cork_flush(ndata);
+	if (rv)
+	    return rv;
+	if (ndata->cork_len) {
+	    if (rcount)
+		*rcount = 0;
+	    return 0;
+	}
+    }
+
+    rv = ll_write(ndata, &count, sg, sglen, auxdata);
+    if (!rv && count < total) {
+	if (ndata->write_unlocked)
+	    ndata->write_blocked = true;
+	else
+	    ndata->ll_can_write = false;
+    }
+    if (rcount)
+	*rcount = count;
     return rv;
 }
 
@@ -653,7 +1388,8 @@ basen_filter_ul_push(struct basen_data *ndata, bool check_open_close)
 static bool
 write_data_pending(struct basen_data *ndata)
 {
-    return filter_ll_write_queued(ndata) || ndata->in_write_count > 0;
+    return (filter_ll_write_queued(ndata) || ndata->in_write_count > 0 ||
+	    ndata->cork_len > 0);
 }
 
 static int
@@ -661,8 +1397,11 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
 	    const struct gensio_sg *sg, gensiods sglen,
 	    const char *const *auxdata)
 {
+    bool unlocked, blocked = false;
+    int64_t lat_start = 0;
     int err = 0;
 
+    GENSIO_PROBE2(basen_write_entry, ndata->io, sglen);
     basen_lock(ndata);
     if (ndata->state != BASEN_OPEN) {
 	err = GE_NOTREADY;
@@ -674,8 +1413,37 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
     }
     ndata->in_write_count++;
 
+    /*
+     * With no filter and no corking the write goes straight to the
+     * ll, which does its own locking, so only hold the write lock
+     * for that.  in_write_count holds off a close in the meantime.
+     */
+    basen_write_lock(ndata);
+    if (ndata->lat)
+	lat_start = ndata->lat->wr_entry = basen_now_nsecs(ndata);
+    unlocked = !ndata->filter && !ndata->cork_size;
+    if (unlocked) {
+	ndata->write_unlocked = true;
+	ndata->write_blocked = false;
+	basen_unlock(ndata);
+    }
     err = filter_ul_write(ndata, basen_write_data_handler, rcount, sg, sglen,
 			  auxdata);
+    if (lat_start) {
+	basen_lat_add(ndata->lat, BASEN_LAT_WR_TOTAL,
+		      basen_now_nsecs(ndata) - lat_start);
+	ndata->lat->wr_entry = 0;
+    }
+    if (unlocked) {
+	ndata->write_unlocked = false;
+	blocked = ndata->write_blocked;
+    }
+    basen_write_unlock(ndata);
+    if (unlocked) {
+	basen_lock(ndata);
+	if (blocked)
+	    ndata->ll_can_write = false;
+    }
 
     ndata->in_write_count--;
     if (err)
@@ -717,6 +1485,7 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
     basen_set_ll_enables(ndata);
     basen_unlock(ndata);
 
+    GENSIO_PROBE3(basen_write_return, ndata->io, err, rcount ? *rcount : 0);
     return err;
 }
 
@@ -728,6 +1497,187 @@ basen_can_deliver_ul_data(struct basen_data *ndata)
 	ndata->state == BASEN_IO_ERR_CLOSE;
 }
 
+/* Default time to hold read data below the low-water mark, in usecs. */
+#define BASEN_READ_DEFAULT_USECS	1000
+
+static void
+basen_read_timer_stop(struct basen_data *ndata)
+{
+    if (ndata->read_timer_running &&
+		ndata->o->stop_timer(ndata->cold.read_timer) == 0) {
+	ndata->read_timer_running = false;
+	basen_deref(ndata);
+    }
+}
+
+static void
+basen_read_timeout(struct gensio_timer *timer, void *cb_data)
+{
+    struct basen_data *ndata = cb_data;
+
+    basen_lock(ndata);
+    ndata->read_timer_running = false;
+    if (ndata->rbuf_len) {
+	/* Deadline passed, hand over what we have. */
+	ndata->rbuf_ready = true;
+	if (basen_read_wanted(ndata) && !ndata->in_read &&
+		basen_can_deliver_ul_data(ndata)) {
+	    ndata->deferred_read = true;
+	    basen_inline_begin(ndata);
+	    basen_sched_deferred_op(ndata);
+	    basen_inline_end(ndata);
+	}
+    }
+    basen_deref_and_unlock(ndata);
+}
+
+/* Add data to the read coalescing buffer, returns the amount taken. */
+static gensiods
+basen_rbuf_add(struct basen_data *ndata, unsigned char *buf, gensiods len)
+{
+    if (len > ndata->read_lowat - ndata->rbuf_len)
+	len = ndata->read_lowat - ndata->rbuf_len;
+    memcpy(ndata->rbuf + ndata->rbuf_len, buf, len);
+    ndata->rbuf_len += len;
+    if (ndata->rbuf_len >= ndata->read_lowat) {
+	ndata->rbuf_ready = true;
+    } else if (!ndata->read_timer_running &&
+		ndata->o->start_timer(ndata->cold.read_timer,
+				      &ndata->cold.read_max_delay) == 0) {
+	ndata->read_timer_running = true;
+	basen_ref(ndata);
+    }
+    return len;
+}
+
+/*
+ * Should len bytes of read data without auxdata be held for
+ * coalescing?  Called locked.
+ */
+static bool
+basen_rbuf_hold(struct basen_data *ndata, gensiods len)
+{
+    if (!ndata->read_lowat)
+	return false;
+    if (ndata->rbuf_len)
+	return true;
+    if (len >= ndata->read_lowat)
+	return false;
+    /* In idle mode the first data after a quiet spell goes right up. */
+    return !ndata->read_idle || basen_now_nsecs(ndata) < ndata->read_quiet_at;
+}
+
+/* Read data went to the user, start a new quiet period.  Called locked. */
+static void
+basen_rbuf_delivered(struct basen_data *ndata)
+{
+    if (ndata->read_idle)
+	ndata->read_quiet_at = basen_now_nsecs(ndata) +
+	    ndata->cold.read_max_delay.secs * 1000000000LL +
+	    ndata->cold.read_max_delay.nsecs;
+}
+
+/* Give the coalesced read data to the user.  Called and returns locked. */
+static int
+basen_deliver_rbuf(struct basen_data *ndata)
+{
+    gensiods rval = ndata->rbuf_len;
+    int64_t lat_start;
+    int err;
+
+    basen_read_timer_stop(ndata);
+    if (basen_rinto_copy(ndata)) {
+	rval = basen_rinto_fill(ndata, ndata->rbuf, rval);
+	err = 0;
+	goto out;
+    }
+    lat_start = basen_lat_rd_deliver(ndata);
+    basen_unlock(ndata);
+    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, 0, ndata->rbuf, &rval,
+		    NULL);
+    basen_lock(ndata);
+    basen_lat_rd_done(ndata, lat_start);
+ out:
+    basen_rbuf_delivered(ndata);
+    if (rval > ndata->rbuf_len)
+	rval = ndata->rbuf_len;
+    if (rval < ndata->rbuf_len)
+	memmove(ndata->rbuf, ndata->rbuf + rval, ndata->rbuf_len - rval);
+    ndata->rbuf_len -= rval;
+    if (!ndata->rbuf_len)
+	ndata->rbuf_ready = false;
+    return err;
+}
+
+static int
+basen_read_lowat_control(struct basen_data *ndata, bool get, char *data,
+			 gensiods *datalen)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    unsigned long lowat, usecs = BASEN_READ_DEFAULT_USECS;
+    unsigned char *buf = NULL;
+    bool idle = false;
+    char *end;
+    int rv = 0;
+
+    basen_lock(ndata);
+    if (get) {
+	*datalen = snprintf(data, *datalen,
+			    "lowat=%lu usecs=%lu pending=%lu idle=%d",
+			    (unsigned long) ndata->read_lowat,
+			    (unsigned long)
+			    (ndata->cold.read_max_delay.secs * 1000000
+			     + ndata->cold.read_max_delay.nsecs / 1000),
+			    (unsigned long) ndata->rbuf_len, ndata->read_idle);
+	goto out_unlock;
+    }
+
+    lowat = strtoul(data, &end, 0);
+    if (end != data && *end == ',' && end[1] >= '0' && end[1] <= '9')
+	usecs = strtoul(end + 1, &end, 0);
+    if (end != data && strcmp(end, ",idle") == 0) {
+	idle = true;
+	end += 5;
+    }
+    if (*end || end == data) {
+	rv = GE_INVAL;
+	goto out_unlock;
+    }
+    if (ndata->rbuf_len) {
+	/* The user hasn't taken the held data yet. */
+	rv = GE_INPROGRESS;
+	goto out_unlock;
+    }
+    if (lowat && !ndata->cold.read_timer) {
+	ndata->cold.read_timer = o->alloc_timer(o, basen_read_timeout, ndata);
+	if (!ndata->cold.read_timer) {
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    if (lowat && lowat != ndata->read_lowat) {
+	buf = o->zalloc(o, lowat);
+	if (!buf) {
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    if (lowat != ndata->read_lowat) {
+	if (ndata->rbuf)
+	    o->free(o, ndata->rbuf);
+	ndata->rbuf = buf;
+	ndata->read_lowat = lowat;
+    }
+    ndata->cold.read_max_delay.secs = usecs / 1000000;
+    ndata->cold.read_max_delay.nsecs = (usecs % 1000000) * 1000;
+    ndata->read_idle = idle;
+    ndata->read_quiet_at = 0;
+
+ out_unlock:
+    basen_unlock(ndata);
+    return rv;
+}
+
 static int
 basen_read_data_handler(void *cb_data,
 			gensiods *rcount,
@@ -737,8 +1687,10 @@ basen_read_data_handler(void *cb_data,
 {
     struct basen_data *ndata = cb_data;
     gensiods count = 0, rval;
+    int64_t lat_start;
     int err = 0;
 
+    GENSIO_PROBE2(basen_read_entry, ndata->io, buflen);
     basen_lock(ndata);
     if (!basen_can_deliver_ul_data(ndata)) {
 	if (ndata->state != BASEN_IN_LL_OPEN &&
@@ -751,14 +1703,29 @@ basen_read_data_handler(void *cb_data,
 	}
 	goto out_unlock;
     }
-    while (basen_can_deliver_ul_data(ndata) && ndata->read_enabled &&
+    /* Data with auxdata can't be merged, push out anything held first. */
+    if (auxdata && ndata->rbuf_len)
+	ndata->rbuf_ready = true;
+    while (basen_can_deliver_ul_data(ndata) && basen_read_wanted(ndata) &&
 	   (count < buflen || ndata->ll_err)) {
-	if (ndata->ll_err && !filter_ul_read_pending(ndata)) {
+	if (ndata->rbuf_len && (ndata->rbuf_ready || ndata->ll_err)) {
+	    err = basen_deliver_rbuf(ndata);
+	} else if (ndata->ll_err && !basen_ul_read_pending(ndata) &&
+		   basen_rinto_copy(ndata)) {
+	    basen_rinto_complete(ndata, ndata->ll_err, 0);
+	} else if (ndata->ll_err && !basen_ul_read_pending(ndata)) {
 	    basen_unlock(ndata);
 	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->ll_err,
 			    NULL, NULL, NULL);
 	    basen_lock(ndata);
+	} else if (basen_rinto_copy(ndata)) {
+	    count += basen_rinto_fill(ndata, buf + count, buflen - count);
+	} else if (!auxdata && basen_rbuf_hold(ndata, buflen - count)) {
+	    /* Hold it until we reach the low-water mark or time out. */
+	    count += basen_rbuf_add(ndata, buf + count, buflen - count);
 	} else {
+	    basen_rbuf_delivered(ndata);
+	    lat_start = basen_lat_rd_deliver(ndata);
 	    basen_unlock(ndata);
 	    rval = buflen - count;
 	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, 0,
@@ -771,15 +1738,19 @@ basen_read_data_handler(void *cb_data,
 		rval = buflen - count;
 #endif
 	    count += rval;
-	    if (count >= buflen)
+	    if (count >= buflen && !lat_start)
 		goto out; /* Don't claim the lock if I don't have to. */
 	    basen_lock(ndata);
+	    basen_lat_rd_done(ndata, lat_start);
+	    if (count >= buflen)
+		goto out_unlock;
 	}
     }
  out_unlock:
     basen_unlock(ndata);
 
  out:
+    GENSIO_PROBE3(basen_read_return, ndata->io, err, count);
     if (rcount)
 	*rcount = count;
     return err;
@@ -800,7 +1771,7 @@ i_handle_ioerr(struct basen_data *ndata, int err, int line)
     ll_set_read_callback_enable(ndata, false);
 
     ndata->ll_err = err;
-    ndata->open_err = err;
+    ndata->cold.open_err = err;
 
     /* Strange looking, but don't enable ll write if we get an error. */
     ndata->ll_can_write = true;
@@ -905,19 +1876,21 @@ basen_finish_close(struct basen_data *ndata)
     assert(!ndata->in_read);
     filter_cleanup(ndata);
     basen_set_state(ndata, BASEN_CLOSED);
-    if (ndata->close_done) {
+    if (basen_rinto_copy(ndata))
+	basen_rinto_complete(ndata, GE_LOCALCLOSED, 0);
+    if (ndata->cold.close_done) {
 	basen_unlock(ndata);
-	ndata->close_done(ndata->io, ndata->close_data);
+	ndata->cold.close_done(ndata->io, ndata->cold.close_data);
 	basen_lock(ndata);
     }
-    if (ndata->timer) {
+    if (ndata->cold.timer) {
 	/*
 	 * This will either stop the timer and call
 	 * basen_timer_stopped which will do the deref for the timer,
 	 * or it will fail if there was no timer running (no ref) or
 	 * if the timer was in the callback (the callback will deref).
 	 */
-	ndata->o->stop_timer_with_done(ndata->timer,
+	ndata->o->stop_timer_with_done(ndata->cold.timer,
 				       basen_timer_stopped,
 				       ndata);
     }
@@ -934,13 +1907,13 @@ basen_finish_open(struct basen_data *ndata, int err)
     if (!err) {
 	assert(ndata->state == BASEN_IN_FILTER_OPEN || ndata->state == BASEN_OPEN);
 	basen_set_state(ndata, BASEN_OPEN);
-	if (ndata->timer_start_pending)
-	    basen_start_timer(ndata, &ndata->pending_timer);
+	if (ndata->cold.timer_start_pending)
+	    basen_start_timer(ndata, &ndata->cold.pending_timer);
     }
 
-    open_done = ndata->open_done;
-    ndata->open_done = NULL;
-    open_data = ndata->open_data;
+    open_done = ndata->cold.open_done;
+    ndata->cold.open_done = NULL;
+    open_data = ndata->cold.open_data;
     basen_unlock(ndata);
     open_done(ndata->io, err, open_data);
     basen_lock(ndata);
@@ -971,34 +1944,40 @@ basen_in_write_callbackable_state(struct basen_data *ndata)
 	    ndata->state == BASEN_IO_ERR_CLOSE);
 }
 
+/* Run the pending deferred operations.  Called and returns locked. */
 static void
-basen_deferred_op(struct gensio_runner *runner, void *cbdata)
+basen_run_deferred_ops(struct basen_data *ndata)
 {
-    struct basen_data *ndata = cbdata;
     int err;
 
-    basen_lock(ndata);
     ndata->deferred_op_pending = false;
 
     if (ndata->deferred_open) {
 	ndata->deferred_open = false;
 	i_basen_add_trace(ndata, 100, __LINE__);
-	basen_finish_open(ndata, ndata->open_err);
+	basen_finish_open(ndata, ndata->cold.open_err);
     }
 
     while (ndata->deferred_read) {
-	if (ndata->in_read || !ndata->read_enabled)
+	if (ndata->in_read || !basen_read_wanted(ndata))
 	    goto skip_read;
 	ndata->deferred_read = false;
 	ndata->in_read = true;
 	do {
-	    if (ndata->ll_err && !filter_ul_read_pending(ndata)) {
+	    if (ndata->ll_err && !basen_ul_read_pending(ndata) &&
+		    basen_rinto_copy(ndata)) {
+		basen_rinto_complete(ndata, ndata->ll_err, 0);
+		err = 0;
+	    } else if (ndata->ll_err && !basen_ul_read_pending(ndata)) {
 		/* Automatically disable read on an error. */
 		ndata->read_enabled = false;
 		basen_unlock(ndata);
 		err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->ll_err,
 				NULL, NULL, NULL);
 		basen_lock(ndata);
+	    } else if (ndata->rbuf_len &&
+		       (ndata->rbuf_ready || ndata->ll_err)) {
+		err = basen_deliver_rbuf(ndata);
 	    } else {
 		basen_unlock(ndata);
 		err = filter_ll_write(ndata, basen_read_data_handler,
@@ -1009,8 +1988,8 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 		handle_ioerr(ndata, err);
 		break;
 	    }
-	} while (ndata->read_enabled &&
-		 (ndata->ll_err || filter_ul_read_pending(ndata)));
+	} while (basen_read_wanted(ndata) &&
+		 (ndata->ll_err || basen_ul_read_pending(ndata)));
 	ndata->in_read = false;
     }
 
@@ -1049,16 +2028,51 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	basen_filter_ul_push(ndata, true);
 	basen_set_ll_enables(ndata);
     }
+}
+
+static void
+basen_deferred_op(struct gensio_runner *runner, void *cbdata)
+{
+    struct basen_data *ndata = cbdata;
+
+    basen_lock(ndata);
+    basen_run_deferred_ops(ndata);
     basen_deref_and_unlock(ndata); /* Ref from basen_sched_deferred_op */
 }
 
+/*
+ * Called locked from an os or ll callback that is not running a user
+ * callback and will not unlock before basen_inline_end().  Deferred
+ * ops scheduled in between are run directly by basen_inline_end().
+ */
+static void
+basen_inline_begin(struct basen_data *ndata)
+{
+    ndata->sched_inline = true;
+}
+
+static void
+basen_inline_end(struct basen_data *ndata)
+{
+    ndata->sched_inline = false;
+    if (ndata->deferred_op_inline) {
+	ndata->deferred_op_inline = false;
+	basen_run_deferred_ops(ndata);
+    }
+}
+
 static void
 basen_sched_deferred_op(struct basen_data *ndata)
 {
     if (!ndata->deferred_op_pending) {
 	ndata->deferred_op_pending = true;
+	if (ndata->sched_inline) {
+	    /* The caller holds a ref and will run it. */
+	    ndata->deferred_op_inline = true;
+	    return;
+	}
 	basen_ref(ndata);
-	ndata->o->run(ndata->deferred_op_runner);
+	ndata->o->run(ndata->cold.deferred_op_runner);
     }
 }
 
@@ -1113,7 +2127,7 @@ basen_ll_open_done(void *cb_data, int err, void *open_data)
     struct basen_data *ndata = cb_data;
 
     basen_lock_and_ref(ndata);
-    if (ndata->ll_err || ndata->open_err) {
+    if (ndata->ll_err || ndata->cold.open_err) {
 	/* Nothing to do here, we failed the open, a close should be pending. */
     } else if (err) {
 	basen_set_state(ndata, BASEN_CLOSED);
@@ -1124,12 +2138,12 @@ basen_ll_open_done(void *cb_data, int err, void *open_data)
 	/*
 	 * Once the lower layer is open, propagate the traits.
 	 */
-	if (ndata->child) {
-	    if (gensio_is_reliable(ndata->child))
+	if (ndata->cold.child) {
+	    if (gensio_is_reliable(ndata->cold.child))
 		gensio_set_is_reliable(ndata->io, true);
-	    if (gensio_is_authenticated(ndata->child))
+	    if (gensio_is_authenticated(ndata->cold.child))
 		gensio_set_is_authenticated(ndata->io, true);
-	    if (gensio_is_encrypted(ndata->child))
+	    if (gensio_is_encrypted(ndata->cold.child))
 		gensio_set_is_encrypted(ndata->io, true);
 	}
 
@@ -1155,7 +2169,7 @@ basen_open(struct basen_data *ndata, gensio_done_err open_done, void *open_data)
 	    goto out_err;
 
 	ndata->ll_err = 0;
-	ndata->open_err = 0;
+	ndata->cold.open_err = 0;
 	ndata->in_read = false;
 	ndata->deferred_read = false;
 	ndata->deferred_write = false;
@@ -1164,12 +2178,12 @@ basen_open(struct basen_data *ndata, gensio_done_err open_done, void *open_data)
 	ndata->read_enabled = false;
 	ndata->xmit_enabled = false;
 	ndata->ll_can_write = false;
-	ndata->timer_start_pending = false;
+	ndata->cold.timer_start_pending = false;
 	ndata->close_requested = false;
 	ndata->ll_want_close = false;
 
-	ndata->open_done = open_done;
-	ndata->open_data = open_data;
+	ndata->cold.open_done = open_done;
+	ndata->cold.open_data = open_data;
 	basen_set_state(ndata, BASEN_IN_LL_OPEN);
 	err = ll_open(ndata, basen_ll_open_done, ndata);
 	if (err == 0) {
@@ -1213,7 +2227,7 @@ basen_open_nochild(struct basen_data *ndata,
 	    goto out_err;
 
 	ndata->ll_err = 0;
-	ndata->open_err = 0;
+	ndata->cold.open_err = 0;
 	ndata->in_read = false;
 	ndata->deferred_read = false;
 	ndata->deferred_write = false;
@@ -1221,10 +2235,10 @@ basen_open_nochild(struct basen_data *ndata,
 	ndata->deferred_close = false;
 	ndata->read_enabled = false;
 	ndata->xmit_enabled = false;
-	ndata->timer_start_pending = false;
+	ndata->cold.timer_start_pending = false;
 
-	ndata->open_done = open_done;
-	ndata->open_data = open_data;
+	ndata->cold.open_done = open_done;
+	ndata->cold.open_data = open_data;
 
 	basen_set_state(ndata, BASEN_IN_FILTER_OPEN);
 	err = basen_filter_try_connect(ndata, false);
@@ -1290,13 +2304,17 @@ basen_i_close(struct basen_data *ndata,
 
     ndata->read_enabled = false;
     ndata->xmit_enabled = false;
-    ndata->close_done = close_done;
-    ndata->close_data = close_data;
+    ndata->cold.close_done = close_done;
+    ndata->cold.close_data = close_data;
     /*
      * Set local close no matter what, so it get's delivered if open is
      * not yet complete.
      */
-    ndata->open_err = GE_LOCALCLOSED;
+    ndata->cold.open_err = GE_LOCALCLOSED;
+    /* Held read data won't be delivered after a close. */
+    basen_read_timer_stop(ndata);
+    ndata->rbuf_len = 0;
+    ndata->rbuf_ready = false;
     if (ndata->state == BASEN_IN_LL_OPEN ||
 		ndata->state == BASEN_IN_FILTER_OPEN) {
 	basen_set_state(ndata, BASEN_IN_LL_CLOSE);
@@ -1309,6 +2327,8 @@ basen_i_close(struct basen_data *ndata,
 	    ndata->deferred_close = true;
 	    basen_sched_deferred_op(ndata);
 	}
+    } else if ((rv = basen_cork_flush(ndata))) {
+	handle_ioerr(ndata, rv);
     } else if (write_data_pending(ndata)) {
 	basen_set_state(ndata, BASEN_CLOSE_WAIT_DRAIN);
     } else {
@@ -1334,12 +2354,12 @@ basen_close(struct basen_data *ndata, gensio_done close_done, void *close_data)
 		ndata->state == BASEN_IN_LL_OPEN) {
 	basen_i_close(ndata, close_done, close_data);
     } else if (ndata->state == BASEN_IN_LL_IO_ERR_CLOSE) {
-	ndata->close_done = close_done;
-	ndata->close_data = close_data;
+	ndata->cold.close_done = close_done;
+	ndata->cold.close_data = close_data;
 	basen_set_state(ndata, BASEN_IN_LL_CLOSE);
     } else if (ndata->state == BASEN_IO_ERR_CLOSE) {
-	ndata->close_done = close_done;
-	ndata->close_data = close_data;
+	ndata->cold.close_done = close_done;
+	ndata->cold.close_data = close_data;
 	i_basen_add_trace(ndata, 102, __LINE__);
 	ndata->deferred_close = true;
 	basen_sched_deferred_op(ndata);
@@ -1370,12 +2390,12 @@ basen_free(struct basen_data *ndata)
 	break;
 
     case BASEN_IN_LL_IO_ERR_CLOSE:
-	ndata->close_done = NULL;
+	ndata->cold.close_done = NULL;
 	basen_set_state(ndata, BASEN_IN_LL_CLOSE);
 	break;
 
     case BASEN_IO_ERR_CLOSE:
-	ndata->close_done = NULL;
+	ndata->cold.close_done = NULL;
 	ndata->deferred_close = true;
 	basen_sched_deferred_op(ndata);
 	break;
@@ -1383,7 +2403,7 @@ basen_free(struct basen_data *ndata)
     default:
 	/* In the close process, lose a ref so it will free when done. */
 	/* Don't call the done */
-	ndata->close_done = NULL;
+	ndata->cold.close_done = NULL;
 	break;
     }
     /* Lose the initial ref so it will be freed when done. */
@@ -1419,7 +2439,9 @@ basen_timeout(struct gensio_timer *timer, void *cb_data)
 	break;
     }
     basen_filter_ul_push(ndata, true);
+    basen_inline_begin(ndata);
     basen_set_ll_enables(ndata);
+    basen_inline_end(ndata);
     basen_deref_and_unlock(ndata);
 }
 
@@ -1436,7 +2458,7 @@ basen_set_read_callback_enable(struct basen_data *ndata, bool enabled)
     if (!basen_in_read_callbackable_state(ndata))
 	goto out_unlock;
     ndata->read_enabled = enabled;
-    read_pending = filter_ul_read_pending(ndata);
+    read_pending = basen_ul_read_pending(ndata);
     if (ndata->deferred_op_pending && enabled) {
 	/* Nothing to do, let the read/open handling wake things up. */
 	ndata->deferred_read = true;
@@ -1476,6 +2498,63 @@ basen_set_write_callback_enable(struct basen_data *ndata, bool enabled)
     basen_unlock(ndata);
 }
 
+static int
+basen_read_into(struct basen_data *ndata,
+		const struct gensio_func_read_into_data *d)
+{
+    int rv = 0;
+
+    if (d->sglen > GENSIO_LL_READ_INTO_MAX_SG)
+	return GE_TOOBIG;
+
+    basen_lock(ndata);
+    if (ndata->state != BASEN_OPEN) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (ndata->ll_err) {
+	rv = ndata->ll_err;
+	goto out_unlock;
+    }
+    if (ndata->rinto_done) {
+	rv = GE_INUSE;
+	goto out_unlock;
+    }
+    memcpy(ndata->cold.rinto_sg, d->sg, d->sglen * sizeof(*d->sg));
+    ndata->cold.rinto_sglen = d->sglen;
+    ndata->rinto_done = d->done;
+    ndata->cold.rinto_data = d->read_data;
+    /* With nothing in between, let the ll read straight into it. */
+    if (!ndata->filter && !ndata->rbuf_len &&
+		gensio_ll_read_into(ndata->ll, d->sg, d->sglen) == 0)
+	ndata->rinto_ll = true;
+    basen_set_ll_enables(ndata);
+ out_unlock:
+    basen_unlock(ndata);
+    return rv;
+}
+
+/*
+ * Can a parent take over this gensio's filter and ll?  Only if
+ * nothing has been done with it yet and the parent is the only user.
+ */
+static int
+basen_fuse_check(struct basen_data *ndata, struct basen_data **rndata)
+{
+    int rv = GE_NOTSUP;
+
+    basen_lock(ndata);
+    if (ndata->state == BASEN_CLOSED && ndata->filter &&
+		!ndata->cold.no_fuse && ndata->refcount == 1 &&
+		!ndata->cold.open_done &&
+		gensio_is_client(ndata->io)) {
+	*rndata = ndata;
+	rv = 0;
+    }
+    basen_unlock(ndata);
+    return rv;
+}
+
 static int
 gensio_base_func(struct gensio *io, int func, gensiods *count,
 		 const void *cbuf, gensiods buflen, void *buf,
@@ -1510,6 +2589,15 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	return 0;
 
     case GENSIO_FUNC_CONTROL:
+	if (buflen == GENSIO_CONTROL_CORK)
+	    return basen_cork_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_READ_LOWAT)
+	    return basen_read_lowat_control(ndata, *((bool *) cbuf), buf,
+					    count);
+	if (buflen == GENSIO_CONTROL_LATENCY)
+	    return basen_latency_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_MEMORY)
+	    return basen_memory_control(ndata, *((bool *) cbuf), buf, count);
 	rv = GE_NOTSUP;
 	if (ndata->filter) {
 	    rv = gensio_filter_control(ndata->filter, *((bool *) cbuf), buflen,
@@ -1530,11 +2618,17 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	    if (ndata->filter)
 		gensio_filter_cleanup(ndata->filter);
 	    gensio_ll_disable(ndata->ll);
-	    if (ndata->child)
-		gensio_disable(ndata->child);
+	    if (ndata->cold.child)
+		gensio_disable(ndata->cold.child);
 	}
 	return 0;
 
+    case GENSIO_FUNC_READ_INTO:
+	return basen_read_into(ndata, cbuf);
+
+    case GENSIO_FUNC_FUSE:
+	return basen_fuse_check(ndata, buf);
+
     default:
 	return GE_NOTSUP;
     }
@@ -1570,6 +2664,7 @@ basen_ll_read(void *cb_data, int readerr,
 {
     struct basen_data *ndata = cb_data;
     unsigned char *buf = ibuf;
+    gensiods ibuflen = buflen;
     int err;
 
 #ifdef DEBUG_DATA
@@ -1577,6 +2672,17 @@ basen_ll_read(void *cb_data, int readerr,
     prbuf(buf, buflen);
 #endif
     basen_lock_and_ref(ndata);
+    if (ndata->lat && !ndata->in_read)
+	ndata->lat->rd_arrive = basen_now_nsecs(ndata);
+    if (ndata->lat && buflen && !ndata->lat->rd_more) {
+	/* Not the rest of data we didn't take last time. */
+	int64_t now = basen_now_nsecs(ndata);
+
+	if (ndata->lat->rd_last)
+	    basen_lat_add(ndata->lat, BASEN_LAT_RD_GAP,
+			  now - ndata->lat->rd_last);
+	ndata->lat->rd_last = now;
+    }
     if (readerr) {
 	handle_ioerr(ndata, readerr);
 	goto out_finish;
@@ -1594,7 +2700,7 @@ basen_ll_read(void *cb_data, int readerr,
     }
 
     while (buflen > 0 &&
-	   (ndata->read_enabled || filter_ll_read_needed(ndata))) {
+	   (basen_read_wanted(ndata) || filter_ll_read_needed(ndata))) {
 	ndata->in_read = true;
 	do {
 	    gensiods wrlen = 0;
@@ -1628,7 +2734,7 @@ basen_ll_read(void *cb_data, int readerr,
 		buf += wrlen;
 		buflen -= wrlen;
 	    }
-	} while (ndata->read_enabled && buflen > 0);
+	} while (basen_read_wanted(ndata) && buflen > 0);
 	ndata->in_read = false;
 
 	basen_filter_ul_push(ndata, true);
@@ -1650,13 +2756,28 @@ basen_ll_read(void *cb_data, int readerr,
     }
 
  out_finish:
+    basen_inline_begin(ndata);
     basen_set_ll_enables(ndata);
+    basen_inline_end(ndata);
+    if (ndata->lat && ndata->lat->rd_arrive) {
+	/* Anything left over waits for a later read. */
+	if (!ndata->lat->rd_queued &&
+		(basen_rd_held(ndata) || buf < ibuf + ibuflen))
+	    ndata->lat->rd_queued = ndata->lat->rd_arrive;
+	ndata->lat->rd_arrive = 0;
+    }
  out_unlock:
+    if (ndata->lat)
+	ndata->lat->rd_more = buf < ibuf + ibuflen;
     basen_deref_and_unlock(ndata);
 
 #ifdef DEBUG_DATA
     printf("LL read returns %ld\n", buf - ibuf);
 #endif
+    if (buf > ibuf) {
+	gensio_stats_add(ndata->stats, rx_bytes, buf - ibuf);
+	gensio_stats_add(ndata->stats, rx_events, 1);
+    }
     return buf - ibuf;
 }
 
@@ -1666,6 +2787,7 @@ basen_ll_write_ready(void *cb_data)
     struct basen_data *ndata = cb_data;
     int err;
 
+    basen_count_unblocked(ndata);
     basen_lock_and_ref(ndata);
     if (ndata->ll_err) {
 	/* Just ignore it if we have an error. */
@@ -1685,6 +2807,11 @@ basen_ll_write_ready(void *cb_data)
     ndata->ll_can_write = true;
     ndata->in_xmit_ready = true;
  retry:
+    err = basen_cork_flush(ndata);
+    if (err) {
+	handle_ioerr(ndata, err);
+	goto out_setnotready;
+    }
     if (filter_ll_write_pending(ndata)) {
 	err = filter_ul_write(ndata, basen_write_data_handler, NULL, NULL, 0,
 			      NULL);
@@ -1718,11 +2845,33 @@ basen_ll_write_ready(void *cb_data)
     }
 
  out_setnotready:
+    basen_inline_begin(ndata);
     basen_set_ll_enables(ndata);
     ndata->in_xmit_ready = false;
     if (ndata->deferred_write)
 	/* Could have gotten a deferred write while we were unlocked. */
 	basen_sched_deferred_op(ndata);
+    basen_inline_end(ndata);
+ out:
+    basen_deref_and_unlock(ndata);
+}
+
+static void
+basen_ll_read_into_done(struct basen_data *ndata, int err, gensiods count)
+{
+    basen_lock_and_ref(ndata);
+    if (!ndata->rinto_ll)
+	goto out;
+    if (err && err != GE_LOCALCLOSED)
+	handle_ioerr(ndata, err);
+    if (count) {
+	gensio_stats_add(ndata->stats, rx_bytes, count);
+	gensio_stats_add(ndata->stats, rx_events, 1);
+    }
+    basen_rinto_complete(ndata, err, count);
+    basen_inline_begin(ndata);
+    basen_set_ll_enables(ndata);
+    basen_inline_end(ndata);
  out:
     basen_deref_and_unlock(ndata);
 }
@@ -1740,6 +2889,10 @@ gensio_ll_base_cb(void *cb_data, int op, int val,
 	basen_ll_write_ready(cb_data);
 	return 0;
 
+    case GENSIO_LL_CB_READ_INTO_DONE:
+	basen_ll_read_into_done(cb_data, val, buflen);
+	return 0;
+
     default:
 	return 0;
     }
@@ -1763,8 +2916,8 @@ basen_start_timer_op(void *cb_data, gensio_time *timeout)
     if (ndata->state == BASEN_OPEN || ndata->state == BASEN_CLOSE_WAIT_DRAIN) {
 	basen_start_timer(ndata, timeout);
     } else {
-	ndata->timer_start_pending = true;
-	ndata->pending_timer = *timeout;
+	ndata->cold.timer_start_pending = true;
+	ndata->cold.pending_timer = *timeout;
     }
 }
 
@@ -1782,8 +2935,8 @@ static int
 basen_call_child_control_op(struct basen_data *ndata,
 			    struct gensio_filter_cb_control_data *ctrl)
 {
-    return gensio_control(ndata->child, ctrl->depth, ctrl->get, ctrl->option,
-			  ctrl->data, ctrl->datalen);
+    return gensio_control(ndata->cold.child, ctrl->depth, ctrl->get,
+			  ctrl->option, ctrl->data, ctrl->datalen);
 }
 
 static void
@@ -1809,12 +2962,21 @@ basen_filter_input_ready(void *cb_data)
     basen_unlock(ndata);
 }
 
-static int
-gensio_base_filter_cb(void *cb_data, int op, void *data)
+static void
+basen_filter_deref(void *cb_data)
 {
-    switch (op) {
-    case GENSIO_FILTER_CB_OUTPUT_READY:
-	basen_output_ready(cb_data);
+    struct basen_data *ndata = cb_data;
+
+    basen_lock(ndata);
+    basen_deref_and_unlock(ndata);
+}
+
+static int
+gensio_base_filter_cb(void *cb_data, int op, void *data)
+{
+    switch (op) {
+    case GENSIO_FILTER_CB_OUTPUT_READY:
+	basen_output_ready(cb_data);
 	return 0;
 
     case GENSIO_FILTER_CB_START_TIMER:
@@ -1837,6 +2999,14 @@ gensio_base_filter_cb(void *cb_data, int op, void *data)
 	basen_filter_input_ready(cb_data);
 	return 0;
 
+    case GENSIO_FILTER_CB_REF:
+	basen_ref((struct basen_data *) cb_data);
+	return 0;
+
+    case GENSIO_FILTER_CB_DEREF:
+	basen_filter_deref(cb_data);
+	return 0;
+
     default:
 	return GE_NOTSUP;
     }
@@ -1860,16 +3030,28 @@ gensio_i_alloc(struct gensio_os_funcs *o,
     ndata->o = o;
     ndata->refcount = 1;
 
+#ifdef DEBUG_STATE
+    ndata->cold.state_trace = o->zalloc(o, sizeof(struct basen_state_trace) *
+					STATE_TRACE_LEN);
+    if (!ndata->cold.state_trace)
+	goto out_nomem;
+#endif
+
     ndata->lock = o->alloc_lock(o);
     if (!ndata->lock)
 	goto out_nomem;
 
-    ndata->timer = o->alloc_timer(o, basen_timeout, ndata);
-    if (!ndata->timer)
+    ndata->write_lock = o->alloc_lock(o);
+    if (!ndata->write_lock)
 	goto out_nomem;
 
-    ndata->deferred_op_runner = o->alloc_runner(o, basen_deferred_op, ndata);
-    if (!ndata->deferred_op_runner)
+    ndata->cold.timer = o->alloc_timer(o, basen_timeout, ndata);
+    if (!ndata->cold.timer)
+	goto out_nomem;
+
+    ndata->cold.deferred_op_runner = o->alloc_runner(o, basen_deferred_op,
+						     ndata);
+    if (!ndata->cold.deferred_op_runner)
 	goto out_nomem;
 
     ll->ndata = ndata;
@@ -1877,7 +3059,8 @@ gensio_i_alloc(struct gensio_os_funcs *o,
 				  child, typename, ndata);
     if (!ndata->io)
 	goto out_nomem;
-    ndata->child = child;
+    ndata->cold.child = child;
+    ndata->stats = gensio_get_stats(ndata->io);
     gensio_set_is_client(ndata->io, is_client);
     gensio_ll_set_callback(ll, gensio_ll_base_cb, ndata);
     if (filter) {
@@ -1905,16 +3088,16 @@ gensio_i_alloc(struct gensio_os_funcs *o,
 	if (!open_done)
 	    goto out_nomem;
 
-	ndata->open_done = open_done;
-	ndata->open_data = open_data;
+	ndata->cold.open_done = open_done;
+	ndata->cold.open_data = open_data;
     }
 
-    if (ndata->child) {
-	if (gensio_is_reliable(ndata->child))
+    if (ndata->cold.child) {
+	if (gensio_is_reliable(ndata->cold.child))
 	    gensio_set_is_reliable(ndata->io, true);
-	if (gensio_is_authenticated(ndata->child))
+	if (gensio_is_authenticated(ndata->cold.child))
 	    gensio_set_is_authenticated(ndata->io, true);
-	if (gensio_is_encrypted(ndata->child))
+	if (gensio_is_encrypted(ndata->cold.child))
 	    gensio_set_is_encrypted(ndata->io, true);
     }
     return ndata->io;
@@ -1924,6 +3107,808 @@ out_nomem:
     return NULL;
 }
 
+
+/*
+ * A fused filter runs a stack of filters that would otherwise each be
+ * in their own base gensio over the one below it, see the "fuse"
+ * default.  This saves a gensio, its lock, and its callbacks per
+ * layer.  subs[0] is the top filter, next to the user, and
+ * subs[nr_subs - 1] is next to the ll.  Written data goes from
+ * subs[0] down, read data goes from subs[nr_subs - 1] up.
+ *
+ * The subs connect one at a time from the bottom and disconnect one
+ * at a time from the top, like they would as separate gensios.  The
+ * base only has one timer, so the timers the subs ask for are kept
+ * here and the base timer is run for the earliest one.  While
+ * opening and closing, the base timer is used for retries, so the
+ * sub timers are folded into the retry time.
+ */
+struct fuse_level {
+    struct fuse_filter *ffilter;
+    unsigned int idx;
+    bool timer_set;
+    int64_t deadline;
+};
+
+struct fuse_filter {
+    struct gensio_filter *filter;
+    struct gensio_os_funcs *o;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+    struct gensio *io;
+
+    unsigned int nr_subs;
+    struct gensio_filter **subs;
+    struct fuse_level *levels;
+
+    /*
+     * Where data out of the bottom and the top goes for the current
+     * write.  The base serializes ul and ll writes separately.
+     */
+    gensio_ul_filter_data_handler ul_handler;
+    void *ul_cb_data;
+    gensio_ll_filter_data_handler ll_handler;
+    void *ll_cb_data;
+
+    /* Protects the timer data and the open and close position. */
+    struct gensio_lock *lock;
+
+    /*
+     * The sub being connected, counts down to -1 when all are open.
+     * When closing, the sub being disconnected, counts up to nr_subs.
+     */
+    int cur_open;
+    unsigned int cur_close;
+    bool closing;
+
+    /* A retry the current sub asked for while opening or closing. */
+    bool retry_set;
+    int64_t retry_deadline;
+
+    /* The base timer is running for the sub timers. */
+    bool armed;
+    int64_t armed_deadline;
+};
+
+#define filter_to_fuse(v) ((struct fuse_filter *) \
+			   gensio_filter_get_user_data(v))
+
+static int fuse_filter_func(struct gensio_filter *filter, int op,
+			    void *func, void *data,
+			    gensiods *count, void *buf,
+			    const void *cbuf, gensiods buflen,
+			    const char *const *auxdata);
+
+static int64_t
+fuse_now(struct fuse_filter *ffilter)
+{
+    gensio_time t;
+
+    ffilter->o->get_monotonic_time(ffilter->o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+static void
+fuse_set_time(gensio_time *t, int64_t nsecs)
+{
+    if (nsecs < 0)
+	nsecs = 0;
+    t->secs = nsecs / 1000000000LL;
+    t->nsecs = nsecs % 1000000000LL;
+}
+
+/*
+ * Is the sub open as far as its timers go?  A separate gensio does
+ * not run filter timeouts while its filter is opening or closing.
+ */
+static bool
+fuse_sub_running(struct fuse_filter *ffilter, unsigned int i)
+{
+    if ((int) i <= ffilter->cur_open)
+	return false;
+    return !ffilter->closing || i > ffilter->cur_close;
+}
+
+/* Call with the lock held. */
+static bool
+fuse_next_deadline(struct fuse_filter *ffilter, int64_t *deadline)
+{
+    unsigned int i;
+    bool found = false;
+
+    for (i = 0; i < ffilter->nr_subs; i++) {
+	struct fuse_level *l = &ffilter->levels[i];
+
+	if (!l->timer_set || !fuse_sub_running(ffilter, i))
+	    continue;
+	if (!found || l->deadline < *deadline)
+	    *deadline = l->deadline;
+	found = true;
+    }
+    return found;
+}
+
+/* Run the base timer for the earliest sub timer, call with the lock held. */
+static void
+fuse_arm_timer(struct fuse_filter *ffilter)
+{
+    int64_t deadline;
+    gensio_time t;
+
+    if (ffilter->cur_open >= 0 || ffilter->closing)
+	return; /* See fuse_retry(). */
+
+    if (!fuse_next_deadline(ffilter, &deadline)) {
+	if (ffilter->armed)
+	    ffilter->filter_cb(ffilter->filter_cb_data,
+			       GENSIO_FILTER_CB_STOP_TIMER, NULL);
+	ffilter->armed = false;
+	return;
+    }
+    if (ffilter->armed) {
+	if (ffilter->armed_deadline <= deadline)
+	    return;
+	ffilter->filter_cb(ffilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+    }
+    fuse_set_time(&t, deadline - fuse_now(ffilter));
+    ffilter->filter_cb(ffilter->filter_cb_data, GENSIO_FILTER_CB_START_TIMER,
+		       &t);
+    ffilter->armed = true;
+    ffilter->armed_deadline = deadline;
+}
+
+static int
+fuse_run_timers(struct fuse_filter *ffilter)
+{
+    int64_t now = fuse_now(ffilter);
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < ffilter->nr_subs; i++) {
+	struct fuse_level *l = &ffilter->levels[i];
+
+	ffilter->o->lock(ffilter->lock);
+	if (!l->timer_set || l->deadline > now ||
+		!fuse_sub_running(ffilter, i)) {
+	    ffilter->o->unlock(ffilter->lock);
+	    continue;
+	}
+	l->timer_set = false;
+	ffilter->o->unlock(ffilter->lock);
+	err = gensio_filter_timeout(ffilter->subs[i]);
+	if (err)
+	    return err;
+    }
+    return 0;
+}
+
+static int
+fuse_timeout(struct fuse_filter *ffilter)
+{
+    int err;
+
+    ffilter->o->lock(ffilter->lock);
+    ffilter->armed = false;
+    ffilter->o->unlock(ffilter->lock);
+    err = fuse_run_timers(ffilter);
+    ffilter->o->lock(ffilter->lock);
+    fuse_arm_timer(ffilter);
+    ffilter->o->unlock(ffilter->lock);
+    return err;
+}
+
+/*
+ * The current sub wants a retry, or the subs that are open have
+ * timers, or a sub finished and the next one may have data to get
+ * out.  Have the base run its timer for the earliest one.
+ */
+static int
+fuse_retry(struct fuse_filter *ffilter, gensio_time *timeout, int64_t now,
+	   bool progress)
+{
+    int64_t deadline = now;
+    bool found;
+
+    ffilter->o->lock(ffilter->lock);
+    found = fuse_next_deadline(ffilter, &deadline);
+    ffilter->o->unlock(ffilter->lock);
+    if (ffilter->retry_set && (!found || ffilter->retry_deadline < deadline)) {
+	deadline = ffilter->retry_deadline;
+	found = true;
+    }
+    if (progress) {
+	deadline = now;
+	found = true;
+    }
+    if (!found)
+	return GE_INPROGRESS;
+    fuse_set_time(timeout, deadline - now);
+    return GE_RETRY;
+}
+
+/*
+ * Did the current sub's own retry time come?  The base timer may have
+ * gone off for a sub timer instead.
+ */
+static bool
+fuse_sub_timed_out(struct fuse_filter *ffilter, bool was_timeout, int64_t now)
+{
+    if (!was_timeout || !ffilter->retry_set || now < ffilter->retry_deadline)
+	return false;
+    ffilter->retry_set = false;
+    return true;
+}
+
+static void
+fuse_sub_retry(struct fuse_filter *ffilter, gensio_time *timeout, int64_t now)
+{
+    /* Like the base timer, a retry while one is pending is ignored. */
+    if (ffilter->retry_set)
+	return;
+    ffilter->retry_set = true;
+    ffilter->retry_deadline = now + timeout->secs * 1000000000LL +
+	timeout->nsecs;
+}
+
+static int
+fuse_try_connect(struct fuse_filter *ffilter, gensio_time *timeout,
+		 bool was_timeout)
+{
+    struct gensio_filter *sub;
+    bool progress = false;
+    int64_t now;
+    int err;
+
+    err = fuse_run_timers(ffilter);
+    if (err)
+	return err;
+
+    now = fuse_now(ffilter);
+    while (ffilter->cur_open >= 0) {
+	sub = ffilter->subs[ffilter->cur_open];
+	err = gensio_filter_try_connect(sub, timeout,
+				fuse_sub_timed_out(ffilter, was_timeout, now));
+	if (err == GE_RETRY) {
+	    fuse_sub_retry(ffilter, timeout, now);
+	    break;
+	}
+	if (err)
+	    break;
+	ffilter->retry_set = false;
+	if (ffilter->cur_open > 0) {
+	    /* The base does this for the top one. */
+	    err = gensio_filter_check_open_done(sub, ffilter->io);
+	    if (err)
+		return err;
+	}
+	ffilter->o->lock(ffilter->lock);
+	ffilter->cur_open--;
+	ffilter->o->unlock(ffilter->lock);
+	was_timeout = false;
+	progress = true;
+    }
+
+    if (ffilter->cur_open < 0) {
+	ffilter->o->lock(ffilter->lock);
+	fuse_arm_timer(ffilter);
+	ffilter->o->unlock(ffilter->lock);
+	return 0;
+    }
+    if (err != GE_INPROGRESS && err != GE_RETRY)
+	return err;
+    return fuse_retry(ffilter, timeout, now, progress);
+}
+
+static bool
+fuse_subs_queued(struct fuse_filter *ffilter, unsigned int last)
+{
+    unsigned int i;
+
+    for (i = 0; i <= last; i++) {
+	if (gensio_filter_ll_write_queued(ffilter->subs[i]))
+	    return true;
+    }
+    return false;
+}
+
+static int
+fuse_try_disconnect(struct fuse_filter *ffilter, gensio_time *timeout,
+		    bool was_timeout)
+{
+    bool progress = false;
+    int64_t now;
+    int err;
+
+    if (!ffilter->closing) {
+	ffilter->o->lock(ffilter->lock);
+	ffilter->closing = true;
+	ffilter->cur_close = 0;
+	ffilter->armed = false;
+	ffilter->o->unlock(ffilter->lock);
+	ffilter->retry_set = false;
+    }
+
+    err = fuse_run_timers(ffilter);
+    if (err)
+	return err;
+
+    now = fuse_now(ffilter);
+    while (ffilter->cur_close < ffilter->nr_subs) {
+	/*
+	 * Like a separate gensio, a sub doesn't close until what it
+	 * and the subs above it have written is gone.  The base waits
+	 * for this before the top one.
+	 */
+	if (ffilter->cur_close > 0 &&
+		fuse_subs_queued(ffilter, ffilter->cur_close)) {
+	    err = GE_INPROGRESS;
+	    break;
+	}
+	err = gensio_filter_try_disconnect(ffilter->subs[ffilter->cur_close],
+			timeout, fuse_sub_timed_out(ffilter, was_timeout, now));
+	if (err == GE_RETRY) {
+	    fuse_sub_retry(ffilter, timeout, now);
+	    break;
+	}
+	if (err == GE_INPROGRESS)
+	    break;
+	/* Errors are ignored here, like the base does. */
+	ffilter->retry_set = false;
+	ffilter->o->lock(ffilter->lock);
+	ffilter->cur_close++;
+	ffilter->o->unlock(ffilter->lock);
+	was_timeout = false;
+	progress = true;
+    }
+
+    if (ffilter->cur_close >= ffilter->nr_subs)
+	return 0;
+    return fuse_retry(ffilter, timeout, now, progress);
+}
+
+static int
+fuse_ul_handler(void *cb_data, gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    struct fuse_level *l = cb_data;
+    struct fuse_filter *ffilter = l->ffilter;
+    unsigned int i = l->idx + 1;
+
+    if (i == ffilter->nr_subs)
+	return ffilter->ul_handler(ffilter->ul_cb_data, rcount, sg, sglen,
+				   auxdata);
+    return gensio_filter_ul_write(ffilter->subs[i], fuse_ul_handler,
+				  &ffilter->levels[i], rcount, sg, sglen,
+				  auxdata);
+}
+
+static int
+fuse_ul_write(struct fuse_filter *ffilter,
+	      gensio_ul_filter_data_handler handler, void *cb_data,
+	      gensiods *rcount,
+	      const struct gensio_sg *sg, gensiods sglen,
+	      const char *const *auxdata)
+{
+    unsigned int i = 0;
+    int err;
+
+    ffilter->ul_handler = handler;
+    ffilter->ul_cb_data = cb_data;
+    if (sg) {
+	err = gensio_filter_ul_write(ffilter->subs[0], fuse_ul_handler,
+				     &ffilter->levels[0], rcount, sg, sglen,
+				     auxdata);
+	if (err)
+	    return err;
+	i = 1;
+    } else if (rcount) {
+	*rcount = 0;
+    }
+
+    /* Push out anything the subs are holding, from the top down. */
+    for (; i < ffilter->nr_subs; i++) {
+	if (!gensio_filter_ll_write_pending(ffilter->subs[i]))
+	    continue;
+	err = gensio_filter_ul_write(ffilter->subs[i], fuse_ul_handler,
+				     &ffilter->levels[i], NULL, NULL, 0, NULL);
+	if (err)
+	    return err;
+    }
+    return 0;
+}
+
+static int
+fuse_ll_handler(void *cb_data, gensiods *rcount,
+		unsigned char *buf, gensiods buflen,
+		const char *const *auxdata)
+{
+    struct fuse_level *l = cb_data;
+    struct fuse_filter *ffilter = l->ffilter;
+    unsigned int i = l->idx;
+
+    if (i == 0)
+	return ffilter->ll_handler(ffilter->ll_cb_data, rcount, buf, buflen,
+				   auxdata);
+    return gensio_filter_ll_write(ffilter->subs[i - 1], fuse_ll_handler,
+				  &ffilter->levels[i - 1], rcount, buf, buflen,
+				  auxdata);
+}
+
+static int
+fuse_ll_write(struct fuse_filter *ffilter,
+	      gensio_ll_filter_data_handler handler, void *cb_data,
+	      gensiods *rcount,
+	      unsigned char *buf, gensiods buflen,
+	      const char *const *auxdata)
+{
+    unsigned int i, last = ffilter->nr_subs - 1;
+    int err;
+
+    ffilter->ll_handler = handler;
+    ffilter->ll_cb_data = cb_data;
+    if (buf)
+	return gensio_filter_ll_write(ffilter->subs[last], fuse_ll_handler,
+				      &ffilter->levels[last], rcount,
+				      buf, buflen, auxdata);
+
+    /* Deliver what the subs are holding, from the bottom up. */
+    if (rcount)
+	*rcount = 0;
+    for (i = last + 1; i > 0; i--) {
+	if (i > 1 && !gensio_filter_ul_read_pending(ffilter->subs[i - 1]))
+	    continue;
+	err = gensio_filter_ll_write(ffilter->subs[i - 1], fuse_ll_handler,
+				     &ffilter->levels[i - 1], NULL,
+				     NULL, 0, NULL);
+	if (err)
+	    return err;
+    }
+    return 0;
+}
+
+static int
+fuse_sub_cb(void *cb_data, int op, void *data)
+{
+    struct fuse_level *l = cb_data;
+    struct fuse_filter *ffilter = l->ffilter;
+    struct gensio_filter_cb_control_data *ctrl, nctrl;
+    gensio_time *timeout;
+    unsigned int i;
+
+    switch (op) {
+    case GENSIO_FILTER_CB_START_TIMER:
+	timeout = data;
+	ffilter->o->lock(ffilter->lock);
+	/* Like the base timer, a start while running is ignored. */
+	if (!l->timer_set) {
+	    l->timer_set = true;
+	    l->deadline = fuse_now(ffilter) +
+		timeout->secs * 1000000000LL + timeout->nsecs;
+	    fuse_arm_timer(ffilter);
+	}
+	ffilter->o->unlock(ffilter->lock);
+	return 0;
+
+    case GENSIO_FILTER_CB_STOP_TIMER:
+	ffilter->o->lock(ffilter->lock);
+	l->timer_set = false;
+	fuse_arm_timer(ffilter);
+	ffilter->o->unlock(ffilter->lock);
+	return 0;
+
+    case GENSIO_FILTER_CB_CONTROL:
+	/* The child of a sub is the sub below it. */
+	ctrl = data;
+	i = l->idx + 1 + ctrl->depth;
+	if (i < ffilter->nr_subs) {
+	    gensio_filter_control(ffilter->subs[i], ctrl->get, ctrl->option,
+				  ctrl->data, ctrl->datalen);
+	    return 0;
+	}
+	nctrl = *ctrl;
+	nctrl.depth = i - ffilter->nr_subs;
+	return ffilter->filter_cb(ffilter->filter_cb_data, op, &nctrl);
+
+    default:
+	return ffilter->filter_cb(ffilter->filter_cb_data, op, data);
+    }
+}
+
+static void
+fuse_set_callback(struct gensio_filter *filter, gensio_filter_cb cb,
+		  void *cb_data)
+{
+    struct fuse_filter *ffilter = filter_to_fuse(filter);
+    unsigned int i;
+
+    ffilter->filter_cb = cb;
+    ffilter->filter_cb_data = cb_data;
+    for (i = 0; i < ffilter->nr_subs; i++) {
+	ffilter->subs[i]->ndata = filter->ndata;
+	gensio_filter_set_callback(ffilter->subs[i], fuse_sub_cb,
+				   &ffilter->levels[i]);
+    }
+}
+
+static void
+fuse_reset(struct fuse_filter *ffilter)
+{
+    unsigned int i;
+
+    ffilter->o->lock(ffilter->lock);
+    ffilter->cur_open = ffilter->nr_subs - 1;
+    ffilter->cur_close = 0;
+    ffilter->closing = false;
+    ffilter->retry_set = false;
+    ffilter->armed = false;
+    for (i = 0; i < ffilter->nr_subs; i++)
+	ffilter->levels[i].timer_set = false;
+    ffilter->o->unlock(ffilter->lock);
+}
+
+static int
+fuse_setup(struct fuse_filter *ffilter, struct gensio *io)
+{
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < ffilter->nr_subs; i++) {
+	err = gensio_filter_setup(ffilter->subs[i], io);
+	if (err) {
+	    while (i > 0)
+		gensio_filter_cleanup(ffilter->subs[--i]);
+	    return err;
+	}
+    }
+    ffilter->io = io;
+    fuse_reset(ffilter);
+    return 0;
+}
+
+static void
+fuse_cleanup(struct fuse_filter *ffilter)
+{
+    unsigned int i;
+
+    for (i = 0; i < ffilter->nr_subs; i++)
+	gensio_filter_cleanup(ffilter->subs[i]);
+    fuse_reset(ffilter);
+}
+
+/* Free the fused filter but not the subs. */
+static void
+fuse_free_shell(struct fuse_filter *ffilter)
+{
+    struct gensio_os_funcs *o = ffilter->o;
+
+    if (ffilter->filter)
+	gensio_filter_free_data(ffilter->filter);
+    if (ffilter->lock)
+	o->free_lock(ffilter->lock);
+    if (ffilter->subs)
+	o->free(o, ffilter->subs);
+    if (ffilter->levels)
+	o->free(o, ffilter->levels);
+    o->free(o, ffilter);
+}
+
+static void
+fuse_free(struct fuse_filter *ffilter)
+{
+    unsigned int i;
+
+    for (i = 0; i < ffilter->nr_subs; i++)
+	gensio_filter_free(ffilter->subs[i]);
+    fuse_free_shell(ffilter);
+}
+
+static int
+fuse_filter_func(struct gensio_filter *filter, int op,
+		 void *func, void *data,
+		 gensiods *count, void *buf,
+		 const void *cbuf, gensiods buflen,
+		 const char *const *auxdata)
+{
+    struct fuse_filter *ffilter = filter_to_fuse(filter);
+    unsigned int i;
+    int rv;
+
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	fuse_set_callback(filter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	for (i = 0; i < ffilter->nr_subs; i++) {
+	    if (gensio_filter_ul_read_pending(ffilter->subs[i]))
+		return true;
+	}
+	return false;
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	for (i = 0; i < ffilter->nr_subs; i++) {
+	    if (gensio_filter_ll_write_pending(ffilter->subs[i]))
+		return true;
+	}
+	return false;
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	for (i = 0; i < ffilter->nr_subs; i++) {
+	    if (gensio_filter_ll_read_needed(ffilter->subs[i]))
+		return true;
+	}
+	return false;
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return gensio_filter_check_open_done(ffilter->subs[0], data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return fuse_try_connect(ffilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return fuse_try_disconnect(ffilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return fuse_ul_write(ffilter, func, data, count, cbuf, buflen,
+			     auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return fuse_ll_write(ffilter, func, data, count, buf, buflen,
+			     auxdata);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	return fuse_timeout(ffilter);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return fuse_setup(ffilter, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	fuse_cleanup(ffilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	fuse_free(ffilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	/* The first sub from the top that knows the control gets it. */
+	for (i = 0; i < ffilter->nr_subs; i++) {
+	    rv = gensio_filter_control(ffilter->subs[i], *((bool *) cbuf),
+				       buflen, data, count);
+	    if (rv != GE_NOTSUP)
+		return rv;
+	}
+	return GE_NOTSUP;
+
+    case GENSIO_FILTER_FUNC_UL_CAN_WRITE:
+	*((bool *) data) = true;
+	for (i = 0; i < ffilter->nr_subs; i++) {
+	    if (!gensio_filter_ul_can_write(ffilter->subs[i])) {
+		*((bool *) data) = false;
+		break;
+	    }
+	}
+	return 0;
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_QUEUED:
+	*((bool *) data) = fuse_subs_queued(ffilter, ffilter->nr_subs - 1);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_IO_ERR:
+	for (i = 0; i < ffilter->nr_subs; i++)
+	    gensio_filter_io_err(ffilter->subs[i], *((int *) data));
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/*
+ * Make a fused filter with top over below.  If below is a fused
+ * filter its subs are used, it is not touched.
+ */
+static struct gensio_filter *
+fuse_filter_alloc(struct gensio_os_funcs *o, struct gensio_filter *top,
+		  struct gensio_filter *below)
+{
+    struct fuse_filter *ffilter, *bfilter = NULL;
+    unsigned int i, nr_subs = 2;
+
+    if (below->func == fuse_filter_func) {
+	bfilter = filter_to_fuse(below);
+	nr_subs = bfilter->nr_subs + 1;
+    }
+
+    ffilter = o->zalloc(o, sizeof(*ffilter));
+    if (!ffilter)
+	return NULL;
+    ffilter->o = o;
+    ffilter->nr_subs = nr_subs;
+    ffilter->lock = o->alloc_lock(o);
+    if (!ffilter->lock)
+	goto out_nomem;
+    ffilter->subs = o->zalloc(o, sizeof(*ffilter->subs) * nr_subs);
+    if (!ffilter->subs)
+	goto out_nomem;
+    ffilter->levels = o->zalloc(o, sizeof(*ffilter->levels) * nr_subs);
+    if (!ffilter->levels)
+	goto out_nomem;
+    ffilter->filter = gensio_filter_alloc_data(o, fuse_filter_func, ffilter);
+    if (!ffilter->filter)
+	goto out_nomem;
+
+    ffilter->subs[0] = top;
+    for (i = 1; i < nr_subs; i++)
+	ffilter->subs[i] = bfilter ? bfilter->subs[i - 1] : below;
+    for (i = 0; i < nr_subs; i++) {
+	ffilter->levels[i].ffilter = ffilter;
+	ffilter->levels[i].idx = i;
+    }
+    ffilter->cur_open = nr_subs - 1;
+    return ffilter->filter;
+
+ out_nomem:
+    fuse_free_shell(ffilter);
+    return NULL;
+}
+
+/*
+ * Merge the fusable child into a new gensio with filter on top of
+ * the child's filters.  The child is left empty, it goes away when
+ * the caller drops it.  Returns NULL if it can't be done, nothing is
+ * changed then.
+ */
+static struct gensio *
+basen_fuse_alloc(struct gensio_os_funcs *o,
+		 struct gensio_ll *ll,
+		 struct gensio_filter *filter,
+		 struct gensio *child,
+		 const char *typename,
+		 gensio_event cb, void *user_data)
+{
+    struct basen_data *cndata;
+    struct gensio_filter *ffilter;
+    struct gensio *io;
+
+    if (gensio_call_func(child, GENSIO_FUNC_FUSE, NULL, NULL, 0, &cndata,
+			 NULL))
+	return NULL;
+
+    ffilter = fuse_filter_alloc(o, filter, cndata->filter);
+    if (!ffilter)
+	return NULL;
+
+    io = gensio_i_alloc(o, cndata->ll, ffilter, cndata->cold.child, typename,
+			true, NULL, NULL, cb, user_data);
+    if (!io) {
+	cndata->ll->ndata = cndata;
+	fuse_free_shell(filter_to_fuse(ffilter));
+	return NULL;
+    }
+
+    /* Keep what the child had from below. */
+    if (gensio_is_reliable(child))
+	gensio_set_is_reliable(io, true);
+    if (gensio_is_authenticated(child))
+	gensio_set_is_authenticated(io, true);
+    if (gensio_is_encrypted(child))
+	gensio_set_is_encrypted(io, true);
+
+    if (cndata->filter->func == fuse_filter_func)
+	fuse_free_shell(filter_to_fuse(cndata->filter));
+    cndata->filter = NULL;
+    cndata->ll = NULL;
+    cndata->cold.child = NULL;
+
+    /* Drops the ll's hold on the child. */
+    gensio_ll_free(ll);
+    return io;
+}
+
 struct gensio *
 base_gensio_alloc(struct gensio_os_funcs *o,
 		  struct gensio_ll *ll,
@@ -1932,10 +3917,25 @@ base_gensio_alloc(struct gensio_os_funcs *o,
 		  const char *typename,
 		  gensio_event cb, void *user_data)
 {
+    struct gensio *io;
+
+    if (filter && child && gensio_is_fusable(child)) {
+	io = basen_fuse_alloc(o, ll, filter, child, typename, cb, user_data);
+	if (io)
+	    return io;
+    }
     return gensio_i_alloc(o, ll, filter, child, typename, true,
 			  NULL, NULL, cb, user_data);
 }
 
+void
+base_gensio_set_no_fuse(struct gensio *io)
+{
+    struct basen_data *ndata = gensio_get_gensio_data(io);
+
+    ndata->cold.no_fuse = true;
+}
+
 struct gensio *
 base_gensio_server_alloc(struct gensio_os_funcs *o,
 			 struct gensio_ll *ll,
@@ -1993,6 +3993,8 @@ gensio_filter_set_callback(struct gensio_filter *filter,
 bool
 gensio_filter_ul_read_pending(struct gensio_filter *filter)
 {
+    if (filter->ops && filter->ops->ul_read_pending)
+	return filter->ops->ul_read_pending(filter);
     return filter->func(filter, GENSIO_FILTER_FUNC_UL_READ_PENDING,
 			NULL, NULL, NULL, NULL, NULL, 0, NULL);
 }
@@ -2000,6 +4002,8 @@ gensio_filter_ul_read_pending(struct gensio_filter *filter)
 bool
 gensio_filter_ll_write_pending(struct gensio_filter *filter)
 {
+    if (filter->ops && filter->ops->ll_write_pending)
+	return filter->ops->ll_write_pending(filter);
     return filter->func(filter, GENSIO_FILTER_FUNC_LL_WRITE_PENDING,
 			NULL, NULL, NULL, NULL, NULL, 0, NULL);
 }
@@ -2011,8 +4015,11 @@ gensio_filter_ul_can_write(struct gensio_filter *filter)
     int err;
 
     /* If not implemented, this will just be ignored. */
-    err = filter->func(filter, GENSIO_FILTER_FUNC_UL_CAN_WRITE,
-		       NULL, &val, NULL, NULL, NULL, 0, NULL);
+    if (filter->ops && filter->ops->ul_can_write)
+	err = filter->ops->ul_can_write(filter, &val);
+    else
+	err = filter->func(filter, GENSIO_FILTER_FUNC_UL_CAN_WRITE,
+			   NULL, &val, NULL, NULL, NULL, 0, NULL);
     if (err)
 	return filter->ndata->ll_can_write;
     return val;
@@ -2025,8 +4032,11 @@ gensio_filter_ll_write_queued(struct gensio_filter *filter)
     int rv;
 
     /* If not implemented, this will just be ignored. */
-    rv = filter->func(filter, GENSIO_FILTER_FUNC_LL_WRITE_QUEUED,
-		      NULL, &val, NULL, NULL, NULL, 0, NULL);
+    if (filter->ops && filter->ops->ll_write_queued)
+	rv = filter->ops->ll_write_queued(filter, &val);
+    else
+	rv = filter->func(filter, GENSIO_FILTER_FUNC_LL_WRITE_QUEUED,
+			  NULL, &val, NULL, NULL, NULL, 0, NULL);
     if (rv)
 	return gensio_filter_ll_write_pending(filter);
     return val;
@@ -2042,6 +4052,8 @@ gensio_filter_io_err(struct gensio_filter *filter, int err)
 bool
 gensio_filter_ll_read_needed(struct gensio_filter *filter)
 {
+    if (filter->ops && filter->ops->ll_read_needed)
+	return filter->ops->ll_read_needed(filter);
     return filter->func(filter, GENSIO_FILTER_FUNC_LL_READ_NEEDED,
 			NULL, NULL, NULL, NULL, NULL, 0, NULL);
 }
@@ -2079,6 +4091,9 @@ gensio_filter_ul_write(struct gensio_filter *filter,
 		       const struct gensio_sg *sg, gensiods sglen,
 		       const char *const *auxdata)
 {
+    if (filter->ops && filter->ops->ul_write)
+	return filter->ops->ul_write(filter, handler, cb_data, rcount,
+				     sg, sglen, auxdata);
     return filter->func(filter, GENSIO_FILTER_FUNC_UL_WRITE_SG,
 			handler, cb_data, rcount, NULL, sg, sglen, auxdata);
 }
@@ -2090,10 +4105,86 @@ gensio_filter_ll_write(struct gensio_filter *filter,
 		       unsigned char *buf, gensiods buflen,
 		       const char *const *auxdata)
 {
+    if (filter->ops && filter->ops->ll_write)
+	return filter->ops->ll_write(filter, handler, cb_data, rcount,
+				     buf, buflen, auxdata);
     return filter->func(filter, GENSIO_FILTER_FUNC_LL_WRITE,
 			handler, cb_data, rcount, buf, NULL, buflen, auxdata);
 }
 
+/*
+ * Max number of segments converted to an sg array on the stack for
+ * filters and lls that don't do chains.  Writes may be partial, so
+ * anything past this is just not written on this call.
+ */
+#define GENSIO_CHAIN_MAX_SG 16
+
+static gensiods
+gensio_bufsegs_to_sg(struct gensio_sg *sg, const struct gensio_bufseg *segs,
+		     gensiods nsegs)
+{
+    gensiods i;
+
+    if (nsegs > GENSIO_CHAIN_MAX_SG)
+	nsegs = GENSIO_CHAIN_MAX_SG;
+    for (i = 0; i < nsegs; i++) {
+	sg[i].buf = segs[i].buf->data + segs[i].offset;
+	sg[i].buflen = segs[i].len;
+    }
+    return nsegs;
+}
+
+int
+gensio_filter_ul_write_chain(struct gensio_filter *filter,
+			     gensio_ul_filter_data_handler handler,
+			     void *cb_data, gensiods *rcount,
+			     const struct gensio_bufseg *segs, gensiods nsegs,
+			     const char *const *auxdata)
+{
+    struct gensio_sg sg[GENSIO_CHAIN_MAX_SG];
+    int rv;
+
+    rv = filter->func(filter, GENSIO_FILTER_FUNC_UL_WRITE_CHAIN,
+		      handler, cb_data, rcount, NULL, segs, nsegs, auxdata);
+    if (rv != GE_NOTSUP)
+	return rv;
+
+    nsegs = gensio_bufsegs_to_sg(sg, segs, nsegs);
+    return gensio_filter_ul_write(filter, handler, cb_data, rcount,
+				  nsegs ? sg : NULL, nsegs, auxdata);
+}
+
+int
+gensio_filter_ll_write_chain(struct gensio_filter *filter,
+			     gensio_ll_filter_data_handler handler,
+			     void *cb_data, gensiods *rcount,
+			     const struct gensio_bufseg *segs, gensiods nsegs,
+			     const char *const *auxdata)
+{
+    gensiods i, count, total = 0;
+    int rv;
+
+    rv = filter->func(filter, GENSIO_FILTER_FUNC_LL_WRITE_CHAIN,
+		      handler, cb_data, rcount, NULL, segs, nsegs, auxdata);
+    if (rv != GE_NOTSUP)
+	return rv;
+
+    for (i = 0; i < nsegs; i++) {
+	count = 0;
+	rv = gensio_filter_ll_write(filter, handler, cb_data, &count,
+				    segs[i].buf->data + segs[i].offset,
+				    segs[i].len, auxdata);
+	if (rv)
+	    return rv;
+	total += count;
+	if (count < segs[i].len)
+	    break;
+    }
+    if (rcount)
+	*rcount = total;
+    return 0;
+}
+
 int
 gensio_filter_timeout(struct gensio_filter *filter)
 {
@@ -2161,6 +4252,13 @@ gensio_filter_alloc_data(struct gensio_os_funcs *o,
     return filter;
 }
 
+void
+gensio_filter_set_ops(struct gensio_filter *filter,
+		      const struct gensio_filter_ops *ops)
+{
+    filter->ops = ops;
+}
+
 void
 gensio_filter_free_data(struct gensio_filter *filter)
 {
@@ -2185,6 +4283,8 @@ gensio_ll_write(struct gensio_ll *ll, gensiods *rcount,
 		const struct gensio_sg *sg, gensiods sglen,
 		const char *const *auxdata)
 {
+    if (ll->ops && ll->ops->write)
+	return ll->ops->write(ll, rcount, sg, sglen, auxdata);
     return ll->func(ll, GENSIO_LL_FUNC_WRITE_SG, rcount, NULL, sg, sglen,
 		    auxdata);
 }
@@ -2208,6 +4308,10 @@ gensio_ll_close(struct gensio_ll *ll,
 void
 gensio_ll_set_read_callback(struct gensio_ll *ll, bool enabled)
 {
+    if (ll->ops && ll->ops->set_read_callback) {
+	ll->ops->set_read_callback(ll, enabled);
+	return;
+    }
     ll->func(ll, GENSIO_LL_FUNC_SET_READ_CALLBACK, NULL, NULL, NULL, enabled,
 	     NULL);
 }
@@ -2215,6 +4319,10 @@ gensio_ll_set_read_callback(struct gensio_ll *ll, bool enabled)
 void
 gensio_ll_set_write_callback(struct gensio_ll *ll, bool enabled)
 {
+    if (ll->ops && ll->ops->set_write_callback) {
+	ll->ops->set_write_callback(ll, enabled);
+	return;
+    }
     ll->func(ll, GENSIO_LL_FUNC_SET_WRITE_CALLBACK, NULL, NULL, NULL, enabled,
 	     NULL);
 }
@@ -2231,6 +4339,70 @@ gensio_ll_disable(struct gensio_ll *ll)
     ll->func(ll, GENSIO_LL_FUNC_DISABLE, NULL, NULL, NULL, 0, NULL);
 }
 
+int
+gensio_ll_read_into(struct gensio_ll *ll, const struct gensio_sg *sg,
+		    gensiods sglen)
+{
+    return ll->func(ll, GENSIO_LL_FUNC_READ_INTO, NULL, NULL, sg, sglen,
+		    NULL);
+}
+
+int
+gensio_ll_write_chain(struct gensio_ll *ll, gensiods *rcount,
+		      const struct gensio_bufseg *segs, gensiods nsegs,
+		      const char *const *auxdata)
+{
+    struct gensio_sg sg[GENSIO_CHAIN_MAX_SG];
+    int rv;
+
+    rv = ll->func(ll, GENSIO_LL_FUNC_WRITE_CHAIN, rcount, NULL, segs, nsegs,
+		  auxdata);
+    if (rv != GE_NOTSUP)
+	return rv;
+
+    nsegs = gensio_bufsegs_to_sg(sg, segs, nsegs);
+    return gensio_ll_write(ll, rcount, sg, nsegs, auxdata);
+}
+
+struct gensio_buf *
+gensio_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_buf *buf;
+
+    buf = o->zalloc(o, sizeof(*buf) + size);
+    if (!buf)
+	return NULL;
+    buf->o = o;
+    buf->refcount = 1;
+    buf->size = size;
+    buf->data = ((unsigned char *) buf) + sizeof(*buf);
+    return buf;
+}
+
+void
+gensio_buf_ref(struct gensio_buf *buf)
+{
+#ifdef _MSC_VER
+    _InterlockedIncrement((volatile long *) &buf->refcount);
+#else
+    __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+void
+gensio_buf_deref(struct gensio_buf *buf)
+{
+    unsigned int count;
+
+#ifdef _MSC_VER
+    count = _InterlockedDecrement((volatile long *) &buf->refcount);
+#else
+    count = __atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL);
+#endif
+    if (count == 0)
+	buf->o->free(buf->o, buf);
+}
+
 int
 gensio_ll_control(struct gensio_ll *ll, bool get, int option, char *data,
 		  gensiods *datalen)
@@ -2264,6 +4436,12 @@ gensio_ll_alloc_data(struct gensio_os_funcs *o,
     return ll;
 }
 
+void
+gensio_ll_set_ops(struct gensio_ll *ll, const struct gensio_ll_ops *ops)
+{
+    ll->ops = ops;
+}
+
 void
 gensio_ll_free_data(struct gensio_ll *ll)
 {
@@ -2276,6 +4454,14 @@ gensio_ll_get_user_data(struct gensio_ll *ll)
     return ll->user_data;
 }
 
+struct gensio_stats *
+gensio_ll_get_stats(struct gensio_ll *ll)
+{
+    if (!ll->ndata)
+	return NULL;
+    return ll->ndata->stats;
+}
+
 struct gensio_ll *
 base_gensio_get_ll(struct gensio *io)
 {
@@ -5,10 +5,18 @@
  *  SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#define _GNU_SOURCE /* Get memfd_create(). */
+#include "config.h"
 #include <string.h>
 #include <assert.h>
 #include <gensio/gensio_circbuf.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_err.h>
+
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 struct gensio_circbuf {
     struct gensio_os_funcs *o;
@@ -16,11 +24,68 @@ struct gensio_circbuf {
     gensiods size;
     gensiods bufsize;
     unsigned char *cbuf;
+
+    /*
+     * cbuf is mapped twice back to back, so any bufsize bytes
+     * starting in the first copy are contiguous.
+     */
+    bool mirrored;
+
+    /*
+     * In SPSC mode pos and size are not used.  head (written by the
+     * producer) and tail (written by the consumer) run from 0 to
+     * 2 * bufsize, so a full buffer and an empty one differ.  They
+     * are kept on separate cache lines.
+     */
+    bool spsc;
+    gensio_circbuf_notify notify;
+    void *notify_data;
+    unsigned char head_pad[GENSIO_CIRCBUF_CACHELINE];
+    gensiods head;
+    unsigned char tail_pad[GENSIO_CIRCBUF_CACHELINE];
+    gensiods tail;
+    unsigned char end_pad[GENSIO_CIRCBUF_CACHELINE];
 };
 
+#if HAVE_GCC_ATOMICS
+#define spsc_load(v) __atomic_load_n(&(v), __ATOMIC_ACQUIRE)
+#define spsc_store(v, val) __atomic_store_n(&(v), val, __ATOMIC_RELEASE)
+#else
+/* gensio_circbuf_set_spsc() refuses to turn on SPSC mode. */
+#define spsc_load(v) (v)
+#define spsc_store(v, val) ((v) = (val))
+#endif
+
+static gensiods
+spsc_used(struct gensio_circbuf *c, gensiods head, gensiods tail)
+{
+    if (head >= tail)
+	return head - tail;
+    return head + c->bufsize * 2 - tail;
+}
+
+static gensiods
+spsc_advance(struct gensio_circbuf *c, gensiods idx, gensiods len)
+{
+    idx += len;
+    if (idx >= c->bufsize * 2)
+	idx -= c->bufsize * 2;
+    return idx;
+}
+
+static gensiods
+spsc_offset(struct gensio_circbuf *c, gensiods idx)
+{
+    if (idx >= c->bufsize)
+	return idx - c->bufsize;
+    return idx;
+}
+
 gensiods
 gensio_circbuf_room_left(struct gensio_circbuf *c)
 {
+    if (c->spsc)
+	return c->bufsize - spsc_used(c, c->head, spsc_load(c->tail));
     return c->bufsize - c->size;
 }
 
@@ -30,8 +95,19 @@ gensio_circbuf_next_write_area(struct gensio_circbuf *c,
 {
     gensiods end;
 
+    if (c->spsc) {
+	end = spsc_offset(c, c->head);
+	*size = gensio_circbuf_room_left(c);
+	if (!c->mirrored && *size > c->bufsize - end)
+	    *size = c->bufsize - end;
+	*pos = c->cbuf + end;
+	return;
+    }
+
     end = (c->pos + c->size) % c->bufsize;
-    if (c->size == c->bufsize)
+    if (c->mirrored)
+	*size = c->bufsize - c->size;
+    else if (c->size == c->bufsize)
 	*size = 0;
     else if (end >= c->pos)
 	/* Unwrapped or empty buffer, write to the end. */
@@ -45,6 +121,23 @@ gensio_circbuf_next_write_area(struct gensio_circbuf *c,
 void
 gensio_circbuf_data_added(struct gensio_circbuf *c, gensiods len)
 {
+    gensiods old_head;
+
+    if (c->spsc) {
+	assert(len <= gensio_circbuf_room_left(c));
+	old_head = c->head;
+	spsc_store(c->head, spsc_advance(c, old_head, len));
+	if (c->notify && len) {
+#if HAVE_GCC_ATOMICS
+	    /* Order the head store before the tail load. */
+	    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+	    if (spsc_load(c->tail) == old_head)
+		/* It was empty, the consumer may be waiting. */
+		c->notify(c, c->notify_data);
+	}
+	return;
+    }
     assert(len + c->size <= c->bufsize);
     c->size += len;
 }
@@ -55,9 +148,18 @@ gensio_circbuf_next_read_area(struct gensio_circbuf *c,
 {
     gensiods end;
 
+    if (c->spsc) {
+	end = spsc_offset(c, c->tail);
+	*size = gensio_circbuf_datalen(c);
+	if (!c->mirrored && *size > c->bufsize - end)
+	    *size = c->bufsize - end;
+	*pos = c->cbuf + end;
+	return;
+    }
+
     end = (c->pos + c->size) % c->bufsize;
-    if (c->size == 0)
-	*size = 0;
+    if (c->mirrored || c->size == 0)
+	*size = c->size;
     else if (end > c->pos)
 	/* Unwrapped buffer, read the whole thing. */
 	*size = c->size;
@@ -70,6 +172,11 @@ gensio_circbuf_next_read_area(struct gensio_circbuf *c,
 void
 gensio_circbuf_data_removed(struct gensio_circbuf *c, gensiods len)
 {
+    if (c->spsc) {
+	assert(len <= gensio_circbuf_datalen(c));
+	spsc_store(c->tail, spsc_advance(c, c->tail, len));
+	return;
+    }
     assert(len <= c->size);
     c->size -= len;
     c->pos = (c->pos + len) % c->bufsize;
@@ -78,6 +185,8 @@ gensio_circbuf_data_removed(struct gensio_circbuf *c, gensiods len)
 gensiods
 gensio_circbuf_datalen(struct gensio_circbuf *c)
 {
+    if (c->spsc)
+	return spsc_used(c, spsc_load(c->head), c->tail);
     return c->size;
 }
 
@@ -86,6 +195,27 @@ gensio_circbuf_reset(struct gensio_circbuf *c)
 {
     c->pos = 0;
     c->size = 0;
+    c->head = 0;
+    c->tail = 0;
+}
+
+int
+gensio_circbuf_set_spsc(struct gensio_circbuf *c,
+			gensio_circbuf_notify notify, void *notify_data)
+{
+#if HAVE_GCC_ATOMICS
+    if (c->size)
+	return GE_INUSE;
+    c->spsc = true;
+    c->notify = notify;
+    c->notify_data = notify_data;
+    c->pos = 0;
+    c->head = 0;
+    spsc_store(c->tail, 0);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
 }
 
 void
@@ -159,9 +289,64 @@ gensio_circbuf_alloc(struct gensio_os_funcs *o, gensiods size)
     return c;
 }
 
+struct gensio_circbuf *
+gensio_circbuf_alloc_mirrored(struct gensio_os_funcs *o, gensiods size)
+{
+#ifdef HAVE_MEMFD_CREATE
+    struct gensio_circbuf *c;
+    unsigned char *buf, *m;
+    gensiods pagesize = sysconf(_SC_PAGESIZE);
+    int fd;
+
+    size = (size + pagesize - 1) / pagesize * pagesize;
+    fd = memfd_create("gensio_circbuf", MFD_CLOEXEC);
+    if (fd == -1)
+	goto out_fallback;
+    if (ftruncate(fd, size) == -1)
+	goto out_close;
+
+    /* Reserve room for both copies, then map the file into each half. */
+    buf = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+	goto out_close;
+    m = mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	     fd, 0);
+    if (m == MAP_FAILED)
+	goto out_unmap;
+    m = mmap(buf + size, size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_FIXED, fd, 0);
+    if (m == MAP_FAILED)
+	goto out_unmap;
+    close(fd);
+
+    c = o->zalloc(o, sizeof(*c));
+    if (!c) {
+	munmap(buf, size * 2);
+	return NULL;
+    }
+    c->o = o;
+    c->cbuf = buf;
+    c->bufsize = size;
+    c->mirrored = true;
+    return c;
+
+ out_unmap:
+    munmap(buf, size * 2);
+ out_close:
+    close(fd);
+ out_fallback:
+#endif
+    return gensio_circbuf_alloc(o, size);
+}
+
 void
 gensio_circbuf_free(struct gensio_circbuf *c)
 {
-    c->o->free(c->o, c->cbuf);
+#ifdef HAVE_MEMFD_CREATE
+    if (c->mirrored)
+	munmap(c->cbuf, c->bufsize * 2);
+    else
+#endif
+	c->o->free(c->o, c->cbuf);
     c->o->free(c->o, c);
 }
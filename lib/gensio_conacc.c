@@ -9,6 +9,7 @@
 
 #include "config.h"
 #include <assert.h>
+#include <string.h>
 #include <gensio/gensio.h>
 #include <gensio/gensio_time.h>
 #include <gensio/gensio_os_funcs.h>
@@ -28,6 +29,13 @@ struct conaccn_data {
     struct gensio_os_funcs *o;
     struct gensio_lock *lock;
     struct conaccna_data *nadata;
+
+    /*
+     * Holds a ref on the accepter until this is freed, so it can be
+     * kept as the accepter's spare.  nadata is cleared on disable,
+     * this is not.
+     */
+    struct conaccna_data *owner;
     enum conaccn_state child_state;
 
     struct gensio *io;
@@ -264,14 +272,32 @@ struct conaccna_data {
     /* Set when an error happens to report it back to the accepter log. */
     int con_err;
 
-    /* Used to start the child gensio. */
-    char *gensio_str;
+    /* Used to start the child gensio, parsed once at allocation. */
+    struct gensio_template *tmpl;
+
+    /*
+     * Only one session is open at a time, so the last one freed is
+     * kept here to use for the next.
+     */
+    struct conaccn_data *spare;
+
+    /*
+     * With reuse-child, a session close leaves the child open.
+     * reuse_close is the session being closed, reuse_io is the open
+     * child waiting for the next session, and reuse_open is the new
+     * session to report.  These are handled in the deferred op.
+     */
+    bool reuse_child;
+    struct conaccn_data *reuse_close;
+    struct gensio *reuse_io;
+    struct conaccn_data *reuse_open;
 
     unsigned int refcount;
 };
 
 static void conacc_start(struct conaccna_data *nadata);
 static void start_retry(struct conaccna_data *nadata);
+static void conaccn_open_done(struct gensio *io, int err, void *open_data);
 
 static void
 conaccn_lock(struct conaccn_data *ndata)
@@ -292,33 +318,6 @@ conaccn_ref(struct conaccn_data *ndata)
     ndata->refcount++;
 }
 
-static void
-conaccn_finish_free(struct conaccn_data *ndata)
-{
-    struct gensio_os_funcs *o = ndata->o;
-
-    if (ndata->io)
-	gensio_data_free(ndata->io);
-    if (ndata->child)
-	gensio_free(ndata->child);
-    if (ndata->lock)
-	o->free_lock(ndata->lock);
-    o->free(o, ndata);
-}
-
-static void
-conaccn_deref_and_unlock(struct conaccn_data *ndata)
-{
-    assert(ndata->refcount > 0);
-    ndata->refcount--;
-    if (ndata->refcount == 0) {
-	conaccn_unlock(ndata);
-	conaccn_finish_free(ndata);
-    } else {
-	conaccn_unlock(ndata);
-    }
-}
-
 static void
 conaccna_lock(struct conaccna_data *nadata)
 {
@@ -343,8 +342,12 @@ conaccna_finish_free(struct conaccna_data *nadata)
 {
     struct gensio_os_funcs *o = nadata->o;
 
-    if (nadata->gensio_str)
-	o->free(o, nadata->gensio_str);
+    if (nadata->spare) {
+	o->free_lock(nadata->spare->lock);
+	o->free(o, nadata->spare);
+    }
+    if (nadata->tmpl)
+	gensio_template_free(nadata->tmpl);
     if (nadata->deferred_runner)
 	o->free_runner(nadata->deferred_runner);
     if (nadata->retry_timer)
@@ -375,6 +378,58 @@ conaccna_deref_and_unlock(struct conaccna_data *nadata)
     }
 }
 
+/*
+ * Keep the session data as the accepter's spare or free it, and drop
+ * its ref on the accepter.  Must hold the accepter lock, and this is
+ * not the last ref.
+ */
+static void
+conaccn_put_locked(struct conaccn_data *ndata)
+{
+    struct conaccna_data *nadata = ndata->owner;
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_lock *lock = ndata->lock;
+
+    if (ndata->io)
+	gensio_data_free(ndata->io);
+    if (ndata->child)
+	gensio_free(ndata->child);
+    if (!nadata->spare) {
+	memset(ndata, 0, sizeof(*ndata));
+	ndata->o = o;
+	ndata->lock = lock;
+	nadata->spare = ndata;
+    } else {
+	o->free_lock(lock);
+	o->free(o, ndata);
+    }
+    conaccna_deref(nadata);
+}
+
+static void
+conaccn_finish_free(struct conaccn_data *ndata)
+{
+    struct conaccna_data *nadata = ndata->owner;
+
+    conaccna_lock(nadata);
+    conaccna_ref(nadata);
+    conaccn_put_locked(ndata);
+    conaccna_deref_and_unlock(nadata);
+}
+
+static void
+conaccn_deref_and_unlock(struct conaccn_data *ndata)
+{
+    assert(ndata->refcount > 0);
+    ndata->refcount--;
+    if (ndata->refcount == 0) {
+	conaccn_unlock(ndata);
+	conaccn_finish_free(ndata);
+    } else {
+	conaccn_unlock(ndata);
+    }
+}
+
 /* Releases the lock and re-acquires it. */
 static void
 conaccna_call_enabled(struct conaccna_data *nadata)
@@ -406,14 +461,33 @@ conaccna_finish_shutdown(struct conaccna_data *nadata)
     }
 }
 
+static void conaccn_finish_reuse(struct conaccn_data *ndata);
+
 static void
 conaccna_do_deferred(struct gensio_runner *runner, void *cb_data)
 {
     struct conaccna_data *nadata = cb_data;
+    struct conaccn_data *ndata;
 
     conaccna_lock(nadata);
     nadata->deferred_op_pending = false;
 
+    if (nadata->reuse_close) {
+	ndata = nadata->reuse_close;
+	nadata->reuse_close = NULL;
+	conaccna_unlock(nadata);
+	conaccn_finish_reuse(ndata);
+	conaccna_lock(nadata);
+    }
+    if (nadata->reuse_open) {
+	/* A new session on the still open child, report it. */
+	ndata = nadata->reuse_open;
+	nadata->reuse_open = NULL;
+	conaccna_unlock(nadata);
+	conaccn_open_done(ndata->child, 0, ndata);
+	conaccna_lock(nadata);
+    }
+
     conaccna_call_enabled(nadata);
 
     switch (nadata->state) {
@@ -514,6 +588,77 @@ conaccn_close_done(struct gensio *child_io, void *close_cb_data)
     conaccn_deref_and_unlock(ndata);
 }
 
+/*
+ * The user closed a session with reuse-child set, the child stays
+ * open for the next session.  Called from the deferred op.
+ */
+static void
+conaccn_finish_reuse(struct conaccn_data *ndata)
+{
+    struct conaccna_data *nadata = ndata->nadata;
+    struct gensio *child;
+    gensio_done close_done;
+    void *close_data;
+
+    conaccn_lock(ndata);
+    close_done = ndata->close_done;
+    close_data = ndata->close_data;
+    ndata->close_done = NULL;
+    child = ndata->child;
+    ndata->child = NULL;
+    ndata->child_state = CONACCN_CLOSED;
+    conaccn_unlock(ndata);
+
+    if (close_done)
+	close_done(ndata->io, close_data);
+
+    conaccna_lock(nadata);
+    nadata->ndata = NULL;
+    if (nadata->state == CONACCNA_READY) {
+	nadata->reuse_io = child;
+	conacc_start(nadata);
+	child = nadata->reuse_io;
+	nadata->reuse_io = NULL;
+    }
+    conaccna_deref_and_unlock(nadata);
+
+    /* Not used for a new session, so really close it. */
+    if (child)
+	gensio_free(child);
+
+    conaccn_lock(ndata);
+    conaccn_deref_and_unlock(ndata);
+}
+
+/* Must hold the session lock. */
+static bool
+conaccn_try_reuse(struct conaccn_data *ndata,
+		  gensio_done close_done, void *close_data)
+{
+    struct conaccna_data *nadata = ndata->nadata;
+    bool rv = false;
+
+    if (!nadata || ndata->child_state != CONACCN_OPEN)
+	return false;
+
+    conaccna_lock(nadata);
+    if (nadata->reuse_child && nadata->state == CONACCNA_READY &&
+		!nadata->reuse_close) {
+	ndata->child_state = CONACCN_IN_CLOSE;
+	gensio_set_read_callback_enable(ndata->child, false);
+	gensio_set_write_callback_enable(ndata->child, false);
+	/* Like a close, this ref is dropped when it finishes. */
+	conaccn_ref(ndata);
+	ndata->close_done = close_done;
+	ndata->close_data = close_data;
+	nadata->reuse_close = ndata;
+	conaccna_deferred_op(nadata);
+	rv = true;
+    }
+    conaccna_unlock(nadata);
+    return rv;
+}
+
 static int
 i_conaccn_close(struct conaccn_data *ndata,
 		gensio_done close_done, void *close_data)
@@ -522,6 +667,8 @@ i_conaccn_close(struct conaccn_data *ndata,
 
     if (ndata->in_close || !ndata->child)
 	return GE_NOTREADY;
+    if (conaccn_try_reuse(ndata, close_done, close_data))
+	return 0;
     ndata->child_state = CONACCN_IN_CLOSE;
     err = gensio_close(ndata->child, conaccn_close_done, ndata);
     if (err) {
@@ -619,6 +766,8 @@ conaccn_func(struct gensio *io, int func, gensiods *count,
 
     default:
 	/* Everything but the above just passes through. */
+	if (!ndata->child)
+	    return GE_NOTREADY; /* Closed, and the child went to reuse. */
 	return gensio_call_func(ndata->child,
 				func, count, cbuf, buflen, buf, auxdata);
     }
@@ -723,8 +872,9 @@ conaccn_open_done(struct gensio *io, int err, void *open_data)
 	err = GE_NOTREADY;
 	base_gensio_server_open_done(nadata->acc, ndata->io, err);
     }
-    conaccn_finish_free(ndata);
+    nadata->ndata = NULL;
     conaccna_deref_and_unlock(nadata);
+    conaccn_finish_free(ndata);
 }
 
 static void
@@ -740,18 +890,40 @@ conacc_start(struct conaccna_data *nadata)
 
     nadata->state = CONACCNA_OPENING;
 
-    ndata = nadata->o->zalloc(nadata->o, sizeof(*ndata));
-    if (!ndata)
-	goto out_err_nofree;
-    ndata->o = nadata->o;
+    if (nadata->spare) {
+	ndata = nadata->spare;
+	nadata->spare = NULL;
+    } else {
+	ndata = nadata->o->zalloc(nadata->o, sizeof(*ndata));
+	if (!ndata)
+	    goto out_err_nofree;
+	ndata->o = nadata->o;
+	ndata->lock = nadata->o->alloc_lock(nadata->o);
+	if (!ndata->lock) {
+	    nadata->o->free(nadata->o, ndata);
+	    goto out_err_nofree;
+	}
+    }
     ndata->nadata = nadata;
+    ndata->owner = nadata;
+    conaccna_ref(nadata);
     ndata->refcount = 1;
-    ndata->lock = nadata->o->alloc_lock(nadata->o);
-    if (!ndata->lock)
-	goto out_err;
 
-    err = str_to_gensio(nadata->gensio_str, ndata->o, conaccn_event, ndata,
-			&ndata->child);
+    if (nadata->reuse_io) {
+	/* The last session left the child open, just report it again. */
+	ndata->child = nadata->reuse_io;
+	nadata->reuse_io = NULL;
+	gensio_set_callback(ndata->child, conaccn_event, ndata);
+	nadata->ndata = ndata;
+	conaccna_ref(nadata);
+	ndata->child_state = CONACCN_IN_OPEN;
+	nadata->reuse_open = ndata;
+	conaccna_deferred_op(nadata);
+	return;
+    }
+
+    err = gensio_template_alloc(nadata->tmpl, NULL, conaccn_event, ndata,
+				&ndata->child);
     if (err)
 	goto out_err;
 
@@ -767,7 +939,7 @@ conacc_start(struct conaccna_data *nadata)
     return;
 
  out_err:
-    conaccn_finish_free(ndata);
+    conaccn_put_locked(ndata);
  out_err_nofree:
     if (!gensio_time_is_zero(nadata->retry_time)) {
 	start_retry(nadata);
@@ -1125,11 +1297,14 @@ conacc_gensio_accepter_alloc(const void *gdata,
     struct conaccna_data *nadata;
     unsigned int i;
     struct gensio_time retry_time = { 0, 0 };
+    bool reuse_child = false;
     int err;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keytime(args[i], "retry-time", 'm', &retry_time) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "reuse-child", &reuse_child) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
@@ -1140,10 +1315,11 @@ conacc_gensio_accepter_alloc(const void *gdata,
     nadata->enabled = true;
     nadata->refcount = 1;
     nadata->retry_time = retry_time;
+    nadata->reuse_child = reuse_child;
 
-    nadata->gensio_str = gensio_strdup(o, gensio_str);
-    if (!nadata->gensio_str)
-	goto out_nomem;
+    err = gensio_template_compile(gensio_str, o, &nadata->tmpl);
+    if (err)
+	goto out_err;
 
     nadata->lock = o->alloc_lock(o);
     if (!nadata->lock)
@@ -23,9 +23,16 @@
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #endif
 
+#if !USE_FILE_STDIO
+#define FILEN_AIO 1
+#else
+#define FILEN_AIO 0
+#endif
+
 enum filen_state {
     FILEN_CLOSED,
     FILEN_IN_OPEN,
@@ -34,6 +41,35 @@ enum filen_state {
     FILEN_IN_CLOSE,
 };
 
+#if FILEN_AIO
+#define FILEN_AIO_ACTIVE(ndata) ((ndata)->async_threads)
+
+enum filen_aio_op { FILEN_AIO_READ, FILEN_AIO_WRITE, FILEN_AIO_FSYNC };
+
+/*
+ * An operation handed to the I/O worker threads.  busy and complete
+ * are protected by the ndata lock, queued and next by filen_aio_lock.
+ * The rest belongs to the worker while busy is set.
+ */
+struct filen_aio {
+    struct filen_aio *next;
+    struct filen_data *ndata;
+    enum filen_aio_op op;
+    bool busy;
+    bool queued;
+    bool complete;
+    int fd;
+    unsigned char *buf;
+    gensiods len;
+    gensiods count;
+    int err;
+};
+
+#define FILEN_AIO_WBUF_SIZE 65536
+#else
+#define FILEN_AIO_ACTIVE(ndata) false
+#endif
+
 struct filen_data {
     struct gensio_os_funcs *o;
     struct gensio_lock *lock;
@@ -45,9 +81,56 @@ struct filen_data {
 
     gensiods max_read_size;
     unsigned char *read_data;
+    unsigned char *read_ptr; /* Start of the pending data. */
     gensiods data_pending_len;
     int read_err;
 
+#if !USE_FILE_STDIO
+    /*
+     * For the mmap option, the input file is mapped a window at a
+     * time and reads are delivered from the mapping.  map_pos is how
+     * far into the window has been handed out.
+     */
+    bool use_mmap;
+    gensiods mmap_window;
+    bool mapping;
+    unsigned char *map;
+    gensiods map_len;
+    gensiods map_pos;
+    off_t map_off;
+    off_t file_size;
+#endif
+
+    /*
+     * For read_rate, pace the data delivered from the input file to
+     * read_rate bytes per second.
+     */
+    gensiods read_rate;
+    int64_t rate_start;
+    uint64_t rate_bytes;
+    bool rate_wait;
+    struct gensio_timer *rate_timer;
+
+#if !USE_FILE_STDIO
+    bool do_fsync;
+#endif
+#if FILEN_AIO
+    /*
+     * For async_threads, reads, writes, and fsync are done by worker
+     * threads.  rd_aio reads into its own buffer, which is swapped
+     * with read_data when delivered, so the next read is in flight
+     * while the user handles the current one.  Writes are copied into
+     * wbuf, which is swapped with wr_aio's buffer to write it out.
+     */
+    unsigned int async_threads;
+    struct filen_aio rd_aio;
+    struct filen_aio wr_aio;
+    unsigned char *wbuf;
+    gensiods wbuf_len;
+    int write_err;
+    bool fsync_done;
+#endif
+
     char *infile;
     char *outfile;
     bool create;
@@ -223,6 +306,25 @@ filen_finish_free(struct filen_data *ndata)
 	o->free(ndata->o, ndata->outfile);
     if (ndata->read_data)
 	o->free(o, ndata->read_data);
+#if !USE_FILE_STDIO
+    if (ndata->map)
+	munmap(ndata->map, ndata->map_len);
+#endif
+    if (ndata->rate_timer)
+	o->free_timer(ndata->rate_timer);
+#if FILEN_AIO
+    if (ndata->rd_aio.buf)
+	o->free(o, ndata->rd_aio.buf);
+    if (ndata->wr_aio.buf)
+	o->free(o, ndata->wr_aio.buf);
+    if (ndata->wbuf)
+	o->free(o, ndata->wbuf);
+#endif
+    /* In case it was freed without a close. */
+    if (f_ready(ndata->inf))
+	f_close(ndata->inf);
+    if (f_ready(ndata->outf))
+	f_close(ndata->outf);
     if (ndata->deferred_op_runner)
 	o->free_runner(ndata->deferred_op_runner);
     if (ndata->lock)
@@ -262,6 +364,357 @@ filen_unlock_and_deref(struct filen_data *ndata)
     }
 }
 
+#if FILEN_AIO
+/*
+ * A slow disk or network filesystem blocks whatever thread does the
+ * I/O, and on the service thread that holds up every gensio on it.
+ * With the async_threads option, file I/O is handed to a
+ * process-wide pool of worker threads and the results come back
+ * through the deferred op.  Workers are started as operations are
+ * queued, up to the largest async_threads value, and sleep on
+ * filen_aio_sem when there is nothing to do.
+ */
+#define FILEN_AIO_MAX_THREADS 16
+
+struct filen_aio_worker {
+    struct gensio_thread *tid;
+    struct filen_aio_worker *next;
+};
+
+static struct gensio_once filen_aio_once;
+static struct gensio_os_funcs *filen_aio_o;
+static struct gensio_lock *filen_aio_lock;
+static struct gensio_thread_sem *filen_aio_sem;
+static struct filen_aio_worker *filen_aio_workers;
+static unsigned int filen_aio_nr_threads;
+static unsigned int filen_aio_nr_idle;
+static bool filen_aio_shutdown;
+static struct filen_aio *filen_aio_queue;
+static struct filen_aio **filen_aio_queue_tail = &filen_aio_queue;
+
+static void
+filen_aio_do(struct filen_aio *a)
+{
+    struct gensio_os_funcs *o = a->ndata->o;
+    ssize_t rv;
+
+    a->err = 0;
+    a->count = 0;
+    switch (a->op) {
+    case FILEN_AIO_READ:
+	do {
+	    rv = read(a->fd, a->buf, a->len);
+	} while (rv == -1 && errno == EINTR);
+	if (rv < 0)
+	    a->err = gensio_os_err_to_err(o, errno);
+	else if (rv == 0)
+	    a->err = GE_REMCLOSE;
+	else
+	    a->count = rv;
+	break;
+
+    case FILEN_AIO_WRITE:
+	while (a->count < a->len) {
+	    rv = write(a->fd, a->buf + a->count, a->len - a->count);
+	    if (rv == -1 && errno == EINTR)
+		continue;
+	    if (rv < 0) {
+		a->err = gensio_os_err_to_err(o, errno);
+		break;
+	    }
+	    if (rv == 0) {
+		a->err = GE_REMCLOSE;
+		break;
+	    }
+	    a->count += rv;
+	}
+	break;
+
+    case FILEN_AIO_FSYNC:
+	if (fsync(a->fd) == -1)
+	    a->err = gensio_os_err_to_err(o, errno);
+	break;
+    }
+}
+
+static void
+filen_aio_thread(void *data)
+{
+    struct gensio_os_funcs *o = filen_aio_o;
+    struct filen_aio *a;
+    struct filen_data *ndata;
+
+    gensio_os_thread_set_attr(o, NULL);
+
+    o->lock(filen_aio_lock);
+    while (!filen_aio_shutdown) {
+	a = filen_aio_queue;
+	if (!a) {
+	    filen_aio_nr_idle++;
+	    o->unlock(filen_aio_lock);
+	    gensio_os_sem_wait(filen_aio_sem);
+	    o->lock(filen_aio_lock);
+	    continue;
+	}
+	filen_aio_queue = a->next;
+	if (!filen_aio_queue)
+	    filen_aio_queue_tail = &filen_aio_queue;
+	a->queued = false;
+	o->unlock(filen_aio_lock);
+
+	filen_aio_do(a);
+
+	ndata = a->ndata;
+	filen_lock(ndata);
+	a->busy = false;
+	a->complete = true;
+	filen_start_deferred_op(ndata);
+	filen_unlock_and_deref(ndata); /* Ref from the submit. */
+
+	o->lock(filen_aio_lock);
+    }
+    o->unlock(filen_aio_lock);
+}
+
+static void
+filen_aio_cleanup(void)
+{
+    struct gensio_os_funcs *o = filen_aio_o;
+    struct filen_aio_worker *w;
+
+    if (!filen_aio_lock)
+	return;
+    o->lock(filen_aio_lock);
+    filen_aio_shutdown = true;
+    for (; filen_aio_nr_idle > 0; filen_aio_nr_idle--)
+	gensio_os_sem_post(filen_aio_sem);
+    o->unlock(filen_aio_lock);
+    while ((w = filen_aio_workers)) {
+	filen_aio_workers = w->next;
+	gensio_os_wait_thread(w->tid);
+	o->free(o, w);
+    }
+    filen_aio_nr_threads = 0;
+    filen_aio_shutdown = false;
+    gensio_os_free_sem(filen_aio_sem);
+    filen_aio_sem = NULL;
+    o->free_lock(filen_aio_lock);
+    filen_aio_lock = NULL;
+    memset(&filen_aio_once, 0, sizeof(filen_aio_once));
+}
+
+static struct gensio_class_cleanup filen_aio_cleanup_data = {
+    filen_aio_cleanup
+};
+
+static void
+filen_aio_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    filen_aio_o = o;
+    if (gensio_os_new_sem(o, &filen_aio_sem))
+	return;
+    filen_aio_lock = o->alloc_lock(o);
+    if (!filen_aio_lock) {
+	gensio_os_free_sem(filen_aio_sem);
+	filen_aio_sem = NULL;
+	return;
+    }
+    gensio_register_class_cleanup(&filen_aio_cleanup_data);
+}
+
+/*
+ * Get a worker to look at the queue, waking an idle one or starting
+ * another if under count.  Returns false if there are no workers to
+ * do the job.  Call with filen_aio_lock held.
+ */
+static bool
+filen_aio_kick(unsigned int count)
+{
+    struct gensio_os_funcs *o = filen_aio_o;
+    struct filen_aio_worker *w;
+
+    if (filen_aio_nr_idle > 0) {
+	filen_aio_nr_idle--;
+	gensio_os_sem_post(filen_aio_sem);
+	return true;
+    }
+    if (count > FILEN_AIO_MAX_THREADS)
+	count = FILEN_AIO_MAX_THREADS;
+    if (filen_aio_nr_threads >= count)
+	return true;
+    w = o->zalloc(o, sizeof(*w));
+    if (!w)
+	return filen_aio_nr_threads > 0;
+    if (gensio_os_new_thread(o, filen_aio_thread, NULL, &w->tid)) {
+	o->free(o, w);
+	return filen_aio_nr_threads > 0;
+    }
+    w->next = filen_aio_workers;
+    filen_aio_workers = w;
+    filen_aio_nr_threads++;
+    return true;
+}
+
+/*
+ * Hand the operation to a worker.  The result is processed from the
+ * deferred op.  Call with the ndata lock held.
+ */
+static void
+filen_aio_submit(struct filen_data *ndata, struct filen_aio *a,
+		 enum filen_aio_op op, int fd, gensiods len)
+{
+    struct gensio_os_funcs *o = filen_aio_o;
+
+    a->op = op;
+    a->fd = fd;
+    a->len = len;
+    a->complete = false;
+
+    o->lock(filen_aio_lock);
+    if (!filen_aio_kick(ndata->async_threads)) {
+	/* Couldn't start any threads, just do it here. */
+	o->unlock(filen_aio_lock);
+	filen_aio_do(a);
+	a->complete = true;
+	filen_start_deferred_op(ndata);
+	return;
+    }
+    a->busy = true;
+    filen_ref(ndata);
+    a->next = NULL;
+    *filen_aio_queue_tail = a;
+    filen_aio_queue_tail = &a->next;
+    a->queued = true;
+    o->unlock(filen_aio_lock);
+}
+
+/*
+ * Pull the operation back if a worker hasn't started it.  If it's
+ * running, busy will still be set.  Call with the ndata lock held.
+ */
+static void
+filen_aio_cancel(struct filen_data *ndata, struct filen_aio *a)
+{
+    struct gensio_os_funcs *o = filen_aio_o;
+    struct filen_aio **p;
+
+    if (!a->busy)
+	return;
+    o->lock(filen_aio_lock);
+    if (a->queued) {
+	for (p = &filen_aio_queue; *p != a; p = &(*p)->next)
+	    ;
+	*p = a->next;
+	if (!*p)
+	    filen_aio_queue_tail = p;
+	a->queued = false;
+	a->busy = false;
+	/* Can't be the last ref, the caller has one. */
+	ndata->refcount--;
+    }
+    o->unlock(filen_aio_lock);
+}
+
+/*
+ * Get the next read chunk into read_data.  Returns GE_INPROGRESS if
+ * we have to wait for a worker.
+ */
+static int
+filen_aio_read(struct filen_data *ndata, gensiods *count)
+{
+    struct filen_aio *a = &ndata->rd_aio;
+    unsigned char *tmp;
+
+    if (a->busy)
+	return GE_INPROGRESS;
+    if (!a->complete) {
+	filen_aio_submit(ndata, a, FILEN_AIO_READ, ndata->inf,
+			 ndata->max_read_size);
+	if (!a->complete)
+	    return GE_INPROGRESS;
+    }
+    a->complete = false;
+    if (a->err)
+	return a->err;
+
+    tmp = ndata->read_data;
+    ndata->read_data = a->buf;
+    a->buf = tmp;
+    ndata->read_ptr = ndata->read_data;
+    *count = a->count;
+
+    /* Read the next chunk while this one is being delivered. */
+    filen_aio_submit(ndata, a, FILEN_AIO_READ, ndata->inf,
+		     ndata->max_read_size);
+    return 0;
+}
+
+/* Start writing out wbuf if there is anything and we can. */
+static void
+filen_aio_write_start(struct filen_data *ndata)
+{
+    struct filen_aio *a = &ndata->wr_aio;
+    unsigned char *tmp;
+
+    if (a->busy || a->complete || !ndata->wbuf_len || ndata->write_err)
+	return;
+    tmp = ndata->wbuf;
+    ndata->wbuf = a->buf;
+    a->buf = tmp;
+    filen_aio_submit(ndata, a, FILEN_AIO_WRITE, ndata->outf,
+		     ndata->wbuf_len);
+    ndata->wbuf_len = 0;
+}
+
+/* Handle a finished write or fsync, and start the next write. */
+static void
+filen_aio_write_done(struct filen_data *ndata)
+{
+    struct filen_aio *a = &ndata->wr_aio;
+
+    if (a->complete) {
+	a->complete = false;
+	if (a->err && !ndata->write_err)
+	    ndata->write_err = a->err;
+    }
+    filen_aio_write_start(ndata);
+}
+
+static int
+filen_aio_write(struct filen_data *ndata, const struct gensio_sg *sg,
+		gensiods sglen, gensiods *rcount)
+{
+    gensiods i, len, total = 0;
+
+    if (ndata->write_err)
+	return ndata->write_err;
+    for (i = 0; i < sglen; i++) {
+	len = FILEN_AIO_WBUF_SIZE - ndata->wbuf_len;
+	if (len > sg[i].buflen)
+	    len = sg[i].buflen;
+	memcpy(ndata->wbuf + ndata->wbuf_len, sg[i].buf, len);
+	ndata->wbuf_len += len;
+	total += len;
+	if (len < sg[i].buflen)
+	    break;
+    }
+    filen_aio_write_start(ndata);
+    *rcount = total;
+    return 0;
+}
+
+static bool
+filen_write_room(struct filen_data *ndata)
+{
+    return (!ndata->async_threads || ndata->write_err ||
+	    ndata->wbuf_len < FILEN_AIO_WBUF_SIZE);
+}
+#else
+#define filen_write_room(ndata) true
+#endif
+
 static int
 filen_write(struct gensio *io, gensiods *count,
 	    const struct gensio_sg *sg, gensiods sglen)
@@ -279,6 +732,11 @@ filen_write(struct gensio *io, gensiods *count,
 	for (total_write = 0, i = 0; i < sglen; i++)
 	    total_write += sg->buflen;
     } else {
+#if FILEN_AIO
+	if (ndata->async_threads)
+	    err = filen_aio_write(ndata, sg, sglen, &wcount);
+	else
+#endif
 	err = f_writev(ndata->o, ndata->outf, sg, sglen, &wcount);
 	if (!err)
 	    total_write = wcount;
@@ -289,6 +747,214 @@ filen_write(struct gensio *io, gensiods *count,
     return err;
 }
 
+#if !USE_FILE_STDIO
+static int
+filen_map_read(struct filen_data *ndata, gensiods *count)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    gensiods len;
+    struct stat st;
+    void *p;
+
+    if (ndata->map && ndata->map_pos >= ndata->map_len) {
+	munmap(ndata->map, ndata->map_len);
+	ndata->map = NULL;
+	ndata->map_off += ndata->map_len;
+    }
+
+    if (!ndata->map) {
+	if (ndata->map_off >= ndata->file_size) {
+	    /* See if the file has grown. */
+	    if (fstat(ndata->inf, &st) == -1)
+		return gensio_os_err_to_err(o, errno);
+	    ndata->file_size = st.st_size;
+	    if (ndata->map_off >= ndata->file_size)
+		return GE_REMCLOSE;
+	}
+	len = ndata->mmap_window;
+	if (len > ndata->file_size - ndata->map_off)
+	    len = ndata->file_size - ndata->map_off;
+	p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, ndata->inf,
+		 ndata->map_off);
+	if (p == MAP_FAILED)
+	    return gensio_os_err_to_err(o, errno);
+#ifdef MADV_SEQUENTIAL
+	madvise(p, len, MADV_SEQUENTIAL);
+#endif
+#ifdef POSIX_FADV_WILLNEED
+	/* Start reading in the next window while this one is used. */
+	if (ndata->map_off + len < ndata->file_size)
+	    posix_fadvise(ndata->inf, ndata->map_off + len,
+			  ndata->mmap_window, POSIX_FADV_WILLNEED);
+#endif
+	ndata->map = p;
+	ndata->map_len = len;
+	ndata->map_pos = 0;
+    }
+
+    len = ndata->map_len - ndata->map_pos;
+    if (len > ndata->max_read_size)
+	len = ndata->max_read_size;
+    ndata->read_ptr = ndata->map + ndata->map_pos;
+    ndata->map_pos += len;
+    *count = len;
+    return 0;
+}
+
+static void
+filen_map_start(struct filen_data *ndata)
+{
+    struct stat st;
+
+    /* Things like pipes can't be mapped, just read those. */
+    ndata->mapping = (ndata->use_mmap && fstat(ndata->inf, &st) == 0 &&
+		      S_ISREG(st.st_mode));
+    if (ndata->mapping) {
+	ndata->file_size = st.st_size;
+	ndata->map_off = 0;
+    }
+}
+
+static void
+filen_map_stop(struct filen_data *ndata)
+{
+    if (ndata->map) {
+	munmap(ndata->map, ndata->map_len);
+	ndata->map = NULL;
+    }
+    ndata->mapping = false;
+}
+#endif
+
+static int
+filen_read_more(struct filen_data *ndata, gensiods *count)
+{
+#if FILEN_AIO
+    if (ndata->async_threads)
+	return filen_aio_read(ndata, count);
+#endif
+#if !USE_FILE_STDIO
+    if (ndata->mapping)
+	return filen_map_read(ndata, count);
+#endif
+    ndata->read_ptr = ndata->read_data;
+    return f_read(ndata->o, ndata->inf, ndata->read_data,
+		  ndata->max_read_size, count);
+}
+
+static int64_t
+filen_now(struct filen_data *ndata)
+{
+    gensio_time t;
+
+    ndata->o->get_monotonic_time(ndata->o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+/*
+ * Account for count bytes delivered and, if we are ahead of
+ * read_rate, stop reading until the timer says we can send more.
+ */
+static void
+filen_rate_check(struct filen_data *ndata, gensiods count)
+{
+    int64_t now, due;
+    gensio_time timeout;
+
+    ndata->rate_bytes += count;
+    due = ndata->rate_start +
+	(int64_t) (ndata->rate_bytes * 1000000000ULL / ndata->read_rate);
+    now = filen_now(ndata);
+    if (due <= now) {
+	if (now - due > 1000000000LL) {
+	    /* Way behind, the user wasn't reading.  Don't burst. */
+	    ndata->rate_start = now;
+	    ndata->rate_bytes = 0;
+	}
+	return;
+    }
+    timeout.secs = (due - now) / 1000000000LL;
+    timeout.nsecs = (due - now) % 1000000000LL;
+    if (ndata->o->start_timer(ndata->rate_timer, &timeout) == 0) {
+	ndata->rate_wait = true;
+	filen_ref(ndata);
+    }
+}
+
+static void
+filen_rate_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct filen_data *ndata = cb_data;
+
+    filen_lock(ndata);
+    ndata->rate_wait = false;
+    if (ndata->state == FILEN_OPEN && ndata->read_enabled)
+	filen_start_deferred_op(ndata);
+    filen_unlock_and_deref(ndata);
+}
+
+static void
+filen_rate_stop(struct filen_data *ndata)
+{
+    if (ndata->rate_wait && ndata->o->stop_timer(ndata->rate_timer) == 0) {
+	ndata->rate_wait = false;
+	/* Can't be the last ref, the caller has one. */
+	ndata->refcount--;
+    }
+}
+
+static void
+filen_close_files(struct filen_data *ndata)
+{
+    if (f_ready(ndata->inf)) {
+#if !USE_FILE_STDIO
+	filen_map_stop(ndata);
+#endif
+	f_close(ndata->inf);
+	f_set_not_ready(ndata->inf);
+    }
+    if (f_ready(ndata->outf)) {
+#if !USE_FILE_STDIO
+	if (ndata->do_fsync && !FILEN_AIO_ACTIVE(ndata))
+	    fsync(ndata->outf);
+#endif
+	f_close(ndata->outf);
+	f_set_not_ready(ndata->outf);
+    }
+}
+
+/*
+ * Returns true when the files are closed.  With async I/O, this waits
+ * for the workers to finish what they are doing and for written data
+ * to get to the file (and be synced if asked).
+ */
+static bool
+filen_close_ready(struct filen_data *ndata)
+{
+#if FILEN_AIO
+    if (ndata->async_threads) {
+	filen_aio_cancel(ndata, &ndata->rd_aio);
+	if (ndata->rd_aio.busy)
+	    return false;
+	ndata->rd_aio.complete = false;
+	filen_aio_write_done(ndata);
+	if (ndata->wr_aio.busy)
+	    return false;
+	if (ndata->do_fsync && !ndata->fsync_done && f_ready(ndata->outf) &&
+		!ndata->write_err) {
+	    ndata->fsync_done = true;
+	    filen_aio_submit(ndata, &ndata->wr_aio, FILEN_AIO_FSYNC,
+			     ndata->outf, 0);
+	    if (ndata->wr_aio.busy)
+		return false;
+	}
+	ndata->wr_aio.complete = false;
+    }
+#endif
+    filen_close_files(ndata);
+    return true;
+}
+
 static void
 filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 {
@@ -298,12 +964,19 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
     filen_lock(ndata);
     ndata->deferred_op_pending = false;
 
+#if FILEN_AIO
+    if (ndata->async_threads && ndata->state == FILEN_OPEN)
+	filen_aio_write_done(ndata);
+#endif
+
     if (ndata->state == FILEN_IN_OPEN || ndata->state == FILEN_IN_OPEN_CLOSE) {
 	if (ndata->state == FILEN_IN_OPEN_CLOSE) {
 	    ndata->state = FILEN_IN_CLOSE;
 	    err = GE_LOCALCLOSED;
 	} else {
 	    ndata->state = FILEN_OPEN;
+	    ndata->rate_start = filen_now(ndata);
+	    ndata->rate_bytes = 0;
 	}
 	if (ndata->open_done) {
 	    filen_unlock(ndata);
@@ -313,14 +986,18 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
     }
 
     while (ndata->state == FILEN_OPEN &&
-	   (f_ready(ndata->inf) || ndata->read_err) && ndata->read_enabled) {
+	   (f_ready(ndata->inf) || ndata->read_err) && ndata->read_enabled &&
+	   !ndata->rate_wait) {
 	gensiods count = 0;
 
 	if (ndata->data_pending_len == 0 && !ndata->read_err) {
-	    err = f_read(ndata->o, ndata->inf, ndata->read_data,
-			 ndata->max_read_size, &count);
+	    err = filen_read_more(ndata, &count);
 
-	    if (err) {
+	    if (err == GE_INPROGRESS) {
+		/* Waiting for the read to finish. */
+		err = 0;
+		break;
+	    } else if (err) {
 		ndata->read_enabled = false;
 		ndata->read_err = err;
 	    } else {
@@ -334,7 +1011,7 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 	} else {
 	    filen_unlock(ndata);
 	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->read_err,
-			    ndata->read_data, &count, NULL);
+			    ndata->read_ptr, &count, NULL);
 	    filen_lock(ndata);
 	    if (err) {
 		ndata->read_enabled = false;
@@ -344,16 +1021,19 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 	}
 	if (count > 0) {
 	    if (count >= ndata->data_pending_len) {
+		count = ndata->data_pending_len;
 		ndata->data_pending_len = 0;
 	    } else {
-		memcpy(ndata->read_data, ndata->read_data + count,
-		       ndata->data_pending_len - count);
+		ndata->read_ptr += count;
 		ndata->data_pending_len -= count;
 	    }
+	    if (ndata->read_rate)
+		filen_rate_check(ndata, count);
 	}
     }
 
-    while (ndata->state == FILEN_OPEN && ndata->xmit_enabled) {
+    while (ndata->state == FILEN_OPEN && ndata->xmit_enabled &&
+	   filen_write_room(ndata)) {
 	filen_unlock(ndata);
 	err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0,
 			NULL, NULL, NULL);
@@ -365,7 +1045,7 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 	}
     }
 
-    if (ndata->state == FILEN_IN_CLOSE) {
+    if (ndata->state == FILEN_IN_CLOSE && filen_close_ready(ndata)) {
 	ndata->state = FILEN_CLOSED;
 	if (ndata->close_done) {
 	    filen_unlock(ndata);
@@ -431,7 +1111,15 @@ filen_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	err = f_open(ndata->o, ndata->infile, F_O_RDONLY, 0, &ndata->inf);
 	if (err)
 	    goto out_unlock;
+#if !USE_FILE_STDIO
+	filen_map_start(ndata);
+#endif
     }
+#if FILEN_AIO
+    ndata->wbuf_len = 0;
+    ndata->write_err = 0;
+    ndata->fsync_done = false;
+#endif
     if (ndata->outfile) {
 	int flags = F_O_WRONLY;
 
@@ -463,14 +1151,11 @@ filen_close(struct gensio *io, gensio_done close_done, void *close_data)
 	err = GE_NOTREADY;
 	goto out_unlock;
     }
-    if (f_ready(ndata->inf)) {
-	f_close(ndata->inf);
-	f_set_not_ready(ndata->inf);
-    }
-    if (f_ready(ndata->outf)) {
-	f_close(ndata->outf);
-	f_set_not_ready(ndata->outf);
-    }
+    if (!FILEN_AIO_ACTIVE(ndata))
+	filen_close_files(ndata);
+    filen_rate_stop(ndata);
+    ndata->data_pending_len = 0;
+    ndata->read_err = 0;
     if (ndata->state == FILEN_IN_OPEN)
 	ndata->state = FILEN_IN_OPEN_CLOSE;
     else
@@ -490,6 +1175,16 @@ filen_free(struct gensio *io)
     struct filen_data *ndata = gensio_get_gensio_data(io);
 
     filen_lock(ndata);
+    filen_rate_stop(ndata);
+#if FILEN_AIO
+    if (ndata->async_threads) {
+	filen_aio_cancel(ndata, &ndata->rd_aio);
+	filen_aio_cancel(ndata, &ndata->wr_aio);
+	if (ndata->rd_aio.busy || ndata->wr_aio.busy)
+	    /* Don't report anything when the workers finish. */
+	    ndata->state = FILEN_CLOSED;
+    }
+#endif
     assert(ndata->refcount > 0);
     if (ndata->refcount == 1)
 	ndata->state = FILEN_CLOSED;
@@ -513,23 +1208,67 @@ filen_control(struct gensio *io, bool get, int op,
 	      char *data, gensiods *datalen)
 {
     struct filen_data *ndata = gensio_get_gensio_data(io);
+#if !USE_FILE_STDIO
+    unsigned long val;
+    int fd, rv = 0;
+#endif
 
-    if (op != GENSIO_CONTROL_RADDR)
-	return GE_NOTSUP;
-    if (!get)
-	return GE_NOTSUP;
-    if (strtoul(data, NULL, 0) > 0)
-	return GE_NOTFOUND;
+    switch (op) {
+    case GENSIO_CONTROL_RADDR:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 0)
+	    return GE_NOTFOUND;
+
+	*datalen = snprintf(data, *datalen,
+			    "file(%s%s%s%s%s)",
+			    ndata->infile ? "infile=" : "",
+			    ndata->infile ? ndata->infile : "",
+			    (ndata->infile && ndata->outfile) ? "," : "",
+			    ndata->outfile ? "outfile=" : "",
+			    ndata->outfile ? ndata->outfile : "");
+	return 0;
 
-    *datalen = snprintf(data, *datalen,
-			"file(%s%s%s%s%s)",
-			ndata->infile ? "infile=" : "",
-			ndata->infile ? ndata->infile : "",
-			(ndata->infile && ndata->outfile) ? "," : "",
-			ndata->outfile ? "outfile=" : "",
-			ndata->outfile ? ndata->outfile : "");
+#if !USE_FILE_STDIO
+    case GENSIO_CONTROL_FD:
+	if (!get)
+	    return GE_NOTSUP;
+	val = strtoul(data, NULL, 0);
+	if (val > 1)
+	    return GE_INVAL;
+	filen_lock(ndata);
+	fd = val == 0 ? ndata->inf : ndata->outf;
+	if (ndata->state != FILEN_OPEN)
+	    rv = GE_NOTREADY;
+	else if (!f_ready(fd))
+	    rv = GE_NOTFOUND;
+	else if (val == 0 && ndata->data_pending_len)
+	    /* Data already read from the fd would be lost. */
+	    rv = GE_INUSE;
+#if FILEN_AIO
+	else if (ndata->async_threads && val == 0 &&
+		 (ndata->rd_aio.busy || ndata->rd_aio.complete))
+	    /* Reading ahead, same problem. */
+	    rv = GE_INUSE;
+	else if (ndata->async_threads && val == 1 &&
+		 (ndata->wr_aio.busy || ndata->wbuf_len))
+	    /* Written data hasn't made it to the file yet. */
+	    rv = GE_INUSE;
+#endif
+	else if (val == 0 && ndata->mapping &&
+		 lseek(fd, ndata->map_off + ndata->map_pos, SEEK_SET) == -1)
+	    /* The fd offset doesn't move when mapped, fix it up. */
+	    rv = gensio_os_err_to_err(ndata->o, errno);
+	filen_unlock(ndata);
+	if (rv)
+	    return rv;
+	*datalen = snprintf(data, *datalen, "%d", fd);
+	return 0;
+#endif
 
-    return 0;
+    default:
+	return GE_NOTSUP;
+    }
 }
 
 static int
@@ -572,6 +1311,13 @@ gensio_file_func(struct gensio *io, int func, gensiods *count,
 
 struct file_ndata_data {
     gensiods max_read_size;
+    gensiods read_rate;
+#if !USE_FILE_STDIO
+    bool use_mmap;
+    gensiods mmap_window;
+    bool do_fsync;
+    unsigned int async_threads;
+#endif
     const char *infile;
     const char *outfile;
     bool create;
@@ -593,6 +1339,36 @@ file_ndata_setup(struct gensio_os_funcs *o, struct file_ndata_data *data,
     ndata->create = data->create;
     ndata->mode = data->mode;
     ndata->read_close = data->read_close;
+    ndata->read_rate = data->read_rate;
+#if !USE_FILE_STDIO
+    ndata->use_mmap = data->use_mmap;
+    ndata->mmap_window = data->mmap_window;
+    ndata->do_fsync = data->do_fsync;
+#endif
+#if FILEN_AIO
+    ndata->async_threads = data->async_threads;
+    ndata->rd_aio.ndata = ndata;
+    ndata->wr_aio.ndata = ndata;
+    if (ndata->async_threads) {
+	o->call_once(o, &filen_aio_once, filen_aio_init, o);
+	if (!filen_aio_lock)
+	    /* No pool, just do the I/O directly. */
+	    ndata->async_threads = 0;
+    }
+    if (ndata->async_threads) {
+	/* Async reads don't map, the page faults would block. */
+	ndata->use_mmap = false;
+	ndata->rd_aio.buf = o->zalloc(o, data->max_read_size);
+	if (!ndata->rd_aio.buf)
+	    goto out_nomem;
+	ndata->wr_aio.buf = o->zalloc(o, FILEN_AIO_WBUF_SIZE);
+	if (!ndata->wr_aio.buf)
+	    goto out_nomem;
+	ndata->wbuf = o->zalloc(o, FILEN_AIO_WBUF_SIZE);
+	if (!ndata->wbuf)
+	    goto out_nomem;
+    }
+#endif
 
     if (data->infile) {
 	ndata->infile = gensio_strdup(o, data->infile);
@@ -618,6 +1394,12 @@ file_ndata_setup(struct gensio_os_funcs *o, struct file_ndata_data *data,
     if (!ndata->deferred_op_runner)
 	goto out_nomem;
 
+    if (ndata->read_rate) {
+	ndata->rate_timer = o->alloc_timer(o, filen_rate_timeout, ndata);
+	if (!ndata->rate_timer)
+	    goto out_nomem;
+    }
+
     ndata->lock = o->alloc_lock(o);
     if (!ndata->lock)
 	goto out_nomem;
@@ -637,12 +1419,16 @@ process_file_args(const char * const args[], struct file_ndata_data *data)
 {
 #if !USE_FILE_STDIO
     unsigned int mode;
+    long pagesize;
 #endif
     unsigned int umode = 6, gmode = 6, omode = 6, i;
 
     memset(data, 0, sizeof(*data));
     data->read_close = true;
     data->max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+#if !USE_FILE_STDIO
+    data->mmap_window = 4 * 1024 * 1024;
+#endif
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &data->max_read_size) > 0)
@@ -653,7 +1439,19 @@ process_file_args(const char * const args[], struct file_ndata_data *data)
 	    continue;
 	if (gensio_check_keybool(args[i], "create", &data->create) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "read_rate", &data->read_rate) > 0)
+	    continue;
 #if !USE_FILE_STDIO
+	if (gensio_check_keybool(args[i], "mmap", &data->use_mmap) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "mmap_window",
+			       &data->mmap_window) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "fsync", &data->do_fsync) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "async_threads",
+				 &data->async_threads) > 0)
+	    continue;
 	if (gensio_check_keymode(args[i], "umode", &umode) > 0)
 	    continue;
 	if (gensio_check_keymode(args[i], "gmode", &gmode) > 0)
@@ -672,6 +1470,15 @@ process_file_args(const char * const args[], struct file_ndata_data *data)
 	return GE_INVAL;
     }
     data->mode = umode << 6 | gmode << 3 | omode;
+#if !USE_FILE_STDIO
+    /* Windows are mapped at multiples of their size, so page align it. */
+    pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0)
+	pagesize = 4096;
+    if (data->mmap_window < (gensiods) pagesize)
+	data->mmap_window = pagesize;
+    data->mmap_window -= data->mmap_window % pagesize;
+#endif
     return 0;
 }
 
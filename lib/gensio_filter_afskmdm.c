@@ -17,11 +17,13 @@
 #include <math.h>
 #include <float.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_time.h>
 #include <gensio/gensio_ax25_addr.h>
+#include <gensio/gensio_crc16.h>
 
 /*
  * This filter implements a audio frequency shift keying modem per the
@@ -153,6 +155,14 @@ struct xmit_entry {
     unsigned int size; /* in bytes. */
     bool is_mark;
 
+    /*
+     * The output frames for this entry, data spread out over the
+     * output channels in the output format and ready to copy into
+     * the transmit buffer.  This is just data if there is only one
+     * float output channel.
+     */
+    void *frames;
+
     /*
      * If we just send this, the first two are the next entries to
      * send if the next is a space or a mark.  The second two are
@@ -164,6 +174,15 @@ struct xmit_entry {
     struct xmit_entry *next;
 };
 
+struct afskmdm_dec_job {
+    struct afskmdm_filter *sfilter;
+    unsigned char *buf1;
+    unsigned char *buf2;
+    unsigned int start;
+    unsigned int end;
+    struct afskmdm_dec_job *next;
+};
+
 struct afskmdm_filter {
     struct gensio_filter *filter;
     struct gensio_os_funcs *o;
@@ -185,6 +204,26 @@ struct afskmdm_filter {
     unsigned int out_chunksize; /* Frame count we send to the sound gensio. */
     bool full_duplex;
 
+    /*
+     * How to get the tone power.  Convolution against the tone tables
+     * for every bit, or a sliding DFT that is updated per sample.
+     */
+    enum afskmdm_demod {
+	AFSKMDM_DEMOD_CONVOLVE,
+	AFSKMDM_DEMOD_SDFT
+    } demod;
+
+    /*
+     * Sliding DFT state for a tone.  re and im are the cos and sin
+     * sums for the window starting at pos.  pos is in the same
+     * units as curr_in_pos, -1 means it must be recalculated.
+     */
+    struct afskmdm_sdft {
+	int pos;
+	float re;
+	float im;
+    } sdft_mark, sdft_space;
+
     unsigned int nsec_per_frame;
 
     /*
@@ -252,6 +291,21 @@ struct afskmdm_filter {
     float *hzmark;
     float *hzspace;
 
+    /*
+     * Fixed point mode, used when the sound gensio is set to s16 so
+     * no floating point is done per sample.  Samples and the tone
+     * tables are Q15, the IIR filter is direct form I with Q28
+     * coefficients in qcoefa/qcoefb and the last two inputs and
+     * outputs in qiirhold.  Only the per bit power comparison is
+     * done in float.
+     */
+    bool fixed;
+    int16_t *qhzmark;
+    int16_t *qhzspace;
+    int32_t qcoefa[2];
+    int32_t qcoefb[3];
+    int32_t qiirhold[4];
+
 /*
  * Use this to tell if we are receiving valid data, mostly to know if
  * we can transmit.  If nr_in_sync is > the given value, we are in
@@ -283,6 +337,29 @@ struct afskmdm_filter {
     unsigned char *prevread;
     unsigned int prevread_size;
 
+    /*
+     * The samples for one channel being convolved, pulled out of
+     * prevread and the current buffer so they are contiguous.  This
+     * is in_convsize + 2 * CONVEDGE long.
+     */
+    float *convsamples;
+
+    /*
+     * With decode_threads set, the tone powers for every window
+     * start in prevread and the current buffer are worked out by the
+     * decoder pool before the bits are processed, see
+     * afskmdm_dec_powers().  pmark_tab and pspace_tab are ntab long,
+     * dec_jobs is decode_threads + 1 long, the first job is done by
+     * the thread delivering the samples.  dec_wait is posted as each
+     * of the other jobs finishes.
+     */
+    unsigned int decode_threads;
+    float *pmark_tab;
+    float *pspace_tab;
+    unsigned int ntab;
+    struct afskmdm_dec_job *dec_jobs;
+    struct gensio_thread_sem *dec_wait;
+
     /*
      * Messages we are currently working on assembling.
      */
@@ -359,54 +436,6 @@ struct afskmdm_filter {
     bool keyed; /* Is the transmitter keyed? */
 };
 
-/* See rfc1549 */
-static const unsigned short ccitt_table[256] = {
-   0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-   0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-   0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-   0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-   0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-   0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-   0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-   0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-   0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-   0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-   0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-   0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-   0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-   0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-   0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-   0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-   0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-   0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-   0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-   0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-   0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-   0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-   0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-   0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-   0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-   0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-   0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-   0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-   0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-   0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-   0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-   0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
-
-static void
-crc16_ccitt(const unsigned char *buf, unsigned int len, uint16_t *icrc)
-{
-	unsigned int i;
-	uint16_t crc = *icrc;
-
-	for (i = 0; i < len; i++)
-	    crc = (crc >> 8) ^ ccitt_table[(crc ^ buf[i]) & 0xff];
-
-	*icrc = crc;
-}
-
 #define filter_to_afskmdm(v) ((struct afskmdm_filter *) \
 			      gensio_filter_get_user_data(v))
 
@@ -788,8 +817,8 @@ afskmdm_add_wrbit(struct afskmdm_filter *sfilter)
     unsigned char bit = sfilter->wrbyte & 1;
     unsigned char level = sfilter->prev_xmit_level;
     struct xmit_entry *curr = sfilter->curr_xmit_ent;
-    unsigned int send_alt = 0, i, j;
-    float *s;
+    unsigned int send_alt = 0;
+    unsigned char *s;
 
     if (sfilter->out_bit_adj) {
 	sfilter->out_bit_counter++;
@@ -826,16 +855,8 @@ afskmdm_add_wrbit(struct afskmdm_filter *sfilter)
     curr = curr->next_send[level + send_alt];
     sfilter->curr_xmit_ent = curr;
 
-    s = (float *) sfilter->xmit_buf;
-    s += sfilter->xmit_buf_len * sfilter->out_nchans;
-    for (i = 0; i < curr->size; i++) {
-	for (j = 0; j < sfilter->out_nchans; j++) {
-	    if ((1 << j) & sfilter->out_chans)
-		*s++ = curr->data[i];
-	    else
-		*s++ = 0.;
-	}
-    }
+    s = sfilter->xmit_buf + sfilter->xmit_buf_len * sfilter->out_framesize;
+    memcpy(s, curr->frames, curr->size * sfilter->out_framesize);
     sfilter->xmit_buf_len += curr->size;
 }
 
@@ -992,7 +1013,7 @@ afskmdm_ul_write(struct gensio_filter *filter,
     /* We have two extra bytes on the end for the CRC, no check needed. */
     crc = 0xffff;
     len = sfilter->wrbufs[cbuf].len;
-    crc16_ccitt(sfilter->wrbufs[cbuf].data, len, &crc);
+    gensio_crc16_ccitt(sfilter->wrbufs[cbuf].data, len, &crc);
     crc ^= 0xffff;
     sfilter->wrbufs[cbuf].data[len++] = crc & 0xff;
     sfilter->wrbufs[cbuf].data[len++] = (crc >> 8) & 0xff;
@@ -1049,11 +1070,7 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
 #endif
 
 /*
- * Do a convolution.
- *
- * convdata is the sin/cosine table to convolve against, the first 2 *
- * in_convsize floats are the sin table, the second 2 * in_convsize floats
- * are the cosine table.
+ * Get n frames of our channel starting at curpos into out.
  *
  * The data comes in two chunks, buf1 is 2 * in_convsize frames at the
  * beginning, buf2 is chunksize frames after that.
@@ -1062,6 +1079,111 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
  * interleaved, meaning that frames from multiple channels may be in
  * it.  We only care about one channel.  So we have to multiply by the
  * number of channels and add the channel offset.
+ */
+static void
+afskmdm_get_samples(struct afskmdm_filter *sfilter, unsigned int curpos,
+		    unsigned int n, unsigned char *buf1, unsigned char *buf2,
+		    float *out)
+{
+    unsigned int i = 0, nchans = sfilter->in_nchans;
+    float *s;
+
+    if (curpos < sfilter->prevread_size) {
+	s = (float *) buf1 + sfilter->in_chan + curpos * nchans;
+	for (; i < n && curpos < sfilter->prevread_size; i++, curpos++) {
+	    out[i] = *s;
+	    s += nchans;
+	}
+    }
+    if (i == n)
+	return;
+
+    /* Make sure we don't go past the end of the buffer. */
+    assert(curpos - sfilter->prevread_size + (n - i) <= sfilter->in_chunksize);
+
+    s = (float *) buf2 + sfilter->in_chan;
+    s += (curpos - sfilter->prevread_size) * nchans;
+    if (nchans == 1) {
+	memcpy(out + i, s, (n - i) * sizeof(float));
+	return;
+    }
+    for (; i < n; i++) {
+	out[i] = *s;
+	s += nchans;
+    }
+}
+
+/* Get a single frame of our channel, see afskmdm_get_samples(). */
+static float
+afskmdm_get_sample(struct afskmdm_filter *sfilter, unsigned int pos,
+		   unsigned char *buf1, unsigned char *buf2)
+{
+    unsigned int off = sfilter->in_chan;
+
+    if (pos < sfilter->prevread_size)
+	return ((float *) buf1)[off + pos * sfilter->in_nchans];
+    pos -= sfilter->prevread_size;
+    assert(pos < sfilter->in_chunksize);
+    return ((float *) buf2)[off + pos * sfilter->in_nchans];
+}
+
+/*
+ * Get the power of a tone for the windows starting at start through
+ * start + (edge * 2) using a sliding DFT, results go into p like
+ * afskmdm_convolve().
+ *
+ * If B(s) is the sum of x[s+k]e^(jwk) over the window, sliding it by
+ * one frame is B(s+1) = e^(-jw)(B(s) - x[s] + x[s+N]e^(jwN)).  The
+ * tone tables already have those values at index 1 and N.  This is
+ * O(1) per frame, the sums are recalculated directly when the window
+ * jumps backwards or a long way forward, and once per input chunk to
+ * keep rounding errors from building up.
+ */
+static void
+afskmdm_sdft(struct afskmdm_filter *sfilter, const float *convdata,
+	     struct afskmdm_sdft *st, unsigned int edge, unsigned int start,
+	     unsigned char *buf1, unsigned char *buf2, float p[])
+{
+    unsigned int n = sfilter->in_convsize, i, k;
+    const float *csin = convdata;
+    const float *ccos = convdata + 2 * n;
+    float x0, xn, tre, tim;
+
+    for (k = 0; k <= edge * 2; k++) {
+	int target = start + k;
+
+	if (st->pos < 0 || target < st->pos ||
+		(unsigned int) (target - st->pos) > n) {
+	    st->re = 0;
+	    st->im = 0;
+	    for (i = 0; i < n; i++) {
+		x0 = afskmdm_get_sample(sfilter, target + i, buf1, buf2);
+		st->re += ccos[i] * x0;
+		st->im += csin[i] * x0;
+	    }
+	    st->pos = target;
+	}
+	for (; st->pos < target; st->pos++) {
+	    x0 = afskmdm_get_sample(sfilter, st->pos, buf1, buf2);
+	    xn = afskmdm_get_sample(sfilter, st->pos + n, buf1, buf2);
+	    tre = st->re - x0 + xn * ccos[n];
+	    tim = st->im + xn * csin[n];
+	    st->re = tre * ccos[1] + tim * csin[1];
+	    st->im = tim * ccos[1] - tre * csin[1];
+	}
+	p[k] = st->re * st->re + st->im * st->im;
+    }
+}
+
+/*
+ * Do a convolution.
+ *
+ * convdata is the sin/cosine table to convolve against, the first 2 *
+ * in_convsize floats are the sin table, the second 2 * in_convsize floats
+ * are the cosine table.
+ *
+ * samples is in_convsize + (edge * 2) contiguous frames of the
+ * channel, from afskmdm_get_samples().
  *
  * Each convolution is done on in_convsize frames of data.  The first
  * in_convsize bytes is processed and put into p[0] (power at the given
@@ -1078,64 +1200,381 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
  * dummyp must be [edge * 4].  p must be [(edge * 2) + 1].
  */
 static void
-afskmdm_convolve(struct afskmdm_filter *sfilter, float *convdata,
-		 unsigned int edge,
-		 unsigned int curpos, unsigned char *buf1, unsigned char *buf2,
+afskmdm_convolve(struct afskmdm_filter *sfilter, const float *convdata,
+		 unsigned int edge, const float *samples,
 		 float p[], float dummyp[])
 {
-    /* There will always be one byte before the data, so the -1 ok. */
-    float *s1 = (float *) buf1 + sfilter->in_chan;
-    float *s2 = (float *) buf2 + sfilter->in_chan;
-    float *csin = convdata;
-    float *ccos = convdata + 2 * sfilter->in_convsize;
-    float v;
-    float psin = 0, pcos = 0;
-    unsigned int i, ppos = 0, spos;
+    const float *csin = convdata;
+    const float *ccos = convdata + 2 * sfilter->in_convsize;
+    unsigned int i, n = sfilter->in_convsize, ppos = 0;
+    float psin, pcos;
+    /*
+     * Use four separate sums so the compiler can keep them in one
+     * vector register and the adds don't all wait on each other.
+     */
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    float c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+	s0 += csin[i] * samples[i];
+	s1 += csin[i + 1] * samples[i + 1];
+	s2 += csin[i + 2] * samples[i + 2];
+	s3 += csin[i + 3] * samples[i + 3];
+	c0 += ccos[i] * samples[i];
+	c1 += ccos[i + 1] * samples[i + 1];
+	c2 += ccos[i + 2] * samples[i + 2];
+	c3 += ccos[i + 3] * samples[i + 3];
+    }
+    for (; i < n; i++) {
+	s0 += csin[i] * samples[i];
+	c0 += ccos[i] * samples[i];
+    }
+    psin = (s0 + s1) + (s2 + s3);
+    pcos = (c0 + c1) + (c2 + c3);
+    p[ppos++] = psin * psin + pcos * pcos;
 
-    if (curpos < sfilter->prevread_size)
-	s1 += curpos * sfilter->in_nchans;
-    else
-	s2 += (curpos - sfilter->prevread_size) * sfilter->in_nchans;
+    for (i = 0; i < edge * 2; i++) {
+	dummyp[i * 2] = csin[i] * samples[i];
+	dummyp[i * 2 + 1] = ccos[i] * samples[i];
+    }
 
-    for (i = 0; i < sfilter->in_convsize; i++, curpos++) {
-	if (curpos < sfilter->prevread_size) {
-	    v = *s1;
-	    s1 += sfilter->in_nchans;
-	} else {
-	    v = *s2;
-	    s2 += sfilter->in_nchans;
+    for (i = n; i < n + (edge * 2); i++) {
+	psin -= dummyp[(i - n) * 2];
+	pcos -= dummyp[(i - n) * 2 + 1];
+	psin += csin[i] * samples[i];
+	pcos += ccos[i] * samples[i];
+	p[ppos++] = psin * psin + pcos * pcos;
+    }
+}
+
+/* afskmdm_get_samples() for s16 samples. */
+static void
+afskmdm_get_samples_q15(struct afskmdm_filter *sfilter, unsigned int curpos,
+			unsigned int n, unsigned char *buf1,
+			unsigned char *buf2, int16_t *out)
+{
+    unsigned int i = 0, nchans = sfilter->in_nchans;
+    int16_t *s;
+
+    if (curpos < sfilter->prevread_size) {
+	s = (int16_t *) buf1 + sfilter->in_chan + curpos * nchans;
+	for (; i < n && curpos < sfilter->prevread_size; i++, curpos++) {
+	    out[i] = *s;
+	    s += nchans;
 	}
-	psin += *csin * v;
-	pcos += *ccos * v;
-	if (i < edge * 2) {
-	    dummyp[i * 2] = *csin * v;
-	    dummyp[i * 2 + 1] = *ccos * v;
+    }
+    if (i == n)
+	return;
+
+    assert(curpos - sfilter->prevread_size + (n - i) <= sfilter->in_chunksize);
+
+    s = (int16_t *) buf2 + sfilter->in_chan;
+    s += (curpos - sfilter->prevread_size) * nchans;
+    for (; i < n; i++) {
+	out[i] = *s;
+	s += nchans;
+    }
+}
+
+/*
+ * afskmdm_convolve() in fixed point.  The products are Q30, they are
+ * taken back to Q15 before summing so the sums fit in 32 bits for
+ * any reasonable convolution size.  The powers are only compared
+ * with each other, so the scale doesn't matter.
+ *
+ * dummyp must be [edge * 4].  p must be [(edge * 2) + 1].
+ */
+static void
+afskmdm_convolve_q15(struct afskmdm_filter *sfilter, const int16_t *convdata,
+		     unsigned int edge, const int16_t *samples,
+		     float p[], int32_t dummyp[])
+{
+    const int16_t *csin = convdata;
+    const int16_t *ccos = convdata + 2 * sfilter->in_convsize;
+    unsigned int i, n = sfilter->in_convsize, ppos = 0;
+    int32_t psin = 0, pcos = 0;
+
+    for (i = 0; i < n; i++) {
+	psin += ((int32_t) csin[i] * samples[i]) >> 15;
+	pcos += ((int32_t) ccos[i] * samples[i]) >> 15;
+    }
+    p[ppos++] = (float) ((int64_t) psin * psin + (int64_t) pcos * pcos);
+
+    for (i = 0; i < edge * 2; i++) {
+	dummyp[i * 2] = ((int32_t) csin[i] * samples[i]) >> 15;
+	dummyp[i * 2 + 1] = ((int32_t) ccos[i] * samples[i]) >> 15;
+    }
+
+    for (i = n; i < n + (edge * 2); i++) {
+	psin -= dummyp[(i - n) * 2];
+	pcos -= dummyp[(i - n) * 2 + 1];
+	psin += ((int32_t) csin[i] * samples[i]) >> 15;
+	pcos += ((int32_t) ccos[i] * samples[i]) >> 15;
+	p[ppos++] = (float) ((int64_t) psin * psin + (int64_t) pcos * pcos);
+    }
+}
+
+/*
+ * The tone measurements are the part of decoding that grows with
+ * the sample rate, and with a lot of samples (a high sample rate,
+ * or several modems in one process) they can be more than one
+ * thread keeps up with.  The bit
+ * processing after it can't be split up, the bit clock, the sync
+ * count and the working message sets all depend on the previous
+ * bit.  But the bit clock only ever picks windows out of the chunk,
+ * so with the decode-threads option the powers for every window
+ * start in the chunk are worked out ahead of time, in parts, by a
+ * process-wide pool of worker threads.  The bits are then processed
+ * in order from those tables, so frames come out in order like
+ * before.
+ *
+ * The pool is shared by all the afskmdm filters, workers are started
+ * as jobs are queued, up to the largest decode-threads value, and
+ * sleep on afskmdm_dec_sem when there is nothing to do.  The thread
+ * delivering the samples does a part itself and waits for the rest
+ * before going on, so the jobs never outlive the write.
+ */
+#define AFSKMDM_DEC_MAX_THREADS 64
+
+struct afskmdm_dec_worker {
+    struct gensio_thread *tid;
+    struct afskmdm_dec_worker *next;
+};
+
+static struct gensio_once afskmdm_dec_once;
+static struct gensio_os_funcs *afskmdm_dec_o;
+static struct gensio_lock *afskmdm_dec_lock;
+static struct gensio_thread_sem *afskmdm_dec_sem;
+static struct afskmdm_dec_worker *afskmdm_dec_workers;
+static unsigned int afskmdm_dec_nr_threads;
+static unsigned int afskmdm_dec_nr_idle;
+static bool afskmdm_dec_shutdown;
+static struct afskmdm_dec_job *afskmdm_dec_queue;
+static struct afskmdm_dec_job **afskmdm_dec_queue_tail = &afskmdm_dec_queue;
+
+/*
+ * Fill in the power tables from job->start up to job->end.  A
+ * sliding DFT makes each window after the first O(1).
+ */
+static void
+afskmdm_dec_run(struct afskmdm_dec_job *job)
+{
+    struct afskmdm_filter *sfilter = job->sfilter;
+    struct afskmdm_sdft mark = { -1, 0, 0 }, space = { -1, 0, 0 };
+    unsigned int i;
+
+    for (i = job->start; i < job->end; i++) {
+	afskmdm_sdft(sfilter, sfilter->hzmark, &mark, 0, i,
+		     job->buf1, job->buf2, &sfilter->pmark_tab[i]);
+	afskmdm_sdft(sfilter, sfilter->hzspace, &space, 0, i,
+		     job->buf1, job->buf2, &sfilter->pspace_tab[i]);
+    }
+}
+
+static void
+afskmdm_dec_thread(void *data)
+{
+    struct afskmdm_dec_job *job;
+
+    gensio_os_thread_set_attr(afskmdm_dec_o, NULL);
+
+    afskmdm_dec_o->lock(afskmdm_dec_lock);
+    while (!afskmdm_dec_shutdown) {
+	job = afskmdm_dec_queue;
+	if (!job) {
+	    afskmdm_dec_nr_idle++;
+	    afskmdm_dec_o->unlock(afskmdm_dec_lock);
+	    gensio_os_sem_wait(afskmdm_dec_sem);
+	    afskmdm_dec_o->lock(afskmdm_dec_lock);
+	    continue;
 	}
-	csin++;
-	ccos++;
+	afskmdm_dec_queue = job->next;
+	if (!afskmdm_dec_queue)
+	    afskmdm_dec_queue_tail = &afskmdm_dec_queue;
+	afskmdm_dec_o->unlock(afskmdm_dec_lock);
+
+	afskmdm_dec_run(job);
+	gensio_os_sem_post(job->sfilter->dec_wait);
+
+	afskmdm_dec_o->lock(afskmdm_dec_lock);
     }
-    p[ppos++] = psin * psin + pcos * pcos;
+    afskmdm_dec_o->unlock(afskmdm_dec_lock);
+}
+
+static void
+afskmdm_dec_cleanup(void)
+{
+    struct afskmdm_dec_worker *w;
 
-    for (spos = 0; i < sfilter->in_convsize + (edge * 2);
-	 i++, curpos++, spos++) {
+    if (!afskmdm_dec_lock)
+	return;
+    afskmdm_dec_o->lock(afskmdm_dec_lock);
+    afskmdm_dec_shutdown = true;
+    for (; afskmdm_dec_nr_idle > 0; afskmdm_dec_nr_idle--)
+	gensio_os_sem_post(afskmdm_dec_sem);
+    afskmdm_dec_o->unlock(afskmdm_dec_lock);
+    while ((w = afskmdm_dec_workers)) {
+	afskmdm_dec_workers = w->next;
+	gensio_os_wait_thread(w->tid);
+	afskmdm_dec_o->free(afskmdm_dec_o, w);
+    }
+    afskmdm_dec_nr_threads = 0;
+    afskmdm_dec_shutdown = false;
+    gensio_os_free_sem(afskmdm_dec_sem);
+    afskmdm_dec_sem = NULL;
+    afskmdm_dec_o->free_lock(afskmdm_dec_lock);
+    afskmdm_dec_lock = NULL;
+    memset(&afskmdm_dec_once, 0, sizeof(afskmdm_dec_once));
+}
 
-	/* Make sure we don't go past the end of the buffer. */
-	assert(curpos <= sfilter->prevread_size ||
-	       curpos - sfilter->prevread_size < sfilter->in_chunksize);
+static struct gensio_class_cleanup afskmdm_dec_cleanup_data = {
+    afskmdm_dec_cleanup
+};
 
-	if (curpos < sfilter->prevread_size) {
-	    v = *s1;
-	    s1 += sfilter->in_nchans;
-	} else {
-	    v = *s2;
-	    s2 += sfilter->in_nchans;
+static void
+afskmdm_dec_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    afskmdm_dec_o = o;
+    if (gensio_os_new_sem(o, &afskmdm_dec_sem))
+	return;
+    afskmdm_dec_lock = o->alloc_lock(o);
+    if (!afskmdm_dec_lock) {
+	gensio_os_free_sem(afskmdm_dec_sem);
+	afskmdm_dec_sem = NULL;
+	return;
+    }
+    gensio_register_class_cleanup(&afskmdm_dec_cleanup_data);
+}
+
+/*
+ * Get a worker to look at the queue, waking an idle one or starting
+ * another if the filter allows it.  If this fails the job is left on
+ * the queue for the delivering thread to do.  Call with
+ * afskmdm_dec_lock held.
+ */
+static void
+afskmdm_dec_kick(struct afskmdm_filter *sfilter)
+{
+    unsigned int max = sfilter->decode_threads;
+    struct afskmdm_dec_worker *w;
+
+    if (afskmdm_dec_nr_idle > 0) {
+	afskmdm_dec_nr_idle--;
+	gensio_os_sem_post(afskmdm_dec_sem);
+	return;
+    }
+    if (max > AFSKMDM_DEC_MAX_THREADS)
+	max = AFSKMDM_DEC_MAX_THREADS;
+    if (afskmdm_dec_nr_threads >= max)
+	return;
+    w = afskmdm_dec_o->zalloc(afskmdm_dec_o, sizeof(*w));
+    if (!w)
+	return;
+    if (gensio_os_new_thread(afskmdm_dec_o, afskmdm_dec_thread, NULL,
+			     &w->tid)) {
+	afskmdm_dec_o->free(afskmdm_dec_o, w);
+	return;
+    }
+    w->next = afskmdm_dec_workers;
+    afskmdm_dec_workers = w;
+    afskmdm_dec_nr_threads++;
+}
+
+/*
+ * Work out the tone powers for every window in prevread (buf1) and
+ * the current chunk (buf2).
+ */
+static void
+afskmdm_dec_powers(struct afskmdm_filter *sfilter,
+		   unsigned char *buf1, unsigned char *buf2)
+{
+    unsigned int i, nr_jobs = sfilter->decode_threads + 1, nr_queued = 0;
+    unsigned int per = (sfilter->ntab + nr_jobs - 1) / nr_jobs;
+    struct afskmdm_dec_job *job, **prev;
+
+    for (i = 0; i < nr_jobs; i++) {
+	job = &sfilter->dec_jobs[i];
+	job->buf1 = buf1;
+	job->buf2 = buf2;
+	job->start = i * per;
+	if (job->start > sfilter->ntab)
+	    job->start = sfilter->ntab;
+	job->end = job->start + per;
+	if (job->end > sfilter->ntab)
+	    job->end = sfilter->ntab;
+    }
+
+    afskmdm_dec_o->lock(afskmdm_dec_lock);
+    for (i = 1; i < nr_jobs; i++) {
+	job = &sfilter->dec_jobs[i];
+	if (job->start == job->end)
+	    break;
+	job->next = NULL;
+	*afskmdm_dec_queue_tail = job;
+	afskmdm_dec_queue_tail = &job->next;
+	nr_queued++;
+	afskmdm_dec_kick(sfilter);
+    }
+    afskmdm_dec_o->unlock(afskmdm_dec_lock);
+
+    afskmdm_dec_run(&sfilter->dec_jobs[0]);
+
+    /* Do any of ours that no worker has picked up yet. */
+    afskmdm_dec_o->lock(afskmdm_dec_lock);
+    prev = &afskmdm_dec_queue;
+    while ((job = *prev)) {
+	if (job->sfilter != sfilter) {
+	    prev = &job->next;
+	    continue;
 	}
-	psin -= dummyp[spos * 2];
-	pcos -= dummyp[spos * 2 + 1];
-	psin += *csin++ * v;
-	pcos += *ccos++ * v;
-	p[ppos++] = psin * psin + pcos * pcos;
+	*prev = job->next;
+	if (!*prev)
+	    afskmdm_dec_queue_tail = prev;
+	afskmdm_dec_o->unlock(afskmdm_dec_lock);
+	afskmdm_dec_run(job);
+	nr_queued--;
+	afskmdm_dec_o->lock(afskmdm_dec_lock);
+	/* The queue may have changed, start over. */
+	prev = &afskmdm_dec_queue;
+    }
+    afskmdm_dec_o->unlock(afskmdm_dec_lock);
+
+    for (; nr_queued > 0; nr_queued--)
+	gensio_os_sem_wait(sfilter->dec_wait);
+}
+
+/*
+ * Set up the decoder pool for the filter.  If this fails the filter
+ * just decodes on the thread delivering the samples.
+ */
+static int
+afskmdm_dec_setup(struct afskmdm_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned int i, nr_jobs = sfilter->decode_threads + 1;
+
+    o->call_once(o, &afskmdm_dec_once, afskmdm_dec_init, o);
+    if (!afskmdm_dec_lock) {
+	sfilter->decode_threads = 0;
+	return 0;
     }
+
+    sfilter->ntab = (sfilter->prevread_size + sfilter->in_chunksize -
+		     sfilter->in_convsize + 1);
+    sfilter->pmark_tab = o->zalloc(o, sizeof(float) * sfilter->ntab);
+    if (!sfilter->pmark_tab)
+	return GE_NOMEM;
+    sfilter->pspace_tab = o->zalloc(o, sizeof(float) * sfilter->ntab);
+    if (!sfilter->pspace_tab)
+	return GE_NOMEM;
+    sfilter->dec_jobs = o->zalloc(o, sizeof(*sfilter->dec_jobs) * nr_jobs);
+    if (!sfilter->dec_jobs)
+	return GE_NOMEM;
+    for (i = 0; i < nr_jobs; i++)
+	sfilter->dec_jobs[i].sfilter = sfilter;
+    return gensio_os_new_sem(o, &sfilter->dec_wait);
 }
 
 static void
@@ -1210,7 +1649,7 @@ afskmdm_handle_new_message(struct afskmdm_filter *sfilter, unsigned int pos,
 	goto bad_msg;
 
     crc = 0xffff;
-    crc16_ccitt(w->read_data, w->read_data_len - 2, &crc);
+    gensio_crc16_ccitt(w->read_data, w->read_data_len - 2, &crc);
     crc ^= 0xffff;
     msgcrc = ((w->read_data[w->read_data_len - 1] << 8) |
 	      w->read_data[w->read_data_len - 2]);
@@ -1471,10 +1910,38 @@ afskmdm_check_for_data(struct afskmdm_filter *sfilter, unsigned int *curpos,
     unsigned int i, best_pos = 0, wset;
     float certainty = 0.0, m;
 
-    afskmdm_convolve(sfilter, sfilter->hzmark, CONVEDGE, (*curpos) - CONVEDGE,
-		     buf1, buf2, pmark, dummyp);
-    afskmdm_convolve(sfilter, sfilter->hzspace, CONVEDGE, (*curpos) - CONVEDGE,
-		     buf1, buf2, pspace, dummyp);
+    if (sfilter->pmark_tab && (*curpos) + CONVEDGE < sfilter->ntab) {
+	/* The decoder pool already did the work. */
+	memcpy(pmark, sfilter->pmark_tab + (*curpos) - CONVEDGE,
+	       sizeof(pmark));
+	memcpy(pspace, sfilter->pspace_tab + (*curpos) - CONVEDGE,
+	       sizeof(pspace));
+    } else if (sfilter->demod == AFSKMDM_DEMOD_SDFT) {
+	afskmdm_sdft(sfilter, sfilter->hzmark, &sfilter->sdft_mark, CONVEDGE,
+		     (*curpos) - CONVEDGE, buf1, buf2, pmark);
+	afskmdm_sdft(sfilter, sfilter->hzspace, &sfilter->sdft_space, CONVEDGE,
+		     (*curpos) - CONVEDGE, buf1, buf2, pspace);
+    } else if (sfilter->fixed) {
+	int32_t qdummyp[CONVEDGE * 4];
+	int16_t *samples = (int16_t *) sfilter->convsamples;
+
+	afskmdm_get_samples_q15(sfilter, (*curpos) - CONVEDGE,
+				sfilter->in_convsize + CONVEDGE * 2,
+				buf1, buf2, samples);
+	afskmdm_convolve_q15(sfilter, sfilter->qhzmark, CONVEDGE,
+			     samples, pmark, qdummyp);
+	afskmdm_convolve_q15(sfilter, sfilter->qhzspace, CONVEDGE,
+			     samples, pspace, qdummyp);
+    } else {
+	/* Pull the samples out once and use them for both tones. */
+	afskmdm_get_samples(sfilter, (*curpos) - CONVEDGE,
+			    sfilter->in_convsize + CONVEDGE * 2, buf1, buf2,
+			    sfilter->convsamples);
+	afskmdm_convolve(sfilter, sfilter->hzmark, CONVEDGE,
+			 sfilter->convsamples, pmark, dummyp);
+	afskmdm_convolve(sfilter, sfilter->hzspace, CONVEDGE,
+			 sfilter->convsamples, pspace, dummyp);
+    }
 
     process_powers(sfilter, pmark, pspace, &best_pos, &certainty, &level);
     if (sfilter->debug & 2) {
@@ -1553,6 +2020,37 @@ afskmdm_iir_filter(float *inbuf, float *outbuf, unsigned int nsamples,
     }
 }
 
+/*
+ * afskmdm_iir_filter() for s16 samples.  This uses direct form I, so
+ * the held values are the last two inputs and outputs and stay in
+ * the sample range.  hold is x[n-1], x[n-2], y[n-1], y[n-2].
+ */
+static void
+afskmdm_iir_filter_q15(int16_t *inbuf, int16_t *outbuf, unsigned int nsamples,
+		       unsigned int nchans, unsigned int chan,
+		       int32_t coefa[2], int32_t coefb[3], int32_t hold[4])
+{
+    unsigned int i;
+    int64_t acc;
+    int32_t y;
+
+    for (i = chan; i < nsamples * nchans; i += nchans) {
+	acc = ((int64_t) coefb[0] * inbuf[i] + (int64_t) coefb[1] * hold[0] +
+	       (int64_t) coefb[2] * hold[1] + (int64_t) coefa[0] * hold[2] +
+	       (int64_t) coefa[1] * hold[3]);
+	y = acc >> 28;
+	if (y > INT16_MAX)
+	    y = INT16_MAX;
+	else if (y < INT16_MIN)
+	    y = INT16_MIN;
+	outbuf[i] = y;
+	hold[1] = hold[0];
+	hold[0] = inbuf[i];
+	hold[3] = hold[2];
+	hold[2] = y;
+    }
+}
+
 /*
  * Calculate 2nd order IIR filter coefficients for a low-pass
  * Butterworth filter.
@@ -1604,7 +2102,15 @@ afskmdm_ll_write(struct gensio_filter *filter,
     if (buflen != (gensiods) sfilter->in_chunksize * sfilter->in_framesize)
 	return GE_INVAL;
 
-    if (sfilter->filteredbuf) {
+    if (sfilter->filteredbuf && sfilter->fixed) {
+	afskmdm_iir_filter_q15((int16_t *) buf,
+			       (int16_t *) sfilter->filteredbuf,
+			       sfilter->in_chunksize,
+			       sfilter->in_nchans, sfilter->in_chan,
+			       sfilter->qcoefa, sfilter->qcoefb,
+			       sfilter->qiirhold);
+	buf = sfilter->filteredbuf;
+    } else if (sfilter->filteredbuf) {
 	afskmdm_iir_filter((float *) buf, (float *) sfilter->filteredbuf,
 			   sfilter->in_chunksize,
 			   sfilter->in_nchans, sfilter->in_chan,
@@ -1620,6 +2126,8 @@ afskmdm_ll_write(struct gensio_filter *filter,
 	sfilter->curr_in_pos = sfilter->prevread_size;
 	goto skip_processing;
     }
+    if (sfilter->decode_threads)
+	afskmdm_dec_powers(sfilter, sfilter->prevread, buf);
     while (pos < sfilter->in_chunksize + sfilter->in_convsize - CONVEDGE) {
 	bool in_sync = true;
 
@@ -1661,6 +2169,9 @@ afskmdm_ll_write(struct gensio_filter *filter,
 	pos += sfilter->in_convsize;
     }
     sfilter->curr_in_pos = pos - sfilter->in_chunksize;
+    /* Positions are about to shift, recalculate the sliding DFT. */
+    sfilter->sdft_mark.pos = -1;
+    sfilter->sdft_space.pos = -1;
  skip_processing:
     sfilter->framenr += sfilter->in_chunksize;
 
@@ -1739,6 +2250,8 @@ afskmdm_sfilter_free(struct afskmdm_filter *sfilter)
 
     while (e) {
 	n = e->next;
+	if (e->frames && e->frames != e->data)
+	    o->free(o, e->frames);
 	o->free(o, e);
 	e = n;
     }
@@ -1760,8 +2273,22 @@ afskmdm_sfilter_free(struct afskmdm_filter *sfilter)
 	o->free(o, sfilter->hzmark);
     if (sfilter->hzspace)
 	o->free(o, sfilter->hzspace);
+    if (sfilter->qhzmark)
+	o->free(o, sfilter->qhzmark);
+    if (sfilter->qhzspace)
+	o->free(o, sfilter->qhzspace);
     if (sfilter->prevread)
 	o->free(o, sfilter->prevread);
+    if (sfilter->convsamples)
+	o->free(o, sfilter->convsamples);
+    if (sfilter->pmark_tab)
+	o->free(o, sfilter->pmark_tab);
+    if (sfilter->pspace_tab)
+	o->free(o, sfilter->pspace_tab);
+    if (sfilter->dec_jobs)
+	o->free(o, sfilter->dec_jobs);
+    if (sfilter->dec_wait)
+	gensio_os_free_sem(sfilter->dec_wait);
     if (sfilter->wmsgsets) {
 	for (i = 0; i < sfilter->wmsg_sets; i++) {
 	    if (sfilter->wmsgsets[i].wmsgs) {
@@ -1905,6 +2432,50 @@ afskmdm_find_wave_pos(float *wave, unsigned int wave_size,
 static int afskmdm_setup_xmit_ent(struct afskmdm_filter *sfilter,
 				  struct xmit_entry *e);
 
+/*
+ * Build the output frames for the entry, so transmitting a bit is
+ * just a copy.
+ */
+static int
+afskmdm_setup_xmit_frames(struct afskmdm_filter *sfilter,
+			  struct xmit_entry *e)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned int i, j;
+    float *s;
+
+    if (!sfilter->fixed && sfilter->out_nchans == 1 &&
+		sfilter->out_chans == 1) {
+	e->frames = e->data;
+	return 0;
+    }
+
+    e->frames = o->zalloc(o, e->size * sfilter->out_framesize);
+    if (!e->frames)
+	return GE_NOMEM;
+    if (sfilter->fixed) {
+	int16_t *q = e->frames;
+
+	for (i = 0; i < e->size; i++) {
+	    for (j = 0; j < sfilter->out_nchans; j++) {
+		if ((1 << j) & sfilter->out_chans)
+		    *q = lrintf(e->data[i] * INT16_MAX);
+		q++;
+	    }
+	}
+	return 0;
+    }
+    s = e->frames;
+    for (i = 0; i < e->size; i++) {
+	for (j = 0; j < sfilter->out_nchans; j++) {
+	    if ((1 << j) & sfilter->out_chans)
+		*s = e->data[i];
+	    s++;
+	}
+    }
+    return 0;
+}
+
 static struct xmit_entry *
 afskmdm_create_xmit_ent(struct afskmdm_filter *sfilter, bool is_mark,
 			unsigned int pos, float *data, unsigned int size)
@@ -1920,6 +2491,8 @@ afskmdm_create_xmit_ent(struct afskmdm_filter *sfilter, bool is_mark,
     e->next = sfilter->xmit_ent_list;
     sfilter->xmit_ent_list = e;
 
+    if (afskmdm_setup_xmit_frames(sfilter, e))
+	return NULL;
     if (afskmdm_setup_xmit_ent(sfilter, e))
 	return NULL;
 
@@ -2025,6 +2598,9 @@ struct gensio_afskmdm_data {
     const char *keyon;
     const char *keyoff;
     bool full_duplex;
+    bool fixed;
+    enum afskmdm_demod demod;
+    unsigned int decode_threads;
 };
 
 static int
@@ -2068,6 +2644,8 @@ afskmdm_setup_transmit(struct afskmdm_filter *sfilter,
     e->next = NULL;
     sfilter->xmit_ent_list = e;
     sfilter->curr_xmit_ent = e;
+    if (afskmdm_setup_xmit_frames(sfilter, e))
+	return GE_NOMEM;
 
     return afskmdm_setup_xmit_ent(sfilter, e);
 }
@@ -2089,8 +2667,14 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->out_nchans = data->out_nchans;
     sfilter->in_chan = data->in_chan;
     sfilter->out_chans = data->out_chans;
-    sfilter->in_framesize = sizeof(float) * data->in_nchans;
-    sfilter->out_framesize = sizeof(float) * data->out_nchans;
+    sfilter->fixed = data->fixed;
+    if (data->fixed) {
+	sfilter->in_framesize = sizeof(int16_t) * data->in_nchans;
+	sfilter->out_framesize = sizeof(int16_t) * data->out_nchans;
+    } else {
+	sfilter->in_framesize = sizeof(float) * data->in_nchans;
+	sfilter->out_framesize = sizeof(float) * data->out_nchans;
+    }
     sfilter->max_write_size = data->max_write_size;
     sfilter->max_read_size = data->max_read_size + 2; /* Extra 2 for the CRC. */
     sfilter->debug = data->debug;
@@ -2105,6 +2689,9 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->tx_postamble_time = GENSIO_MSECS_TO_NSECS(data->tx_postamble_time);
     sfilter->tx_predelay_time = GENSIO_MSECS_TO_NSECS(data->tx_predelay_time);
     sfilter->full_duplex = data->full_duplex;
+    sfilter->demod = data->demod;
+    sfilter->sdft_mark.pos = -1;
+    sfilter->sdft_space.pos = -1;
     if (data->key) {
 	sfilter->key = gensio_strdup(o, data->key);
 	if (!sfilter->key)
@@ -2217,9 +2804,28 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_os_funcs *o,
 	sfilter->hzspace[i + 2 * sfilter->in_convsize] = cos(v / fconvsize);
     }
 
+    if (sfilter->fixed) {
+	unsigned int n = 4 * sfilter->in_convsize;
+
+	sfilter->qhzmark = o->zalloc(o, sizeof(int16_t) * n);
+	if (!sfilter->qhzmark)
+	    goto out_nomem;
+	sfilter->qhzspace = o->zalloc(o, sizeof(int16_t) * n);
+	if (!sfilter->qhzspace)
+	    goto out_nomem;
+	for (i = 0; i < n; i++) {
+	    sfilter->qhzmark[i] = lrintf(sfilter->hzmark[i] * INT16_MAX);
+	    sfilter->qhzspace[i] = lrintf(sfilter->hzspace[i] * INT16_MAX);
+	}
+    }
+
     if (data->lpcutoff) {
 	afskmdm_calc_iir_coefs(data->in_framerate, data->lpcutoff,
 			       sfilter->coefa, sfilter->coefb);
+	for (i = 0; i < 2; i++)
+	    sfilter->qcoefa[i] = lrintf(sfilter->coefa[i] * (1 << 28));
+	for (i = 0; i < 3; i++)
+	    sfilter->qcoefb[i] = lrintf(sfilter->coefb[i] * (1 << 28));
 
 	sfilter->filteredbuf = o->zalloc(o,
 		(gensiods) sfilter->in_framesize * sfilter->in_chunksize);
@@ -2232,8 +2838,17 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_os_funcs *o,
 		(gensiods) sfilter->in_framesize * sfilter->prevread_size);
     if (!sfilter->prevread)
 	goto out_nomem;
+
+    sfilter->convsamples = o->zalloc(o, sizeof(float) *
+				     (sfilter->in_convsize + CONVEDGE * 2));
+    if (!sfilter->convsamples)
+	goto out_nomem;
     sfilter->curr_in_pos = sfilter->prevread_size;
 
+    sfilter->decode_threads = data->decode_threads;
+    if (sfilter->decode_threads && afskmdm_dec_setup(sfilter))
+	goto out_nomem;
+
     sfilter->wmsgsets = o->zalloc(o, (sizeof(struct wmsgset) *
 				      sfilter->wmsg_sets));
     for (i = 0; i < sfilter->wmsg_sets; i++) {
@@ -2309,6 +2924,12 @@ afskmdm_child_getuint(struct gensio *child, int option, unsigned int *val)
     return 0;
 }
 
+static struct gensio_enum_val afskmdm_demod_enums[] = {
+    { "convolve", AFSKMDM_DEMOD_CONVOLVE },
+    { "sdft", AFSKMDM_DEMOD_SDFT },
+    { NULL }
+};
+
 int
 gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
 			    struct gensio *child,
@@ -2339,6 +2960,7 @@ gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
 	.tx_predelay_time = 100,
 	.volume = .75,
 	.full_duplex = false,
+	.demod = AFSKMDM_DEMOD_CONVOLVE,
     };
     unsigned int i;
     int err;
@@ -2346,6 +2968,7 @@ gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
     gensiods cdata_len;
     unsigned int chan;
     unsigned int wmsg_extra = 1;
+    int ival;
 
     err = afskmdm_child_getuint(child, GENSIO_CONTROL_IN_BUFSIZE,
 				&data.in_chunksize);
@@ -2367,16 +2990,21 @@ gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
     afskmdm_child_getuint(child, GENSIO_CONTROL_OUT_NR_CHANS,
 			  &data.out_nchans);
 
+    /* float uses the float DSP, s16 uses fixed point. */
     cdata_len = sizeof(cdata);
     err = gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, true,
 			 GENSIO_CONTROL_IN_FORMAT, cdata, &cdata_len);
-    if (err || strcmp(cdata, "float") != 0)
+    if (err)
+	return GE_INCONSISTENT;
+    if (strcmp(cdata, "s16") == 0)
+	data.fixed = true;
+    else if (strcmp(cdata, "float") != 0)
 	return GE_INCONSISTENT;
 
     cdata_len = sizeof(cdata);
     err = gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, true,
 			 GENSIO_CONTROL_OUT_FORMAT, cdata, &cdata_len);
-    if (err || strcmp(cdata, "float") != 0)
+    if (err || strcmp(cdata, data.fixed ? "s16" : "float") != 0)
 	return GE_INCONSISTENT;
 
     for (i = 0; args && args[i]; i++) {
@@ -2443,6 +3071,14 @@ gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
 	    continue;
 	if (gensio_check_keybool(args[i], "full-duplex", &data.full_duplex) > 0)
 	    continue;
+	if (gensio_check_keyenum(args[i], "demod", afskmdm_demod_enums,
+				 &ival) > 0) {
+	    data.demod = ival;
+	    continue;
+	}
+	if (gensio_check_keyuint(args[i], "decode-threads",
+				 &data.decode_threads) > 0)
+	    continue;
 	if (gensio_check_keyuint(args[i], "debug", &data.debug) > 0)
 	    continue;
 	return GE_INVAL;
@@ -2459,6 +3095,11 @@ gensio_afskmdm_filter_alloc(struct gensio_os_funcs *o,
     if (data.key && (!data.keyon || !data.keyoff))
 	return GE_INVAL;
 
+    /* The sliding DFT, and the decoder pool that uses it, are float only. */
+    if (data.fixed && (data.demod == AFSKMDM_DEMOD_SDFT ||
+		       data.decode_threads))
+	return GE_INVAL;
+
     data.wmsg_sets = wmsg_extra * 2 + 1;
 
     filter = gensio_afskmdm_filter_raw_alloc(o, &data);
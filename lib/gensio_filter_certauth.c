@@ -31,6 +31,9 @@ struct gensio_certauth_filter_data {
     bool use_child_auth;
     bool enable_password;
     bool do_2fa; /* Ask for two-factor authentication, version 2+ */
+    bool fast_auth;
+    unsigned int verify_cache;
+    gensio_time verify_cache_time;
 
     /*
      * The following is only used for testing. so certauth can be run
@@ -41,6 +44,8 @@ struct gensio_certauth_filter_data {
 
 #include <assert.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <openssl/x509.h>
 #include <openssl/x509_vfy.h>
@@ -52,6 +57,7 @@ struct gensio_certauth_filter_data {
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_time.h>
 
 /* Also in gensio_filter_ssl.c. */
 static int
@@ -165,6 +171,7 @@ gensio_cert_fingerprint(X509 *cert, char *buf, gensiods *buflen)
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #define X509_up_ref(x) CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509)
+#define X509_get0_notAfter(x) X509_get_notAfter(x)
 static EVP_MD_CTX *EVP_MD_CTX_new(void)
 {
     EVP_MD_CTX *c = OPENSSL_malloc(sizeof(*c));
@@ -181,7 +188,13 @@ static void EVP_MD_CTX_free(EVP_MD_CTX *c)
 
 #define GENSIO_CERTAUTH_DATA_SIZE	2048
 #define GENSIO_CERTAUTH_CHALLENGE_SIZE	32
-#define GENSIO_CERTAUTH_VERSION		4
+#define GENSIO_CERTAUTH_VERSION		5
+
+/*
+ * Label for the TLS keying material signed for fast authentication,
+ * version 5 and later.  See CERTAUTH_OPTIONS.
+ */
+#define GENSIO_CERTAUTH_FAST_LABEL	"EXPORTER-gensio-certauth"
 
 /*
  * Passwords are always sent in this size buffer to keep an attacker
@@ -226,6 +239,12 @@ enum certauth_state {
      *
      * Message contains a VERSION element, an optional USERNAME
      * element, and an optional SERVICE element.
+     *
+     * In version 5 and later, the message may also contain an
+     * OPTIONS element with the client's certificate and a challenge
+     * response.  If that verifies, the server sends a SERVERDONE
+     * right away and skips the rest.  Otherwise it goes on as if the
+     * OPTIONS element was not there.
      */
     CERTAUTH_CLIENTHELLO = 1,
 
@@ -332,7 +351,15 @@ enum certauth_elements {
     CERTAUTH_USERNAME		= 101,
 
     /*
-     * Currently not used.
+     * 102 <n> <elements>
+     *
+     * Fast authentication, version 5 and later, client to server in
+     * CLIENTHELLO.  Holds a CERTIFICATE element followed by a
+     * CHALLENGE_RSP element, in the normal format.  The challenge
+     * response signs 32 bytes of keying material exported from the
+     * TLS layer under GENSIO_CERTAUTH_FAST_LABEL instead of challenge
+     * data from the server.  That is unique to the connection, so it
+     * can't be replayed.  Earlier versions ignore this element.
      */
     CERTAUTH_OPTIONS		= 102,
 
@@ -467,6 +494,18 @@ struct certauth_filter {
     /* Enable 2-factor authentication. */
     bool do_2fa;
 
+    /*
+     * Send (client) or accept (server) the certificate in the hello,
+     * see CERTAUTH_OPTIONS.  fast_data is the OPTIONS element received
+     * by the server.
+     */
+    bool fast_auth;
+    unsigned char *fast_data;
+    gensiods fast_data_len;
+
+    /* Number of messages received from the other end. */
+    unsigned int round_trips;
+
     char *username;
     size_t username_len;
 
@@ -495,6 +534,15 @@ struct certauth_filter {
     EVP_PKEY *pkey;
     X509_STORE *verify_store;
 
+    /*
+     * Verified certificate cache, see certauth_vcache_check().
+     * verify_ca is the file or directory verify_store was loaded
+     * from, NULL if none.
+     */
+    unsigned int verify_cache;
+    int64_t verify_cache_time;
+    char *verify_ca;
+
     bool allow_authfail;
 
     BUF_MEM cert_buf_mem;
@@ -530,6 +578,13 @@ static void
 gca_vlog(struct certauth_filter *f, enum gensio_log_levels l,
 	 bool do_ssl_err, char *fmt, va_list ap)
 {
+    if (!gensio_log_enabled(f->o, l)) {
+	/* Keep the error queue the same as if we had logged. */
+	if (do_ssl_err)
+	    ERR_get_error();
+	return;
+    }
+
     if (do_ssl_err) {
 	char buf[256], buf2[200];
 	unsigned long ssl_err = ERR_get_error();
@@ -712,6 +767,191 @@ certauth_writepos(struct certauth_filter *sfilter)
     return sfilter->write_buf + sfilter->write_buf_len;
 }
 
+/*
+ * Building and checking the certificate chain is expensive, and the
+ * same clients tend to reconnect over and over.  If enabled, the
+ * SHA-256 digest of each certificate that verifies is saved, along
+ * with the CA location it verified against and when that changed.
+ * If the CA file or directory is modified, or the entry times out,
+ * the certificate is verified again.  Only the chain check is
+ * skipped, the challenge response is still done every time.
+ */
+struct certauth_vcache_ent {
+    struct certauth_vcache_ent *next;
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    char *ca;
+    time_t ca_mtime;
+    time_t ca_ctime;
+    gensio_time expire;
+};
+
+static struct gensio_once certauth_vcache_once;
+static struct gensio_os_funcs *certauth_vcache_o;
+static struct gensio_lock *certauth_vcache_lock;
+static struct certauth_vcache_ent *certauth_vcache;
+static unsigned int certauth_vcache_len;
+
+static void
+certauth_vcache_ent_free(struct certauth_vcache_ent *e)
+{
+    struct gensio_os_funcs *o = certauth_vcache_o;
+
+    if (e->ca)
+	o->free(o, e->ca);
+    o->free(o, e);
+}
+
+static void
+certauth_vcache_cleanup(void)
+{
+    struct certauth_vcache_ent *e;
+
+    while (certauth_vcache) {
+	e = certauth_vcache;
+	certauth_vcache = e->next;
+	certauth_vcache_ent_free(e);
+    }
+    certauth_vcache_len = 0;
+    if (certauth_vcache_lock)
+	certauth_vcache_o->free_lock(certauth_vcache_lock);
+    certauth_vcache_lock = NULL;
+    memset(&certauth_vcache_once, 0, sizeof(certauth_vcache_once));
+}
+
+static struct gensio_class_cleanup certauth_vcache_cleanup_data = {
+    certauth_vcache_cleanup
+};
+
+static void
+certauth_vcache_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    certauth_vcache_o = o;
+    certauth_vcache_lock = o->alloc_lock(o);
+    if (certauth_vcache_lock)
+	gensio_register_class_cleanup(&certauth_vcache_cleanup_data);
+}
+
+static bool
+certauth_vcache_key(struct certauth_filter *sfilter, unsigned char *md,
+		    unsigned int *mdlen, time_t *mtime, time_t *ctime)
+{
+    struct stat st;
+
+    if (X509_digest(sfilter->cert, EVP_sha256(), md, mdlen) == 0)
+	return false;
+    *mtime = 0;
+    *ctime = 0;
+    if (sfilter->verify_ca) {
+	/* A directory's times change when files are added or removed. */
+	if (stat(sfilter->verify_ca, &st) != 0)
+	    return false;
+	*mtime = st.st_mtime;
+	*ctime = st.st_ctime;
+    }
+    return true;
+}
+
+static bool
+certauth_vcache_match(struct certauth_vcache_ent *e,
+		      struct certauth_filter *sfilter, const unsigned char *md, unsigned int mdlen,
+		      time_t mtime, time_t ctime)
+{
+    if (e->mdlen != mdlen || memcmp(e->md, md, mdlen) != 0)
+	return false;
+    if (!e->ca || !sfilter->verify_ca)
+	return e->ca == sfilter->verify_ca;
+    return (strcmp(e->ca, sfilter->verify_ca) == 0 &&
+	    e->ca_mtime == mtime && e->ca_ctime == ctime);
+}
+
+/*
+ * Look the certificate up in the cache, or add it if add is set.
+ * Returns true if it was found.  Call with the filter lock held.
+ */
+static bool
+certauth_vcache_check(struct certauth_filter *sfilter, bool add)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    struct certauth_vcache_ent *e, **pe;
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    time_t mtime, ctime;
+    gensio_time now;
+    bool found = false;
+
+    if (!sfilter->verify_cache)
+	return false;
+    o->call_once(o, &certauth_vcache_once, certauth_vcache_init, o);
+    if (!certauth_vcache_lock)
+	return false;
+    if (!certauth_vcache_key(sfilter, md, &mdlen, &mtime, &ctime))
+	return false;
+    o->get_monotonic_time(o, &now);
+
+    o->lock(certauth_vcache_lock);
+    for (pe = &certauth_vcache; *pe; ) {
+	e = *pe;
+	if (gensio_time_diff_nsecs(&e->expire, &now) <= 0) {
+	    *pe = e->next;
+	    certauth_vcache_ent_free(e);
+	    certauth_vcache_len--;
+	    continue;
+	}
+	if (certauth_vcache_match(e, sfilter, md, mdlen, mtime, ctime)) {
+	    /* Move it to the front. */
+	    *pe = e->next;
+	    e->next = certauth_vcache;
+	    certauth_vcache = e;
+	    found = true;
+	    break;
+	}
+	pe = &e->next;
+    }
+
+    if (found) {
+	/* The cache entry may outlive the certificate. */
+	if (X509_cmp_current_time(X509_get0_notAfter(sfilter->cert)) <= 0)
+	    found = false;
+	goto out_unlock;
+    }
+    if (!add)
+	goto out_unlock;
+
+    while (certauth_vcache_len >= sfilter->verify_cache) {
+	/* Drop the least recently used. */
+	for (pe = &certauth_vcache; (*pe)->next; pe = &(*pe)->next)
+	    ;
+	certauth_vcache_ent_free(*pe);
+	*pe = NULL;
+	certauth_vcache_len--;
+    }
+    e = certauth_vcache_o->zalloc(certauth_vcache_o, sizeof(*e));
+    if (!e)
+	goto out_unlock;
+    if (sfilter->verify_ca) {
+	e->ca = gensio_strdup(certauth_vcache_o, sfilter->verify_ca);
+	if (!e->ca) {
+	    certauth_vcache_ent_free(e);
+	    goto out_unlock;
+	}
+    }
+    memcpy(e->md, md, mdlen);
+    e->mdlen = mdlen;
+    e->ca_mtime = mtime;
+    e->ca_ctime = ctime;
+    e->expire = now;
+    gensio_time_add_nsecs(&e->expire, sfilter->verify_cache_time);
+    e->next = certauth_vcache;
+    certauth_vcache = e;
+    certauth_vcache_len++;
+ out_unlock:
+    o->unlock(certauth_vcache_lock);
+    return found;
+}
+
 static int
 certauth_verify_cert(struct certauth_filter *sfilter)
 {
@@ -719,6 +959,11 @@ certauth_verify_cert(struct certauth_filter *sfilter)
     int rv = 0, verify_err;
     const char *auxdata[] = { NULL, NULL };
 
+    if (certauth_vcache_check(sfilter, false)) {
+	verify_err = X509_V_OK;
+	goto report;
+    }
+
     cert_store_ctx = X509_STORE_CTX_new();
     if (!cert_store_ctx) {
 	rv = GE_NOMEM;
@@ -746,8 +991,10 @@ certauth_verify_cert(struct certauth_filter *sfilter)
 	    rv = GE_CERTINVALID;
     } else {
 	verify_err = X509_V_OK;
+	certauth_vcache_check(sfilter, true);
     }
 
+ report:
     certauth_unlock(sfilter);
     if (rv)
 	auxdata[0] = X509_verify_cert_error_string(verify_err);
@@ -799,11 +1046,12 @@ certauth_add_cert(struct certauth_filter *sfilter)
 }
 
 static int
-certauth_get_cert(struct certauth_filter *sfilter)
+certauth_get_cert(struct certauth_filter *sfilter,
+		  unsigned char *buf, gensiods len)
 {
-    sfilter->cert_buf_mem.length = sfilter->read_buf_len;
-    sfilter->cert_buf_mem.data = (char *) sfilter->read_buf;
-    sfilter->cert_buf_mem.max = sfilter->read_buf_len;
+    sfilter->cert_buf_mem.length = len;
+    sfilter->cert_buf_mem.data = (char *) buf;
+    sfilter->cert_buf_mem.max = len;
     BIO_set_mem_buf(sfilter->cert_bio, &sfilter->cert_buf_mem,
 		    BIO_NOCLOSE);
     BIO_set_flags(sfilter->cert_bio, BIO_FLAGS_MEM_RDONLY);
@@ -828,6 +1076,32 @@ certauth_get_cert(struct certauth_filter *sfilter)
     return 0;
 }
 
+/*
+ * Ed25519 and Ed448 keys sign the message directly and cannot be
+ * given a separate digest.  RSA and EC keys use the negotiated one.
+ */
+static bool
+certauth_pkey_is_eddsa(EVP_PKEY *pkey)
+{
+#ifdef EVP_PKEY_ED25519
+    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_ED25519)
+	return true;
+#endif
+#ifdef EVP_PKEY_ED448
+    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_ED448)
+	return true;
+#endif
+    return false;
+}
+
+static const EVP_MD *
+certauth_sig_digest(struct certauth_filter *sfilter, EVP_PKEY *pkey)
+{
+    if (certauth_pkey_is_eddsa(pkey))
+	return NULL;
+    return sfilter->digest;
+}
+
 static int
 v3_certauth_add_challenge_rsp(struct certauth_filter *sfilter)
 {
@@ -835,13 +1109,11 @@ v3_certauth_add_challenge_rsp(struct certauth_filter *sfilter)
     unsigned int lenpos, len;
     int rv = 0;
 
-#ifdef EVP_PKEY_ED25519
-    if (EVP_PKEY_base_id(sfilter->pkey) == EVP_PKEY_ED25519) {
+    if (certauth_pkey_is_eddsa(sfilter->pkey)) {
 	gca_log_err(sfilter,
-		    "Remote end or SSL too old to support ed25519 key");
+		    "Remote end or SSL too old to support ed25519/ed448 key");
 	return GE_KEYINVALID;
     }
-#endif
 
     certauth_write_byte(sfilter, CERTAUTH_CHALLENGE_RSP);
     lenpos = sfilter->write_buf_len;
@@ -886,8 +1158,13 @@ v3_certauth_add_challenge_rsp(struct certauth_filter *sfilter)
     goto out;
 }
 
+/*
+ * Add a version 4 challenge response, the challenge plus the service
+ * signed with the private key.
+ */
 static int
-certauth_add_challenge_rsp(struct certauth_filter *sfilter)
+certauth_add_sig(struct certauth_filter *sfilter,
+		 const unsigned char *challenge, gensiods challenge_size)
 {
     struct gensio_os_funcs *o = sfilter->o;
     EVP_MD_CTX *sign_ctx;
@@ -895,15 +1172,7 @@ certauth_add_challenge_rsp(struct certauth_filter *sfilter)
     int rv = 0;
     unsigned char *to_sign = NULL;
     gensiods to_sign_size;
-    const EVP_MD *digest = sfilter->digest;
-
-    if (sfilter->version < 4 || sfilter->my_version < 4)
-	return v3_certauth_add_challenge_rsp(sfilter);
-
-#ifdef EVP_PKEY_ED25519
-    if (EVP_PKEY_base_id(sfilter->pkey) == EVP_PKEY_ED25519)
-	digest = NULL;
-#endif
+    const EVP_MD *digest = certauth_sig_digest(sfilter, sfilter->pkey);
 
     certauth_write_byte(sfilter, CERTAUTH_CHALLENGE_RSP);
     lenpos = sfilter->write_buf_len;
@@ -915,32 +1184,32 @@ certauth_add_challenge_rsp(struct certauth_filter *sfilter)
 	return GE_NOMEM;
     }
 
-    to_sign_size = sfilter->challenge_data_size + sfilter->service_len;
+    to_sign_size = challenge_size + sfilter->service_len;
     to_sign = o->zalloc(o, to_sign_size);
     if (!to_sign) {
 	gca_logs_err(sfilter, "challeng data allocation failed");
 	goto out_nomem;
     }
-    memcpy(to_sign, sfilter->challenge_data, sfilter->challenge_data_size);
-    memcpy(to_sign + sfilter->challenge_data_size,
-	   sfilter->service, sfilter->service_len);
+    memcpy(to_sign, challenge, challenge_size);
+    memcpy(to_sign + challenge_size, sfilter->service, sfilter->service_len);
 
     if (!EVP_DigestSignInit(sign_ctx, NULL, digest, NULL, sfilter->pkey)) {
 	gca_logs_err(sfilter, "Digest signature init failed");
 	goto out_nomem;
     }
-    if (!EVP_DigestSign(sign_ctx, NULL, &len,
-			to_sign, to_sign_size)) {
-	gca_logs_err(sfilter, "Digest Signature sign failed");
-	goto out_nomem;
-    }
+    /*
+     * EVP_PKEY_size() is an upper bound on the signature size for
+     * every key type, so sign once directly into the buffer.
+     */
+    len = EVP_PKEY_size(sfilter->pkey);
     if (certauth_writeleft(sfilter) < len) {
 	gca_log_err(sfilter, "Signature too large to fit in the data");
-	return GE_TOOBIG;
+	rv = GE_TOOBIG;
+	goto out;
     }
     if (!EVP_DigestSign(sign_ctx, certauth_writepos(sfilter), &len,
 			to_sign, to_sign_size)) {
-	gca_logs_err(sfilter, "Digest Signature sign(2) failed");
+	gca_logs_err(sfilter, "Digest Signature sign failed");
 	goto out_nomem;
     }
     sfilter->write_buf_len += len;
@@ -957,6 +1226,16 @@ certauth_add_challenge_rsp(struct certauth_filter *sfilter)
     goto out;
 }
 
+static int
+certauth_add_challenge_rsp(struct certauth_filter *sfilter)
+{
+    if (sfilter->version < 4 || sfilter->my_version < 4)
+	return v3_certauth_add_challenge_rsp(sfilter);
+
+    return certauth_add_sig(sfilter, sfilter->challenge_data,
+			    sfilter->challenge_data_size);
+}
+
 static int
 v3_certauth_check_challenge(struct certauth_filter *sfilter)
 {
@@ -1013,8 +1292,14 @@ v3_certauth_check_challenge(struct certauth_filter *sfilter)
     goto out;
 }
 
+/*
+ * Check a version 4 challenge response against the certificate and
+ * set response_result.
+ */
 static int
-certauth_check_challenge(struct certauth_filter *sfilter)
+certauth_check_sig(struct certauth_filter *sfilter,
+		   const unsigned char *challenge, gensiods challenge_size,
+		   const unsigned char *sig, gensiods sig_len)
 {
     struct gensio_os_funcs *o = sfilter->o;
     EVP_MD_CTX *sign_ctx;
@@ -1022,10 +1307,7 @@ certauth_check_challenge(struct certauth_filter *sfilter)
     EVP_PKEY *pkey = NULL;
     unsigned char *to_sign = NULL;
     gensiods to_sign_size;
-    const EVP_MD *digest = sfilter->digest;
-
-    if (sfilter->version < 4 || sfilter->my_version < 4)
-	return v3_certauth_check_challenge(sfilter);
+    const EVP_MD *digest;
 
     sign_ctx = EVP_MD_CTX_new();
     if (!sign_ctx) {
@@ -1033,15 +1315,14 @@ certauth_check_challenge(struct certauth_filter *sfilter)
 	return GE_NOMEM;
     }
 
-    to_sign_size = sfilter->challenge_data_size + sfilter->service_len;
+    to_sign_size = challenge_size + sfilter->service_len;
     to_sign = o->zalloc(o, to_sign_size);
     if (!to_sign) {
 	gca_logs_err(sfilter, "challeng data allocation failed");
 	goto out_nomem;
     }
-    memcpy(to_sign, sfilter->challenge_data, sfilter->challenge_data_size);
-    memcpy(to_sign + sfilter->challenge_data_size,
-	   sfilter->service, sfilter->service_len);
+    memcpy(to_sign, challenge, challenge_size);
+    memcpy(to_sign + challenge_size, sfilter->service, sfilter->service_len);
 
     pkey = X509_get_pubkey(sfilter->cert);
     if (!pkey) {
@@ -1049,17 +1330,13 @@ certauth_check_challenge(struct certauth_filter *sfilter)
 	goto out_nomem;
     }
 
-#ifdef EVP_PKEY_ED25519
-    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_ED25519)
-	digest = NULL;
-#endif
+    digest = certauth_sig_digest(sfilter, pkey);
 
     if (!EVP_DigestVerifyInit(sign_ctx, NULL, digest, NULL, pkey)) {
 	gca_logs_err(sfilter, "Digest verify init failed");
 	goto out_nomem;
     }
-    rv = EVP_DigestVerify(sign_ctx, sfilter->read_buf, sfilter->read_buf_len,
-			  to_sign, to_sign_size);
+    rv = EVP_DigestVerify(sign_ctx, sig, sig_len, to_sign, to_sign_size);
     if (rv != 0 && rv != 1) {
 	gca_logs_err(sfilter, "Verify final failed");
 	goto out_nomem;
@@ -1087,6 +1364,17 @@ certauth_check_challenge(struct certauth_filter *sfilter)
     goto out;
 }
 
+static int
+certauth_check_challenge(struct certauth_filter *sfilter)
+{
+    if (sfilter->version < 4 || sfilter->my_version < 4)
+	return v3_certauth_check_challenge(sfilter);
+
+    return certauth_check_sig(sfilter, sfilter->challenge_data,
+			      sfilter->challenge_data_size,
+			      sfilter->read_buf, sfilter->read_buf_len);
+}
+
 static void
 certauth_add_dummy(struct certauth_filter *sfilter, unsigned int len)
 {
@@ -1115,6 +1403,10 @@ certauth_send_server_done(struct certauth_filter *sfilter)
     certauth_write_byte(sfilter, CERTAUTH_END);
 }
 
+/*
+ * Pick the digest for RSA and EC signatures.  EdDSA keys ignore this,
+ * see certauth_sig_digest().
+ */
 static void
 set_digest(struct certauth_filter *sfilter)
 {
@@ -1124,6 +1416,175 @@ set_digest(struct certauth_filter *sfilter)
 	sfilter->digest = sfilter->rsa_md5;
 }
 
+/*
+ * Get the keying material for fast authentication from the TLS layer
+ * below.  Returns false if there is no TLS layer that can do it.
+ */
+static bool
+certauth_get_fast_challenge(struct certauth_filter *sfilter,
+			    unsigned char *buf)
+{
+    struct gensio *io = gensio_filter_get_gensio(sfilter->filter);
+    struct gensio *child;
+    gensiods len = GENSIO_CERTAUTH_CHALLENGE_SIZE;
+
+    if (!io)
+	return false;
+    child = gensio_get_child(io, 1);
+    if (!child)
+	return false;
+    strcpy((char *) buf, GENSIO_CERTAUTH_FAST_LABEL);
+    if (gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_EXPORT_KEYING, (char *) buf, &len))
+	return false;
+    return len == GENSIO_CERTAUTH_CHALLENGE_SIZE;
+}
+
+/*
+ * Add the OPTIONS element for fast authentication to the client hello.
+ * If it can't be done for some reason, just leave it out, the normal
+ * exchange will be done.
+ */
+static void
+certauth_add_fast_auth(struct certauth_filter *sfilter)
+{
+    unsigned char challenge[GENSIO_CERTAUTH_CHALLENGE_SIZE];
+    gensiods start = sfilter->write_buf_len, lenpos;
+    int err;
+
+    if (!sfilter->cert || !sfilter->pkey || sfilter->my_version < 5)
+	return;
+    if (!certauth_get_fast_challenge(sfilter, challenge)) {
+	gca_log_info(sfilter, "No TLS keying material, not using fast-auth");
+	return;
+    }
+
+    certauth_write_byte(sfilter, CERTAUTH_OPTIONS);
+    lenpos = sfilter->write_buf_len;
+    sfilter->write_buf_len += 2;
+    /* The server version isn't known yet, use the version 5 digest. */
+    sfilter->digest = sfilter->sha3_512;
+    err = certauth_add_cert(sfilter);
+    if (!err)
+	err = certauth_add_sig(sfilter, challenge, sizeof(challenge));
+    memset(challenge, 0, sizeof(challenge));
+    if (err) {
+	gca_log_info(sfilter, "Unable to add fast-auth data: %s",
+		     gensio_err_to_str(err));
+	sfilter->write_buf_len = start;
+	return;
+    }
+    certauth_u16_to_buf(sfilter->write_buf + lenpos,
+			sfilter->write_buf_len - lenpos - 2);
+}
+
+/*
+ * Pull the certificate and challenge response out of the OPTIONS
+ * element from the client.  If they are not there or the data is bad,
+ * this just leaves them unset and the normal exchange will be done.
+ */
+static int
+certauth_get_fast_auth(struct certauth_filter *sfilter)
+{
+    unsigned char challenge[GENSIO_CERTAUTH_CHALLENGE_SIZE];
+    unsigned char *buf = sfilter->fast_data;
+    gensiods left = sfilter->fast_data_len, len;
+    unsigned int elem;
+    int err = 0;
+
+    if (!certauth_get_fast_challenge(sfilter, challenge))
+	return 0;
+
+    while (!err && left >= 3) {
+	elem = buf[0];
+	len = certauth_buf_to_u16(buf + 1);
+	buf += 3;
+	left -= 3;
+	if (len > left)
+	    break;
+	if (elem == CERTAUTH_CERTIFICATE && !sfilter->cert)
+	    err = certauth_get_cert(sfilter, buf, len);
+	else if (elem == CERTAUTH_CHALLENGE_RSP && sfilter->cert &&
+		 !sfilter->response_result)
+	    err = certauth_check_sig(sfilter, challenge, sizeof(challenge),
+				     buf, len);
+	buf += len;
+	left -= len;
+    }
+    memset(challenge, 0, sizeof(challenge));
+    return err;
+}
+
+/* Forget the fast authentication data when falling back. */
+static void
+certauth_fast_auth_reset(struct certauth_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+
+    if (sfilter->sk_ca)
+	sk_X509_pop_free(sfilter->sk_ca, X509_free);
+    sfilter->sk_ca = NULL;
+    if (sfilter->cert)
+	X509_free(sfilter->cert);
+    sfilter->cert = NULL;
+    sfilter->response_result = 0;
+    sfilter->verified = false;
+    o->free(o, sfilter->fast_data);
+    sfilter->fast_data = NULL;
+    sfilter->fast_data_len = 0;
+}
+
+/*
+ * Verify the certificate and challenge response from the client,
+ * setting result if it passes.  Returns an error if the connection
+ * should be failed.
+ */
+static int
+certauth_check_cert_rsp(struct certauth_filter *sfilter)
+{
+    int err;
+
+    if (!!sfilter->cert != !!sfilter->response_result) {
+	gca_log_err(sfilter, "Remote end did not send cert and response");
+	return GE_PROTOERR;
+    }
+
+    if (!sfilter->result) {
+	certauth_unlock(sfilter);
+	err = gensio_filter_do_event(sfilter->filter,
+				     GENSIO_EVENT_PRECERT_VERIFY, 0,
+				     NULL, NULL, NULL);
+	certauth_lock(sfilter);
+	if (!err) {
+	    sfilter->result = CERTAUTH_RESULT_SUCCESS;
+	} else if (err == GE_AUTHREJECT) {
+	    gca_log_err(sfilter, "precert verify rejected connection");
+	    sfilter->result = CERTAUTH_RESULT_ERR;
+	} else if (err != GE_NOTSUP) {
+	    gca_log_err(sfilter, "Error from application at precert: %s",
+			gensio_err_to_str(err));
+	    return err;
+	}
+    }
+    err = certauth_verify_cert(sfilter);
+    if (!sfilter->result) {
+	if (err == GE_AUTHREJECT) {
+	    gca_log_err(sfilter, "precert verify rejected connection");
+	    sfilter->result = CERTAUTH_RESULT_ERR;
+	} else if (err && err != GE_NOTSUP) {
+	    gca_log_err(sfilter, "Error from application at precert: %s",
+			gensio_err_to_str(err));
+	    return err;
+	}
+
+	if (sfilter->verified &&
+		    sfilter->response_result == CERTAUTH_RESULT_SUCCESS) {
+	    sfilter->result = CERTAUTH_RESULT_SUCCESS;
+	}
+    }
+    return 0;
+}
+
 static int
 certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 {
@@ -1157,6 +1618,8 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	    certauth_write_u16(sfilter, sfilter->service_len);
 	    certauth_write(sfilter, sfilter->service, sfilter->service_len);
 	}
+	if (sfilter->fast_auth)
+	    certauth_add_fast_auth(sfilter);
 
 	certauth_write_byte(sfilter, CERTAUTH_END);
 
@@ -1219,6 +1682,23 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	    goto finish_result;
 	}
 
+	if (sfilter->fast_data) {
+	    if (sfilter->version >= 5 && sfilter->my_version >= 5 &&
+			sfilter->result != CERTAUTH_RESULT_SUCCESS) {
+		err = certauth_get_fast_auth(sfilter);
+		if (!err && sfilter->cert && sfilter->response_result)
+		    err = certauth_check_cert_rsp(sfilter);
+		if (err) {
+		    sfilter->pending_err = err;
+		    goto finish_result;
+		}
+	    }
+	    /* 2-factor data has to be asked for, so that can't be fast. */
+	    if (sfilter->result && !sfilter->do_2fa)
+		goto finish_result;
+	    certauth_fast_auth_reset(sfilter);
+	}
+
 	sfilter->write_buf_len = 0;
 	certauth_write_byte(sfilter, CERTAUTH_SERVERHELLO);
 	certauth_write_byte(sfilter, CERTAUTH_VERSION);
@@ -1306,47 +1786,9 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	    goto try_password;
 	}
 
-	if (!!sfilter->cert != !!sfilter->response_result) {
-	    gca_log_err(sfilter, "Remote end did not send cert and response");
-	    sfilter->pending_err = GE_PROTOERR;
+	sfilter->pending_err = certauth_check_cert_rsp(sfilter);
+	if (sfilter->pending_err)
 	    goto finish_result;
-	}
-
-	if (!sfilter->result) {
-	    certauth_unlock(sfilter);
-	    err = gensio_filter_do_event(sfilter->filter,
-					 GENSIO_EVENT_PRECERT_VERIFY, 0,
-					 NULL, NULL, NULL);
-	    certauth_lock(sfilter);
-	    if (!err) {
-		sfilter->result = CERTAUTH_RESULT_SUCCESS;
-	    } else if (err == GE_AUTHREJECT) {
-		gca_log_err(sfilter, "precert verify rejected connection");
-		sfilter->result = CERTAUTH_RESULT_ERR;
-	    } else if (err != GE_NOTSUP) {
-		gca_log_err(sfilter, "Error from application at precert: %s",
-			    gensio_err_to_str(err));
-		sfilter->pending_err = err;
-		goto finish_result;
-	    }
-	}
-	err = certauth_verify_cert(sfilter);
-	if (!sfilter->result) {
-	    if (err == GE_AUTHREJECT) {
-		gca_log_err(sfilter, "precert verify rejected connection");
-		sfilter->result = CERTAUTH_RESULT_ERR;
-	    } else if (err && err != GE_NOTSUP) {
-		gca_log_err(sfilter, "Error from application at precert: %s",
-			    gensio_err_to_str(err));
-		sfilter->pending_err = err;
-		goto finish_result;
-	    }
-
-	    if (sfilter->verified &&
-			sfilter->response_result == CERTAUTH_RESULT_SUCCESS) {
-		sfilter->result = CERTAUTH_RESULT_SUCCESS;
-	    }
-	}
 
 	/*
 	 * We may mark it as authenticated, but go through the
@@ -1814,6 +2256,23 @@ certauth_handle_new_element(struct certauth_filter *sfilter)
 	break;
 
     case CERTAUTH_OPTIONS:
+	if (sfilter->is_client || !sfilter->fast_auth ||
+		sfilter->state != CERTAUTH_CLIENTHELLO)
+	    break;
+	if (sfilter->fast_data) {
+	    gca_log_err(sfilter, "Options received when already set");
+	    sfilter->pending_err = GE_PROTOERR;
+	    break;
+	}
+	sfilter->fast_data = o->zalloc(o, sfilter->curr_elem_len);
+	if (!sfilter->fast_data) {
+	    gca_log_err(sfilter, "Unable to allocate memory for options");
+	    sfilter->pending_err = GE_NOMEM;
+	} else {
+	    memcpy(sfilter->fast_data, sfilter->read_buf,
+		   sfilter->curr_elem_len);
+	    sfilter->fast_data_len = sfilter->curr_elem_len;
+	}
 	break;
 
     case CERTAUTH_CHALLENGE_DATA:
@@ -1849,7 +2308,8 @@ certauth_handle_new_element(struct certauth_filter *sfilter)
 	    sfilter->pending_err = GE_PROTOERR;
 	    break;
 	}
-	sfilter->pending_err = certauth_get_cert(sfilter);
+	sfilter->pending_err = certauth_get_cert(sfilter, sfilter->read_buf,
+					       sfilter->read_buf_len);
 	break;
 
     case CERTAUTH_RESULT:
@@ -1951,6 +2411,7 @@ certauth_ll_write(struct gensio_filter *filter,
 	if (sfilter->curr_elem == CERTAUTH_END) {
 	    sfilter->curr_msg_type = 0;
 	    sfilter->got_msg = true;
+	    sfilter->round_trips++;
 	    goto out_unlock;
 	}
 	if (sfilter->curr_elem > CERTAUTH_MAX_ELEMENT ||
@@ -2121,6 +2582,10 @@ sfilter_free(struct certauth_filter *sfilter)
 	gensio_filter_free_data(sfilter->filter);
     if (sfilter->verify_store)
 	X509_STORE_free(sfilter->verify_store);
+    if (sfilter->verify_ca)
+	o->free(o, sfilter->verify_ca);
+    if (sfilter->fast_data)
+	o->free(o, sfilter->fast_data);
     o->free(o, sfilter);
 }
 
@@ -2138,6 +2603,7 @@ certauth_filter_control(struct gensio_filter *filter, bool get, int op,
 {
     struct certauth_filter *sfilter = filter_to_certauth(filter);
     X509_STORE *store;
+    char *new_ca;
     char *CApath = NULL, *CAfile = NULL;
     int rv = 0;
 
@@ -2359,10 +2825,19 @@ certauth_filter_control(struct gensio_filter *filter, bool get, int op,
 	    return GE_CERTNOTFOUND;
 	}
 
+	new_ca = gensio_strdup(sfilter->o, data);
+	if (!new_ca) {
+	    X509_STORE_free(store);
+	    return GE_NOMEM;
+	}
+
 	certauth_lock(sfilter);
 	if (sfilter->verify_store)
 	    X509_STORE_free(sfilter->verify_store);
 	sfilter->verify_store = store;
+	if (sfilter->verify_ca)
+	    sfilter->o->free(sfilter->o, sfilter->verify_ca);
+	sfilter->verify_ca = new_ca;
 	certauth_unlock(sfilter);
 	return 0;
 
@@ -2373,6 +2848,14 @@ certauth_filter_control(struct gensio_filter *filter, bool get, int op,
 	    return GE_NOTFOUND;
 	return gensio_cert_fingerprint(sfilter->cert, data, datalen);
 
+    case GENSIO_CONTROL_ROUND_TRIPS:
+	if (!get)
+	    return GE_NOTSUP;
+	certauth_lock(sfilter);
+	*datalen = snprintf(data, *datalen, "%u", sfilter->round_trips);
+	certauth_unlock(sfilter);
+	return 0;
+
     default:
 	return GE_NOTSUP;
     }
@@ -2446,6 +2929,9 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
 				 const char *service,
 				 bool allow_authfail, bool use_child_auth,
 				 bool enable_password, bool do_2fa,
+				 bool fast_auth, const char *CAfilepath,
+				 unsigned int verify_cache,
+				 int64_t verify_cache_time,
 				 struct gensio_filter **rfilter)
 {
     struct certauth_filter *sfilter;
@@ -2461,6 +2947,7 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->use_child_auth = use_child_auth;
     sfilter->enable_password = enable_password;
     sfilter->do_2fa = do_2fa;
+    sfilter->fast_auth = fast_auth;
     sfilter->my_version = GENSIO_CERTAUTH_VERSION;
     sfilter->rsa_md5 = EVP_get_digestbyname("ssl3-md5");
     if (!sfilter->rsa_md5) {
@@ -2524,6 +3011,14 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
 	sfilter->service_len = strlen(service);
     }
 
+    if (CAfilepath && CAfilepath[0]) {
+	sfilter->verify_ca = gensio_strdup(o, CAfilepath);
+	if (!sfilter->verify_ca)
+	    goto out_nomem;
+    }
+    sfilter->verify_cache = verify_cache;
+    sfilter->verify_cache_time = verify_cache_time;
+
     if (is_client) {
 	sfilter->state = CERTAUTH_CLIENT_START;
 	sfilter->got_msg = true; /* Go ahead and run the state machine. */
@@ -2631,6 +3126,25 @@ gensio_certauth_filter_config(struct gensio_os_funcs *o,
 	return rv;
     data->enable_password = ival;
 
+    rv = gensio_get_default(o, "certauth", "fast-auth", false,
+			    GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (rv)
+	return rv;
+    data->fast_auth = ival;
+
+    rv = gensio_get_default(o, "certauth", "verify-cache", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->verify_cache = ival;
+
+    rv = gensio_get_default(o, "certauth", "verify-cache-time", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->verify_cache_time.secs = ival;
+    data->verify_cache_time.nsecs = 0;
+
     rv = gensio_get_default(o, "certauth", "mode", false,
 			    GENSIO_DEFAULT_STR, &fstr, NULL);
     if (rv) {
@@ -2713,6 +3227,15 @@ gensio_certauth_filter_config(struct gensio_os_funcs *o,
 	if (gensio_check_keybool(args[i], "enable-2fa",
 				 &data->do_2fa) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "fast-auth",
+				 &data->fast_auth) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "verify-cache",
+				 &data->verify_cache) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "verify-cache-time", 's',
+				 &data->verify_cache_time) > 0)
+	    continue;
 	if (gensio_check_keybool(args[i], "allow-unencrypted",
 				 &data->allow_unencrypted) > 0)
 	    continue;
@@ -2957,6 +3480,12 @@ gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
 					  data->use_child_auth,
 					  data->enable_password,
 					  data->do_2fa,
+					  data->fast_auth,
+					  data->CAfilepath,
+					  data->verify_cache,
+					  (data->verify_cache_time.secs *
+					   GENSIO_NSECS_IN_SEC +
+					   data->verify_cache_time.nsecs),
 					  &filter);
     if (rv)
 	goto err;
@@ -0,0 +1,1134 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A filter that compresses the data going through it.  The data is
+ * sent in blocks, each with a 4 byte header: a type byte and a 24 bit
+ * big endian length of the data after the header.  A data block holds
+ * compressed data that continues the compression stream from the
+ * previous data blocks, so small writes still get the benefit of
+ * what was sent before.  A raw block holds uncompressed data, and
+ * both sides restart the compression stream after it.  Raw blocks
+ * are sent when the data doesn't compress, and for a while after
+ * that, so incompressible data doesn't cost compression time.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_os_funcs.h>
+
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4.h>
+#endif
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "gensio_filter_compress.h"
+
+#define COMPRESS_BLK_DATA	1
+#define COMPRESS_BLK_RAW	2
+
+#define COMPRESS_HDR_SIZE	4
+
+#define COMPRESS_DEFAULT_BLOCKSIZE	16384
+#define COMPRESS_MAX_BLOCKSIZE		65536
+
+/*
+ * Compressed data may come out a bit larger than the input, allow
+ * this much before giving up and sending the block raw.  This keeps
+ * small writes, which always grow a bit, in the compression stream.
+ */
+#define COMPRESS_SLOP			256
+
+/* The biggest block that can be received. */
+#define COMPRESS_MAX_PAYLOAD	(COMPRESS_MAX_BLOCKSIZE + COMPRESS_SLOP)
+
+/* Blocks at least this big are sent raw if they don't get smaller. */
+#define COMPRESS_SKIP_MIN		256
+
+#define COMPRESS_DEFAULT_SKIP		8
+
+#define COMPRESS_MAX_DICT		(1024 * 1024)
+
+/* lz4 only looks back this far. */
+#define COMPRESS_LZ4_HIST		65536
+
+enum compress_mode {
+    COMPRESS_MODE_ZSTD,
+    COMPRESS_MODE_LZ4,
+    COMPRESS_MODE_DEFLATE
+};
+
+static struct gensio_enum_val compress_modes[] = {
+#if HAVE_ZSTD
+    { "zstd", COMPRESS_MODE_ZSTD },
+#endif
+#if HAVE_LZ4
+    { "lz4", COMPRESS_MODE_LZ4 },
+#endif
+#if HAVE_ZLIB
+    { "deflate", COMPRESS_MODE_DEFLATE },
+#endif
+    { NULL }
+};
+
+struct compress_filter;
+
+struct compress_alg {
+    int (*alloc)(struct compress_filter *cfilter);
+    void (*free)(struct compress_filter *cfilter);
+
+    /* Start a new stream, with the dictionary if there is one. */
+    int (*comp_reset)(struct compress_filter *cfilter);
+    int (*decomp_reset)(struct compress_filter *cfilter);
+
+    /*
+     * Compress all of in and flush it to out.  Returns GE_TOOBIG if
+     * it doesn't fit in outsize.
+     */
+    int (*compress)(struct compress_filter *cfilter,
+		    const unsigned char *in, gensiods inlen,
+		    unsigned char *out, gensiods outsize, gensiods *outlen);
+
+    /* Decompress all of in to out.  Returns GE_INVAL if it fails. */
+    int (*decompress)(struct compress_filter *cfilter,
+		      const unsigned char *in, gensiods inlen,
+		      unsigned char *out, gensiods outsize, gensiods *outlen);
+};
+
+struct compress_filter {
+    struct gensio_filter *filter;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    const struct compress_alg *alg;
+    int level;
+    bool level_set;
+
+    unsigned char *dict;
+    gensiods dict_len;
+
+    gensiods blocksize;
+    gensio_time flush_time;
+    unsigned int skip_blocks;
+
+    /* Blocks left to send raw without trying to compress them. */
+    unsigned int skip_left;
+
+    /* Data written by the user that is not yet compressed. */
+    unsigned char *inbuf;
+    gensiods inbuf_len;
+    bool flush_due;
+    bool timer_running;
+
+    /* A block ready to be sent. */
+    unsigned char *outbuf;
+    gensiods outbuf_len;
+    gensiods outbuf_pos;
+
+    /* The block being received. */
+    unsigned char hdr[COMPRESS_HDR_SIZE];
+    gensiods hdr_len;
+    gensiods rdbuf_needed;
+    unsigned char *rdbuf;
+    gensiods rdbuf_len;
+    bool decomp_needs_reset;
+
+    /* Received data not yet delivered to the user. */
+    unsigned char *decbuf;
+    unsigned char *deliver;
+    gensiods deliver_len;
+
+#if HAVE_ZSTD
+    ZSTD_CCtx *zcctx;
+    ZSTD_DCtx *zdctx;
+#endif
+#if HAVE_LZ4
+    LZ4_stream_t *lz4c;
+    char *lz4c_hist;
+    char *lz4d_hist;
+    int lz4d_hist_len;
+#endif
+#if HAVE_ZLIB
+    z_stream defc;
+    z_stream defd;
+    bool defc_inited;
+    bool defd_inited;
+#endif
+};
+
+#define filter_to_compress(v) ((struct compress_filter *) \
+			       gensio_filter_get_user_data(v))
+
+static void
+compress_lock(struct compress_filter *cfilter)
+{
+    cfilter->o->lock(cfilter->lock);
+}
+
+static void
+compress_unlock(struct compress_filter *cfilter)
+{
+    cfilter->o->unlock(cfilter->lock);
+}
+
+#if HAVE_ZSTD
+static int
+zstd_alloc(struct compress_filter *cfilter)
+{
+    cfilter->zcctx = ZSTD_createCCtx();
+    if (!cfilter->zcctx)
+	return GE_NOMEM;
+    cfilter->zdctx = ZSTD_createDCtx();
+    if (!cfilter->zdctx)
+	return GE_NOMEM;
+    if (cfilter->level_set &&
+		ZSTD_isError(ZSTD_CCtx_setParameter(cfilter->zcctx,
+						    ZSTD_c_compressionLevel,
+						    cfilter->level)))
+	return GE_INVAL;
+    if (cfilter->dict) {
+	if (ZSTD_isError(ZSTD_CCtx_loadDictionary(cfilter->zcctx,
+						  cfilter->dict,
+						  cfilter->dict_len)))
+	    return GE_INVAL;
+	if (ZSTD_isError(ZSTD_DCtx_loadDictionary(cfilter->zdctx,
+						  cfilter->dict,
+						  cfilter->dict_len)))
+	    return GE_INVAL;
+    }
+    return 0;
+}
+
+static void
+zstd_free(struct compress_filter *cfilter)
+{
+    if (cfilter->zcctx)
+	ZSTD_freeCCtx(cfilter->zcctx);
+    if (cfilter->zdctx)
+	ZSTD_freeDCtx(cfilter->zdctx);
+}
+
+/* Session resets keep the parameters and the dictionary. */
+static int
+zstd_comp_reset(struct compress_filter *cfilter)
+{
+    ZSTD_CCtx_reset(cfilter->zcctx, ZSTD_reset_session_only);
+    return 0;
+}
+
+static int
+zstd_decomp_reset(struct compress_filter *cfilter)
+{
+    ZSTD_DCtx_reset(cfilter->zdctx, ZSTD_reset_session_only);
+    return 0;
+}
+
+static int
+zstd_compress(struct compress_filter *cfilter,
+	      const unsigned char *in, gensiods inlen,
+	      unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    ZSTD_inBuffer ib = { in, inlen, 0 };
+    ZSTD_outBuffer ob = { out, outsize, 0 };
+    size_t rv;
+
+    do {
+	rv = ZSTD_compressStream2(cfilter->zcctx, &ob, &ib, ZSTD_e_flush);
+	if (ZSTD_isError(rv))
+	    return GE_INVAL;
+	if (rv > 0 && ob.pos == ob.size)
+	    return GE_TOOBIG;
+    } while (rv > 0);
+    *outlen = ob.pos;
+    return 0;
+}
+
+static int
+zstd_decompress(struct compress_filter *cfilter,
+		const unsigned char *in, gensiods inlen,
+		unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    ZSTD_inBuffer ib = { in, inlen, 0 };
+    ZSTD_outBuffer ob = { out, outsize, 0 };
+    size_t rv;
+
+    /*
+     * The data was flushed, so everything comes out once the input
+     * is used up and there is still output room.
+     */
+    do {
+	rv = ZSTD_decompressStream(cfilter->zdctx, &ob, &ib);
+	if (ZSTD_isError(rv))
+	    return GE_INVAL;
+	if (ob.pos == ob.size)
+	    return GE_INVAL;
+    } while (ib.pos < ib.size);
+    *outlen = ob.pos;
+    return 0;
+}
+
+static const struct compress_alg zstd_alg = {
+    .alloc = zstd_alloc,
+    .free = zstd_free,
+    .comp_reset = zstd_comp_reset,
+    .decomp_reset = zstd_decomp_reset,
+    .compress = zstd_compress,
+    .decompress = zstd_decompress
+};
+#endif
+
+#if HAVE_LZ4
+/*
+ * lz4 streams need the previous data to still be there, so both sides
+ * keep a copy of the last 64K in a history buffer.  The level is the
+ * lz4 acceleration, bigger is faster and compresses less.
+ */
+static int
+lz4_alloc(struct compress_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+
+    if (!cfilter->level_set || cfilter->level < 1)
+	cfilter->level = 1;
+    cfilter->lz4c = LZ4_createStream();
+    if (!cfilter->lz4c)
+	return GE_NOMEM;
+    cfilter->lz4c_hist = o->zalloc(o, COMPRESS_LZ4_HIST);
+    if (!cfilter->lz4c_hist)
+	return GE_NOMEM;
+    cfilter->lz4d_hist = o->zalloc(o, COMPRESS_LZ4_HIST);
+    if (!cfilter->lz4d_hist)
+	return GE_NOMEM;
+    return 0;
+}
+
+static void
+lz4_free(struct compress_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+
+    if (cfilter->lz4c)
+	LZ4_freeStream(cfilter->lz4c);
+    if (cfilter->lz4c_hist)
+	o->free(o, cfilter->lz4c_hist);
+    if (cfilter->lz4d_hist)
+	o->free(o, cfilter->lz4d_hist);
+}
+
+static int
+lz4_comp_reset(struct compress_filter *cfilter)
+{
+    LZ4_resetStream_fast(cfilter->lz4c);
+    if (cfilter->dict)
+	LZ4_loadDict(cfilter->lz4c, (char *) cfilter->dict,
+		     cfilter->dict_len);
+    return 0;
+}
+
+static int
+lz4_decomp_reset(struct compress_filter *cfilter)
+{
+    gensiods len = cfilter->dict_len;
+
+    if (len > COMPRESS_LZ4_HIST)
+	len = COMPRESS_LZ4_HIST;
+    if (len)
+	memcpy(cfilter->lz4d_hist, cfilter->dict + cfilter->dict_len - len,
+	       len);
+    cfilter->lz4d_hist_len = len;
+    return 0;
+}
+
+static int
+lz4_compress(struct compress_filter *cfilter,
+	     const unsigned char *in, gensiods inlen,
+	     unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    int rv;
+
+    rv = LZ4_compress_fast_continue(cfilter->lz4c, (const char *) in,
+				    (char *) out, inlen, outsize,
+				    cfilter->level);
+    if (rv <= 0)
+	return GE_TOOBIG;
+    /* in gets overwritten, save what the next block refers to. */
+    LZ4_saveDict(cfilter->lz4c, cfilter->lz4c_hist, COMPRESS_LZ4_HIST);
+    *outlen = rv;
+    return 0;
+}
+
+static int
+lz4_decompress(struct compress_filter *cfilter,
+	       const unsigned char *in, gensiods inlen,
+	       unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    char *hist = cfilter->lz4d_hist;
+    int rv, keep;
+
+    rv = LZ4_decompress_safe_usingDict((const char *) in, (char *) out,
+				       inlen, outsize,
+				       hist, cfilter->lz4d_hist_len);
+    if (rv < 0)
+	return GE_INVAL;
+
+    if (rv >= COMPRESS_LZ4_HIST) {
+	memcpy(hist, out + rv - COMPRESS_LZ4_HIST, COMPRESS_LZ4_HIST);
+	cfilter->lz4d_hist_len = COMPRESS_LZ4_HIST;
+    } else {
+	keep = cfilter->lz4d_hist_len;
+	if (keep > COMPRESS_LZ4_HIST - rv)
+	    keep = COMPRESS_LZ4_HIST - rv;
+	memmove(hist, hist + cfilter->lz4d_hist_len - keep, keep);
+	memcpy(hist + keep, out, rv);
+	cfilter->lz4d_hist_len = keep + rv;
+    }
+    *outlen = rv;
+    return 0;
+}
+
+static const struct compress_alg lz4_alg = {
+    .alloc = lz4_alloc,
+    .free = lz4_free,
+    .comp_reset = lz4_comp_reset,
+    .decomp_reset = lz4_decomp_reset,
+    .compress = lz4_compress,
+    .decompress = lz4_decompress
+};
+#endif
+
+#if HAVE_ZLIB
+/* Raw deflate, the block header does the framing. */
+static int
+deflate_alloc(struct compress_filter *cfilter)
+{
+    int level = Z_DEFAULT_COMPRESSION;
+
+    if (cfilter->level_set)
+	level = cfilter->level;
+    if (deflateInit2(&cfilter->defc, level, Z_DEFLATED, -15, 8,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	return GE_INVAL;
+    cfilter->defc_inited = true;
+    if (inflateInit2(&cfilter->defd, -15) != Z_OK)
+	return GE_NOMEM;
+    cfilter->defd_inited = true;
+    return 0;
+}
+
+static void
+deflate_free(struct compress_filter *cfilter)
+{
+    if (cfilter->defc_inited)
+	deflateEnd(&cfilter->defc);
+    if (cfilter->defd_inited)
+	inflateEnd(&cfilter->defd);
+}
+
+static int
+deflate_comp_reset(struct compress_filter *cfilter)
+{
+    deflateReset(&cfilter->defc);
+    if (cfilter->dict)
+	deflateSetDictionary(&cfilter->defc, cfilter->dict, cfilter->dict_len);
+    return 0;
+}
+
+static int
+deflate_decomp_reset(struct compress_filter *cfilter)
+{
+    inflateReset(&cfilter->defd);
+    if (cfilter->dict)
+	inflateSetDictionary(&cfilter->defd, cfilter->dict, cfilter->dict_len);
+    return 0;
+}
+
+static int
+deflate_compress(struct compress_filter *cfilter,
+		 const unsigned char *in, gensiods inlen,
+		 unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    z_stream *s = &cfilter->defc;
+    int rv;
+
+    s->next_in = (unsigned char *) in;
+    s->avail_in = inlen;
+    s->next_out = out;
+    s->avail_out = outsize;
+    rv = deflate(s, Z_SYNC_FLUSH);
+    if (rv != Z_OK && rv != Z_BUF_ERROR)
+	return GE_INVAL;
+    /* All the output is there if deflate didn't fill the buffer. */
+    if (s->avail_out == 0)
+	return GE_TOOBIG;
+    *outlen = outsize - s->avail_out;
+    return 0;
+}
+
+static int
+deflate_decompress(struct compress_filter *cfilter,
+		   const unsigned char *in, gensiods inlen,
+		   unsigned char *out, gensiods outsize, gensiods *outlen)
+{
+    z_stream *s = &cfilter->defd;
+    int rv;
+
+    s->next_in = (unsigned char *) in;
+    s->avail_in = inlen;
+    s->next_out = out;
+    s->avail_out = outsize;
+    rv = inflate(s, Z_SYNC_FLUSH);
+    if (rv != Z_OK && rv != Z_BUF_ERROR)
+	return GE_INVAL;
+    if (s->avail_in > 0 || s->avail_out == 0)
+	return GE_INVAL;
+    *outlen = outsize - s->avail_out;
+    return 0;
+}
+
+static const struct compress_alg deflate_alg = {
+    .alloc = deflate_alloc,
+    .free = deflate_free,
+    .comp_reset = deflate_comp_reset,
+    .decomp_reset = deflate_decomp_reset,
+    .compress = deflate_compress,
+    .decompress = deflate_decompress
+};
+#endif
+
+static void
+compress_set_callbacks(struct compress_filter *cfilter,
+		       gensio_filter_cb cb, void *cb_data)
+{
+    cfilter->filter_cb = cb;
+    cfilter->filter_cb_data = cb_data;
+}
+
+static bool
+compress_ul_read_pending(struct compress_filter *cfilter)
+{
+    return cfilter->deliver_len > 0;
+}
+
+/* Is there a block to send, or the user data ready to make one? */
+static bool
+compress_block_ready(struct compress_filter *cfilter)
+{
+    if (cfilter->outbuf_pos < cfilter->outbuf_len)
+	return true;
+    if (cfilter->inbuf_len == 0)
+	return false;
+    return (cfilter->inbuf_len >= cfilter->blocksize || cfilter->flush_due ||
+	    (cfilter->flush_time.secs == 0 && cfilter->flush_time.nsecs == 0));
+}
+
+static bool
+compress_ll_write_pending(struct compress_filter *cfilter)
+{
+    bool rv;
+
+    compress_lock(cfilter);
+    rv = compress_block_ready(cfilter);
+    compress_unlock(cfilter);
+    return rv;
+}
+
+static int
+compress_ll_write_queued(struct compress_filter *cfilter, bool *rv)
+{
+    compress_lock(cfilter);
+    *rv = (cfilter->outbuf_pos < cfilter->outbuf_len ||
+	   cfilter->inbuf_len > 0);
+    compress_unlock(cfilter);
+    return 0;
+}
+
+static int
+compress_ul_can_write(struct compress_filter *cfilter, bool *rv)
+{
+    compress_lock(cfilter);
+    *rv = cfilter->inbuf_len < cfilter->blocksize;
+    compress_unlock(cfilter);
+    return 0;
+}
+
+static bool
+compress_ll_read_needed(struct compress_filter *cfilter)
+{
+    return false;
+}
+
+static int
+compress_check_open_done(struct compress_filter *cfilter, struct gensio *io)
+{
+    return 0;
+}
+
+static int
+compress_try_connect(struct compress_filter *cfilter, gensio_time *timeout)
+{
+    return 0;
+}
+
+static int
+compress_try_disconnect(struct compress_filter *cfilter, gensio_time *timeout)
+{
+    return 0;
+}
+
+static void
+compress_set_hdr(unsigned char *hdr, unsigned char type, gensiods len)
+{
+    hdr[0] = type;
+    hdr[1] = (len >> 16) & 0xff;
+    hdr[2] = (len >> 8) & 0xff;
+    hdr[3] = len & 0xff;
+}
+
+/* Turn the user data in inbuf into a block in outbuf. */
+static int
+compress_make_block(struct compress_filter *cfilter)
+{
+    unsigned char *out = cfilter->outbuf + COMPRESS_HDR_SIZE;
+    gensiods inlen = cfilter->inbuf_len, outlen = 0;
+    int err;
+
+    if (cfilter->skip_left > 0) {
+	cfilter->skip_left--;
+	goto send_raw;
+    }
+
+    err = cfilter->alg->compress(cfilter, cfilter->inbuf, inlen,
+				 out, inlen + COMPRESS_SLOP, &outlen);
+    if (err && err != GE_TOOBIG)
+	return err;
+    if (!err && (inlen < COMPRESS_SKIP_MIN || outlen < inlen)) {
+	compress_set_hdr(cfilter->outbuf, COMPRESS_BLK_DATA, outlen);
+	goto out;
+    }
+
+    /*
+     * Doesn't compress.  The compressor has already taken the data,
+     * so start over, the other end does the same on a raw block.
+     */
+    cfilter->skip_left = cfilter->skip_blocks;
+    err = cfilter->alg->comp_reset(cfilter);
+    if (err)
+	return err;
+
+ send_raw:
+    memcpy(out, cfilter->inbuf, inlen);
+    outlen = inlen;
+    compress_set_hdr(cfilter->outbuf, COMPRESS_BLK_RAW, outlen);
+
+ out:
+    cfilter->outbuf_len = outlen + COMPRESS_HDR_SIZE;
+    cfilter->outbuf_pos = 0;
+    cfilter->inbuf_len = 0;
+    cfilter->flush_due = false;
+    if (cfilter->timer_running) {
+	cfilter->timer_running = false;
+	cfilter->filter_cb(cfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+    }
+    return 0;
+}
+
+/* Send blocks until there is nothing ready or the lower layer is full. */
+static int
+compress_push(struct compress_filter *cfilter,
+	      gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    struct gensio_sg sg;
+    gensiods count;
+    int err;
+
+    while (compress_block_ready(cfilter)) {
+	if (cfilter->outbuf_pos >= cfilter->outbuf_len) {
+	    err = compress_make_block(cfilter);
+	    if (err)
+		return err;
+	}
+	sg.buf = cfilter->outbuf + cfilter->outbuf_pos;
+	sg.buflen = cfilter->outbuf_len - cfilter->outbuf_pos;
+	count = 0;
+	err = handler(cb_data, &count, &sg, 1, NULL);
+	if (err)
+	    return err;
+	cfilter->outbuf_pos += count;
+	if (count < sg.buflen)
+	    break;
+    }
+    return 0;
+}
+
+static int
+compress_ul_write(struct compress_filter *cfilter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    gensiods i, pos = 0, len, count = 0;
+    int err;
+
+    compress_lock(cfilter);
+    err = compress_push(cfilter, handler, cb_data);
+    if (err)
+	goto out_unlock;
+
+    for (i = 0; i < sglen; ) {
+	len = cfilter->blocksize - cfilter->inbuf_len;
+	if (len == 0) {
+	    /* Only room for more if the full block goes out. */
+	    err = compress_push(cfilter, handler, cb_data);
+	    if (err || cfilter->inbuf_len > 0)
+		break;
+	    continue;
+	}
+	if (len > sg[i].buflen - pos)
+	    len = sg[i].buflen - pos;
+	memcpy(cfilter->inbuf + cfilter->inbuf_len,
+	       ((const unsigned char *) sg[i].buf) + pos, len);
+	cfilter->inbuf_len += len;
+	count += len;
+	pos += len;
+	if (pos >= sg[i].buflen) {
+	    i++;
+	    pos = 0;
+	}
+    }
+
+    if (!err)
+	err = compress_push(cfilter, handler, cb_data);
+
+    if (!err && cfilter->inbuf_len > 0 && !cfilter->timer_running &&
+		!compress_block_ready(cfilter)) {
+	cfilter->timer_running = true;
+	cfilter->filter_cb(cfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_START_TIMER, &cfilter->flush_time);
+    }
+ out_unlock:
+    compress_unlock(cfilter);
+
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+/* Process a full received block and set it up for delivery. */
+static int
+compress_handle_block(struct compress_filter *cfilter)
+{
+    gensiods len = 0;
+    int err;
+
+    if (cfilter->hdr[0] == COMPRESS_BLK_RAW) {
+	cfilter->deliver = cfilter->rdbuf;
+	cfilter->deliver_len = cfilter->rdbuf_len;
+	cfilter->decomp_needs_reset = true;
+	return 0;
+    }
+
+    if (cfilter->decomp_needs_reset) {
+	err = cfilter->alg->decomp_reset(cfilter);
+	if (err)
+	    return err;
+	cfilter->decomp_needs_reset = false;
+    }
+    err = cfilter->alg->decompress(cfilter, cfilter->rdbuf, cfilter->rdbuf_len,
+				   cfilter->decbuf, COMPRESS_MAX_BLOCKSIZE + 1,
+				   &len);
+    if (err)
+	return err;
+    cfilter->deliver = cfilter->decbuf;
+    cfilter->deliver_len = len;
+    return 0;
+}
+
+static int
+compress_deliver(struct compress_filter *cfilter,
+		 gensio_ll_filter_data_handler handler, void *cb_data)
+{
+    gensiods count;
+    int err;
+
+    while (cfilter->deliver_len > 0) {
+	count = 0;
+	compress_unlock(cfilter);
+	err = handler(cb_data, &count, cfilter->deliver, cfilter->deliver_len,
+		      NULL);
+	compress_lock(cfilter);
+	if (err)
+	    return err;
+	if (count == 0)
+	    break;
+	cfilter->deliver += count;
+	cfilter->deliver_len -= count;
+    }
+    return 0;
+}
+
+static int
+compress_ll_write(struct compress_filter *cfilter,
+		  gensio_ll_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    gensiods len, count = 0;
+    int err;
+
+    compress_lock(cfilter);
+    err = compress_deliver(cfilter, handler, cb_data);
+    if (err)
+	goto out_unlock;
+
+    while (buflen > 0 && cfilter->deliver_len == 0) {
+	if (cfilter->hdr_len < COMPRESS_HDR_SIZE) {
+	    len = COMPRESS_HDR_SIZE - cfilter->hdr_len;
+	    if (len > buflen)
+		len = buflen;
+	    memcpy(cfilter->hdr + cfilter->hdr_len, buf, len);
+	    cfilter->hdr_len += len;
+	    buf += len;
+	    buflen -= len;
+	    count += len;
+	    if (cfilter->hdr_len < COMPRESS_HDR_SIZE)
+		break;
+	    if (cfilter->hdr[0] != COMPRESS_BLK_DATA &&
+			cfilter->hdr[0] != COMPRESS_BLK_RAW) {
+		err = GE_INVAL;
+		goto out_unlock;
+	    }
+	    cfilter->rdbuf_needed = ((cfilter->hdr[1] << 16) |
+				     (cfilter->hdr[2] << 8) | cfilter->hdr[3]);
+	    if (cfilter->rdbuf_needed > COMPRESS_MAX_PAYLOAD ||
+			(cfilter->hdr[0] == COMPRESS_BLK_RAW &&
+			 cfilter->rdbuf_needed > COMPRESS_MAX_BLOCKSIZE)) {
+		err = GE_INVAL;
+		goto out_unlock;
+	    }
+	    cfilter->rdbuf_len = 0;
+	}
+
+	len = cfilter->rdbuf_needed - cfilter->rdbuf_len;
+	if (len > buflen)
+	    len = buflen;
+	memcpy(cfilter->rdbuf + cfilter->rdbuf_len, buf, len);
+	cfilter->rdbuf_len += len;
+	buf += len;
+	buflen -= len;
+	count += len;
+	if (cfilter->rdbuf_len < cfilter->rdbuf_needed)
+	    break;
+
+	cfilter->hdr_len = 0;
+	err = compress_handle_block(cfilter);
+	if (!err)
+	    err = compress_deliver(cfilter, handler, cb_data);
+	if (err)
+	    goto out_unlock;
+    }
+
+ out_unlock:
+    compress_unlock(cfilter);
+
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+static int
+compress_setup(struct compress_filter *cfilter)
+{
+    int err;
+
+    cfilter->inbuf_len = 0;
+    cfilter->flush_due = false;
+    cfilter->timer_running = false;
+    cfilter->outbuf_len = 0;
+    cfilter->outbuf_pos = 0;
+    cfilter->hdr_len = 0;
+    cfilter->deliver_len = 0;
+    cfilter->skip_left = 0;
+    cfilter->decomp_needs_reset = false;
+    err = cfilter->alg->comp_reset(cfilter);
+    if (!err)
+	err = cfilter->alg->decomp_reset(cfilter);
+    return err;
+}
+
+static void
+compress_filter_cleanup(struct compress_filter *cfilter)
+{
+    cfilter->inbuf_len = 0;
+    cfilter->outbuf_len = 0;
+    cfilter->outbuf_pos = 0;
+    cfilter->hdr_len = 0;
+    cfilter->deliver_len = 0;
+}
+
+static int
+compress_filter_timeout(struct compress_filter *cfilter)
+{
+    compress_lock(cfilter);
+    cfilter->timer_running = false;
+    if (cfilter->inbuf_len > 0) {
+	cfilter->flush_due = true;
+	cfilter->filter_cb(cfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    }
+    compress_unlock(cfilter);
+    return 0;
+}
+
+static void
+compress_free(struct compress_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+
+    if (cfilter->alg)
+	cfilter->alg->free(cfilter);
+    if (cfilter->dict)
+	o->free(o, cfilter->dict);
+    if (cfilter->inbuf)
+	o->free(o, cfilter->inbuf);
+    if (cfilter->outbuf)
+	o->free(o, cfilter->outbuf);
+    if (cfilter->rdbuf)
+	o->free(o, cfilter->rdbuf);
+    if (cfilter->decbuf)
+	o->free(o, cfilter->decbuf);
+    if (cfilter->lock)
+	o->free_lock(cfilter->lock);
+    if (cfilter->filter)
+	gensio_filter_free_data(cfilter->filter);
+    o->free(o, cfilter);
+}
+
+static int gensio_compress_filter_func(struct gensio_filter *filter, int op,
+				       void *func, void *data,
+				       gensiods *count,
+				       void *buf, const void *cbuf,
+				       gensiods buflen,
+				       const char *const *auxdata)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	compress_set_callbacks(cfilter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return compress_ul_read_pending(cfilter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return compress_ll_write_pending(cfilter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_QUEUED:
+	return compress_ll_write_queued(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_UL_CAN_WRITE:
+	return compress_ul_can_write(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return compress_ll_read_needed(cfilter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return compress_check_open_done(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return compress_try_connect(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return compress_try_disconnect(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return compress_ul_write(cfilter, func, data, count, cbuf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return compress_ll_write(cfilter, func, data, count, buf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return compress_setup(cfilter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	compress_filter_cleanup(cfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	compress_free(cfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	return compress_filter_timeout(cfilter);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+compress_read_dict(struct compress_filter *cfilter, const char *filename)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+    FILE *f;
+    long size;
+    int rv = 0;
+
+    f = fopen(filename, "rb");
+    if (!f)
+	return GE_NOTFOUND;
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+		fseek(f, 0, SEEK_SET) != 0) {
+	rv = GE_IOERR;
+	goto out;
+    }
+    if (size == 0 || size > COMPRESS_MAX_DICT) {
+	rv = GE_INVAL;
+	goto out;
+    }
+    cfilter->dict = o->zalloc(o, size);
+    if (!cfilter->dict) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    if (fread(cfilter->dict, 1, size, f) != (size_t) size) {
+	rv = GE_IOERR;
+	goto out;
+    }
+    cfilter->dict_len = size;
+ out:
+    fclose(f);
+    return rv;
+}
+
+int
+gensio_compress_filter_alloc(struct gensio_os_funcs *o,
+			     const char * const args[],
+			     struct gensio_filter **rfilter)
+{
+    struct compress_filter *cfilter;
+    unsigned int i;
+    int mode, rv = GE_INVAL;
+    const char *dictfile = NULL;
+
+    if (!compress_modes[0].name)
+	return GE_NOTSUP;
+
+    cfilter = o->zalloc(o, sizeof(*cfilter));
+    if (!cfilter)
+	return GE_NOMEM;
+
+    cfilter->o = o;
+    cfilter->blocksize = COMPRESS_DEFAULT_BLOCKSIZE;
+    cfilter->skip_blocks = COMPRESS_DEFAULT_SKIP;
+    mode = compress_modes[0].val;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyenum(args[i], "mode", compress_modes, &mode) > 0)
+	    continue;
+	if (gensio_check_keyint(args[i], "level", &cfilter->level) > 0) {
+	    cfilter->level_set = true;
+	    continue;
+	}
+	if (gensio_check_keyds(args[i], "blocksize", &cfilter->blocksize) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "flush-time", 'm',
+				 &cfilter->flush_time) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "skip", &cfilter->skip_blocks) > 0)
+	    continue;
+	if (gensio_check_keyvalue(args[i], "dict", &dictfile) > 0)
+	    continue;
+	goto out_err;
+    }
+
+    if (cfilter->blocksize < 1 || cfilter->blocksize > COMPRESS_MAX_BLOCKSIZE)
+	goto out_err;
+
+    switch (mode) {
+#if HAVE_ZSTD
+    case COMPRESS_MODE_ZSTD:
+	cfilter->alg = &zstd_alg;
+	break;
+#endif
+#if HAVE_LZ4
+    case COMPRESS_MODE_LZ4:
+	cfilter->alg = &lz4_alg;
+	break;
+#endif
+#if HAVE_ZLIB
+    case COMPRESS_MODE_DEFLATE:
+	cfilter->alg = &deflate_alg;
+	break;
+#endif
+    default:
+	goto out_err;
+    }
+
+    if (dictfile) {
+	rv = compress_read_dict(cfilter, dictfile);
+	if (rv)
+	    goto out_err;
+    }
+
+    rv = GE_NOMEM;
+    cfilter->lock = o->alloc_lock(o);
+    if (!cfilter->lock)
+	goto out_err;
+
+    cfilter->inbuf = o->zalloc(o, cfilter->blocksize);
+    if (!cfilter->inbuf)
+	goto out_err;
+    cfilter->outbuf = o->zalloc(o, (COMPRESS_HDR_SIZE + cfilter->blocksize +
+				    COMPRESS_SLOP));
+    if (!cfilter->outbuf)
+	goto out_err;
+    cfilter->rdbuf = o->zalloc(o, COMPRESS_MAX_PAYLOAD);
+    if (!cfilter->rdbuf)
+	goto out_err;
+    /* One extra so a full buffer means the data was bad. */
+    cfilter->decbuf = o->zalloc(o, COMPRESS_MAX_BLOCKSIZE + 1);
+    if (!cfilter->decbuf)
+	goto out_err;
+
+    rv = cfilter->alg->alloc(cfilter);
+    if (rv)
+	goto out_err;
+
+    rv = GE_NOMEM;
+    cfilter->filter = gensio_filter_alloc_data(o, gensio_compress_filter_func,
+					       cfilter);
+    if (!cfilter->filter)
+	goto out_err;
+
+    *rfilter = cfilter->filter;
+    return 0;
+
+ out_err:
+    compress_free(cfilter);
+    return rv;
+}
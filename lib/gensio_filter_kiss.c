@@ -49,12 +49,12 @@ struct kiss_filter {
     gensiods write_data_len;
 
     gensiods max_write_size; /* Maximum user message size. */
-    gensiods user_write_pos; /* Current user position. */
 
     bool tncs[16];
     uint8_t curr_tnc;
-    unsigned char startdata[320];
-    unsigned char startdata_len;
+    /* Up to 5 parameter frames per TNC, 6 bytes each escaped. */
+    unsigned char startdata[16 * 5 * 6];
+    gensiods startdata_len;
 };
 
 #define filter_to_kiss(v) ((struct kiss_filter *) \
@@ -102,17 +102,65 @@ kiss_check_open_done(struct gensio_filter *filter, struct gensio *io)
     return 0;
 }
 
-static void
-kiss_add_wrbyte(struct kiss_filter *kfilter, unsigned char byte)
+static gensiods
+kiss_escape_byte(unsigned char *out, unsigned char byte)
 {
     if (byte == 0xc0) {
-	kfilter->write_data[kfilter->write_data_len++] = 0xdb;
-	kfilter->write_data[kfilter->write_data_len++] = 0xdc;
+	out[0] = 0xdb;
+	out[1] = 0xdc;
+	return 2;
     } else if (byte == 0xdb) {
-	kfilter->write_data[kfilter->write_data_len++] = 0xdb;
-	kfilter->write_data[kfilter->write_data_len++] = 0xdd;
-    } else {
-	kfilter->write_data[kfilter->write_data_len++] = byte;
+	out[0] = 0xdb;
+	out[1] = 0xdd;
+	return 2;
+    }
+    out[0] = byte;
+    return 1;
+}
+
+static void
+kiss_add_wrbyte(struct kiss_filter *kfilter, unsigned char byte)
+{
+    kfilter->write_data_len +=
+	kiss_escape_byte(kfilter->write_data + kfilter->write_data_len, byte);
+}
+
+/*
+ * Find the first FEND or FESC in buf, or return end.  The previous
+ * results are passed in so each byte is only scanned once per call
+ * sequence.
+ */
+static const unsigned char *
+kiss_next_special(const unsigned char *buf, const unsigned char *end,
+		  const unsigned char **fend, const unsigned char **fesc)
+{
+    if (!*fend || *fend < buf) {
+	*fend = memchr(buf, 0xc0, end - buf);
+	if (!*fend)
+	    *fend = end;
+    }
+    if (!*fesc || *fesc < buf) {
+	*fesc = memchr(buf, 0xdb, end - buf);
+	if (!*fesc)
+	    *fesc = end;
+    }
+    return *fend < *fesc ? *fend : *fesc;
+}
+
+/* Escape user data, copying everything between FENDs/FESCs in one go. */
+static void
+kiss_add_wrdata(struct kiss_filter *kfilter, const unsigned char *buf,
+		gensiods len)
+{
+    const unsigned char *end = buf + len, *fend = NULL, *fesc = NULL, *p;
+
+    while (buf < end) {
+	p = kiss_next_special(buf, end, &fend, &fesc);
+	memcpy(kfilter->write_data + kfilter->write_data_len, buf, p - buf);
+	kfilter->write_data_len += p - buf;
+	if (p < end)
+	    kiss_add_wrbyte(kfilter, *p++);
+	buf = p;
     }
 }
 
@@ -120,7 +168,6 @@ static int
 kiss_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
-    unsigned int i;
 
     if (!kfilter->waiting_setup_timer && kfilter->setupstr_len) {
 	kfilter->setupstr_pos = 0;
@@ -131,9 +178,11 @@ kiss_try_connect(struct gensio_filter *filter, gensio_time *timeout)
     } else {
 	kfilter->waiting_setup_timer = false;
     }
-    for (i = 0; i < kfilter->startdata_len; i++)
-	kiss_add_wrbyte(kfilter, kfilter->startdata[i]);
-    if (i > 0)
+    /* startdata is already framed and escaped. */
+    memcpy(kfilter->write_data + kfilter->write_data_len,
+	   kfilter->startdata, kfilter->startdata_len);
+    kfilter->write_data_len += kfilter->startdata_len;
+    if (kfilter->startdata_len > 0)
 	kfilter->out_msg_ready = true;
     return 0;
 }
@@ -158,6 +207,7 @@ kiss_ul_write(struct gensio_filter *filter,
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
     unsigned int i, tnc = 0;
+    gensiods writelen = 0;
     int rv = 0;
 
     if (auxdata) {
@@ -173,6 +223,11 @@ kiss_ul_write(struct gensio_filter *filter,
 	    }
 	}
     }
+    for (i = 0; i < sglen; i++)
+	writelen += sg[i].buflen;
+    if (writelen > kfilter->max_write_size)
+	return GE_TOOBIG;
+
     kiss_lock(kfilter);
     if (!kfilter->tncs[tnc]) {
 	rv = GE_INVAL;
@@ -190,32 +245,39 @@ kiss_ul_write(struct gensio_filter *filter,
 	    if (rcount)
 		*rcount = 0;
 	}
-    } else if (kfilter->out_msg_ready) {
+    } else if (writelen == 0) {
 	if (rcount)
 	    *rcount = 0;
     } else {
-	gensiods i, j, writelen = 0;
-
-	kfilter->write_data[kfilter->write_data_len++] = 0xc0;
-	kiss_add_wrbyte(kfilter, tnc << 4);
-	for (i = 0; i < sglen; i++) {
-	    gensiods inlen = sg[i].buflen;
-	    const unsigned char *buf = sg[i].buf;
-
-	    for (j = 0; j < inlen; j++) {
-		if (kfilter->user_write_pos >= kfilter->max_write_size)
-		    break;
-		kfilter->user_write_pos++;
-		kiss_add_wrbyte(kfilter, buf[j]);
-	    }
-	    writelen += inlen;
+	/*
+	 * Frames may be added behind ones that are not written yet, so
+	 * several go to the TNC in one burst.  Only do it if the worst
+	 * case encoding (two FENDs, the escaped command byte and every
+	 * data byte escaped) fits.
+	 */
+	gensiods space = writelen * 2 + 4;
+
+	if (kfilter->out_msg_ready &&
+		kfilter->write_data_len + space > kfilter->buf_max_write &&
+		kfilter->write_data_pos > 0) {
+	    kfilter->write_data_len -= kfilter->write_data_pos;
+	    memmove(kfilter->write_data,
+		    kfilter->write_data + kfilter->write_data_pos,
+		    kfilter->write_data_len);
+	    kfilter->write_data_pos = 0;
 	}
-	if (rcount)
-	    *rcount = writelen;
-
-	if (kfilter->user_write_pos > 0) {
-	    kfilter->out_msg_ready = true;
+	if (kfilter->write_data_len + space > kfilter->buf_max_write) {
+	    if (rcount)
+		*rcount = 0;
+	} else {
+	    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
+	    kiss_add_wrbyte(kfilter, tnc << 4);
+	    for (i = 0; i < sglen; i++)
+		kiss_add_wrdata(kfilter, sg[i].buf, sg[i].buflen);
 	    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
+	    kfilter->out_msg_ready = true;
+	    if (rcount)
+		*rcount = writelen;
 	}
     }
 
@@ -237,7 +299,6 @@ kiss_ul_write(struct gensio_filter *filter,
 		kfilter->write_data_len = 0;
 		kfilter->write_data_pos = 0;
 		kfilter->out_msg_ready = false;
-		kfilter->user_write_pos = 0;
 	    } else {
 		kfilter->write_data_pos += count;
 	    }
@@ -265,8 +326,38 @@ kiss_ll_write(struct gensio_filter *filter,
 	    *rcount = 0;
     } else {
 	while (buflen && !kfilter->in_msg_complete) {
-	    unsigned char b = *buf++;
+	    unsigned char b;
+
+	    if (kfilter->in_bad_packet) {
+		/* Ignore input until a frame end. */
+		unsigned char *fend = memchr(buf, 0xc0, buflen);
+
+		if (!fend) {
+		    buflen = 0;
+		    break;
+		}
+		buflen -= fend - buf;
+		buf = fend;
+	    } else if (!kfilter->in_esc && *buf != 0xc0 && *buf != 0xdb) {
+		/* Copy everything up to the next FEND or FESC in one go. */
+		const unsigned char *end = buf + buflen, *p;
+		const unsigned char *fend = NULL, *fesc = NULL;
+		gensiods n;
+
+		p = kiss_next_special(buf, end, &fend, &fesc);
+		n = p - buf;
+		if (n > kfilter->max_read_size - kfilter->read_data_len) {
+		    kfilter->in_bad_packet = true;
+		} else {
+		    memcpy(kfilter->read_data + kfilter->read_data_len, buf, n);
+		    kfilter->read_data_len += n;
+		}
+		buf += n;
+		buflen -= n;
+		continue;
+	    }
 
+	    b = *buf++;
 	    buflen--;
 
 	    if (b == 0xc0) { /* Frame end char */
@@ -363,7 +454,6 @@ kiss_filter_cleanup(struct gensio_filter *filter)
     kfilter->read_data_pos = 0;
     kfilter->write_data_len = 0;
     kfilter->write_data_pos = 0;
-    kfilter->user_write_pos = 0;
     kfilter->in_msg_complete = false;
     kfilter->in_esc = false;
     kfilter->out_msg_ready = false;
@@ -466,7 +556,9 @@ handle_get_ranges(bool vals[16], const char *str)
 		return GE_INVAL;
 	    if (v2 > 15)
 		return GE_INVAL;
-	    for (i = v1; i < v2; i++)
+	    if (v2 < v1)
+		return GE_INVAL;
+	    for (i = v1; i <= v2; i++)
 		vals[i] = true;
 	} else {
 	    vals[v1] = true;
@@ -479,6 +571,21 @@ handle_get_ranges(bool vals[16], const char *str)
     return 0;
 }
 
+/* Add a parameter setting frame to send at startup. */
+static void
+kiss_add_startcmd(struct kiss_filter *kfilter, unsigned int tnc,
+		  unsigned int cmd, unsigned char val)
+{
+    unsigned char *d = kfilter->startdata;
+
+    d[kfilter->startdata_len++] = 0xc0;
+    kfilter->startdata_len += kiss_escape_byte(d + kfilter->startdata_len,
+					       (tnc << 4) | cmd);
+    kfilter->startdata_len += kiss_escape_byte(d + kfilter->startdata_len,
+					       val);
+    d[kfilter->startdata_len++] = 0xc0;
+}
+
 int
 gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 			 bool server, struct gensio_filter **rfilter)
@@ -496,6 +603,7 @@ gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
     unsigned int setup_delay = 1000;
     bool set_hardware_set = false, bval;
     const char *str, *setupstr = NULL;
+    unsigned int packmsgs = 4;
     int rv;
 
     for (i = 0; args && args[i]; i++) {
@@ -536,6 +644,8 @@ gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	    continue;
 	if (gensio_check_keyvalue(args[i], "setupstr", &setupstr) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "packmsgs", &packmsgs) > 0)
+	    continue;
 	if (gensio_check_keyuint(args[i], "setup-delay", &setup_delay) > 0)
 	    continue;
 	if (gensio_check_keybool(args[i], "d710", &bval) > 0) {
@@ -551,7 +661,7 @@ gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	return GE_INVAL;
     }
 
-    if (max_read_size < 256 || max_write_size < 256)
+    if (max_read_size < 256 || max_write_size < 256 || packmsgs < 1)
 	return GE_INVAL;
 
     kfilter = o->zalloc(o, sizeof(*kfilter));
@@ -571,8 +681,12 @@ gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	kfilter->setupstr_len = strlen(setupstr);
     }
 
-    /* Room to double every byte and the begin and end frame markers. */
-    kfilter->buf_max_write = ((max_write_size + 2) * 2) + 2;
+    /*
+     * Room to double every byte and the begin and end frame markers,
+     * for each frame that may be packed into one write.  This is
+     * always big enough for startdata.
+     */
+    kfilter->buf_max_write = (((max_write_size + 2) * 2) + 2) * packmsgs;
 
     kfilter->lock = o->alloc_lock(o);
     if (!kfilter->lock)
@@ -597,28 +711,12 @@ gensio_kiss_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	if (!tncs[i])
 	    continue;
 
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = (i << 4) | 1;
-	kfilter->startdata[kfilter->startdata_len++] = (txdelay + 5) / 10;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = (i << 4) | 2;
-	kfilter->startdata[kfilter->startdata_len++] = persist;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = (i << 4) | 3;
-	kfilter->startdata[kfilter->startdata_len++] = (slot_time + 5) / 10;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	kfilter->startdata[kfilter->startdata_len++] = (i << 4) | 5;
-	kfilter->startdata[kfilter->startdata_len++] = full_duplex;
-	kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	if (set_hardware_set) {
-	    kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	    kfilter->startdata[kfilter->startdata_len++] = (i << 4) | 6;
-	    kfilter->startdata[kfilter->startdata_len++] = set_hardware;
-	    kfilter->startdata[kfilter->startdata_len++] = 0xc0;
-	}
+	kiss_add_startcmd(kfilter, i, 1, (txdelay + 5) / 10);
+	kiss_add_startcmd(kfilter, i, 2, persist);
+	kiss_add_startcmd(kfilter, i, 3, (slot_time + 5) / 10);
+	kiss_add_startcmd(kfilter, i, 5, full_duplex);
+	if (set_hardware_set)
+	    kiss_add_startcmd(kfilter, i, 6, set_hardware);
     }
 
     *rfilter = kfilter->filter;
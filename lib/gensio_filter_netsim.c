@@ -0,0 +1,666 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A filter that makes its child look like a network link with a
+ * given bandwidth, latency, jitter and loss.  It is meant to sit on
+ * a pipe gensio, and with the simulation os funcs a whole network of
+ * connections can be run in virtual time.
+ *
+ * Writes are cut into packets of at most mtu bytes.  Each packet is
+ * given the time it would arrive at the other end: when the link is
+ * free after the packets before it, plus the time to send it at the
+ * bandwidth, plus the latency and a random part of the jitter.  Lost
+ * packets still use the link, they are just never queued.  Packets
+ * go down to the child, with a two byte length in front, when they
+ * arrive.  Unless reorder is set a packet never arrives before the
+ * one ahead of it, so jitter only spreads them out.
+ *
+ * The receive side only splits the data from the child back into
+ * packets, so both ends must use the same mtu.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <assert.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
+
+#include "gensio_filter_netsim.h"
+
+#define NETSIM_HDR_SIZE		2
+#define NETSIM_DEFAULT_MTU	1500
+#define NETSIM_MAX_MTU		65535
+#define NETSIM_DEFAULT_QUEUE	65536
+
+/* loss is kept in parts per NETSIM_LOSS_SCALE. */
+#define NETSIM_LOSS_SCALE	1000000
+
+struct netsim_pkt {
+    struct gensio_link link;
+    int64_t due; /* nsecs of monotonic time when it arrives. */
+    gensiods len; /* Including the header. */
+    gensiods pos; /* How much has been written to the child. */
+    unsigned char data[];
+};
+
+struct netsim_filter {
+    struct gensio_filter *filter;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    /* Link parameters. */
+    gensiods bandwidth; /* Bytes per second, zero is unlimited. */
+    int64_t latency;
+    int64_t jitter;
+    uint32_t loss;
+    bool reorder;
+    bool packet;
+    gensiods mtu;
+    gensiods queue_max;
+
+    bool xmit_ready;
+    uint64_t rand_state;
+
+    /* Packets on the link, in the order they arrive. */
+    struct gensio_list xmitq;
+    gensiods queued; /* Payload bytes in xmitq. */
+    int64_t link_free; /* When the link is done sending what it has. */
+    int64_t last_due;
+    bool timer_running;
+    int64_t timer_due;
+
+    /* The packet being received. */
+    unsigned char *read_data;
+    gensiods read_data_len;
+    gensiods read_data_pos;
+    bool in_pkt_complete;
+};
+
+#define filter_to_netsim(v) ((struct netsim_filter *) \
+			     gensio_filter_get_user_data(v))
+
+static void
+netsim_lock(struct netsim_filter *nfilter)
+{
+    nfilter->o->lock(nfilter->lock);
+}
+
+static void
+netsim_unlock(struct netsim_filter *nfilter)
+{
+    nfilter->o->unlock(nfilter->lock);
+}
+
+static int64_t
+netsim_now(struct netsim_filter *nfilter)
+{
+    gensio_time now;
+
+    nfilter->o->get_monotonic_time(nfilter->o, &now);
+    return now.secs * GENSIO_NSECS_IN_SEC + now.nsecs;
+}
+
+/* xorshift64*, seeded from the os funcs so the simulation repeats. */
+static uint64_t
+netsim_rand(struct netsim_filter *nfilter)
+{
+    nfilter->rand_state ^= nfilter->rand_state >> 12;
+    nfilter->rand_state ^= nfilter->rand_state << 25;
+    nfilter->rand_state ^= nfilter->rand_state >> 27;
+    return nfilter->rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static struct netsim_pkt *
+netsim_first_pkt(struct netsim_filter *nfilter)
+{
+    if (gensio_list_empty(&nfilter->xmitq))
+	return NULL;
+    return gensio_container_of(gensio_list_first(&nfilter->xmitq),
+			       struct netsim_pkt, link);
+}
+
+static bool
+netsim_pkt_due(struct netsim_filter *nfilter)
+{
+    struct netsim_pkt *p = netsim_first_pkt(nfilter);
+
+    return p && (p->pos > 0 || p->due <= netsim_now(nfilter));
+}
+
+/* Make sure the timer goes off when the first packet arrives. */
+static void
+netsim_start_timer(struct netsim_filter *nfilter)
+{
+    struct netsim_pkt *p = netsim_first_pkt(nfilter);
+    gensio_time timeout = { 0, 0 };
+    int64_t now;
+
+    if (!p)
+	return;
+    if (nfilter->timer_running) {
+	if (nfilter->timer_due <= p->due)
+	    return;
+	nfilter->filter_cb(nfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+    }
+    now = netsim_now(nfilter);
+    if (p->due > now)
+	gensio_time_add_nsecs(&timeout, p->due - now);
+    nfilter->timer_running = true;
+    nfilter->timer_due = p->due;
+    nfilter->filter_cb(nfilter->filter_cb_data,
+		       GENSIO_FILTER_CB_START_TIMER, &timeout);
+}
+
+static void
+netsim_free_xmitq(struct netsim_filter *nfilter)
+{
+    struct netsim_pkt *p;
+
+    while ((p = netsim_first_pkt(nfilter))) {
+	gensio_list_rm(&nfilter->xmitq, &p->link);
+	nfilter->o->free(nfilter->o, p);
+    }
+    nfilter->queued = 0;
+}
+
+static void
+netsim_set_callbacks(struct netsim_filter *nfilter,
+		     gensio_filter_cb cb, void *cb_data)
+{
+    nfilter->filter_cb = cb;
+    nfilter->filter_cb_data = cb_data;
+}
+
+static bool
+netsim_ul_read_pending(struct netsim_filter *nfilter)
+{
+    return nfilter->in_pkt_complete;
+}
+
+static bool
+netsim_ll_write_pending(struct netsim_filter *nfilter)
+{
+    bool rv;
+
+    netsim_lock(nfilter);
+    rv = netsim_pkt_due(nfilter);
+    netsim_unlock(nfilter);
+    return rv;
+}
+
+static int
+netsim_ll_write_queued(struct netsim_filter *nfilter, bool *rv)
+{
+    netsim_lock(nfilter);
+    *rv = !gensio_list_empty(&nfilter->xmitq);
+    netsim_unlock(nfilter);
+    return 0;
+}
+
+static int
+netsim_ul_can_write(struct netsim_filter *nfilter, bool *rv)
+{
+    netsim_lock(nfilter);
+    *rv = nfilter->xmit_ready && nfilter->queued < nfilter->queue_max;
+    netsim_unlock(nfilter);
+    return 0;
+}
+
+static bool
+netsim_ll_read_needed(struct netsim_filter *nfilter)
+{
+    return false;
+}
+
+static int
+netsim_check_open_done(struct netsim_filter *nfilter, struct gensio *io)
+{
+    return 0;
+}
+
+static int
+netsim_try_connect(struct netsim_filter *nfilter, gensio_time *timeout,
+		   bool was_timeout)
+{
+    netsim_lock(nfilter);
+    nfilter->xmit_ready = true;
+    nfilter->link_free = netsim_now(nfilter);
+    nfilter->last_due = nfilter->link_free;
+    netsim_unlock(nfilter);
+    return 0;
+}
+
+/* Wait for the packets still on the link to get to the other end. */
+static int
+netsim_try_disconnect(struct netsim_filter *nfilter, gensio_time *timeout,
+		      bool was_timeout)
+{
+    struct netsim_pkt *p;
+    int64_t now;
+    int rv = 0;
+
+    netsim_lock(nfilter);
+    nfilter->xmit_ready = false;
+    p = netsim_first_pkt(nfilter);
+    if (p) {
+	now = netsim_now(nfilter);
+	if (p->pos > 0 || p->due <= now) {
+	    rv = GE_INPROGRESS;
+	} else {
+	    timeout->secs = 0;
+	    timeout->nsecs = 0;
+	    gensio_time_add_nsecs(timeout, p->due - now);
+	    rv = GE_RETRY;
+	}
+    }
+    netsim_unlock(nfilter);
+    return rv;
+}
+
+static void
+netsim_copy_sg(unsigned char *dest, const struct gensio_sg *sg,
+	       gensiods sglen, gensiods offset, gensiods len)
+{
+    gensiods i, n;
+
+    for (i = 0; i < sglen && len > 0; i++) {
+	if (offset >= sg[i].buflen) {
+	    offset -= sg[i].buflen;
+	    continue;
+	}
+	n = sg[i].buflen - offset;
+	if (n > len)
+	    n = len;
+	memcpy(dest, ((const unsigned char *) sg[i].buf) + offset, n);
+	dest += n;
+	len -= n;
+	offset = 0;
+    }
+}
+
+/* Put a packet on the link, or lose it. */
+static int
+netsim_send_pkt(struct netsim_filter *nfilter, const struct gensio_sg *sg,
+		gensiods sglen, gensiods offset, gensiods len)
+{
+    struct gensio_os_funcs *o = nfilter->o;
+    struct netsim_pkt *p, *p2;
+    struct gensio_link *l;
+    int64_t now = netsim_now(nfilter), due;
+
+    if (nfilter->link_free < now)
+	nfilter->link_free = now;
+    if (nfilter->bandwidth)
+	nfilter->link_free += ((len + NETSIM_HDR_SIZE) * GENSIO_NSECS_IN_SEC /
+			       nfilter->bandwidth);
+    due = nfilter->link_free + nfilter->latency;
+    if (nfilter->jitter)
+	due += netsim_rand(nfilter) % (nfilter->jitter + 1);
+    if (!nfilter->reorder) {
+	if (due < nfilter->last_due)
+	    due = nfilter->last_due;
+	nfilter->last_due = due;
+    }
+
+    if (nfilter->loss &&
+		netsim_rand(nfilter) % NETSIM_LOSS_SCALE < nfilter->loss)
+	return 0;
+
+    p = o->zalloc(o, sizeof(*p) + len + NETSIM_HDR_SIZE);
+    if (!p)
+	return GE_NOMEM;
+    p->due = due;
+    p->len = len + NETSIM_HDR_SIZE;
+    p->data[0] = len >> 8;
+    p->data[1] = len & 0xff;
+    netsim_copy_sg(p->data + NETSIM_HDR_SIZE, sg, sglen, offset, len);
+
+    /*
+     * Usually it goes on the end, find where it goes otherwise.  The
+     * list head's link ends the search, adding after that puts it
+     * first.
+     */
+    for (l = gensio_list_last(&nfilter->xmitq); l != &nfilter->xmitq.link;
+	 l = l->prev) {
+	p2 = gensio_container_of(l, struct netsim_pkt, link);
+	if (p2->due <= due || p2->pos > 0)
+	    break;
+    }
+    gensio_list_add_next(&nfilter->xmitq, l, &p->link);
+    nfilter->queued += len;
+    return 0;
+}
+
+static int
+netsim_ul_write(struct netsim_filter *nfilter,
+		gensio_ul_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    gensiods i, total = 0, count = 0, len;
+    struct netsim_pkt *p;
+    struct gensio_sg xsg;
+    bool was_full;
+    int err = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    if (nfilter->packet && total > nfilter->mtu)
+	return GE_TOOBIG;
+
+    netsim_lock(nfilter);
+    if (nfilter->xmit_ready) {
+	while (count < total && nfilter->queued < nfilter->queue_max) {
+	    len = total - count;
+	    if (len > nfilter->mtu)
+		len = nfilter->mtu;
+	    err = netsim_send_pkt(nfilter, sg, sglen, count, len);
+	    if (err)
+		goto out_unlock;
+	    count += len;
+	}
+    }
+
+    /* Hand the packets that have arrived to the child. */
+    was_full = nfilter->queued >= nfilter->queue_max;
+    while (netsim_pkt_due(nfilter)) {
+	gensiods wcount = 0;
+
+	p = netsim_first_pkt(nfilter);
+	xsg.buf = p->data + p->pos;
+	xsg.buflen = p->len - p->pos;
+	netsim_unlock(nfilter);
+	err = handler(cb_data, &wcount, &xsg, 1, NULL);
+	netsim_lock(nfilter);
+	if (err)
+	    goto out_unlock;
+	p->pos += wcount;
+	if (p->pos < p->len)
+	    break;
+	gensio_list_rm(&nfilter->xmitq, &p->link);
+	nfilter->queued -= p->len - NETSIM_HDR_SIZE;
+	nfilter->o->free(nfilter->o, p);
+    }
+    if (was_full && nfilter->queued < nfilter->queue_max)
+	nfilter->filter_cb(nfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    if (!netsim_pkt_due(nfilter))
+	netsim_start_timer(nfilter);
+ out_unlock:
+    netsim_unlock(nfilter);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+static int
+netsim_ll_write(struct netsim_filter *nfilter,
+		gensio_ll_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		unsigned char *buf, gensiods buflen,
+		const char *const *auxdata)
+{
+    static const char *eomaux[2] = { "eom", NULL };
+    gensiods in_buflen = buflen, pktlen, n, count;
+    int err = 0;
+
+    netsim_lock(nfilter);
+    for (;;) {
+	if (nfilter->in_pkt_complete) {
+	    pktlen = nfilter->read_data_len - NETSIM_HDR_SIZE;
+	    count = 0;
+	    netsim_unlock(nfilter);
+	    err = handler(cb_data, &count,
+			  nfilter->read_data + NETSIM_HDR_SIZE +
+			  nfilter->read_data_pos,
+			  pktlen - nfilter->read_data_pos,
+			  nfilter->packet ? eomaux : NULL);
+	    netsim_lock(nfilter);
+	    if (err)
+		break;
+	    nfilter->read_data_pos += count;
+	    if (nfilter->read_data_pos < pktlen)
+		break;
+	    nfilter->in_pkt_complete = false;
+	    nfilter->read_data_len = 0;
+	    nfilter->read_data_pos = 0;
+	}
+	if (buflen == 0)
+	    break;
+
+	if (nfilter->read_data_len < NETSIM_HDR_SIZE) {
+	    n = NETSIM_HDR_SIZE - nfilter->read_data_len;
+	} else {
+	    pktlen = (nfilter->read_data[0] << 8) | nfilter->read_data[1];
+	    if (pktlen > nfilter->mtu) {
+		err = GE_PROTOERR;
+		break;
+	    }
+	    n = pktlen + NETSIM_HDR_SIZE - nfilter->read_data_len;
+	}
+	if (n > buflen)
+	    n = buflen;
+	memcpy(nfilter->read_data + nfilter->read_data_len, buf, n);
+	nfilter->read_data_len += n;
+	buf += n;
+	buflen -= n;
+	if (nfilter->read_data_len >= NETSIM_HDR_SIZE) {
+	    pktlen = (nfilter->read_data[0] << 8) | nfilter->read_data[1];
+	    if (nfilter->read_data_len == pktlen + NETSIM_HDR_SIZE &&
+			pktlen > 0)
+		nfilter->in_pkt_complete = true;
+	    else if (pktlen == 0)
+		nfilter->read_data_len = 0;
+	}
+    }
+    netsim_unlock(nfilter);
+
+    if (!err && rcount)
+	*rcount = in_buflen - buflen;
+    return err;
+}
+
+static int
+netsim_setup(struct netsim_filter *nfilter)
+{
+    uint64_t seed = 0;
+    int rv;
+
+    rv = nfilter->o->get_random(nfilter->o, &seed, sizeof(seed));
+    if (rv)
+	return rv;
+    nfilter->rand_state = seed ? seed : 1;
+    return 0;
+}
+
+static void
+netsim_filter_cleanup(struct netsim_filter *nfilter)
+{
+    netsim_free_xmitq(nfilter);
+    nfilter->xmit_ready = false;
+    nfilter->timer_running = false;
+    nfilter->read_data_len = 0;
+    nfilter->read_data_pos = 0;
+    nfilter->in_pkt_complete = false;
+}
+
+static void
+netsim_free(struct netsim_filter *nfilter)
+{
+    struct gensio_os_funcs *o = nfilter->o;
+
+    netsim_free_xmitq(nfilter);
+    if (nfilter->read_data)
+	o->free(o, nfilter->read_data);
+    if (nfilter->lock)
+	o->free_lock(nfilter->lock);
+    if (nfilter->filter)
+	gensio_filter_free_data(nfilter->filter);
+    o->free(o, nfilter);
+}
+
+static int
+netsim_filter_timeout(struct netsim_filter *nfilter)
+{
+    netsim_lock(nfilter);
+    nfilter->timer_running = false;
+    if (netsim_pkt_due(nfilter))
+	nfilter->filter_cb(nfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    else
+	netsim_start_timer(nfilter);
+    netsim_unlock(nfilter);
+    return 0;
+}
+
+static int gensio_netsim_filter_func(struct gensio_filter *filter, int op,
+				     void *func, void *data,
+				     gensiods *count,
+				     void *buf, const void *cbuf,
+				     gensiods buflen,
+				     const char *const *auxdata)
+{
+    struct netsim_filter *nfilter = filter_to_netsim(filter);
+
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	netsim_set_callbacks(nfilter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return netsim_ul_read_pending(nfilter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return netsim_ll_write_pending(nfilter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_QUEUED:
+	return netsim_ll_write_queued(nfilter, data);
+
+    case GENSIO_FILTER_FUNC_UL_CAN_WRITE:
+	return netsim_ul_can_write(nfilter, data);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return netsim_ll_read_needed(nfilter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return netsim_check_open_done(nfilter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return netsim_try_connect(nfilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return netsim_try_disconnect(nfilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return netsim_ul_write(nfilter, func, data, count, cbuf, buflen,
+			       auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return netsim_ll_write(nfilter, func, data, count, buf, buflen,
+			       auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return netsim_setup(nfilter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	netsim_filter_cleanup(nfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	netsim_free(nfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	return netsim_filter_timeout(nfilter);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_netsim_filter_alloc(struct gensio_os_funcs *o,
+			   const char * const args[],
+			   bool *is_packet,
+			   struct gensio_filter **rfilter)
+{
+    struct netsim_filter *nfilter;
+    unsigned int i;
+    gensiods bandwidth = 0, mtu = NETSIM_DEFAULT_MTU;
+    gensiods queue_max = NETSIM_DEFAULT_QUEUE;
+    gensio_time latency = { 0, 0 }, jitter = { 0, 0 };
+    float loss = 0;
+    bool reorder = false;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "bandwidth", &bandwidth) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "latency", 'm', &latency) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "jitter", 'm', &jitter) > 0)
+	    continue;
+	if (gensio_check_keyfloat(args[i], "loss", &loss) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "reorder", &reorder) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "mtu", &mtu) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "queue", &queue_max) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (mtu == 0 || mtu > NETSIM_MAX_MTU || queue_max == 0 ||
+		loss < 0 || loss > 100)
+	return GE_INVAL;
+
+    nfilter = o->zalloc(o, sizeof(*nfilter));
+    if (!nfilter)
+	return GE_NOMEM;
+
+    nfilter->o = o;
+    nfilter->bandwidth = bandwidth;
+    nfilter->latency = latency.secs * GENSIO_NSECS_IN_SEC + latency.nsecs;
+    nfilter->jitter = jitter.secs * GENSIO_NSECS_IN_SEC + jitter.nsecs;
+    nfilter->loss = loss * (NETSIM_LOSS_SCALE / 100);
+    nfilter->reorder = reorder;
+    nfilter->packet = nfilter->loss > 0 || reorder;
+    nfilter->mtu = mtu;
+    nfilter->queue_max = queue_max;
+    gensio_list_init(&nfilter->xmitq);
+
+    nfilter->lock = o->alloc_lock(o);
+    if (!nfilter->lock)
+	goto out_nomem;
+
+    nfilter->read_data = o->zalloc(o, mtu + NETSIM_HDR_SIZE);
+    if (!nfilter->read_data)
+	goto out_nomem;
+
+    nfilter->filter = gensio_filter_alloc_data(o, gensio_netsim_filter_func,
+					       nfilter);
+    if (!nfilter->filter)
+	goto out_nomem;
+
+    *is_packet = nfilter->packet;
+    *rfilter = nfilter->filter;
+    return 0;
+
+ out_nomem:
+    netsim_free(nfilter);
+    return GE_NOMEM;
+}
@@ -0,0 +1,22 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_FILTER_NETSIM_H
+#define GENSIO_FILTER_NETSIM_H
+
+#include <gensio/gensio_base.h>
+
+/*
+ * is_packet is set if the link may lose or reorder packets, in which
+ * case writes are packets.  Otherwise it is a reliable stream.
+ */
+int gensio_netsim_filter_alloc(struct gensio_os_funcs *o,
+			       const char * const args[],
+			       bool *is_packet,
+			       struct gensio_filter **rfilter);
+
+#endif /* GENSIO_FILTER_NETSIM_H */
@@ -8,6 +8,7 @@
 #include "config.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
@@ -15,6 +16,31 @@
 
 #include "gensio_filter_perf.h"
 
+/*
+ * Latency histogram, like HdrHistogram with two significant digits.
+ * Values below PERF_HIST_SUB are exact, above that each power of two
+ * is split into PERF_HIST_SUB / 2 buckets, so a value is off by less
+ * than 1/64.  Values are in nanoseconds, and anything over 2^40
+ * (about 18 minutes) goes in the top bucket.
+ */
+#define PERF_HIST_SUB_BITS	7
+#define PERF_HIST_SUB		(1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_HALF		(PERF_HIST_SUB / 2)
+#define PERF_HIST_MAX_BITS	40
+#define PERF_HIST_BUCKETS	((PERF_HIST_MAX_BITS - PERF_HIST_SUB_BITS + 2) * \
+				 PERF_HIST_HALF)
+
+/*
+ * In latency mode each message starts with this, the rest of the
+ * message is zeros.  The other end must send the data back.
+ */
+#define PERF_LAT_MAGIC		0x70657266 /* "perf" */
+struct perf_lat_hdr {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t nsecs;
+};
+
 struct perf_filter {
     struct gensio_filter *filter;
     gensio_filter_cb filter_cb;
@@ -45,8 +71,57 @@ struct perf_filter {
 
     gensiods print_pending;
     gensiods print_pos;
-    char print_buffer[1024];
+    char *print_buffer;
+    gensiods print_size;
     bool final_started;
+
+    /* Monotonic nsecs the next per-second print is due. */
+    uint64_t tick_due;
+
+    bool json;
+
+    /*
+     * Latency mode.  Up to concurrency messages of msg_size bytes are
+     * outstanding at a time, a new one is sent as each one comes
+     * back.  Message data to send is built in write_data.
+     */
+    bool latency;
+    gensiods msg_size;
+    gensiods msg_count;
+    gensiods concurrency;
+    gensiods msgs_sent;
+    gensiods msgs_recv;
+    gensiods msgs_bad;
+    gensiods out_pos;
+    gensiods out_len;
+    gensiods in_pos; /* Position in the current incoming message. */
+    struct perf_lat_hdr in_hdr;
+    uint64_t *hist;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+
+    /*
+     * Jitter, the change in latency from one message to the next.
+     * Messages slower than deadline (if not zero) are counted.
+     */
+    uint64_t lat_prev;
+    uint64_t jitter_sum;
+    uint64_t jitter_max;
+    uint64_t deadline;
+    gensiods deadline_misses;
+
+    /* Add the histogram buckets to the json output. */
+    bool show_hist;
+
+    /*
+     * Wait think nsecs after a message comes back before sending
+     * another, next_send is when that is.  timer_due is when the
+     * filter timer will go off.
+     */
+    uint64_t think;
+    uint64_t next_send;
+    uint64_t timer_due;
 };
 
 #define filter_to_perf(v) ((struct perf_filter *) \
@@ -72,11 +147,200 @@ perf_ul_read_pending(struct gensio_filter *filter)
     return pfilter->print_pending;
 }
 
+static unsigned int
+perf_hist_idx(uint64_t v)
+{
+    unsigned int shift = 0;
+
+    if (v >= (uint64_t) 1 << PERF_HIST_MAX_BITS)
+	return PERF_HIST_BUCKETS - 1;
+    while (v >= PERF_HIST_SUB) {
+	v >>= 1;
+	shift++;
+    }
+    return shift * PERF_HIST_HALF + v;
+}
+
+/* The highest value that goes in the bucket. */
+static uint64_t
+perf_hist_value(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < PERF_HIST_SUB)
+	return idx;
+    shift = idx / PERF_HIST_HALF - 1;
+    return ((uint64_t) (idx - shift * PERF_HIST_HALF + 1) << shift) - 1;
+}
+
+static uint64_t
+perf_hist_percentile(struct perf_filter *pfilter, double pct)
+{
+    uint64_t want, count = 0, v;
+    gensiods n = pfilter->msgs_recv - pfilter->msgs_bad;
+    unsigned int i;
+
+    if (n == 0)
+	return 0;
+    want = (uint64_t) ((double) n * pct / 100.0 + 0.5);
+    if (want == 0)
+	want = 1;
+    for (i = 0; i < PERF_HIST_BUCKETS - 1; i++) {
+	count += pfilter->hist[i];
+	if (count >= want)
+	    break;
+    }
+    v = perf_hist_value(i);
+    if (v > pfilter->lat_max)
+	v = pfilter->lat_max;
+    return v;
+}
+
+static uint64_t
+perf_now_nsecs(struct perf_filter *pfilter)
+{
+    gensio_time t;
+
+    pfilter->o->get_monotonic_time(pfilter->o, &t);
+    return (uint64_t) t.secs * 1000000000 + t.nsecs;
+}
+
+#define PERF_TICK_NSECS		1000000000ULL
+
+/* Run the timer until the next print tick or the end of a think. */
+static void
+perf_filter_start_timer(struct perf_filter *pfilter, uint64_t now)
+{
+    uint64_t due = pfilter->tick_due, wait;
+    gensio_time timeout;
+
+    if (pfilter->think && pfilter->next_send > now && pfilter->next_send < due)
+	due = pfilter->next_send;
+    wait = due > now ? due - now : 0;
+    timeout.secs = wait / 1000000000;
+    timeout.nsecs = wait % 1000000000;
+    pfilter->timer_due = due;
+    pfilter->filter_cb(pfilter->filter_cb_data,
+		       GENSIO_FILTER_CB_START_TIMER, &timeout);
+}
+
+static bool
+perf_lat_can_write(struct perf_filter *pfilter)
+{
+    if (pfilter->out_pos < pfilter->out_len)
+	return true;
+    if (pfilter->msgs_sent >= pfilter->msg_count ||
+		pfilter->msgs_sent - pfilter->msgs_recv >= pfilter->concurrency)
+	return false;
+    return !pfilter->think || perf_now_nsecs(pfilter) >= pfilter->next_send;
+}
+
+/* Build as many new messages as we are allowed to send. */
+static void
+perf_lat_fill(struct perf_filter *pfilter)
+{
+    struct perf_lat_hdr h;
+
+    pfilter->out_pos = 0;
+    pfilter->out_len = 0;
+    h.magic = PERF_LAT_MAGIC;
+    h.nsecs = perf_now_nsecs(pfilter);
+    while (pfilter->msgs_sent < pfilter->msg_count &&
+	   pfilter->msgs_sent - pfilter->msgs_recv < pfilter->concurrency &&
+	   (pfilter->out_len == 0 ||
+	    pfilter->out_len + pfilter->msg_size <= pfilter->writebuf_size)) {
+	h.seq = pfilter->msgs_sent++;
+	memcpy(pfilter->write_data + pfilter->out_len, &h, sizeof(h));
+	pfilter->out_len += pfilter->msg_size;
+    }
+}
+
+static void
+perf_lat_record(struct perf_filter *pfilter, uint64_t now)
+{
+    uint64_t lat;
+
+    pfilter->msgs_recv++;
+    if (pfilter->in_hdr.magic != PERF_LAT_MAGIC ||
+		pfilter->in_hdr.nsecs > now) {
+	pfilter->msgs_bad++;
+	return;
+    }
+    if (pfilter->think) {
+	pfilter->next_send = now + pfilter->think;
+	if (pfilter->next_send < pfilter->timer_due) {
+	    /* Wake up sooner to send the next message. */
+	    pfilter->filter_cb(pfilter->filter_cb_data,
+			       GENSIO_FILTER_CB_STOP_TIMER, NULL);
+	    perf_filter_start_timer(pfilter, now);
+	}
+    }
+    lat = now - pfilter->in_hdr.nsecs;
+    pfilter->hist[perf_hist_idx(lat)]++;
+    if (pfilter->msgs_recv - pfilter->msgs_bad == 1) {
+	pfilter->lat_min = lat;
+    } else {
+	uint64_t jitter = (lat > pfilter->lat_prev ? lat - pfilter->lat_prev
+			   : pfilter->lat_prev - lat);
+
+	pfilter->jitter_sum += jitter;
+	if (jitter > pfilter->jitter_max)
+	    pfilter->jitter_max = jitter;
+	if (lat < pfilter->lat_min)
+	    pfilter->lat_min = lat;
+    }
+    pfilter->lat_prev = lat;
+    if (lat > pfilter->lat_max)
+	pfilter->lat_max = lat;
+    pfilter->lat_sum += lat;
+    if (pfilter->deadline && lat > pfilter->deadline)
+	pfilter->deadline_misses++;
+}
+
+/* Split incoming data into messages and time the ones that finish. */
+static void
+perf_lat_read(struct perf_filter *pfilter, const unsigned char *buf,
+	      gensiods buflen)
+{
+    uint64_t now = 0;
+    gensiods len;
+
+    while (buflen > 0) {
+	if (pfilter->in_pos < sizeof(pfilter->in_hdr)) {
+	    len = sizeof(pfilter->in_hdr) - pfilter->in_pos;
+	    if (len > buflen)
+		len = buflen;
+	    memcpy(((unsigned char *) &pfilter->in_hdr) + pfilter->in_pos,
+		   buf, len);
+	} else {
+	    len = pfilter->msg_size - pfilter->in_pos;
+	    if (len > buflen)
+		len = buflen;
+	}
+	buf += len;
+	buflen -= len;
+	pfilter->in_pos += len;
+	if (pfilter->in_pos == pfilter->msg_size) {
+	    if (!now)
+		now = perf_now_nsecs(pfilter);
+	    perf_lat_record(pfilter, now);
+	    pfilter->in_pos = 0;
+	}
+    }
+}
+
 static bool
 perf_ll_write_pending(struct gensio_filter *filter)
 {
     struct perf_filter *pfilter = filter_to_perf(filter);
 
+    if (pfilter->latency) {
+	if (pfilter->final_started)
+	    return pfilter->print_pending == 0;
+	/* Don't spin waiting for responses, reads will push writes. */
+	return pfilter->expect_len == 0 || perf_lat_can_write(pfilter);
+    }
+
     /*
      * Always return true if we are supplying data.  We want it to
      * supply data and then return a GE_REMCLOSE when out of data.
@@ -96,15 +360,6 @@ perf_ll_read_needed(struct gensio_filter *filter)
     return false;
 }
 
-static void
-perf_filter_start_timer(struct perf_filter *pfilter)
-{
-    gensio_time timeout = { 1, 0 };
-
-    pfilter->filter_cb(pfilter->filter_cb_data,
-		       GENSIO_FILTER_CB_START_TIMER, &timeout);
-}
-
 static void
 perf_set_callbacks(struct gensio_filter *filter,
 		   gensio_filter_cb cb, void *cb_data)
@@ -119,8 +374,10 @@ static int
 perf_check_open_done(struct gensio_filter *filter, struct gensio *io)
 {
     struct perf_filter *pfilter = filter_to_perf(filter);
+    uint64_t now = perf_now_nsecs(pfilter);
 
-    perf_filter_start_timer(pfilter);
+    pfilter->tick_due = now + PERF_TICK_NSECS;
+    perf_filter_start_timer(pfilter, now);
     pfilter->o->get_monotonic_time(pfilter->o, &pfilter->start_time);
     return 0;
 }
@@ -149,6 +406,134 @@ set_write_end_time(struct perf_filter *pfilter)
     }
 }
 
+#define NS_TO_US(v) ((double) (v) / 1000.0)
+
+/* Mean change in latency between messages. */
+static double
+perf_jitter_mean(struct perf_filter *pfilter)
+{
+    gensiods n = pfilter->msgs_recv - pfilter->msgs_bad;
+
+    return n > 1 ? NS_TO_US(pfilter->jitter_sum / (n - 1)) : 0.0;
+}
+
+static int
+perf_print_latency(struct perf_filter *pfilter, char *buf, gensiods len)
+{
+    gensiods n = pfilter->msgs_recv - pfilter->msgs_bad;
+    int pos;
+
+    pos = snprintf(buf, len,
+		    "LATENCY: %lu messages of %lu bytes, %lu outstanding"
+		    ", %lu bad\n"
+		    "         usecs min %.1f p50 %.1f p99 %.1f p99.9 %.1f"
+		    " max %.1f mean %.1f\n",
+		    (unsigned long) pfilter->msgs_recv,
+		    (unsigned long) pfilter->msg_size,
+		    (unsigned long) pfilter->concurrency,
+		    (unsigned long) pfilter->msgs_bad,
+		    NS_TO_US(pfilter->lat_min),
+		    NS_TO_US(perf_hist_percentile(pfilter, 50.0)),
+		    NS_TO_US(perf_hist_percentile(pfilter, 99.0)),
+		    NS_TO_US(perf_hist_percentile(pfilter, 99.9)),
+		    NS_TO_US(pfilter->lat_max),
+		    n ? NS_TO_US(pfilter->lat_sum / n) : 0.0);
+    if (pos < len)
+	pos += snprintf(buf + pos, len - pos,
+			"JITTER:  usecs mean %.1f max %.1f p99.9-p50 %.1f"
+			", real-time profile %s\n",
+			perf_jitter_mean(pfilter),
+			NS_TO_US(pfilter->jitter_max),
+			NS_TO_US(perf_hist_percentile(pfilter, 99.9) -
+				 perf_hist_percentile(pfilter, 50.0)),
+			gensio_os_funcs_is_realtime(pfilter->o) ? "on" : "off");
+    if (pfilter->deadline && pos < len)
+	pos += snprintf(buf + pos, len - pos,
+			"         %lu messages over the %.1f usec deadline\n",
+			(unsigned long) pfilter->deadline_misses,
+			NS_TO_US(pfilter->deadline));
+    return pos;
+}
+
+static int
+perf_print_json(struct perf_filter *pfilter, gensiods write_count,
+		double total_write_time, double total_read_time)
+{
+    char *buf = pfilter->print_buffer;
+    gensiods n = pfilter->msgs_recv - pfilter->msgs_bad;
+    gensiods len = pfilter->print_size;
+    unsigned int i;
+    bool first = true;
+    int pos;
+
+    pos = snprintf(buf, len,
+		   "{\"write_bytes\": %lu, \"write_secs\": %.6f,"
+		   " \"write_bytes_per_sec\": %.1f,"
+		   " \"read_bytes\": %lu, \"read_secs\": %.6f,"
+		   " \"read_bytes_per_sec\": %.1f",
+		   (unsigned long) write_count, total_write_time,
+		   total_write_time > 0 ? write_count / total_write_time : 0.0,
+		   (unsigned long) pfilter->read_count, total_read_time,
+		   total_read_time > 0 ?
+			pfilter->read_count / total_read_time : 0.0);
+    if (pfilter->latency && pos < len)
+	pos += snprintf(buf + pos, len - pos,
+		", \"latency\": {\"messages\": %lu, \"msg_size\": %lu,"
+		" \"concurrency\": %lu, \"bad\": %lu,"
+		" \"min_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f,"
+		" \"p999_us\": %.1f, \"max_us\": %.1f, \"mean_us\": %.1f}",
+		(unsigned long) pfilter->msgs_recv,
+		(unsigned long) pfilter->msg_size,
+		(unsigned long) pfilter->concurrency,
+		(unsigned long) pfilter->msgs_bad,
+		NS_TO_US(pfilter->lat_min),
+		NS_TO_US(perf_hist_percentile(pfilter, 50.0)),
+		NS_TO_US(perf_hist_percentile(pfilter, 99.0)),
+		NS_TO_US(perf_hist_percentile(pfilter, 99.9)),
+		NS_TO_US(pfilter->lat_max),
+		n ? NS_TO_US(pfilter->lat_sum / n) : 0.0);
+    if (pfilter->latency && pos < len) {
+	/* Add the jitter inside the latency object. */
+	pos--; /* Back over the closing brace. */
+	pos += snprintf(buf + pos, len - pos,
+			", \"jitter_mean_us\": %.1f, \"jitter_max_us\": %.1f,"
+			" \"realtime\": %s",
+			perf_jitter_mean(pfilter),
+			NS_TO_US(pfilter->jitter_max),
+			gensio_os_funcs_is_realtime(pfilter->o) ?
+			    "true" : "false");
+	if (pfilter->deadline && pos < len)
+	    pos += snprintf(buf + pos, len - pos,
+			    ", \"deadline_us\": %.1f, \"deadline_misses\": %lu",
+			    NS_TO_US(pfilter->deadline),
+			    (unsigned long) pfilter->deadline_misses);
+	if (pos < len)
+	    pos += snprintf(buf + pos, len - pos, "}");
+    }
+    if (pfilter->latency && pfilter->show_hist && pos < len) {
+	/*
+	 * Add the non-empty buckets as [top nsecs, count] pairs inside
+	 * the latency object, so runs can be merged.
+	 */
+	pos--; /* Back over the closing brace. */
+	pos += snprintf(buf + pos, len - pos, ", \"hist\": [");
+	for (i = 0; i < PERF_HIST_BUCKETS && pos < len; i++) {
+	    if (!pfilter->hist[i])
+		continue;
+	    pos += snprintf(buf + pos, len - pos, "%s[%llu, %llu]",
+			    first ? "" : ", ",
+			    (unsigned long long) perf_hist_value(i),
+			    (unsigned long long) pfilter->hist[i]);
+	    first = false;
+	}
+	if (pos < len)
+	    pos += snprintf(buf + pos, len - pos, "]}");
+    }
+    if (pos < len)
+	pos += snprintf(buf + pos, len - pos, "}\n");
+    return pos;
+}
+
 static int
 perf_handle_end_check(struct perf_filter *pfilter)
 {
@@ -185,9 +570,14 @@ perf_handle_end_check(struct perf_filter *pfilter)
 			   ((double) pfilter->write_end_time.nsecs /
 			    1000000000.0));
 
-	/* Flip read and write, this is from the user's perspective. */
-	pfilter->print_pending = snprintf(pfilter->print_buffer,
-			  sizeof(pfilter->print_buffer),
+	if (pfilter->json)
+	    pfilter->print_pending = perf_print_json(pfilter, write_count,
+						     total_write_time,
+						     total_read_time);
+	else
+	    /* Flip read and write, this is from the user's perspective. */
+	    pfilter->print_pending = snprintf(pfilter->print_buffer,
+			  pfilter->print_size,
 			  "TOTAL: Wrote %ld in %llu.%3.3u seconds\n"
 			  "         %lf write bytes/sec\n"
 			  "       Read %ld in %llu.%3.3u seconds\n"
@@ -200,6 +590,13 @@ perf_handle_end_check(struct perf_filter *pfilter)
 			  (unsigned long long) pfilter->read_end_time.secs,
 			  (pfilter->read_end_time.nsecs + 500000) / 1000000,
 			  (double) pfilter->read_count / total_read_time);
+	if (pfilter->latency && !pfilter->json &&
+		pfilter->print_pending < pfilter->print_size)
+	    pfilter->print_pending += perf_print_latency(pfilter,
+			pfilter->print_buffer + pfilter->print_pending,
+			pfilter->print_size - pfilter->print_pending);
+	if (pfilter->print_pending >= pfilter->print_size)
+	    pfilter->print_pending = pfilter->print_size - 1;
 	pfilter->final_started = true;
 	pfilter->print_pos = 0;
     }
@@ -230,7 +627,32 @@ perf_ul_write(struct gensio_filter *filter,
 	*rcount = writelen;
 
     perf_lock(pfilter);
-    if (pfilter->write_data_left > 0) {
+    if (pfilter->latency && pfilter->write_data_left > 0) {
+	gensiods count;
+	struct gensio_sg sg;
+
+	if (pfilter->out_pos == pfilter->out_len) {
+	    if (!perf_lat_can_write(pfilter))
+		goto out_unlock; /* Waiting for responses. */
+	    perf_lat_fill(pfilter);
+	}
+	sg.buf = pfilter->write_data + pfilter->out_pos;
+	sg.buflen = pfilter->out_len - pfilter->out_pos;
+	count = sg.buflen;
+
+	perf_unlock(pfilter);
+	err = handler(cb_data, &count, &sg, 1, NULL);
+	perf_lock(pfilter);
+	if (!err) {
+	    if (count > sg.buflen)
+		count = sg.buflen;
+	    pfilter->out_pos += count;
+	    pfilter->write_since_last_timeout += count;
+	    pfilter->write_data_left -= count;
+	    if (pfilter->write_data_left == 0)
+		set_write_end_time(pfilter);
+	}
+    } else if (pfilter->write_data_left > 0) {
 	gensiods count = pfilter->write_data_left, ocount;
 	struct gensio_sg sg = { pfilter->write_data, 0 };
 
@@ -259,6 +681,7 @@ perf_ul_write(struct gensio_filter *filter,
 	    err = GE_REMCLOSE;
     }
 
+ out_unlock:
     perf_unlock(pfilter);
 
     return err;
@@ -278,6 +701,8 @@ perf_ll_write(struct gensio_filter *filter,
 	*rcount = buflen; /* Ignore data from below. */
 
     perf_lock(pfilter);
+    if (pfilter->latency)
+	perf_lat_read(pfilter, buf, buflen);
     pfilter->read_count += buflen;
     pfilter->read_since_last_timeout += buflen;
     if (buflen > pfilter->expect_len)
@@ -313,12 +738,19 @@ static int
 perf_filter_timeout(struct gensio_filter *filter)
 {
     struct perf_filter *pfilter = filter_to_perf(filter);
+    uint64_t now;
 
     perf_lock(pfilter);
+    now = perf_now_nsecs(pfilter);
+    if (now < pfilter->tick_due)
+	goto out_restart; /* A think ended, just let writes go again. */
+    pfilter->tick_due += PERF_TICK_NSECS;
+    if (pfilter->tick_due <= now)
+	pfilter->tick_due = now + PERF_TICK_NSECS;
     pfilter->timeouts_since_print++;
-    if (!pfilter->print_pending) {
+    if (!pfilter->print_pending && !pfilter->json) {
 	pfilter->print_pending = snprintf(pfilter->print_buffer,
-			  sizeof(pfilter->print_buffer),
+			  pfilter->print_size,
 			  "Wrote %ld, Read %ld in %u second%s\n",
 			  pfilter->write_since_last_timeout,
 			  pfilter->read_since_last_timeout,
@@ -329,7 +761,8 @@ perf_filter_timeout(struct gensio_filter *filter)
 	pfilter->timeouts_since_print = 0;
 	pfilter->print_pos = 0;
     }
-    perf_filter_start_timer(pfilter);
+ out_restart:
+    perf_filter_start_timer(pfilter, now);
     perf_unlock(pfilter);
 
     return 0;
@@ -366,6 +799,22 @@ perf_filter_cleanup(struct gensio_filter *filter)
     pfilter->timeouts_since_print = 0;
     pfilter->print_pending = 0;
     pfilter->final_started = false;
+    pfilter->msgs_sent = 0;
+    pfilter->msgs_recv = 0;
+    pfilter->msgs_bad = 0;
+    pfilter->out_pos = 0;
+    pfilter->out_len = 0;
+    pfilter->in_pos = 0;
+    pfilter->next_send = 0;
+    pfilter->lat_min = 0;
+    pfilter->lat_max = 0;
+    pfilter->lat_sum = 0;
+    pfilter->lat_prev = 0;
+    pfilter->jitter_sum = 0;
+    pfilter->jitter_max = 0;
+    pfilter->deadline_misses = 0;
+    if (pfilter->hist)
+	memset(pfilter->hist, 0, PERF_HIST_BUCKETS * sizeof(*pfilter->hist));
 }
 
 static void
@@ -375,6 +824,10 @@ pfilter_free(struct perf_filter *pfilter)
 	pfilter->o->free_lock(pfilter->lock);
     if (pfilter->write_data)
 	pfilter->o->free(pfilter->o, pfilter->write_data);
+    if (pfilter->hist)
+	pfilter->o->free(pfilter->o, pfilter->hist);
+    if (pfilter->print_buffer)
+	pfilter->o->free(pfilter->o, pfilter->print_buffer);
     if (pfilter->filter)
 	gensio_filter_free_data(pfilter->filter);
     pfilter->o->free(pfilter->o, pfilter);
@@ -450,7 +903,10 @@ static int gensio_perf_filter_func(struct gensio_filter *filter, int op,
 static struct gensio_filter *
 gensio_perf_filter_raw_alloc(struct gensio_os_funcs *o,
 			     gensiods writebuf_size, gensiods write_len,
-			     gensiods expect_len)
+			     gensiods expect_len, bool latency,
+			     gensiods msg_size, gensiods msg_count,
+			     gensiods concurrency, bool json, bool show_hist,
+			     gensiods think_usecs, gensiods deadline_usecs)
 {
     struct perf_filter *pfilter;
 
@@ -459,6 +915,27 @@ gensio_perf_filter_raw_alloc(struct gensio_os_funcs *o,
 	return NULL;
 
     pfilter->o = o;
+    pfilter->json = json;
+    if (latency) {
+	/*
+	 * The throughput counting and the end handling work as normal,
+	 * just with every message written and expected back.
+	 */
+	pfilter->latency = true;
+	pfilter->msg_size = msg_size;
+	pfilter->msg_count = msg_count;
+	pfilter->concurrency = concurrency;
+	pfilter->show_hist = show_hist;
+	pfilter->think = (uint64_t) think_usecs * 1000;
+	pfilter->deadline = (uint64_t) deadline_usecs * 1000;
+	write_len = msg_size * msg_count;
+	expect_len = write_len;
+	if (writebuf_size < msg_size)
+	    writebuf_size = msg_size;
+	pfilter->hist = o->zalloc(o, PERF_HIST_BUCKETS * sizeof(*pfilter->hist));
+	if (!pfilter->hist)
+	    goto out_nomem;
+    }
     pfilter->writebuf_size = writebuf_size;
     pfilter->write_len = write_len;
     pfilter->write_data_left = write_len;
@@ -469,6 +946,14 @@ gensio_perf_filter_raw_alloc(struct gensio_os_funcs *o,
     if (!pfilter->lock)
 	goto out_nomem;
 
+    /* Room for up to about 24 bytes per histogram bucket. */
+    pfilter->print_size = 1024;
+    if (pfilter->show_hist)
+	pfilter->print_size += PERF_HIST_BUCKETS * 24;
+    pfilter->print_buffer = o->zalloc(o, pfilter->print_size);
+    if (!pfilter->print_buffer)
+	goto out_nomem;
+
     pfilter->write_data = o->zalloc(o, writebuf_size);
     if (!pfilter->write_data)
 	goto out_nomem;
@@ -494,6 +979,9 @@ gensio_perf_filter_alloc(struct gensio_os_funcs *o,
     gensiods writebuf_size = 1024;
     gensiods write_len = 0;
     gensiods expect_len = 0;
+    gensiods msg_size = 64, msg_count = 10000, concurrency = 1, think = 0;
+    gensiods deadline = 0;
+    bool latency = false, json = false, show_hist = false;
     unsigned int i;
 
     for (i = 0; args && args[i]; i++) {
@@ -503,11 +991,33 @@ gensio_perf_filter_alloc(struct gensio_os_funcs *o,
 	    continue;
 	if (gensio_check_keyds(args[i], "expect_len", &expect_len) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "latency", &latency) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "msg_size", &msg_size) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "msg_count", &msg_count) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "concurrency", &concurrency) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "json", &json) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "hist", &show_hist) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "think", &think) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "deadline", &deadline) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
+    if (latency && (msg_size < sizeof(struct perf_lat_hdr) ||
+		    msg_count == 0 || concurrency == 0))
+	return GE_INVAL;
+
     filter = gensio_perf_filter_raw_alloc(o, writebuf_size, write_len,
-					  expect_len);
+					  expect_len, latency, msg_size,
+					  msg_count, concurrency, json, show_hist,
+					  think, deadline);
     if (!filter)
 	return GE_NOMEM;
 
@@ -11,9 +11,49 @@
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
 
 #include "gensio_filter_ratelimit.h"
 
+/*
+ * A named token bucket shared by all ratelimit filters that give its
+ * name.  Tokens are bytes, they refill at rate bytes per second up to
+ * burst.  Writers that find the bucket empty wait on the waiters
+ * list in order, and a single timer for the bucket wakes them in a
+ * batch when enough tokens are there, each getting an even share.
+ *
+ * Everything in the buckets is protected by ratelimit_buckets_lock.
+ */
+struct ratelimit_bucket {
+    struct gensio_link link;
+    char *name;
+    unsigned int refcount;
+
+    struct gensio_os_funcs *o;
+    struct gensio_timer *timer;
+    bool timer_running;
+
+    gensiods rate;
+    gensiods burst;
+    gensiods tokens;
+    gensio_time last_fill;
+
+    struct gensio_list waiters;
+    unsigned int nr_waiters;
+};
+
+/* Default write size for a filter using a bucket. */
+#define RATELIMIT_BUCKET_XMIT_LEN	1024
+
+/* Max sg entries passed through in one write, the rest waits. */
+#define RATELIMIT_MAX_SG		16
+
+static struct gensio_once ratelimit_buckets_initialized;
+static struct gensio_lock *ratelimit_buckets_lock;
+static struct gensio_list ratelimit_buckets;
+static int ratelimit_buckets_rv;
+
 struct ratelimit_filter {
     struct gensio_filter *filter;
 
@@ -24,11 +64,19 @@ struct ratelimit_filter {
     gensio_filter_cb filter_cb;
     void *filter_cb_data;
 
-    gensiods xmit_buf_len;
-    unsigned char *xmit_buf;
+    gensiods xmit_max; /* Max bytes to write at a time. */
     gensio_time delay;
 
     bool xmit_ready;
+
+    /*
+     * If using a shared bucket.  The below are protected by the
+     * bucket lock.  grant is the most a woken writer may take.
+     */
+    struct ratelimit_bucket *bucket;
+    struct gensio_link waitlink;
+    bool waiting;
+    gensiods grant;
 };
 
 #define filter_to_ratelimit(v) ((struct ratelimit_filter *) \
@@ -46,6 +94,272 @@ ratelimit_unlock(struct ratelimit_filter *rfilter)
     rfilter->o->unlock(rfilter->lock);
 }
 
+static void
+ratelimit_buckets_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&ratelimit_buckets);
+    ratelimit_buckets_lock = o->alloc_lock(o);
+    if (!ratelimit_buckets_lock)
+	ratelimit_buckets_rv = GE_NOMEM;
+}
+
+static void
+bucket_free(struct ratelimit_bucket *b)
+{
+    struct gensio_os_funcs *o = b->o;
+
+    if (b->timer)
+	o->free_timer(b->timer);
+    if (b->name)
+	o->free(o, b->name);
+    o->free(o, b);
+}
+
+/* Add tokens for the time since the last fill. */
+static void
+bucket_fill(struct ratelimit_bucket *b)
+{
+    gensio_time now;
+    int64_t nsecs, add;
+
+    b->o->get_monotonic_time(b->o, &now);
+    nsecs = gensio_time_diff_nsecs(&now, &b->last_fill);
+    add = nsecs * b->rate / GENSIO_NSECS_IN_SEC;
+    if (add <= 0)
+	return;
+    if (b->tokens + add >= b->burst) {
+	b->tokens = b->burst;
+	b->last_fill = now;
+    } else {
+	b->tokens += add;
+	/* Keep the fraction of a token not added yet. */
+	gensio_time_add_nsecs(&b->last_fill,
+			      add * GENSIO_NSECS_IN_SEC / b->rate);
+    }
+}
+
+/*
+ * Start the timer to wake the waiters when there are enough tokens for
+ * all of them to get a reasonable share.
+ */
+static void
+bucket_start_timer(struct ratelimit_bucket *b)
+{
+    gensiods want = b->burst / 8;
+    gensio_time timeout = { 0, 0 };
+    int64_t nsecs;
+
+    if (b->timer_running)
+	return;
+    if (want < 1)
+	want = 1;
+    if (want > b->tokens)
+	nsecs = (want - b->tokens) * GENSIO_NSECS_IN_SEC / b->rate;
+    else
+	nsecs = 0;
+    if (nsecs < 1000000)
+	nsecs = 1000000;
+    gensio_time_add_nsecs(&timeout, nsecs);
+    if (b->o->start_timer(b->timer, &timeout) == 0)
+	b->timer_running = true;
+}
+
+static void
+bucket_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct ratelimit_bucket *b = cb_data;
+    struct ratelimit_filter *rfilter;
+    struct gensio_link *l;
+    gensiods share;
+
+    b->o->lock(ratelimit_buckets_lock);
+    b->timer_running = false;
+    if (b->refcount == 0) {
+	b->o->unlock(ratelimit_buckets_lock);
+	bucket_free(b);
+	return;
+    }
+    bucket_fill(b);
+    if (b->nr_waiters == 0)
+	goto out_unlock;
+
+    /* Wake everyone that can get a share in one pass. */
+    share = b->tokens / b->nr_waiters;
+    if (share < 1)
+	share = 1;
+    while (b->tokens >= share && b->nr_waiters > 0) {
+	l = gensio_list_first(&b->waiters);
+	rfilter = gensio_container_of(l, struct ratelimit_filter, waitlink);
+	gensio_list_rm(&b->waiters, l);
+	b->nr_waiters--;
+	rfilter->waiting = false;
+	rfilter->grant = share;
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    }
+    if (b->nr_waiters > 0)
+	bucket_start_timer(b);
+ out_unlock:
+    b->o->unlock(ratelimit_buckets_lock);
+}
+
+/*
+ * Find or create the named bucket.  rate and burst of zero mean use
+ * what the existing bucket has.
+ */
+static int
+bucket_get(struct gensio_os_funcs *o, const char *name,
+	   gensiods rate, gensiods burst, struct ratelimit_bucket **rb)
+{
+    struct ratelimit_bucket *b = NULL;
+    struct gensio_link *l;
+    int rv = 0;
+
+    o->call_once(o, &ratelimit_buckets_initialized, ratelimit_buckets_init,
+		 o);
+    if (ratelimit_buckets_rv)
+	return ratelimit_buckets_rv;
+
+    o->lock(ratelimit_buckets_lock);
+    gensio_list_for_each(&ratelimit_buckets, l) {
+	b = gensio_container_of(l, struct ratelimit_bucket, link);
+	if (strcmp(b->name, name) == 0)
+	    break;
+	b = NULL;
+    }
+    if (b) {
+	if ((rate && rate != b->rate) || (burst && burst != b->burst)) {
+	    rv = GE_INCONSISTENT;
+	    goto out_unlock;
+	}
+	b->refcount++;
+	goto out_unlock;
+    }
+
+    if (!rate) {
+	rv = GE_INVAL;
+	goto out_unlock;
+    }
+    b = o->zalloc(o, sizeof(*b));
+    if (!b) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    b->o = o;
+    b->refcount = 1;
+    b->rate = rate;
+    b->burst = burst ? burst : rate / 10;
+    if (b->burst < 1)
+	b->burst = 1;
+    b->tokens = b->burst;
+    o->get_monotonic_time(o, &b->last_fill);
+    gensio_list_init(&b->waiters);
+    b->name = gensio_strdup(o, name);
+    if (!b->name)
+	goto out_nomem;
+    b->timer = o->alloc_timer(o, bucket_timeout, b);
+    if (!b->timer)
+	goto out_nomem;
+    gensio_list_add_tail(&ratelimit_buckets, &b->link);
+
+ out_unlock:
+    o->unlock(ratelimit_buckets_lock);
+    if (!rv)
+	*rb = b;
+    return rv;
+
+ out_nomem:
+    o->unlock(ratelimit_buckets_lock);
+    bucket_free(b);
+    return GE_NOMEM;
+}
+
+static void
+bucket_put(struct ratelimit_bucket *b)
+{
+    struct gensio_os_funcs *o = b->o;
+
+    o->lock(ratelimit_buckets_lock);
+    assert(b->refcount > 0);
+    if (--b->refcount > 0) {
+	o->unlock(ratelimit_buckets_lock);
+	return;
+    }
+    gensio_list_rm(&ratelimit_buckets, &b->link);
+    if (b->timer_running && o->stop_timer(b->timer) != 0) {
+	/* The timeout is running, it will free it. */
+	o->unlock(ratelimit_buckets_lock);
+	return;
+    }
+    o->unlock(ratelimit_buckets_lock);
+    bucket_free(b);
+}
+
+static void
+bucket_rm_waiter(struct ratelimit_filter *rfilter)
+{
+    struct ratelimit_bucket *b = rfilter->bucket;
+
+    if (rfilter->waiting) {
+	gensio_list_rm(&b->waiters, &rfilter->waitlink);
+	b->nr_waiters--;
+	rfilter->waiting = false;
+    }
+    rfilter->grant = 0;
+}
+
+/*
+ * Take up to want tokens from the bucket, return how many were
+ * taken.  If none were, the filter is put on the wait list.  Writers
+ * can't pass those already waiting.
+ */
+static gensiods
+bucket_take(struct ratelimit_filter *rfilter, gensiods want)
+{
+    struct ratelimit_bucket *b = rfilter->bucket;
+    gensiods count = 0;
+
+    b->o->lock(ratelimit_buckets_lock);
+    if (rfilter->waiting)
+	goto out_unlock;
+    bucket_fill(b);
+    if (rfilter->grant) {
+	if (want > rfilter->grant)
+	    want = rfilter->grant;
+	rfilter->grant = 0;
+    } else if (b->nr_waiters) {
+	want = 0;
+    }
+    count = want;
+    if (count > b->tokens)
+	count = b->tokens;
+    b->tokens -= count;
+    if (count == 0) {
+	gensio_list_add_tail(&b->waiters, &rfilter->waitlink);
+	b->nr_waiters++;
+	rfilter->waiting = true;
+	bucket_start_timer(b);
+    }
+ out_unlock:
+    b->o->unlock(ratelimit_buckets_lock);
+    return count;
+}
+
+/* Give back tokens that were taken but not written. */
+static void
+bucket_return(struct ratelimit_filter *rfilter, gensiods count)
+{
+    struct ratelimit_bucket *b = rfilter->bucket;
+
+    b->o->lock(ratelimit_buckets_lock);
+    b->tokens += count;
+    if (b->tokens > b->burst)
+	b->tokens = b->burst;
+    b->o->unlock(ratelimit_buckets_lock);
+}
+
 static void
 ratelimit_filter_start_timer(struct ratelimit_filter *rfilter)
 {
@@ -76,7 +390,13 @@ ratelimit_ll_write_pending(struct ratelimit_filter *rfilter)
 static bool
 ratelimit_ul_can_write(struct ratelimit_filter *rfilter, bool *rv)
 {
-    *rv = rfilter->xmit_ready;
+    if (rfilter->bucket) {
+	rfilter->o->lock(ratelimit_buckets_lock);
+	*rv = rfilter->xmit_ready && !rfilter->waiting;
+	rfilter->o->unlock(ratelimit_buckets_lock);
+    } else {
+	*rv = rfilter->xmit_ready;
+    }
     return 0;
 }
 
@@ -114,28 +434,47 @@ ratelimit_ul_write(struct ratelimit_filter *rfilter,
 		   const struct gensio_sg *sg, gensiods sglen,
 		   const char *const *auxdata)
 {
-    gensiods i, count = 0;
-    struct gensio_sg xsg;
+    gensiods i, count = 0, maxlen = rfilter->xmit_max, taken = 0;
+    struct gensio_sg xsg[RATELIMIT_MAX_SG];
     int err = 0;
 
     ratelimit_lock(rfilter);
     if (!rfilter->xmit_ready)
 	goto out;
-    for (i = 0; i < sglen && count < rfilter->xmit_buf_len; i++) {
+    if (rfilter->bucket) {
+	gensiods total = 0;
+
+	for (i = 0; i < sglen; i++)
+	    total += sg[i].buflen;
+	if (total < maxlen)
+	    maxlen = total;
+	if (maxlen == 0)
+	    goto out;
+	maxlen = bucket_take(rfilter, maxlen);
+	if (maxlen == 0)
+	    goto out;
+	taken = maxlen;
+    }
+    /* Pass the user's data through, just trimmed to maxlen. */
+    for (i = 0; i < sglen && i < RATELIMIT_MAX_SG && count < maxlen; i++) {
 	gensiods len = sg[i].buflen;
 
-	if (len > rfilter->xmit_buf_len - count)
-	    len = rfilter->xmit_buf_len - count;
+	if (len > maxlen - count)
+	    len = maxlen - count;
 
-	memcpy(rfilter->xmit_buf + count, sg[i].buf, len);
+	xsg[i].buf = sg[i].buf;
+	xsg[i].buflen = len;
 	count += len;
     }
-    xsg.buf = rfilter->xmit_buf;
-    xsg.buflen = count;
     ratelimit_unlock(rfilter);
-    err = handler(cb_data, &count, &xsg, 1, auxdata);
+    err = handler(cb_data, &count, xsg, i, auxdata);
     ratelimit_lock(rfilter);
-    if (!err && count > 0) {
+    if (rfilter->bucket) {
+	if (err)
+	    count = 0;
+	if (count < taken)
+	    bucket_return(rfilter, taken - count);
+    } else if (!err && count > 0) {
 	rfilter->xmit_ready = false;
 	ratelimit_filter_start_timer(rfilter);
     }
@@ -165,6 +504,11 @@ ratelimit_setup(struct ratelimit_filter *rfilter)
 static void
 ratelimit_filter_cleanup(struct ratelimit_filter *rfilter)
 {
+    if (rfilter->bucket) {
+	rfilter->o->lock(ratelimit_buckets_lock);
+	bucket_rm_waiter(rfilter);
+	rfilter->o->unlock(ratelimit_buckets_lock);
+    }
 }
 
 static void
@@ -172,10 +516,14 @@ ratelimit_free(struct ratelimit_filter *rfilter)
 {
     struct gensio_os_funcs *o = rfilter->o;
 
+    if (rfilter->bucket) {
+	o->lock(ratelimit_buckets_lock);
+	bucket_rm_waiter(rfilter);
+	o->unlock(ratelimit_buckets_lock);
+	bucket_put(rfilter->bucket);
+    }
     if (rfilter->lock)
 	o->free_lock(rfilter->lock);
-    if (rfilter->xmit_buf)
-	o->free(o, rfilter->xmit_buf);
     if (rfilter->filter)
 	gensio_filter_free_data(rfilter->filter);
     o->free(o, rfilter);
@@ -257,21 +605,22 @@ static int gensio_ratelimit_filter_func(struct gensio_filter *filter, int op,
 static struct gensio_filter *
 gensio_ratelimit_filter_raw_alloc(struct gensio_os_funcs *o,
 				  gensiods xmit_size,
-				  struct gensio_time xmit_delay)
+				  struct gensio_time xmit_delay,
+				  struct ratelimit_bucket *bucket)
 {
     struct ratelimit_filter *rfilter;
 
     rfilter = o->zalloc(o, sizeof(*rfilter));
-    if (!rfilter)
+    if (!rfilter) {
+	if (bucket)
+	    bucket_put(bucket);
 	return NULL;
+    }
 
     rfilter->o = o;
-    rfilter->xmit_buf_len = xmit_size;
+    rfilter->xmit_max = xmit_size;
     rfilter->delay = xmit_delay;
-
-    rfilter->xmit_buf = o->zalloc(o, xmit_size);
-    if (!rfilter->xmit_buf)
-	goto out_nomem;
+    rfilter->bucket = bucket;
 
     rfilter->lock = o->alloc_lock(o);
     if (!rfilter->lock)
@@ -296,21 +645,42 @@ gensio_ratelimit_filter_alloc(struct gensio_os_funcs *o,
 {
     struct gensio_filter *filter;
     unsigned int i;
-    gensiods xmit_len = 1;
+    gensiods xmit_len = 0;
     struct gensio_time xmit_delay = { 0, 0 };
+    const char *bucket_name = NULL;
+    gensiods bucket_rate = 0, bucket_burst = 0;
+    struct ratelimit_bucket *bucket = NULL;
+    int rv;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "xmit_len", &xmit_len) > 0)
 	    continue;
 	if (gensio_check_keytime(args[i], "xmit_delay", 0, &xmit_delay) > 0)
 	    continue;
+	if (gensio_check_keyvalue(args[i], "bucket", &bucket_name) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "bucket_rate", &bucket_rate) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "bucket_burst", &bucket_burst) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
-    if (xmit_delay.secs == 0 && xmit_delay.nsecs == 0)
-	return GE_INVAL;
+    if (bucket_name) {
+	if (xmit_len == 0)
+	    xmit_len = RATELIMIT_BUCKET_XMIT_LEN;
+	rv = bucket_get(o, bucket_name, bucket_rate, bucket_burst, &bucket);
+	if (rv)
+	    return rv;
+    } else {
+	if (xmit_len == 0)
+	    xmit_len = 1;
+	if (xmit_delay.secs == 0 && xmit_delay.nsecs == 0)
+	    return GE_INVAL;
+    }
 
-    filter = gensio_ratelimit_filter_raw_alloc(o, xmit_len, xmit_delay);
+    filter = gensio_ratelimit_filter_raw_alloc(o, xmit_len, xmit_delay,
+					       bucket);
     if (!filter)
 	return GE_NOMEM;
 
@@ -11,6 +11,7 @@
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_time.h>
 
 #include "gensio_filter_relpkt.h"
 #if 0
@@ -23,6 +24,46 @@ unsigned int curr_drop;
 #endif
 #include "utils.h"
 
+/*
+ * Version 0 of the protocol has 8-bit sequence numbers.  Version 1
+ * has 16-bit sequence numbers, a 16-bit receive window in the init
+ * message, and uses selective acks instead of resend requests.
+ * Version 2 adds forward error correction messages.  The lower of the
+ * two ends' versions is used.
+ */
+#define RELPKT_PROTOCOL_VERSION	2
+
+/* Largest data header, the version 1 one. */
+#define RELPKT_MAX_HDR		5
+
+/*
+ * The window can't be more than half the sequence space, or old
+ * packets can't be told from new ones.
+ */
+#define RELPKT_V0_MAX_WINDOW	127
+#define RELPKT_V1_MAX_WINDOW	32767
+
+/* Max bitmap bytes in a selective ack, covers 512 packets. */
+#define RELPKT_MAX_SACK_BYTES	64
+
+/*
+ * Retransmit timeout limits, in microseconds.  The timeout starts at
+ * a second and follows the measured round trip time (RFC 6298).
+ */
+#define RELPKT_INIT_RTO		1000000
+#define RELPKT_MIN_RTO		200000
+#define RELPKT_MAX_RTO		60000000
+
+/* Congestion window at start and after a timeout, in packets. */
+#define RELPKT_INIT_CWND	4
+
+/* Limits on the number of data packets covered by a parity packet. */
+#define RELPKT_FEC_MIN_BLOCK	2
+#define RELPKT_FEC_MAX_BLOCK	16
+
+/* Blocks without a loss before adaptive FEC sends less parity. */
+#define RELPKT_FEC_GROW_BLOCKS	8
+
 enum relpkt_msgs {
     /*
      * Request a connection be established.
@@ -34,6 +75,13 @@ enum relpkt_msgs {
      * | pktlen msb     |    pktlen lsb  |
      * +----------------+----------------+
      * A - response bit, 1 if a response, 0 if not.
+     *
+     * Version 1 and later adds the following.  The 8-bit recv window
+     * above is set to the window limited to 127.
+     *
+     * +----------------+----------------+
+     * | recv window msb| recv window lsb|
+     * +----------------+----------------+
      */
     RELPKT_MSG_INIT = 1,
 
@@ -45,6 +93,12 @@ enum relpkt_msgs {
      * |   2   |reserv|A| next expected  |  msg seq       |
      * +----------------+----------------+----------------+
      * A - eom bit, if 1 end of message, if 0 not.
+     *
+     * In version 1 the sequence numbers are 16 bits, msb first.
+     *
+     * +----------------+--------+-------+--------+-------+--------+
+     * |   2   |reserv|A| next expected          |  msg seq       |
+     * +----------------+--------+-------+--------+-------+--------+
      */
     RELPKT_MSG_DATA = 2,
 
@@ -52,6 +106,7 @@ enum relpkt_msgs {
      * Request resending data from starting at the first sequence
      * number up to and including the last sequence number.
      * Data after the header is more resend requests in pairs.
+     * Version 0 only.
      *
      * +----------------+----------------+----------------+
      * |   3   |reserved|first seq resend|last seq resend |
@@ -66,7 +121,35 @@ enum relpkt_msgs {
      * |   4   |reserved|   error msb    |   error lsb    |
      * +----------------+----------------+----------------+
      */
-    RELPKT_MSG_CLOSE = 4
+    RELPKT_MSG_CLOSE = 4,
+
+    /*
+     * Selective ack, version 1 and later.  This acks everything
+     * before next expected, like a data message.  Bit n of the
+     * bitmap (byte n / 8, bit n % 8 with bit 0 the lsb) is set if
+     * packet next expected + n has been received.  The sender
+     * resends packets in holes before the last set bit.
+     *
+     * +----------------+--------+-------+--------+-------+
+     * |   5   |reserved| next expected  |  bitmap ...    |
+     * +----------------+--------+-------+--------+-------+
+     */
+    RELPKT_MSG_SACK = 5,
+
+    /*
+     * Forward error correction, version 2 and later.  This is sent
+     * after count data packets starting at first seq were sent for
+     * the first time.  The data is the xor of the data of all those
+     * packets, shorter ones padded with zeros.  Length is the xor of
+     * their lengths and E is the xor of their eom bits.  If only one
+     * of the packets is lost, the receiver can rebuild it from the
+     * others and this.  It is not acked or resent.
+     *
+     * +----------------+--------+-------+--------+-------+
+     * |   6   |count-1 | first seq      |E| length       |
+     * +----------------+--------+-------+--------+-------+
+     */
+    RELPKT_MSG_FEC = 6
 };
 
 enum relpkt_state {
@@ -243,14 +326,48 @@ struct pkt {
 
     uint16_t start; /* For partial acceptance by user */
 
+    uint16_t seq;
+
     bool sent; /* If true, packet does not need to be sent. */
 
+    bool sacked; /* Remote end has it, never resend. */
+    bool resent; /* Resent for a selective ack hole already. */
+
+    /* Receive packet has data for seq, even after delivery. */
+    bool valid;
+
+    /* Times sent and when last sent, for round trip measurement. */
+    unsigned int xmit_count;
+    gensio_time sent_time;
+
     bool ready; /* If true, packet is ready to deliver to the user. */
     bool eom; /* If true, report end of message. */
 
     unsigned char *data;
 };
 
+struct relpkt_filter;
+
+/*
+ * A congestion controller.  It sets cwnd, the number of packets past
+ * the last acked one that may be sent.
+ */
+struct relpkt_cc {
+    const char *name;
+
+    /* Connection is open, max_xmitpkt is known. */
+    void (*init)(struct relpkt_filter *rfilter);
+
+    /* nr packets were newly acked. */
+    void (*acked)(struct relpkt_filter *rfilter, unsigned int nr);
+
+    /* A loss was reported by the remote end, once per window. */
+    void (*lost)(struct relpkt_filter *rfilter);
+
+    /* The retransmit timer went off. */
+    void (*timeout)(struct relpkt_filter *rfilter);
+};
+
 struct relpkt_filter {
     struct gensio_filter *filter;
 
@@ -270,9 +387,18 @@ struct relpkt_filter {
     gensiods max_pktsize;
     unsigned int max_pkt; /* Our set value. */
 
-    uint8_t next_expected_seq; /* Next seq we expect from the remote. */
-    uint8_t next_deliver_seq; /* Next seq we will deliver to the user. */
-    uint8_t deliver_recvpkt; /* Pos in recvpkts of next_deliver_seq. */
+    /* The highest version we offer, normally RELPKT_PROTOCOL_VERSION. */
+    unsigned int max_version;
+
+    /* Negotiated protocol version and the things that depend on it. */
+    unsigned int version;
+    uint16_t seq_mask;
+    unsigned int hdrlen;
+    unsigned int recv_window; /* What we told the remote end. */
+
+    uint16_t next_expected_seq; /* Next seq we expect from the remote. */
+    uint16_t next_deliver_seq; /* Next seq we will deliver to the user. */
+    unsigned int deliver_recvpkt; /* Pos in recvpkts of next_deliver_seq. */
     struct pkt *recvpkts;
 
     /*
@@ -285,29 +411,72 @@ struct relpkt_filter {
 
     unsigned int max_xmit_pktsize;
     unsigned int max_xmitpkt; /* Set from remote end by init packet. */
-    uint8_t next_acked_seq; /* Seq for next packet that is unacked. */
-    uint8_t next_send_seq; /* Seq for next packet we will send. */
-    uint8_t first_xmitpkt; /* Pos in xmitpkts of where next_ack_seq is. */
+    uint16_t next_acked_seq; /* Seq for next packet that is unacked. */
+    uint16_t next_send_seq; /* Seq for next packet we will send. */
+    unsigned int first_xmitpkt; /* Pos in xmitpkts of where next_ack_seq is. */
     struct pkt *xmitpkts;
     unsigned int nr_waiting_xmitpkt; /* nr in xmitpkt unsent */
 
-    char init_pkt[5];
+    unsigned char init_pkt[7];
+    unsigned int init_pkt_len;
     bool send_init_pkt;
     unsigned int init_retry_count;
 
-    char close_pkt[3];
+    unsigned char close_pkt[3];
     bool send_close_pkt;
     unsigned int close_retry_count;
 
-    char ack_pkt[3];
+    unsigned char ack_pkt[RELPKT_MAX_HDR];
     bool send_ack_pkt;
 
-    char resend_pkt[51];
+    unsigned char resend_pkt[51];
     bool send_resend_pkt;
     uint16_t resend_pkt_len;
 
-    uint8_t last_timeout_ack; /* next_acked_seq on the last timeout. */
-    unsigned int timeout_ack_count; /* nr timeouts last_timeout_ack same. */
+    unsigned char sack_pkt[3 + RELPKT_MAX_SACK_BYTES];
+    bool send_sack_pkt;
+
+    /* When the next once a second ack/keepalive check is done. */
+    gensio_time next_tick;
+
+    /*
+     * Round trip estimates and the retransmit timeout, in
+     * microseconds.  rtt is zero until the first measurement.
+     */
+    int64_t srtt;
+    int64_t rttvar;
+    int64_t rto;
+    bool rto_running;
+    gensio_time rto_start; /* When the retransmit timer started. */
+    unsigned long retrans; /* Total packets retransmitted. */
+
+    const struct relpkt_cc *cc;
+    unsigned int cwnd;
+    unsigned int ssthresh;
+    unsigned int cwnd_acked; /* Acks toward the next cwnd increase. */
+    bool in_recovery;
+    uint16_t recover_seq; /* Recovery ends when this is acked. */
+
+    /*
+     * Forward error correction.  A parity packet is sent after every
+     * fec_block data packets, 0 means off.  If fec_adapt is set,
+     * fec_block moves between RELPKT_FEC_MIN_BLOCK and fec_max_block
+     * depending on losses.
+     */
+    unsigned int fec_max_block;
+    unsigned int fec_block;
+    bool fec_adapt;
+    uint16_t fec_first; /* First seq in the current block. */
+    unsigned int fec_count; /* Data packets in the current block. */
+    uint16_t fec_len; /* xor of lengths, eom xor in the top bit. */
+    unsigned int fec_maxlen;
+    unsigned char *fec_data; /* Parity being accumulated. */
+    unsigned long fec_last_retrans; /* retrans at the last block end. */
+    unsigned int fec_clean_blocks; /* Blocks in a row with no loss. */
+    unsigned char *fec_pkt;
+    unsigned int fec_pkt_len;
+    bool send_fec_pkt;
+    unsigned long fec_recovered; /* Packets rebuilt from parity. */
 };
 
 #define filter_to_relpkt(v) ((struct relpkt_filter *) \
@@ -328,75 +497,330 @@ relpkt_unlock(struct relpkt_filter *rfilter)
     rfilter->o->unlock(rfilter->lock);
 }
 
+static uint16_t
+seq_add(struct relpkt_filter *rfilter, uint16_t seq, unsigned int n)
+{
+    return (seq + n) & rfilter->seq_mask;
+}
+
+/* Returns a - b in sequence space. */
+static unsigned int
+seq_diff(struct relpkt_filter *rfilter, uint16_t a, uint16_t b)
+{
+    return (uint16_t) (a - b) & rfilter->seq_mask;
+}
+
 /*
  * Returns true if seq >= first and seq < next, taking into account
  * wrapping.  If first == next, this will always return false.
  */
 static bool
-seq_inside(uint8_t seq, uint8_t first, uint8_t next)
+seq_inside(struct relpkt_filter *rfilter,
+	   uint16_t seq, uint16_t first, uint16_t next)
 {
-    if (first <= next)
-	/* not wrapped */
-	return seq >= first && seq < next;
-    else
-	/* wrapped */
-	return seq >= first || seq < next;
+    return seq_diff(rfilter, seq, first) < seq_diff(rfilter, next, first);
 }
 
-static uint8_t
-recvpkt_pos(struct relpkt_filter *rfilter, uint8_t pos)
+static unsigned int
+recvpkt_pos(struct relpkt_filter *rfilter, unsigned int pos)
 {
     return (rfilter->deliver_recvpkt + pos) % rfilter->max_pkt;
 }
 
-static uint8_t
-xmitpkt_pos(struct relpkt_filter *rfilter, uint8_t pos)
+static unsigned int
+xmitpkt_pos(struct relpkt_filter *rfilter, unsigned int pos)
 {
     return (rfilter->first_xmitpkt + pos) % rfilter->max_xmitpkt;
 }
 
+/*
+ * Additive increase, multiplicative decrease, like TCP Reno.  The
+ * window grows by a packet per ack until ssthresh, then a packet per
+ * window.  It is halved on a loss and goes to one on a timeout.
+ */
+static void
+aimd_init(struct relpkt_filter *rfilter)
+{
+    rfilter->cwnd = RELPKT_INIT_CWND;
+    rfilter->ssthresh = rfilter->max_xmitpkt;
+}
+
+static void
+aimd_acked(struct relpkt_filter *rfilter, unsigned int nr)
+{
+    if (rfilter->cwnd < rfilter->ssthresh) {
+	rfilter->cwnd += nr;
+    } else {
+	rfilter->cwnd_acked += nr;
+	if (rfilter->cwnd_acked >= rfilter->cwnd) {
+	    rfilter->cwnd_acked -= rfilter->cwnd;
+	    rfilter->cwnd++;
+	}
+    }
+}
+
+static void
+aimd_lost(struct relpkt_filter *rfilter)
+{
+    rfilter->ssthresh = rfilter->cwnd / 2;
+    if (rfilter->ssthresh < 2)
+	rfilter->ssthresh = 2;
+    rfilter->cwnd = rfilter->ssthresh;
+    rfilter->cwnd_acked = 0;
+}
+
+static void
+aimd_timeout(struct relpkt_filter *rfilter)
+{
+    aimd_lost(rfilter);
+    rfilter->cwnd = 1;
+}
+
+/* No congestion control, the remote end's window is the limit. */
+static void
+none_init(struct relpkt_filter *rfilter)
+{
+    rfilter->cwnd = rfilter->max_xmitpkt;
+}
+
+static void
+none_acked(struct relpkt_filter *rfilter, unsigned int nr)
+{
+}
+
+static void
+none_lost(struct relpkt_filter *rfilter)
+{
+}
+
+static const struct relpkt_cc relpkt_ccs[] = {
+    { "aimd", aimd_init, aimd_acked, aimd_lost, aimd_timeout },
+    { "none", none_init, none_acked, none_lost, none_lost },
+    { NULL }
+};
+
 static void
-resend_packets(struct relpkt_filter *rfilter, uint8_t first, uint8_t last)
+relpkt_cc_acked(struct relpkt_filter *rfilter, unsigned int nr)
 {
-    uint8_t seq;
+    unsigned int diff;
+
+    if (rfilter->in_recovery) {
+	/* Recovery ends when everything sent before the loss is acked. */
+	diff = seq_diff(rfilter, rfilter->recover_seq,
+			rfilter->next_acked_seq);
+	if (diff == 0 || diff > rfilter->max_xmitpkt)
+	    rfilter->in_recovery = false;
+	else
+	    return;
+    }
+    rfilter->cc->acked(rfilter, nr);
+    if (rfilter->cwnd > rfilter->max_xmitpkt)
+	rfilter->cwnd = rfilter->max_xmitpkt;
+}
+
+static void
+relpkt_cc_lost(struct relpkt_filter *rfilter)
+{
+    if (rfilter->in_recovery)
+	return;
+    rfilter->in_recovery = true;
+    rfilter->recover_seq = rfilter->next_send_seq;
+    rfilter->cc->lost(rfilter);
+}
+
+/* Take a round trip sample in microseconds. */
+static void
+relpkt_rtt_sample(struct relpkt_filter *rfilter, int64_t rtt)
+{
+    int64_t err;
+
+    if (rfilter->srtt == 0) {
+	rfilter->srtt = rtt;
+	rfilter->rttvar = rtt / 2;
+    } else {
+	err = rfilter->srtt - rtt;
+	if (err < 0)
+	    err = -err;
+	rfilter->rttvar = (3 * rfilter->rttvar + err) / 4;
+	rfilter->srtt = (7 * rfilter->srtt + rtt) / 8;
+    }
+    rfilter->rto = rfilter->srtt + 4 * rfilter->rttvar;
+    if (rfilter->rto < RELPKT_MIN_RTO)
+	rfilter->rto = RELPKT_MIN_RTO;
+    if (rfilter->rto > RELPKT_MAX_RTO)
+	rfilter->rto = RELPKT_MAX_RTO;
+}
+
+static void
+set_version(struct relpkt_filter *rfilter, unsigned int version)
+{
+    rfilter->version = version;
+    if (version == 0) {
+	rfilter->seq_mask = 0xff;
+	rfilter->hdrlen = 3;
+	rfilter->recv_window = rfilter->max_pkt;
+	if (rfilter->recv_window > RELPKT_V0_MAX_WINDOW)
+	    rfilter->recv_window = RELPKT_V0_MAX_WINDOW;
+    } else {
+	rfilter->seq_mask = 0xffff;
+	rfilter->hdrlen = RELPKT_MAX_HDR;
+	rfilter->recv_window = rfilter->max_pkt;
+    }
+}
+
+/* Resend unacked packets from first up to but not including last. */
+static void
+resend_packets(struct relpkt_filter *rfilter, uint16_t first, uint16_t last)
+{
+    uint16_t seq;
     unsigned int i, pos;
 
-    for (seq = first, i = first - rfilter->next_acked_seq; seq != last; i++) {
+    i = seq_diff(rfilter, first, rfilter->next_acked_seq);
+    for (seq = first; seq != last; i++) {
+	struct pkt *p;
+
 	pos = xmitpkt_pos(rfilter, i);
-	if (rfilter->xmitpkts[pos].sent) {
-	    rfilter->xmitpkts[pos].sent = false;
+	p = &rfilter->xmitpkts[pos];
+	p->resent = false;
+	if (p->sent && !p->sacked) {
+	    p->sent = false;
 	    rfilter->nr_waiting_xmitpkt++;
 	}
-	seq++;
+	seq = seq_add(rfilter, seq, 1);
     }
 }
 
+/*
+ * Find the first packet that needs to be sent and that the congestion
+ * window allows.  Returns NULL if there is none.
+ */
 static struct pkt *
 first_xmitpkt_to_send(struct relpkt_filter *rfilter)
 {
-    uint8_t seq = rfilter->next_acked_seq;
+    uint16_t seq = rfilter->next_acked_seq;
     unsigned int i, pos;
 
-    for (i = 0; seq != rfilter->next_send_seq; i++, seq++) {
+    if (!rfilter->nr_waiting_xmitpkt)
+	return NULL;
+    for (i = 0; seq != rfilter->next_send_seq && i < rfilter->cwnd;
+	 i++, seq = seq_add(rfilter, seq, 1)) {
 	pos = xmitpkt_pos(rfilter, i);
 	if (!rfilter->xmitpkts[pos].sent)
 	    return &(rfilter->xmitpkts[pos]);
     }
-    assert(0);
     return NULL;
 }
 
+/*
+ * A data packet is being sent for the first time, add it to the
+ * parity block and send the parity packet if the block is full.
+ */
+static void
+fec_add_pkt(struct relpkt_filter *rfilter, struct pkt *p)
+{
+    unsigned int i;
+    unsigned char *data = p->data + RELPKT_MAX_HDR;
+
+    if (rfilter->version < 2 || !rfilter->fec_block)
+	return;
+
+    if (rfilter->fec_count &&
+		p->seq != seq_add(rfilter, rfilter->fec_first,
+				  rfilter->fec_count))
+	/* Not the next one, shouldn't happen, but start over. */
+	rfilter->fec_count = 0;
+    if (rfilter->fec_count == 0) {
+	rfilter->fec_first = p->seq;
+	rfilter->fec_len = 0;
+	rfilter->fec_maxlen = 0;
+	memset(rfilter->fec_data, 0, rfilter->max_xmit_pktsize);
+    }
+    for (i = 0; i < p->len; i++)
+	rfilter->fec_data[i] ^= data[i];
+    rfilter->fec_len ^= p->len | (p->eom << 15);
+    if (p->len > rfilter->fec_maxlen)
+	rfilter->fec_maxlen = p->len;
+    rfilter->fec_count++;
+    if (rfilter->fec_count < rfilter->fec_block)
+	return;
+
+    rfilter->fec_pkt[0] = (RELPKT_MSG_FEC << 4) | (rfilter->fec_count - 1);
+    gensio_u16_to_buf(rfilter->fec_pkt + 1, rfilter->fec_first);
+    gensio_u16_to_buf(rfilter->fec_pkt + 3, rfilter->fec_len);
+    memcpy(rfilter->fec_pkt + 5, rfilter->fec_data, rfilter->fec_maxlen);
+    rfilter->fec_pkt_len = rfilter->fec_maxlen + 5;
+    rfilter->send_fec_pkt = true;
+    rfilter->fec_count = 0;
+
+    if (!rfilter->fec_adapt)
+	return;
+    /* Send more parity if packets were lost, less if not. */
+    if (rfilter->retrans != rfilter->fec_last_retrans) {
+	rfilter->fec_last_retrans = rfilter->retrans;
+	rfilter->fec_clean_blocks = 0;
+	if (rfilter->fec_block > RELPKT_FEC_MIN_BLOCK)
+	    rfilter->fec_block--;
+    } else if (++rfilter->fec_clean_blocks >= RELPKT_FEC_GROW_BLOCKS) {
+	rfilter->fec_clean_blocks = 0;
+	if (rfilter->fec_block < rfilter->fec_max_block)
+	    rfilter->fec_block++;
+    }
+}
+
 static void
 send_init(struct relpkt_filter *rfilter, bool response)
 {
+    unsigned int v0_window = rfilter->max_pkt;
+
+    if (v0_window > RELPKT_V0_MAX_WINDOW)
+	v0_window = RELPKT_V0_MAX_WINDOW;
     rfilter->init_pkt[0] = (RELPKT_MSG_INIT << 4) | (uint8_t) response;
-    rfilter->init_pkt[1] = 0; /* version */
-    rfilter->init_pkt[2] = rfilter->max_pkt;
+    rfilter->init_pkt[1] = rfilter->max_version;
+    rfilter->init_pkt[2] = v0_window;
     rfilter->init_pkt[3] = rfilter->max_pktsize >> 8;
     rfilter->init_pkt[4] = rfilter->max_pktsize & 0xff;
+    if (rfilter->max_version == 0) {
+	/* Version 0 has no 16-bit window. */
+	rfilter->init_pkt_len = 5;
+    } else {
+	gensio_u16_to_buf(rfilter->init_pkt + 5, rfilter->max_pkt);
+	rfilter->init_pkt_len = 7;
+    }
     rfilter->send_init_pkt = true;
 }
 
+/*
+ * Handle the parameters in an init message from the remote end.
+ * Returns an error string on a protocol error.
+ */
+static const char *
+handle_init(struct relpkt_filter *rfilter, unsigned char *buf, gensiods buflen)
+{
+    unsigned int version = buf[1], max_window;
+
+    if (version > rfilter->max_version)
+	version = rfilter->max_version;
+    set_version(rfilter, version);
+
+    if (version > 0 && buflen >= 7) {
+	rfilter->max_xmitpkt = gensio_buf_to_u16(buf + 5);
+	max_window = RELPKT_V1_MAX_WINDOW;
+    } else {
+	rfilter->max_xmitpkt = buf[2];
+	max_window = RELPKT_V0_MAX_WINDOW;
+    }
+    if (rfilter->max_xmitpkt == 0)
+	return "rfilter->max_xmitpkt == 0";
+    if (rfilter->max_xmitpkt > rfilter->max_pkt)
+	rfilter->max_xmitpkt = rfilter->max_pkt;
+    if (rfilter->max_xmitpkt > max_window)
+	rfilter->max_xmitpkt = max_window;
+    rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
+    if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
+	rfilter->max_xmit_pktsize = rfilter->max_pktsize;
+    return NULL;
+}
+
 static void
 send_close(struct relpkt_filter *rfilter)
 {
@@ -410,13 +834,49 @@ static void
 send_ack(struct relpkt_filter *rfilter)
 {
     rfilter->ack_pkt[0] = RELPKT_MSG_DATA << 4;
-    /* seq will be filled in at send time. */
-    rfilter->ack_pkt[2] = 0;
+    /* ack will be filled in at send time, seq is ignored. */
+    memset(rfilter->ack_pkt + 1, 0, sizeof(rfilter->ack_pkt) - 1);
     rfilter->send_ack_pkt = true;
 }
 
+/* Is there a missing packet before the last one received? */
+static bool
+recv_has_gap(struct relpkt_filter *rfilter)
+{
+    unsigned int i, n;
+
+    n = seq_diff(rfilter, rfilter->next_expected_seq,
+		 rfilter->next_deliver_seq);
+    for (i = 0; i < n; i++) {
+	if (!rfilter->recvpkts[recvpkt_pos(rfilter, i)].ready)
+	    return true;
+    }
+    return false;
+}
+
+/* Fill in the selective ack, returns its length. */
+static unsigned int
+setup_sack(struct relpkt_filter *rfilter)
+{
+    unsigned int i, n, len;
+
+    n = seq_diff(rfilter, rfilter->next_expected_seq,
+		 rfilter->next_deliver_seq);
+    if (n > RELPKT_MAX_SACK_BYTES * 8)
+	n = RELPKT_MAX_SACK_BYTES * 8;
+    len = (n + 7) / 8;
+    rfilter->sack_pkt[0] = RELPKT_MSG_SACK << 4;
+    gensio_u16_to_buf(rfilter->sack_pkt + 1, rfilter->next_deliver_seq);
+    memset(rfilter->sack_pkt + 3, 0, len);
+    for (i = 0; i < n; i++) {
+	if (rfilter->recvpkts[recvpkt_pos(rfilter, i)].ready)
+	    rfilter->sack_pkt[3 + i / 8] |= 1 << (i % 8);
+    }
+    return len + 3;
+}
+
 static void
-request_resend(struct relpkt_filter *rfilter, uint8_t first, uint8_t last)
+request_resend(struct relpkt_filter *rfilter, uint16_t first, uint16_t last)
 {
     if (!rfilter->send_resend_pkt) {
 	rfilter->resend_pkt_len = 1;
@@ -427,21 +887,160 @@ request_resend(struct relpkt_filter *rfilter, uint8_t first, uint8_t last)
 	return; /* No space left, let transmit timeout get it. */
     rfilter->resend_pkt[rfilter->resend_pkt_len++] = first;
     rfilter->resend_pkt[rfilter->resend_pkt_len++] = last;
-    rfilter->timeout_ack_count = 0;
 }
 
-/* Returns true on a protocol error. */
+/*
+ * The resend packet may sit queued while we deliver data, and the
+ * acks we send in the meantime may cover part of what it asks for.
+ * Trim the ranges against what we have delivered so the remote end
+ * never sees a request for something it has already seen acked.
+ * Returns false if nothing is left to send.
+ */
 static bool
-handle_ack(struct relpkt_filter *rfilter, uint8_t seq)
+trim_resend_pkt(struct relpkt_filter *rfilter)
+{
+    unsigned int i, len = 1;
+    uint16_t first, last;
+
+    for (i = 1; i + 1 < rfilter->resend_pkt_len; i += 2) {
+	first = rfilter->resend_pkt[i];
+	last = rfilter->resend_pkt[i + 1];
+	if (!seq_inside(rfilter, last, rfilter->next_deliver_seq,
+			rfilter->next_expected_seq))
+	    continue;
+	if (!seq_inside(rfilter, first, rfilter->next_deliver_seq,
+			rfilter->next_expected_seq))
+	    first = rfilter->next_deliver_seq;
+	rfilter->resend_pkt[len++] = first;
+	rfilter->resend_pkt[len++] = last;
+    }
+    rfilter->resend_pkt_len = len;
+    if (len == 1)
+	rfilter->send_resend_pkt = false;
+    return len > 1;
+}
+
+/*
+ * Packet seq is in the receive window and its data is in place, mark
+ * it received.
+ */
+static void
+recv_pkt_done(struct relpkt_filter *rfilter, uint16_t seq, struct pkt *p)
+{
+    if (seq == rfilter->next_expected_seq) {
+	rfilter->next_expected_seq = seq_add(rfilter, seq, 1);
+    } else if (!seq_inside(rfilter, seq, rfilter->next_deliver_seq,
+			   rfilter->next_expected_seq)) {
+	if (rfilter->version == 0)
+	    request_resend(rfilter, rfilter->next_expected_seq,
+			   seq_add(rfilter, seq, rfilter->seq_mask));
+	else
+	    rfilter->send_sack_pkt = true;
+	rfilter->next_expected_seq = seq_add(rfilter, seq, 1);
+    }
+    p->seq = seq;
+    p->start = 0;
+    p->ready = true;
+    p->valid = true;
+}
+
+/*
+ * Find the receive packet holding seq, delivered or not.  Returns
+ * NULL if it's not there.  *missing is set if seq is in the receive
+ * window but not received yet.
+ */
+static struct pkt *
+fec_find_recvpkt(struct relpkt_filter *rfilter, uint16_t seq, bool *missing)
 {
     unsigned int pos;
+    struct pkt *p;
+
+    *missing = false;
+    pos = seq_diff(rfilter, seq, rfilter->next_deliver_seq);
+    if (pos < rfilter->recv_window) {
+	p = &rfilter->recvpkts[recvpkt_pos(rfilter, pos)];
+	if (p->ready)
+	    return p;
+	*missing = true;
+	return p;
+    }
+    /* Maybe delivered already, the data is there until reused. */
+    pos = seq_diff(rfilter, rfilter->next_deliver_seq, seq);
+    if (pos > rfilter->max_pkt)
+	return NULL;
+    p = &rfilter->recvpkts[(rfilter->deliver_recvpkt + rfilter->max_pkt - pos)
+			   % rfilter->max_pkt];
+    if (p->valid && p->seq == seq)
+	return p;
+    return NULL;
+}
+
+/*
+ * A parity packet came in, if exactly one of the packets it covers is
+ * missing, rebuild it.
+ */
+static void
+handle_fec(struct relpkt_filter *rfilter, unsigned char *buf,
+	   gensiods buflen)
+{
+    unsigned int count = (buf[0] & 0xf) + 1, i, j, len;
+    uint16_t first = gensio_buf_to_u16(buf + 1);
+    uint16_t xlen = gensio_buf_to_u16(buf + 3);
+    uint16_t seq, lost_seq = 0;
+    struct pkt *p, *lost = NULL;
+    bool missing;
+
+    buf += 5;
+    buflen -= 5;
+    for (i = 0; i < count; i++) {
+	seq = seq_add(rfilter, first, i);
+	p = fec_find_recvpkt(rfilter, seq, &missing);
+	if (!p)
+	    return; /* Can't rebuild without all the others. */
+	if (missing) {
+	    if (lost)
+		return; /* Two lost, let a resend handle it. */
+	    lost = p;
+	    lost_seq = seq;
+	} else {
+	    xlen ^= p->len | (p->eom << 15);
+	}
+    }
+    if (!lost)
+	return;
+
+    len = xlen & 0x7fff;
+    if (len > buflen || len > rfilter->max_pktsize)
+	return; /* Bogus, just ignore it. */
+    memcpy(lost->data, buf, len);
+    for (i = 0; i < count; i++) {
+	seq = seq_add(rfilter, first, i);
+	if (seq == lost_seq)
+	    continue;
+	p = fec_find_recvpkt(rfilter, seq, &missing);
+	for (j = 0; j < p->len && j < len; j++)
+	    lost->data[j] ^= p->data[j];
+    }
+    lost->len = len;
+    lost->eom = !!(xlen & 0x8000);
+    recv_pkt_done(rfilter, lost_seq, lost);
+    rfilter->fec_recovered++;
+}
+
+/* Returns true on a protocol error. */
+static bool
+handle_ack(struct relpkt_filter *rfilter, uint16_t seq)
+{
+    unsigned int pos, nr = 0;
+    struct pkt *last = NULL;
+    gensio_time now;
 
     /*
      * The last received message on the other end is in seq, but we
      * keep the next thing that should be acked, thus the +1.
      */
-    if (!seq_inside(seq, rfilter->next_acked_seq,
-		    rfilter->next_send_seq + 1))
+    if (!seq_inside(rfilter, seq, rfilter->next_acked_seq,
+		    seq_add(rfilter, rfilter->next_send_seq, 1)))
 	return true;
     while (rfilter->next_acked_seq != seq) {
 	pos = rfilter->first_xmitpkt;
@@ -455,23 +1054,116 @@ handle_ack(struct relpkt_filter *rfilter, uint8_t seq)
 	    assert(rfilter->nr_waiting_xmitpkt > 0);
 	    rfilter->nr_waiting_xmitpkt--;
 	}
+	last = &rfilter->xmitpkts[pos];
 	rfilter->first_xmitpkt = xmitpkt_pos(rfilter, 1);
-	rfilter->next_acked_seq++;
+	rfilter->next_acked_seq = seq_add(rfilter, rfilter->next_acked_seq, 1);
+	nr++;
     }
     rfilter->timeouts_since_ack = 0;
 
+    if (nr) {
+	rfilter->o->get_monotonic_time(rfilter->o, &now);
+	/* Karn's algorithm, a resent packet's ack is ambiguous. */
+	if (last->xmit_count == 1 && !last->sacked)
+	    relpkt_rtt_sample(rfilter,
+			gensio_time_diff_nsecs(&now, &last->sent_time) / 1000);
+	relpkt_cc_acked(rfilter, nr);
+	/* Restart the retransmit timer for the remaining packets. */
+	rfilter->rto_start = now;
+	if (rfilter->next_acked_seq == rfilter->next_send_seq)
+	    rfilter->rto_running = false;
+    }
+
     return false;
 }
 
+/*
+ * Handle a selective ack.  Packets the remote end has are never sent
+ * again, holes before the last one it has are resent once.  Returns
+ * true on a protocol error.
+ */
+static bool
+handle_sack(struct relpkt_filter *rfilter, unsigned char *buf,
+	    gensiods buflen)
+{
+    uint16_t seq = gensio_buf_to_u16(buf + 1);
+    unsigned int i, n, last = 0, nqueued;
+    struct pkt *p;
+
+    if (handle_ack(rfilter, seq))
+	return true;
+
+    buf += 3;
+    n = (buflen - 3) * 8;
+    nqueued = seq_diff(rfilter, rfilter->next_send_seq,
+		       rfilter->next_acked_seq);
+    if (n > nqueued)
+	n = nqueued;
+    for (i = 0; i < n; i++) {
+	if (!(buf[i / 8] & (1 << (i % 8))))
+	    continue;
+	p = &rfilter->xmitpkts[xmitpkt_pos(rfilter, i)];
+	if (!p->sent) {
+	    p->sent = true;
+	    assert(rfilter->nr_waiting_xmitpkt > 0);
+	    rfilter->nr_waiting_xmitpkt--;
+	}
+	p->sacked = true;
+	last = i + 1;
+    }
+    for (i = 0; i < last; i++) {
+	p = &rfilter->xmitpkts[xmitpkt_pos(rfilter, i)];
+	if (p->sacked || p->resent || !p->sent)
+	    continue;
+	p->resent = true;
+	p->sent = false;
+	rfilter->nr_waiting_xmitpkt++;
+	relpkt_cc_lost(rfilter);
+    }
+
+    return false;
+}
+
+/*
+ * Start the timer for the next keepalive tick or retransmit timeout,
+ * whichever comes first.
+ */
 static void
 relpkt_filter_start_timer(struct relpkt_filter *rfilter)
 {
-    gensio_time timeout = { 1, 0 };
+    gensio_time now, timeout;
+    int64_t nsecs, rto_nsecs;
+
+    gensio_os_funcs_get_loop_time(rfilter->o, &now);
+    nsecs = gensio_time_diff_nsecs(&rfilter->next_tick, &now);
+    if (rfilter->rto_running) {
+	rto_nsecs = (gensio_time_diff_nsecs(&rfilter->rto_start, &now) +
+		     rfilter->rto * 1000);
+	if (rto_nsecs < nsecs)
+	    nsecs = rto_nsecs;
+    }
+    if (nsecs < 1000000)
+	nsecs = 1000000;
+    timeout.secs = 0;
+    timeout.nsecs = 0;
+    gensio_time_add_nsecs(&timeout, nsecs);
 
     rfilter->filter_cb(rfilter->filter_cb_data,
 		       GENSIO_FILTER_CB_START_TIMER, &timeout);
 }
 
+/*
+ * Connection is open, start the timers and congestion control.
+ */
+static void
+relpkt_filter_open(struct relpkt_filter *rfilter)
+{
+    gensio_os_funcs_get_loop_time(rfilter->o, &rfilter->next_tick);
+    gensio_time_add_nsecs(&rfilter->next_tick, GENSIO_NSECS_IN_SEC);
+    rfilter->cc->init(rfilter);
+    relpkt_filter_start_timer(rfilter);
+}
+
 static void
 relpkt_set_callbacks(struct relpkt_filter *rfilter,
 		     gensio_filter_cb cb, void *cb_data)
@@ -491,24 +1183,27 @@ relpkt_ul_read_pending(struct relpkt_filter *rfilter)
 static bool
 relpkt_ll_write_pending(struct relpkt_filter *rfilter)
 {
-    return rfilter->nr_waiting_xmitpkt || rfilter->send_init_pkt ||
+    return first_xmitpkt_to_send(rfilter) || rfilter->send_init_pkt ||
 	rfilter->send_close_pkt || rfilter->send_resend_pkt ||
-	rfilter->send_ack_pkt;
+	rfilter->send_ack_pkt || rfilter->send_sack_pkt ||
+	rfilter->send_fec_pkt;
 }
 
-static bool
+static int
 relpkt_ul_can_write(struct relpkt_filter *rfilter, bool *rv)
 {
-    unsigned int nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    unsigned int nrqueued = seq_diff(rfilter, rfilter->next_send_seq,
+				     rfilter->next_acked_seq);
 
     *rv = nrqueued < rfilter->max_xmitpkt;
     return 0;
 }
 
-static bool
+static int
 relpkt_ll_write_queued(struct relpkt_filter *rfilter, bool *rv)
 {
-    unsigned int nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    unsigned int nrqueued = seq_diff(rfilter, rfilter->next_send_seq,
+				     rfilter->next_acked_seq);
 
     *rv = nrqueued > 0;
     return 0;
@@ -693,7 +1388,8 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
     bool finish_close = false;
 
     relpkt_lock(rfilter);
-    nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    nrqueued = seq_diff(rfilter, rfilter->next_send_seq,
+			rfilter->next_acked_seq);
     if (sglen == 0 || nrqueued >= rfilter->max_xmitpkt) {
 	if (rcount)
 	    *rcount = 0;
@@ -713,7 +1409,7 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 		inlen = rfilter->max_xmit_pktsize - p->len;
 		trunc = true;
 	    }
-	    memcpy(p->data + p->len + 3, buf, inlen);
+	    memcpy(p->data + p->len + RELPKT_MAX_HDR, buf, inlen);
 	    writelen += inlen;
 	    p->len += inlen;
 	    if (p->len == rfilter->max_xmit_pktsize)
@@ -723,14 +1419,14 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 	    *rcount = writelen;
 
 	if (writelen > 0) {
-	    if (!trunc && gensio_str_in_auxdata(auxdata, "eom"))
-		p->eom = true;
-	    p->data[0] = (RELPKT_MSG_DATA << 4) | (uint8_t) p->eom;
-	    /* Ack (byte 1) will be filled in on transmit. */
-	    p->data[2] = rfilter->next_send_seq;
-	    rfilter->next_send_seq++;
+	    p->eom = !trunc && gensio_str_in_auxdata(auxdata, "eom");
+	    /* The header will be filled in on transmit. */
+	    p->seq = rfilter->next_send_seq;
+	    rfilter->next_send_seq = seq_add(rfilter, rfilter->next_send_seq, 1);
 	    p->sent = false;
-	    p->len += 3; /* For the header. */
+	    p->sacked = false;
+	    p->resent = false;
+	    p->xmit_count = 0;
 	    rfilter->nr_waiting_xmitpkt++;
 	}
     }
@@ -738,22 +1434,44 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
     p = NULL;
     if (rfilter->send_init_pkt) {
 	rsg.buf = rfilter->init_pkt;
-	rsg.buflen = 5;
+	rsg.buflen = rfilter->init_pkt_len;
 	endbool = &rfilter->send_init_pkt;
-    } else if (rfilter->nr_waiting_xmitpkt) {
-	p = first_xmitpkt_to_send(rfilter);
-	rsg.buf = p->data;
-	rsg.buflen = p->len;
-	p->data[1] = rfilter->next_deliver_seq; /* Add the ack */
+    } else if (rfilter->send_fec_pkt) {
+	rsg.buf = rfilter->fec_pkt;
+	rsg.buflen = rfilter->fec_pkt_len;
+	endbool = &rfilter->send_fec_pkt;
+    } else if ((p = first_xmitpkt_to_send(rfilter))) {
+	unsigned char *hdr;
+
+	hdr = p->data + RELPKT_MAX_HDR - rfilter->hdrlen;
+	hdr[0] = (RELPKT_MSG_DATA << 4) | (uint8_t) p->eom;
+	if (rfilter->version == 0) {
+	    hdr[1] = rfilter->next_deliver_seq; /* Add the ack */
+	    hdr[2] = p->seq;
+	} else {
+	    gensio_u16_to_buf(hdr + 1, rfilter->next_deliver_seq);
+	    gensio_u16_to_buf(hdr + 3, p->seq);
+	}
+	rsg.buf = hdr;
+	rsg.buflen = p->len + rfilter->hdrlen;
 	rfilter->send_ack_pkt = false;
-    } else if (rfilter->send_resend_pkt) {
+    } else if (rfilter->send_resend_pkt && trim_resend_pkt(rfilter)) {
 	rsg.buf = rfilter->resend_pkt;
 	rsg.buflen = rfilter->resend_pkt_len;
 	endbool = &rfilter->send_resend_pkt;
+    } else if (rfilter->send_sack_pkt) {
+	/* Built now so it has the latest state. */
+	rsg.buflen = setup_sack(rfilter);
+	rsg.buf = rfilter->sack_pkt;
+	endbool = &rfilter->send_sack_pkt;
+	rfilter->send_ack_pkt = false;
     } else if (rfilter->send_ack_pkt) {
-	rfilter->ack_pkt[1] = rfilter->next_deliver_seq;
+	if (rfilter->version == 0)
+	    rfilter->ack_pkt[1] = rfilter->next_deliver_seq;
+	else
+	    gensio_u16_to_buf(rfilter->ack_pkt + 1, rfilter->next_deliver_seq);
 	rsg.buf = rfilter->ack_pkt;
-	rsg.buflen = 3;
+	rsg.buflen = rfilter->hdrlen;
 	endbool = &rfilter->send_ack_pkt;
     } else if (rfilter->send_close_pkt) {
 	rsg.buf = rfilter->close_pkt;
@@ -795,6 +1513,23 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 		    assert(rfilter->nr_waiting_xmitpkt);
 		    rfilter->nr_waiting_xmitpkt--;
 		    rfilter->send_since_timeout = true;
+		    rfilter->o->get_monotonic_time(rfilter->o, &p->sent_time);
+		    if (p->xmit_count++ > 0)
+			rfilter->retrans++;
+		    else
+			fec_add_pkt(rfilter, p);
+		    if (!rfilter->rto_running) {
+			rfilter->rto_running = true;
+			rfilter->rto_start = p->sent_time;
+			if (rfilter->state == RELPKT_OPEN &&
+				rfilter->rto * 1000 < GENSIO_NSECS_IN_SEC) {
+			    /* Timer may be a tick away, bring it in. */
+			    rfilter->filter_cb(rfilter->filter_cb_data,
+					       GENSIO_FILTER_CB_STOP_TIMER,
+					       NULL);
+			    relpkt_filter_start_timer(rfilter);
+			}
+		    }
 		} else {
 		    if (endbool)
 			*endbool = false;
@@ -821,8 +1556,8 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
     int err = 0;
     static const char *eomaux[2] = { "eom", NULL };
     bool response;
-    uint8_t seq, endseq, pos, ppos;
-    unsigned int i;
+    uint16_t seq, ack, endseq;
+    unsigned int i, pos, ppos;
     struct pkt *p;
     const char *proto_err_str = NULL;
 
@@ -867,32 +1602,22 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 
 	case RELPKT_WAITING_INIT:
 	    if (!response) {
-		rfilter->max_xmitpkt = buf[2];
-		if (rfilter->max_xmitpkt == 0) {
-		    proto_err_str = "rfilter->max_xmitpkt == 0";
+		proto_err_str = handle_init(rfilter, buf, buflen);
+		if (proto_err_str)
 		    goto protocol_err;
-		}
-		if (rfilter->max_xmitpkt > rfilter->max_pkt)
-		    rfilter->max_xmitpkt = rfilter->max_pkt;
-		rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
-		if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
-		    rfilter->max_xmit_pktsize = rfilter->max_pktsize;
 		send_init(rfilter, true);
 		rfilter->state = RELPKT_OPEN;
-		relpkt_filter_start_timer(rfilter);
+		relpkt_filter_open(rfilter);
 	    }
 	    break;
 
 	case RELPKT_WAITING_INIT_RSP:
 	    if (response) {
-		rfilter->max_xmitpkt = buf[2];
-		if (rfilter->max_xmitpkt > rfilter->max_pkt)
-		    rfilter->max_xmitpkt = rfilter->max_pkt;
-		rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
-		if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
-		    rfilter->max_xmit_pktsize = rfilter->max_pktsize;
+		proto_err_str = handle_init(rfilter, buf, buflen);
+		if (proto_err_str)
+		    goto protocol_err;
 		rfilter->state = RELPKT_OPEN;
-		relpkt_filter_start_timer(rfilter);
+		relpkt_filter_open(rfilter);
 	    }
 	    break;
 
@@ -921,11 +1646,22 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 
 	case RELPKT_OPEN:
 	case RELPKT_WAITING_CLOSE_CLEAR:
-	    if (buflen > rfilter->max_pktsize + 3) {
-		proto_err_str = "buflen > rfilter->max_pktsize + 3";
+	    if (buflen < rfilter->hdrlen) {
+		proto_err_str = "buflen < hdrlen";
+		goto protocol_err;
+	    }
+	    if (buflen > rfilter->max_pktsize + rfilter->hdrlen) {
+		proto_err_str = "buflen > rfilter->max_pktsize + hdrlen";
 		goto protocol_err;
 	    }
-	    if (handle_ack(rfilter, buf[1]))
+	    if (rfilter->version == 0) {
+		ack = buf[1];
+		seq = buf[2];
+	    } else {
+		ack = gensio_buf_to_u16(buf + 1);
+		seq = gensio_buf_to_u16(buf + 3);
+	    }
+	    if (handle_ack(rfilter, ack))
 		goto out_unlock;
 	    if (rfilter->state != RELPKT_OPEN) {
 		/* Only deliver data in open state */
@@ -937,27 +1673,18 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 		}
 		break;
 	    }
-	    if (buflen == 3) /* Just an ack */
+	    if (buflen == rfilter->hdrlen) /* Just an ack */
 		break;
-	    seq = buf[2];
-	    pos = seq - rfilter->next_deliver_seq;
-	    if (seq - rfilter->next_deliver_seq > rfilter->max_pkt)
+	    pos = seq_diff(rfilter, seq, rfilter->next_deliver_seq);
+	    if (pos >= rfilter->recv_window)
 		break; /* Ignore it */
 	    ppos = recvpkt_pos(rfilter, pos);
-	    if (seq == rfilter->next_expected_seq) {
-		rfilter->next_expected_seq++;
-	    } else if (!seq_inside(seq, rfilter->next_deliver_seq,
-				  rfilter->next_expected_seq)) {
-		request_resend(rfilter, rfilter->next_expected_seq, seq - 1);
-		rfilter->next_expected_seq = seq + 1;
-	    }
 	    p = &(rfilter->recvpkts[ppos]);
 	    if (!p->ready) {
-		memcpy(p->data, buf + 3, buflen - 3);
-		p->len = buflen - 3;
-		p->start = 0;
-		p->ready = true;
+		memcpy(p->data, buf + rfilter->hdrlen, buflen - rfilter->hdrlen);
+		p->len = buflen - rfilter->hdrlen;
 		p->eom = buf[0] & 1;
+		recv_pkt_done(rfilter, seq, p);
 	    }
 	    break;
 
@@ -977,6 +1704,10 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	case RELPKT_OPEN:
 	case RELPKT_WAITING_CLOSE_CLEAR:
 	case RELPKT_WAITING_CLOSE_RSP:
+	    if (rfilter->version > 0) {
+		proto_err_str = "resend in version 1";
+		goto protocol_err;
+	    }
 	    buf++;
 	    buflen--;
 	    if (buflen % 2 != 0) { /* Should be pairs of sequence numbers. */
@@ -986,17 +1717,96 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	    for (i = 0; i < buflen; i += 2) {
 		seq = buf[i];
 		endseq = buf[i + 1];
-		if (!seq_inside(seq, rfilter->next_acked_seq,
+		/*
+		 * An ack may overtake a resend request, so parts of
+		 * the request that we have already seen acked are
+		 * stale, not an error.
+		 */
+		if (seq_inside(rfilter, endseq,
+			       seq_add(rfilter, rfilter->next_acked_seq,
+				       rfilter->seq_mask + 1 -
+				       rfilter->max_xmitpkt),
+			       rfilter->next_acked_seq))
+		    continue;
+		if (!seq_inside(rfilter, endseq, rfilter->next_acked_seq,
 				rfilter->next_send_seq)) {
-		    proto_err_str = "seq_inside A";
+		    proto_err_str = "seq_inside B";
 		    goto protocol_err;
 		}
-		if (!seq_inside(endseq, rfilter->next_acked_seq,
+		if (!seq_inside(rfilter, seq, rfilter->next_acked_seq,
 				rfilter->next_send_seq)) {
-		    proto_err_str = "seq_inside B";
-		    goto protocol_err;
+		    if (!seq_inside(rfilter, seq,
+				    seq_add(rfilter, rfilter->next_acked_seq,
+					    rfilter->seq_mask + 1 -
+					    rfilter->max_xmitpkt),
+				    rfilter->next_acked_seq)) {
+			proto_err_str = "seq_inside A";
+			goto protocol_err;
+		    }
+		    seq = rfilter->next_acked_seq;
 		}
-		resend_packets(rfilter, seq, endseq + 1);
+		resend_packets(rfilter, seq, seq_add(rfilter, endseq, 1));
+		relpkt_cc_lost(rfilter);
+	    }
+	    break;
+
+	default:
+	    assert(0);
+	}
+	break;
+
+    case RELPKT_MSG_FEC:
+	switch (rfilter->state) {
+	case RELPKT_CLOSED:
+	case RELPKT_WAITING_INIT:
+	case RELPKT_WAITING_INIT_RSP:
+	case RELPKT_WAITING_CLOSE_RSP:
+	case RELPKT_REMCLOSED:
+	case RELPKT_WAITING_CLOSE_CLEAR:
+	    break;
+
+	case RELPKT_OPEN:
+	    if (rfilter->version < 2) {
+		proto_err_str = "fec before version 2";
+		goto protocol_err;
+	    }
+	    if (buflen < 5 || buflen > rfilter->max_pktsize + 5) {
+		proto_err_str = "bad fec size";
+		goto protocol_err;
+	    }
+	    handle_fec(rfilter, buf, buflen);
+	    break;
+
+	default:
+	    assert(0);
+	}
+	break;
+
+    case RELPKT_MSG_SACK:
+	switch (rfilter->state) {
+	case RELPKT_CLOSED:
+	case RELPKT_WAITING_INIT:
+	case RELPKT_WAITING_INIT_RSP:
+	case RELPKT_WAITING_CLOSE_RSP:
+	case RELPKT_REMCLOSED:
+	    break;
+
+	case RELPKT_OPEN:
+	case RELPKT_WAITING_CLOSE_CLEAR:
+	    if (rfilter->version == 0) {
+		proto_err_str = "sack in version 0";
+		goto protocol_err;
+	    }
+	    if (buflen > 3 + RELPKT_MAX_SACK_BYTES) {
+		proto_err_str = "sack too long";
+		goto protocol_err;
+	    }
+	    if (handle_sack(rfilter, buf, buflen))
+		goto out_unlock;
+	    if (rfilter->state != RELPKT_OPEN &&
+			rfilter->next_acked_seq == rfilter->next_send_seq) {
+		rfilter->state = RELPKT_WAITING_CLOSE_RSP;
+		send_close(rfilter);
 	    }
 	    break;
 
@@ -1049,7 +1859,8 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	    if (count >= p->len - p->start) {
 		p->ready = false;
 		rfilter->deliver_recvpkt = recvpkt_pos(rfilter, 1);
-		rfilter->next_deliver_seq++;
+		rfilter->next_deliver_seq =
+		    seq_add(rfilter, rfilter->next_deliver_seq, 1);
 		send_ack(rfilter);
 	    } else {
 		p->start += count;
@@ -1094,10 +1905,27 @@ relpkt_filter_cleanup(struct relpkt_filter *rfilter)
     rfilter->close_retry_count = 0;
     rfilter->send_resend_pkt = false;
     rfilter->send_ack_pkt = false;
+    rfilter->send_sack_pkt = false;
+    rfilter->srtt = 0;
+    rfilter->rttvar = 0;
+    rfilter->rto = RELPKT_INIT_RTO;
+    rfilter->rto_running = false;
+    rfilter->retrans = 0;
+    rfilter->cwnd = RELPKT_INIT_CWND;
+    rfilter->cwnd_acked = 0;
+    rfilter->in_recovery = false;
+    rfilter->fec_block = rfilter->fec_max_block;
+    rfilter->fec_count = 0;
+    rfilter->fec_last_retrans = 0;
+    rfilter->fec_clean_blocks = 0;
+    rfilter->send_fec_pkt = false;
+    rfilter->fec_recovered = 0;
+    set_version(rfilter, 0);
     for (i = 0; i < rfilter->max_pkt; i++) {
 	struct pkt *p = &rfilter->recvpkts[i];
 
 	p->ready = false;
+	p->valid = false;
     }
 }
 
@@ -1112,7 +1940,7 @@ relpkt_free(struct relpkt_filter *rfilter)
     if (rfilter->recvpkts) {
 	for (i = 0; i < rfilter->max_pkt; i++) {
 	    if (rfilter->recvpkts[i].data)
-		o->free(o, rfilter->recvpkts[i].data);
+		gensio_os_funcs_buf_free(o, rfilter->recvpkts[i].data);
 	}
 	o->free(o, rfilter->recvpkts);
     }
@@ -1120,10 +1948,14 @@ relpkt_free(struct relpkt_filter *rfilter)
 	/* Yes, the below is max_pkt for xmit.  That's the array size. */
 	for (i = 0; i < rfilter->max_pkt; i++) {
 	    if (rfilter->xmitpkts[i].data)
-		o->free(o, rfilter->xmitpkts[i].data);
+		gensio_os_funcs_buf_free(o, rfilter->xmitpkts[i].data);
 	}
 	o->free(o, rfilter->xmitpkts);
     }
+    if (rfilter->fec_data)
+	o->free(o, rfilter->fec_data);
+    if (rfilter->fec_pkt)
+	o->free(o, rfilter->fec_pkt);
     if (rfilter->filter)
 	gensio_filter_free_data(rfilter->filter);
     rfilter->o->free(rfilter->o, rfilter);
@@ -1132,33 +1964,43 @@ relpkt_free(struct relpkt_filter *rfilter)
 static int
 i_relpkt_filter_timeout(struct relpkt_filter *rfilter)
 {
-    rfilter->timeouts_since_ack++;
-    if (rfilter->timeouts_since_ack > 5) {
-	rfilter->err = GE_TIMEDOUT;
-	return GE_TIMEDOUT;
-    }
+    gensio_time now;
 
-    if (rfilter->send_since_timeout)
-	rfilter->send_since_timeout = false;
-    else
-	send_ack(rfilter);
+    gensio_os_funcs_get_loop_time(rfilter->o, &now);
 
-    if (rfilter->next_acked_seq != rfilter->next_send_seq) {
-	if (rfilter->next_acked_seq == rfilter->last_timeout_ack) {
-	    rfilter->timeout_ack_count++;
-	    if (rfilter->timeout_ack_count > 1) {
-		/*
-		 * We haven't received an ack for something we sent.
-		 * The packet must have been dropped.  Resend.
-		 */
-		resend_packets(rfilter, rfilter->next_acked_seq,
-			       rfilter->next_send_seq);
-		rfilter->timeout_ack_count = 0;
-	    }
-	} else {
-	    rfilter->timeout_ack_count = 0;
-	    rfilter->last_timeout_ack = rfilter->next_acked_seq;
+    if (gensio_time_diff_nsecs(&now, &rfilter->next_tick) >= 0) {
+	rfilter->next_tick = now;
+	gensio_time_add_nsecs(&rfilter->next_tick, GENSIO_NSECS_IN_SEC);
+
+	rfilter->timeouts_since_ack++;
+	if (rfilter->timeouts_since_ack > 5) {
+	    rfilter->err = GE_TIMEDOUT;
+	    return GE_TIMEDOUT;
 	}
+
+	if (rfilter->send_since_timeout)
+	    rfilter->send_since_timeout = false;
+	else
+	    send_ack(rfilter);
+	if (rfilter->version > 0 && recv_has_gap(rfilter))
+	    /* The last one may have been lost. */
+	    rfilter->send_sack_pkt = true;
+    }
+
+    if (rfilter->rto_running &&
+		gensio_time_diff_nsecs(&now, &rfilter->rto_start) >=
+		rfilter->rto * 1000) {
+	/*
+	 * We haven't received an ack for something we sent in time.
+	 * The packet must have been dropped.  Resend and back off.
+	 */
+	resend_packets(rfilter, rfilter->next_acked_seq,
+		       rfilter->next_send_seq);
+	rfilter->rto *= 2;
+	if (rfilter->rto > RELPKT_MAX_RTO)
+	    rfilter->rto = RELPKT_MAX_RTO;
+	rfilter->rto_start = now;
+	rfilter->cc->timeout(rfilter);
     }
     relpkt_filter_start_timer(rfilter);
     return 0;
@@ -1175,6 +2017,32 @@ relpkt_filter_timeout(struct relpkt_filter *rfilter)
     return err;
 }
 
+static int
+relpkt_control(struct relpkt_filter *rfilter, bool get, int op, char *data,
+	       gensiods *datalen)
+{
+    switch (op) {
+    case GENSIO_CONTROL_RELPKT_INFO:
+	if (!get)
+	    return GE_NOTSUP;
+	relpkt_lock(rfilter);
+	*datalen = snprintf(data, *datalen,
+			    "rtt=%lld rttvar=%lld rto=%lld cwnd=%u"
+			    " retrans=%lu cc=%s fec_block=%u fec_recovered=%lu",
+			    (long long) rfilter->srtt,
+			    (long long) rfilter->rttvar,
+			    (long long) rfilter->rto, rfilter->cwnd,
+			    rfilter->retrans, rfilter->cc->name,
+			    rfilter->version >= 2 ? rfilter->fec_block : 0,
+			    rfilter->fec_recovered);
+	relpkt_unlock(rfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
 				     void *func, void *data,
 				     gensiods *count,
@@ -1235,15 +2103,83 @@ static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
     case GENSIO_FILTER_FUNC_TIMEOUT:
 	return relpkt_filter_timeout(rfilter);
 
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return relpkt_control(rfilter, *((bool *) cbuf), buflen, data, count);
+
     default:
 	return GE_NOTSUP;
     }
 }
 
+/* Direct entry points for the per packet ops, see gensio_filter_ops. */
+static bool
+relpkt_op_ul_read_pending(struct gensio_filter *filter)
+{
+    return relpkt_ul_read_pending(filter_to_relpkt(filter));
+}
+
+static bool
+relpkt_op_ll_write_pending(struct gensio_filter *filter)
+{
+    return relpkt_ll_write_pending(filter_to_relpkt(filter));
+}
+
+static bool
+relpkt_op_ll_read_needed(struct gensio_filter *filter)
+{
+    return relpkt_ll_read_needed(filter_to_relpkt(filter));
+}
+
+static int
+relpkt_op_ul_can_write(struct gensio_filter *filter, bool *val)
+{
+    return relpkt_ul_can_write(filter_to_relpkt(filter), val);
+}
+
+static int
+relpkt_op_ll_write_queued(struct gensio_filter *filter, bool *val)
+{
+    return relpkt_ll_write_queued(filter_to_relpkt(filter), val);
+}
+
+static int
+relpkt_op_ul_write(struct gensio_filter *filter,
+		   gensio_ul_filter_data_handler handler, void *cb_data,
+		   gensiods *rcount,
+		   const struct gensio_sg *sg, gensiods sglen,
+		   const char *const *auxdata)
+{
+    return relpkt_ul_write(filter_to_relpkt(filter), handler, cb_data,
+			   rcount, sg, sglen, auxdata);
+}
+
+static int
+relpkt_op_ll_write(struct gensio_filter *filter,
+		   gensio_ll_filter_data_handler handler, void *cb_data,
+		   gensiods *rcount,
+		   unsigned char *buf, gensiods buflen,
+		   const char *const *auxdata)
+{
+    return relpkt_ll_write(filter_to_relpkt(filter), handler, cb_data,
+			   rcount, buf, buflen, auxdata);
+}
+
+static const struct gensio_filter_ops relpkt_filter_ops = {
+    .ul_read_pending = relpkt_op_ul_read_pending,
+    .ll_write_pending = relpkt_op_ll_write_pending,
+    .ll_read_needed = relpkt_op_ll_read_needed,
+    .ul_can_write = relpkt_op_ul_can_write,
+    .ll_write_queued = relpkt_op_ll_write_queued,
+    .ul_write = relpkt_op_ul_write,
+    .ll_write = relpkt_op_ll_write,
+};
+
 static struct gensio_filter *
 gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
 			       gensiods max_pktsize, gensiods max_packets,
-			       bool server)
+			       bool server, const struct relpkt_cc *cc,
+			       unsigned int fec_block, bool fec_adapt,
+			       unsigned int max_version)
 {
     struct relpkt_filter *rfilter;
     gensiods i;
@@ -1254,6 +2190,13 @@ gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
 
     rfilter->o = o;
     rfilter->server = server;
+    rfilter->cc = cc;
+    rfilter->rto = RELPKT_INIT_RTO;
+    rfilter->cwnd = RELPKT_INIT_CWND;
+    rfilter->fec_max_block = fec_block;
+    rfilter->fec_block = fec_block;
+    rfilter->fec_adapt = fec_adapt;
+    rfilter->max_version = max_version;
 
     rfilter->lock = o->alloc_lock(o);
     if (!rfilter->lock)
@@ -1266,7 +2209,7 @@ gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
     if (!rfilter->recvpkts)
 	goto out_nomem;
     for (i = 0; i < max_packets; i++) {
-	rfilter->recvpkts[i].data = o->zalloc(o, max_pktsize);
+	rfilter->recvpkts[i].data = gensio_os_funcs_buf_zalloc(o, max_pktsize);
 	if (!rfilter->recvpkts[i].data)
 	    goto out_nomem;
     }
@@ -1275,15 +2218,26 @@ gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
     if (!rfilter->xmitpkts)
 	goto out_nomem;
     for (i = 0; i < max_packets; i++) {
-	rfilter->xmitpkts[i].data = o->zalloc(o, max_pktsize + 3);
+	rfilter->xmitpkts[i].data = gensio_os_funcs_buf_zalloc(o,
+						max_pktsize + RELPKT_MAX_HDR);
 	if (!rfilter->xmitpkts[i].data)
 	    goto out_nomem;
     }
 
+    if (fec_block) {
+	rfilter->fec_data = o->zalloc(o, max_pktsize);
+	if (!rfilter->fec_data)
+	    goto out_nomem;
+	rfilter->fec_pkt = o->zalloc(o, max_pktsize + 5);
+	if (!rfilter->fec_pkt)
+	    goto out_nomem;
+    }
+
     rfilter->filter = gensio_filter_alloc_data(o, gensio_relpkt_filter_func,
 					       rfilter);
     if (!rfilter->filter)
 	goto out_nomem;
+    gensio_filter_set_ops(rfilter->filter, &relpkt_filter_ops);
 
     return rfilter->filter;
 
@@ -1295,12 +2249,19 @@ gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
 int
 gensio_relpkt_filter_alloc(struct gensio_os_funcs *o,
 			   const char * const args[],
-			   bool server, struct gensio_filter **rfilter)
+			   bool server, bool net_pkts,
+			   struct gensio_filter **rfilter)
 {
     struct gensio_filter *filter;
     unsigned int i;
-    gensiods max_pktsize = 123; /* FIXME - magic number. */
-    gensiods max_packets = 16;
+    /* msgdelim max packet size - 5, or fits in an ethernet frame. */
+    gensiods max_pktsize = net_pkts ? 1400 : 123;
+    gensiods max_packets = net_pkts ? 256 : 16;
+    const struct relpkt_cc *cc = &relpkt_ccs[0];
+    const char *ccstr;
+    unsigned int fec = 0;
+    bool fec_adapt = false;
+    unsigned int max_version = RELPKT_PROTOCOL_VERSION;
     char *str = NULL;
     int rv;
 
@@ -1331,11 +2292,36 @@ gensio_relpkt_filter_alloc(struct gensio_os_funcs *o,
 	if (gensio_check_keyboolv(args[i], "mode", "server", "client",
 				  &server) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "fec", &fec) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "fec_adapt", &fec_adapt) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "max_version", &max_version) > 0)
+	    continue;
+	if (gensio_check_keyvalue(args[i], "cc", &ccstr) > 0) {
+	    for (cc = relpkt_ccs; cc->name; cc++) {
+		if (strcmp(cc->name, ccstr) == 0)
+		    break;
+	    }
+	    if (!cc->name)
+		return GE_INVAL;
+	    continue;
+	}
 	return GE_INVAL;
     }
 
+    if (max_pktsize == 0 || max_pktsize > 65535 ||
+		max_packets == 0 || max_packets > RELPKT_V1_MAX_WINDOW ||
+		max_version > RELPKT_PROTOCOL_VERSION)
+	return GE_INVAL;
+    /* The parity length has 15 bits. */
+    if (fec && (fec < RELPKT_FEC_MIN_BLOCK || fec > RELPKT_FEC_MAX_BLOCK ||
+		max_pktsize > 0x7fff))
+	return GE_INVAL;
+
     filter = gensio_relpkt_filter_raw_alloc(o, max_pktsize, max_packets,
-					    server);
+					    server, cc, fec, fec_adapt,
+					    max_version);
     if (!filter)
 	return GE_NOMEM;
 
@@ -10,9 +10,13 @@
 
 #include <gensio/gensio_base.h>
 
+/*
+ * If net_pkts is true, the child carries network packets (like UDP),
+ * so the defaults are MTU-sized packets and a bigger window.
+ */
 int gensio_relpkt_filter_alloc(struct gensio_os_funcs *o,
 			       const char * const args[],
-			       bool default_is_server,
+			       bool default_is_server, bool net_pkts,
 			       struct gensio_filter **rfilter);
 
 #endif /* GENSIO_FILTER_RELPKT_H */
@@ -15,11 +15,13 @@
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_list.h>
 
 #include "gensio_filter_script.h"
 
 enum script_state {
     SCRIPT_CLOSED,
+    SCRIPT_WAIT_SLOT,
     SCRIPT_IN_SUB_OPEN,
     SCRIPT_IN_OPEN,
     SCRIPT_OPEN,
@@ -58,8 +60,33 @@ struct script_filter {
 
     char *str;
     struct gensio *io;
+
+    /*
+     * For limiting the number of scripts running at once, see
+     * script_slot_get().  The fields below are protected by
+     * script_slots_lock.
+     */
+    unsigned int max_scripts;
+    bool in_slot;
+    bool queued;
+    struct gensio_link slot_link;
+    bool runner_pending;
+    bool free_pending;
+    struct gensio_runner *slot_runner;
+
+    /* Times of each phase of the script, in nanoseconds. */
+    int64_t connect_time;
+    int64_t start_time;
+    int64_t open_time;
+    int64_t done_time;
 };
 
+static int script_sub_event(struct gensio *io, void *user_data,
+			    int event, int err,
+			    unsigned char *buf, gensiods *buflen,
+			    const char *const *auxdata);
+static void script_open_done(struct gensio *io, int err, void *open_data);
+
 #define filter_to_script(v) ((struct script_filter *) \
 			     gensio_filter_get_user_data(v))
 
@@ -75,6 +102,183 @@ script_unlock(struct script_filter *sfilter)
     sfilter->o->unlock(sfilter->lock);
 }
 
+static int64_t
+script_now(struct script_filter *sfilter)
+{
+    gensio_time t;
+
+    sfilter->o->get_monotonic_time(sfilter->o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+/*
+ * A process-wide pool of script slots.  If max-scripts is set, only
+ * that many scripts run at once and the rest wait in order for a slot
+ * to free up.  A waiting filter is handed its slot when another
+ * script finishes and its script is started from slot_runner.
+ */
+static struct gensio_once script_slots_once;
+static struct gensio_os_funcs *script_slots_o;
+static struct gensio_lock *script_slots_lock;
+static struct gensio_list script_slots_queue;
+static unsigned int script_slots_running;
+
+static void
+script_slots_cleanup(void)
+{
+    if (script_slots_lock)
+	script_slots_o->free_lock(script_slots_lock);
+    script_slots_lock = NULL;
+    script_slots_running = 0;
+    memset(&script_slots_once, 0, sizeof(script_slots_once));
+}
+
+static struct gensio_class_cleanup script_slots_cleanup_data = {
+    script_slots_cleanup
+};
+
+static void
+script_slots_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    script_slots_o = o;
+    gensio_list_init(&script_slots_queue);
+    script_slots_lock = o->alloc_lock(o);
+    if (script_slots_lock)
+	gensio_register_class_cleanup(&script_slots_cleanup_data);
+}
+
+/*
+ * Get a slot to run the script.  Returns true if we got one, false if
+ * the filter was queued to wait for one.  Called with the filter lock
+ * held.
+ */
+static bool
+script_slot_get(struct script_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    bool rv = true;
+
+    if (!sfilter->max_scripts)
+	return true;
+
+    o->lock(script_slots_lock);
+    if (script_slots_running < sfilter->max_scripts) {
+	script_slots_running++;
+	sfilter->in_slot = true;
+    } else {
+	gensio_list_add_tail(&script_slots_queue, &sfilter->slot_link);
+	sfilter->queued = true;
+	rv = false;
+    }
+    o->unlock(script_slots_lock);
+
+    return rv;
+}
+
+/*
+ * Give up our slot or our place in the queue.  If a slot frees up,
+ * hand it to the next waiter.  Called with the filter lock held.
+ */
+static void
+script_slot_put(struct script_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    struct script_filter *w;
+    struct gensio_link *l;
+
+    if (!sfilter->in_slot && !sfilter->queued)
+	return;
+
+    o->lock(script_slots_lock);
+    if (sfilter->queued) {
+	gensio_list_rm(&script_slots_queue, &sfilter->slot_link);
+	sfilter->queued = false;
+    }
+    if (sfilter->in_slot) {
+	sfilter->in_slot = false;
+	script_slots_running--;
+    }
+    while (!gensio_list_empty(&script_slots_queue)) {
+	l = gensio_list_first(&script_slots_queue);
+	w = gensio_container_of(l, struct script_filter, slot_link);
+	if (script_slots_running >= w->max_scripts)
+	    break;
+	gensio_list_rm(&script_slots_queue, l);
+	w->queued = false;
+	w->in_slot = true;
+	script_slots_running++;
+	if (!w->runner_pending) {
+	    w->runner_pending = true;
+	    o->run(w->slot_runner);
+	}
+    }
+    o->unlock(script_slots_lock);
+}
+
+/* Called with the lock held. */
+static int
+script_start(struct script_filter *sfilter)
+{
+    int err;
+
+    sfilter->start_time = script_now(sfilter);
+    err = str_to_gensio(sfilter->str, sfilter->o,
+			script_sub_event, sfilter, &sfilter->io);
+    if (!err) {
+	err = gensio_open(sfilter->io, script_open_done, sfilter);
+	if (err) {
+	    gensio_free(sfilter->io);
+	    sfilter->io = NULL;
+	}
+    }
+    if (!err)
+	sfilter->state = SCRIPT_IN_SUB_OPEN;
+    else
+	script_slot_put(sfilter);
+
+    return err;
+}
+
+static void sfilter_free(struct script_filter *sfilter);
+
+static void
+script_slot_ready(struct gensio_runner *runner, void *cb_data)
+{
+    struct script_filter *sfilter = cb_data;
+    struct gensio_os_funcs *o = sfilter->o;
+    bool start;
+    int err;
+
+    o->lock(script_slots_lock);
+    sfilter->runner_pending = false;
+    if (sfilter->free_pending) {
+	o->unlock(script_slots_lock);
+	sfilter_free(sfilter);
+	return;
+    }
+    o->unlock(script_slots_lock);
+
+    script_lock(sfilter);
+    /* We may have been disconnected while this was pending. */
+    start = sfilter->state == SCRIPT_WAIT_SLOT && sfilter->in_slot;
+    if (!start) {
+	script_unlock(sfilter);
+	return;
+    }
+    err = script_start(sfilter);
+    if (err) {
+	sfilter->err = err;
+	sfilter->state = SCRIPT_OPEN_FAIL;
+    }
+    script_unlock(sfilter);
+
+    if (err)
+	sfilter->filter_cb(sfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OPEN_DONE, NULL);
+}
+
 static bool
 script_ul_read_pending(struct gensio_filter *filter)
 {
@@ -149,6 +353,11 @@ script_finish_close(struct gensio *io, void *close_data)
     gensio_free(sfilter->io);
     sfilter->io = NULL;
 
+    sfilter->done_time = script_now(sfilter);
+    script_lock(sfilter);
+    script_slot_put(sfilter);
+    script_unlock(sfilter);
+
     sfilter->filter_cb(sfilter->filter_cb_data, GENSIO_FILTER_CB_OPEN_DONE,
 		       NULL);
 }
@@ -170,6 +379,7 @@ script_handle_err_unlock(struct script_filter *sfilter, int err)
 	sfilter->state = SCRIPT_OPEN_FAIL;
 	script_unlock(sfilter);
 	script_finish_close(sfilter->io, sfilter);
+	return;
     } else {
 	err = gensio_close(sfilter->io, script_finish_close, sfilter);
 	if (err)
@@ -188,6 +398,7 @@ script_open_done(struct gensio *io, int err, void *open_data)
 	script_handle_err_unlock(sfilter, err);
     } else {
 	sfilter->state = SCRIPT_IN_OPEN;
+	sfilter->open_time = script_now(sfilter);
 	gensio_set_read_callback_enable(sfilter->io, true);
 	script_unlock(sfilter);
 	sfilter->filter_cb(sfilter->filter_cb_data,
@@ -278,24 +489,23 @@ script_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 
     script_lock(sfilter);
     switch(sfilter->state) {
+    case SCRIPT_WAIT_SLOT:
     case SCRIPT_IN_SUB_OPEN:
     case SCRIPT_IN_OPEN:
 	break;
 
     case SCRIPT_CLOSED:
-	err = str_to_gensio(sfilter->str, sfilter->o,
-			    script_sub_event, sfilter, &sfilter->io);
-	if (!err) {
-	    err = gensio_open(sfilter->io, script_open_done, sfilter);
-	    if (err) {
-		gensio_free(sfilter->io);
-		sfilter->io = NULL;
-	    }
+	sfilter->connect_time = script_now(sfilter);
+	sfilter->start_time = 0;
+	sfilter->open_time = 0;
+	sfilter->done_time = 0;
+	if (!script_slot_get(sfilter)) {
+	    sfilter->state = SCRIPT_WAIT_SLOT;
+	    break;
 	}
-	if (!err) {
-	    sfilter->state = SCRIPT_IN_SUB_OPEN;
+	err = script_start(sfilter);
+	if (!err)
 	    err = GE_INPROGRESS;
-	}
 	break;
 
     case SCRIPT_OPEN:
@@ -322,6 +532,10 @@ script_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
 	sfilter->io = NULL;
 	/* fallthrough */
 
+    case SCRIPT_WAIT_SLOT:
+	script_slot_put(sfilter);
+	/* fallthrough */
+
     case SCRIPT_OPEN:
 	sfilter->state = SCRIPT_CLOSED;
 	err = 0;
@@ -458,11 +672,16 @@ script_filter_cleanup(struct gensio_filter *filter)
 	gensio_free(sfilter->io);
 	sfilter->io = NULL;
     }
+    script_lock(sfilter);
+    script_slot_put(sfilter);
+    script_unlock(sfilter);
 }
 
 static void
 sfilter_free(struct script_filter *sfilter)
 {
+    if (sfilter->slot_runner)
+	sfilter->o->free_runner(sfilter->slot_runner);
     if (sfilter->lock)
 	sfilter->o->free_lock(sfilter->lock);
     if (sfilter->filter)
@@ -476,10 +695,63 @@ static void
 script_free(struct gensio_filter *filter)
 {
     struct script_filter *sfilter = filter_to_script(filter);
+    struct gensio_os_funcs *o = sfilter->o;
+
+    script_lock(sfilter);
+    script_slot_put(sfilter);
+    script_unlock(sfilter);
+
+    if (sfilter->max_scripts) {
+	o->lock(script_slots_lock);
+	if (sfilter->runner_pending) {
+	    /* The runner will free it. */
+	    sfilter->free_pending = true;
+	    o->unlock(script_slots_lock);
+	    return;
+	}
+	o->unlock(script_slots_lock);
+    }
 
     sfilter_free(sfilter);
 }
 
+static int64_t
+script_usecs(int64_t start, int64_t end)
+{
+    if (!start || !end)
+	return 0;
+    return (end - start) / 1000;
+}
+
+static int
+script_filter_control(struct gensio_filter *filter, bool get,
+		      unsigned int option, char *data, gensiods *datalen)
+{
+    struct script_filter *sfilter = filter_to_script(filter);
+
+    switch (option) {
+    case GENSIO_CONTROL_SCRIPT_INFO:
+	if (!get)
+	    return GE_NOTSUP;
+	script_lock(sfilter);
+	*datalen = snprintf(data, *datalen,
+		"queue=%lld start=%lld run=%lld total=%lld",
+		(long long) script_usecs(sfilter->connect_time,
+					 sfilter->start_time),
+		(long long) script_usecs(sfilter->start_time,
+					 sfilter->open_time),
+		(long long) script_usecs(sfilter->open_time,
+					 sfilter->done_time),
+		(long long) script_usecs(sfilter->connect_time,
+					 sfilter->done_time));
+	script_unlock(sfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int
 script_set_callback(struct gensio_filter *filter,
 			gensio_filter_cb cb, void *cb_data)
@@ -540,7 +812,8 @@ static int gensio_script_filter_func(struct gensio_filter *filter, int op,
 	return 0;
 
     case GENSIO_FILTER_FUNC_CONTROL:
-	return GE_NOTSUP;
+	return script_filter_control(filter, *((bool *) cbuf), buflen, data,
+				     count);
 
     default:
 	return GE_NOTSUP;
@@ -548,7 +821,8 @@ static int gensio_script_filter_func(struct gensio_filter *filter, int op,
 }
 
 static struct gensio_filter *
-gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str)
+gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str,
+			       unsigned int max_scripts)
 {
     struct script_filter *sfilter;
 
@@ -558,11 +832,16 @@ gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str)
 
     sfilter->o = o;
     sfilter->str = str;
+    sfilter->max_scripts = max_scripts;
 
     sfilter->lock = o->alloc_lock(o);
     if (!sfilter->lock)
 	goto out_nomem;
 
+    sfilter->slot_runner = o->alloc_runner(o, script_slot_ready, sfilter);
+    if (!sfilter->slot_runner)
+	goto out_nomem;
+
     sfilter->filter = gensio_filter_alloc_data(o, gensio_script_filter_func,
 					       sfilter);
     if (!sfilter->filter)
@@ -584,11 +863,20 @@ gensio_script_filter_alloc(struct gensio_os_funcs *o,
     const char *scr = NULL;
     const char *gensioscr = NULL;
     char *str;
-    unsigned int i;
+    unsigned int i, max_scripts;
+    int ival, err;
+
+    err = gensio_get_default(o, "script", "max-scripts", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    max_scripts = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyvalue(args[i], "script", &scr) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "max-scripts", &max_scripts) > 0)
+	    continue;
 	if (gensio_check_keyvalue(args[i], "gensio", &gensioscr) > 0)
 	    continue;
 	return GE_INVAL;
@@ -601,8 +889,18 @@ gensio_script_filter_alloc(struct gensio_os_funcs *o,
 	str = gensio_alloc_sprintf(o, "stdio(noredir-stderr),%s", scr);
     else
 	str = gensio_strdup(o, gensioscr);
+    if (!str)
+	return GE_NOMEM;
+
+    if (max_scripts) {
+	o->call_once(o, &script_slots_once, script_slots_init, o);
+	if (!script_slots_lock) {
+	    o->free(o, str);
+	    return GE_NOMEM;
+	}
+    }
 
-    filter = gensio_script_filter_raw_alloc(o, str);
+    filter = gensio_script_filter_raw_alloc(o, str, max_scripts);
     if (!filter) {
 	o->free(o, str);
 	return GE_NOMEM;
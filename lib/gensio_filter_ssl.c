@@ -11,9 +11,14 @@
 #include <gensio/gensio_err.h>
 
 #include "gensio_filter_ssl.h"
+#include "gensio_probes.h"
 
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
@@ -21,6 +26,7 @@
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_time.h>
 
 #ifdef _WIN32
 #define DIRSEP '\\'
@@ -38,12 +44,30 @@ struct gensio_ssl_filter_data {
     gensiods max_write_size;
     bool allow_authfail;
     bool clientauth;
+    unsigned int handshake_threads;
+    gensiods record_start;
+    gensiods record_grow;
+    gensio_time record_idle;
+    bool dtls;
+    gensiods mtu;
+    gensiods early_data_max;
+    gensio_time early_data_age;
 };
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define HAVE_SSL_DTLS
+#define HAVE_SSL_EARLY_DATA
+static BIO_METHOD *ssl_dgram_method;
+static void ssl_dgram_method_init(void);
+#endif
+
 static void
 gensio_do_ssl_init(void *cb_data)
 {
     SSL_library_init();
+#ifdef HAVE_SSL_DTLS
+    ssl_dgram_method_init();
+#endif
 }
 
 static struct gensio_once gensio_ssl_init_once;
@@ -54,6 +78,26 @@ gensio_ssl_initialize(struct gensio_os_funcs *o)
     o->call_once(o, &gensio_ssl_init_once, gensio_do_ssl_init, NULL);
 }
 
+/* A datagram waiting in one of the DTLS queues. */
+struct ssl_dgram {
+    struct ssl_dgram *next;
+    gensiods len;
+    unsigned char *data;
+};
+
+struct ssl_dgram_queue {
+    struct ssl_dgram *head;
+    struct ssl_dgram **tail;
+    unsigned int len;
+};
+
+/*
+ * The most datagrams held in each direction.  Outgoing ones only pile
+ * up while the lower layer is blocked, incoming ones while the user
+ * isn't taking data.
+ */
+#define SSL_DGRAM_QUEUE_MAX 16
+
 struct ssl_filter {
     struct gensio_filter *filter;
     struct gensio_os_funcs *o;
@@ -73,26 +117,42 @@ struct ssl_filter {
     bool expect_peer_cert;
     bool allow_authfail;
 
-    /* This is data from SSL_read() that is waiting to be sent to the user. */
+    /*
+     * This is data from SSL_read() that is waiting to be sent to the
+     * user.  The buffer is only borrowed (see ssl_rbuf_get()) while
+     * there is data in it, idle connections don't hold one.
+     */
     unsigned char *read_data;
     gensiods read_data_pos;
     gensiods read_data_len;
+    gensiods read_data_filled;
+    unsigned int read_data_node; /* The rbuf pool it came from. */
     gensiods max_read_size;
 
     /*
-     * This is data from the user waiting to be sent to SSL_write().  This
-     * is required because if SSL_write() return that it needs I/O, it must
-     * be called again with exactly the same data.
+     * User data is encrypted straight from the user's buffers, this
+     * is the most handed to one SSL_write().
      */
-    unsigned char *write_data;
     gensiods max_write_size;
-    gensiods write_data_len;
 
-    /* This is data from BIO_read() waiting to be sent to the lower layer. */
-    unsigned char *xmit_buf;
-    gensiods xmit_buf_pos;
-    gensiods xmit_buf_len;
-    gensiods max_xmit_buf;
+    /*
+     * Dynamic record sizing.  If record_start is set, records start
+     * out that size so the first bytes go in one segment, and go to
+     * max_write_size after record_grow bytes.  If nothing is written
+     * for record_idle nanoseconds it starts over.
+     */
+    gensiods record_start;
+    gensiods record_grow;
+    int64_t record_idle;
+    gensiods record_sent;
+    gensio_time record_last;
+
+    /*
+     * Encrypted data is sent to the lower layer straight out of the
+     * BIO pair's buffer, to avoid copying it.  This is set if the
+     * lower layer didn't take all of it.
+     */
+    bool xmit_blocked;
 
     /*
      * SSL has asked for something.
@@ -106,14 +166,110 @@ struct ssl_filter {
      * and consistency with certauth.
      */
     char *username;
+
+    /*
+     * For clients, sessions are saved in a process-wide store so the
+     * next connection to the same place can resume it instead of
+     * doing a full handshake.  sess_key_base holds the settings part
+     * of the key, sess_key is the full key with the remote address.
+     */
+    struct gensio *io;
+    char *sess_key_base;
+    char *sess_key;
+    bool sess_checked;
+
+    /* For the ssl_handshake_start probe. */
+    bool hs_started;
+
+    /*
+     * If handshake_threads is set, handshake steps with data to
+     * process are done by a worker thread.  hs_state and hs_rv are
+     * protected by the handshake pool lock.  While hs_state is
+     * RUNNING the worker owns the SSL.  It holds the filter lock while
+     * it works on it, except around the PRECERT_VERIFY event.
+     */
+    unsigned int handshake_threads;
+    enum { SSL_HS_IDLE, SSL_HS_QUEUED, SSL_HS_RUNNING, SSL_HS_DONE } hs_state;
+    int hs_rv;
+    struct ssl_filter *hs_next;
+
+    /*
+     * hs_runner tells the base a step is done and gives back the
+     * references for steps in hs_refs.  hs_refs and hs_run_pending
+     * are protected by the handshake pool lock.  hs_runner is only
+     * set if the pool is in use.
+     */
+    struct gensio_runner *hs_runner;
+    unsigned int hs_refs;
+    bool hs_run_pending;
+
+    /*
+     * ssl_hs_cancel() waits on hs_wait for a running step to finish,
+     * hs_cancel_waiters is how many are waiting.  Protected by the
+     * handshake pool lock.
+     */
+    struct gensio_thread_sem *hs_wait;
+    unsigned int hs_cancel_waiters;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    /*
+     * For DTLS the SSL talks to a datagram BIO (ssl_dgram_method)
+     * instead of a BIO pair.  It keeps whole datagrams in a queue in
+     * each direction, so each record goes to the lower layer as its
+     * own packet and each packet from below is handed to SSL alone.
+     * Writes from the user are gathered into dgram_buf so one write
+     * is one record.
+     */
+    bool dtls;
+    gensiods mtu;
+    struct ssl_dgram_queue dgram_in;
+    struct ssl_dgram_queue dgram_out;
+    unsigned char *dgram_buf;
+    gensiods dgram_write_size; /* Largest user write, set on connect. */
+
+    /*
+     * TLS 1.3 0-RTT data, if early_data_max is set.  A client queues
+     * it with GENSIO_CONTROL_EARLY_DATA before the open and it goes
+     * with the ClientHello if the session being resumed allows it.
+     * If it couldn't be sent or the server rejected it, it is sent as
+     * normal data once connected, ahead of any user data.  A server
+     * reads it with SSL_read_early_data() and finishes the open as
+     * soon as some arrives, early_reading is set until the client's
+     * Finished comes in.  early_data_age is the oldest session (in
+     * seconds) a server takes early data on, 0 is no limit.
+     */
+    gensiods early_data_max;
+    long early_data_age;
+    unsigned char *early_data;
+    gensiods early_data_len;
+    gensiods early_data_pos;
+    bool early_written;
+    bool early_reading;
 };
 
 #define filter_to_ssl(v) ((struct ssl_filter *) gensio_filter_get_user_data(v))
 
+static void ssl_session_find(struct ssl_filter *sfilter);
+static unsigned char *ssl_rbuf_get(struct ssl_filter *sfilter);
+static void ssl_rbuf_put(struct ssl_filter *sfilter);
+static bool ssl_hs_busy(struct ssl_filter *sfilter);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+static int ssl_session_new(SSL *ssl, SSL_SESSION *sess);
+#endif
+
 static void
 gssl_vlog(struct ssl_filter *f, enum gensio_log_levels l,
 	  bool do_ssl_err, char *fmt, va_list ap)
 {
+    if (!gensio_log_enabled(f->o, l)) {
+	/* Keep the error queue the same as if we had logged. */
+	if (do_ssl_err)
+	    ERR_get_error();
+	return;
+    }
+
     if (do_ssl_err) {
 	char buf[256], buf2[200];
 	unsigned long ssl_err = ERR_get_error();
@@ -179,11 +335,151 @@ ssl_unlock(struct ssl_filter *sfilter)
     sfilter->o->unlock(sfilter->lock);
 }
 
+static void
+ssl_dgram_queue_init(struct ssl_dgram_queue *q)
+{
+    q->head = NULL;
+    q->tail = &q->head;
+    q->len = 0;
+}
+
+static bool
+ssl_dgram_queue_add(struct gensio_os_funcs *o, struct ssl_dgram_queue *q,
+		    const void *data, gensiods len)
+{
+    struct ssl_dgram *d;
+
+    d = o->zalloc(o, sizeof(*d) + len);
+    if (!d)
+	return false;
+    d->data = (unsigned char *) (d + 1);
+    memcpy(d->data, data, len);
+    d->len = len;
+    *q->tail = d;
+    q->tail = &d->next;
+    q->len++;
+    return true;
+}
+
+static void
+ssl_dgram_queue_pop(struct gensio_os_funcs *o, struct ssl_dgram_queue *q)
+{
+    struct ssl_dgram *d = q->head;
+
+    q->head = d->next;
+    if (!q->head)
+	q->tail = &q->head;
+    q->len--;
+    o->free(o, d);
+}
+
+static void
+ssl_dgram_queue_clear(struct gensio_os_funcs *o, struct ssl_dgram_queue *q)
+{
+    while (q->head)
+	ssl_dgram_queue_pop(o, q);
+}
+
+#ifdef HAVE_SSL_DTLS
+/*
+ * The BIO the SSL uses for DTLS.  A write from SSL is one datagram
+ * and a read gets one datagram, the filter moves them to and from
+ * the lower layer.
+ */
+static int
+ssl_dgram_write(BIO *bio, const char *buf, int len)
+{
+    struct ssl_filter *sfilter = BIO_get_data(bio);
+
+    BIO_clear_retry_flags(bio);
+    if (sfilter->dgram_out.len >= SSL_DGRAM_QUEUE_MAX) {
+	BIO_set_retry_write(bio);
+	return -1;
+    }
+    if (!ssl_dgram_queue_add(sfilter->o, &sfilter->dgram_out, buf, len))
+	return -1;
+    return len;
+}
+
+static int
+ssl_dgram_read(BIO *bio, char *buf, int len)
+{
+    struct ssl_filter *sfilter = BIO_get_data(bio);
+    struct ssl_dgram *d = sfilter->dgram_in.head;
+
+    BIO_clear_retry_flags(bio);
+    if (!d) {
+	BIO_set_retry_read(bio);
+	return -1;
+    }
+    /* Like a socket, whatever doesn't fit is lost. */
+    if ((gensiods) len > d->len)
+	len = d->len;
+    memcpy(buf, d->data, len);
+    ssl_dgram_queue_pop(sfilter->o, &sfilter->dgram_in);
+    return len;
+}
+
+static long
+ssl_dgram_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    struct ssl_filter *sfilter = BIO_get_data(bio);
+
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+	return 1;
+
+    case BIO_CTRL_PENDING:
+	return sfilter->dgram_in.head ? sfilter->dgram_in.head->len : 0;
+
+    case BIO_CTRL_WPENDING:
+	return sfilter->dgram_out.head ? sfilter->dgram_out.head->len : 0;
+
+    default:
+	/* The MTU is set on the SSL, no socket things are needed. */
+	return 0;
+    }
+}
+
+static int
+ssl_dgram_create(BIO *bio)
+{
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+static void
+ssl_dgram_method_init(void)
+{
+    BIO_METHOD *m;
+
+    m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK,
+		     "gensio dgram");
+    if (!m)
+	return;
+    if (!BIO_meth_set_write(m, ssl_dgram_write) ||
+	    !BIO_meth_set_read(m, ssl_dgram_read) ||
+	    !BIO_meth_set_ctrl(m, ssl_dgram_ctrl) ||
+	    !BIO_meth_set_create(m, ssl_dgram_create)) {
+	BIO_meth_free(m);
+	return;
+    }
+    ssl_dgram_method = m;
+}
+#endif
+
+static void ssl_hs_setup(struct ssl_filter *sfilter);
+
 static void
 ssl_set_callbacks(struct gensio_filter *filter,
 		  gensio_filter_cb cb, void *cb_data)
 {
-    /* We don't currently use callbacks. */
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+
+    sfilter->filter_cb = cb;
+    sfilter->filter_cb_data = cb_data;
+    if (!sfilter->hs_runner)
+	ssl_hs_setup(sfilter);
 }
 
 static bool
@@ -193,8 +489,12 @@ ssl_ul_read_pending(struct gensio_filter *filter)
     char buf[1];
     bool rv;
 
+    if (ssl_hs_busy(sfilter))
+	return false;
+
     ssl_lock(sfilter);
-    rv = sfilter->read_data_len || SSL_peek(sfilter->ssl, buf, 1) > 0;
+    rv = sfilter->read_data_len ||
+	(!sfilter->early_reading && SSL_peek(sfilter->ssl, buf, 1) > 0);
     ssl_unlock(sfilter);
     return rv;
 }
@@ -205,9 +505,15 @@ ssl_ll_write_pending(struct gensio_filter *filter)
     struct ssl_filter *sfilter = filter_to_ssl(filter);
     bool rv;
 
+    if (ssl_hs_busy(sfilter))
+	return false;
+
     ssl_lock(sfilter);
-    rv = BIO_pending(sfilter->io_bio) || sfilter->write_data_len ||
-	sfilter->xmit_buf_len || sfilter->want_write;
+    if (sfilter->dtls)
+	rv = sfilter->dgram_out.head || sfilter->want_write;
+    else
+	rv = (BIO_pending(sfilter->io_bio) || sfilter->want_write ||
+	      (sfilter->early_data && sfilter->connected));
     ssl_unlock(sfilter);
     return rv;
 }
@@ -218,19 +524,26 @@ ssl_ll_read_needed(struct gensio_filter *filter)
     struct ssl_filter *sfilter = filter_to_ssl(filter);
     bool rv;
 
+    if (ssl_hs_busy(sfilter))
+	/* The worker has the SSL, the base is told when it's done. */
+	return false;
+
     ssl_lock(sfilter);
-    rv = BIO_should_read(sfilter->io_bio) || sfilter->want_read;
+    if (sfilter->dtls)
+	rv = sfilter->want_read;
+    else
+	rv = BIO_should_read(sfilter->io_bio) || sfilter->want_read;
     ssl_unlock(sfilter);
     return rv;
 }
 
-static bool
+static int
 ssl_ul_can_write(struct gensio_filter *filter, bool *val)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
 
     ssl_lock(sfilter);
-    *val = sfilter->write_data_len == 0 && sfilter->xmit_buf_len == 0;
+    *val = !sfilter->xmit_blocked;
     ssl_unlock(sfilter);
 
     return 0;
@@ -300,17 +613,189 @@ ssl_check_open_done(struct gensio_filter *filter, struct gensio *io)
     return rv;
 }
 
+static void
+ssl_early_free(struct ssl_filter *sfilter)
+{
+    if (!sfilter->early_data)
+	return;
+    memset(sfilter->early_data, 0, sfilter->early_data_len);
+    sfilter->o->free(sfilter->o, sfilter->early_data);
+    sfilter->early_data = NULL;
+    sfilter->early_data_len = 0;
+    sfilter->early_data_pos = 0;
+}
+
+#ifdef HAVE_SSL_EARLY_DATA
+/*
+ * Send the queued data with the ClientHello if the session allows
+ * it, then carry on with the handshake.  Returns like SSL_connect().
+ */
 static int
-ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+ssl_early_connect(struct ssl_filter *sfilter)
+{
+    SSL_SESSION *sess = SSL_get_session(sfilter->ssl);
+    size_t written;
+
+    if (!sfilter->early_written && sess &&
+	    SSL_SESSION_get_max_early_data(sess) >= sfilter->early_data_len) {
+	if (!SSL_write_early_data(sfilter->ssl, sfilter->early_data,
+				  sfilter->early_data_len, &written))
+	    return -1;
+	sfilter->early_written = true;
+    }
+    return SSL_connect(sfilter->ssl);
+}
+
+/*
+ * Read 0-RTT data into read_data, which must be there.  Returns like
+ * SSL_read(), except that it returns 0 (or the last data) when the
+ * early data is done and clears early_reading.  SSL_read() takes
+ * over after that.
+ */
+static int
+ssl_early_read(struct ssl_filter *sfilter)
+{
+    size_t count = 0;
+
+    switch (SSL_read_early_data(sfilter->ssl, sfilter->read_data,
+				sfilter->max_read_size, &count)) {
+    case SSL_READ_EARLY_DATA_SUCCESS:
+	return count;
+
+    case SSL_READ_EARLY_DATA_FINISH:
+	sfilter->early_reading = false;
+	return count;
+
+    default:
+	return -1;
+    }
+}
+
+/* Server data sent before the client's Finished. */
+static int
+ssl_early_write(struct ssl_filter *sfilter, const void *buf, int len)
+{
+    size_t written;
+
+    if (!SSL_write_early_data(sfilter->ssl, buf, len, &written))
+	return -1;
+    return written;
+}
+
+static bool
+ssl_early_accepted(struct ssl_filter *sfilter)
+{
+    return SSL_get_early_data_status(sfilter->ssl) == SSL_EARLY_DATA_ACCEPTED;
+}
+
+/*
+ * Replay protection comes from OpenSSL, with early data on it makes
+ * the tickets single use through the shared SSL_CTX's session cache.
+ * This adds a limit on how old the session may be.
+ */
+static int
+ssl_early_allow(SSL *ssl, void *cb_data)
+{
+    struct ssl_filter *sfilter = cb_data;
+    SSL_SESSION *sess = SSL_get_session(ssl);
+
+    if (!sess)
+	return 0;
+    if (!sfilter->early_data_age)
+	return 1;
+    return time(NULL) - SSL_SESSION_get_time(sess) <= sfilter->early_data_age;
+}
+
+static void
+ssl_early_setup(struct ssl_filter *sfilter)
+{
+    if (sfilter->is_client || !sfilter->early_data_max)
+	return;
+    SSL_set_max_early_data(sfilter->ssl, sfilter->early_data_max);
+    SSL_set_recv_max_early_data(sfilter->ssl, sfilter->early_data_max);
+    SSL_set_allow_early_data_cb(sfilter->ssl, ssl_early_allow, sfilter);
+    sfilter->early_reading = true;
+}
+#else
+static int
+ssl_early_connect(struct ssl_filter *sfilter)
+{
+    return SSL_connect(sfilter->ssl);
+}
+
+static int
+ssl_early_read(struct ssl_filter *sfilter)
+{
+    sfilter->early_reading = false;
+    return 0;
+}
+
+static int
+ssl_early_write(struct ssl_filter *sfilter, const void *buf, int len)
+{
+    return SSL_write(sfilter->ssl, buf, len);
+}
+
+static bool
+ssl_early_accepted(struct ssl_filter *sfilter)
+{
+    return false;
+}
+
+static void
+ssl_early_setup(struct ssl_filter *sfilter)
+{
+}
+#endif
+
+/*
+ * Server side, read early data if the client sent some and finish the
+ * open with it.  Otherwise do the normal handshake.  Returns like
+ * SSL_accept().
+ */
+static int
+ssl_early_accept(struct ssl_filter *sfilter)
+{
+    int rv;
+
+    if (sfilter->read_data_len)
+	/* ssl_ll_write() already got some. */
+	return 1;
+    if (!sfilter->read_data && !ssl_rbuf_get(sfilter)) {
+	gssl_log_err(sfilter, "Out of memory for early data");
+	return 0;
+    }
+    rv = ssl_early_read(sfilter);
+    if (rv > 0) {
+	sfilter->read_data_len = rv;
+	sfilter->read_data_filled = rv;
+	sfilter->read_data_pos = 0;
+	return 1;
+    }
+    ssl_rbuf_put(sfilter);
+    if (rv == 0)
+	return SSL_accept(sfilter->ssl);
+    return rv;
+}
+
+/*
+ * Run one step of the handshake, returning 0 if it is complete,
+ * GE_INPROGRESS if it needs more I/O, or an error.  Call with the
+ * filter lock held.
+ */
+static int
+ssl_handshake_step(struct ssl_filter *sfilter)
 {
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
     int rv, success, err;
 
-    ssl_lock(sfilter);
     sfilter->want_read = false;
     sfilter->want_write = false;
-    if (sfilter->is_client)
+    if (sfilter->is_client && sfilter->early_data)
+	success = ssl_early_connect(sfilter);
+    else if (sfilter->is_client)
 	success = SSL_connect(sfilter->ssl);
+    else if (sfilter->early_reading)
+	success = ssl_early_accept(sfilter);
     else
 	success = SSL_accept(sfilter->ssl);
 
@@ -318,7 +803,6 @@ ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	err = SSL_get_error(sfilter->ssl, success);
 	goto err_rpt;
     } else if (success == 1) {
-	sfilter->connected = true;
 	rv = 0;
     } else {
 	err = SSL_get_error(sfilter->ssl, success);
@@ -348,60 +832,495 @@ ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	    rv = GE_COMMERR;
 	}
     }
-    ssl_unlock(sfilter);
     return rv;
 }
 
-static int
-ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
-{
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
-    int success, rv = GE_INPROGRESS, shutdown, err;
+/*
+ * The public key operations in a handshake are expensive, and a
+ * burst of new connections doing them on the I/O threads holds up
+ * every established connection on those threads.  With the
+ * handshake-threads option, steps of the handshake that have data to
+ * process are handed to a process-wide pool of worker threads.
+ *
+ * Workers are started as work is queued, up to the largest
+ * handshake-threads value, and sleep on ssl_hs_sem when there is
+ * nothing to do.  The filter holds a reference on the base while a
+ * step is out, and the filter's runner gives it back after telling
+ * the base the step is done, so the base calls ssl_try_connect()
+ * again without polling.
+ */
+#define SSL_HS_MAX_THREADS 64
 
-    ssl_lock(sfilter);
-    sfilter->connected = false;
+struct ssl_hs_worker {
+    struct gensio_thread *tid;
+    struct ssl_hs_worker *next;
+};
 
-    shutdown = SSL_get_shutdown(sfilter->ssl);
-    shutdown &= SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN;
-    if (shutdown == (SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN)) {
-	/* Shutdown is complete. */
-	rv = 0;
-	goto out_unlock;
+static struct gensio_once ssl_hs_once;
+static struct gensio_os_funcs *ssl_hs_o;
+static struct gensio_lock *ssl_hs_lock;
+static struct gensio_thread_sem *ssl_hs_sem;
+static struct ssl_hs_worker *ssl_hs_workers;
+static unsigned int ssl_hs_nr_threads;
+static unsigned int ssl_hs_nr_idle;
+static bool ssl_hs_shutdown;
+static struct ssl_filter *ssl_hs_queue;
+static struct ssl_filter **ssl_hs_queue_tail = &ssl_hs_queue;
+
+/*
+ * Tell the runner a step is finished with, and the reference for it
+ * can be given back.  Call with ssl_hs_lock held.
+ */
+static void
+ssl_hs_release(struct ssl_filter *sfilter)
+{
+    sfilter->hs_refs++;
+    if (!sfilter->hs_run_pending) {
+	sfilter->hs_run_pending = true;
+	sfilter->o->run(sfilter->hs_runner);
     }
+}
 
-    sfilter->want_read = false;
-    sfilter->want_write = false;
+static void
+ssl_hs_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct ssl_filter *sfilter = cb_data;
+    gensio_filter_cb filter_cb = sfilter->filter_cb;
+    void *filter_cb_data = sfilter->filter_cb_data;
+    unsigned int refs;
 
-    if (!sfilter->shutdown_success) {
-	success = SSL_shutdown(sfilter->ssl);
-	if (success >= 0) {
-	    sfilter->shutdown_success = true;
-	    if (success == 1)
-		rv = 0;
-	    else
-		sfilter->want_read = true;
-	    goto out_unlock;
-	}
+    ssl_hs_o->lock(ssl_hs_lock);
+    sfilter->hs_run_pending = false;
+    refs = sfilter->hs_refs;
+    sfilter->hs_refs = 0;
+    ssl_hs_o->unlock(ssl_hs_lock);
 
-	err = SSL_get_error(sfilter->ssl, success);
-	switch (err) {
-	case SSL_ERROR_WANT_READ:
-	    sfilter->want_read = true;
-	    break;
+    /*
+     * Do this even if something else picked up the result, the base
+     * may not have pushed out what the step wrote.
+     */
+    filter_cb(filter_cb_data, GENSIO_FILTER_CB_OPEN_DONE, NULL);
+    /* The last of these may free the filter. */
+    while (refs--)
+	filter_cb(filter_cb_data, GENSIO_FILTER_CB_DEREF, NULL);
+}
 
-	case SSL_ERROR_WANT_WRITE:
-	    sfilter->want_write = true;
-	    break;
+static void
+ssl_hs_thread(void *data)
+{
+    struct ssl_filter *sfilter;
+    bool run;
+    int rv = 0;
 
-	case SSL_ERROR_SSL:
-	    gssl_logs_err(sfilter, "Failed SSL shutdown");
-	    rv = GE_PROTOERR;
-	    break;
+    gensio_os_thread_set_attr(ssl_hs_o, NULL);
 
-	default:
-	    gssl_log_err(sfilter, "Failed SSL shutdown");
-	    rv = GE_COMMERR;
+    ssl_hs_o->lock(ssl_hs_lock);
+    while (!ssl_hs_shutdown) {
+	sfilter = ssl_hs_queue;
+	if (!sfilter) {
+	    ssl_hs_nr_idle++;
+	    ssl_hs_o->unlock(ssl_hs_lock);
+	    gensio_os_sem_wait(ssl_hs_sem);
+	    ssl_hs_o->lock(ssl_hs_lock);
+	    continue;
 	}
+	ssl_hs_queue = sfilter->hs_next;
+	if (!ssl_hs_queue)
+	    ssl_hs_queue_tail = &ssl_hs_queue;
+	sfilter->hs_state = SSL_HS_RUNNING;
+	ssl_hs_o->unlock(ssl_hs_lock);
+
+	ssl_lock(sfilter);
+	ssl_hs_o->lock(ssl_hs_lock);
+	/* Don't bother if it was cancelled while waiting for the lock. */
+	run = sfilter->hs_cancel_waiters == 0;
+	ssl_hs_o->unlock(ssl_hs_lock);
+	if (run)
+	    rv = ssl_handshake_step(sfilter);
+	ssl_unlock(sfilter);
+	/* Anything left is for this thread, don't let it build up. */
+	ERR_clear_error();
+
+	ssl_hs_o->lock(ssl_hs_lock);
+	if (sfilter->hs_cancel_waiters) {
+	    sfilter->hs_state = SSL_HS_IDLE;
+	    for (; sfilter->hs_cancel_waiters > 0;
+		 sfilter->hs_cancel_waiters--)
+		gensio_os_sem_post(sfilter->hs_wait);
+	} else {
+	    sfilter->hs_rv = rv;
+	    sfilter->hs_state = SSL_HS_DONE;
+	}
+	/* This may free the filter, don't touch it after. */
+	ssl_hs_release(sfilter);
+    }
+    ssl_hs_o->unlock(ssl_hs_lock);
+}
+
+static void
+ssl_hs_cleanup(void)
+{
+    struct ssl_hs_worker *w;
+
+    if (!ssl_hs_lock)
+	return;
+    ssl_hs_o->lock(ssl_hs_lock);
+    ssl_hs_shutdown = true;
+    for (; ssl_hs_nr_idle > 0; ssl_hs_nr_idle--)
+	gensio_os_sem_post(ssl_hs_sem);
+    ssl_hs_o->unlock(ssl_hs_lock);
+    while ((w = ssl_hs_workers)) {
+	ssl_hs_workers = w->next;
+	gensio_os_wait_thread(w->tid);
+	ssl_hs_o->free(ssl_hs_o, w);
+    }
+    ssl_hs_nr_threads = 0;
+    ssl_hs_shutdown = false;
+    gensio_os_free_sem(ssl_hs_sem);
+    ssl_hs_sem = NULL;
+    ssl_hs_o->free_lock(ssl_hs_lock);
+    ssl_hs_lock = NULL;
+    memset(&ssl_hs_once, 0, sizeof(ssl_hs_once));
+}
+
+static struct gensio_class_cleanup ssl_hs_cleanup_data = {
+    ssl_hs_cleanup
+};
+
+static void
+ssl_hs_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    ssl_hs_o = o;
+    if (gensio_os_new_sem(o, &ssl_hs_sem))
+	return;
+    ssl_hs_lock = o->alloc_lock(o);
+    if (!ssl_hs_lock) {
+	gensio_os_free_sem(ssl_hs_sem);
+	ssl_hs_sem = NULL;
+	return;
+    }
+    gensio_register_class_cleanup(&ssl_hs_cleanup_data);
+}
+
+/*
+ * Get a worker to look at the queue, waking an idle one or starting
+ * another if the filter allows it.  Returns false if there are no
+ * workers to do the job.  Call with ssl_hs_lock held.
+ */
+static bool
+ssl_hs_kick(struct ssl_filter *sfilter)
+{
+    unsigned int max = sfilter->handshake_threads;
+    struct ssl_hs_worker *w;
+
+    if (ssl_hs_nr_idle > 0) {
+	ssl_hs_nr_idle--;
+	gensio_os_sem_post(ssl_hs_sem);
+	return true;
+    }
+    if (max > SSL_HS_MAX_THREADS)
+	max = SSL_HS_MAX_THREADS;
+    if (ssl_hs_nr_threads >= max)
+	return true;
+    w = ssl_hs_o->zalloc(ssl_hs_o, sizeof(*w));
+    if (!w)
+	return ssl_hs_nr_threads > 0;
+    if (gensio_os_new_thread(ssl_hs_o, ssl_hs_thread, NULL, &w->tid)) {
+	ssl_hs_o->free(ssl_hs_o, w);
+	return ssl_hs_nr_threads > 0;
+    }
+    w->next = ssl_hs_workers;
+    ssl_hs_workers = w;
+    ssl_hs_nr_threads++;
+    return true;
+}
+
+static bool
+ssl_hs_busy(struct ssl_filter *sfilter)
+{
+    bool rv;
+
+    if (!sfilter->hs_runner || sfilter->connected)
+	return false;
+    ssl_hs_o->lock(ssl_hs_lock);
+    rv = (sfilter->hs_state == SSL_HS_QUEUED ||
+	  sfilter->hs_state == SSL_HS_RUNNING);
+    ssl_hs_o->unlock(ssl_hs_lock);
+    return rv;
+}
+
+/*
+ * Make sure no worker has or will touch the SSL.  The filter lock
+ * can't be used to wait for a running step, the worker lets go of it
+ * around the PRECERT_VERIFY event, so wait for the worker to say it
+ * is done.  This does not wait for the base lock, so it's safe to
+ * call with that held.  Call without the filter lock held.
+ */
+static void
+ssl_hs_cancel(struct ssl_filter *sfilter)
+{
+    struct ssl_filter **p;
+    bool running = false;
+
+    if (!sfilter->hs_runner)
+	return;
+    ssl_hs_o->lock(ssl_hs_lock);
+    if (sfilter->hs_state == SSL_HS_QUEUED) {
+	for (p = &ssl_hs_queue; *p != sfilter; p = &(*p)->hs_next)
+	    ;
+	*p = sfilter->hs_next;
+	if (!*p)
+	    ssl_hs_queue_tail = p;
+	ssl_hs_release(sfilter);
+    }
+    if (sfilter->hs_state == SSL_HS_RUNNING) {
+	/* The worker sets it to IDLE. */
+	sfilter->hs_cancel_waiters++;
+	running = true;
+    } else {
+	sfilter->hs_state = SSL_HS_IDLE;
+    }
+    ssl_hs_o->unlock(ssl_hs_lock);
+
+    if (running)
+	gensio_os_sem_wait(sfilter->hs_wait);
+}
+
+/*
+ * See if the handshake step should go to a worker, or if a worker
+ * has finished one.  Returns false to do it here.  Otherwise *rv is
+ * set, GE_INPROGRESS with sfilter->hs_state QUEUED or RUNNING means a
+ * worker has it and the base will be told when it's done.  Call with
+ * the filter lock held, from ssl_try_connect() so the base lock is
+ * held for GENSIO_FILTER_CB_REF.
+ */
+static bool
+ssl_hs_offload(struct ssl_filter *sfilter, int *rv)
+{
+    bool handled = true;
+
+    ssl_hs_o->lock(ssl_hs_lock);
+    switch (sfilter->hs_state) {
+    case SSL_HS_QUEUED:
+    case SSL_HS_RUNNING:
+	*rv = GE_INPROGRESS;
+	break;
+
+    case SSL_HS_DONE:
+	sfilter->hs_state = SSL_HS_IDLE;
+	*rv = sfilter->hs_rv;
+	if (*rv != GE_INPROGRESS || BIO_ctrl_pending(sfilter->ssl_bio) == 0)
+	    break;
+	/* More came in while it was running, go again. */
+	/* Fallthrough */
+    case SSL_HS_IDLE:
+	/* Only steps with something to process do the expensive work. */
+	if (BIO_ctrl_pending(sfilter->ssl_bio) == 0 ||
+		!ssl_hs_kick(sfilter) ||
+		sfilter->filter_cb(sfilter->filter_cb_data,
+				   GENSIO_FILTER_CB_REF, NULL)) {
+	    handled = false;
+	    break;
+	}
+	sfilter->hs_state = SSL_HS_QUEUED;
+	sfilter->hs_next = NULL;
+	*ssl_hs_queue_tail = sfilter;
+	ssl_hs_queue_tail = &sfilter->hs_next;
+	*rv = GE_INPROGRESS;
+	break;
+    }
+    ssl_hs_o->unlock(ssl_hs_lock);
+
+    return handled;
+}
+
+/*
+ * Set up the runner if the filter will use the handshake pool.  If
+ * this fails the handshake is just done on the I/O threads.  DTLS
+ * doesn't use the pool, its retransmit timer works on the SSL
+ * between steps.
+ */
+static void
+ssl_hs_setup(struct ssl_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+
+    if (!sfilter->handshake_threads || !sfilter->filter_cb || sfilter->dtls)
+	return;
+    o->call_once(o, &ssl_hs_once, ssl_hs_init, o);
+    if (!ssl_hs_lock)
+	return;
+    if (gensio_os_new_sem(o, &sfilter->hs_wait))
+	return;
+    sfilter->hs_runner = o->alloc_runner(o, ssl_hs_done, sfilter);
+    if (!sfilter->hs_runner) {
+	gensio_os_free_sem(sfilter->hs_wait);
+	sfilter->hs_wait = NULL;
+    }
+}
+
+#ifdef HAVE_SSL_DTLS
+/*
+ * DTLS retransmits lost handshake messages on a timer.  If one is
+ * running, return GE_RETRY with the time left so the base calls back
+ * then.
+ */
+static int
+ssl_dtls_handshake_timer(struct ssl_filter *sfilter, gensio_time *timeout)
+{
+    struct timeval tv;
+
+    if (!DTLSv1_get_timeout(sfilter->ssl, &tv))
+	return GE_INPROGRESS;
+    timeout->secs = tv.tv_sec;
+    timeout->nsecs = tv.tv_usec * 1000;
+    return GE_RETRY;
+}
+
+static void
+ssl_dtls_connected(struct ssl_filter *sfilter)
+{
+    gensiods size = DTLS_get_data_mtu(sfilter->ssl);
+
+    if (size == 0 || size > sfilter->max_write_size)
+	size = sfilter->max_write_size;
+    sfilter->dgram_write_size = size;
+}
+
+/*
+ * The side that sends the last handshake flight keeps its retransmit
+ * timer after the connection is up, so the base timer can still go
+ * off when open.
+ */
+static int
+ssl_dtls_timeout(struct ssl_filter *sfilter)
+{
+    ssl_lock(sfilter);
+    if (DTLSv1_handle_timeout(sfilter->ssl) < 0)
+	gssl_logs_err(sfilter, "DTLS retransmit failed");
+    ssl_unlock(sfilter);
+    return 0;
+}
+#else
+static int
+ssl_dtls_handshake_timer(struct ssl_filter *sfilter, gensio_time *timeout)
+{
+    return GE_INPROGRESS;
+}
+
+static void
+ssl_dtls_connected(struct ssl_filter *sfilter)
+{
+}
+
+static int
+ssl_dtls_timeout(struct ssl_filter *sfilter)
+{
+    return GE_NOTSUP;
+}
+#endif
+
+static int
+ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+    int rv = GE_INPROGRESS;
+
+    if (sfilter->is_client && !sfilter->sess_checked) {
+	/* Done outside the lock, it goes down to the child. */
+	sfilter->sess_checked = true;
+	ssl_session_find(sfilter);
+    }
+
+    ssl_lock(sfilter);
+    if (!sfilter->hs_started) {
+	sfilter->hs_started = true;
+	GENSIO_PROBE2(ssl_handshake_start, sfilter, sfilter->is_client);
+    }
+    if (sfilter->dtls && DTLSv1_handle_timeout(sfilter->ssl) < 0)
+	/* Retransmitted too many times. */
+	rv = GE_TIMEDOUT;
+    else if (!sfilter->hs_runner || !ssl_hs_offload(sfilter, &rv))
+	rv = ssl_handshake_step(sfilter);
+    if (rv == GE_INPROGRESS && sfilter->dtls)
+	rv = ssl_dtls_handshake_timer(sfilter, timeout);
+    if (rv == 0) {
+	sfilter->connected = true;
+	if (sfilter->dtls)
+	    ssl_dtls_connected(sfilter);
+	if (sfilter->early_data && sfilter->early_written &&
+		ssl_early_accepted(sfilter))
+	    /* Otherwise ssl_ul_write() sends it. */
+	    ssl_early_free(sfilter);
+    }
+    if (rv != GE_INPROGRESS)
+	GENSIO_PROBE3(ssl_handshake_done, sfilter, sfilter->is_client, rv);
+    ssl_unlock(sfilter);
+    return rv;
+}
+
+static int
+ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+    int success, rv = GE_INPROGRESS, shutdown, err;
+
+    ssl_hs_cancel(sfilter);
+
+    ssl_lock(sfilter);
+    sfilter->connected = false;
+
+    shutdown = SSL_get_shutdown(sfilter->ssl);
+    shutdown &= SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN;
+    if (shutdown == (SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN)) {
+	/* Shutdown is complete. */
+	rv = 0;
+	goto out_unlock;
+    }
+
+    sfilter->want_read = false;
+    sfilter->want_write = false;
+
+    if (!sfilter->shutdown_success) {
+	success = SSL_shutdown(sfilter->ssl);
+	if (success >= 0) {
+	    sfilter->shutdown_success = true;
+	    if (sfilter->dtls)
+		/*
+		 * The other end's close may never come over a lossy
+		 * link, just get ours out.
+		 */
+		rv = sfilter->dgram_out.head ? GE_INPROGRESS : 0;
+	    else if (success == 1)
+		rv = 0;
+	    else
+		sfilter->want_read = true;
+	    goto out_unlock;
+	}
+
+	err = SSL_get_error(sfilter->ssl, success);
+	switch (err) {
+	case SSL_ERROR_WANT_READ:
+	    sfilter->want_read = true;
+	    break;
+
+	case SSL_ERROR_WANT_WRITE:
+	    sfilter->want_write = true;
+	    break;
+
+	case SSL_ERROR_SSL:
+	    gssl_logs_err(sfilter, "Failed SSL shutdown");
+	    rv = GE_PROTOERR;
+	    break;
+
+	default:
+	    gssl_log_err(sfilter, "Failed SSL shutdown");
+	    rv = GE_COMMERR;
+	}
+    } else if (sfilter->dtls) {
+	rv = sfilter->dgram_out.head ? GE_INPROGRESS : 0;
     } else {
 	/* Waiting to receive the shutdown from the other end. */
 	sfilter->want_read = true;
@@ -414,130 +1333,347 @@ ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     return rv;
 }
 
+/*
+ * The most one SSL_write() can add to the BIO, beyond the data,
+ * including a possible extra record for CBC IV splitting.
+ */
+#define SSL_WRITE_OVERHEAD \
+    (2 * (SSL3_RT_HEADER_LENGTH + SSL3_RT_MAX_ENCRYPTED_OVERHEAD))
+
+/*
+ * Small pieces of a scatter-gather list are gathered into one record
+ * in a buffer on the stack.  Larger ones are encrypted in place.
+ */
+#define SSL_WRITE_GATHER_SIZE 2048
+
+/*
+ * Move everything the BIO has to the lower layer.  Sets xmit_blocked
+ * if the lower layer didn't take it all.
+ */
 static int
-ssl_ul_write(struct gensio_filter *filter,
-	     gensio_ul_filter_data_handler handler, void *cb_data,
-	     gensiods *rcount,
-	     const struct gensio_sg *sg, gensiods sglen,
-	     const char *const *auxdata)
+ssl_xmit(struct ssl_filter *sfilter,
+	 gensio_ul_filter_data_handler handler, void *cb_data)
 {
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
-    int err = 0;
-    gensiods i;
+    char *xmit_data;
+    int xmit_len, err;
+
+    sfilter->xmit_blocked = false;
+    while (sfilter->dtls) {
+	struct ssl_dgram *d = sfilter->dgram_out.head;
+	gensiods written = 0;
+	struct gensio_sg sg;
+
+	if (!d)
+	    return 0;
+	/* Each datagram goes down whole, as its own packet. */
+	sg.buf = d->data;
+	sg.buflen = d->len;
+	err = handler(cb_data, &written, &sg, 1, NULL);
+	if (err)
+	    return err;
+	if (written < d->len) {
+	    sfilter->xmit_blocked = true;
+	    return 0;
+	}
+	ssl_dgram_queue_pop(sfilter->o, &sfilter->dgram_out);
+    }
+    for (;;) {
+	gensiods written = 0;
+	struct gensio_sg sg;
+
+	xmit_len = BIO_nread0(sfilter->io_bio, &xmit_data);
+	if (xmit_len <= 0)
+	    return 0;
+
+	sg.buf = xmit_data;
+	sg.buflen = xmit_len;
+	err = handler(cb_data, &written, &sg, 1, NULL);
+	if (err)
+	    return err;
+	/* Only now is it safe to let the BIO reuse the space. */
+	if (written > 0)
+	    BIO_nread(sfilter->io_bio, &xmit_data, written);
+	if (written < (gensiods) xmit_len) {
+	    sfilter->xmit_blocked = true;
+	    return 0;
+	}
+	/* The buffer may have wrapped, there may be more. */
+    }
+}
+
+/*
+ * Encrypt len bytes from buf.  The caller makes sure the BIO has room
+ * for all of it, so SSL_write() never has to be retried with the same
+ * data.  Returns the number of bytes taken, 0 if SSL needs I/O first,
+ * or -1 on error with *rerr set.
+ */
+static int
+ssl_encrypt(struct ssl_filter *sfilter, const void *buf, int len, int *rerr)
+{
+    int rv, err;
+
+    sfilter->want_read = false;
+    sfilter->want_write = false;
+    if (sfilter->early_reading)
+	rv = ssl_early_write(sfilter, buf, len);
+    else
+	rv = SSL_write(sfilter->ssl, buf, len);
+    if (rv > 0)
+	return rv;
+
+    err = SSL_get_error(sfilter->ssl, rv);
+    switch (err) {
+    case SSL_ERROR_WANT_READ:
+	sfilter->want_read = true;
+	return 0;
+
+    case SSL_ERROR_WANT_WRITE:
+	sfilter->want_write = true;
+	return 0;
+
+    case SSL_ERROR_SSL:
+	gssl_logs_err(sfilter, "Failed SSL write");
+	*rerr = GE_PROTOERR;
+	break;
+
+    case SSL_ERROR_ZERO_RETURN:
+	*rerr = GE_REMCLOSE;
+	break;
+
+    default:
+	gssl_log_err(sfilter, "Failed SSL write: %d", err);
+	*rerr = GE_COMMERR;
+    }
+    return -1;
+}
+
+/*
+ * If the connection has been idle, the congestion window has probably
+ * shrunk, start over with small records.
+ */
+static void
+ssl_record_check_idle(struct ssl_filter *sfilter)
+{
+    gensio_time now;
+
+    sfilter->o->get_monotonic_time(sfilter->o, &now);
+    if (gensio_time_diff_nsecs(&now, &sfilter->record_last) >
+		sfilter->record_idle)
+	sfilter->record_sent = 0;
+    sfilter->record_last = now;
+}
+
+/*
+ * For DTLS, a user write is one record, which is one datagram, so
+ * message boundaries are kept.  The write is taken whole or not at
+ * all, and one bigger than fits in a datagram fails with GE_TOOBIG.
+ */
+static int
+ssl_dtls_ul_write(struct ssl_filter *sfilter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen)
+{
+    gensiods i, count = 0, total = 0, nsg = 0;
+    const void *buf = NULL;
+    int err = 0, rv;
+
+    for (i = 0; i < sglen; i++) {
+	if (sg[i].buflen) {
+	    buf = sg[i].buf;
+	    nsg++;
+	}
+	total += sg[i].buflen;
+    }
 
     ssl_lock(sfilter);
     if (sfilter->err) {
-	if (rcount) {
-	    *rcount = 0;
-	    for (i = 0; i < sglen; i++)
-		*rcount += sg[i].buflen;
-	}
+	count = total;
 	err = sfilter->err;
 	goto out_unlock;
     }
 
-    if (!sfilter->connected) {
+    if (!sfilter->connected)
 	/* No new data after a close. */
-	if (rcount) {
-	    *rcount = 0;
-	    for (i = 0; i < sglen; i++)
-		*rcount += sg[i].buflen;
-	}
-    } else if (sfilter->write_data_len) {
-	/* Ignore any incoming data if we already have some. */
-	if (rcount)
-	    *rcount = 0;
-    } else {
-	for (i = 0; i < sglen; i++) {
-	    gensiods buflen = sg[i].buflen;
-
-	    if (buflen > sfilter->max_write_size - sfilter->write_data_len)
-		buflen = sfilter->max_write_size - sfilter->write_data_len;
-	    memcpy(sfilter->write_data + sfilter->write_data_len,
-		   sg[i].buf, buflen);
-	    sfilter->write_data_len += buflen;
+	count = total;
+
+    err = ssl_xmit(sfilter, handler, cb_data);
+    if (err || sfilter->xmit_blocked || !sfilter->connected || total == 0)
+	goto out_err;
+
+    if (total > sfilter->dgram_write_size) {
+	/* Not a connection error, just don't take it. */
+	ssl_unlock(sfilter);
+	return GE_TOOBIG;
+    }
+    if (nsg > 1) {
+	for (i = 0, total = 0; i < sglen; i++) {
+	    memcpy(sfilter->dgram_buf + total, sg[i].buf, sg[i].buflen);
+	    total += sg[i].buflen;
 	}
-	if (rcount)
-	    *rcount = sfilter->write_data_len;
+	buf = sfilter->dgram_buf;
     }
+    /* The outgoing queue is empty here, so this can't block. */
+    rv = ssl_encrypt(sfilter, buf, total, &err);
+    if (buf == sfilter->dgram_buf)
+	memset(sfilter->dgram_buf, 0, total);
+    if (rv > 0) {
+	count = total;
+	err = ssl_xmit(sfilter, handler, cb_data);
+    }
+ out_err:
+    if (err)
+	sfilter->err = err;
+ out_unlock:
+    ssl_unlock(sfilter);
+    if (rcount)
+	*rcount = count;
 
- restart:
-    if (sfilter->xmit_buf_len) {
-	gensiods written;
-	struct gensio_sg sg = { sfilter->xmit_buf + sfilter->xmit_buf_pos,
-				sfilter->xmit_buf_len - sfilter->xmit_buf_pos };
+    return err;
+}
 
-	err = handler(cb_data, &written, &sg, 1, NULL);
-	if (err) {
-	    sfilter->xmit_buf_len = 0;
-	    sfilter->write_data_len = 0;
-	} else {
-	    sfilter->xmit_buf_pos += written;
-	    if (sfilter->xmit_buf_pos >= sfilter->xmit_buf_len)
-		sfilter->xmit_buf_len = 0;
-	}
+/*
+ * Client early data that didn't go as 0-RTT goes out as normal data
+ * before anything else is written.
+ */
+static int
+ssl_early_resend(struct ssl_filter *sfilter,
+		 gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    gensiods left, room;
+    int rv, err = 0;
+
+    while (!err && !sfilter->xmit_blocked &&
+	   sfilter->early_data_pos < sfilter->early_data_len) {
+	room = BIO_ctrl_get_write_guarantee(sfilter->ssl_bio);
+	if (room <= SSL_WRITE_OVERHEAD)
+	    break;
+	room -= SSL_WRITE_OVERHEAD;
+	left = sfilter->early_data_len - sfilter->early_data_pos;
+	if (left > room)
+	    left = room;
+	if (left > sfilter->max_write_size)
+	    left = sfilter->max_write_size;
+	rv = ssl_encrypt(sfilter, sfilter->early_data + sfilter->early_data_pos,
+			 left, &err);
+	if (rv <= 0)
+	    break;
+	sfilter->early_data_pos += rv;
+	err = ssl_xmit(sfilter, handler, cb_data);
     }
+    if (sfilter->early_data_pos >= sfilter->early_data_len)
+	ssl_early_free(sfilter);
+    return err;
+}
 
-    if (!err && sfilter->xmit_buf_len == 0 && sfilter->write_data_len > 0) {
-	sfilter->want_read = false;
-	sfilter->want_write = false;
-	err = SSL_write(sfilter->ssl, sfilter->write_data,
-			sfilter->write_data_len);
-	if (err <= 0) {
-	    err = SSL_get_error(sfilter->ssl, err);
-	    switch (err) {
-	    case SSL_ERROR_WANT_READ:
-		sfilter->want_read = true;
-		err = 0;
-		break;
+static int
+ssl_ul_write(struct gensio_filter *filter,
+	     gensio_ul_filter_data_handler handler, void *cb_data,
+	     gensiods *rcount,
+	     const struct gensio_sg *sg, gensiods sglen,
+	     const char *const *auxdata)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+    unsigned char gather[SSL_WRITE_GATHER_SIZE];
+    gensiods i, count = 0, pos = 0, total = 0;
+    int err = 0;
 
-	    case SSL_ERROR_WANT_WRITE:
-		sfilter->want_write = true;
-		err = 0;
-		break;
+    if (sfilter->dtls)
+	return ssl_dtls_ul_write(sfilter, handler, cb_data, rcount, sg, sglen);
 
-	    case SSL_ERROR_SSL:
-		gssl_logs_err(sfilter, "Failed SSL write");
-		err = GE_PROTOERR;
-		sfilter->write_data_len = 0;
-		break;
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
 
-	    case SSL_ERROR_ZERO_RETURN:
-		err = GE_REMCLOSE;
-		sfilter->write_data_len = 0;
-		break;
+    if (ssl_hs_busy(sfilter)) {
+	/* Not connected, so nothing to take, and the worker has the BIO. */
+	if (rcount)
+	    *rcount = total;
+	return 0;
+    }
 
-	    default:
-		gssl_log_err(sfilter, "Failed SSL write: %d", err);
-		err = GE_COMMERR;
-		sfilter->write_data_len = 0;
-	    }
-	} else {
-	    assert(err == sfilter->write_data_len);
-	    sfilter->write_data_len = 0;
-	    err = 0;
-	}
+    ssl_lock(sfilter);
+    if (sfilter->err) {
+	count = total;
+	err = sfilter->err;
+	goto out_unlock;
     }
 
-    if (!err && sfilter->xmit_buf_len == 0) {
-	int rdlen = BIO_read(sfilter->io_bio, sfilter->xmit_buf,
-			     sfilter->max_xmit_buf);
+    if (!sfilter->connected)
+	/* No new data after a close. */
+	count = total;
+
+    err = ssl_xmit(sfilter, handler, cb_data);
+    if (!err && sfilter->early_data && sfilter->connected)
+	err = ssl_early_resend(sfilter, handler, cb_data);
+    if (sfilter->record_start && total > 0)
+	ssl_record_check_idle(sfilter);
+    i = 0;
+    while (!err && !sfilter->xmit_blocked && sfilter->connected &&
+	   !sfilter->early_data && i < sglen) {
+	gensiods left = sg[i].buflen - pos, room, max;
+	int rv;
+
+	if (left == 0) {
+	    i++;
+	    pos = 0;
+	    continue;
+	}
 
-	if (rdlen <= 0) {
-	    if (!BIO_should_retry(sfilter->io_bio)) {
-		gssl_log_err(sfilter, "Failed BIO read");
-		err = GE_COMMERR;
+	/* The BIO is empty here, a full record always fits. */
+	room = BIO_ctrl_get_write_guarantee(sfilter->ssl_bio);
+	if (room <= SSL_WRITE_OVERHEAD)
+	    break;
+	max = room - SSL_WRITE_OVERHEAD;
+	if (max > sfilter->max_write_size)
+	    max = sfilter->max_write_size;
+	if (sfilter->record_start && sfilter->record_sent < sfilter->record_grow
+		&& max > sfilter->record_start)
+	    max = sfilter->record_start;
+	if (max > INT_MAX)
+	    max = INT_MAX;
+
+	if (left < sizeof(gather) && i + 1 < sglen && max >= sizeof(gather)) {
+	    gensiods glen = 0, gi = i, gpos = pos;
+
+	    /* Gather the small pieces into one record. */
+	    while (gi < sglen && sg[gi].buflen - gpos <= sizeof(gather) - glen) {
+		memcpy(gather + glen, (const unsigned char *) sg[gi].buf + gpos,
+		       sg[gi].buflen - gpos);
+		glen += sg[gi].buflen - gpos;
+		gi++;
+		gpos = 0;
 	    }
+	    rv = ssl_encrypt(sfilter, gather, glen, &err);
+	    memset(gather, 0, glen);
+	    if (rv <= 0)
+		break;
+	    count += glen;
+	    sfilter->record_sent += glen;
+	    i = gi;
+	    pos = gpos;
 	} else {
-	    sfilter->xmit_buf_len = rdlen;
-	    sfilter->xmit_buf_pos = 0;
-	    goto restart;
+	    if (left > max)
+		left = max;
+	    rv = ssl_encrypt(sfilter, (const unsigned char *) sg[i].buf + pos,
+			     left, &err);
+	    if (rv <= 0)
+		break;
+	    count += rv;
+	    pos += rv;
+	    sfilter->record_sent += rv;
 	}
+
+	err = ssl_xmit(sfilter, handler, cb_data);
     }
+    if (!err && !sfilter->xmit_blocked && BIO_pending(sfilter->io_bio))
+	/* SSL_write() may have produced handshake data with no user data. */
+	err = ssl_xmit(sfilter, handler, cb_data);
     if (err)
 	sfilter->err = err;
  out_unlock:
     ssl_unlock(sfilter);
+    if (rcount)
+	*rcount = count;
 
     return err;
 }
@@ -567,7 +1703,18 @@ ssl_ll_write(struct gensio_filter *filter,
 	goto out_unlock;
     }
 
-    if (buflen > 0) {
+    if (buflen > 0 && sfilter->dtls) {
+	/* One packet from below is one datagram. */
+	if (sfilter->dgram_in.len >= SSL_DGRAM_QUEUE_MAX)
+	    buflen = 0; /* Leave it below until SSL takes some. */
+	else if (!ssl_dgram_queue_add(sfilter->o, &sfilter->dgram_in,
+				      buf, buflen))
+	    err = GE_NOMEM;
+	if (rcount)
+	    *rcount = buflen;
+	if (err)
+	    goto out_err;
+    } else if (buflen > 0) {
 	int wrlen = BIO_write(sfilter->io_bio, buf, buflen);
 
 	if (wrlen <= 0) {
@@ -584,13 +1731,37 @@ ssl_ll_write(struct gensio_filter *filter,
     }
 
  process_more:
+    if (sfilter->hs_runner && !sfilter->connected)
+	/* Leave the handshake to ssl_try_connect() so it can offload. */
+	goto out_err;
+
     if (!sfilter->read_data_len) {
-	int rlen;
+	int rlen = 0;
 
 	sfilter->want_read = false;
 	sfilter->want_write = false;
-	rlen = SSL_read(sfilter->ssl, sfilter->read_data,
-			sfilter->max_read_size);
+	if (sfilter->early_reading) {
+	    if (!sfilter->read_data && !ssl_rbuf_get(sfilter)) {
+		err = GE_NOMEM;
+		goto out_err;
+	    }
+	    rlen = ssl_early_read(sfilter);
+	}
+	if (rlen == 0 && !sfilter->early_reading) {
+	    if (!sfilter->read_data) {
+		char c;
+
+		/* Only borrow a buffer if there is something to read. */
+		rlen = SSL_peek(sfilter->ssl, &c, 1);
+		if (rlen > 0 && !ssl_rbuf_get(sfilter)) {
+		    err = GE_NOMEM;
+		    goto out_err;
+		}
+	    }
+	    if (sfilter->read_data)
+		rlen = SSL_read(sfilter->ssl, sfilter->read_data,
+				sfilter->max_read_size);
+	}
 	if (rlen <= 0) {
 	    err = SSL_get_error(sfilter->ssl, rlen);
 	    switch (err) {
@@ -630,6 +1801,7 @@ ssl_ll_write(struct gensio_filter *filter,
 	    }
 	} else {
 	    sfilter->read_data_len = rlen;
+	    sfilter->read_data_filled = rlen;
 	}
 	sfilter->read_data_pos = 0;
     }
@@ -654,6 +1826,9 @@ ssl_ll_write(struct gensio_filter *filter,
 	    }
 	}
     }
+ out_err:
+    if (!sfilter->read_data_len && sfilter->read_data)
+	ssl_rbuf_put(sfilter);
     if (err && !sfilter->err)
 	sfilter->err = err;
  out_unlock:
@@ -662,34 +1837,72 @@ ssl_ll_write(struct gensio_filter *filter,
     return err;
 }
 
+#ifdef HAVE_SSL_DTLS
+static int
+ssl_dtls_setup(struct ssl_filter *sfilter)
+{
+    BIO *bio;
+
+    if (!ssl_dgram_method)
+	return GE_NOMEM;
+    bio = BIO_new(ssl_dgram_method);
+    if (!bio)
+	return GE_NOMEM;
+    BIO_set_data(bio, sfilter);
+    SSL_set_bio(sfilter->ssl, bio, bio);
+
+    /* There's no socket to ask, the MTU comes from the user. */
+    SSL_set_options(sfilter->ssl, SSL_OP_NO_QUERY_MTU);
+    if (!SSL_set_mtu(sfilter->ssl, sfilter->mtu))
+	return GE_INVAL;
+    return 0;
+}
+#else
+static int
+ssl_dtls_setup(struct ssl_filter *sfilter)
+{
+    return GE_NOTSUP;
+}
+#endif
+
 static int
 ssl_setup(struct gensio_filter *filter, struct gensio *io)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
-    int success;
+    int success, rv;
     gensiods bio_size = sfilter->max_read_size * 2;
 
+    sfilter->io = io;
     sfilter->ssl = SSL_new(sfilter->ctx);
     if (!sfilter->ssl)
 	return GE_NOMEM;
 
-    /* The BIO has to be large enough to hold a full SSL key transaction. */
-    if (bio_size < 4096)
-	bio_size = 4096;
-    success = BIO_new_bio_pair(&sfilter->ssl_bio, bio_size,
-			       &sfilter->io_bio, bio_size);
-    if (!success) {
+    if (sfilter->dtls) {
+	rv = ssl_dtls_setup(sfilter);
+    } else {
+	/* The BIO has to be large enough to hold a full SSL key transaction. */
+	if (bio_size < 4096)
+	    bio_size = 4096;
+	success = BIO_new_bio_pair(&sfilter->ssl_bio, bio_size,
+				   &sfilter->io_bio, bio_size);
+	if (success)
+	    SSL_set_bio(sfilter->ssl, sfilter->ssl_bio, sfilter->ssl_bio);
+	rv = success ? 0 : GE_NOMEM;
+    }
+    if (rv) {
 	SSL_free(sfilter->ssl);
 	sfilter->ssl = NULL;
-	return GE_NOMEM;
+	return rv;
     }
 
-    SSL_set_bio(sfilter->ssl, sfilter->ssl_bio, sfilter->ssl_bio);
+    /* The SSL_CTX may be shared, so the verify callback finds us here. */
+    SSL_set_app_data(sfilter->ssl, sfilter);
 
     if (sfilter->is_client)
 	SSL_set_connect_state(sfilter->ssl);
     else
 	SSL_set_accept_state(sfilter->ssl);
+    ssl_early_setup(sfilter);
 
     return 0;
 }
@@ -699,12 +1912,24 @@ ssl_cleanup(struct gensio_filter *filter)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
 
+    ssl_hs_cancel(sfilter);
     if (sfilter->verify_store)
 	X509_STORE_free(sfilter->verify_store);
     sfilter->verify_store = NULL;
     if (sfilter->remcert)
 	X509_free(sfilter->remcert);
     sfilter->remcert = NULL;
+    if (sfilter->ssl &&
+	    SSL_get_shutdown(sfilter->ssl) & SSL_RECEIVED_SHUTDOWN)
+	/*
+	 * The other end closed cleanly, but ours may not have gone out
+	 * if the lower layer closed first.  Without this SSL_free()
+	 * takes the session out of the server's cache, which loses
+	 * session id resumption and the single use tickets early data
+	 * needs.
+	 */
+	SSL_set_shutdown(sfilter->ssl, (SSL_SENT_SHUTDOWN |
+					SSL_RECEIVED_SHUTDOWN));
     if (sfilter->ssl)
 	SSL_free(sfilter->ssl);
     sfilter->ssl = NULL;
@@ -713,19 +1938,35 @@ ssl_cleanup(struct gensio_filter *filter)
 	BIO_free(sfilter->io_bio);
     sfilter->ssl_bio = NULL;
     sfilter->io_bio = NULL;
+    ssl_dgram_queue_clear(sfilter->o, &sfilter->dgram_in);
+    ssl_dgram_queue_clear(sfilter->o, &sfilter->dgram_out);
+    sfilter->dgram_write_size = 0;
     sfilter->err = 0;
     sfilter->read_data_len = 0;
     sfilter->read_data_pos = 0;
-    sfilter->xmit_buf_len = 0;
-    sfilter->xmit_buf_pos = 0;
-    sfilter->write_data_len = 0;
+    if (sfilter->read_data)
+	ssl_rbuf_put(sfilter);
+    sfilter->xmit_blocked = false;
     sfilter->connected = false;
     sfilter->shutdown_success = false;
+    if (sfilter->sess_key)
+	sfilter->o->free(sfilter->o, sfilter->sess_key);
+    sfilter->sess_key = NULL;
+    sfilter->sess_checked = false;
+    sfilter->hs_started = false;
+    ssl_early_free(sfilter);
+    sfilter->early_written = false;
+    sfilter->early_reading = false;
 }
 
 static void
 sfilter_free(struct ssl_filter *sfilter)
 {
+    ssl_hs_cancel(sfilter);
+    if (sfilter->hs_runner)
+	sfilter->o->free_runner(sfilter->hs_runner);
+    if (sfilter->hs_wait)
+	gensio_os_free_sem(sfilter->hs_wait);
     if (sfilter->verify_store)
 	X509_STORE_free(sfilter->verify_store);
     if (sfilter->remcert)
@@ -737,16 +1978,19 @@ sfilter_free(struct ssl_filter *sfilter)
 	BIO_free(sfilter->io_bio);
     if (sfilter->ctx)
 	SSL_CTX_free(sfilter->ctx);
+    ssl_dgram_queue_clear(sfilter->o, &sfilter->dgram_in);
+    ssl_dgram_queue_clear(sfilter->o, &sfilter->dgram_out);
+    if (sfilter->dgram_buf)
+	sfilter->o->free(sfilter->o, sfilter->dgram_buf);
+    if (sfilter->sess_key)
+	sfilter->o->free(sfilter->o, sfilter->sess_key);
+    if (sfilter->sess_key_base)
+	sfilter->o->free(sfilter->o, sfilter->sess_key_base);
     if (sfilter->lock)
 	sfilter->o->free_lock(sfilter->lock);
-    if (sfilter->read_data) {
-	memset(sfilter->read_data, 0, sfilter->max_read_size);
-	sfilter->o->free(sfilter->o, sfilter->read_data);
-    }
-    if (sfilter->xmit_buf)
-	sfilter->o->free(sfilter->o, sfilter->xmit_buf);
-    if (sfilter->write_data)
-	sfilter->o->free(sfilter->o, sfilter->write_data);
+    if (sfilter->read_data)
+	ssl_rbuf_put(sfilter);
+    ssl_early_free(sfilter);
     if (sfilter->filter)
 	gensio_filter_free_data(sfilter->filter);
     sfilter->o->free(sfilter->o, sfilter);
@@ -952,9 +2196,82 @@ ssl_filter_control(struct gensio_filter *filter, bool get, int op, char *data,
     case GENSIO_CONTROL_MAX_WRITE_PACKET:
 	if (!get)
 	    return GE_NOTSUP;
-	*datalen = snprintf(data, *datalen, "%lu",
-			    (unsigned long) sfilter->max_write_size);
+	if (sfilter->dtls && sfilter->dgram_write_size)
+	    *datalen = snprintf(data, *datalen, "%lu",
+				(unsigned long) sfilter->dgram_write_size);
+	else
+	    *datalen = snprintf(data, *datalen, "%lu",
+				(unsigned long) sfilter->max_write_size);
+	return 0;
+
+    case GENSIO_CONTROL_SESSION_REUSED: {
+	int reused = 0;
+
+	if (!get)
+	    return GE_NOTSUP;
+	ssl_lock(sfilter);
+	if (!sfilter->ssl || !sfilter->connected) {
+	    ssl_unlock(sfilter);
+	    return GE_NOTREADY;
+	}
+	reused = SSL_session_reused(sfilter->ssl);
+	ssl_unlock(sfilter);
+	*datalen = snprintf(data, *datalen, "%d", reused ? 1 : 0);
 	return 0;
+    }
+
+    case GENSIO_CONTROL_EARLY_DATA: {
+	int rv = 0;
+
+	ssl_lock(sfilter);
+	if (get) {
+	    if (!sfilter->ssl || !sfilter->connected)
+		rv = GE_NOTREADY;
+	    else
+		*datalen = snprintf(data, *datalen, "%d",
+				    ssl_early_accepted(sfilter) ? 1 : 0);
+	} else if (!sfilter->is_client || !sfilter->early_data_max) {
+	    rv = GE_NOTSUP;
+	} else if (sfilter->hs_started) {
+	    rv = GE_NOTREADY;
+	} else if (*datalen > sfilter->early_data_max - sfilter->early_data_len) {
+	    rv = GE_TOOBIG;
+	} else {
+	    if (!sfilter->early_data)
+		sfilter->early_data = sfilter->o->zalloc(sfilter->o,
+						sfilter->early_data_max);
+	    if (!sfilter->early_data) {
+		rv = GE_NOMEM;
+	    } else {
+		memcpy(sfilter->early_data + sfilter->early_data_len, data,
+		       *datalen);
+		sfilter->early_data_len += *datalen;
+	    }
+	}
+	ssl_unlock(sfilter);
+	return rv;
+    }
+
+    case GENSIO_CONTROL_EXPORT_KEYING: {
+	char *label;
+	int rv = 0;
+
+	if (!get)
+	    return GE_NOTSUP;
+	label = gensio_strdup(sfilter->o, data);
+	if (!label)
+	    return GE_NOMEM;
+	ssl_lock(sfilter);
+	if (!sfilter->ssl || !sfilter->connected)
+	    rv = GE_NOTREADY;
+	else if (!SSL_export_keying_material(sfilter->ssl,
+					     (unsigned char *) data, *datalen,
+					     label, strlen(label), NULL, 0, 0))
+	    rv = GE_INVAL;
+	ssl_unlock(sfilter);
+	sfilter->o->free(sfilter->o, label);
+	return rv;
+    }
 
     default:
 	return GE_NOTSUP;
@@ -1016,11 +2333,24 @@ static int gensio_ssl_filter_func(struct gensio_filter *filter, int op,
 				  count);
 
     case GENSIO_FILTER_FUNC_TIMEOUT:
+	if (filter_to_ssl(filter)->dtls)
+	    return ssl_dtls_timeout(filter_to_ssl(filter));
+	return GE_NOTSUP;
+
     default:
 	return GE_NOTSUP;
     }
 }
 
+static const struct gensio_filter_ops ssl_filter_ops = {
+    .ul_read_pending = ssl_ul_read_pending,
+    .ll_write_pending = ssl_ll_write_pending,
+    .ll_read_needed = ssl_ll_read_needed,
+    .ul_can_write = ssl_ul_can_write,
+    .ul_write = ssl_ul_write,
+    .ll_write = ssl_ll_write,
+};
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #define X509_STORE_CTX_get0_cert(ctx) ((ctx)->cert)
 #define X509_STORE_CTX_get0_chain(ctx) ((ctx)->chain)
@@ -1029,7 +2359,9 @@ static int gensio_ssl_filter_func(struct gensio_filter *filter, int op,
 static int
 gensio_ssl_cert_verify(X509_STORE_CTX *ctx, void *cb_data)
 {
-    struct ssl_filter *sfilter = cb_data;
+    SSL *ssl = X509_STORE_CTX_get_ex_data(ctx,
+					  SSL_get_ex_data_X509_STORE_CTX_idx());
+    struct ssl_filter *sfilter = SSL_get_app_data(ssl);
     X509_STORE_CTX *nctx = NULL;
     X509 *cert = X509_STORE_CTX_get0_cert(ctx);
     int rv;
@@ -1112,31 +2444,15 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->expect_peer_cert = expect_peer_cert;
     sfilter->allow_authfail = allow_authfail;
 
-    SSL_CTX_set_cert_verify_callback(ctx, gensio_ssl_cert_verify, sfilter);
-
     sfilter->lock = o->alloc_lock(o);
     if (!sfilter->lock)
 	goto out_nomem;
 
-    sfilter->read_data = o->zalloc(o, sfilter->max_read_size);
-    if (!sfilter->read_data)
-	goto out_nomem;
-
-    sfilter->write_data = o->zalloc(o, sfilter->max_write_size);
-    if (!sfilter->write_data)
-	goto out_nomem;
-
-    sfilter->max_xmit_buf = sfilter->max_write_size + 128;
-    if (sfilter->max_xmit_buf < 1024)
-	sfilter->max_xmit_buf = 1024; /* Enough room for the protocol. */
-    sfilter->xmit_buf = o->zalloc(o, sfilter->max_xmit_buf);
-    if (!sfilter->xmit_buf)
-	goto out_nomem;
-
     sfilter->filter = gensio_filter_alloc_data(o, gensio_ssl_filter_func,
 					       sfilter);
     if (!sfilter->filter)
 	goto out_nomem;
+    gensio_filter_set_ops(sfilter->filter, &ssl_filter_ops);
 
     /*
      * Delay setting this so that it's not freed if there is a memory
@@ -1150,11 +2466,15 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
     return NULL;
 }
 
-int
-gensio_ssl_filter_config(struct gensio_os_funcs *o,
-			 const char * const args[],
-			 bool default_is_client,
-			 struct gensio_ssl_filter_data **rdata)
+/*
+ * The ssl and dtls gensios take the same options, except for mtu.
+ * Defaults come from their own class.
+ */
+static int
+ssl_filter_config(struct gensio_os_funcs *o, const char *cls,
+		  const char * const args[],
+		  bool default_is_client, bool dtls,
+		  struct gensio_ssl_filter_data **rdata)
 {
     unsigned int i;
     struct gensio_ssl_filter_data *data = o->zalloc(o, sizeof(*data));
@@ -1166,21 +2486,60 @@ gensio_ssl_filter_config(struct gensio_os_funcs *o,
 	return GE_NOMEM;
     data->o = o;
     data->is_client = default_is_client;
+    data->dtls = dtls;
     data->max_write_size = SSL3_RT_MAX_PLAIN_LENGTH;
     data->max_read_size = SSL3_RT_MAX_PLAIN_LENGTH;
 
-    rv = gensio_get_default(o, "ssl", "allow-authfail", false,
+    if (dtls) {
+	rv = gensio_get_default(o, cls, "mtu", false,
+				GENSIO_DEFAULT_INT, NULL, &ival);
+	if (rv)
+	    return rv;
+	data->mtu = ival;
+    }
+
+    rv = gensio_get_default(o, cls, "allow-authfail", false,
 			    GENSIO_DEFAULT_BOOL, NULL, &ival);
     if (rv)
 	return rv;
     data->allow_authfail = ival;
-    rv = gensio_get_default(o, "ssl", "clientauth", false,
+    rv = gensio_get_default(o, cls, "clientauth", false,
 			    GENSIO_DEFAULT_BOOL, NULL, &ival);
     if (rv)
 	return rv;
     data->clientauth = ival;
+    rv = gensio_get_default(o, cls, "handshake-threads", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->handshake_threads = ival;
+    rv = gensio_get_default(o, cls, "record-start", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->record_start = ival;
+    rv = gensio_get_default(o, cls, "record-grow", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->record_grow = ival;
+    rv = gensio_get_default(o, cls, "record-idle", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    gensio_msecs_to_time(&data->record_idle, ival);
+    rv = gensio_get_default(o, cls, "early-data", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->early_data_max = ival;
+    rv = gensio_get_default(o, cls, "early-data-age", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->early_data_age.secs = ival;
 
-    rv = gensio_get_default(o, "ssl", "mode", false,
+    rv = gensio_get_default(o, cls, "mode", false,
 			    GENSIO_DEFAULT_STR, &str, NULL);
     if (rv) {
 	gensio_log(o, GENSIO_LOG_ERR,
@@ -1232,24 +2591,44 @@ gensio_ssl_filter_config(struct gensio_os_funcs *o,
 	if (gensio_check_keybool(args[i], "clientauth",
 				 &data->clientauth) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "handshake-threads",
+				 &data->handshake_threads) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "record-start",
+			       &data->record_start) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "record-grow",
+			       &data->record_grow) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "record-idle", 'm',
+				 &data->record_idle) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "early-data",
+			       &data->early_data_max) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "early-data-age", 's',
+				 &data->early_data_age) > 0)
+	    continue;
+	if (dtls && gensio_check_keyds(args[i], "mtu", &data->mtu) > 0)
+	    continue;
 	rv = GE_INVAL;
 	goto out_err;
     }
 
     if (!data->keyfile) {
-	rv = gensio_get_default(o, "ssl", "key", false, GENSIO_DEFAULT_STR,
+	rv = gensio_get_default(o, cls, "key", false, GENSIO_DEFAULT_STR,
 				&data->keyfile, NULL);
 	if (rv)
 	    goto out_err;
     }
     if (!data->certfile) {
-	rv = gensio_get_default(o, "ssl", "cert", false, GENSIO_DEFAULT_STR,
+	rv = gensio_get_default(o, cls, "cert", false, GENSIO_DEFAULT_STR,
 				&data->certfile, NULL);
 	if (rv)
 	    goto out_err;
     }
     if (!data->CAfilepath) {
-	rv = gensio_get_default(o, "ssl", "CA", false, GENSIO_DEFAULT_STR,
+	rv = gensio_get_default(o, cls, "CA", false, GENSIO_DEFAULT_STR,
 				&data->CAfilepath, NULL);
 	if (rv)
 	    goto out_err;
@@ -1270,6 +2649,29 @@ gensio_ssl_filter_config(struct gensio_os_funcs *o,
 	}
     }
 
+    if (dtls) {
+	if (data->mtu < 256 || data->mtu > 65535) {
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	/*
+	 * Records are sized by the datagram, and the handshake is
+	 * driven by its retransmit timer, so these don't apply.
+	 */
+	data->handshake_threads = 0;
+	data->record_start = 0;
+	/* DTLS 1.2 has no 0-RTT. */
+	data->early_data_max = 0;
+    }
+
+    if (data->early_data_max > SSL3_RT_MAX_PLAIN_LENGTH) {
+	rv = GE_INVAL;
+	goto out_err;
+    }
+#ifndef HAVE_SSL_EARLY_DATA
+    data->early_data_max = 0;
+#endif
+
     *rdata = data;
 
     return 0;
@@ -1284,6 +2686,28 @@ gensio_ssl_filter_config(struct gensio_os_funcs *o,
     return rv;
 }
 
+int
+gensio_ssl_filter_config(struct gensio_os_funcs *o,
+			 const char * const args[],
+			 bool default_is_client,
+			 struct gensio_ssl_filter_data **rdata)
+{
+    return ssl_filter_config(o, "ssl", args, default_is_client, false, rdata);
+}
+
+int
+gensio_dtls_filter_config(struct gensio_os_funcs *o,
+			  const char * const args[],
+			  bool default_is_client,
+			  struct gensio_ssl_filter_data **rdata)
+{
+#ifdef HAVE_SSL_DTLS
+    return ssl_filter_config(o, "dtls", args, default_is_client, true, rdata);
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 void
 gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data)
 {
@@ -1302,28 +2726,50 @@ gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data)
     o->free(o, data);
 }
 
-int
-gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
-			struct gensio_filter **rfilter)
+static int
+gensio_ssl_ctx_alloc(struct gensio_ssl_filter_data *data,
+		     bool expect_peer_cert, SSL_CTX **rctx)
 {
-    struct gensio_os_funcs *o = data->o;
-    SSL_CTX *ctx = NULL;
-    struct gensio_filter *filter;
-    bool expect_peer_cert;
-    int rv = GE_INVAL;
-
-    gensio_ssl_initialize(o);
+    SSL_CTX *ctx;
+    int rv;
 
-    if (data->is_client) {
-	expect_peer_cert = true;
+    if (data->dtls)
+#ifdef HAVE_SSL_DTLS
+	ctx = SSL_CTX_new(data->is_client ? DTLS_client_method()
+			  : DTLS_server_method());
+#else
+	return GE_NOTSUP;
+#endif
+    else if (data->is_client)
 	ctx = SSL_CTX_new(SSLv23_client_method());
-    } else {
-	expect_peer_cert = data->clientauth;
+    else
 	ctx = SSL_CTX_new(SSLv23_server_method());
-    }
     if (!ctx)
 	return GE_NOMEM;
 
+    SSL_CTX_set_cert_verify_callback(ctx, gensio_ssl_cert_verify, NULL);
+
+    /*
+     * User data is not copied, so if a write ever does have to be
+     * retried the data will come from a different buffer.
+     */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    /*
+     * Servers resume sessions through the SSL_CTX, which is shared
+     * between connections.  A session id context is required for that
+     * when verifying the peer.  Clients keep their sessions in the
+     * session store, not in the SSL_CTX.
+     */
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "gensio", 6);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (data->is_client) {
+	SSL_CTX_set_session_cache_mode(ctx, (SSL_SESS_CACHE_CLIENT |
+					     SSL_SESS_CACHE_NO_INTERNAL_STORE));
+	SSL_CTX_sess_set_new_cb(ctx, ssl_session_new);
+    }
+#endif
+
     if (!data->is_client && expect_peer_cert)
 	/*
 	 * In server mode, the certificate will not be requested unless
@@ -1365,21 +2811,575 @@ gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
 	}
     }
 
+    *rctx = ctx;
+    return 0;
+
+ err:
+    SSL_CTX_free(ctx);
+    return rv;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/*
+ * Loading keys and certificates is expensive, much more than the
+ * handshake, so SSL_CTXs are shared between all ssl filters with the
+ * same settings, like all the connections from an accepter.  Each
+ * filter holds a reference (SSL_CTX_up_ref()) and the cache holds
+ * one.  If any of the files change, the next filter gets a new
+ * SSL_CTX; ones already using the old one keep it.
+ */
+#define SSL_CTX_CACHE_MAX 16
+
+enum { SSL_CTX_FILE_CA, SSL_CTX_FILE_CERT, SSL_CTX_FILE_KEY,
+       SSL_CTX_NR_FILES };
+
+struct ssl_ctx_file_id {
+    time_t mtime;
+    time_t ctime;
+    off_t size;
+    ino_t ino;
+};
+
+struct ssl_ctx_cache_ent {
+    struct ssl_ctx_cache_ent *next;
+    SSL_CTX *ctx;
+    bool is_client;
+    bool dtls;
+    bool expect_peer_cert;
+    char *files[SSL_CTX_NR_FILES];
+    struct ssl_ctx_file_id ids[SSL_CTX_NR_FILES];
+};
+
+static struct gensio_once ssl_cache_once;
+static struct gensio_os_funcs *ssl_cache_o;
+static struct gensio_lock *ssl_cache_lock;
+static struct ssl_ctx_cache_ent *ssl_ctx_cache;
+static unsigned int ssl_ctx_cache_len;
+
+static void
+ssl_ctx_cache_ent_free(struct ssl_ctx_cache_ent *e)
+{
+    struct gensio_os_funcs *o = ssl_cache_o;
+    unsigned int i;
+
+    if (e->ctx)
+	SSL_CTX_free(e->ctx);
+    for (i = 0; i < SSL_CTX_NR_FILES; i++) {
+	if (e->files[i])
+	    o->free(o, e->files[i]);
+    }
+    o->free(o, e);
+}
+
+/*
+ * Read buffers are only needed while decrypted data is waiting for
+ * the user, so they are kept in a pool and borrowed.  Only buffers
+ * of the default size are pooled, others come from the allocator.
+ * There is a pool per NUMA node, like the fd read buffers.
+ */
+#define SSL_RBUF_POOL_MAX 32
+#define SSL_RBUF_MAX_NODES 8
+
+struct ssl_rbuf {
+    struct ssl_rbuf *next;
+};
+
+static struct ssl_rbuf *ssl_rbuf_pool[SSL_RBUF_MAX_NODES];
+static unsigned int ssl_rbuf_pool_len[SSL_RBUF_MAX_NODES];
+
+static unsigned char *
+ssl_rbuf_get(struct ssl_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    struct ssl_rbuf *b = NULL;
+
+    sfilter->read_data_node = gensio_os_funcs_get_numa_node(o) %
+	SSL_RBUF_MAX_NODES;
+    if (sfilter->max_read_size == SSL3_RT_MAX_PLAIN_LENGTH && ssl_cache_lock) {
+	unsigned int node = sfilter->read_data_node;
+
+	ssl_cache_o->lock(ssl_cache_lock);
+	b = ssl_rbuf_pool[node];
+	if (b) {
+	    ssl_rbuf_pool[node] = b->next;
+	    ssl_rbuf_pool_len[node]--;
+	}
+	ssl_cache_o->unlock(ssl_cache_lock);
+	if (b)
+	    memset(b, 0, sizeof(*b));
+    }
+    if (!b)
+	b = gensio_os_funcs_buf_zalloc(o, sfilter->max_read_size);
+    sfilter->read_data = (unsigned char *) b;
+    sfilter->read_data_filled = 0;
+    return sfilter->read_data;
+}
+
+static void
+ssl_rbuf_put(struct ssl_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    struct ssl_rbuf *b = (struct ssl_rbuf *) sfilter->read_data;
+
+    /* Don't leave plaintext lying around. */
+    memset(b, 0, sfilter->read_data_filled);
+    sfilter->read_data = NULL;
+    sfilter->read_data_filled = 0;
+    if (sfilter->max_read_size == SSL3_RT_MAX_PLAIN_LENGTH && ssl_cache_lock) {
+	unsigned int node = sfilter->read_data_node;
+
+	ssl_cache_o->lock(ssl_cache_lock);
+	if (ssl_rbuf_pool_len[node] < SSL_RBUF_POOL_MAX) {
+	    b->next = ssl_rbuf_pool[node];
+	    ssl_rbuf_pool[node] = b;
+	    ssl_rbuf_pool_len[node]++;
+	    b = NULL;
+	}
+	ssl_cache_o->unlock(ssl_cache_lock);
+    }
+    if (b)
+	gensio_os_funcs_buf_free(o, b);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+/*
+ * Client sessions, keyed by the remote address and the settings
+ * (including the file identities, so a changed CA doesn't accept a
+ * session verified with the old one).  The most recently used is
+ * first.
+ */
+#define SSL_SESSION_STORE_MAX 64
+
+struct ssl_session_ent {
+    struct ssl_session_ent *next;
+    char *key;
+    SSL_SESSION *sess;
+};
+
+static struct ssl_session_ent *ssl_session_store;
+static unsigned int ssl_session_store_len;
+
+static void
+ssl_session_ent_free(struct ssl_session_ent *e)
+{
+    struct gensio_os_funcs *o = ssl_cache_o;
+
+    SSL_SESSION_free(e->sess);
+    o->free(o, e->key);
+    o->free(o, e);
+}
+
+/* Call with the cache lock held.  Returns the pointer to the entry. */
+static struct ssl_session_ent **
+ssl_session_lookup(const char *key)
+{
+    struct ssl_session_ent **pe;
+
+    for (pe = &ssl_session_store; *pe; pe = &(*pe)->next) {
+	if (strcmp((*pe)->key, key) == 0)
+	    return pe;
+    }
+    return NULL;
+}
+
+static void
+ssl_session_find(struct ssl_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    struct ssl_session_ent **pe, *e;
+    struct gensio *child;
+    char raddr[256] = "0";
+    gensiods len = sizeof(raddr);
+
+    if (!sfilter->sess_key_base || !ssl_cache_lock)
+	return;
+
+    child = gensio_get_child(sfilter->io, 1);
+    if (!child)
+	return;
+    if (gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_RADDR, raddr, &len))
+	return;
+    if (len >= sizeof(raddr))
+	return; /* Truncated, don't risk a wrong match. */
+
+    sfilter->sess_key = gensio_alloc_sprintf(o, "%s;%s", raddr,
+					     sfilter->sess_key_base);
+    if (!sfilter->sess_key)
+	return;
+
+    ssl_cache_o->lock(ssl_cache_lock);
+    pe = ssl_session_lookup(sfilter->sess_key);
+    if (pe) {
+	e = *pe;
+	if (SSL_SESSION_is_resumable(e->sess))
+	    SSL_set_session(sfilter->ssl, e->sess);
+	/*
+	 * TLS 1.3 tickets should only be used once, a new one will
+	 * come in on the new connection.
+	 */
+	if (!SSL_SESSION_is_resumable(e->sess) || (!sfilter->dtls &&
+		SSL_SESSION_get_protocol_version(e->sess) >= TLS1_3_VERSION)) {
+	    *pe = e->next;
+	    ssl_session_ent_free(e);
+	    ssl_session_store_len--;
+	}
+    }
+    ssl_cache_o->unlock(ssl_cache_lock);
+}
+
+/*
+ * Called by OpenSSL when the server gives us a session.  Returning 1
+ * means we keep the reference.
+ */
+static int
+ssl_session_new(SSL *ssl, SSL_SESSION *sess)
+{
+    struct ssl_filter *sfilter = SSL_get_app_data(ssl);
+    struct gensio_os_funcs *o = ssl_cache_o;
+    struct ssl_session_ent **pe, *e;
+
+    if (!sfilter || !sfilter->sess_key || !ssl_cache_lock)
+	return 0;
+    /* Don't let a bad certificate get past allow-authfail later. */
+    if (SSL_get_verify_result(ssl) != X509_V_OK)
+	return 0;
+
+    ssl_cache_o->lock(ssl_cache_lock);
+    pe = ssl_session_lookup(sfilter->sess_key);
+    if (pe) {
+	e = *pe;
+	*pe = e->next;
+	SSL_SESSION_free(e->sess);
+    } else {
+	if (ssl_session_store_len >= SSL_SESSION_STORE_MAX) {
+	    /* Drop the oldest. */
+	    for (pe = &ssl_session_store; (*pe)->next; pe = &(*pe)->next)
+		;
+	    ssl_session_ent_free(*pe);
+	    *pe = NULL;
+	    ssl_session_store_len--;
+	}
+	e = o->zalloc(o, sizeof(*e));
+	if (!e)
+	    goto out_fail;
+	e->key = gensio_strdup(o, sfilter->sess_key);
+	if (!e->key) {
+	    o->free(o, e);
+	    goto out_fail;
+	}
+	ssl_session_store_len++;
+    }
+    e->sess = sess;
+    e->next = ssl_session_store;
+    ssl_session_store = e;
+    ssl_cache_o->unlock(ssl_cache_lock);
+    return 1;
+
+ out_fail:
+    ssl_cache_o->unlock(ssl_cache_lock);
+    return 0;
+}
+#else
+static void
+ssl_session_find(struct ssl_filter *sfilter)
+{
+}
+#endif
+
+static void
+ssl_cache_cleanup(void)
+{
+    struct ssl_ctx_cache_ent *e;
+    unsigned int i;
+
+    while (ssl_ctx_cache) {
+	e = ssl_ctx_cache;
+	ssl_ctx_cache = e->next;
+	ssl_ctx_cache_ent_free(e);
+    }
+    ssl_ctx_cache_len = 0;
+    for (i = 0; i < SSL_RBUF_MAX_NODES; i++) {
+	while (ssl_rbuf_pool[i]) {
+	    struct ssl_rbuf *b = ssl_rbuf_pool[i];
+
+	    ssl_rbuf_pool[i] = b->next;
+	    gensio_os_funcs_buf_free(ssl_cache_o, b);
+	}
+	ssl_rbuf_pool_len[i] = 0;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    while (ssl_session_store) {
+	struct ssl_session_ent *se = ssl_session_store;
+
+	ssl_session_store = se->next;
+	ssl_session_ent_free(se);
+    }
+    ssl_session_store_len = 0;
+#endif
+    if (ssl_cache_lock)
+	ssl_cache_o->free_lock(ssl_cache_lock);
+    ssl_cache_lock = NULL;
+    memset(&ssl_cache_once, 0, sizeof(ssl_cache_once));
+}
+
+static struct gensio_class_cleanup ssl_cache_cleanup_data = {
+    ssl_cache_cleanup
+};
+
+static void
+ssl_cache_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    ssl_cache_o = o;
+    ssl_cache_lock = o->alloc_lock(o);
+    if (ssl_cache_lock)
+	gensio_register_class_cleanup(&ssl_cache_cleanup_data);
+}
+
+static void
+ssl_ctx_file_id(const char *file, struct ssl_ctx_file_id *id)
+{
+    struct stat st;
+
+    memset(id, 0, sizeof(*id));
+    if (file && stat(file, &st) == 0) {
+	id->mtime = st.st_mtime;
+	id->ctime = st.st_ctime;
+	id->size = st.st_size;
+	id->ino = st.st_ino;
+    }
+}
+
+static bool
+ssl_ctx_str_eq(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+	return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+/* Call with the cache lock held. */
+static void
+ssl_ctx_cache_add(struct gensio_ssl_filter_data *data, bool expect_peer_cert,
+		  const char *files[], struct ssl_ctx_file_id ids[],
+		  SSL_CTX *ctx)
+{
+    struct gensio_os_funcs *o = ssl_cache_o;
+    struct ssl_ctx_cache_ent *e, **pe;
+    unsigned int i;
+
+    if (ssl_ctx_cache_len >= SSL_CTX_CACHE_MAX) {
+	/* Drop the oldest. */
+	for (pe = &ssl_ctx_cache; (*pe)->next; pe = &(*pe)->next)
+	    ;
+	ssl_ctx_cache_ent_free(*pe);
+	*pe = NULL;
+	ssl_ctx_cache_len--;
+    }
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e)
+	return;
+    for (i = 0; i < SSL_CTX_NR_FILES; i++) {
+	e->ids[i] = ids[i];
+	if (files[i]) {
+	    e->files[i] = gensio_strdup(o, files[i]);
+	    if (!e->files[i]) {
+		ssl_ctx_cache_ent_free(e);
+		return;
+	    }
+	}
+    }
+    e->is_client = data->is_client;
+    e->dtls = data->dtls;
+    e->expect_peer_cert = expect_peer_cert;
+    SSL_CTX_up_ref(ctx);
+    e->ctx = ctx;
+    e->next = ssl_ctx_cache;
+    ssl_ctx_cache = e;
+    ssl_ctx_cache_len++;
+}
+
+static int
+gensio_ssl_get_ctx(struct gensio_ssl_filter_data *data, bool expect_peer_cert,
+		   SSL_CTX **rctx)
+{
+    struct gensio_os_funcs *o = data->o;
+    const char *files[SSL_CTX_NR_FILES];
+    struct ssl_ctx_file_id ids[SSL_CTX_NR_FILES];
+    struct ssl_ctx_cache_ent *e, **pe;
+    unsigned int i;
+    int rv;
+
+    o->call_once(o, &ssl_cache_once, ssl_cache_init, o);
+    if (!ssl_cache_lock)
+	return gensio_ssl_ctx_alloc(data, expect_peer_cert, rctx);
+
+    files[SSL_CTX_FILE_CA] = data->CAfilepath;
+    files[SSL_CTX_FILE_CERT] = data->certfile;
+    files[SSL_CTX_FILE_KEY] = data->keyfile;
+    for (i = 0; i < SSL_CTX_NR_FILES; i++)
+	ssl_ctx_file_id(files[i], &ids[i]);
+
+    ssl_cache_o->lock(ssl_cache_lock);
+    for (pe = &ssl_ctx_cache; (e = *pe); pe = &e->next) {
+	if (e->is_client != data->is_client || e->dtls != data->dtls ||
+		e->expect_peer_cert != expect_peer_cert)
+	    continue;
+	for (i = 0; i < SSL_CTX_NR_FILES; i++) {
+	    if (!ssl_ctx_str_eq(e->files[i], files[i]))
+		break;
+	}
+	if (i < SSL_CTX_NR_FILES)
+	    continue;
+	if (memcmp(e->ids, ids, sizeof(ids)) != 0) {
+	    /* A file changed, this one is stale. */
+	    *pe = e->next;
+	    ssl_ctx_cache_ent_free(e);
+	    ssl_ctx_cache_len--;
+	    break;
+	}
+	SSL_CTX_up_ref(e->ctx);
+	*rctx = e->ctx;
+	ssl_cache_o->unlock(ssl_cache_lock);
+	return 0;
+    }
+    ssl_cache_o->unlock(ssl_cache_lock);
+
+    /* Loading the files can take a while, don't hold the lock. */
+    rv = gensio_ssl_ctx_alloc(data, expect_peer_cert, rctx);
+    if (rv)
+	return rv;
+
+    ssl_cache_o->lock(ssl_cache_lock);
+    ssl_ctx_cache_add(data, expect_peer_cert, files, ids, *rctx);
+    ssl_cache_o->unlock(ssl_cache_lock);
+    return 0;
+}
+
+static char *
+gensio_ssl_sess_key_base(struct gensio_ssl_filter_data *data)
+{
+    struct gensio_os_funcs *o = data->o;
+    const char *files[SSL_CTX_NR_FILES];
+    struct ssl_ctx_file_id id;
+    char *key, *nkey;
+    unsigned int i;
+
+    files[SSL_CTX_FILE_CA] = data->CAfilepath;
+    files[SSL_CTX_FILE_CERT] = data->certfile;
+    files[SSL_CTX_FILE_KEY] = data->keyfile;
+    /* TLS and DTLS sessions can't be swapped. */
+    key = gensio_strdup(o, data->dtls ? "dtls," : "");
+    for (i = 0; key && i < SSL_CTX_NR_FILES; i++) {
+	ssl_ctx_file_id(files[i], &id);
+	nkey = gensio_alloc_sprintf(o, "%s%s,%lld.%lld.%lld.%llu,", key,
+				    files[i] ? files[i] : "",
+				    (long long) id.mtime,
+				    (long long) id.ctime,
+				    (long long) id.size,
+				    (unsigned long long) id.ino);
+	o->free(o, key);
+	key = nkey;
+    }
+    return key;
+}
+#else
+static int
+gensio_ssl_get_ctx(struct gensio_ssl_filter_data *data, bool expect_peer_cert,
+		   SSL_CTX **rctx)
+{
+    /* No SSL_CTX_up_ref(), so no sharing. */
+    return gensio_ssl_ctx_alloc(data, expect_peer_cert, rctx);
+}
+
+static void
+ssl_session_find(struct ssl_filter *sfilter)
+{
+}
+
+static char *
+gensio_ssl_sess_key_base(struct gensio_ssl_filter_data *data)
+{
+    return NULL;
+}
+
+static unsigned char *
+ssl_rbuf_get(struct ssl_filter *sfilter)
+{
+    sfilter->read_data = gensio_os_funcs_buf_zalloc(sfilter->o,
+						    sfilter->max_read_size);
+    sfilter->read_data_filled = 0;
+    return sfilter->read_data;
+}
+
+static void
+ssl_rbuf_put(struct ssl_filter *sfilter)
+{
+    memset(sfilter->read_data, 0, sfilter->read_data_filled);
+    gensio_os_funcs_buf_free(sfilter->o, sfilter->read_data);
+    sfilter->read_data = NULL;
+    sfilter->read_data_filled = 0;
+}
+#endif
+
+int
+gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
+			struct gensio_filter **rfilter)
+{
+    struct gensio_os_funcs *o = data->o;
+    SSL_CTX *ctx = NULL;
+    struct gensio_filter *filter;
+    struct ssl_filter *sfilter;
+    bool expect_peer_cert;
+    int rv;
+
+    gensio_ssl_initialize(o);
+
+    if (data->is_client)
+	expect_peer_cert = true;
+    else
+	expect_peer_cert = data->clientauth;
+
+    rv = gensio_ssl_get_ctx(data, expect_peer_cert, &ctx);
+    if (rv)
+	return rv;
+
     filter = gensio_ssl_filter_raw_alloc(o, data->is_client, ctx,
 					 expect_peer_cert,
 					 data->allow_authfail,
 					 data->max_read_size,
 					 data->max_write_size);
     if (!filter) {
-	rv = GE_NOMEM;
-	goto err;
+	SSL_CTX_free(ctx);
+	return GE_NOMEM;
     }
 
+    sfilter = filter_to_ssl(filter);
+    if (data->is_client)
+	/* If this fails, sessions just won't be saved. */
+	sfilter->sess_key_base = gensio_ssl_sess_key_base(data);
+    sfilter->handshake_threads = data->handshake_threads;
+    sfilter->record_start = data->record_start;
+    sfilter->record_grow = data->record_grow;
+    sfilter->record_idle = (data->record_idle.secs * GENSIO_NSECS_IN_SEC +
+			    data->record_idle.nsecs);
+    sfilter->early_data_max = data->early_data_max;
+    sfilter->early_data_age = data->early_data_age.secs;
+    if (data->dtls) {
+	sfilter->dtls = true;
+	sfilter->mtu = data->mtu;
+	ssl_dgram_queue_init(&sfilter->dgram_in);
+	ssl_dgram_queue_init(&sfilter->dgram_out);
+	sfilter->dgram_buf = o->zalloc(o, data->mtu);
+	if (!sfilter->dgram_buf) {
+	    gensio_filter_free(filter);
+	    return GE_NOMEM;
+	}
+    }
 
     *rfilter = filter;
     return 0;
-
- err:
-    SSL_CTX_free(ctx);
-    return rv;
 }
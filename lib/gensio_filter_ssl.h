@@ -17,9 +17,21 @@ int gensio_ssl_filter_config(struct gensio_os_funcs *o,
 			     bool default_is_client,
 			     struct gensio_ssl_filter_data **data);
 
+/*
+ * Like gensio_ssl_filter_config(), but the filter runs DTLS over a
+ * packet lower layer, see gensio_dtls.c.
+ */
+int gensio_dtls_filter_config(struct gensio_os_funcs *o,
+			      const char * const args[],
+			      bool default_is_client,
+			      struct gensio_ssl_filter_data **data);
+
 void gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data);
 
 int gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
 			    struct gensio_filter **rfilter);
 
+/* The dtls gensio is in the ssl module, this registers it. */
+int gensio_init_dtls(struct gensio_os_funcs *o);
+
 #endif /* GENSIO_FILTER_SSL_H */
@@ -57,6 +57,14 @@ struct telnet_filter {
 
     struct telnet_data_s tn_data;
 
+    /*
+     * The read and write buffers are only needed when data has to be
+     * copied (commands or IACs in it), they are allocated on first
+     * use.  In lean mode they are freed again when they are empty, so
+     * idle connections hold no buffers.
+     */
+    bool lean;
+
     /* Data waiting to be delivered to the user. */
     unsigned char *read_data;
     gensiods max_read_size;
@@ -134,9 +142,31 @@ telnet_ll_write_pending(struct gensio_filter *filter)
     return rv;
 }
 
+static int
+telnet_get_buf(struct telnet_filter *tfilter, unsigned char **buf,
+	       gensiods size)
+{
+    if (!*buf) {
+	*buf = tfilter->o->zalloc(tfilter->o, size);
+	if (!*buf)
+	    return GE_NOMEM;
+    }
+    return 0;
+}
+
+static void
+telnet_put_buf(struct telnet_filter *tfilter, unsigned char **buf)
+{
+    if (tfilter->lean && *buf) {
+	tfilter->o->free(tfilter->o, *buf);
+	*buf = NULL;
+    }
+}
+
 static void
 telnet_clear_write(struct telnet_filter *tfilter)
 {
+    telnet_put_buf(tfilter, &tfilter->write_data);
     tfilter->write_data_len = 0;
     gensio_buffer_reset(&tfilter->tn_data.out_telnet_cmd);
 }
@@ -181,25 +211,152 @@ telnet_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     return 0;
 }
 
-struct telnet_buffer_data {
-    gensio_ul_filter_data_handler handler;
-    void *cb_data;
-    const char *const *auxdata;
-};
+/* Maximum number of sg entries to build for a direct write. */
+#define TELNET_MAX_WRITE_SG 32
 
+static const unsigned char telnet_iac = TN_IAC;
+
+/*
+ * Write the user's data straight from their buffers.  IACs are
+ * doubled by adding an sg entry that points to another IAC right
+ * after each one, so nothing is copied.
+ */
 static int
-telnet_buffer_do_write(void *cb_data, void *buf, unsigned int buflen,
-		       unsigned int *written)
+telnet_write_direct(struct telnet_filter *tfilter,
+		    gensio_ul_filter_data_handler handler, void *cb_data,
+		    gensiods *rcount,
+		    const struct gensio_sg *sg, gensiods sglen,
+		    const char *const *auxdata)
 {
-    struct telnet_buffer_data *data = cb_data;
-    gensiods count;
-    struct gensio_sg sg = { buf, buflen };
+    struct gensio_sg xsg[TELNET_MAX_WRITE_SG];
+    gensiods i, nsg = 0, count = 0, incount = 0;
     int err;
 
-    err = data->handler(data->cb_data, &count, &sg, 1, data->auxdata);
-    if (!err)
-	*written = count;
-    return err;
+    for (i = 0; i < sglen && nsg + 2 <= TELNET_MAX_WRITE_SG; i++) {
+	const unsigned char *buf = sg[i].buf;
+	gensiods len, left = sg[i].buflen;
+
+	while (left > 0 && nsg + 2 <= TELNET_MAX_WRITE_SG) {
+	    const unsigned char *iac = memchr(buf, TN_IAC, left);
+
+	    if (!iac) {
+		xsg[nsg].buf = buf;
+		xsg[nsg++].buflen = left;
+		left = 0;
+		break;
+	    }
+	    len = iac - buf + 1;
+	    xsg[nsg].buf = buf;
+	    xsg[nsg++].buflen = len;
+	    xsg[nsg].buf = &telnet_iac;
+	    xsg[nsg++].buflen = 1;
+	    buf += len;
+	    left -= len;
+	}
+	if (left > 0)
+	    break;
+    }
+
+    if (nsg == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+
+    err = handler(cb_data, &count, xsg, nsg, auxdata);
+    if (err) {
+	telnet_clear_write(tfilter);
+	return err;
+    }
+
+    /* Work out how much of the user's data was written. */
+    for (i = 0; i < nsg && count >= xsg[i].buflen; i++) {
+	count -= xsg[i].buflen;
+	if (xsg[i].buf != &telnet_iac)
+	    incount += xsg[i].buflen;
+    }
+    if (i < nsg) {
+	if (xsg[i].buf != &telnet_iac) {
+	    incount += count;
+	} else {
+	    /* Wrote the first IAC but not its double, save that. */
+	    err = telnet_get_buf(tfilter, &tfilter->write_data,
+				 tfilter->max_write_size);
+	    if (err) {
+		telnet_clear_write(tfilter);
+		return err;
+	    }
+	    tfilter->write_data[0] = TN_IAC;
+	    tfilter->write_data_pos = 0;
+	    tfilter->write_data_len = 1;
+	    tfilter->write_state = TELNET_IN_USER_WRITE;
+	}
+    }
+    if (rcount)
+	*rcount = incount;
+    return 0;
+}
+
+/*
+ * Write out the pending telnet commands.  Any user data waiting to go
+ * is put after them in the same write, so control traffic goes out
+ * with the data instead of in its own small packets.
+ */
+static int
+telnet_write_cmds(struct telnet_filter *tfilter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  const char *const *auxdata)
+{
+    struct gensio_buffer *cmdbuf = &tfilter->tn_data.out_telnet_cmd;
+    struct gensio_sg sg[3];
+    gensiods nsg = 0, count = 0, cmdlen = cmdbuf->cursize, len;
+    int err;
+
+    /* The command buffer is circular, it may take two pieces. */
+    len = cmdbuf->maxsize - cmdbuf->pos;
+    if (len > cmdlen)
+	len = cmdlen;
+    sg[nsg].buf = cmdbuf->buf + cmdbuf->pos;
+    sg[nsg++].buflen = len;
+    if (len < cmdlen) {
+	sg[nsg].buf = cmdbuf->buf;
+	sg[nsg++].buflen = cmdlen - len;
+    }
+    if (tfilter->write_data_len) {
+	sg[nsg].buf = tfilter->write_data + tfilter->write_data_pos;
+	sg[nsg++].buflen = tfilter->write_data_len;
+    }
+
+    err = handler(cb_data, &count, sg, nsg, auxdata);
+    if (err) {
+	telnet_clear_write(tfilter);
+	return err;
+    }
+
+    if (count < cmdlen) {
+	cmdbuf->pos = (cmdbuf->pos + count) % cmdbuf->maxsize;
+	cmdbuf->cursize -= count;
+	tfilter->write_state = TELNET_IN_TN_WRITE;
+	return 0;
+    }
+    gensio_buffer_reset(cmdbuf);
+
+    count -= cmdlen;
+    if (count >= tfilter->write_data_len) {
+	tfilter->write_state = TELNET_NOT_WRITING;
+	tfilter->write_data_len = 0;
+	tfilter->write_data_pos = 0;
+	telnet_put_buf(tfilter, &tfilter->write_data);
+    } else {
+	/* Don't split the user's data with a command if we started it. */
+	if (count)
+	    tfilter->write_state = TELNET_IN_USER_WRITE;
+	else
+	    tfilter->write_state = TELNET_NOT_WRITING;
+	tfilter->write_data_len -= count;
+	tfilter->write_data_pos += count;
+    }
+    return 0;
 }
 
 static int
@@ -213,12 +370,25 @@ telnet_ul_write(struct gensio_filter *filter,
     int err = 0;
 
     telnet_lock(tfilter);
+    if (!tfilter->write_data_len &&
+		tfilter->write_state == TELNET_NOT_WRITING &&
+		!gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd)) {
+	err = telnet_write_direct(tfilter, handler, cb_data, rcount,
+				  sg, sglen, auxdata);
+	telnet_unlock(tfilter);
+	return err;
+    }
+
     if (tfilter->write_data_len) {
 	if (rcount)
 	    *rcount = 0;
-    } else {
+    } else if (sglen) {
 	gensiods i, writelen = 0;
 
+	err = telnet_get_buf(tfilter, &tfilter->write_data,
+			     tfilter->max_write_size);
+	if (err)
+	    goto out_unlock;
 	for (i = 0; i < sglen; i++) {
 	    size_t inlen = sg[i].buflen;
 	    const unsigned char *buf = sg[i].buf;
@@ -233,26 +403,16 @@ telnet_ul_write(struct gensio_filter *filter,
 	}
 	if (rcount)
 	    *rcount = writelen;
+	if (!tfilter->write_data_len)
+	    telnet_put_buf(tfilter, &tfilter->write_data);
+    } else if (rcount) {
+	*rcount = 0;
     }
 
     if (tfilter->write_state != TELNET_IN_USER_WRITE &&
 		gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd)) {
-	struct telnet_buffer_data data = { handler, cb_data, auxdata };
-
-	err = gensio_buffer_write(telnet_buffer_do_write, &data,
-				  &tfilter->tn_data.out_telnet_cmd);
-	if (err) {
-	    telnet_clear_write(tfilter);
-	} else {
-	    if (gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd))
-		tfilter->write_state = TELNET_IN_TN_WRITE;
-	    else
-		tfilter->write_state = TELNET_NOT_WRITING;
-	}
-    }
-
-    if (tfilter->write_state != TELNET_IN_TN_WRITE &&
-		tfilter->write_data_len) {
+	err = telnet_write_cmds(tfilter, handler, cb_data, auxdata);
+    } else if (tfilter->write_data_len) {
 	gensiods count = 0;
 	struct gensio_sg sg = { tfilter->write_data + tfilter->write_data_pos,
 				tfilter->write_data_len };
@@ -265,6 +425,7 @@ telnet_ul_write(struct gensio_filter *filter,
 		tfilter->write_state = TELNET_NOT_WRITING;
 		tfilter->write_data_len = 0;
 		tfilter->write_data_pos = 0;
+		telnet_put_buf(tfilter, &tfilter->write_data);
 	    } else {
 		tfilter->write_state = TELNET_IN_USER_WRITE;
 		tfilter->write_data_len -= count;
@@ -272,6 +433,7 @@ telnet_ul_write(struct gensio_filter *filter,
 	    }
 	}
     }
+ out_unlock:
     telnet_unlock(tfilter);
 
     return err;
@@ -334,6 +496,27 @@ telnet_ll_write(struct gensio_filter *filter,
 	    }
 	}
 
+	/*
+	 * If we are not in a command and there are no IACs, just pass
+	 * the data straight up without copying it.
+	 */
+	if (inlen > 0 && tfilter->tn_data.telnet_cmd_pos == 0 &&
+		!memchr(buf, TN_IAC, inlen)) {
+	    gensiods count = 0;
+
+	    telnet_unlock(tfilter);
+	    err = handler(cb_data, &count, buf, inlen, NULL);
+	    telnet_lock(tfilter);
+	    if (rcount)
+		*rcount = buflen - inlen + count;
+	    goto out_unlock;
+	}
+
+	err = telnet_get_buf(tfilter, &tfilter->read_data,
+			     tfilter->max_read_size);
+	if (err)
+	    goto out_unlock;
+
 	/*
 	 * Process the telnet receive data unlocked.  It can do callbacks to
 	 * the users, and we are guaranteed to be single-threaded in the
@@ -348,6 +531,8 @@ telnet_ll_write(struct gensio_filter *filter,
 	tfilter->read_data_len += proclen;
 	if (rcount)
 	    *rcount = buflen - inlen;
+	if (!tfilter->read_data_len)
+	    telnet_put_buf(tfilter, &tfilter->read_data);
     }
 
     if (tfilter->read_data_len) {
@@ -362,6 +547,7 @@ telnet_ll_write(struct gensio_filter *filter,
 	    if (count >= tfilter->read_data_len) {
 		tfilter->read_data_len = 0;
 		tfilter->read_data_pos = 0;
+		telnet_put_buf(tfilter, &tfilter->read_data);
 	    } else {
 		tfilter->read_data_len -= count;
 		tfilter->read_data_pos += count;
@@ -475,8 +661,10 @@ telnet_filter_cleanup(struct gensio_filter *filter)
     tfilter->in_urgent = 0;
     tfilter->read_data_len = 0;
     tfilter->read_data_pos = 0;
+    telnet_put_buf(tfilter, &tfilter->read_data);
     tfilter->write_data_len = 0;
     tfilter->write_data_pos = 0;
+    telnet_put_buf(tfilter, &tfilter->write_data);
     telnet_cleanup(&tfilter->tn_data);
 }
 
@@ -520,7 +708,23 @@ static int
 telnet_filter_control(struct gensio_filter *filter, bool get, int op,
 		      char *data, gensiods *datalen)
 {
+    struct telnet_filter *tfilter = filter_to_telnet(filter);
     unsigned char buf[2];
+    gensiods size;
+
+    if (op == GENSIO_CONTROL_MEMORY) {
+	if (!get)
+	    return GE_NOTSUP;
+	telnet_lock(tfilter);
+	size = sizeof(*tfilter);
+	if (tfilter->read_data)
+	    size += tfilter->max_read_size;
+	if (tfilter->write_data)
+	    size += tfilter->max_write_size;
+	telnet_unlock(tfilter);
+	*datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+	return 0;
+    }
 
     if (get)
 	return GE_NOTSUP;
@@ -666,14 +870,6 @@ gensio_telnet_filter_raw_alloc(struct gensio_os_funcs *o,
     if (!tfilter->lock)
 	goto out_nomem;
 
-    tfilter->read_data = o->zalloc(o, max_read_size);
-    if (!tfilter->read_data)
-	goto out_nomem;
-
-    tfilter->write_data = o->zalloc(o, max_write_size);
-    if (!tfilter->write_data)
-	goto out_nomem;
-
     *rops = &telnet_filter_rops;
     tfilter->filter = gensio_filter_alloc_data(o, gensio_telnet_filter_func,
 					       tfilter);
@@ -753,10 +949,10 @@ gensio_telnet_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 			   struct gensio_filter **rfilter)
 {
     struct gensio_filter *filter;
-    unsigned int i;
+    unsigned int i, dummy;
     gensiods max_read_size = 4096; /* FIXME - magic number. */
     gensiods max_write_size = 4096; /* FIXME - magic number. */
-    bool allow_2217 = false;
+    bool allow_2217 = false, lean;
     bool is_client = default_is_client;
     const struct telnet_cmd *telnet_cmds;
     const unsigned char *init_seq;
@@ -770,6 +966,12 @@ gensio_telnet_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	return rv;
     allow_2217 = ival;
 
+    rv = gensio_get_default(o, "telnet", "lean", false,
+			    GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (rv)
+	return rv;
+    lean = ival;
+
     rv = gensio_get_default(o, "telnet", "mode", false,
 			    GENSIO_DEFAULT_STR, &str, NULL);
     if (rv) {
@@ -792,6 +994,8 @@ gensio_telnet_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keybool(args[i], "rfc2217", &allow_2217) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "lean", &lean) > 0)
+	    continue;
 	if (gensio_check_keyds(args[i], "writebuf", &max_write_size) > 0)
 	    continue;
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
@@ -799,6 +1003,9 @@ gensio_telnet_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 	if (gensio_check_keyboolv(args[i], "mode", "client", "server",
 				  &is_client) > 0)
 	    continue;
+	/* Handled by sergensio_telnet. */
+	if (gensio_check_keyuint(args[i], "modemstate_holdoff", &dummy) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
@@ -824,6 +1031,7 @@ gensio_telnet_filter_alloc(struct gensio_os_funcs *o, const char * const args[],
 
     if (!filter)
 	return GE_NOMEM;
+    filter_to_telnet(filter)->lean = lean;
 
     *rfilter = filter;
     return 0;
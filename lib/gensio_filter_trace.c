@@ -8,8 +8,11 @@
 #include "config.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <time.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
@@ -40,8 +43,54 @@ struct trace_filter {
     const char *modeflag;
 
     FILE *tr;
+
+    /*
+     * pcapng output.  Records are put in a ring by the data path and
+     * written to the file by a writer thread, so file I/O is never
+     * done with the lock held.  Producers hold the lock to serialize
+     * themselves and own ring_head, the writer owns ring_tail and
+     * does not take the lock.  If the ring is full the record is
+     * dropped and counted, the count goes into an interface
+     * statistics block when the trace is closed.
+     */
+    bool pcapng;
+    bool pcapng_started;
+    gensiods ringsize;
+    unsigned char *ring;
+    uint64_t ring_head;
+    uint64_t ring_tail;
+    uint64_t drops;
+    int64_t ts_offset; /* Realtime - monotonic, in seconds. */
+    struct gensio_thread *writer;
+    struct gensio_thread_sem *writer_sem;
+    bool writer_running;
+    bool writer_stop;
+
+    /*
+     * Flight recorder.  If frec_size is set, nothing is written as it
+     * happens.  The last frec_size bytes of records for each
+     * direction are kept in memory and written to the file on an
+     * error or with GENSIO_CONTROL_TRACE_DUMP.  Protected by lock.
+     */
+    gensiods frec_size;
+    struct trace_frec {
+	unsigned char *buf;
+	uint64_t head;
+	uint64_t tail;
+    } frec[2];
+};
+
+/* A flight recorder record, followed by len bytes of data. */
+struct trace_frec_hdr {
+    int64_t secs;
+    int32_t nsecs;
+    int32_t err;
+    gensiods len;
 };
 
+/* A number to identify the stack in the pcapng interface name. */
+static unsigned int trace_stack_id;
+
 #define filter_to_trace(v) ((struct trace_filter *) \
 			    gensio_filter_get_user_data(v))
 
@@ -75,9 +124,318 @@ trace_ll_read_needed(struct gensio_filter *filter)
     return false;
 }
 
+/*
+ * pcapng format, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng
+ * Blocks are written in host byte order, readers handle either.
+ */
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_ISB		0x00000005
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_LINKTYPE_USER0	147
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_SHB_USERAPPL	4
+#define PCAPNG_IF_NAME		2
+#define PCAPNG_IF_DESCRIPTION	3
+#define PCAPNG_IF_TSRESOL	9
+#define PCAPNG_EPB_FLAGS	2
+#define PCAPNG_ISB_IFDROP	5
+
+#define PCAPNG_EPB_INBOUND	1
+#define PCAPNG_EPB_OUTBOUND	2
+
+/* Enhanced packet block without the data. */
+#define PCAPNG_EPB_HDR_LEN	28
+#define PCAPNG_EPB_TRAILER_LEN	(8 + 4 + 4)
+
+#define PCAPNG_PAD(len) (((len) + 3) & ~((gensiods) 3))
+
+#define TRACE_DEFAULT_RINGSIZE	(1024 * 1024)
+
+static unsigned char *
+pcapng_put32(unsigned char *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+static unsigned char *
+pcapng_opt(unsigned char *p, uint16_t code, const void *data, uint16_t len)
+{
+    memcpy(p, &code, 2);
+    memcpy(p + 2, &len, 2);
+    p += 4;
+    if (len) {
+	memcpy(p, data, len);
+	memset(p + len, 0, PCAPNG_PAD(len) - len);
+	p += PCAPNG_PAD(len);
+    }
+    return p;
+}
+
+/* Fill in the block type and both lengths, p is the end of the block. */
+static gensiods
+pcapng_finish_block(unsigned char *buf, unsigned char *p, uint32_t type)
+{
+    uint32_t len = p - buf + 4;
+
+    pcapng_put32(buf, type);
+    pcapng_put32(buf + 4, len);
+    pcapng_put32(p, len);
+    return len;
+}
+
+static void
+pcapng_time(struct trace_filter *tfilter, uint32_t *hi, uint32_t *lo)
+{
+    gensio_time t;
+    uint64_t ts;
+
+    tfilter->o->get_monotonic_time(tfilter->o, &t);
+    ts = (uint64_t) (t.secs + tfilter->ts_offset) * 1000000000 + t.nsecs;
+    *hi = ts >> 32;
+    *lo = (uint32_t) ts;
+}
+
+/*
+ * Write the section header and the interface for this trace.  Each
+ * trace starts its own section, so appending to an existing pcapng
+ * file still gives a valid file.
+ */
+static int
+trace_pcapng_header(struct trace_filter *tfilter, struct gensio *io)
+{
+    unsigned char buf[512], *p;
+    char name[32], stack[256];
+    gensiods len, pos = 0;
+    const char *type;
+    unsigned int i, id;
+    uint16_t v16;
+    int64_t secs64 = -1;
+    gensio_time now;
+    uint8_t tsresol = 9; /* nanoseconds */
+
+    tfilter->o->get_monotonic_time(tfilter->o, &now);
+    tfilter->ts_offset = (int64_t) time(NULL) - now.secs;
+
+    p = buf + 8;
+    p = pcapng_put32(p, PCAPNG_BYTE_ORDER);
+    v16 = 1; /* major */
+    memcpy(p, &v16, 2);
+    v16 = 0; /* minor */
+    memcpy(p + 2, &v16, 2);
+    memcpy(p + 4, &secs64, 8); /* Section length unknown. */
+    p += 12;
+    p = pcapng_opt(p, PCAPNG_SHB_USERAPPL, "gensio", 6);
+    p = pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+    len = pcapng_finish_block(buf, p, PCAPNG_SHB);
+    if (fwrite(buf, 1, len, tfilter->tr) != len)
+	return GE_IOERR;
+
+    id = __atomic_add_fetch(&trace_stack_id, 1, __ATOMIC_RELAXED);
+    snprintf(name, sizeof(name), "gensio%u", id);
+    stack[0] = '\0';
+    for (i = 0; (type = gensio_get_type(io, i)); i++)
+	pos += snprintf(stack + pos, sizeof(stack) - pos, "%s%s",
+			i ? "," : "", type);
+
+    p = buf + 8;
+    v16 = PCAPNG_LINKTYPE_USER0;
+    memcpy(p, &v16, 2);
+    v16 = 0;
+    memcpy(p + 2, &v16, 2);
+    p = pcapng_put32(p + 4, 0); /* No snaplen */
+    p = pcapng_opt(p, PCAPNG_IF_NAME, name, strlen(name));
+    if (pos > sizeof(stack) - 1)
+	pos = sizeof(stack) - 1;
+    p = pcapng_opt(p, PCAPNG_IF_DESCRIPTION, stack, pos);
+    p = pcapng_opt(p, PCAPNG_IF_TSRESOL, &tsresol, 1);
+    p = pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+    len = pcapng_finish_block(buf, p, PCAPNG_IDB);
+    if (fwrite(buf, 1, len, tfilter->tr) != len)
+	return GE_IOERR;
+    fflush(tfilter->tr);
+    return 0;
+}
+
+/* Write a statistics block with the drop count at the end. */
+static void
+trace_pcapng_trailer(struct trace_filter *tfilter)
+{
+    unsigned char buf[64], *p;
+    uint32_t hi, lo;
+    gensiods len;
+
+    pcapng_time(tfilter, &hi, &lo);
+    p = pcapng_put32(buf + 8, 0); /* Interface id */
+    p = pcapng_put32(p, hi);
+    p = pcapng_put32(p, lo);
+    p = pcapng_opt(p, PCAPNG_ISB_IFDROP, &tfilter->drops, 8);
+    p = pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+    len = pcapng_finish_block(buf, p, PCAPNG_ISB);
+    fwrite(buf, 1, len, tfilter->tr);
+    fflush(tfilter->tr);
+}
+
+static void
+trace_ring_put(struct trace_filter *tfilter, uint64_t *pos,
+	       const void *data, gensiods len)
+{
+    gensiods off = *pos % tfilter->ringsize, left = tfilter->ringsize - off;
+
+    if (len > left) {
+	memcpy(tfilter->ring + off, data, left);
+	memcpy(tfilter->ring, ((const unsigned char *) data) + left,
+	       len - left);
+    } else {
+	memcpy(tfilter->ring + off, data, len);
+    }
+    *pos += len;
+}
+
+/*
+ * Write out what is in the ring.  Only called by the writer, or with
+ * the lock held if there is no writer thread.  Returns true if
+ * something was written.
+ */
+static bool
+trace_pcapng_drain(struct trace_filter *tfilter)
+{
+    uint64_t head = __atomic_load_n(&tfilter->ring_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = tfilter->ring_tail;
+    gensiods off, len;
+
+    if (head == tail)
+	return false;
+    off = tail % tfilter->ringsize;
+    len = head - tail;
+    if (off + len > tfilter->ringsize) {
+	fwrite(tfilter->ring + off, 1, tfilter->ringsize - off, tfilter->tr);
+	len -= tfilter->ringsize - off;
+	off = 0;
+    }
+    fwrite(tfilter->ring + off, 1, len, tfilter->tr);
+    fflush(tfilter->tr);
+    __atomic_store_n(&tfilter->ring_tail, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * A producer that finds the ring empty posts writer_sem, and the
+ * writer only sleeps after finding the ring empty, so the writer
+ * can't miss a record.
+ */
+static void
+trace_pcapng_writer(void *data)
+{
+    struct trace_filter *tfilter = data;
+
+    gensio_os_thread_set_attr(tfilter->o, NULL);
+    while (!__atomic_load_n(&tfilter->writer_stop, __ATOMIC_ACQUIRE)) {
+	if (!trace_pcapng_drain(tfilter))
+	    gensio_os_sem_wait(tfilter->writer_sem);
+    }
+    trace_pcapng_drain(tfilter);
+}
+
+static void
+trace_pcapng_wake_writer(struct trace_filter *tfilter)
+{
+    if (tfilter->writer_running)
+	gensio_os_sem_post(tfilter->writer_sem);
+    else
+	trace_pcapng_drain(tfilter);
+}
+
+/* Add a data record to the ring.  Call with the lock held. */
+static void
+trace_pcapng_data(struct trace_filter *tfilter, bool outbound,
+		  gensiods written, const struct gensio_sg *sg, gensiods sglen)
+{
+    unsigned char hdr[PCAPNG_EPB_HDR_LEN], trl[PCAPNG_EPB_TRAILER_LEN], *p;
+    static const unsigned char zeros[4];
+    uint32_t hi, lo, flags, blklen;
+    uint64_t tail, head = tfilter->ring_head, pos = head;
+    gensiods i, len;
+
+    if (written == 0)
+	return;
+
+    blklen = PCAPNG_EPB_HDR_LEN + PCAPNG_PAD(written) + PCAPNG_EPB_TRAILER_LEN;
+    tail = __atomic_load_n(&tfilter->ring_tail, __ATOMIC_ACQUIRE);
+    if (written > UINT32_MAX / 2 ||
+		blklen > tfilter->ringsize - (head - tail)) {
+	tfilter->drops++;
+	return;
+    }
+
+    pcapng_time(tfilter, &hi, &lo);
+    p = pcapng_put32(hdr, PCAPNG_EPB);
+    p = pcapng_put32(p, blklen);
+    p = pcapng_put32(p, 0); /* Interface id */
+    p = pcapng_put32(p, hi);
+    p = pcapng_put32(p, lo);
+    p = pcapng_put32(p, written); /* Captured length */
+    p = pcapng_put32(p, written); /* Original length */
+    trace_ring_put(tfilter, &pos, hdr, sizeof(hdr));
+
+    for (i = 0; i < sglen && pos - head - sizeof(hdr) < written; i++) {
+	len = written - (pos - head - sizeof(hdr));
+	if (sg[i].buflen < len)
+	    len = sg[i].buflen;
+	trace_ring_put(tfilter, &pos, sg[i].buf, len);
+    }
+    trace_ring_put(tfilter, &pos, zeros, PCAPNG_PAD(written) - written);
+
+    flags = outbound ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND;
+    p = pcapng_opt(trl, PCAPNG_EPB_FLAGS, &flags, 4);
+    p = pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+    pcapng_put32(p, blklen);
+    trace_ring_put(tfilter, &pos, trl, sizeof(trl));
+
+    __atomic_store_n(&tfilter->ring_head, pos, __ATOMIC_RELEASE);
+    if (head == tail)
+	trace_pcapng_wake_writer(tfilter);
+}
+
+static void
+trace_pcapng_stop(struct trace_filter *tfilter)
+{
+    if (tfilter->writer_running) {
+	__atomic_store_n(&tfilter->writer_stop, true, __ATOMIC_RELEASE);
+	gensio_os_sem_post(tfilter->writer_sem);
+	gensio_os_wait_thread(tfilter->writer);
+	tfilter->writer_running = false;
+    }
+    trace_pcapng_drain(tfilter);
+    trace_pcapng_trailer(tfilter);
+}
+
 static int
 trace_check_open_done(struct gensio_filter *filter, struct gensio *io)
 {
+    struct trace_filter *tfilter = filter_to_trace(filter);
+    int rv;
+
+    if (!tfilter->pcapng || !tfilter->tr)
+	return 0;
+
+    rv = trace_pcapng_header(tfilter, io);
+    if (rv)
+	return rv;
+    tfilter->pcapng_started = true;
+    tfilter->ring_head = 0;
+    tfilter->ring_tail = 0;
+    tfilter->drops = 0;
+    tfilter->writer_stop = false;
+    /* If the thread can't be started, just write synchronously. */
+    if (tfilter->writer_sem &&
+	    gensio_os_new_thread(tfilter->o, trace_pcapng_writer, tfilter,
+				 &tfilter->writer) == 0)
+	tfilter->writer_running = true;
     return 0;
 }
 
@@ -86,7 +444,11 @@ trace_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 {
     struct trace_filter *tfilter = filter_to_trace(filter);
 
-    if (tfilter->tr_stdout) {
+    if (tfilter->frec_size) {
+	/* The file is only opened when the recorder is dumped. */
+	tfilter->frec[0].head = tfilter->frec[0].tail = 0;
+	tfilter->frec[1].head = tfilter->frec[1].tail = 0;
+    } else if (tfilter->tr_stdout) {
 	tfilter->tr = stdout;
     } else if (tfilter->tr_stderr) {
 	tfilter->tr = stderr;
@@ -143,6 +505,168 @@ trace_data(const char *op, struct gensio_os_funcs *o,
     }
 }
 
+static void
+trace_frec_put(struct trace_filter *tfilter, struct trace_frec *r,
+	       const void *data, gensiods len)
+{
+    gensiods off = r->head % tfilter->frec_size;
+    gensiods left = tfilter->frec_size - off;
+
+    if (len > left) {
+	memcpy(r->buf + off, data, left);
+	memcpy(r->buf, ((const unsigned char *) data) + left, len - left);
+    } else {
+	memcpy(r->buf + off, data, len);
+    }
+    r->head += len;
+}
+
+static void
+trace_frec_get(struct trace_filter *tfilter, struct trace_frec *r,
+	       uint64_t pos, void *data, gensiods len)
+{
+    gensiods off = pos % tfilter->frec_size;
+    gensiods left = tfilter->frec_size - off;
+
+    if (len > left) {
+	memcpy(data, r->buf + off, left);
+	memcpy(((unsigned char *) data) + left, r->buf, len - left);
+    } else {
+	memcpy(data, r->buf + off, len);
+    }
+}
+
+/*
+ * Add a record to the flight recorder, throwing away the oldest
+ * records to make room.  If the data is bigger than the recorder only
+ * the end of it is kept.  Call with the lock held.
+ */
+static void
+trace_frec_add(struct trace_filter *tfilter, enum trace_dir dir, int err,
+	       gensiods written, const struct gensio_sg *sg, gensiods sglen)
+{
+    struct trace_frec *r = &tfilter->frec[dir == DIR_WRITE];
+    struct trace_frec_hdr h, oh;
+    gensiods i, len, skip, room = tfilter->frec_size - sizeof(h);
+    gensio_time time;
+
+    if (!err && !written)
+	return;
+
+    tfilter->o->get_monotonic_time(tfilter->o, &time);
+    h.secs = time.secs;
+    h.nsecs = time.nsecs;
+    h.err = err;
+    h.len = written;
+    skip = 0;
+    if (h.len > room) {
+	skip = h.len - room;
+	h.len = room;
+    }
+
+    while (tfilter->frec_size - (r->head - r->tail) < sizeof(h) + h.len) {
+	trace_frec_get(tfilter, r, r->tail, &oh, sizeof(oh));
+	r->tail += sizeof(oh) + oh.len;
+    }
+
+    trace_frec_put(tfilter, r, &h, sizeof(h));
+    for (i = 0; i < sglen && written > 0; i++, written -= len) {
+	len = sg[i].buflen;
+	if (len > written)
+	    len = written;
+	if (skip >= len) {
+	    skip -= len;
+	    continue;
+	}
+	trace_frec_put(tfilter, r, ((const unsigned char *) sg[i].buf) + skip,
+		       len - skip);
+	skip = 0;
+    }
+}
+
+static void
+trace_frec_dump_rec(struct trace_filter *tfilter, FILE *f,
+		    struct trace_frec *r, const struct trace_frec_hdr *h,
+		    const char *op)
+{
+    struct gensio_fdump d;
+    gensiods off, left;
+
+    if (h->err) {
+	fprintf(f, "%lld:%6.6d %s error: %d %s\n",
+		(long long) h->secs, (h->nsecs + 500) / 1000, op,
+		h->err, gensio_err_to_str(h->err));
+	return;
+    }
+    fprintf(f, "%lld:%6.6d %s (%lu):\n",
+	    (long long) h->secs, (h->nsecs + 500) / 1000, op,
+	    (unsigned long) h->len);
+    gensio_fdump_init(&d, 1);
+    off = (r->tail + sizeof(*h)) % tfilter->frec_size;
+    left = tfilter->frec_size - off;
+    if (h->len > left) {
+	gensio_fdump_buf(f, r->buf + off, left, &d);
+	gensio_fdump_buf(f, r->buf, h->len - left, &d);
+    } else {
+	gensio_fdump_buf(f, r->buf + off, h->len, &d);
+    }
+    gensio_fdump_buf_finish(f, &d);
+}
+
+/*
+ * Write out the flight recorder in time order and empty it.  Call
+ * with the lock held.
+ */
+static int
+trace_frec_dump(struct trace_filter *tfilter, const char *reason)
+{
+    struct trace_frec *rd = &tfilter->frec[0], *wr = &tfilter->frec[1];
+    struct trace_frec_hdr rh, wh;
+    bool have_rd, have_wr;
+    FILE *f;
+
+    if (rd->head == rd->tail && wr->head == wr->tail)
+	return 0;
+
+    if (tfilter->tr_stdout)
+	f = stdout;
+    else if (tfilter->tr_stderr)
+	f = stderr;
+    else if (tfilter->filename)
+	/* Always append, many gensios may be dumping to the file. */
+	f = fopen(tfilter->filename, "a");
+    else
+	return 0;
+    if (!f)
+	return GE_PERM;
+
+    fprintf(f, "Trace flight recorder dump: %s\n", reason);
+    for (;;) {
+	have_rd = rd->head != rd->tail;
+	have_wr = wr->head != wr->tail;
+	if (!have_rd && !have_wr)
+	    break;
+	if (have_rd)
+	    trace_frec_get(tfilter, rd, rd->tail, &rh, sizeof(rh));
+	if (have_wr)
+	    trace_frec_get(tfilter, wr, wr->tail, &wh, sizeof(wh));
+	if (have_rd && (!have_wr || rh.secs < wh.secs ||
+			(rh.secs == wh.secs && rh.nsecs <= wh.nsecs))) {
+	    trace_frec_dump_rec(tfilter, f, rd, &rh, "Read");
+	    rd->tail += sizeof(rh) + rh.len;
+	} else {
+	    trace_frec_dump_rec(tfilter, f, wr, &wh, "Write");
+	    wr->tail += sizeof(wh) + wh.len;
+	}
+    }
+    fprintf(f, "Trace flight recorder dump end\n");
+    if (f == stdout || f == stderr)
+	fflush(f);
+    else
+	fclose(f);
+    return 0;
+}
+
 static int
 trace_ul_write(struct gensio_filter *filter,
 	       gensio_ul_filter_data_handler handler, void *cb_data,
@@ -168,9 +692,16 @@ trace_ul_write(struct gensio_filter *filter,
     err = handler(cb_data, &count, sg, sglen, auxdata);
     if (tfilter->dir == DIR_WRITE || tfilter->dir == DIR_BOTH) {
 	trace_lock(tfilter);
-	if (tfilter->tr)
+	if (tfilter->pcapng_started && !err)
+	    trace_pcapng_data(tfilter, true, count, sg, sglen);
+	else if (tfilter->tr && !tfilter->pcapng)
 	    trace_data("Write", tfilter->o, tfilter->tr, tfilter->raw, err,
 		       count, sg, sglen);
+	else if (tfilter->frec_size) {
+	    trace_frec_add(tfilter, DIR_WRITE, err, count, sg, sglen);
+	    if (err)
+		trace_frec_dump(tfilter, "write error");
+	}
 	trace_unlock(tfilter);
     }
     if (!err && rcount)
@@ -201,9 +732,16 @@ trace_ll_write(struct gensio_filter *filter,
 	struct gensio_sg sg = {buf, buflen};
 
 	trace_lock(tfilter);
-	if (tfilter->tr)
+	if (tfilter->pcapng_started && !err)
+	    trace_pcapng_data(tfilter, false, count, &sg, 1);
+	else if (tfilter->tr && !tfilter->pcapng)
 	    trace_data("Read", tfilter->o, tfilter->tr, tfilter->raw, err,
 		       count, &sg, 1);
+	else if (tfilter->frec_size) {
+	    trace_frec_add(tfilter, DIR_READ, err, count, &sg, 1);
+	    if (err)
+		trace_frec_dump(tfilter, "read error");
+	}
 	trace_unlock(tfilter);
     }
     if (!err && rcount)
@@ -212,6 +750,44 @@ trace_ll_write(struct gensio_filter *filter,
     return err;
 }
 
+static void
+trace_io_err(struct gensio_filter *filter, int err)
+{
+    struct trace_filter *tfilter = filter_to_trace(filter);
+    char reason[100];
+
+    if (!tfilter->frec_size)
+	return;
+
+    snprintf(reason, sizeof(reason), "I/O error: %s",
+	     gensio_err_to_str(err));
+    trace_lock(tfilter);
+    trace_frec_add(tfilter, DIR_READ, err, 0, NULL, 0);
+    trace_frec_dump(tfilter, reason);
+    trace_unlock(tfilter);
+}
+
+static int
+trace_control(struct gensio_filter *filter, bool get, unsigned int option,
+	      char *data, gensiods *datalen)
+{
+    struct trace_filter *tfilter = filter_to_trace(filter);
+    int rv;
+
+    switch (option) {
+    case GENSIO_CONTROL_TRACE_DUMP:
+	if (get || !tfilter->frec_size)
+	    return GE_NOTSUP;
+	trace_lock(tfilter);
+	rv = trace_frec_dump(tfilter, data && *data ? data : "requested");
+	trace_unlock(tfilter);
+	return rv;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int
 trace_setup(struct gensio_filter *filter)
 {
@@ -223,6 +799,9 @@ trace_filter_cleanup(struct gensio_filter *filter)
 {
     struct trace_filter *tfilter = filter_to_trace(filter);
 
+    if (tfilter->pcapng_started)
+	trace_pcapng_stop(tfilter);
+    tfilter->pcapng_started = false;
     if (!tfilter->tr_stdout && !tfilter->tr_stderr && tfilter->tr)
 	fclose(tfilter->tr);
     tfilter->tr = NULL;
@@ -237,6 +816,14 @@ tfilter_free(struct trace_filter *tfilter)
 	gensio_filter_free_data(tfilter->filter);
     if (tfilter->filename)
 	tfilter->o->free(tfilter->o, tfilter->filename);
+    if (tfilter->frec[0].buf)
+	tfilter->o->free(tfilter->o, tfilter->frec[0].buf);
+    if (tfilter->frec[1].buf)
+	tfilter->o->free(tfilter->o, tfilter->frec[1].buf);
+    if (tfilter->ring)
+	tfilter->o->free(tfilter->o, tfilter->ring);
+    if (tfilter->writer_sem)
+	gensio_os_free_sem(tfilter->writer_sem);
     tfilter->o->free(tfilter->o, tfilter);
 }
 
@@ -293,8 +880,12 @@ static int gensio_trace_filter_func(struct gensio_filter *filter, int op,
 	trace_free(filter);
 	return 0;
 
+    case GENSIO_FILTER_FUNC_IO_ERR:
+	trace_io_err(filter, *((int *) data));
+	return 0;
+
     case GENSIO_FILTER_FUNC_CONTROL:
-	return GE_NOTSUP;
+	return trace_control(filter, *((bool *) cbuf), buflen, data, count);
 
     default:
 	return GE_NOTSUP;
@@ -304,7 +895,9 @@ static int gensio_trace_filter_func(struct gensio_filter *filter, int op,
 static struct gensio_filter *
 gensio_trace_filter_raw_alloc(struct gensio_os_funcs *o, enum trace_dir dir,
 			      enum trace_dir block,
-			      bool raw, const char *filename, bool tr_stdout,
+			      bool raw, bool pcapng, gensiods ringsize,
+			      gensiods frec_size,
+			      const char *filename, bool tr_stdout,
 			      bool tr_stderr, const char *modeflag)
 {
     struct trace_filter *tfilter;
@@ -329,6 +922,23 @@ gensio_trace_filter_raw_alloc(struct gensio_os_funcs *o, enum trace_dir dir,
     tfilter->tr_stderr = tr_stderr;
     tfilter->modeflag = modeflag;
 
+    if (frec_size && dir != DIR_NONE) {
+	tfilter->frec_size = frec_size;
+	tfilter->frec[0].buf = o->zalloc(o, frec_size);
+	tfilter->frec[1].buf = o->zalloc(o, frec_size);
+	if (!tfilter->frec[0].buf || !tfilter->frec[1].buf)
+	    goto out_nomem;
+    } else if (pcapng && dir != DIR_NONE) {
+	tfilter->pcapng = true;
+	tfilter->ringsize = ringsize;
+	tfilter->ring = o->zalloc(o, ringsize);
+	if (!tfilter->ring)
+	    goto out_nomem;
+	/* Without this the ring is written out synchronously. */
+	if (gensio_os_new_sem(o, &tfilter->writer_sem))
+	    tfilter->writer_sem = NULL;
+    }
+
     tfilter->lock = o->alloc_lock(o);
     if (!tfilter->lock)
 	goto out_nomem;
@@ -345,6 +955,36 @@ gensio_trace_filter_raw_alloc(struct gensio_os_funcs *o, enum trace_dir dir,
     return NULL;
 }
 
+/* Like gensio_check_keyds(), but allow a k or m suffix. */
+static int
+trace_check_keysize(const char *str, const char *key, gensiods *rvalue)
+{
+    const char *sval;
+    char *end;
+    int rv = gensio_check_keyvalue(str, key, &sval);
+    gensiods value;
+
+    if (!rv)
+	return 0;
+
+    if (!*sval)
+	return -1;
+
+    value = strtoul(sval, &end, 0);
+    if (*end == 'k' || *end == 'K') {
+	value *= 1024;
+	end++;
+    } else if (*end == 'm' || *end == 'M') {
+	value *= 1024 * 1024;
+	end++;
+    }
+    if (*end != '\0')
+	return -1;
+
+    *rvalue = value;
+    return 1;
+}
+
 static struct gensio_enum_val trace_dir_enum[] = {
     { "none", DIR_NONE },
     { "read", DIR_READ },
@@ -362,6 +1002,8 @@ gensio_trace_filter_alloc(struct gensio_os_funcs *o,
     int dir = DIR_NONE;
     int block = DIR_NONE;
     bool raw = false, tr_stdout = false, tr_stderr = false, tbool;
+    bool pcapng = false;
+    gensiods ringsize = TRACE_DEFAULT_RINGSIZE, frec_size = 0;
     const char *filename = NULL;
     unsigned int i;
     const char *modeflag = "a";
@@ -373,6 +1015,18 @@ gensio_trace_filter_alloc(struct gensio_os_funcs *o,
 	    continue;
 	if (gensio_check_keybool(args[i], "raw", &raw) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "pcapng", &pcapng) > 0)
+	    continue;
+	if (trace_check_keysize(args[i], "ringsize", &ringsize) > 0) {
+	    if (ringsize < 4096)
+		return GE_INVAL;
+	    continue;
+	}
+	if (trace_check_keysize(args[i], "ring", &frec_size) > 0) {
+	    if (frec_size && frec_size < 256)
+		return GE_INVAL;
+	    continue;
+	}
 	if (gensio_check_keyvalue(args[i], "file", &filename) > 0)
 	    continue;
 	if (gensio_check_keybool(args[i], "stdout", &tr_stdout) > 0)
@@ -387,8 +1041,17 @@ gensio_trace_filter_alloc(struct gensio_os_funcs *o,
 	return GE_INVAL;
     }
 
-    filter = gensio_trace_filter_raw_alloc(o, dir, block, raw, filename,
-					   tr_stdout, tr_stderr, modeflag);
+    if (frec_size && dir == DIR_NONE)
+	dir = DIR_BOTH;
+    if (frec_size)
+	pcapng = false;
+    if (pcapng && strcmp(modeflag, "a") == 0)
+	modeflag = "ab"; /* Binary data on Windows. */
+    else if (pcapng)
+	modeflag = "wb";
+    filter = gensio_trace_filter_raw_alloc(o, dir, block, raw, pcapng,
+					   ringsize, frec_size, filename, tr_stdout,
+					   tr_stderr, modeflag);
     if (!filter)
 	return GE_NOMEM;
 
@@ -15,21 +15,35 @@
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_circbuf.h>
 
 #include "gensio_filter_xlt.h"
 
+#define XLT_BUFSIZE 1024
+
+/*
+ * If only this many bytes or fewer translate to something else, copy
+ * the data and then fix up those bytes instead of doing a lookup on
+ * every byte.
+ */
+#define XLT_MAX_FIXUPS 4
+
+struct xlt_table {
+    unsigned char xlt[256];
+    unsigned int nfixups;
+    unsigned char fixups[XLT_MAX_FIXUPS];
+};
+
 struct xlt_filter {
     struct gensio_filter *filter;
 
     struct gensio_lock *lock;
 
-    unsigned char inxlt[256];
-    unsigned char inbuf[256];
-    gensiods inlen;
+    struct xlt_table inxlt;
+    struct gensio_circbuf *inbuf;
 
-    unsigned char outxlt[256];
-    unsigned char outbuf[256];
-    gensiods outlen;
+    struct xlt_table outxlt;
+    struct gensio_circbuf *outbuf;
 
     struct gensio_os_funcs *o;
 };
@@ -54,7 +68,7 @@ xlt_ul_read_pending(struct gensio_filter *filter)
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
 
-    return tfilter->inlen > 0;
+    return gensio_circbuf_datalen(tfilter->inbuf) > 0;
 }
 
 static bool
@@ -62,7 +76,7 @@ xlt_ll_write_pending(struct gensio_filter *filter)
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
 
-    return tfilter->outlen > 0;
+    return gensio_circbuf_datalen(tfilter->outbuf) > 0;
 }
 
 static bool
@@ -89,6 +103,92 @@ xlt_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     return 0;
 }
 
+/* Work out which bytes are not translated to themselves. */
+static void
+xlt_table_setup(struct xlt_table *t)
+{
+    unsigned int i;
+
+    t->nfixups = 0;
+    for (i = 0; i < 256; i++) {
+	if (t->xlt[i] == i)
+	    continue;
+	if (t->nfixups >= XLT_MAX_FIXUPS) {
+	    t->nfixups = XLT_MAX_FIXUPS + 1;
+	    break;
+	}
+	t->fixups[t->nfixups++] = i;
+    }
+
+    /*
+     * Fixups are done one byte value at a time, so that only works if
+     * no byte translates to another byte that gets translated.
+     */
+    for (i = 0; i < t->nfixups && t->nfixups <= XLT_MAX_FIXUPS; i++) {
+	unsigned char v = t->xlt[t->fixups[i]];
+
+	if (t->xlt[v] != v)
+	    t->nfixups = XLT_MAX_FIXUPS + 1;
+    }
+}
+
+static void
+xlt_translate(const struct xlt_table *t, unsigned char *out,
+	      const unsigned char *in, gensiods len)
+{
+    gensiods i;
+
+    if (t->nfixups <= XLT_MAX_FIXUPS) {
+	unsigned int j;
+
+	memcpy(out, in, len);
+	for (j = 0; j < t->nfixups; j++) {
+	    unsigned char *p = out, *end = out + len;
+
+	    while ((p = memchr(p, t->fixups[j], end - p)))
+		*p++ = t->xlt[t->fixups[j]];
+	}
+	return;
+    }
+
+    for (i = 0; i + 8 <= len; i += 8) {
+	out[i] = t->xlt[in[i]];
+	out[i + 1] = t->xlt[in[i + 1]];
+	out[i + 2] = t->xlt[in[i + 2]];
+	out[i + 3] = t->xlt[in[i + 3]];
+	out[i + 4] = t->xlt[in[i + 4]];
+	out[i + 5] = t->xlt[in[i + 5]];
+	out[i + 6] = t->xlt[in[i + 6]];
+	out[i + 7] = t->xlt[in[i + 7]];
+    }
+    for (; i < len; i++)
+	out[i] = t->xlt[in[i]];
+}
+
+/*
+ * Translate as much of the data as will fit into the buffer,
+ * returning the number of bytes taken.
+ */
+static gensiods
+xlt_to_circbuf(const struct xlt_table *t, struct gensio_circbuf *c,
+	       const unsigned char *in, gensiods len)
+{
+    gensiods count = 0, size;
+    void *pos;
+
+    while (len > 0 && gensio_circbuf_room_left(c) > 0) {
+	gensio_circbuf_next_write_area(c, &pos, &size);
+	if (size > len)
+	    size = len;
+	xlt_translate(t, pos, in, size);
+	gensio_circbuf_data_added(c, size);
+	in += size;
+	len -= size;
+	count += size;
+    }
+    return count;
+}
+
 static int
 xlt_ul_write(struct gensio_filter *filter,
 	       gensio_ul_filter_data_handler handler, void *cb_data,
@@ -98,38 +198,36 @@ xlt_ul_write(struct gensio_filter *filter,
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
     int err = 0;
-    gensiods i, j, pos = tfilter->outlen;
-    gensiods count = 0;
+    gensiods i, count = 0, len = 0;
 
     xlt_lock(tfilter);
-    for (i = 0; pos < sizeof(tfilter->outbuf) && i < sglen; i++) {
-	const unsigned char *buf = sg[i].buf;
-
-	for (j = 0; pos < sizeof(tfilter->outbuf) && j < sg[i].buflen; j++)
-	    tfilter->outbuf[pos++] = tfilter->outxlt[buf[j]];
+    for (i = 0; i < sglen; i++) {
+	count = xlt_to_circbuf(&tfilter->outxlt, tfilter->outbuf,
+			       sg[i].buf, sg[i].buflen);
+	len += count;
+	if (count < sg[i].buflen)
+	    break;
     }
-    tfilter->outlen = pos;
 
-    if (tfilter->outlen > 0) {
+    /* Unless the buffer is mirrored this may take two writes. */
+    while (gensio_circbuf_datalen(tfilter->outbuf) > 0) {
 	struct gensio_sg osg;
+	void *pos;
 
-	osg.buf = tfilter->outbuf;
-	osg.buflen = tfilter->outlen;
+	gensio_circbuf_next_read_area(tfilter->outbuf, &pos, &osg.buflen);
+	osg.buf = pos;
+	count = 0;
 	err = handler(cb_data, &count, &osg, 1, auxdata);
-	if (!err) {
-	    if (count >= tfilter->outlen) {
-		tfilter->outlen = 0;
-	    } else {
-		tfilter->outlen -= count;
-		memmove(tfilter->outbuf, tfilter->outbuf + count,
-			tfilter->outlen);
-	    }
-	}
+	if (err)
+	    break;
+	gensio_circbuf_data_removed(tfilter->outbuf, count);
+	if (count < osg.buflen)
+	    break;
     }
     xlt_unlock(tfilter);
 
     if (!err && rcount)
-	*rcount = pos;
+	*rcount = len;
 
     return err;
 }
@@ -143,30 +241,28 @@ xlt_ll_write(struct gensio_filter *filter,
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
     int err = 0;
-    gensiods i, pos = tfilter->inlen;
-    gensiods count = 0;
+    gensiods count = 0, len;
 
     xlt_lock(tfilter);
-    for (i = 0; pos < sizeof(tfilter->inbuf) && i < buflen; i++)
-	tfilter->inbuf[pos++] = tfilter->inxlt[buf[i]];
-    tfilter->inlen = pos;
-
-    if (tfilter->inlen > 0) {
-	err = handler(cb_data, &count, tfilter->inbuf, tfilter->inlen, auxdata);
-	if (!err) {
-	    if (count >= tfilter->inlen) {
-		tfilter->inlen = 0;
-	    } else {
-		tfilter->inlen -= count;
-		memmove(tfilter->inbuf, tfilter->inbuf + count,
-			tfilter->inlen);
-	    }
-	}
+    len = xlt_to_circbuf(&tfilter->inxlt, tfilter->inbuf, buf, buflen);
+
+    while (gensio_circbuf_datalen(tfilter->inbuf) > 0) {
+	gensiods size;
+	void *pos;
+
+	gensio_circbuf_next_read_area(tfilter->inbuf, &pos, &size);
+	count = 0;
+	err = handler(cb_data, &count, pos, size, auxdata);
+	if (err)
+	    break;
+	gensio_circbuf_data_removed(tfilter->inbuf, count);
+	if (count < size)
+	    break;
     }
     xlt_unlock(tfilter);
 
     if (!err && rcount)
-	*rcount = pos;
+	*rcount = len;
 
     return err;
 }
@@ -187,6 +283,10 @@ tfilter_free(struct xlt_filter *tfilter)
 {
     if (tfilter->lock)
 	tfilter->o->free_lock(tfilter->lock);
+    if (tfilter->inbuf)
+	gensio_circbuf_free(tfilter->inbuf);
+    if (tfilter->outbuf)
+	gensio_circbuf_free(tfilter->outbuf);
     if (tfilter->filter)
 	gensio_filter_free_data(tfilter->filter);
     tfilter->o->free(tfilter->o, tfilter);
@@ -288,8 +388,8 @@ gensio_xlt_filter_alloc(struct gensio_os_funcs *o,
     tfilter->o = o;
 
     for (i = 0; i < 256; i++) {
-	tfilter->inxlt[i] = i;
-	tfilter->outxlt[i] = i;
+	tfilter->inxlt.xlt[i] = i;
+	tfilter->outxlt.xlt[i] = i;
     }
 
     tfilter->lock = o->alloc_lock(o);
@@ -298,6 +398,18 @@ gensio_xlt_filter_alloc(struct gensio_os_funcs *o,
 	goto out_err;
     }
 
+    tfilter->inbuf = gensio_circbuf_alloc_mirrored(o, XLT_BUFSIZE);
+    if (!tfilter->inbuf) {
+	rv = GE_NOMEM;
+	goto out_err;
+    }
+
+    tfilter->outbuf = gensio_circbuf_alloc_mirrored(o, XLT_BUFSIZE);
+    if (!tfilter->outbuf) {
+	rv = GE_NOMEM;
+	goto out_err;
+    }
+
     tfilter->filter = gensio_filter_alloc_data(o, gensio_xlt_filter_func,
 					       tfilter);
     if (!tfilter->filter) {
@@ -307,40 +419,43 @@ gensio_xlt_filter_alloc(struct gensio_os_funcs *o,
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyvalue(args[i], "in", &str) > 0) {
-	    rv = process_xlt(tfilter->inxlt, str);
+	    rv = process_xlt(tfilter->inxlt.xlt, str);
 	    if (rv)
 		goto out_err;
 	    continue;
 	}
 	if (gensio_check_keyvalue(args[i], "out", &str) > 0) {
-	    rv = process_xlt(tfilter->outxlt, str);
+	    rv = process_xlt(tfilter->outxlt.xlt, str);
 	    if (rv)
 		goto out_err;
 	    continue;
 	}
 	if (gensio_check_keybool(args[i], "crlf", &bval) > 0) {
-	    tfilter->inxlt['\r'] = '\n';
-	    tfilter->outxlt['\n'] = '\r';
+	    tfilter->inxlt.xlt['\r'] = '\n';
+	    tfilter->outxlt.xlt['\n'] = '\r';
 	    continue;
 	}
 	if (gensio_check_keybool(args[i], "lfcr", &bval) > 0) {
-	    tfilter->outxlt['\r'] = '\n';
-	    tfilter->inxlt['\n'] = '\r';
+	    tfilter->outxlt.xlt['\r'] = '\n';
+	    tfilter->inxlt.xlt['\n'] = '\r';
 	    continue;
 	}
 	if (gensio_check_keybool(args[i], "crnl", &bval) > 0) {
-	    tfilter->inxlt['\r'] = '\n';
-	    tfilter->outxlt['\n'] = '\r';
+	    tfilter->inxlt.xlt['\r'] = '\n';
+	    tfilter->outxlt.xlt['\n'] = '\r';
 	    continue;
 	}
 	if (gensio_check_keybool(args[i], "nlcr", &bval) > 0) {
-	    tfilter->outxlt['\r'] = '\n';
-	    tfilter->inxlt['\n'] = '\r';
+	    tfilter->outxlt.xlt['\r'] = '\n';
+	    tfilter->inxlt.xlt['\n'] = '\r';
 	    continue;
 	}
 	goto out_err;
     }
 
+    xlt_table_setup(&tfilter->inxlt);
+    xlt_table_setup(&tfilter->outxlt);
+
     *rfilter = tfilter->filter;
     return 0;
 
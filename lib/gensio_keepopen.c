@@ -17,6 +17,7 @@
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_time.h>
 #include <gensio/argvutils.h>
 
 /*
@@ -164,6 +165,16 @@ struct keepn_data {
     struct gensio_timer *retry_timer;
     struct gensio_time retry_time;
 
+    /*
+     * Retries back off exponentially from retry_time up to retry_max,
+     * and each gets a random extra delay up to retry_spread so a lot
+     * of keepopens that lose their connection at the same time don't
+     * all retry together.  cur_retry is the next backoff value.
+     */
+    struct gensio_time retry_max;
+    struct gensio_time retry_spread;
+    struct gensio_time cur_retry;
+
     bool read_enabled;
     bool xmit_enabled;
 
@@ -243,8 +254,24 @@ keepn_start_zero_timer(struct keepn_data *ndata)
 static void
 keepn_start_timer(struct keepn_data *ndata)
 {
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_time timeout = ndata->cur_retry;
+    int64_t spread, cur;
+    uint32_t randv;
+
+    spread = gensio_time_to_usecs(&ndata->retry_spread);
+    if (spread > 0 && o->get_random(o, &randv, sizeof(randv)) == 0)
+	gensio_time_add_nsecs(&timeout,
+			      GENSIO_USECS_TO_NSECS(randv % (spread + 1)));
+
+    cur = gensio_time_to_usecs(&ndata->cur_retry);
+    if (cur * 2 < gensio_time_to_usecs(&ndata->retry_max))
+	gensio_usecs_to_time(&ndata->cur_retry, cur * 2);
+    else
+	ndata->cur_retry = ndata->retry_max;
+
     keepn_ref(ndata);
-    if (ndata->o->start_timer(ndata->retry_timer, &ndata->retry_time) != 0)
+    if (o->start_timer(ndata->retry_timer, &timeout) != 0)
 	assert(0);
 }
 
@@ -321,6 +348,7 @@ keepn_open_done(struct gensio *io, int err, void *open_data)
 	    if (ndata->last_child_err)
 		gensio_log(ndata->o, GENSIO_LOG_INFO,
 			   "child gensio open restored");
+	    ndata->cur_retry = ndata->retry_time;
 	    gensio_set_write_callback_enable(ndata->child, ndata->tx_enable);
 	    gensio_set_read_callback_enable(ndata->child, ndata->rx_enable);
 	    ndata->state = KEEPN_OPEN;
@@ -470,6 +498,7 @@ keepn_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	ndata->last_child_err = 0;
 	ndata->state = KEEPN_IN_OPEN;
     }
+    ndata->cur_retry = ndata->retry_time;
     ndata->open_done = open_done;
     ndata->open_data = open_data;
  out_unlock:
@@ -651,16 +680,26 @@ keepopen_gensio_alloc(struct gensio *child, const char * const args[],
     struct keepn_data *ndata = NULL;
     int i;
     struct gensio_time retry_time = { 1, 0 };
+    struct gensio_time retry_max = { 0, 0 };
+    struct gensio_time retry_spread = { 0, 0 };
     bool discard_badwrites = false;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keytime(args[i], "retry-time", 'm', &retry_time) > 0)
 	    continue;
+	if (gensio_check_keytime(args[i], "retry-max", 'm', &retry_max) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "retry-spread", 'm',
+				 &retry_spread) > 0)
+	    continue;
 	if (gensio_check_keybool(args[i], "discard-badwrites",
 				 &discard_badwrites) > 0)
 	    continue;
 	return GE_INVAL;
     }
+    /* By default the retry time is fixed. */
+    if (gensio_time_to_usecs(&retry_max) < gensio_time_to_usecs(&retry_time))
+	retry_max = retry_time;
 
     ndata = o->zalloc(o, sizeof(*ndata));
     if (!ndata)
@@ -678,6 +717,9 @@ keepopen_gensio_alloc(struct gensio *child, const char * const args[],
 
     ndata->child = child;
     ndata->retry_time = retry_time;
+    ndata->retry_max = retry_max;
+    ndata->retry_spread = retry_spread;
+    ndata->cur_retry = retry_time;
     ndata->discard_badwrites = discard_badwrites;
     gensio_set_callback(child, keepn_event, ndata);
 
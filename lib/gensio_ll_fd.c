@@ -8,11 +8,18 @@
 #include "config.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_os_funcs_public.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_err.h>
+#include <gensio/gensio_control.h>
 #include <gensio/gensio_ll_fd.h>
+#include <gensio/gensio_list.h>
+
+#include "gensio_probes.h"
 
 enum fd_state {
     /*
@@ -96,68 +103,116 @@ struct fd_state_trace {
 #define STATE_TRACE_LEN 256
 #endif
 
-struct fd_ll {
-    struct gensio_ll *ll;
-    struct gensio_os_funcs *o;
+/*
+ * Things only used for open, close, and buffer pool waits.  These are
+ * kept at the end of struct fd_ll, out of the cache lines the read and
+ * write paths touch.
+ */
+struct fd_ll_cold {
+    gensio_ll_open_done open_done;
+    void *open_data;
+    int open_err;
 
-    struct gensio_lock *lock;
+    struct gensio_timer *close_timer;
+    gensio_ll_close_done close_done;
+    void *close_data;
+    bool freed;
 
-    unsigned int refcount;
+    /* Waiting for a read buffer pool buffer, see read_buf_wait. */
+    struct gensio_link rbuf_link;
+    struct gensio_runner *rbuf_runner;
+
+    /*
+     * Used to run read callbacks from the selector to avoid running
+     * it directly from user calls.
+     */
+    struct gensio_runner *deferred_op_runner;
+
+    /* See rinto_sglen. */
+    struct gensio_sg rinto_sg[GENSIO_LL_READ_INTO_MAX_SG];
+
+#ifdef DEBUG_STATE
+    /* Allocated separately, it's big. */
+    struct fd_state_trace *trace;
+    unsigned int trace_pos;
+#endif
+};
+
+/*
+ * The fields used on every read and write come first so they share as
+ * few cache lines as possible, with the flags together.
+ */
+struct fd_ll {
+    struct gensio_lock *lock;
+    struct gensio_os_funcs *o;
+    struct gensio_ll *ll;
 
     gensio_ll_cb cb;
     void *cb_data;
 
     struct gensio_iod *iod;
 
+    const struct gensio_fd_ll_ops *ops;
+    void *handler_data;
+
     enum fd_state state;
+    unsigned int refcount;
 
     bool read_enabled;
     bool write_enabled;
     bool write_only;
-
-    const struct gensio_fd_ll_ops *ops;
-    void *handler_data;
-
-    gensio_ll_open_done open_done;
-    void *open_data;
-    int open_err;
-
-    struct gensio_timer *close_timer;
-    gensio_ll_close_done close_done;
-    void *close_data;
-    bool close_requested;
-    bool freed;
-
-    unsigned char *read_data;
-    gensiods read_data_size;
-    gensiods read_data_len;
-    gensiods read_data_pos;
-    const char *const *auxdata;
-
     bool in_read;
     bool in_write;
+    bool close_requested;
+    bool read_adaptive;
+    bool read_buf_wait; /* Waiting for a pool buffer, reads are off. */
 
     /*
-     * Used to run read callbacks from the selector to avoid running
-     * it directly from user calls.
+     * deferred_op_pending is set while the deferred op runner is
+     * scheduled, the others say what it has to do.
      */
     bool deferred_op_pending;
-    struct gensio_runner *deferred_op_runner;
-
     bool deferred_open;
     bool deferred_read;
     bool deferred_close;
     bool deferred_except;
 
-#ifdef DEBUG_STATE
-    struct fd_state_trace trace[STATE_TRACE_LEN];
-    unsigned int trace_pos;
-#endif
+    /*
+     * If rbuf_class is >= 0, read_data is borrowed from the read
+     * buffer pool and is only held while read data is pending.
+     * Otherwise read_data is allocated for the life of the fdll.
+     */
+    unsigned char *read_data;
+    gensiods read_data_size;
+    int rbuf_class;
+    unsigned int rbuf_node;
+
+    /*
+     * Size of the next read.  This is read_data_size unless adaptive
+     * sizing is on (see GENSIO_CONTROL_READ_SIZE), then it moves
+     * between read_size_min and read_data_size.
+     */
+    gensiods read_size;
+    gensiods read_size_min;
+    unsigned int read_full_count;
+    unsigned int read_short_count;
+    gensiods read_data_len;
+    gensiods read_data_pos;
+    const char *const *auxdata;
+
+    /*
+     * A read posted with GENSIO_LL_FUNC_READ_INTO, reads go straight
+     * into it until it completes.  rinto_sglen is 0 if none.
+     */
+    gensiods rinto_sglen;
+
+    struct fd_ll_cold cold;
 };
 
 #define ll_to_fd(v) ((struct fd_ll *) gensio_ll_get_user_data(v))
 
 static void fd_handle_write_ready(struct fd_ll *fdll, struct gensio_iod *iod);
+static void fd_rbuf_put(struct fd_ll *fdll);
 
 static void fd_finish_free(struct fd_ll *fdll)
 {
@@ -165,14 +220,22 @@ static void fd_finish_free(struct fd_ll *fdll)
 	gensio_ll_free_data(fdll->ll);
     if (fdll->lock)
 	fdll->o->free_lock(fdll->lock);
-    if (fdll->close_timer)
-	fdll->o->free_timer(fdll->close_timer);
-    if (fdll->deferred_op_runner)
-	fdll->o->free_runner(fdll->deferred_op_runner);
-    if (fdll->read_data)
-	fdll->o->free(fdll->o, fdll->read_data);
+    if (fdll->cold.close_timer)
+	fdll->o->free_timer(fdll->cold.close_timer);
+    if (fdll->cold.deferred_op_runner)
+	fdll->o->free_runner(fdll->cold.deferred_op_runner);
+    if (fdll->cold.rbuf_runner)
+	fdll->o->free_runner(fdll->cold.rbuf_runner);
+    if (fdll->read_data && fdll->rbuf_class >= 0)
+	fd_rbuf_put(fdll);
+    else if (fdll->read_data)
+	gensio_os_funcs_buf_free(fdll->o, fdll->read_data);
     if (fdll->ops)
 	fdll->ops->free(fdll->handler_data);
+#ifdef DEBUG_STATE
+    if (fdll->cold.trace)
+	fdll->o->free(fdll->o, fdll->cold.trace);
+#endif
     fdll->o->free(fdll->o, fdll);
 }
 
@@ -180,13 +243,17 @@ static void fd_finish_free(struct fd_ll *fdll)
 static void
 i_fd_add_trace(struct fd_ll *fdll, enum fd_state new_state, int line)
 {
-    fdll->trace[fdll->trace_pos].old_state = fdll->state;
-    fdll->trace[fdll->trace_pos].new_state = new_state;
-    fdll->trace[fdll->trace_pos].line = line;
-    if (fdll->trace_pos == STATE_TRACE_LEN - 1)
-	fdll->trace_pos = 0;
+    struct fd_ll_cold *c = &fdll->cold;
+
+    if (!c->trace)
+	return;
+    c->trace[c->trace_pos].old_state = fdll->state;
+    c->trace[c->trace_pos].new_state = new_state;
+    c->trace[c->trace_pos].line = line;
+    if (c->trace_pos == STATE_TRACE_LEN - 1)
+	c->trace_pos = 0;
     else
-	fdll->trace_pos++;
+	c->trace_pos++;
 }
 #define fd_add_trace(fdll, new_state) \
     i_fd_add_trace(fdll, new_state, __LINE__)
@@ -312,6 +379,232 @@ fd_deref_and_unlock(struct fd_ll *fdll)
 }
 #endif /* DEBUG_STATE */
 
+/*
+ * A global pool of read buffers in power of two size classes.  The
+ * total memory in the pool, borrowed and cached, is limited to
+ * fd_rbuf_limit if that is not zero.  If a read can't get a buffer
+ * because of the limit, its read handler is disabled and it waits
+ * for a buffer to be returned.
+ *
+ * Cached buffers are kept per NUMA node (see
+ * gensio_os_funcs_set_numa()), buffers are taken from the reading
+ * thread's node and go back to the node they came from, so a
+ * connection's reads land in memory local to its thread.
+ */
+#define FD_RBUF_MIN_SHIFT	8
+#define FD_RBUF_NUM_CLASSES	20
+#define FD_RBUF_DEFAULT_CACHE	(1024 * 1024)
+#define FD_RBUF_MAX_NODES	8
+
+static struct gensio_once fd_rbuf_once;
+static struct gensio_os_funcs *fd_rbuf_o;
+static struct gensio_lock *fd_rbuf_lock;
+static void *fd_rbuf_free[FD_RBUF_MAX_NODES][FD_RBUF_NUM_CLASSES];
+static gensiods fd_rbuf_limit;
+static gensiods fd_rbuf_total;
+static gensiods fd_rbuf_cached;
+static struct gensio_list fd_rbuf_waiters;
+
+#define fd_rbuf_size(c) (((gensiods) 1) << ((c) + FD_RBUF_MIN_SHIFT))
+
+static void
+fd_rbuf_cleanup(void)
+{
+    struct gensio_os_funcs *o = fd_rbuf_o;
+    unsigned int i, n;
+    void *buf;
+
+    for (n = 0; n < FD_RBUF_MAX_NODES; n++) {
+	for (i = 0; i < FD_RBUF_NUM_CLASSES; i++) {
+	    while (fd_rbuf_free[n][i]) {
+		buf = fd_rbuf_free[n][i];
+		fd_rbuf_free[n][i] = *((void **) buf);
+		gensio_os_funcs_buf_free(o, buf);
+	    }
+	}
+    }
+    fd_rbuf_total = 0;
+    fd_rbuf_cached = 0;
+    if (fd_rbuf_lock)
+	o->free_lock(fd_rbuf_lock);
+    fd_rbuf_lock = NULL;
+    memset(&fd_rbuf_once, 0, sizeof(fd_rbuf_once));
+}
+
+static struct gensio_class_cleanup fd_rbuf_cleanup_data = {
+    fd_rbuf_cleanup
+};
+
+static void
+fd_rbuf_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&fd_rbuf_waiters);
+    fd_rbuf_o = o;
+    fd_rbuf_lock = o->alloc_lock(o);
+    if (fd_rbuf_lock)
+	gensio_register_class_cleanup(&fd_rbuf_cleanup_data);
+}
+
+void
+gensio_fd_ll_set_read_buf_limit(gensiods limit)
+{
+    fd_rbuf_limit = limit;
+}
+
+/* Return the size class for size, or -1 if it is too big to pool. */
+static int
+fd_rbuf_class_of(gensiods size)
+{
+    int c;
+
+    for (c = 0; c < FD_RBUF_NUM_CLASSES; c++) {
+	if (fd_rbuf_size(c) >= size)
+	    return c;
+    }
+    return -1;
+}
+
+/* Free cached buffers until size more bytes fit.  Pool lock held. */
+static void
+fd_rbuf_trim(gensiods size)
+{
+    struct gensio_os_funcs *o = fd_rbuf_o;
+    unsigned int i, n;
+    void *buf;
+
+    for (n = 0; n < FD_RBUF_MAX_NODES; n++) {
+	for (i = 0; i < FD_RBUF_NUM_CLASSES; i++) {
+	    while (fd_rbuf_free[n][i] && fd_rbuf_total + size > fd_rbuf_limit) {
+		buf = fd_rbuf_free[n][i];
+		fd_rbuf_free[n][i] = *((void **) buf);
+		fd_rbuf_total -= fd_rbuf_size(i);
+		fd_rbuf_cached -= fd_rbuf_size(i);
+		gensio_os_funcs_buf_free(o, buf);
+	    }
+	}
+    }
+}
+
+/*
+ * Get a read buffer for fdll.  Returns GE_INPROGRESS if the pool is
+ * at its limit, fdll is then queued (with a ref) and its rbuf_runner
+ * is run when a buffer is returned.  Called with the fdll lock held.
+ */
+static int
+fd_rbuf_get(struct fd_ll *fdll)
+{
+    struct gensio_os_funcs *o = fd_rbuf_o;
+    gensiods size;
+    void *buf;
+
+    /* Only the read size is needed, it may be smaller than the max. */
+    fdll->rbuf_class = fd_rbuf_class_of(fdll->read_size);
+    size = fd_rbuf_size(fdll->rbuf_class);
+    fdll->rbuf_node = gensio_os_funcs_get_numa_node(o) % FD_RBUF_MAX_NODES;
+
+    o->lock(fd_rbuf_lock);
+    buf = fd_rbuf_free[fdll->rbuf_node][fdll->rbuf_class];
+    if (buf) {
+	fd_rbuf_free[fdll->rbuf_node][fdll->rbuf_class] = *((void **) buf);
+	fd_rbuf_cached -= size;
+	o->unlock(fd_rbuf_lock);
+	fdll->read_data = buf;
+	return 0;
+    }
+    if (fd_rbuf_limit && fd_rbuf_total + size > fd_rbuf_limit) {
+	fd_rbuf_trim(size);
+	/* Always allow one buffer so something can make progress. */
+	if (fd_rbuf_total + size > fd_rbuf_limit && fd_rbuf_total > 0) {
+	    fd_ref(fdll);
+	    fdll->read_buf_wait = true;
+	    gensio_list_add_tail(&fd_rbuf_waiters, &fdll->cold.rbuf_link);
+	    o->unlock(fd_rbuf_lock);
+	    return GE_INPROGRESS;
+	}
+    }
+    fd_rbuf_total += size;
+    o->unlock(fd_rbuf_lock);
+
+    buf = gensio_os_funcs_buf_zalloc(o, size);
+    if (!buf) {
+	o->lock(fd_rbuf_lock);
+	fd_rbuf_total -= size;
+	o->unlock(fd_rbuf_lock);
+	return GE_NOMEM;
+    }
+    fdll->read_data = buf;
+    return 0;
+}
+
+/* Return fdll's read buffer to the pool and wake a waiter. */
+static void
+fd_rbuf_put(struct fd_ll *fdll)
+{
+    struct gensio_os_funcs *o = fd_rbuf_o;
+    gensiods size = fd_rbuf_size(fdll->rbuf_class);
+    gensiods max_cache = fd_rbuf_limit ? fd_rbuf_limit : FD_RBUF_DEFAULT_CACHE;
+    struct gensio_link *l;
+    struct fd_ll *w = NULL;
+    void *buf = fdll->read_data;
+
+    fdll->read_data = NULL;
+    o->lock(fd_rbuf_lock);
+    if (fd_rbuf_cached + size <= max_cache) {
+	*((void **) buf) = fd_rbuf_free[fdll->rbuf_node][fdll->rbuf_class];
+	fd_rbuf_free[fdll->rbuf_node][fdll->rbuf_class] = buf;
+	fd_rbuf_cached += size;
+	buf = NULL;
+    } else {
+	fd_rbuf_total -= size;
+    }
+    if (!gensio_list_empty(&fd_rbuf_waiters)) {
+	l = gensio_list_first(&fd_rbuf_waiters);
+	gensio_list_rm(&fd_rbuf_waiters, l);
+	w = gensio_container_of(l, struct fd_ll, cold.rbuf_link);
+    }
+    o->unlock(fd_rbuf_lock);
+
+    if (buf)
+	gensio_os_funcs_buf_free(o, buf);
+    if (w)
+	w->o->run(w->cold.rbuf_runner);
+}
+
+/* Stop waiting for a buffer, for close.  Called with the fdll lock held. */
+static void
+fd_rbuf_cancel_wait(struct fd_ll *fdll)
+{
+    bool waiting;
+
+    if (fdll->rbuf_class < 0)
+	return;
+    fd_rbuf_o->lock(fd_rbuf_lock);
+    waiting = gensio_list_link_inlist(&fdll->cold.rbuf_link);
+    if (waiting)
+	gensio_list_rm(&fd_rbuf_waiters, &fdll->cold.rbuf_link);
+    fd_rbuf_o->unlock(fd_rbuf_lock);
+    if (waiting) {
+	fdll->read_buf_wait = false;
+	fd_deref(fdll);
+    }
+}
+
+static void
+fd_rbuf_ready(struct gensio_runner *runner, void *cbdata)
+{
+    struct fd_ll *fdll = cbdata;
+
+    fd_lock(fdll);
+    fdll->read_buf_wait = false;
+    if (fdll->state == FD_OPEN && fdll->read_enabled && !fdll->in_read) {
+	fdll->o->set_read_handler(fdll->iod, true);
+	fdll->o->set_except_handler(fdll->iod, true);
+    }
+    fd_deref_and_unlock(fdll);
+}
+
 static void
 fd_set_callbacks(struct gensio_ll *ll, gensio_ll_cb cb, void *cb_data)
 {
@@ -330,18 +623,51 @@ gensio_fd_ll_callback(struct gensio_ll *ll, int op, int val, void *buf,
     return fdll->cb(fdll->cb_data, op, val, buf, buflen, data);
 }
 
+static void
+fd_count_sys(struct fd_ll *fdll, bool write, int err, gensiods count)
+{
+    struct gensio_stats *stats = gensio_ll_get_stats(fdll->ll);
+
+    if (write)
+	GENSIO_PROBE3(fd_write, fdll, err, err ? 0 : count);
+    else
+	GENSIO_PROBE3(fd_read, fdll, err, err ? 0 : count);
+    if (!stats)
+	return;
+    if (write) {
+	gensio_stats_add(stats, sys_writes, 1);
+	if (!err && !count)
+	    gensio_stats_add(stats, sys_writes_empty, 1);
+    } else {
+	gensio_stats_add(stats, sys_reads, 1);
+	if (!err && !count)
+	    gensio_stats_add(stats, sys_reads_empty, 1);
+    }
+}
+
 static int
 fd_write(struct gensio_ll *ll, gensiods *rcount,
 	 const struct gensio_sg *sg, gensiods sglen,
 	 const char *const *auxdata)
 {
     struct fd_ll *fdll = ll_to_fd(ll);
+    gensiods count = 0;
+    int err;
 
-    if (fdll->ops->write)
-	return fdll->ops->write(fdll->handler_data, fdll->iod,
-				rcount, sg, sglen, auxdata);
+    if (!fdll->ops->write) {
+	err = fdll->o->write(fdll->iod, sg, sglen, &count);
+	fd_count_sys(fdll, true, err, count);
+	if (rcount)
+	    *rcount = count;
+	return err;
+    }
 
-    return fdll->o->write(fdll->iod, sg, sglen, rcount);
+    err = fdll->ops->write(fdll->handler_data, fdll->iod,
+			   &count, sg, sglen, auxdata);
+    fd_count_sys(fdll, true, err, count);
+    if (rcount)
+	*rcount = count;
+    return err;
 }
 
 static void
@@ -360,6 +686,8 @@ fd_deliver_read_data(struct fd_ll *fdll, int err)
 	    fdll->read_data_pos = 0;
 	    fdll->read_data_len = 0;
 	    fdll->auxdata = NULL;
+	    if (fdll->read_data && fdll->rbuf_class >= 0)
+		fd_rbuf_put(fdll);
 	} else {
 	    fdll->read_data_pos += count;
 	    fdll->read_data_len -= count;
@@ -372,7 +700,7 @@ fd_deliver_read_data(struct fd_ll *fdll, int err)
 static void
 fd_finish_open(struct fd_ll *fdll, int err)
 {
-    gensio_ll_open_done open_done = fdll->open_done;
+    gensio_ll_open_done open_done = fdll->cold.open_done;
 
     if (err)
 	fd_set_state(fdll, FD_CLOSED);
@@ -380,9 +708,9 @@ fd_finish_open(struct fd_ll *fdll, int err)
 	fd_set_state(fdll, FD_OPEN);
 
 
-    fdll->open_done = NULL;
+    fdll->cold.open_done = NULL;
     fd_unlock(fdll);
-    open_done(fdll->cb_data, err, fdll->open_data);
+    open_done(fdll->cb_data, err, fdll->cold.open_data);
     fd_lock(fdll);
 
     if (fdll->state == FD_OPEN) {
@@ -395,15 +723,28 @@ fd_finish_open(struct fd_ll *fdll, int err)
     }
 }
 
+/* Complete a posted read_into.  Called and returns locked. */
+static void
+fd_read_into_done(struct fd_ll *fdll, int err, gensiods count)
+{
+    fdll->rinto_sglen = 0;
+    fd_unlock(fdll);
+    gensio_fd_ll_callback(fdll->ll, GENSIO_LL_CB_READ_INTO_DONE, err,
+			  NULL, count, NULL);
+    fd_lock(fdll);
+}
+
 static void fd_finish_close(struct fd_ll *fdll)
 {
     fd_set_state(fdll, FD_CLOSED);
-    if (fdll->close_done) {
-	gensio_ll_close_done close_done = fdll->close_done;
+    if (fdll->rinto_sglen)
+	fd_read_into_done(fdll, GE_LOCALCLOSED, 0);
+    if (fdll->cold.close_done) {
+	gensio_ll_close_done close_done = fdll->cold.close_done;
 
-	fdll->close_done = NULL;
+	fdll->cold.close_done = NULL;
 	fd_unlock(fdll);
-	close_done(fdll->cb_data, fdll->close_data);
+	close_done(fdll->cb_data, fdll->cold.close_data);
 	fd_lock(fdll);
     }
     fd_deref(fdll);
@@ -417,7 +758,7 @@ fd_deferred_op(struct gensio_runner *runner, void *cbdata)
     fd_lock(fdll);
     if (fdll->deferred_open) {
 	fdll->deferred_open = false;
-	fd_finish_open(fdll, fdll->open_err);
+	fd_finish_open(fdll, fdll->cold.open_err);
     }
 
     if (fdll->deferred_except && fdll->write_enabled) {
@@ -442,7 +783,8 @@ fd_deferred_op(struct gensio_runner *runner, void *cbdata)
 
     fdll->deferred_op_pending = false;
     if (fdll->state == FD_OPEN) {
-	fdll->o->set_read_handler(fdll->iod, fdll->read_enabled);
+	fdll->o->set_read_handler(fdll->iod,
+				  fdll->read_enabled && !fdll->read_buf_wait);
 	fdll->o->set_except_handler(fdll->iod,
 				    fdll->read_enabled || fdll->write_enabled);
 	fdll->o->set_write_handler(fdll->iod, fdll->write_enabled);
@@ -457,7 +799,7 @@ fd_sched_deferred_op(struct fd_ll *fdll)
 	/* Call the read from the selector to avoid lock nesting issues. */
 	fd_ref(fdll);
 	fdll->deferred_op_pending = true;
-	fdll->o->run(fdll->deferred_op_runner);
+	fdll->o->run(fdll->cold.deferred_op_runner);
     }
 }
 
@@ -467,6 +809,7 @@ fd_start_close(struct fd_ll *fdll)
     if (fdll->ops->check_close)
 	fdll->ops->check_close(fdll->handler_data, fdll->iod,
 			       GENSIO_LL_CLOSE_STATE_START, NULL);
+    fd_rbuf_cancel_wait(fdll);
     if (!fdll->iod) {
 	fdll->deferred_close = true;
 	fd_sched_deferred_op(fdll);
@@ -477,6 +820,82 @@ fd_start_close(struct fd_ll *fdll)
     fd_set_state(fdll, FD_IN_CLOSE);
 }
 
+static int gensio_ll_fd_read(struct gensio_iod *iod, void *buf, gensiods count,
+			     gensiods *rcount, const char ***auxdata,
+			     void *cb_data);
+
+/*
+ * Adaptive read sizing.  Grow the read size when reads keep filling
+ * the buffer, or straight to what the OS says is pending if it can
+ * tell us.  Shrink it after a run of short reads.
+ */
+#define FD_READ_GROW_COUNT	2
+#define FD_READ_SHRINK_COUNT	8
+
+static void
+fd_adapt_read_size(struct fd_ll *fdll, gensiods count)
+{
+    gensiods size = fdll->read_size, pending;
+
+    if (count >= size) {
+	fdll->read_short_count = 0;
+	if (!fdll->o->bufcount(fdll->iod, GENSIO_IN_BUF, &pending) &&
+		pending > 0) {
+	    if (pending > size)
+		size = pending;
+	} else if (++fdll->read_full_count >= FD_READ_GROW_COUNT) {
+	    fdll->read_full_count = 0;
+	    size *= 2;
+	}
+    } else if (count < size / 4) {
+	fdll->read_full_count = 0;
+	if (++fdll->read_short_count >= FD_READ_SHRINK_COUNT) {
+	    fdll->read_short_count = 0;
+	    size /= 2;
+	}
+    } else {
+	fdll->read_full_count = 0;
+	fdll->read_short_count = 0;
+    }
+
+    if (size > fdll->read_data_size)
+	size = fdll->read_data_size;
+    if (size < fdll->read_size_min)
+	size = fdll->read_size_min;
+    fdll->read_size = size;
+}
+
+/*
+ * Read straight into the posted read_into buffers, stopping at the
+ * first short read.  Called and returns locked, in_read must be set.
+ */
+static int
+fd_do_read_into(struct fd_ll *fdll)
+{
+    struct gensio_sg sg[GENSIO_LL_READ_INTO_MAX_SG];
+    gensiods i, sglen = fdll->rinto_sglen, count, total = 0;
+    int err = 0;
+
+    memcpy(sg, fdll->cold.rinto_sg, sglen * sizeof(*sg));
+    fd_unlock(fdll);
+    for (i = 0; i < sglen; i++) {
+	err = fdll->iod->f->read(fdll->iod, (void *) sg[i].buf, sg[i].buflen,
+				 &count);
+	fd_count_sys(fdll, false, err, count);
+	if (err)
+	    break;
+	total += count;
+	if (count < sg[i].buflen)
+	    break;
+    }
+    fd_lock(fdll);
+    if (total)
+	err = 0; /* Give the data, the error will come on the next read. */
+    if (total || err)
+	fd_read_into_done(fdll, err, total);
+    return err;
+}
+
 static void
 fd_handle_incoming(struct fd_ll *fdll,
 		   int (*doread)(struct gensio_iod *iod, void *buf, gensiods count,
@@ -493,19 +912,40 @@ fd_handle_incoming(struct fd_ll *fdll,
 	goto out_disable;
     fdll->in_read = true;
 
-    if (!fdll->read_data_len) {
+    if (fdll->rinto_sglen && !fdll->read_data_len &&
+		doread == gensio_ll_fd_read) {
+	err = fd_do_read_into(fdll);
+	goto out_err;
+    }
+
+    if (!fdll->read_data_len && !fdll->read_data && fdll->rbuf_class >= 0) {
+	err = fd_rbuf_get(fdll);
+	if (err == GE_INPROGRESS) {
+	    fdll->in_read = false;
+	    goto out_disable;
+	}
+    }
+
+    if (!err && !fdll->read_data_len) {
 	fd_unlock(fdll);
-	err = doread(fdll->iod, fdll->read_data, fdll->read_data_size, &count,
+	err = doread(fdll->iod, fdll->read_data, fdll->read_size, &count,
 		     &auxdata, cb_data);
+	fd_count_sys(fdll, false, err, count);
 	fd_lock(fdll);
 	if (!err) {
 	    fdll->read_data_len = count;
 	    fdll->auxdata = auxdata;
+	    /* Only for streams, a short packet read would truncate. */
+	    if (fdll->read_adaptive && doread == gensio_ll_fd_read)
+		fd_adapt_read_size(fdll, count);
 	}
     }
 
     fd_deliver_read_data(fdll, err);
+    if (!fdll->read_data_len && fdll->read_data && fdll->rbuf_class >= 0)
+	fd_rbuf_put(fdll); /* Nothing was read. */
 
+ out_err:
     if (err) {
 	switch(fdll->state) {
 	case FD_IN_OPEN:
@@ -531,7 +971,7 @@ fd_handle_incoming(struct fd_ll *fdll,
      * We could turn off read when there is pending data, but
      * if the user is doing their job right, it shouldn't matter.
      */
-    if (fdll->state == FD_OPEN && fdll->read_enabled) {
+    if (fdll->state == FD_OPEN && (fdll->read_enabled || fdll->rinto_sglen)) {
 	fdll->o->set_read_handler(fdll->iod, true);
 	fdll->o->set_except_handler(fdll->iod, true);
     } else {
@@ -587,6 +1027,11 @@ fd_handle_write_ready(struct fd_ll *fdll, struct gensio_iod *iod)
 	fdll->o->set_write_handler(iod, false);
 	fdll->o->set_except_handler(iod, fdll->read_enabled);
 	err = fdll->ops->check_open(fdll->handler_data, fdll->iod);
+	if (err == GE_INPROGRESS) {
+	    /* Waiting on something else, gensio_fd_ll_check_open() later. */
+	    fdll->o->set_except_handler(iod, false);
+	    return;
+	}
 	/*
 	 * The GE_NOMEM check is strange here, but it really has more
 	 * to do with testing.  check_open() is not going to return
@@ -599,7 +1044,7 @@ fd_handle_write_ready(struct fd_ll *fdll, struct gensio_iod *iod)
 	    fdll->o->clear_fd_handlers(fdll->iod);
 	} else {
 	    if (err) {
-		fdll->open_err = err;
+		fdll->cold.open_err = err;
 		fd_set_state(fdll, FD_OPEN_ERR_WAIT);
 		fdll->o->clear_fd_handlers(fdll->iod);
 	    } else {
@@ -714,7 +1159,7 @@ fd_check_close(struct fd_ll *fdll)
 
     if (err == GE_INPROGRESS) {
 	fd_ref(fdll);
-	fdll->o->start_timer(fdll->close_timer, &timeout);
+	fdll->o->start_timer(fdll->cold.close_timer, &timeout);
     } else {
 	fd_finish_cleared(fdll);
     }
@@ -776,9 +1221,11 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
     }
 
     fdll->close_requested = false;
-    fdll->open_err = 0;
+    fdll->cold.open_err = 0;
     fdll->read_data_len = 0;
     fdll->read_data_pos = 0;
+    if (fdll->read_data && fdll->rbuf_class >= 0)
+	fd_rbuf_put(fdll);
 
     err = fdll->ops->sub_open(fdll->handler_data, &fdll->iod);
     if (err == GE_INPROGRESS || err == 0) {
@@ -789,8 +1236,8 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
 	    goto out;
 	}
 
-	fdll->open_done = done;
-	fdll->open_data = open_data;
+	fdll->cold.open_done = done;
+	fdll->cold.open_data = open_data;
 	if (err == GE_INPROGRESS) {
 	    fd_set_state(fdll, FD_IN_OPEN);
 	    fdll->o->set_write_handler(fdll->iod, true);
@@ -828,7 +1275,7 @@ static int fd_close(struct gensio_ll *ll, gensio_ll_close_done done,
     switch(fdll->state) {
     case FD_IN_OPEN:
     case FD_IN_OPEN_RETRY:
-	fdll->open_err = GE_LOCALCLOSED;
+	fdll->cold.open_err = GE_LOCALCLOSED;
 	/* Fallthrough */
     case FD_OPEN_ERR_WAIT:
 	fdll->deferred_open = true;
@@ -836,8 +1283,8 @@ static int fd_close(struct gensio_ll *ll, gensio_ll_close_done done,
 	/* Fallthrough */
     case FD_OPEN:
     case FD_ERR_WAIT:
-	fdll->close_done = done;
-	fdll->close_data = close_data;
+	fdll->cold.close_done = done;
+	fdll->cold.close_data = close_data;
 	fd_start_close(fdll);
 	err = 0;
 	break;
@@ -873,13 +1320,46 @@ fd_set_read_callback_enable(struct gensio_ll *ll, bool enabled)
 	fdll->deferred_read = true;
 	fd_sched_deferred_op(fdll);
     } else {
-	fdll->o->set_read_handler(fdll->iod, enabled);
+	enabled = enabled || fdll->rinto_sglen;
+	fdll->o->set_read_handler(fdll->iod, enabled && !fdll->read_buf_wait);
 	fdll->o->set_except_handler(fdll->iod, enabled || fdll->write_enabled);
     }
  out_unlock:
     fd_unlock(fdll);
 }
 
+static int
+fd_read_into(struct gensio_ll *ll, const struct gensio_sg *sg, gensiods sglen)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    int err = 0;
+
+    /* Handlers with their own read_ready do their own reading. */
+    if (fdll->ops->read_ready || sglen > GENSIO_LL_READ_INTO_MAX_SG)
+	return GE_NOTSUP;
+
+    fd_lock(fdll);
+    if (fdll->write_only || fdll->read_data_len || fdll->in_read) {
+	err = GE_NOTSUP;
+	goto out_unlock;
+    }
+    if (fdll->state != FD_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (fdll->rinto_sglen) {
+	err = GE_INUSE;
+	goto out_unlock;
+    }
+    memcpy(fdll->cold.rinto_sg, sg, sglen * sizeof(*sg));
+    fdll->rinto_sglen = sglen;
+    fdll->o->set_read_handler(fdll->iod, true);
+    fdll->o->set_except_handler(fdll->iod, true);
+ out_unlock:
+    fd_unlock(fdll);
+    return err;
+}
+
 static void
 fd_set_write_callback_enable(struct gensio_ll *ll, bool enabled)
 {
@@ -902,8 +1382,8 @@ static void fd_free(struct gensio_ll *ll)
     struct fd_ll *fdll = ll_to_fd(ll);
 
     fd_lock(fdll);
-    assert(!fdll->freed);
-    fdll->freed = true;
+    assert(!fdll->cold.freed);
+    fdll->cold.freed = true;
     switch (fdll->state) {
     case FD_IN_CLOSE:
     case FD_CLOSED:
@@ -912,7 +1392,7 @@ static void fd_free(struct gensio_ll *ll)
     case FD_OPEN:
     case FD_ERR_WAIT:
     case FD_OPEN_ERR_WAIT:
-	fdll->close_done = NULL;
+	fdll->cold.close_done = NULL;
 	fd_start_close(fdll);
 	break;
 
@@ -927,6 +1407,55 @@ static int fd_control(struct gensio_ll *ll, bool get, unsigned int option,
 		      char *data, gensiods *datalen)
 {
     struct fd_ll *fdll = ll_to_fd(ll);
+    gensiods min;
+    char *end;
+
+    if (option == GENSIO_CONTROL_READ_SIZE) {
+	fd_lock(fdll);
+	if (get) {
+	    *datalen = snprintf(data, *datalen, "size=%lu min=%lu max=%lu",
+				(unsigned long) fdll->read_size,
+				(unsigned long) fdll->read_size_min,
+				(unsigned long) fdll->read_data_size);
+	} else {
+	    min = strtoul(data, &end, 0);
+	    if (*end || end == data) {
+		fd_unlock(fdll);
+		return GE_INVAL;
+	    }
+	    if (min == 0 || min >= fdll->read_data_size) {
+		fdll->read_adaptive = false;
+		fdll->read_size_min = fdll->read_data_size;
+		fdll->read_size = fdll->read_data_size;
+	    } else {
+		fdll->read_adaptive = true;
+		fdll->read_size_min = min;
+	    }
+	}
+	fd_unlock(fdll);
+	return 0;
+    }
+
+    if (option == GENSIO_CONTROL_MEMORY) {
+	gensiods size = sizeof(*fdll);
+	char buf[30];
+	gensiods len = sizeof(buf);
+
+	if (!get)
+	    return GE_NOTSUP;
+	fd_lock(fdll);
+	if (fdll->read_data)
+	    size += (fdll->rbuf_class >= 0 ? fd_rbuf_size(fdll->rbuf_class)
+		     : fdll->read_data_size);
+	fd_unlock(fdll);
+	/* Add in what the user of the fd ll has. */
+	if (fdll->ops->control &&
+		fdll->ops->control(fdll->handler_data, fdll->iod, true,
+				   option, buf, &len) == 0)
+	    size += strtoul(buf, NULL, 0);
+	*datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+	return 0;
+    }
 
     if (!fdll->ops->control)
 	return GE_NOTSUP;
@@ -983,11 +1512,20 @@ gensio_ll_fd_func(struct gensio_ll *ll, int op, gensiods *count,
 	fd_disable(ll);
 	return 0;
 
+    case GENSIO_LL_FUNC_READ_INTO:
+	return fd_read_into(ll, cbuf, buflen);
+
     default:
 	return GE_NOTSUP;
     }
 }
 
+static const struct gensio_ll_ops fd_ll_ops = {
+    .write = fd_write,
+    .set_read_callback = fd_set_read_callback_enable,
+    .set_write_callback = fd_set_write_callback_enable,
+};
+
 void *
 gensio_fd_ll_get_handler_data(struct gensio_ll *ll)
 {
@@ -996,6 +1534,44 @@ gensio_fd_ll_get_handler_data(struct gensio_ll *ll)
     return fdll->handler_data;
 }
 
+bool
+gensio_fd_ll_can_read_again(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    bool rv;
+
+    fd_lock(fdll);
+    rv = (fdll->state == FD_OPEN && fdll->read_enabled &&
+	  !fdll->read_data_len && !fdll->in_read);
+    fd_unlock(fdll);
+    return rv;
+}
+
+void
+gensio_fd_ll_check_open(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock_and_ref(fdll);
+    if (fdll->state == FD_IN_OPEN)
+	fd_handle_write_ready(fdll, fdll->iod);
+    fd_deref_and_unlock(fdll);
+}
+
+void
+gensio_fd_ll_check_close(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    gensio_time timeout = { 0, 0 };
+
+    fd_lock(fdll);
+    /* A stopped close timer keeps its ref when restarted. */
+    if (fdll->state == FD_IN_CLOSE &&
+		fdll->o->stop_timer(fdll->cold.close_timer) == 0)
+	fdll->o->start_timer(fdll->cold.close_timer, &timeout);
+    fd_unlock(fdll);
+}
+
 struct gensio_ll *
 fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 		   struct gensio_iod *iod,
@@ -1011,6 +1587,14 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 	return NULL;
 
     fdll->o = o;
+#ifdef DEBUG_STATE
+    fdll->cold.trace = o->zalloc(o, sizeof(struct fd_state_trace) *
+				 STATE_TRACE_LEN);
+    if (!fdll->cold.trace) {
+	o->free(o, fdll);
+	return NULL;
+    }
+#endif
     fdll->handler_data = handler_data;
     fdll->iod = iod;
     fdll->refcount = 1;
@@ -1022,12 +1606,12 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 	fd_ref(fdll);
     }
 
-    fdll->close_timer = o->alloc_timer(o, fd_close_timeout, fdll);
-    if (!fdll->close_timer)
+    fdll->cold.close_timer = o->alloc_timer(o, fd_close_timeout, fdll);
+    if (!fdll->cold.close_timer)
 	goto out_nomem;
 
-    fdll->deferred_op_runner = o->alloc_runner(o, fd_deferred_op, fdll);
-    if (!fdll->deferred_op_runner)
+    fdll->cold.deferred_op_runner = o->alloc_runner(o, fd_deferred_op, fdll);
+    if (!fdll->cold.deferred_op_runner)
 	goto out_nomem;
 
     fdll->lock = o->alloc_lock(o);
@@ -1035,15 +1619,32 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 	goto out_nomem;
 
     fdll->read_data_size = max_read_size;
+    fdll->read_size = max_read_size;
+    fdll->read_size_min = max_read_size;
+    fdll->rbuf_class = -1;
     if (max_read_size > 0) {
-	fdll->read_data = o->zalloc(o, max_read_size);
-	if (!fdll->read_data)
-	    goto out_nomem;
+	o->call_once(o, &fd_rbuf_once, fd_rbuf_init, o);
+	/*
+	 * With the real-time profile keep a buffer of our own so reads
+	 * never wait on the pool or allocate.
+	 */
+	if (fd_rbuf_lock && !gensio_os_funcs_is_realtime(o))
+	    fdll->rbuf_class = fd_rbuf_class_of(max_read_size);
+	if (fdll->rbuf_class >= 0) {
+	    fdll->cold.rbuf_runner = o->alloc_runner(o, fd_rbuf_ready, fdll);
+	    if (!fdll->cold.rbuf_runner)
+		goto out_nomem;
+	} else {
+	    fdll->read_data = gensio_os_funcs_buf_zalloc(o, max_read_size);
+	    if (!fdll->read_data)
+		goto out_nomem;
+	}
     }
 
     fdll->ll = gensio_ll_alloc_data(o, gensio_ll_fd_func, fdll);
     if (!fdll->ll)
 	goto out_nomem;
+    gensio_ll_set_ops(fdll->ll, &fd_ll_ops);
 
     if (iod) {
 	int err = fd_setup_handlers(fdll);
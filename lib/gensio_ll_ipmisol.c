@@ -20,6 +20,7 @@
 #include <gensio/gensio_list.h>
 
 #include <gensio/gensio_buffer.h>
+#include <gensio/gensio_time.h>
 #include "utils.h"
 
 #include <OpenIPMI/ipmiif.h>
@@ -602,6 +603,24 @@ struct sol_ll {
 
     unsigned int nacks_sent;
 
+    /*
+     * The biggest packet we have refused since the last nack release.
+     * Don't release the nack until that fits, the BMC will resend the
+     * same packet, and with large payloads a fixed threshold just gets
+     * it refused again.
+     */
+    gensiods nack_size;
+
+    /* Counters for GENSIO_CONTROL_IPMISOL_INFO. */
+    gensio_time open_time;
+    unsigned long tx_bytes;
+    unsigned long tx_writes;
+    unsigned long tx_errors;
+    unsigned long rx_bytes;
+    unsigned long rx_packets;
+    unsigned long rx_nacks;
+    unsigned long bmc_overruns;
+
     /* SOL parms */
     int speed;
     bool authenticated;
@@ -759,10 +778,12 @@ check_for_read_delivery(struct sol_ll *solll)
 
 	    /* Maybe we consumed some data, let the other end send if so. */
 	    while (solll->nacks_sent > 0 &&
-		   gensio_buffer_left(&solll->read_data) > 128) { /* FIXME - magic */
+		   gensio_buffer_left(&solll->read_data) >= solll->nack_size) {
 		if (ipmi_sol_release_nack(solll->sol))
 		    break;
 		solll->nacks_sent--;
+		if (solll->nacks_sent == 0)
+		    solll->nack_size = 0;
 	    }
 	}
     }
@@ -855,6 +876,7 @@ handle_xmit_dones(struct gensio_runner *runner, void *cbdata)
 	o->unlock(solll->xmit_done_lock);
 
 	if (tc->err && solll->state != SOL_IN_CLOSE) {
+	    solll->tx_errors++;
 	    solll->read_err = tc->err;
 	    check_for_read_delivery(solll);
 	} else {
@@ -995,6 +1017,8 @@ sol_write(struct gensio_ll *ll, gensiods *rcount,
 	    goto out_finish;
 	} else {
 	    solll->write_outstanding += tc->size;
+	    solll->tx_bytes += tc->size;
+	    solll->tx_writes++;
 	    sol_ref(solll);
 	    pos += tc->size;
 	}
@@ -1020,9 +1044,14 @@ sol_data_received(ipmi_sol_conn_t *conn,
     sol_lock(solll);
     if (count <= gensio_buffer_left(&solll->read_data)) {
 	gensio_buffer_output(&solll->read_data, idata, count);
+	solll->rx_bytes += count;
+	solll->rx_packets++;
 	check_for_read_delivery(solll);
     } else {
+	if (count > solll->nack_size)
+	    solll->nack_size = count;
 	solll->nacks_sent++;
+	solll->rx_nacks++;
 	rv = 1;
     }
     sol_unlock(solll);
@@ -1037,6 +1066,11 @@ sol_break_detected(ipmi_sol_conn_t *conn, void *user_data)
 static void
 bmc_transmit_overrun(ipmi_sol_conn_t *conn, void *user_data)
 {
+    struct sol_ll *solll = user_data;
+
+    sol_lock(solll);
+    solll->bmc_overruns++;
+    sol_unlock(solll);
 }
 
 static void
@@ -1206,6 +1240,15 @@ sol_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
     solll->deferred_write = false;
     gensio_buffer_reset(&solll->read_data);
     solll->nacks_sent = 0;
+    solll->nack_size = 0;
+    solll->tx_bytes = 0;
+    solll->tx_writes = 0;
+    solll->tx_errors = 0;
+    solll->rx_bytes = 0;
+    solll->rx_packets = 0;
+    solll->rx_nacks = 0;
+    solll->bmc_overruns = 0;
+    solll->o->get_monotonic_time(solll->o, &solll->open_time);
 
     err = ipmi_args_setup_con(solll->args, gensio_os_handler, NULL,
 			      &solll->ipmi);
@@ -1375,11 +1418,38 @@ static void sol_disable(struct gensio_ll *ll)
 
 static int ipmisol_do_break(struct gensio_ll *ll);
 
+static int
+sol_info_control(struct gensio_ll *ll, bool get, char *data,
+		 gensiods *datalen)
+{
+    struct sol_ll *solll = ll_to_sol(ll);
+    gensio_time now;
+
+    if (!get)
+	return GE_NOTSUP;
+    solll->o->get_monotonic_time(solll->o, &now);
+    sol_lock(solll);
+    *datalen = snprintf(data, *datalen,
+			"tx_bytes=%lu tx_writes=%lu tx_errors=%lu"
+			" rx_bytes=%lu rx_packets=%lu rx_nacks=%lu"
+			" bmc_overruns=%lu msecs=%lld",
+			solll->tx_bytes, solll->tx_writes, solll->tx_errors,
+			solll->rx_bytes, solll->rx_packets, solll->rx_nacks,
+			solll->bmc_overruns,
+			(long long) GENSIO_NSECS_TO_MSECS(
+			    gensio_time_diff_nsecs(&now, &solll->open_time)));
+    sol_unlock(solll);
+    return 0;
+}
+
 static int
 sol_control(struct gensio_ll *ll, bool get, unsigned int option,
 	    char *data, gensiods *datalen)
 {
     switch(option) {
+    case GENSIO_CONTROL_IPMISOL_INFO:
+	return sol_info_control(ll, get, data, datalen);
+
     case GENSIO_CONTROL_RADDR:
 	if (!get)
 	    return GE_NOTSUP;
@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_time.h>
@@ -454,6 +455,11 @@ struct sound_cnv_info {
 		   struct sound_cnv_info *info);
     void (*convout)(const unsigned char **in, unsigned char **out,
 		    struct sound_cnv_info *info);
+    /* Convert nsamples samples at once. */
+    void (*convin_n)(const unsigned char *in, unsigned char *out,
+		     gensiods nsamples, struct sound_cnv_info *info);
+    void (*convout_n)(const unsigned char *in, unsigned char *out,
+		      gensiods nsamples, struct sound_cnv_info *info);
     unsigned char *buf; /* PCM buffer(s) */
 };
 
@@ -537,6 +543,119 @@ conv_float_to_float_out(const unsigned char **in, unsigned char **out,
     put_float(v, out, info->psize, info->host_bswap);
 }
 
+static void
+conv_n_in(const unsigned char *in, unsigned char *out,
+	  gensiods nsamples, struct sound_cnv_info *info)
+{
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	info->convin(&in, &out, info);
+}
+
+static void
+conv_n_out(const unsigned char *in, unsigned char *out,
+	   gensiods nsamples, struct sound_cnv_info *info)
+{
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	info->convout(&in, &out, info);
+}
+
+/*
+ * Conversions between user float and host order signed 16 and 32 bit
+ * PCM, the common cases.  These are simple loops the compiler can
+ * vectorize, and give the same results as the single sample
+ * versions.
+ */
+static void
+conv_n_s16_to_float_in(const unsigned char *in, unsigned char *out,
+		       gensiods nsamples, struct sound_cnv_info *info)
+{
+    const int16_t *ip = (const int16_t *) in;
+    float *op = (float *) out;
+    float scale = info->scale_in;
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	op[i] = ip[i] * scale;
+}
+
+static void
+conv_n_float_to_s16_out(const unsigned char *in, unsigned char *out,
+			gensiods nsamples, struct sound_cnv_info *info)
+{
+    const float *ip = (const float *) in;
+    int16_t *op = (int16_t *) out;
+    float scale = info->scale_out;
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	op[i] = (int32_t) (ip[i] * scale + .5f);
+}
+
+static void
+conv_n_s32_to_float_in(const unsigned char *in, unsigned char *out,
+		       gensiods nsamples, struct sound_cnv_info *info)
+{
+    const int32_t *ip = (const int32_t *) in;
+    float *op = (float *) out;
+    double scale = info->scale_in;
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	op[i] = ip[i] * scale;
+}
+
+static void
+conv_n_float_to_s32_out(const unsigned char *in, unsigned char *out,
+			gensiods nsamples, struct sound_cnv_info *info)
+{
+    const float *ip = (const float *) in;
+    int32_t *op = (int32_t *) out;
+    double scale = info->scale_out;
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	op[i] = ip[i] * scale + .5;
+}
+
+/*
+ * Integer factor resampler between the device rate and the user rate.
+ * On input this is a decimator, each output is a FIR over the last
+ * ntaps device frames and only every factor'th output is computed.
+ * On output it is a polyphase interpolator, each user frame produces
+ * factor device frames, each from its own ntaps / factor taps.  The
+ * filter is a Blackman windowed sinc low pass, flat to about a
+ * quarter of the user rate and down by the user Nyquist rate.  The
+ * math is done in float, the user format must be float or s16.
+ */
+#define SOUND_RS_TAPS_PER_PHASE 16
+
+struct sound_rs_info {
+    unsigned int factor; /* 1 if disabled. */
+    unsigned int ntaps;
+    float *taps;
+
+    /*
+     * Filter input, whist frames of history followed by the new
+     * frames, as float.  Input history is device frames, output
+     * history is user frames.
+     */
+    float *wbuf;
+    unsigned int whist;
+    unsigned int phase; /* Device frames since the last decimated frame. */
+
+    /*
+     * Input: decimated user frames not yet given to the user.
+     * Output: interpolated device frames not yet taken by the device.
+     */
+    unsigned char *buf;
+    gensiods pos;
+    gensiods len;
+};
+
 struct sound_type {
     const char *name;
     int (*setup)(struct sound_info *si, struct gensio_sound_info *io);
@@ -575,6 +694,12 @@ struct sound_info {
     gensiods bufsize; /* Size in frames of buf. */
     unsigned char *buf; /* User side buffer. */
 
+    /*
+     * If set, input data is delivered from here instead of buf.  The
+     * type must set this back to NULL in next_read.
+     */
+    unsigned char *rbuf;
+
     /*
      * The conversion buffer info.  This is the pcm side of the data.
      * If cnv.enabled is false, don't use most of this.  A few fields
@@ -582,6 +707,13 @@ struct sound_info {
      */
     struct sound_cnv_info cnv;
 
+    /*
+     * Sample rate conversion between the device and the user.  If
+     * factor is > 1, samplerate and bufsize above are the device's
+     * values and the user sees them divided by factor.
+     */
+    struct sound_rs_info rs;
+
     void *pinfo; /* Info for the specific I/O type (alsa, file, etc.). */
 };
 
@@ -621,6 +753,19 @@ setup_convv(struct sound_info *si, enum gensio_sound_fmt_type pfmt)
 	si->cnv.convout = conv_int_to_int_out;
     }
 
+    si->cnv.convin_n = conv_n_in;
+    si->cnv.convout_n = conv_n_out;
+    if (ufmt == GENSIO_SOUND_FMT_FLOAT && !pinfo->isfloat &&
+		!pinfo->host_bswap && !pinfo->offset) {
+	if (pinfo->size == 2) {
+	    si->cnv.convin_n = conv_n_s16_to_float_in;
+	    si->cnv.convout_n = conv_n_float_to_s16_out;
+	} else if (pinfo->size == 4) {
+	    si->cnv.convin_n = conv_n_s32_to_float_in;
+	    si->cnv.convout_n = conv_n_float_to_s32_out;
+	}
+    }
+
     si->cnv.enabled = true;
 }
 
@@ -667,6 +812,224 @@ setup_conv(const char *ufmt, const char *pfmt, struct sound_info *si)
     return 0;
 }
 
+static int
+sound_rs_setup(struct gensio_os_funcs *o, struct sound_info *si,
+	       unsigned int factor)
+{
+    struct sound_rs_info *rs = &si->rs;
+    gensiods ubufsize = si->bufsize;
+    unsigned int i;
+    double fc, x, w, sum = 0;
+
+    rs->factor = 1;
+    if (factor <= 1)
+	return 0;
+    if (si->cnv.ufmt != GENSIO_SOUND_FMT_FLOAT &&
+		si->cnv.ufmt != GENSIO_SOUND_FMT_S16)
+	return GE_INVAL;
+    if (si->samplerate % factor != 0)
+	return GE_INVAL;
+
+    rs->factor = factor;
+    si->bufsize *= factor;
+    rs->ntaps = SOUND_RS_TAPS_PER_PHASE * factor;
+    if (si->is_input)
+	rs->whist = rs->ntaps - 1;
+    else
+	rs->whist = SOUND_RS_TAPS_PER_PHASE - 1;
+
+    rs->taps = o->zalloc(o, sizeof(float) * rs->ntaps);
+    if (!rs->taps)
+	return GE_NOMEM;
+    rs->wbuf = o->zalloc(o, sizeof(float) * si->chans *
+			 (rs->whist + (si->is_input ? si->bufsize : ubufsize)));
+    if (!rs->wbuf)
+	return GE_NOMEM;
+    if (si->is_input)
+	rs->buf = o->zalloc(o, ubufsize * si->framesize);
+    else
+	rs->buf = o->zalloc(o, si->bufsize * si->framesize);
+    if (!rs->buf)
+	return GE_NOMEM;
+
+    /* Cutoff in cycles per device sample. */
+    fc = 0.4 / factor;
+    for (i = 0; i < rs->ntaps; i++) {
+	x = i - (rs->ntaps - 1) / 2.0;
+	w = (0.42 - 0.5 * cos(2 * M_PI * i / (rs->ntaps - 1))
+	     + 0.08 * cos(4 * M_PI * i / (rs->ntaps - 1)));
+	if (x == 0)
+	    rs->taps[i] = 2 * fc;
+	else
+	    rs->taps[i] = w * sin(2 * M_PI * fc * x) / (M_PI * x);
+	sum += rs->taps[i];
+    }
+    /*
+     * Unity gain at DC.  The interpolator inserts factor - 1 zeros
+     * per frame, so it needs factor times the gain.
+     */
+    for (i = 0; i < rs->ntaps; i++)
+	rs->taps[i] *= (si->is_input ? 1 : factor) / sum;
+
+    return 0;
+}
+
+static void
+sound_rs_cleanup(struct gensio_os_funcs *o, struct sound_info *si)
+{
+    struct sound_rs_info *rs = &si->rs;
+
+    if (rs->taps)
+	o->free(o, rs->taps);
+    if (rs->wbuf)
+	o->free(o, rs->wbuf);
+    if (rs->buf)
+	o->free(o, rs->buf);
+}
+
+/* Convert nframes of user data to float after the history in wbuf. */
+static void
+sound_rs_to_float(struct sound_info *si, const unsigned char *in,
+		  gensiods nframes)
+{
+    struct sound_rs_info *rs = &si->rs;
+    float *w = rs->wbuf + (gensiods) rs->whist * si->chans;
+    gensiods i, n = nframes * si->chans;
+
+    if (si->cnv.ufmt == GENSIO_SOUND_FMT_FLOAT) {
+	memcpy(w, in, n * sizeof(float));
+    } else {
+	const int16_t *ip = (const int16_t *) in;
+
+	for (i = 0; i < n; i++)
+	    w[i] = ip[i] * (1.0f / 32768.0f);
+    }
+}
+
+static void
+sound_rs_put(struct sound_info *si, unsigned char *out, gensiods idx, float v)
+{
+    if (si->cnv.ufmt == GENSIO_SOUND_FMT_FLOAT) {
+	((float *) out)[idx] = v;
+    } else {
+	v *= 32768.0f;
+	if (v > 32767.0f)
+	    v = 32767.0f;
+	else if (v < -32768.0f)
+	    v = -32768.0f;
+	((int16_t *) out)[idx] = lrintf(v);
+    }
+}
+
+/* Keep the last whist frames of wbuf for the next time. */
+static void
+sound_rs_save_hist(struct sound_info *si, gensiods nframes)
+{
+    struct sound_rs_info *rs = &si->rs;
+
+    memmove(rs->wbuf, rs->wbuf + nframes * si->chans,
+	    sizeof(float) * rs->whist * si->chans);
+}
+
+/*
+ * Sum n (a multiple of 4) taps, tstride apart, times the samples at x,
+ * xstride apart.  Four sums are kept so the adds don't wait on each
+ * other.
+ */
+static float
+sound_rs_dot(const float *taps, unsigned int tstride,
+	     const float *x, ptrdiff_t xstride, unsigned int n)
+{
+    float v0 = 0, v1 = 0, v2 = 0, v3 = 0;
+    ptrdiff_t k;
+
+    for (k = 0; k < (ptrdiff_t) n; k += 4) {
+	v0 += taps[k * tstride] * x[k * xstride];
+	v1 += taps[(k + 1) * tstride] * x[(k + 1) * xstride];
+	v2 += taps[(k + 2) * tstride] * x[(k + 2) * xstride];
+	v3 += taps[(k + 3) * tstride] * x[(k + 3) * xstride];
+    }
+    return (v0 + v1) + (v2 + v3);
+}
+
+/*
+ * sound_rs_dot() over all the taps for the decimator, taking
+ * advantage of the taps being symmetric to do half the multiplies.
+ */
+static float
+sound_rs_dot_sym(const float *taps, const float *x, ptrdiff_t xstride,
+		 unsigned int ntaps)
+{
+    float v0 = 0, v1 = 0, v2 = 0, v3 = 0;
+    const float *y = x + (ptrdiff_t) (ntaps - 1) * xstride;
+    ptrdiff_t k;
+
+    for (k = 0; k < (ptrdiff_t) ntaps / 2; k += 4) {
+	v0 += taps[k] * (x[k * xstride] + y[-k * xstride]);
+	v1 += taps[k + 1] * (x[(k + 1) * xstride] + y[-(k + 1) * xstride]);
+	v2 += taps[k + 2] * (x[(k + 2) * xstride] + y[-(k + 2) * xstride]);
+	v3 += taps[k + 3] * (x[(k + 3) * xstride] + y[-(k + 3) * xstride]);
+    }
+    return (v0 + v1) + (v2 + v3);
+}
+
+/*
+ * Decimate nframes device frames from in into rs->buf.  Returns the
+ * number of user frames generated.
+ */
+static gensiods
+sound_rs_decimate(struct sound_info *si, const unsigned char *in,
+		  gensiods nframes)
+{
+    struct sound_rs_info *rs = &si->rs;
+    unsigned int chans = si->chans, c;
+    gensiods t, count = 0;
+    const float *w;
+
+    sound_rs_to_float(si, in, nframes);
+    for (t = 0; t < nframes; t++) {
+	if (++rs->phase < rs->factor)
+	    continue;
+	rs->phase = 0;
+	/* The filter ends at the new frame, at t + whist in wbuf. */
+	w = rs->wbuf + t * chans;
+	for (c = 0; c < chans; c++)
+	    sound_rs_put(si, rs->buf, count * chans + c,
+			 sound_rs_dot_sym(rs->taps, w + c, chans, rs->ntaps));
+	count++;
+    }
+    sound_rs_save_hist(si, nframes);
+    return count;
+}
+
+/*
+ * Interpolate nframes user frames from in into rs->buf, generating
+ * nframes * factor device frames.
+ */
+static void
+sound_rs_interpolate(struct sound_info *si, const unsigned char *in,
+		     gensiods nframes)
+{
+    struct sound_rs_info *rs = &si->rs;
+    unsigned int chans = si->chans, factor = rs->factor, c, p;
+    gensiods n, count = 0;
+    const float *w;
+
+    sound_rs_to_float(si, in, nframes);
+    for (n = 0; n < nframes; n++) {
+	/* The newest frame is at n + whist in wbuf, the taps go backwards. */
+	w = rs->wbuf + (n + rs->whist) * chans;
+	for (p = 0; p < factor; p++) {
+	    for (c = 0; c < chans; c++)
+		sound_rs_put(si, rs->buf, count * chans + c,
+			     sound_rs_dot(rs->taps + p, factor, w + c,
+					  -(ptrdiff_t) chans, rs->whist + 1));
+	    count++;
+	}
+    }
+    sound_rs_save_hist(si, nframes);
+}
+
 struct sound_ll {
     struct gensio_os_funcs *o;
     struct gensio_lock *lock;
@@ -736,6 +1099,8 @@ gensio_sound_ll_free(struct sound_ll *soundll)
 	o->free(o, soundll->out.buf);
     if (soundll->out.cnv.buf)
 	o->free(o, soundll->out.cnv.buf);
+    sound_rs_cleanup(o, &soundll->in);
+    sound_rs_cleanup(o, &soundll->out);
     if (soundll->ll)
 	gensio_ll_free_data(soundll->ll);
     if (soundll->lock)
@@ -831,6 +1196,30 @@ static int gensio_sound_api_default_write(struct sound_info *out,
 
 #include "file_sound.h"
 
+/* Is there input data for the user? */
+static bool
+gensio_sound_in_ready(struct sound_info *si)
+{
+    return si->ready || si->rs.len > 0;
+}
+
+/*
+ * Run the device buffer through the decimator and release it back to
+ * the device.
+ */
+static void
+gensio_sound_ll_decimate(struct sound_info *si)
+{
+    si->rs.len = sound_rs_decimate(si, (si->rbuf ? si->rbuf : si->buf)
+				   + si->readpos * si->framesize, si->len);
+    si->rs.pos = 0;
+    si->readpos = 0;
+    si->len = 0;
+    si->ready = false;
+    if (si->type->next_read)
+	si->type->next_read(si);
+}
+
 static void
 gensio_sound_ll_check_read(struct sound_ll *soundll)
 {
@@ -838,11 +1227,15 @@ gensio_sound_ll_check_read(struct sound_ll *soundll)
 
     if (soundll->in_read)
 	return;
-    if (soundll->read_enabled && (si->ready || soundll->err)) {
+    if (si->rs.factor > 1 && soundll->read_enabled && !si->rs.len &&
+		si->ready)
+	gensio_sound_ll_decimate(si);
+    if (soundll->read_enabled && (gensio_sound_in_ready(si) || soundll->err)) {
 	unsigned int len;
 	gensiods count;
 
-	if (soundll->err) {
+	/* Deliver any resampled data before the error. */
+	if (soundll->err && !si->rs.len) {
 	    soundll->in_read = true;
 	    gensio_sound_ll_unlock(soundll);
 	    count = soundll->cb(soundll->cb_data, GENSIO_LL_CB_READ,
@@ -852,6 +1245,21 @@ gensio_sound_ll_check_read(struct sound_ll *soundll)
 	    goto out;
 	}
 
+	if (si->rs.factor > 1) {
+	    soundll->in_read = true;
+	    gensio_sound_ll_unlock(soundll);
+	    count = soundll->cb(soundll->cb_data, GENSIO_LL_CB_READ, 0,
+				si->rs.buf + si->rs.pos * si->framesize,
+				si->rs.len * si->framesize, NULL);
+	    gensio_sound_ll_lock(soundll);
+	    soundll->in_read = false;
+	    if (soundll->state != GENSIO_SOUND_LL_OPEN)
+		goto out;
+	    si->rs.pos += count / si->framesize;
+	    si->rs.len -= count / si->framesize;
+	    goto out;
+	}
+
 	if (si->readpos + si->len > si->bufsize)
 	    len = si->bufsize - si->readpos;
 	else
@@ -859,7 +1267,8 @@ gensio_sound_ll_check_read(struct sound_ll *soundll)
 	soundll->in_read = true;
 	gensio_sound_ll_unlock(soundll);
 	count = soundll->cb(soundll->cb_data, GENSIO_LL_CB_READ, 0,
-			    si->buf + si->readpos * si->framesize,
+			    (si->rbuf ? si->rbuf : si->buf)
+			    + si->readpos * si->framesize,
 			    (gensiods) len * si->framesize, NULL);
 	gensio_sound_ll_lock(soundll);
 	soundll->in_read = false;
@@ -875,10 +1284,35 @@ gensio_sound_ll_check_read(struct sound_ll *soundll)
 	}
     }
  out:
-    if (soundll->read_enabled && (si->ready || soundll->err))
+    if (soundll->read_enabled && (gensio_sound_in_ready(si) || soundll->err))
 	gensio_sound_sched_deferred_op(soundll);
 }
 
+/* Push interpolated frames the device hasn't taken yet. */
+static int
+gensio_sound_rs_flush(struct sound_info *si)
+{
+    struct sound_rs_info *rs = &si->rs;
+    struct gensio_sg sg;
+    gensiods count;
+    int err;
+
+    while (rs->len) {
+	sg.buf = rs->buf + rs->pos * si->framesize;
+	sg.buflen = rs->len * si->framesize;
+	count = 0;
+	err = si->type->write(si, &count, &sg, 1);
+	if (err)
+	    return err;
+	count /= si->framesize;
+	if (count == 0)
+	    break;
+	rs->pos += count;
+	rs->len -= count;
+    }
+    return 0;
+}
+
 static void
 gensio_sound_ll_check_write(struct sound_ll *soundll)
 {
@@ -886,7 +1320,16 @@ gensio_sound_ll_check_write(struct sound_ll *soundll)
 
     if (soundll->in_write)
 	return;
-    if (soundll->write_enabled && si->ready) {
+    if (si->rs.len && si->ready) {
+	int err = gensio_sound_rs_flush(si);
+
+	if (err && !soundll->err)
+	    soundll->err = err;
+	/* Write was left enabled to finish the flush, see write_rs. */
+	if (!si->rs.len && !soundll->write_enabled)
+	    si->type->set_write_enable(si, false);
+    }
+    if (soundll->write_enabled && si->ready && !si->rs.len) {
 	soundll->in_write = true;
 	gensio_sound_ll_unlock(soundll);
 	soundll->cb(soundll->cb_data, GENSIO_LL_CB_WRITE_READY, 0,
@@ -926,10 +1369,10 @@ static void
 gensio_sound_do_read_enable(struct sound_ll *soundll)
 {
     soundll->in.type->set_read_enable(&soundll->in, true);
-    if (soundll->in.ready || soundll->err) {
+    if (gensio_sound_in_ready(&soundll->in) || soundll->err) {
 	gensio_sound_sched_deferred_op(soundll);
     } else {
-	if (soundll->in.ready || soundll->err)
+	if (gensio_sound_in_ready(&soundll->in) || soundll->err)
 	    gensio_sound_sched_deferred_op(soundll);
     }
 }
@@ -1018,12 +1461,11 @@ gensio_sound_api_default_write(struct sound_info *out, gensiods *rcount,
 	    ibuflen = sg[i].buflen / out->framesize;
 	moredata:
 	    tbuf = out->cnv.buf;
-	    for (j = 0; j < ibuflen && j < out->bufsize; j++) {
-		gensiods k;
-
-		for (k = 0; k < out->chans; k++)
-		    out->cnv.convout(&ibuf, &tbuf, &out->cnv);
-	    }
+	    j = ibuflen;
+	    if (j > out->bufsize)
+		j = out->bufsize;
+	    out->cnv.convout_n(ibuf, tbuf, j * out->chans, &out->cnv);
+	    ibuf += j * out->framesize;
 	    if (j == ibuflen)
 		ibuf = NULL;
 	    else
@@ -1049,6 +1491,53 @@ gensio_sound_api_default_write(struct sound_info *out, gensiods *rcount,
     return err;
 }
 
+/*
+ * Interpolate the user data and write it.  Whatever the device
+ * doesn't take is held in rs and the user data is reported as
+ * written, then nothing more is taken until that is flushed.
+ */
+static int
+gensio_sound_ll_write_rs(struct sound_ll *soundll, gensiods *rcount,
+			 const struct gensio_sg *sg, gensiods sglen)
+{
+    struct sound_info *si = &soundll->out;
+    struct sound_rs_info *rs = &si->rs;
+    gensiods count = 0, i, n, left, ubufsize = si->bufsize / rs->factor;
+    const unsigned char *buf;
+    int err;
+
+    err = gensio_sound_rs_flush(si);
+    if (err)
+	return err;
+
+    for (i = 0; i < sglen && !rs->len; i++) {
+	buf = sg[i].buf;
+	left = sg[i].buflen / si->framesize;
+	while (left > 0 && !rs->len) {
+	    n = left;
+	    if (n > ubufsize)
+		n = ubufsize;
+	    sound_rs_interpolate(si, buf, n);
+	    rs->pos = 0;
+	    rs->len = n * rs->factor;
+	    buf += n * si->framesize;
+	    left -= n;
+	    count += n * si->framesize;
+	    err = gensio_sound_rs_flush(si);
+	    if (err)
+		return err;
+	}
+    }
+
+    /* Make sure the leftovers get written even if the user stops. */
+    if (rs->len && !soundll->write_enabled)
+	si->type->set_write_enable(si, true);
+
+    if (rcount)
+	*rcount = count;
+    return 0;
+}
+
 static int
 gensio_sound_ll_write(struct sound_ll *soundll, gensiods *rcount,
 		      const struct gensio_sg *sg, gensiods sglen)
@@ -1074,7 +1563,10 @@ gensio_sound_ll_write(struct sound_ll *soundll, gensiods *rcount,
 	    goto out_unlock;
 	}
     }
-    err = soundll->out.type->write(&soundll->out, rcount, sg, sglen);
+    if (soundll->out.rs.factor > 1)
+	err = gensio_sound_ll_write_rs(soundll, rcount, sg, sglen);
+    else
+	err = soundll->out.type->write(&soundll->out, rcount, sg, sglen);
  out_unlock:
     gensio_sound_ll_unlock(soundll);
     return err;
@@ -1172,28 +1664,32 @@ gensio_sound_ll_control(struct sound_ll *soundll, bool get, unsigned int option,
 	if (!get)
 	    return GE_NOTSUP;
 	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%u",
-				       soundll->in.samplerate);
+				       soundll->in.samplerate /
+				       soundll->in.rs.factor);
 	return 0;
 
     case GENSIO_CONTROL_OUT_RATE:
 	if (!get)
 	    return GE_NOTSUP;
 	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%u",
-				       soundll->out.samplerate);
+				       soundll->out.samplerate /
+				       soundll->out.rs.factor);
 	return 0;
 
     case GENSIO_CONTROL_IN_BUFSIZE:
 	if (!get)
 	    return GE_NOTSUP;
+	si = &soundll->in;
 	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%lu",
-				       (unsigned long) soundll->in.bufsize);
+			(unsigned long) (si->bufsize / si->rs.factor));
 	return 0;
 
     case GENSIO_CONTROL_OUT_BUFSIZE:
 	if (!get)
 	    return GE_NOTSUP;
+	si = &soundll->out;
 	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%lu",
-				       (unsigned long) soundll->out.bufsize);
+			(unsigned long) (si->bufsize / si->rs.factor));
 	return 0;
 
     case GENSIO_CONTROL_IN_NR_CHANS:
@@ -1241,6 +1737,7 @@ gensio_sound_ll_control(struct sound_ll *soundll, bool get, unsigned int option,
 	    return GE_NOTSUP;
 	if (si->type->drain_count)
 	    frames_left = si->type->drain_count(si);
+	frames_left = (frames_left + si->rs.len) / si->rs.factor;
 	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%lu", frames_left);
 	return 0;
     }
@@ -1323,7 +1820,10 @@ gensio_sound_ll_func(struct gensio_ll *ll, int op,
 	if (soundll->write_enabled != enable) {
 	    soundll->write_enabled = enable;
 	    if (soundll->state == GENSIO_SOUND_LL_OPEN) {
-		soundll->out.type->set_write_enable(&soundll->out, enable);
+		/* Leave it on to flush resampler leftovers. */
+		soundll->out.type->set_write_enable(&soundll->out,
+						    enable ||
+						    soundll->out.rs.len);
 		if (soundll->out.ready)
 		    gensio_sound_sched_deferred_op(soundll);
 	    }
@@ -1392,6 +1892,10 @@ setup_sound_info(struct gensio_os_funcs *o,
     if (err)
 	return err;
 
+    err = sound_rs_setup(o, si, io->resample);
+    if (err)
+	return err;
+
     err = si->type->setup(si, io);
     if (err)
 	return err;
@@ -1402,7 +1906,7 @@ setup_sound_info(struct gensio_os_funcs *o,
 
     if (isinput) {
 	/* One buffer for sending to the user. */
-	si->buf = o->zalloc(o, io->bufsize * si->framesize);
+	si->buf = o->zalloc(o, si->bufsize * si->framesize);
 	if (!si->buf)
 	    return GE_NOMEM;
     }
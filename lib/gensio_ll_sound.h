@@ -19,6 +19,13 @@ struct gensio_sound_info {
     unsigned int num_bufs;
     const char *format;
     const char *pformat; /* Format on the PCM side. */
+    bool mmap; /* Use mmap access to the PCM ring, ALSA only. */
+    gensiods period; /* PCM period size in frames, 0 for default. */
+    /*
+     * Run the device at samplerate and present samplerate / resample
+     * to the user.  bufsize is in user frames.  0 or 1 disables it.
+     */
+    unsigned int resample;
 };
 
 int gensio_sound_ll_alloc(struct gensio_os_funcs *o,
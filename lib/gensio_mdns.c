@@ -22,6 +22,7 @@
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_mdns.h>
+#include <gensio/gensio_list.h>
 #include <gensio/argvutils.h>
 
 enum mdnsn_state {
@@ -51,9 +52,16 @@ struct mdnsn_data {
     char *domain;
     char *host;
 
-    bool mdns_in_free;
-    struct gensio_mdns *mdns;
-    struct gensio_mdns_watch *watch;
+    /*
+     * The shared cache entry we are using while opening, see
+     * mdns_cache_ent.  If waiting is set, we are on the entry's
+     * waiters list through wlink and that holds a ref.
+     */
+    bool cache;
+    unsigned int cache_time;
+    struct mdns_cache_ent *centry;
+    struct gensio_link wlink;
+    bool waiting;
 
     char *laddr;
     gensiods max_read_size;
@@ -77,6 +85,7 @@ struct mdnsn_data {
 };
 
 static void mdnsn_start_deferred_op(struct mdnsn_data *ndata);
+static void i_child_open_cb(struct mdnsn_data *ndata, int err);
 
 static void
 mdnsn_finish_free(struct mdnsn_data *ndata)
@@ -121,6 +130,14 @@ mdnsn_ref(struct mdnsn_data *ndata)
     ndata->refcount++;
 }
 
+/* Drop a ref that is known not to be the last one. */
+static void
+mdnsn_deref(struct mdnsn_data *ndata)
+{
+    assert(ndata->refcount > 1);
+    ndata->refcount--;
+}
+
 static void
 mdnsn_deref_and_unlock(struct mdnsn_data *ndata)
 {
@@ -148,7 +165,7 @@ child_cb(struct gensio *io, void *user_data,
 static void
 mdnsn_check_close(struct mdnsn_data *ndata)
 {
-    if (!ndata->child && !ndata->mdns_in_free) {
+    if (!ndata->child) {
 	ndata->state = MDNSN_CLOSED;
 	mdnsn_unlock(ndata);
 
@@ -165,8 +182,12 @@ mdnsn_deferred_op(struct gensio_runner *runner, void *cb_data)
     struct mdnsn_data *ndata = cb_data;
 
     mdnsn_lock(ndata);
-    if (ndata->state == MDNSN_IN_CLOSE)
+    if (ndata->state == MDNSN_IN_CLOSE) {
 	mdnsn_check_close(ndata);
+    } else if (ndata->state == MDNSN_IN_OPEN_ERR) {
+	i_child_open_cb(ndata, ndata->open_err);
+	mdnsn_deref(ndata); /* Ref from the open. */
+    }
 
     ndata->deferred_op_pending = false;
     mdnsn_deref_and_unlock(ndata);
@@ -220,21 +241,6 @@ child_closed_cb(struct gensio *io, void *cb_data)
     mdnsn_deref_and_unlock(ndata);
 }
 
-static void
-mdns_freed(struct gensio_mdns *m, void *userdata)
-{
-    struct mdnsn_data *ndata = userdata;
-
-    mdnsn_lock(ndata);
-    ndata->mdns_in_free = false;
-    if (ndata->state == MDNSN_IN_OPEN_ERR) {
-	i_child_open_cb(ndata, ndata->open_err);
-    } else {
-	mdnsn_check_close(ndata);
-    }
-    mdnsn_deref_and_unlock(ndata);
-}
-
 /* Validate that the gensio stack contains only safe gensios. */
 static bool
 gensiostack_ok(const char *s)
@@ -385,137 +391,664 @@ get_mdns_gensiostack(struct mdnsn_data *ndata, const char * const *txt,
     goto out;
 }
 
-static void
-mdns_cb(struct gensio_mdns_watch *w,
-	enum gensio_mdns_data_state state,
-	int interface, int ipdomain,
-	const char *name, const char *type,
-	const char *domain, const char *host,
-	const struct gensio_addr *addr, const char * const *txt,
-	void *userdata)
-{
-    struct mdnsn_data *ndata = userdata;
+/*
+ * Allocate and open the child for a resolved service.  Returns
+ * GE_NOTSUP if the service isn't something we can connect to, so the
+ * caller can try another one.  Called with the ndata lock held.
+ */
+static int
+mdnsn_start_child(struct mdnsn_data *ndata, const char *type,
+		  const struct gensio_addr *addr, const char * const *txt)
+{
+    struct gensio_os_funcs *o = ndata->o;
     const char **argv = NULL;
+    gensiods args = 0, argc = 0;
     char *s, *stack = NULL;
-    int err;
-
-    mdnsn_lock(ndata);
-    if (ndata->state != MDNSN_IN_OPEN_QUERY)
-	goto out_unlock;
+    int err = 0;
 
-    if (state == GENSIO_MDNS_ALL_FOR_NOW) {
-	/* Didn't find what we were looking for. */
-	ndata->open_err = GE_NOTFOUND;
-	goto out_err;
+    if (!ndata->nostack) {
+	err = get_mdns_gensiostack(ndata, txt, addr, &stack);
+	if (err)
+	    return err;
     }
 
-    if (state == GENSIO_MDNS_NEW_DATA) {
-	gensiods args = 0, argc = 0;
+    if (stack) {
+	err = str_to_gensio(stack, o, child_cb, ndata, &ndata->child);
+	o->free(o, stack);
+	if (err)
+	    return err;
+    } else {
+	/* Look for the trailing protocol type. */
+	s = strrchr(type, '.');
+	if (!s)
+	    return GE_NOTSUP;
+	s++;
+	if (strcmp(s, "_tcp") != 0 && strcmp(s, "_udp") != 0)
+	    return GE_NOTSUP;
+
+	if (ndata->readbuf_set) {
+	    err = gensio_argv_sappend(o, &argv, &args, &argc, "readbuf=%lu",
+				      (unsigned long) ndata->max_read_size);
+	    if (err)
+		goto out;
+	}
 
-	if (!ndata->nostack) {
-	    ndata->open_err = get_mdns_gensiostack(ndata, txt, addr, &stack);
-	    if (ndata->open_err)
-		goto out_err;
+	if (ndata->nodelay_set && strcmp(s, "_udp") != 0) {
+	    /* Don't add nodelay for udp. */
+	    err = gensio_argv_sappend(o, &argv, &args, &argc, "nodelay=%d",
+				      ndata->nodelay);
+	    if (err)
+		goto out;
 	}
 
-	if (stack) {
-	    ndata->open_err = str_to_gensio(stack, ndata->o,
-					    child_cb, ndata, &ndata->child);
-	    ndata->o->free(ndata->o, stack);
-	} else  {
-	    /* Look for the trailing protocol type. */
-	    s = strrchr(type, '.');
-	    if (!s)
-		goto out_unlock;
-	    s++;
+	if (ndata->laddr) {
+	    err = gensio_argv_sappend(o, &argv, &args, &argc, "laddr=%s",
+				      ndata->laddr);
+	    if (err)
+		goto out;
+	}
 
-	    if (ndata->readbuf_set) {
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-					&argc, "readbuf=%lu",
-					(unsigned long) ndata->max_read_size);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+	err = gensio_argv_append(o, &argv, NULL, &args, &argc, false);
+	if (err)
+	    goto out;
 
-	    if (ndata->nodelay_set && strcmp(s, "_udp") != 0) {
-		/* Don't add nodelay for udp. */
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-						      &argc, "nodelay=%d",
-						      ndata->nodelay);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+	/* Skip the '_' to get "tcp" or "udp". */
+	err = gensio_terminal_alloc(s + 1, addr, argv, o, child_cb, ndata,
+				    &ndata->child);
+	if (err)
+	    goto out;
+    }
 
-	    if (ndata->laddr) {
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-						      &argc, "laddr=%s",
-						      ndata->laddr);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+    err = gensio_open(ndata->child, child_open_cb, ndata);
+    if (err) {
+	gensio_free(ndata->child);
+	ndata->child = NULL;
+	goto out;
+    }
+    ndata->state = MDNSN_IN_CHILD_OPEN;
 
-	    ndata->open_err = gensio_argv_append(ndata->o, &argv, NULL,
-						 &args, &argc, false);
-	    if (ndata->open_err)
-		goto out_err;
-
-	    if (strcmp(s, "_tcp") == 0) {
-		ndata->open_err = gensio_terminal_alloc("tcp",
-						addr, argv, ndata->o,
-						child_cb, ndata,
-						&ndata->child);
-	    } else if (strcmp(s, "_udp") == 0) {
-		ndata->open_err = gensio_terminal_alloc("udp",
-						addr, argv, ndata->o,
-						child_cb, ndata,
-						&ndata->child);
-	    } else {
-		goto out_unlock;
-	    }
-	}
-	if (ndata->open_err)
-	    goto out_err;
+ out:
+    if (argv)
+	gensio_argv_free(o, argv);
+    return err;
+}
 
-	ndata->open_err = gensio_open(ndata->child, child_open_cb, ndata);
-	if (ndata->open_err) {
-	    gensio_free(ndata->child);
-	    ndata->child = NULL;
-	    goto out_err;
+/*
+ * A process-wide cache of mDNS lookups.  Opens asking the same
+ * question share an entry, and the entry has a single long-lived
+ * watch that keeps the set of results current.  So N opens of the
+ * same service cause one query, and an open of a service that is
+ * already known connects right away.  Avahi ages records by their TTL
+ * and the watch reports them gone when they expire, so the cache
+ * simply follows the watch.
+ *
+ * Once an entry has no users it is kept for cache_time milliseconds
+ * before the watch is shut down.  Entries allocated with cache=false
+ * are never put on the list, so they aren't shared and go away with
+ * their user.
+ *
+ * Lock ordering is ndata lock, then mdns_cache_lock, then the mdns
+ * library lock.  The watch callback is called with no locks held.
+ */
+struct mdns_cache_result {
+    struct gensio_link link;
+    int interface;
+    int ipdomain;
+    char *name;
+    char *type;
+    char *domain;
+    struct gensio_addr *addr;
+    const char **txt;
+};
+
+struct mdns_cache_ent {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+
+    /* Everything below is protected by mdns_cache_lock. */
+    unsigned int users;
+    bool linked;
+    bool dying;
+
+    /* The key. */
+    int interface;
+    int nettype;
+    char *name;
+    char *type;
+    char *domain;
+    char *host;
+
+    struct gensio_mdns *mdns;
+    struct gensio_mdns_watch *watch;
+
+    struct gensio_list results;
+    bool all_for_now;
+
+    /* mdnsn_data waiting for a result. */
+    struct gensio_list waiters;
+
+    unsigned int cache_time;
+    int64_t expire;
+    bool timer_running;
+    struct gensio_timer *timer;
+};
+
+static struct gensio_once mdns_cache_once;
+static struct gensio_os_funcs *mdns_cache_o;
+static struct gensio_lock *mdns_cache_lock;
+static struct gensio_list mdns_cache;
+
+static bool
+mdns_cache_dupstr(struct gensio_os_funcs *o, const char *src, char **dest)
+{
+    if (!src) {
+	*dest = NULL;
+	return true;
+    }
+    *dest = gensio_strdup(o, src);
+    return *dest != NULL;
+}
+
+static bool
+mdns_cache_streq(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+	return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+static int64_t
+mdns_cache_now(struct gensio_os_funcs *o)
+{
+    gensio_time t;
+
+    o->get_monotonic_time(o, &t);
+    return t.secs * 1000000000LL + t.nsecs;
+}
+
+static void
+mdns_cache_result_free(struct gensio_os_funcs *o, struct mdns_cache_result *r)
+{
+    if (r->name)
+	o->free(o, r->name);
+    if (r->type)
+	o->free(o, r->type);
+    if (r->domain)
+	o->free(o, r->domain);
+    if (r->addr)
+	gensio_addr_free(r->addr);
+    if (r->txt)
+	gensio_argv_free(o, r->txt);
+    o->free(o, r);
+}
+
+static void
+mdns_cache_ent_free(struct mdns_cache_ent *e)
+{
+    struct gensio_os_funcs *o = e->o;
+    struct gensio_link *l, *l2;
+    struct mdns_cache_result *r;
+
+    gensio_list_for_each_safe(&e->results, l, l2) {
+	r = gensio_container_of(l, struct mdns_cache_result, link);
+	gensio_list_rm(&e->results, l);
+	mdns_cache_result_free(o, r);
+    }
+    if (e->timer)
+	o->free_timer(e->timer);
+    if (e->name)
+	o->free(o, e->name);
+    if (e->type)
+	o->free(o, e->type);
+    if (e->domain)
+	o->free(o, e->domain);
+    if (e->host)
+	o->free(o, e->host);
+    o->free(o, e);
+}
+
+static void
+mdns_cache_mdns_freed(struct gensio_mdns *m, void *userdata)
+{
+    mdns_cache_ent_free(userdata);
+}
+
+static void
+mdns_cache_watch_removed(struct gensio_mdns_watch *w, void *userdata)
+{
+    struct mdns_cache_ent *e = userdata;
+
+    if (gensio_free_mdns(e->mdns, mdns_cache_mdns_freed, e))
+	mdns_cache_ent_free(e);
+}
+
+/*
+ * Take the entry out of the cache and shut down its watch.  The entry
+ * is freed once the mdns code is done with it.  Call with the cache
+ * lock held and no users.
+ */
+static void
+mdns_cache_shutdown(struct mdns_cache_ent *e)
+{
+    e->dying = true;
+    if (e->linked) {
+	gensio_list_rm(&mdns_cache, &e->link);
+	e->linked = false;
+    }
+    if (gensio_mdns_remove_watch(e->watch, mdns_cache_watch_removed, e))
+	mdns_cache_watch_removed(e->watch, e);
+}
+
+static void
+mdns_cache_start_timer(struct mdns_cache_ent *e, int64_t nsecs)
+{
+    gensio_time timeout;
+
+    timeout.secs = nsecs / 1000000000LL;
+    timeout.nsecs = nsecs % 1000000000LL;
+    if (e->o->start_timer(e->timer, &timeout) == 0)
+	e->timer_running = true;
+    else
+	mdns_cache_shutdown(e);
+}
+
+/*
+ * The timer is never stopped when an entry gets a new user, the
+ * timeout just checks the users and expire time and restarts itself
+ * if the entry was used in the meantime.
+ */
+static void
+mdns_cache_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct mdns_cache_ent *e = cb_data;
+    int64_t now;
+
+    e->o->lock(mdns_cache_lock);
+    e->timer_running = false;
+    if (e->users || e->dying)
+	goto out_unlock;
+    now = mdns_cache_now(e->o);
+    if (now < e->expire)
+	mdns_cache_start_timer(e, e->expire - now);
+    else
+	mdns_cache_shutdown(e);
+ out_unlock:
+    e->o->unlock(mdns_cache_lock);
+}
+
+static void
+mdns_cache_add_result(struct mdns_cache_ent *e, int interface, int ipdomain,
+		      const char *name, const char *type, const char *domain,
+		      const struct gensio_addr *addr, const char * const *txt)
+{
+    struct gensio_os_funcs *o = e->o;
+    struct mdns_cache_result *r;
+
+    r = o->zalloc(o, sizeof(*r));
+    if (!r)
+	return;
+    r->interface = interface;
+    r->ipdomain = ipdomain;
+    if (!mdns_cache_dupstr(o, name, &r->name))
+	goto out_err;
+    if (!mdns_cache_dupstr(o, type, &r->type))
+	goto out_err;
+    if (!mdns_cache_dupstr(o, domain, &r->domain))
+	goto out_err;
+    r->addr = gensio_addr_dup(addr);
+    if (!r->addr)
+	goto out_err;
+    if (txt && gensio_argv_copy(o, txt, NULL, &r->txt))
+	goto out_err;
+    gensio_list_add_tail(&e->results, &r->link);
+    return;
+
+ out_err:
+    /* Not fatal, the next open will just wait for the watch. */
+    mdns_cache_result_free(o, r);
+}
+
+static void
+mdns_cache_rm_result(struct mdns_cache_ent *e, int interface, int ipdomain,
+		     const char *name, const char *type, const char *domain,
+		     const struct gensio_addr *addr)
+{
+    struct gensio_link *l, *l2;
+    struct mdns_cache_result *r;
+
+    gensio_list_for_each_safe(&e->results, l, l2) {
+	r = gensio_container_of(l, struct mdns_cache_result, link);
+	if (r->interface == interface && r->ipdomain == ipdomain &&
+		mdns_cache_streq(r->name, name) &&
+		mdns_cache_streq(r->type, type) &&
+		mdns_cache_streq(r->domain, domain) &&
+		gensio_addr_equal(r->addr, addr, true, true)) {
+	    gensio_list_rm(&e->results, l);
+	    mdns_cache_result_free(e->o, r);
+	    break;
 	}
+    }
+}
 
-	ndata->state = MDNSN_IN_CHILD_OPEN;
-	if (ndata->watch)
-	    gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-	err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-	if (!err) {
-	    mdnsn_ref(ndata);
-	    ndata->mdns_in_free = true;
+/* Call with the ndata lock held. */
+static void
+mdnsn_cache_put(struct mdnsn_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct mdns_cache_ent *e = ndata->centry;
+    bool drop_ref = false;
+
+    if (!e)
+	return;
+
+    o->lock(mdns_cache_lock);
+    if (ndata->waiting) {
+	gensio_list_rm(&e->waiters, &ndata->wlink);
+	ndata->waiting = false;
+	drop_ref = true;
+    }
+    ndata->centry = NULL;
+    assert(e->users > 0);
+    e->users--;
+    if (!e->users) {
+	if (!e->linked || !e->cache_time) {
+	    mdns_cache_shutdown(e);
 	} else {
-	    ndata->mdns = NULL;
+	    e->expire = mdns_cache_now(o) + e->cache_time * 1000000LL;
+	    if (!e->timer_running)
+		mdns_cache_start_timer(e, e->cache_time * 1000000LL);
 	}
     }
+    o->unlock(mdns_cache_lock);
+
+    if (drop_ref)
+	mdnsn_deref(ndata);
+}
 
+static void
+mdnsn_open_fail(struct mdnsn_data *ndata, int err)
+{
+    ndata->open_err = err;
+    ndata->state = MDNSN_IN_OPEN_ERR;
+    mdnsn_start_deferred_op(ndata);
+}
+
+/* Call with the cache lock held. */
+static void
+mdnsn_cache_wait(struct mdnsn_data *ndata)
+{
+    gensio_list_add_tail(&ndata->centry->waiters, &ndata->wlink);
+    ndata->waiting = true;
+    mdnsn_ref(ndata);
+}
+
+static void
+mdns_cache_cb(struct gensio_mdns_watch *w,
+	      enum gensio_mdns_data_state state,
+	      int interface, int ipdomain,
+	      const char *name, const char *type,
+	      const char *domain, const char *host,
+	      const struct gensio_addr *addr, const char * const *txt,
+	      void *userdata)
+{
+    struct mdns_cache_ent *e = userdata;
+    struct gensio_os_funcs *o = e->o;
+    struct gensio_list waiters;
+    struct gensio_link *l, *l2;
+    struct mdnsn_data *ndata;
+    int err = 0, rv;
+
+    gensio_list_init(&waiters);
+
+    o->lock(mdns_cache_lock);
+    if (e->dying)
+	goto out_unlock;
+
+    switch (state) {
+    case GENSIO_MDNS_NEW_DATA:
+	mdns_cache_add_result(e, interface, ipdomain, name, type, domain,
+			      addr, txt);
+	break;
+
+    case GENSIO_MDNS_DATA_GONE:
+	mdns_cache_rm_result(e, interface, ipdomain, name, type, domain, addr);
+	goto out_unlock;
+
+    case GENSIO_MDNS_ALL_FOR_NOW:
+	e->all_for_now = true;
+	if (!gensio_list_empty(&e->results))
+	    /* Waiters already tried everything we have. */
+	    goto out_unlock;
+	/* Didn't find what we were looking for. */
+	err = GE_NOTFOUND;
+	break;
+    }
+
+    /*
+     * Take all the waiters, they each keep the ref they got when
+     * they were put on the list.
+     */
+    gensio_list_for_each_safe(&e->waiters, l, l2) {
+	ndata = gensio_container_of(l, struct mdnsn_data, wlink);
+	gensio_list_rm(&e->waiters, l);
+	ndata->waiting = false;
+	gensio_list_add_tail(&waiters, l);
+    }
  out_unlock:
-    mdnsn_unlock(ndata);
- out:
-    if (argv)
-	gensio_argv_free(ndata->o, argv);
-    return;
+    o->unlock(mdns_cache_lock);
+
+    /*
+     * The entry can't be freed until we return, the free is done from
+     * the same runner that calls us.
+     */
+    gensio_list_for_each_safe(&waiters, l, l2) {
+	ndata = gensio_container_of(l, struct mdnsn_data, wlink);
+	gensio_list_rm(&waiters, l);
+
+	mdnsn_lock(ndata);
+	if (ndata->state != MDNSN_IN_OPEN_QUERY || ndata->centry != e)
+	    goto next;
+
+	rv = err;
+	if (!rv)
+	    rv = mdnsn_start_child(ndata, type, addr, txt);
+	if (rv == GE_NOTSUP) {
+	    /* Can't use this one, keep waiting. */
+	    o->lock(mdns_cache_lock);
+	    mdnsn_cache_wait(ndata);
+	    o->unlock(mdns_cache_lock);
+	    goto next;
+	}
+	mdnsn_cache_put(ndata);
+	if (rv)
+	    mdnsn_open_fail(ndata, rv);
+    next:
+	mdnsn_deref_and_unlock(ndata);
+    }
+}
+
+static bool
+mdns_cache_match(struct mdns_cache_ent *e, struct mdnsn_data *ndata)
+{
+    return (e->o == ndata->o && !e->dying &&
+	    e->interface == ndata->interface &&
+	    e->nettype == ndata->nettype &&
+	    mdns_cache_streq(e->name, ndata->name) &&
+	    mdns_cache_streq(e->type, ndata->type) &&
+	    mdns_cache_streq(e->domain, ndata->domain) &&
+	    mdns_cache_streq(e->host, ndata->host));
+}
+
+static void
+mdns_cache_cleanup(void)
+{
+    struct gensio_link *l, *l2;
+    struct mdns_cache_ent *e;
+
+    gensio_list_for_each_safe(&mdns_cache, l, l2) {
+	e = gensio_container_of(l, struct mdns_cache_ent, link);
+	gensio_list_rm(&mdns_cache, l);
+	if (e->timer_running)
+	    e->o->stop_timer(e->timer);
+	gensio_mdns_remove_watch(e->watch, NULL, NULL);
+	gensio_free_mdns(e->mdns, NULL, NULL);
+	mdns_cache_ent_free(e);
+    }
+    if (mdns_cache_lock)
+	mdns_cache_o->free_lock(mdns_cache_lock);
+    mdns_cache_lock = NULL;
+    memset(&mdns_cache_once, 0, sizeof(mdns_cache_once));
+}
+
+static struct gensio_class_cleanup mdns_cache_cleanup_data = {
+    mdns_cache_cleanup
+};
+
+static void
+mdns_cache_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    mdns_cache_o = o;
+    gensio_list_init(&mdns_cache);
+    mdns_cache_lock = o->alloc_lock(o);
+    if (mdns_cache_lock)
+	gensio_register_class_cleanup(&mdns_cache_cleanup_data);
+}
+
+/* Call with the cache lock held. */
+static int
+mdns_cache_alloc(struct mdnsn_data *ndata, struct mdns_cache_ent **re)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct mdns_cache_ent *e;
+    int err;
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e)
+	return GE_NOMEM;
+    e->o = o;
+    e->interface = ndata->interface;
+    e->nettype = ndata->nettype;
+    e->cache_time = ndata->cache_time;
+    gensio_list_init(&e->results);
+    gensio_list_init(&e->waiters);
+
+    err = GE_NOMEM;
+    if (!mdns_cache_dupstr(o, ndata->name, &e->name))
+	goto out_err;
+    if (!mdns_cache_dupstr(o, ndata->type, &e->type))
+	goto out_err;
+    if (!mdns_cache_dupstr(o, ndata->domain, &e->domain))
+	goto out_err;
+    if (!mdns_cache_dupstr(o, ndata->host, &e->host))
+	goto out_err;
+    e->timer = o->alloc_timer(o, mdns_cache_timeout, e);
+    if (!e->timer)
+	goto out_err;
+
+    err = gensio_alloc_mdns(o, &e->mdns);
+    if (err)
+	goto out_err;
+    err = gensio_mdns_add_watch(e->mdns, e->interface, e->nettype,
+				e->name, e->type, e->domain, e->host,
+				mdns_cache_cb, e, &e->watch);
+    if (err) {
+	gensio_free_mdns(e->mdns, NULL, NULL);
+	goto out_err;
+    }
+
+    if (ndata->cache) {
+	gensio_list_add_tail(&mdns_cache, &e->link);
+	e->linked = true;
+    }
+    *re = e;
+    return 0;
 
  out_err:
-    ndata->state = MDNSN_IN_OPEN_ERR;
-    if (ndata->watch)
-	gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-    err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-    if (!err) {
-	ndata->mdns_in_free = true;
+    mdns_cache_ent_free(e);
+    return err;
+}
+
+/*
+ * Find or create the cache entry for our query and become a user of
+ * it.  Call with the ndata lock held.
+ */
+static int
+mdnsn_cache_get(struct mdnsn_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_link *l;
+    struct mdns_cache_ent *e = NULL;
+    int err = 0;
+
+    o->call_once(o, &mdns_cache_once, mdns_cache_init, o);
+    if (!mdns_cache_lock)
+	return GE_NOMEM;
+
+    o->lock(mdns_cache_lock);
+    if (ndata->cache) {
+	gensio_list_for_each(&mdns_cache, l) {
+	    e = gensio_container_of(l, struct mdns_cache_ent, link);
+	    if (mdns_cache_match(e, ndata))
+		break;
+	    e = NULL;
+	}
+    }
+    if (e) {
+	if (ndata->cache_time > e->cache_time)
+	    e->cache_time = ndata->cache_time;
     } else {
-	ndata->mdns = NULL;
-	i_child_open_cb(ndata, ndata->open_err);
-	mdnsn_deref_and_unlock(ndata);
-	goto out;
+	err = mdns_cache_alloc(ndata, &e);
+	if (err)
+	    goto out_unlock;
     }
-    goto out_unlock;
+    e->users++;
+    ndata->centry = e;
+ out_unlock:
+    o->unlock(mdns_cache_lock);
+
+    return err;
+}
+
+/*
+ * Try to start the child from what is already in the cache entry, or
+ * wait for the watch to find something.  Call with the ndata lock
+ * held.
+ */
+static int
+mdnsn_cache_lookup(struct mdnsn_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct mdns_cache_ent *e = ndata->centry;
+    struct gensio_link *l;
+    struct mdns_cache_result *r;
+    int err = GE_NOTSUP;
+    bool done = true;
+
+    o->lock(mdns_cache_lock);
+    gensio_list_for_each(&e->results, l) {
+	r = gensio_container_of(l, struct mdns_cache_result, link);
+	err = mdnsn_start_child(ndata, r->type, r->addr,
+				(const char * const *) r->txt);
+	if (err != GE_NOTSUP)
+	    break;
+    }
+    if (err == GE_NOTSUP) {
+	err = 0;
+	if (e->all_for_now)
+	    mdnsn_open_fail(ndata, GE_NOTFOUND);
+	else {
+	    mdnsn_cache_wait(ndata);
+	    done = false;
+	}
+    }
+    o->unlock(mdns_cache_lock);
+
+    if (done)
+	mdnsn_cache_put(ndata);
+
+    return err;
 }
 
 static int
@@ -529,24 +1062,20 @@ mdnsn_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	err = GE_NOTREADY;
 	goto out_unlock;
     }
-    err = gensio_alloc_mdns(ndata->o, &ndata->mdns);
+    err = mdnsn_cache_get(ndata);
     if (err)
 	goto out_unlock;
-    err = gensio_mdns_add_watch(ndata->mdns, ndata->interface,
-				ndata->nettype,
-				ndata->name, ndata->type, ndata->domain,
-				ndata->host,
-				mdns_cb, ndata, &ndata->watch);
-    if (err) {
-	gensio_free_mdns(ndata->mdns, NULL, NULL);
-	ndata->mdns = NULL;
-	goto out_unlock;
-    }
 
     mdnsn_ref(ndata);
     ndata->state = MDNSN_IN_OPEN_QUERY;
     ndata->open_done = open_done;
     ndata->open_data = open_data;
+    err = mdnsn_cache_lookup(ndata);
+    if (err) {
+	ndata->state = MDNSN_CLOSED;
+	mdnsn_deref(ndata);
+	goto out_unlock;
+    }
     mdnsn_start_deferred_op(ndata);
  out_unlock:
     mdnsn_unlock(ndata);
@@ -572,15 +1101,10 @@ mdnsn_start_close(struct mdnsn_data *ndata)
 	break;
 
     case MDNSN_IN_OPEN_QUERY:
-	if (ndata->watch)
-	    gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-	err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-	if (err)
-	    ndata->mdns = NULL;
-	else {
-	    ndata->mdns_in_free = true;
-	    mdnsn_ref(ndata);
-	}
+	mdnsn_cache_put(ndata);
+	mdnsn_deref(ndata); /* Ref from the open. */
+	mdnsn_start_deferred_op(ndata);
+	err = 0;
 	break;
 
     default:
@@ -731,6 +1255,8 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
     char *laddr = NULL, *name = NULL, *type = NULL;
     char *domain = NULL, *host = NULL, *nettype_str = NULL;
     bool nodelay = false, readbuf_set = false, nodelay_set = false;
+    bool cache = true;
+    unsigned int cache_time = 0;
     const char *str;
 
     err = gensio_get_default(o, type, "nostack", false,
@@ -774,6 +1300,18 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
     if (err)
 	goto out_base_free;
 
+    err = gensio_get_default(o, "mdns", "cache", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &i);
+    if (err)
+	goto out_base_free;
+    cache = i;
+
+    err = gensio_get_default(o, "mdns", "cache-time", false,
+			     GENSIO_DEFAULT_INT, NULL, &i);
+    if (err)
+	goto out_base_free;
+    cache_time = i;
+
     if (mstr) {
 	if (name)
 	    free(name);
@@ -795,6 +1333,10 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
 	}
 	if (gensio_check_keybool(args[i], "nostack", &nostack) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "cache", &cache) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "cache-time", &cache_time) > 0)
+	    continue;
 	if (gensio_check_keyvalue(args[i], "laddr", &str) > 0) {
 	    if (laddr)
 		free(laddr);
@@ -880,6 +1422,8 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
 	goto out_base_free;
 
     ndata->readbuf_set = readbuf_set;
+    ndata->cache = cache;
+    ndata->cache_time = cache_time;
     ndata->nodelay_set = nodelay_set;
     ndata->laddr = laddr;
     ndata->name = name;
@@ -0,0 +1,1574 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This code is for a gensio that spreads one stream over several
+ * child connections.
+ *
+ * The connecter opens "paths" children from the same child string.
+ * Each child first sends a hello with a random session id, the
+ * number of paths, the path's index and the frame size, so the
+ * accepter can group the children of one session.  After that,
+ * written data is cut into frames of at most frame-size bytes, each
+ * with a sequence number, and each frame goes out on whichever path
+ * is free.  The receiver holds at most one frame per path and
+ * delivers the frames in sequence order.  Each child is in order, so
+ * the next frame is always at the head of one of the paths.
+ *
+ * Any error on any path is an error for the whole connection, since
+ * the frames on that path are lost.
+ *
+ * Everything in a connection is protected by its lock.  Children are
+ * only called with the lock held for things that don't call back.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "config.h"
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_base.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
+
+#define MPATH_MAGIC		0x4d505448 /* "MPTH" */
+#define MPATH_VERSION		1
+#define MPATH_SESSION_SIZE	8
+/* magic(4) version(1) paths(1) index(1) 0(1) frame-size(4) session(8) */
+#define MPATH_HELLO_SIZE	20
+/* sequence(4) length(2) */
+#define MPATH_HDR_SIZE		6
+#define MPATH_MAX_PATHS		32
+#define MPATH_MIN_FRAME		16
+#define MPATH_MAX_FRAME		65535
+
+struct mpath_data;
+
+struct mpath_path {
+    struct mpath_data *mdata;
+    struct gensio *child;
+    bool open;
+    bool failed;
+    bool rd_enabled;
+    bool wr_enabled;
+
+    /* The hello or frame being sent. */
+    unsigned char *xbuf;
+    gensiods xlen;
+    gensiods xpos;
+
+    /*
+     * The frame being received.  rpos is the amount received until
+     * have_frame is set, then the amount delivered.
+     */
+    unsigned char hdr[MPATH_HDR_SIZE];
+    unsigned int hdrlen;
+    uint32_t rseq;
+    unsigned char *rbuf;
+    gensiods rlen;
+    gensiods rpos;
+    bool have_frame;
+};
+
+enum mpath_state {
+    MPATH_CLOSED,
+    MPATH_IN_OPEN,
+    MPATH_OPEN,
+    MPATH_IN_CLOSE,
+};
+
+struct mpath_data {
+    struct gensio_os_funcs *o;
+    struct gensio *io;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+    enum mpath_state state;
+
+    unsigned int npaths;
+    struct mpath_path *paths;
+    gensiods frame_size;
+    unsigned char session[MPATH_SESSION_SIZE];
+
+    unsigned int nr_opening;
+    unsigned int nr_closing;
+    int open_err;
+    bool close_pending;
+
+    /* The first I/O error on any path. */
+    int err;
+    bool err_reported;
+
+    uint32_t tx_seq;
+    uint32_t rx_seq;
+    unsigned int tx_next;
+
+    bool rx_enable;
+    bool tx_enable;
+    bool in_read;
+    bool in_xmit_ready;
+
+    struct gensio_runner *runner;
+    bool runner_pending;
+    bool deferred_open;
+    int deferred_open_err;
+    bool deferred_read;
+    bool deferred_close;
+
+    gensio_done_err open_done;
+    void *open_data;
+
+    gensio_done close_done;
+    void *close_data;
+};
+
+static void mpath_deliver(struct mpath_data *mdata);
+
+static void
+mpath_lock(struct mpath_data *mdata)
+{
+    mdata->o->lock(mdata->lock);
+}
+
+static void
+mpath_unlock(struct mpath_data *mdata)
+{
+    mdata->o->unlock(mdata->lock);
+}
+
+static void
+mpath_ref(struct mpath_data *mdata)
+{
+    assert(mdata->refcount > 0);
+    mdata->refcount++;
+}
+
+/* Cannot be called for the last deref. */
+static void
+mpath_deref(struct mpath_data *mdata)
+{
+    assert(mdata->refcount > 1);
+    mdata->refcount--;
+}
+
+static void
+mpath_finish_free(struct mpath_data *mdata)
+{
+    struct gensio_os_funcs *o = mdata->o;
+    unsigned int i;
+
+    if (mdata->paths) {
+	for (i = 0; i < mdata->npaths; i++) {
+	    struct mpath_path *path = &mdata->paths[i];
+
+	    if (path->child)
+		gensio_free(path->child);
+	    if (path->xbuf)
+		o->free(o, path->xbuf);
+	    if (path->rbuf)
+		o->free(o, path->rbuf);
+	}
+	o->free(o, mdata->paths);
+    }
+    if (mdata->io)
+	gensio_data_free(mdata->io);
+    if (mdata->runner)
+	o->free_runner(mdata->runner);
+    if (mdata->lock)
+	o->free_lock(mdata->lock);
+    o->free(o, mdata);
+}
+
+static void
+mpath_deref_and_unlock(struct mpath_data *mdata)
+{
+    assert(mdata->refcount > 0);
+    if (--mdata->refcount > 0) {
+	mpath_unlock(mdata);
+	return;
+    }
+    mpath_unlock(mdata);
+    mpath_finish_free(mdata);
+}
+
+static void
+mpath_runner(struct gensio_runner *r, void *cb_data)
+{
+    struct mpath_data *mdata = cb_data;
+
+    mpath_lock(mdata);
+    mdata->runner_pending = false;
+    if (mdata->deferred_open) {
+	gensio_done_err open_done = mdata->open_done;
+	void *open_data = mdata->open_data;
+	int err = mdata->deferred_open_err;
+
+	mdata->deferred_open = false;
+	mdata->open_done = NULL;
+	if (open_done) {
+	    mpath_unlock(mdata);
+	    open_done(mdata->io, err, open_data);
+	    mpath_lock(mdata);
+	}
+    }
+    if (mdata->deferred_read) {
+	mdata->deferred_read = false;
+	mpath_deliver(mdata);
+    }
+    if (mdata->deferred_close) {
+	gensio_done close_done = mdata->close_done;
+	void *close_data = mdata->close_data;
+
+	mdata->deferred_close = false;
+	mdata->close_done = NULL;
+	if (close_done) {
+	    mpath_unlock(mdata);
+	    close_done(mdata->io, close_data);
+	    mpath_lock(mdata);
+	}
+    }
+    mpath_deref_and_unlock(mdata);
+}
+
+static void
+mpath_sched_runner(struct mpath_data *mdata)
+{
+    if (mdata->runner_pending)
+	return;
+    mdata->runner_pending = true;
+    mpath_ref(mdata);
+    mdata->o->run(mdata->runner);
+}
+
+static void
+mpath_report_open(struct mpath_data *mdata, int err)
+{
+    mdata->deferred_open = true;
+    mdata->deferred_open_err = err;
+    mpath_sched_runner(mdata);
+}
+
+static void
+mpath_report_close(struct mpath_data *mdata)
+{
+    mdata->state = MPATH_CLOSED;
+    mdata->deferred_close = true;
+    mpath_sched_runner(mdata);
+}
+
+static void
+mpath_set_child_read(struct mpath_path *path, bool enable)
+{
+    if (path->rd_enabled == enable)
+	return;
+    path->rd_enabled = enable;
+    gensio_set_read_callback_enable(path->child, enable);
+}
+
+static void
+mpath_set_child_write(struct mpath_path *path, bool enable)
+{
+    if (path->wr_enabled == enable)
+	return;
+    path->wr_enabled = enable;
+    gensio_set_write_callback_enable(path->child, enable);
+}
+
+static void mpath_check_close(struct mpath_data *mdata);
+
+/*
+ * A path has failed, so the connection has.  Data already received
+ * in order is still delivered before the error.
+ */
+static void
+mpath_path_err(struct mpath_path *path, int err)
+{
+    struct mpath_data *mdata = path->mdata;
+
+    path->failed = true;
+    path->xlen = 0;
+    path->xpos = 0;
+    mpath_set_child_read(path, false);
+    mpath_set_child_write(path, false);
+    if (!mdata->err)
+	mdata->err = err;
+    if (mdata->state == MPATH_OPEN && mdata->rx_enable) {
+	mdata->deferred_read = true;
+	mpath_sched_runner(mdata);
+    }
+    mpath_check_close(mdata);
+}
+
+/* Send what's left of the path's frame. */
+static void
+mpath_path_flush(struct mpath_path *path)
+{
+    struct mpath_data *mdata = path->mdata;
+    gensiods count;
+    int err;
+
+    if (path->xpos < path->xlen) {
+	err = gensio_write(path->child, &count, path->xbuf + path->xpos,
+			   path->xlen - path->xpos, NULL);
+	if (err) {
+	    mpath_path_err(path, err);
+	    return;
+	}
+	path->xpos += count;
+	if (path->xpos == path->xlen)
+	    path->xlen = path->xpos = 0;
+    }
+    mpath_set_child_write(path, path->xlen || mdata->tx_enable);
+}
+
+static void
+mpath_send_hello(struct mpath_path *path, unsigned int index)
+{
+    struct mpath_data *mdata = path->mdata;
+    unsigned char *h = path->xbuf;
+
+    gensio_u32_to_buf(h, MPATH_MAGIC);
+    h[4] = MPATH_VERSION;
+    h[5] = mdata->npaths;
+    h[6] = index;
+    h[7] = 0;
+    gensio_u32_to_buf(h + 8, mdata->frame_size);
+    memcpy(h + 12, mdata->session, MPATH_SESSION_SIZE);
+    path->xlen = MPATH_HELLO_SIZE;
+    path->xpos = 0;
+    mpath_path_flush(path);
+}
+
+/*
+ * Give the user the frames that are next in sequence.  Called and
+ * returns locked, the lock is released around the callbacks.
+ */
+static void
+mpath_deliver(struct mpath_data *mdata)
+{
+    struct mpath_path *path;
+    gensiods count;
+    unsigned int i;
+    int err;
+
+    while (mdata->state == MPATH_OPEN && mdata->rx_enable && !mdata->in_read) {
+	path = NULL;
+	for (i = 0; i < mdata->npaths; i++) {
+	    if (mdata->paths[i].have_frame &&
+			mdata->paths[i].rseq == mdata->rx_seq) {
+		path = &mdata->paths[i];
+		break;
+	    }
+	}
+	if (!path) {
+	    if (!mdata->err || mdata->err_reported)
+		break;
+	    /* Nothing more can come in order, report the error. */
+	    mdata->err_reported = true;
+	    mdata->rx_enable = false;
+	    mdata->in_read = true;
+	    mpath_unlock(mdata);
+	    gensio_cb(mdata->io, GENSIO_EVENT_READ, mdata->err,
+		      NULL, NULL, NULL);
+	    mpath_lock(mdata);
+	    mdata->in_read = false;
+	    break;
+	}
+
+	count = path->rlen - path->rpos;
+	mdata->in_read = true;
+	mpath_unlock(mdata);
+	err = gensio_cb(mdata->io, GENSIO_EVENT_READ, 0,
+			path->rbuf + path->rpos, &count, NULL);
+	mpath_lock(mdata);
+	mdata->in_read = false;
+	if (err)
+	    break;
+	if (count > path->rlen - path->rpos)
+	    count = path->rlen - path->rpos;
+	path->rpos += count;
+	if (path->rpos < path->rlen) {
+	    if (count == 0)
+		break;
+	    continue;
+	}
+	path->have_frame = false;
+	path->hdrlen = 0;
+	path->rpos = 0;
+	mdata->rx_seq++;
+	if (!path->failed)
+	    mpath_set_child_read(path, true);
+    }
+}
+
+static int
+mpath_child_read(struct mpath_path *path, int err,
+		 unsigned char *buf, gensiods *buflen)
+{
+    struct mpath_data *mdata = path->mdata;
+    gensiods pos = 0, len = 0, n;
+
+    if (buflen)
+	len = *buflen;
+
+    mpath_lock(mdata);
+    if (err) {
+	mpath_path_err(path, err);
+	goto out_unlock;
+    }
+    if (path->failed || (mdata->state != MPATH_OPEN &&
+			 mdata->state != MPATH_IN_CLOSE)) {
+	/* Nobody to give it to. */
+	pos = len;
+	goto out_unlock;
+    }
+
+    while (pos < len && !path->have_frame) {
+	if (path->hdrlen < MPATH_HDR_SIZE) {
+	    n = MPATH_HDR_SIZE - path->hdrlen;
+	    if (n > len - pos)
+		n = len - pos;
+	    memcpy(path->hdr + path->hdrlen, buf + pos, n);
+	    path->hdrlen += n;
+	    pos += n;
+	    if (path->hdrlen < MPATH_HDR_SIZE)
+		break;
+	    path->rseq = gensio_buf_to_u32(path->hdr);
+	    path->rlen = gensio_buf_to_u16(path->hdr + 4);
+	    path->rpos = 0;
+	    if (path->rlen == 0 || path->rlen > mdata->frame_size) {
+		mpath_path_err(path, GE_PROTOERR);
+		pos = len;
+		goto out_unlock;
+	    }
+	    continue;
+	}
+	n = path->rlen - path->rpos;
+	if (n > len - pos)
+	    n = len - pos;
+	memcpy(path->rbuf + path->rpos, buf + pos, n);
+	path->rpos += n;
+	pos += n;
+	if (path->rpos == path->rlen) {
+	    path->have_frame = true;
+	    path->rpos = 0;
+	}
+    }
+    if (path->have_frame) {
+	/* Hold the rest in the child until this frame is delivered. */
+	mpath_set_child_read(path, false);
+	mpath_deliver(mdata);
+    }
+
+ out_unlock:
+    mpath_unlock(mdata);
+    if (buflen)
+	*buflen = pos;
+    return 0;
+}
+
+static void
+mpath_child_write_ready(struct mpath_path *path)
+{
+    struct mpath_data *mdata = path->mdata;
+
+    mpath_lock(mdata);
+    if (path->failed || !path->open) {
+	mpath_set_child_write(path, false);
+	goto out_unlock;
+    }
+    mpath_path_flush(path);
+    if (mdata->state == MPATH_IN_CLOSE) {
+	mpath_check_close(mdata);
+    } else if (mdata->state == MPATH_OPEN && !path->failed && !path->xlen &&
+	       mdata->tx_enable && !mdata->in_xmit_ready) {
+	mdata->in_xmit_ready = true;
+	mpath_unlock(mdata);
+	gensio_cb(mdata->io, GENSIO_EVENT_WRITE_READY, 0, NULL, NULL, NULL);
+	mpath_lock(mdata);
+	mdata->in_xmit_ready = false;
+    }
+ out_unlock:
+    mpath_unlock(mdata);
+}
+
+static int
+mpath_child_event(struct gensio *io, void *user_data,
+		  int event, int err,
+		  unsigned char *buf, gensiods *buflen,
+		  const char *const *auxdata)
+{
+    struct mpath_path *path = user_data;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	return mpath_child_read(path, err, buf, buflen);
+
+    case GENSIO_EVENT_WRITE_READY:
+	mpath_child_write_ready(path);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/* All the children are closed, finish the open or close. */
+static void
+mpath_children_closed(struct mpath_data *mdata)
+{
+    if (mdata->state == MPATH_IN_OPEN) {
+	/* Failed open. */
+	mpath_report_open(mdata, mdata->open_err);
+	mdata->state = MPATH_CLOSED;
+	if (mdata->close_pending) {
+	    mdata->close_pending = false;
+	    mpath_report_close(mdata);
+	}
+    } else if (mdata->state == MPATH_IN_CLOSE) {
+	mpath_report_close(mdata);
+    }
+}
+
+static void
+mpath_child_close_done(struct gensio *io, void *close_data)
+{
+    struct mpath_path *path = close_data;
+    struct mpath_data *mdata = path->mdata;
+
+    mpath_lock(mdata);
+    assert(mdata->nr_closing > 0);
+    if (--mdata->nr_closing == 0)
+	mpath_children_closed(mdata);
+    mpath_deref_and_unlock(mdata);
+}
+
+/* Close all the open children. */
+static void
+mpath_close_children(struct mpath_data *mdata)
+{
+    struct mpath_path *path;
+    unsigned int i;
+
+    for (i = 0; i < mdata->npaths; i++) {
+	path = &mdata->paths[i];
+	if (!path->open)
+	    continue;
+	path->open = false;
+	mpath_set_child_read(path, false);
+	mpath_set_child_write(path, false);
+	mdata->nr_closing++;
+	mpath_ref(mdata);
+	if (gensio_close(path->child, mpath_child_close_done, path)) {
+	    /* Already closed. */
+	    mdata->nr_closing--;
+	    mpath_deref(mdata);
+	}
+    }
+    if (mdata->nr_closing == 0)
+	mpath_children_closed(mdata);
+}
+
+/*
+ * When closing, wait for the frames already accepted from the user
+ * to go out, then close the children.
+ */
+static void
+mpath_check_close(struct mpath_data *mdata)
+{
+    unsigned int i;
+
+    if (mdata->state != MPATH_IN_CLOSE || mdata->nr_closing)
+	return;
+    if (!mdata->err) {
+	for (i = 0; i < mdata->npaths; i++) {
+	    if (mdata->paths[i].open && mdata->paths[i].xlen)
+		return;
+	}
+    }
+    mpath_close_children(mdata);
+}
+
+static void
+mpath_child_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct mpath_path *path = open_data;
+    struct mpath_data *mdata = path->mdata;
+    unsigned int i;
+
+    mpath_lock(mdata);
+    assert(mdata->nr_opening > 0);
+    mdata->nr_opening--;
+    if (err) {
+	if (!mdata->open_err)
+	    mdata->open_err = err;
+    } else {
+	path->open = true;
+	mpath_send_hello(path, path - mdata->paths);
+	if (path->failed && !mdata->open_err)
+	    mdata->open_err = mdata->err;
+    }
+
+    if (mdata->nr_opening > 0)
+	goto out_unlock;
+
+    if (mdata->close_pending) {
+	mdata->close_pending = false;
+	mpath_report_open(mdata, GE_LOCALCLOSED);
+	mdata->state = MPATH_IN_CLOSE;
+	mpath_close_children(mdata);
+    } else if (mdata->open_err) {
+	mpath_close_children(mdata);
+    } else {
+	mdata->state = MPATH_OPEN;
+	for (i = 0; i < mdata->npaths; i++)
+	    mpath_set_child_read(&mdata->paths[i], true);
+	mpath_report_open(mdata, 0);
+    }
+ out_unlock:
+    mpath_deref_and_unlock(mdata);
+}
+
+static void
+mpath_reset(struct mpath_data *mdata)
+{
+    unsigned int i;
+
+    mdata->err = 0;
+    mdata->err_reported = false;
+    mdata->open_err = 0;
+    mdata->tx_seq = 0;
+    mdata->rx_seq = 0;
+    mdata->tx_next = 0;
+    for (i = 0; i < mdata->npaths; i++) {
+	struct mpath_path *path = &mdata->paths[i];
+
+	path->open = false;
+	path->failed = false;
+	path->rd_enabled = false;
+	path->wr_enabled = false;
+	path->xlen = 0;
+	path->xpos = 0;
+	path->hdrlen = 0;
+	path->rpos = 0;
+	path->have_frame = false;
+    }
+}
+
+static int
+mpath_open(struct mpath_data *mdata, gensio_done_err open_done,
+	   void *open_data)
+{
+    struct gensio_os_funcs *o = mdata->o;
+    unsigned int i;
+    int err = 0;
+
+    if (!gensio_is_client(mdata->io))
+	return GE_NOTSUP;
+
+    mpath_lock(mdata);
+    if (mdata->state != MPATH_CLOSED || mdata->runner_pending) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    err = o->get_random(o, mdata->session, sizeof(mdata->session));
+    if (err)
+	goto out_unlock;
+    mpath_reset(mdata);
+    mdata->open_done = open_done;
+    mdata->open_data = open_data;
+    mdata->state = MPATH_IN_OPEN;
+    for (i = 0; i < mdata->npaths; i++) {
+	err = gensio_open(mdata->paths[i].child, mpath_child_open_done,
+			  &mdata->paths[i]);
+	if (err)
+	    break;
+	mdata->nr_opening++;
+	mpath_ref(mdata);
+    }
+    if (err) {
+	if (mdata->nr_opening == 0) {
+	    mdata->state = MPATH_CLOSED;
+	    mdata->open_done = NULL;
+	} else {
+	    /* Report it when the ones that started finish. */
+	    mdata->open_err = err;
+	    err = 0;
+	}
+    }
+ out_unlock:
+    mpath_unlock(mdata);
+
+    return err;
+}
+
+static int
+mpath_close(struct mpath_data *mdata, gensio_done close_done,
+	    void *close_data)
+{
+    int err = 0;
+
+    mpath_lock(mdata);
+    switch (mdata->state) {
+    case MPATH_OPEN:
+	mdata->state = MPATH_IN_CLOSE;
+	mdata->close_done = close_done;
+	mdata->close_data = close_data;
+	mpath_check_close(mdata);
+	break;
+
+    case MPATH_IN_OPEN:
+	if (mdata->close_pending) {
+	    err = GE_NOTREADY;
+	    break;
+	}
+	/* Finish it when the children are done opening or closing. */
+	mdata->close_pending = true;
+	mdata->close_done = close_done;
+	mdata->close_data = close_data;
+	break;
+
+    default:
+	err = GE_NOTREADY;
+    }
+    mpath_unlock(mdata);
+
+    return err;
+}
+
+static void
+mpath_free(struct mpath_data *mdata)
+{
+    mpath_lock(mdata);
+    if (mdata->state == MPATH_OPEN || mdata->state == MPATH_IN_OPEN) {
+	mpath_unlock(mdata);
+	mpath_close(mdata, NULL, NULL);
+	mpath_lock(mdata);
+    }
+    /* Don't call the user back on a free. */
+    mdata->open_done = NULL;
+    mdata->close_done = NULL;
+    mpath_deref_and_unlock(mdata);
+}
+
+static int
+mpath_write(struct mpath_data *mdata, gensiods *rcount,
+	    const struct gensio_sg *sg, gensiods sglen)
+{
+    struct mpath_path *path;
+    gensiods total = 0, n, c, sgi = 0, sgpos = 0;
+    unsigned int i, idx, start;
+    unsigned char *p;
+    int err = 0;
+
+    mpath_lock(mdata);
+    if (mdata->state != MPATH_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (mdata->err) {
+	err = mdata->err;
+	goto out_unlock;
+    }
+
+    /* Put a frame on each free path, starting after the last one used. */
+    start = mdata->tx_next;
+    for (i = 0; i < mdata->npaths && sgi < sglen && !mdata->err; i++) {
+	idx = (start + i) % mdata->npaths;
+	path = &mdata->paths[idx];
+	if (path->xlen || path->failed)
+	    continue;
+
+	p = path->xbuf + MPATH_HDR_SIZE;
+	n = 0;
+	while (sgi < sglen && n < mdata->frame_size) {
+	    c = sg[sgi].buflen - sgpos;
+	    if (c > mdata->frame_size - n)
+		c = mdata->frame_size - n;
+	    memcpy(p + n, ((const unsigned char *) sg[sgi].buf) + sgpos, c);
+	    n += c;
+	    sgpos += c;
+	    if (sgpos == sg[sgi].buflen) {
+		sgi++;
+		sgpos = 0;
+	    }
+	}
+	if (n == 0)
+	    break;
+
+	gensio_u32_to_buf(path->xbuf, mdata->tx_seq++);
+	gensio_u16_to_buf(path->xbuf + 4, n);
+	path->xlen = n + MPATH_HDR_SIZE;
+	path->xpos = 0;
+	total += n;
+	mdata->tx_next = (idx + 1) % mdata->npaths;
+	mpath_path_flush(path);
+    }
+    if (rcount)
+	*rcount = total;
+ out_unlock:
+    mpath_unlock(mdata);
+
+    return err;
+}
+
+static int
+mpath_gensio_func(struct gensio *io, int func, gensiods *count,
+		  const void *cbuf, gensiods buflen, void *buf,
+		  const char *const *auxdata)
+{
+    struct mpath_data *mdata = gensio_get_gensio_data(io);
+    unsigned int i;
+
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	if (auxdata && auxdata[0])
+	    return GE_INVAL;
+	return mpath_write(mdata, count, cbuf, buflen);
+
+    case GENSIO_FUNC_OPEN:
+	return mpath_open(mdata, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return mpath_close(mdata, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	mpath_free(mdata);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	mpath_lock(mdata);
+	for (i = 0; i < mdata->npaths; i++) {
+	    if (mdata->paths[i].open)
+		gensio_disable(mdata->paths[i].child);
+	    mdata->paths[i].open = false;
+	}
+	mdata->state = MPATH_CLOSED;
+	mpath_unlock(mdata);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	mpath_lock(mdata);
+	mdata->rx_enable = buflen;
+	if (mdata->rx_enable && mdata->state == MPATH_OPEN) {
+	    mdata->deferred_read = true;
+	    mpath_sched_runner(mdata);
+	}
+	mpath_unlock(mdata);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	mpath_lock(mdata);
+	mdata->tx_enable = buflen;
+	if (mdata->state == MPATH_OPEN) {
+	    for (i = 0; i < mdata->npaths; i++) {
+		struct mpath_path *path = &mdata->paths[i];
+
+		if (path->open && !path->failed)
+		    mpath_set_child_write(path, path->xlen || buflen);
+	    }
+	}
+	mpath_unlock(mdata);
+	return 0;
+
+    case GENSIO_FUNC_CONTROL:
+	/* All the paths are the same kind, the first one answers. */
+	return gensio_control(mdata->paths[0].child,
+			      GENSIO_CONTROL_DEPTH_FIRST,
+			      *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct mpath_data *
+mpath_data_alloc(struct gensio_os_funcs *o, unsigned int npaths,
+		 gensiods frame_size, gensio_event cb, void *user_data)
+{
+    struct mpath_data *mdata;
+    gensiods xsize = MPATH_HDR_SIZE + frame_size;
+    unsigned int i;
+
+    if (xsize < MPATH_HELLO_SIZE)
+	xsize = MPATH_HELLO_SIZE;
+
+    mdata = o->zalloc(o, sizeof(*mdata));
+    if (!mdata)
+	return NULL;
+    mdata->o = o;
+    mdata->refcount = 1;
+    mdata->npaths = npaths;
+    mdata->frame_size = frame_size;
+
+    mdata->lock = o->alloc_lock(o);
+    if (!mdata->lock)
+	goto out_nomem;
+    mdata->runner = o->alloc_runner(o, mpath_runner, mdata);
+    if (!mdata->runner)
+	goto out_nomem;
+    mdata->paths = o->zalloc(o, npaths * sizeof(*mdata->paths));
+    if (!mdata->paths)
+	goto out_nomem;
+    for (i = 0; i < npaths; i++) {
+	mdata->paths[i].mdata = mdata;
+	mdata->paths[i].xbuf = o->zalloc(o, xsize);
+	if (!mdata->paths[i].xbuf)
+	    goto out_nomem;
+	mdata->paths[i].rbuf = o->zalloc(o, frame_size);
+	if (!mdata->paths[i].rbuf)
+	    goto out_nomem;
+    }
+
+    mdata->io = gensio_data_alloc(o, cb, user_data, mpath_gensio_func,
+				  NULL, "mpath", mdata);
+    if (!mdata->io)
+	goto out_nomem;
+    gensio_set_is_reliable(mdata->io, true);
+
+    return mdata;
+
+ out_nomem:
+    mpath_finish_free(mdata);
+    return NULL;
+}
+
+static int
+mpath_gensio_alloc(const void *gdata, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    const char *str = gdata;
+    struct mpath_data *mdata;
+    unsigned int npaths = 2, i;
+    gensiods frame_size = 16384;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyuint(args[i], "paths", &npaths) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "frame-size", &frame_size) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (npaths == 0 || npaths > MPATH_MAX_PATHS ||
+		frame_size < MPATH_MIN_FRAME || frame_size > MPATH_MAX_FRAME)
+	return GE_INVAL;
+
+    mdata = mpath_data_alloc(o, npaths, frame_size, cb, user_data);
+    if (!mdata)
+	return GE_NOMEM;
+    gensio_set_is_client(mdata->io, true);
+
+    for (i = 0; i < npaths; i++) {
+	err = str_to_gensio(str, o, mpath_child_event, &mdata->paths[i],
+			    &mdata->paths[i].child);
+	if (err)
+	    goto out_err;
+    }
+
+    *new_gensio = mdata->io;
+    return 0;
+
+ out_err:
+    mpath_finish_free(mdata);
+    return err;
+}
+
+static int
+str_to_mpath_gensio(const char *str, const char * const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
+{
+    return mpath_gensio_alloc(str, args, o, cb, user_data, new_gensio);
+}
+
+/*
+ * Make the server side from a complete set of children.  The
+ * children are open and their hellos have been read.
+ */
+static int
+mpath_server_alloc(struct gensio_os_funcs *o, unsigned int npaths,
+		   gensiods frame_size, struct gensio **children,
+		   struct gensio **new_gensio)
+{
+    struct mpath_data *mdata;
+    unsigned int i;
+
+    mdata = mpath_data_alloc(o, npaths, frame_size, NULL, NULL);
+    if (!mdata)
+	return GE_NOMEM;
+
+    mpath_lock(mdata);
+    mdata->state = MPATH_OPEN;
+    for (i = 0; i < npaths; i++) {
+	mdata->paths[i].child = children[i];
+	mdata->paths[i].open = true;
+	gensio_set_callback(children[i], mpath_child_event, &mdata->paths[i]);
+	mpath_set_child_read(&mdata->paths[i], true);
+    }
+    mpath_unlock(mdata);
+
+    *new_gensio = mdata->io;
+    return 0;
+}
+
+/*
+ * The accepter.  Children that come in from the child accepter are
+ * held until their hello is read and all the paths of their session
+ * have arrived, then they become one mpath gensio.  Children that
+ * don't get that far within hello-timeout are dropped, along with the
+ * rest of their session.
+ */
+
+struct mpathna_session;
+
+struct mpathna_conn {
+    struct gensio_link link;
+    struct mpathna_data *nadata;
+    struct gensio *child;
+    gensio_time start;
+    bool closing;
+
+    unsigned char hello[MPATH_HELLO_SIZE];
+    unsigned int hlen;
+    struct mpathna_session *session;
+};
+
+struct mpathna_session {
+    struct gensio_link link;
+    unsigned char id[MPATH_SESSION_SIZE];
+    unsigned int npaths;
+    gensiods frame_size;
+    unsigned int nr_conns;
+    struct mpathna_conn *conns[MPATH_MAX_PATHS];
+};
+
+struct mpathna_data {
+    struct gensio_accepter *acc;
+    struct gensio_accepter *child;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    gensio_time hello_timeout;
+    struct gensio_timer *timer;
+    bool timer_running;
+
+    /* Children that are not part of a gensio yet. */
+    struct gensio_list conns;
+    struct gensio_list sessions;
+
+    gensio_acc_done shutdown_done;
+    gensio_acc_done cb_en_done;
+};
+
+static void
+mpathna_lock(struct mpathna_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+}
+
+static void
+mpathna_unlock(struct mpathna_data *nadata)
+{
+    nadata->o->unlock(nadata->lock);
+}
+
+static void
+mpathna_finish_free(struct mpathna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->timer)
+	o->free_timer(nadata->timer);
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    o->free(o, nadata);
+}
+
+static void
+mpathna_deref_and_unlock(struct mpathna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    if (--nadata->refcount > 0) {
+	mpathna_unlock(nadata);
+	return;
+    }
+    mpathna_unlock(nadata);
+    mpathna_finish_free(nadata);
+}
+
+static void
+mpathna_conn_close_done(struct gensio *io, void *close_data)
+{
+    struct mpathna_conn *conn = close_data;
+    struct mpathna_data *nadata = conn->nadata;
+
+    gensio_free(io);
+    mpathna_lock(nadata);
+    nadata->o->free(nadata->o, conn);
+    mpathna_deref_and_unlock(nadata);
+}
+
+static void
+mpathna_conn_close(struct mpathna_conn *conn)
+{
+    struct mpathna_data *nadata = conn->nadata;
+
+    gensio_list_rm(&nadata->conns, &conn->link);
+    conn->closing = true;
+    conn->session = NULL;
+    gensio_set_read_callback_enable(conn->child, false);
+    nadata->refcount++;
+    if (gensio_close(conn->child, mpathna_conn_close_done, conn)) {
+	/* Already closed. */
+	gensio_free(conn->child);
+	nadata->o->free(nadata->o, conn);
+	nadata->refcount--;
+    }
+}
+
+/* Drop a waiting child, and the rest of its session if it has one. */
+static void
+mpathna_conn_drop(struct mpathna_conn *conn)
+{
+    struct mpathna_data *nadata = conn->nadata;
+    struct mpathna_session *s = conn->session;
+    unsigned int i;
+
+    if (!s) {
+	mpathna_conn_close(conn);
+	return;
+    }
+    for (i = 0; i < s->npaths; i++) {
+	if (s->conns[i])
+	    mpathna_conn_close(s->conns[i]);
+    }
+    gensio_list_rm(&nadata->sessions, &s->link);
+    nadata->o->free(nadata->o, s);
+}
+
+static void
+mpathna_drop_all(struct mpathna_data *nadata)
+{
+    struct gensio_link *l;
+
+    while (!gensio_list_empty(&nadata->conns)) {
+	l = gensio_list_first(&nadata->conns);
+	mpathna_conn_drop(gensio_container_of(l, struct mpathna_conn, link));
+    }
+}
+
+static void
+mpathna_start_timer(struct mpathna_data *nadata)
+{
+    if (nadata->timer_running || gensio_list_empty(&nadata->conns))
+	return;
+    if (nadata->o->start_timer(nadata->timer, &nadata->hello_timeout) == 0) {
+	nadata->timer_running = true;
+	nadata->refcount++;
+    }
+}
+
+static void
+mpathna_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct mpathna_data *nadata = cb_data;
+    struct mpathna_conn *conn;
+    struct gensio_link *l;
+    gensio_time now;
+    int64_t timeout;
+
+    timeout = gensio_time_to_msecs(&nadata->hello_timeout);
+    timeout = GENSIO_MSECS_TO_NSECS(timeout);
+    gensio_os_funcs_get_monotonic_time(nadata->o, &now);
+
+    mpathna_lock(nadata);
+    nadata->timer_running = false;
+ restart:
+    gensio_list_for_each(&nadata->conns, l) {
+	conn = gensio_container_of(l, struct mpathna_conn, link);
+	if (gensio_time_diff_nsecs(&now, &conn->start) >= timeout) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+			   "mpath: dropping a connection that didn't finish"
+			   " its session in time");
+	    mpathna_conn_drop(conn);
+	    goto restart;
+	}
+    }
+    mpathna_start_timer(nadata);
+    mpathna_deref_and_unlock(nadata);
+}
+
+/*
+ * Turn a complete session into a gensio and report it.  Called
+ * unlocked, the session is already off the lists.
+ */
+static void
+mpathna_session_start(struct mpathna_data *nadata, struct mpathna_session *s)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio *children[MPATH_MAX_PATHS];
+    struct gensio *io;
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < s->npaths; i++) {
+	children[i] = s->conns[i]->child;
+	o->free(o, s->conns[i]);
+    }
+
+    err = base_gensio_accepter_new_child_start(nadata->acc);
+    if (err)
+	goto out_err;
+    err = mpath_server_alloc(o, s->npaths, s->frame_size, children, &io);
+    if (err) {
+	base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
+	goto out_err;
+    }
+    base_gensio_accepter_new_child_end(nadata->acc, io, 0);
+    base_gensio_server_open_done(nadata->acc, io, 0);
+    o->free(o, s);
+    return;
+
+ out_err:
+    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		   "Error setting up mpath gensio: %s",
+		   gensio_err_to_str(err));
+    for (i = 0; i < s->npaths; i++) {
+	gensio_disable(children[i]);
+	gensio_free(children[i]);
+    }
+    o->free(o, s);
+}
+
+/*
+ * Check a hello and add the child to its session.  Returns the
+ * session if it is now complete, it is taken off the lists.
+ */
+static struct mpathna_session *
+mpathna_hello(struct mpathna_data *nadata, struct mpathna_conn *conn)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    unsigned char *h = conn->hello;
+    struct mpathna_session *s = NULL;
+    struct gensio_link *l;
+    unsigned int npaths = h[5], index = h[6], i;
+    gensiods frame_size = gensio_buf_to_u32(h + 8);
+
+    if (gensio_buf_to_u32(h) != MPATH_MAGIC || h[4] != MPATH_VERSION ||
+		npaths == 0 || npaths > MPATH_MAX_PATHS || index >= npaths ||
+		frame_size < MPATH_MIN_FRAME || frame_size > MPATH_MAX_FRAME) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+		       "mpath: invalid hello from a connection");
+	goto out_drop;
+    }
+
+    gensio_list_for_each(&nadata->sessions, l) {
+	s = gensio_container_of(l, struct mpathna_session, link);
+	if (memcmp(s->id, h + 12, MPATH_SESSION_SIZE) == 0)
+	    break;
+	s = NULL;
+    }
+    if (s) {
+	if (s->npaths != npaths || s->frame_size != frame_size ||
+		s->conns[index]) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+			   "mpath: connection doesn't match its session");
+	    goto out_drop;
+	}
+    } else {
+	s = o->zalloc(o, sizeof(*s));
+	if (!s)
+	    goto out_drop;
+	memcpy(s->id, h + 12, MPATH_SESSION_SIZE);
+	s->npaths = npaths;
+	s->frame_size = frame_size;
+	gensio_list_add_tail(&nadata->sessions, &s->link);
+    }
+    s->conns[index] = conn;
+    conn->session = s;
+    if (++s->nr_conns < npaths)
+	return NULL;
+
+    gensio_list_rm(&nadata->sessions, &s->link);
+    for (i = 0; i < npaths; i++)
+	gensio_list_rm(&nadata->conns, &s->conns[i]->link);
+    return s;
+
+ out_drop:
+    mpathna_conn_close(conn);
+    return NULL;
+}
+
+static int
+mpathna_conn_event(struct gensio *io, void *user_data,
+		   int event, int err,
+		   unsigned char *buf, gensiods *buflen,
+		   const char *const *auxdata)
+{
+    struct mpathna_conn *conn = user_data;
+    struct mpathna_data *nadata = conn->nadata;
+    struct mpathna_session *s = NULL;
+    gensiods n = 0;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    mpathna_lock(nadata);
+    if (conn->closing) {
+	if (buflen)
+	    n = *buflen;
+	goto out_unlock;
+    }
+    if (err) {
+	mpathna_conn_drop(conn);
+	goto out_unlock;
+    }
+    n = MPATH_HELLO_SIZE - conn->hlen;
+    if (n > *buflen)
+	n = *buflen;
+    memcpy(conn->hello + conn->hlen, buf, n);
+    conn->hlen += n;
+    if (conn->hlen == MPATH_HELLO_SIZE) {
+	/* Anything after the hello is data for the new gensio. */
+	gensio_set_read_callback_enable(io, false);
+	s = mpathna_hello(nadata, conn);
+    }
+ out_unlock:
+    mpathna_unlock(nadata);
+    if (buflen)
+	*buflen = n;
+    if (s)
+	mpathna_session_start(nadata, s);
+    return 0;
+}
+
+static int
+mpathna_child_event(struct gensio_accepter *accepter, void *user_data,
+		    int event, void *data)
+{
+    struct mpathna_data *nadata = user_data;
+    struct mpathna_conn *conn;
+    struct gensio *child = data;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return gensio_acc_cb(nadata->acc, event, data);
+
+    conn = nadata->o->zalloc(nadata->o, sizeof(*conn));
+    if (!conn) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "mpath: out of memory for a new connection");
+	gensio_free(child);
+	return 0;
+    }
+    conn->nadata = nadata;
+    conn->child = child;
+    gensio_os_funcs_get_monotonic_time(nadata->o, &conn->start);
+
+    mpathna_lock(nadata);
+    gensio_list_add_tail(&nadata->conns, &conn->link);
+    gensio_set_callback(child, mpathna_conn_event, conn);
+    gensio_set_read_callback_enable(child, true);
+    mpathna_start_timer(nadata);
+    mpathna_unlock(nadata);
+
+    return 0;
+}
+
+static void
+mpathna_child_shutdown(struct gensio_accepter *accepter, void *shutdown_data)
+{
+    struct mpathna_data *nadata = shutdown_data;
+
+    mpathna_lock(nadata);
+    mpathna_drop_all(nadata);
+    mpathna_unlock(nadata);
+    nadata->shutdown_done(nadata->acc, NULL);
+}
+
+static void
+mpathna_cb_en_done(struct gensio_accepter *accepter, void *cb_data)
+{
+    struct mpathna_data *nadata = cb_data;
+
+    nadata->cb_en_done(nadata->acc, NULL);
+}
+
+static void
+mpathna_free(struct mpathna_data *nadata)
+{
+    struct gensio_accepter *child = nadata->child;
+
+    mpathna_lock(nadata);
+    mpathna_drop_all(nadata);
+    if (nadata->timer_running &&
+		nadata->o->stop_timer(nadata->timer) == 0) {
+	nadata->timer_running = false;
+	nadata->refcount--;
+    }
+    nadata->child = NULL;
+    mpathna_deref_and_unlock(nadata);
+    gensio_acc_free(child);
+}
+
+static void
+mpathna_disable(struct mpathna_data *nadata)
+{
+    struct mpathna_conn *conn;
+    struct gensio_link *l;
+    struct mpathna_session *s;
+
+    mpathna_lock(nadata);
+    while (!gensio_list_empty(&nadata->conns)) {
+	l = gensio_list_first(&nadata->conns);
+	conn = gensio_container_of(l, struct mpathna_conn, link);
+	gensio_list_rm(&nadata->conns, l);
+	gensio_disable(conn->child);
+	gensio_free(conn->child);
+	nadata->o->free(nadata->o, conn);
+    }
+    while (!gensio_list_empty(&nadata->sessions)) {
+	l = gensio_list_first(&nadata->sessions);
+	s = gensio_container_of(l, struct mpathna_session, link);
+	gensio_list_rm(&nadata->sessions, l);
+	nadata->o->free(nadata->o, s);
+    }
+    mpathna_unlock(nadata);
+    gensio_acc_disable(nadata->child);
+}
+
+static int
+mpath_base_acc_op(struct gensio_accepter *acc, int func,
+		  void *acc_op_data, void *done, int val1,
+		  void *data, void *data2, void *ret)
+{
+    struct mpathna_data *nadata = acc_op_data;
+    gensio_acc_done ldone = NULL;
+
+    switch (func) {
+    case GENSIO_BASE_ACC_STARTUP:
+	return gensio_acc_startup(nadata->child);
+
+    case GENSIO_BASE_ACC_SHUTDOWN:
+	nadata->shutdown_done = done;
+	return gensio_acc_shutdown(nadata->child, mpathna_child_shutdown,
+				   nadata);
+
+    case GENSIO_BASE_ACC_SET_CB_ENABLE:
+	nadata->cb_en_done = done;
+	if (done)
+	    ldone = mpathna_cb_en_done;
+	return gensio_acc_set_accept_callback_enable_cb(nadata->child, val1,
+							ldone, nadata);
+
+    case GENSIO_BASE_ACC_FREE:
+	mpathna_free(nadata);
+	return 0;
+
+    case GENSIO_BASE_ACC_DISABLE:
+	mpathna_disable(nadata);
+	return 0;
+
+    case GENSIO_BASE_ACC_CONTROL:
+	return gensio_acc_control(nadata->child, GENSIO_CONTROL_DEPTH_FIRST,
+				  val1, *((unsigned int *) done), data, ret);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+mpath_gensio_accepter_alloc(struct gensio_accepter *child,
+			    const char * const args[],
+			    struct gensio_os_funcs *o,
+			    gensio_accepter_event cb, void *user_data,
+			    struct gensio_accepter **accepter)
+{
+    struct mpathna_data *nadata;
+    gensio_time hello_timeout = { 10, 0 };
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keytime(args[i], "hello-timeout", 's',
+				 &hello_timeout) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->refcount = 1;
+    nadata->hello_timeout = hello_timeout;
+    gensio_list_init(&nadata->conns);
+    gensio_list_init(&nadata->sessions);
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_nomem;
+    nadata->timer = o->alloc_timer(o, mpathna_timeout, nadata);
+    if (!nadata->timer)
+	goto out_nomem;
+
+    err = base_gensio_accepter_alloc(child, mpath_base_acc_op, nadata,
+				     o, "mpath", cb, user_data, accepter);
+    if (err)
+	goto out_err;
+    nadata->acc = *accepter;
+    nadata->child = child;
+    gensio_acc_set_is_reliable(nadata->acc, true);
+    gensio_acc_set_callback(child, mpathna_child_event, nadata);
+
+    return 0;
+
+ out_nomem:
+    err = GE_NOMEM;
+ out_err:
+    mpathna_finish_free(nadata);
+    return err;
+}
+
+static int
+str_to_mpath_gensio_accepter(const char *str, const char * const args[],
+			     struct gensio_os_funcs *o,
+			     gensio_accepter_event cb,
+			     void *user_data,
+			     struct gensio_accepter **acc)
+{
+    int err;
+    struct gensio_accepter *acc2 = NULL;
+
+    err = str_to_gensio_accepter(str, o, NULL, NULL, &acc2);
+    if (!err) {
+	err = mpath_gensio_accepter_alloc(acc2, args, o, cb, user_data, acc);
+	if (err)
+	    gensio_acc_free(acc2);
+    }
+
+    return err;
+}
+
+int
+gensio_init_mpath(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    rv = register_gensio(o, "mpath", str_to_mpath_gensio, mpath_gensio_alloc);
+    if (rv)
+	return rv;
+    return register_filter_gensio_accepter(o, "mpath",
+					   str_to_mpath_gensio_accepter,
+					   mpath_gensio_accepter_alloc);
+}
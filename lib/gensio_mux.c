@@ -16,6 +16,7 @@
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_acc_gensio.h>
 #include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
 
 /*
  * The protocol consists of messages.  The first byte of a message
@@ -47,6 +48,22 @@
  * accepted.  Note that the flags (1 byte) and data size (2 bytes) is
  * considered part of the outstanding bytes for each message, so it
  * can be stored in the buffer with the data.
+ *
+ * Acks ride along in every data message, a data message with no data
+ * is sent if there is nothing else to carry the ack.  Starting with
+ * version 2, acks may be delayed to coalesce them.  An ack is sent
+ * right away once MUX_ACK_FRACTION of the receive window is waiting
+ * to be acked, otherwise it waits up to MUX_ACK_DELAY_MSECS for data
+ * to carry it.  Since a message may be up to half the window, a
+ * sender that is blocked on the window always has enough unacked to
+ * get an immediate ack once the data is consumed.  Acks are never
+ * delayed to a version 1 end.
+ *
+ * Starting with version 3, the receive window may grow.  A data
+ * message with a 3 word header carries a new, larger byte count
+ * window, the sender uses it from then on.  The window is never made
+ * smaller in the protocol.  Instead the receiver shrinks it by
+ * holding back acks for data the user has consumed.
  */
 
 enum mux_msgs {
@@ -58,10 +75,18 @@ enum mux_msgs {
      * version adds data after the version, older version should
      * ignore it.
      *
-     * This is version 1 of the protocol.
+     * This is version 4 of the protocol.  Version 2 adds delayed
+     * acks, the messages are the same.  Version 3 adds window
+     * updates to the data message.  Version 4 adds early data, see
+     * MUX_FLAG_EARLY_DATA, and the early window to this message.
+     * That is the byte count window channels the remote end opens
+     * get, so data up to that size can be sent before the new
+     * channel response comes back.
      *
      * +----------------+--------+-------+----------------+----------------+
-     * |   1   |size(1) |    reserved    |    version     |   reserved     |
+     * |   1   |size(2) |    reserved    |    version     |   reserved     |
+     * +----------------+--------+-------+----------------+----------------+
+     * |                            early window                           |
      * +----------------+--------+-------+----------------+----------------+
      */
     MUX_INIT		= 1,
@@ -136,6 +161,19 @@ enum mux_msgs {
      * +----------------+----------------+----------------+----------------+
      * |                               data...                             |
      * +----------------+----------------+----------------+----------------+
+     *
+     * If the size is 3, the header has a new byte count window
+     * after the ack count.  Version 3 and later only.
+     *
+     * +----------------+----------------+----------------+----------------+
+     * |   5   |size(3) |     flags      |      remote channel id          |
+     * +----------------+----------------+----------------+----------------+
+     * |    Ack count (number of bytes received by user)                   |
+     * +----------------+----------------+----------------+----------------+
+     * |                          byte count window                        |
+     * +----------------+----------------+----------------+----------------+
+     * |            data size            |            data....             |
+     * +----------------+----------------+----------------+----------------+
      */
     MUX_DATA		= 5,
 };
@@ -148,9 +186,59 @@ static unsigned int mux_msg_hdr_sizes[] = { 0, 1, 2, 3, 2, 2 };
 #define MUX_FLAG_END_OF_MESSAGE		(1 << 0)
 #define MUX_FLAG_OUT_OF_BOUND		(1 << 1)
 
+/*
+ * Version 4 and later, data sent on a channel before the new channel
+ * response was received.  The channel id is the sender's id, the one
+ * in the new channel message, since the sender does not know the
+ * remote id yet.  If the channel was refused, the data is dropped.
+ */
+#define MUX_FLAG_EARLY_DATA		(1 << 2)
+
 #define MUX_MAX_HDR_SIZE	12
 #define MUX_MIN_SEND_WINDOW_SIZE	128
 
+#define MUX_PROTOCOL_VERSION	4
+
+/*
+ * Delayed acks, see the comment at the top.  An ack is sent
+ * immediately when 1/MUX_ACK_FRACTION of the window is unacked.
+ */
+#define MUX_ACK_FRACTION	4
+#define MUX_ACK_DELAY_MSECS	5
+
+/*
+ * Read buffers start at this size and double as data comes in, so
+ * they only use what the remote end actually sends.  RTT samples
+ * for window tuning are limited to MUX_MAX_TUNE_NSECS.
+ */
+#define MUX_RDBUF_START_SIZE	1024
+#define MUX_MAX_TUNE_NSECS	GENSIO_SECS_TO_NSECS(1)
+
+/*
+ * Writes with up to this many sg entries may go straight from the
+ * user's buffers to the child, see chan_try_direct_write().
+ */
+#define MUX_MAX_DIRECT_SG	8
+
+/*
+ * The most channels whose messages are written to the child in one
+ * call, see mux_write_sendq().
+ */
+#define MUX_MAX_BATCH		16
+
+/* The data size in a data message is 16 bits. */
+#define MUX_MAX_DATA_SIZE	0xffff
+
+/*
+ * Write scheduling.  Channels with data to send are kept on one list
+ * per priority, higher priorities are always sent first.  Inside a
+ * priority, channels take turns with deficit round robin, each turn
+ * a channel gets weight * MUX_DRR_QUANTUM bytes of credit.
+ */
+#define MUX_NR_PRIORITIES	8
+#define MUX_MAX_WEIGHT		256
+#define MUX_DRR_QUANTUM		1024
+
 #ifdef ENABLE_INTERNAL_TRACE
 #define MUX_TRACING
 #endif
@@ -214,6 +302,49 @@ struct mux_inst {
     gensiods read_data_len;
     gensiods max_read_size;
     bool read_enabled;
+
+    /*
+     * read_data is read_data_size bytes, grown as data comes in.  If
+     * it has to grow while the user has a pointer into it, the old
+     * buffer is kept in old_read_data until the read callback returns.
+     * The peaks are the most data held in the buffer the last two
+     * times it was filled, it is shrunk back to fit them.  If
+     * read_data_fixed is set it starts at full size and is not
+     * shrunk, see fixed_rdbuf in struct mux_data.
+     */
+    bool read_data_fixed;
+    gensiods read_data_size;
+    unsigned char *old_read_data;
+    gensiods read_data_peak;
+    gensiods read_data_prev_peak;
+
+    /*
+     * Receive window tuning.  max_read_size is the window the remote
+     * end was told, it never gets smaller.  rcv_window is the window
+     * we want.  If it is smaller, acks are held back in ack_debt
+     * until the remote end effectively has rcv_window.  min_read_size
+     * is the configured window, tuning never goes below it or below
+     * half of max_read_size.
+     */
+    gensiods min_read_size;
+    gensiods rcv_window;
+    gensiods ack_debt;
+    bool send_window_update;
+
+    /*
+     * Receive RTT is measured as the time it takes to receive one
+     * window of data, starting when rcv_total was rcv_rtt_seq less
+     * a window.  rcv_rtt is the estimate in nanoseconds, zero if not
+     * known yet.  rcv_copied is what the user consumed since
+     * rcv_space_time, rcv_space is what was consumed in the last RTT.
+     */
+    gensiods rcv_total;
+    gensiods rcv_rtt_seq;
+    gensio_time rcv_rtt_start;
+    int64_t rcv_rtt;
+    gensiods rcv_copied;
+    gensiods rcv_space;
+    gensio_time rcv_space_time;
     bool in_read_report;
     int in_newchannel;
 
@@ -239,8 +370,8 @@ struct mux_inst {
     bool deferred_op_pending;
     struct gensio_runner *deferred_op_runner;
 
-    /* Used for current message being transmitted. */
-    unsigned char hdr[MUX_MAX_HDR_SIZE];
+    /* Used for current message being transmitted, plus the data size. */
+    unsigned char hdr[MUX_MAX_HDR_SIZE + 2];
     struct gensio_sg sg[3];
     unsigned int sgpos;
     unsigned int sglen;
@@ -256,11 +387,30 @@ struct mux_inst {
 
     /* Link for list of channels waiting write. */
     struct gensio_link wrlink;
-    bool wr_ready; /* Also true if chan == muxdata->sending_chan. */
+    bool wr_ready; /* Also true if the channel is in muxdata->sendq. */
+
+    /* Link for muxdata->sendq. */
+    struct gensio_link sendlink;
+    bool in_sendq;
 
     bool in_wrlist;
     bool in_open_chan;
 
+    /* Link for the list of channels with a delayed ack. */
+    struct gensio_link acklink;
+    bool in_acklist;
+
+    /*
+     * Scheduling parameters, see MUX_NR_PRIORITIES.  deficit is the
+     * credit left for the current turn, it may go negative if a large
+     * message was sent.  If max_burst is not zero, messages and the
+     * credit of a turn are limited to that many bytes.
+     */
+    unsigned int priority;
+    unsigned int weight;
+    gensiods max_burst;
+    long deficit;
+
     struct gensio_link link;
 };
 
@@ -307,8 +457,8 @@ chan_next_read_pos(struct mux_inst *chan, unsigned int count)
 {
     unsigned rv = chan->read_data_pos + count;
 
-    if (rv >= chan->max_read_size)
-	rv -= chan->max_read_size;
+    if (rv >= chan->read_data_size)
+	rv -= chan->read_data_size;
     return rv;
 }
 
@@ -317,11 +467,11 @@ chan_addrdbuf(struct mux_inst *chan, const unsigned char *data, gensiods len)
 {
     gensiods epos = chan->read_data_pos + chan->read_data_len;
 
-    if (epos >= chan->max_read_size)
-	epos -= chan->max_read_size;
+    if (epos >= chan->read_data_size)
+	epos -= chan->read_data_size;
 
-    if (len + epos > chan->max_read_size) {
-	gensiods plen = chan->max_read_size - epos;
+    if (len + epos > chan->read_data_size) {
+	gensiods plen = chan->read_data_size - epos;
 
 	memcpy(chan->read_data + epos, data, plen);
 	data += plen;
@@ -339,10 +489,87 @@ chan_addrdbyte(struct mux_inst *chan, unsigned char data)
     chan_addrdbuf(chan, &data, 1);
 }
 
+/*
+ * How much more the remote end may send.  Held back acks count
+ * against its window.
+ */
 static gensiods
 chan_rdbufleft(struct mux_inst *chan)
 {
-    return chan->max_read_size - chan->read_data_len;
+    return chan->max_read_size - chan->ack_debt - chan->read_data_len;
+}
+
+/*
+ * Make room for len more bytes in the read buffer.  The buffer at
+ * least doubles, so the data already in it can stay at the same
+ * offsets without wrapping.  A read callback in progress continues
+ * from those offsets.
+ */
+static int
+chan_rdbuf_make_room(struct mux_inst *chan, gensiods len)
+{
+    struct gensio_os_funcs *o = chan->o;
+    gensiods size = chan->read_data_size;
+    gensiods end = chan->read_data_pos + chan->read_data_len;
+    unsigned char *data;
+
+    if (chan->read_data_len + len <= size)
+	return 0;
+    while (chan->read_data_len + len > size)
+	size *= 2;
+    data = gensio_os_funcs_buf_zalloc(o, size);
+    if (!data)
+	return GE_NOMEM;
+    if (end > chan->read_data_size) {
+	memcpy(data + chan->read_data_pos,
+	       chan->read_data + chan->read_data_pos,
+	       chan->read_data_size - chan->read_data_pos);
+	memcpy(data + chan->read_data_size, chan->read_data,
+	       end - chan->read_data_size);
+    } else {
+	memcpy(data + chan->read_data_pos,
+	       chan->read_data + chan->read_data_pos, chan->read_data_len);
+    }
+    if (chan->in_read_report && !chan->old_read_data)
+	chan->old_read_data = chan->read_data;
+    else
+	gensio_os_funcs_buf_free(o, chan->read_data);
+    chan->read_data = data;
+    chan->read_data_size = size;
+    return 0;
+}
+
+/*
+ * Called when the read buffer is empty.  If the last two fills of
+ * the buffer used well under its size, give the memory back.
+ */
+static void
+chan_rdbuf_check_shrink(struct mux_inst *chan)
+{
+    struct gensio_os_funcs *o = chan->o;
+    gensiods size = chan->read_data_size;
+    gensiods peak = chan->read_data_peak;
+    unsigned char *data;
+
+    if (chan->read_data_len || chan->in_read_report ||
+		!chan->read_data_peak || chan->read_data_fixed)
+	return;
+    if (chan->read_data_prev_peak > peak)
+	peak = chan->read_data_prev_peak;
+    chan->read_data_prev_peak = chan->read_data_peak;
+    chan->read_data_peak = 0;
+
+    while (size / 2 >= MUX_RDBUF_START_SIZE && size / 2 >= peak * 2)
+	size /= 2;
+    if (size == chan->read_data_size)
+	return;
+    data = gensio_os_funcs_buf_zalloc(o, size);
+    if (!data)
+	return;
+    gensio_os_funcs_buf_free(o, chan->read_data);
+    chan->read_data = data;
+    chan->read_data_size = size;
+    chan->read_data_pos = 0;
 }
 
 struct gensio_mux_config {
@@ -352,6 +579,11 @@ struct gensio_mux_config {
     char *service;
     size_t service_len;
     unsigned int max_channels;
+    unsigned int max_version;
+    gensiods window_budget;
+    unsigned int priority;
+    unsigned int weight;
+    gensiods max_burst;
     bool is_client;
 };
 
@@ -425,9 +657,29 @@ struct mux_data {
 
     unsigned int max_channels;
 
+    /*
+     * Receive windows are tuned up to this total for all channels,
+     * zero disables tuning.  window_total is the current total.
+     */
+    gensiods window_budget;
+    gensiods window_total;
+
+    /* Scheduling parameters for channels opened by the remote end. */
+    unsigned int priority;
+    unsigned int weight;
+    gensiods max_burst;
+
     /* Number of channels that are not closed. */
     unsigned int nr_not_closed;
 
+    /*
+     * With the real-time profile channel read buffers are allocated
+     * at full size and never shrink.  They only grow if window
+     * tuning raises max_read_size, so once the window settles
+     * nothing is allocated for data.
+     */
+    bool fixed_rdbuf;
+
     bool is_client;
 
     /*
@@ -447,9 +699,12 @@ struct mux_data {
     void *acc_open_data;
 
     /*
-     * Channel I am currently sending data on.
+     * Channels with a message set up to send, in the order they go
+     * out.  They are written to the child together, only the first
+     * one may be partially written.
      */
-    struct mux_inst *sending_chan;
+    struct gensio_list sendq;
+    unsigned int sendq_len;
 
     enum mux_state state;
 
@@ -477,8 +732,29 @@ struct mux_data {
     /* The last id we chose for a channel. */
     unsigned int last_id;
 
-    /* Mux instances with write pending. */
-    struct gensio_list wrchans;
+    /* Protocol version, the lower of ours and the remote end's. */
+    unsigned int version;
+
+    /* The highest version we offer, normally MUX_PROTOCOL_VERSION. */
+    unsigned int max_version;
+
+    /*
+     * The window the remote end gives channels we open, from its init
+     * message.  Early data on a new channel is limited to this.
+     */
+    gensiods early_window;
+
+    /*
+     * Channels with a delayed ack, and a timer to send them.  The
+     * timer holds a reference to the mux while it is running.
+     */
+    struct gensio_list ackchans;
+    struct gensio_timer *ack_timer;
+    bool ack_timer_running;
+
+    /* Mux instances with write pending, one list per priority. */
+    struct gensio_list wrchans[MUX_NR_PRIORITIES];
+    unsigned int nr_wrchans;
 
     /* Muxes waiting to open. */
     struct gensio_list openchans;
@@ -493,11 +769,19 @@ struct mux_data {
     struct mux_inst *do_normal_close_chan;
 
     /*
-     * All the channels in the mux.  The channels are kept in id
-     * order.
+     * All the channels in the mux, in the order they were created.
      */
     struct gensio_list chans;
 
+    /*
+     * Channels indexed by id, grown as higher ids are used, and a
+     * bitmap of the ids in use.  Bits past max_channels are always
+     * set so they are never picked.
+     */
+    struct mux_inst **chan_table;
+    unsigned int chan_table_size;
+    unsigned long *id_map;
+
 #ifdef MUX_TRACING
     struct mux_trace_info trace[MUX_TRACE_SIZE];
     unsigned int trace_pos;
@@ -564,6 +848,7 @@ static int muxc_gensio_handler(struct gensio *io, int func, gensiods *count,
 			       const void *cbuf, gensiods buflen, void *buf,
 			       const char *const *auxdata);
 static void muxc_add_to_wrlist(struct mux_inst *chan);
+static bool chan_delay_ack(struct mux_inst *chan);
 static void mux_shutdown_channels(struct mux_data *muxdata, int err);
 
 static void
@@ -581,6 +866,12 @@ muxdata_free(struct mux_data *muxdata)
 {
     assert(gensio_list_empty(&muxdata->chans));
 
+    if (muxdata->chan_table)
+	muxdata->o->free(muxdata->o, muxdata->chan_table);
+    if (muxdata->id_map)
+	muxdata->o->free(muxdata->o, muxdata->id_map);
+    if (muxdata->ack_timer)
+	muxdata->o->free_timer(muxdata->ack_timer);
     if (muxdata->lock)
 	muxdata->o->free_lock(muxdata->lock);
     if (muxdata->child)
@@ -669,9 +960,11 @@ chan_free(struct mux_inst *chan)
     if (chan->io)
 	gensio_data_free(chan->io);
     if (chan->read_data)
-	o->free(o, chan->read_data);
+	gensio_os_funcs_buf_free(o, chan->read_data);
+    if (chan->old_read_data)
+	gensio_os_funcs_buf_free(o, chan->old_read_data);
     if (chan->write_data)
-	o->free(o, chan->write_data);
+	gensio_os_funcs_buf_free(o, chan->write_data);
     if (chan->service)
 	o->free(o, chan->service);
     if (chan->deferred_op_runner)
@@ -679,6 +972,95 @@ chan_free(struct mux_inst *chan)
     o->free(o, chan);
 }
 
+#define MUX_ID_MAP_BITS (sizeof(unsigned long) * 8)
+
+static void
+mux_id_map_set(struct mux_data *muxdata, unsigned int id)
+{
+    muxdata->id_map[id / MUX_ID_MAP_BITS] |= 1UL << (id % MUX_ID_MAP_BITS);
+}
+
+static void
+mux_id_map_clear(struct mux_data *muxdata, unsigned int id)
+{
+    muxdata->id_map[id / MUX_ID_MAP_BITS] &= ~(1UL << (id % MUX_ID_MAP_BITS));
+}
+
+static int
+mux_id_map_alloc(struct mux_data *muxdata)
+{
+    struct gensio_os_funcs *o = muxdata->o;
+    unsigned int i, nwords;
+
+    nwords = (muxdata->max_channels + MUX_ID_MAP_BITS - 1) / MUX_ID_MAP_BITS;
+    muxdata->id_map = o->zalloc(o, nwords * sizeof(unsigned long));
+    if (!muxdata->id_map)
+	return GE_NOMEM;
+    for (i = muxdata->max_channels; i < nwords * MUX_ID_MAP_BITS; i++)
+	mux_id_map_set(muxdata, i);
+    return 0;
+}
+
+/*
+ * Find the first free id at or after start, wrapping around.  This
+ * works a word of the bitmap at a time.  Returns false if all the ids
+ * are in use.
+ */
+static bool
+mux_id_map_find(struct mux_data *muxdata, unsigned int start,
+		unsigned int *rid)
+{
+    unsigned int nwords, word, i, bit;
+    unsigned long free_bits;
+
+    nwords = (muxdata->max_channels + MUX_ID_MAP_BITS - 1) / MUX_ID_MAP_BITS;
+    word = start / MUX_ID_MAP_BITS;
+    /* Ignore the ids before start in the first word the first time. */
+    free_bits = ~muxdata->id_map[word] &
+	~((1UL << (start % MUX_ID_MAP_BITS)) - 1);
+    for (i = 0; i <= nwords; i++) {
+	if (free_bits) {
+	    for (bit = 0; !(free_bits & (1UL << bit)); bit++)
+		;
+	    *rid = word * MUX_ID_MAP_BITS + bit;
+	    return true;
+	}
+	if (++word >= nwords)
+	    word = 0;
+	free_bits = ~muxdata->id_map[word];
+    }
+    return false;
+}
+
+/* Make sure the channel table can hold the given id. */
+static int
+mux_chan_table_grow(struct mux_data *muxdata, unsigned int id)
+{
+    struct gensio_os_funcs *o = muxdata->o;
+    struct mux_inst **table;
+    unsigned int size = muxdata->chan_table_size;
+
+    if (id < size)
+	return 0;
+    if (size == 0)
+	size = 16;
+    while (size <= id)
+	size *= 2;
+    if (size > muxdata->max_channels)
+	size = muxdata->max_channels;
+    table = o->zalloc(o, size * sizeof(*table));
+    if (!table)
+	return GE_NOMEM;
+    if (muxdata->chan_table) {
+	memcpy(table, muxdata->chan_table,
+	       muxdata->chan_table_size * sizeof(*table));
+	o->free(o, muxdata->chan_table);
+    }
+    muxdata->chan_table = table;
+    muxdata->chan_table_size = size;
+    return 0;
+}
+
 static void i_chan_ref(struct mux_inst *chan)
 {
     assert(chan->refcount > 0);
@@ -692,6 +1074,15 @@ static bool i_chan_deref(struct mux_inst *chan)
 	struct mux_data *mux = chan->mux;
 
 	gensio_list_rm(&mux->chans, &chan->link);
+	if (chan->in_acklist)
+	    gensio_list_rm(&mux->ackchans, &chan->acklink);
+	if (chan->in_sendq) {
+	    gensio_list_rm(&mux->sendq, &chan->sendlink);
+	    mux->sendq_len--;
+	}
+	mux->window_total -= chan->rcv_window;
+	mux_id_map_clear(mux, chan->id);
+	mux->chan_table[chan->id] = NULL;
 	chan_free(chan);
 	i_mux_deref(mux);
 	return true;
@@ -873,12 +1264,19 @@ mux_send_new_channel_rsp(struct mux_data *muxdata, unsigned int remote_id,
 static void
 mux_send_init(struct mux_data *muxdata)
 {
-    muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x1;
     muxdata->xmit_data[1] = 0;
-    muxdata->xmit_data[2] = 1;
+    muxdata->xmit_data[2] = muxdata->max_version;
     muxdata->xmit_data[3] = 0;
     muxdata->xmit_data_pos = 0;
-    muxdata->xmit_data_len = 4;
+    if (muxdata->max_version < 4) {
+	/* Older versions have no early window. */
+	muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x1;
+	muxdata->xmit_data_len = 4;
+    } else {
+	muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x2;
+	gensio_u32_to_buf(&muxdata->xmit_data[4], muxdata->max_read_size);
+	muxdata->xmit_data_len = 8;
+    }
 }
 
 /*
@@ -931,6 +1329,203 @@ full_msg_ready(struct mux_inst *chan, gensiods *rlen)
     return len + 3 <= chan->read_data_len;
 }
 
+static void
+mux_ack_timeout(struct gensio_timer *timer, void *cb_data)
+{
+    struct mux_data *muxdata = cb_data;
+    struct gensio_link *l, *l2;
+    struct mux_inst *chan;
+
+    mux_lock(muxdata);
+    muxdata->ack_timer_running = false;
+    gensio_list_for_each_safe(&muxdata->ackchans, l, l2) {
+	chan = gensio_container_of(l, struct mux_inst, acklink);
+	gensio_list_rm(&muxdata->ackchans, &chan->acklink);
+	chan->in_acklist = false;
+	/* It may have gone out with data already. */
+	if (chan->received_unacked && !chan->close_sent)
+	    muxc_add_to_wrlist(chan);
+    }
+    mux_deref_and_unlock(muxdata);
+}
+
+/*
+ * See if the ack for a channel can wait.  If so, put it on the
+ * delayed ack list and return true.
+ */
+static bool
+chan_delay_ack(struct mux_inst *chan)
+{
+    struct mux_data *muxdata = chan->mux;
+    gensio_time timeout;
+
+    if (muxdata->version < 2)
+	return false;
+    if (chan->in_wrlist)
+	/* A message is already queued, the ack will go with it. */
+	return true;
+    if (chan->received_unacked >= chan->rcv_window / MUX_ACK_FRACTION)
+	return false;
+    if (chan->in_acklist)
+	return true;
+
+    if (!muxdata->ack_timer_running) {
+	gensio_msecs_to_time(&timeout, MUX_ACK_DELAY_MSECS);
+	if (muxdata->o->start_timer(muxdata->ack_timer, &timeout))
+	    return false;
+	mux_ref(muxdata);
+	muxdata->ack_timer_running = true;
+    }
+    gensio_list_add_tail(&muxdata->ackchans, &chan->acklink);
+    chan->in_acklist = true;
+    return true;
+}
+
+static void
+chan_read_report_done(struct mux_inst *chan)
+{
+    chan->in_read_report = false;
+    if (chan->old_read_data) {
+	gensio_os_funcs_buf_free(chan->o, chan->old_read_data);
+	chan->old_read_data = NULL;
+    }
+}
+
+static bool
+chan_rcv_tuning(struct mux_inst *chan)
+{
+    return chan->mux->window_budget && chan->mux->version >= 3;
+}
+
+/*
+ * Called as data arrives.  A window of data takes about one RTT to
+ * arrive if the sender is limited by the window, which is the case
+ * the tuning cares about.
+ */
+static void
+chan_rcv_rtt_measure(struct mux_inst *chan, gensiods len)
+{
+    gensio_time now;
+    int64_t sample;
+
+    chan->rcv_total += len;
+    if (chan->rcv_rtt_seq && chan->rcv_total < chan->rcv_rtt_seq)
+	return;
+
+    chan->o->get_monotonic_time(chan->o, &now);
+    if (!chan->rcv_rtt_seq) {
+	chan->rcv_rtt_seq = (chan->rcv_total + chan->max_read_size -
+			     chan->ack_debt);
+	chan->rcv_rtt_start = now;
+	return;
+    }
+    chan->rcv_rtt_seq = 0;
+
+    sample = gensio_time_diff_nsecs(&now, &chan->rcv_rtt_start);
+    if (sample > MUX_MAX_TUNE_NSECS)
+	sample = MUX_MAX_TUNE_NSECS;
+    if (sample < 1)
+	sample = 1;
+    /* Take lower values right away, others slowly. */
+    if (!chan->rcv_rtt || sample < chan->rcv_rtt)
+	chan->rcv_rtt = sample;
+    else
+	chan->rcv_rtt += (sample - chan->rcv_rtt) / 8;
+}
+
+/*
+ * Set the receive window we want, within the mux budget.  A larger
+ * window first gives back held acks, then grows the remote end's
+ * window with an update.  A smaller one is done by chan_hold_acks()
+ * as the user consumes data.
+ */
+static void
+chan_set_rcv_window(struct mux_inst *chan, gensiods window)
+{
+    struct mux_data *muxdata = chan->mux;
+    gensiods avail = 0, debt;
+
+    if (window < chan->min_read_size)
+	window = chan->min_read_size;
+    /*
+     * The remote end builds messages up to half of max_read_size,
+     * one of those has to fit or it can never send again.
+     */
+    if (window < chan->max_read_size / 2)
+	window = chan->max_read_size / 2;
+    if (window > UINT32_MAX)
+	window = UINT32_MAX;
+    if (window > chan->rcv_window) {
+	if (muxdata->window_budget > muxdata->window_total)
+	    avail = muxdata->window_budget - muxdata->window_total;
+	if (window - chan->rcv_window > avail)
+	    window = chan->rcv_window + avail;
+    }
+    if (window == chan->rcv_window)
+	return;
+    muxdata->window_total -= chan->rcv_window;
+    muxdata->window_total += window;
+    chan->rcv_window = window;
+
+    if (window > chan->max_read_size) {
+	chan->max_read_size = window;
+	chan->send_window_update = true;
+	muxc_add_to_wrlist(chan);
+    }
+    debt = chan->max_read_size - window;
+    if (chan->ack_debt > debt) {
+	chan->received_unacked += chan->ack_debt - debt;
+	chan->ack_debt = debt;
+	muxc_add_to_wrlist(chan);
+    }
+}
+
+/* Hold back acks until the remote end's window is down to rcv_window. */
+static void
+chan_hold_acks(struct mux_inst *chan)
+{
+    gensiods debt = chan->max_read_size - chan->rcv_window, hold;
+
+    if (chan->ack_debt >= debt)
+	return;
+    hold = debt - chan->ack_debt;
+    if (hold > chan->received_unacked)
+	hold = chan->received_unacked;
+    chan->received_unacked -= hold;
+    chan->ack_debt += hold;
+}
+
+/*
+ * Called as the user consumes data.  Once per RTT, look at how much
+ * was consumed.  If it went up and was more than half the window,
+ * the window is probably what limits the throughput, so grow it to
+ * twice what was consumed.  If it was under a quarter of the window,
+ * shrink toward that.
+ */
+static void
+chan_rcv_tune(struct mux_inst *chan, gensiods consumed)
+{
+    gensio_time now;
+    gensiods copied, window = chan->rcv_window;
+
+    chan->rcv_copied += consumed;
+    if (!chan->rcv_rtt)
+	return;
+    chan->o->get_monotonic_time(chan->o, &now);
+    if (gensio_time_diff_nsecs(&now, &chan->rcv_space_time) < chan->rcv_rtt)
+	return;
+
+    copied = chan->rcv_copied;
+    chan->rcv_copied = 0;
+    chan->rcv_space_time = now;
+    if (copied > chan->rcv_space && copied * 2 > window)
+	window = copied * 2;
+    else if (copied * 4 < window)
+	window = copied * 2;
+    chan->rcv_space = copied;
+    chan_set_rcv_window(chan, window);
+}
+
 /*
  * Must be called with an extra refcount held.
  */
@@ -955,7 +1550,7 @@ chan_check_read(struct mux_inst *chan)
 	    err = gensio_cb(chan->io, GENSIO_EVENT_READ, chan->errcode,
 			    NULL, NULL, NULL);
 	    mux_lock(muxdata);
-	    chan->in_read_report = false;
+	    chan_read_report_done(chan);
 	    if (err)
 		break;
 	    continue;
@@ -977,9 +1572,9 @@ chan_check_read(struct mux_inst *chan)
 	    flstr[i++] = "oob";
 	}
 	flstr[i] = NULL;
-	if (pos + len > chan->max_read_size) {
+	if (pos + len > chan->read_data_size) {
 	    /* Buffer wraps, deliver in two parts. */
-	    rcount = chan->max_read_size - pos;
+	    rcount = chan->read_data_size - pos;
 	    orcount = rcount;
 	    mux_unlock(muxdata);
 	    err = gensio_cb(chan->io, GENSIO_EVENT_READ,
@@ -998,7 +1593,8 @@ chan_check_read(struct mux_inst *chan)
 	    if (rcount < orcount || !chan->read_enabled)
 		/* User didn't consume all data. */
 		goto after_read_done;
-	    pos = 0;
+	    /* Not always 0, the buffer may have grown in the callback. */
+	    pos = chan_next_read_pos(chan, olen + 3);
 	}
 	rcount = len;
 	orcount = rcount;
@@ -1019,7 +1615,7 @@ chan_check_read(struct mux_inst *chan)
 	to_ack += rcount;
 	olen += rcount;
     after_read_done:
-	chan->in_read_report = false;
+	chan_read_report_done(chan);
 
 	if (len > 0) {
 	    /* Partial read, create a new 3-byte header over the data left. */
@@ -1034,15 +1630,22 @@ chan_check_read(struct mux_inst *chan)
 	    to_ack += 3;
 	}
 	chan->received_unacked += to_ack;
+	if (chan_rcv_tuning(chan)) {
+	    chan_rcv_tune(chan, to_ack);
+	    chan_hold_acks(chan);
+	}
+	chan_rdbuf_check_shrink(chan);
     }
+
     /*
      * Schedule an ack send if we need it.  The send_close thing may
      * look strange, but we delay finishing the close until all read
      * data is delivered, so if all the data is processed and a close
      * is pending, we send it.
      */
-    if (chan->received_unacked ||
-		(chan->send_close && chan->read_data_len == 0))
+    if (chan->send_close && chan->read_data_len == 0)
+	muxc_add_to_wrlist(chan);
+    else if (chan->received_unacked && !chan_delay_ack(chan))
 	muxc_add_to_wrlist(chan);
 }
 
@@ -1081,21 +1684,204 @@ chan_sched_deferred_op(struct mux_inst *chan)
     }
 }
 
+/*
+ * Put a channel on the write list for its priority.  If new_turn is
+ * set, the channel goes to the end and gets its credit for its next
+ * turn.  Otherwise it goes to the front to continue the turn it is
+ * on.
+ */
+static void
+mux_wrlist_add(struct mux_data *muxdata, struct mux_inst *chan,
+	       bool new_turn)
+{
+    struct gensio_list *list = &muxdata->wrchans[chan->priority];
+
+    assert(!chan->in_wrlist);
+    if (new_turn) {
+	chan->deficit += (long) chan->weight * MUX_DRR_QUANTUM;
+	if (chan->max_burst && chan->deficit > (long) chan->max_burst)
+	    chan->deficit = chan->max_burst;
+	gensio_list_add_tail(list, &chan->wrlink);
+    } else {
+	gensio_list_add_head(list, &chan->wrlink);
+    }
+    chan->in_wrlist = true;
+    muxdata->nr_wrchans++;
+}
+
+static void
+mux_wrlist_rm(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    assert(chan->in_wrlist);
+    gensio_list_rm(&muxdata->wrchans[chan->priority], &chan->wrlink);
+    chan->in_wrlist = false;
+    muxdata->nr_wrchans--;
+}
+
+/* Return the channel that should send next, NULL if there is none. */
+static struct mux_inst *
+mux_wrlist_first(struct mux_data *muxdata)
+{
+    unsigned int i;
+
+    if (muxdata->nr_wrchans == 0)
+	return NULL;
+    for (i = MUX_NR_PRIORITIES; i > 0; i--) {
+	if (!gensio_list_empty(&muxdata->wrchans[i - 1]))
+	    return gensio_container_of(
+			gensio_list_first(&muxdata->wrchans[i - 1]),
+			struct mux_inst, wrlink);
+    }
+    assert(0);
+    return NULL;
+}
+
+static void
+mux_sendq_add(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    assert(!chan->in_sendq);
+    gensio_list_add_tail(&muxdata->sendq, &chan->sendlink);
+    chan->in_sendq = true;
+    muxdata->sendq_len++;
+}
+
+static void
+mux_sendq_rm(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    assert(chan->in_sendq);
+    gensio_list_rm(&muxdata->sendq, &chan->sendlink);
+    chan->in_sendq = false;
+    muxdata->sendq_len--;
+}
+
+/* Drop any partially sent messages, the child is gone. */
+static void
+mux_sendq_clear(struct mux_data *muxdata)
+{
+    struct gensio_link *l, *l2;
+    struct mux_inst *chan;
+
+    gensio_list_for_each_safe(&muxdata->sendq, l, l2) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
+	mux_sendq_rm(muxdata, chan);
+	chan->cur_msg_len = 0;
+	chan->sgpos = 0;
+	chan->sglen = 0;
+    }
+}
+
 static void
 muxc_add_to_wrlist(struct mux_inst *chan)
 {
     struct mux_data *muxdata = chan->mux;
 
     if (!chan->wr_ready && !muxdata->err_shutdown) {
-	assert(!chan->in_wrlist);
-	gensio_list_add_tail(&muxdata->wrchans, &chan->wrlink);
+	chan->deficit = 0;
+	mux_wrlist_add(muxdata, chan, true);
 	chan->wr_ready = true;
-	chan->in_wrlist = true;
 	if (muxdata->state != MUX_CLOSED)
 	    gensio_set_write_callback_enable(muxdata->child, true);
     }
 }
 
+/*
+ * If nothing else is waiting to go out, write a data message straight
+ * from the user's buffers.  Only what the child does not take gets
+ * copied into the write buffer, it is then finished like any other
+ * message.  Returns false if the message must be queued normally.
+ */
+static bool
+chan_try_direct_write(struct mux_inst *chan, const struct gensio_sg *sg,
+		      gensiods sglen, unsigned char flags, gensiods len)
+{
+    struct mux_data *muxdata = chan->mux;
+    struct gensio_sg xsg[MUX_MAX_DIRECT_SG + 1];
+    gensiods i, j, left, rcount;
+    unsigned int hdrlen = 8;
+
+    if (muxdata->state != MUX_OPEN || chan->state != MUX_INST_OPEN ||
+		muxdata->sendq_len ||
+		muxdata->xmit_data_len || muxdata->nr_wrchans ||
+		chan->wr_ready || chan->write_data_len ||
+		chan->send_new_channel || chan->send_close || chan->close_sent)
+	return false;
+    /* Same as chan_setup_send_data(), the flags count, too. */
+    if (len + 3 > chan->send_window_size - chan->sent_unacked)
+	return false;
+
+    for (i = 0, j = 1, left = len; left && i < sglen; i++) {
+	if (sg[i].buflen == 0)
+	    continue;
+	if (j > MUX_MAX_DIRECT_SG)
+	    return false;
+	xsg[j].buf = sg[i].buf;
+	xsg[j].buflen = sg[i].buflen;
+	if (xsg[j].buflen > left)
+	    xsg[j].buflen = left;
+	left -= xsg[j].buflen;
+	j++;
+    }
+
+    chan->hdr[0] = (MUX_DATA << 4) | 0x2;
+    chan->hdr[1] = flags;
+    gensio_u16_to_buf(chan->hdr + 2, chan->remote_id);
+    gensio_u32_to_buf(chan->hdr + 4, chan->received_unacked);
+    if (chan->send_window_update) {
+	chan->hdr[0] = (MUX_DATA << 4) | 0x3;
+	gensio_u32_to_buf(chan->hdr + 8, chan->max_read_size);
+	hdrlen = 12;
+    }
+    gensio_u16_to_buf(chan->hdr + hdrlen, len);
+    hdrlen += 2;
+    xsg[0].buf = chan->hdr;
+    xsg[0].buflen = hdrlen;
+
+    if (gensio_write_sg(muxdata->child, &rcount, xsg, j, NULL))
+	/* Queue it, the write ready handler will deal with the error. */
+	return false;
+
+    chan->received_unacked = 0;
+    chan->send_window_update = false;
+    chan->sent_unacked += len + 3;
+    if (rcount >= hdrlen + len)
+	return true;
+
+    /*
+     * The child took part of it, the rest has to go out next.  The
+     * write buffer is empty and has room, the caller checked.
+     */
+    chan->write_data_pos = 0;
+    chan->sglen = 0;
+    if (rcount < hdrlen) {
+	chan->sg[0].buf = chan->hdr + rcount;
+	chan->sg[0].buflen = hdrlen - rcount;
+	chan->sglen = 1;
+	rcount = 0;
+    } else {
+	rcount -= hdrlen;
+    }
+    for (i = 1; i < j; i++) {
+	if (rcount >= xsg[i].buflen) {
+	    rcount -= xsg[i].buflen;
+	    continue;
+	}
+	chan_addwrbuf(chan, ((const unsigned char *) xsg[i].buf) + rcount,
+		      xsg[i].buflen - rcount);
+	rcount = 0;
+    }
+    if (chan->write_data_len) {
+	chan->sg[chan->sglen].buf = chan->write_data;
+	chan->sg[chan->sglen].buflen = chan->write_data_len;
+	chan->sglen++;
+    }
+    chan->cur_msg_len = chan->write_data_len;
+    chan->sgpos = 0;
+    chan->wr_ready = true;
+    mux_sendq_add(muxdata, chan);
+    gensio_set_write_callback_enable(muxdata->child, true);
+    return true;
+}
+
 static int
 muxc_write(struct mux_inst *chan, gensiods *count,
 	   const struct gensio_sg *sg, gensiods sglen,
@@ -1116,7 +1902,8 @@ muxc_write(struct mux_inst *chan, gensiods *count,
     tot_len += 3; /* Add the header. */
 
     mux_lock(muxdata);
-    if (chan->state != MUX_INST_OPEN) {
+    if (chan->state != MUX_INST_OPEN &&
+		!(chan->state == MUX_INST_IN_OPEN && muxdata->early_window)) {
 	mux_unlock(muxdata);
 	return GE_NOTREADY;
     }
@@ -1168,6 +1955,17 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	truncated = true;
     }
 
+    if (tot_len > MUX_MAX_DATA_SIZE + 3) {
+	tot_len = MUX_MAX_DATA_SIZE + 3;
+	truncated = true;
+    }
+
+    if (chan->max_burst && tot_len > chan->max_burst + 3) {
+	/* Keep messages small so other channels get a turn. */
+	tot_len = chan->max_burst + 3;
+	truncated = true;
+    }
+
     if (tot_len > chan->send_window_size / 2) {
 	/* Only allow sends to 1/2 the window size. */
 	tot_len = chan->send_window_size / 2;
@@ -1184,10 +1982,16 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	hdr[0] |= MUX_FLAG_END_OF_MESSAGE;
     if (gensio_str_in_auxdata(auxdata, "oob"))
 	hdr[0] |= MUX_FLAG_OUT_OF_BOUND;
-    gensio_u16_to_buf(hdr + 1, tot_len - 3);
-    chan_addwrbuf(chan, hdr, 3);
     tot_len -= 3;
 
+    if (chan_try_direct_write(chan, sg, sglen, hdr[0], tot_len)) {
+	rcount = tot_len;
+	goto out_unlock;
+    }
+
+    gensio_u16_to_buf(hdr + 1, tot_len);
+    chan_addwrbuf(chan, hdr, 3);
+
     rcount = 0;
     for (i = 0; i < sglen && tot_len; i++) {
 	len = sg[i].buflen;
@@ -1198,7 +2002,13 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	tot_len -= len;
     }
 
-    muxc_add_to_wrlist(chan);
+    /*
+     * If the channel is waiting to send its new channel message, the
+     * data goes after that is sent.
+     */
+    if (!chan->in_open_chan)
+	muxc_add_to_wrlist(chan);
+ out_unlock:
     mux_unlock(muxdata);
 
     if (count)
@@ -1395,65 +2205,56 @@ mux_new_channel(struct mux_data *muxdata, gensio_event cb, void *user_data,
     chan->is_client = is_client;
     chan->max_read_size = muxdata->max_read_size;
     chan->max_write_size = muxdata->max_write_size;
-    chan->read_data = o->zalloc(o, chan->max_read_size);
+    chan->priority = muxdata->priority;
+    chan->weight = muxdata->weight;
+    chan->max_burst = muxdata->max_burst;
+    chan->min_read_size = chan->max_read_size;
+    chan->rcv_window = chan->max_read_size;
+    chan->read_data_fixed = muxdata->fixed_rdbuf;
+    chan->read_data_size = MUX_RDBUF_START_SIZE;
+    if (chan->read_data_fixed || chan->read_data_size > chan->max_read_size)
+	chan->read_data_size = chan->max_read_size;
+    chan->read_data = gensio_os_funcs_buf_zalloc(o, chan->read_data_size);
     if (!chan->read_data)
 	goto out_free;
-    chan->write_data = o->zalloc(o, chan->max_write_size);
+    chan->write_data = gensio_os_funcs_buf_zalloc(o, chan->max_write_size);
     if (!chan->write_data)
 	goto out_free;
 
     /*
-     * We maintain the list in number order and rotate through the
-     * numbers.  So we start after the last number used and rotate
-     * through the entries until we find an empty spot.
+     * We rotate through the numbers, so start after the last number
+     * used and take the first free one.
      */
     if (gensio_list_empty(&muxdata->chans)) {
-	gensio_list_add_tail(&muxdata->chans, &chan->link);
-	/* Note that we do not claim a ref here, there is already one. */
-    } else {
-	struct gensio_link *l, *p = &muxdata->chans.link, *f;
-	struct mux_inst *tchan = NULL;
-
-	/* First find the place at or before where the last number starts. */
-	id = muxdata->last_id;
-	gensio_list_for_each(&muxdata->chans, l) {
-	    tchan = gensio_container_of(l, struct mux_inst, link);
-	    if (tchan->id > id)
-		break;
-	    p = l;
-	}
-
-	id = next_chan_id(muxdata, id);
-	l = gensio_list_next_wrap(&muxdata->chans, p);
-	f = l;
-	do {
-	    tchan = gensio_container_of(l, struct mux_inst, link);
-	    if (id != tchan->id)
-		goto found;
-	    id = next_chan_id(muxdata, id);
-	    p = l;
-	    l = gensio_list_next_wrap(&muxdata->chans, p);
-	} while (f != l);
-	tchan = gensio_container_of(l, struct mux_inst, link);
-	if (id != tchan->id)
-	    goto found;
-
+	id = 0;
+    } else if (!mux_id_map_find(muxdata,
+				next_chan_id(muxdata, muxdata->last_id), &id)) {
 	err = GE_INUSE;
+	goto out_free;
+    }
+    err = mux_chan_table_grow(muxdata, id);
+    if (err)
+	goto out_free;
 
-    out_free:
-	/* Didn't find a free number. */
-	chan_free(chan);
-	return err;
-
-    found:
-	chan->id = id;
+    chan->id = id;
+    mux_id_map_set(muxdata, id);
+    muxdata->chan_table[id] = chan;
+    if (gensio_list_empty(&muxdata->chans)) {
+	/* Note that we do not claim a ref here, there is already one. */
+	gensio_list_add_tail(&muxdata->chans, &chan->link);
+    } else {
 	muxdata->last_id = id;
-	gensio_list_add_next(&muxdata->chans, p, &chan->link);
+	gensio_list_add_tail(&muxdata->chans, &chan->link);
 	mux_ref(muxdata);
     }
+    muxdata->window_total += chan->rcv_window;
 
     *new_mux = chan;
     return 0;
+
+ out_free:
+    chan_free(chan);
+    return err;
 }
 
 static int
@@ -1482,6 +2283,9 @@ muxc_alloc_channel_data(struct mux_data *muxdata,
 	}
 	chan->service_len = data->service_len;
     }
+    chan->priority = data->priority;
+    chan->weight = data->weight;
+    chan->max_burst = data->max_burst;
 
     muxc_set_state(chan, MUX_INST_CLOSED);
 
@@ -1522,6 +2326,34 @@ gensio_mux_config(struct gensio_os_funcs *o,
 	    }
 	    continue;
 	}
+	if (gensio_check_keyuint(args[i], "priority", &data->priority) > 0) {
+	    if (data->priority >= MUX_NR_PRIORITIES) {
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_check_keyuint(args[i], "weight", &data->weight) > 0) {
+	    if (data->weight > MUX_MAX_WEIGHT || data->weight < 1) {
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_check_keyds(args[i], "max_burst", &data->max_burst) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "max_version",
+				 &data->max_version) > 0) {
+	    if (data->max_version > MUX_PROTOCOL_VERSION ||
+			data->max_version < 1) {
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_check_keyds(args[i], "window_budget",
+			       &data->window_budget) > 0)
+	    continue;
 	if (gensio_check_keyvalue(args[i], "service", &str) > 0) {
 	    data->service = gensio_strdup(o, str);
 	    if (!data->service)
@@ -1551,6 +2383,29 @@ gensio_mux_config_cleanup(struct gensio_mux_config *data)
 	o->free(o, data->service);
 }
 
+static int
+get_default_sched(struct gensio_os_funcs *o, struct gensio_mux_config *data)
+{
+    int rv, ival;
+
+    rv = gensio_get_default(o, "mux", "priority", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->priority = ival;
+    rv = gensio_get_default(o, "mux", "weight", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->weight = ival;
+    rv = gensio_get_default(o, "mux", "max-burst", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    data->max_burst = ival;
+    return 0;
+}
+
 /* If the mode is specified in the default, override is_client. */
 static int get_default_mode(struct gensio_os_funcs *o, bool *is_client)
 {
@@ -1597,6 +2452,10 @@ muxc_alloc_channel(struct mux_data *muxdata,
     data.max_read_size = muxdata->max_read_size;
     data.max_write_size = muxdata->max_write_size;
     data.max_channels = muxdata->max_channels;
+    data.max_version = muxdata->max_version;
+    data.priority = muxdata->priority;
+    data.weight = muxdata->weight;
+    data.max_burst = muxdata->max_burst;
     data.is_client = true;
     err = get_default_mode(muxdata->o, &data.is_client);
     if (err)
@@ -1666,6 +2525,17 @@ muxc_reinit(struct mux_inst *chan)
     chan->read_data_len = 0;
     chan->in_read_report = false;
     chan->received_unacked = 0;
+    chan->mux->window_total -= chan->rcv_window - chan->min_read_size;
+    chan->max_read_size = chan->min_read_size;
+    chan->rcv_window = chan->min_read_size;
+    chan->ack_debt = 0;
+    chan->send_window_update = false;
+    chan->rcv_total = 0;
+    chan->rcv_rtt_seq = 0;
+    chan->rcv_rtt = 0;
+    chan->rcv_copied = 0;
+    chan->rcv_space = 0;
+    memset(&chan->rcv_space_time, 0, sizeof(chan->rcv_space_time));
     chan->write_data_pos = 0;
     chan->write_data_len = 0;
     chan->write_ready_enabled = false;
@@ -1687,14 +2557,17 @@ muxc_open(struct mux_inst *chan, gensio_done_err open_done, void *open_data,
 
     mux_lock(muxdata);
     if (muxdata->state == MUX_CLOSED) {
-	muxdata->sending_chan = NULL;
+	mux_sendq_clear(muxdata);
 	muxdata->in_hdr = true;
 	muxdata->hdr_pos = 0;
 	muxdata->hdr_size = 0;
 	muxdata->exit_err = 0;
 	muxdata->err_shutdown = 0;
 	muxdata->do_normal_close = false;
+	muxdata->version = 0;
+	muxdata->early_window = 0;
 	muxc_reinit(chan);
+	chan->send_window_size = 0;
 	if (muxdata->is_client) {
 	    if (!chan->in_open_chan) {
 		gensio_list_add_tail(&chan->mux->openchans, &chan->wrlink);
@@ -1749,6 +2622,8 @@ muxc_open(struct mux_inst *chan, gensio_done_err open_done, void *open_data,
 	chan->open_done = open_done;
 	chan->open_data = open_data;
 	chan->send_new_channel = true;
+	/* Writes are allowed now if the remote end takes early data. */
+	chan->send_window_size = muxdata->early_window;
 	muxc_set_state(chan, MUX_INST_IN_OPEN);
 	err = 0;
     }
@@ -1806,6 +2681,49 @@ muxc_control(struct mux_inst *chan, bool get, int op,
 	    chan->do_oob = !!strtoul(data, NULL, 0);
 	break;
 
+    case GENSIO_CONTROL_MUX_PRIORITY:
+	if (get) {
+	    *datalen = snprintf(data, *datalen, "%u", chan->priority);
+	} else {
+	    unsigned long val = strtoul(data, NULL, 0);
+
+	    if (val >= MUX_NR_PRIORITIES) {
+		err = GE_INVAL;
+		goto out;
+	    }
+	    if (chan->in_wrlist) {
+		/* Move it to the list for the new priority. */
+		mux_wrlist_rm(muxdata, chan);
+		chan->priority = val;
+		mux_wrlist_add(muxdata, chan, false);
+	    } else {
+		chan->priority = val;
+	    }
+	}
+	break;
+
+    case GENSIO_CONTROL_MUX_WEIGHT:
+	if (get) {
+	    *datalen = snprintf(data, *datalen, "%u", chan->weight);
+	} else {
+	    unsigned long val = strtoul(data, NULL, 0);
+
+	    if (val < 1 || val > MUX_MAX_WEIGHT) {
+		err = GE_INVAL;
+		goto out;
+	    }
+	    chan->weight = val;
+	}
+	break;
+
+    case GENSIO_CONTROL_MUX_MAX_BURST:
+	if (get)
+	    *datalen = snprintf(data, *datalen, "%lu",
+				(unsigned long) chan->max_burst);
+	else
+	    chan->max_burst = strtoul(data, NULL, 0);
+	break;
+
     default:
 	err = GE_NOTSUP;
 	break;
@@ -1869,6 +2787,7 @@ mux_shutdown_channels(struct mux_data *muxdata, int err)
     struct mux_inst *chan;
 
     muxdata->err_shutdown = true;
+    mux_sendq_clear(muxdata);
 
     mux_set_state(muxdata, MUX_CLOSED);
     if (muxdata->acc_open_done &&
@@ -1887,11 +2806,13 @@ mux_shutdown_channels(struct mux_data *muxdata, int err)
 
     gensio_list_for_each_safe(&muxdata->chans, l, l2) {
 	chan = gensio_container_of(l, struct mux_inst, link);
-	if (chan->in_wrlist) {
-	    gensio_list_rm(&muxdata->wrchans, &chan->wrlink);
-	    chan->in_wrlist = false;
-	}
+	if (chan->in_wrlist)
+	    mux_wrlist_rm(muxdata, chan);
 	chan->wr_ready = false;
+	if (chan->in_acklist) {
+	    gensio_list_rm(&muxdata->ackchans, &chan->acklink);
+	    chan->in_acklist = false;
+	}
 	if (chan->in_open_chan) {
 	    gensio_list_rm(&muxdata->openchans, &chan->wrlink);
 	    chan->in_open_chan = false;
@@ -1970,24 +2891,31 @@ chan_setup_send_data(struct mux_inst *chan)
     unsigned char flags = 0;
     gensiods pos;
     gensiods window_left = chan->send_window_size - chan->sent_unacked;
+    unsigned int hdrlen = 8;
 
     assert(chan->sglen == 0);
     chan->hdr[0] = (MUX_DATA << 4) | 0x2;
     chan->hdr[1] = 0;
     gensio_u16_to_buf(chan->hdr + 2, chan->remote_id);
     gensio_u32_to_buf(chan->hdr + 4, chan->received_unacked);
+    if (chan->send_window_update) {
+	chan->hdr[0] = (MUX_DATA << 4) | 0x3;
+	gensio_u32_to_buf(chan->hdr + 8, chan->max_read_size);
+	hdrlen = 12;
+    }
 
     chan->sg[0].buf = chan->hdr;
-    chan->sg[0].buflen = 8;
+    chan->sg[0].buflen = hdrlen;
 
     if (chan->write_data_len == 0) {
     check_send_ack:
-	if (chan->received_unacked == 0)
+	if (chan->received_unacked == 0 && !chan->send_window_update)
 	    return false;
 	chan->received_unacked = 0;
+	chan->send_window_update = false;
 	/* Just sending an ack. */
-	gensio_u16_to_buf(chan->hdr + 8, 0);
-	chan->sg[0].buflen = 10;
+	gensio_u16_to_buf(chan->hdr + hdrlen, 0);
+	chan->sg[0].buflen = hdrlen + 2;
 	chan->sglen = 1;
 	return true;
     }
@@ -2007,9 +2935,16 @@ chan_setup_send_data(struct mux_inst *chan)
     }
 
     chan->received_unacked = 0;
+    chan->send_window_update = false;
 
     flags = chan->write_data[chan->write_data_pos];
     chan_incr_write_pos(chan, 1);
+    if (chan->state == MUX_INST_IN_OPEN ||
+		chan->state == MUX_INST_IN_OPEN_CLOSE) {
+	/* No new channel response yet, send it as early data. */
+	flags |= MUX_FLAG_EARLY_DATA;
+	gensio_u16_to_buf(chan->hdr + 2, chan->id);
+    }
     chan->hdr[1] = flags;
     chan->sent_unacked++; /* Flags is stored as delivered data on remote end. */
 
@@ -2043,30 +2978,70 @@ mux_on_err_close(struct gensio *child, void *close_data)
     mux_deref_and_unlock(muxdata); /* Lose the open ref. */
 }
 
+/* A channel's message has been completely written to the child. */
+static void
+chan_msg_sent(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    mux_sendq_rm(muxdata, chan);
+    chan->write_data_pos = chan_next_write_pos(chan, chan->cur_msg_len);
+    chan->write_data_len -= chan->cur_msg_len;
+    chan->deficit -= chan->cur_msg_len;
+    chan->cur_msg_len = 0;
+    chan->sgpos = 0;
+    chan->sglen = 0;
+    if (chan->write_data_len > 0 || chan->send_new_channel ||
+		chan->send_close) {
+	/*
+	 * More messages to send.  Keep going if it has credit
+	 * left, otherwise go to the tail for fairness.
+	 */
+	mux_wrlist_add(muxdata, chan, chan->deficit <= 0);
+    } else {
+	chan->wr_ready = false;
+	/*
+	 * Data may have been consumed or the window grown while
+	 * this was sending, adding to the write list did
+	 * nothing then.
+	 */
+	if (chan->send_window_update && !chan->close_sent)
+	    muxc_add_to_wrlist(chan);
+	else if (chan->received_unacked && !chan->close_sent &&
+		 !chan_delay_ack(chan))
+	    muxc_add_to_wrlist(chan);
+    }
+    /*
+     * Maybe the user can write.  Also, if a close is pending,
+     * handle it there, too.
+     */
+    chan_sched_deferred_op(chan);
+}
+
+/*
+ * Write the messages on the send queue to the child in one call.
+ * Only the first one can be partially written afterwards.
+ */
 static int
-mux_child_write_ready(struct mux_data *muxdata)
+mux_write_sendq(struct mux_data *muxdata)
 {
-    int err = 0;
+    struct gensio_sg sg[MUX_MAX_BATCH * 3];
+    struct gensio_link *l, *l2;
     struct mux_inst *chan;
+    unsigned int sglen = 0, i;
     gensiods rcount;
+    int err;
 
-    mux_lock_and_ref(muxdata);
-    if (muxdata->state == MUX_IN_CLOSE || muxdata->state == MUX_CLOSED) {
-	gensio_set_read_callback_enable(muxdata->child, false);
-	gensio_set_write_callback_enable(muxdata->child, false);
-	mux_deref_and_unlock(muxdata);
-	return 0;
+    gensio_list_for_each(&muxdata->sendq, l) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
+	assert(chan->sglen > 0 && chan->sgpos < chan->sglen);
+	for (i = chan->sgpos; i < chan->sglen; i++)
+	    sg[sglen++] = chan->sg[i];
     }
+    err = gensio_write_sg(muxdata->child, &rcount, sg, sglen, NULL);
+    if (err)
+	return err;
 
-    /* Finish any pending channel data. */
-    if (muxdata->sending_chan) {
-	chan = muxdata->sending_chan;
-    next_channel:
-	assert(chan->sglen > 0 && chan->sgpos < chan->sglen);
-	err = gensio_write_sg(muxdata->child, &rcount, chan->sg + chan->sgpos,
-			      chan->sglen - chan->sgpos, NULL);
-	if (err)
-	    goto out_write_err;
+    gensio_list_for_each_safe(&muxdata->sendq, l, l2) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
 	while (rcount > 0 && chan->sgpos < chan->sglen) {
 	    if (chan->sg[chan->sgpos].buflen <= rcount) {
 		rcount -= chan->sg[chan->sgpos].buflen;
@@ -2079,31 +3054,37 @@ mux_child_write_ready(struct mux_data *muxdata)
 		rcount = 0;
 	    }
 	}
-	if (chan->sgpos >= chan->sglen) {
-	    /* Finished sending one message. */
-	    chan->write_data_pos = chan_next_write_pos(chan, chan->cur_msg_len);
-	    chan->write_data_len -= chan->cur_msg_len;
-	    chan->cur_msg_len = 0;
-	    chan->sgpos = 0;
-	    chan->sglen = 0;
-	    muxdata->sending_chan = NULL;
-	    if (chan->write_data_len > 0 || chan->send_new_channel ||
-			chan->send_close) {
-		/* More messages to send, add it to the tail for fairness. */
-		gensio_list_add_tail(&muxdata->wrchans, &chan->wrlink);
-		chan->in_wrlist = true;
-	    } else {
-		chan->wr_ready = false;
-	    }
-	    /*
-	     * Maybe the user can write.  Also, if a close is pending,
-	     * handle it there, too.
-	     */
-	    chan_sched_deferred_op(chan);
-	} else {
+	if (chan->sgpos < chan->sglen)
+	    break;
+	chan_msg_sent(muxdata, chan);
+    }
+    return 0;
+}
+
+static int
+mux_child_write_ready(struct mux_data *muxdata)
+{
+    int err = 0;
+    struct mux_inst *chan;
+    gensiods rcount;
+
+    mux_lock_and_ref(muxdata);
+    if (muxdata->state == MUX_IN_CLOSE || muxdata->state == MUX_CLOSED) {
+	gensio_set_read_callback_enable(muxdata->child, false);
+	gensio_set_write_callback_enable(muxdata->child, false);
+	mux_deref_and_unlock(muxdata);
+	return 0;
+    }
+
+    /* Finish any pending channel data. */
+    if (!gensio_list_empty(&muxdata->sendq)) {
+    write_sendq:
+	err = mux_write_sendq(muxdata);
+	if (err)
+	    goto out_write_err;
+	if (!gensio_list_empty(&muxdata->sendq))
 	    /* Couldn't send all the data. */
 	    goto out;
-	}
     }
 
     /* Handle data not associated with an existing channel. */
@@ -2128,19 +3109,21 @@ mux_child_write_ready(struct mux_data *muxdata)
 
     /* Now look for a new channel to send. */
  check_next_channel:
-    if (!gensio_list_empty(&muxdata->wrchans)) {
-	assert(muxdata->sending_chan == NULL);
-	chan = gensio_container_of(gensio_list_first(&muxdata->wrchans),
-				   struct mux_inst, wrlink);
-	gensio_list_rm(&muxdata->wrchans, &chan->wrlink);
-	chan->in_wrlist = false;
+    chan = mux_wrlist_first(muxdata);
+    if (chan && muxdata->sendq_len < MUX_MAX_BATCH) {
+	mux_wrlist_rm(muxdata, chan);
+
+	if (chan->deficit <= 0) {
+	    /* Used up its credit sending a big message, wait a turn. */
+	    mux_wrlist_add(muxdata, chan, true);
+	    goto check_next_channel;
+	}
 
 	if (chan->send_new_channel) {
 	    chan_setup_send_new_channel(chan);
 	    chan->send_new_channel = false;
-	    muxdata->sending_chan = chan;
-	} else if ((chan->write_data_len || chan->received_unacked) &&
-		   !chan->close_sent) {
+	} else if ((chan->write_data_len || chan->received_unacked ||
+		    chan->send_window_update) && !chan->close_sent) {
 	    /*
 	     * Send a data packet, either for data delivery or an ack.
 	     * Once we send a close, we cannot send any more data,
@@ -2150,7 +3133,6 @@ mux_child_write_ready(struct mux_data *muxdata)
 		chan->wr_ready = false;
 		goto check_next_channel;
 	    }
-	    muxdata->sending_chan = chan;
 	} else if (chan->send_close &&
 		   (chan->read_data_len == 0 ||
 		    chan->state == MUX_INST_IN_CLOSE ||
@@ -2166,16 +3148,18 @@ mux_child_write_ready(struct mux_data *muxdata)
 	    chan_send_close(chan);
 	    chan->send_close = false;
 	    chan->close_sent = true;
-	    muxdata->sending_chan = chan;
 	} else {
 	    chan->wr_ready = false;
 	    goto check_next_channel;
 	}
-	goto next_channel;
+	mux_sendq_add(muxdata, chan);
+	goto check_next_channel;
     }
+    if (!gensio_list_empty(&muxdata->sendq))
+	goto write_sendq;
  out:
     gensio_set_write_callback_enable(muxdata->child,
-		muxdata->sending_chan || !gensio_list_empty(&muxdata->wrchans));
+		!gensio_list_empty(&muxdata->sendq) || muxdata->nr_wrchans > 0);
     mux_deref_and_unlock(muxdata);
     return 0;
 
@@ -2192,21 +3176,36 @@ mux_child_write_ready(struct mux_data *muxdata)
     return 0;
 }
 
+/*
+ * Find the channel early data is for, the id is the remote end's
+ * id for the channel.  Only channels that were accepted can take it.
+ */
 static struct mux_inst *
-mux_get_channel(struct mux_data *muxdata)
+mux_find_early_chan(struct mux_data *muxdata, unsigned int id)
 {
     struct gensio_link *l;
-    unsigned int id = gensio_buf_to_u16(muxdata->hdr + 2);
 
     gensio_list_for_each(&muxdata->chans, l) {
 	struct mux_inst *chan = gensio_container_of(l, struct mux_inst, link);
 
-	if (chan->id == id)
+	if (chan->remote_id == id &&
+		(chan->state == MUX_INST_OPEN ||
+		 chan->state == MUX_INST_IN_CLOSE))
 	    return chan;
     }
     return NULL;
 }
 
+static struct mux_inst *
+mux_get_channel(struct mux_data *muxdata)
+{
+    unsigned int id = gensio_buf_to_u16(muxdata->hdr + 2);
+
+    if (id >= muxdata->chan_table_size)
+	return NULL;
+    return muxdata->chan_table[id];
+}
+
 static bool
 mux_find_remote_id(struct mux_data *muxdata, unsigned int id)
 {
@@ -2294,10 +3293,22 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 	    muxdata->hdr_pos = 0;
 
 	    if (muxdata->msgid == MUX_INIT) {
+		struct gensio_link *rl;
+
 		if (muxdata->state != MUX_UNINITIALIZED) {
 		    proto_err_str = "Init when already initialized";
 		    goto protocol_err;
 		}
+		muxdata->version = muxdata->hdr[2];
+		if (muxdata->version > muxdata->max_version)
+		    muxdata->version = muxdata->max_version;
+		muxdata->early_window = 0;
+		if (muxdata->version >= 4 && muxdata->hdr_size >= 8)
+		    muxdata->early_window = gensio_buf_to_u32(muxdata->hdr + 4);
+		gensio_list_for_each(&muxdata->openchans, rl) {
+		    chan = gensio_container_of(rl, struct mux_inst, wrlink);
+		    chan->send_window_size = muxdata->early_window;
+		}
 		if (gensio_list_empty(&muxdata->openchans)) {
 		    mux_set_state(muxdata, MUX_WAITING_OPEN);
 		    goto more_data;
@@ -2378,7 +3389,6 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    goto protocol_err;
 		}
 		chan->errcode = gensio_buf_to_u16(muxdata->hdr + 10);
-		muxdata->sending_chan = NULL;
 
 		assert(muxdata->opencount > 0);
 		muxdata->opencount--;
@@ -2386,6 +3396,19 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		if (chan->errcode) {
 		    enum mux_inst_state old_state = chan->state;
 
+		    /*
+		     * Early data was dropped by the remote end, drop
+		     * the rest of it here.  A message being sent has
+		     * to finish.
+		     */
+		    if (chan->in_wrlist)
+			mux_wrlist_rm(muxdata, chan);
+		    if (chan->in_sendq) {
+			chan->write_data_len = chan->cur_msg_len;
+		    } else {
+			chan->write_data_len = 0;
+			chan->wr_ready = false;
+		    }
 		    muxc_set_state(chan, MUX_INST_CLOSED);
 		    mux_call_open_done(muxdata, chan, chan->errcode);
 		    if (old_state == MUX_INST_IN_OPEN_CLOSE)
@@ -2454,7 +3477,20 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		break;
 
 	    case MUX_DATA:
-		chan = mux_get_channel(muxdata);
+		if (muxdata->hdr[1] & MUX_FLAG_EARLY_DATA) {
+		    muxdata->hdr[1] &= ~MUX_FLAG_EARLY_DATA;
+		    chan = mux_find_early_chan(muxdata,
+					gensio_buf_to_u16(muxdata->hdr + 2));
+		    if (!chan) {
+			/* The channel was refused, drop the data. */
+			muxdata->curr_chan = NULL;
+			muxdata->data_pos = 0;
+			muxdata->in_hdr = false;
+			break;
+		    }
+		} else {
+		    chan = mux_get_channel(muxdata);
+		}
 		if (!chan) {
 		    proto_err_str = "No channel on data";
 		    goto protocol_err;
@@ -2475,6 +3511,16 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		chan->sent_unacked -= acked;
 		if (acked > 0 && chan->write_data_len)
 		    muxc_add_to_wrlist(chan);
+		if (muxdata->hdr_size >= 12) {
+		    /* Window update, it can only get bigger. */
+		    unsigned int window = gensio_buf_to_u32(muxdata->hdr + 8);
+
+		    if (window > chan->send_window_size) {
+			chan->send_window_size = window;
+			if (chan->write_data_len)
+			    muxc_add_to_wrlist(chan);
+		    }
+		}
 		muxdata->curr_chan = chan;
 		muxdata->data_pos = 0;
 		muxdata->in_hdr = false; /* Receive the data */
@@ -2522,13 +3568,28 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    break;
 
 		case MUX_DATA:
-		    assert(chan);
+		    if (!chan) {
+			/* Dropping early data. */
+			if (muxdata->data_size == 0)
+			    muxdata->in_hdr = true;
+			break;
+		    }
 		    if (muxdata->data_size == 0)
 			goto handle_read_no_data;
 		    if (chan_rdbufleft(chan) < muxdata->data_size + 3) {
 			proto_err_str = "Too much data from remote end";
 			goto protocol_err;
 		    }
+		    if (chan_rdbuf_make_room(chan, muxdata->data_size + 3)) {
+			ierr = GE_NOMEM;
+			goto out_err;
+		    }
+		    if (chan->read_data_len + muxdata->data_size + 3 >
+				chan->read_data_peak)
+			chan->read_data_peak = (chan->read_data_len +
+						muxdata->data_size + 3);
+		    if (chan_rcv_tuning(chan))
+			chan_rcv_rtt_measure(chan, muxdata->data_size + 3);
 		    /* Add the message flags first. */
 		    chan_addrdbyte(chan, muxdata->hdr[1]);
 		    chan_addrdbyte(chan, muxdata->data_size >> 8);
@@ -2641,7 +3702,17 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		goto more_data;
 
 	    case MUX_DATA:
-		assert(chan);
+		if (!chan) {
+		    /* Dropping early data. */
+		    if (buflen + muxdata->data_pos < muxdata->data_size + 2) {
+			muxdata->data_pos += buflen;
+			processed += buflen;
+			goto out_unlock;
+		    }
+		    used = muxdata->data_size + 2 - muxdata->data_pos;
+		    muxdata->in_hdr = true;
+		    goto more_data;
+		}
 		if (buflen + muxdata->data_pos < muxdata->data_size + 2) {
 		    /* Not all data received yet. */
 		    chan_addrdbuf(chan, buf, buflen);
@@ -2730,6 +3801,7 @@ mux_gensio_alloc_data(struct gensio *child, struct gensio_mux_config *data,
 {
     struct gensio_os_funcs *o = data->o;
     struct mux_data *muxdata;
+    unsigned int i;
     int rv;
 
     if (data->max_write_size < MUX_MIN_SEND_WINDOW_SIZE ||
@@ -2749,12 +3821,26 @@ mux_gensio_alloc_data(struct gensio *child, struct gensio_mux_config *data,
     muxdata->max_write_size = data->max_write_size;
     muxdata->max_read_size = data->max_read_size;
     muxdata->max_channels = data->max_channels;
+    muxdata->max_version = data->max_version;
+    muxdata->window_budget = data->window_budget;
+    muxdata->priority = data->priority;
+    muxdata->weight = data->weight;
+    muxdata->max_burst = data->max_burst;
+    muxdata->fixed_rdbuf = gensio_os_funcs_is_realtime(o);
     gensio_list_init(&muxdata->chans);
     gensio_list_init(&muxdata->openchans);
-    gensio_list_init(&muxdata->wrchans);
+    gensio_list_init(&muxdata->ackchans);
+    gensio_list_init(&muxdata->sendq);
+    for (i = 0; i < MUX_NR_PRIORITIES; i++)
+	gensio_list_init(&muxdata->wrchans[i]);
+    if (mux_id_map_alloc(muxdata))
+	goto out_nomem;
     muxdata->lock = o->alloc_lock(o);
     if (!muxdata->lock)
 	goto out_nomem;
+    muxdata->ack_timer = o->alloc_timer(o, mux_ack_timeout, muxdata);
+    if (!muxdata->ack_timer)
+	goto out_nomem;
     gensio_set_callback(child, mux_child_cb, muxdata);
 
     /* Set up to send the init message. */
@@ -2771,10 +3857,17 @@ mux_gensio_alloc_data(struct gensio *child, struct gensio_mux_config *data,
     return 0;
 
  out_nomem:
-    if (!gensio_list_empty(&muxdata->chans))
+    if (!gensio_list_empty(&muxdata->chans)) {
+	/* Channel 0 holds the only reference, this frees muxdata. */
 	chan_deref(gensio_container_of(
 				gensio_list_first(&muxdata->chans),
 				struct mux_inst, link));
+	return GE_NOMEM;
+    }
+    if (muxdata->id_map)
+	o->free(o, muxdata->id_map);
+    if (muxdata->ack_timer)
+	o->free_timer(muxdata->ack_timer);
     if (muxdata->lock)
 	o->free_lock(muxdata->lock);
     o->free(o, muxdata);
@@ -2801,11 +3894,20 @@ mux_gensio_alloc(struct gensio *child, const char *const args[],
     data.max_read_size = GENSIO_DEFAULT_BUF_SIZE * 16;
     data.max_write_size = GENSIO_DEFAULT_BUF_SIZE * 2;
     data.max_channels = 1000;
+    data.max_version = MUX_PROTOCOL_VERSION;
     err = gensio_get_default(o, "mux", "max-channels", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
     if (err)
 	return err;
     data.max_channels = ival;
+    err = gensio_get_default(o, "mux", "window-budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    data.window_budget = ival;
+    err = get_default_sched(o, &data);
+    if (err)
+	return err;
     data.is_client = true;
     err = get_default_mode(o, &data.is_client);
     if (err)
@@ -2945,6 +4047,7 @@ mux_gensio_accepter_alloc(struct gensio_accepter *child,
     nadata->data.max_read_size = GENSIO_DEFAULT_BUF_SIZE;
     nadata->data.max_write_size = GENSIO_DEFAULT_BUF_SIZE;
     nadata->data.max_channels = 1000;
+    nadata->data.max_version = MUX_PROTOCOL_VERSION;
     err = gensio_get_default(o, "mux", "max-channels", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
     if (err) {
@@ -2952,6 +4055,18 @@ mux_gensio_accepter_alloc(struct gensio_accepter *child,
 	return err;
     }
     nadata->data.max_channels = ival;
+    err = gensio_get_default(o, "mux", "window-budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err) {
+	o->free(o, nadata);
+	return err;
+    }
+    nadata->data.window_budget = ival;
+    err = get_default_sched(o, &nadata->data);
+    if (err) {
+	o->free(o, nadata);
+	return err;
+    }
     nadata->data.is_client = false;
     err = get_default_mode(o, &nadata->data.is_client);
     if (err) {
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #if HAVE_UNIX
 #include <sys/un.h>
@@ -29,11 +30,34 @@
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_ll_fd.h>
+#include <gensio/gensio_list.h>
 #include <gensio/argvutils.h>
 #include <gensio/gensio_osops.h>
+#include <gensio/gensio_time.h>
 
 #include "gensio_net.h"
 
+struct net_data;
+
+/* A connect to another address racing the main one, see below. */
+struct net_race {
+    struct gensio_link link;
+    struct net_data *tdata;
+    struct gensio_iod *iod;
+    unsigned int idx; /* The address index it is connecting to. */
+};
+
+/*
+ * Zero-copy sends go out of this many buffers of this size, a write
+ * that finds them all in use is just copied into the kernel.
+ */
+#define NET_ZC_NUM_BUFS		4
+#define NET_ZC_BUF_SIZE		262144
+
+/* Poll for completions on close this often, and this many times. */
+#define NET_ZC_CLOSE_POLL_NSECS	10000000
+#define NET_ZC_CLOSE_TRIES	500
+
 struct net_data {
     struct gensio_os_funcs *o;
 
@@ -41,31 +65,482 @@ struct net_data {
 
     struct gensio_addr *ai; /* Iterater points to the remote. */
     struct gensio_addr *lai; /* Local address, NULL if not set. */
+    unsigned int ai_idx; /* The position in the try order ai points to. */
+    unsigned int nr_ai;
+
+    /*
+     * Try the address that last connected first and the ones that
+     * failed last, see net_affinity_order().  ai_order maps a
+     * position in the try order to the index in ai, it is NULL if the
+     * addresses are tried in their normal order.
+     */
+    bool affinity;
+    unsigned int *ai_order;
 
     bool nodelay;
 
+    /* Try TCP fast open when connecting. */
+    bool tfo;
+
+    /* Socket busy poll time in usecs (SO_BUSY_POLL), TCP only. */
+    unsigned int busy_poll;
+
+    /*
+     * Staggered connects (RFC 8305 "happy eyeballs"), TCP only.  If
+     * a connect hasn't finished after race_delay, the next address is
+     * tried too, and so on, and the first one to connect wins.  An
+     * address that fails starts the next one right away.  The connect
+     * the fd ll is watching is race_primary, the others are in races.
+     * A winner from races has its handlers cleared, then the fd ll is
+     * told to check the open again and retry_open hands the winner
+     * over.  race_lock protects these; race_refs counts the timer and
+     * the race entries, tdata is not freed until they are gone.
+     */
+    gensio_time race_delay;
+    struct gensio_lock *race_lock;
+    struct gensio_timer *race_timer;
+    bool race_timer_running;
+    bool racing;
+    struct gensio_list races;
+    struct net_race *race_winner;
+    bool race_winner_ready;
+    struct gensio_iod *race_primary;
+    unsigned int race_primary_idx;
+    bool race_primary_failed;
+    unsigned int race_next; /* The next address index to try. */
+    unsigned int race_refs;
+    bool freed;
+
     bool istcp;
 
     int last_err;
 
     bool do_oob;
     int oob_char;
+
+    /*
+     * Zero-copy sends, TCP only.  Writes of at least zerocopy bytes
+     * are sent with GENSIO_MSG_ZEROCOPY, zc_on is set if the socket
+     * allows it.  The user gets its buffer back as soon as the write
+     * returns, so the data is sent from zc_bufs, which the kernel
+     * holds until it reports the send complete.  zc_bufs is a ring,
+     * zc_outstanding buffers starting at zc_first are in use, and
+     * TCP completes sends in order.  zc_lock protects these, the
+     * write and the except handler can run at the same time.
+     */
+    gensiods zerocopy;
+    bool zc_on;
+    struct gensio_lock *zc_lock;
+    unsigned char *zc_bufs[NET_ZC_NUM_BUFS];
+    unsigned int zc_first;
+    unsigned int zc_outstanding;
+    unsigned int zc_close_tries;
+
+    /*
+     * Kernel timestamps, TCP only, GENSIO_TSTAMP_xxx flags.  With
+     * receive timestamps the reads are done here to get them, and
+     * rxaux points to the strings for the last read.  Transmit
+     * timestamps are collected into the txts ring by the except
+     * handler, txts_pos is the oldest of txts_count entries.
+     * ts_lock protects the ring.
+     */
+    unsigned int tstamp;
+    char rxts[40];
+    char rxhwts[40];
+    const char *rxaux[3];
+    struct gensio_lock *ts_lock;
+    struct gensio_tx_tstamp *txts;
+    unsigned int txts_pos;
+    unsigned int txts_count;
+
+    /*
+     * Descriptor passing, unix only.  The reads are done here to
+     * accept descriptors sent with SCM_RIGHTS, a read that brings
+     * some in has "fd" auxdata.  They are held on the socket until
+     * taken with GENSIO_CONTROL_RECV_FD.
+     */
+    bool passfd;
+
+    /*
+     * A sockfd gensio is built on a socket that is already connected.
+     * It is handed to the ll on the first open; if the gensio is
+     * freed before that, it is closed here.
+     */
+    bool from_fd;
+    struct gensio_iod *fd_iod;
 };
 
+
+/* Fast open connections allowed to wait on a handshake, per socket. */
+#define NET_TFO_QUEUE_LEN	64
+
+/* Transmit timestamps held for GENSIO_CONTROL_TX_TSTAMP, oldest dropped. */
+#define NET_MAX_TX_TSTAMPS	64
+
+#define NET_TSTAMP_RX (GENSIO_TSTAMP_RX_SW | GENSIO_TSTAMP_RX_HW)
+#define NET_TSTAMP_TX (GENSIO_TSTAMP_TX_SW | GENSIO_TSTAMP_TX_HW)
+
+static int net_race_check_open(struct net_data *tdata,
+			       struct gensio_iod *iod);
+
+static void net_affinity_note(struct net_data *tdata, bool ok);
+
+static void net_setup_tstamp(struct net_data *tdata, struct gensio_iod *iod);
+
 static int net_check_open(void *handler_data, struct gensio_iod *iod)
 {
     struct net_data *tdata = handler_data;
+    int err;
+
+    if (tdata->race_lock) {
+	err = net_race_check_open(tdata, iod);
+    } else {
+	err = tdata->o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN,
+				     NULL, NULL);
+	tdata->last_err = err;
+	net_affinity_note(tdata, !err);
+    }
+    if (!err)
+	/* Transmit timestamp ids can only be set up once connected. */
+	net_setup_tstamp(tdata, iod);
+    return err;
+}
+
+static void
+net_setup_zerocopy(struct net_data *tdata, struct gensio_iod *iod)
+{
+    tdata->zc_on = false;
+    tdata->zc_first = 0;
+    tdata->zc_outstanding = 0;
+    tdata->zc_close_tries = 0;
+    if (!tdata->zc_lock)
+	return;
+    /* If it's not supported, just do normal writes. */
+    if (!tdata->o->sock_control(iod, GENSIO_SOCKCTL_SET_ZEROCOPY, NULL, NULL))
+	tdata->zc_on = true;
+}
 
-    tdata->last_err = tdata->o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN,
-					     NULL, NULL);
-    return tdata->last_err;
+/*
+ * Allocate what timestamps need.  The timestamps are turned on in
+ * net_setup_tstamp() when the socket is there.
+ */
+static int
+net_alloc_tstamp(struct net_data *tdata, unsigned int tstamp)
+{
+    struct gensio_os_funcs *o = tdata->o;
+
+    tdata->tstamp = tstamp;
+    if (!(tstamp & NET_TSTAMP_TX))
+	return 0;
+    tdata->ts_lock = o->alloc_lock(o);
+    if (!tdata->ts_lock)
+	return GE_NOMEM;
+    tdata->txts = o->zalloc(o, sizeof(*tdata->txts) * NET_MAX_TX_TSTAMPS);
+    if (!tdata->txts)
+	return GE_NOMEM;
+    return 0;
 }
 
+static void
+net_setup_tstamp(struct net_data *tdata, struct gensio_iod *iod)
+{
+    unsigned int tstamp = tdata->tstamp;
+    gensiods size = sizeof(tstamp);
+
+    /* If it's not supported, there are just no timestamps. */
+    if (tstamp)
+	tdata->o->sock_control(iod, GENSIO_SOCKCTL_SET_TIMESTAMPING,
+			       &tstamp, &size);
+}
+
+/* Move transmit timestamps from the socket to the txts ring. */
+static void
+net_tstamp_reap(struct net_data *tdata, struct gensio_iod *iod)
+{
+    struct gensio_tx_tstamp ts[16];
+    gensiods i, count;
+
+    tdata->o->lock(tdata->ts_lock);
+    do {
+	count = 16;
+	if (tdata->o->sock_control(iod, GENSIO_SOCKCTL_TSTAMP_REAP,
+				   ts, &count))
+	    break;
+	for (i = 0; i < count; i++) {
+	    if (tdata->txts_count == NET_MAX_TX_TSTAMPS) {
+		tdata->txts_pos = (tdata->txts_pos + 1) % NET_MAX_TX_TSTAMPS;
+		tdata->txts_count--;
+	    }
+	    tdata->txts[(tdata->txts_pos + tdata->txts_count) %
+			NET_MAX_TX_TSTAMPS] = ts[i];
+	    tdata->txts_count++;
+	}
+    } while (count == 16);
+    tdata->o->unlock(tdata->ts_lock);
+}
+
+/* Call with zc_lock held.  Returns true if all sends are done. */
+static bool
+net_zc_reap(struct net_data *tdata, struct gensio_iod *iod)
+{
+    unsigned int count = 0;
+    gensiods size = sizeof(count);
+
+    if (tdata->zc_outstanding &&
+	    !tdata->o->sock_control(iod, GENSIO_SOCKCTL_ZEROCOPY_REAP,
+				    &count, &size)) {
+	if (count > tdata->zc_outstanding)
+	    count = tdata->zc_outstanding;
+	tdata->zc_first = (tdata->zc_first + count) % NET_ZC_NUM_BUFS;
+	tdata->zc_outstanding -= count;
+    }
+    return tdata->zc_outstanding == 0;
+}
+
+/*
+ * Wait a while for outstanding zero-copy sends before closing the
+ * socket so the data going out doesn't change under the kernel.
+ */
 static int
-net_try_open(struct net_data *tdata, struct gensio_iod **iod)
+net_zc_check_close(struct net_data *tdata, struct gensio_iod *iod,
+		   gensio_time *timeout)
+{
+    bool done;
+
+    if (!tdata->zc_lock)
+	return 0;
+
+    tdata->o->lock(tdata->zc_lock);
+    done = net_zc_reap(tdata, iod);
+    tdata->o->unlock(tdata->zc_lock);
+    if (done || tdata->zc_close_tries++ >= NET_ZC_CLOSE_TRIES)
+	return 0;
+    timeout->secs = 0;
+    timeout->nsecs = NET_ZC_CLOSE_POLL_NSECS;
+    return GE_INPROGRESS;
+}
+
+/*
+ * A process-wide record of how connects to each remote address went,
+ * so a name with several addresses tries the one that connected last
+ * first, and the ones that failed last, instead of waiting on a dead
+ * address on every reconnect.  Entries are keyed on the address
+ * string, which includes the port, and expire after NET_AFFINITY_TTL
+ * seconds so a failed address eventually gets its normal place back.
+ */
+#define NET_AFFINITY_MAX	64
+#define NET_AFFINITY_TTL	600
+#define NET_AFFINITY_ADDRLEN	80
+
+struct net_affinity_ent {
+    struct net_affinity_ent *next;
+    char addr[NET_AFFINITY_ADDRLEN];
+    bool ok;
+    gensio_time when;
+};
+
+static struct gensio_once net_affinity_once;
+static struct gensio_os_funcs *net_affinity_o;
+static struct gensio_lock *net_affinity_lock;
+static struct net_affinity_ent *net_affinity;
+static unsigned int net_affinity_len;
+
+static void
+net_affinity_cleanup(void)
+{
+    struct net_affinity_ent *e;
+
+    while (net_affinity) {
+	e = net_affinity;
+	net_affinity = e->next;
+	net_affinity_o->free(net_affinity_o, e);
+    }
+    net_affinity_len = 0;
+    if (net_affinity_lock)
+	net_affinity_o->free_lock(net_affinity_lock);
+    net_affinity_lock = NULL;
+    memset(&net_affinity_once, 0, sizeof(net_affinity_once));
+}
+
+static struct gensio_class_cleanup net_affinity_cleanup_data = {
+    net_affinity_cleanup
+};
+
+static void
+net_affinity_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    net_affinity_o = o;
+    net_affinity_lock = o->alloc_lock(o);
+    if (net_affinity_lock)
+	gensio_register_class_cleanup(&net_affinity_cleanup_data);
+}
+
+/* Get the key for the current address, false if it doesn't fit. */
+static bool
+net_affinity_key(struct net_data *tdata, char *key)
+{
+    gensiods pos = 0;
+
+    if (gensio_addr_to_str(tdata->ai, key, &pos, NET_AFFINITY_ADDRLEN))
+	return false;
+    return pos < NET_AFFINITY_ADDRLEN;
+}
+
+/*
+ * Find an entry, drop the expired ones along the way.  A found entry
+ * is moved to the front, so the last one is the least recently used.
+ * Call with the lock held.
+ */
+static struct net_affinity_ent *
+net_affinity_find(const char *key, gensio_time *now)
+{
+    struct net_affinity_ent *e, **pe = &net_affinity;
+
+    while ((e = *pe)) {
+	if (now->secs - e->when.secs >= NET_AFFINITY_TTL) {
+	    *pe = e->next;
+	    net_affinity_len--;
+	    net_affinity_o->free(net_affinity_o, e);
+	    continue;
+	}
+	if (strcmp(e->addr, key) == 0) {
+	    *pe = e->next;
+	    e->next = net_affinity;
+	    net_affinity = e;
+	    return e;
+	}
+	pe = &e->next;
+    }
+    return NULL;
+}
+
+/* Remember how a connect to the address ai points to went. */
+static void
+net_affinity_note(struct net_data *tdata, bool ok)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct net_affinity_ent *e, **pe;
+    char key[NET_AFFINITY_ADDRLEN];
+    gensio_time now;
+
+    if (!tdata->ai_order || !net_affinity_key(tdata, key))
+	return;
+
+    o->get_monotonic_time(o, &now);
+    o->lock(net_affinity_lock);
+    e = net_affinity_find(key, &now);
+    if (!e) {
+	if (net_affinity_len >= NET_AFFINITY_MAX) {
+	    /* Drop the least recently used. */
+	    for (pe = &net_affinity; (*pe)->next; pe = &(*pe)->next)
+		;
+	    net_affinity_o->free(net_affinity_o, *pe);
+	    *pe = NULL;
+	    net_affinity_len--;
+	}
+	e = net_affinity_o->zalloc(net_affinity_o, sizeof(*e));
+	if (!e)
+	    goto out_unlock;
+	strcpy(e->addr, key);
+	e->next = net_affinity;
+	net_affinity = e;
+	net_affinity_len++;
+    }
+    e->ok = ok;
+    e->when = now;
+ out_unlock:
+    o->unlock(net_affinity_lock);
+}
+
+/*
+ * Set up ai_order for a new open: the address that connected most
+ * recently goes first, then the others in their normal order, then
+ * the ones that failed the last time they were tried.
+ */
+static void
+net_affinity_order(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct net_affinity_ent *e;
+    char key[NET_AFFINITY_ADDRLEN];
+    unsigned int i, n, rank, *ranks, best = tdata->nr_ai;
+    gensio_time now, best_time = { 0, 0 };
+
+    if (tdata->ai_order) {
+	o->free(o, tdata->ai_order);
+	tdata->ai_order = NULL;
+    }
+    if (!tdata->affinity || tdata->nr_ai < 2)
+	return;
+
+    o->call_once(o, &net_affinity_once, net_affinity_init, o);
+    if (!net_affinity_lock)
+	return;
+    /* The second half holds the rank of each address while sorting. */
+    tdata->ai_order = o->zalloc(o, sizeof(unsigned int) * tdata->nr_ai * 2);
+    if (!tdata->ai_order)
+	return;
+    ranks = tdata->ai_order + tdata->nr_ai;
+
+    o->get_monotonic_time(o, &now);
+    o->lock(net_affinity_lock);
+    gensio_addr_rewind(tdata->ai);
+    for (i = 0; i < tdata->nr_ai; i++) {
+	e = NULL;
+	if (net_affinity_key(tdata, key))
+	    e = net_affinity_find(key, &now);
+	ranks[i] = 1;
+	if (e && !e->ok) {
+	    ranks[i] = 2;
+	} else if (e && (best == tdata->nr_ai ||
+			 gensio_time_diff_nsecs(&e->when, &best_time) > 0)) {
+	    best = i;
+	    best_time = e->when;
+	}
+	gensio_addr_next(tdata->ai);
+    }
+    o->unlock(net_affinity_lock);
+    if (best < tdata->nr_ai)
+	ranks[best] = 0;
+
+    for (n = 0, rank = 0; rank < 3; rank++) {
+	for (i = 0; i < tdata->nr_ai; i++) {
+	    if (ranks[i] == rank)
+		tdata->ai_order[n++] = i;
+	}
+    }
+}
+
+/*
+ * Start a connect to the address tdata->ai points to.  If the connect
+ * itself failed, *connect_failed is set so the caller can move on to
+ * the next address.
+ */
+/* If the OS can't busy poll sockets, the loop's busy poll still helps. */
+static int
+net_setup_busy_poll(struct gensio_os_funcs *o, struct gensio_iod *iod,
+		    unsigned int busy_poll)
+{
+    gensiods size = sizeof(busy_poll);
+    int err;
+
+    if (!busy_poll)
+	return 0;
+    err = o->sock_control(iod, GENSIO_SOCKCTL_SET_BUSY_POLL,
+			  &busy_poll, &size);
+    if (err == GE_NOTSUP)
+	err = 0;
+    return err;
+}
+
+static int
+net_connect_one(struct net_data *tdata, struct gensio_iod **iod,
+		bool *connect_failed)
 {
     struct gensio_iod *new_iod = NULL;
-    int err = GE_INUSE;
+    int err;
     int protocol = tdata->istcp ? GENSIO_NET_PROTOCOL_TCP
 				: GENSIO_NET_PROTOCOL_UNIX;
     unsigned int setup = (GENSIO_SET_OPENSOCK_REUSEADDR |
@@ -73,24 +548,68 @@ net_try_open(struct net_data *tdata, struct gensio_iod **iod)
 			  GENSIO_SET_OPENSOCK_KEEPALIVE |
 			  GENSIO_SET_OPENSOCK_NODELAY);
 
+    *connect_failed = false;
     if (tdata->istcp)
 	setup |= GENSIO_OPENSOCK_KEEPALIVE;
     if (tdata->nodelay)
 	setup |= GENSIO_OPENSOCK_NODELAY;
- retry:
+
     err = tdata->o->socket_open(tdata->o, tdata->ai, protocol, &new_iod);
     if (err)
-	goto out;
+	return err;
 
     err = tdata->o->socket_set_setup(new_iod, setup, tdata->lai);
     if (err)
-	goto out;
+	goto out_err;
+
+    net_setup_zerocopy(tdata, new_iod);
+
+    err = net_setup_busy_poll(tdata->o, new_iod, tdata->busy_poll);
+    if (err)
+	goto out_err;
+
+    if (tdata->tfo)
+	/* If it's not supported, just do a normal connect. */
+	tdata->o->sock_control(new_iod,
+			       GENSIO_SOCKCTL_SET_TCP_FASTOPEN_CONNECT,
+			       NULL, NULL);
 
     err = tdata->o->connect(new_iod, tdata->ai);
-    if (err == GE_INPROGRESS) {
-	*iod = new_iod;
-	goto out_return;
+    if (err && err != GE_INPROGRESS) {
+	*connect_failed = true;
+	goto out_err;
+    }
+    *iod = new_iod;
+    return err;
+
+ out_err:
+    tdata->o->close(&new_iod);
+    return err;
+}
+
+/* Point ai at the address at position pos in the try order. */
+static bool
+net_ai_seek(struct net_data *tdata, unsigned int pos)
+{
+    unsigned int i, idx = tdata->ai_order ? tdata->ai_order[pos] : pos;
+
+    gensio_addr_rewind(tdata->ai);
+    for (i = 0; i < idx; i++) {
+	if (!gensio_addr_next(tdata->ai))
+	    return false;
     }
+    tdata->ai_idx = pos;
+    return true;
+}
+
+static int
+net_try_open(struct net_data *tdata, struct gensio_iod **iod)
+{
+    bool connect_failed;
+    int err;
+
+ retry:
+    err = net_connect_one(tdata, iod, &connect_failed);
 
     /*
      * The GE_NOMEM check is strange here, but it really has more to
@@ -99,53 +618,483 @@ net_try_open(struct net_data *tdata, struct gensio_iod **iod)
      * fail in that case or we will get a "error triggered but no
      * failure" in the test.
      */
-    if (err && err != GE_NOMEM) {
-	if (gensio_addr_next(tdata->ai)) {
-	    tdata->o->close(&new_iod);
+    if (connect_failed && err != GE_NOMEM) {
+	net_affinity_note(tdata, false);
+	if (tdata->ai_idx + 1 < tdata->nr_ai &&
+		net_ai_seek(tdata, tdata->ai_idx + 1))
 	    goto retry;
+    }
+
+    return err;
+}
+
+static void
+net_finish_free(struct net_data *tdata)
+{
+    unsigned int i;
+
+    if (tdata->fd_iod)
+	tdata->o->close(&tdata->fd_iod);
+    if (tdata->ai)
+	gensio_addr_free(tdata->ai);
+    if (tdata->lai)
+	gensio_addr_free(tdata->lai);
+    if (tdata->zc_lock)
+	tdata->o->free_lock(tdata->zc_lock);
+    for (i = 0; i < NET_ZC_NUM_BUFS; i++) {
+	if (tdata->zc_bufs[i])
+	    tdata->o->free(tdata->o, tdata->zc_bufs[i]);
+    }
+    if (tdata->ts_lock)
+	tdata->o->free_lock(tdata->ts_lock);
+    if (tdata->txts)
+	tdata->o->free(tdata->o, tdata->txts);
+    if (tdata->race_timer)
+	tdata->o->free_timer(tdata->race_timer);
+    if (tdata->race_lock)
+	tdata->o->free_lock(tdata->race_lock);
+    if (tdata->ai_order)
+	tdata->o->free(tdata->o, tdata->ai_order);
+    tdata->o->free(tdata->o, tdata);
+}
+
+/* Call with race_lock held. */
+static void
+net_race_deref_and_unlock(struct net_data *tdata)
+{
+    bool do_free;
+
+    assert(tdata->race_refs > 0);
+    do_free = --tdata->race_refs == 0 && tdata->freed;
+    tdata->o->unlock(tdata->race_lock);
+    if (do_free)
+	net_finish_free(tdata);
+}
+
+/* Call with race_lock held. */
+static void
+net_race_start_timer(struct net_data *tdata)
+{
+    if (tdata->race_timer_running)
+	return;
+    if (tdata->o->start_timer(tdata->race_timer, &tdata->race_delay) == 0) {
+	tdata->race_timer_running = true;
+	tdata->race_refs++;
+    }
+}
+
+/* Call with race_lock held. */
+static void
+net_race_stop_timer(struct net_data *tdata)
+{
+    if (tdata->race_timer_running &&
+		tdata->o->stop_timer(tdata->race_timer) == 0) {
+	tdata->race_timer_running = false;
+	tdata->race_refs--;
+    }
+}
+
+/*
+ * Cancel all the racing connects except the winner.  Call with
+ * race_lock held.  The entries go away when their handlers are
+ * cleared.
+ */
+static void
+net_race_cancel_others(struct net_data *tdata)
+{
+    struct gensio_link *l, *l2;
+    struct net_race *race;
+
+    net_race_stop_timer(tdata);
+    gensio_list_for_each_safe(&tdata->races, l, l2) {
+	race = gensio_container_of(l, struct net_race, link);
+	gensio_list_rm(&tdata->races, l);
+	tdata->o->clear_fd_handlers(race->iod);
+    }
+}
+
+/* Stop racing, the open is done or being closed.  Call with race_lock held. */
+static void
+net_race_cancel_all(struct net_data *tdata)
+{
+    struct net_race *race = tdata->race_winner;
+
+    tdata->racing = false;
+    net_race_cancel_others(tdata);
+    if (race) {
+	tdata->race_winner = NULL;
+	/* If not ready, net_race_cleared() will close it. */
+	if (tdata->race_winner_ready) {
+	    tdata->o->close(&race->iod);
+	    tdata->o->free(tdata->o, race);
+	    tdata->race_refs--;
 	}
     }
- out:
-    if (err) {
-	if (new_iod)
-	    tdata->o->close(&new_iod);
+}
+
+static void net_race_ready(struct gensio_iod *iod, void *cb_data);
+static void net_race_cleared(struct gensio_iod *iod, void *cb_data);
+
+/*
+ * Start a connect to the next address that will take one.  Call with
+ * race_lock held.  Returns true if the fd ll needs to check the open
+ * again, because there is a winner or everything has failed.
+ */
+static bool
+net_race_start(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct gensio_iod *iod = NULL;
+    struct net_race *race;
+    bool connect_failed;
+    int err;
+
+    while (tdata->race_next < tdata->nr_ai) {
+	if (!net_ai_seek(tdata, tdata->race_next++))
+	    break;
+	err = net_connect_one(tdata, &iod, &connect_failed);
+	if (err && err != GE_INPROGRESS) {
+	    tdata->last_err = err;
+	    if (connect_failed)
+		net_affinity_note(tdata, false);
+	    continue;
+	}
+
+	race = o->zalloc(o, sizeof(*race));
+	if (!race) {
+	    o->close(&iod);
+	    tdata->last_err = GE_NOMEM;
+	    continue;
+	}
+	race->tdata = tdata;
+	race->iod = iod;
+	race->idx = tdata->ai_idx;
+	tdata->race_refs++;
+
+	if (!err) {
+	    /* Connected immediately, it wins. */
+	    tdata->race_winner = race;
+	    tdata->race_winner_ready = true;
+	    net_race_cancel_others(tdata);
+	    return true;
+	}
+
+	err = o->set_fd_handlers(iod, race, NULL, net_race_ready,
+				 net_race_ready, net_race_cleared);
+	if (err) {
+	    o->close(&iod);
+	    o->free(o, race);
+	    tdata->race_refs--;
+	    tdata->last_err = err;
+	    continue;
+	}
+	o->set_write_handler(iod, true);
+	o->set_except_handler(iod, true);
+	gensio_list_add_tail(&tdata->races, &race->link);
+	break;
+    }
+
+    if (tdata->race_next < tdata->nr_ai)
+	net_race_start_timer(tdata);
+
+    return (tdata->race_primary_failed && gensio_list_empty(&tdata->races)
+	    && tdata->race_next >= tdata->nr_ai);
+}
+
+static void
+net_race_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    bool check = false;
+
+    tdata->o->lock(tdata->race_lock);
+    tdata->race_timer_running = false;
+    if (tdata->racing && !tdata->race_winner)
+	check = net_race_start(tdata);
+    tdata->race_refs++; /* Keep tdata around for the check. */
+    net_race_deref_and_unlock(tdata); /* Lose the timer ref. */
+
+    if (check)
+	gensio_fd_ll_check_open(tdata->ll);
+
+    tdata->o->lock(tdata->race_lock);
+    net_race_deref_and_unlock(tdata);
+}
+
+static void
+net_race_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct net_race *race = cb_data;
+    struct net_data *tdata = race->tdata;
+    struct gensio_os_funcs *o = tdata->o;
+    bool check = false;
+    int err;
+
+    o->lock(tdata->race_lock);
+    if (!gensio_list_link_inlist(&race->link)) {
+	/* Already done or cancelled. */
+	o->unlock(tdata->race_lock);
+	return;
+    }
+    o->set_write_handler(iod, false);
+    o->set_except_handler(iod, false);
+    gensio_list_rm(&tdata->races, &race->link);
+    err = o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN, NULL, NULL);
+    if (!err && tdata->racing && !tdata->race_winner) {
+	/* The fd ll is told when the handlers are cleared. */
+	tdata->race_winner = race;
+	tdata->race_winner_ready = false;
+	net_race_cancel_others(tdata);
+    } else if (err && tdata->racing && !tdata->race_winner) {
+	tdata->last_err = err;
+	net_ai_seek(tdata, race->idx);
+	net_affinity_note(tdata, false);
+	net_race_stop_timer(tdata);
+	check = net_race_start(tdata);
+    }
+    o->clear_fd_handlers(iod);
+    tdata->race_refs++; /* Keep tdata around for the check. */
+    o->unlock(tdata->race_lock);
+
+    if (check)
+	gensio_fd_ll_check_open(tdata->ll);
+
+    o->lock(tdata->race_lock);
+    net_race_deref_and_unlock(tdata);
+}
+
+static void
+net_race_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct net_race *race = cb_data;
+    struct net_data *tdata = race->tdata;
+    struct gensio_os_funcs *o = tdata->o;
+
+    o->lock(tdata->race_lock);
+    if (race == tdata->race_winner) {
+	/* The winner is ready to hand to the fd ll. */
+	tdata->race_winner_ready = true;
+	tdata->race_refs++; /* Keep tdata around for the check. */
+	o->unlock(tdata->race_lock);
+	gensio_fd_ll_check_open(tdata->ll);
+	o->lock(tdata->race_lock);
     } else {
-	*iod = new_iod;
+	o->close(&race->iod);
+	o->free(o, race);
     }
+    net_race_deref_and_unlock(tdata);
+}
 
- out_return:
+/* Called from check_open(), with the fd ll lock held. */
+static int
+net_race_check_open(struct net_data *tdata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    int err;
+
+    o->lock(tdata->race_lock);
+    if (!tdata->racing || iod != tdata->race_primary) {
+	err = o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN, NULL, NULL);
+	tdata->last_err = err;
+	net_affinity_note(tdata, !err);
+	goto out_unlock;
+    }
+
+    if (tdata->race_winner) {
+	/* Another address won, retry_open() will switch to it. */
+	tdata->race_primary_failed = true;
+	err = tdata->race_winner_ready ? GE_RETRY : GE_INPROGRESS;
+	goto out_unlock;
+    }
+
+    if (tdata->race_primary_failed) {
+	err = tdata->last_err;
+    } else {
+	err = o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN, NULL, NULL);
+	/* Racing moves ai around, point it back at the primary. */
+	net_ai_seek(tdata, tdata->race_primary_idx);
+	net_affinity_note(tdata, !err);
+    }
+    if (!err) {
+	net_race_cancel_all(tdata);
+	goto out_unlock;
+    }
+    tdata->last_err = err;
+    tdata->race_primary_failed = true;
+
+    /* Move on to the next address now. */
+    net_race_stop_timer(tdata);
+    net_race_start(tdata);
+    if (tdata->race_winner)
+	err = GE_RETRY; /* Connected immediately. */
+    else if (!gensio_list_empty(&tdata->races))
+	err = GE_INPROGRESS;
+    else
+	err = tdata->last_err;
+
+ out_unlock:
+    o->unlock(tdata->race_lock);
     return err;
 }
 
+/* A new primary connect was started, see if it needs company. */
+static void
+net_race_begin(struct net_data *tdata, struct gensio_iod *iod, int err)
+{
+    if (!tdata->race_lock)
+	return;
+
+    tdata->o->lock(tdata->race_lock);
+    tdata->race_winner = NULL;
+    tdata->race_primary = iod;
+    tdata->race_primary_idx = tdata->ai_idx;
+    tdata->race_primary_failed = false;
+    tdata->race_next = tdata->ai_idx + 1;
+    tdata->racing = err == GE_INPROGRESS && tdata->race_next < tdata->nr_ai;
+    if (tdata->racing)
+	net_race_start_timer(tdata);
+    tdata->o->unlock(tdata->race_lock);
+}
+
 static int
 net_retry_open(void *handler_data, struct gensio_iod **iod)
 {
     struct net_data *tdata = handler_data;
+    struct net_race *race;
+    int err;
 
-    if (!gensio_addr_next(tdata->ai))
+    if (tdata->race_lock) {
+	tdata->o->lock(tdata->race_lock);
+	if (tdata->racing) {
+	    race = tdata->race_winner;
+	    tdata->racing = false;
+	    if (!race || !tdata->race_winner_ready) {
+		net_race_cancel_all(tdata);
+		tdata->o->unlock(tdata->race_lock);
+		return tdata->last_err;
+	    }
+	    /* Hand over the winner, the fd ll will check it. */
+	    tdata->race_winner = NULL;
+	    *iod = race->iod;
+	    net_ai_seek(tdata, race->idx);
+	    tdata->o->free(tdata->o, race);
+	    tdata->race_refs--;
+	    tdata->o->unlock(tdata->race_lock);
+	    return GE_INPROGRESS;
+	}
+	tdata->o->unlock(tdata->race_lock);
+    }
+
+    if (tdata->ai_idx + 1 >= tdata->nr_ai ||
+	    !net_ai_seek(tdata, tdata->ai_idx + 1))
 	return tdata->last_err;
-    return net_try_open(tdata, iod);
+    err = net_try_open(tdata, iod);
+    net_race_begin(tdata, *iod, err);
+    return err;
+}
+
+/* Already connected, but there is only the one socket. */
+static int
+net_fd_sub_open(struct net_data *tdata, struct gensio_iod **iod)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    unsigned int setup;
+    int err;
+
+    if (!tdata->fd_iod)
+	return GE_NOTREADY;
+
+    err = o->sock_control(tdata->fd_iod, GENSIO_SOCKCTL_ADOPT, NULL, NULL);
+    if (err)
+	return err;
+    err = o->set_non_blocking(tdata->fd_iod);
+    if (err)
+	return err;
+    if (tdata->istcp) {
+	setup = (GENSIO_SET_OPENSOCK_KEEPALIVE | GENSIO_OPENSOCK_KEEPALIVE |
+		 GENSIO_SET_OPENSOCK_NODELAY);
+	if (tdata->nodelay)
+	    setup |= GENSIO_OPENSOCK_NODELAY;
+	err = o->socket_set_setup(tdata->fd_iod, setup, NULL);
+	if (err)
+	    return err;
+    }
+    *iod = tdata->fd_iod;
+    tdata->fd_iod = NULL;
+    return 0;
 }
 
 static int
 net_sub_open(void *handler_data, struct gensio_iod **iod)
 {
     struct net_data *tdata = handler_data;
+    int err;
+
+    if (tdata->from_fd)
+	return net_fd_sub_open(tdata, iod);
 
     gensio_addr_rewind(tdata->ai);
-    return net_try_open(tdata, iod);
+    for (tdata->nr_ai = 1; gensio_addr_next(tdata->ai); tdata->nr_ai++)
+	;
+    net_affinity_order(tdata);
+    net_ai_seek(tdata, 0);
+    err = net_try_open(tdata, iod);
+    net_race_begin(tdata, *iod, err);
+    return err;
 }
 
 static void
 net_free(void *handler_data)
 {
     struct net_data *tdata = handler_data;
+    bool do_free = true;
+
+    if (tdata->race_lock) {
+	tdata->o->lock(tdata->race_lock);
+	net_race_cancel_all(tdata);
+	tdata->freed = true;
+	do_free = tdata->race_refs == 0;
+	tdata->o->unlock(tdata->race_lock);
+    }
+    if (do_free)
+	net_finish_free(tdata);
+}
 
-    if (tdata->ai)
-	gensio_addr_free(tdata->ai);
-    if (tdata->lai)
-	gensio_addr_free(tdata->lai);
-    tdata->o->free(tdata->o, tdata);
+/*
+ * Report the transmit timestamps collected so far, one per line.
+ * Ones that don't fit in data are left for the next call.
+ */
+static int
+net_tx_tstamp_control(struct net_data *tdata, struct gensio_iod *iod,
+		      char *data, gensiods *datalen)
+{
+    struct gensio_tx_tstamp *ts;
+    gensiods pos = 0, start;
+
+    net_tstamp_reap(tdata, iod);
+    tdata->o->lock(tdata->ts_lock);
+    if (*datalen > 0)
+	data[0] = '\0';
+    while (tdata->txts_count) {
+	ts = &tdata->txts[tdata->txts_pos];
+	start = pos;
+	gensio_pos_snprintf(data, *datalen, &pos,
+			    "id=%lu sw=%lld.%9.9ld hw=%lld.%9.9ld\n",
+			    (unsigned long) ts->id,
+			    (long long) ts->sw.secs, (long) ts->sw.nsecs,
+			    (long long) ts->hw.secs, (long) ts->hw.nsecs);
+	if (pos >= *datalen) {
+	    if (start < *datalen)
+		data[start] = '\0';
+	    pos = start;
+	    break;
+	}
+	tdata->txts_pos = (tdata->txts_pos + 1) % NET_MAX_TX_TSTAMPS;
+	tdata->txts_count--;
+    }
+    tdata->o->unlock(tdata->ts_lock);
+    *datalen = pos;
+    return 0;
 }
 
 static int
@@ -157,6 +1106,7 @@ net_control(void *handler_data, struct gensio_iod *iod, bool get,
     unsigned int i, setup;
     gensiods pos, size;
     struct gensio_addr *addr;
+    struct gensio_tcp_info tinfo;
 
     switch (option) {
     case GENSIO_CONTROL_NODELAY:
@@ -226,24 +1176,98 @@ net_control(void *handler_data, struct gensio_iod *iod, bool get,
     case GENSIO_CONTROL_RADDR_BIN:
 	if (!get)
 	    return GE_NOTSUP;
-	gensio_addr_getaddr(tdata->ai, data, datalen);
+	gensio_addr_getaddr(tdata->ai, data, datalen);
+	return 0;
+
+    case GENSIO_CONTROL_FD:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 1)
+	    return GE_INVAL;
+	if (!iod)
+	    return GE_NOTREADY;
+	*datalen = snprintf(data, *datalen, "%d", tdata->o->iod_get_fd(iod));
+	return 0;
+
+    case GENSIO_CONTROL_TCP_INFO:
+	if (!get || !tdata->istcp)
+	    return GE_NOTSUP;
+	if (!iod)
+	    return GE_NOTREADY;
+	size = sizeof(tinfo);
+	rv = tdata->o->sock_control(iod, GENSIO_SOCKCTL_GET_TCP_INFO,
+				    &tinfo, &size);
+	if (rv)
+	    return rv;
+	*datalen = snprintf(data, *datalen,
+			    "rtt=%lu rttvar=%lu cwnd=%lu retrans=%lu"
+			    " bytes_acked=%llu pacing_rate=%llu"
+			    " delivery_rate=%llu",
+			    (unsigned long) tinfo.rtt,
+			    (unsigned long) tinfo.rttvar,
+			    (unsigned long) tinfo.snd_cwnd,
+			    (unsigned long) tinfo.total_retrans,
+			    (unsigned long long) tinfo.bytes_acked,
+			    (unsigned long long) tinfo.pacing_rate,
+			    (unsigned long long) tinfo.delivery_rate);
+	return 0;
+
+    case GENSIO_CONTROL_LPORT:
+	if (!get)
+	    return GE_NOTSUP;
+	size = sizeof(unsigned int);
+	rv = tdata->o->sock_control(iod, GENSIO_SOCKCTL_GET_PORT, &i, &size);
+	if (rv)
+	    return rv;
+	*datalen = snprintf(data, *datalen, "%d", i);
+	return 0;
+
+    case GENSIO_CONTROL_ENABLE_OOB:
+	if (get)
+	    *datalen = snprintf(data, *datalen, "%u", tdata->do_oob);
+	else
+	    tdata->do_oob = !!strtoul(data, NULL, 0);
+	return 0;
+
+    case GENSIO_CONTROL_TX_TSTAMP:
+	if (!get)
+	    return GE_NOTSUP;
+	if (!tdata->txts || !iod)
+	    return GE_NOTREADY;
+	return net_tx_tstamp_control(tdata, iod, data, datalen);
+
+    case GENSIO_CONTROL_SEND_FD:
+	if (get || tdata->istcp)
+	    return GE_NOTSUP;
+	if (!iod)
+	    return GE_NOTREADY;
+	val = strtol(data, NULL, 0);
+	size = sizeof(val);
+	return tdata->o->sock_control(iod, GENSIO_SOCKCTL_SEND_FD,
+				      &val, &size);
+
+    case GENSIO_CONTROL_RECV_FD:
+	if (!get || !tdata->passfd)
+	    return GE_NOTSUP;
+	if (!iod)
+	    return GE_NOTREADY;
+	size = sizeof(val);
+	rv = tdata->o->sock_control(iod, GENSIO_SOCKCTL_GET_FD, &val, &size);
+	if (rv)
+	    return rv;
+	*datalen = snprintf(data, *datalen, "%d", val);
 	return 0;
 
-    case GENSIO_CONTROL_LPORT:
+    case GENSIO_CONTROL_HANDOFF:
 	if (!get)
 	    return GE_NOTSUP;
-	size = sizeof(unsigned int);
-	rv = tdata->o->sock_control(iod, GENSIO_SOCKCTL_GET_PORT, &i, &size);
+	if (!iod)
+	    return GE_NOTREADY;
+	size = sizeof(val);
+	rv = tdata->o->sock_control(iod, GENSIO_SOCKCTL_DUP_FD, &val, &size);
 	if (rv)
 	    return rv;
-	*datalen = snprintf(data, *datalen, "%d", i);
-	return 0;
-
-    case GENSIO_CONTROL_ENABLE_OOB:
-	if (get)
-	    *datalen = snprintf(data, *datalen, "%u", tdata->do_oob);
-	else
-	    tdata->do_oob = !!strtoul(data, NULL, 0);
+	*datalen = snprintf(data, *datalen, "%d", val);
 	return 0;
 
     default:
@@ -282,20 +1306,185 @@ net_except_ready(void *handler_data, struct gensio_iod *iod)
     struct net_data *tdata = handler_data;
     unsigned char urgdata;
     gensiods rcount = 0;
+    bool reaped = false;
     int rv;
 
     if (!tdata->istcp)
 	return GE_NOTSUP;
 
+    if (tdata->txts) {
+	/* So do transmit timestamps. */
+	net_tstamp_reap(tdata, iod);
+	reaped = true;
+    }
+
+    if (tdata->zc_on) {
+	/* Zero-copy completions come in as an exception. */
+	tdata->o->lock(tdata->zc_lock);
+	if (tdata->zc_outstanding) {
+	    reaped = true;
+	    net_zc_reap(tdata, iod);
+	}
+	tdata->o->unlock(tdata->zc_lock);
+    }
+
     rv = tdata->o->recv(iod, &urgdata, 1, &rcount, GENSIO_MSG_OOB);
     if (rv || rcount == 0)
-	return GE_NOTSUP;
+	return reaped ? 0 : GE_NOTSUP;
 
     tdata->oob_char = urgdata;
     gensio_fd_ll_handle_incoming(tdata->ll, net_except_read, NULL, tdata);
     return 0;
 }
 
+static void
+net_fmt_tstamp(char *buf, gensiods len, const char *name,
+	       const gensio_time *t)
+{
+    snprintf(buf, len, "%s:%lld.%9.9ld", name, (long long) t->secs,
+	     (long) t->nsecs);
+}
+
+/* A read that gets the receive timestamps, too. */
+static int
+net_tstamp_read(struct gensio_iod *iod, void *buf, gensiods count,
+		gensiods *rcount, const char ***auxdata, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    struct gensio_sockmsg msg;
+    gensiods nr = 1;
+    unsigned int n = 0;
+    int err;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.buf = buf;
+    msg.buflen = count;
+    err = tdata->o->sock_control(iod, GENSIO_SOCKCTL_RECV_MULTI, &msg, &nr);
+    if (err)
+	return err;
+    if (nr == 0) {
+	*rcount = 0;
+	return 0;
+    }
+    if (msg.len == 0)
+	return GE_REMCLOSE;
+
+    if (msg.rx_sw.secs || msg.rx_sw.nsecs) {
+	net_fmt_tstamp(tdata->rxts, sizeof(tdata->rxts), "rxts", &msg.rx_sw);
+	tdata->rxaux[n++] = tdata->rxts;
+    }
+    if (msg.rx_hw.secs || msg.rx_hw.nsecs) {
+	net_fmt_tstamp(tdata->rxhwts, sizeof(tdata->rxhwts), "rxhwts",
+		       &msg.rx_hw);
+	tdata->rxaux[n++] = tdata->rxhwts;
+    }
+    tdata->rxaux[n] = NULL;
+    if (n)
+	*auxdata = tdata->rxaux;
+    *rcount = msg.len;
+    return 0;
+}
+
+static void
+net_tstamp_read_ready(void *handler_data, struct gensio_iod *iod)
+{
+    struct net_data *tdata = handler_data;
+
+    gensio_fd_ll_handle_incoming(tdata->ll, net_tstamp_read, NULL, tdata);
+}
+
+/* A read that accepts passed descriptors. */
+static int
+net_passfd_read(struct gensio_iod *iod, void *buf, gensiods count,
+		gensiods *rcount, const char ***auxdata, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    static const char *argv[2] = { "fd", NULL };
+    struct gensio_sockmsg msg;
+    gensiods nr_fds = 0;
+    int err;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.buf = buf;
+    msg.buflen = count;
+    err = tdata->o->sock_control(iod, GENSIO_SOCKCTL_RECV_FDS,
+				 &msg, &nr_fds);
+    if (err)
+	return err;
+    if (nr_fds)
+	*auxdata = argv;
+    *rcount = msg.len;
+    return 0;
+}
+
+static void
+net_passfd_read_ready(void *handler_data, struct gensio_iod *iod)
+{
+    struct net_data *tdata = handler_data;
+
+    gensio_fd_ll_handle_incoming(tdata->ll, net_passfd_read, NULL, tdata);
+}
+
+/*
+ * Big writes are copied into a free zero-copy buffer and sent from
+ * there, the count is the real count sent.  If no buffer is free or
+ * the kernel can't pin one, the data is just sent normally.
+ */
+static int
+net_write_zerocopy(struct net_data *tdata, struct gensio_iod *iod,
+		   gensiods *rcount, const struct gensio_sg *sg,
+		   gensiods sglen)
+{
+    struct gensio_sg zsg;
+    unsigned char *buf;
+    gensiods i, len, total = 0, count = 0;
+    unsigned int pos;
+    int err;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    if (total < tdata->zerocopy)
+	return tdata->o->send(iod, sg, sglen, rcount, 0);
+
+    tdata->o->lock(tdata->zc_lock);
+    net_zc_reap(tdata, iod);
+    if (tdata->zc_outstanding == NET_ZC_NUM_BUFS)
+	goto out_copy;
+
+    pos = (tdata->zc_first + tdata->zc_outstanding) % NET_ZC_NUM_BUFS;
+    buf = tdata->zc_bufs[pos];
+    if (!buf) {
+	buf = tdata->o->zalloc(tdata->o, NET_ZC_BUF_SIZE);
+	if (!buf)
+	    goto out_copy;
+	tdata->zc_bufs[pos] = buf;
+    }
+    for (i = 0, len = 0; i < sglen && len < NET_ZC_BUF_SIZE; i++) {
+	gensiods c = sg[i].buflen;
+
+	if (c > NET_ZC_BUF_SIZE - len)
+	    c = NET_ZC_BUF_SIZE - len;
+	memcpy(buf + len, sg[i].buf, c);
+	len += c;
+    }
+    zsg.buf = buf;
+    zsg.buflen = len;
+    err = tdata->o->send(iod, &zsg, 1, &count, GENSIO_MSG_ZEROCOPY);
+    if (err == GE_NOMEM)
+	/* Kernel couldn't pin it, just copy this one. */
+	goto out_copy;
+    if (!err && count > 0)
+	tdata->zc_outstanding++;
+    tdata->o->unlock(tdata->zc_lock);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+
+ out_copy:
+    tdata->o->unlock(tdata->zc_lock);
+    return tdata->o->send(iod, sg, sglen, rcount, 0);
+}
+
 static int
 net_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
 	  const struct gensio_sg *sg, gensiods sglen,
@@ -317,6 +1506,9 @@ net_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
 	}
     }
 
+    if (tdata->zc_on && !flags)
+	return net_write_zerocopy(tdata, iod, rcount, sg, sglen);
+
     return tdata->o->send(iod, sg, sglen, rcount, flags);
 }
 
@@ -328,8 +1520,19 @@ net_check_close(void *handler_data, struct gensio_iod *iod,
     struct net_data *tdata = handler_data;
     int err;
 
-    if (state == GENSIO_LL_CLOSE_STATE_START)
+    if (state == GENSIO_LL_CLOSE_STATE_START) {
+	if (tdata->race_lock) {
+	    /* Could be closed while connecting. */
+	    tdata->o->lock(tdata->race_lock);
+	    net_race_cancel_all(tdata);
+	    tdata->o->unlock(tdata->race_lock);
+	}
 	return 0;
+    }
+
+    err = net_zc_check_close(tdata, iod, timeout);
+    if (err)
+	return err;
 
     err = tdata->o->graceful_close(&iod);
     if (err == GE_INPROGRESS && timeout) {
@@ -350,6 +1553,70 @@ static const struct gensio_fd_ll_ops net_fd_ll_ops = {
     .check_close = net_check_close
 };
 
+/* With receive timestamps, which means doing the reads here. */
+static const struct gensio_fd_ll_ops net_tstamp_fd_ll_ops = {
+    .sub_open = net_sub_open,
+    .check_open = net_check_open,
+    .retry_open = net_retry_open,
+    .free = net_free,
+    .control = net_control,
+    .read_ready = net_tstamp_read_ready,
+    .except_ready = net_except_ready,
+    .write = net_write,
+    .check_close = net_check_close
+};
+
+/* Unix with descriptor passing. */
+static const struct gensio_fd_ll_ops net_passfd_fd_ll_ops = {
+    .sub_open = net_sub_open,
+    .check_open = net_check_open,
+    .retry_open = net_retry_open,
+    .free = net_free,
+    .control = net_control,
+    .read_ready = net_passfd_read_ready,
+    .except_ready = net_except_ready,
+    .write = net_write,
+    .check_close = net_check_close
+};
+
+/* Get the defaults for rxtstamp, txtstamp, and hwtstamp. */
+static int
+net_tstamp_defaults(struct gensio_os_funcs *o, const char *type,
+		    bool *rxtstamp, bool *txtstamp, bool *hwtstamp)
+{
+    int err, ival;
+
+    err = gensio_get_default(o, type, "rxtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *rxtstamp = ival;
+    err = gensio_get_default(o, type, "txtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *txtstamp = ival;
+    err = gensio_get_default(o, type, "hwtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *hwtstamp = ival;
+    return 0;
+}
+
+/* Convert the timestamp options to GENSIO_TSTAMP_xxx flags. */
+static unsigned int
+net_tstamp_flags(bool rxtstamp, bool txtstamp, bool hwtstamp)
+{
+    unsigned int tstamp = 0;
+
+    if (rxtstamp)
+	tstamp |= GENSIO_TSTAMP_RX_SW | (hwtstamp ? GENSIO_TSTAMP_RX_HW : 0);
+    if (txtstamp)
+	tstamp |= GENSIO_TSTAMP_TX_SW | (hwtstamp ? GENSIO_TSTAMP_TX_HW : 0);
+    return tstamp;
+}
+
 static int
 net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 		 struct gensio_os_funcs *o,
@@ -360,7 +1627,14 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
     struct gensio_addr *laddr = NULL, *laddr2, *addr = NULL;
     struct gensio *io;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods zerocopy = 0;
     bool nodelay = false;
+    bool tfo = false;
+    bool passfd = false;
+    unsigned int busy_poll = 0;
+    bool rxtstamp = false, txtstamp = false, hwtstamp = false;
+    gensio_time race_delay = { 0, 0 };
+    bool affinity = false;
     unsigned int i;
     int ival;
     int err;
@@ -386,9 +1660,59 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 	return err;
     nodelay = ival;
 
+    if (istcp) {
+	err = gensio_get_default(o, type, "zerocopy", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	zerocopy = ival;
+	err = gensio_get_default(o, type, "tfo", false,
+				 GENSIO_DEFAULT_BOOL, NULL, &ival);
+	if (err)
+	    return err;
+	tfo = ival;
+	err = gensio_get_default(o, type, "busypoll", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	busy_poll = ival;
+	err = gensio_get_default(o, type, "stagger", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	race_delay.secs = ival / 1000;
+	race_delay.nsecs = (ival % 1000) * 1000000;
+	err = gensio_get_default(o, type, "affinity", false,
+				 GENSIO_DEFAULT_BOOL, NULL, &ival);
+	if (err)
+	    return err;
+	affinity = ival;
+	err = net_tstamp_defaults(o, type, &rxtstamp, &txtstamp, &hwtstamp);
+	if (err)
+	    return err;
+    }
+
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (istcp && gensio_check_keyds(args[i], "zerocopy", &zerocopy) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "tfo", &tfo) > 0)
+	    continue;
+	if (istcp && gensio_check_keyuint(args[i], "busypoll",
+					  &busy_poll) > 0)
+	    continue;
+	if (istcp && gensio_check_keytime(args[i], "stagger", 'm',
+					  &race_delay) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "affinity", &affinity) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "rxtstamp", &rxtstamp) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "txtstamp", &txtstamp) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "hwtstamp", &hwtstamp) > 0)
+	    continue;
 	if (istcp && gensio_check_keyaddrs(o, args[i], "laddr",
 					   GENSIO_NET_PROTOCOL_TCP,
 					   true, false, &laddr2) > 0) {
@@ -399,6 +1723,8 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 	}
 	if (istcp && gensio_check_keybool(args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (!istcp && gensio_check_keybool(args[i], "passfd", &passfd) > 0)
+	    continue;
 
 	if (laddr)
 	    gensio_addr_free(laddr);
@@ -411,6 +1737,7 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 
     tdata->istcp = istcp;
     tdata->oob_char = -1;
+    tdata->passfd = passfd;
 
     addr = gensio_addr_dup(iai);
     if (!addr)
@@ -418,9 +1745,35 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 
     tdata->o = o;
     tdata->nodelay = nodelay;
+    tdata->tfo = tfo;
+    tdata->busy_poll = busy_poll;
+    tdata->affinity = affinity;
+    tdata->zerocopy = zerocopy;
+    if (zerocopy) {
+	tdata->zc_lock = o->alloc_lock(o);
+	if (!tdata->zc_lock)
+	    goto out_nomem;
+    }
+    if (net_alloc_tstamp(tdata, net_tstamp_flags(rxtstamp, txtstamp,
+						 hwtstamp)))
+	goto out_nomem;
+    if (race_delay.secs || race_delay.nsecs) {
+	tdata->race_delay = race_delay;
+	gensio_list_init(&tdata->races);
+	tdata->race_lock = o->alloc_lock(o);
+	if (!tdata->race_lock)
+	    goto out_nomem;
+	tdata->race_timer = o->alloc_timer(o, net_race_timeout, tdata);
+	if (!tdata->race_timer)
+	    goto out_nomem;
+    }
 
-    tdata->ll = fd_gensio_ll_alloc(o, NULL, &net_fd_ll_ops, tdata,
-				   max_read_size, false);
+    tdata->ll = fd_gensio_ll_alloc(o, NULL,
+				   (tdata->tstamp & NET_TSTAMP_RX ?
+				    &net_tstamp_fd_ll_ops :
+				    passfd ? &net_passfd_fd_ll_ops :
+				    &net_fd_ll_ops),
+				   tdata, max_read_size, false);
     if (!tdata->ll)
 	goto out_nomem;
 
@@ -447,7 +1800,7 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 	    gensio_ll_free(tdata->ll);
 	else
 	    /* gensio_ll_free() frees it otherwise. */
-	    o->free(o, tdata);
+	    net_free(tdata);
     }
     return GE_NOMEM;
 }
@@ -473,49 +1826,172 @@ str_to_net_gensio(const char *str, const char * const args[],
 }
 
 static int
-tcp_gensio_alloc(const void *gdata, const char * const args[],
-		 struct gensio_os_funcs *o,
-		 gensio_event cb, void *user_data,
-		 struct gensio **new_gensio)
+tcp_gensio_alloc(const void *gdata, const char * const args[],
+		 struct gensio_os_funcs *o,
+		 gensio_event cb, void *user_data,
+		 struct gensio **new_gensio)
+{
+    const struct gensio_addr *iai = gdata;
+
+    return net_gensio_alloc(iai, args, o, cb, user_data, "tcp", new_gensio);
+}
+
+static int
+str_to_tcp_gensio(const char *str, const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_TCP, "tcp",
+			     o, cb, user_data, new_gensio);
+}
+
+static int
+unix_gensio_alloc(const void *gdata, const char * const args[],
+		 struct gensio_os_funcs *o,
+		 gensio_event cb, void *user_data,
+		 struct gensio **new_gensio)
+{
+#if HAVE_UNIX
+    const struct gensio_addr *iai = gdata;
+
+    return net_gensio_alloc(iai, args, o, cb, user_data, "unix", new_gensio);
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static int
+str_to_unix_gensio(const char *str, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_UNIX, "unix",
+			     o, cb, user_data, new_gensio);
+}
+
+/*
+ * A gensio on a socket that is already connected, one inherited from
+ * a parent or received with GENSIO_CONTROL_RECV_FD.  The gensio owns
+ * the socket once this succeeds.
+ */
+static int
+net_fd_gensio_alloc(int fd, const char * const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
+{
+    struct net_data *tdata = NULL;
+    struct gensio_iod *iod = NULL;
+    struct gensio_addr *addr = NULL;
+    struct gensio *io;
+    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    bool nodelay = false, passfd = false, istcp;
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "nodelay", &nodelay) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "passfd", &passfd) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    /*
+     * The socket is set up on open, so nothing here needs undoing if
+     * this fails.
+     */
+    err = o->add_iod(o, GENSIO_IOD_SOCKET, fd, &iod);
+    if (err)
+	return err;
+    err = o->sock_control(iod, GENSIO_SOCKCTL_GET_PEERNAME, &addr, NULL);
+    if (err)
+	goto out_err;
+
+#if HAVE_UNIX
+    /* Socket addresses report the address family here. */
+    istcp = gensio_addr_get_nettype(addr) != AF_UNIX;
+#else
+    istcp = true;
+#endif
+    err = GE_INVAL;
+    if ((istcp && passfd) || (!istcp && nodelay))
+	goto out_err;
+
+    err = GE_NOMEM;
+    tdata = o->zalloc(o, sizeof(*tdata));
+    if (!tdata)
+	goto out_err;
+    tdata->o = o;
+    tdata->istcp = istcp;
+    tdata->nodelay = nodelay;
+    tdata->passfd = passfd;
+    tdata->oob_char = -1;
+    tdata->from_fd = true;
+
+    tdata->ll = fd_gensio_ll_alloc(o, NULL,
+				   passfd ? &net_passfd_fd_ll_ops :
+				   &net_fd_ll_ops,
+				   tdata, max_read_size, false);
+    if (!tdata->ll)
+	goto out_err;
+
+    io = base_gensio_alloc(o, tdata->ll, NULL, NULL, "sockfd",
+			   cb, user_data);
+    if (!io) {
+	gensio_ll_free(tdata->ll);
+	goto out_err_nofree;
+    }
+
+    /* Assign these last so gensio_ll_free() won't free them on err. */
+    tdata->ai = addr;
+    tdata->fd_iod = iod;
+
+    gensio_set_is_reliable(io, true);
+
+    *new_gensio = io;
+    return 0;
+
+ out_err:
+    if (tdata)
+	net_free(tdata);
+ out_err_nofree:
+    if (addr)
+	gensio_addr_free(addr);
+    /* The caller still owns the descriptor on failure. */
+    o->release_iod(iod);
+    return err;
+}
+
+static int
+sockfd_gensio_alloc(const void *gdata, const char * const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
 {
-    const struct gensio_addr *iai = gdata;
-
-    return net_gensio_alloc(iai, args, o, cb, user_data, "tcp", new_gensio);
-}
+    const int *fd = gdata;
 
-static int
-str_to_tcp_gensio(const char *str, const char * const args[],
-		  struct gensio_os_funcs *o,
-		  gensio_event cb, void *user_data,
-		  struct gensio **new_gensio)
-{
-    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_TCP, "tcp",
-			     o, cb, user_data, new_gensio);
+    return net_fd_gensio_alloc(*fd, args, o, cb, user_data, new_gensio);
 }
 
 static int
-unix_gensio_alloc(const void *gdata, const char * const args[],
-		 struct gensio_os_funcs *o,
-		 gensio_event cb, void *user_data,
-		 struct gensio **new_gensio)
+str_to_sockfd_gensio(const char *str, const char * const args[],
+		     struct gensio_os_funcs *o,
+		     gensio_event cb, void *user_data,
+		     struct gensio **new_gensio)
 {
-#if HAVE_UNIX
-    const struct gensio_addr *iai = gdata;
+    char *end;
+    long fd;
 
-    return net_gensio_alloc(iai, args, o, cb, user_data, "unix", new_gensio);
-#else
-    return GE_NOTSUP;
-#endif
-}
+    fd = strtol(str, &end, 0);
+    if (end == str || *end || fd < 0 || fd > INT_MAX)
+	return GE_INVAL;
 
-static int
-str_to_unix_gensio(const char *str, const char * const args[],
-		   struct gensio_os_funcs *o,
-		   gensio_event cb, void *user_data,
-		   struct gensio **new_gensio)
-{
-    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_UNIX, "unix",
-			     o, cb, user_data, new_gensio);
+    return net_fd_gensio_alloc(fd, args, o, cb, user_data, new_gensio);
 }
 
 struct netna_data {
@@ -529,6 +2005,14 @@ struct netna_data {
 
     gensiods max_read_size;
     bool nodelay;
+    gensiods zerocopy;
+    bool tfo;
+    unsigned int tstamp;
+    bool passfd;
+    unsigned int busy_poll;
+
+    unsigned int accept_batch;	/* Max connections per read wakeup. */
+    bool accepts_enabled;
 
     gensio_acc_done shutdown_done;
     gensio_acc_done cb_en_done;
@@ -555,13 +2039,62 @@ struct netna_data {
     unsigned int opensock_flags;
 
     bool istcp;
+
+    /*
+     * A sockfd accepter is built on sockets that are already
+     * listening.  They are set up on the first startup and closed on
+     * shutdown, so it can't be started again.
+     */
+    bool from_fd;
+
+    /*
+     * A listening socket was handed to another process, leave the
+     * unix socket in the filesystem for it.
+     */
+    bool handed_off;
 };
 
+static int
+net_server_check_close(void *handler_data, struct gensio_iod *iod,
+		       enum gensio_ll_close_state state,
+		       gensio_time *timeout)
+{
+    struct net_data *tdata = handler_data;
+    int err;
+
+    if (state == GENSIO_LL_CLOSE_STATE_START)
+	return 0;
+
+    err = net_zc_check_close(tdata, iod, timeout);
+    if (!err)
+	tdata->o->close(&iod);
+    return err;
+}
+
 static const struct gensio_fd_ll_ops net_server_fd_ll_ops = {
     .free = net_free,
     .control = net_control,
     .except_ready = net_except_ready,
-    .write = net_write
+    .write = net_write,
+    .check_close = net_server_check_close
+};
+
+static const struct gensio_fd_ll_ops net_server_tstamp_fd_ll_ops = {
+    .free = net_free,
+    .control = net_control,
+    .read_ready = net_tstamp_read_ready,
+    .except_ready = net_except_ready,
+    .write = net_write,
+    .check_close = net_server_check_close
+};
+
+static const struct gensio_fd_ll_ops net_server_passfd_fd_ll_ops = {
+    .free = net_free,
+    .control = net_control,
+    .read_ready = net_passfd_read_ready,
+    .except_ready = net_except_ready,
+    .write = net_write,
+    .check_close = net_server_check_close
 };
 
 static void
@@ -595,6 +2128,7 @@ netna_set_fd_enables(struct netna_data *nadata, bool enable)
 {
     unsigned int i;
 
+    nadata->accepts_enabled = enable;
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->set_read_handler(nadata->acceptfds[i].iod, enable);
 }
@@ -607,10 +2141,13 @@ netna_finish_server_open(struct gensio *net, int err, void *cb_data)
     base_gensio_server_open_done(nadata->acc, net, err);
 }
 
-static void
-netna_readhandler(struct gensio_iod *iod, void *cbdata)
+/*
+ * Accept and set up one connection.  Returns an error if nothing was
+ * accepted or the accepter can't take any more right now.
+ */
+static int
+netna_accept_one(struct netna_data *nadata, struct gensio_iod *iod)
 {
-    struct netna_data *nadata = cbdata;
     struct gensio_iod *new_iod = NULL;
     struct gensio_addr *raddr;
     struct net_data *tdata = NULL;
@@ -628,14 +2165,14 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 			   "Error accepting net gensio: %s",
 			   gensio_err_to_str(err));
-	return;
+	return err;
     }
 
     err = base_gensio_accepter_new_child_start(nadata->acc);
     if (err) {
 	gensio_addr_free(raddr);
 	nadata->o->close(&new_iod);
-	return;
+	return err;
     }
 
 #ifdef HAVE_TCPD_H
@@ -669,8 +2206,29 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
     tdata->ai = raddr;
     tdata->istcp = nadata->istcp;
     tdata->nodelay = nadata->nodelay;
+    tdata->zerocopy = nadata->zerocopy;
+    tdata->passfd = nadata->passfd;
     raddr = NULL;
 
+    if (tdata->zerocopy) {
+	tdata->zc_lock = nadata->o->alloc_lock(nadata->o);
+	if (!tdata->zc_lock) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+			   "Error accepting net gensio: out of memory");
+	    err = GE_NOMEM;
+	    goto out_err;
+	}
+	net_setup_zerocopy(tdata, new_iod);
+    }
+
+    if (net_alloc_tstamp(tdata, nadata->tstamp)) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+		       "Error accepting net gensio: out of memory");
+	err = GE_NOMEM;
+	goto out_err;
+    }
+    net_setup_tstamp(tdata, new_iod);
+
     if (tdata->istcp)
 	setup |= GENSIO_OPENSOCK_KEEPALIVE;
     if (tdata->nodelay)
@@ -681,8 +2239,20 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 		       "Error setting up net port: %s", gensio_err_to_str(err));
 	goto out_err;
     }
+    err = net_setup_busy_poll(tdata->o, new_iod, nadata->busy_poll);
+    if (err) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Error setting up net busy poll: %s",
+		       gensio_err_to_str(err));
+	goto out_err;
+    }
 
-    tdata->ll = fd_gensio_ll_alloc(nadata->o, new_iod, &net_server_fd_ll_ops,
+    tdata->ll = fd_gensio_ll_alloc(nadata->o, new_iod,
+				   (tdata->tstamp & NET_TSTAMP_RX ?
+				    &net_server_tstamp_fd_ll_ops :
+				    tdata->passfd ?
+				    &net_server_passfd_fd_ll_ops :
+				    &net_server_fd_ll_ops),
 				   tdata, nadata->max_read_size, false);
     if (!tdata->ll) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
@@ -705,18 +2275,18 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
     if (err)
 	goto out_err;
     base_gensio_accepter_new_child_end(nadata->acc, io, 0);
-    return;
+    return 0;
 
  out_err:
     base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
     if (io) {
 	gensio_free(io);
-	return;
+	return 0;
     }
     if (tdata) {
 	if (tdata->ll) {
 	    gensio_ll_free(tdata->ll);
-	    return;
+	    return 0;
 	}
 
 	/* gensio_ll_free() frees it otherwise. */
@@ -726,6 +2296,23 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 	gensio_addr_free(raddr);
     if (new_iod)
 	nadata->o->close(&new_iod);
+    return 0;
+}
+
+/*
+ * Take up to accept_batch connections per wakeup, this helps a lot
+ * when a bunch of clients connect at once.
+ */
+static void
+netna_readhandler(struct gensio_iod *iod, void *cbdata)
+{
+    struct netna_data *nadata = cbdata;
+    unsigned int i;
+
+    for (i = 0; i < nadata->accept_batch && nadata->accepts_enabled; i++) {
+	if (netna_accept_one(nadata, iod))
+	    break;
+    }
 }
 
 #if HAVE_UNIX
@@ -773,8 +2360,20 @@ netna_b4_listen(struct gensio_iod *iod, void *data)
     char unpath[MAX_UNIX_ADDR_PATH];
 #endif
 
-    if (nadata->istcp)
-	return 0;
+    if (nadata->istcp) {
+	unsigned int qlen = NET_TFO_QUEUE_LEN;
+	gensiods len = sizeof(qlen);
+	int rv;
+
+	if (!nadata->tfo)
+	    return 0;
+	rv = nadata->o->sock_control(iod, GENSIO_SOCKCTL_SET_TCP_FASTOPEN,
+				     &qlen, &len);
+	/* Clients just do a normal handshake if it's not available. */
+	if (rv == GE_NOTSUP)
+	    rv = 0;
+	return rv;
+    }
 
 #if HAVE_UNIX
     get_unix_addr_path(nadata->ai, unpath);
@@ -829,11 +2428,44 @@ netna_b4_listen(struct gensio_iod *iod, void *data)
 #endif
 }
 
+static int
+netna_fd_startup(struct netna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    unsigned int i;
+    int rv = 0;
+
+    if (!nadata->acceptfds)
+	return GE_NOTREADY;
+
+    for (i = 0; i < nadata->nr_acceptfds; i++) {
+	rv = o->set_non_blocking(nadata->acceptfds[i].iod);
+	if (rv)
+	    break;
+	rv = o->set_fd_handlers(nadata->acceptfds[i].iod, nadata,
+				netna_readhandler, NULL, NULL,
+				netna_fd_cleared);
+	if (rv)
+	    break;
+    }
+    if (rv) {
+	while (i > 0)
+	    o->clear_fd_handlers_norpt(nadata->acceptfds[--i].iod);
+	return rv;
+    }
+
+    netna_set_fd_enables(nadata, true);
+    return 0;
+}
+
 static int
 netna_startup(struct gensio_accepter *accepter, struct netna_data *nadata)
 {
     int rv;
 
+    if (nadata->from_fd)
+	return netna_fd_startup(nadata);
+
     rv = gensio_os_open_listen_sockets(nadata->o, nadata->ai,
 			       netna_readhandler,
 			       NULL, netna_fd_cleared, netna_b4_listen, nadata,
@@ -856,7 +2488,7 @@ netna_shutdown(struct gensio_accepter *accepter,
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->clear_fd_handlers(nadata->acceptfds[i].iod);
 
-    if (!nadata->istcp)
+    if (!nadata->istcp && !nadata->handed_off)
 	/* Remove the socket. */
 	netna_rm_unix_socket(nadata->ai);
 
@@ -885,6 +2517,7 @@ netna_set_accept_callback_enable(struct gensio_accepter *accepter,
 	return GE_INUSE;
 
     nadata->cb_en_done = done;
+    nadata->accepts_enabled = enabled;
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->set_read_handler(nadata->acceptfds[i].iod, enabled);
 
@@ -896,6 +2529,14 @@ netna_set_accept_callback_enable(struct gensio_accepter *accepter,
 static void
 netna_free(struct gensio_accepter *accepter, struct netna_data *nadata)
 {
+    unsigned int i;
+
+    if (nadata->from_fd && nadata->acceptfds) {
+	/* Handed in but never started. */
+	for (i = 0; i < nadata->nr_acceptfds; i++)
+	    nadata->o->close(&nadata->acceptfds[i].iod);
+	nadata->o->free(nadata->o, nadata->acceptfds);
+    }
     if (nadata->lock)
 	nadata->o->free_lock(nadata->lock);
     if (nadata->cb_en_done_runner)
@@ -921,7 +2562,7 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
 		    gensio_event cb, void *user_data, struct gensio **new_io)
 {
     int err;
-    const char *args[4] = { NULL, NULL, NULL, NULL };
+    const char *args[5] = { NULL, NULL, NULL, NULL, NULL };
     char buf[100];
     unsigned int i;
     gensiods max_read_size = nadata->max_read_size;
@@ -931,6 +2572,7 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
     bool is_port_set;
     int protocol = 0;
     bool nodelay = false;
+    bool tfo = false;
 
     err = gensio_scan_network_port(nadata->o, addr, false, &ai,
 				   &protocol, &is_port_set, NULL, &iargs);
@@ -957,6 +2599,9 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
 	if (nadata->istcp &&
 		gensio_check_keybool(args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (nadata->istcp &&
+		gensio_check_keybool(iargs[i], "tfo", &tfo) > 0)
+	    continue;
 	goto out_err;
     }
 
@@ -973,6 +2618,9 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
     if (nodelay)
 	args[i++] = "nodelay";
 
+    if (tfo)
+	args[i++] = "tfo";
+
     err = net_gensio_alloc(ai, args, nadata->o, cb, user_data,
 			   nadata->istcp ? "tcp" : "unix", new_io);
 
@@ -1041,6 +2689,34 @@ netna_control_lport(struct netna_data *nadata, bool get,
     return 0;
 }
 
+static int
+netna_control_handoff(struct netna_data *nadata, bool get,
+		      char *data, gensiods *datalen)
+{
+    unsigned int i;
+    gensiods size = sizeof(int);
+    int rv, fd;
+
+    if (!get)
+	return GE_NOTSUP;
+
+    if (nadata->nr_acceptfds == 0 || !nadata->acceptfds)
+	return GE_NOTREADY;
+
+    i = strtoul(data, NULL, 0);
+    if (i >= nadata->nr_acceptfds)
+	return GE_NOTFOUND;
+
+    rv = nadata->o->sock_control(nadata->acceptfds[i].iod,
+				 GENSIO_SOCKCTL_DUP_FD, &fd, &size);
+    if (rv)
+	return rv;
+    nadata->handed_off = true;
+
+    *datalen = snprintf(data, *datalen, "%d", fd);
+    return 0;
+}
+
 static int
 netna_control(struct gensio_accepter *accepter, struct netna_data *nadata,
 	      bool get, unsigned int option, char *data, gensiods *datalen)
@@ -1052,6 +2728,9 @@ netna_control(struct gensio_accepter *accepter, struct netna_data *nadata,
     case GENSIO_ACC_CONTROL_LPORT:
 	return netna_control_lport(nadata, get, data, datalen);
 
+    case GENSIO_ACC_CONTROL_HANDOFF:
+	return netna_control_handoff(nadata, get, data, datalen);
+
 #ifdef HAVE_TCPD_H
     case GENSIO_ACC_CONTROL_TCPDNAME:
 	if (get) {
@@ -1131,12 +2810,19 @@ struct gensio_enum_val tcpd_enums[] = {
 };
 #endif
 
+/*
+ * If acceptfds is set, the accepter is built on those sockets, which
+ * are already listening, instead of opening its own on startup.  It
+ * owns them if this succeeds.
+ */
 static int
 net_gensio_accepter_alloc(const struct gensio_addr *iai,
 			  const char * const args[],
 			  struct gensio_os_funcs *o,
 			  gensio_accepter_event cb, void *user_data,
 			  const char *type,
+			  struct gensio_opensocks *acceptfds,
+			  unsigned int nr_acceptfds,
 			  struct gensio_accepter **accepter)
 {
     struct netna_data *nadata;
@@ -1144,6 +2830,13 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     bool nodelay = false;
     bool istcp = strcmp(type, "tcp") == 0;
     bool reuseaddr = istcp ? true : false;
+    unsigned int reuseport = 0;
+    unsigned int accept_batch;
+    gensiods zerocopy = 0;
+    bool tfo = false;
+    bool passfd = false;
+    unsigned int busy_poll = 0;
+    bool rxtstamp = false, txtstamp = false, hwtstamp = false;
 #if HAVE_UNIX
     unsigned int umode = 6, gmode = 6, omode = 6, mode;
     bool mode_set = false;
@@ -1169,6 +2862,38 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     }
     reuseaddr = ival;
 
+    if (istcp) {
+	err = gensio_get_default(o, type, "reuseport", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	reuseport = ival;
+	err = gensio_get_default(o, type, "zerocopy", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	zerocopy = ival;
+	err = gensio_get_default(o, type, "tfo", false,
+				 GENSIO_DEFAULT_BOOL, NULL, &ival);
+	if (err)
+	    return err;
+	tfo = ival;
+	err = gensio_get_default(o, type, "busypoll", false,
+				 GENSIO_DEFAULT_INT, NULL, &ival);
+	if (err)
+	    return err;
+	busy_poll = ival;
+	err = net_tstamp_defaults(o, type, &rxtstamp, &txtstamp, &hwtstamp);
+	if (err)
+	    return err;
+    }
+
+    err = gensio_get_default(o, type, "acceptbatch", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    accept_batch = ival;
+
 #ifdef HAVE_TCPD_H
     err = gensio_get_default(o, type, "tcpd", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
@@ -1188,6 +2913,27 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
 	if (istcp &&
 		gensio_check_keybool(args[i], "reuseaddr", &reuseaddr) > 0)
 	    continue;
+	if (istcp &&
+		gensio_check_keyuint(args[i], "reuseport", &reuseport) > 0)
+	    continue;
+	if (istcp && gensio_check_keyds(args[i], "zerocopy", &zerocopy) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "tfo", &tfo) > 0)
+	    continue;
+	if (istcp && gensio_check_keyuint(args[i], "busypoll",
+					  &busy_poll) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "rxtstamp", &rxtstamp) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "txtstamp", &txtstamp) > 0)
+	    continue;
+	if (istcp && gensio_check_keybool(args[i], "hwtstamp", &hwtstamp) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "acceptbatch", &accept_batch) > 0) {
+	    if (accept_batch < 1)
+		return GE_INVAL;
+	    continue;
+	}
 #ifdef HAVE_TCPD_H
 	if (istcp && gensio_check_keyvalue(args[i], "tcpdname", &tcpdname))
 	    continue;
@@ -1221,6 +2967,8 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
 	    continue;
 	if (!istcp && gensio_check_keyvalue(args[i], "group", &group))
 	    continue;
+	if (!istcp && gensio_check_keybool(args[i], "passfd", &passfd) > 0)
+	    continue;
 #endif
 	return GE_INVAL;
     }
@@ -1233,6 +2981,9 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     err = GE_NOMEM;
     if (reuseaddr)
 	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEADDR;
+    if (reuseport)
+	nadata->opensock_flags |= (GENSIO_OPENSOCK_REUSEPORT |
+				   GENSIO_OPENSOCK_SHARDS(reuseport));
 #if HAVE_UNIX
     nadata->mode_set = mode_set;
     nadata->mode = umode << 6 | gmode << 3 | omode;
@@ -1277,6 +3028,17 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     gensio_acc_set_is_reliable(nadata->acc, true);
     nadata->max_read_size = max_read_size;
     nadata->nodelay = nodelay;
+    nadata->zerocopy = zerocopy;
+    nadata->tfo = tfo;
+    nadata->tstamp = net_tstamp_flags(rxtstamp, txtstamp, hwtstamp);
+    nadata->passfd = passfd;
+    nadata->busy_poll = busy_poll;
+    nadata->accept_batch = accept_batch;
+    if (acceptfds) {
+	nadata->from_fd = true;
+	nadata->acceptfds = acceptfds;
+	nadata->nr_acceptfds = nr_acceptfds;
+    }
 
     return 0;
 
@@ -1300,7 +3062,8 @@ str_to_net_gensio_accepter(const char *str, const char * const args[],
     if (err)
 	return err;
 
-    err = net_gensio_accepter_alloc(ai, args, o, cb, user_data, typestr, acc);
+    err = net_gensio_accepter_alloc(ai, args, o, cb, user_data, typestr,
+				    NULL, 0, acc);
     gensio_addr_free(ai);
 
     return err;
@@ -1316,7 +3079,7 @@ tcp_gensio_accepter_alloc(const void *gdata,
     const struct gensio_addr *iai = gdata;
 
     return net_gensio_accepter_alloc(iai, args, o, cb, user_data, "tcp",
-				     accepter);
+				     NULL, 0, accepter);
 }
 
 static int
@@ -1341,7 +3104,7 @@ unix_gensio_accepter_alloc(const void *gdata,
     const struct gensio_addr *iai = gdata;
 
     return net_gensio_accepter_alloc(iai, args, o, cb, user_data, "unix",
-				     accepter);
+				     NULL, 0, accepter);
 #else
     return GE_NOTSUP;
 #endif
@@ -1358,6 +3121,146 @@ str_to_unix_gensio_accepter(const char *str, const char * const args[],
 				      "unix", o, cb, user_data, acc);
 }
 
+/*
+ * Allocate an accepter on the listening sockets in fds, handed over
+ * with GENSIO_ACC_CONTROL_HANDOFF by a process being replaced, for
+ * instance.  The accepter owns the sockets once this succeeds.
+ */
+static int
+net_fd_gensio_accepter_alloc(const int *fds, unsigned int nr_fds,
+			     const char * const args[],
+			     struct gensio_os_funcs *o,
+			     gensio_accepter_event cb, void *user_data,
+			     struct gensio_accepter **accepter)
+{
+    struct gensio_opensocks *acceptfds;
+    struct gensio_addr *addr = NULL, *tmpaddr;
+    gensiods size;
+    bool istcp = true, sock_istcp;
+    unsigned int i, nr_iods = 0;
+    int err;
+
+    if (nr_fds == 0)
+	return GE_INVAL;
+
+    acceptfds = o->zalloc(o, sizeof(*acceptfds) * nr_fds);
+    if (!acceptfds)
+	return GE_NOMEM;
+
+    for (i = 0; i < nr_fds; i++) {
+	err = o->add_iod(o, GENSIO_IOD_SOCKET, fds[i], &acceptfds[i].iod);
+	if (err)
+	    goto out_err;
+	nr_iods++;
+	err = o->sock_control(acceptfds[i].iod, GENSIO_SOCKCTL_ADOPT,
+			      NULL, NULL);
+	if (err)
+	    goto out_err;
+	tmpaddr = NULL;
+	err = o->sock_control(acceptfds[i].iod, GENSIO_SOCKCTL_GET_SOCKNAME,
+			      &tmpaddr, NULL);
+	if (err)
+	    goto out_err;
+
+#if HAVE_UNIX
+	/* Socket addresses report the address family here. */
+	sock_istcp = gensio_addr_get_nettype(tmpaddr) != AF_UNIX;
+#else
+	sock_istcp = true;
+#endif
+	acceptfds[i].family = gensio_addr_get_nettype(tmpaddr);
+	if (!addr) {
+	    addr = tmpaddr;
+	    istcp = sock_istcp;
+	} else {
+	    gensio_addr_free(tmpaddr);
+	    if (sock_istcp != istcp) {
+		err = GE_INVAL;
+		goto out_err;
+	    }
+	}
+
+	if (istcp) {
+	    size = sizeof(acceptfds[i].port);
+	    err = o->sock_control(acceptfds[i].iod, GENSIO_SOCKCTL_GET_PORT,
+				  &acceptfds[i].port, &size);
+	    if (err)
+		goto out_err;
+	}
+    }
+
+    err = net_gensio_accepter_alloc(addr, args, o, cb, user_data,
+				    istcp ? "tcp" : "unix",
+				    acceptfds, nr_fds, accepter);
+    gensio_addr_free(addr);
+    if (!err)
+	return 0;
+    addr = NULL;
+
+ out_err:
+    if (addr)
+	gensio_addr_free(addr);
+    /* The caller still owns the descriptors on failure. */
+    for (i = 0; i < nr_iods; i++)
+	o->release_iod(acceptfds[i].iod);
+    o->free(o, acceptfds);
+    return err;
+}
+
+static int
+sockfd_gensio_accepter_alloc(const void *gdata, const char * const args[],
+			     struct gensio_os_funcs *o,
+			     gensio_accepter_event cb, void *user_data,
+			     struct gensio_accepter **accepter)
+{
+    const int *fds = gdata;
+    unsigned int nr_fds;
+
+    /* The descriptor list is terminated by a -1. */
+    for (nr_fds = 0; fds[nr_fds] >= 0; nr_fds++)
+	;
+
+    return net_fd_gensio_accepter_alloc(fds, nr_fds, args, o, cb, user_data,
+					accepter);
+}
+
+static int
+str_to_sockfd_gensio_accepter(const char *str, const char * const args[],
+			      struct gensio_os_funcs *o,
+			      gensio_accepter_event cb,
+			      void *user_data,
+			      struct gensio_accepter **acc)
+{
+    const char *s;
+    char *end;
+    unsigned int nr_fds = 1, i;
+    int *fds, err;
+    long fd;
+
+    for (s = str; *s; s++) {
+	if (*s == ',')
+	    nr_fds++;
+    }
+
+    fds = o->zalloc(o, sizeof(*fds) * nr_fds);
+    if (!fds)
+	return GE_NOMEM;
+
+    for (s = str, i = 0; i < nr_fds; i++, s = end + 1) {
+	fd = strtol(s, &end, 0);
+	if (end == s || (*end && *end != ',') || fd < 0 || fd > INT_MAX) {
+	    o->free(o, fds);
+	    return GE_INVAL;
+	}
+	fds[i] = fd;
+    }
+
+    err = net_fd_gensio_accepter_alloc(fds, nr_fds, args, o, cb, user_data,
+				       acc);
+    o->free(o, fds);
+    return err;
+}
+
 int
 gensio_init_net(struct gensio_os_funcs *o)
 {
@@ -1377,5 +3280,13 @@ gensio_init_net(struct gensio_os_funcs *o)
 				  unix_gensio_accepter_alloc);
     if (rv)
 	return rv;
+    rv = register_gensio(o, "sockfd", str_to_sockfd_gensio,
+			 sockfd_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_gensio_accepter(o, "sockfd", str_to_sockfd_gensio_accepter,
+				  sockfd_gensio_accepter_alloc);
+    if (rv)
+	return rv;
     return 0;
 }
@@ -0,0 +1,230 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include "config.h"
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_ll_gensio.h>
+#include <gensio/gensio_acc_gensio.h>
+#include <gensio/argvutils.h>
+
+#include "gensio_filter_netsim.h"
+
+static int
+netsim_gensio_alloc(struct gensio *child, const char *const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **net)
+{
+    int err;
+    struct gensio_filter *filter;
+    struct gensio_ll *ll;
+    struct gensio *io;
+    bool is_packet;
+
+    err = gensio_netsim_filter_alloc(o, args, &is_packet, &filter);
+    if (err)
+	return err;
+
+    ll = gensio_gensio_ll_alloc(o, child);
+    if (!ll) {
+	gensio_filter_free(filter);
+	return GE_NOMEM;
+    }
+
+    gensio_ref(child); /* So gensio_ll_free doesn't free the child if fail */
+    io = base_gensio_alloc(o, ll, filter, child, "netsim", cb, user_data);
+    if (!io) {
+	gensio_ll_free(ll);
+	gensio_filter_free(filter);
+	return GE_NOMEM;
+    }
+
+    gensio_set_is_packet(io, is_packet);
+    gensio_set_is_reliable(io, !is_packet);
+    gensio_free(child); /* Lose the ref we acquired. */
+
+    *net = io;
+    return 0;
+}
+
+static int
+str_to_netsim_gensio(const char *str, const char * const args[],
+		     struct gensio_os_funcs *o,
+		     gensio_event cb, void *user_data,
+		     struct gensio **new_gensio)
+{
+    int err;
+    struct gensio *io2;
+
+    err = str_to_gensio(str, o, NULL, NULL, &io2);
+    if (err)
+	return err;
+
+    err = netsim_gensio_alloc(io2, args, o, cb, user_data, new_gensio);
+    if (err)
+	gensio_free(io2);
+
+    return err;
+}
+
+struct netsimna_data {
+    struct gensio_accepter *acc;
+    const char **args;
+    struct gensio_os_funcs *o;
+    bool is_packet;
+};
+
+static void
+netsimna_free(void *acc_data)
+{
+    struct netsimna_data *nadata = acc_data;
+
+    if (nadata->args)
+	gensio_argv_free(nadata->o, nadata->args);
+    nadata->o->free(nadata->o, nadata);
+}
+
+static int
+netsimna_alloc_gensio(void *acc_data, const char * const *iargs,
+		      struct gensio *child, struct gensio **rio)
+{
+    struct netsimna_data *nadata = acc_data;
+
+    return netsim_gensio_alloc(child, iargs, nadata->o, NULL, NULL, rio);
+}
+
+static int
+netsimna_new_child(void *acc_data, void **finish_data,
+		   struct gensio_filter **filter)
+{
+    struct netsimna_data *nadata = acc_data;
+    bool is_packet;
+
+    return gensio_netsim_filter_alloc(nadata->o, nadata->args, &is_packet,
+				      filter);
+}
+
+static int
+netsimna_finish_parent(void *acc_data, void *finish_data, struct gensio *io)
+{
+    struct netsimna_data *nadata = acc_data;
+
+    gensio_set_is_packet(io, nadata->is_packet);
+    gensio_set_is_reliable(io, !nadata->is_packet);
+    return 0;
+}
+
+static int
+gensio_gensio_acc_netsim_cb(void *acc_data, int op, void *data1, void *data2,
+			    void *data3, const void *data4)
+{
+    switch (op) {
+    case GENSIO_GENSIO_ACC_ALLOC_GENSIO:
+	return netsimna_alloc_gensio(acc_data, data4, data1, data2);
+
+    case GENSIO_GENSIO_ACC_NEW_CHILD:
+	return netsimna_new_child(acc_data, data1, data2);
+
+    case GENSIO_GENSIO_ACC_FINISH_PARENT:
+	return netsimna_finish_parent(acc_data, data1, data2);
+
+    case GENSIO_GENSIO_ACC_FREE:
+	netsimna_free(acc_data);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+netsim_gensio_accepter_alloc(struct gensio_accepter *child,
+			     const char * const args[],
+			     struct gensio_os_funcs *o,
+			     gensio_accepter_event cb, void *user_data,
+			     struct gensio_accepter **accepter)
+{
+    struct netsimna_data *nadata;
+    struct gensio_filter *filter;
+    bool is_packet;
+    int err;
+
+    /* Check the arguments and find out what kind of link it is. */
+    err = gensio_netsim_filter_alloc(o, args, &is_packet, &filter);
+    if (err)
+	return err;
+    gensio_filter_free(filter);
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+
+    err = gensio_argv_copy(o, args, NULL, &nadata->args);
+    if (err) {
+	o->free(o, nadata);
+	return err;
+    }
+
+    nadata->o = o;
+    nadata->is_packet = is_packet;
+
+    err = gensio_gensio_accepter_alloc(child, o, "netsim", cb, user_data,
+				       gensio_gensio_acc_netsim_cb, nadata,
+				       &nadata->acc);
+    if (err)
+	goto out_err;
+    gensio_acc_set_is_packet(nadata->acc, is_packet);
+    gensio_acc_set_is_reliable(nadata->acc, !is_packet);
+    *accepter = nadata->acc;
+
+    return 0;
+
+ out_err:
+    netsimna_free(nadata);
+    return err;
+}
+
+static int
+str_to_netsim_gensio_accepter(const char *str, const char * const args[],
+			      struct gensio_os_funcs *o,
+			      gensio_accepter_event cb,
+			      void *user_data,
+			      struct gensio_accepter **acc)
+{
+    int err;
+    struct gensio_accepter *acc2 = NULL;
+
+    err = str_to_gensio_accepter(str, o, NULL, NULL, &acc2);
+    if (!err) {
+	err = netsim_gensio_accepter_alloc(acc2, args, o, cb, user_data, acc);
+	if (err)
+	    gensio_acc_free(acc2);
+    }
+
+    return err;
+}
+
+int
+gensio_init_netsim(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    rv = register_filter_gensio(o, "netsim",
+				str_to_netsim_gensio,
+				netsim_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_filter_gensio_accepter(o, "netsim",
+					 str_to_netsim_gensio_accepter,
+					 netsim_gensio_accepter_alloc);
+    if (rv)
+	return rv;
+    return 0;
+}
@@ -29,6 +29,7 @@
 #include <gensio/gensio_list.h>
 
 #include "errtrig.h"
+#include "pthread_handler.h"
 
 static const char *progname = "gensio";
 
@@ -56,6 +57,7 @@ bool gensio_set_progname(const char *iprogname)
 #include <net/if.h>
 #include <limits.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
 
 int
 gensio_unix_os_setupnewprog(void)
@@ -294,6 +296,104 @@ gensio_os_scan_netaddr(struct gensio_os_funcs *o, const char *str, bool listen,
     return rv;
 }
 
+struct gensio_os_scan_op {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_runner *runner;
+    struct gensio_thread *thread;
+    char *str;
+    bool listen;
+    int protocol;
+    gensio_os_scan_netaddr_done done;
+    void *cb_data;
+    int err;
+    struct gensio_addr *addr;
+};
+
+static void
+gensio_os_scan_op_free(struct gensio_os_scan_op *op)
+{
+    struct gensio_os_funcs *o = op->o;
+
+    if (op->runner)
+	o->free_runner(op->runner);
+    if (op->lock)
+	o->free_lock(op->lock);
+    if (op->str)
+	o->free(o, op->str);
+    o->free(o, op);
+}
+
+static void
+gensio_os_scan_op_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct gensio_os_scan_op *op = cb_data;
+
+    /* Make sure the thread has been stored. */
+    op->o->lock(op->lock);
+    op->o->unlock(op->lock);
+    if (op->thread)
+	gensio_os_wait_thread(op->thread);
+    op->done(op->o, op->err, op->addr, op->cb_data);
+    gensio_os_scan_op_free(op);
+}
+
+static void
+gensio_os_scan_op_thread(void *data)
+{
+    struct gensio_os_scan_op *op = data;
+
+    gensio_os_thread_set_attr(op->o, NULL);
+    op->err = gensio_os_scan_netaddr(op->o, op->str, op->listen,
+				     op->protocol, &op->addr);
+    op->o->run(op->runner);
+}
+
+int
+gensio_os_scan_netaddr_async(struct gensio_os_funcs *o, const char *str,
+			     bool listen, int protocol,
+			     gensio_os_scan_netaddr_done done,
+			     void *cb_data)
+{
+    struct gensio_os_scan_op *op;
+    int err;
+
+    op = o->zalloc(o, sizeof(*op));
+    if (!op)
+	return GE_NOMEM;
+    op->o = o;
+    op->listen = listen;
+    op->protocol = protocol;
+    op->done = done;
+    op->cb_data = cb_data;
+    op->str = gensio_strdup(o, str);
+    if (!op->str)
+	goto out_nomem;
+    op->lock = o->alloc_lock(o);
+    if (!op->lock)
+	goto out_nomem;
+    op->runner = o->alloc_runner(o, gensio_os_scan_op_done, op);
+    if (!op->runner)
+	goto out_nomem;
+
+    o->lock(op->lock);
+    err = gensio_os_new_thread(o, gensio_os_scan_op_thread, op, &op->thread);
+    o->unlock(op->lock);
+    if (err == GE_NOTSUP) {
+	/* No threads, just do it here. */
+	op->thread = NULL;
+	gensio_os_scan_op_thread(op);
+    } else if (err) {
+	gensio_os_scan_op_free(op);
+	return err;
+    }
+    return 0;
+
+ out_nomem:
+    gensio_os_scan_op_free(op);
+    return GE_NOMEM;
+}
+
 
 void
 gensio_os_free_net_ifs(struct gensio_os_funcs *o,
@@ -1057,6 +1157,21 @@ gensio_win_commport_control(struct gensio_os_funcs *o, int op, bool get,
 
     case GENSIO_IOD_CONTROL_FLOWCTL_STATE:
 	rv = GE_NOTSUP;
+	break;
+
+    case GENSIO_IOD_CONTROL_XFER_SIZE:
+	if (get || val <= 0)
+	    return GE_INVAL;
+	if (!SetupComm(h, val, val))
+	    goto out_err;
+	break;
+
+    case GENSIO_IOD_CONTROL_DRAIN:
+	if (get)
+	    return GE_NOTSUP;
+	if (!FlushFileBuffers(h))
+	    goto out_err;
+	break;
 
     default:
 	rv = GE_NOTSUP;
@@ -2376,7 +2491,7 @@ gensio_unix_do_cleanup_nonblock(struct gensio_os_funcs *o, int fd,
     *m = NULL;
 }
 
-#if HAVE_DECL_TIOCSRS485
+#if HAVE_DECL_TIOCSRS485 || defined(__linux__)
 #include <linux/serial.h>
 #endif
 
@@ -2444,6 +2559,13 @@ do_break(int fd)
 {
     ioctl(fd, TCSBRK, 0);
 }
+
+static int
+do_drain(int fd)
+{
+    /* This is what tcdrain() does. */
+    return ioctl(fd, TCSBRK, 1);
+}
 #else
 
 static int
@@ -2475,6 +2597,12 @@ do_break(int fd)
 {
     tcsendbreak(fd, 0);
 }
+
+static int
+do_drain(int fd)
+{
+    return tcdrain(fd);
+}
 #endif
 
 static void s_cfmakeraw(g_termios *termios_p) {
@@ -2739,6 +2867,64 @@ process_rs485(struct gensio_os_funcs *o, struct gensio_unix_termios *t, int fd,
 #endif
 }
 
+/*
+ * USB serial adapters with a latency timer have it as the
+ * latency_timer file in the device directory of the tty in sysfs.
+ */
+static int
+gensio_unix_usb_latency(struct gensio_os_funcs *o, int fd, bool get,
+			intptr_t val)
+{
+#ifdef __linux__
+    char name[PATH_MAX], path[PATH_MAX + 64], buf[16], *end;
+    const char *base;
+    int lfd, rv = 0;
+    ssize_t len;
+    long lval;
+
+    if (ttyname_r(fd, name, sizeof(name)))
+	return GE_NOTSUP;
+    base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer",
+	     base);
+
+    lfd = open(path, get ? O_RDONLY : O_WRONLY);
+    if (lfd == -1) {
+	if (errno == ENOENT || errno == ENOTDIR)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, errno);
+    }
+    if (get) {
+	len = read(lfd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+	    rv = gensio_os_err_to_err(o, errno);
+	    goto out;
+	}
+	buf[len] = '\0';
+	lval = strtol(buf, &end, 10);
+	if (end == buf) {
+	    rv = GE_IOERR;
+	    goto out;
+	}
+	*((int *) val) = lval;
+    } else {
+	if (val < 0 || val > 255) {
+	    rv = GE_INVAL;
+	    goto out;
+	}
+	len = snprintf(buf, sizeof(buf), "%d", (int) val);
+	if (write(lfd, buf, len) != len)
+	    rv = gensio_os_err_to_err(o, errno);
+    }
+ out:
+    close(lfd);
+    return rv;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 int
 gensio_unix_termios_control(struct gensio_os_funcs *o, int op, bool get,
 			    intptr_t val,
@@ -3064,6 +3250,73 @@ gensio_unix_termios_control(struct gensio_os_funcs *o, int op, bool get,
 	    return GE_NOTSUP;
 	set_flowcontrol(fd, val);
 	break;
+
+    case GENSIO_IOD_CONTROL_LOW_LATENCY: {
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+	struct serial_struct ss;
+
+	if (ioctl(fd, TIOCGSERIAL, &ss) == -1) {
+	    if (errno == ENOTTY || errno == EINVAL) /* ptys, USB, etc. */
+		return GE_NOTSUP;
+	    return gensio_os_err_to_err(o, errno);
+	}
+	if (get) {
+	    *((int *) val) = !!(ss.flags & ASYNC_LOW_LATENCY);
+	} else {
+	    if (val)
+		ss.flags |= ASYNC_LOW_LATENCY;
+	    else
+		ss.flags &= ~ASYNC_LOW_LATENCY;
+	    if (ioctl(fd, TIOCSSERIAL, &ss) == -1) {
+		if (errno == ENOTTY || errno == EINVAL)
+		    return GE_NOTSUP;
+		return gensio_os_err_to_err(o, errno);
+	    }
+	}
+	break;
+#else
+	return GE_NOTSUP;
+#endif
+    }
+
+    case GENSIO_IOD_CONTROL_MODEMWAIT:
+#ifdef TIOCMIWAIT
+	if (get)
+	    return GE_NOTSUP;
+	nval = 0;
+	if (val & SERGENSIO_MODEMSTATE_CD)
+	    nval |= TIOCM_CD;
+	if (val & SERGENSIO_MODEMSTATE_RI)
+	    nval |= TIOCM_RI;
+	if (val & SERGENSIO_MODEMSTATE_DSR)
+	    nval |= TIOCM_DSR;
+	if (val & SERGENSIO_MODEMSTATE_CTS)
+	    nval |= TIOCM_CTS;
+	if (ioctl(fd, TIOCMIWAIT, nval) == -1) {
+	    if (errno == ENOTTY || errno == EINVAL || errno == ENOSYS)
+		return GE_NOTSUP;
+	    return gensio_os_err_to_err(o, errno);
+	}
+	break;
+#else
+	return GE_NOTSUP;
+#endif
+
+    case GENSIO_IOD_CONTROL_USB_LATENCY:
+	return gensio_unix_usb_latency(o, fd, get, val);
+
+    case GENSIO_IOD_CONTROL_XFER_SIZE:
+	return GE_NOTSUP;
+
+    case GENSIO_IOD_CONTROL_DRAIN:
+	if (get)
+	    return GE_NOTSUP;
+	if (do_drain(fd) == -1) {
+	    if (errno == ENOTTY || errno == EINVAL)
+		return GE_NOTSUP;
+	    return gensio_os_err_to_err(o, errno);
+	}
+	break;
     }
 
     return rv;
@@ -3114,6 +3367,11 @@ gensio_unix_get_bufcount(struct gensio_os_funcs *o,
 	}
     } else {
 	count = 0; /* Doesn't matter for anything else. */
+#ifdef FIONREAD
+	/* Sockets and pipes can report their receive queue. */
+	if (whichbuf == GENSIO_IN_BUF && ioctl(fd, FIONREAD, &count) == -1)
+	    count = 0;
+#endif
     }
     if (rv)
 	rv = gensio_os_err_to_err(o, errno);
@@ -3124,6 +3382,58 @@ gensio_unix_get_bufcount(struct gensio_os_funcs *o,
 
 extern char **environ;
 
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP) && \
+	defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+#define USE_POSIX_SPAWN
+#include <spawn.h>
+
+/*
+ * Start the program with posix_spawn, which avoids copying the page
+ * tables of a large process like fork does.  Returns -1 if the
+ * caller should fall back to fork, like when the user needs to be
+ * changed or spawning fails, so errors are reported the same way.
+ */
+static int
+gensio_unix_spawn(const char *argv[], const char **env,
+		  const char *start_dir, unsigned int flags, bool do_stderr,
+		  int stdinpipe[2], int stdoutpipe[2], int stderrpipe[2],
+		  int *rpid)
+{
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int err;
+
+    if (getuid() != geteuid())
+	return -1;
+
+    if (posix_spawn_file_actions_init(&fa))
+	return -1;
+    err = posix_spawn_file_actions_adddup2(&fa, stdinpipe[0], 0);
+    if (!err)
+	err = posix_spawn_file_actions_adddup2(&fa, stdoutpipe[1], 1);
+    if (!err && (flags & GENSIO_EXEC_STDERR_TO_STDOUT))
+	err = posix_spawn_file_actions_adddup2(&fa, stdoutpipe[1], 2);
+    else if (!err && do_stderr)
+	err = posix_spawn_file_actions_adddup2(&fa, stderrpipe[1], 2);
+    /* Close everything but stdio. */
+    if (!err)
+	err = posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+    if (!err && start_dir)
+	err = posix_spawn_file_actions_addchdir_np(&fa, start_dir);
+    if (!env)
+	env = (const char **) environ;
+    if (!err)
+	err = posix_spawnp(&pid, argv[0], &fa, NULL, (char * const *) argv,
+			   (char * const *) env);
+    posix_spawn_file_actions_destroy(&fa);
+    if (err)
+	return -1;
+
+    *rpid = pid;
+    return 0;
+}
+#endif
+
 int
 gensio_unix_do_exec(struct gensio_os_funcs *o,
 		    const char *argv[], const char **env,
@@ -3161,6 +3471,16 @@ gensio_unix_do_exec(struct gensio_os_funcs *o,
 	}
     }
 
+#ifdef USE_POSIX_SPAWN
+    if (do_errtrig()) {
+	err = ENOMEM;
+	goto out_err;
+    }
+    if (gensio_unix_spawn(argv, env, start_dir, flags, !!rerr,
+			  stdinpipe, stdoutpipe, stderrpipe, &pid) == 0)
+	goto started;
+#endif
+
     pid = fork();
     if (pid < 0) {
 	err = errno;
@@ -3203,6 +3523,9 @@ gensio_unix_do_exec(struct gensio_os_funcs *o,
 	exit(1); /* Only reached on error. */
     }
 
+#ifdef USE_POSIX_SPAWN
+ started:
+#endif
     close(stdinpipe[0]);
     close(stdoutpipe[1]);
     if (rerr)
@@ -3467,8 +3790,6 @@ gensio_os_loadlib(struct gensio_os_funcs *o, const char *name)
 
 #ifdef ENABLE_INTERNAL_TRACE
 
-#include <pthread_handler.h>
-
 #define TRACEBACK_DEPTH 1
 
 #define MEM_MAGIC 0xddf0983aec9320b0
@@ -3767,6 +4088,620 @@ gensio_os_funcs_zfree(struct gensio_os_funcs *o, void *data)
     o->free(o, data);
 }
 
+/*
+ * Generic object cache, used if the os funcs don't supply one.  Freed
+ * objects are kept on a singly linked list threaded through the
+ * objects themselves, up to a limit.
+ */
+#define GENSIO_MEMCACHE_MAX_FREE 256
+
+struct gensio_memcache {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    void *freelist;
+    struct gensio_memcache_stats stats;
+};
+
+struct gensio_memcache *
+gensio_os_funcs_alloc_cache(struct gensio_os_funcs *o, gensiods size,
+			    const char *name)
+{
+    struct gensio_memcache *c;
+
+    if (o->alloc_cache)
+	return o->alloc_cache(o, size, name);
+
+    c = o->zalloc(o, sizeof(*c));
+    if (!c)
+	return NULL;
+    c->lock = o->alloc_lock(o);
+    if (!c->lock) {
+	o->free(o, c);
+	return NULL;
+    }
+    c->o = o;
+    if (size < sizeof(void *))
+	size = sizeof(void *);
+    c->stats.name = name;
+    c->stats.size = size;
+
+    return c;
+}
+
+void
+gensio_os_funcs_free_cache(struct gensio_os_funcs *o,
+			   struct gensio_memcache *c)
+{
+    void *data;
+
+    if (o->free_cache) {
+	o->free_cache(c);
+	return;
+    }
+
+    assert(c->stats.in_use == 0);
+    while (c->freelist) {
+	data = c->freelist;
+	c->freelist = *((void **) data);
+	o->free(o, data);
+    }
+    o->free_lock(c->lock);
+    o->free(o, c);
+}
+
+void *
+gensio_os_funcs_cache_zalloc(struct gensio_os_funcs *o,
+			     struct gensio_memcache *c)
+{
+    void *data;
+
+    if (o->cache_zalloc)
+	return o->cache_zalloc(c);
+
+    o->lock(c->lock);
+    data = c->freelist;
+    if (data) {
+	c->freelist = *((void **) data);
+	c->stats.cached--;
+	c->stats.hits++;
+    }
+    o->unlock(c->lock);
+
+    if (data)
+	memset(data, 0, c->stats.size);
+    else
+	data = o->zalloc(o, c->stats.size);
+    if (!data)
+	return NULL;
+
+    o->lock(c->lock);
+    c->stats.allocs++;
+    if (++c->stats.in_use > c->stats.max_in_use)
+	c->stats.max_in_use = c->stats.in_use;
+    o->unlock(c->lock);
+
+    return data;
+}
+
+void
+gensio_os_funcs_cache_free(struct gensio_os_funcs *o,
+			   struct gensio_memcache *c, void *data)
+{
+    if (o->cache_free) {
+	o->cache_free(c, data);
+	return;
+    }
+
+    o->lock(c->lock);
+    c->stats.in_use--;
+    if (c->stats.cached < GENSIO_MEMCACHE_MAX_FREE) {
+	*((void **) data) = c->freelist;
+	c->freelist = data;
+	c->stats.cached++;
+	data = NULL;
+    }
+    o->unlock(c->lock);
+
+    if (data)
+	o->free(o, data);
+}
+
+void
+gensio_os_funcs_cache_stats(struct gensio_os_funcs *o,
+			    struct gensio_memcache *c,
+			    struct gensio_memcache_stats *stats)
+{
+    if (o->cache_stats) {
+	o->cache_stats(c, stats);
+	return;
+    }
+
+    o->lock(c->lock);
+    *stats = c->stats;
+    o->unlock(c->lock);
+}
+
+/*
+ * The I/O buffer arena.  It is cut into 2MB chunks, and each chunk
+ * holds buffers of one power of two size class, so the class of a
+ * freed buffer comes from its chunk.  Freed buffers go on a free list
+ * per class, chunks are never given back.  The arena outlives any os
+ * funcs, so it has its own spin lock instead of a gensio lock; the
+ * locked sections are just a few instructions.
+ */
+#define GENSIO_ARENA_CHUNK_SHIFT	21
+#define GENSIO_ARENA_CHUNK_SIZE		\
+    (((gensiods) 1) << GENSIO_ARENA_CHUNK_SHIFT)
+#define GENSIO_ARENA_MIN_SHIFT		8
+#define GENSIO_ARENA_NUM_CLASSES	\
+    (GENSIO_ARENA_CHUNK_SHIFT - GENSIO_ARENA_MIN_SHIFT + 1)
+
+#define gensio_arena_class_size(c) \
+    (((gensiods) 1) << ((c) + GENSIO_ARENA_MIN_SHIFT))
+
+struct gensio_buf_arena {
+    unsigned char *base;
+    unsigned char *end;
+    unsigned char *chunk_class; /* Size class of each used chunk. */
+    void *freelist[GENSIO_ARENA_NUM_CLASSES];
+    unsigned char *carve[GENSIO_ARENA_NUM_CLASSES];
+    gensiods carve_left[GENSIO_ARENA_NUM_CLASSES];
+    struct gensio_buf_arena_stats stats;
+};
+
+static struct gensio_buf_arena *buf_arena;
+static long buf_arena_locked;
+
+static void
+buf_arena_lock(void)
+{
+#ifdef _MSC_VER
+    while (_InterlockedExchange(&buf_arena_locked, 1))
+	;
+#else
+    while (__atomic_exchange_n(&buf_arena_locked, 1, __ATOMIC_ACQUIRE))
+	;
+#endif
+}
+
+static void
+buf_arena_unlock(void)
+{
+#ifdef _MSC_VER
+    _InterlockedExchange(&buf_arena_locked, 0);
+#else
+    __atomic_store_n(&buf_arena_locked, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static struct gensio_buf_arena *
+buf_arena_get(void)
+{
+#ifdef _MSC_VER
+    return (struct gensio_buf_arena *)
+	_InterlockedCompareExchangePointer((void * volatile *) &buf_arena,
+					   NULL, NULL);
+#else
+    return __atomic_load_n(&buf_arena, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Map size bytes, aligned to a chunk.  Returns NULL on failure. */
+static unsigned char *
+buf_arena_map(gensiods size, bool *huge_pages)
+{
+    unsigned char *p = NULL;
+#ifdef _WIN32
+    SIZE_T large = GetLargePageMinimum();
+
+    /* This needs the "Lock pages in memory" privilege. */
+    if (large && GENSIO_ARENA_CHUNK_SIZE % large == 0)
+	p = VirtualAlloc(NULL, size,
+			 MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+			 PAGE_READWRITE);
+    *huge_pages = p != NULL;
+    if (!p)
+	p = VirtualAlloc(NULL, size + GENSIO_ARENA_CHUNK_SIZE,
+			 MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (p && !*huge_pages)
+	/* The slack is wasted, Windows can't unmap part of a region. */
+	p = (unsigned char *)
+	    (((uintptr_t) p + GENSIO_ARENA_CHUNK_SIZE - 1) &
+	     ~((uintptr_t) GENSIO_ARENA_CHUNK_SIZE - 1));
+#else
+    unsigned char *m;
+    uintptr_t head;
+
+#ifdef MAP_HUGETLB
+    /* Fails if the administrator hasn't reserved enough huge pages. */
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED)
+	p = NULL;
+#endif
+    *huge_pages = p != NULL;
+    if (p)
+	return p;
+
+    /* Align it so transparent huge pages can back whole chunks. */
+    m = mmap(NULL, size + GENSIO_ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+	return NULL;
+    head = (GENSIO_ARENA_CHUNK_SIZE -
+	    ((uintptr_t) m & (GENSIO_ARENA_CHUNK_SIZE - 1))) &
+	(GENSIO_ARENA_CHUNK_SIZE - 1);
+    if (head)
+	munmap(m, head);
+    p = m + head;
+    munmap(p + size, GENSIO_ARENA_CHUNK_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+#endif
+    return p;
+}
+
+int
+gensio_os_funcs_set_buf_arena(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_buf_arena *a;
+    gensiods nr_chunks;
+    int rv = 0;
+
+    if (size == 0 || size > ((gensiods) -1) - GENSIO_ARENA_CHUNK_SIZE)
+	return GE_INVAL;
+    nr_chunks = ((size + GENSIO_ARENA_CHUNK_SIZE - 1) >>
+		 GENSIO_ARENA_CHUNK_SHIFT);
+    size = nr_chunks << GENSIO_ARENA_CHUNK_SHIFT;
+
+    /* Not from zalloc, this stays around after the os funcs are gone. */
+    a = calloc(1, sizeof(*a) + nr_chunks);
+    if (!a)
+	return GE_NOMEM;
+    a->chunk_class = ((unsigned char *) a) + sizeof(*a);
+
+    buf_arena_lock();
+    if (buf_arena) {
+	rv = GE_INUSE;
+	goto out_unlock;
+    }
+    a->base = buf_arena_map(size, &a->stats.huge_pages);
+    if (!a->base) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    a->end = a->base + size;
+    a->stats.size = size;
+    a->stats.chunks = nr_chunks;
+#ifdef _MSC_VER
+    _InterlockedExchangePointer((void * volatile *) &buf_arena, a);
+#else
+    __atomic_store_n(&buf_arena, a, __ATOMIC_RELEASE);
+#endif
+    a = NULL;
+ out_unlock:
+    buf_arena_unlock();
+    if (a)
+	free(a);
+    return rv;
+}
+
+int
+gensio_os_funcs_get_buf_arena_stats(struct gensio_os_funcs *o,
+				    struct gensio_buf_arena_stats *stats)
+{
+    struct gensio_buf_arena *a = buf_arena_get();
+
+    if (!a)
+	return GE_NOTREADY;
+    buf_arena_lock();
+    *stats = a->stats;
+    buf_arena_unlock();
+    return 0;
+}
+
+void *
+gensio_os_funcs_buf_zalloc(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_buf_arena *a = buf_arena_get();
+    unsigned int c;
+    gensiods csize;
+    void *p;
+
+    if (!a)
+	return o->zalloc(o, size);
+
+    for (c = 0; c < GENSIO_ARENA_NUM_CLASSES; c++) {
+	if (gensio_arena_class_size(c) >= size)
+	    break;
+    }
+    csize = gensio_arena_class_size(c);
+
+    buf_arena_lock();
+    if (c == GENSIO_ARENA_NUM_CLASSES)
+	goto out_fallback;
+    p = a->freelist[c];
+    if (p) {
+	a->freelist[c] = *((void **) p);
+    } else {
+	if (a->carve_left[c] < csize) {
+	    if (a->stats.chunks_used == a->stats.chunks)
+		goto out_fallback;
+	    a->carve[c] = a->base + (a->stats.chunks_used <<
+				     GENSIO_ARENA_CHUNK_SHIFT);
+	    a->carve_left[c] = GENSIO_ARENA_CHUNK_SIZE;
+	    a->chunk_class[a->stats.chunks_used++] = c;
+	}
+	p = a->carve[c];
+	a->carve[c] += csize;
+	a->carve_left[c] -= csize;
+    }
+    a->stats.allocs++;
+    a->stats.in_use += csize;
+    if (a->stats.in_use > a->stats.max_in_use)
+	a->stats.max_in_use = a->stats.in_use;
+    buf_arena_unlock();
+
+    memset(p, 0, size);
+    return p;
+
+ out_fallback:
+    a->stats.fallbacks++;
+    buf_arena_unlock();
+    return o->zalloc(o, size);
+}
+
+void
+gensio_os_funcs_buf_free(struct gensio_os_funcs *o, void *data)
+{
+    struct gensio_buf_arena *a = buf_arena_get();
+    unsigned char *p = data;
+    unsigned int c;
+
+    if (!a || p < a->base || p >= a->end) {
+	o->free(o, data);
+	return;
+    }
+
+    c = a->chunk_class[(p - a->base) >> GENSIO_ARENA_CHUNK_SHIFT];
+    buf_arena_lock();
+    *((void **) p) = a->freelist[c];
+    a->freelist[c] = p;
+    a->stats.in_use -= gensio_arena_class_size(c);
+    buf_arena_unlock();
+}
+
+int
+gensio_os_funcs_set_loop_stats(struct gensio_os_funcs *o, bool enable,
+			       unsigned int long_cb_usecs)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_SET_LOOP_STATS,
+		      enable ? &long_cb_usecs : NULL, NULL);
+}
+
+int
+gensio_os_funcs_get_loop_stats(struct gensio_os_funcs *o,
+			       struct gensio_loop_stats *stats)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_GET_LOOP_STATS, stats, NULL);
+}
+
+/*
+ * Allocation profiling.  The original zalloc and free are wrapped
+ * with ones that charge each allocation to the innermost tag pushed
+ * by the current thread.  Tags are looked up by pointer and op in a
+ * small table, there are only a few dozen gensio types.
+ */
+#define GENSIO_ALLOC_PROF_ENTRIES 256
+
+struct gensio_alloc_prof {
+    lock_type lock;
+    void *(*zalloc)(struct gensio_os_funcs *o, gensiods size);
+    void (*free)(struct gensio_os_funcs *o, void *data);
+    unsigned int nr_entries;
+    struct gensio_alloc_prof_entry entries[GENSIO_ALLOC_PROF_ENTRIES];
+};
+
+/* The current thread's innermost tag. */
+#ifdef _WIN32
+static DWORD alloc_tag_key = TLS_OUT_OF_INDEXES;
+
+static bool
+alloc_tag_key_init(void)
+{
+    if (alloc_tag_key == TLS_OUT_OF_INDEXES)
+	alloc_tag_key = TlsAlloc();
+    return alloc_tag_key != TLS_OUT_OF_INDEXES;
+}
+#define alloc_tag_get() ((struct gensio_alloc_tag *) TlsGetValue(alloc_tag_key))
+#define alloc_tag_set(t) TlsSetValue(alloc_tag_key, t)
+#elif defined(USE_PTHREADS)
+static pthread_key_t alloc_tag_key;
+static bool alloc_tag_key_set;
+
+static bool
+alloc_tag_key_init(void)
+{
+    if (!alloc_tag_key_set)
+	alloc_tag_key_set = !pthread_key_create(&alloc_tag_key, NULL);
+    return alloc_tag_key_set;
+}
+#define alloc_tag_get() ((struct gensio_alloc_tag *) \
+			 pthread_getspecific(alloc_tag_key))
+#define alloc_tag_set(t) pthread_setspecific(alloc_tag_key, t)
+#else
+static struct gensio_alloc_tag *alloc_tag_cur;
+
+static bool
+alloc_tag_key_init(void)
+{
+    return true;
+}
+#define alloc_tag_get() alloc_tag_cur
+#define alloc_tag_set(t) (alloc_tag_cur = (t))
+#endif
+static lock_type alloc_tag_key_lock = LOCK_INITIALIZER;
+
+/* Called with the lock held.  Returns NULL if the table is full. */
+static struct gensio_alloc_prof_entry *
+alloc_prof_entry(struct gensio_alloc_prof *p, const char *tag,
+		 unsigned int op)
+{
+    struct gensio_alloc_prof_entry *e;
+    unsigned int i;
+
+    for (i = 0; i < p->nr_entries; i++) {
+	e = &p->entries[i];
+	if (e->tag == tag && e->op == op)
+	    return e;
+    }
+    if (p->nr_entries >= GENSIO_ALLOC_PROF_ENTRIES)
+	return NULL;
+    e = &p->entries[p->nr_entries++];
+    e->tag = tag;
+    e->op = op;
+    return e;
+}
+
+static struct gensio_alloc_prof_entry *
+alloc_prof_cur_entry(struct gensio_alloc_prof *p)
+{
+    struct gensio_alloc_tag *t = alloc_tag_get();
+
+    if (!t)
+	return alloc_prof_entry(p, NULL, GENSIO_ALLOC_OP_OTHER);
+    return alloc_prof_entry(p, t->tag, t->op);
+}
+
+static void *
+alloc_prof_zalloc(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_alloc_prof *p = o->alloc_prof;
+    struct gensio_alloc_prof_entry *e;
+    void *data;
+
+    data = p->zalloc(o, size);
+    if (data) {
+	LOCK(&p->lock);
+	e = alloc_prof_cur_entry(p);
+	if (e) {
+	    e->allocs++;
+	    e->bytes += size;
+	}
+	UNLOCK(&p->lock);
+    }
+    return data;
+}
+
+static void
+alloc_prof_free(struct gensio_os_funcs *o, void *data)
+{
+    struct gensio_alloc_prof *p = o->alloc_prof;
+    struct gensio_alloc_prof_entry *e;
+
+    LOCK(&p->lock);
+    e = alloc_prof_cur_entry(p);
+    if (e)
+	e->frees++;
+    UNLOCK(&p->lock);
+    p->free(o, data);
+}
+
+void
+gensio_alloc_tag_push(struct gensio_os_funcs *o, struct gensio_alloc_tag *t,
+		      const char *tag, unsigned int op)
+{
+    struct gensio_alloc_prof *p = o->alloc_prof;
+    struct gensio_alloc_prof_entry *e;
+
+    t->pushed = p != NULL;
+    if (!p)
+	return;
+    t->tag = tag;
+    t->op = op;
+    t->prev = alloc_tag_get();
+    alloc_tag_set(t);
+    LOCK(&p->lock);
+    e = alloc_prof_entry(p, tag, op);
+    if (e)
+	e->count++;
+    UNLOCK(&p->lock);
+}
+
+void
+gensio_alloc_tag_pop(struct gensio_alloc_tag *t)
+{
+    if (t->pushed)
+	alloc_tag_set(t->prev);
+}
+
+int
+gensio_os_funcs_set_alloc_prof(struct gensio_os_funcs *o, bool enable)
+{
+    struct gensio_alloc_prof *p = o->alloc_prof;
+    bool key_ok;
+
+    if (!enable) {
+	if (p) {
+	    o->zalloc = p->zalloc;
+	    o->free = p->free;
+	    o->alloc_prof = NULL;
+	    LOCK_DESTROY(&p->lock);
+	    free(p);
+	}
+	return 0;
+    }
+
+    if (p) {
+	LOCK(&p->lock);
+	p->nr_entries = 0;
+	memset(p->entries, 0, sizeof(p->entries));
+	UNLOCK(&p->lock);
+	return 0;
+    }
+
+    LOCK(&alloc_tag_key_lock);
+    key_ok = alloc_tag_key_init();
+    UNLOCK(&alloc_tag_key_lock);
+    if (!key_ok)
+	return GE_NOMEM;
+
+    p = malloc(sizeof(*p));
+    if (!p)
+	return GE_NOMEM;
+    memset(p, 0, sizeof(*p));
+    LOCK_INIT(&p->lock);
+    p->zalloc = o->zalloc;
+    p->free = o->free;
+    o->alloc_prof = p;
+    o->zalloc = alloc_prof_zalloc;
+    o->free = alloc_prof_free;
+    return 0;
+}
+
+int
+gensio_os_funcs_get_alloc_prof(struct gensio_os_funcs *o,
+			       struct gensio_alloc_prof_entry *entries,
+			       gensiods *nr_entries)
+{
+    struct gensio_alloc_prof *p = o->alloc_prof;
+    gensiods i;
+
+    if (!p)
+	return GE_NOTREADY;
+    LOCK(&p->lock);
+    for (i = 0; i < p->nr_entries && i < *nr_entries; i++)
+	entries[i] = p->entries[i];
+    *nr_entries = p->nr_entries;
+    UNLOCK(&p->lock);
+    return 0;
+}
+
 struct gensio_waiter *
 gensio_os_funcs_alloc_waiter(struct gensio_os_funcs *o)
 {
@@ -3847,6 +4782,69 @@ gensio_os_funcs_get_monotonic_time(struct gensio_os_funcs *o,
     o->get_monotonic_time(o, time);
 }
 
+void
+gensio_os_funcs_get_loop_time(struct gensio_os_funcs *o, gensio_time *time)
+{
+    if (!o->control ||
+		o->control(o, GENSIO_CONTROL_GET_LOOP_TIME, time, NULL))
+	o->get_monotonic_time(o, time);
+}
+
+int
+gensio_os_funcs_set_coarse_time(struct gensio_os_funcs *o, bool enable,
+				unsigned int timer_slack_usecs)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_SET_COARSE_TIME,
+		      enable ? &timer_slack_usecs : NULL, NULL);
+}
+
+int
+gensio_os_funcs_set_busy_poll(struct gensio_os_funcs *o, unsigned int usecs)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_SET_BUSY_POLL, &usecs, NULL);
+}
+
+int
+gensio_os_funcs_set_numa(struct gensio_os_funcs *o, bool enable)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_SET_NUMA, &enable, NULL);
+}
+
+unsigned int
+gensio_os_funcs_get_numa_node(struct gensio_os_funcs *o)
+{
+    unsigned int node;
+
+    if (!o->control || o->control(o, GENSIO_CONTROL_GET_NUMA_NODE,
+				  &node, NULL))
+	return 0;
+    return node;
+}
+
+int
+gensio_os_funcs_set_realtime(struct gensio_os_funcs *o, bool enable,
+			     unsigned int priority)
+{
+    if (!o->control)
+	return GE_NOTSUP;
+    return o->control(o, GENSIO_CONTROL_SET_REALTIME,
+		      enable ? &priority : NULL, NULL);
+}
+
+bool
+gensio_os_funcs_is_realtime(struct gensio_os_funcs *o)
+{
+    if (!o->control)
+	return false;
+    return o->control(o, GENSIO_CONTROL_GET_REALTIME, NULL, NULL) == 0;
+}
+
 struct gensio_timer *
 gensio_os_funcs_alloc_timer(struct gensio_os_funcs *o,
 			    void (*handler)(struct gensio_timer *t,
@@ -0,0 +1,1127 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * An in-process gensio pair.  A pipe accepter registers a name in the
+ * process, and opening a pipe connecter with that name creates a
+ * connection between the two with no kernel involvement.
+ *
+ * Each connection has a buffer for each direction.  A write copies
+ * the data into the buffer of the other end, and the other end's
+ * read callback gets a pointer straight into that buffer, so data is
+ * copied once.  The buffers are mirrored where possible, so a read
+ * always gets all the data waiting.
+ *
+ * Everything about a connection, both ends included, is protected by
+ * the connection lock.  The pipes list is protected by pipes_lock,
+ * which nests outside the accepter lock.  Nothing takes either of
+ * those with a connection lock held.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_base.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_circbuf.h>
+#include <gensio/argvutils.h>
+
+enum pipe_end_state {
+    PIPE_END_CLOSED,
+    PIPE_END_IN_OPEN,
+    PIPE_END_OPEN,
+    PIPE_END_IN_CLOSE
+};
+
+struct pipe_conn;
+
+struct pipe_end {
+    struct pipe_conn *conn;
+    unsigned int side; /* 0 is the connecter, 1 the accepter. */
+    enum pipe_end_state state;
+
+    gensio_ll_cb cb;
+    void *cb_data;
+
+    bool read_enabled;
+    bool write_enabled;
+    bool in_read;
+    bool in_write;
+
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_runner;
+    bool deferred_open;
+
+    int open_err;
+    gensio_ll_open_done open_done;
+    void *open_data;
+    gensio_ll_close_done close_done;
+    void *close_data;
+};
+
+struct pipe_conn {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    /* On the accepter's pending list until it is accepted. */
+    struct gensio_link link;
+
+    /* buf[n] holds the data for end n to read. */
+    struct gensio_circbuf *buf[2];
+    struct pipe_end end[2];
+};
+
+struct pipe_ll {
+    struct gensio_os_funcs *o;
+    struct gensio_ll *ll;
+    char *name;
+    unsigned int side;
+    gensiods readbuf;
+
+    gensio_ll_cb cb;
+    void *cb_data;
+    bool read_enabled;
+    bool write_enabled;
+
+    /* The connecter gets a new one on each open. */
+    struct pipe_conn *conn;
+};
+
+#define ll_to_pipe(v) ((struct pipe_ll *) gensio_ll_get_user_data(v))
+
+struct pipena_data {
+    struct gensio_link link;
+    struct gensio_accepter *acc;
+    struct gensio_os_funcs *o;
+    char *name;
+    gensiods readbuf;
+    bool in_list;
+
+    struct gensio_lock *lock;
+    bool runner_pending;
+    bool runner_rerun;
+    struct gensio_runner *runner;
+    gensio_acc_done cb_en_done;
+    gensio_acc_done shutdown_done;
+    bool accepts_enabled;
+
+    /* Connections waiting to be accepted. */
+    struct gensio_list pending;
+};
+
+static struct gensio_once pipes_initialized;
+static struct gensio_lock *pipes_lock;
+static struct gensio_list pipes;
+static int pipes_rv;
+
+static void pipena_sched_runner(struct pipena_data *nadata);
+
+static void
+pipes_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&pipes);
+    pipes_lock = o->alloc_lock(o);
+    if (!pipes_lock)
+	pipes_rv = GE_NOMEM;
+}
+
+static void
+pipe_conn_lock(struct pipe_conn *conn)
+{
+    conn->o->lock(conn->lock);
+}
+
+static void
+pipe_conn_unlock(struct pipe_conn *conn)
+{
+    conn->o->unlock(conn->lock);
+}
+
+static void
+pipe_conn_ref(struct pipe_conn *conn)
+{
+    assert(conn->refcount > 0);
+    conn->refcount++;
+}
+
+static void
+pipe_conn_finish_free(struct pipe_conn *conn)
+{
+    struct gensio_os_funcs *o = conn->o;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+	if (conn->buf[i])
+	    gensio_circbuf_free(conn->buf[i]);
+	if (conn->end[i].deferred_runner)
+	    o->free_runner(conn->end[i].deferred_runner);
+    }
+    if (conn->lock)
+	o->free_lock(conn->lock);
+    o->free(o, conn);
+}
+
+static void
+pipe_conn_deref_and_unlock(struct pipe_conn *conn)
+{
+    unsigned int refcount;
+
+    assert(conn->refcount > 0);
+    refcount = --conn->refcount;
+    pipe_conn_unlock(conn);
+    if (refcount == 0)
+	pipe_conn_finish_free(conn);
+}
+
+static struct pipe_end *
+pipe_end_peer(struct pipe_end *e)
+{
+    return &e->conn->end[!e->side];
+}
+
+static bool
+pipe_end_gone(struct pipe_end *e)
+{
+    return e->state == PIPE_END_CLOSED || e->state == PIPE_END_IN_CLOSE;
+}
+
+/* Must be called with the lock held. */
+static void
+pipe_end_sched_deferred_op(struct pipe_end *e)
+{
+    if (!e->deferred_op_pending) {
+	pipe_conn_ref(e->conn);
+	e->deferred_op_pending = true;
+	e->conn->o->run(e->deferred_runner);
+    }
+}
+
+static void
+pipe_end_check_read(struct pipe_end *e)
+{
+    struct gensio_circbuf *buf = e->conn->buf[e->side];
+    struct pipe_end *peer = pipe_end_peer(e);
+    gensiods count, avail;
+    void *data;
+
+    if (e->in_read)
+	return;
+    e->in_read = true;
+    while (e->read_enabled && e->state == PIPE_END_OPEN) {
+	/* Data written before the peer closed is delivered first. */
+	if (gensio_circbuf_datalen(buf) == 0) {
+	    if (!pipe_end_gone(peer))
+		break;
+	    pipe_conn_unlock(e->conn);
+	    e->cb(e->cb_data, GENSIO_LL_CB_READ, GE_REMCLOSE, NULL, 0, NULL);
+	    pipe_conn_lock(e->conn);
+	    break;
+	}
+
+	gensio_circbuf_next_read_area(buf, &data, &avail);
+	pipe_conn_unlock(e->conn);
+	count = e->cb(e->cb_data, GENSIO_LL_CB_READ, 0, data, avail, NULL);
+	pipe_conn_lock(e->conn);
+	if (count > avail)
+	    count = avail;
+	gensio_circbuf_data_removed(buf, count);
+	if (count && peer->write_enabled)
+	    pipe_end_sched_deferred_op(peer);
+
+	if (count < avail) {
+	    /* The user didn't take it all, try again later. */
+	    if (e->read_enabled)
+		pipe_end_sched_deferred_op(e);
+	    break;
+	}
+    }
+    e->in_read = false;
+}
+
+static bool
+pipe_end_write_ready(struct pipe_end *e)
+{
+    struct pipe_end *peer = pipe_end_peer(e);
+
+    /* Let the write report the peer going away. */
+    return (pipe_end_gone(peer) ||
+	    gensio_circbuf_room_left(e->conn->buf[peer->side]) > 0);
+}
+
+static void
+pipe_end_check_write(struct pipe_end *e)
+{
+    if (e->in_write || !e->write_enabled || e->state != PIPE_END_OPEN)
+	return;
+    if (!pipe_end_write_ready(e))
+	return;
+
+    e->in_write = true;
+    pipe_conn_unlock(e->conn);
+    e->cb(e->cb_data, GENSIO_LL_CB_WRITE_READY, 0, NULL, 0, NULL);
+    pipe_conn_lock(e->conn);
+    e->in_write = false;
+
+    if (e->write_enabled && e->state == PIPE_END_OPEN &&
+		pipe_end_write_ready(e))
+	pipe_end_sched_deferred_op(e);
+}
+
+static int
+pipe_end_write(struct pipe_end *e, gensiods *rcount,
+	       const struct gensio_sg *sg, gensiods sglen)
+{
+    struct pipe_end *peer;
+    gensiods count = 0;
+    int err = 0;
+
+    pipe_conn_lock(e->conn);
+    peer = pipe_end_peer(e);
+    if (e->state != PIPE_END_OPEN) {
+	err = GE_NOTREADY;
+    } else if (pipe_end_gone(peer)) {
+	err = GE_REMCLOSE;
+    } else {
+	gensio_circbuf_sg_write(e->conn->buf[peer->side], sg, sglen, &count);
+	if (count && peer->read_enabled)
+	    pipe_end_sched_deferred_op(peer);
+    }
+    pipe_conn_unlock(e->conn);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+static void
+pipe_end_do_open(struct pipe_end *e, int err)
+{
+    gensio_ll_open_done open_done = e->open_done;
+    void *open_data = e->open_data;
+
+    e->open_done = NULL;
+    if (!open_done)
+	return;
+    pipe_conn_unlock(e->conn);
+    open_done(e->cb_data, err, open_data);
+    pipe_conn_lock(e->conn);
+}
+
+static void
+pipe_end_do_close(struct pipe_end *e)
+{
+    gensio_ll_close_done close_done = e->close_done;
+    void *close_data = e->close_data;
+
+    e->close_done = NULL;
+    if (!close_done)
+	return;
+    pipe_conn_unlock(e->conn);
+    close_done(e->cb_data, close_data);
+    pipe_conn_lock(e->conn);
+}
+
+static void
+pipe_end_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct pipe_end *e = cb_data;
+
+    pipe_conn_lock(e->conn);
+    e->deferred_op_pending = false;
+    switch (e->state) {
+    case PIPE_END_OPEN:
+	if (e->deferred_open) {
+	    e->deferred_open = false;
+	    pipe_end_do_open(e, 0);
+	    if (e->state != PIPE_END_OPEN)
+		break;
+	}
+	pipe_end_check_read(e);
+	pipe_end_check_write(e);
+	break;
+
+    case PIPE_END_IN_CLOSE:
+	e->state = PIPE_END_CLOSED;
+	pipe_end_do_open(e, e->open_err ? e->open_err : GE_LOCALCLOSED);
+	pipe_end_do_close(e);
+	break;
+
+    default:
+	break;
+    }
+    pipe_conn_deref_and_unlock(e->conn);
+}
+
+/*
+ * Must be called with the lock held.  The peer is kicked so it sees
+ * us going away.
+ */
+static void
+pipe_end_start_close(struct pipe_end *e)
+{
+    struct pipe_end *peer = pipe_end_peer(e);
+
+    e->state = PIPE_END_IN_CLOSE;
+    e->deferred_open = false;
+    pipe_end_sched_deferred_op(e);
+    if (peer->state == PIPE_END_OPEN)
+	pipe_end_sched_deferred_op(peer);
+}
+
+/* Fail an open that never got to the accepter. */
+static void
+pipe_conn_refuse(struct pipe_conn *conn, int err)
+{
+    struct pipe_end *e = &conn->end[0];
+
+    pipe_conn_lock(conn);
+    if (e->state == PIPE_END_IN_OPEN) {
+	e->open_err = err;
+	e->state = PIPE_END_IN_CLOSE;
+	pipe_end_sched_deferred_op(e);
+    }
+    pipe_conn_deref_and_unlock(conn);
+}
+
+static struct pipe_conn *
+pipe_conn_alloc(struct gensio_os_funcs *o)
+{
+    struct pipe_conn *conn;
+    unsigned int i;
+
+    conn = o->zalloc(o, sizeof(*conn));
+    if (!conn)
+	return NULL;
+    conn->o = o;
+    conn->refcount = 1;
+
+    conn->lock = o->alloc_lock(o);
+    if (!conn->lock)
+	goto out_nomem;
+
+    for (i = 0; i < 2; i++) {
+	conn->end[i].conn = conn;
+	conn->end[i].side = i;
+	conn->end[i].deferred_runner = o->alloc_runner(o, pipe_end_deferred_op,
+						       &conn->end[i]);
+	if (!conn->end[i].deferred_runner)
+	    goto out_nomem;
+    }
+    return conn;
+
+ out_nomem:
+    pipe_conn_finish_free(conn);
+    return NULL;
+}
+
+/* Attach a connection end to the ll, copying the ll's settings. */
+static void
+pipe_ll_attach(struct pipe_ll *pll, struct pipe_conn *conn)
+{
+    struct pipe_end *e = &conn->end[pll->side];
+
+    pll->conn = conn;
+    e->cb = pll->cb;
+    e->cb_data = pll->cb_data;
+    e->read_enabled = pll->read_enabled;
+    e->write_enabled = pll->write_enabled;
+}
+
+static int
+pipe_ll_open(struct pipe_ll *pll, gensio_ll_open_done done, void *open_data)
+{
+    struct gensio_os_funcs *o = pll->o;
+    struct pipena_data *nadata = NULL;
+    struct pipe_conn *conn, *old;
+    struct gensio_link *l;
+    struct pipe_end *e;
+
+    if (pll->side != 0)
+	return GE_NOTREADY;
+
+    old = pll->conn;
+    if (old) {
+	pipe_conn_lock(old);
+	if (old->end[0].state != PIPE_END_CLOSED) {
+	    pipe_conn_unlock(old);
+	    return GE_NOTREADY;
+	}
+	pipe_conn_unlock(old);
+    }
+
+    o->call_once(o, &pipes_initialized, pipes_init, o);
+    if (pipes_rv)
+	return pipes_rv;
+
+    conn = pipe_conn_alloc(o);
+    if (!conn)
+	return GE_NOMEM;
+    conn->buf[0] = gensio_circbuf_alloc_mirrored(o, pll->readbuf);
+    if (!conn->buf[0]) {
+	pipe_conn_finish_free(conn);
+	return GE_NOMEM;
+    }
+    e = &conn->end[0];
+    e->state = PIPE_END_IN_OPEN;
+    e->open_done = done;
+    e->open_data = open_data;
+    /* The accepter end stays closed until the accepter takes it. */
+
+    o->lock(pipes_lock);
+    gensio_list_for_each(&pipes, l) {
+	nadata = gensio_container_of(l, struct pipena_data, link);
+	if (nadata->o == o && strcmp(nadata->name, pll->name) == 0)
+	    break;
+	nadata = NULL;
+    }
+    if (!nadata) {
+	o->unlock(pipes_lock);
+	pipe_conn_finish_free(conn);
+	return GE_CONNREFUSE;
+    }
+
+    if (old) {
+	pipe_conn_lock(old);
+	pipe_conn_deref_and_unlock(old);
+    }
+    pipe_ll_attach(pll, conn);
+
+    o->lock(nadata->lock);
+    pipe_conn_ref(conn); /* For the pending list. */
+    gensio_list_add_tail(&nadata->pending, &conn->link);
+    if (nadata->accepts_enabled)
+	pipena_sched_runner(nadata);
+    o->unlock(nadata->lock);
+    o->unlock(pipes_lock);
+
+    return GE_INPROGRESS;
+}
+
+static int
+pipe_ll_close(struct pipe_ll *pll, gensio_ll_close_done done,
+	      void *close_data)
+{
+    struct pipe_end *e;
+    int err = 0;
+
+    if (!pll->conn)
+	return GE_NOTREADY;
+    e = &pll->conn->end[pll->side];
+
+    pipe_conn_lock(pll->conn);
+    switch (e->state) {
+    case PIPE_END_IN_OPEN:
+	e->open_err = GE_LOCALCLOSED;
+	/* Fallthrough */
+    case PIPE_END_OPEN:
+	e->close_done = done;
+	e->close_data = close_data;
+	pipe_end_start_close(e);
+	break;
+
+    case PIPE_END_IN_CLOSE:
+	/* A failed open that hasn't been reported yet. */
+	if (e->open_done && !e->close_done) {
+	    e->close_done = done;
+	    e->close_data = close_data;
+	    break;
+	}
+	/* Fallthrough */
+    default:
+	err = GE_NOTREADY;
+    }
+    pipe_conn_unlock(pll->conn);
+    return err;
+}
+
+static void
+pipe_ll_set_read_callback_enable(struct pipe_ll *pll, bool enabled)
+{
+    struct pipe_end *e;
+
+    pll->read_enabled = enabled;
+    if (!pll->conn)
+	return;
+    e = &pll->conn->end[pll->side];
+
+    pipe_conn_lock(pll->conn);
+    e->read_enabled = enabled;
+    if (enabled && e->state == PIPE_END_OPEN && !e->deferred_open)
+	pipe_end_sched_deferred_op(e);
+    pipe_conn_unlock(pll->conn);
+}
+
+static void
+pipe_ll_set_write_callback_enable(struct pipe_ll *pll, bool enabled)
+{
+    struct pipe_end *e;
+
+    pll->write_enabled = enabled;
+    if (!pll->conn)
+	return;
+    e = &pll->conn->end[pll->side];
+
+    pipe_conn_lock(pll->conn);
+    e->write_enabled = enabled;
+    if (enabled && e->state == PIPE_END_OPEN && !e->deferred_open)
+	pipe_end_sched_deferred_op(e);
+    pipe_conn_unlock(pll->conn);
+}
+
+static int
+pipe_ll_control(struct pipe_ll *pll, bool get, unsigned int option,
+		char *data, gensiods *datalen)
+{
+    switch (option) {
+    case GENSIO_CONTROL_RADDR:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 0)
+	    return GE_NOTFOUND;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%s", pll->name);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+pipe_ll_finish_free(struct pipe_ll *pll)
+{
+    struct gensio_os_funcs *o = pll->o;
+
+    if (pll->name)
+	o->free(o, pll->name);
+    if (pll->ll)
+	gensio_ll_free_data(pll->ll);
+    o->free(o, pll);
+}
+
+static void
+pipe_ll_free(struct pipe_ll *pll)
+{
+    struct pipe_conn *conn = pll->conn;
+    struct pipe_end *e;
+
+    if (conn) {
+	e = &conn->end[pll->side];
+	pipe_conn_lock(conn);
+	e->open_done = NULL;
+	e->close_done = NULL;
+	if (e->state == PIPE_END_IN_OPEN || e->state == PIPE_END_OPEN)
+	    pipe_end_start_close(e);
+	pipe_conn_deref_and_unlock(conn);
+    }
+    pipe_ll_finish_free(pll);
+}
+
+static void
+pipe_ll_disable(struct pipe_ll *pll)
+{
+    if (!pll->conn)
+	return;
+    pipe_conn_lock(pll->conn);
+    pll->conn->end[pll->side].state = PIPE_END_CLOSED;
+    pipe_conn_unlock(pll->conn);
+}
+
+static int
+pipe_ll_func(struct gensio_ll *ll, int op, gensiods *count,
+	     void *buf, const void *cbuf, gensiods buflen,
+	     const char *const *auxdata)
+{
+    struct pipe_ll *pll = ll_to_pipe(ll);
+
+    switch (op) {
+    case GENSIO_LL_FUNC_SET_CALLBACK:
+	pll->cb = (gensio_ll_cb) cbuf;
+	pll->cb_data = buf;
+	if (pll->conn) {
+	    pipe_conn_lock(pll->conn);
+	    pll->conn->end[pll->side].cb = pll->cb;
+	    pll->conn->end[pll->side].cb_data = pll->cb_data;
+	    pipe_conn_unlock(pll->conn);
+	}
+	return 0;
+
+    case GENSIO_LL_FUNC_WRITE_SG:
+	if (!pll->conn)
+	    return GE_NOTREADY;
+	return pipe_end_write(&pll->conn->end[pll->side], count, cbuf, buflen);
+
+    case GENSIO_LL_FUNC_OPEN:
+	return pipe_ll_open(pll, (gensio_ll_open_done) cbuf, buf);
+
+    case GENSIO_LL_FUNC_CLOSE:
+	return pipe_ll_close(pll, (gensio_ll_close_done) cbuf, buf);
+
+    case GENSIO_LL_FUNC_SET_READ_CALLBACK:
+	pipe_ll_set_read_callback_enable(pll, buflen);
+	return 0;
+
+    case GENSIO_LL_FUNC_SET_WRITE_CALLBACK:
+	pipe_ll_set_write_callback_enable(pll, buflen);
+	return 0;
+
+    case GENSIO_LL_FUNC_FREE:
+	pipe_ll_free(pll);
+	return 0;
+
+    case GENSIO_LL_FUNC_DISABLE:
+	pipe_ll_disable(pll);
+	return 0;
+
+    case GENSIO_LL_FUNC_CONTROL:
+	return pipe_ll_control(pll, *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct pipe_ll *
+pipe_ll_alloc(struct gensio_os_funcs *o, const char *name, unsigned int side,
+	      gensiods readbuf)
+{
+    struct pipe_ll *pll;
+
+    pll = o->zalloc(o, sizeof(*pll));
+    if (!pll)
+	return NULL;
+    pll->o = o;
+    pll->side = side;
+    pll->readbuf = readbuf;
+
+    pll->name = gensio_strdup(o, name);
+    if (!pll->name)
+	goto out_nomem;
+
+    pll->ll = gensio_ll_alloc_data(o, pipe_ll_func, pll);
+    if (!pll->ll)
+	goto out_nomem;
+
+    return pll;
+
+ out_nomem:
+    pipe_ll_finish_free(pll);
+    return NULL;
+}
+
+static int
+pipe_gensio_alloc(const void *gdata, const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    const char *name = gdata;
+    gensiods readbuf = GENSIO_DEFAULT_BUF_SIZE;
+    struct pipe_ll *pll;
+    struct gensio *io;
+    unsigned int i;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "readbuf", &readbuf) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (readbuf == 0)
+	return GE_INVAL;
+
+    pll = pipe_ll_alloc(o, name, 0, readbuf);
+    if (!pll)
+	return GE_NOMEM;
+
+    io = base_gensio_alloc(o, pll->ll, NULL, NULL, "pipe", cb, user_data);
+    if (!io) {
+	gensio_ll_free(pll->ll);
+	return GE_NOMEM;
+    }
+    gensio_set_is_reliable(io, true);
+
+    *new_gensio = io;
+    return 0;
+}
+
+static int
+str_to_pipe_gensio(const char *str, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    return pipe_gensio_alloc(str, args, o, cb, user_data, new_gensio);
+}
+
+static void
+pipena_lock(struct pipena_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+}
+
+static void
+pipena_unlock(struct pipena_data *nadata)
+{
+    nadata->o->unlock(nadata->lock);
+}
+
+static void
+pipena_finish_server_open(struct gensio *io, int err, void *cb_data)
+{
+    struct pipena_data *nadata = cb_data;
+
+    base_gensio_server_open_done(nadata->acc, io, err);
+}
+
+/* Create the accepter end of a pending connection.  Drops its ref. */
+static void
+pipena_accept_one(struct pipena_data *nadata, struct pipe_conn *conn)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct pipe_ll *pll = NULL;
+    struct gensio *io = NULL;
+    struct pipe_end *e;
+    int err;
+
+    pipe_conn_lock(conn);
+    if (conn->end[0].state != PIPE_END_IN_OPEN) {
+	/* Closed while waiting. */
+	pipe_conn_deref_and_unlock(conn);
+	return;
+    }
+    pipe_conn_unlock(conn);
+
+    err = base_gensio_accepter_new_child_start(nadata->acc);
+    if (err) {
+	pipe_conn_refuse(conn, err);
+	return;
+    }
+
+    err = GE_NOMEM;
+    conn->buf[1] = gensio_circbuf_alloc_mirrored(o, nadata->readbuf);
+    if (!conn->buf[1])
+	goto out_err;
+
+    pll = pipe_ll_alloc(o, nadata->name, 1, nadata->readbuf);
+    if (!pll)
+	goto out_err;
+    pipe_conn_lock(conn);
+    pipe_conn_ref(conn);
+    pipe_ll_attach(pll, conn);
+    conn->end[1].state = PIPE_END_OPEN;
+    pipe_conn_unlock(conn);
+
+    io = base_gensio_server_alloc(o, pll->ll, NULL, NULL, "pipe",
+				  pipena_finish_server_open, nadata);
+    if (!io)
+	goto out_err;
+    gensio_set_is_reliable(io, true);
+    err = base_gensio_server_start(io);
+    if (err)
+	goto out_err;
+    base_gensio_accepter_new_child_end(nadata->acc, io, 0);
+
+    /* Now finish the connecter's open. */
+    pipe_conn_lock(conn);
+    e = &conn->end[0];
+    if (e->state == PIPE_END_IN_OPEN) {
+	e->state = PIPE_END_OPEN;
+	e->deferred_open = true;
+	pipe_end_sched_deferred_op(e);
+    } else {
+	/* Closed while we were working, let the new end know. */
+	pipe_end_sched_deferred_op(&conn->end[1]);
+    }
+    pipe_conn_deref_and_unlock(conn);
+    return;
+
+ out_err:
+    base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
+    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		   "Error setting up pipe gensio: %s", gensio_err_to_str(err));
+    if (io)
+	gensio_free(io);
+    else if (pll)
+	gensio_ll_free(pll->ll);
+    pipe_conn_refuse(conn, err);
+}
+
+static void
+pipena_runner(struct gensio_runner *runner, void *cb_data)
+{
+    struct pipena_data *nadata = cb_data;
+    struct gensio_link *l;
+    struct pipe_conn *conn;
+    gensio_acc_done done;
+
+    pipena_lock(nadata);
+ restart:
+    nadata->runner_rerun = false;
+    if (nadata->cb_en_done) {
+	done = nadata->cb_en_done;
+	nadata->cb_en_done = NULL;
+	pipena_unlock(nadata);
+	done(nadata->acc, NULL);
+	pipena_lock(nadata);
+    }
+
+    while (nadata->accepts_enabled && !nadata->shutdown_done &&
+	   !gensio_list_empty(&nadata->pending)) {
+	l = gensio_list_first(&nadata->pending);
+	gensio_list_rm(&nadata->pending, l);
+	conn = gensio_container_of(l, struct pipe_conn, link);
+	pipena_unlock(nadata);
+	pipena_accept_one(nadata, conn);
+	pipena_lock(nadata);
+    }
+
+    if (nadata->shutdown_done) {
+	/* Nothing can be added now, we are off the pipes list. */
+	while (!gensio_list_empty(&nadata->pending)) {
+	    l = gensio_list_first(&nadata->pending);
+	    gensio_list_rm(&nadata->pending, l);
+	    conn = gensio_container_of(l, struct pipe_conn, link);
+	    pipe_conn_refuse(conn, GE_CONNREFUSE);
+	}
+	done = nadata->shutdown_done;
+	nadata->shutdown_done = NULL;
+	nadata->runner_pending = false;
+	pipena_unlock(nadata);
+	done(nadata->acc, NULL);
+	return;
+    }
+    if (nadata->runner_rerun)
+	goto restart;
+    nadata->runner_pending = false;
+    pipena_unlock(nadata);
+}
+
+/*
+ * Must be called with the lock held.  The runner may drop the lock,
+ * if it is running it is told to go around again instead of being
+ * run a second time in parallel.
+ */
+static void
+pipena_sched_runner(struct pipena_data *nadata)
+{
+    if (nadata->runner_pending) {
+	nadata->runner_rerun = true;
+    } else {
+	nadata->runner_pending = true;
+	nadata->o->run(nadata->runner);
+    }
+}
+
+static void
+pipena_remove(struct pipena_data *nadata)
+{
+    nadata->o->lock(pipes_lock);
+    if (nadata->in_list) {
+	gensio_list_rm(&pipes, &nadata->link);
+	nadata->in_list = false;
+    }
+    nadata->o->unlock(pipes_lock);
+}
+
+static int
+pipena_startup(struct gensio_accepter *accepter, struct pipena_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_link *l;
+    struct pipena_data *other;
+    int rv = 0;
+
+    o->call_once(o, &pipes_initialized, pipes_init, o);
+    if (pipes_rv)
+	return pipes_rv;
+
+    o->lock(pipes_lock);
+    gensio_list_for_each(&pipes, l) {
+	other = gensio_container_of(l, struct pipena_data, link);
+	if (other->o == o && strcmp(other->name, nadata->name) == 0) {
+	    rv = GE_ADDRINUSE;
+	    goto out_unlock;
+	}
+    }
+    gensio_list_add_tail(&pipes, &nadata->link);
+    nadata->in_list = true;
+    pipena_lock(nadata);
+    nadata->accepts_enabled = true;
+    pipena_unlock(nadata);
+ out_unlock:
+    o->unlock(pipes_lock);
+    return rv;
+}
+
+static int
+pipena_shutdown(struct gensio_accepter *accepter, struct pipena_data *nadata,
+		gensio_acc_done shutdown_done)
+{
+    pipena_remove(nadata);
+    pipena_lock(nadata);
+    nadata->accepts_enabled = false;
+    nadata->shutdown_done = shutdown_done;
+    pipena_sched_runner(nadata);
+    pipena_unlock(nadata);
+    return 0;
+}
+
+static int
+pipena_set_accept_callback_enable(struct gensio_accepter *accepter,
+				  struct pipena_data *nadata,
+				  bool enabled, gensio_acc_done done)
+{
+    int rv = 0;
+
+    pipena_lock(nadata);
+    if (nadata->cb_en_done) {
+	rv = GE_INUSE;
+	goto out_unlock;
+    }
+    nadata->cb_en_done = done;
+    nadata->accepts_enabled = enabled;
+    if (done || (enabled && !gensio_list_empty(&nadata->pending)))
+	pipena_sched_runner(nadata);
+ out_unlock:
+    pipena_unlock(nadata);
+    return rv;
+}
+
+static void
+pipena_free(struct gensio_accepter *accepter, struct pipena_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->in_list)
+	pipena_remove(nadata);
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    if (nadata->runner)
+	o->free_runner(nadata->runner);
+    if (nadata->name)
+	o->free(o, nadata->name);
+    o->free(o, nadata);
+}
+
+static void
+pipena_disable(struct gensio_accepter *accepter, struct pipena_data *nadata)
+{
+    pipena_remove(nadata);
+}
+
+static int
+pipena_base_acc_op(struct gensio_accepter *acc, int op,
+		   void *acc_op_data, void *done, int val1,
+		   void *data, void *data2, void *ret)
+{
+    switch(op) {
+    case GENSIO_BASE_ACC_STARTUP:
+	return pipena_startup(acc, acc_op_data);
+
+    case GENSIO_BASE_ACC_SHUTDOWN:
+	return pipena_shutdown(acc, acc_op_data, done);
+
+    case GENSIO_BASE_ACC_SET_CB_ENABLE:
+	return pipena_set_accept_callback_enable(acc, acc_op_data, val1, done);
+
+    case GENSIO_BASE_ACC_FREE:
+	pipena_free(acc, acc_op_data);
+	return 0;
+
+    case GENSIO_BASE_ACC_DISABLE:
+	pipena_disable(acc, acc_op_data);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+pipe_gensio_accepter_alloc(const void *gdata,
+			   const char * const args[],
+			   struct gensio_os_funcs *o,
+			   gensio_accepter_event cb, void *user_data,
+			   struct gensio_accepter **accepter)
+{
+    const char *name = gdata;
+    gensiods readbuf = GENSIO_DEFAULT_BUF_SIZE;
+    struct pipena_data *nadata;
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "readbuf", &readbuf) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (readbuf == 0)
+	return GE_INVAL;
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->readbuf = readbuf;
+    gensio_list_init(&nadata->pending);
+
+    err = GE_NOMEM;
+    nadata->name = gensio_strdup(o, name);
+    if (!nadata->name)
+	goto out_err;
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_err;
+
+    nadata->runner = o->alloc_runner(o, pipena_runner, nadata);
+    if (!nadata->runner)
+	goto out_err;
+
+    err = base_gensio_accepter_alloc(NULL, pipena_base_acc_op, nadata,
+				     o, "pipe", cb, user_data, accepter);
+    if (err)
+	goto out_err;
+    nadata->acc = *accepter;
+    gensio_acc_set_is_reliable(nadata->acc, true);
+
+    return 0;
+
+ out_err:
+    pipena_free(NULL, nadata);
+    return err;
+}
+
+static int
+str_to_pipe_gensio_accepter(const char *str, const char * const args[],
+			    struct gensio_os_funcs *o,
+			    gensio_accepter_event cb,
+			    void *user_data,
+			    struct gensio_accepter **acc)
+{
+    return pipe_gensio_accepter_alloc(str, args, o, cb, user_data, acc);
+}
+
+int
+gensio_init_pipe(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    rv = register_gensio(o, "pipe", str_to_pipe_gensio, pipe_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_gensio_accepter(o, "pipe", str_to_pipe_gensio_accepter,
+				  pipe_gensio_accepter_alloc);
+    if (rv)
+	return rv;
+    return 0;
+}
@@ -0,0 +1,963 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This code is for a gensio that hands out already open child
+ * connections from a pool.
+ *
+ * All pool gensios in the process with the same child string and
+ * options share one pool.  The pool keeps at least "min" idle open
+ * children, opening new ones in the background as they are taken, and
+ * never has more than "max" children open or opening.  Opening a pool
+ * gensio takes an idle child if there is one, otherwise it waits for
+ * one to open or be returned.  Closing a pool gensio returns the
+ * child to the pool unless it has seen an I/O error.
+ *
+ * Idle children have read enabled.  Any data or error on an idle
+ * child means it is not usable, so it is closed.  Idle children over
+ * min are closed after idle-timeout.
+ *
+ * Everything in a pool and its gensios is protected by the pool lock,
+ * except that data and events on an in-use child pass straight
+ * through.  The pools list and pool refcounts are protected by
+ * pools_lock, which nests inside the pool lock.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include "config.h"
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
+#include <gensio/argvutils.h>
+
+struct pool;
+
+struct pool_child {
+    struct gensio_link link;
+    struct pool *pool;
+    struct gensio *io;
+    gensio_time idle_since;
+    bool is_idle;
+
+    /* If set, report a close to this user when the close finishes. */
+    struct pool_data *pdata;
+};
+
+struct pool {
+    struct gensio_link link;
+    char *str;
+    unsigned int refcount;
+
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    unsigned int min;
+    unsigned int max;
+    gensio_time idle_timeout;
+    gensio_time retry_time;
+
+    struct gensio_timer *timer;
+    bool timer_running;
+    bool retry_pending;
+
+    /* Most recently used at the head. */
+    struct gensio_list idle;
+    unsigned int nr_idle;
+
+    /* Number of children opening, in use, or idle. */
+    unsigned int nr_total;
+    unsigned int nr_opening;
+    unsigned int nr_closing;
+
+    struct gensio_list waiters;
+    unsigned int nr_waiters;
+};
+
+enum pool_state {
+    POOL_CLOSED,
+    POOL_IN_OPEN,
+    POOL_OPEN,
+    POOL_IN_CLOSE,
+};
+
+struct pool_data {
+    struct gensio_os_funcs *o;
+    struct pool *pool;
+    struct gensio *io;
+    unsigned int refcount;
+    enum pool_state state;
+
+    struct pool_child *child;
+    bool child_err;
+
+    struct gensio_link waitlink;
+
+    /* Keep these around to set them when a child is assigned. */
+    bool rx_enable;
+    bool tx_enable;
+
+    struct gensio_runner *runner;
+    bool runner_pending;
+    bool deferred_open;
+    int deferred_open_err;
+    bool deferred_close;
+
+    gensio_done_err open_done;
+    void *open_data;
+
+    gensio_done close_done;
+    void *close_data;
+};
+
+static struct gensio_once pools_initialized;
+static struct gensio_lock *pools_lock;
+static struct gensio_list pools;
+static int pools_rv;
+
+static void pool_replenish(struct pool *pool);
+static void pool_start_timer(struct pool *pool);
+static void pool_child_close(struct pool_child *pchild);
+
+static void
+pools_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&pools);
+    pools_lock = o->alloc_lock(o);
+    if (!pools_lock)
+	pools_rv = GE_NOMEM;
+}
+
+static void
+pool_lock(struct pool *pool)
+{
+    pool->o->lock(pool->lock);
+}
+
+static void
+pool_unlock(struct pool *pool)
+{
+    pool->o->unlock(pool->lock);
+}
+
+static void
+pool_finish_free(struct pool *pool)
+{
+    struct gensio_os_funcs *o = pool->o;
+
+    if (pool->timer)
+	o->free_timer(pool->timer);
+    if (pool->lock)
+	o->free_lock(pool->lock);
+    if (pool->str)
+	o->free(o, pool->str);
+    o->free(o, pool);
+}
+
+/*
+ * Unlock the pool and free it if nothing is using it any more.  The
+ * pool is already off the pools list when the last user goes away.
+ */
+static void
+pool_unlock_and_check_free(struct pool *pool)
+{
+    bool do_free;
+
+    do_free = (pool->refcount == 0 && pool->nr_total == 0 &&
+	       pool->nr_closing == 0 && !pool->timer_running);
+    pool_unlock(pool);
+    if (do_free)
+	pool_finish_free(pool);
+}
+
+static void
+pool_idle_rm(struct pool *pool, struct pool_child *pchild)
+{
+    gensio_list_rm(&pool->idle, &pchild->link);
+    pool->nr_idle--;
+    pchild->is_idle = false;
+}
+
+static void
+pool_data_ref(struct pool_data *pdata)
+{
+    assert(pdata->refcount > 0);
+    pdata->refcount++;
+}
+
+/* Cannot be called for the last deref. */
+static void
+pool_data_deref(struct pool_data *pdata)
+{
+    assert(pdata->refcount > 1);
+    pdata->refcount--;
+}
+
+static void
+pool_data_finish_free(struct pool_data *pdata)
+{
+    struct gensio_os_funcs *o = pdata->o;
+
+    if (pdata->io)
+	gensio_data_free(pdata->io);
+    if (pdata->runner)
+	o->free_runner(pdata->runner);
+    o->free(o, pdata);
+}
+
+/*
+ * Drop a reference to the user gensio.  Called with the pool lock
+ * held, the lock is released.
+ */
+static void
+pool_data_unlock_and_deref(struct pool_data *pdata)
+{
+    struct pool *pool = pdata->pool;
+
+    assert(pdata->refcount > 0);
+    if (--pdata->refcount > 0) {
+	pool_unlock(pool);
+	return;
+    }
+
+    /*
+     * The pool refcount is changed under pools_lock so pool_get()
+     * cannot find a pool that is going away.
+     */
+    pool->o->lock(pools_lock);
+    if (--pool->refcount == 0)
+	gensio_list_rm(&pools, &pool->link);
+    pool->o->unlock(pools_lock);
+    if (pool->refcount == 0) {
+	struct gensio_link *l, *l2;
+
+	/* Last user, take the pool out of service. */
+	gensio_list_for_each_safe(&pool->idle, l, l2) {
+	    struct pool_child *pchild;
+
+	    pchild = gensio_container_of(l, struct pool_child, link);
+	    pool_idle_rm(pool, pchild);
+	    pool->nr_total--;
+	    pool_child_close(pchild);
+	}
+	if (pool->timer_running && pool->o->stop_timer(pool->timer) == 0)
+	    pool->timer_running = false;
+    }
+    pool_unlock_and_check_free(pool);
+    pool_data_finish_free(pdata);
+}
+
+static void
+pool_runner(struct gensio_runner *r, void *cb_data)
+{
+    struct pool_data *pdata = cb_data;
+    struct pool *pool = pdata->pool;
+
+    pool_lock(pool);
+    pdata->runner_pending = false;
+    if (pdata->deferred_open) {
+	gensio_done_err open_done = pdata->open_done;
+	void *open_data = pdata->open_data;
+	int err = pdata->deferred_open_err;
+
+	pdata->deferred_open = false;
+	pdata->open_done = NULL;
+	if (open_done) {
+	    pool_unlock(pool);
+	    open_done(pdata->io, err, open_data);
+	    pool_lock(pool);
+	}
+    }
+    if (pdata->deferred_close) {
+	gensio_done close_done = pdata->close_done;
+	void *close_data = pdata->close_data;
+
+	pdata->deferred_close = false;
+	pdata->close_done = NULL;
+	if (close_done) {
+	    pool_unlock(pool);
+	    close_done(pdata->io, close_data);
+	    pool_lock(pool);
+	}
+    }
+    pool_data_unlock_and_deref(pdata);
+}
+
+static void
+pool_sched_runner(struct pool_data *pdata)
+{
+    if (pdata->runner_pending)
+	return;
+    pdata->runner_pending = true;
+    pool_data_ref(pdata);
+    pdata->o->run(pdata->runner);
+}
+
+static void
+pool_report_open(struct pool_data *pdata, int err)
+{
+    pdata->deferred_open = true;
+    pdata->deferred_open_err = err;
+    pool_sched_runner(pdata);
+}
+
+static void
+pool_report_close(struct pool_data *pdata)
+{
+    pdata->state = POOL_CLOSED;
+    pdata->deferred_close = true;
+    pool_sched_runner(pdata);
+}
+
+static int
+pool_child_event(struct gensio *io, void *user_data,
+		 int event, int err,
+		 unsigned char *buf, gensiods *buflen,
+		 const char *const *auxdata)
+{
+    struct pool_data *pdata = user_data;
+
+    if (err && event == GENSIO_EVENT_READ)
+	pdata->child_err = true;
+
+    return gensio_cb(pdata->io, event, err, buf, buflen, auxdata);
+}
+
+static int
+pool_idle_event(struct gensio *io, void *user_data,
+		int event, int err,
+		unsigned char *buf, gensiods *buflen,
+		const char *const *auxdata)
+{
+    struct pool_child *pchild = user_data;
+    struct pool *pool = pchild->pool;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    pool_lock(pool);
+    if (!pchild->is_idle) {
+	/* Raced with a user taking it, leave the data for them. */
+	pool_unlock(pool);
+	*buflen = 0;
+	return 0;
+    }
+
+    /* Nothing should show up on an idle connection, drop it. */
+    gensio_log(pool->o, GENSIO_LOG_INFO,
+	       "pool: dropping idle connection to %s: %s", pool->str,
+	       err ? gensio_err_to_str(err) : "unexpected data");
+    gensio_set_read_callback_enable(io, false);
+    pool_idle_rm(pool, pchild);
+    pool->nr_total--;
+    pool_child_close(pchild);
+    pool_replenish(pool);
+    pool_unlock(pool);
+
+    return 0;
+}
+
+/* Hand an open child to a user.  Called with the pool lock held. */
+static void
+pool_assign(struct pool_data *pdata, struct pool_child *pchild)
+{
+    pdata->child = pchild;
+    pdata->child_err = false;
+    pdata->state = POOL_OPEN;
+    gensio_set_callback(pchild->io, pool_child_event, pdata);
+    gensio_set_write_callback_enable(pchild->io, pdata->tx_enable);
+    gensio_set_read_callback_enable(pchild->io, pdata->rx_enable);
+    pool_report_open(pdata, 0);
+}
+
+/*
+ * Give a usable open child to the first waiter, or put it on the idle
+ * list.  Called with the pool lock held.
+ */
+static void
+pool_child_available(struct pool *pool, struct pool_child *pchild)
+{
+    if (pool->refcount == 0) {
+	pool->nr_total--;
+	pool_child_close(pchild);
+	return;
+    }
+
+    if (pool->nr_waiters > 0) {
+	struct gensio_link *l = gensio_list_first(&pool->waiters);
+	struct pool_data *pdata;
+
+	pdata = gensio_container_of(l, struct pool_data, waitlink);
+	gensio_list_rm(&pool->waiters, l);
+	pool->nr_waiters--;
+	pool_assign(pdata, pchild);
+	return;
+    }
+
+    gensio_os_funcs_get_loop_time(pool->o, &pchild->idle_since);
+    gensio_set_callback(pchild->io, pool_idle_event, pchild);
+    gensio_list_add_head(&pool->idle, &pchild->link);
+    pool->nr_idle++;
+    pchild->is_idle = true;
+    gensio_set_read_callback_enable(pchild->io, true);
+    pool_start_timer(pool);
+}
+
+/* Fail all waiters, nothing is going to open for them. */
+static void
+pool_fail_waiters(struct pool *pool, int err)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&pool->waiters, l, l2) {
+	struct pool_data *pdata;
+
+	pdata = gensio_container_of(l, struct pool_data, waitlink);
+	gensio_list_rm(&pool->waiters, l);
+	pool->nr_waiters--;
+	pdata->state = POOL_CLOSED;
+	pool_report_open(pdata, err);
+    }
+}
+
+static void
+pool_child_close_done(struct gensio *io, void *close_data)
+{
+    struct pool_child *pchild = close_data;
+    struct pool *pool = pchild->pool;
+    struct pool_data *pdata = pchild->pdata;
+
+    gensio_free(io);
+    pool_lock(pool);
+    pool->nr_closing--;
+    if (pdata) {
+	/* The runner holds a ref, so this is never the last one. */
+	pool_report_close(pdata);
+	pool_data_deref(pdata);
+    }
+    pool->o->free(pool->o, pchild);
+    pool_unlock_and_check_free(pool);
+}
+
+/*
+ * Close a child that has been taken out of the counts.  Called with
+ * the pool lock held.
+ */
+static void
+pool_child_close(struct pool_child *pchild)
+{
+    struct pool *pool = pchild->pool;
+
+    gensio_set_read_callback_enable(pchild->io, false);
+    gensio_set_write_callback_enable(pchild->io, false);
+    pool->nr_closing++;
+    if (gensio_close(pchild->io, pool_child_close_done, pchild)) {
+	/* Already closed, just get rid of it. */
+	pool->nr_closing--;
+	gensio_free(pchild->io);
+	if (pchild->pdata) {
+	    pool_report_close(pchild->pdata);
+	    pool_data_deref(pchild->pdata);
+	}
+	pool->o->free(pool->o, pchild);
+    }
+}
+
+static void
+pool_child_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct pool_child *pchild = open_data;
+    struct pool *pool = pchild->pool;
+
+    pool_lock(pool);
+    pool->nr_opening--;
+    if (err) {
+	gensio_log(pool->o, GENSIO_LOG_INFO,
+		   "pool: error opening %s: %s", pool->str,
+		   gensio_err_to_str(err));
+	pool->nr_total--;
+	gensio_free(io);
+	pool->o->free(pool->o, pchild);
+	if (pool->nr_opening == 0)
+	    pool_fail_waiters(pool, err);
+	pool->retry_pending = true;
+	if (pool->refcount > 0)
+	    pool_start_timer(pool);
+    } else {
+	pool_child_available(pool, pchild);
+    }
+    pool_unlock_and_check_free(pool);
+}
+
+static int
+pool_start_child(struct pool *pool)
+{
+    struct gensio_os_funcs *o = pool->o;
+    struct pool_child *pchild;
+    int err;
+
+    pchild = o->zalloc(o, sizeof(*pchild));
+    if (!pchild)
+	return GE_NOMEM;
+    pchild->pool = pool;
+
+    err = str_to_gensio(pool->str, o, NULL, NULL, &pchild->io);
+    if (err) {
+	o->free(o, pchild);
+	return err;
+    }
+
+    err = gensio_open(pchild->io, pool_child_open_done, pchild);
+    if (err) {
+	gensio_free(pchild->io);
+	o->free(o, pchild);
+	return err;
+    }
+    pool->nr_opening++;
+    pool->nr_total++;
+    return 0;
+}
+
+/*
+ * Start opening children for the waiters and to get the idle count
+ * up to min.  Called with the pool lock held.
+ */
+static void
+pool_replenish(struct pool *pool)
+{
+    unsigned int want;
+    int err;
+
+    if (pool->refcount == 0 || pool->retry_pending)
+	return;
+
+    want = pool->nr_waiters;
+    if (pool->nr_idle < pool->min)
+	want += pool->min - pool->nr_idle;
+    while (want > pool->nr_opening && pool->nr_total < pool->max) {
+	err = pool_start_child(pool);
+	if (err) {
+	    gensio_log(pool->o, GENSIO_LOG_INFO,
+		       "pool: unable to start %s: %s", pool->str,
+		       gensio_err_to_str(err));
+	    if (pool->nr_opening == 0)
+		pool_fail_waiters(pool, err);
+	    pool->retry_pending = true;
+	    pool_start_timer(pool);
+	    break;
+	}
+    }
+}
+
+/*
+ * Run the timer if an open needs to be retried or there are idle
+ * children that may time out.  Called with the pool lock held.
+ */
+static void
+pool_start_timer(struct pool *pool)
+{
+    gensio_time timeout;
+
+    if (pool->timer_running)
+	return;
+    if (pool->retry_pending) {
+	timeout = pool->retry_time;
+    } else if (pool->nr_idle > pool->min) {
+	struct gensio_link *l = gensio_list_last(&pool->idle);
+	struct pool_child *pchild;
+	gensio_time now;
+	int64_t nsecs;
+
+	/* Wake up when the oldest idle child times out. */
+	pchild = gensio_container_of(l, struct pool_child, link);
+	gensio_os_funcs_get_loop_time(pool->o, &now);
+	timeout = pool->idle_timeout;
+	nsecs = gensio_time_diff_nsecs(&now, &pchild->idle_since);
+	gensio_time_add_nsecs(&timeout, -nsecs);
+	if (timeout.secs < 0)
+	    timeout.secs = timeout.nsecs = 0;
+    } else {
+	return;
+    }
+    if (pool->o->start_timer(pool->timer, &timeout) == 0)
+	pool->timer_running = true;
+}
+
+static void
+pool_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct pool *pool = cb_data;
+    struct gensio_link *l;
+    struct pool_child *pchild;
+    gensio_time now;
+    int64_t timeout;
+
+    timeout = GENSIO_MSECS_TO_NSECS(gensio_time_to_msecs(&pool->idle_timeout));
+    pool_lock(pool);
+    pool->timer_running = false;
+    if (pool->refcount == 0)
+	goto out_unlock;
+
+    gensio_os_funcs_get_loop_time(pool->o, &now);
+    while (pool->nr_idle > pool->min) {
+	l = gensio_list_last(&pool->idle);
+	pchild = gensio_container_of(l, struct pool_child, link);
+	if (gensio_time_diff_nsecs(&now, &pchild->idle_since) < timeout)
+	    break;
+	pool_idle_rm(pool, pchild);
+	pool->nr_total--;
+	pool_child_close(pchild);
+    }
+
+    pool->retry_pending = false;
+    pool_replenish(pool);
+    pool_start_timer(pool);
+ out_unlock:
+    pool_unlock_and_check_free(pool);
+}
+
+/*
+ * Find or create the pool for the child string and options.  Options
+ * that don't match an existing pool return GE_INCONSISTENT.
+ */
+static int
+pool_get(struct gensio_os_funcs *o, const char *str,
+	 unsigned int min, unsigned int max,
+	 gensio_time *idle_timeout, gensio_time *retry_time,
+	 struct pool **rpool)
+{
+    struct pool *pool = NULL;
+    struct gensio_link *l;
+    int rv = 0;
+
+    o->call_once(o, &pools_initialized, pools_init, o);
+    if (pools_rv)
+	return pools_rv;
+
+    o->lock(pools_lock);
+    gensio_list_for_each(&pools, l) {
+	pool = gensio_container_of(l, struct pool, link);
+	if (pool->o == o && strcmp(pool->str, str) == 0)
+	    break;
+	pool = NULL;
+    }
+    if (pool) {
+	/* These never change, so no need for the pool lock. */
+	if (min != pool->min || max != pool->max ||
+		gensio_time_diff_nsecs(idle_timeout, &pool->idle_timeout) ||
+		gensio_time_diff_nsecs(retry_time, &pool->retry_time))
+	    rv = GE_INCONSISTENT;
+	else
+	    pool->refcount++;
+	o->unlock(pools_lock);
+	goto out;
+    }
+
+    pool = o->zalloc(o, sizeof(*pool));
+    if (!pool) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    pool->o = o;
+    pool->refcount = 1;
+    pool->min = min;
+    pool->max = max;
+    pool->idle_timeout = *idle_timeout;
+    pool->retry_time = *retry_time;
+    gensio_list_init(&pool->idle);
+    gensio_list_init(&pool->waiters);
+    pool->str = gensio_strdup(o, str);
+    if (!pool->str)
+	goto out_nomem;
+    pool->lock = o->alloc_lock(o);
+    if (!pool->lock)
+	goto out_nomem;
+    pool->timer = o->alloc_timer(o, pool_timeout, pool);
+    if (!pool->timer)
+	goto out_nomem;
+    gensio_list_add_tail(&pools, &pool->link);
+    o->unlock(pools_lock);
+
+    /* Get the first min children going. */
+    pool_lock(pool);
+    pool_replenish(pool);
+    pool_unlock(pool);
+
+ out:
+    if (!rv)
+	*rpool = pool;
+    return rv;
+
+ out_unlock:
+    o->unlock(pools_lock);
+    return rv;
+
+ out_nomem:
+    o->unlock(pools_lock);
+    pool_finish_free(pool);
+    return GE_NOMEM;
+}
+
+static int
+pool_open(struct gensio *io, gensio_done_err open_done, void *open_data)
+{
+    struct pool_data *pdata = gensio_get_gensio_data(io);
+    struct pool *pool = pdata->pool;
+    int err = 0;
+
+    pool_lock(pool);
+    if (pdata->state != POOL_CLOSED || pdata->runner_pending) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    pdata->open_done = open_done;
+    pdata->open_data = open_data;
+
+    if (pool->nr_idle > 0) {
+	struct gensio_link *l = gensio_list_first(&pool->idle);
+	struct pool_child *pchild;
+
+	pchild = gensio_container_of(l, struct pool_child, link);
+	pool_idle_rm(pool, pchild);
+	gensio_set_read_callback_enable(pchild->io, false);
+	pool_assign(pdata, pchild);
+    } else {
+	pdata->state = POOL_IN_OPEN;
+	gensio_list_add_tail(&pool->waiters, &pdata->waitlink);
+	pool->nr_waiters++;
+	if (pool->retry_pending && pool->nr_opening == 0) {
+	    /* Don't make the user wait on the retry timer. */
+	    pool->retry_pending = false;
+	}
+    }
+    pool_replenish(pool);
+ out_unlock:
+    pool_unlock(pool);
+
+    return err;
+}
+
+static int
+pool_close(struct gensio *io, gensio_done close_done, void *close_data)
+{
+    struct pool_data *pdata = gensio_get_gensio_data(io);
+    struct pool *pool = pdata->pool;
+    struct pool_child *pchild;
+    int err = 0;
+
+    pool_lock(pool);
+    switch (pdata->state) {
+    case POOL_IN_OPEN:
+	gensio_list_rm(&pool->waiters, &pdata->waitlink);
+	pool->nr_waiters--;
+	pdata->close_done = close_done;
+	pdata->close_data = close_data;
+	pool_report_open(pdata, GE_LOCALCLOSED);
+	pool_report_close(pdata);
+	break;
+
+    case POOL_OPEN:
+	pchild = pdata->child;
+	pdata->child = NULL;
+	pdata->close_done = close_done;
+	pdata->close_data = close_data;
+	gensio_set_read_callback_enable(pchild->io, false);
+	gensio_set_write_callback_enable(pchild->io, false);
+	if (pdata->child_err) {
+	    /* Report the close when the child close finishes. */
+	    pdata->state = POOL_IN_CLOSE;
+	    pool->nr_total--;
+	    pchild->pdata = pdata;
+	    pool_data_ref(pdata);
+	    pool_child_close(pchild);
+	    pool_replenish(pool);
+	} else {
+	    pool_report_close(pdata);
+	    pool_child_available(pool, pchild);
+	}
+	break;
+
+    default:
+	err = GE_NOTREADY;
+    }
+    pool_unlock(pool);
+
+    return err;
+}
+
+static void
+pool_free(struct gensio *io)
+{
+    struct pool_data *pdata = gensio_get_gensio_data(io);
+    struct pool *pool = pdata->pool;
+
+    pool_lock(pool);
+    if (pdata->state == POOL_IN_OPEN || pdata->state == POOL_OPEN) {
+	pool_unlock(pool);
+	pool_close(io, NULL, NULL);
+	pool_lock(pool);
+    }
+    /* Don't call the user back on a free. */
+    pdata->open_done = NULL;
+    pdata->close_done = NULL;
+    pool_data_unlock_and_deref(pdata);
+}
+
+static int
+pool_gensio_func(struct gensio *io, int func, gensiods *count,
+		 const void *cbuf, gensiods buflen, void *buf,
+		 const char *const *auxdata)
+{
+    struct pool_data *pdata = gensio_get_gensio_data(io);
+    struct pool *pool = pdata->pool;
+    struct gensio *child = NULL;
+    int err;
+
+    switch (func) {
+    case GENSIO_FUNC_OPEN:
+	return pool_open(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return pool_close(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	pool_free(io);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	pool_lock(pool);
+	if (pdata->child)
+	    gensio_disable(pdata->child->io);
+	pdata->state = POOL_CLOSED;
+	pool_unlock(pool);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	pool_lock(pool);
+	pdata->rx_enable = buflen;
+	if (pdata->state == POOL_OPEN)
+	    gensio_set_read_callback_enable(pdata->child->io, buflen);
+	pool_unlock(pool);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	pool_lock(pool);
+	pdata->tx_enable = buflen;
+	if (pdata->state == POOL_OPEN)
+	    gensio_set_write_callback_enable(pdata->child->io, buflen);
+	pool_unlock(pool);
+	return 0;
+
+    case GENSIO_FUNC_CONTROL:
+	/*
+	 * The pool gensio has no fixed child, so controls go to the
+	 * first layer of the current child that takes them.
+	 */
+	pool_lock(pool);
+	if (pdata->state == POOL_OPEN)
+	    child = pdata->child->io;
+	pool_unlock(pool);
+	if (!child)
+	    return GE_NOTSUP;
+	return gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST,
+			      *((bool *) cbuf), buflen, buf, count);
+
+    case GENSIO_FUNC_OPEN_NOCHILD:
+	return GE_NOTSUP;
+
+    default:
+	/* Data and everything else goes to the child in use. */
+	if (pdata->state != POOL_OPEN)
+	    return GE_NOTREADY;
+	child = pdata->child->io;
+	err = gensio_call_func(child, func, count, cbuf, buflen, buf,
+			       auxdata);
+	if (err && func == GENSIO_FUNC_WRITE_SG)
+	    pdata->child_err = true;
+	return err;
+    }
+}
+
+static int
+pool_gensio_alloc(const void *gdata, const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    const char *str = gdata;
+    struct pool_data *pdata;
+    unsigned int min = 1, max = 16;
+    gensio_time idle_timeout = { 60, 0 };
+    gensio_time retry_time = { 1, 0 };
+    int i, err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyuint(args[i], "min", &min) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "max", &max) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "idle-timeout", 's',
+				 &idle_timeout) > 0)
+	    continue;
+	if (gensio_check_keytime(args[i], "retry-time", 'm', &retry_time) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (max == 0 || min > max)
+	return GE_INVAL;
+
+    pdata = o->zalloc(o, sizeof(*pdata));
+    if (!pdata)
+	return GE_NOMEM;
+    pdata->o = o;
+    pdata->refcount = 1;
+
+    pdata->runner = o->alloc_runner(o, pool_runner, pdata);
+    if (!pdata->runner)
+	goto out_nomem;
+
+    pdata->io = gensio_data_alloc(o, cb, user_data, pool_gensio_func,
+				  NULL, "pool", pdata);
+    if (!pdata->io)
+	goto out_nomem;
+    gensio_set_is_client(pdata->io, true);
+    gensio_set_is_reliable(pdata->io, true);
+
+    err = pool_get(o, str, min, max, &idle_timeout, &retry_time,
+		   &pdata->pool);
+    if (err) {
+	pool_data_finish_free(pdata);
+	return err;
+    }
+
+    *new_gensio = pdata->io;
+    return 0;
+
+ out_nomem:
+    pool_data_finish_free(pdata);
+    return GE_NOMEM;
+}
+
+static int
+str_to_pool_gensio(const char *str, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    return pool_gensio_alloc(str, args, o, cb, user_data, new_gensio);
+}
+
+int
+gensio_init_pool(struct gensio_os_funcs *o)
+{
+    return register_gensio(o, "pool", str_to_pool_gensio, pool_gensio_alloc);
+}
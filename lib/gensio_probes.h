@@ -0,0 +1,56 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Static tracepoints (USDT) for tools like bpftrace, perf and
+ * systemtap.  Enabled with --enable-probes if sys/sdt.h is available,
+ * otherwise they compile to nothing.  A probe that is not being traced
+ * is a single nop in the code.  All probes are in the "gensio"
+ * provider:
+ *
+ *  basen_state(ndata, old_state, new_state)
+ *  basen_write_entry(io, sglen)
+ *  basen_write_return(io, err, count)
+ *  basen_read_entry(io, buflen)
+ *  basen_read_return(io, err, count)
+ *  fd_read(fdll, err, count)
+ *  fd_write(fdll, err, count)
+ *  sel_wakeup(sel, nevents)
+ *  sel_fd_dispatch(sel, fd, events)
+ *  sel_timer_entry(sel, timer) / sel_timer_return(sel, timer)
+ *  sel_runner_entry(sel, runner) / sel_runner_return(sel, runner)
+ *  ssl_handshake_start(sfilter, is_client)
+ *  ssl_handshake_done(sfilter, is_client, err)
+ *
+ * For instance, to get a histogram of time spent in read callbacks:
+ *
+ *  bpftrace -e 'usdt:libgensio.so:gensio:basen_read_entry
+ *                 { @s[tid] = nsecs; }
+ *               usdt:libgensio.so:gensio:basen_read_return /@s[tid]/
+ *                 { @us = hist((nsecs - @s[tid]) / 1000); delete(@s[tid]); }'
+ */
+#ifndef _GENSIO_PROBES_H
+#define _GENSIO_PROBES_H
+
+#include "config.h"
+
+#ifdef ENABLE_PROBES
+#include <sys/sdt.h>
+
+#define GENSIO_PROBE1(name, a) \
+    DTRACE_PROBE1(gensio, name, a)
+#define GENSIO_PROBE2(name, a, b) \
+    DTRACE_PROBE2(gensio, name, a, b)
+#define GENSIO_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(gensio, name, a, b, c)
+#else
+#define GENSIO_PROBE1(name, a) do { } while (0)
+#define GENSIO_PROBE2(name, a, b) do { } while (0)
+#define GENSIO_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif /* _GENSIO_PROBES_H */
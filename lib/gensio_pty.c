@@ -640,6 +640,8 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
     const char *user = NULL, *passwd = NULL, *module = NULL;
 #endif
     const char *start_dir = NULL;
+    gensiods coalesce = 0, coalesce_usecs = 1000;
+    char lowat[40];
     bool raw = false;
     int err;
 
@@ -648,6 +650,11 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
 	    continue;
 	if (gensio_check_keyvalue(args[i], "start-dir", &start_dir) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "coalesce", &coalesce) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "coalesce-usecs",
+			       &coalesce_usecs) > 0)
+	    continue;
 #if HAVE_PTSNAME_R
 	if (gensio_check_keyvalue(args[i], "link", &link))
 	    continue;
@@ -779,6 +786,18 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
 
     gensio_set_is_reliable(io, true);
 
+    if (coalesce) {
+	/* Idle mode so a lone keystroke echo is not held. */
+	snprintf(lowat, sizeof(lowat), "%lu,%lu,idle",
+		 (unsigned long) coalesce, (unsigned long) coalesce_usecs);
+	err = gensio_control(io, 0, GENSIO_CONTROL_SET,
+			     GENSIO_CONTROL_READ_LOWAT, lowat, NULL);
+	if (err) {
+	    gensio_free(io);
+	    return err;
+	}
+    }
+
     *new_gensio = io;
     return 0;
 
@@ -0,0 +1,445 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Move all the data from one gensio to another.  If both ends are
+ * plain file descriptors (see GENSIO_CONTROL_FD) and the OS can copy
+ * between them in the kernel, that is used so the data never comes
+ * into user space.  Otherwise data is read from one gensio and
+ * written to the other with normal flow control.
+ */
+
+#define _GNU_SOURCE /* Get splice(). */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_os_funcs.h>
+
+#if defined(HAVE_SYS_SENDFILE_H) || defined(HAVE_SPLICE)
+#define GENSIO_PUMP_KERNEL_COPY 1
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#endif
+
+/* Maximum amount to hand to sendfile() at a time. */
+#define GENSIO_PUMP_SENDFILE_CHUNK	(1024 * 1024)
+
+/* How much to splice at a time, and per write ready callback. */
+#define GENSIO_PUMP_SPLICE_CHUNK	(64 * 1024)
+#define GENSIO_PUMP_SPLICE_MAX		(1024 * 1024)
+
+struct gensio_pump {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    struct gensio *from;
+    struct gensio *to;
+
+    /* The callbacks the gensios had before, restored when done. */
+    gensio_event from_cb;
+    void *from_data;
+    gensio_event to_cb;
+    void *to_data;
+
+    gensio_pump_done done;
+    void *cb_data;
+
+    bool use_sendfile;
+    int from_fd;
+    int to_fd;
+    gensiods sent;
+
+    /*
+     * If from is a pipe, splice() moves the data straight from it.
+     * When the pipe is empty or the destination is full, one read
+     * goes through the gensios to wait.  read_held is set while
+     * "from" holds read data that hasn't been written yet, nothing
+     * can be spliced until that is out.
+     */
+    bool use_splice;
+    bool read_held;
+
+    /*
+     * running is cleared when the pump stops.  in_cb counts callbacks
+     * that are using the pump, it is not freed until that goes to
+     * zero.  freed is set when the user has called gensio_pump_free().
+     */
+    bool running;
+    bool freed;
+    unsigned int in_cb;
+    int err;
+};
+
+static void
+pump_finish_free(struct gensio_pump *pump)
+{
+    struct gensio_os_funcs *o = pump->o;
+
+    o->free_lock(pump->lock);
+    o->free(o, pump);
+}
+
+/* Must be called with the lock held. */
+static bool
+pump_stop(struct gensio_pump *pump, int err)
+{
+    if (!pump->running)
+	return false;
+    pump->running = false;
+    pump->err = err;
+    gensio_set_read_callback_enable(pump->from, false);
+    gensio_set_write_callback_enable(pump->to, false);
+    gensio_set_callback(pump->from, pump->from_cb, pump->from_data);
+    gensio_set_callback(pump->to, pump->to_cb, pump->to_data);
+    return true;
+}
+
+/*
+ * Leave a callback, reporting the finish if the callback stopped the
+ * pump.  The reference is held across the done call so the user can
+ * free the pump from it.
+ */
+static void
+pump_deref_and_unlock(struct gensio_pump *pump, bool stopped)
+{
+    struct gensio_os_funcs *o = pump->o;
+    bool do_free;
+
+    if (stopped && !pump->freed) {
+	o->unlock(pump->lock);
+	pump->done(pump, pump->err, pump->cb_data);
+	o->lock(pump->lock);
+    }
+    do_free = --pump->in_cb == 0 && pump->freed;
+    o->unlock(pump->lock);
+    if (do_free)
+	pump_finish_free(pump);
+}
+
+static int
+pump_read(struct gensio_pump *pump, int err,
+	  unsigned char *buf, gensiods *buflen)
+{
+    gensiods count = 0;
+    bool stopped = false;
+
+    pump->o->lock(pump->lock);
+    pump->in_cb++;
+    if (!pump->running) {
+	*buflen = 0;
+	goto out;
+    }
+    if (err) {
+	stopped = pump_stop(pump, err == GE_REMCLOSE ? 0 : err);
+	goto out;
+    }
+
+    err = gensio_write(pump->to, &count, buf, *buflen, NULL);
+    if (err) {
+	stopped = pump_stop(pump, err);
+	count = *buflen;
+    } else if (count < *buflen) {
+	/* Wait for the other end to take everything. */
+	pump->read_held = true;
+	gensio_set_read_callback_enable(pump->from, false);
+	gensio_set_write_callback_enable(pump->to, true);
+    } else if (pump->use_splice) {
+	/* Got everything out, go back to moving it in the kernel. */
+	gensio_set_read_callback_enable(pump->from, false);
+	gensio_set_write_callback_enable(pump->to, true);
+    }
+    *buflen = count;
+ out:
+    pump_deref_and_unlock(pump, stopped);
+    return 0;
+}
+
+#ifdef HAVE_SYS_SENDFILE_H
+/*
+ * sendfile() went around the gensio, so it doesn't know the socket
+ * is full and would just keep calling write ready.  Write one byte
+ * of the file through the gensio.  Either it goes (and the file is
+ * moved past it) or the gensio will wait for the socket to drain.
+ */
+static bool
+pump_sendfile_wait(struct gensio_pump *pump)
+{
+    gensiods count = 0;
+    unsigned char c;
+    off_t pos;
+    ssize_t rv;
+    int err;
+
+    pos = lseek(pump->from_fd, 0, SEEK_CUR);
+    if (pos == -1)
+	return pump_stop(pump, gensio_os_err_to_err(pump->o, errno));
+    rv = pread(pump->from_fd, &c, 1, pos);
+    if (rv == 0)
+	return pump_stop(pump, 0);
+    if (rv < 0)
+	return pump_stop(pump, gensio_os_err_to_err(pump->o, errno));
+    err = gensio_write(pump->to, &count, &c, 1, NULL);
+    if (err)
+	return pump_stop(pump, err);
+    if (count == 1) {
+	lseek(pump->from_fd, 1, SEEK_CUR);
+	pump->sent++;
+    }
+    return false;
+}
+
+/* Must be called with the lock held.  Returns true if the pump stopped. */
+static bool
+pump_sendfile(struct gensio_pump *pump)
+{
+    ssize_t rv;
+
+    rv = sendfile(pump->to_fd, pump->from_fd, NULL,
+		  GENSIO_PUMP_SENDFILE_CHUNK);
+    if (rv > 0) {
+	pump->sent += rv;
+	return false;
+    }
+    if (rv == 0)
+	return pump_stop(pump, 0);
+    if (errno == EINTR)
+	return false;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+	return pump_sendfile_wait(pump);
+    if (pump->sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+	/* The descriptors can't do it, move the data ourselves. */
+	pump->use_sendfile = false;
+	gensio_set_write_callback_enable(pump->to, false);
+	gensio_set_read_callback_enable(pump->from, true);
+	return false;
+    }
+    return pump_stop(pump, gensio_os_err_to_err(pump->o, errno));
+}
+#endif
+
+#ifdef HAVE_SPLICE
+/* Must be called with the lock held.  Returns true if the pump stopped. */
+static bool
+pump_splice(struct gensio_pump *pump)
+{
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    gensiods total = 0;
+    ssize_t rv;
+
+    while (total < GENSIO_PUMP_SPLICE_MAX) {
+	rv = splice(pump->from_fd, NULL, pump->to_fd, NULL,
+		    GENSIO_PUMP_SPLICE_CHUNK, flags);
+	if (rv == 0)
+	    return pump_stop(pump, 0);
+	if (rv > 0) {
+	    pump->sent += rv;
+	    total += rv;
+	    continue;
+	}
+	if (errno == EINTR)
+	    continue;
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    /*
+	     * Either the pipe is empty or the destination is full,
+	     * do a normal read to wait on whichever it is.
+	     */
+	    break;
+	if (pump->sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+	    /* The descriptors can't do it, move the data ourselves. */
+	    pump->use_splice = false;
+	    break;
+	}
+	return pump_stop(pump, gensio_os_err_to_err(pump->o, errno));
+    }
+    if (total < GENSIO_PUMP_SPLICE_MAX) {
+	gensio_set_write_callback_enable(pump->to, false);
+	gensio_set_read_callback_enable(pump->from, true);
+    }
+    return false;
+}
+#endif
+
+static int
+pump_write_ready(struct gensio_pump *pump)
+{
+    bool stopped = false;
+
+    pump->o->lock(pump->lock);
+    pump->in_cb++;
+    if (!pump->running)
+	goto out;
+#ifdef HAVE_SYS_SENDFILE_H
+    if (pump->use_sendfile) {
+	stopped = pump_sendfile(pump);
+	goto out;
+    }
+#endif
+#ifdef HAVE_SPLICE
+    if (pump->use_splice && !pump->read_held) {
+	stopped = pump_splice(pump);
+	goto out;
+    }
+#endif
+    pump->read_held = false;
+    gensio_set_write_callback_enable(pump->to, false);
+    gensio_set_read_callback_enable(pump->from, true);
+ out:
+    pump_deref_and_unlock(pump, stopped);
+    return 0;
+}
+
+static int
+pump_from_event(struct gensio *io, void *user_data, int event, int err,
+		unsigned char *buf, gensiods *buflen,
+		const char *const *auxdata)
+{
+    struct gensio_pump *pump = user_data;
+
+    if (event == GENSIO_EVENT_READ)
+	return pump_read(pump, err, buf, buflen);
+    if (event == GENSIO_EVENT_WRITE_READY) {
+	gensio_set_write_callback_enable(io, false);
+	return 0;
+    }
+    if (!pump->from_cb)
+	return GE_NOTSUP;
+    return pump->from_cb(io, pump->from_data, event, err, buf, buflen,
+			 auxdata);
+}
+
+static int
+pump_to_event(struct gensio *io, void *user_data, int event, int err,
+	      unsigned char *buf, gensiods *buflen,
+	      const char *const *auxdata)
+{
+    struct gensio_pump *pump = user_data;
+
+    if (event == GENSIO_EVENT_WRITE_READY)
+	return pump_write_ready(pump);
+    if (event == GENSIO_EVENT_READ) {
+	/* Data from the destination is not part of the pump. */
+	gensio_set_read_callback_enable(io, false);
+	*buflen = 0;
+	return 0;
+    }
+    if (!pump->to_cb)
+	return GE_NOTSUP;
+    return pump->to_cb(io, pump->to_data, event, err, buf, buflen, auxdata);
+}
+
+#ifdef GENSIO_PUMP_KERNEL_COPY
+static int
+pump_get_fd(struct gensio *io, const char *which, int *fd)
+{
+    char data[20];
+    gensiods len = sizeof(data);
+    int err;
+
+    snprintf(data, sizeof(data), "%s", which);
+    err = gensio_control(io, 0, GENSIO_CONTROL_GET, GENSIO_CONTROL_FD,
+			 data, &len);
+    if (!err)
+	*fd = strtol(data, NULL, 0);
+    return err;
+}
+#endif
+
+int
+gensio_pump_alloc(struct gensio_os_funcs *o,
+		  struct gensio *from, struct gensio *to,
+		  gensio_pump_done done, void *cb_data,
+		  struct gensio_pump **rpump)
+{
+    struct gensio_pump *pump;
+
+    if (!done)
+	return GE_INVAL;
+
+    pump = o->zalloc(o, sizeof(*pump));
+    if (!pump)
+	return GE_NOMEM;
+    pump->lock = o->alloc_lock(o);
+    if (!pump->lock) {
+	o->free(o, pump);
+	return GE_NOMEM;
+    }
+    pump->o = o;
+    pump->from = from;
+    pump->to = to;
+    pump->done = done;
+    pump->cb_data = cb_data;
+
+#ifdef GENSIO_PUMP_KERNEL_COPY
+    if (!pump_get_fd(from, "0", &pump->from_fd) &&
+		!pump_get_fd(to, "1", &pump->to_fd)) {
+#ifdef HAVE_SPLICE
+	struct stat st;
+#endif
+
+	/*
+	 * sendfile() only reads from something it can map, so only
+	 * use it for files, splice() needs a pipe on one end.  Both
+	 * fall back if the descriptors won't do it.
+	 */
+#ifdef HAVE_SYS_SENDFILE_H
+	if (strcmp(gensio_get_type(from, 0), "file") == 0)
+	    pump->use_sendfile = true;
+#endif
+#ifdef HAVE_SPLICE
+	if (!pump->use_sendfile && fstat(pump->from_fd, &st) == 0 &&
+		S_ISFIFO(st.st_mode))
+	    pump->use_splice = true;
+#endif
+    }
+#endif
+
+    o->lock(pump->lock);
+    pump->from_cb = gensio_get_cb(from);
+    pump->from_data = gensio_get_user_data(from);
+    pump->to_cb = gensio_get_cb(to);
+    pump->to_data = gensio_get_user_data(to);
+    gensio_set_callback(from, pump_from_event, pump);
+    gensio_set_callback(to, pump_to_event, pump);
+    pump->running = true;
+    gensio_set_read_callback_enable(to, false);
+    if (pump->use_sendfile || pump->use_splice) {
+	gensio_set_read_callback_enable(from, false);
+	gensio_set_write_callback_enable(to, true);
+    } else {
+	gensio_set_write_callback_enable(to, false);
+	gensio_set_read_callback_enable(from, true);
+    }
+    o->unlock(pump->lock);
+
+    *rpump = pump;
+    return 0;
+}
+
+void
+gensio_pump_free(struct gensio_pump *pump)
+{
+    struct gensio_os_funcs *o = pump->o;
+    bool do_free;
+
+    o->lock(pump->lock);
+    pump_stop(pump, GE_LOCALCLOSED);
+    pump->freed = true;
+    do_free = pump->in_cb == 0;
+    o->unlock(pump->lock);
+    if (do_free)
+	pump_finish_free(pump);
+}
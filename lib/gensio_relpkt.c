@@ -6,6 +6,7 @@
  */
 
 #include "config.h"
+#include <string.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
@@ -16,6 +17,12 @@
 
 #include "gensio_filter_relpkt.h"
 
+static bool
+relpkt_type_is_net(const char *type)
+{
+    return type && (strcmp(type, "udp") == 0 || strcmp(type, "netsim") == 0);
+}
+
 static int
 relpkt_gensio_alloc(struct gensio *child, const char *const args[],
 		    struct gensio_os_funcs *o,
@@ -26,8 +33,10 @@ relpkt_gensio_alloc(struct gensio *child, const char *const args[],
     struct gensio_filter *filter;
     struct gensio_ll *ll;
     struct gensio *io;
+    bool net_pkts;
 
-    err = gensio_relpkt_filter_alloc(o, args, false, &filter);
+    net_pkts = relpkt_type_is_net(gensio_get_type(child, 0));
+    err = gensio_relpkt_filter_alloc(o, args, false, net_pkts, &filter);
     if (err)
 	return err;
 
@@ -78,6 +87,7 @@ struct relpktna_data {
     struct gensio_accepter *acc;
     const char **args;
     struct gensio_os_funcs *o;
+    bool net_pkts;
 };
 
 static void
@@ -105,7 +115,8 @@ relpktna_new_child(void *acc_data, void **finish_data,
 {
     struct relpktna_data *nadata = acc_data;
 
-    return gensio_relpkt_filter_alloc(nadata->o, nadata->args, true, filter);
+    return gensio_relpkt_filter_alloc(nadata->o, nadata->args, true,
+				      nadata->net_pkts, filter);
 }
 
 static int
@@ -163,6 +174,7 @@ relpkt_gensio_accepter_alloc(struct gensio_accepter *child,
     }
 
     nadata->o = o;
+    nadata->net_pkts = relpkt_type_is_net(gensio_acc_get_type(child, 0));
 
     err = gensio_gensio_accepter_alloc(child, o, "relpkt", cb, user_data,
 				       gensio_gensio_acc_relpkt_cb, nadata,
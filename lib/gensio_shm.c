@@ -0,0 +1,1586 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A gensio that moves data between two processes on the same host
+ * through shared memory.
+ *
+ * The accepter listens on a unix socket.  For each connection it
+ * creates a memfd holding two rings, one in each direction, and four
+ * eventfds, and passes them to the connecter over the socket.  After
+ * that the socket is only used to see when the other end goes away.
+ *
+ * Each ring has a single producer and a single consumer.  The
+ * producer only writes tail, the consumer only writes head, both are
+ * free running byte counts.  The producer kicks the data eventfd only
+ * when it finds the ring was empty after adding data.  The consumer
+ * kicks the space eventfd only when the producer has set want_space
+ * because it ran out of room.  In both cases the side doing the
+ * storing checks the other side's value after its own store, so one
+ * of them always sees the other and no wakeup is lost.
+ *
+ * In packet mode each packet is a 4 byte length and the data, padded
+ * to 4 bytes.  Packets never wrap, if one doesn't fit at the end of
+ * the ring a wrap marker is put there and it starts at the beginning.
+ */
+
+#define _GNU_SOURCE /* Get memfd_create() and MSG_CMSG_CLOEXEC. */
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_base.h>
+#include <gensio/gensio_osops.h>
+#include <gensio/argvutils.h>
+
+#if defined(HAVE_MEMFD_CREATE) && defined(linux)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#define SHM_MAGIC		0x67736d31
+#define SHM_VERSION		1
+#define SHM_FLAG_PACKET		(1 << 0)
+
+#define SHM_DEFAULT_SIZE	65536
+#define SHM_MIN_SIZE		4096
+#define SHM_MAX_SIZE		(1 << 30)
+
+#define SHM_PKT_WRAP		0xffffffff
+#define SHM_PKT_ALIGN(v)	(((v) + 3) & ~((uint32_t) 3))
+
+/*
+ * Ring 0 carries data from the connecter to the accepter, ring 1 the
+ * other way.  The eventfds are passed in the order data 0, space 0,
+ * data 1, space 1.
+ */
+#define SHM_NR_EFDS		4
+#define SHM_EFD_DATA(r)		((r) * 2)
+#define SHM_EFD_SPACE(r)	((r) * 2 + 1)
+
+#define SHM_CACHELINE		64
+
+struct shm_ring {
+    uint32_t head;
+    uint32_t want_space;
+    unsigned char pad1[SHM_CACHELINE - 8];
+    uint32_t tail;
+    unsigned char pad2[SHM_CACHELINE - 4];
+};
+
+#define shm_map_size(size) (2 * (sizeof(struct shm_ring) + (size)))
+
+struct shm_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t flags;
+};
+
+enum shm_ll_state {
+    SHM_LL_CLOSED,
+    SHM_LL_IN_OPEN,
+    SHM_LL_OPEN,
+    SHM_LL_IN_CLOSE
+};
+
+struct shm_ll {
+    struct gensio_os_funcs *o;
+    struct gensio_ll *ll;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    enum shm_ll_state state;
+
+    gensio_ll_cb cb;
+    void *cb_data;
+
+    char *path;
+    struct gensio_addr *ai;	/* Connecter only. */
+    bool is_acc;
+    bool is_packet;
+
+    uint32_t size;
+    uint32_t mask;
+    uint32_t max_pkt;
+
+    int memfd;
+    int efds[SHM_NR_EFDS];
+    unsigned char *map;
+
+    struct gensio_iod *sock_iod;
+
+    /* The ring we read from.  We wait on data and kick space. */
+    struct shm_ring *rx;
+    unsigned char *rxbuf;
+    struct gensio_iod *rx_data_iod;
+    int rx_space_fd;
+    uint32_t rx_pkt_pos;
+
+    /* The ring we write to.  We kick data and wait on space. */
+    struct shm_ring *tx;
+    unsigned char *txbuf;
+    struct gensio_iod *tx_space_iod;
+    int tx_data_fd;
+
+    bool efd_handlers_set;
+    unsigned int nr_clearing;
+
+    /* Set when the peer goes away or breaks the ring. */
+    int rx_err;
+
+    bool read_enabled;
+    bool write_enabled;
+    bool in_read;
+    bool in_write;
+
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_runner;
+    bool deferred_open;
+
+    int open_err;
+    gensio_ll_open_done open_done;
+    void *open_data;
+    gensio_ll_close_done close_done;
+    void *close_data;
+};
+
+#define ll_to_shm(v) ((struct shm_ll *) gensio_ll_get_user_data(v))
+
+static void shm_ll_sched_deferred_op(struct shm_ll *shm);
+
+static void
+shm_ll_lock(struct shm_ll *shm)
+{
+    shm->o->lock(shm->lock);
+}
+
+static void
+shm_ll_unlock(struct shm_ll *shm)
+{
+    shm->o->unlock(shm->lock);
+}
+
+static void
+shm_ll_ref(struct shm_ll *shm)
+{
+    shm->refcount++;
+}
+
+static void
+shm_ll_deref(struct shm_ll *shm)
+{
+    assert(shm->refcount > 1);
+    shm->refcount--;
+}
+
+static void
+shm_ll_release(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+    unsigned int i;
+
+    if (shm->sock_iod)
+	o->close(&shm->sock_iod);
+    if (shm->rx_data_iod)
+	o->close(&shm->rx_data_iod);
+    if (shm->tx_space_iod)
+	o->close(&shm->tx_space_iod);
+    for (i = 0; i < SHM_NR_EFDS; i++) {
+	if (shm->efds[i] != -1)
+	    close(shm->efds[i]);
+	shm->efds[i] = -1;
+    }
+    if (shm->memfd != -1)
+	close(shm->memfd);
+    shm->memfd = -1;
+    if (shm->map)
+	munmap(shm->map, shm_map_size(shm->size));
+    shm->map = NULL;
+    shm->rx_space_fd = -1;
+    shm->tx_data_fd = -1;
+    shm->efd_handlers_set = false;
+}
+
+static void
+shm_ll_finish_free(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+
+    shm_ll_release(shm);
+    if (shm->ai)
+	gensio_addr_free(shm->ai);
+    if (shm->path)
+	o->free(o, shm->path);
+    if (shm->deferred_runner)
+	o->free_runner(shm->deferred_runner);
+    if (shm->lock)
+	o->free_lock(shm->lock);
+    if (shm->ll)
+	gensio_ll_free_data(shm->ll);
+    o->free(o, shm);
+}
+
+static void
+shm_ll_deref_and_unlock(struct shm_ll *shm)
+{
+    unsigned int refcount;
+
+    assert(shm->refcount > 0);
+    refcount = --shm->refcount;
+    shm_ll_unlock(shm);
+    if (refcount == 0)
+	shm_ll_finish_free(shm);
+}
+
+static void
+shm_kick(int fd)
+{
+    uint64_t v = 1;
+
+    while (write(fd, &v, sizeof(v)) == -1 && errno == EINTR)
+	;
+}
+
+static void
+shm_drain(struct gensio_os_funcs *o, struct gensio_iod *iod)
+{
+    uint64_t v;
+
+    while (read(o->iod_get_fd(iod), &v, sizeof(v)) == -1 && errno == EINTR)
+	;
+}
+
+/*
+ * Bytes waiting in a ring, or -1 if the other end has put garbage in
+ * head or tail.
+ */
+static int64_t
+shm_ring_used(struct shm_ll *shm, uint32_t head, uint32_t tail)
+{
+    uint32_t used = tail - head;
+
+    if (used > shm->size)
+	return -1;
+    return used;
+}
+
+static bool
+shm_tx_ready(struct shm_ll *shm)
+{
+    uint32_t head = __atomic_load_n(&shm->tx->head, __ATOMIC_SEQ_CST);
+    int64_t used = shm_ring_used(shm, head, shm->tx->tail);
+
+    if (used < 0)
+	return true; /* Let the write report the error. */
+    /* A packet plus the padding before it always fits in half. */
+    if (shm->is_packet)
+	return shm->size - used >= shm->size / 2;
+    return used < shm->size;
+}
+
+/*
+ * Update the wait handlers from the enables.  Must be called with the
+ * lock held and the ll open.
+ */
+static void
+shm_ll_set_handlers(struct shm_ll *shm)
+{
+    shm->o->set_read_handler(shm->rx_data_iod, shm->read_enabled);
+    shm->o->set_read_handler(shm->tx_space_iod, shm->write_enabled);
+}
+
+static void
+shm_ll_check_read(struct shm_ll *shm)
+{
+    struct shm_ring *r = shm->rx;
+    uint32_t head, tail, off, len = 0, avail;
+    unsigned char *data;
+    gensiods count;
+    int64_t used;
+    int err;
+
+    if (shm->in_read)
+	return;
+    shm->in_read = true;
+    while (shm->read_enabled && shm->state == SHM_LL_OPEN) {
+	/*
+	 * Get the error first, anything the peer put in the ring
+	 * before going away is delivered before it.
+	 */
+	err = shm->rx_err;
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+	used = shm_ring_used(shm, head, tail);
+	if (used < 0) {
+	    err = shm->rx_err = GE_PROTOERR;
+	    used = 0;
+	}
+	if (used == 0) {
+	    if (!err)
+		break;
+	    goto deliver_err;
+	}
+
+	off = head & shm->mask;
+	if (shm->is_packet) {
+	    len = *((uint32_t *) (shm->rxbuf + off));
+	    if (len == SHM_PKT_WRAP) {
+		__atomic_store_n(&r->head, head + shm->size - off,
+				 __ATOMIC_SEQ_CST);
+		continue;
+	    }
+	    if (len > shm->max_pkt || SHM_PKT_ALIGN(len + 4) > used ||
+			shm->rx_pkt_pos > len) {
+		err = shm->rx_err = GE_PROTOERR;
+		goto deliver_err;
+	    }
+	    data = shm->rxbuf + off + 4 + shm->rx_pkt_pos;
+	    avail = len - shm->rx_pkt_pos;
+	} else {
+	    data = shm->rxbuf + off;
+	    avail = used;
+	    if (avail > shm->size - off)
+		avail = shm->size - off;
+	}
+
+	shm_ll_unlock(shm);
+	count = shm->cb(shm->cb_data, GENSIO_LL_CB_READ, 0, data, avail, NULL);
+	shm_ll_lock(shm);
+	if (count > avail)
+	    count = avail;
+
+	if (shm->is_packet) {
+	    shm->rx_pkt_pos += count;
+	    if (shm->rx_pkt_pos == len) {
+		head += SHM_PKT_ALIGN(len + 4);
+		shm->rx_pkt_pos = 0;
+	    }
+	} else {
+	    head += count;
+	}
+	__atomic_store_n(&r->head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->want_space, __ATOMIC_SEQ_CST) &&
+		__atomic_exchange_n(&r->want_space, 0, __ATOMIC_SEQ_CST))
+	    shm_kick(shm->rx_space_fd);
+
+	if (count < avail) {
+	    /* The user didn't take it all, try again later. */
+	    if (shm->read_enabled)
+		shm_ll_sched_deferred_op(shm);
+	    break;
+	}
+	continue;
+
+    deliver_err:
+	shm_ll_unlock(shm);
+	shm->cb(shm->cb_data, GENSIO_LL_CB_READ, err, NULL, 0, NULL);
+	shm_ll_lock(shm);
+	break;
+    }
+    shm->in_read = false;
+}
+
+static void
+shm_ll_check_write(struct shm_ll *shm)
+{
+    if (shm->in_write || !shm->write_enabled || shm->state != SHM_LL_OPEN)
+	return;
+
+    if (!shm->rx_err && !shm_tx_ready(shm)) {
+	/*
+	 * Ask the reader for a kick, then check again in case it
+	 * made room before it could see the request.
+	 */
+	__atomic_store_n(&shm->tx->want_space, 1, __ATOMIC_SEQ_CST);
+	if (!shm_tx_ready(shm))
+	    return;
+    }
+
+    shm->in_write = true;
+    shm_ll_unlock(shm);
+    shm->cb(shm->cb_data, GENSIO_LL_CB_WRITE_READY, 0, NULL, 0, NULL);
+    shm_ll_lock(shm);
+    shm->in_write = false;
+
+    if (shm->write_enabled && shm->state == SHM_LL_OPEN &&
+		(shm->rx_err || shm_tx_ready(shm)))
+	shm_ll_sched_deferred_op(shm);
+}
+
+static void
+shm_ring_copy_in(struct shm_ll *shm, uint32_t pos,
+		 const void *data, gensiods len)
+{
+    uint32_t off = pos & shm->mask;
+    gensiods n = len;
+
+    if (n > shm->size - off)
+	n = shm->size - off;
+    memcpy(shm->txbuf + off, data, n);
+    if (n < len)
+	memcpy(shm->txbuf, ((const unsigned char *) data) + n, len - n);
+}
+
+static int
+shm_ll_write(struct shm_ll *shm, gensiods *rcount,
+	     const struct gensio_sg *sg, gensiods sglen)
+{
+    struct shm_ring *r;
+    uint32_t head, tail, otail, space, off, pad, need, len;
+    gensiods i, total = 0, count = 0, n;
+    int64_t used;
+    int err = 0;
+
+    shm_ll_lock(shm);
+    if (shm->state != SHM_LL_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (shm->rx_err) {
+	err = shm->rx_err;
+	goto out_unlock;
+    }
+
+    r = shm->tx;
+    otail = tail = r->tail;
+    head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+    used = shm_ring_used(shm, head, tail);
+    if (used < 0) {
+	err = shm->rx_err = GE_PROTOERR;
+	goto out_unlock;
+    }
+    space = shm->size - used;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    if (shm->is_packet) {
+	if (total > shm->max_pkt) {
+	    err = GE_TOOBIG;
+	    goto out_unlock;
+	}
+	len = total;
+	need = SHM_PKT_ALIGN(len + 4);
+	off = tail & shm->mask;
+	pad = 0;
+	if (shm->size - off < need)
+	    pad = shm->size - off;
+	if (pad + need > space)
+	    goto out_done;
+	if (pad) {
+	    *((uint32_t *) (shm->txbuf + off)) = SHM_PKT_WRAP;
+	    tail += pad;
+	}
+	shm_ring_copy_in(shm, tail, &len, 4);
+	for (i = 0, n = 4; i < sglen; i++) {
+	    shm_ring_copy_in(shm, tail + n, sg[i].buf, sg[i].buflen);
+	    n += sg[i].buflen;
+	}
+	tail += need;
+	count = total;
+    } else {
+	for (i = 0; i < sglen && space > 0; i++) {
+	    n = sg[i].buflen;
+	    if (n > space)
+		n = space;
+	    shm_ring_copy_in(shm, tail, sg[i].buf, n);
+	    tail += n;
+	    space -= n;
+	    count += n;
+	}
+    }
+
+    if (tail != otail) {
+	__atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+	/* Only wake the reader if it had emptied the ring. */
+	if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == otail)
+	    shm_kick(shm->tx_data_fd);
+    }
+
+ out_done:
+    if (rcount)
+	*rcount = count;
+ out_unlock:
+    shm_ll_unlock(shm);
+    return err;
+}
+
+static void
+shm_ll_do_open(struct shm_ll *shm, int err)
+{
+    gensio_ll_open_done open_done = shm->open_done;
+    void *open_data = shm->open_data;
+
+    shm->open_done = NULL;
+    if (!open_done)
+	return;
+    shm_ll_unlock(shm);
+    open_done(shm->cb_data, err, open_data);
+    shm_ll_lock(shm);
+}
+
+static void
+shm_ll_do_close(struct shm_ll *shm)
+{
+    gensio_ll_close_done close_done = shm->close_done;
+    void *close_data = shm->close_data;
+
+    shm->close_done = NULL;
+    if (!close_done)
+	return;
+    shm_ll_unlock(shm);
+    close_done(shm->cb_data, close_data);
+    shm_ll_lock(shm);
+}
+
+static void
+shm_ll_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+
+    shm_ll_lock(shm);
+    shm->deferred_op_pending = false;
+    switch (shm->state) {
+    case SHM_LL_OPEN:
+	if (shm->deferred_open) {
+	    shm->deferred_open = false;
+	    shm_ll_do_open(shm, 0);
+	    if (shm->state != SHM_LL_OPEN)
+		break;
+	    /* Enables set before the open finished take effect now. */
+	    shm_ll_set_handlers(shm);
+	}
+	shm_ll_check_read(shm);
+	shm_ll_check_write(shm);
+	break;
+
+    case SHM_LL_IN_CLOSE:
+	if (shm->nr_clearing)
+	    break;
+	shm_ll_release(shm);
+	shm->state = SHM_LL_CLOSED;
+	shm_ll_do_open(shm, shm->open_err ? shm->open_err : GE_LOCALCLOSED);
+	shm_ll_do_close(shm);
+	shm_ll_deref(shm); /* Lose the ref from shm_ll_start_close(). */
+	break;
+
+    default:
+	break;
+    }
+    shm_ll_deref_and_unlock(shm);
+}
+
+/* Must be called with the lock held. */
+static void
+shm_ll_sched_deferred_op(struct shm_ll *shm)
+{
+    if (!shm->deferred_op_pending) {
+	shm_ll_ref(shm);
+	shm->deferred_op_pending = true;
+	shm->o->run(shm->deferred_runner);
+    }
+}
+
+static void
+shm_iod_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+
+    shm_ll_lock(shm);
+    assert(shm->nr_clearing > 0);
+    if (--shm->nr_clearing == 0)
+	shm_ll_sched_deferred_op(shm);
+    shm_ll_unlock(shm);
+}
+
+/*
+ * Clear all the handlers, the rest of the close is done in the
+ * deferred op when that finishes.
+ */
+static void
+shm_ll_start_close(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+
+    shm->state = SHM_LL_IN_CLOSE;
+    shm->deferred_open = false;
+    shm_ll_ref(shm);
+    shm->nr_clearing = 1;
+    if (shm->efd_handlers_set)
+	shm->nr_clearing += 2;
+    o->clear_fd_handlers(shm->sock_iod);
+    if (shm->efd_handlers_set) {
+	o->clear_fd_handlers(shm->rx_data_iod);
+	o->clear_fd_handlers(shm->tx_space_iod);
+    }
+}
+
+static void
+shm_rx_data_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+
+    shm_drain(shm->o, iod);
+    shm_ll_lock(shm);
+    shm_ll_check_read(shm);
+    shm_ll_unlock(shm);
+}
+
+static void
+shm_tx_space_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+
+    shm_drain(shm->o, iod);
+    shm_ll_lock(shm);
+    shm_ll_check_write(shm);
+    shm_ll_unlock(shm);
+}
+
+/*
+ * Map the memory and set up the eventfds.  The eventfds we wait on
+ * get iods, we just write to the others.
+ */
+static int
+shm_ll_setup(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+    unsigned int rxr = shm->is_acc ? 0 : 1, txr = !rxr;
+    unsigned char *rings[2];
+    void *map;
+    int err;
+
+    map = mmap(NULL, shm_map_size(shm->size), PROT_READ | PROT_WRITE,
+	       MAP_SHARED, shm->memfd, 0);
+    if (map == MAP_FAILED)
+	return gensio_os_err_to_err(o, errno);
+    shm->map = map;
+    close(shm->memfd);
+    shm->memfd = -1;
+
+    rings[0] = shm->map;
+    rings[1] = shm->map + sizeof(struct shm_ring) + shm->size;
+    shm->rx = (struct shm_ring *) rings[rxr];
+    shm->rxbuf = rings[rxr] + sizeof(struct shm_ring);
+    shm->tx = (struct shm_ring *) rings[txr];
+    shm->txbuf = rings[txr] + sizeof(struct shm_ring);
+
+    err = o->add_iod(o, GENSIO_IOD_DEV, shm->efds[SHM_EFD_DATA(rxr)],
+		     &shm->rx_data_iod);
+    if (err)
+	return err;
+    shm->efds[SHM_EFD_DATA(rxr)] = -1;
+    err = o->add_iod(o, GENSIO_IOD_DEV, shm->efds[SHM_EFD_SPACE(txr)],
+		     &shm->tx_space_iod);
+    if (err)
+	return err;
+    shm->efds[SHM_EFD_SPACE(txr)] = -1;
+    shm->rx_space_fd = shm->efds[SHM_EFD_SPACE(rxr)];
+    shm->tx_data_fd = shm->efds[SHM_EFD_DATA(txr)];
+
+    err = o->set_fd_handlers(shm->rx_data_iod, shm, shm_rx_data_ready,
+			     NULL, NULL, shm_iod_cleared);
+    if (err)
+	return err;
+    err = o->set_fd_handlers(shm->tx_space_iod, shm, shm_tx_space_ready,
+			     NULL, NULL, shm_iod_cleared);
+    if (err) {
+	o->clear_fd_handlers_norpt(shm->rx_data_iod);
+	return err;
+    }
+    shm->efd_handlers_set = true;
+    return 0;
+}
+
+static int
+shm_recv_hello(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+    struct shm_hello hello;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(sizeof(int) * (SHM_NR_EFDS + 1))];
+    } cbuf;
+    struct cmsghdr *cmsg;
+    int fds[SHM_NR_EFDS + 1];
+    unsigned int i, nfds = 0;
+    struct stat st;
+    ssize_t rv;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+
+    rv = recvmsg(o->iod_get_fd(shm->sock_iod), &msg,
+		 MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (rv == -1) {
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+	    return GE_INPROGRESS;
+	return gensio_os_err_to_err(o, errno);
+    }
+    if (rv == 0)
+	return GE_REMCLOSE;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+	    nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	    if (nfds > SHM_NR_EFDS + 1)
+		nfds = SHM_NR_EFDS + 1;
+	    memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+	    break;
+	}
+    }
+    if (nfds != SHM_NR_EFDS + 1) {
+	for (i = 0; i < nfds; i++)
+	    close(fds[i]);
+	return GE_PROTOERR;
+    }
+    shm->memfd = fds[0];
+    for (i = 0; i < SHM_NR_EFDS; i++)
+	shm->efds[i] = fds[i + 1];
+
+    if (rv != sizeof(hello) || msg.msg_flags & MSG_CTRUNC ||
+		hello.magic != SHM_MAGIC || hello.version != SHM_VERSION)
+	return GE_PROTOERR;
+    if (!!(hello.flags & SHM_FLAG_PACKET) != shm->is_packet)
+	return GE_INCONSISTENT;
+    if (hello.size < SHM_MIN_SIZE || hello.size > SHM_MAX_SIZE ||
+		(hello.size & (hello.size - 1)))
+	return GE_PROTOERR;
+    /* Make sure touching the memory won't fault. */
+    if (fstat(shm->memfd, &st) == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (st.st_size < (off_t) shm_map_size(hello.size))
+	return GE_PROTOERR;
+
+    shm->size = hello.size;
+    shm->mask = hello.size - 1;
+    shm->max_pkt = hello.size / 4 - 4;
+    return 0;
+}
+
+static int
+shm_send_hello(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+    struct shm_hello hello;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(sizeof(int) * (SHM_NR_EFDS + 1))];
+    } cbuf;
+    struct cmsghdr *cmsg;
+    int fds[SHM_NR_EFDS + 1];
+    ssize_t rv;
+
+    hello.magic = SHM_MAGIC;
+    hello.version = SHM_VERSION;
+    hello.size = shm->size;
+    hello.flags = shm->is_packet ? SHM_FLAG_PACKET : 0;
+
+    fds[0] = shm->memfd;
+    memcpy(fds + 1, shm->efds, sizeof(shm->efds));
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    /* The socket is new and the message is small, this won't block. */
+    rv = sendmsg(o->iod_get_fd(shm->sock_iod), &msg,
+		 MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (rv == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (rv != sizeof(hello))
+	return GE_COMMERR;
+    return 0;
+}
+
+static void
+shm_ll_fail_open(struct shm_ll *shm, int err)
+{
+    shm->open_err = err;
+    shm_ll_start_close(shm);
+}
+
+static void
+shm_sock_read_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+    int err;
+
+    shm_ll_lock(shm);
+    switch (shm->state) {
+    case SHM_LL_IN_OPEN:
+	err = shm_recv_hello(shm);
+	if (err == GE_INPROGRESS)
+	    break;
+	if (!err)
+	    err = shm_ll_setup(shm);
+	if (err) {
+	    shm_ll_fail_open(shm, err);
+	    break;
+	}
+	/* Stay readable to see the accepter go away. */
+	shm->state = SHM_LL_OPEN;
+	shm->deferred_open = true;
+	shm_ll_sched_deferred_op(shm);
+	break;
+
+    case SHM_LL_OPEN:
+	/* Nothing comes over the socket once open, this is a close. */
+	shm->o->set_read_handler(iod, false);
+	if (!shm->rx_err)
+	    shm->rx_err = GE_REMCLOSE;
+	shm_ll_sched_deferred_op(shm);
+	break;
+
+    default:
+	shm->o->set_read_handler(iod, false);
+	break;
+    }
+    shm_ll_unlock(shm);
+}
+
+static void
+shm_sock_write_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct shm_ll *shm = cb_data;
+    int err;
+
+    shm_ll_lock(shm);
+    shm->o->set_write_handler(iod, false);
+    if (shm->state == SHM_LL_IN_OPEN) {
+	/* The connect finished. */
+	err = shm->o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN, NULL, NULL);
+	if (err)
+	    shm_ll_fail_open(shm, err);
+	else
+	    shm->o->set_read_handler(iod, true);
+    }
+    shm_ll_unlock(shm);
+}
+
+static int
+shm_ll_open(struct shm_ll *shm, gensio_ll_open_done done, void *open_data)
+{
+    struct gensio_os_funcs *o = shm->o;
+    int err;
+
+    shm_ll_lock(shm);
+    if (shm->state != SHM_LL_CLOSED || shm->is_acc) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+
+    err = o->socket_open(o, shm->ai, GENSIO_NET_PROTOCOL_UNIX,
+			 &shm->sock_iod);
+    if (err)
+	goto out_unlock;
+    err = o->set_fd_handlers(shm->sock_iod, shm, shm_sock_read_ready,
+			     shm_sock_write_ready, NULL, shm_iod_cleared);
+    if (err) {
+	o->close(&shm->sock_iod);
+	goto out_unlock;
+    }
+
+    err = o->connect(shm->sock_iod, shm->ai);
+    if (err == GE_INPROGRESS) {
+	o->set_write_handler(shm->sock_iod, true);
+    } else if (!err) {
+	o->set_read_handler(shm->sock_iod, true);
+    } else {
+	o->clear_fd_handlers_norpt(shm->sock_iod);
+	o->close(&shm->sock_iod);
+	goto out_unlock;
+    }
+
+    shm->state = SHM_LL_IN_OPEN;
+    shm->open_err = 0;
+    shm->rx_err = 0;
+    shm->rx_pkt_pos = 0;
+    shm->open_done = done;
+    shm->open_data = open_data;
+    err = GE_INPROGRESS;
+
+ out_unlock:
+    shm_ll_unlock(shm);
+    return err;
+}
+
+static int
+shm_ll_close(struct shm_ll *shm, gensio_ll_close_done done, void *close_data)
+{
+    int err = 0;
+
+    shm_ll_lock(shm);
+    switch (shm->state) {
+    case SHM_LL_IN_OPEN:
+	shm->open_err = GE_LOCALCLOSED;
+	/* Fallthrough */
+    case SHM_LL_OPEN:
+	shm->close_done = done;
+	shm->close_data = close_data;
+	shm_ll_start_close(shm);
+	break;
+
+    case SHM_LL_IN_CLOSE:
+	/* A failed open that hasn't been reported yet. */
+	if (shm->open_done && !shm->close_done) {
+	    shm->close_done = done;
+	    shm->close_data = close_data;
+	    break;
+	}
+	/* Fallthrough */
+    default:
+	err = GE_NOTREADY;
+    }
+    shm_ll_unlock(shm);
+    return err;
+}
+
+static void
+shm_ll_set_read_callback_enable(struct shm_ll *shm, bool enabled)
+{
+    shm_ll_lock(shm);
+    shm->read_enabled = enabled;
+    if (shm->state == SHM_LL_OPEN && !shm->deferred_open) {
+	shm->o->set_read_handler(shm->rx_data_iod, enabled);
+	if (enabled)
+	    shm_ll_sched_deferred_op(shm);
+    }
+    shm_ll_unlock(shm);
+}
+
+static void
+shm_ll_set_write_callback_enable(struct shm_ll *shm, bool enabled)
+{
+    shm_ll_lock(shm);
+    shm->write_enabled = enabled;
+    if (shm->state == SHM_LL_OPEN && !shm->deferred_open) {
+	shm->o->set_read_handler(shm->tx_space_iod, enabled);
+	if (enabled)
+	    shm_ll_sched_deferred_op(shm);
+    }
+    shm_ll_unlock(shm);
+}
+
+static int
+shm_ll_control(struct shm_ll *shm, bool get, unsigned int option,
+	       char *data, gensiods *datalen)
+{
+    switch (option) {
+    case GENSIO_CONTROL_RADDR:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 0)
+	    return GE_NOTFOUND;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "%s", shm->path);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+shm_ll_free(struct shm_ll *shm)
+{
+    shm_ll_lock(shm);
+    shm->open_done = NULL;
+    shm->close_done = NULL;
+    if (shm->state == SHM_LL_IN_OPEN || shm->state == SHM_LL_OPEN)
+	shm_ll_start_close(shm);
+    shm_ll_deref_and_unlock(shm);
+}
+
+static void
+shm_ll_disable(struct shm_ll *shm)
+{
+    struct gensio_os_funcs *o = shm->o;
+
+    if (shm->sock_iod)
+	o->clear_fd_handlers_norpt(shm->sock_iod);
+    if (shm->efd_handlers_set) {
+	o->clear_fd_handlers_norpt(shm->rx_data_iod);
+	o->clear_fd_handlers_norpt(shm->tx_space_iod);
+    }
+    shm_ll_release(shm);
+    shm->state = SHM_LL_CLOSED;
+}
+
+static int
+shm_ll_func(struct gensio_ll *ll, int op, gensiods *count,
+	    void *buf, const void *cbuf, gensiods buflen,
+	    const char *const *auxdata)
+{
+    struct shm_ll *shm = ll_to_shm(ll);
+
+    switch (op) {
+    case GENSIO_LL_FUNC_SET_CALLBACK:
+	shm->cb = (gensio_ll_cb) cbuf;
+	shm->cb_data = buf;
+	return 0;
+
+    case GENSIO_LL_FUNC_WRITE_SG:
+	return shm_ll_write(shm, count, cbuf, buflen);
+
+    case GENSIO_LL_FUNC_OPEN:
+	return shm_ll_open(shm, (gensio_ll_open_done) cbuf, buf);
+
+    case GENSIO_LL_FUNC_CLOSE:
+	return shm_ll_close(shm, (gensio_ll_close_done) cbuf, buf);
+
+    case GENSIO_LL_FUNC_SET_READ_CALLBACK:
+	shm_ll_set_read_callback_enable(shm, buflen);
+	return 0;
+
+    case GENSIO_LL_FUNC_SET_WRITE_CALLBACK:
+	shm_ll_set_write_callback_enable(shm, buflen);
+	return 0;
+
+    case GENSIO_LL_FUNC_FREE:
+	shm_ll_free(shm);
+	return 0;
+
+    case GENSIO_LL_FUNC_DISABLE:
+	shm_ll_disable(shm);
+	return 0;
+
+    case GENSIO_LL_FUNC_CONTROL:
+	return shm_ll_control(shm, *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct shm_ll *
+shm_ll_alloc(struct gensio_os_funcs *o, const char *path, bool is_acc,
+	     bool is_packet)
+{
+    struct shm_ll *shm;
+    unsigned int i;
+
+    shm = o->zalloc(o, sizeof(*shm));
+    if (!shm)
+	return NULL;
+
+    shm->o = o;
+    shm->refcount = 1;
+    shm->is_acc = is_acc;
+    shm->is_packet = is_packet;
+    shm->memfd = -1;
+    for (i = 0; i < SHM_NR_EFDS; i++)
+	shm->efds[i] = -1;
+    shm->rx_space_fd = -1;
+    shm->tx_data_fd = -1;
+
+    shm->path = gensio_strdup(o, path);
+    if (!shm->path)
+	goto out_nomem;
+
+    shm->lock = o->alloc_lock(o);
+    if (!shm->lock)
+	goto out_nomem;
+
+    shm->deferred_runner = o->alloc_runner(o, shm_ll_deferred_op, shm);
+    if (!shm->deferred_runner)
+	goto out_nomem;
+
+    shm->ll = gensio_ll_alloc_data(o, shm_ll_func, shm);
+    if (!shm->ll)
+	goto out_nomem;
+
+    return shm;
+
+ out_nomem:
+    shm_ll_finish_free(shm);
+    return NULL;
+}
+
+/*
+ * Set up the accepter side of a new connection on sock_iod.  It is
+ * open as soon as the memory and eventfds are sent.
+ */
+static int
+shm_ll_server_start(struct shm_ll *shm, uint32_t size)
+{
+    struct gensio_os_funcs *o = shm->o;
+    unsigned int i;
+    int err;
+
+    shm->size = size;
+    shm->mask = size - 1;
+    shm->max_pkt = size / 4 - 4;
+
+    shm->memfd = memfd_create("gensio_shm", MFD_CLOEXEC);
+    if (shm->memfd == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (ftruncate(shm->memfd, shm_map_size(size)) == -1)
+	return gensio_os_err_to_err(o, errno);
+    for (i = 0; i < SHM_NR_EFDS; i++) {
+	shm->efds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (shm->efds[i] == -1)
+	    return gensio_os_err_to_err(o, errno);
+    }
+
+    err = shm_send_hello(shm);
+    if (err)
+	return err;
+    err = shm_ll_setup(shm);
+    if (err)
+	return err;
+
+    err = o->set_fd_handlers(shm->sock_iod, shm, shm_sock_read_ready,
+			     NULL, NULL, shm_iod_cleared);
+    if (err) {
+	o->clear_fd_handlers_norpt(shm->rx_data_iod);
+	o->clear_fd_handlers_norpt(shm->tx_space_iod);
+	shm->efd_handlers_set = false;
+	return err;
+    }
+    o->set_read_handler(shm->sock_iod, true);
+    shm->state = SHM_LL_OPEN;
+    return 0;
+}
+
+static int
+shm_gensio_alloc(const void *gdata, const char * const args[],
+		 struct gensio_os_funcs *o,
+		 gensio_event cb, void *user_data,
+		 struct gensio **new_gensio)
+{
+    const char *path = gdata;
+    struct gensio_addr *ai = NULL;
+    struct shm_ll *shm;
+    struct gensio *io;
+    bool is_packet = false;
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keybool(args[i], "packet", &is_packet) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    err = gensio_os_scan_netaddr(o, path, false, GENSIO_NET_PROTOCOL_UNIX,
+				 &ai);
+    if (err)
+	return err;
+
+    shm = shm_ll_alloc(o, path, false, is_packet);
+    if (!shm) {
+	gensio_addr_free(ai);
+	return GE_NOMEM;
+    }
+    shm->ai = ai;
+
+    io = base_gensio_alloc(o, shm->ll, NULL, NULL, "shm", cb, user_data);
+    if (!io) {
+	gensio_ll_free(shm->ll);
+	return GE_NOMEM;
+    }
+    gensio_set_is_reliable(io, true);
+    if (is_packet)
+	gensio_set_is_packet(io, true);
+
+    *new_gensio = io;
+    return 0;
+}
+
+static int
+str_to_shm_gensio(const char *str, const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    return shm_gensio_alloc(str, args, o, cb, user_data, new_gensio);
+}
+
+struct shmna_data {
+    struct gensio_accepter *acc;
+    struct gensio_os_funcs *o;
+
+    char *path;
+    struct gensio_addr *ai;
+    bool is_packet;
+    uint32_t size;
+    unsigned int opensock_flags;
+
+    struct gensio_lock *lock;
+    struct gensio_runner *cb_en_done_runner;
+    gensio_acc_done cb_en_done;
+    gensio_acc_done shutdown_done;
+
+    bool accepts_enabled;
+    struct gensio_opensocks *acceptfds;
+    unsigned int nr_acceptfds;
+    unsigned int nr_accept_close_waiting;
+};
+
+static void
+shmna_set_fd_enables(struct shmna_data *nadata, bool enable)
+{
+    unsigned int i;
+
+    nadata->accepts_enabled = enable;
+    for (i = 0; i < nadata->nr_acceptfds; i++)
+	nadata->o->set_read_handler(nadata->acceptfds[i].iod, enable);
+}
+
+static void
+shmna_finish_server_open(struct gensio *io, int err, void *cb_data)
+{
+    struct shmna_data *nadata = cb_data;
+
+    base_gensio_server_open_done(nadata->acc, io, err);
+}
+
+static int
+shmna_accept_one(struct shmna_data *nadata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_iod *new_iod = NULL;
+    struct gensio_addr *raddr;
+    struct shm_ll *shm = NULL;
+    struct gensio *io = NULL;
+    int err;
+
+    err = o->accept(iod, &raddr, &new_iod);
+    if (err) {
+	if (err != GE_NODATA)
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			   "Error accepting shm gensio: %s",
+			   gensio_err_to_str(err));
+	return err;
+    }
+    gensio_addr_free(raddr);
+
+    err = base_gensio_accepter_new_child_start(nadata->acc);
+    if (err) {
+	o->close(&new_iod);
+	return err;
+    }
+
+    shm = shm_ll_alloc(o, nadata->path, true, nadata->is_packet);
+    if (!shm) {
+	err = GE_NOMEM;
+	goto out_err;
+    }
+    shm->sock_iod = new_iod;
+    new_iod = NULL;
+
+    err = shm_ll_server_start(shm, nadata->size);
+    if (err)
+	goto out_err;
+
+    io = base_gensio_server_alloc(o, shm->ll, NULL, NULL, "shm",
+				  shmna_finish_server_open, nadata);
+    if (!io) {
+	err = GE_NOMEM;
+	goto out_err;
+    }
+    gensio_set_is_reliable(io, true);
+    if (nadata->is_packet)
+	gensio_set_is_packet(io, true);
+    err = base_gensio_server_start(io);
+    if (err)
+	goto out_err;
+    base_gensio_accepter_new_child_end(nadata->acc, io, 0);
+    return 0;
+
+ out_err:
+    base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
+    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		   "Error setting up shm gensio: %s", gensio_err_to_str(err));
+    if (io)
+	gensio_free(io);
+    else if (shm)
+	gensio_ll_free(shm->ll);
+    else if (new_iod)
+	o->close(&new_iod);
+    return 0;
+}
+
+static void
+shmna_readhandler(struct gensio_iod *iod, void *cb_data)
+{
+    struct shmna_data *nadata = cb_data;
+
+    if (nadata->accepts_enabled)
+	shmna_accept_one(nadata, iod);
+}
+
+static void
+shmna_fd_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct shmna_data *nadata = cb_data;
+    unsigned int num_left, i;
+
+    for (i = 0; i < nadata->nr_acceptfds; i++) {
+	if (iod == nadata->acceptfds[i].iod)
+	    break;
+    }
+    assert(i < nadata->nr_acceptfds);
+    nadata->o->close(&nadata->acceptfds[i].iod);
+
+    nadata->o->lock(nadata->lock);
+    assert(nadata->nr_accept_close_waiting > 0);
+    num_left = --nadata->nr_accept_close_waiting;
+    if (num_left == 0) {
+	nadata->o->free(nadata->o, nadata->acceptfds);
+	nadata->acceptfds = NULL;
+    }
+    nadata->o->unlock(nadata->lock);
+
+    if (num_left == 0)
+	nadata->shutdown_done(nadata->acc, NULL);
+}
+
+static int
+shmna_startup(struct gensio_accepter *accepter, struct shmna_data *nadata)
+{
+    int rv;
+
+    rv = gensio_os_open_listen_sockets(nadata->o, nadata->ai,
+				       shmna_readhandler, NULL,
+				       shmna_fd_cleared, NULL, nadata,
+				       nadata->opensock_flags,
+				       &nadata->acceptfds,
+				       &nadata->nr_acceptfds);
+    if (!rv)
+	shmna_set_fd_enables(nadata, true);
+    return rv;
+}
+
+static int
+shmna_shutdown(struct gensio_accepter *accepter, struct shmna_data *nadata,
+	       gensio_acc_done shutdown_done)
+{
+    unsigned int i;
+
+    nadata->shutdown_done = shutdown_done;
+    nadata->nr_accept_close_waiting = nadata->nr_acceptfds;
+    for (i = 0; i < nadata->nr_acceptfds; i++)
+	nadata->o->clear_fd_handlers(nadata->acceptfds[i].iod);
+    unlink(nadata->path);
+    return 0;
+}
+
+static void
+shmna_cb_en_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct shmna_data *nadata = cb_data;
+    gensio_acc_done done = nadata->cb_en_done;
+
+    nadata->cb_en_done = NULL;
+    done(nadata->acc, NULL);
+}
+
+static int
+shmna_set_accept_callback_enable(struct gensio_accepter *accepter,
+				 struct shmna_data *nadata,
+				 bool enabled, gensio_acc_done done)
+{
+    if (nadata->cb_en_done)
+	return GE_INUSE;
+
+    nadata->cb_en_done = done;
+    shmna_set_fd_enables(nadata, enabled);
+
+    if (done)
+	nadata->o->run(nadata->cb_en_done_runner);
+    return 0;
+}
+
+static void
+shmna_free(struct gensio_accepter *accepter, struct shmna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    if (nadata->cb_en_done_runner)
+	o->free_runner(nadata->cb_en_done_runner);
+    if (nadata->ai)
+	gensio_addr_free(nadata->ai);
+    if (nadata->path)
+	o->free(o, nadata->path);
+    o->free(o, nadata);
+}
+
+static void
+shmna_disable(struct gensio_accepter *accepter, struct shmna_data *nadata)
+{
+    unsigned int i;
+
+    for (i = 0; i < nadata->nr_acceptfds; i++)
+	nadata->o->clear_fd_handlers_norpt(nadata->acceptfds[i].iod);
+    for (i = 0; i < nadata->nr_acceptfds; i++)
+	nadata->o->close(&nadata->acceptfds[i].iod);
+}
+
+static int
+shmna_base_acc_op(struct gensio_accepter *acc, int op,
+		  void *acc_op_data, void *done, int val1,
+		  void *data, void *data2, void *ret)
+{
+    switch(op) {
+    case GENSIO_BASE_ACC_STARTUP:
+	return shmna_startup(acc, acc_op_data);
+
+    case GENSIO_BASE_ACC_SHUTDOWN:
+	return shmna_shutdown(acc, acc_op_data, done);
+
+    case GENSIO_BASE_ACC_SET_CB_ENABLE:
+	return shmna_set_accept_callback_enable(acc, acc_op_data, val1, done);
+
+    case GENSIO_BASE_ACC_FREE:
+	shmna_free(acc, acc_op_data);
+	return 0;
+
+    case GENSIO_BASE_ACC_DISABLE:
+	shmna_disable(acc, acc_op_data);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+shm_gensio_accepter_alloc(const void *gdata,
+			  const char * const args[],
+			  struct gensio_os_funcs *o,
+			  gensio_accepter_event cb, void *user_data,
+			  struct gensio_accepter **accepter)
+{
+    const char *path = gdata;
+    struct shmna_data *nadata;
+    gensiods size = SHM_DEFAULT_SIZE;
+    bool is_packet = false, delsock = false;
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "size", &size) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "packet", &is_packet) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "delsock", &delsock) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (size < SHM_MIN_SIZE || size > SHM_MAX_SIZE || (size & (size - 1)))
+	return GE_INVAL;
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->is_packet = is_packet;
+    nadata->size = size;
+    if (delsock)
+	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEADDR;
+
+    err = GE_NOMEM;
+    nadata->path = gensio_strdup(o, path);
+    if (!nadata->path)
+	goto out_err;
+
+    err = gensio_os_scan_netaddr(o, path, true, GENSIO_NET_PROTOCOL_UNIX,
+				 &nadata->ai);
+    if (err)
+	goto out_err;
+
+    err = GE_NOMEM;
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_err;
+
+    nadata->cb_en_done_runner = o->alloc_runner(o, shmna_cb_en_done, nadata);
+    if (!nadata->cb_en_done_runner)
+	goto out_err;
+
+    err = base_gensio_accepter_alloc(NULL, shmna_base_acc_op, nadata,
+				     o, "shm", cb, user_data, accepter);
+    if (err)
+	goto out_err;
+    nadata->acc = *accepter;
+
+    if (is_packet)
+	gensio_acc_set_is_packet(nadata->acc, true);
+    gensio_acc_set_is_reliable(nadata->acc, true);
+
+    return 0;
+
+ out_err:
+    shmna_free(NULL, nadata);
+    return err;
+}
+
+static int
+str_to_shm_gensio_accepter(const char *str, const char * const args[],
+			   struct gensio_os_funcs *o,
+			   gensio_accepter_event cb,
+			   void *user_data,
+			   struct gensio_accepter **acc)
+{
+    return shm_gensio_accepter_alloc(str, args, o, cb, user_data, acc);
+}
+
+int
+gensio_init_shm(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    rv = register_gensio(o, "shm", str_to_shm_gensio, shm_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_gensio_accepter(o, "shm", str_to_shm_gensio_accepter,
+				  shm_gensio_accepter_alloc);
+    if (rv)
+	return rv;
+    return 0;
+}
+
+#else /* defined(HAVE_MEMFD_CREATE) && defined(linux) */
+
+int
+gensio_init_shm(struct gensio_os_funcs *o)
+{
+    /* No memfds or eventfds, shm is not available. */
+    return 0;
+}
+
+#endif
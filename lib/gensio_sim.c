@@ -0,0 +1,644 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * An os funcs with a virtual clock, for running gensio stacks over
+ * in-memory links reproducibly and much faster than real time.
+ *
+ * Nothing ever blocks.  service() runs the oldest scheduled runner if
+ * there is one, otherwise it moves the clock to the earliest timer
+ * and runs it.  Timers are kept in a heap sorted by expiry and then
+ * by a sequence number taken when they are started, so ties always
+ * go the same way.  Everything must run in one thread, the locks
+ * from the base os funcs are only there so process-wide data that
+ * other os funcs may use stays protected.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_osops_addrinfo.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
+#include <gensio/gensio_sim.h>
+
+struct sim_data;
+
+typedef struct heap_val_s {
+    struct sim_data *d;
+    void (*handler)(struct gensio_timer *t, void *cb_data);
+    void *cb_data;
+
+    int64_t expiry; /* nsecs of virtual time */
+    uint64_t seq;
+    bool in_heap;
+
+    void (*done_handler)(struct gensio_timer *t, void *cb_data);
+    void *done_cb_data;
+    struct gensio_runner *done_runner;
+} heap_val_t;
+
+typedef struct sim_theap_s sim_theap_t;
+#define heap_s sim_theap_s
+#define heap_node_s gensio_timer
+#define HEAP_EXPORT_NAME(s) sim_theap_ ## s
+#define HEAP_NAMES_LOCAL static
+#define HEAP_OUTPUT_PRINTF "(%lld)"
+#define HEAP_OUTPUT_DATA (long long) pos->expiry
+
+static int
+heap_cmp_key(heap_val_t *v1, heap_val_t *v2)
+{
+    if (v1->expiry < v2->expiry)
+	return -1;
+    if (v1->expiry > v2->expiry)
+	return 1;
+    if (v1->seq < v2->seq)
+	return -1;
+    if (v1->seq > v2->seq)
+	return 1;
+    return 0;
+}
+
+#include "heap.h"
+
+struct sim_data {
+    struct gensio_os_funcs *base;
+    unsigned int refcount;
+
+    int64_t now; /* nsecs of virtual time */
+    uint64_t timer_seq;
+    uint64_t rand_state;
+
+    sim_theap_t timers;
+    unsigned int timers_pending;
+
+    /* Runners that are scheduled, in the order they were run(). */
+    struct gensio_list runq;
+
+    unsigned long long runners_run;
+    unsigned long long timers_run;
+
+    struct gensio_os_proc_data *pdata;
+};
+
+struct gensio_runner {
+    struct sim_data *d;
+    struct gensio_link link;
+    bool scheduled;
+    void (*handler)(struct gensio_runner *r, void *cb_data);
+    void *cb_data;
+};
+
+struct gensio_waiter {
+    struct sim_data *d;
+    unsigned int count;
+};
+
+static void *
+sim_zalloc(struct gensio_os_funcs *f, gensiods size)
+{
+    struct sim_data *d = f->user_data;
+
+    return d->base->zalloc(d->base, size);
+}
+
+static void
+sim_free(struct gensio_os_funcs *f, void *data)
+{
+    struct sim_data *d = f->user_data;
+
+    d->base->free(d->base, data);
+}
+
+static struct gensio_lock *
+sim_alloc_lock(struct gensio_os_funcs *f)
+{
+    struct sim_data *d = f->user_data;
+
+    return d->base->alloc_lock(d->base);
+}
+
+static struct gensio_timer *
+sim_alloc_timer(struct gensio_os_funcs *f,
+		void (*handler)(struct gensio_timer *t, void *cb_data),
+		void *cb_data)
+{
+    struct sim_data *d = f->user_data;
+    struct gensio_timer *t;
+
+    t = sim_zalloc(f, sizeof(*t));
+    if (!t)
+	return NULL;
+    t->val.d = d;
+    t->val.handler = handler;
+    t->val.cb_data = cb_data;
+    return t;
+}
+
+static void
+sim_timer_unheap(struct gensio_timer *t)
+{
+    struct sim_data *d = t->val.d;
+
+    sim_theap_remove(&d->timers, t);
+    t->val.in_heap = false;
+    d->timers_pending--;
+}
+
+static void sim_free_runner(struct gensio_runner *r);
+
+static void
+sim_free_timer(struct gensio_timer *t)
+{
+    struct sim_data *d = t->val.d;
+
+    if (t->val.in_heap)
+	sim_timer_unheap(t);
+    if (t->val.done_runner)
+	sim_free_runner(t->val.done_runner);
+    d->base->free(d->base, t);
+}
+
+static int
+sim_start_timer_abs_nsecs(struct gensio_timer *t, int64_t expiry)
+{
+    struct sim_data *d = t->val.d;
+
+    if (t->val.in_heap || t->val.done_handler)
+	return GE_INUSE;
+    if (expiry < d->now)
+	expiry = d->now;
+    t->val.expiry = expiry;
+    t->val.seq = d->timer_seq++;
+    t->val.in_heap = true;
+    sim_theap_add(&d->timers, t);
+    d->timers_pending++;
+    return 0;
+}
+
+static int
+sim_start_timer(struct gensio_timer *t, gensio_time *timeout)
+{
+    struct sim_data *d = t->val.d;
+
+    return sim_start_timer_abs_nsecs(t, d->now +
+				     timeout->secs * GENSIO_NSECS_IN_SEC +
+				     timeout->nsecs);
+}
+
+static int
+sim_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
+{
+    return sim_start_timer_abs_nsecs(t, timeout->secs * GENSIO_NSECS_IN_SEC +
+				     timeout->nsecs);
+}
+
+static int
+sim_stop_timer(struct gensio_timer *t)
+{
+    if (!t->val.in_heap)
+	return GE_TIMEDOUT;
+    sim_timer_unheap(t);
+    return 0;
+}
+
+static int sim_run(struct gensio_runner *r);
+
+static void
+sim_timer_done(struct gensio_runner *r, void *cb_data)
+{
+    struct gensio_timer *t = cb_data;
+    void (*done_handler)(struct gensio_timer *t, void *cb_data);
+
+    done_handler = t->val.done_handler;
+    t->val.done_handler = NULL;
+    done_handler(t, t->val.done_cb_data);
+}
+
+static struct gensio_runner *sim_alloc_runner_d(struct sim_data *d,
+				void (*handler)(struct gensio_runner *r,
+						void *cb_data),
+				void *cb_data);
+
+static int
+sim_stop_timer_with_done(struct gensio_timer *t,
+			 void (*done_handler)(struct gensio_timer *t,
+					      void *cb_data),
+			 void *cb_data)
+{
+    struct sim_data *d = t->val.d;
+
+    if (t->val.done_handler)
+	return GE_INUSE;
+    if (!t->val.in_heap)
+	return GE_TIMEDOUT;
+    if (!t->val.done_runner) {
+	t->val.done_runner = sim_alloc_runner_d(d, sim_timer_done, t);
+	if (!t->val.done_runner)
+	    return GE_NOMEM;
+    }
+    sim_timer_unheap(t);
+    t->val.done_handler = done_handler;
+    t->val.done_cb_data = cb_data;
+    sim_run(t->val.done_runner);
+    return 0;
+}
+
+static struct gensio_runner *
+sim_alloc_runner_d(struct sim_data *d,
+		   void (*handler)(struct gensio_runner *r, void *cb_data),
+		   void *cb_data)
+{
+    struct gensio_runner *r;
+
+    r = d->base->zalloc(d->base, sizeof(*r));
+    if (!r)
+	return NULL;
+    r->d = d;
+    r->handler = handler;
+    r->cb_data = cb_data;
+    return r;
+}
+
+static struct gensio_runner *
+sim_alloc_runner(struct gensio_os_funcs *f,
+		 void (*handler)(struct gensio_runner *r, void *cb_data),
+		 void *cb_data)
+{
+    return sim_alloc_runner_d(f->user_data, handler, cb_data);
+}
+
+static void
+sim_free_runner(struct gensio_runner *r)
+{
+    struct sim_data *d = r->d;
+
+    if (r->scheduled)
+	gensio_list_rm(&d->runq, &r->link);
+    d->base->free(d->base, r);
+}
+
+static int
+sim_run(struct gensio_runner *r)
+{
+    struct sim_data *d = r->d;
+
+    if (r->scheduled)
+	return GE_INUSE;
+    r->scheduled = true;
+    gensio_list_add_tail(&d->runq, &r->link);
+    return 0;
+}
+
+static struct gensio_waiter *
+sim_alloc_waiter(struct gensio_os_funcs *f)
+{
+    struct gensio_waiter *w;
+
+    w = sim_zalloc(f, sizeof(*w));
+    if (!w)
+	return NULL;
+    w->d = f->user_data;
+    return w;
+}
+
+static void
+sim_free_waiter(struct gensio_waiter *w)
+{
+    struct sim_data *d = w->d;
+
+    d->base->free(d->base, w);
+}
+
+
+static void
+sim_nsecs_to_time(int64_t v, gensio_time *t)
+{
+    t->secs = v / GENSIO_NSECS_IN_SEC;
+    t->nsecs = v % GENSIO_NSECS_IN_SEC;
+}
+
+/*
+ * Do one thing: the oldest runner, else the first timer if it expires
+ * before the timeout.  If there is nothing to do before the timeout
+ * the clock moves to the end of it, with no timeout it just returns
+ * since nothing could ever happen.
+ */
+static int
+sim_service_d(struct sim_data *d, gensio_time *timeout)
+{
+    struct gensio_runner *r;
+    struct gensio_timer *t;
+    int64_t end = 0;
+
+    if (!gensio_list_empty(&d->runq)) {
+	r = gensio_container_of(gensio_list_first(&d->runq),
+				struct gensio_runner, link);
+	gensio_list_rm(&d->runq, &r->link);
+	r->scheduled = false;
+	d->runners_run++;
+	r->handler(r, r->cb_data);
+	return 0;
+    }
+
+    if (timeout)
+	end = d->now + timeout->secs * GENSIO_NSECS_IN_SEC + timeout->nsecs;
+
+    t = sim_theap_get_top(&d->timers);
+    if (t && (!timeout || t->val.expiry <= end)) {
+	sim_timer_unheap(t);
+	if (t->val.expiry > d->now)
+	    d->now = t->val.expiry;
+	if (timeout)
+	    sim_nsecs_to_time(end - d->now, timeout);
+	d->timers_run++;
+	t->val.handler(t, t->val.cb_data);
+	return 0;
+    }
+
+    if (timeout) {
+	d->now = end;
+	timeout->secs = 0;
+	timeout->nsecs = 0;
+    }
+    return GE_TIMEDOUT;
+}
+
+static int
+sim_service(struct gensio_os_funcs *f, gensio_time *timeout)
+{
+    return sim_service_d(f->user_data, timeout);
+}
+
+/*
+ * Run things until the waiter has count wakes.  Once there is nothing
+ * left to run nothing can wake it, so that is a timeout even with no
+ * timeout given.
+ */
+static int
+sim_wait(struct gensio_waiter *w, unsigned int count, gensio_time *timeout)
+{
+    int rv;
+
+    while (w->count < count) {
+	rv = sim_service_d(w->d, timeout);
+	if (rv)
+	    return rv;
+    }
+    w->count -= count;
+    return 0;
+}
+
+static int
+sim_wait_intr_sigmask(struct gensio_waiter *w, unsigned int count,
+		      gensio_time *timeout,
+		      struct gensio_os_proc_data *proc_data)
+{
+    return sim_wait(w, count, timeout);
+}
+
+static void
+sim_wake(struct gensio_waiter *w)
+{
+    w->count++;
+}
+
+static struct gensio_os_funcs *
+sim_get_funcs(struct gensio_os_funcs *f)
+{
+    struct sim_data *d = f->user_data;
+
+    assert(d->refcount > 0);
+    d->refcount++;
+    return f;
+}
+
+static void
+sim_free_funcs(struct gensio_os_funcs *f)
+{
+    struct sim_data *d = f->user_data;
+    struct gensio_os_funcs *base = d->base;
+
+    assert(d->refcount > 0);
+    if (--d->refcount > 0)
+	return;
+    base->free(base, d);
+    base->free(base, f);
+    base->free_funcs(base);
+}
+
+static void
+sim_call_once(struct gensio_os_funcs *f, struct gensio_once *once,
+	      void (*func)(void *cb_data), void *cb_data)
+{
+    struct sim_data *d = f->user_data;
+
+    d->base->call_once(d->base, once, func, cb_data);
+}
+
+static void
+sim_get_monotonic_time(struct gensio_os_funcs *f, gensio_time *time)
+{
+    struct sim_data *d = f->user_data;
+
+    sim_nsecs_to_time(d->now, time);
+}
+
+static int
+sim_handle_fork(struct gensio_os_funcs *f)
+{
+    return 0;
+}
+
+/* xorshift64*, plenty for loss and jitter and cheap to reproduce. */
+static int
+sim_get_random(struct gensio_os_funcs *f, void *data, unsigned int len)
+{
+    struct sim_data *d = f->user_data;
+    unsigned char *p = data;
+    uint64_t v;
+    unsigned int n;
+
+    while (len > 0) {
+	d->rand_state ^= d->rand_state >> 12;
+	d->rand_state ^= d->rand_state << 25;
+	d->rand_state ^= d->rand_state >> 27;
+	v = d->rand_state * 0x2545f4914f6cdd1dULL;
+	n = len < sizeof(v) ? len : sizeof(v);
+	memcpy(p, &v, n);
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+static int
+sim_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
+	    intptr_t fd, struct gensio_iod **iod)
+{
+    return GE_NOTSUP;
+}
+
+static bool
+sim_is_regfile(struct gensio_os_funcs *o, intptr_t fd)
+{
+    return false;
+}
+
+static int
+sim_open_dev(struct gensio_os_funcs *o, const char *name, int options,
+	     struct gensio_iod **iod)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_exec_subprog(struct gensio_os_funcs *o,
+		 const char *argv[], const char **env,
+		 const char *start_dir,
+		 unsigned int flags,
+		 intptr_t *rpid,
+		 struct gensio_iod **rstdin,
+		 struct gensio_iod **rstdout,
+		 struct gensio_iod **rstderr)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_kill_subprog(struct gensio_os_funcs *o, intptr_t pid, bool force)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_wait_subprog(struct gensio_os_funcs *o, intptr_t pid, int *retcode)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_socket_open(struct gensio_os_funcs *o,
+		const struct gensio_addr *addr, int protocol,
+		struct gensio_iod **iod)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_open_listen_sockets(struct gensio_os_funcs *o,
+			struct gensio_addr *addr,
+			int (*call_b4_listen)(struct gensio_iod *, void *),
+			void *data, unsigned int opensock_flags,
+			struct gensio_opensocks **fds,
+			unsigned int *nr_fds)
+{
+    return GE_NOTSUP;
+}
+
+static int
+sim_control(struct gensio_os_funcs *o, int func, void *data,
+	    gensiods *datalen)
+{
+    struct sim_data *d = o->user_data;
+
+    switch (func) {
+    case GENSIO_CONTROL_SET_PROC_DATA:
+	d->pdata = data;
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_sim_funcs_alloc(struct gensio_os_funcs *base, uint64_t seed,
+		       struct gensio_os_funcs **ro)
+{
+    struct sim_data *d;
+    struct gensio_os_funcs *o;
+
+    o = base->zalloc(base, sizeof(*o));
+    if (!o)
+	return GE_NOMEM;
+    d = base->zalloc(base, sizeof(*d));
+    if (!d) {
+	base->free(base, o);
+	return GE_NOMEM;
+    }
+
+    d->base = base->get_funcs(base);
+    d->refcount = 1;
+    /* xorshift can't have a zero state. */
+    d->rand_state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    sim_theap_init(&d->timers);
+    gensio_list_init(&d->runq);
+    o->user_data = d;
+
+    o->zalloc = sim_zalloc;
+    o->free = sim_free;
+    o->alloc_lock = sim_alloc_lock;
+    o->free_lock = base->free_lock;
+    o->lock = base->lock;
+    o->unlock = base->unlock;
+    o->alloc_timer = sim_alloc_timer;
+    o->free_timer = sim_free_timer;
+    o->start_timer = sim_start_timer;
+    o->start_timer_abs = sim_start_timer_abs;
+    o->stop_timer = sim_stop_timer;
+    o->stop_timer_with_done = sim_stop_timer_with_done;
+    o->alloc_runner = sim_alloc_runner;
+    o->free_runner = sim_free_runner;
+    o->run = sim_run;
+    o->alloc_waiter = sim_alloc_waiter;
+    o->free_waiter = sim_free_waiter;
+    o->wait = sim_wait;
+    o->wait_intr = sim_wait;
+    o->wait_intr_sigmask = sim_wait_intr_sigmask;
+    o->wake = sim_wake;
+    o->service = sim_service;
+    o->get_funcs = sim_get_funcs;
+    o->free_funcs = sim_free_funcs;
+    o->call_once = sim_call_once;
+    o->get_monotonic_time = sim_get_monotonic_time;
+    o->handle_fork = sim_handle_fork;
+    o->get_random = sim_get_random;
+    o->add_iod = sim_add_iod;
+    o->is_regfile = sim_is_regfile;
+    o->open_dev = sim_open_dev;
+    o->exec_subprog = sim_exec_subprog;
+    o->kill_subprog = sim_kill_subprog;
+    o->wait_subprog = sim_wait_subprog;
+    o->socket_open = sim_socket_open;
+    o->open_listen_sockets = sim_open_listen_sockets;
+    o->control = sim_control;
+
+    gensio_addr_addrinfo_set_os_funcs(o);
+
+    *ro = o;
+    return 0;
+}
+
+int
+gensio_sim_funcs_get_stats(struct gensio_os_funcs *o,
+			   struct gensio_sim_stats *stats)
+{
+    struct sim_data *d;
+
+    if (o->service != sim_service)
+	return GE_INVAL;
+    d = o->user_data;
+    sim_nsecs_to_time(d->now, &stats->now);
+    stats->runners_run = d->runners_run;
+    stats->timers_run = d->timers_run;
+    stats->timers_pending = d->timers_pending;
+    return 0;
+}
@@ -145,8 +145,34 @@ sound_gensio_alloc(const void *gdata, const char * const args[],
 	    out.samplerate = uival;
 	    continue;
 	}
+	if (gensio_check_keybool(args[i], "inmmap", &in.mmap) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "outmmap", &out.mmap) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "mmap", &in.mmap) > 0) {
+	    out.mmap = in.mmap;
+	    continue;
+	}
+	if (gensio_check_keyds(args[i], "inperiod", &in.period) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "outperiod", &out.period) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "period", &dsval) > 0) {
+	    in.period = dsval;
+	    out.period = dsval;
+	    continue;
+	}
 	if (gensio_check_keybool(args[i], "list", &list) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "inresample", &in.resample) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "outresample", &out.resample) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "resample", &uival) > 0) {
+	    in.resample = uival;
+	    out.resample = uival;
+	    continue;
+	}
 	if (gensio_check_keyvalue(args[i], "intype", &in.type) > 0)
 	    continue;
 	if (gensio_check_keyvalue(args[i], "outtype", &out.type) > 0)
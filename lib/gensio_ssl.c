@@ -249,5 +249,5 @@ gensio_init_ssl(struct gensio_os_funcs *o)
 					 ssl_gensio_accepter_alloc);
     if (rv)
 	return rv;
-    return 0;
+    return gensio_init_dtls(o);
 }
@@ -86,6 +86,9 @@ struct stdiona_data {
     bool stderr_to_stdout;
     bool noredir_stderr;
 
+    /* Capacity to set on the child's pipes, 0 leaves the default. */
+    gensiods pipesize;
+
     unsigned int refcount;
 
     int argc;
@@ -625,6 +628,23 @@ stdion_write_except_ready(struct gensio_iod *iod, void *cbdata)
     stdion_write_ready(iod, cbdata);
 }
 
+static void
+set_pipe_size(struct stdiona_data *nadata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    int rv;
+
+    if (!iod)
+	return;
+    rv = o->iod_control(iod, GENSIO_IOD_CONTROL_PIPE_SIZE, false,
+			nadata->pipesize);
+    if (rv)
+	/* Over the system limit or not supported, keep going. */
+	gensio_log(o, GENSIO_LOG_INFO,
+		   "stdio: Unable to set pipe size to %lu: %s",
+		   (unsigned long) nadata->pipesize, gensio_err_to_str(rv));
+}
+
 static int
 setup_child_proc(struct stdiona_data *nadata)
 {
@@ -636,6 +656,11 @@ setup_child_proc(struct stdiona_data *nadata)
 			 &nadata->opid, &nadata->io.in_iod,
 			 &nadata->io.out_iod,
 			 nadata->noredir_stderr ? NULL : &nadata->err.out_iod);
+    if (!rv && nadata->pipesize) {
+	set_pipe_size(nadata, nadata->io.in_iod);
+	set_pipe_size(nadata, nadata->io.out_iod);
+	set_pipe_size(nadata, nadata->err.out_iod);
+    }
     return rv;
 }
 
@@ -1031,6 +1056,28 @@ stdion_control(struct gensio *io, bool get, unsigned int option,
 	    return GE_INVAL;
 	return 0;
 
+    case GENSIO_CONTROL_FD:
+	if (!get)
+	    return GE_NOTSUP;
+	val = strtoul(data, NULL, 0);
+	if (val > 1)
+	    return GE_INVAL;
+	err = 0;
+	stdiona_lock(nadata);
+	if (val == 0 && !schan->out_iod)
+	    err = GE_NOTFOUND;
+	else if (val == 1 && !schan->in_iod)
+	    err = GE_NOTFOUND;
+	else if (val == 0 && schan->data_pending_len)
+	    /* Data already read from the fd would be lost. */
+	    err = GE_INUSE;
+	else
+	    *datalen = snprintf(data, *datalen, "%d",
+				o->iod_get_fd(val == 0 ? schan->out_iod :
+					      schan->in_iod));
+	stdiona_unlock(nadata);
+	return err;
+
     case GENSIO_CONTROL_START_DIRECTORY:
 	if (get) {
 	    *datalen = snprintf(data, *datalen, "%s", nadata->start_dir);
@@ -1185,10 +1232,13 @@ stdio_gensio_alloc(const void *gdata, const char * const args[],
     bool noredir_stderr = false;
     bool raw = false;
     const char *start_dir = NULL;
+    gensiods pipesize = 0;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "pipesize", &pipesize) > 0)
+	    continue;
 	if (gensio_check_keybool(args[i], "console", &console) > 0)
 	    continue;
 	if (gensio_check_keybool(args[i], "self", &self) > 0)
@@ -1218,6 +1268,7 @@ stdio_gensio_alloc(const void *gdata, const char * const args[],
 
     nadata->stderr_to_stdout = stderr_to_stdout;
     nadata->noredir_stderr = noredir_stderr;
+    nadata->pipesize = pipesize;
     if (start_dir) {
 	nadata->start_dir = gensio_strdup(o, start_dir);
 	if (!nadata->start_dir) {
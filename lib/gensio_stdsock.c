@@ -32,8 +32,10 @@ typedef int sockret;
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 typedef socklen_t taddrlen;
 typedef ssize_t sockret;
 #define sock_errno errno
@@ -47,6 +49,32 @@ typedef ssize_t sockret;
 #if HAVE_UNIX
 #include <sys/un.h>
 #endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+	defined(SO_EE_ORIGIN_ZEROCOPY) && defined(HAVE_RECVMSG)
+#define STDSOCK_HAVE_ZEROCOPY
+#endif
+#if defined(TCP_INFO) && defined(__linux__)
+#define STDSOCK_HAVE_TCP_INFO
+#endif
+#ifdef HAVE_LINUX_NET_TSTAMP_H
+#include <linux/net_tstamp.h>
+#endif
+/* The SOF_TIMESTAMPING_xxx values are an enum, not defines. */
+#if defined(SO_TIMESTAMPING) && defined(HAVE_LINUX_NET_TSTAMP_H) && \
+	defined(SO_EE_ORIGIN_TIMESTAMPING) && defined(HAVE_RECVMMSG)
+#define STDSOCK_HAVE_TIMESTAMPING
+#ifndef SCM_TIMESTAMPING
+#define SCM_TIMESTAMPING SO_TIMESTAMPING
+#endif
+#endif
+#if defined(SCM_RIGHTS) && defined(HAVE_RECVMSG) && !defined(_WIN32)
+#define STDSOCK_HAVE_FDPASS
+/* Descriptors held on a socket for GENSIO_SOCKCTL_GET_FD. */
+#define STDSOCK_MAX_RFDS 16
+#endif
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
@@ -83,6 +111,22 @@ struct gensio_stdsock_info {
 #ifdef HAVE_RECVMSG
     /* Is the extrainfo flag set? */
     bool extrainfo;
+
+    /* Is UDP_GRO set?  If so, report coalesced segment sizes. */
+    bool gro;
+
+    /* GENSIO_TSTAMP_xxx flags set on the socket. */
+    unsigned int tstamp;
+#endif
+
+#ifdef STDSOCK_HAVE_FDPASS
+    /*
+     * Descriptors received with GENSIO_SOCKCTL_RECV_FDS and not yet
+     * taken with GENSIO_SOCKCTL_GET_FD, oldest first.  Allocated on
+     * the first receive, anything left is closed with the socket.
+     */
+    int *rfds;
+    unsigned int nr_rfds;
 #endif
 };
 
@@ -778,6 +822,11 @@ gensio_stdsock_send(struct gensio_iod *iod,
     if (do_errtrig())
 	return GE_NOMEM;
 
+#ifdef STDSOCK_HAVE_ZEROCOPY
+    if (gflags & GENSIO_MSG_ZEROCOPY)
+	flags |= MSG_ZEROCOPY;
+#endif
+
     {
 #ifdef HAVE_SENDMSG
 	struct msghdr hdr;
@@ -788,6 +837,19 @@ gensio_stdsock_send(struct gensio_iod *iod,
 
     retry:
 	rv = sendmsg(o->iod_get_fd(iod), &hdr, flags);
+#ifdef STDSOCK_HAVE_ZEROCOPY
+	/* Out of optmem to track the pages, the caller will copy. */
+	if (rv < 0 && sock_errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+	    return GE_NOMEM;
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+	/* A fast open connect went out without data, wait for it. */
+	if (rv < 0 && sock_errno == EINPROGRESS) {
+	    if (rcount)
+		*rcount = 0;
+	    return 0;
+	}
+#endif
 	ERRHANDLE();
 #else
 	gensiods len;
@@ -863,6 +925,124 @@ gensio_addr_addrinfo_alloc_recvfrom(struct gensio_os_funcs *o)
 				     true);
 }
 
+#ifdef HAVE_RECVMSG
+/*
+ * Pull the interface and destination address from the control
+ * messages for extrainfo and put them in the 2nd and 3rd addresses in
+ * addr.
+ */
+static void
+gensio_stdsock_get_pktinfo(struct msghdr *hdr, struct gensio_addr *addr)
+{
+    struct addrinfo *ai;
+    struct cmsghdr *cmsg;
+
+#ifdef IP_PKTINFO
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == IPPROTO_IP &&
+		    cmsg->cmsg_type == IP_PKTINFO) {
+	    struct in_pktinfo *pi;
+
+	    pi = (struct in_pktinfo *) CMSG_DATA(cmsg);
+	    if (gensio_addr_next(addr)) {
+		struct sockaddr *inaddr;
+
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = GENSIO_AF_IFINDEX;
+		inaddr = (struct sockaddr *) ai->ai_addr;
+		inaddr->sa_family = GENSIO_AF_IFINDEX;
+		*((unsigned int *) inaddr->sa_data) = pi->ipi_ifindex;
+	    }
+	    if (gensio_addr_next(addr)) {
+		struct sockaddr_in *inaddr;
+
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = AF_INET;
+		ai->ai_addrlen = sizeof(*inaddr);
+		inaddr = (struct sockaddr_in *) ai->ai_addr;
+		inaddr->sin_family = AF_INET;
+		inaddr->sin_port = 0;
+		inaddr->sin_addr = pi->ipi_addr;
+	    }
+	}
+    }
+#elif defined(IP_RECVIF) && defined(IP_RECVDSTADDR)
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == IPPROTO_IP &&
+		    cmsg->cmsg_type == IP_RECVIF) {
+	    uint16_t *iptr;
+	    struct sockaddr *inaddr;
+
+	    /*
+	     * There's no docs on this that I could find, but the
+	     * value seems to be in the second 16-bit value in the
+	     * data.  Not sure if it will work on big endian, or
+	     * if this is even right.
+	     */
+	    iptr = (uint16_t *) CMSG_DATA(cmsg);
+	    if (gensio_addr_next(addr)) {
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = GENSIO_AF_IFINDEX;
+		inaddr = (struct sockaddr *) ai->ai_addr;
+		inaddr->sa_family = GENSIO_AF_IFINDEX;
+		*((unsigned int *) inaddr->sa_data) = iptr[1];
+	    }
+	}
+    }
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == IPPROTO_IP &&
+		   cmsg->cmsg_type == IP_RECVDSTADDR) {
+	    struct sockaddr_in *inaddr;
+
+	    if (gensio_addr_next(addr)) {
+		struct in_addr *iptr;
+
+		iptr = (struct in_addr *) CMSG_DATA(cmsg);
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = AF_INET;
+		ai->ai_addrlen = sizeof(*inaddr);
+		inaddr = (struct sockaddr_in *) ai->ai_addr;
+		inaddr->sin_family = AF_INET;
+		inaddr->sin_port = 0;
+		inaddr->sin_addr = *iptr;
+	    }
+	}
+    }
+#endif
+#ifdef IPV6_RECVPKTINFO
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == IPPROTO_IPV6 &&
+		    cmsg->cmsg_type == IPV6_PKTINFO) {
+	    struct in6_pktinfo *pi;
+
+	    pi = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+	    if (gensio_addr_next(addr)) {
+		struct sockaddr *inaddr;
+
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = GENSIO_AF_IFINDEX;
+		inaddr = (struct sockaddr *) ai->ai_addr;
+		inaddr->sa_family = GENSIO_AF_IFINDEX;
+		*((unsigned int *) inaddr->sa_data) = pi->ipi6_ifindex;
+	    }
+	    if (gensio_addr_next(addr)) {
+		struct sockaddr_in6 *inaddr;
+
+		ai = gensio_addr_addrinfo_get_curr(addr);
+		ai->ai_family = AF_INET6;
+		ai->ai_addrlen = sizeof(*inaddr);
+		inaddr = (struct sockaddr_in6 *) ai->ai_addr;
+		memset(inaddr, 0, sizeof(*inaddr));
+		inaddr->sin6_family = AF_INET6;
+		inaddr->sin6_addr = pi->ipi6_addr;
+	    }
+	}
+    }
+    gensio_addr_rewind(addr);
+#endif
+}
+#endif
+
 static int
 gensio_stdsock_recvfrom(struct gensio_iod *iod,
 			void *buf, gensiods buflen, gensiods *rcount,
@@ -919,115 +1099,174 @@ gensio_stdsock_recvfrom(struct gensio_iod *iod,
 	    err = sock_errno;
     }
 #ifdef HAVE_RECVMSG
-    if (!err && gsi->extrainfo) {
-	struct cmsghdr *cmsg;
+    if (!err && gsi->extrainfo)
+	gensio_stdsock_get_pktinfo(&hdr, addr);
+#endif
+    if (!err && rcount)
+	*rcount = rv;
+    return gensio_os_err_to_err(o, err);
+}
 
-#ifdef IP_PKTINFO
-	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
-	    if (cmsg->cmsg_level == IPPROTO_IP &&
-			cmsg->cmsg_type == IP_PKTINFO) {
-		struct in_pktinfo *pi;
-
-		pi = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		if (gensio_addr_next(addr)) {
-		    struct sockaddr *inaddr;
-
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = GENSIO_AF_IFINDEX;
-		    inaddr = (struct sockaddr *) ai->ai_addr;
-		    inaddr->sa_family = GENSIO_AF_IFINDEX;
-		    *((unsigned int *) inaddr->sa_data) = pi->ipi_ifindex;
-		}
-		if (gensio_addr_next(addr)) {
-		    struct sockaddr_in *inaddr;
-
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = AF_INET;
-		    inaddr = (struct sockaddr_in *) ai->ai_addr;
-		    inaddr->sin_family = AF_INET;
-		    inaddr->sin_port = 0;
-		    inaddr->sin_addr = pi->ipi_addr;
-		}
-	    }
-	}
-#elif defined(IP_RECVIF) && defined(IP_RECVDSTADDR)
-	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
-	    if (cmsg->cmsg_level == IPPROTO_IP &&
-			cmsg->cmsg_type == IP_RECVIF) {
-		uint16_t *iptr;
-		struct sockaddr *inaddr;
+#ifdef HAVE_RECVMMSG
+#define STDSOCK_MAX_MMSG 64
 
-		/*
-		 * There's no docs on this that I could find, but the
-		 * value seems to be in the second 16-bit value in the
-		 * data.  Not sure if it will work on big endian, or
-		 * if this is even right.
-		 */
-		iptr = (uint16_t *) CMSG_DATA(cmsg);
-		if (gensio_addr_next(addr)) {
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = GENSIO_AF_IFINDEX;
-		    inaddr = (struct sockaddr *) ai->ai_addr;
-		    inaddr->sa_family = GENSIO_AF_IFINDEX;
-		    *((unsigned int *) inaddr->sa_data) = iptr[1];
-		}
-	    }
+#ifdef UDP_GRO
+/*
+ * Return the size of the individual datagrams in a buffer the kernel
+ * coalesced with GRO, or 0 if it's a single datagram.
+ */
+static gensiods
+gensio_stdsock_get_gro_size(struct msghdr *hdr)
+{
+    struct cmsghdr *cmsg;
+    int segsize;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+	    memcpy(&segsize, CMSG_DATA(cmsg), sizeof(segsize));
+	    if (segsize > 0)
+		return segsize;
 	}
-	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
-	    if (cmsg->cmsg_level == IPPROTO_IP &&
-		       cmsg->cmsg_type == IP_RECVDSTADDR) {
-		struct sockaddr_in *inaddr;
+    }
+    return 0;
+}
+#endif
 
-		if (gensio_addr_next(addr)) {
-		    struct in_addr *iptr;
+#ifdef STDSOCK_HAVE_TIMESTAMPING
+/*
+ * The kernel's struct scm_timestamping.  ts[0] is the software
+ * timestamp, ts[2] is the raw hardware timestamp, ts[1] is unused.
+ */
+struct stdsock_scm_timestamping {
+    struct timespec ts[3];
+};
 
-		    iptr = (struct in_addr *) CMSG_DATA(cmsg);
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = AF_INET;
-		    inaddr = (struct sockaddr_in *) ai->ai_addr;
-		    inaddr->sin_family = AF_INET;
-		    inaddr->sin_port = 0;
-		    inaddr->sin_addr = *iptr;
-		}
-	    }
+static void
+gensio_stdsock_get_tstamps(struct msghdr *hdr,
+			   gensio_time *sw, gensio_time *hw)
+{
+    struct stdsock_scm_timestamping tss;
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level == SOL_SOCKET &&
+		cmsg->cmsg_type == SCM_TIMESTAMPING) {
+	    memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+	    sw->secs = tss.ts[0].tv_sec;
+	    sw->nsecs = tss.ts[0].tv_nsec;
+	    hw->secs = tss.ts[2].tv_sec;
+	    hw->nsecs = tss.ts[2].tv_nsec;
+	    return;
 	}
+    }
+}
 #endif
-#ifdef IPV6_RECVPKTINFO
-	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
-	    if (cmsg->cmsg_level == IPPROTO_IPV6 &&
-			cmsg->cmsg_type == IPV6_PKTINFO) {
-		struct in6_pktinfo *pi;
-
-		pi = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		if (gensio_addr_next(addr)) {
-		    struct sockaddr *inaddr;
-
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = GENSIO_AF_IFINDEX;
-		    inaddr = (struct sockaddr *) ai->ai_addr;
-		    inaddr->sa_family = GENSIO_AF_IFINDEX;
-		    *((unsigned int *) inaddr->sa_data) = pi->ipi6_ifindex;
-		}
-		if (gensio_addr_next(addr)) {
-		    struct sockaddr_in6 *inaddr;
-
-		    ai = gensio_addr_addrinfo_get_curr(addr);
-		    ai->ai_family = AF_INET6;
-		    inaddr = (struct sockaddr_in6 *) ai->ai_addr;
-		    memset(inaddr, 0, sizeof(*inaddr));
-		    inaddr->sin6_family = AF_INET6;
-		    inaddr->sin6_addr = pi->ipi6_addr;
-		}
-	    }
+
+static int
+gensio_stdsock_recv_multi(struct gensio_iod *iod,
+			  struct gensio_sockmsg *msgs, gensiods *nr_msgs)
+{
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    struct mmsghdr hdrs[STDSOCK_MAX_MMSG];
+    struct iovec iovs[STDSOCK_MAX_MMSG];
+    unsigned char ctrlinfo[STDSOCK_MAX_MMSG][128];
+    struct addrinfo *ai;
+    unsigned int i, count = *nr_msgs;
+    int rv, err;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (count > STDSOCK_MAX_MMSG)
+	count = STDSOCK_MAX_MMSG;
+
+    memset(hdrs, 0, sizeof(*hdrs) * count);
+    for (i = 0; i < count; i++) {
+	if (msgs[i].addr) {
+	    gensio_addr_rewind(msgs[i].addr);
+	    ai = gensio_addr_addrinfo_get_curr(msgs[i].addr);
+	    hdrs[i].msg_hdr.msg_name = ai->ai_addr;
+	    hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
 	}
-	gensio_addr_rewind(addr);
-#endif
+	iovs[i].iov_base = msgs[i].buf;
+	iovs[i].iov_len = msgs[i].buflen;
+	hdrs[i].msg_hdr.msg_iov = &iovs[i];
+	hdrs[i].msg_hdr.msg_iovlen = 1;
+	hdrs[i].msg_hdr.msg_control = ctrlinfo[i];
+	hdrs[i].msg_hdr.msg_controllen = sizeof(ctrlinfo[i]);
     }
+
+ retry:
+    rv = recvmmsg(o->iod_get_fd(iod), hdrs, count, 0, NULL);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN) {
+	    *nr_msgs = 0;
+	    return 0;
+	}
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+
+    for (i = 0; i < (unsigned int) rv; i++) {
+	msgs[i].len = hdrs[i].msg_len;
+	msgs[i].segsize = 0;
+	memset(&msgs[i].rx_sw, 0, sizeof(msgs[i].rx_sw));
+	memset(&msgs[i].rx_hw, 0, sizeof(msgs[i].rx_hw));
+#ifdef STDSOCK_HAVE_TIMESTAMPING
+	if (gsi->tstamp & (GENSIO_TSTAMP_RX_SW | GENSIO_TSTAMP_RX_HW))
+	    gensio_stdsock_get_tstamps(&hdrs[i].msg_hdr,
+				       &msgs[i].rx_sw, &msgs[i].rx_hw);
 #endif
-    if (!err && rcount)
-	*rcount = rv;
-    return gensio_os_err_to_err(o, err);
+	if (!msgs[i].addr)
+	    continue;
+	ai = gensio_addr_addrinfo_get_curr(msgs[i].addr);
+	ai->ai_addrlen = hdrs[i].msg_hdr.msg_namelen;
+	ai->ai_family = ai->ai_addr->sa_family;
+	if (gsi->extrainfo)
+	    gensio_stdsock_get_pktinfo(&hdrs[i].msg_hdr, msgs[i].addr);
+#ifdef UDP_GRO
+	if (gsi->gro)
+	    msgs[i].segsize = gensio_stdsock_get_gro_size(&hdrs[i].msg_hdr);
+#endif
+    }
+    *nr_msgs = rv;
+    return 0;
+}
+#else
+/* No recvmmsg(), at least save the trips through the selector. */
+static int
+gensio_stdsock_recv_multi(struct gensio_iod *iod,
+			  struct gensio_sockmsg *msgs, gensiods *nr_msgs)
+{
+    gensiods i;
+    int err = 0;
+
+    for (i = 0; i < *nr_msgs; i++) {
+	if (msgs[i].addr)
+	    err = gensio_stdsock_recvfrom(iod, msgs[i].buf, msgs[i].buflen,
+					  &msgs[i].len, 0, msgs[i].addr);
+	else
+	    err = gensio_stdsock_recv(iod, msgs[i].buf, msgs[i].buflen,
+				      &msgs[i].len, 0);
+	msgs[i].segsize = 0;
+	memset(&msgs[i].rx_sw, 0, sizeof(msgs[i].rx_sw));
+	memset(&msgs[i].rx_hw, 0, sizeof(msgs[i].rx_hw));
+	if (err || msgs[i].len == 0)
+	    break;
+    }
+    if (i > 0)
+	err = 0; /* Report the error on the next call. */
+    *nr_msgs = i;
+    return err;
 }
+#endif
 
 static int
 gensio_stdsock_accept(struct gensio_iod *iod,
@@ -1042,6 +1281,7 @@ gensio_stdsock_accept(struct gensio_iod *iod,
     struct gensio_iod *riod = NULL;
     struct addrinfo *ai = NULL;
     struct gensio_stdsock_info *gsi = NULL, *ogsi = NULL;
+    bool nonblock_set = false;
 
     if (do_errtrig())
 	return GE_NOMEM;
@@ -1059,7 +1299,18 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	len = sizeof(sadata);
     }
 
+#ifdef HAVE_ACCEPT4
+    /* Saves two fcntl() calls per connection. */
+    rv = accept4(o->iod_get_fd(iod), sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (rv == -1 && errno == ENOSYS) {
+	len = ai ? ai->ai_addrlen : sizeof(sadata);
+	rv = accept(o->iod_get_fd(iod), sa, &len);
+    } else {
+	nonblock_set = true;
+    }
+#else
     rv = accept(o->iod_get_fd(iod), sa, &len);
+#endif
 
     if (rv >= 0) {
 	gsi = o->zalloc(o, sizeof(*gsi));
@@ -1075,9 +1326,11 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	    goto out;
 	}
 
-	err = o->set_non_blocking(riod);
-	if (err)
-	    goto out;
+	if (!nonblock_set) {
+	    err = o->set_non_blocking(riod);
+	    if (err)
+		goto out;
+	}
 
 	o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
 		       (intptr_t) &ogsi);
@@ -1094,7 +1347,7 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	*newiod = riod;
     } else {
 	rv = sock_errno;
-	if (rv == SOCK_EAGAIN && rv == SOCK_EWOULDBLOCK)
+	if (rv == SOCK_EAGAIN || rv == SOCK_EWOULDBLOCK)
 	    err = GE_NODATA;
 	else
 	    err = gensio_os_err_to_err(o, rv);
@@ -1430,8 +1683,16 @@ gensio_stdsock_close_socket(struct gensio_iod *iod, bool retry, bool force)
 #else
     err = close_socket(o, o->iod_get_fd(iod));
 #endif
-    if (err != GE_INPROGRESS && gsi)
+    if (err != GE_INPROGRESS && gsi) {
+#ifdef STDSOCK_HAVE_FDPASS
+	if (gsi->rfds) {
+	    while (gsi->nr_rfds > 0)
+		close(gsi->rfds[--gsi->nr_rfds]);
+	    o->free(o, gsi->rfds);
+	}
+#endif
 	o->free(o, gsi);
+    }
     return err;
 }
 
@@ -1720,7 +1981,7 @@ gensio_stdsock_getpeername(struct gensio_iod *iod, struct gensio_addr **raddr)
 			     (intptr_t) &gsi);
 	if (err)
 	    return err;
-	if (gsi->protocol == GENSIO_NET_PROTOCOL_SCTP)
+	if (gsi && gsi->protocol == GENSIO_NET_PROTOCOL_SCTP)
 	    return gensio_os_sctp_getpaddrs(iod, raddr);
     }
 #endif
@@ -1954,6 +2215,623 @@ gensio_stdsock_get_extrainfo(struct gensio_iod *iod, unsigned int *val)
 #endif
 }
 
+static int
+gensio_stdsock_set_udp_gso(struct gensio_iod *iod, unsigned int val)
+{
+#ifndef UDP_SEGMENT
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, ival = val;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP)
+	return GE_INVAL;
+
+    err = setsockopt(o->iod_get_fd(iod), IPPROTO_UDP, UDP_SEGMENT,
+		     &ival, sizeof(ival));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT)
+	    return GE_NOTSUP; /* Kernel is too old. */
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_udp_gro(struct gensio_iod *iod, bool val)
+{
+#if !defined(UDP_GRO) || !defined(HAVE_RECVMMSG)
+    /* Only the RECV_MULTI path can split coalesced buffers. */
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, ival = val;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP)
+	return GE_INVAL;
+
+    err = setsockopt(o->iod_get_fd(iod), IPPROTO_UDP, UDP_GRO,
+		     &ival, sizeof(ival));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT)
+	    return GE_NOTSUP; /* Kernel is too old. */
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    gsi->gro = val;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_zerocopy(struct gensio_iod *iod)
+{
+#ifndef STDSOCK_HAVE_ZEROCOPY
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int err, val = 1;
+
+    err = setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_ZEROCOPY,
+		     &val, sizeof(val));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT || sock_errno == EOPNOTSUPP)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_zerocopy_reap(struct gensio_iod *iod, unsigned int *count)
+{
+#ifndef STDSOCK_HAVE_ZEROCOPY
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr hdr;
+    unsigned char ctrlinfo[128];
+    unsigned int done = 0;
+    sockret rv;
+
+    for (;;) {
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_control = ctrlinfo;
+	hdr.msg_controllen = sizeof(ctrlinfo);
+	rv = recvmsg(o->iod_get_fd(iod), &hdr, MSG_ERRQUEUE);
+	if (rv < 0) {
+	    if (sock_errno == SOCK_EINTR)
+		continue;
+	    if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+		break;
+	    return gensio_os_err_to_err(o, sock_errno);
+	}
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+	     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	    if (!((cmsg->cmsg_level == IPPROTO_IP &&
+		   cmsg->cmsg_type == IP_RECVERR) ||
+		  (cmsg->cmsg_level == IPPROTO_IPV6 &&
+		   cmsg->cmsg_type == IPV6_RECVERR)))
+		continue;
+	    serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+	    if (serr->ee_errno != 0 ||
+			serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		continue;
+	    /* ee_info to ee_data is the range of sends that finished. */
+	    done += serr->ee_data - serr->ee_info + 1;
+	}
+    }
+    *count = done;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_timestamping(struct gensio_iod *iod, unsigned int flags)
+{
+#ifndef STDSOCK_HAVE_TIMESTAMPING
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, val = 0;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP &&
+		gsi->protocol != GENSIO_NET_PROTOCOL_TCP)
+	return GE_INVAL;
+
+    if (flags & GENSIO_TSTAMP_RX_SW)
+	val |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (flags & GENSIO_TSTAMP_RX_HW)
+	val |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (flags & GENSIO_TSTAMP_TX_SW)
+	val |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (flags & GENSIO_TSTAMP_TX_HW)
+	val |= SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (flags & (GENSIO_TSTAMP_TX_SW | GENSIO_TSTAMP_TX_HW))
+	/* Just the timestamp and an id, not a copy of the packet. */
+	val |= SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    err = setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_TIMESTAMPING,
+		     &val, sizeof(val));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT || sock_errno == EOPNOTSUPP)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    gsi->tstamp = flags;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_tstamp_reap(struct gensio_iod *iod,
+			   struct gensio_tx_tstamp *ts, gensiods *count)
+{
+#ifndef STDSOCK_HAVE_TIMESTAMPING
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr hdr;
+    unsigned char ctrlinfo[256];
+    gensiods done = 0;
+    gensio_time sw, hw;
+    bool have_ts, have_id;
+    uint32_t id = 0;
+    sockret rv;
+
+    while (done < *count) {
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_control = ctrlinfo;
+	hdr.msg_controllen = sizeof(ctrlinfo);
+	rv = recvmsg(o->iod_get_fd(iod), &hdr, MSG_ERRQUEUE);
+	if (rv < 0) {
+	    if (sock_errno == SOCK_EINTR)
+		continue;
+	    if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+		break;
+	    return gensio_os_err_to_err(o, sock_errno);
+	}
+	/* The timestamp and the id come in separate cmsgs. */
+	memset(&sw, 0, sizeof(sw));
+	memset(&hw, 0, sizeof(hw));
+	have_ts = false;
+	have_id = false;
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+	     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	    if (cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_TIMESTAMPING) {
+		gensio_stdsock_get_tstamps(&hdr, &sw, &hw);
+		have_ts = true;
+		continue;
+	    }
+	    if (!((cmsg->cmsg_level == IPPROTO_IP &&
+		   cmsg->cmsg_type == IP_RECVERR) ||
+		  (cmsg->cmsg_level == IPPROTO_IPV6 &&
+		   cmsg->cmsg_type == IPV6_RECVERR)))
+		continue;
+	    serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+	    if (serr->ee_errno != ENOMSG ||
+			serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+		continue;
+	    id = serr->ee_data;
+	    have_id = true;
+	}
+	if (!have_ts || !have_id)
+	    continue;
+	ts[done].id = id;
+	ts[done].sw = sw;
+	ts[done].hw = hw;
+	done++;
+    }
+    *count = done;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_adopt(struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    struct sockaddr_storage ss;
+    taddrlen len;
+    int err, type, protocol;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+    if (gsi)
+	return 0; /* Already set up. */
+
+    len = sizeof(ss);
+    if (getsockname(o->iod_get_fd(iod), (struct sockaddr *) &ss, &len) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    len = sizeof(type);
+    if (getsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_TYPE,
+		   (void *) &type, &len) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+
+    switch (ss.ss_family) {
+#ifdef AF_UNIX
+    case AF_UNIX:
+	if (type != SOCK_STREAM)
+	    return GE_NOTSUP;
+	protocol = GENSIO_NET_PROTOCOL_UNIX;
+	break;
+#endif
+
+    case AF_INET:
+#ifdef AF_INET6
+    case AF_INET6:
+#endif
+	if (type == SOCK_DGRAM) {
+	    protocol = GENSIO_NET_PROTOCOL_UDP;
+	    break;
+	}
+	protocol = GENSIO_NET_PROTOCOL_TCP;
+#if HAVE_LIBSCTP && defined(SO_PROTOCOL)
+	{
+	    int proto;
+
+	    len = sizeof(proto);
+	    if (getsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_PROTOCOL,
+			   (void *) &proto, &len) == 0 &&
+			proto == IPPROTO_SCTP)
+		protocol = GENSIO_NET_PROTOCOL_SCTP;
+	}
+#endif
+	if (protocol == GENSIO_NET_PROTOCOL_TCP && type != SOCK_STREAM)
+	    return GE_NOTSUP;
+	break;
+
+    default:
+	return GE_NOTSUP;
+    }
+
+    gsi = o->zalloc(o, sizeof(*gsi));
+    if (!gsi)
+	return GE_NOMEM;
+    gsi->protocol = protocol;
+    gsi->family = ss.ss_family;
+    gsi->connected = true;
+    o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, false, (intptr_t) gsi);
+    return 0;
+}
+
+static int
+gensio_stdsock_send_fd(struct gensio_iod *iod, int fd)
+{
+#ifndef STDSOCK_HAVE_FDPASS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    union {
+	struct cmsghdr hdr;
+	unsigned char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct cmsghdr *cmsg;
+    struct msghdr hdr;
+    struct iovec iov;
+    unsigned char byte = 0;
+    sockret rv;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+ retry:
+    rv = sendmsg(o->iod_get_fd(iod), &hdr, 0);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+	    return GE_INPROGRESS;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_recv_fds(struct gensio_iod *iod, struct gensio_sockmsg *msg,
+			gensiods *nr_fds)
+{
+#ifndef STDSOCK_HAVE_FDPASS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    union {
+	struct cmsghdr hdr;
+	unsigned char buf[CMSG_SPACE(sizeof(int) * STDSOCK_MAX_RFDS)];
+    } ctrl;
+    struct cmsghdr *cmsg;
+    struct msghdr hdr;
+    struct iovec iov;
+    unsigned int i, n;
+    gensiods count = 0;
+    int flags = 0, fd, err;
+    sockret rv;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+    if (!gsi)
+	return GE_NOTREADY; /* Not adopted. */
+    if (!gsi->rfds) {
+	gsi->rfds = o->zalloc(o, sizeof(int) * STDSOCK_MAX_RFDS);
+	if (!gsi->rfds)
+	    return GE_NOMEM;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = msg->buf;
+    iov.iov_len = msg->buflen;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+ retry:
+    rv = recvmsg(o->iod_get_fd(iod), &hdr, flags);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN) {
+	    msg->len = 0;
+	    *nr_fds = 0;
+	    return 0;
+	}
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	    continue;
+	n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	for (i = 0; i < n; i++) {
+	    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+	    if (gsi->nr_rfds >= STDSOCK_MAX_RFDS) {
+		/* Nobody is taking them, don't leak them. */
+		close(fd);
+		continue;
+	    }
+	    gsi->rfds[gsi->nr_rfds++] = fd;
+	    count++;
+	}
+    }
+
+    if (rv == 0 && count == 0)
+	return gensio_os_err_to_err(o, SOCK_EPIPE);
+    msg->len = rv;
+    *nr_fds = count;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_get_fd(struct gensio_iod *iod, int *fd)
+{
+#ifndef STDSOCK_HAVE_FDPASS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+    if (!gsi || gsi->nr_rfds == 0)
+	return GE_NOTFOUND;
+    *fd = gsi->rfds[0];
+    gsi->nr_rfds--;
+    memmove(gsi->rfds, gsi->rfds + 1, sizeof(int) * gsi->nr_rfds);
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_dup_fd(struct gensio_iod *iod, int *fd)
+{
+#ifdef _WIN32
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int nfd;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+#ifdef F_DUPFD_CLOEXEC
+    nfd = fcntl(o->iod_get_fd(iod), F_DUPFD_CLOEXEC, 0);
+#else
+    nfd = dup(o->iod_get_fd(iod));
+    if (nfd != -1 && fcntl(nfd, F_SETFD, FD_CLOEXEC) == -1) {
+	int err = errno;
+
+	close(nfd);
+	return gensio_os_err_to_err(o, err);
+    }
+#endif
+    if (nfd == -1)
+	return gensio_os_err_to_err(o, errno);
+    *fd = nfd;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_busy_poll(struct gensio_iod *iod, unsigned int usecs)
+{
+#ifndef SO_BUSY_POLL
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int err, val = usecs;
+
+    err = setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_BUSY_POLL,
+		     &val, sizeof(val));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    val = !!usecs;
+    /* Older kernels don't have this, busy polling still works. */
+    setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_PREFER_BUSY_POLL,
+	       &val, sizeof(val));
+#endif
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_tcp_fastopen(struct gensio_iod *iod, unsigned int qlen)
+{
+#ifndef TCP_FASTOPEN
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int err, val = qlen;
+
+    err = setsockopt(o->iod_get_fd(iod), IPPROTO_TCP, TCP_FASTOPEN,
+		     &val, sizeof(val));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT || sock_errno == EOPNOTSUPP)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_tcp_fastopen_connect(struct gensio_iod *iod)
+{
+#ifndef TCP_FASTOPEN_CONNECT
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int err, val = 1;
+
+    err = setsockopt(o->iod_get_fd(iod), IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+		     &val, sizeof(val));
+    if (err) {
+	if (sock_errno == ENOPROTOOPT || sock_errno == EOPNOTSUPP)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    return 0;
+#endif
+}
+
+#ifdef STDSOCK_HAVE_TCP_INFO
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_DELIVERY_RATE
+typedef struct tcp_info stdsock_tcp_info;
+#define STI_BASE(info, field) (info).tcpi_ ## field
+#define STI_EXT(info, field) (info).tcpi_ ## field
+#else
+/*
+ * Older libcs stop struct tcp_info at tcpi_total_retrans; the kernel
+ * only ever adds fields at the end, so add the ones we use here.
+ */
+typedef struct {
+    struct tcp_info base;
+    uint64_t pacing_rate;
+    uint64_t max_pacing_rate;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t segs_out;
+    uint32_t segs_in;
+    uint32_t notsent_bytes;
+    uint32_t min_rtt;
+    uint32_t data_segs_in;
+    uint32_t data_segs_out;
+    uint64_t delivery_rate;
+} stdsock_tcp_info;
+#define STI_BASE(info, field) (info).base.tcpi_ ## field
+#define STI_EXT(info, field) (info).field
+#endif
+#endif
+
+static int
+gensio_stdsock_get_tcp_info(struct gensio_iod *iod,
+			    struct gensio_tcp_info *tinfo)
+{
+#ifndef STDSOCK_HAVE_TCP_INFO
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    stdsock_tcp_info info;
+    socklen_t len = sizeof(info);
+
+    /* Older kernels return less, leaving the newer fields zero. */
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(o->iod_get_fd(iod), IPPROTO_TCP, TCP_INFO,
+		   &info, &len) == -1) {
+	if (sock_errno == ENOPROTOOPT || sock_errno == EOPNOTSUPP)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+
+    tinfo->rtt = STI_BASE(info, rtt);
+    tinfo->rttvar = STI_BASE(info, rttvar);
+    tinfo->snd_cwnd = STI_BASE(info, snd_cwnd);
+    tinfo->total_retrans = STI_BASE(info, total_retrans);
+    tinfo->bytes_acked = STI_EXT(info, bytes_acked);
+    tinfo->pacing_rate = STI_EXT(info, pacing_rate);
+    tinfo->delivery_rate = STI_EXT(info, delivery_rate);
+    return 0;
+#endif
+}
+
 static int
 gensio_stdsock_control(struct gensio_iod *iod, int func,
 		       void *data, gensiods *datalen)
@@ -1995,6 +2873,58 @@ gensio_stdsock_control(struct gensio_iod *iod, int func,
 	if (*datalen != sizeof(unsigned int))
 	    return GE_INVAL;
 	return gensio_stdsock_get_extrainfo(iod, ((unsigned int *) data));
+    case GENSIO_SOCKCTL_RECV_MULTI:
+	return gensio_stdsock_recv_multi(iod, data, datalen);
+    case GENSIO_SOCKCTL_SET_UDP_GSO:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_udp_gso(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_UDP_GRO:
+	if (*datalen != sizeof(bool))
+	    return GE_INVAL;
+	return gensio_stdsock_set_udp_gro(iod, *((bool *) data));
+    case GENSIO_SOCKCTL_SET_ZEROCOPY:
+	return gensio_stdsock_set_zerocopy(iod);
+    case GENSIO_SOCKCTL_ZEROCOPY_REAP:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_zerocopy_reap(iod, ((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_TCP_FASTOPEN:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_tcp_fastopen(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_TCP_FASTOPEN_CONNECT:
+	return gensio_stdsock_set_tcp_fastopen_connect(iod);
+    case GENSIO_SOCKCTL_GET_TCP_INFO:
+	if (*datalen != sizeof(struct gensio_tcp_info))
+	    return GE_INVAL;
+	return gensio_stdsock_get_tcp_info(iod, data);
+    case GENSIO_SOCKCTL_SET_TIMESTAMPING:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_timestamping(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_TSTAMP_REAP:
+	return gensio_stdsock_tstamp_reap(iod, data, datalen);
+    case GENSIO_SOCKCTL_SEND_FD:
+	if (*datalen != sizeof(int))
+	    return GE_INVAL;
+	return gensio_stdsock_send_fd(iod, *((int *) data));
+    case GENSIO_SOCKCTL_RECV_FDS:
+	return gensio_stdsock_recv_fds(iod, data, datalen);
+    case GENSIO_SOCKCTL_GET_FD:
+	if (*datalen != sizeof(int))
+	    return GE_INVAL;
+	return gensio_stdsock_get_fd(iod, data);
+    case GENSIO_SOCKCTL_ADOPT:
+	return gensio_stdsock_adopt(iod);
+    case GENSIO_SOCKCTL_DUP_FD:
+	if (*datalen != sizeof(int))
+	    return GE_INVAL;
+	return gensio_stdsock_dup_fd(iod, data);
+    case GENSIO_SOCKCTL_SET_BUSY_POLL:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_busy_poll(iod, *((unsigned int *) data));
     default:
 	return GE_NOTSUP;
     }
@@ -2027,6 +2957,7 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
     struct gensio_opensocks *fds;
     unsigned int curr_fd = 0, i;
     unsigned int max_fds = 0;
+    unsigned int shard, nr_shards, shard_start;
     struct addrinfo *ai;
     int rv = 0;
     struct gensio_listen_scan_info scaninfo;
@@ -2040,11 +2971,22 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
 	return gensio_os_sctp_open_sockets(o, addr, call_b4_listen, data,
 					   opensock_flags, rfds, nr_fds);
 #endif
+    nr_shards = GENSIO_OPENSOCK_GET_SHARDS(opensock_flags);
+    if (nr_shards == 0)
+	nr_shards = 1;
+#ifndef SO_REUSEPORT
+    if (opensock_flags & GENSIO_OPENSOCK_REUSEPORT)
+	return GE_NOTSUP;
+#endif
+    if (nr_shards > 1 && !(opensock_flags & GENSIO_OPENSOCK_REUSEPORT))
+	return GE_INVAL;
+
     for (rp = ai; rp != NULL; rp = rp->ai_next)
 	max_fds++;
 
     if (max_fds == 0)
 	return GE_INVAL;
+    max_fds *= nr_shards;
 
     fds = o->zalloc(o, sizeof(*fds) * max_fds);
     if (!fds)
@@ -2055,6 +2997,9 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
 #if !HAVE_WORKING_PORT0
  restart_family:
 #endif
+    shard = 0;
+ restart_shard:
+    shard_start = curr_fd;
 #ifdef AF_INET6
     family = AF_INET6; /* Try IPV6 first, then IPV4. */
 #else
@@ -2104,6 +3049,13 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
     }
 #endif
 
+    if (nr_shards > 1) {
+	for (i = shard_start; i < curr_fd; i++)
+	    o->iod_control(fds[i].iod, GENSIO_IOD_CONTROL_SHARD, false, shard);
+	if (++shard < nr_shards)
+	    goto restart_shard;
+    }
+
     if (curr_fd == 0) {
 	o->free(o, fds);
 	if (rv)
@@ -2231,6 +3183,15 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 	}
     }
 
+#ifdef SO_REUSEPORT
+    if ((opensock_flags & GENSIO_OPENSOCK_REUSEPORT) &&
+		family_is_inet(family)) {
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		       (void *) &optval, sizeof(optval)) == -1)
+	    goto out_err;
+    }
+#endif
+
     if (check_ipv6_only(family, sockproto, flags, fd) == -1)
 	goto out_err;
 #if !HAVE_WORKING_PORT0
@@ -2312,7 +3273,8 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 	    goto out;
     }
 
-    if (do_listen && listen(fd, 5) != 0)
+    /* Let the kernel cap it, connection bursts overrun small backlogs. */
+    if (do_listen && listen(fd, SOMAXCONN) != 0)
 	goto out_err;
 
  out:
@@ -29,6 +29,24 @@
  * not a good idea to override this.
  */
 #define GENSIO_DEFAULT_UDP_BUF_SIZE	65536
+/* Largest datagram payload, so the biggest gso= that makes sense. */
+#define GENSIO_UDP_MAX_GSO_SIZE		65507
+/* Largest buffer GRO can coalesce packets into. */
+#define GENSIO_UDP_GRO_BUF_SIZE		65536
+/* Most packets given in one GENSIO_EVENT_READ_BATCH. */
+#define GENSIO_UDP_MAX_READ_BATCH	64
+/* Transmit timestamps held for GENSIO_CONTROL_TX_TSTAMP, oldest dropped. */
+#define GENSIO_UDP_MAX_TX_TSTAMPS	64
+
+/* Auxdata strings for one received packet. */
+struct udpn_aux {
+    char raddr[200];
+    char daddr[200];
+    char ifidx[20];
+    char rxts[40];
+    char rxhwts[40];
+    const char *mem[6];
+};
 
 struct udpna_data;
 
@@ -58,6 +76,16 @@ struct udpn_data {
     bool in_close_cb;	/* Currently in a close callback. */
     bool extrainfo;	/* Deliver extrainfo to user? */
 
+    /*
+     * If read_batch is set, reads are delivered with
+     * GENSIO_EVENT_READ_BATCH, up to read_batch packets at a time.
+     * batch_pkts and batch_aux have batch_size entries.
+     */
+    unsigned int read_batch;
+    unsigned int batch_size;
+    struct gensio_pkt *batch_pkts;
+    struct udpn_aux *batch_aux;
+
     enum udpn_state state;
     bool freed;		/* Freed during the close process. */
 
@@ -72,9 +100,22 @@ struct udpn_data {
 
     struct gensio_addr *raddr;		/* Points to remote, for convenience. */
 
+    /*
+     * Gets the packets sent to the multicast group in raddr (with
+     * mcastdemux), not the ones from raddr.
+     */
+    bool group;
+
     struct gensio_link link;
+
+    /* In nadata->udpn_hash, by raddr, for the whole life of the udpn. */
+    struct gensio_link hash_link;
+    unsigned int hash;
 };
 
+#define gensio_hlink_to_ndata(l) \
+    gensio_container_of(l, struct udpn_data, hash_link);
+
 #define gensio_link_to_ndata(l) \
     gensio_container_of(l, struct udpn_data, link);
 
@@ -96,6 +137,13 @@ struct udpna_data {
     struct gensio_accepter *acc;
     struct gensio_list udpns;
     unsigned int udpn_count;
+
+    /*
+     * Hash of both udpns and closed_udpns by remote address.  If NULL
+     * (empty or allocation failure) the lists are searched.
+     */
+    struct gensio_list *udpn_hash;
+    unsigned int udpn_hash_size; /* Always a power of 2 */
     unsigned int refcount;
 
     struct gensio_os_funcs *o;
@@ -146,8 +194,63 @@ struct udpna_data {
     unsigned int extrainfo; /* Is extrainfo enabled or disabled in the iod? */
 
     bool nocon;		/* Disable connection-oriented handling. */
+
+    /*
+     * Multicast groups joined on the listening sockets.  If
+     * mcastdemux is set, packets sent to one of these go to a gensio
+     * for the group instead of one for the sender.
+     */
+    struct gensio_addr *mcast;
+    bool mcastdemux;
+
     struct gensio_addr *curr_recvaddr;	/* Address of current received packet */
 
+    /*
+     * If recv_batch > 1, packets are received recv_batch at a time
+     * into batch and read_data and curr_recvaddr point into the entry
+     * of the packet being handled.  The batch_count entries starting
+     * at batch_pos have not been handled yet, they came in on
+     * batch_iod.
+     */
+    unsigned int recv_batch;
+    struct gensio_sockmsg *batch;
+    unsigned int batch_pos;
+    unsigned int batch_count;
+    struct gensio_iod *batch_iod;
+
+    /*
+     * With GRO an entry in batch may hold several datagrams of
+     * segsize bytes, batch_off is where the next one starts in the
+     * entry at batch_pos.
+     */
+    bool gro;
+    gensiods batch_off;
+
+    /*
+     * GENSIO_TSTAMP_xxx flags for kernel timestamps.  Receive
+     * timestamps only come in through the batch path, curr_msg is the
+     * batch entry of the packet being handled for them.  Transmit
+     * timestamps are collected into the txts ring when the socket
+     * reports them, txts_pos is the oldest of txts_count entries.
+     */
+    unsigned int tstamp;
+    struct gensio_sockmsg *curr_msg;
+    struct gensio_tx_tstamp *txts;
+    unsigned int txts_pos;
+    unsigned int txts_count;
+
+    /*
+     * If gso_size is set, writes larger than gso_size are sent as a
+     * series of gso_size datagrams.  The kernel does this if it can,
+     * otherwise gso_soft is set and it's done here one sendto() at a
+     * time.
+     */
+    unsigned int gso_size;
+    bool gso_soft;
+
+    /* Socket busy poll time in usecs (SO_BUSY_POLL), 0 is off. */
+    unsigned int busy_poll;
+
     bool in_write;
     unsigned int read_disable_count;
     bool read_disabled;
@@ -160,6 +263,7 @@ struct udpna_data {
 };
 
 static void udpna_do_free(struct udpna_data *nadata);
+static void udpna_handle_batch(struct udpna_data *nadata);
 
 static void
 i_udpna_lock(struct udpna_data *nadata)
@@ -295,21 +399,168 @@ udpn_remove_from_list(struct gensio_list *list, struct udpn_data *ndata)
     gensio_list_rm(list, &ndata->link);
 }
 
+/*
+ * If the packet with the received address addr was sent to one of
+ * the multicast groups being demultiplexed, leave addr at the
+ * destination address and return true.  Otherwise addr is rewound.
+ * With extrainfo on, the destination is the third address.
+ */
+static bool
+udpna_group_dest(struct udpna_data *nadata, struct gensio_addr *addr)
+{
+    uint64_t sa[16]; /* Big enough for any socket address. */
+    gensiods len = sizeof(sa);
+
+    if (!nadata->mcastdemux)
+	return false;
+
+    if (gensio_addr_next(addr) && gensio_addr_next(addr)) {
+	gensio_addr_getaddr(addr, sa, &len);
+	if (len <= sizeof(sa) &&
+		gensio_addr_addr_present(nadata->mcast, sa, len, false))
+	    return true;
+    }
+    gensio_addr_rewind(addr);
+    return false;
+}
+
+/*
+ * Does the received address addr belong to ndata?  For a group the
+ * port is not compared, the destination from the kernel has none.
+ */
+static bool
+udpn_is_mine(struct udpn_data *ndata, struct gensio_addr *addr)
+{
+    bool rv;
+
+    if (!udpna_group_dest(ndata->nadata, addr))
+	return !ndata->group && gensio_addr_equal(ndata->raddr, addr,
+						  true, false);
+    rv = ndata->group && gensio_addr_equal(ndata->raddr, addr, false, false);
+    gensio_addr_rewind(addr);
+    return rv;
+}
+
+/*
+ * Find the gensio for addr.  If group is set, addr is at a multicast
+ * destination from udpna_group_dest() and the gensio for that group
+ * is returned.
+ */
 static struct udpn_data *
-udpn_find(struct gensio_list *list, struct gensio_addr *addr)
+udpn_find(struct udpna_data *nadata, struct gensio_list *list,
+	  struct gensio_addr *addr, bool group)
 {
     struct gensio_link *l;
 
+    if (nadata->udpn_hash) {
+	unsigned int hash = gensio_addr_hash(addr, !group);
+	struct gensio_list *bucket;
+
+	bucket = &nadata->udpn_hash[hash & (nadata->udpn_hash_size - 1)];
+	gensio_list_for_each(bucket, l) {
+	    struct udpn_data *ndata = gensio_hlink_to_ndata(l);
+
+	    if (ndata->hash == hash && ndata->group == group &&
+			gensio_list_link_in_this_list(&ndata->link, list) &&
+			gensio_addr_equal(ndata->raddr, addr, !group, false))
+		return ndata;
+	}
+	return NULL;
+    }
+
     gensio_list_for_each(list, l) {
 	struct udpn_data *ndata = gensio_link_to_ndata(l);
 
-	if (gensio_addr_equal(ndata->raddr, addr, true, false))
+	if (ndata->group == group &&
+		gensio_addr_equal(ndata->raddr, addr, !group, false))
 	    return ndata;
     }
 
     return NULL;
 }
 
+#define UDPN_HASH_INIT_SIZE 16
+
+/*
+ * Grow the hash so the chains average two or less.  On an allocation
+ * failure the old table (or the list search) keeps working, just
+ * slower.
+ */
+static void
+udpn_hash_resize(struct udpna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_list *nhash;
+    struct gensio_link *l, *l2;
+    unsigned int i, nsize;
+
+    if (nadata->udpn_hash) {
+	if (nadata->udpn_count <= nadata->udpn_hash_size * 2)
+	    return;
+	nsize = nadata->udpn_hash_size * 2;
+    } else if (nadata->udpn_count <= 1) {
+	/* The lists are fine for just one. */
+	return;
+    } else {
+	nsize = UDPN_HASH_INIT_SIZE;
+    }
+
+    nhash = o->zalloc(o, sizeof(*nhash) * nsize);
+    if (!nhash)
+	return;
+    for (i = 0; i < nsize; i++)
+	gensio_list_init(&nhash[i]);
+
+    if (nadata->udpn_hash) {
+	for (i = 0; i < nadata->udpn_hash_size; i++) {
+	    gensio_list_for_each_safe(&nadata->udpn_hash[i], l, l2) {
+		struct udpn_data *ndata = gensio_hlink_to_ndata(l);
+
+		gensio_list_rm(&nadata->udpn_hash[i], l);
+		gensio_list_add_tail(&nhash[ndata->hash & (nsize - 1)], l);
+	    }
+	}
+	o->free(o, nadata->udpn_hash);
+    } else {
+	gensio_list_for_each(&nadata->udpns, l) {
+	    struct udpn_data *ndata = gensio_link_to_ndata(l);
+
+	    gensio_list_add_tail(&nhash[ndata->hash & (nsize - 1)],
+				 &ndata->hash_link);
+	}
+	gensio_list_for_each(&nadata->closed_udpns, l) {
+	    struct udpn_data *ndata = gensio_link_to_ndata(l);
+
+	    gensio_list_add_tail(&nhash[ndata->hash & (nsize - 1)],
+				 &ndata->hash_link);
+	}
+    }
+    nadata->udpn_hash = nhash;
+    nadata->udpn_hash_size = nsize;
+}
+
+static void
+udpn_hash_add(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    ndata->hash = gensio_addr_hash(ndata->raddr, !ndata->group);
+    if (nadata->udpn_hash)
+	gensio_list_add_tail(&nadata->udpn_hash[ndata->hash &
+						(nadata->udpn_hash_size - 1)],
+			     &ndata->hash_link);
+    else
+	/* Gets added from the lists if the table is allocated. */
+	udpn_hash_resize(nadata);
+}
+
+static void
+udpn_hash_rm(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    if (nadata->udpn_hash)
+	gensio_list_rm(&nadata->udpn_hash[ndata->hash &
+					  (nadata->udpn_hash_size - 1)],
+		       &ndata->hash_link);
+}
+
 static void udpn_add_to_list(struct gensio_list *list, struct udpn_data *ndata)
 {
     gensio_list_add_tail(list, &ndata->link);
@@ -323,6 +574,9 @@ udpna_enable_read(struct udpna_data *nadata)
     nadata->read_disabled = false;
     for (i = 0; i < nadata->nr_fds; i++)
 	nadata->o->set_read_handler(nadata->fds[i].iod, true);
+    if (nadata->batch_count)
+	/* The fd may not go readable again, handle what we have. */
+	udpna_start_deferred_op(nadata);
 }
 
 static void
@@ -413,12 +667,28 @@ udpna_do_free(struct udpna_data *nadata)
 	nadata->o->free_runner(nadata->enable_done_runner);
     if (nadata->ai)
 	gensio_addr_free(nadata->ai);
+    if (nadata->mcast)
+	gensio_addr_free(nadata->mcast);
     if (nadata->fds)
 	nadata->o->free(nadata->o, nadata->fds);
-    if (nadata->curr_recvaddr)
-	gensio_addr_free(nadata->curr_recvaddr);
-    if (nadata->read_data)
-	nadata->o->free(nadata->o, nadata->read_data);
+    if (nadata->udpn_hash)
+	nadata->o->free(nadata->o, nadata->udpn_hash);
+    if (nadata->batch) {
+	for (i = 0; i < nadata->recv_batch; i++) {
+	    if (nadata->batch[i].addr)
+		gensio_addr_free(nadata->batch[i].addr);
+	}
+	if (nadata->batch[0].buf)
+	    nadata->o->free(nadata->o, nadata->batch[0].buf);
+	nadata->o->free(nadata->o, nadata->batch);
+    } else {
+	if (nadata->curr_recvaddr)
+	    gensio_addr_free(nadata->curr_recvaddr);
+	if (nadata->read_data)
+	    nadata->o->free(nadata->o, nadata->read_data);
+    }
+    if (nadata->txts)
+	nadata->o->free(nadata->o, nadata->txts);
     if (nadata->lock)
 	nadata->o->free_lock(nadata->lock);
     if (nadata->acc)
@@ -463,6 +733,10 @@ udpn_do_free(struct udpn_data *ndata)
 	ndata->o->free_runner(ndata->deferred_op_runner);
     if (ndata->raddr)
 	gensio_addr_free(ndata->raddr);
+    if (ndata->batch_pkts)
+	ndata->o->free(ndata->o, ndata->batch_pkts);
+    if (ndata->batch_aux)
+	ndata->o->free(ndata->o, ndata->batch_aux);
     ndata->o->free(ndata->o, ndata);
 }
 
@@ -472,12 +746,113 @@ udpn_finish_free(struct udpn_data *ndata)
     struct udpna_data *nadata = ndata->nadata;
 
     udpn_remove_from_list(&nadata->closed_udpns, ndata);
+    udpn_hash_rm(nadata, ndata);
     assert(nadata->udpn_count > 0);
     nadata->udpn_count--;
     udpn_do_free(ndata);
     udpna_check_finish_free(nadata);
 }
 
+/*
+ * Fill in out with the part of sg that is len bytes starting at off.
+ * out must have room for sglen entries.  Returns the number of
+ * entries used.
+ */
+static gensiods
+udpn_sg_slice(const struct gensio_sg *sg, gensiods sglen,
+	      gensiods off, gensiods len, struct gensio_sg *out)
+{
+    gensiods i, n = 0, l;
+
+    for (i = 0; i < sglen && len > 0; i++) {
+	l = sg[i].buflen;
+	if (off >= l) {
+	    off -= l;
+	    continue;
+	}
+	l -= off;
+	if (l > len)
+	    l = len;
+	out[n].buf = ((const unsigned char *) sg[i].buf) + off;
+	out[n].buflen = l;
+	off = 0;
+	len -= l;
+	n++;
+    }
+    return n;
+}
+
+#define UDPN_SEG_SG_LEN 8
+
+/*
+ * Send a write larger than what one sendto() can take with the gso
+ * setting in pieces.  If some pieces can't be sent, count is set to
+ * what was sent; pieces are always a multiple of gso_size so the
+ * rest of the write still splits the same way.
+ */
+static int
+udpn_write_segmented(struct udpn_data *ndata, gensiods *count,
+		     const struct gensio_sg *sg, gensiods sglen,
+		     gensiods total, const struct gensio_addr *addr)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_sg lsg[UDPN_SEG_SG_LEN], *ssg = lsg;
+    gensiods chunk, off = 0, len, ssglen, sent;
+    int err = 0;
+
+    if (nadata->gso_soft)
+	chunk = nadata->gso_size;
+    else
+	chunk = (gensiods) nadata->gso_size * GENSIO_UDP_GSO_MAX_SEGS;
+
+    if (sglen > UDPN_SEG_SG_LEN) {
+	ssg = o->zalloc(o, sizeof(*ssg) * sglen);
+	if (!ssg)
+	    return GE_NOMEM;
+    }
+
+    while (off < total) {
+	len = total - off;
+	if (len > chunk)
+	    len = chunk;
+	ssglen = udpn_sg_slice(sg, sglen, off, len, ssg);
+	sent = 0;
+	err = o->sendto(ndata->myiod, ssg, ssglen, &sent, 0, addr);
+	if (err || sent == 0)
+	    break;
+	off += len;
+    }
+
+    if (ssg != lsg)
+	o->free(o, ssg);
+    if (off > 0)
+	err = 0; /* Report the error when the rest is written. */
+    if (!err && count)
+	*count = off;
+    return err;
+}
+
+static int
+udpn_write_gso(struct udpn_data *ndata, gensiods *count,
+	       const struct gensio_sg *sg, gensiods sglen,
+	       const struct gensio_addr *addr)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    gensiods i, total = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    if (total > nadata->gso_size &&
+	    (nadata->gso_soft ||
+	     total > (gensiods) nadata->gso_size * GENSIO_UDP_GSO_MAX_SEGS))
+	return udpn_write_segmented(ndata, count, sg, sglen, total, addr);
+
+    /* The kernel can split this up itself. */
+    return ndata->o->sendto(ndata->myiod, sg, sglen, count, 0, addr);
+}
+
 static int
 udpn_write(struct gensio *io, gensiods *count,
 	   const struct gensio_sg *sg, gensiods sglen,
@@ -506,7 +881,10 @@ udpn_write(struct gensio *io, gensiods *count,
     if (!addr)
 	addr = ndata->raddr;
 
-    err = ndata->o->sendto(ndata->myiod, sg, sglen, count, 0, addr);
+    if (ndata->nadata->gso_size)
+	err = udpn_write_gso(ndata, count, sg, sglen, addr);
+    else
+	err = ndata->o->sendto(ndata->myiod, sg, sglen, count, 0, addr);
     if (free_addr)
 	gensio_addr_free(addr);
     return err;
@@ -536,6 +914,8 @@ udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
     if (nadata->pending_data_owner == ndata) {
 	nadata->pending_data_owner = NULL;
 	nadata->data_pending_len = 0;
+	if (nadata->batch_count)
+	    udpna_start_deferred_op(nadata);
     }
 
     if (ndata->freed && !ndata->deferred_op_pending)
@@ -543,67 +923,217 @@ udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
 }
 
 static void
-udpn_finish_read(struct udpn_data *ndata)
+udpn_fmt_tstamp(char *buf, gensiods len, const char *name,
+		const gensio_time *t)
 {
-    struct udpna_data *nadata = ndata->nadata;
-    struct gensio *io = ndata->io;
-    gensiods count;
-    char raddrdata[200];
-    char daddrdata[200];
-    char ifidx[20];
-    const char *auxmem[4] = { NULL, NULL, NULL, NULL };
-    const char *const *auxdata;
-    int err;
-    gensiods pos;
+    snprintf(buf, len, "%s:%lld.%9.9ld", name, (long long) t->secs,
+	     (long) t->nsecs);
+}
 
- retry:
-    udpna_unlock(nadata);
-    count = nadata->data_pending_len;
-    auxdata = NULL;
+/*
+ * Fill in the auxdata for a packet received from addr.  msg is the
+ * batch entry it came in, for the timestamps, or NULL.
+ */
+static const char *const *
+udpn_fill_aux(struct udpn_data *ndata, struct gensio_addr *addr,
+	      struct gensio_sockmsg *msg, struct udpn_aux *aux)
+{
+    unsigned int n = 1;
+    gensiods pos;
+    int err;
 
-    auxdata = auxmem;
-    auxmem[0] = raddrdata;
-    strcpy(raddrdata, "addr:");
+    memset(aux->mem, 0, sizeof(aux->mem));
+    aux->mem[0] = aux->raddr;
+    strcpy(aux->raddr, "addr:");
     pos = 5;
-    err = gensio_addr_to_str(nadata->curr_recvaddr, raddrdata, &pos,
-			     sizeof(raddrdata));
+    err = gensio_addr_to_str(addr, aux->raddr, &pos, sizeof(aux->raddr));
     if (err) {
-	strcpy(raddrdata, "err:addr:");
-	strncpy(raddrdata + 9, gensio_err_to_str(err), sizeof(raddrdata) - 9);
-	raddrdata[sizeof(raddrdata) - 1] = '\0';
+	strcpy(aux->raddr, "err:addr:");
+	strncpy(aux->raddr + 9, gensio_err_to_str(err),
+		sizeof(aux->raddr) - 9);
+	aux->raddr[sizeof(aux->raddr) - 1] = '\0';
     }
 
     if (ndata->extrainfo) {
 	/* Get the ifidx */
-	if (gensio_addr_next(nadata->curr_recvaddr)) {
+	if (gensio_addr_next(addr)) {
 	    pos = 0;
-	    err = gensio_addr_to_str(nadata->curr_recvaddr, ifidx, &pos,
-				     sizeof(ifidx));
+	    err = gensio_addr_to_str(addr, aux->ifidx, &pos,
+				     sizeof(aux->ifidx));
 	    if (!err)
-		auxmem[1] = ifidx;
+		aux->mem[n++] = aux->ifidx;
 	}
 	/* Get the destination address */
-	if (gensio_addr_next(nadata->curr_recvaddr)) {
-	    strncpy(daddrdata, "daddr:", sizeof(daddrdata));
+	if (gensio_addr_next(addr)) {
+	    strncpy(aux->daddr, "daddr:", sizeof(aux->daddr));
 	    pos = 6;
-	    err = gensio_addr_to_str(nadata->curr_recvaddr, daddrdata, &pos,
-				     sizeof(daddrdata));
+	    err = gensio_addr_to_str(addr, aux->daddr, &pos,
+				     sizeof(aux->daddr));
 	    if (!err) {
 		/* Chop off the ,0 at the end. */
 		pos -= 2;
-		if (daddrdata[pos] == ',' && daddrdata[pos + 1] == '0')
-		    daddrdata[pos] = '\0';
-		auxmem[2] = daddrdata;
+		if (aux->daddr[pos] == ',' && aux->daddr[pos + 1] == '0')
+		    aux->daddr[pos] = '\0';
+		aux->mem[n++] = aux->daddr;
 	    }
 	}
+	/* It may still be looked up by address. */
+	gensio_addr_rewind(addr);
+    }
+
+    if (msg && (msg->rx_sw.secs || msg->rx_sw.nsecs)) {
+	udpn_fmt_tstamp(aux->rxts, sizeof(aux->rxts), "rxts", &msg->rx_sw);
+	aux->mem[n++] = aux->rxts;
+    }
+    if (msg && (msg->rx_hw.secs || msg->rx_hw.nsecs)) {
+	udpn_fmt_tstamp(aux->rxhwts, sizeof(aux->rxhwts), "rxhwts",
+			&msg->rx_hw);
+	aux->mem[n++] = aux->rxhwts;
+    }
+    return aux->mem;
+}
+
+/*
+ * Take the next packet from the received batch, *rmsg is set to the
+ * batch entry it is in.  Buffers coalesced by GRO are split back into
+ * their datagrams here.  Returns false if the batch is empty.
+ */
+static bool
+udpna_batch_pop(struct udpna_data *nadata, unsigned char **buf,
+		gensiods *len, struct gensio_sockmsg **rmsg)
+{
+    struct gensio_sockmsg *msg;
+
+    if (!nadata->batch_count)
+	return false;
+    msg = &nadata->batch[nadata->batch_pos];
+    *len = msg->len - nadata->batch_off;
+    if (msg->segsize && *len > msg->segsize)
+	*len = msg->segsize;
+    *buf = ((unsigned char *) msg->buf) + nadata->batch_off;
+    *rmsg = msg;
+    nadata->batch_off += *len;
+    if (nadata->batch_off >= msg->len) {
+	nadata->batch_pos++;
+	nadata->batch_count--;
+	nadata->batch_off = 0;
     }
+    return true;
+}
 
-    err = gensio_cb(io, GENSIO_EVENT_READ, 0, nadata->read_data,
-		    &count, auxdata);
+/*
+ * Give the pending packet, and the packets after it in the received
+ * batch that are for this gensio, to the user in one
+ * GENSIO_EVENT_READ_BATCH.  Returns GE_NOTSUP if the user doesn't
+ * handle the event, nothing is consumed then.
+ */
+static int
+udpn_read_batch(struct udpn_data *ndata)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    unsigned int save_pos = nadata->batch_pos;
+    unsigned int save_count = nadata->batch_count;
+    gensiods save_off = nadata->batch_off;
+    unsigned int pos, count;
+    gensiods off, n = 0, consumed, len;
+    struct gensio_sockmsg *msg;
+    unsigned char *buf;
+    int err;
+
+    ndata->batch_pkts[0].buf = nadata->read_data;
+    ndata->batch_pkts[0].buflen = nadata->data_pending_len;
+    ndata->batch_pkts[0].auxdata = udpn_fill_aux(ndata, nadata->curr_recvaddr,
+						 nadata->curr_msg,
+						 &ndata->batch_aux[0]);
+    n = 1;
+    while (n < ndata->read_batch) {
+	pos = nadata->batch_pos;
+	count = nadata->batch_count;
+	off = nadata->batch_off;
+	if (!udpna_batch_pop(nadata, &buf, &len, &msg))
+	    break;
+	if (len == 0)
+	    continue;
+	if (!nadata->nocon && !udpn_is_mine(ndata, msg->addr)) {
+	    /* Someone else's, stop here. */
+	    nadata->batch_pos = pos;
+	    nadata->batch_count = count;
+	    nadata->batch_off = off;
+	    break;
+	}
+	ndata->batch_pkts[n].buf = buf;
+	ndata->batch_pkts[n].buflen = len;
+	ndata->batch_pkts[n].auxdata = udpn_fill_aux(ndata, msg->addr, msg,
+						     &ndata->batch_aux[n]);
+	n++;
+    }
+    nadata->batch_pos = save_pos;
+    nadata->batch_count = save_count;
+    nadata->batch_off = save_off;
+
+    /*
+     * The batch can't change while we are unlocked, nothing is
+     * received while data is pending.
+     */
+    udpna_unlock(nadata);
+    consumed = n;
+    err = gensio_cb(ndata->io, GENSIO_EVENT_READ_BATCH, 0,
+		    (unsigned char *) ndata->batch_pkts, &consumed, NULL);
+    udpna_lock(nadata);
+    if (err)
+	return err;
+
+    if (consumed > n)
+	consumed = n;
+    if (consumed) {
+	nadata->pending_data_owner = NULL;
+	nadata->data_pending_len = 0;
+	/* Drop the rest of what was consumed from the batch. */
+	while (--consumed) {
+	    do {
+		udpna_batch_pop(nadata, &buf, &len, &msg);
+	    } while (len == 0);
+	}
+    }
+    return 0;
+}
+
+static void
+udpn_finish_read(struct udpn_data *ndata)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    struct gensio *io = ndata->io;
+    gensiods count;
+    struct udpn_aux aux;
+    const char *const *auxdata;
+    int err;
+
+ retry:
+    if (ndata->read_batch && !nadata->data_pos) {
+	err = udpn_read_batch(ndata);
+	if (err == GE_NOTSUP) {
+	    /* The user doesn't do batches, fall back to single reads. */
+	    ndata->read_batch = 0;
+	    goto retry;
+	}
+	if (err)
+	    goto out;
+	count = 0; /* data_pending_len is 0 if it was consumed. */
+	goto check_consumed;
+    }
+
+    udpna_unlock(nadata);
+    count = nadata->data_pending_len;
+    auxdata = udpn_fill_aux(ndata, nadata->curr_recvaddr, nadata->curr_msg,
+			    &aux);
+
+    err = gensio_cb(io, GENSIO_EVENT_READ, 0,
+		    nadata->read_data + nadata->data_pos, &count, auxdata);
     udpna_lock(nadata);
     if (err)
 	goto out;
 
+ check_consumed:
     if (ndata->state == UDPN_IN_CLOSE) {
 	udpn_finish_close(nadata, ndata);
 	goto out;
@@ -644,6 +1174,9 @@ udpna_deferred_op(struct gensio_runner *runner, void *cbdata)
 	}
     }
 
+    if (nadata->batch_count)
+	udpna_handle_batch(nadata);
+
     if (nadata->in_shutdown && !nadata->in_new_connection) {
 	struct gensio_accepter *accepter = nadata->acc;
 
@@ -1032,6 +1565,128 @@ udpna_control_lport(struct udpna_data *nadata, bool get,
     return 0;
 }
 
+static int
+udpn_read_batch_control(struct udpn_data *ndata, bool get, char *data,
+			gensiods *datalen)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_pkt *pkts;
+    struct udpn_aux *aux;
+    unsigned long val;
+    char *end;
+    int rv = 0;
+
+    if (get) {
+	*datalen = snprintf(data, *datalen, "%u", ndata->read_batch);
+	return 0;
+    }
+
+    val = strtoul(data, &end, 0);
+    if (*end || end == data)
+	return GE_INVAL;
+    if (val > GENSIO_UDP_MAX_READ_BATCH)
+	val = GENSIO_UDP_MAX_READ_BATCH;
+
+    udpna_lock(nadata);
+    if (val > ndata->batch_size) {
+	if (ndata->in_read) {
+	    /* The arrays are in use. */
+	    rv = GE_INPROGRESS;
+	    goto out_unlock;
+	}
+	pkts = o->zalloc(o, sizeof(*pkts) * val);
+	aux = o->zalloc(o, sizeof(*aux) * val);
+	if (!pkts || !aux) {
+	    if (pkts)
+		o->free(o, pkts);
+	    if (aux)
+		o->free(o, aux);
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+	if (ndata->batch_pkts)
+	    o->free(o, ndata->batch_pkts);
+	if (ndata->batch_aux)
+	    o->free(o, ndata->batch_aux);
+	ndata->batch_pkts = pkts;
+	ndata->batch_aux = aux;
+	ndata->batch_size = val;
+    }
+    ndata->read_batch = val;
+ out_unlock:
+    udpna_unlock(nadata);
+    return rv;
+}
+
+/*
+ * Move transmit timestamps from the socket's error queue to the txts
+ * ring.  Call with the lock held.
+ */
+static void
+udpna_tstamp_reap(struct udpna_data *nadata, struct gensio_iod *iod)
+{
+    struct gensio_tx_tstamp ts[16];
+    gensiods i, count;
+
+    do {
+	count = 16;
+	if (nadata->o->sock_control(iod, GENSIO_SOCKCTL_TSTAMP_REAP,
+				    ts, &count))
+	    return;
+	for (i = 0; i < count; i++) {
+	    if (nadata->txts_count == GENSIO_UDP_MAX_TX_TSTAMPS) {
+		nadata->txts_pos = ((nadata->txts_pos + 1) %
+				    GENSIO_UDP_MAX_TX_TSTAMPS);
+		nadata->txts_count--;
+	    }
+	    nadata->txts[(nadata->txts_pos + nadata->txts_count) %
+			 GENSIO_UDP_MAX_TX_TSTAMPS] = ts[i];
+	    nadata->txts_count++;
+	}
+    } while (count == 16);
+}
+
+/*
+ * Report the transmit timestamps collected so far, one per line.
+ * Ones that don't fit in data are left for the next call.
+ */
+static int
+udpn_tx_tstamp_control(struct udpn_data *ndata, char *data, gensiods *datalen)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    struct gensio_tx_tstamp *ts;
+    gensiods pos = 0, start;
+
+    if (!nadata->txts)
+	return GE_NOTREADY;
+
+    udpna_lock(nadata);
+    udpna_tstamp_reap(nadata, ndata->myiod);
+    if (*datalen > 0)
+	data[0] = '\0';
+    while (nadata->txts_count) {
+	ts = &nadata->txts[nadata->txts_pos];
+	start = pos;
+	gensio_pos_snprintf(data, *datalen, &pos,
+			    "id=%lu sw=%lld.%9.9ld hw=%lld.%9.9ld\n",
+			    (unsigned long) ts->id,
+			    (long long) ts->sw.secs, (long) ts->sw.nsecs,
+			    (long long) ts->hw.secs, (long) ts->hw.nsecs);
+	if (pos >= *datalen) {
+	    if (start < *datalen)
+		data[start] = '\0';
+	    pos = start;
+	    break;
+	}
+	nadata->txts_pos = (nadata->txts_pos + 1) % GENSIO_UDP_MAX_TX_TSTAMPS;
+	nadata->txts_count--;
+    }
+    udpna_unlock(nadata);
+    *datalen = pos;
+    return 0;
+}
+
 static int
 udpn_control(struct gensio *io, bool get, int option,
 	     char *data, gensiods *datalen)
@@ -1130,6 +1785,14 @@ udpn_control(struct gensio *io, bool get, int option,
 	break;
     }
 
+    case GENSIO_CONTROL_READ_BATCH:
+	return udpn_read_batch_control(ndata, get, data, datalen);
+
+    case GENSIO_CONTROL_TX_TSTAMP:
+	if (!get)
+	    return GE_NOTSUP;
+	return udpn_tx_tstamp_control(ndata, data, datalen);
+
     case GENSIO_CONTROL_EXTRAINFO: {
 	int val;
 	gensiods size = sizeof(val);
@@ -1150,14 +1813,17 @@ udpn_control(struct gensio *io, bool get, int option,
 			(!val && nadata->extrainfo == 1)) {
 		    err = o->sock_control(iod, GENSIO_SOCKCTL_SET_EXTRAINFO,
 					  &val, &size);
-		    if (err)
+		    if (err) {
+			udpna_unlock(nadata);
 			return err;
-		    ndata->extrainfo = val;
-		    if (val)
-			nadata->extrainfo++;
-		    else
-			nadata->extrainfo--;
+		    }
 		}
+		/* mcastdemux may already have it on, so always count. */
+		ndata->extrainfo = val;
+		if (val)
+		    nadata->extrainfo++;
+		else
+		    nadata->extrainfo--;
 	    }
 	    udpna_unlock(nadata);
 	}
@@ -1213,7 +1879,7 @@ static struct udpn_data *
 udp_alloc_gensio(struct udpna_data *nadata, struct gensio_iod *iod,
 		 const struct gensio_addr *addr,
 		 gensio_event cb, void *user_data,
-		 struct gensio_list *starting_list)
+		 struct gensio_list *starting_list, bool group)
 {
     struct udpn_data *ndata = nadata->o->zalloc(nadata->o, sizeof(*ndata));
 
@@ -1222,6 +1888,7 @@ udp_alloc_gensio(struct udpna_data *nadata, struct gensio_iod *iod,
 
     ndata->o = nadata->o;
     ndata->nadata = nadata;
+    ndata->group = group;
 
     ndata->deferred_op_runner = ndata->o->alloc_runner(ndata->o,
 						       udpn_deferred_op, ndata);
@@ -1252,37 +1919,57 @@ udp_alloc_gensio(struct udpna_data *nadata, struct gensio_iod *iod,
     /* Stick it on the end of the list. */
     udpn_add_to_list(starting_list, ndata);
     nadata->udpn_count++;
+    if (nadata->udpn_hash)
+	udpn_hash_resize(nadata);
+    udpn_hash_add(nadata, ndata);
 
     return ndata;
 }
 
-static void
-udpna_readhandler(struct gensio_iod *iod, void *cbdata)
+/*
+ * Make the address for a group gensio from the multicast destination
+ * addr is at.  It gets the port of the socket the packet came in on,
+ * so writes go to the group.
+ */
+static int
+udpna_group_addr(struct udpna_data *nadata, struct gensio_iod *iod,
+		 struct gensio_addr *addr, struct gensio_addr **raddr)
 {
-    struct udpna_data *nadata = cbdata;
-    struct udpn_data *ndata;
-    gensiods datalen;
+    char str[200];
+    gensiods pos = 0;
+    unsigned int i, port = 0;
     int err;
 
-    udpna_lock_and_ref(nadata);
-    if (nadata->data_pending_len) {
-	nadata->readhandler_read_disabled = true;
-	udpna_fd_read_disable(nadata);
-	goto out_unlock;
+    for (i = 0; i < nadata->nr_fds; i++) {
+	if (nadata->fds[i].iod == iod)
+	    port = nadata->fds[i].port;
     }
 
-    err = nadata->o->recvfrom(iod, nadata->read_data, nadata->max_read_size,
-			      &datalen, 0, nadata->curr_recvaddr);
-    if (err) {
-	if (!nadata->is_dummy)
-	    /* Don't log on dummy accepters. */
-	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
-			   "Could not accept on UDP: %s",
-			   gensio_err_to_str(err));
-	goto out_unlock;
-    }
-    if (datalen == 0)
-	goto out_unlock;
+    err = gensio_addr_to_str(addr, str, &pos, sizeof(str));
+    if (err)
+	return err;
+    /* The destination has a zero port, replace it. */
+    if (pos < 2 || pos >= sizeof(str) || strcmp(str + pos - 2, ",0") != 0)
+	return GE_INVAL;
+    snprintf(str + pos - 1, sizeof(str) - pos + 1, "%u", port);
+
+    return gensio_os_scan_netaddr(nadata->o, str, false,
+				  GENSIO_NET_PROTOCOL_UDP, raddr);
+}
+
+/*
+ * Handle the packet in read_data/curr_recvaddr that came in on iod.
+ * Called and returns with the lock held, but releases it in the
+ * callbacks.
+ */
+static void
+udpna_handle_packet(struct udpna_data *nadata, struct gensio_iod *iod,
+		    gensiods datalen)
+{
+    struct udpn_data *ndata;
+    struct gensio_addr *gaddr;
+    bool group = false;
+    int err;
 
     nadata->data_pending_len = datalen;
     nadata->data_pos = 0;
@@ -1294,22 +1981,41 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 	    ndata = gensio_link_to_ndata(gensio_list_first(&nadata->udpns));
 	}
     } else {
-	ndata = udpn_find(&nadata->udpns, nadata->curr_recvaddr);
+	group = udpna_group_dest(nadata, nadata->curr_recvaddr);
+	ndata = udpn_find(nadata, &nadata->udpns, nadata->curr_recvaddr,
+			  group);
     }
     if (ndata) {
 	/* Data belongs to an existing connection. */
+	gensio_addr_rewind(nadata->curr_recvaddr);
 	nadata->pending_data_owner = ndata;
 	goto got_ndata;
     }
 
     if (nadata->closed || !nadata->enabled) {
+	gensio_addr_rewind(nadata->curr_recvaddr);
 	nadata->data_pending_len = 0;
-	goto out_unlock_enable;
+	return;
     }
 
     /* New connection. */
-    ndata = udp_alloc_gensio(nadata, iod, nadata->curr_recvaddr,
-			     NULL, NULL, &nadata->udpns);
+    if (group) {
+	err = udpna_group_addr(nadata, iod, nadata->curr_recvaddr, &gaddr);
+	gensio_addr_rewind(nadata->curr_recvaddr);
+	if (err) {
+	    nadata->data_pending_len = 0;
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			   "Unable to get multicast group address: %s",
+			   gensio_err_to_str(err));
+	    return;
+	}
+	ndata = udp_alloc_gensio(nadata, iod, gaddr,
+				 NULL, NULL, &nadata->udpns, true);
+	gensio_addr_free(gaddr);
+    } else {
+	ndata = udp_alloc_gensio(nadata, iod, nadata->curr_recvaddr,
+				 NULL, NULL, &nadata->udpns, false);
+    }
     if (!ndata)
 	goto out_nomem;
 
@@ -1349,7 +2055,7 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 
     if (ndata->state == UDPN_IN_CLOSE) {
 	udpn_finish_close(nadata, ndata);
-	goto out_unlock_enable;
+	return;
     }
 
     if (nadata->in_shutdown) {
@@ -1364,13 +2070,95 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 	ndata->in_read = false;
     }
     udpna_check_finish_free(nadata);
-    goto out_unlock_enable;
+    return;
 
  out_nomem:
     nadata->data_pending_len = 0;
     gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		   "Out of memory allocating for udp port");
- out_unlock_enable:
+}
+
+/*
+ * Work through the received batch one packet at a time, stopping
+ * whenever a single recvfrom() would not have been done, so delivery
+ * is the same as without batching.
+ */
+static void
+udpna_handle_batch(struct udpna_data *nadata)
+{
+    gensiods len;
+
+    while (nadata->batch_count && !nadata->data_pending_len &&
+	   !nadata->read_disable_count && !nadata->finished_free) {
+	udpna_batch_pop(nadata, &nadata->read_data, &len, &nadata->curr_msg);
+	nadata->curr_recvaddr = nadata->curr_msg->addr;
+	if (len == 0)
+	    continue;
+	udpna_handle_packet(nadata, nadata->batch_iod, len);
+    }
+}
+
+static int
+udpna_recv_batch(struct udpna_data *nadata, struct gensio_iod *iod)
+{
+    gensiods count = nadata->recv_batch;
+    int err;
+
+    err = nadata->o->sock_control(iod, GENSIO_SOCKCTL_RECV_MULTI,
+				  nadata->batch, &count);
+    if (err)
+	return err;
+    nadata->batch_iod = iod;
+    nadata->batch_pos = 0;
+    nadata->batch_off = 0;
+    nadata->batch_count = count;
+    return 0;
+}
+
+static void
+udpna_readhandler(struct gensio_iod *iod, void *cbdata)
+{
+    struct udpna_data *nadata = cbdata;
+    gensiods datalen;
+    int err;
+
+    udpna_lock_and_ref(nadata);
+    if (nadata->txts)
+	/* These wake us up until they are taken off the socket. */
+	udpna_tstamp_reap(nadata, iod);
+    if (nadata->data_pending_len) {
+	nadata->readhandler_read_disabled = true;
+	udpna_fd_read_disable(nadata);
+	goto out_unlock;
+    }
+
+    if (nadata->batch) {
+	if (nadata->batch_count == 0)
+	    err = udpna_recv_batch(nadata, iod);
+	else
+	    err = 0; /* Finish the old batch first, we will be back. */
+    } else {
+	err = nadata->o->recvfrom(iod, nadata->read_data,
+				  nadata->max_read_size,
+				  &datalen, 0, nadata->curr_recvaddr);
+    }
+    if (err) {
+	if (!nadata->is_dummy)
+	    /* Don't log on dummy accepters. */
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			   "Could not accept on UDP: %s",
+			   gensio_err_to_str(err));
+	goto out_unlock;
+    }
+
+    if (nadata->batch) {
+	udpna_handle_batch(nadata);
+    } else {
+	if (datalen == 0)
+	    goto out_unlock;
+	udpna_handle_packet(nadata, iod, datalen);
+    }
+
     if (nadata->readhandler_read_disabled) {
 	nadata->readhandler_read_disabled = false;
 	udpna_fd_read_enable(nadata);
@@ -1379,10 +2167,101 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
     udpna_deref_and_unlock(nadata);
 }
 
+/*
+ * Turn on the segmentation offloads, timestamps, and busy polling
+ * asked for on the socket.  If the kernel can't do GSO, gso_soft is
+ * set so the writes get split by hand.
+ */
+static int
+udpna_setup_offload(struct gensio_os_funcs *o, struct gensio_iod *iod,
+		    unsigned int gso_size, bool gro, unsigned int tstamp,
+		    unsigned int busy_poll, bool *gso_soft)
+{
+    gensiods size;
+    int err;
+
+    if (gso_size) {
+	size = sizeof(gso_size);
+	err = o->sock_control(iod, GENSIO_SOCKCTL_SET_UDP_GSO,
+			      &gso_size, &size);
+	if (err == GE_NOTSUP)
+	    *gso_soft = true;
+	else if (err)
+	    return err;
+    }
+    if (gro) {
+	size = sizeof(gro);
+	err = o->sock_control(iod, GENSIO_SOCKCTL_SET_UDP_GRO, &gro, &size);
+	/* Without GRO the packets just come in one at a time. */
+	if (err && err != GE_NOTSUP)
+	    return err;
+    }
+    if (tstamp) {
+	size = sizeof(tstamp);
+	err = o->sock_control(iod, GENSIO_SOCKCTL_SET_TIMESTAMPING,
+			      &tstamp, &size);
+	/* Without it there are just no timestamps. */
+	if (err && err != GE_NOTSUP)
+	    return err;
+    }
+    if (busy_poll) {
+	size = sizeof(busy_poll);
+	err = o->sock_control(iod, GENSIO_SOCKCTL_SET_BUSY_POLL,
+			      &busy_poll, &size);
+	if (err && err != GE_NOTSUP)
+	    return err;
+    }
+    return 0;
+}
+
+/*
+ * Join each multicast group on the first socket that can take it,
+ * and turn on extrainfo everywhere if demultiplexing so the
+ * destination group of each packet is known.
+ */
+static int
+udpna_setup_mcast(struct udpna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    unsigned int i, val = 1;
+    gensiods size = sizeof(val);
+    int rv = 0;
+
+    gensio_addr_rewind(nadata->mcast);
+    do {
+	for (i = 0; i < nadata->nr_fds; i++) {
+	    if (gensio_addr_family_supports(nadata->mcast,
+					    nadata->fds[i].family, 0))
+		break;
+	}
+	if (i == nadata->nr_fds) {
+	    /* Try for an IPv6 socket that takes IPv4. */
+	    for (i = 0; i < nadata->nr_fds; i++) {
+		if (gensio_addr_family_supports(nadata->mcast,
+						nadata->fds[i].family,
+						nadata->fds[i].flags))
+		    break;
+	    }
+	}
+	if (i == nadata->nr_fds)
+	    rv = GE_INVAL;
+	else
+	    rv = o->mcast_add(nadata->fds[i].iod, nadata->mcast, 0, true);
+    } while (!rv && gensio_addr_next(nadata->mcast));
+    gensio_addr_rewind(nadata->mcast);
+
+    for (i = 0; !rv && nadata->mcastdemux && i < nadata->nr_fds; i++)
+	rv = o->sock_control(nadata->fds[i].iod, GENSIO_SOCKCTL_SET_EXTRAINFO,
+			     &val, &size);
+
+    return rv;
+}
+
 static int
 udpna_startup(struct gensio_accepter *accepter)
 {
     struct udpna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    unsigned int i;
     int rv = 0;
 
     udpna_lock(nadata);
@@ -1394,6 +2273,29 @@ udpna_startup(struct gensio_accepter *accepter)
 				   &nadata->fds, &nadata->nr_fds);
 	if (rv)
 	    goto out_unlock;
+
+	for (i = 0; i < nadata->nr_fds &&
+		 (nadata->gso_size || nadata->gro || nadata->tstamp ||
+		  nadata->busy_poll); i++) {
+	    rv = udpna_setup_offload(nadata->o, nadata->fds[i].iod,
+				     nadata->gso_size, nadata->gro,
+				     nadata->tstamp, nadata->busy_poll,
+				     &nadata->gso_soft);
+	    if (rv)
+		break;
+	}
+	if (!rv && nadata->mcast)
+	    rv = udpna_setup_mcast(nadata);
+	if (rv) {
+	    for (i = 0; i < nadata->nr_fds; i++) {
+		nadata->o->clear_fd_handlers_norpt(nadata->fds[i].iod);
+		nadata->o->close(&nadata->fds[i].iod);
+	    }
+	    nadata->o->free(nadata->o, nadata->fds);
+	    nadata->fds = NULL;
+	    nadata->nr_fds = 0;
+	    goto out_unlock;
+	}
     }
 
     nadata->enabled = true;
@@ -1550,9 +2452,9 @@ udpna_str_to_gensio(struct gensio_accepter *accepter, const char *addrstr,
  found:
 
     udpna_lock(nadata);
-    ndata = udpn_find(&nadata->udpns, addr);
+    ndata = udpn_find(nadata, &nadata->udpns, addr, false);
     if (!ndata)
-	ndata = udpn_find(&nadata->closed_udpns, addr);
+	ndata = udpn_find(nadata, &nadata->closed_udpns, addr, false);
     if (ndata) {
 	udpna_unlock(nadata);
 	err = GE_EXISTS;
@@ -1560,7 +2462,7 @@ udpna_str_to_gensio(struct gensio_accepter *accepter, const char *addrstr,
     }
 
     ndata = udp_alloc_gensio(nadata, nadata->fds[fdi].iod, addr,
-			     cb, user_data, &nadata->closed_udpns);
+			     cb, user_data, &nadata->closed_udpns, false);
     if (!ndata) {
 	udpna_unlock(nadata);
 	err = GE_NOMEM;
@@ -1638,33 +2540,126 @@ gensio_acc_udp_func(struct gensio_accepter *acc, int func, int val,
     }
 }
 
+/* Get the defaults for rxtstamp, txtstamp, and hwtstamp. */
+static int
+udp_tstamp_defaults(struct gensio_os_funcs *o,
+		    bool *rxtstamp, bool *txtstamp, bool *hwtstamp)
+{
+    int err, ival;
+
+    err = gensio_get_default(o, "udp", "rxtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *rxtstamp = ival;
+    err = gensio_get_default(o, "udp", "txtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *txtstamp = ival;
+    err = gensio_get_default(o, "udp", "hwtstamp", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    *hwtstamp = ival;
+    return 0;
+}
+
+/* Convert the timestamp options to GENSIO_TSTAMP_xxx flags. */
+static unsigned int
+udp_tstamp_flags(bool rxtstamp, bool txtstamp, bool hwtstamp)
+{
+    unsigned int tstamp = 0;
+
+    if (rxtstamp)
+	tstamp |= GENSIO_TSTAMP_RX_SW | (hwtstamp ? GENSIO_TSTAMP_RX_HW : 0);
+    if (txtstamp)
+	tstamp |= GENSIO_TSTAMP_TX_SW | (hwtstamp ? GENSIO_TSTAMP_TX_HW : 0);
+    return tstamp;
+}
+
 static int
 i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
 			    gensiods max_read_size,
-			    bool reuseaddr, struct gensio_os_funcs *o,
+			    bool reuseaddr, unsigned int reuseport,
+			    unsigned int recv_batch,
+			    unsigned int gso_size, bool gro,
+			    unsigned int tstamp,
+			    struct gensio_os_funcs *o,
 			    gensio_accepter_event cb, void *user_data,
 			    struct gensio_accepter **accepter)
 {
     struct udpna_data *nadata;
+    gensiods slot_size = max_read_size;
+    unsigned int i;
 
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
 	return GE_NOMEM;
     nadata->o = o;
+    nadata->gso_size = gso_size;
+    nadata->gro = gro;
+    nadata->tstamp = tstamp;
     gensio_list_init(&nadata->udpns);
     gensio_list_init(&nadata->closed_udpns);
     nadata->refcount = 1;
     if (reuseaddr)
 	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEADDR;
+    if (reuseport)
+	nadata->opensock_flags |= (GENSIO_OPENSOCK_REUSEPORT |
+				   GENSIO_OPENSOCK_SHARDS(reuseport));
 
     if (iai)
 	nadata->ai = gensio_addr_dup(iai);
     if (!nadata->ai && iai) /* Allow a null ai if it was passed in. */
 	goto out_nomem;
 
-    nadata->read_data = o->zalloc(o, max_read_size);
-    if (!nadata->read_data)
-	goto out_nomem;
+    if (gro) {
+	/*
+	 * Coalesced packets only come in through the batch path, and
+	 * need room for a full coalesced buffer.
+	 */
+	if (recv_batch < 1)
+	    recv_batch = 1;
+	if (slot_size < GENSIO_UDP_GRO_BUF_SIZE)
+	    slot_size = GENSIO_UDP_GRO_BUF_SIZE;
+    }
+    /* Receive timestamps only come in through the batch path, too. */
+    if (tstamp & (GENSIO_TSTAMP_RX_SW | GENSIO_TSTAMP_RX_HW) &&
+		recv_batch < 1)
+	recv_batch = 1;
+
+    if (tstamp & (GENSIO_TSTAMP_TX_SW | GENSIO_TSTAMP_TX_HW)) {
+	nadata->txts = o->zalloc(o, (sizeof(*nadata->txts) *
+				     GENSIO_UDP_MAX_TX_TSTAMPS));
+	if (!nadata->txts)
+	    goto out_nomem;
+    }
+
+    if (recv_batch > 1 || gro ||
+		tstamp & (GENSIO_TSTAMP_RX_SW | GENSIO_TSTAMP_RX_HW)) {
+	nadata->batch = o->zalloc(o, sizeof(*nadata->batch) * recv_batch);
+	if (!nadata->batch)
+	    goto out_nomem;
+	nadata->recv_batch = recv_batch;
+	nadata->batch[0].buf = o->zalloc(o, slot_size * recv_batch);
+	if (!nadata->batch[0].buf)
+	    goto out_nomem;
+	for (i = 0; i < recv_batch; i++) {
+	    nadata->batch[i].buf = ((unsigned char *) nadata->batch[0].buf +
+				    slot_size * i);
+	    nadata->batch[i].buflen = slot_size;
+	    nadata->batch[i].addr = o->addr_alloc_recvfrom(o);
+	    if (!nadata->batch[i].addr)
+		goto out_nomem;
+	}
+	nadata->read_data = nadata->batch[0].buf;
+	nadata->curr_recvaddr = nadata->batch[0].addr;
+    } else {
+	nadata->read_data = o->zalloc(o, max_read_size);
+	if (!nadata->read_data)
+	    goto out_nomem;
+    }
 
     nadata->deferred_op_runner = o->alloc_runner(o, udpna_deferred_op, nadata);
     if (!nadata->deferred_op_runner)
@@ -1680,9 +2675,11 @@ i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
     if (!nadata->lock)
 	goto out_nomem;
 
-    nadata->curr_recvaddr = o->addr_alloc_recvfrom(o);
-    if (!nadata->curr_recvaddr)
-	goto out_nomem;
+    if (!nadata->curr_recvaddr) {
+	nadata->curr_recvaddr = o->addr_alloc_recvfrom(o);
+	if (!nadata->curr_recvaddr)
+	    goto out_nomem;
+    }
 
     nadata->acc = gensio_acc_data_alloc(o, cb, user_data, gensio_acc_udp_func,
 					NULL, "udp", nadata);
@@ -1710,22 +2707,118 @@ udp_gensio_accepter_alloc(const void *gdata,
     const struct gensio_addr *iai = gdata;
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
     unsigned int i;
-    bool reuseaddr = false;
+    bool reuseaddr = false, gro, rxtstamp, txtstamp, hwtstamp;
+    bool mcastdemux = false;
+    struct gensio_addr *mcast = NULL, *tmpaddr, *tmpaddr2;
+    unsigned int reuseport, recv_batch, gso_size, busy_poll;
     int err, ival;
 
+    err = gensio_get_default(o, "udp", "reuseport", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    reuseport = ival;
+    err = gensio_get_default(o, "udp", "recvbatch", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    recv_batch = ival;
+    err = gensio_get_default(o, "udp", "gso", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    gso_size = ival;
+    err = gensio_get_default(o, "udp", "gro", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    gro = ival;
+    err = gensio_get_default(o, "udp", "busypoll", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    busy_poll = ival;
+    err = udp_tstamp_defaults(o, &rxtstamp, &txtstamp, &hwtstamp);
+    if (err)
+	return err;
+
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
-	return GE_INVAL;
+	if (gensio_check_keyuint(args[i], "reuseport", &reuseport) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "busypoll", &busy_poll) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "recvbatch", &recv_batch) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "gso", &gso_size) > 0) {
+	    if (gso_size > GENSIO_UDP_MAX_GSO_SIZE) {
+		err = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_check_keybool(args[i], "gro", &gro) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "rxtstamp", &rxtstamp) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "txtstamp", &txtstamp) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "hwtstamp", &hwtstamp) > 0)
+	    continue;
+	tmpaddr = NULL;
+	if (gensio_check_keyaddrs_noport(o, args[i], "mcast",
+					 GENSIO_NET_PROTOCOL_UDP,
+					 &tmpaddr) > 0) {
+	    if (mcast) {
+		tmpaddr2 = gensio_addr_cat(mcast, tmpaddr);
+		gensio_addr_free(tmpaddr);
+		if (!tmpaddr2) {
+		    err = GE_NOMEM;
+		    goto out_err;
+		}
+		gensio_addr_free(mcast);
+		mcast = tmpaddr2;
+	    } else {
+		mcast = tmpaddr;
+	    }
+	    continue;
+	}
+	if (gensio_check_keybool(args[i], "mcastdemux", &mcastdemux) > 0)
+	    continue;
+	err = GE_INVAL;
+	goto out_err;
+    }
+    if (mcastdemux && !mcast) {
+	err = GE_INVAL;
+	goto out_err;
     }
     err = gensio_get_default(o, "udp", "reuseaddr", false,
 			     GENSIO_DEFAULT_BOOL, NULL, &ival);
     if (err)
-	return err;
+	goto out_err;
     reuseaddr = ival;
 
-    return i_udp_gensio_accepter_alloc(iai, max_read_size, reuseaddr,
-				       o, cb, user_data, accepter);
+    err = i_udp_gensio_accepter_alloc(iai, max_read_size, reuseaddr,
+				      reuseport, recv_batch, gso_size, gro,
+				      udp_tstamp_flags(rxtstamp, txtstamp,
+						       hwtstamp),
+				      o, cb, user_data, accepter);
+    if (!err) {
+	struct udpna_data *nadata = gensio_acc_get_gensio_data(*accepter);
+
+	nadata->busy_poll = busy_poll;
+	nadata->mcast = mcast;
+	nadata->mcastdemux = mcastdemux;
+	/* Extrainfo stays on for the group demultiplexing. */
+	if (mcastdemux)
+	    nadata->extrainfo = 1;
+	mcast = NULL;
+    }
+ out_err:
+    if (mcast)
+	gensio_addr_free(mcast);
+    return err;
 }
 
 static int
@@ -1764,8 +2857,9 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE, size;
     unsigned int i, setup;
     bool nocon = false, mcast_loop_set = false, mcast_loop = true;
-    bool reuseaddr = false;
-    unsigned int mttl;
+    bool reuseaddr = false, gro, gso_soft = false;
+    bool rxtstamp, txtstamp, hwtstamp;
+    unsigned int mttl, recv_batch, gso_size, tstamp, busy_poll;
 
     err = gensio_get_defaultaddr(o, "udp", "laddr", false,
 				 GENSIO_NET_PROTOCOL_UDP, true, false, &laddr);
@@ -1784,6 +2878,29 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
     if (err)
 	return err;
     mttl = ival;
+    err = gensio_get_default(o, "udp", "recvbatch", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    recv_batch = ival;
+    err = gensio_get_default(o, "udp", "gso", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    gso_size = ival;
+    err = gensio_get_default(o, "udp", "gro", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	return err;
+    gro = ival;
+    err = gensio_get_default(o, "udp", "busypoll", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	return err;
+    busy_poll = ival;
+    err = udp_tstamp_defaults(o, &rxtstamp, &txtstamp, &hwtstamp);
+    if (err)
+	return err;
 
     err = GE_INVAL;
     for (i = 0; args && args[i]; i++) {
@@ -1829,6 +2946,25 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
 	}
 	if (gensio_check_keybool(args[i], "reuseaddr", &reuseaddr) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "recvbatch", &recv_batch) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "gso", &gso_size) > 0) {
+	    if (gso_size > GENSIO_UDP_MAX_GSO_SIZE) {
+		err = GE_INVAL;
+		goto parm_err;
+	    }
+	    continue;
+	}
+	if (gensio_check_keybool(args[i], "gro", &gro) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "rxtstamp", &rxtstamp) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "txtstamp", &txtstamp) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "hwtstamp", &hwtstamp) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "busypoll", &busy_poll) > 0)
+	    continue;
     parm_err:
 	if (laddr)
 	    gensio_addr_free(laddr);
@@ -1894,14 +3030,24 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
 	}
     }
 
+    tstamp = udp_tstamp_flags(rxtstamp, txtstamp, hwtstamp);
+    err = udpna_setup_offload(o, new_iod, gso_size, gro, tstamp, busy_poll,
+			      &gso_soft);
+    if (err) {
+	o->close(&new_iod);
+	return err;
+    }
+
     /* Allocate a dummy network accepter. */
-    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, reuseaddr, o,
-				      NULL, NULL, &accepter);
+    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, reuseaddr, 0,
+				      recv_batch, gso_size, gro, tstamp,
+				      o, NULL, NULL, &accepter);
     if (err) {
 	o->close(&new_iod);
 	return err;
     }
     nadata = gensio_acc_get_gensio_data(accepter);
+    nadata->gso_soft = gso_soft;
     nadata->is_dummy = true;
     nadata->nocon = nocon;
 
@@ -1920,7 +3066,7 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
     nadata->freed = true;
 
     ndata = udp_alloc_gensio(nadata, new_iod, addr,
-			     cb, user_data, &nadata->closed_udpns);
+			     cb, user_data, &nadata->closed_udpns, false);
     if (!ndata) {
 	err = GE_NOMEM;
     } else {
@@ -5,6 +5,10 @@
  *  SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#ifdef linux
+#define _GNU_SOURCE /* Get sched_getcpu() and CPU affinity. */
+#endif
+
 #include "config.h"
 #include <string.h>
 #include <errno.h>
@@ -25,6 +29,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/types.h>
@@ -32,16 +37,86 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "errtrig.h"
 
+#if defined(USE_PTHREADS) && defined(linux)
+#define GENSIO_UNIX_NUMA 1
+#include <sched.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#else
+#define GENSIO_UNIX_NUMA 0
+#endif
+
 struct gensio_data {
     struct selector_s *sel;
     lock_type reflock;
     unsigned int refcount;
     bool freesel;
     int wake_sig;
+    bool use_wakefd;
     struct gensio_os_proc_data *pdata;
     struct gensio_memtrack *mtrack;
+
+    /*
+     * Caches for timers and runners.  These are NULL (and plain
+     * zalloc is used) when memory tracking is on.
+     */
+    struct gensio_memcache *timer_cache;
+    struct gensio_memcache *runner_cache;
+
+    /* Use the coarse clock for GENSIO_CONTROL_GET_LOOP_TIME. */
+    bool coarse_time;
+
+    /*
+     * The selectors, sels[0] is sel.  There is more than one only
+     * if allocated with gensio_unix_funcs_alloc_multi(), each
+     * service thread is then bound to one of them, see
+     * get_sel_thread().
+     */
+    struct selector_s **sels;
+    unsigned int nr_sels;
+#ifdef USE_PTHREADS
+    lock_type msel_lock;
+    unsigned int *sel_load; /* Number of iods on each selector. */
+    unsigned int *sel_servers; /* Service threads bound to each. */
+    unsigned int *sel_waiters; /* Unbound threads waiting on each. */
+    unsigned int next_home;
+    unsigned int next_accept;
+    pthread_key_t sel_thread_key;
+#endif
+#if GENSIO_UNIX_NUMA
+    /*
+     * NUMA placement, see gensio_unix_numa_setup().  Each selector
+     * belongs to a node (sel_node), threads waiting on it are pinned
+     * to the node's CPUs, and accepted connections are moved to a
+     * selector on the node where they came in.
+     */
+    bool numa;
+    unsigned int nr_nodes;
+    unsigned int *sel_node;
+    cpu_set_t *node_cpus;
+    int *cpu_node;
+    unsigned int nr_cpus;
+#endif
+
+    /*
+     * Real-time profile, see gensio_unix_set_realtime().  rt_gen
+     * changes every time it is set, a waiting thread compares it with
+     * the generation it last applied (in rt_key) and changes its
+     * scheduling to match.
+     */
+    bool realtime;
+#ifdef USE_PTHREADS
+    unsigned int rt_prio;
+    unsigned int rt_gen;
+    bool rt_key_set;
+    pthread_key_t rt_key;
+#endif
+
+    int (*orig_accept)(struct gensio_iod *iod, struct gensio_addr **raddr,
+		       struct gensio_iod **newiod);
 };
 
 static void *
@@ -98,9 +173,289 @@ timeval_to_gensio_time(gensio_time *t, struct timeval *tv)
 
 #include <pthread.h>
 
+/*
+ * If eventfd wakeups are enabled (see gensio_unix_alloc_sel()), each
+ * thread that waits on a selector gets its own wakefd, freed when
+ * the thread exits.
+ */
+static pthread_key_t wakefd_key;
+static pthread_once_t wakefd_once = PTHREAD_ONCE_INIT;
+static bool wakefd_key_ok;
+
+static void
+wakefd_key_destroy(void *data)
+{
+    sel_free_wakefd(data);
+}
+
+static void
+wakefd_key_init(void)
+{
+    wakefd_key_ok = pthread_key_create(&wakefd_key, wakefd_key_destroy) == 0;
+}
+
+/* Returns NULL if a wakefd can't be had, use a signal then. */
+static sel_wakefd_t *
+get_thread_wakefd(void)
+{
+    sel_wakefd_t *w;
+
+    pthread_once(&wakefd_once, wakefd_key_init);
+    if (!wakefd_key_ok)
+	return NULL;
+    w = pthread_getspecific(wakefd_key);
+    if (!w) {
+	if (sel_alloc_wakefd(&w))
+	    return NULL;
+	if (pthread_setspecific(wakefd_key, w)) {
+	    sel_free_wakefd(w);
+	    return NULL;
+	}
+    }
+    return w;
+}
+
+/*
+ * In multi-selector mode, a thread's home selector and the selector
+ * new iods, timers and runners are allocated on (normally the home,
+ * but see gensio_unix_accept()).  A home is handed out round-robin
+ * the first time a thread needs one.  Only threads that call service
+ * are bound to their home and wait on it, they are moved to the
+ * selector with the fewest service threads the first time, see
+ * thread_service_sel().  Other threads that wait aren't bound, see
+ * thread_waiter_sel().
+ */
+struct gensio_sel_thread {
+    struct gensio_data *d;
+    unsigned int home;
+    unsigned int cur;
+    bool pinned;
+    bool serves; /* Bound to home, see thread_run_sel(). */
+};
+
+/* Thread exit, let another service thread have the selector. */
+static void
+sel_thread_free(void *data)
+{
+    struct gensio_sel_thread *t = data;
+    struct gensio_data *d = t->d;
+
+    if (t->serves) {
+	LOCK(&d->msel_lock);
+	d->sel_servers[t->home]--;
+	UNLOCK(&d->msel_lock);
+    }
+    free(t);
+}
+
+static struct gensio_sel_thread *
+get_sel_thread(struct gensio_data *d)
+{
+    struct gensio_sel_thread *t;
+
+    if (d->nr_sels <= 1)
+	return NULL;
+    t = pthread_getspecific(d->sel_thread_key);
+    if (!t) {
+	t = malloc(sizeof(*t));
+	if (!t)
+	    return NULL; /* Just use the first selector. */
+	t->d = d;
+	LOCK(&d->msel_lock);
+	t->home = d->next_home++ % d->nr_sels;
+	UNLOCK(&d->msel_lock);
+	t->cur = t->home;
+	t->pinned = false;
+	t->serves = false;
+	if (pthread_setspecific(d->sel_thread_key, t)) {
+	    free(t);
+	    return NULL;
+	}
+    }
+    return t;
+}
+
+/* Give the current thread the real-time profile's scheduling. */
+static void
+thread_rt_check(struct gensio_data *d)
+{
+    unsigned int gen = __atomic_load_n(&d->rt_gen, __ATOMIC_ACQUIRE);
+    struct sched_param p;
+
+    if (!gen || (uintptr_t) pthread_getspecific(d->rt_key) == gen)
+	return;
+    pthread_setspecific(d->rt_key, (void *) (uintptr_t) gen);
+    memset(&p, 0, sizeof(p));
+    p.sched_priority = d->rt_prio;
+    /* Failure just means the thread keeps running as it was. */
+    pthread_setschedparam(pthread_self(),
+			  d->rt_prio ? SCHED_FIFO : SCHED_OTHER, &p);
+}
+
+/*
+ * The selector with the fewest threads on it, counting unbound
+ * waiters if waiters is set.  Ties go to prefer.  Must be called
+ * with msel_lock held.
+ */
+static unsigned int
+least_served_sel(struct gensio_data *d, unsigned int prefer, bool waiters)
+{
+    unsigned int i, n, best = prefer, best_n = UINT_MAX;
+
+    for (i = 0; i < d->nr_sels; i++) {
+	n = d->sel_servers[i];
+	if (waiters)
+	    n += d->sel_waiters[i];
+	if (n < best_n || (n == best_n && i == prefer)) {
+	    best = i;
+	    best_n = n;
+	}
+    }
+    return best;
+}
+
+/*
+ * The selector a thread calling service waits on.  The first time,
+ * the thread is bound to the selector with the fewest service
+ * threads, so every selector gets one as long as there are enough.
+ */
+static struct selector_s *
+thread_service_sel(struct gensio_data *d)
+{
+    struct gensio_sel_thread *t;
+
+    thread_rt_check(d);
+    t = get_sel_thread(d);
+    if (!t)
+	return d->sel;
+    if (!t->serves) {
+	LOCK(&d->msel_lock);
+	t->home = least_served_sel(d, t->home, false);
+	d->sel_servers[t->home]++;
+	UNLOCK(&d->msel_lock);
+	t->cur = t->home;
+	t->serves = true;
+    }
+#if GENSIO_UNIX_NUMA
+    /*
+     * Only service threads are pinned, a thread that just
+     * allocates things or waits shouldn't have its CPUs changed.  Failure
+     * just means the thread runs where the scheduler puts it.
+     */
+    if (d->numa && !t->pinned) {
+	t->pinned = true;
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+			       &d->node_cpus[d->sel_node[t->home]]);
+    }
+#endif
+    return d->sels[t->home];
+}
+
+/*
+ * The selector a thread waits on in a waiter.  A service thread uses
+ * its home.  Other threads, like one in a synchronous call, aren't
+ * bound to anything.  They wait on the selector with the fewest
+ * threads on it right now (preferring the one they allocate on), so
+ * one that has no service thread still gets run.  *idx is set for
+ * thread_waiter_done(), UINT_MAX if nothing needs to be undone.
+ */
+static struct selector_s *
+thread_waiter_sel(struct gensio_data *d, unsigned int *idx)
+{
+    struct gensio_sel_thread *t;
+
+    *idx = UINT_MAX;
+    thread_rt_check(d);
+    t = get_sel_thread(d);
+    if (!t)
+	return d->sel;
+    if (t->serves)
+	return d->sels[t->home];
+    LOCK(&d->msel_lock);
+    *idx = least_served_sel(d, t->home, true);
+    d->sel_waiters[*idx]++;
+    UNLOCK(&d->msel_lock);
+    return d->sels[*idx];
+}
+
+static void
+thread_waiter_done(struct gensio_data *d, unsigned int idx)
+{
+    if (idx == UINT_MAX)
+	return;
+    LOCK(&d->msel_lock);
+    d->sel_waiters[idx]--;
+    UNLOCK(&d->msel_lock);
+}
+
+#if GENSIO_UNIX_NUMA
+static void
+gensio_unix_numa_free(struct gensio_data *d)
+{
+    free(d->sel_node);
+    d->sel_node = NULL;
+    free(d->node_cpus);
+    d->node_cpus = NULL;
+    free(d->cpu_node);
+    d->cpu_node = NULL;
+}
+#endif
+
+/* The selector to allocate things on from the current thread. */
+static unsigned int
+thread_alloc_sel(struct gensio_data *d)
+{
+    struct gensio_sel_thread *t = get_sel_thread(d);
+
+    return t ? t->cur : 0;
+}
+
+/*
+ * The selector to queue a runner on from the current thread, or NULL
+ * for the one it was allocated on.  Runners started from a service
+ * thread stay on that thread's selector, where the data they touch
+ * is probably in cache.  Other threads don't have a selector of their
+ * own, so they leave it where it was.
+ */
+static struct selector_s *
+thread_run_sel(struct gensio_data *d)
+{
+    struct gensio_sel_thread *t = get_sel_thread(d);
+
+    if (t && t->serves)
+	return d->sels[t->home];
+    return NULL;
+}
+
+static void
+update_sel_load(struct gensio_data *d, unsigned int idx, int change)
+{
+    if (d->nr_sels <= 1)
+	return;
+    LOCK(&d->msel_lock);
+    d->sel_load[idx] += change;
+    UNLOCK(&d->msel_lock);
+}
+
+/*
+ * Called around handlers so an accept in a handler only affects
+ * things allocated in the rest of that handler.
+ */
+static void
+thread_reset_sel(struct gensio_data *d)
+{
+    struct gensio_sel_thread *t = get_sel_thread(d);
+
+    if (t)
+	t->cur = t->home;
+}
+
 struct waiter_data {
     pthread_t tid;
     int wake_sig;
+    sel_wakefd_t *wakefd;
+    struct selector_s *sel;
+    unsigned int sel_idx; /* For thread_waiter_done(). */
     unsigned int count;
     struct waiter_data *prev;
     struct waiter_data *next;
@@ -110,13 +465,15 @@ typedef struct waiter_s {
     struct gensio_os_funcs *o;
     struct selector_s *sel;
     int wake_sig;
+    bool use_wakefd;
     unsigned int count;
     pthread_mutex_t lock;
     struct waiter_data wts;
 } waiter_t;
 
 static waiter_t *
-alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig)
+alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig,
+	     bool use_wakefd)
 {
     waiter_t *waiter;
 
@@ -124,6 +481,7 @@ alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig)
     if (waiter) {
 	waiter->o = o;
 	waiter->wake_sig = wake_sig;
+	waiter->use_wakefd = use_wakefd;
 	waiter->sel = sel;
 	pthread_mutex_init(&waiter->lock, NULL);
 	waiter->wts.next = &waiter->wts;
@@ -146,7 +504,10 @@ wake_thread_send_sig_waiter(long thread_id, void *cb_data)
 {
     struct waiter_data *w = cb_data;
 
-    pthread_kill(w->tid, w->wake_sig);
+    if (w->wakefd)
+	sel_wakefd_send_sig(thread_id, w->wakefd);
+    else
+	pthread_kill(w->tid, w->wake_sig);
 }
 
 static void
@@ -166,10 +527,10 @@ i_wake_waiter(waiter_t *waiter, unsigned int count)
 	    }
 	    if (w->count == 0) {
 #ifdef BROKEN_PSELECT
-		sel_wake_one(waiter->sel, (long) w->tid,
+		sel_wake_one(w->sel, (long) w->tid,
 			     wake_thread_send_sig_waiter, w);
 #else
-		pthread_kill(w->tid, w->wake_sig);
+		wake_thread_send_sig_waiter((long) w->tid, w);
 #endif
 	    }
 	}
@@ -189,6 +550,10 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
 
     w.tid = pthread_self();
     w.wake_sig = waiter->wake_sig;
+    w.wakefd = NULL;
+    if (waiter->use_wakefd)
+	w.wakefd = get_thread_wakefd();
+    w.sel = thread_waiter_sel(waiter->o->user_data, &w.sel_idx);
     w.next = NULL;
     w.prev = NULL;
     w.count = count;
@@ -212,12 +577,19 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
     }
     while (w.count > 0) {
 	pthread_mutex_unlock(&waiter->lock);
-	if (intr)
-	    err = sel_select_intr_sigmask(waiter->sel,
+	if (w.wakefd && intr)
+	    err = sel_select_intr_sigmask(w.sel, sel_wakefd_send_sig,
+					  (long) w.tid, w.wakefd, rtv,
+					  sigmask);
+	else if (w.wakefd)
+	    err = sel_select(w.sel, sel_wakefd_send_sig,
+			     (long) w.tid, w.wakefd, rtv);
+	else if (intr)
+	    err = sel_select_intr_sigmask(w.sel,
 					  wake_thread_send_sig_waiter,
 					  (long) w.tid, &w, rtv, sigmask);
 	else
-	    err = sel_select(waiter->sel, wake_thread_send_sig_waiter,
+	    err = sel_select(w.sel, wake_thread_send_sig_waiter,
 			     (long) w.tid, &w, rtv);
 	if (err < 0)
 	    err = errno;
@@ -231,6 +603,7 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
 	    break;
     }
     timeval_to_gensio_time(timeout, rtv);
+    thread_waiter_done(waiter->o->user_data, w.sel_idx);
     w.next->prev = w.prev;
     w.prev->next = w.next;
     if (w.count == 0) {
@@ -257,6 +630,28 @@ wake_waiter(waiter_t *waiter)
 
 #else /* USE_PTHREADS */
 
+static unsigned int
+thread_alloc_sel(struct gensio_data *d)
+{
+    return 0;
+}
+
+static void
+thread_reset_sel(struct gensio_data *d)
+{
+}
+
+static struct selector_s *
+thread_run_sel(struct gensio_data *d)
+{
+    return NULL;
+}
+
+static void
+update_sel_load(struct gensio_data *d, unsigned int idx, int change)
+{
+}
+
 typedef struct waiter_s {
     struct gensio_os_funcs *o;
     unsigned int count;
@@ -264,7 +659,8 @@ typedef struct waiter_s {
 } waiter_t;
 
 static waiter_t *
-alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig)
+alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig,
+	     bool use_wakefd)
 {
     waiter_t *waiter;
 
@@ -388,6 +784,9 @@ struct gensio_iod_unix {
     struct gensio_iod r;
     int orig_fd;
     int fd;
+    struct selector_s *sel;
+    unsigned int sel_idx;
+    bool sharded; /* Placed by GENSIO_IOD_CONTROL_SHARD. */
     enum gensio_iod_type type;
     bool handlers_set;
     bool is_stdio;
@@ -414,22 +813,31 @@ struct gensio_iod_unix {
 static void iod_read_handler(int fd, void *cb_data)
 {
     struct gensio_iod_unix *iod = cb_data;
+    struct gensio_data *d = iod->r.f->user_data;
 
+    thread_reset_sel(d);
     iod->read_handler(&iod->r, iod->cb_data);
+    thread_reset_sel(d);
 }
 
 static void iod_write_handler(int fd, void *cb_data)
 {
     struct gensio_iod_unix *iod = cb_data;
+    struct gensio_data *d = iod->r.f->user_data;
 
+    thread_reset_sel(d);
     iod->write_handler(&iod->r, iod->cb_data);
+    thread_reset_sel(d);
 }
 
 static void iod_except_handler(int fd, void *cb_data)
 {
     struct gensio_iod_unix *iod = cb_data;
+    struct gensio_data *d = iod->r.f->user_data;
 
+    thread_reset_sel(d);
     iod->except_handler(&iod->r, iod->cb_data);
+    thread_reset_sel(d);
 }
 
 static void iod_cleared_handler(int fd, void *cb_data)
@@ -454,7 +862,6 @@ gensio_unix_set_fd_handlers(struct gensio_iod *iiod,
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int rv = 0;
 
     if (iod->handlers_set)
@@ -466,7 +873,7 @@ gensio_unix_set_fd_handlers(struct gensio_iod *iiod,
     iod->except_handler = except_handler;
     iod->cleared_handler = cleared_handler;
     if (iod->type != GENSIO_IOD_FILE)
-	rv = sel_set_fd_handlers(d->sel, iod->fd, iod,
+	rv = sel_set_fd_handlers(iod->sel, iod->fd, iod,
 				 read_handler ? iod_read_handler : NULL,
 				 write_handler ? iod_write_handler : NULL,
 				 except_handler ? iod_except_handler : NULL,
@@ -482,7 +889,6 @@ gensio_unix_clear_fd_handlers(struct gensio_iod *iiod)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
 
     if (!iod->handlers_set)
 	return;
@@ -494,7 +900,7 @@ gensio_unix_clear_fd_handlers(struct gensio_iod *iiod)
 	}
 	f->unlock(iod->u.file.lock);
     } else {
-	sel_clear_fd_handlers(d->sel, iod->fd);
+	sel_clear_fd_handlers(iod->sel, iod->fd);
     }
 }
 
@@ -502,13 +908,11 @@ static void
 gensio_unix_clear_fd_handlers_norpt(struct gensio_iod *iiod)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
-    struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
 
     if (iod->handlers_set) {
 	iod->handlers_set = false;
 	if (iod->type != GENSIO_IOD_FILE)
-	    sel_clear_fd_handlers_norpt(d->sel, iod->fd);
+	    sel_clear_fd_handlers_norpt(iod->sel, iod->fd);
     }
 }
 
@@ -547,7 +951,6 @@ gensio_unix_set_read_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE) {
@@ -568,7 +971,7 @@ gensio_unix_set_read_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_read_handler(d->sel, iod->fd, op);
+    sel_set_fd_read_handler(iod->sel, iod->fd, op);
 }
 
 static void
@@ -576,7 +979,6 @@ gensio_unix_set_write_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE) {
@@ -597,15 +999,13 @@ gensio_unix_set_write_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_write_handler(d->sel, iod->fd, op);
+    sel_set_fd_write_handler(iod->sel, iod->fd, op);
 }
 
 static void
 gensio_unix_set_except_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
-    struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE)
@@ -616,7 +1016,7 @@ gensio_unix_set_except_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_except_handler(d->sel, iod->fd, op);
+    sel_set_fd_except_handler(iod->sel, iod->fd, op);
 }
 
 struct gensio_timer {
@@ -635,8 +1035,30 @@ gensio_timeout_handler(struct selector_s *sel,
 		       struct sel_timer_s *sel_timer, void *cb_data)
 {
     struct gensio_timer *timer = cb_data;
+    struct gensio_data *d = timer->f->user_data;
 
+    thread_reset_sel(d);
     timer->handler(timer, timer->cb_data);
+    thread_reset_sel(d);
+}
+
+static void *
+gensio_unix_obj_alloc(struct gensio_os_funcs *f, struct gensio_memcache *c,
+		      gensiods size)
+{
+    if (c)
+	return gensio_os_funcs_cache_zalloc(f, c);
+    return f->zalloc(f, size);
+}
+
+static void
+gensio_unix_obj_free(struct gensio_os_funcs *f, struct gensio_memcache *c,
+		     void *data)
+{
+    if (c)
+	gensio_os_funcs_cache_free(f, c, data);
+    else
+	f->free(f, data);
 }
 
 static struct gensio_timer *
@@ -648,7 +1070,7 @@ gensio_unix_alloc_timer(struct gensio_os_funcs *f,
     struct gensio_timer *timer;
     int rv;
 
-    timer = f->zalloc(f, sizeof(*timer));
+    timer = gensio_unix_obj_alloc(f, d->timer_cache, sizeof(*timer));
     if (!timer)
 	return NULL;
 
@@ -657,10 +1079,11 @@ gensio_unix_alloc_timer(struct gensio_os_funcs *f,
     timer->cb_data = cb_data;
     LOCK_INIT(&timer->lock);
 
-    rv = sel_alloc_timer(d->sel, gensio_timeout_handler, timer,
+    rv = sel_alloc_timer(d->sels[thread_alloc_sel(d)],
+			 gensio_timeout_handler, timer,
 			 &timer->sel_timer);
     if (rv) {
-	f->free(f, timer);
+	gensio_unix_obj_free(f, d->timer_cache, timer);
 	return NULL;
     }
 
@@ -670,8 +1093,10 @@ gensio_unix_alloc_timer(struct gensio_os_funcs *f,
 static void
 gensio_unix_free_timer(struct gensio_timer *timer)
 {
+    struct gensio_data *d = timer->f->user_data;
+
     sel_free_timer(timer->sel_timer);
-    timer->f->free(timer->f, timer);
+    gensio_unix_obj_free(timer->f, d->timer_cache, timer);
 }
 
 static int
@@ -762,7 +1187,7 @@ gensio_unix_alloc_runner(struct gensio_os_funcs *f,
     struct gensio_runner *runner;
     int rv;
 
-    runner = f->zalloc(f, sizeof(*runner));
+    runner = gensio_unix_obj_alloc(f, d->runner_cache, sizeof(*runner));
     if (!runner)
 	return NULL;
 
@@ -770,9 +1195,9 @@ gensio_unix_alloc_runner(struct gensio_os_funcs *f,
     runner->handler = handler;
     runner->cb_data = cb_data;
 
-    rv = sel_alloc_runner(d->sel, &runner->sel_runner);
+    rv = sel_alloc_runner(d->sels[thread_alloc_sel(d)], &runner->sel_runner);
     if (rv) {
-	f->free(f, runner);
+	gensio_unix_obj_free(f, d->runner_cache, runner);
 	return NULL;
     }
 
@@ -782,21 +1207,31 @@ gensio_unix_alloc_runner(struct gensio_os_funcs *f,
 static void
 gensio_unix_free_runner(struct gensio_runner *runner)
 {
+    struct gensio_data *d = runner->f->user_data;
+
     sel_free_runner(runner->sel_runner);
-    runner->f->free(runner->f, runner);
+    gensio_unix_obj_free(runner->f, d->runner_cache, runner);
 }
 
 static void
 gensio_runner_handler(sel_runner_t *sel_runner, void *cb_data)
 {
     struct gensio_runner *runner = cb_data;
+    struct gensio_data *d = runner->f->user_data;
 
+    thread_reset_sel(d);
     runner->handler(runner, runner->cb_data);
+    thread_reset_sel(d);
 }
 
 static int
 gensio_unix_run(struct gensio_runner *runner)
 {
+    struct selector_s *sel = thread_run_sel(runner->f->user_data);
+
+    if (sel)
+	return sel_run_on(sel, runner->sel_runner, gensio_runner_handler,
+			  runner);
     return sel_run(runner->sel_runner, gensio_runner_handler, runner);
 }
 
@@ -816,7 +1251,7 @@ gensio_unix_alloc_waiter(struct gensio_os_funcs *f)
 
     waiter->f = f;
 
-    waiter->sel_waiter = alloc_waiter(f, d->sel, d->wake_sig);
+    waiter->sel_waiter = alloc_waiter(f, d->sel, d->wake_sig, d->use_wakefd);
     if (!waiter->sel_waiter) {
 	f->free(f, waiter);
 	return NULL;
@@ -893,25 +1328,76 @@ wake_thread_send_sig(long thread_id, void *cb_data)
     pthread_kill(w->id, w->wake_sig);
 }
 
+/*
+ * Only steal from a selector with at least this many runners waiting,
+ * a single runner will be handled soon enough by its own thread.
+ */
+#define GENSIO_UNIX_STEAL_MIN 2
+
+/*
+ * If sel has no runners waiting, run the ones waiting on the selector
+ * with the most, so a thread stuck in a long callback doesn't hold
+ * up work that idle threads could do.  Returns true if any were run.
+ */
+static bool
+steal_runners(struct gensio_data *d, struct selector_s *sel)
+{
+    struct selector_s *from = NULL;
+    unsigned int i, n, most = GENSIO_UNIX_STEAL_MIN - 1;
+
+    if (d->nr_sels <= 1 || sel_runners_queued(sel))
+	return false;
+    for (i = 0; i < d->nr_sels; i++) {
+	if (d->sels[i] == sel)
+	    continue;
+	n = sel_runners_queued(d->sels[i]);
+	if (n > most) {
+	    most = n;
+	    from = d->sels[i];
+	}
+    }
+    if (!from)
+	return false;
+    return sel_steal_runners(sel, from) > 0;
+}
+
 static int
 gensio_unix_service(struct gensio_os_funcs *f, gensio_time *timeout)
 {
     struct gensio_data *d = f->user_data;
+    struct selector_s *sel = thread_service_sel(d);
     struct wait_data w;
-    struct timeval tv, *rtv;
+    struct timeval tv, *rtv, zero = { 0, 0 };
+    sel_wakefd_t *wakefd = NULL;
+    bool stole;
     int err;
 
     w.id = pthread_self();
     w.wake_sig = d->wake_sig;
     rtv = gensio_time_to_timeval(&tv, timeout);
-    err = sel_select_intr(d->sel, wake_thread_send_sig, (long) w.id, &w, rtv);
+    /*
+     * After stealing just poll our own selector, the caller gets to
+     * check what the stolen runners did before waiting.
+     */
+    stole = steal_runners(d, sel);
+    if (stole)
+	rtv = &zero;
+    if (d->use_wakefd)
+	wakefd = get_thread_wakefd();
+    if (wakefd)
+	err = sel_select_intr(sel, sel_wakefd_send_sig, (long) w.id,
+			      wakefd, rtv);
+    else
+	err = sel_select_intr(sel, wake_thread_send_sig, (long) w.id, &w,
+			      rtv);
     if (err < 0)
 	err = gensio_os_err_to_err(f, errno);
-    else if (err == 0)
+    else if (err == 0 && !stole)
 	err = GE_TIMEDOUT;
     else
 	err = 0;
-    timeval_to_gensio_time(timeout, rtv);
+    if (!stole)
+	timeval_to_gensio_time(timeout, rtv);
 
     return err;
 }
@@ -982,9 +1468,34 @@ gensio_unix_free_funcs(struct gensio_os_funcs *f)
     UNLOCK(&defos_lock);
 
     gensio_stdsock_cleanup(f);
+    if (d->timer_cache)
+	gensio_os_funcs_free_cache(f, d->timer_cache);
+    if (d->runner_cache)
+	gensio_os_funcs_free_cache(f, d->runner_cache);
     gensio_memtrack_cleanup(d->mtrack);
-    if (d->freesel)
-	sel_free_selector(d->sel);
+    if (d->freesel) {
+	unsigned int i;
+
+	for (i = 0; i < d->nr_sels; i++)
+	    sel_free_selector(d->sels[i]);
+    }
+#ifdef USE_PTHREADS
+    if (d->rt_key_set)
+	pthread_key_delete(d->rt_key);
+    if (d->nr_sels > 1) {
+	/*
+	 * Note that this does not free the per-thread data of threads
+	 * still running, pthread_key_delete() doesn't do that.
+	 */
+	pthread_key_delete(d->sel_thread_key);
+	LOCK_DESTROY(&d->msel_lock);
+#if GENSIO_UNIX_NUMA
+	gensio_unix_numa_free(d);
+#endif
+	free(d->sel_load);
+	free(d->sels);
+    }
+#endif
     free(f->user_data);
     free(f);
 }
@@ -1018,14 +1529,19 @@ static int
 gensio_handle_fork(struct gensio_os_funcs *f)
 {
     struct gensio_data *d = f->user_data;
+    unsigned int i;
+    int rv = 0;
 
-    return sel_setup_forked_process(d->sel);
+    for (i = 0; !rv && i < d->nr_sels; i++)
+	rv = sel_setup_forked_process(d->sels[i]);
+    return rv;
 }
 
 static int
 gensio_unix_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
 		    intptr_t ofd, struct gensio_iod **riod)
 {
+    struct gensio_data *d = o->user_data;
     struct gensio_iod_unix *iod = NULL;
     bool closefd = false;
     int err = GE_NOMEM, fd = ofd;
@@ -1058,6 +1574,8 @@ gensio_unix_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
     iod->r.f = o;
     iod->fd = fd;
     iod->orig_fd = ofd;
+    iod->sel_idx = thread_alloc_sel(d);
+    iod->sel = d->sels[iod->sel_idx];
     if (type == GENSIO_IOD_STDIO) {
 	struct stat statb;
 
@@ -1093,6 +1611,7 @@ gensio_unix_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
 	}
     }
 
+    update_sel_load(d, iod->sel_idx, 1);
     *riod = &iod->r;
     return 0;
 
@@ -1111,6 +1630,7 @@ gensio_unix_release_iod(struct gensio_iod *iiod)
     struct gensio_os_funcs *o = iod->r.f;
 
     assert(!iod->handlers_set);
+    update_sel_load(o->user_data, iod->sel_idx, -1);
     if (iod->type == GENSIO_IOD_FILE) {
 	o->free_runner(iod->u.file.runner);
 	o->free_lock(iod->u.file.lock);
@@ -1472,12 +1992,61 @@ gensio_unix_pty_control(struct gensio_iod_unix *iod, int op, bool get,
     }
 }
 
+static int
+gensio_unix_pipe_control(struct gensio_iod_unix *iod, int op, bool get,
+			 intptr_t val)
+{
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    int rv;
+
+    if (op != GENSIO_IOD_CONTROL_PIPE_SIZE)
+	return GE_NOTSUP;
+
+    if (get) {
+	rv = fcntl(iod->fd, F_GETPIPE_SZ);
+	if (rv == -1)
+	    return gensio_os_err_to_err(iod->r.f, errno);
+	*((int *) val) = rv;
+    } else {
+	if (val <= 0 || val > INT_MAX)
+	    return GE_INVAL;
+	if (fcntl(iod->fd, F_SETPIPE_SZ, (int) val) == -1)
+	    return gensio_os_err_to_err(iod->r.f, errno);
+    }
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static void
+shard_iod(struct gensio_data *d, struct gensio_iod_unix *iod, intptr_t shard)
+{
+    unsigned int idx;
+
+    if (d->nr_sels <= 1 || shard < 0)
+	return;
+
+    idx = shard % d->nr_sels;
+    update_sel_load(d, iod->sel_idx, -1);
+    update_sel_load(d, idx, 1);
+    iod->sel_idx = idx;
+    iod->sel = d->sels[idx];
+    iod->sharded = true;
+}
+
 static int
 gensio_unix_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
 
     if (iod->type == GENSIO_IOD_SOCKET) {
+	if (op == GENSIO_IOD_CONTROL_SHARD) {
+	    if (get || iod->handlers_set)
+		return GE_NOTSUP;
+	    shard_iod(iiod->f->user_data, iod, val);
+	    return 0;
+	}
 	if (op != GENSIO_IOD_CONTROL_SOCKINFO)
 	    return GE_NOTSUP;
 
@@ -1492,6 +2061,9 @@ gensio_unix_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
     if (iod->type == GENSIO_IOD_PTY)
 	return gensio_unix_pty_control(iod, op, get, val);
 
+    if (iod->type == GENSIO_IOD_PIPE)
+	return gensio_unix_pipe_control(iod, op, get, val);
+
     if (iod->type != GENSIO_IOD_DEV)
 	return GE_NOTSUP;
 
@@ -1558,46 +2130,545 @@ gensio_unix_get_random(struct gensio_os_funcs *o,
     return gensio_os_err_to_err(o, rv);
 }
 
-static int
-gensio_unix_control(struct gensio_os_funcs *o, int func, void *data,
-		    gensiods *datalen)
+#ifdef USE_PTHREADS
+/*
+ * Move a newly accepted socket to the least loaded selector.  Ties
+ * are broken round-robin.  The rest of the current handler then
+ * allocates on that selector, too, so the gensio built on the socket
+ * ends up all on the same thread.
+ */
+static void
+place_accepted_iod(struct gensio_data *d, struct gensio_iod_unix *iod)
 {
-    struct gensio_data *d = o->user_data;
-
-    switch (func) {
-    case GENSIO_CONTROL_SET_PROC_DATA:
-	d->pdata = data;
-	return 0;
+    struct gensio_sel_thread *t = get_sel_thread(d);
+    unsigned int i, idx, best;
 
-    default:
-	return GE_NOTSUP;
+    LOCK(&d->msel_lock);
+    best = d->next_accept++ % d->nr_sels;
+    for (i = 1; i < d->nr_sels; i++) {
+	idx = (best + i) % d->nr_sels;
+	if (d->sel_load[idx] < d->sel_load[best])
+	    best = idx;
     }
+    d->sel_load[iod->sel_idx]--;
+    d->sel_load[best]++;
+    UNLOCK(&d->msel_lock);
+
+    iod->sel_idx = best;
+    iod->sel = d->sels[best];
+    if (t)
+	t->cur = best;
 }
 
-static struct gensio_os_funcs *
-gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
+/*
+ * Accepted sockets from a sharded listener stay on the listener's
+ * selector, the kernel has already done the balancing.
+ */
+static void
+place_sharded_iod(struct gensio_data *d, struct gensio_iod_unix *liod,
+		  struct gensio_iod_unix *iod)
 {
-    struct gensio_data *d;
-    struct gensio_os_funcs *o;
+    struct gensio_sel_thread *t = get_sel_thread(d);
 
-    o = malloc(sizeof(*o));
-    if (!o)
-	return NULL;
-    memset(o, 0, sizeof(*o));
+    update_sel_load(d, iod->sel_idx, -1);
+    update_sel_load(d, liod->sel_idx, 1);
+    iod->sel_idx = liod->sel_idx;
+    iod->sel = liod->sel;
+    if (t)
+	t->cur = liod->sel_idx;
+}
 
-    d = malloc(sizeof(*d));
-    if (!d) {
-	free(o);
-	return NULL;
-    }
-    memset(d, 0, sizeof(*d));
-    LOCK_INIT(&d->reflock);
-    d->refcount = 1;
+#endif
+
+#if GENSIO_UNIX_NUMA
+/* Parse a sysfs cpu list like "0-3,8-11" into set. */
+static void
+numa_parse_cpulist(const char *str, cpu_set_t *set, unsigned int *max_cpu)
+{
+    unsigned long start, end;
+    char *end_str;
+
+    while (*str && *str != '\n') {
+	start = strtoul(str, &end_str, 10);
+	if (end_str == str)
+	    return;
+	end = start;
+	if (*end_str == '-')
+	    end = strtoul(end_str + 1, &end_str, 10);
+	for (; start <= end && start < CPU_SETSIZE; start++) {
+	    CPU_SET(start, set);
+	    if (start + 1 > *max_cpu)
+		*max_cpu = start + 1;
+	}
+	str = end_str;
+	if (*str == ',')
+	    str++;
+    }
+}
+
+/*
+ * Get the nodes and their CPUs from sysfs and spread the selectors
+ * over the nodes in contiguous blocks.  Nodes are numbered in the
+ * order found, which may not match the kernel's numbers if there are
+ * holes.
+ */
+static int
+gensio_unix_numa_setup(struct gensio_data *d)
+{
+    DIR *dir;
+    struct dirent *e;
+    unsigned int i, n, nr_nodes = 0, max_cpu = 0;
+    cpu_set_t *cpus = NULL, *tmp;
+    char path[300], buf[1024];
+    FILE *f;
+    int rv = GE_NOMEM;
+
+    if (d->nr_sels <= 1)
+	return GE_NOTSUP;
+    if (d->sel_node) {
+	/* Already set up, turning it back on. */
+	d->numa = true;
+	return 0;
+    }
+
+    dir = opendir("/sys/devices/system/node");
+    if (!dir)
+	return GE_NOTSUP;
+    while ((e = readdir(dir))) {
+	if (strncmp(e->d_name, "node", 4) != 0 ||
+		sscanf(e->d_name + 4, "%u", &n) != 1)
+	    continue;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist",
+		 e->d_name);
+	f = fopen(path, "r");
+	if (!f)
+	    continue;
+	if (!fgets(buf, sizeof(buf), f)) {
+	    fclose(f);
+	    continue;
+	}
+	fclose(f);
+	tmp = realloc(cpus, sizeof(*cpus) * (nr_nodes + 1));
+	if (!tmp)
+	    goto out;
+	cpus = tmp;
+	CPU_ZERO(&cpus[nr_nodes]);
+	numa_parse_cpulist(buf, &cpus[nr_nodes], &max_cpu);
+	if (CPU_COUNT(&cpus[nr_nodes]) > 0) /* Memory only nodes. */
+	    nr_nodes++;
+    }
+    if (nr_nodes == 0) {
+	rv = GE_NOTSUP;
+	goto out;
+    }
+
+    d->node_cpus = cpus;
+    cpus = NULL;
+    d->nr_nodes = nr_nodes;
+    d->nr_cpus = max_cpu;
+    d->cpu_node = calloc(max_cpu, sizeof(*d->cpu_node));
+    d->sel_node = calloc(d->nr_sels, sizeof(*d->sel_node));
+    if (!d->cpu_node || !d->sel_node) {
+	gensio_unix_numa_free(d);
+	goto out;
+    }
+    for (n = 0; n < nr_nodes; n++) {
+	for (i = 0; i < max_cpu; i++) {
+	    if (CPU_ISSET(i, &d->node_cpus[n]))
+		d->cpu_node[i] = n;
+	}
+    }
+    for (i = 0; i < d->nr_sels; i++)
+	d->sel_node[i] = i * nr_nodes / d->nr_sels;
+    d->numa = true;
+    rv = 0;
+ out:
+    closedir(dir);
+    free(cpus);
+    return rv;
+}
+
+/* The node of the CPU the calling thread is on. */
+static unsigned int
+numa_curr_node(struct gensio_data *d)
+{
+    int cpu = sched_getcpu();
+
+    if (cpu < 0 || (unsigned int) cpu >= d->nr_cpus)
+	return 0;
+    return d->cpu_node[cpu];
+}
+
+/*
+ * Put a new connection on the node whose CPU handled its incoming
+ * packets, the kernel tells us that with SO_INCOMING_CPU.  A sharded
+ * listener already on that node keeps it, otherwise the least loaded
+ * selector on the node is used.  Returns false if the node can't be
+ * found or has no selectors, use the normal placement then.
+ */
+static bool
+place_numa_iod(struct gensio_data *d, struct gensio_iod_unix *liod,
+	       struct gensio_iod_unix *iod)
+{
+#ifdef SO_INCOMING_CPU
+    struct gensio_sel_thread *t = get_sel_thread(d);
+    int cpu;
+    socklen_t len = sizeof(cpu);
+    unsigned int i, node, best = d->nr_sels;
+
+    if (getsockopt(iod->fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) ||
+		cpu < 0 || (unsigned int) cpu >= d->nr_cpus)
+	return false;
+    node = d->cpu_node[cpu];
+    if (liod->sharded && d->sel_node[liod->sel_idx] == node)
+	return false;
+
+    LOCK(&d->msel_lock);
+    for (i = 0; i < d->nr_sels; i++) {
+	if (d->sel_node[i] != node)
+	    continue;
+	if (best == d->nr_sels || d->sel_load[i] < d->sel_load[best])
+	    best = i;
+    }
+    if (best == d->nr_sels) {
+	UNLOCK(&d->msel_lock);
+	return false;
+    }
+    d->sel_load[iod->sel_idx]--;
+    d->sel_load[best]++;
+    UNLOCK(&d->msel_lock);
+
+    iod->sel_idx = best;
+    iod->sel = d->sels[best];
+    if (t)
+	t->cur = best;
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+static int
+gensio_unix_accept(struct gensio_iod *iod, struct gensio_addr **raddr,
+		   struct gensio_iod **newiod)
+{
+    struct gensio_data *d = iod->f->user_data;
+    int rv;
+
+    rv = d->orig_accept(iod, raddr, newiod);
+#ifdef USE_PTHREADS
+    if (!rv && d->nr_sels > 1) {
+	struct gensio_iod_unix *liod = i_to_sel(iod);
+	struct gensio_iod_unix *niod = i_to_sel(*newiod);
+
+#if GENSIO_UNIX_NUMA
+	if (d->numa && place_numa_iod(d, liod, niod))
+	    return 0;
+#endif
+	if (liod->sharded)
+	    place_sharded_iod(d, liod, niod);
+	else
+	    place_accepted_iod(d, niod);
+    }
+#endif
+    return rv;
+}
+
+/* Report the user's handlers for long callbacks, not our wrappers. */
+static void
+gensio_unix_loop_resolve(int type, void **handler, void **cb_data)
+{
+    if (*handler == (void *) iod_read_handler) {
+	struct gensio_iod_unix *iod = *cb_data;
+
+	*handler = (void *) iod->read_handler;
+	*cb_data = iod->cb_data;
+    } else if (*handler == (void *) iod_write_handler) {
+	struct gensio_iod_unix *iod = *cb_data;
+
+	*handler = (void *) iod->write_handler;
+	*cb_data = iod->cb_data;
+    } else if (*handler == (void *) iod_except_handler) {
+	struct gensio_iod_unix *iod = *cb_data;
+
+	*handler = (void *) iod->except_handler;
+	*cb_data = iod->cb_data;
+    } else if (*handler == (void *) gensio_timeout_handler) {
+	struct gensio_timer *timer = *cb_data;
+
+	*handler = (void *) timer->handler;
+	*cb_data = timer->cb_data;
+    } else if (*handler == (void *) gensio_runner_handler) {
+	struct gensio_runner *runner = *cb_data;
+
+	*handler = (void *) runner->handler;
+	*cb_data = runner->cb_data;
+    }
+}
+
+/*
+ * Lock all memory, and set the priority threads waiting on the os
+ * funcs pick up the next time they wait.  The priority is tried on
+ * the calling thread first so permission problems are reported.
+ */
+static int
+gensio_unix_set_realtime(struct gensio_os_funcs *o, struct gensio_data *d,
+			 unsigned int *prio)
+{
+#ifdef USE_PTHREADS
+    struct sched_param old, p;
+    int policy, err;
+#endif
+
+    if (!prio) {
+	if (d->realtime)
+	    munlockall();
+	d->realtime = false;
+#ifdef USE_PTHREADS
+	if (d->rt_prio) {
+	    d->rt_prio = 0;
+	    __atomic_add_fetch(&d->rt_gen, 1, __ATOMIC_RELEASE);
+	}
+#endif
+	return 0;
+    }
+
+#ifdef USE_PTHREADS
+    if (*prio) {
+	if ((int) *prio < sched_get_priority_min(SCHED_FIFO) ||
+		(int) *prio > sched_get_priority_max(SCHED_FIFO))
+	    return GE_INVAL;
+	err = pthread_getschedparam(pthread_self(), &policy, &old);
+	if (err)
+	    return gensio_os_err_to_err(o, err);
+	memset(&p, 0, sizeof(p));
+	p.sched_priority = *prio;
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &p);
+	if (err)
+	    return gensio_os_err_to_err(o, err);
+	pthread_setschedparam(pthread_self(), policy, &old);
+    }
+    LOCK(&d->reflock);
+    if (!d->rt_key_set)
+	d->rt_key_set = pthread_key_create(&d->rt_key, NULL) == 0;
+    UNLOCK(&d->reflock);
+    if (!d->rt_key_set)
+	return GE_NOMEM;
+#else
+    if (*prio)
+	return GE_NOTSUP;
+#endif
+
+    if (!d->realtime && mlockall(MCL_CURRENT | MCL_FUTURE))
+	return gensio_os_err_to_err(o, errno);
+    d->realtime = true;
+#ifdef USE_PTHREADS
+    d->rt_prio = *prio;
+    __atomic_add_fetch(&d->rt_gen, 1, __ATOMIC_RELEASE);
+#endif
+    return 0;
+}
+
+#define LOOP_MAX(f) if (s.f > stats->f) stats->f = s.f
+
+/* Combine the stats from all the selectors. */
+static int
+gensio_unix_get_loop_stats(struct gensio_data *d,
+			   struct gensio_loop_stats *stats)
+{
+    struct sel_loop_stats s;
+    unsigned int i, j;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < d->nr_sels; i++) {
+	if (sel_get_loop_stats(d->sels[i], &s))
+	    return GE_NOTREADY;
+	LOOP_MAX(elapsed_nsecs);
+	stats->wakeups += s.wakeups;
+	stats->iterations += s.iterations;
+	stats->iter_nsecs += s.iter_nsecs;
+	LOOP_MAX(iter_max_nsecs);
+	stats->callbacks += s.callbacks;
+	stats->cb_nsecs += s.cb_nsecs;
+	LOOP_MAX(cb_max_nsecs);
+	stats->long_cb_nsecs = s.long_cb_nsecs;
+	stats->long_cbs += s.long_cbs;
+	stats->timers += s.timers;
+	stats->timer_late_nsecs += s.timer_late_nsecs;
+	LOOP_MAX(timer_late_max_nsecs);
+	stats->runner_batches += s.runner_batches;
+	stats->runners += s.runners;
+	LOOP_MAX(runner_depth_max);
+	stats->runners_stolen += s.runners_stolen;
+	if (i < GENSIO_LOOP_NR_QUEUES) {
+	    stats->runner_queued[i] = s.runner_queued;
+	    stats->nr_queues = i + 1;
+	}
+	stats->busy_poll_hits += s.busy_poll_hits;
+	stats->busy_poll_blocks += s.busy_poll_blocks;
+	stats->busy_poll_nsecs += s.busy_poll_nsecs;
+	for (j = 0; j < s.nr_recent_long &&
+		 stats->nr_recent_long < GENSIO_LOOP_NR_LONG_CBS; j++) {
+	    struct gensio_loop_long_cb *l;
+
+	    l = &stats->recent_long[stats->nr_recent_long++];
+	    l->type = s.recent_long[j].type;
+	    l->handler = s.recent_long[j].handler;
+	    l->cb_data = s.recent_long[j].cb_data;
+	    l->nsecs = s.recent_long[j].nsecs;
+	}
+    }
+    return 0;
+}
+
+static int
+gensio_unix_control(struct gensio_os_funcs *o, int func, void *data,
+		    gensiods *datalen)
+{
+    struct gensio_data *d = o->user_data;
+
+    switch (func) {
+    case GENSIO_CONTROL_SET_PROC_DATA:
+	d->pdata = data;
+	return 0;
+
+    case GENSIO_CONTROL_GET_CACHE_STATS: {
+	struct gensio_memcache_stats *stats = data;
+	struct gensio_memcache *caches[2];
+	gensiods i, n = 0;
+
+	if (d->timer_cache)
+	    caches[n++] = d->timer_cache;
+	if (d->runner_cache)
+	    caches[n++] = d->runner_cache;
+	for (i = 0; i < n && i < *datalen; i++)
+	    gensio_os_funcs_cache_stats(o, caches[i], &stats[i]);
+	*datalen = n;
+	return 0;
+    }
+
+    case GENSIO_CONTROL_SET_LOOP_STATS: {
+	unsigned int i;
+
+	for (i = 0; i < d->nr_sels; i++)
+	    sel_set_loop_stats(d->sels[i], !!data,
+			       data ? *((unsigned int *) data) : 0,
+			       gensio_unix_loop_resolve);
+	return 0;
+    }
+
+    case GENSIO_CONTROL_GET_LOOP_STATS:
+	return gensio_unix_get_loop_stats(d, data);
+
+    case GENSIO_CONTROL_SET_COARSE_TIME: {
+	unsigned int i;
+
+	for (i = 0; i < d->nr_sels; i++)
+	    sel_set_timer_slack(d->sels[i],
+				data ? *((unsigned int *) data) : 0);
+	__atomic_store_n(&d->coarse_time, !!data, __ATOMIC_RELAXED);
+	return 0;
+    }
+
+    case GENSIO_CONTROL_SET_BUSY_POLL: {
+	unsigned int i;
+	int rv;
+
+	for (i = 0; i < d->nr_sels; i++) {
+	    rv = sel_set_busy_poll(d->sels[i], *((unsigned int *) data));
+	    if (rv == ENOSYS)
+		return GE_NOTSUP;
+	    if (rv)
+		return gensio_os_err_to_err(o, rv);
+	}
+	return 0;
+    }
+
+    case GENSIO_CONTROL_SET_REALTIME:
+	return gensio_unix_set_realtime(o, d, data);
+
+    case GENSIO_CONTROL_GET_REALTIME:
+	return d->realtime ? 0 : GE_NOTREADY;
+
+    case GENSIO_CONTROL_SET_NUMA:
+#if GENSIO_UNIX_NUMA
+	if (!*((bool *) data)) {
+	    /* Threads already pinned stay pinned. */
+	    d->numa = false;
+	    return 0;
+	}
+	return gensio_unix_numa_setup(d);
+#else
+	return GE_NOTSUP;
+#endif
+
+    case GENSIO_CONTROL_GET_NUMA_NODE:
+#if GENSIO_UNIX_NUMA
+	if (!d->numa)
+	    return GE_NOTSUP;
+	*((unsigned int *) data) = numa_curr_node(d);
+	return 0;
+#else
+	return GE_NOTSUP;
+#endif
+
+    case GENSIO_CONTROL_GET_LOOP_TIME: {
+	struct timeval tv;
+
+	if (__atomic_load_n(&d->coarse_time, __ATOMIC_RELAXED))
+	    sel_get_coarse_monotonic_time(&tv);
+	else
+	    sel_get_monotonic_time(&tv);
+	timeval_to_gensio_time(data, &tv);
+	return 0;
+    }
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct gensio_os_funcs *
+gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
+{
+    struct gensio_data *d;
+    struct gensio_os_funcs *o;
+
+    o = malloc(sizeof(*o));
+    if (!o)
+	return NULL;
+    memset(o, 0, sizeof(*o));
+
+    d = malloc(sizeof(*d));
+    if (!d) {
+	free(o);
+	return NULL;
+    }
+    memset(d, 0, sizeof(*d));
+    LOCK_INIT(&d->reflock);
+    d->refcount = 1;
 
     o->user_data = d;
     d->sel = sel;
+    d->sels = &d->sel;
+    d->nr_sels = 1;
     d->wake_sig = wake_sig;
     d->mtrack = gensio_memtrack_alloc();
+#ifdef USE_PTHREADS
+    /*
+     * Wake threads with a write to a per-thread eventfd instead of
+     * sending them wake_sig, if asked to and the selector can do it.
+     * kevent() cannot atomically change the signal mask, so with
+     * kqueue this is always done (using an EVFILT_USER event).
+     */
+#if defined(HAVE_KQUEUE) && !defined(HAVE_EPOLL_PWAIT)
+    if (wake_sig)
+#else
+    if (wake_sig && getenv("GENSIO_SEL_WAKE_EVENTFD"))
+#endif
+	d->use_wakefd = sel_wakefd_supported(sel);
+#endif
 
     o->zalloc = gensio_unix_zalloc;
     o->free = gensio_unix_free;
@@ -1662,6 +2733,22 @@ gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
 	return NULL;
     }
 
+    /* Catch accepts to place new connections in multi-selector mode. */
+    d->orig_accept = o->accept;
+    o->accept = gensio_unix_accept;
+
+    /*
+     * Timers and runners are allocated and freed a lot.  Don't cache
+     * when tracking memory, the tracker needs to see each free.  If
+     * these fail, plain allocation is used.
+     */
+    if (!d->mtrack) {
+	d->timer_cache = gensio_os_funcs_alloc_cache(o,
+					sizeof(struct gensio_timer), "timer");
+	d->runner_cache = gensio_os_funcs_alloc_cache(o,
+					sizeof(struct gensio_runner), "runner");
+    }
+
     return o;
 }
 
@@ -2182,6 +3269,217 @@ int gensio_os_wait_thread(struct gensio_thread *tid)
 #endif
 }
 
+int
+gensio_os_interrupt_thread(struct gensio_thread *tid)
+{
+#ifdef USE_PTHREADS
+    struct gensio_os_funcs *o = tid->o;
+    int sig, rv;
+
+    if (!o->get_wake_sig)
+	return GE_NOTSUP;
+    sig = o->get_wake_sig(o);
+    if (!sig)
+	return GE_NOTSUP;
+    rv = pthread_kill(tid->id, sig);
+    if (rv)
+	return gensio_os_err_to_err(o, rv);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+struct gensio_thread_sem {
+    struct gensio_os_funcs *o;
+#ifdef USE_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    unsigned int count;
+};
+
+int
+gensio_os_new_sem(struct gensio_os_funcs *o, struct gensio_thread_sem **rsem)
+{
+#ifdef USE_PTHREADS
+    struct gensio_thread_sem *sem;
+
+    sem = o->zalloc(o, sizeof(*sem));
+    if (!sem)
+	return GE_NOMEM;
+    sem->o = o;
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    *rsem = sem;
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+void
+gensio_os_free_sem(struct gensio_thread_sem *sem)
+{
+#ifdef USE_PTHREADS
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->lock);
+    sem->o->free(sem->o, sem);
+#endif
+}
+
+void
+gensio_os_sem_wait(struct gensio_thread_sem *sem)
+{
+#ifdef USE_PTHREADS
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0)
+	pthread_cond_wait(&sem->cond, &sem->lock);
+    sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+#endif
+}
+
+void
+gensio_os_sem_post(struct gensio_thread_sem *sem)
+{
+#ifdef USE_PTHREADS
+    pthread_mutex_lock(&sem->lock);
+    sem->count++;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+#endif
+}
+
+#ifdef USE_PTHREADS
+/*
+ * Attributes for the library's own threads, copied so the user's
+ * memory isn't needed later.
+ */
+static lock_type helper_attr_lock = LOCK_INITIALIZER;
+static bool helper_attr_set;
+static struct gensio_thread_attr helper_attr;
+static char helper_attr_name[32];
+static unsigned char helper_attr_cpus[GENSIO_THREAD_ATTR_MAX_CPUS / 8];
+
+static int
+unix_thread_set_attr(struct gensio_os_funcs *o,
+		     const struct gensio_thread_attr *attr)
+{
+    int rv, err = 0;
+
+    if (attr->name) {
+#ifdef linux
+	char name[16];
+
+	strncpy(name, attr->name, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+	rv = pthread_setname_np(pthread_self(), name);
+	if (rv && !err)
+	    err = gensio_os_err_to_err(o, rv);
+#else
+	if (!err)
+	    err = GE_NOTSUP;
+#endif
+    }
+
+    if (attr->cpus && attr->cpus_len) {
+#ifdef linux
+	cpu_set_t set;
+	unsigned int i;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < attr->cpus_len * 8 && i < CPU_SETSIZE; i++) {
+	    if (attr->cpus[i / 8] & (1 << (i % 8)))
+		CPU_SET(i, &set);
+	}
+	rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rv && !err)
+	    err = gensio_os_err_to_err(o, rv);
+#else
+	if (!err)
+	    err = GE_NOTSUP;
+#endif
+    }
+
+    if (attr->fifo_priority) {
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = attr->fifo_priority;
+	rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (rv && !err)
+	    err = gensio_os_err_to_err(o, rv);
+    }
+
+    return err;
+}
+#endif
+
+int
+gensio_os_thread_set_attr(struct gensio_os_funcs *o,
+			  const struct gensio_thread_attr *attr)
+{
+#ifdef USE_PTHREADS
+    struct gensio_thread_attr hattr;
+    char hname[sizeof(helper_attr_name)];
+    unsigned char hcpus[sizeof(helper_attr_cpus)];
+
+    if (!attr) {
+	LOCK(&helper_attr_lock);
+	if (!helper_attr_set) {
+	    UNLOCK(&helper_attr_lock);
+	    return 0;
+	}
+	hattr = helper_attr;
+	if (hattr.name) {
+	    memcpy(hname, helper_attr_name, sizeof(hname));
+	    hattr.name = hname;
+	}
+	if (hattr.cpus) {
+	    memcpy(hcpus, helper_attr_cpus, hattr.cpus_len);
+	    hattr.cpus = hcpus;
+	}
+	UNLOCK(&helper_attr_lock);
+	attr = &hattr;
+    }
+    return unix_thread_set_attr(o, attr);
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+int
+gensio_os_set_helper_thread_attr(struct gensio_os_funcs *o,
+				 const struct gensio_thread_attr *attr)
+{
+#ifdef USE_PTHREADS
+    if (attr && attr->cpus && attr->cpus_len > sizeof(helper_attr_cpus))
+	return GE_TOOBIG;
+
+    LOCK(&helper_attr_lock);
+    helper_attr_set = !!attr;
+    if (attr) {
+	helper_attr = *attr;
+	if (attr->name) {
+	    strncpy(helper_attr_name, attr->name,
+		    sizeof(helper_attr_name) - 1);
+	    helper_attr.name = helper_attr_name;
+	}
+	if (attr->cpus && attr->cpus_len) {
+	    memcpy(helper_attr_cpus, attr->cpus, attr->cpus_len);
+	    helper_attr.cpus = helper_attr_cpus;
+	} else {
+	    helper_attr.cpus = NULL;
+	}
+    }
+    UNLOCK(&helper_attr_lock);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 
 int
 gensio_i_os_err_to_err(struct gensio_os_funcs *o,
@@ -2301,6 +3599,114 @@ gensio_unix_funcs_alloc(struct selector_s *sel, int wake_sig,
     return 0;
 }
 
+int
+gensio_unix_funcs_alloc_multi(unsigned int nr_sels, int wake_sig,
+			      struct gensio_os_funcs **ro)
+{
+#ifdef USE_PTHREADS
+    struct gensio_os_funcs *o = NULL;
+    struct gensio_data *d;
+    struct selector_s **sels;
+    unsigned int *sel_load, i;
+    int rv = GE_NOMEM;
+
+    if (nr_sels == 0)
+	return GE_INVAL;
+    if (nr_sels == 1)
+	return gensio_unix_funcs_alloc(NULL, wake_sig, ro);
+
+    sels = calloc(nr_sels, sizeof(*sels));
+    sel_load = calloc(nr_sels * 3, sizeof(*sel_load));
+    if (!sels || !sel_load)
+	goto out_err;
+    for (i = 0; i < nr_sels; i++) {
+	if (sel_alloc_selector_thread(&sels[i], wake_sig,
+				      defsel_lock_alloc,
+				      defsel_lock_free, defsel_lock,
+				      defsel_unlock, NULL))
+	    goto out_err;
+    }
+
+    o = gensio_unix_alloc_sel(sels[0], wake_sig);
+    if (!o)
+	goto out_err;
+    d = o->user_data;
+    if (pthread_key_create(&d->sel_thread_key, sel_thread_free))
+	goto out_err;
+    LOCK_INIT(&d->msel_lock);
+    d->freesel = true;
+    d->sels = sels;
+    /* The three per-selector counts share one allocation. */
+    d->sel_load = sel_load;
+    d->sel_servers = sel_load + nr_sels;
+    d->sel_waiters = sel_load + nr_sels * 2;
+    d->nr_sels = nr_sels;
+
+    *ro = o;
+    return 0;
+
+ out_err:
+    if (o) {
+	gensio_stdsock_cleanup(o);
+	gensio_memtrack_cleanup(((struct gensio_data *) o->user_data)->mtrack);
+	free(o->user_data);
+	free(o);
+    }
+    if (sels) {
+	for (i = 0; i < nr_sels && sels[i]; i++)
+	    sel_free_selector(sels[i]);
+	free(sels);
+    }
+    free(sel_load);
+    return rv;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static struct selector_s *
+gensio_unix_poll_sel(struct gensio_os_funcs *o)
+{
+    struct gensio_data *d;
+
+    if (!o || o->service != gensio_unix_service)
+	return NULL;
+    d = o->user_data;
+    if (d->nr_sels > 1)
+	return NULL;
+    return d->sel;
+}
+
+int
+gensio_unix_funcs_get_poll_fd(struct gensio_os_funcs *o, int *fd)
+{
+    struct selector_s *sel = gensio_unix_poll_sel(o);
+    int pfd;
+
+    if (!sel)
+	return GE_NOTSUP;
+    pfd = sel_get_poll_fd(sel);
+    if (pfd < 0)
+	return GE_NOTSUP;
+    *fd = pfd;
+    return 0;
+}
+
+int
+gensio_unix_funcs_next_timeout(struct gensio_os_funcs *o,
+			       gensio_time *timeout)
+{
+    struct selector_s *sel = gensio_unix_poll_sel(o);
+    struct timeval tv;
+
+    if (!sel)
+	return GE_NOTSUP;
+    if (sel_get_next_timeout(sel, &tv))
+	return GE_NOTFOUND;
+    timeval_to_gensio_time(timeout, &tv);
+    return 0;
+}
+
 struct gensio_os_funcs *
 gensio_selector_alloc(struct selector_s *sel, int wake_sig)
 {
@@ -44,6 +44,7 @@
 #endif
 
 static void win_finish_free(struct gensio_os_funcs *o);
+static void win_apply_helper_attr(struct gensio_os_funcs *o, HANDLE h);
 
 static DWORD
 gensio_time_to_ms(struct gensio_time *time)
@@ -350,6 +351,7 @@ win_alloc_iod(struct gensio_os_funcs *o, unsigned int size, int fd,
 				     &wiod->threadid);
 	if (!wiod->threadh)
 	    goto out_err;
+	win_apply_helper_attr(o, wiod->threadh);
     }
 
     glock_lock(d);
@@ -2767,6 +2769,7 @@ win_pty_control(struct gensio_iod_win *wiod, int op, bool get, intptr_t val)
 	    if (!piod->watch_thread) {
 		err = gensio_os_err_to_err(o, GetLastError());
 	    } else {
+		win_apply_helper_attr(o, piod->watch_thread);
 		err = gensio_win_pty_start(o, piod->ptyh,
 					   &piod->child_in, &piod->child_out,
 					   piod->argv,
@@ -3781,6 +3784,7 @@ gensio_win_funcs_alloc(struct gensio_os_funcs **ro)
     d->timerth = CreateThread(NULL, 0, timer_thread, o, 0, &d->timerthid);
     if (!d->timerth)
 	goto out_err;
+    win_apply_helper_attr(o, d->timerth);
 
     o->zalloc = win_zalloc;
     o->free = win_free;
@@ -4157,6 +4161,156 @@ int gensio_os_wait_thread(struct gensio_thread *tid)
     return 0;
 }
 
+int
+gensio_os_interrupt_thread(struct gensio_thread *tid)
+{
+    return GE_NOTSUP;
+}
+
+/*
+ * Not done on Windows yet, users fall back to not using their own
+ * threads.
+ */
+int
+gensio_os_new_sem(struct gensio_os_funcs *o, struct gensio_thread_sem **rsem)
+{
+    return GE_NOTSUP;
+}
+
+void
+gensio_os_free_sem(struct gensio_thread_sem *sem)
+{
+}
+
+void
+gensio_os_sem_wait(struct gensio_thread_sem *sem)
+{
+}
+
+void
+gensio_os_sem_post(struct gensio_thread_sem *sem)
+{
+}
+
+typedef HRESULT (WINAPI *set_thread_desc_func)(HANDLE, PCWSTR);
+
+static int
+win_thread_apply_attr(struct gensio_os_funcs *o, HANDLE h,
+		      const struct gensio_thread_attr *attr)
+{
+    int err = 0;
+
+    if (attr->name) {
+	/* Only in newer Windows versions, so look it up. */
+	set_thread_desc_func setdesc;
+	WCHAR wname[64];
+
+	setdesc = (set_thread_desc_func)
+	    (void *) GetProcAddress(GetModuleHandleA("kernel32.dll"),
+				    "SetThreadDescription");
+	if (!setdesc) {
+	    err = GE_NOTSUP;
+	} else if (!MultiByteToWideChar(CP_UTF8, 0, attr->name, -1, wname,
+					sizeof(wname) / sizeof(WCHAR))) {
+	    err = GE_TOOBIG;
+	} else if (FAILED(setdesc(h, wname))) {
+	    err = GE_INVAL;
+	}
+    }
+
+    if (attr->cpus && attr->cpus_len) {
+	/* Only the first processor group is supported. */
+	DWORD_PTR mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < attr->cpus_len * 8 && i < sizeof(mask) * 8; i++) {
+	    if (attr->cpus[i / 8] & (1 << (i % 8)))
+		mask |= ((DWORD_PTR) 1) << i;
+	}
+	if (!mask) {
+	    if (!err)
+		err = GE_INVAL;
+	} else if (!SetThreadAffinityMask(h, mask) && !err) {
+	    err = gensio_os_err_to_err(o, GetLastError());
+	}
+    }
+
+    if (attr->fifo_priority) {
+	/* No FIFO class, map the top half of the range to time critical. */
+	int prio = THREAD_PRIORITY_HIGHEST;
+
+	if (attr->fifo_priority >= 50)
+	    prio = THREAD_PRIORITY_TIME_CRITICAL;
+	if (!SetThreadPriority(h, prio) && !err)
+	    err = gensio_os_err_to_err(o, GetLastError());
+    }
+
+    return err;
+}
+
+/*
+ * Attributes for the library's own threads, copied so the user's
+ * memory isn't needed later.
+ */
+static SRWLOCK helper_attr_lock = SRWLOCK_INIT;
+static bool helper_attr_set;
+static struct gensio_thread_attr helper_attr;
+static char helper_attr_name[32];
+static unsigned char helper_attr_cpus[GENSIO_THREAD_ATTR_MAX_CPUS / 8];
+
+static void
+win_apply_helper_attr(struct gensio_os_funcs *o, HANDLE h)
+{
+    AcquireSRWLockShared(&helper_attr_lock);
+    if (helper_attr_set)
+	win_thread_apply_attr(o, h, &helper_attr);
+    ReleaseSRWLockShared(&helper_attr_lock);
+}
+
+int
+gensio_os_thread_set_attr(struct gensio_os_funcs *o,
+			  const struct gensio_thread_attr *attr)
+{
+    if (!attr) {
+	win_apply_helper_attr(o, GetCurrentThread());
+	return 0;
+    }
+    return win_thread_apply_attr(o, GetCurrentThread(), attr);
+}
+
+int
+gensio_os_set_helper_thread_attr(struct gensio_os_funcs *o,
+				 const struct gensio_thread_attr *attr)
+{
+    struct gensio_data *d = o->user_data;
+
+    if (attr && attr->cpus && attr->cpus_len > sizeof(helper_attr_cpus))
+	return GE_TOOBIG;
+
+    AcquireSRWLockExclusive(&helper_attr_lock);
+    helper_attr_set = !!attr;
+    if (attr) {
+	helper_attr = *attr;
+	if (attr->name) {
+	    strncpy(helper_attr_name, attr->name,
+		    sizeof(helper_attr_name) - 1);
+	    helper_attr.name = helper_attr_name;
+	}
+	if (attr->cpus && attr->cpus_len) {
+	    memcpy(helper_attr_cpus, attr->cpus, attr->cpus_len);
+	    helper_attr.cpus = helper_attr_cpus;
+	} else {
+	    helper_attr.cpus = NULL;
+	}
+    }
+    ReleaseSRWLockExclusive(&helper_attr_lock);
+
+    /* The timer thread was started with the os funcs. */
+    if (d->timerth)
+	win_apply_helper_attr(o, d->timerth);
+    return 0;
+}
+
 int
 gensio_i_os_err_to_err(struct gensio_os_funcs *o,
 		       int oserr, const char *caller, const char *file,
@@ -25,20 +25,58 @@
 #include <syslog.h>
 #include <string.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#if defined(HAVE_KQUEUE) && defined(HAVE_EPOLL_PWAIT)
+/* Prefer epoll if both are available. */
+#undef HAVE_KQUEUE
+#endif
 #ifdef HAVE_EPOLL_PWAIT
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
+/* kqueue uses the same operations as epoll for sel_update_fd(). */
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
 #else
 #define EPOLL_CTL_ADD 0
 #define EPOLL_CTL_DEL 0
 #define EPOLL_CTL_MOD 0
 #endif
+#if defined(HAVE_EPOLL_PWAIT) || (defined(HAVE_KQUEUE) && defined(EVFILT_USER))
+/* Threads can wait with a sel_wakefd_t, see sel_alloc_wakefd(). */
+#define SEL_HAVE_WAKEFD
+#endif
+#if defined(HAVE_IO_URING) && !defined(HAVE_EPOLL_PWAIT)
+/* The io_uring poller piggybacks on the epoll event handling. */
+#undef HAVE_IO_URING
+#endif
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <endian.h>
+#endif
 #include "errtrig.h"
+#include "gensio_probes.h"
 
 #ifndef EBADFD
 /* At least MacOS doesn't have EBADFD. */
 #define EBADFD EBADF
 #endif
 
+/*
+ * Maximum number of events epoll (or kqueue) can return in a single
+ * call.  The default is one to keep the old behavior of spreading
+ * events across all waiting threads.  It can be raised with
+ * sel_set_epoll_batch() or the GENSIO_SEL_EPOLL_BATCH environment
+ * variable.
+ */
+#define SEL_MAX_EPOLL_BATCH 128
+#define SEL_DEFAULT_EPOLL_BATCH 1
+
 static void *
 sel_alloc(unsigned int size)
 {
@@ -80,8 +118,12 @@ typedef struct fd_control_s
        deletion. */
     fd_state_t       *state;
 
-    /* Link in the hash list. */
-    struct fd_control_s *next;
+    /*
+     * Incremented every time the state is replaced or cleared.  It
+     * is stored with the fd in the epoll data, so events that were
+     * queued for an old user of the fd can be recognized.
+     */
+    uint32_t gen;
 
     /* Handlers for various events on an fd. */
     void             *data; /* Passed to the handlers */
@@ -100,6 +142,20 @@ typedef struct fd_control_s
     /* See the comment in process_fds_epoll() on the use of this. */
     uint32_t saved_events;
 #endif
+#ifdef HAVE_KQUEUE
+    /* The SEL_KQ_xxx filters currently registered with the kqueue. */
+    unsigned char kq_filters;
+#endif
+#ifdef HAVE_IO_URING
+    /*
+     * For io_uring, the sequence number of the currently armed poll
+     * request, whether it is armed, and the events it was armed for.
+     * Completions with an old sequence number are stale and ignored.
+     */
+    uint32_t uring_seq;
+    char uring_armed;
+    uint32_t uring_events;
+#endif
 } fd_control_t;
 
 typedef struct heap_val_s
@@ -131,6 +187,13 @@ typedef struct heap_val_s
 
     sel_timeout_handler_t done_handler;
     void *done_cb_data;
+
+    /* Timer wheel links and position, see sel_timers_add(). */
+    struct sel_timer_s *wnext;
+    struct sel_timer_s **wpprev;
+    uint64_t wtick;
+    unsigned char wlevel;
+    unsigned char widx;
 } heap_val_t;
 
 typedef struct theap_s theap_t;
@@ -167,6 +230,33 @@ heap_cmp_key(heap_val_t *v1, heap_val_t *v2)
 
 #include "heap.h"
 
+#define SEL_WHEEL_BITS 6
+#define SEL_WHEEL_SLOTS (1 << SEL_WHEEL_BITS)
+#define SEL_WHEEL_MASK (SEL_WHEEL_SLOTS - 1)
+#define SEL_WHEEL_LEVELS 5
+#define SEL_WHEEL_EXPIRED SEL_WHEEL_LEVELS
+
+struct sel_wheel_s {
+    /* Microseconds per tick. */
+    uint64_t granularity;
+
+    /* The monotonic time of tick 0, in microseconds. */
+    uint64_t epoch;
+
+    /* All ticks up to and including this one have been processed. */
+    uint64_t now;
+
+    /* Number of timers in the wheel. */
+    unsigned int count;
+
+    sel_timer_t *slots[SEL_WHEEL_LEVELS][SEL_WHEEL_SLOTS];
+    uint64_t bitmap[SEL_WHEEL_LEVELS];
+
+    /* Timers that have expired but not been run yet. */
+    sel_timer_t *expired;
+    sel_timer_t **expired_tail;
+};
+
 /* Used to build a list of threads that may need to be woken if a
    timer on the top of the heap changes, or an FD is added/removed.
    See i_wake_sel_thread() for more info. */
@@ -190,12 +280,17 @@ typedef struct sel_wait_list_s
 
 struct selector_s
 {
-    /* This is an hash table of file descriptors. */
-    fd_control_t *fds[FD_SETSIZE];
+    /*
+     * A table of file descriptors, indexed by fd.  It grows as
+     * needed, the fd_control_t entries themselves are never moved.
+     */
+    fd_control_t **fds;
+    unsigned int fds_len;
 
     /* If something is deleted, we increment this count.  This way when
-       a select/epoll returns a non-timeout, we know that we need to ignore
-       it as it may be  from the just deleted fd. */
+       a select returns a non-timeout, we know that we need to ignore
+       it as it may be  from the just deleted fd.  epoll uses the
+       per-fd generation instead. */
     unsigned long fd_del_count;
 
     void *fd_lock;
@@ -203,26 +298,59 @@ struct selector_s
     /* The timer heap. */
     theap_t timer_heap;
 
+    /* If non-NULL, timers are kept here instead of the heap. */
+    struct sel_wheel_s *wheel;
+
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See i_wake_sel_thread() for more info. */
     sel_wait_list_t wait_list;
 
     void *timer_lock;
 
-    sel_runner_t *runner_head;
-    sel_runner_t *runner_tail;
+    /*
+     * Runners waiting to run, newest first.  Pushed without a lock by
+     * sel_run() and taken all at once by process_runners() or
+     * sel_steal_runners().  runner_queued is how many are on it.
+     */
+    sel_runner_t *runner_stack;
+    unsigned int runner_queued;
 
     int wake_sig;
 
+#ifdef HAVE_IO_URING
+    /* If non-NULL, use io_uring poll requests instead of epoll. */
+    struct sel_uring_s *uring;
+#endif
 #ifdef HAVE_EPOLL_PWAIT
     int epollfd;
+#endif
+#ifdef HAVE_KQUEUE
+    int kqueuefd;
+#endif
+#if defined(HAVE_EPOLL_PWAIT) || defined(HAVE_KQUEUE)
+    /* Maximum number of events to reap in one epoll_pwait()/kevent(). */
+    unsigned int epoll_batch;
+#endif
+#ifdef SEL_HAVE_WAKEFD
+    /*
+     * Of the threads waiting with a sel_wakefd_t, only this one has
+     * the selector's fd armed, see sel_wakefd_claim().
+     */
+    sel_wakefd_t *wakefd_poller;
+#endif
+#ifdef HAVE_EPOLL_PWAIT
+    /* Spin this long polling the fds before blocking, 0 is off. */
+    unsigned int busy_poll_usecs;
 #endif
     sel_lock_t *(*sel_lock_alloc)(void *cb_data);
     void (*sel_lock_free)(sel_lock_t *);
     void (*sel_lock)(sel_lock_t *);
     void (*sel_unlock)(sel_lock_t *);
 
-    /* Everything below is only used for select() and ignore for epoll. */
+    /*
+     * Everything below is only used for select() and ignored for
+     * epoll and kqueue.
+     */
 
     /* These are the offical fd_sets used to track what file descriptors
        need to be monitored. */
@@ -232,8 +360,108 @@ struct selector_s
 
     volatile int maxfd; /* The largest file descriptor registered with
 			   this code. */
+
+    /*
+     * Loop statistics, see sel_set_loop_stats().  The counters are
+     * updated with atomics by whatever thread is running the loop.
+     * long_idx counts the long callbacks saved in the
+     * stats.recent_long ring.
+     */
+    bool stats_on;
+    uint64_t stats_start;
+    uint64_t long_cb_nsecs;
+    sel_loop_resolve_cb resolve;
+    unsigned int long_idx;
+    struct sel_loop_stats stats;
+
+    /*
+     * Timers due within this many microseconds of the current time
+     * are run together in one pass, see sel_set_timer_slack().
+     */
+    unsigned int timer_slack;
+};
+
+static uint64_t
+sel_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+sel_stats_add(unsigned long long *v, uint64_t n)
+{
+    __atomic_fetch_add(v, n, __ATOMIC_RELAXED);
+}
+
+static void
+sel_stats_max(unsigned long long *v, uint64_t n)
+{
+    unsigned long long old = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+    while (n > old && !__atomic_compare_exchange_n(v, &old, n, true,
+						   __ATOMIC_RELAXED,
+						   __ATOMIC_RELAXED))
+	;
+}
+
+/* Returns the start time for sel_stats_cb_done(), or 0 if stats are off. */
+static uint64_t
+sel_stats_start(struct selector_s *sel)
+{
+    if (!__atomic_load_n(&sel->stats_on, __ATOMIC_RELAXED))
+	return 0;
+    return sel_stats_now();
+}
+
+/*
+ * Describes the callback for sel_stats_cb_done().  This has to be
+ * filled in before the call, the objects may be gone after.
+ */
+struct sel_stats_cb {
+    int type;
+    void *handler;
+    void *cb_data;
 };
 
+static void
+sel_stats_cb_init(struct selector_s *sel, struct sel_stats_cb *cb,
+		  int type, void *handler, void *cb_data)
+{
+    cb->type = type;
+    cb->handler = handler;
+    cb->cb_data = cb_data;
+    if (sel->long_cb_nsecs && sel->resolve)
+	sel->resolve(type, &cb->handler, &cb->cb_data);
+}
+
+static void
+sel_stats_cb_done(struct selector_s *sel, uint64_t start,
+		  struct sel_stats_cb *cb)
+{
+    struct sel_loop_long_cb *l;
+    uint64_t t;
+
+    if (!start)
+	return;
+    t = sel_stats_now() - start;
+    sel_stats_add(&sel->stats.callbacks, 1);
+    sel_stats_add(&sel->stats.cb_nsecs, t);
+    sel_stats_max(&sel->stats.cb_max_nsecs, t);
+    if (!sel->long_cb_nsecs || t < sel->long_cb_nsecs)
+	return;
+    sel_stats_add(&sel->stats.long_cbs, 1);
+    l = &sel->stats.recent_long[__atomic_fetch_add(&sel->long_idx, 1,
+						   __ATOMIC_RELAXED)
+				% SEL_LOOP_NR_LONG_CBS];
+    __atomic_store_n(&l->type, cb->type, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->handler, cb->handler, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->cb_data, cb->cb_data, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->nsecs, t, __ATOMIC_RELAXED);
+}
+
 static void
 sel_timer_lock(struct selector_s *sel)
 {
@@ -346,11 +574,298 @@ sel_wake_one(struct selector_s *sel, long thread_id, sel_send_sig_cb killer,
     sel_timer_unlock(sel);
 }
 
+/*
+ * Timer storage.  Timers are normally kept in a heap sorted by
+ * timeout, but a hierarchical timer wheel may be used instead, see
+ * sel_set_timer_wheel().  The wheel makes adding and removing a
+ * timer O(1) at the cost of timers going off up to one tick late.
+ *
+ * The wheel has SEL_WHEEL_LEVELS levels of SEL_WHEEL_SLOTS slots.
+ * Slots in level 0 are one tick wide, each slot in the next level
+ * up covers a whole rotation of the level below it.  When the wheel
+ * crosses a slot boundary at a level, the timers in that slot are
+ * cascaded down to the lower levels.  A bitmap of non-empty slots
+ * makes finding the next tick that needs attention cheap, so the
+ * wheel does not need to be stepped one tick at a time.
+ *
+ * Timeouts are converted to ticks by rounding up, so a timer never
+ * goes off early.  All this must be called with the timer lock held.
+ */
+static void
+wheel_add_expired(struct sel_wheel_s *w, sel_timer_t *timer)
+{
+    timer->val.wlevel = SEL_WHEEL_EXPIRED;
+    timer->val.wnext = NULL;
+    timer->val.wpprev = w->expired_tail;
+    *w->expired_tail = timer;
+    w->expired_tail = &timer->val.wnext;
+}
+
+static void
+wheel_insert(struct sel_wheel_s *w, sel_timer_t *timer)
+{
+    uint64_t tick = timer->val.wtick, delta;
+    unsigned int level, idx;
+    sel_timer_t **head;
+
+    if (tick <= w->now) {
+	wheel_add_expired(w, timer);
+	return;
+    }
+
+    delta = tick - w->now;
+    for (level = 0; level < SEL_WHEEL_LEVELS - 1; level++) {
+	if (delta < (uint64_t) 1 << ((level + 1) * SEL_WHEEL_BITS))
+	    break;
+    }
+    if (level == SEL_WHEEL_LEVELS - 1 &&
+		delta >= (uint64_t) 1 << (SEL_WHEEL_LEVELS * SEL_WHEEL_BITS))
+	/* Too far out, park it at the end.  It will cascade again. */
+	tick = w->now + ((uint64_t) 1 << (SEL_WHEEL_LEVELS * SEL_WHEEL_BITS))
+	    - 1;
+
+    idx = (tick >> (level * SEL_WHEEL_BITS)) & SEL_WHEEL_MASK;
+    head = &w->slots[level][idx];
+    timer->val.wlevel = level;
+    timer->val.widx = idx;
+    timer->val.wnext = *head;
+    timer->val.wpprev = head;
+    if (*head)
+	(*head)->val.wpprev = &timer->val.wnext;
+    *head = timer;
+    w->bitmap[level] |= (uint64_t) 1 << idx;
+}
+
+static void
+wheel_remove(struct sel_wheel_s *w, sel_timer_t *timer)
+{
+    unsigned int level = timer->val.wlevel;
+
+    *timer->val.wpprev = timer->val.wnext;
+    if (timer->val.wnext)
+	timer->val.wnext->val.wpprev = timer->val.wpprev;
+    else if (level == SEL_WHEEL_EXPIRED)
+	w->expired_tail = timer->val.wpprev;
+
+    if (level != SEL_WHEEL_EXPIRED && !w->slots[level][timer->val.widx])
+	w->bitmap[level] &= ~((uint64_t) 1 << timer->val.widx);
+}
+
+/* Move all the timers in a slot to where they belong now. */
+static void
+wheel_cascade(struct sel_wheel_s *w, unsigned int level, unsigned int idx)
+{
+    sel_timer_t *timer = w->slots[level][idx], *next;
+
+    w->slots[level][idx] = NULL;
+    w->bitmap[level] &= ~((uint64_t) 1 << idx);
+    for (; timer; timer = next) {
+	next = timer->val.wnext;
+	wheel_insert(w, timer);
+    }
+}
+
+/*
+ * Return the first tick after w->now where something must be done,
+ * either timers expire or a slot must be cascaded.  Returns
+ * UINT64_MAX if the wheel is empty.
+ */
+static uint64_t
+wheel_next_tick(struct sel_wheel_s *w)
+{
+    uint64_t rv = UINT64_MAX, bits, base, tick;
+    unsigned int level, shift, start, off;
+
+    for (level = 0; level < SEL_WHEEL_LEVELS; level++) {
+	bits = w->bitmap[level];
+	if (!bits)
+	    continue;
+	shift = level * SEL_WHEEL_BITS;
+	base = w->now >> shift;
+	/* Search starting at the slot after the current one. */
+	start = (base + 1) & SEL_WHEEL_MASK;
+	if (start)
+	    bits = (bits >> start) | (bits << (SEL_WHEEL_SLOTS - start));
+	off = __builtin_ctzll(bits) + 1;
+	tick = (base + off) << shift;
+	if (tick < rv)
+	    rv = tick;
+    }
+    return rv;
+}
+
+static void
+wheel_advance(struct sel_wheel_s *w, uint64_t target)
+{
+    uint64_t tick;
+    unsigned int level;
+    sel_timer_t *timer, *next;
+
+    while (w->now < target) {
+	tick = wheel_next_tick(w);
+	if (tick > target) {
+	    /* Nothing to do until after target, just skip there. */
+	    w->now = target;
+	    break;
+	}
+	w->now = tick;
+
+	/* Cascade every level whose slot boundary we just crossed. */
+	for (level = SEL_WHEEL_LEVELS - 1; level > 0; level--) {
+	    unsigned int shift = level * SEL_WHEEL_BITS;
+
+	    if (tick & (((uint64_t) 1 << shift) - 1))
+		continue;
+	    wheel_cascade(w, level, (tick >> shift) & SEL_WHEEL_MASK);
+	}
+
+	timer = w->slots[0][tick & SEL_WHEEL_MASK];
+	w->slots[0][tick & SEL_WHEEL_MASK] = NULL;
+	w->bitmap[0] &= ~((uint64_t) 1 << (tick & SEL_WHEEL_MASK));
+	for (; timer; timer = next) {
+	    next = timer->val.wnext;
+	    wheel_add_expired(w, timer);
+	}
+    }
+}
+
+static uint64_t
+wheel_tv_to_usecs(const struct timeval *tv)
+{
+    return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void
+wheel_tick_to_tv(struct sel_wheel_s *w, uint64_t tick, struct timeval *tv)
+{
+    uint64_t usecs = w->epoch + tick * w->granularity;
+
+    tv->tv_sec = usecs / 1000000;
+    tv->tv_usec = usecs % 1000000;
+}
+
+static void
+sel_timers_add(struct selector_s *sel, sel_timer_t *timer)
+{
+    struct sel_wheel_s *w = sel->wheel;
+
+    if (w) {
+	uint64_t usecs = wheel_tv_to_usecs(&timer->val.timeout);
+
+	if (usecs <= w->epoch)
+	    timer->val.wtick = 0;
+	else
+	    timer->val.wtick = ((usecs - w->epoch + w->granularity - 1)
+				/ w->granularity);
+	wheel_insert(w, timer);
+	w->count++;
+    } else {
+	theap_add(&sel->timer_heap, timer);
+    }
+    timer->val.in_heap = 1;
+}
+
+static void
+sel_timers_remove(struct selector_s *sel, sel_timer_t *timer)
+{
+    if (sel->wheel) {
+	wheel_remove(sel->wheel, timer);
+	sel->wheel->count--;
+    } else {
+	theap_remove(&sel->timer_heap, timer);
+    }
+    timer->val.in_heap = 0;
+}
+
+/*
+ * Get the time of the first timer.  For the wheel this is the time
+ * of the next tick that needs processing, which may be earlier than
+ * any timer.  Returns false if there are no timers.
+ */
+static bool
+sel_timers_next(struct selector_s *sel, struct timeval *tv)
+{
+    struct sel_wheel_s *w = sel->wheel;
+    sel_timer_t *timer;
+    uint64_t tick;
+
+    if (w) {
+	if (w->expired)
+	    tick = w->now;
+	else
+	    tick = wheel_next_tick(w);
+	if (tick == UINT64_MAX)
+	    return false;
+	wheel_tick_to_tv(w, tick, tv);
+	return true;
+    }
+
+    timer = theap_get_top(&sel->timer_heap);
+    if (!timer)
+	return false;
+    *tv = timer->val.timeout;
+    return true;
+}
+
+/*
+ * Remove and return a timer that has expired at time "now", NULL if
+ * there are none.
+ */
+static sel_timer_t *
+sel_timers_get_expired(struct selector_s *sel, struct timeval *now)
+{
+    struct sel_wheel_s *w = sel->wheel;
+    sel_timer_t *timer;
+
+    if (w) {
+	uint64_t usecs = wheel_tv_to_usecs(now);
+
+	if (usecs > w->epoch)
+	    wheel_advance(w, (usecs - w->epoch) / w->granularity);
+	timer = w->expired;
+    } else {
+	timer = theap_get_top(&sel->timer_heap);
+	if (timer && cmp_timeval(now, &timer->val.timeout) < 0)
+	    timer = NULL;
+    }
+    if (timer)
+	sel_timers_remove(sel, timer);
+    return timer;
+}
+
+/* Remove and return any timer, used for cleanup. */
+static sel_timer_t *
+sel_timers_get_any(struct selector_s *sel)
+{
+    struct sel_wheel_s *w = sel->wheel;
+    sel_timer_t *timer = NULL;
+    unsigned int level, idx;
+
+    if (!w) {
+	timer = theap_get_top(&sel->timer_heap);
+    } else if (w->expired) {
+	timer = w->expired;
+    } else {
+	for (level = 0; !timer && level < SEL_WHEEL_LEVELS; level++) {
+	    if (!w->bitmap[level])
+		continue;
+	    idx = __builtin_ctzll(w->bitmap[level]);
+	    timer = w->slots[level][idx];
+	}
+    }
+    if (timer)
+	sel_timers_remove(sel, timer);
+    return timer;
+}
+
 static void
 wake_timer_sel_thread(struct selector_s *sel, volatile sel_timer_t *old_top,
 		      struct timeval *new_timeout)
 {
-    if (old_top != theap_get_top(&sel->timer_heap))
+    if (sel->wheel)
+	/* There is no cheap top, let the wake time check sort it out. */
+	i_wake_sel_thread(sel, new_timeout);
+    else if (old_top != theap_get_top(&sel->timer_heap))
 	/* If the top value changed, restart the waiting threads if required. */
 	i_wake_sel_thread(sel, new_timeout);
 }
@@ -399,80 +914,534 @@ init_fd(fd_control_t *fd)
     fd->except_enabled = 0;
 }
 
-#ifdef HAVE_EPOLL_PWAIT
-static int
-sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
-{
-    struct epoll_event event;
-    int rv;
+#ifdef HAVE_IO_URING
+/*
+ * An alternative to epoll built on io_uring poll requests.  Each fd
+ * with events enabled has one oneshot IORING_OP_POLL_ADD outstanding,
+ * which gives the same semantics as the EPOLLONESHOT handling used
+ * for epoll.  The advantage is that the rearms done after handling a
+ * batch of events are queued in the submission ring and submitted
+ * with a single system call, instead of an epoll_ctl() per event.
+ *
+ * The user_data in the requests holds the fd in the top 32 bits and
+ * a per-fd sequence number in the bottom 32 bits.  The sequence is
+ * incremented every time a new poll is armed, so completions for
+ * removed or replaced requests can be recognized and dropped.
+ *
+ * All ring manipulation is done with the fd lock held.
+ */
+#define SEL_URING_ENTRIES 4096
+#define SEL_URING_IGNORE_DATA (~(uint64_t) 0)
 
-    if (sel->epollfd < 0)
-	return 1;
+struct sel_uring_s {
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int sq_entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *sq_flags;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Number of sqes added to the ring but not yet submitted. */
+    unsigned int to_submit;
+
+    /*
+     * If non-zero, we are processing a batch of completions and
+     * submission is deferred until the batch is done.
+     */
+    unsigned int defer_submit;
+};
 
-    memset(&event, 0, sizeof(event));
-    event.events = EPOLLONESHOT;
-    event.data.fd = fdc->fd;
-    if (fdc->saved_events) {
-	if (op == EPOLL_CTL_DEL)
-	    return 0;
-	if (!fdc->read_enabled && !fdc->except_enabled)
-	    return 0;
-	fdc->saved_events = 0;
-	op = EPOLL_CTL_ADD;
-	if (fdc->read_enabled)
-	    event.events |= EPOLLIN | EPOLLHUP;
-	if (fdc->except_enabled)
-	    event.events |= EPOLLERR | EPOLLPRI;
-    } else if (op != EPOLL_CTL_DEL) {
-	if (fdc->read_enabled)
-	    event.events |= EPOLLIN | EPOLLHUP;
-	if (fdc->write_enabled)
-	    event.events |= EPOLLOUT;
-	if (fdc->except_enabled)
-	    event.events |= EPOLLERR | EPOLLPRI;
-    }
-    /* This should only fail due to system problems, and if that's the case,
-       well, we should probably terminate. */
-    rv = epoll_ctl(sel->epollfd, op, fdc->fd, &event);
-    if (rv) {
-	perror("epoll_ctl");
-	assert(0);
-    }
-    return 0;
-}
-#else
 static int
-sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+sel_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		unsigned int flags, void *arg, size_t argsz)
 {
-    return 1;
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		   arg, argsz);
 }
-#endif
 
 static void
-finish_oldstate(sel_runner_t *runner, void *cbdata)
+sel_uring_free(struct sel_uring_s *u)
 {
-    fd_state_t *oldstate = cbdata;
-
-    if (oldstate->done)
-	oldstate->done(oldstate->tmp_fd, oldstate->done_cbdata);
-    free(oldstate);
+    if (u->sqes)
+	munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+	munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+	munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0)
+	close(u->fd);
+    free(u);
 }
 
-/* Must be called with sel fd lock held. */
-static fd_control_t *
-get_fd(struct selector_s *sel, int fd)
+static int
+sel_uring_alloc(struct sel_uring_s **ru)
 {
-    fd_control_t *fdc = sel->fds[fd % FD_SETSIZE];
+    struct sel_uring_s *u;
+    struct io_uring_params p;
+    char *sq, *cq;
+    int rv;
 
-    while (fdc && fdc->fd != fd)
-	fdc = fdc->next;
-    return fdc;
-}
+    u = sel_alloc(sizeof(*u));
+    if (!u)
+	return ENOMEM;
 
-static void
-valid_fd(struct selector_s *sel, int fd, fd_control_t **rfdc)
-{
-    fd_control_t *fdc;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, SEL_URING_ENTRIES, &p);
+    if (u->fd < 0) {
+	rv = errno;
+	goto out_err;
+    }
+
+    /*
+     * We need the timeout and sigmask on the wait, and we don't want
+     * to lose completions if the completion ring overflows.
+     */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+		!(p.features & IORING_FEAT_NODROP)) {
+	rv = ENOTSUP;
+	goto out_err;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (u->cq_ring_size > u->sq_ring_size)
+	    u->sq_ring_size = u->cq_ring_size;
+	u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+	u->sq_ring = NULL;
+	rv = errno;
+	goto out_err;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	u->cq_ring = u->sq_ring;
+    } else {
+	u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED) {
+	    u->cq_ring = NULL;
+	    rv = errno;
+	    goto out_err;
+	}
+    }
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+	u->sqes = NULL;
+	rv = errno;
+	goto out_err;
+    }
+
+    sq = u->sq_ring;
+    u->sq_entries = p.sq_entries;
+    u->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    u->sq_flags = (unsigned int *) (sq + p.sq_off.flags);
+
+    cq = u->cq_ring;
+    u->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    *ru = u;
+    return 0;
+
+ out_err:
+    sel_uring_free(u);
+    return rv;
+}
+
+/*
+ * Submit everything queued in the submission ring.  On an error the
+ * entries not taken stay queued and are tried again on the next
+ * submit, the error is returned.
+ */
+static int
+sel_uring_submit(struct sel_uring_s *u)
+{
+    int rv;
+
+    while (u->to_submit > 0) {
+	rv = sel_uring_enter(u->fd, u->to_submit, 0, 0, NULL, 0);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    /* Like epoll_ctl failures, this is a system problem. */
+	    rv = errno;
+	    perror("io_uring_enter");
+	    return rv;
+	}
+	if (rv == 0)
+	    /* The kernel took nothing, don't spin on it. */
+	    return EBUSY;
+	u->to_submit -= rv;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *
+sel_uring_get_sqe(struct sel_uring_s *u)
+{
+    unsigned int head, tail, idx;
+    struct io_uring_sqe *sqe;
+
+    tail = *u->sq_tail;
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= u->sq_entries) {
+	sel_uring_submit(u);
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= u->sq_entries)
+	    /* Couldn't make room, the submit error has been reported. */
+	    return NULL;
+    }
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+static void
+sel_uring_commit_sqe(struct sel_uring_s *u)
+{
+    __atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+static uint64_t
+sel_uring_user_data(fd_control_t *fdc)
+{
+    return ((uint64_t) (uint32_t) fdc->fd << 32) | fdc->uring_seq;
+}
+
+static int
+sel_uring_remove_poll(struct sel_uring_s *u, fd_control_t *fdc)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = sel_uring_get_sqe(u);
+    if (!sqe)
+	return EBUSY;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = sel_uring_user_data(fdc);
+    sqe->user_data = SEL_URING_IGNORE_DATA;
+    sel_uring_commit_sqe(u);
+    fdc->uring_armed = 0;
+    return 0;
+}
+
+static int
+sel_uring_add_poll(struct sel_uring_s *u, fd_control_t *fdc, uint32_t events)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = sel_uring_get_sqe(u);
+    if (!sqe)
+	return EBUSY;
+    fdc->uring_seq++;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fdc->fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = sel_uring_user_data(fdc);
+    sel_uring_commit_sqe(u);
+    fdc->uring_armed = 1;
+    return 0;
+}
+
+/*
+ * Do the equivalent of an epoll_ctl() with EPOLLONESHOT set.  Poll
+ * event bits have the same values as the epoll ones in Linux.
+ */
+static int
+sel_uring_update_fd(struct selector_s *sel, fd_control_t *fdc, int op,
+		    uint32_t events)
+{
+    struct sel_uring_s *u = sel->uring;
+    int rv = 0;
+
+    events &= ~EPOLLONESHOT;
+    if (op == EPOLL_CTL_DEL) {
+	if (fdc->uring_armed)
+	    rv = sel_uring_remove_poll(u, fdc);
+	/* Make sure any pending completion is seen as stale. */
+	fdc->uring_seq++;
+    } else {
+	if (fdc->uring_armed) {
+	    if (fdc->uring_events == events)
+		/* Nothing changed, the current request is fine. */
+		return 0;
+	    rv = sel_uring_remove_poll(u, fdc);
+	}
+	if (!rv) {
+	    fdc->uring_events = events;
+	    rv = sel_uring_add_poll(u, fdc, events);
+	}
+    }
+
+    if (!rv && !u->defer_submit)
+	rv = sel_uring_submit(u);
+    return rv;
+}
+
+#endif
+
+/* Are the select() fd sets in use, not epoll or kqueue? */
+static bool
+sel_use_fdsets(struct selector_s *sel)
+{
+#ifdef HAVE_EPOLL_PWAIT
+    return sel->epollfd < 0;
+#elif defined(HAVE_KQUEUE)
+    return sel->kqueuefd < 0;
+#else
+    return true;
+#endif
+}
+
+#ifdef HAVE_EPOLL_PWAIT
+static uint64_t
+sel_epoll_data(fd_control_t *fdc)
+{
+    return ((uint64_t) fdc->gen << 32) | (uint32_t) fdc->fd;
+}
+
+static int
+sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+{
+    struct epoll_event event;
+    int rv;
+
+    if (sel->epollfd < 0)
+	return 1;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLONESHOT;
+    event.data.u64 = sel_epoll_data(fdc);
+    if (fdc->saved_events) {
+	if (op == EPOLL_CTL_DEL)
+	    return 0;
+	if (!fdc->read_enabled && !fdc->except_enabled)
+	    return 0;
+	fdc->saved_events = 0;
+	op = EPOLL_CTL_ADD;
+	if (fdc->read_enabled)
+	    event.events |= EPOLLIN | EPOLLHUP;
+	if (fdc->except_enabled)
+	    event.events |= EPOLLERR | EPOLLPRI;
+    } else if (op != EPOLL_CTL_DEL) {
+	if (fdc->read_enabled)
+	    event.events |= EPOLLIN | EPOLLHUP;
+	if (fdc->write_enabled)
+	    event.events |= EPOLLOUT;
+	if (fdc->except_enabled)
+	    event.events |= EPOLLERR | EPOLLPRI;
+    }
+#ifdef HAVE_IO_URING
+    if (sel->uring)
+	return sel_uring_update_fd(sel, fdc, op, event.events);
+#endif
+    /* This should only fail due to system problems, and if that's the case,
+       well, we should probably terminate. */
+    rv = epoll_ctl(sel->epollfd, op, fdc->fd, &event);
+    if (rv) {
+	perror("epoll_ctl");
+	assert(0);
+    }
+    return 0;
+}
+#elif defined(HAVE_KQUEUE)
+/*
+ * kqueue has a filter per event type instead of a mask of events.
+ * Each filter is added with EV_DISPATCH, so it is disabled when it
+ * reports an event and has to be re-enabled, like EPOLLONESHOT.  The
+ * fd's generation is stored in udata so events for an old user of
+ * the fd can be recognized.  Exceptions are only reported where
+ * EVFILT_EXCEPT exists.
+ */
+#define SEL_KQ_READ	(1 << 0)
+#define SEL_KQ_WRITE	(1 << 1)
+#define SEL_KQ_EXCEPT	(1 << 2)
+#define SEL_KQ_NR_FILTERS 3
+
+static int
+sel_kq_filter(unsigned int kqf)
+{
+    switch (kqf) {
+    case SEL_KQ_READ: return EVFILT_READ;
+    case SEL_KQ_WRITE: return EVFILT_WRITE;
+#ifdef EVFILT_EXCEPT
+    case SEL_KQ_EXCEPT: return EVFILT_EXCEPT;
+#endif
+    default: return 0;
+    }
+}
+
+static int
+sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+{
+    struct kevent changes[SEL_KQ_NR_FILTERS], results[SEL_KQ_NR_FILTERS];
+    void *udata = (void *) (uintptr_t) fdc->gen;
+    unsigned int kqf, want = 0;
+    int n = 0, rv, i;
+
+    if (sel->kqueuefd < 0)
+	return 1;
+
+    if (op != EPOLL_CTL_DEL) {
+	if (fdc->read_enabled)
+	    want |= SEL_KQ_READ;
+	if (fdc->write_enabled)
+	    want |= SEL_KQ_WRITE;
+#ifdef EVFILT_EXCEPT
+	if (fdc->except_enabled)
+	    want |= SEL_KQ_EXCEPT;
+#endif
+    }
+
+    for (kqf = SEL_KQ_READ; kqf <= SEL_KQ_EXCEPT; kqf <<= 1) {
+	unsigned short flags = EV_RECEIPT;
+	unsigned int fflags = 0;
+
+	if (kqf == SEL_KQ_EXCEPT) {
+#ifdef NOTE_OOB
+	    fflags = NOTE_OOB;
+#endif
+	}
+	if (op == EPOLL_CTL_DEL) {
+	    if (!(fdc->kq_filters & kqf))
+		continue;
+	    flags |= EV_DELETE;
+	} else if (want & kqf) {
+	    flags |= EV_ADD | EV_DISPATCH | EV_ENABLE;
+	} else if (fdc->kq_filters & kqf) {
+	    /* EV_ADD so udata gets updated, too. */
+	    flags |= EV_ADD | EV_DISPATCH | EV_DISABLE;
+	} else {
+	    continue;
+	}
+	EV_SET(&changes[n], fdc->fd, sel_kq_filter(kqf), flags, fflags, 0,
+	       udata);
+	n++;
+    }
+    if (op == EPOLL_CTL_DEL)
+	fdc->kq_filters = 0;
+    else
+	fdc->kq_filters |= want;
+    if (n == 0)
+	return 0;
+
+    rv = kevent(sel->kqueuefd, changes, n, results, n, NULL);
+    if (op == EPOLL_CTL_DEL)
+	/* The fd may already be closed, which removes it from the kqueue. */
+	return 0;
+    /* Like epoll_ctl(), this should only fail due to system problems. */
+    if (rv < 0) {
+	perror("kevent");
+	assert(0);
+    }
+    for (i = 0; i < rv; i++) {
+	if (!(results[i].flags & EV_ERROR) || results[i].data == 0)
+	    continue;
+	if (results[i].data == EPIPE)
+	    /* The other end of a pipe is gone, reads will report it. */
+	    continue;
+#ifdef EVFILT_EXCEPT
+	if (results[i].filter == EVFILT_EXCEPT) {
+	    /* Not all fd types support exceptions, just ignore them. */
+	    fdc->kq_filters &= ~SEL_KQ_EXCEPT;
+	    continue;
+	}
+#endif
+	errno = results[i].data;
+	perror("kevent");
+	assert(0);
+    }
+    return 0;
+}
+#else
+static int
+sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+{
+    return 1;
+}
+#endif
+
+static void
+finish_oldstate(sel_runner_t *runner, void *cbdata)
+{
+    fd_state_t *oldstate = cbdata;
+
+    if (oldstate->done)
+	oldstate->done(oldstate->tmp_fd, oldstate->done_cbdata);
+    free(oldstate);
+}
+
+/* Must be called with sel fd lock held. */
+static fd_control_t *
+get_fd(struct selector_s *sel, int fd)
+{
+    if ((unsigned int) fd >= sel->fds_len)
+	return NULL;
+    return sel->fds[fd];
+}
+
+/* Make sure fd fits in the fd table.  Must be called with the fd lock. */
+static int
+grow_fds(struct selector_s *sel, int fd)
+{
+    fd_control_t **nfds;
+    unsigned int nlen;
+
+    if ((unsigned int) fd < sel->fds_len)
+	return 0;
+
+    nlen = sel->fds_len ? sel->fds_len : FD_SETSIZE;
+    while (nlen <= (unsigned int) fd)
+	nlen *= 2;
+    nfds = sel_alloc(nlen * sizeof(*nfds));
+    if (!nfds)
+	return ENOMEM;
+    if (sel->fds) {
+	memcpy(nfds, sel->fds, sel->fds_len * sizeof(*nfds));
+	free(sel->fds);
+    }
+    sel->fds = nfds;
+    sel->fds_len = nlen;
+    return 0;
+}
+
+static void
+valid_fd(struct selector_s *sel, int fd, fd_control_t **rfdc)
+{
+    fd_control_t *fdc;
 
     assert(fd >= 0);
     fdc = get_fd(sel, fd);
@@ -495,10 +1464,8 @@ sel_set_fd_handlers(struct selector_s *sel,
     void         *olddata = NULL;
     int          added = 1;
 
-#ifdef HAVE_EPOLL_PWAIT
-    if (sel->epollfd < 0 && fd >= FD_SETSIZE)
+    if (sel_use_fdsets(sel) && fd >= FD_SETSIZE)
 	return EMFILE;
-#endif
 
     state = sel_alloc(sizeof(*state));
     if (!state)
@@ -511,16 +1478,13 @@ sel_set_fd_handlers(struct selector_s *sel,
     sel_fd_lock(sel);
     fdc = get_fd(sel, fd);
     if (!fdc) {
-	fdc = sel_alloc(sizeof(*fdc));
-	if (!fdc) {
+	if (grow_fds(sel, fd) || !(fdc = sel_alloc(sizeof(*fdc)))) {
 	    sel_fd_unlock(sel);
 	    free(state);
 	    return ENOMEM;
 	}
 	fdc->fd = fd;
-	/* Add it to the list. */
-	fdc->next = sel->fds[fd % FD_SETSIZE];
-	sel->fds[fd % FD_SETSIZE] = fdc;
+	sel->fds[fd] = fdc;
     }
 
     if (fdc->state) {
@@ -530,6 +1494,7 @@ sel_set_fd_handlers(struct selector_s *sel,
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
 #endif
+	fdc->gen++;
 	sel->fd_del_count++;
     }
     fdc->state = state;
@@ -581,14 +1546,12 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int rpt)
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
 #endif
+	fdc->gen++;
 	sel->fd_del_count++;
     }
 
     init_fd(fdc);
-#ifdef HAVE_EPOLL_PWAIT
-    if (sel->epollfd < 0)
-#endif
-    {
+    if (sel_use_fdsets(sel)) {
 	FD_CLR(fd, &sel->read_set);
 	FD_CLR(fd, &sel->write_set);
 	FD_CLR(fd, &sel->except_set);
@@ -648,17 +1611,13 @@ sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->read_enabled)
 	    goto out;
 	fdc->read_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_SET(fd, &sel->read_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->read_enabled)
 	    goto out;
 	fdc->read_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_CLR(fd, &sel->read_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -685,17 +1644,13 @@ sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->write_enabled)
 	    goto out;
 	fdc->write_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_SET(fd, &sel->write_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->write_enabled)
 	    goto out;
 	fdc->write_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_CLR(fd, &sel->write_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -722,17 +1677,13 @@ sel_set_fd_except_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->except_enabled)
 	    goto out;
 	fdc->except_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_SET(fd, &sel->except_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->except_enabled)
 	    goto out;
 	fdc->except_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_use_fdsets(sel))
 	    FD_CLR(fd, &sel->except_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -815,10 +1766,8 @@ sel_stop_timer_i(struct selector_s *sel, sel_timer_t *timer)
      * is used to signal a timer restart on return from a timer
      * handler.)  So make sure it's not in the heap.
      */
-    if (timer->val.in_heap) {
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-    }
+    if (timer->val.in_heap)
+	sel_timers_remove(sel, timer);
     timer->val.stopped = 1;
 
     return rv;
@@ -862,8 +1811,7 @@ sel_start_timer(sel_timer_t    *timer,
 
     if (!timer->val.in_handler) {
 	/* Wait until the handler returns to start the timer. */
-	theap_add(&sel->timer_heap, timer);
-	timer->val.in_heap = 1;
+	sel_timers_add(sel, timer);
     }
     timer->val.stopped = 0;
 
@@ -914,13 +1862,10 @@ sel_stop_timer_with_done(sel_timer_t *timer,
      * heap with an immediate timeout so it will be processed now.
      */
     timer->val.in_handler = 1;
-    if (timer->val.in_heap) {
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-    }
+    if (timer->val.in_heap)
+	sel_timers_remove(sel, timer);
     sel_get_monotonic_time(&timer->val.timeout);
-    theap_add(&sel->timer_heap, timer);
-    timer->val.in_heap = 1;
+    sel_timers_add(sel, timer);
 
  out_unlock:
     sel_timer_unlock(sel);
@@ -937,6 +1882,27 @@ sel_get_monotonic_time(struct timeval *tv)
     tv->tv_usec = (ts.tv_nsec + 500) / 1000;
 }
 
+void
+sel_get_coarse_monotonic_time(struct timeval *tv)
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0) {
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = (ts.tv_nsec + 500) / 1000;
+	return;
+    }
+#endif
+    sel_get_monotonic_time(tv);
+}
+
+void
+sel_set_timer_slack(struct selector_s *sel, unsigned int usecs)
+{
+    __atomic_store_n(&sel->timer_slack, usecs, __ATOMIC_RELAXED);
+}
+
 /*
  * Process timers on selector.  The timeout is always set, to a very
  * long value if no timers are waiting.  Note that this *must* be
@@ -949,14 +1915,28 @@ process_timers(struct selector_s       *sel,
 	       volatile struct timeval *timeout,
 	       struct timeval          *abstime)
 {
-    struct timeval now;
+    struct timeval now, next, until;
     sel_timer_t    *timer;
+    uint64_t       start, expiry;
+    struct sel_stats_cb cb;
+    unsigned int slack;
 
-    timer = theap_get_top(&sel->timer_heap);
     sel_get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
-	theap_remove(&(sel->timer_heap), timer);
-	timer->val.in_heap = 0;
+    until = now;
+    slack = __atomic_load_n(&sel->timer_slack, __ATOMIC_RELAXED);
+    if (slack) {
+	/*
+	 * Something is due, run anything due shortly after it now
+	 * instead of waking up again for it.
+	 */
+	if (sel_timers_next(sel, &next) && cmp_timeval(&now, &next) >= 0) {
+	    until.tv_usec += slack;
+	    until.tv_sec += until.tv_usec / 1000000;
+	    until.tv_usec %= 1000000;
+	}
+    }
+    timer = sel_timers_get_expired(sel, &until);
+    while (timer) {
 	timer->val.stopped = 1;
 
 	/*
@@ -966,8 +1946,26 @@ process_timers(struct selector_s       *sel,
 	 */
 	if (!timer->val.in_handler) {
 	    timer->val.in_handler = 1;
+	    start = sel_stats_start(sel);
+	    if (start) {
+		sel_stats_cb_init(sel, &cb, SEL_LOOP_CB_TIMER,
+				  (void *) timer->val.handler,
+				  timer->val.user_data);
+		expiry = ((uint64_t) timer->val.timeout.tv_sec * 1000000000
+			  + timer->val.timeout.tv_usec * 1000);
+		if (start > expiry) {
+		    sel_stats_add(&sel->stats.timer_late_nsecs,
+				  start - expiry);
+		    sel_stats_max(&sel->stats.timer_late_max_nsecs,
+				  start - expiry);
+		}
+		sel_stats_add(&sel->stats.timers, 1);
+	    }
 	    sel_timer_unlock(sel);
+	    GENSIO_PROBE2(sel_timer_entry, sel, timer);
 	    timer->val.handler(sel, timer, timer->val.user_data);
+	    GENSIO_PROBE2(sel_timer_return, sel, timer);
+	    sel_stats_cb_done(sel, start, &cb);
 	    sel_timer_lock(sel);
 	}
 	(*count)++;
@@ -986,11 +1984,10 @@ process_timers(struct selector_s       *sel,
 	    free(timer);
 	else if (!timer->val.stopped) {
 	    /* We were restarted while in the handler. */
-	    theap_add(&sel->timer_heap, timer);
-	    timer->val.in_heap = 1;
+	    sel_timers_add(sel, timer);
 	}
 
-	timer = theap_get_top(&sel->timer_heap);
+	timer = sel_timers_get_expired(sel, &until);
     }
 
     if (*count) {
@@ -998,11 +1995,9 @@ process_timers(struct selector_s       *sel,
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
 	*abstime = now;
-    } else if (timer) {
-	diff_timeval((struct timeval *) timeout,
-		     (struct timeval *) &timer->val.timeout,
-		     &now);
-	*abstime = timer->val.timeout;
+    } else if (sel_timers_next(sel, &next)) {
+	diff_timeval((struct timeval *) timeout, &next, &now);
+	*abstime = next;
     } else {
 	/* No timers, just set a long time. */
 	timeout->tv_sec = 100000;
@@ -1029,14 +2024,8 @@ sel_alloc_runner(struct selector_s *sel, sel_runner_t **new_runner)
 int
 sel_free_runner(sel_runner_t *runner)
 {
-    struct selector_s *sel = runner->sel;
-
-    sel_timer_lock(sel);
-    if (runner->in_use) {
-	sel_timer_unlock(sel);
+    if (__atomic_load_n(&runner->in_use, __ATOMIC_ACQUIRE))
 	return EBUSY;
-    }
-    sel_timer_unlock(sel);
     free(runner);
     return 0;
 }
@@ -1044,50 +2033,106 @@ sel_free_runner(sel_runner_t *runner)
 int
 sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data)
 {
-    struct selector_s *sel = runner->sel;
+    return sel_run_on(runner->sel, runner, func, cb_data);
+}
 
-    sel_timer_lock(sel);
-    if (runner->in_use) {
-	sel_timer_unlock(sel);
+int
+sel_run_on(struct selector_s *sel, sel_runner_t *runner,
+	   sel_runner_func_t func, void *cb_data)
+{
+    sel_runner_t *old;
+
+    if (__atomic_exchange_n(&runner->in_use, 1, __ATOMIC_ACQUIRE))
 	return EBUSY;
-    }
 
     runner->func = func;
     runner->cb_data = cb_data;
-    runner->next = NULL;
-    runner->in_use = 1;
 
-    if (sel->runner_tail) {
-	sel->runner_tail->next = runner;
-	sel->runner_tail = runner;
-    } else {
-	sel->runner_head = runner;
-	sel->runner_tail = runner;
+    /* Count first so the taker never takes the count below zero. */
+    __atomic_add_fetch(&sel->runner_queued, 1, __ATOMIC_RELAXED);
+
+    old = __atomic_load_n(&sel->runner_stack, __ATOMIC_RELAXED);
+    do {
+	runner->next = old;
+    } while (!__atomic_compare_exchange_n(&sel->runner_stack, &old, runner,
+					  true, __ATOMIC_RELEASE,
+					  __ATOMIC_RELAXED));
+
+    /*
+     * Only the push that makes the stack non-empty needs to wake a
+     * thread, anything already there is handled by that wakeup.
+     * Threads check the stack under the timer lock before waiting, so
+     * the wakeup can't be missed.
+     */
+    if (!old) {
+	sel_timer_lock(sel);
+	i_sel_wake_first(sel);
+	sel_timer_unlock(sel);
     }
-    /* Make sure someone is awake to run the runner. */
-    i_sel_wake_first(sel);
-    sel_timer_unlock(sel);
     return 0;
 }
 
+/*
+ * Take all the runners waiting on from, in the order they were
+ * queued, and account for them in sel's stats.
+ */
+static sel_runner_t *
+take_runners(struct selector_s *sel, struct selector_s *from, bool stolen)
+{
+    sel_runner_t *runner, *next_runner, *list = NULL;
+    unsigned int depth = 0;
+
+    runner = __atomic_exchange_n(&from->runner_stack, NULL, __ATOMIC_ACQUIRE);
+
+    /* The stack is newest first, reverse it to run in order. */
+    while (runner) {
+	next_runner = runner->next;
+	runner->next = list;
+	list = runner;
+	runner = next_runner;
+	depth++;
+    }
+    if (!depth)
+	return NULL;
+    __atomic_sub_fetch(&from->runner_queued, depth, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&sel->stats_on, __ATOMIC_RELAXED)) {
+	sel_stats_add(&sel->stats.runner_batches, 1);
+	sel_stats_add(&sel->stats.runners, depth);
+	sel_stats_max(&sel->stats.runner_depth_max, depth);
+	if (stolen)
+	    sel_stats_add(&sel->stats.runners_stolen, depth);
+    }
+    return list;
+}
+
+/* Run a list from take_runners(), called with sel's timer lock held. */
 static unsigned int
-process_runners(struct selector_s *sel)
+run_runners(struct selector_s *sel, sel_runner_t *list)
 {
-    sel_runner_t *runner = sel->runner_head, *next_runner;
+    sel_runner_t *runner, *next_runner;
     int count = 0;
+    uint64_t start;
+    struct sel_stats_cb cb;
 
-    sel->runner_head = NULL;
-    sel->runner_tail = NULL;
+    runner = list;
     while (runner) {
 	sel_runner_func_t func;
 	void *cb_data;
 
 	next_runner = runner->next;
-	runner->in_use = 0;
 	func = runner->func;
 	cb_data = runner->cb_data;
+	/* After this the runner may be run again, don't touch it. */
+	__atomic_store_n(&runner->in_use, 0, __ATOMIC_RELEASE);
 	sel_timer_unlock(sel);
+	start = sel_stats_start(sel);
+	if (start)
+	    sel_stats_cb_init(sel, &cb, SEL_LOOP_CB_RUNNER, (void *) func,
+			      cb_data);
+	GENSIO_PROBE2(sel_runner_entry, sel, runner);
 	func(runner, cb_data);
+	GENSIO_PROBE2(sel_runner_return, sel, runner);
+	sel_stats_cb_done(sel, start, &cb);
 	count++;
 	sel_timer_lock(sel);
 	runner = next_runner;
@@ -1096,6 +2141,33 @@ process_runners(struct selector_s *sel)
     return count;
 }
 
+static unsigned int
+process_runners(struct selector_s *sel)
+{
+    return run_runners(sel, take_runners(sel, sel, false));
+}
+
+unsigned int
+sel_runners_queued(struct selector_s *sel)
+{
+    return __atomic_load_n(&sel->runner_queued, __ATOMIC_RELAXED);
+}
+
+unsigned int
+sel_steal_runners(struct selector_s *sel, struct selector_s *from)
+{
+    sel_runner_t *list;
+    unsigned int count = 0;
+
+    list = take_runners(sel, from, true);
+    if (list) {
+	sel_timer_lock(sel);
+	count = run_runners(sel, list);
+	sel_timer_unlock(sel);
+    }
+    return count;
+}
+
 static void
 handle_selector_call(struct selector_s *sel, fd_control_t *fdc,
 		     volatile fd_set *fdset, int enabled,
@@ -1103,6 +2175,8 @@ handle_selector_call(struct selector_s *sel, fd_control_t *fdc,
 {
     void             *data;
     fd_state_t       *state;
+    uint64_t         start;
+    struct sel_stats_cb cb;
 
     if (handler == NULL) {
 	/* Somehow we don't have a handler for this.
@@ -1126,7 +2200,11 @@ handle_selector_call(struct selector_s *sel, fd_control_t *fdc,
 	return;
     state->use_count++;
     sel_fd_unlock(sel);
+    start = sel_stats_start(sel);
+    if (start)
+	sel_stats_cb_init(sel, &cb, SEL_LOOP_CB_FD, (void *) handler, data);
     handler(fdc->fd, data);
+    sel_stats_cb_done(sel, start, &cb);
     sel_fd_lock(sel);
     state->use_count--;
     if (state->deleted && state->use_count == 0) {
@@ -1162,7 +2240,7 @@ setup_my_sigmask(sigset_t *sigmask, sigset_t *isigmask)
 static int
 process_fds(struct selector_s	    *sel,
 	    volatile struct timespec *timeout,
-	    sigset_t *isigmask)
+	    sigset_t *isigmask, uint64_t *woke)
 {
     fd_set      tmp_read_set;
     fd_set      tmp_write_set;
@@ -1189,6 +2267,8 @@ process_fds(struct selector_s	    *sel,
 		  &tmp_write_set,
 		  &tmp_except_set,
 		  (struct timespec *) timeout, &sigmask);
+    if (*woke)
+	*woke = sel_stats_now();
     if (err < 0) {
 	if (errno == EBADF || errno == EBADFD)
 	    /* We raced, just retry it. */
@@ -1213,85 +2293,970 @@ process_fds(struct selector_s	    *sel,
 	    handle_selector_call(sel, fdc, &sel->write_set, fdc->write_enabled,
 				 fdc->handle_write);
 	}
-	if (FD_ISSET(i, &tmp_except_set)) {
-	    valid_fd(sel, i, &fdc);
-	    handle_selector_call(sel, fdc, &sel->except_set,
-				 fdc->except_enabled, fdc->handle_except);
+	if (FD_ISSET(i, &tmp_except_set)) {
+	    valid_fd(sel, i, &fdc);
+	    handle_selector_call(sel, fdc, &sel->except_set,
+				 fdc->except_enabled, fdc->handle_except);
+	}
+    }
+ out_unlock:
+    sel_fd_unlock(sel);
+out:
+    return err;
+}
+
+#ifdef SEL_HAVE_WAKEFD
+/*
+ * If every thread waiting with a sel_wakefd_t watched the selector's
+ * fd, they would all wake up on every event.  Instead only one of
+ * them, the poller, has it armed.  The rest only wait for their own
+ * wakeup.  When the poller stops waiting it hands the job to another
+ * waiting thread by waking it with the handoff flag set, that thread
+ * then claims it and waits again.  See the functions below
+ * sel_select_intr_sigmask().
+ */
+static bool sel_wakefd_claim(struct selector_s *sel, sel_wakefd_t *w);
+static void sel_wakefd_release(struct selector_s *sel, sel_wakefd_t *w);
+static void sel_wakefd_kick(sel_wakefd_t *w);
+#endif
+
+#ifdef HAVE_EPOLL_PWAIT
+/*
+ * Per-thread eventfd wakeups.  Instead of sending a signal to wake a
+ * thread waiting in the selector, a thread may wait with its own
+ * sel_wakefd_t.  That holds an eventfd and a private epoll instance
+ * that watches both the eventfd and the selector's epoll (or
+ * io_uring) fd.  Waking the thread is just a write to the eventfd,
+ * and no signal mask needs to be installed while waiting.
+ *
+ * The private epoll is recreated in a forked process, since epoll
+ * and eventfd state is shared with the parent.  This is tracked with
+ * a generation count bumped by sel_setup_forked_process().
+ */
+#define SEL_WAKEFD_EVENT 0
+#define SEL_WAKEFD_SELECTOR 1
+
+static unsigned int sel_wakefd_fork_gen;
+
+struct sel_wakefd_s {
+    int efd;
+    int wfd;
+
+    /*
+     * The selector fd currently in wfd.  It is only armed while this
+     * thread is the selector's poller.
+     */
+    int selfd;
+
+    /* Set by sel_wakefd_send_sig() and by a poller handoff. */
+    unsigned int woken;
+    unsigned int handoff;
+
+    unsigned int fork_gen;
+};
+
+static void
+sel_wakefd_close(sel_wakefd_t *w)
+{
+    if (w->wfd >= 0)
+	close(w->wfd);
+    if (w->efd >= 0)
+	close(w->efd);
+    w->wfd = -1;
+    w->efd = -1;
+    w->selfd = -1;
+}
+
+static int
+sel_wakefd_open(sel_wakefd_t *w)
+{
+    struct epoll_event event;
+    int rv;
+
+    w->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->efd < 0)
+	return errno;
+    w->wfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->wfd < 0) {
+	rv = errno;
+	goto out_err;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = SEL_WAKEFD_EVENT;
+    if (epoll_ctl(w->wfd, EPOLL_CTL_ADD, w->efd, &event)) {
+	rv = errno;
+	goto out_err;
+    }
+    w->selfd = -1;
+    w->woken = 0;
+    w->handoff = 0;
+    w->fork_gen = sel_wakefd_fork_gen;
+    return 0;
+
+ out_err:
+    sel_wakefd_close(w);
+    return rv;
+}
+
+int
+sel_alloc_wakefd(sel_wakefd_t **rw)
+{
+    sel_wakefd_t *w;
+    int rv;
+
+    w = sel_alloc(sizeof(*w));
+    if (!w)
+	return ENOMEM;
+    w->efd = -1;
+    w->wfd = -1;
+    rv = sel_wakefd_open(w);
+    if (rv) {
+	free(w);
+	return rv;
+    }
+    *rw = w;
+    return 0;
+}
+
+void
+sel_free_wakefd(sel_wakefd_t *w)
+{
+    sel_wakefd_close(w);
+    free(w);
+}
+
+static void
+sel_wakefd_kick(sel_wakefd_t *w)
+{
+    uint64_t val = 1;
+
+    /* Can only fail if the counter is full, it's awake then anyway. */
+    if (write(w->efd, &val, sizeof(val)) < 0)
+	return;
+}
+
+void
+sel_wakefd_send_sig(long thread_id, void *cb_data)
+{
+    sel_wakefd_t *w = cb_data;
+
+    __atomic_store_n(&w->woken, 1, __ATOMIC_RELEASE);
+    sel_wakefd_kick(w);
+}
+
+bool
+sel_wakefd_supported(struct selector_s *sel)
+{
+    return sel->epollfd >= 0;
+}
+
+/*
+ * epoll_pwait() only takes the timeout in milliseconds, which rounds
+ * every timer up to the next millisecond.  Use epoll_pwait2() for
+ * the full resolution if the kernel has it (5.11 and later).  ts is
+ * the same time as timeout.
+ */
+static int
+sel_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+	       const struct timespec *ts, int timeout, const sigset_t *sigmask)
+{
+#ifdef HAVE_EPOLL_PWAIT2
+    static bool no_epoll_pwait2;
+    int rv;
+
+    if (!__atomic_load_n(&no_epoll_pwait2, __ATOMIC_RELAXED)) {
+	rv = epoll_pwait2(epfd, events, maxevents, ts, sigmask);
+	if (rv >= 0 || errno != ENOSYS)
+	    return rv;
+	__atomic_store_n(&no_epoll_pwait2, true, __ATOMIC_RELAXED);
+    }
+#endif
+    return epoll_pwait(epfd, events, maxevents, timeout, sigmask);
+}
+
+/* Arm or disarm the selector fd in the private epoll. */
+static int
+sel_wakefd_arm(sel_wakefd_t *w, bool arm)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLONESHOT;
+    if (arm)
+	event.events |= EPOLLIN;
+    event.data.u32 = SEL_WAKEFD_SELECTOR;
+    return epoll_ctl(w->wfd, EPOLL_CTL_MOD, w->selfd, &event);
+}
+
+/*
+ * Wait for the selector fd or the eventfd.  Returns -1 with errno
+ * EINTR if woken by sel_wakefd_send_sig(), the same as for a signal.
+ * Otherwise returns the same as epoll_wait().  The selector fd is
+ * only waited on if this thread can be the poller.
+ */
+static int
+sel_wakefd_wait(struct selector_s *sel, sel_wakefd_t *w, int selfd,
+		const struct timespec *ts, int timeout, sigset_t *sigmask)
+{
+    struct epoll_event events[2];
+    struct timespec left;
+    uint64_t val, end;
+    bool sel_ready, poller;
+    int rv, i, old_errno;
+
+    if (w->fork_gen != sel_wakefd_fork_gen) {
+	sel_wakefd_close(w);
+	rv = sel_wakefd_open(w);
+	if (rv) {
+	    errno = rv;
+	    return -1;
+	}
+    }
+
+    if (w->selfd != selfd) {
+	/* Moving between selectors, the old fd may already be gone. */
+	if (w->selfd >= 0)
+	    epoll_ctl(w->wfd, EPOLL_CTL_DEL, w->selfd, NULL);
+	/* Added disarmed, EPOLLONESHOT without EPOLLIN never fires. */
+	memset(&events[0], 0, sizeof(events[0]));
+	events[0].events = EPOLLONESHOT;
+	events[0].data.u32 = SEL_WAKEFD_SELECTOR;
+	if (epoll_ctl(w->wfd, EPOLL_CTL_ADD, selfd, &events[0]))
+	    return -1;
+	w->selfd = selfd;
+    }
+
+    end = sel_stats_now() + ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+    poller = false;
+ restart:
+    __atomic_store_n(&w->handoff, 0, __ATOMIC_RELAXED);
+    if (!poller && sel_wakefd_claim(sel, w)) {
+	poller = true;
+	if (sel_wakefd_arm(w, true)) {
+	    old_errno = errno;
+	    sel_wakefd_release(sel, w);
+	    errno = old_errno;
+	    return -1;
+	}
+    }
+
+    rv = sel_epoll_wait(w->wfd, events, 2, ts, timeout, sigmask);
+    old_errno = errno;
+
+    sel_ready = false;
+    for (i = 0; i < rv; i++) {
+	if (events[i].data.u32 == SEL_WAKEFD_EVENT) {
+	    while (read(w->efd, &val, sizeof(val)) > 0)
+		;
+	} else {
+	    /* EPOLLONESHOT disarmed it. */
+	    sel_ready = true;
+	}
+    }
+
+    if (rv > 0 && !sel_ready &&
+		!__atomic_exchange_n(&w->woken, 0, __ATOMIC_ACQUIRE)) {
+	/*
+	 * Just a handoff or a leftover kick, wait for the rest of the
+	 * time.  A poller stays the poller.
+	 */
+	val = sel_stats_now();
+	if (val < end) {
+	    val = end - val;
+	    left.tv_sec = val / 1000000000;
+	    left.tv_nsec = val % 1000000000;
+	    ts = &left;
+	    timeout = (val + 999999) / 1000000;
+	    goto restart;
+	}
+	rv = 0;
+    } else if (rv > 0 && !sel_ready) {
+	rv = -1;
+	old_errno = EINTR;
+    }
+
+    if (poller) {
+	if (!sel_ready)
+	    sel_wakefd_arm(w, false);
+	sel_wakefd_release(sel, w);
+    }
+    errno = old_errno;
+    return rv;
+}
+
+/*
+ * Handle a single event returned from epoll.  Must be called with
+ * the fd lock held.
+ */
+static void
+process_epoll_event(struct selector_s *sel, struct epoll_event *event)
+{
+    fd_control_t *fdc;
+
+    valid_fd(sel, (int) (uint32_t) event->data.u64, &fdc);
+    if ((uint32_t) (event->data.u64 >> 32) != fdc->gen)
+	/*
+	 * The fd was cleared or its handlers replaced since this was
+	 * armed, so it may be from the old user of the fd.  Whatever
+	 * replaced it has already armed its own event.
+	 */
+	return;
+    GENSIO_PROBE3(sel_fd_dispatch, sel, (int) (uint32_t) event->data.u64,
+		  event->events);
+    if ((event->events & EPOLLHUP) ||
+	    ((event->events & EPOLLERR) && !fdc->except_enabled)) {
+	/*
+	 * The crazy people that designed epoll made it so that EPOLLHUP
+	 * and EPOLLERR always wake it up, even if they are not set.  That
+	 * makes this fairly inconvenient, because we don't want to wake
+	 * up in that case unless we explicitly ask for it.  Fortunately,
+	 * in those cases we can pretty easily simulate it by just deleting
+	 * it, since in those cases you will not get anything but an
+	 * EPOLLHUP or EPOLLERR, anyway, and then doing the callback
+	 * by hand.
+	 *
+	 * If exceptions are enabled, EPOLLERR was asked for, and it
+	 * is not always fatal, things like zero-copy send completions
+	 * on the socket error queue set it.  Leave the fd armed
+	 * normally in that case, otherwise writes would stop.
+	 */
+	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
+	fdc->saved_events = event->events & (EPOLLHUP | EPOLLERR);
+    }
+    if (event->events & (EPOLLHUP | EPOLLERR))
+	/*
+	 * Have it handle read data, too, so if there is a pending
+	 * error it will get handled.
+	 */
+	event->events |= EPOLLIN;
+    if (event->events & (EPOLLIN | EPOLLHUP))
+	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
+			     fdc->handle_read);
+    if (event->events & EPOLLOUT)
+	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
+			     fdc->handle_write);
+    if (event->events & (EPOLLPRI | EPOLLERR))
+	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
+			     fdc->handle_except);
+
+    /* Rearm the event.  Remember it could have been deleted in the handler. */
+    if (fdc->state)
+	sel_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+/*
+ * Poll the fds without waiting until something shows up, a runner is
+ * queued, or the busy poll time (or the timeout, in msecs) is up.
+ * Returns the epoll_wait() result, 0 means go block.
+ */
+static int
+sel_busy_poll_epoll(struct selector_s *sel, struct epoll_event *events,
+		    int timeout)
+{
+    uint64_t usecs = __atomic_load_n(&sel->busy_poll_usecs, __ATOMIC_RELAXED);
+    uint64_t start, now, end;
+    int rv;
+
+    if (usecs == 0 || timeout == 0)
+	return 0;
+    if ((uint64_t) timeout * 1000 < usecs)
+	usecs = (uint64_t) timeout * 1000;
+
+    start = sel_stats_now();
+    end = start + usecs * 1000;
+    do {
+	rv = epoll_wait(sel->epollfd, events, sel->epoll_batch, 0);
+	if (rv != 0)
+	    break;
+	if (__atomic_load_n(&sel->runner_stack, __ATOMIC_ACQUIRE))
+	    break;
+	now = sel_stats_now();
+    } while (now < end);
+
+    if (__atomic_load_n(&sel->stats_on, __ATOMIC_RELAXED)) {
+	sel_stats_add(&sel->stats.busy_poll_nsecs, sel_stats_now() - start);
+	if (rv > 0)
+	    sel_stats_add(&sel->stats.busy_poll_hits, 1);
+	else
+	    sel_stats_add(&sel->stats.busy_poll_blocks, 1);
+    }
+    return rv;
+}
+
+static int
+process_fds_epoll(struct selector_s *sel, struct timespec *tstimeout,
+		  sigset_t *isigmask, sel_wakefd_t *w, uint64_t *woke)
+{
+    int rv, i;
+    struct epoll_event events[SEL_MAX_EPOLL_BATCH];
+    int timeout;
+    struct timespec ts = *tstimeout;
+    sigset_t sigmask;
+
+    if (!w)
+	setup_my_sigmask(&sigmask, isigmask);
+
+    if (tstimeout->tv_sec > 600) {
+	 /* Don't wait over 10 minutes, to work around an old epoll bug
+	    and avoid issues with timeout overflowing on 64-bit systems,
+	    which is much larger that 10 minutes, but who cares. */
+	timeout = 600 * 1000;
+	ts.tv_sec = 600;
+	ts.tv_nsec = 0;
+    } else {
+	timeout = ((tstimeout->tv_sec * 1000) +
+		   (tstimeout->tv_nsec + 999999) / 1000000);
+    }
+
+    rv = sel_busy_poll_epoll(sel, events, timeout);
+    if (rv) {
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (rv < 0)
+	    return rv;
+    } else if (w) {
+	rv = sel_wakefd_wait(sel, w, sel->epollfd, &ts, timeout, isigmask);
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (rv <= 0)
+	    return rv;
+	rv = epoll_wait(sel->epollfd, events, sel->epoll_batch, 0);
+	if (rv <= 0)
+	    /*
+	     * A thread waiting without a wakefd got it first.  Don't
+	     * report a timeout.
+	     */
+	    return rv < 0 ? rv : 1;
+    } else {
+	sigdelset(&sigmask, sel->wake_sig);
+	rv = sel_epoll_wait(sel->epollfd, events, sel->epoll_batch, &ts,
+			    timeout, &sigmask);
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (rv <= 0)
+	    return rv;
+    }
+
+    GENSIO_PROBE2(sel_wakeup, sel, rv);
+    sel_fd_lock(sel);
+    for (i = 0; i < rv; i++)
+	process_epoll_event(sel, &events[i]);
+    sel_fd_unlock(sel);
+
+    return rv;
+}
+
+#ifdef HAVE_IO_URING
+static int
+process_fds_uring(struct selector_s *sel, struct timespec *tstimeout,
+		  sigset_t *isigmask, sel_wakefd_t *w, uint64_t *woke)
+{
+    struct sel_uring_s *u = sel->uring;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    struct io_uring_cqe cqes[SEL_MAX_EPOLL_BATCH];
+    unsigned int head, tail, i, count = 0;
+    sigset_t sigmask;
+    int rv;
+
+    /* Retry anything a failed submit left behind. */
+    sel_uring_submit(u);
+
+    if (w) {
+	struct timespec wts = *tstimeout;
+	int timeout;
+
+	if (tstimeout->tv_sec > 600) {
+	    timeout = 600 * 1000;
+	    wts.tv_sec = 600;
+	    wts.tv_nsec = 0;
+	} else {
+	    timeout = ((tstimeout->tv_sec * 1000) +
+		       (tstimeout->tv_nsec + 999999) / 1000000);
+	}
+	rv = sel_wakefd_wait(sel, w, u->fd, &wts, timeout, isigmask);
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (rv <= 0)
+	    return rv;
+	if (__atomic_load_n(u->sq_flags, __ATOMIC_ACQUIRE) &
+		IORING_SQ_CQ_OVERFLOW)
+	    /* Get the kernel to flush overflowed completions. */
+	    sel_uring_enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    } else {
+	setup_my_sigmask(&sigmask, isigmask);
+	sigdelset(&sigmask, sel->wake_sig);
+
+	ts.tv_sec = tstimeout->tv_sec;
+	ts.tv_nsec = tstimeout->tv_nsec;
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask = (uint64_t) (uintptr_t) &sigmask;
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (uint64_t) (uintptr_t) &ts;
+
+	rv = sel_uring_enter(u->fd, 0, 1,
+			     IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			     &arg, sizeof(arg));
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (rv < 0) {
+	    if (errno == ETIME)
+		return 0;
+	    return rv;
+	}
+    }
+
+    sel_fd_lock(sel);
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && count < sel->epoll_batch) {
+	cqes[count++] = u->cqes[head & *u->cq_mask];
+	head++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    GENSIO_PROBE2(sel_wakeup, sel, count);
+    /* Rearms are collected and submitted together at the end. */
+    u->defer_submit++;
+    for (i = 0; i < count; i++) {
+	struct epoll_event event;
+	fd_control_t *fdc;
+	uint64_t data = cqes[i].user_data;
+
+	if (data == SEL_URING_IGNORE_DATA)
+	    continue;
+	fdc = get_fd(sel, (int) (data >> 32));
+	if (!fdc || !fdc->uring_armed || fdc->uring_seq != (uint32_t) data)
+	    /* A completion for a removed or replaced request. */
+	    continue;
+	fdc->uring_armed = 0;
+
+	memset(&event, 0, sizeof(event));
+	event.data.u64 = sel_epoll_data(fdc);
+	if (cqes[i].res < 0)
+	    /* Couldn't poll the fd, report it as an error on the fd. */
+	    event.events = EPOLLERR | EPOLLHUP;
+	else
+	    event.events = cqes[i].res;
+
+	process_epoll_event(sel, &event);
+    }
+    u->defer_submit--;
+    if (!u->defer_submit)
+	sel_uring_submit(u);
+    sel_fd_unlock(sel);
+
+    /* Returning 0 would be a timeout, so report something happened. */
+    return count ? count : 1;
+}
+
+/* Must be called with the fd lock held. */
+static int
+sel_uring_setup_fds(struct selector_s *sel)
+{
+    struct sel_uring_s *u;
+    fd_control_t *fdc;
+    unsigned int i;
+    int rv;
+
+    if (sel->uring) {
+	sel_uring_free(sel->uring);
+	sel->uring = NULL;
+    }
+    rv = sel_uring_alloc(&u);
+    if (rv)
+	return rv;
+    sel->uring = u;
+
+    u->defer_submit++;
+    for (i = 0; i < sel->fds_len; i++) {
+	fdc = sel->fds[i];
+	if (fdc) {
+	    fdc->uring_armed = 0;
+	    if (fdc->state)
+		sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+	}
+    }
+    u->defer_submit--;
+    return sel_uring_submit(u);
+}
+#endif
+
+int
+sel_setup_forked_process(struct selector_s *sel)
+{
+    int i;
+
+    /*
+     * More epoll stupidity.  In a forked process we must create a new
+     * epoll because the epoll state is shared between a parent and a
+     * child.  If it worked like it should, each epoll instance would
+     * be independent.  If you don't do this, disabling an fd in the
+     * child disables the parent, too, and vice versa.
+     */
+    close(sel->epollfd);
+    sel->epollfd = epoll_create(32768);
+    /* Thread wakeup fds must be recreated, too. */
+    sel_wakefd_fork_gen++;
+    if (sel->epollfd == -1) {
+	return errno;
+    }
+
+#ifdef HAVE_IO_URING
+    /* The same applies to io_uring, the rings are shared memory. */
+    if (sel->uring) {
+	int rv;
+
+	sel_fd_lock(sel);
+	rv = sel_uring_setup_fds(sel);
+	sel_fd_unlock(sel);
+	return rv;
+    }
+#endif
+
+    for (i = 0; i <= sel->maxfd; i++) {
+	fd_control_t *fdc = get_fd(sel, i);
+	if (fdc && fdc->state)
+	    sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+    }
+    return 0;
+}
+#elif defined(HAVE_KQUEUE)
+static unsigned int sel_wakefd_fork_gen;
+
+#ifdef EVFILT_USER
+/*
+ * Per-thread wakeups for kqueue.  Each sel_wakefd_t has a private
+ * kqueue with an EVFILT_USER event to wake it and the selector's
+ * kqueue fd added for reading.  Waking the thread is just triggering
+ * the user event.
+ *
+ * kqueues are not inherited by a child process, so the private
+ * kqueue is recreated after a fork (without closing the old fd
+ * number, it is not valid in the child and may have been reused).
+ */
+#define SEL_WAKEFD_EVENT 0
+
+struct sel_wakefd_s {
+    int kq;
+
+    /*
+     * The selector fd currently in kq.  It is only enabled while this
+     * thread is the selector's poller.
+     */
+    int selfd;
+
+    /* Set by sel_wakefd_send_sig() and by a poller handoff. */
+    unsigned int woken;
+    unsigned int handoff;
+
+    unsigned int fork_gen;
+};
+
+static int
+sel_wakefd_open(sel_wakefd_t *w)
+{
+    struct kevent ev;
+
+    w->kq = kqueue();
+    if (w->kq < 0)
+	return errno;
+    EV_SET(&ev, SEL_WAKEFD_EVENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(w->kq, &ev, 1, NULL, 0, NULL) < 0) {
+	int rv = errno;
+
+	close(w->kq);
+	w->kq = -1;
+	return rv;
+    }
+    w->selfd = -1;
+    w->woken = 0;
+    w->handoff = 0;
+    w->fork_gen = sel_wakefd_fork_gen;
+    return 0;
+}
+
+int
+sel_alloc_wakefd(sel_wakefd_t **rw)
+{
+    sel_wakefd_t *w;
+    int rv;
+
+    w = sel_alloc(sizeof(*w));
+    if (!w)
+	return ENOMEM;
+    rv = sel_wakefd_open(w);
+    if (rv) {
+	free(w);
+	return rv;
+    }
+    *rw = w;
+    return 0;
+}
+
+void
+sel_free_wakefd(sel_wakefd_t *w)
+{
+    if (w->kq >= 0 && w->fork_gen == sel_wakefd_fork_gen)
+	close(w->kq);
+    free(w);
+}
+
+static void
+sel_wakefd_kick(sel_wakefd_t *w)
+{
+    struct kevent ev;
+
+    EV_SET(&ev, SEL_WAKEFD_EVENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    kevent(w->kq, &ev, 1, NULL, 0, NULL);
+}
+
+void
+sel_wakefd_send_sig(long thread_id, void *cb_data)
+{
+    sel_wakefd_t *w = cb_data;
+
+    __atomic_store_n(&w->woken, 1, __ATOMIC_RELEASE);
+    sel_wakefd_kick(w);
+}
+
+bool
+sel_wakefd_supported(struct selector_s *sel)
+{
+    return sel->kqueuefd >= 0;
+}
+
+/*
+ * Enable or disable the selector fd in the private kqueue, it is
+ * added with EV_DISPATCH so reporting it disables it.
+ */
+static int
+sel_wakefd_arm(sel_wakefd_t *w, bool arm)
+{
+    struct kevent ev;
+
+    EV_SET(&ev, w->selfd, EVFILT_READ,
+	   (arm ? EV_ENABLE : EV_DISABLE) | EV_DISPATCH, 0, 0, NULL);
+    return kevent(w->kq, &ev, 1, NULL, 0, NULL) < 0 ? -1 : 0;
+}
+
+/*
+ * Wait for the selector fd or the user event.  Returns -1 with errno
+ * EINTR if woken by sel_wakefd_send_sig(), the same as for a signal.
+ * Otherwise returns the same as kevent().  The selector fd is only
+ * waited on if this thread can be the poller.
+ */
+static int
+sel_wakefd_wait(struct selector_s *sel, sel_wakefd_t *w, int selfd,
+		struct timespec *timeout)
+{
+    struct kevent events[2];
+    struct timespec left;
+    uint64_t now, end;
+    bool sel_ready, poller;
+    int rv, i, old_errno;
+
+    if (w->fork_gen != sel_wakefd_fork_gen) {
+	rv = sel_wakefd_open(w);
+	if (rv) {
+	    errno = rv;
+	    return -1;
+	}
+    }
+
+    if (w->selfd != selfd) {
+	/* Moving between selectors, the old fd may already be gone. */
+	if (w->selfd >= 0) {
+	    EV_SET(&events[0], w->selfd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	    kevent(w->kq, &events[0], 1, NULL, 0, NULL);
+	}
+	EV_SET(&events[0], selfd, EVFILT_READ,
+	       EV_ADD | EV_DISABLE | EV_DISPATCH, 0, 0, NULL);
+	if (kevent(w->kq, &events[0], 1, NULL, 0, NULL) < 0)
+	    return -1;
+	w->selfd = selfd;
+    }
+
+    end = (sel_stats_now() + timeout->tv_sec * 1000000000ULL +
+	   timeout->tv_nsec);
+    poller = false;
+ restart:
+    __atomic_store_n(&w->handoff, 0, __ATOMIC_RELAXED);
+    if (!poller && sel_wakefd_claim(sel, w)) {
+	poller = true;
+	if (sel_wakefd_arm(w, true)) {
+	    old_errno = errno;
+	    sel_wakefd_release(sel, w);
+	    errno = old_errno;
+	    return -1;
+	}
+    }
+
+    rv = kevent(w->kq, NULL, 0, events, 2, timeout);
+    old_errno = errno;
+
+    sel_ready = false;
+    for (i = 0; i < rv; i++) {
+	if (events[i].filter == EVFILT_READ)
+	    /* EV_DISPATCH disabled it. */
+	    sel_ready = true;
+    }
+
+    if (rv > 0 && !sel_ready &&
+		!__atomic_exchange_n(&w->woken, 0, __ATOMIC_ACQUIRE)) {
+	/* See sel_wakefd_wait() for epoll. */
+	now = sel_stats_now();
+	if (now < end) {
+	    now = end - now;
+	    left.tv_sec = now / 1000000000;
+	    left.tv_nsec = now % 1000000000;
+	    timeout = &left;
+	    goto restart;
 	}
+	rv = 0;
+    } else if (rv > 0 && !sel_ready) {
+	rv = -1;
+	old_errno = EINTR;
     }
- out_unlock:
-    sel_fd_unlock(sel);
-out:
-    return err;
+
+    if (poller) {
+	if (!sel_ready)
+	    sel_wakefd_arm(w, false);
+	sel_wakefd_release(sel, w);
+    }
+    errno = old_errno;
+    return rv;
+}
+#else
+int
+sel_alloc_wakefd(sel_wakefd_t **rw)
+{
+    return ENOTSUP;
 }
 
-#ifdef HAVE_EPOLL_PWAIT
-static int
-process_fds_epoll(struct selector_s *sel, struct timespec *tstimeout,
-		  sigset_t *isigmask)
+void
+sel_free_wakefd(sel_wakefd_t *w)
 {
-    int rv;
-    struct epoll_event event;
-    int timeout;
-    sigset_t sigmask;
-    fd_control_t *fdc;
-    unsigned long entry_fd_del_count = sel->fd_del_count;
+}
 
-    setup_my_sigmask(&sigmask, isigmask);
+void
+sel_wakefd_send_sig(long thread_id, void *cb_data)
+{
+}
 
-    if (tstimeout->tv_sec > 600)
-	 /* Don't wait over 10 minutes, to work around an old epoll bug
-	    and avoid issues with timeout overflowing on 64-bit systems,
-	    which is much larger that 10 minutes, but who cares. */
-	timeout = 600 * 1000;
-    else
-	timeout = ((tstimeout->tv_sec * 1000) +
-		   (tstimeout->tv_nsec + 999999) / 1000000);
+bool
+sel_wakefd_supported(struct selector_s *sel)
+{
+    return false;
+}
+#endif
 
-    sigdelset(&sigmask, sel->wake_sig);
-    rv = epoll_pwait(sel->epollfd, &event, 1, timeout, &sigmask);
-    if (rv <= 0)
-	return rv;
+/*
+ * Handle a single event returned from kevent().  Must be called with
+ * the fd lock held.
+ */
+static void
+process_kqueue_event(struct selector_s *sel, struct kevent *event)
+{
+    fd_control_t *fdc;
 
-    sel_fd_lock(sel);
-    valid_fd(sel, event.data.fd, &fdc);
-    if (entry_fd_del_count != sel->fd_del_count)
-	/* Something was deleted from the FD set, don't process this as it
-	   may be from the old fd wakeup. */
-	goto rearm;
-    if (event.events & (EPOLLHUP | EPOLLERR)) {
-	/*
-	 * The crazy people that designed epoll made it so that EPOLLHUP
-	 * and EPOLLERR always wake it up, even if they are not set.  That
-	 * makes this fairly inconvenient, because we don't want to wake
-	 * up in that case unless we explicitly ask for it.  Fortunately,
-	 * in those cases we can pretty easily simulate it by just deleting
-	 * it, since in those cases you will not get anything but an
-	 * EPOLLHUP or EPOLLERR, anyway, and then doing the callback
-	 * by hand.
-	 */
-	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
-	fdc->saved_events = event.events & (EPOLLHUP | EPOLLERR);
-	/*
-	 * Have it handle read data, too, so if there is a pending
-	 * error it will get handled.
-	 */
-	event.events |= EPOLLIN;
-    }
-    if (event.events & (EPOLLIN | EPOLLHUP))
+    valid_fd(sel, (int) event->ident, &fdc);
+    if ((uint32_t) (uintptr_t) event->udata != fdc->gen)
+	/* From an old user of the fd, see process_epoll_event(). */
+	return;
+
+    switch (event->filter) {
+    case EVFILT_READ:
 	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
 			     fdc->handle_read);
-    if (event.events & EPOLLOUT)
+	break;
+
+    case EVFILT_WRITE:
 	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
 			     fdc->handle_write);
-    if (event.events & (EPOLLPRI | EPOLLERR))
+	break;
+
+#ifdef EVFILT_EXCEPT
+    case EVFILT_EXCEPT:
 	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
 			     fdc->handle_except);
+	break;
+#endif
+    }
 
- rearm:
     /* Rearm the event.  Remember it could have been deleted in the handler. */
     if (fdc->state)
 	sel_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+static void
+sel_set_sigmask(sigset_t *sigmask, sigset_t *oldmask)
+{
+#ifdef USE_PTHREADS
+    pthread_sigmask(SIG_SETMASK, sigmask, oldmask);
+#else
+    sigprocmask(SIG_SETMASK, sigmask, oldmask);
+#endif
+}
+
+static int
+process_fds_kqueue(struct selector_s *sel, volatile struct timespec *tstimeout,
+		   sigset_t *isigmask, sel_wakefd_t *w, uint64_t *woke)
+{
+    struct kevent events[SEL_MAX_EPOLL_BATCH];
+    struct timespec timeout, zero = { 0, 0 };
+    sigset_t sigmask, oldmask;
+    int rv, i, old_errno;
+
+#ifdef SEL_HAVE_WAKEFD
+    if (w) {
+	/* Same race as below with a user mask, but only with that. */
+	if (isigmask)
+	    sel_set_sigmask(isigmask, &oldmask);
+	timeout = *tstimeout;
+	rv = sel_wakefd_wait(sel, w, sel->kqueuefd, &timeout);
+	if (*woke)
+	    *woke = sel_stats_now();
+	if (isigmask) {
+	    old_errno = errno;
+	    sel_set_sigmask(&oldmask, NULL);
+	    errno = old_errno;
+	}
+	if (rv <= 0)
+	    return rv;
+	rv = kevent(sel->kqueuefd, NULL, 0, events, sel->epoll_batch, &zero);
+	if (rv <= 0)
+	    /* Someone else got it first, see process_fds_epoll(). */
+	    return rv < 0 ? rv : 1;
+    } else
+#endif
+    {
+	/*
+	 * kevent() can't atomically set the signal mask, so this is
+	 * like a non-atomic pselect().  BROKEN_PSELECT is set on the
+	 * platforms with kqueue, so the timeout is zeroed before a
+	 * wakeup signal is sent and is read after the signal is
+	 * unblocked.
+	 */
+	setup_my_sigmask(&sigmask, isigmask);
+	sigdelset(&sigmask, sel->wake_sig);
+	sel_set_sigmask(&sigmask, &oldmask);
+	timeout = *tstimeout;
+	rv = kevent(sel->kqueuefd, NULL, 0, events, sel->epoll_batch,
+		    &timeout);
+	old_errno = errno;
+	if (*woke)
+	    *woke = sel_stats_now();
+	sel_set_sigmask(&oldmask, NULL);
+	errno = old_errno;
+	if (rv <= 0)
+	    return rv;
+    }
+
+    sel_fd_lock(sel);
+    for (i = 0; i < rv; i++)
+	process_kqueue_event(sel, &events[i]);
     sel_fd_unlock(sel);
 
     return rv;
@@ -1303,22 +3268,21 @@ sel_setup_forked_process(struct selector_s *sel)
     int i;
 
     /*
-     * More epoll stupidity.  In a forked process we must create a new
-     * epoll because the epoll state is shared between a parent and a
-     * child.  If it worked like it should, each epoll instance would
-     * be independent.  If you don't do this, disabling an fd in the
-     * child disables the parent, too, and vice versa.
+     * kqueues are not inherited by the child, so there is nothing to
+     * close, just make a new one and add everything back.
      */
-    close(sel->epollfd);
-    sel->epollfd = epoll_create(32768);
-    if (sel->epollfd == -1) {
+    sel->kqueuefd = kqueue();
+    sel_wakefd_fork_gen++;
+    if (sel->kqueuefd == -1)
 	return errno;
-    }
 
     for (i = 0; i <= sel->maxfd; i++) {
-	fd_control_t *fdc = sel->fds[i];
-	if (fdc && fdc->state)
+	fd_control_t *fdc = get_fd(sel, i);
+
+	if (fdc && fdc->state) {
+	    fdc->kq_filters = 0;
 	    sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+	}
     }
     return 0;
 }
@@ -1329,6 +3293,93 @@ sel_setup_forked_process(struct selector_s *sel)
     /* Nothing to do. */
     return 0;
 }
+
+int
+sel_alloc_wakefd(sel_wakefd_t **rw)
+{
+    return ENOTSUP;
+}
+
+void
+sel_free_wakefd(sel_wakefd_t *w)
+{
+}
+
+void
+sel_wakefd_send_sig(long thread_id, void *cb_data)
+{
+}
+
+bool
+sel_wakefd_supported(struct selector_s *sel)
+{
+    return false;
+}
+#endif
+
+#ifdef SEL_HAVE_WAKEFD
+/*
+ * Become the selector's poller if nobody else is.  A thread waiting
+ * on another selector can't be the poller here, it was removed as
+ * poller when it stopped waiting.
+ */
+static bool
+sel_wakefd_claim(struct selector_s *sel, sel_wakefd_t *w)
+{
+    sel_wakefd_t *none = NULL;
+
+    return __atomic_compare_exchange_n(&sel->wakefd_poller, &none, w, false,
+				       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/*
+ * Pass the poller job to the most recent other wakefd waiter.  Must
+ * be called with the timer lock held, that keeps the wait list
+ * stable.  If the chosen thread has already stopped waiting it passes
+ * it on again in i_sel_wakefd_leave().
+ */
+static void
+i_sel_wakefd_handoff(struct selector_s *sel, sel_wakefd_t *w)
+{
+    sel_wait_list_t *item;
+    sel_wakefd_t *other;
+
+    for (item = sel->wait_list.next; item != &sel->wait_list;
+	 item = item->next) {
+	if (item->send_sig != sel_wakefd_send_sig)
+	    continue;
+	other = item->send_sig_cb_data;
+	if (other == w)
+	    continue;
+	__atomic_store_n(&other->handoff, 1, __ATOMIC_RELEASE);
+	sel_wakefd_kick(other);
+	break;
+    }
+}
+
+/* Stop being the poller and let another waiting thread take it. */
+static void
+sel_wakefd_release(struct selector_s *sel, sel_wakefd_t *w)
+{
+    __atomic_store_n(&sel->wakefd_poller, NULL, __ATOMIC_RELEASE);
+    sel_timer_lock(sel);
+    i_sel_wakefd_handoff(sel, w);
+    sel_timer_unlock(sel);
+}
+
+/*
+ * Called with the timer lock held when a wakefd thread leaves the
+ * wait list.  A handoff it didn't act on is passed on, otherwise no
+ * thread may be watching the selector's fd.
+ */
+static void
+i_sel_wakefd_leave(struct selector_s *sel, sel_wakefd_t *w)
+{
+    if (!__atomic_exchange_n(&w->handoff, 0, __ATOMIC_ACQUIRE))
+	return;
+    if (!__atomic_load_n(&sel->wakefd_poller, __ATOMIC_ACQUIRE))
+	i_sel_wakefd_handoff(sel, w);
+}
 #endif
 
 int
@@ -1346,17 +3397,25 @@ sel_select_intr_sigmask(struct selector_s *sel,
     unsigned int    count;
     struct timeval  end = { 0, 0 }, now;
     int user_timeout = 0;
+    uint64_t        stats_start, stats_wait = 0, stats_woke = 0;
+#if defined(HAVE_EPOLL_PWAIT) || defined(HAVE_KQUEUE)
+    sel_wakefd_t    *wakefd = NULL;
+
+    if (send_sig == sel_wakefd_send_sig)
+	wakefd = cb_data;
+#endif
 
     if (timeout) {
 	sel_get_monotonic_time(&now);
 	add_timeval(&end, &now, timeout);
     }
 
+    stats_start = sel_stats_start(sel);
     sel_timer_lock(sel);
     count = process_runners(sel);
     process_timers(sel, &count, &tmp_timeout, &wake_time);
 
-    if (count == 0 && !sel->runner_head) {
+    if (count == 0 && !__atomic_load_n(&sel->runner_stack, __ATOMIC_ACQUIRE)) {
 	/* Didn't do anything and no runners waiting, wait for something. */
 	if (timeout) {
 	    if (cmp_timeval(&tmp_timeout, timeout) >= 0) {
@@ -1372,12 +3431,28 @@ sel_select_intr_sigmask(struct selector_s *sel,
 			  &wake_time, &loc_timeout);
 	sel_timer_unlock(sel);
 
+	if (stats_start)
+	    /* The backend sets this to the time the wait returned. */
+	    stats_woke = stats_wait = sel_stats_now();
+#ifdef HAVE_IO_URING
+	if (sel->uring)
+	    err = process_fds_uring(sel, &loc_timeout, sigmask, wakefd,
+				    &stats_woke);
+	else
+#endif
 #ifdef HAVE_EPOLL_PWAIT
 	if (sel->epollfd >= 0)
-	    err = process_fds_epoll(sel, &loc_timeout, sigmask);
+	    err = process_fds_epoll(sel, &loc_timeout, sigmask, wakefd,
+				    &stats_woke);
+	else
+#endif
+#ifdef HAVE_KQUEUE
+	if (sel->kqueuefd >= 0)
+	    err = process_fds_kqueue(sel, &loc_timeout, sigmask, wakefd,
+				     &stats_woke);
 	else
 #endif
-	    err = process_fds(sel, &loc_timeout, sigmask);
+	    err = process_fds(sel, &loc_timeout, sigmask, &stats_woke);
 
 	old_errno = errno;
 
@@ -1399,6 +3474,10 @@ sel_select_intr_sigmask(struct selector_s *sel,
 	}
 
 	remove_sel_wait_list(sel, &wait_entry);
+#ifdef SEL_HAVE_WAKEFD
+	if (wakefd)
+	    i_sel_wakefd_leave(sel, wakefd);
+#endif
 
 	/*
 	 * Process runners before and after the wait.  This way any
@@ -1408,8 +3487,25 @@ sel_select_intr_sigmask(struct selector_s *sel,
 	 * we timed out we want to alert the user of that.
 	 */
 	process_runners(sel);
+    } else if (count == 0) {
+	/*
+	 * A runner was queued after we looked, which is not a
+	 * timeout.  Have the caller come back around to run it.
+	 */
+	count = 1;
     }
     sel_timer_unlock(sel);
+    if (stats_start) {
+	uint64_t busy = sel_stats_now() - stats_start;
+
+	if (stats_wait) {
+	    busy -= stats_woke - stats_wait;
+	    sel_stats_add(&sel->stats.wakeups, 1);
+	}
+	sel_stats_add(&sel->stats.iterations, 1);
+	sel_stats_add(&sel->stats.iter_nsecs, busy);
+	sel_stats_max(&sel->stats.iter_max_nsecs, busy);
+    }
     if (timeout) {
 	sel_get_monotonic_time(&now);
 	diff_timeval(timeout, &end, &now);
@@ -1488,6 +3584,7 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     struct selector_s *sel;
     int rv;
     sigset_t sigset;
+    char *s;
 
     sel = sel_alloc(sizeof(*sel));
     if (!sel)
@@ -1509,8 +3606,6 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     FD_ZERO((fd_set *) &sel->write_set);
     FD_ZERO((fd_set *) &sel->except_set);
 
-    memset(sel->fds, 0, sizeof(sel->fds));
-
     theap_init(&sel->timer_heap);
 
     if (sel->sel_lock_alloc) {
@@ -1545,12 +3640,209 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     if (sel->epollfd == -1)
 	syslog(LOG_ERR, "Unable to set up epoll, falling back to select: %m");
 #endif
+#ifdef HAVE_KQUEUE
+    sel->kqueuefd = kqueue();
+    if (sel->kqueuefd == -1)
+	syslog(LOG_ERR, "Unable to set up kqueue, falling back to select: %m");
+#endif
+#if defined(HAVE_EPOLL_PWAIT) || defined(HAVE_KQUEUE)
+    sel->epoll_batch = SEL_DEFAULT_EPOLL_BATCH;
+    s = getenv("GENSIO_SEL_EPOLL_BATCH");
+    if (s) {
+	char *end;
+	unsigned long val = strtoul(s, &end, 0);
+
+	if (*s && !*end)
+	    sel_set_epoll_batch(sel, val);
+    }
+#endif
+#ifdef HAVE_EPOLL_PWAIT
+    s = getenv("GENSIO_SEL_BUSY_POLL");
+    if (s && sel->epollfd >= 0) {
+	char *end;
+	unsigned long val = strtoul(s, &end, 0);
+
+	if (*s && !*end && val <= 1000000)
+	    sel->busy_poll_usecs = val;
+    }
+#endif
+    s = getenv("GENSIO_SEL_TIMER_WHEEL");
+    if (s) {
+	char *end;
+	unsigned long val = strtoul(s, &end, 0);
+
+	if (*s && !*end && val > 0 && val <= 1000000)
+	    sel_set_timer_wheel(sel, val);
+    }
+#ifdef HAVE_IO_URING
+    s = getenv("GENSIO_SEL_IO_URING");
+    if (s && *s && strcmp(s, "0") != 0 && sel->epollfd >= 0) {
+	rv = sel_uring_alloc(&sel->uring);
+	if (rv)
+	    syslog(LOG_ERR, "Unable to set up io_uring, using epoll: %s",
+		   strerror(rv));
+    }
+#endif
 
     *new_selector = sel;
 
     return 0;
 }
 
+int
+sel_set_loop_stats(struct selector_s *sel, bool enable,
+		   unsigned int long_cb_usecs, sel_loop_resolve_cb resolve)
+{
+    __atomic_store_n(&sel->stats_on, false, __ATOMIC_RELAXED);
+    if (!enable)
+	return 0;
+
+    /*
+     * A callback running in another thread may still add to the old
+     * numbers, that's harmless.
+     */
+    memset(&sel->stats, 0, sizeof(sel->stats));
+    sel->long_idx = 0;
+    sel->long_cb_nsecs = (uint64_t) long_cb_usecs * 1000;
+    sel->resolve = resolve;
+    sel->stats_start = sel_stats_now();
+    __atomic_store_n(&sel->stats_on, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+sel_get_loop_stats(struct selector_s *sel, struct sel_loop_stats *stats)
+{
+    unsigned int i, n, idx;
+
+    if (!__atomic_load_n(&sel->stats_on, __ATOMIC_ACQUIRE))
+	return EINVAL;
+
+    /* Counters may be a little inconsistent with each other. */
+    *stats = sel->stats;
+    stats->elapsed_nsecs = sel_stats_now() - sel->stats_start;
+    stats->long_cb_nsecs = sel->long_cb_nsecs;
+    stats->runner_queued = sel_runners_queued(sel);
+
+    /* Give the saved long callbacks newest first. */
+    idx = __atomic_load_n(&sel->long_idx, __ATOMIC_RELAXED);
+    n = idx < SEL_LOOP_NR_LONG_CBS ? idx : SEL_LOOP_NR_LONG_CBS;
+    for (i = 0; i < n; i++)
+	stats->recent_long[i] =
+	    sel->stats.recent_long[(idx - 1 - i) % SEL_LOOP_NR_LONG_CBS];
+    stats->nr_recent_long = n;
+    return 0;
+}
+
+int
+sel_set_timer_wheel(struct selector_s *sel, unsigned int granularity_us)
+{
+    struct sel_wheel_s *w = NULL;
+    struct timeval now;
+    int rv = 0;
+
+    if (granularity_us) {
+	w = sel_alloc(sizeof(*w));
+	if (!w)
+	    return ENOMEM;
+	w->granularity = granularity_us;
+	sel_get_monotonic_time(&now);
+	w->epoch = wheel_tv_to_usecs(&now);
+	w->expired_tail = &w->expired;
+    }
+
+    sel_timer_lock(sel);
+    if ((sel->wheel && sel->wheel->count) || theap_get_top(&sel->timer_heap)) {
+	rv = EBUSY;
+    } else {
+	if (sel->wheel)
+	    free(sel->wheel);
+	sel->wheel = w;
+	w = NULL;
+    }
+    sel_timer_unlock(sel);
+
+    if (w)
+	free(w);
+    return rv;
+}
+
+int
+sel_set_epoll_batch(struct selector_s *sel, unsigned int count)
+{
+#if defined(HAVE_EPOLL_PWAIT) || defined(HAVE_KQUEUE)
+    if (count == 0)
+	return EINVAL;
+    if (count > SEL_MAX_EPOLL_BATCH)
+	count = SEL_MAX_EPOLL_BATCH;
+    sel->epoll_batch = count;
+#endif
+    return 0;
+}
+
+int
+sel_set_busy_poll(struct selector_s *sel, unsigned int usecs)
+{
+#ifdef HAVE_EPOLL_PWAIT
+#ifdef HAVE_IO_URING
+    if (sel->uring)
+	return ENOSYS;
+#endif
+    if (sel->epollfd < 0)
+	return ENOSYS;
+    if (usecs > 1000000)
+	return EINVAL;
+    __atomic_store_n(&sel->busy_poll_usecs, usecs, __ATOMIC_RELAXED);
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+int
+sel_get_poll_fd(struct selector_s *sel)
+{
+#ifdef HAVE_IO_URING
+    if (sel->uring)
+	return -1;
+#endif
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd >= 0)
+	return sel->epollfd;
+#endif
+#ifdef HAVE_KQUEUE
+    if (sel->kqueuefd >= 0)
+	return sel->kqueuefd;
+#endif
+    return -1;
+}
+
+int
+sel_get_next_timeout(struct selector_s *sel, struct timeval *timeout)
+{
+    struct timeval now, next;
+    int rv = 0;
+
+    sel_timer_lock(sel);
+    if (__atomic_load_n(&sel->runner_stack, __ATOMIC_ACQUIRE)) {
+	timeout->tv_sec = 0;
+	timeout->tv_usec = 0;
+    } else if (sel_timers_next(sel, &next)) {
+	sel_get_monotonic_time(&now);
+	if (cmp_timeval(&next, &now) <= 0) {
+	    timeout->tv_sec = 0;
+	    timeout->tv_usec = 0;
+	} else {
+	    diff_timeval(timeout, &next, &now);
+	}
+    } else {
+	rv = ENOENT;
+    }
+    sel_timer_unlock(sel);
+
+    return rv;
+}
+
 int
 sel_alloc_selector_nothread(struct selector_s **new_selector)
 {
@@ -1564,27 +3856,36 @@ sel_free_selector(struct selector_s *sel)
     sel_timer_t *elem;
     unsigned int i;
 
-    elem = theap_get_top(&(sel->timer_heap));
+    elem = sel_timers_get_any(sel);
     while (elem) {
-	theap_remove(&(sel->timer_heap), elem);
-	elem->val.in_heap = 0;
 	free(elem);
-	elem = theap_get_top(&(sel->timer_heap));
+	elem = sel_timers_get_any(sel);
     }
+    if (sel->wheel)
+	free(sel->wheel);
+#ifdef HAVE_IO_URING
+    if (sel->uring)
+	sel_uring_free(sel->uring);
+#endif
 #ifdef HAVE_EPOLL_PWAIT
     if (sel->epollfd >= 0)
 	close(sel->epollfd);
 #endif
-    for (i = 0; i < FD_SETSIZE; i++) {
-	while (sel->fds[i]) {
-	    fd_control_t *fdc = sel->fds[i];
+#ifdef HAVE_KQUEUE
+    if (sel->kqueuefd >= 0)
+	close(sel->kqueuefd);
+#endif
+    for (i = 0; i < sel->fds_len; i++) {
+	fd_control_t *fdc = sel->fds[i];
 
-	    sel->fds[i] = fdc->next;
+	if (fdc) {
 	    if (fdc->state)
 		free(fdc->state);
 	    free(fdc);
 	}
     }
+    if (sel->fds)
+	free(sel->fds);
     if (sel->fd_lock)
 	sel->sel_lock_free(sel->fd_lock);
     if (sel->timer_lock)
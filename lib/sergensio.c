@@ -368,6 +368,48 @@ sergensio_signature(struct sergensio *sio, const char *sig, unsigned int len,
     return rv;
 }
 
+struct sergensio_done_line_config_data {
+    struct sergensio *sio;
+    sergensio_done_line_config done;
+    void *cb_data;
+};
+
+static void
+sg_done_line_config(struct sergensio *sio, int err,
+		    const struct sergensio_line_config *cfg, void *cb_data)
+{
+    struct sergensio_done_line_config_data *d = cb_data;
+
+    d->done(d->sio, err, cfg, d->cb_data);
+    d->sio->o->free(d->sio->o, d);
+}
+
+int
+sergensio_line_config(struct sergensio *sio,
+		      const struct sergensio_line_config *cfg,
+		      sergensio_done_line_config done, void *cb_data)
+{
+    struct sergensio_done_line_config_data *d = NULL;
+    struct gensio_os_funcs *o = sio->o;
+    int rv;
+
+    if (done) {
+	d = o->zalloc(o, sizeof(*d));
+	if (!d)
+	    return GE_NOMEM;
+	d->sio = sio;
+	d->done = done;
+	d->cb_data = cb_data;
+	done = sg_done_line_config;
+	cb_data = d;
+    }
+    rv = sio->func(sio, SERGENSIO_FUNC_LINE_CONFIG, 0, (char *) cfg,
+		   done, cb_data);
+    if (d && rv)
+	o->free(o, cb_data);
+    return rv;
+}
+
 int
 sergensio_modemstate(struct sergensio *sio, unsigned int val)
 {
@@ -17,10 +17,19 @@
 #include <gensio/sergensio_class.h>
 #include <gensio/gensio_ll_fd.h>
 #include <gensio/gensio_osops.h>
+#include <gensio/gensio_os_funcs_public.h>
+#include <gensio/gensio_time.h>
 
 #include "uucplock.h"
 #include "utils.h"
 
+#if defined(USE_PTHREADS) && !defined(_WIN32)
+#define SERIALDEV_MODEMWAIT 1
+#include <signal.h>
+#else
+#define SERIALDEV_MODEMWAIT 0
+#endif
+
 static int
 speedstr_to_speed(const char *speed, const char **rest)
 {
@@ -80,6 +89,8 @@ struct termio_op_q {
     int op;
     int (*xlat)(struct sterm_data *, bool get, int *oval, int val);
     void (*done)(struct sergensio *sio, int err, int val, void *cb_data);
+    /* If set, this is a line config and done is not used. */
+    sergensio_done_line_config cfg_done;
     void *cb_data;
     struct termio_op_q *next;
 };
@@ -101,6 +112,8 @@ struct sterm_data {
     int close_timeouts_left;
     int char_timeouts_left;
     int last_close_outq_count;
+    bool close_draining;
+    int close_wait_ticks; /* 100ths of a second since the last check. */
 
     char *devname;
     char *parms;
@@ -121,6 +134,47 @@ struct sterm_data {
 
     bool no_uucp_lock;
 
+    /*
+     * Low latency mode, set ASYNC_LOW_LATENCY on the port.  If
+     * lowlat_poll is not zero, after a read keep trying to read for
+     * that many microseconds after the last data before going back
+     * to the selector.  lowlat_got is set when a read gets data.
+     */
+    bool lowlatency;
+    unsigned int lowlat_poll;
+    bool lowlat_got;
+
+    /*
+     * USB serial adapter tuning, set at open if not zero.  The
+     * adapter latency timer in milliseconds and the driver transfer
+     * size in bytes.
+     */
+    unsigned int usb_latency;
+    unsigned int xfer_size;
+
+    /*
+     * Frame gap packetization.  If framegap (in tenths of character
+     * times) is not zero, received bytes collect in frame_buf until
+     * the line has been idle that long, then go up as one read.
+     * frame_done means the frame is complete and waiting to be
+     * delivered.  frame_timer checks the gap, frame_in_timer is set
+     * while its handler runs without the lock.  frame_buf is
+     * allocated on the first frame, in lean mode it is freed when
+     * empty.
+     */
+    unsigned int framegap;
+    bool lean;
+    unsigned char *frame_buf;
+    gensiods frame_size;
+    gensiods frame_len;
+    bool frame_done;
+    int64_t frame_gap_nsecs;
+    gensio_time frame_last_rx;
+    struct gensio_timer *frame_timer;
+    bool frame_timer_running;
+    bool frame_timer_stopped;
+    bool frame_in_timer;
+
     void *default_sercfg;
     int def_baud;
     int def_parity;
@@ -147,6 +201,44 @@ struct sterm_data {
     unsigned int modemstate_mask;
     bool handling_modemstate;
     bool sent_first_modemstate;
+
+    /*
+     * If modemwait is set and the device can do it, a thread waits
+     * for modem line changes and kicks the timer when one happens,
+     * instead of the timer polling the lines every second.  mw_tried
+     * is set once this has been attempted for an open.  mw_active is
+     * set while the thread is doing the work, it is cleared if the
+     * driver can't wait.  mw_stop tells the thread to exit, the close
+     * interrupts it until mw_running goes false, then joins it.
+     */
+    bool modemwait;
+#if SERIALDEV_MODEMWAIT
+    bool mw_tried;
+    bool mw_started;
+    bool mw_running;
+    bool mw_active;
+    bool mw_stop;
+    struct gensio_thread *mw_thread;
+
+    /*
+     * A thread waits for the transmitter to drain, so a close or a
+     * GENSIO_CONTROL_TX_DRAIN finishes when the last character is
+     * out instead of polling the output queue.  dr_started is set
+     * from starting the thread until drain_runner is done with it,
+     * dr_running while it waits.  dr_again waits again for data
+     * written since it started, dr_report delivers
+     * GENSIO_EVENT_SER_TX_DONE to the user.  dr_notsup is set if the
+     * device can't do it this open.
+     */
+    bool dr_started;
+    bool dr_running;
+    bool dr_again;
+    bool dr_report;
+    bool dr_notsup;
+    int dr_err;
+    struct gensio_thread *dr_thread;
+    struct gensio_runner *drain_runner;
+#endif
 };
 
 static int
@@ -236,6 +328,9 @@ sterm_start_deferred_op(struct sterm_data *sdata)
     }
 }
 
+static int serconf_get_line_config(struct sterm_data *sdata,
+				   struct sergensio_line_config *cfg);
+
 static void
 serconf_process(struct sterm_data *sdata)
 {
@@ -245,6 +340,17 @@ serconf_process(struct sterm_data *sdata)
 
 	sdata->termio_q = qe->next;
 
+	if (qe->cfg_done) {
+	    struct sergensio_line_config cfg;
+
+	    err = serconf_get_line_config(sdata, &cfg);
+	    sterm_unlock(sdata);
+	    qe->cfg_done(sdata->sio, err, &cfg, qe->cb_data);
+	    sdata->o->free(sdata->o, qe);
+	    sterm_lock(sdata);
+	    continue;
+	}
+
 	err = sdata->o->iod_control(sdata->iod, qe->op, true, (intptr_t) &val);
 	if (!err && qe->xlat)
 	    err = qe->xlat(sdata, true, &val, val);
@@ -255,6 +361,21 @@ serconf_process(struct sterm_data *sdata)
     }
 }
 
+static void
+serconf_queue(struct sterm_data *sdata, struct termio_op_q *qe)
+{
+    if (!sdata->termio_q) {
+	sdata->termio_q = qe;
+	sterm_start_deferred_op(sdata);
+    } else {
+	struct termio_op_q *curr = sdata->termio_q;
+
+	while (curr->next)
+	    curr = curr->next;
+	curr->next = qe;
+    }
+}
+
 static void
 serconf_clear_q(struct sterm_data *sdata)
 {
@@ -311,18 +432,8 @@ serconf_set_get(struct sterm_data *sdata, int op, int val,
 	    goto out_unlock;
     }
 
-    if (qe) {
-	if (!sdata->termio_q) {
-	    sdata->termio_q = qe;
-	    sterm_start_deferred_op(sdata);
-	} else {
-	    struct termio_op_q *curr = sdata->termio_q;
-
-	    while (curr->next)
-		curr = curr->next;
-	    curr->next = qe;
-	}
-    }
+    if (qe)
+	serconf_queue(sdata, qe);
  out_unlock:
     if (err && qe)
 	sdata->o->free(sdata->o, qe);
@@ -463,6 +574,130 @@ sterm_flowcontrol(struct sergensio *sio, int flowcontrol,
 			   serconf_xlat_flowcontrol, done, cb_data);
 }
 
+static int
+serconf_get_line_config(struct sterm_data *sdata,
+			struct sergensio_line_config *cfg)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    int err, val;
+
+    memset(cfg, 0, sizeof(*cfg));
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_BAUD, true,
+			 (intptr_t) &val);
+    if (err)
+	return err;
+    cfg->baud = val;
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DATASIZE, true,
+			 (intptr_t) &val);
+    if (err)
+	return err;
+    cfg->datasize = val;
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_PARITY, true,
+			 (intptr_t) &val);
+    if (err)
+	return err;
+    cfg->parity = val;
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_STOPBITS, true,
+			 (intptr_t) &val);
+    if (err)
+	return err;
+    cfg->stopbits = val;
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTSCTS, true,
+			 (intptr_t) &val);
+    if (!err)
+	err = serconf_xlat_flowcontrol(sdata, true, &val, val);
+    if (err)
+	return err;
+    cfg->flowcontrol = val;
+    return 0;
+}
+
+/*
+ * Set everything in the termios copy and apply it once, so a client
+ * setting up the port doesn't do a tcsetattr() and a callback for
+ * each setting.  On an error the old settings are put back.
+ */
+static int
+sterm_line_config(struct sergensio *sio,
+		  const struct sergensio_line_config *cfg,
+		  sergensio_done_line_config done, void *cb_data)
+{
+    struct sterm_data *sdata = sergensio_get_gensio_data(sio);
+    struct gensio_os_funcs *o = sdata->o;
+    struct termio_op_q *qe = NULL;
+    void *saved = NULL;
+    int err = 0, val;
+
+    if (sdata->write_only)
+	return GE_NOTSUP;
+
+    switch (cfg->flowcontrol) {
+    case 0:
+    case SERGENSIO_FLOWCONTROL_NONE:
+    case SERGENSIO_FLOWCONTROL_RTS_CTS:
+    case SERGENSIO_FLOWCONTROL_XON_XOFF:
+	break;
+
+    default:
+	return GE_INVAL;
+    }
+
+    if (done) {
+	qe = o->zalloc(o, sizeof(*qe));
+	if (!qe)
+	    return GE_NOMEM;
+	qe->cfg_done = done;
+	qe->cb_data = cb_data;
+    }
+
+    sterm_lock(sdata);
+    if (!sdata->open) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+
+    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_SERDATA, true,
+			 (intptr_t) &saved);
+    if (err)
+	goto out_unlock;
+
+    if (cfg->baud)
+	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_BAUD, false,
+			     cfg->baud);
+    if (!err && cfg->datasize)
+	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DATASIZE, false,
+			     cfg->datasize);
+    if (!err && cfg->parity)
+	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_PARITY, false,
+			     cfg->parity);
+    if (!err && cfg->stopbits)
+	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_STOPBITS, false,
+			     cfg->stopbits);
+    if (!err && cfg->flowcontrol) {
+	err = serconf_xlat_flowcontrol(sdata, false, &val, cfg->flowcontrol);
+	if (!err)
+	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTSCTS, false,
+				 val);
+    }
+    if (!err)
+	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_APPLY, false, 0);
+    if (err)
+	o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_SERDATA, false,
+		       (intptr_t) saved);
+    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_FREE_SERDATA, false,
+		   (intptr_t) saved);
+    if (err)
+	goto out_unlock;
+
+    if (qe)
+	serconf_queue(sdata, qe);
+ out_unlock:
+    if (err && qe)
+	o->free(o, qe);
+    sterm_unlock(sdata);
+    return err;
+}
+
 static int
 sterm_iflowcontrol(struct sergensio *sio, int iflowcontrol,
 		   void (*done)(struct sergensio *sio, int err,
@@ -568,6 +803,292 @@ sterm_rts(struct sergensio *sio, int rts,
 			   serconf_xlat_rts, done, cb_data);
 }
 
+#if SERIALDEV_MODEMWAIT
+#define SERIALDEV_ALL_MODEMLINES (SERGENSIO_MODEMSTATE_CTS |		\
+				  SERGENSIO_MODEMSTATE_DSR |		\
+				  SERGENSIO_MODEMSTATE_RI |		\
+				  SERGENSIO_MODEMSTATE_CD)
+
+static void
+sterm_modemwait_thread(void *data)
+{
+    struct sterm_data *sdata = data;
+    struct gensio_os_funcs *o = sdata->o;
+    gensio_time timeout = {0, 0};
+    sigset_t sigs;
+    int rv;
+
+    gensio_os_thread_set_attr(o, NULL);
+
+    /* The close interrupts the wait with the wake signal. */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, o->get_wake_sig(o));
+    pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+
+    sterm_lock(sdata);
+    while (!sdata->mw_stop) {
+	sterm_unlock(sdata);
+	rv = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_MODEMWAIT, false,
+			    SERIALDEV_ALL_MODEMLINES);
+	sterm_lock(sdata);
+	if (sdata->mw_stop || rv == GE_INTERRUPTED)
+	    continue;
+	if (rv) {
+	    if (rv != GE_NOTSUP)
+		gensio_log(o, GENSIO_LOG_INFO,
+			   "serialdev: Modem wait failed on %s, polling: %s",
+			   sdata->devname, gensio_err_to_str(rv));
+	    sdata->mw_active = false;
+	}
+	/* Report the change, or go back to polling if !mw_active. */
+	o->start_timer(sdata->timer, &timeout);
+	if (!sdata->mw_active)
+	    break;
+    }
+    sdata->mw_running = false;
+    sterm_unlock(sdata);
+}
+
+/*
+ * The wait threads can only be stopped by interrupting the wait with
+ * a signal, so the wake signal must have a handler that does not
+ * restart system calls.
+ */
+static bool
+sterm_can_interrupt(struct gensio_os_funcs *o)
+{
+    struct sigaction act;
+    int sig;
+
+    if (!o->get_wake_sig)
+	return false;
+    sig = o->get_wake_sig(o);
+    if (!sig || sigaction(sig, NULL, &act))
+	return false;
+    return !(act.sa_handler == SIG_DFL || act.sa_handler == SIG_IGN ||
+	     act.sa_flags & SA_RESTART);
+}
+
+/*
+ * Start the modem wait thread if asked for and possible.  Call with
+ * the lock held.
+ */
+static void
+sterm_modemwait_start(struct sterm_data *sdata)
+{
+    if (!sdata->modemwait || sdata->mw_tried || !sdata->open)
+	return;
+    sdata->mw_tried = true;
+
+    if (!sterm_can_interrupt(sdata->o))
+	return;
+
+    sdata->mw_stop = false;
+    sdata->mw_active = true;
+    sdata->mw_running = true;
+    if (gensio_os_new_thread(sdata->o, sterm_modemwait_thread, sdata,
+			     &sdata->mw_thread)) {
+	sdata->mw_active = false;
+	sdata->mw_running = false;
+	return;
+    }
+    sdata->mw_started = true;
+}
+
+/*
+ * Ask the modem wait thread to stop.  Returns false if it is still
+ * running, call again later.  Call with the lock held.
+ *
+ * The thread checks mw_stop and then starts the wait with the lock
+ * released, so the signal can come before the wait starts and be
+ * lost.  Rather than trying to close that window, the signal is sent
+ * again every time this is called.  The close calls this each time
+ * it checks, every 10ms, so a lost signal only delays the close by a
+ * check.
+ */
+static bool
+sterm_modemwait_stop(struct sterm_data *sdata)
+{
+    if (!sdata->mw_started)
+	return true;
+    sdata->mw_stop = true;
+    if (sdata->mw_running) {
+	gensio_os_interrupt_thread(sdata->mw_thread);
+	return false;
+    }
+    gensio_os_wait_thread(sdata->mw_thread);
+    sdata->mw_started = false;
+    sdata->mw_active = false;
+    return true;
+}
+
+static bool
+sterm_modemwait_active(struct sterm_data *sdata)
+{
+    return sdata->mw_active;
+}
+
+static void
+sterm_drain_thread(void *data)
+{
+    struct sterm_data *sdata = data;
+    struct gensio_os_funcs *o = sdata->o;
+    sigset_t sigs;
+    int rv;
+
+    gensio_os_thread_set_attr(o, NULL);
+
+    /* The close interrupts the wait with the wake signal. */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, o->get_wake_sig(o));
+    pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+
+    rv = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DRAIN, false, 0);
+
+    sterm_lock(sdata);
+    sdata->dr_err = rv;
+    sdata->dr_running = false;
+    o->run(sdata->drain_runner);
+    sterm_unlock(sdata);
+}
+
+/*
+ * Wait for everything written so far to be transmitted.  Call with
+ * the lock held.
+ */
+static int
+sterm_drain_start(struct sterm_data *sdata)
+{
+    if (sdata->dr_notsup)
+	return GE_NOTSUP;
+    if (sdata->dr_started) {
+	/* More may have been written since it started. */
+	sdata->dr_again = true;
+	return 0;
+    }
+    if (!sterm_can_interrupt(sdata->o)) {
+	sdata->dr_notsup = true;
+	return GE_NOTSUP;
+    }
+
+    sdata->dr_running = true;
+    if (gensio_os_new_thread(sdata->o, sterm_drain_thread, sdata,
+			     &sdata->dr_thread)) {
+	sdata->dr_running = false;
+	return GE_NOMEM;
+    }
+    sdata->dr_started = true;
+    return 0;
+}
+
+static void
+sterm_drain_done(struct gensio_runner *r, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+    struct gensio *io = sergensio_get_my_gensio(sdata->sio);
+    bool report, closing;
+    int err;
+
+    sterm_lock(sdata);
+    gensio_os_wait_thread(sdata->dr_thread);
+    err = sdata->dr_err;
+    if (err == GE_NOTSUP)
+	sdata->dr_notsup = true;
+    if (sdata->dr_again && !err && sdata->open) {
+	sdata->dr_again = false;
+	sdata->dr_running = true;
+	if (!gensio_os_new_thread(sdata->o, sterm_drain_thread, sdata,
+				  &sdata->dr_thread)) {
+	    sterm_unlock(sdata);
+	    return;
+	}
+	sdata->dr_running = false;
+	err = GE_NOMEM;
+    }
+    sdata->dr_again = false;
+    report = sdata->dr_report && sdata->open;
+    sdata->dr_report = false;
+    closing = !sdata->open;
+    sterm_unlock(sdata);
+
+    if (report)
+	gensio_cb(io, GENSIO_EVENT_SER_TX_DONE, err, NULL, NULL, NULL);
+
+    /* The close is waiting on this, don't let it finish before here. */
+    if (closing)
+	gensio_fd_ll_check_close(sdata->ll);
+
+    sterm_lock(sdata);
+    sdata->dr_started = false;
+    sterm_unlock(sdata);
+}
+
+/*
+ * Make the drain wait return.  Call with the lock held.  Like the
+ * modem wait, the signal can be lost, but the close calls this again
+ * on each check until the drain is done.
+ */
+static void
+sterm_drain_stop(struct sterm_data *sdata)
+{
+    if (sdata->dr_running)
+	gensio_os_interrupt_thread(sdata->dr_thread);
+}
+
+static bool
+sterm_drain_active(struct sterm_data *sdata)
+{
+    return sdata->dr_started;
+}
+
+/* The drain is done and just waiting for drain_runner. */
+static bool
+sterm_drain_finishing(struct sterm_data *sdata)
+{
+    return sdata->dr_started && !sdata->dr_running;
+}
+#else
+static void
+sterm_modemwait_start(struct sterm_data *sdata)
+{
+}
+
+static bool
+sterm_modemwait_stop(struct sterm_data *sdata)
+{
+    return true;
+}
+
+static bool
+sterm_modemwait_active(struct sterm_data *sdata)
+{
+    return false;
+}
+
+static int
+sterm_drain_start(struct sterm_data *sdata)
+{
+    return GE_NOTSUP;
+}
+
+static void
+sterm_drain_stop(struct sterm_data *sdata)
+{
+}
+
+static bool
+sterm_drain_active(struct sterm_data *sdata)
+{
+    return false;
+}
+
+static bool
+sterm_drain_finishing(struct sterm_data *sdata)
+{
+    return false;
+}
+#endif
+
 static void
 serialdev_timeout(struct gensio_timer *t, void *cb_data)
 {
@@ -609,13 +1130,12 @@ serialdev_timeout(struct gensio_timer *t, void *cb_data)
     }
 
  out_restart:
-    if (sdata->modemstate_mask) {
+    sterm_lock(sdata);
+    if (sdata->modemstate_mask && !sterm_modemwait_active(sdata)) {
 	gensio_time timeout = {1, 0};
 
 	sdata->o->start_timer(sdata->timer, &timeout);
     }
-
-    sterm_lock(sdata);
     sdata->handling_modemstate = false;
     sterm_unlock(sdata);
 }
@@ -629,6 +1149,8 @@ sterm_modemstate(struct sergensio *sio, unsigned int val)
     sterm_lock(sdata);
     sdata->modemstate_mask = val;
     sdata->sent_first_modemstate = false;
+    if (val)
+	sterm_modemwait_start(sdata);
     sterm_unlock(sdata);
 
     /* Cause an immediate send of the modemstate. */
@@ -704,6 +1226,10 @@ sergensio_sterm_func(struct sergensio *sio, int op, int val, char *buf,
     case SERGENSIO_FUNC_IFLOWCONTROL:
 	return sterm_iflowcontrol(sio, val, done, cb_data);
 
+    case SERGENSIO_FUNC_LINE_CONFIG:
+	return sterm_line_config(sio, (struct sergensio_line_config *) buf,
+				 done, cb_data);
+
     case SERGENSIO_FUNC_SBREAK:
 	return sterm_sbreak(sio, val, done, cb_data);
 
@@ -740,6 +1266,26 @@ sterm_timer_stopped(struct gensio_timer *timer, void *cb_data)
     sdata->timer_stopped = true;
 }
 
+static void
+sterm_frame_timer_stopped(struct gensio_timer *timer, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+
+    sterm_lock(sdata);
+    sdata->frame_timer_stopped = true;
+    sterm_unlock(sdata);
+}
+
+/* Take ticks off a close timeout, -1 means no timeout. */
+static void
+sterm_count_down(int *left, int ticks)
+{
+    if (*left > ticks)
+	*left -= ticks;
+    else if (*left > 0)
+	*left = 0;
+}
+
 static int
 sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
 			enum gensio_ll_close_state state,
@@ -747,18 +1293,27 @@ sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
 {
     struct sterm_data *sdata = handler_data;
     struct gensio_os_funcs *o = sdata->o;
-    int rv, err = 0;
+    int rv, err = 0, ticks = 1;
+    int64_t wait_nsecs = 10000000;
     gensiods count = 0;
 
     sterm_lock(sdata);
     if (state == GENSIO_LL_CLOSE_STATE_START) {
 	sdata->open = false;
+	sterm_modemwait_stop(sdata);
 	rv = sdata->o->stop_timer_with_done(sdata->timer,
 					    sterm_timer_stopped, sdata);
 	if (rv)
 	    sdata->timer_stopped = true;
+	if (sdata->frame_timer) {
+	    rv = o->stop_timer_with_done(sdata->frame_timer,
+					 sterm_frame_timer_stopped, sdata);
+	    if (rv)
+		sdata->frame_timer_stopped = true;
+	    sdata->frame_timer_running = false;
+	}
 
-	sdata->last_close_outq_count = 0;
+	sdata->close_draining = false;
     }
 
     if (state != GENSIO_LL_CLOSE_STATE_DONE)
@@ -774,35 +1329,73 @@ sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
     if (sdata->handling_modemstate)
 	goto out_einprogress;
 
+    if (!sterm_modemwait_stop(sdata))
+	goto out_einprogress;
+
+    if (sdata->frame_timer &&
+		(!sdata->frame_timer_stopped || sdata->frame_in_timer))
+	goto out_einprogress;
+
     rv = o->bufcount(sdata->iod, GENSIO_OUT_BUF, &count);
-    if (rv || count <= 0)
-	goto out_rm_uucp;
-    if (sdata->last_close_outq_count == 0)
-	/* First time through, set the total time. */
-	sdata->close_timeouts_left = sdata->drain_time;
-    if (sdata->close_timeouts_left >= 0) {
-	if (sdata->close_timeouts_left == 0)
+    if (rv)
+	count = 0;
+
+    if (!sdata->close_draining) {
+	if (count <= 0 && !sterm_drain_active(sdata))
 	    goto out_rm_uucp;
-	sdata->close_timeouts_left--;
+	/* First time through, set the times and wait for the drain. */
+	sdata->close_draining = true;
+	sdata->close_timeouts_left = sdata->drain_time;
+	sdata->char_timeouts_left = sdata->char_drain_wait;
+	sdata->last_close_outq_count = count;
+	sdata->close_wait_ticks = 0;
+	if (count > 0)
+	    sterm_drain_start(sdata);
     }
 
-    if (sdata->last_close_outq_count == 0 ||
-		count < sdata->last_close_outq_count) {
-	/* First time through or some data was written, restart the timer. */
-	sdata->last_close_outq_count = count;
+    /* Count down the time waited since the last check. */
+    sterm_count_down(&sdata->close_timeouts_left, sdata->close_wait_ticks);
+    if (count < sdata->last_close_outq_count)
+	/* Some data was written, restart the timer. */
 	sdata->char_timeouts_left = sdata->char_drain_wait;
-    }
+    else
+	sterm_count_down(&sdata->char_timeouts_left, sdata->close_wait_ticks);
+    sdata->last_close_outq_count = count;
 
-    if (sdata->char_timeouts_left >= 0) {
-	if (sdata->char_timeouts_left == 0)
+    if (!sterm_drain_active(sdata)) {
+	if (count <= 0 || sdata->close_timeouts_left == 0 ||
+		sdata->char_timeouts_left == 0)
 	    goto out_rm_uucp;
-	sdata->char_timeouts_left--;
+	/* Can't wait for the drain, poll the output queue. */
+    } else if (sdata->close_timeouts_left == 0 ||
+	       sdata->char_timeouts_left == 0) {
+	/* Give up, throwing away the output ends the drain wait. */
+	o->flush(sdata->iod, GENSIO_OUT_BUF);
+	sterm_drain_stop(sdata);
+    } else if (sterm_drain_finishing(sdata)) {
+	ticks = 0;
+	wait_nsecs = 1000000;
+    } else {
+	/*
+	 * The drain wait will check the close again when it's done,
+	 * this is just to see if it's still making progress.
+	 */
+	ticks = 100;
+	if (sdata->close_timeouts_left > 0 &&
+		sdata->close_timeouts_left < ticks)
+	    ticks = sdata->close_timeouts_left;
+	if (sdata->char_timeouts_left > 0 &&
+		sdata->char_timeouts_left < ticks)
+	    ticks = sdata->char_timeouts_left;
+	wait_nsecs = (int64_t) ticks * 10000000;
     }
+    sdata->close_wait_ticks = ticks;
 
  out_einprogress:
     err = GE_INPROGRESS;
     next_timeout->secs = 0;
-    next_timeout->nsecs = 10000000;
+    next_timeout->nsecs = 0;
+    gensio_time_add_nsecs(next_timeout, wait_nsecs);
  out_rm_uucp:
     if (!err) {
 	o->flush(sdata->iod, GENSIO_OUT_BUF);
@@ -866,6 +1459,9 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
     }
 
     sdata->timer_stopped = false;
+    sdata->frame_timer_stopped = false;
+    sdata->frame_len = 0;
+    sdata->frame_done = false;
     sdata->iod = NULL; /* If it's a re-open make sure this is clear. */
 
     options = GENSIO_OPEN_OPTION_WRITEABLE;
@@ -921,6 +1517,32 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
 	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_APPLY, false, 0);
 	if (err)
 	    goto out_uucp;
+	if (sdata->lowlatency) {
+	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_LOW_LATENCY,
+				 false, 1);
+	    if (err)
+		/* Lots of devices don't have it, polling still helps. */
+		gensio_log(o, GENSIO_LOG_INFO,
+			   "serialdev: Unable to set low latency on %s: %s",
+			   sdata->devname, gensio_err_to_str(err));
+	}
+	if (sdata->usb_latency) {
+	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_USB_LATENCY,
+				 false, sdata->usb_latency);
+	    if (err)
+		/* Not a USB adapter or no permission, keep going. */
+		gensio_log(o, GENSIO_LOG_INFO,
+			   "serialdev: Unable to set usb latency on %s: %s",
+			   sdata->devname, gensio_err_to_str(err));
+	}
+	if (sdata->xfer_size) {
+	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_XFER_SIZE,
+				 false, sdata->xfer_size);
+	    if (err)
+		gensio_log(o, GENSIO_LOG_INFO,
+			   "serialdev: Unable to set transfer size on %s: %s",
+			   sdata->devname, gensio_err_to_str(err));
+	}
 	if (sdata->rts_set && sdata->rts_first) {
 	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTS, false,
 				 sdata->rts_val);
@@ -961,6 +1583,10 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
     sterm_lock(sdata);
     sdata->open = true;
     sdata->sent_first_modemstate = false;
+#if SERIALDEV_MODEMWAIT
+    sdata->mw_tried = false;
+    sdata->dr_notsup = false;
+#endif
     sterm_unlock(sdata);
 
     if (!sdata->write_only)
@@ -999,10 +1625,18 @@ sterm_free(void *handler_data)
 	sdata->o->free_lock(sdata->lock);
     if (sdata->timer)
 	sdata->o->free_timer(sdata->timer);
+    if (sdata->frame_timer)
+	sdata->o->free_timer(sdata->frame_timer);
+    if (sdata->frame_buf)
+	sdata->o->free(sdata->o, sdata->frame_buf);
     if (sdata->devname)
 	sdata->o->free(sdata->o, sdata->devname);
     if (sdata->deferred_op_runner)
 	sdata->o->free_runner(sdata->deferred_op_runner);
+#if SERIALDEV_MODEMWAIT
+    if (sdata->drain_runner)
+	sdata->o->free_runner(sdata->drain_runner);
+#endif
     sdata->o->free(sdata->o, sdata);
 }
 
@@ -1146,6 +1780,70 @@ sterm_control(void *handler_data, struct gensio_iod *iod,
 			    sdata->o->iod_get_fd(sdata->iod));
 	return 0;
 
+    case GENSIO_CONTROL_FD:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 1)
+	    return GE_INVAL;
+	if (!sdata->iod)
+	    return GE_NOTREADY;
+	*datalen = snprintf(data, *datalen, "%d",
+			    sdata->o->iod_get_fd(sdata->iod));
+	return 0;
+
+    case GENSIO_CONTROL_USB_LATENCY: {
+	int val = 0, rv;
+	unsigned long lval;
+	char *end;
+
+	if (!sdata->iod || sdata->write_only)
+	    return GE_NOTREADY;
+	if (get) {
+	    rv = sdata->o->iod_control(sdata->iod,
+				       GENSIO_IOD_CONTROL_USB_LATENCY,
+				       true, (intptr_t) &val);
+	    if (rv)
+		return rv;
+	    *datalen = snprintf(data, *datalen, "%d", val);
+	    return 0;
+	}
+	lval = strtoul(data, &end, 0);
+	if (end == data || *end || lval < 1 || lval > 255)
+	    return GE_INVAL;
+	rv = sdata->o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_USB_LATENCY,
+				   false, lval);
+	if (!rv)
+	    sdata->usb_latency = lval;
+	return rv;
+    }
+
+    case GENSIO_CONTROL_TX_DRAIN: {
+	int rv;
+
+	if (get)
+	    return GE_NOTSUP;
+	sterm_lock(sdata);
+	if (!sdata->open)
+	    rv = GE_NOTREADY;
+	else
+	    rv = sterm_drain_start(sdata);
+	if (!rv)
+	    sdata->dr_report = true;
+	sterm_unlock(sdata);
+	return rv;
+    }
+
+    case GENSIO_CONTROL_MEMORY:
+	if (!get)
+	    return GE_NOTSUP;
+	sterm_lock(sdata);
+	*datalen = snprintf(data, *datalen, "%lu",
+			    (unsigned long) (sizeof(*sdata) +
+					     (sdata->frame_buf ?
+					      sdata->frame_size : 0)));
+	sterm_unlock(sdata);
+	return 0;
+
     default:
 	break;
     }
@@ -1166,15 +1864,120 @@ sterm_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
     return rv;
 }
 
+/*
+ * The frame gap in nanoseconds from the current port settings, a
+ * character is a start bit, the data bits, parity and stop bits.
+ */
+static int64_t
+sterm_frame_gap(struct sterm_data *sdata)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    int baud = 0, datasize = 8, parity = SERGENSIO_PARITY_NONE;
+    int stopbits = 1, bits;
+
+    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_BAUD, true,
+		   (intptr_t) &baud);
+    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DATASIZE, true,
+		   (intptr_t) &datasize);
+    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_PARITY, true,
+		   (intptr_t) &parity);
+    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_STOPBITS, true,
+		   (intptr_t) &stopbits);
+    if (baud <= 0)
+	baud = 9600;
+    bits = 1 + datasize + (parity != SERGENSIO_PARITY_NONE) + stopbits;
+    return (int64_t) sdata->framegap * bits * 100000000 / baud;
+}
+
+static void
+sterm_frame_start_timer(struct sterm_data *sdata, int64_t nsecs)
+{
+    gensio_time timeout = { 0, 0 };
+
+    gensio_time_add_nsecs(&timeout, nsecs);
+    if (sdata->o->start_timer(sdata->frame_timer, &timeout) == 0)
+	sdata->frame_timer_running = true;
+}
+
+/*
+ * Called with the lock held.  Collect data into the frame and return
+ * the frame once it is done.
+ */
+static int
+sterm_frame_read(struct sterm_data *sdata, struct gensio_iod *iod,
+		 void *data, gensiods count, gensiods *rcount)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    gensiods len = 0;
+    int rv = 0;
+
+    if (!sdata->frame_done) {
+	if (!sdata->frame_buf) {
+	    sdata->frame_buf = o->zalloc(o, sdata->frame_size);
+	    if (!sdata->frame_buf)
+		return GE_NOMEM;
+	}
+	rv = o->read(iod, sdata->frame_buf + sdata->frame_len,
+		     sdata->frame_size - sdata->frame_len, &len);
+	if (rv || !len) {
+	    *rcount = 0;
+	    if (!sdata->frame_len && sdata->lean) {
+		o->free(o, sdata->frame_buf);
+		sdata->frame_buf = NULL;
+	    }
+	    return rv;
+	}
+	if (!sdata->frame_len)
+	    sdata->frame_gap_nsecs = sterm_frame_gap(sdata);
+	sdata->frame_len += len;
+	o->get_monotonic_time(o, &sdata->frame_last_rx);
+	if (sdata->frame_len == sdata->frame_size)
+	    sdata->frame_done = true; /* Full, no point in waiting. */
+	else if (!sdata->frame_timer_running)
+	    sterm_frame_start_timer(sdata, sdata->frame_gap_nsecs);
+    }
+
+    if (!sdata->frame_done) {
+	*rcount = 0;
+	return 0;
+    }
+
+    if (count > sdata->frame_len)
+	count = sdata->frame_len;
+    memcpy(data, sdata->frame_buf, count);
+    sdata->frame_len -= count;
+    if (sdata->frame_len) {
+	memmove(sdata->frame_buf, sdata->frame_buf + count, sdata->frame_len);
+    } else {
+	sdata->frame_done = false;
+	if (sdata->lean) {
+	    o->free(o, sdata->frame_buf);
+	    sdata->frame_buf = NULL;
+	}
+    }
+    *rcount = count;
+    return 0;
+}
+
 static int
 sterm_do_read(struct gensio_iod *iod, void *data, gensiods count, gensiods *rcount,
 	      const char ***auxdata, void *cb_data)
 {
     struct sterm_data *sdata = cb_data;
-    int rv = sdata->o->read(iod, data, count, rcount);
+    int rv;
+
+    if (sdata->framegap) {
+	sterm_lock(sdata);
+	rv = sterm_frame_read(sdata, iod, data, count, rcount);
+	sterm_unlock(sdata);
+    } else {
+	rv = sdata->o->read(iod, data, count, rcount);
+    }
 
     if (rv && sdata->is_pty && rv == GE_IOERR)
 	return GE_REMCLOSE; /* We don't seem to get EPIPE from ptys */
+    if (!rv && *rcount)
+	sdata->lowlat_got = true;
     return rv;
 }
 
@@ -1182,8 +1985,68 @@ static void
 sterm_read_ready(void *handler_data, struct gensio_iod *iod)
 {
     struct sterm_data *sdata = handler_data;
+    struct gensio_os_funcs *o = sdata->o;
+    gensio_time last, now;
 
     gensio_fd_ll_handle_incoming(sdata->ll, sterm_do_read, NULL, sdata);
+    if (!sdata->lowlat_poll)
+	return;
+
+    /*
+     * The next byte is probably on its way, wait for it here instead
+     * of going back through the selector.
+     */
+    o->get_monotonic_time(o, &last);
+    while (gensio_fd_ll_can_read_again(sdata->ll)) {
+	sdata->lowlat_got = false;
+	gensio_fd_ll_handle_incoming(sdata->ll, sterm_do_read, NULL, sdata);
+	o->get_monotonic_time(o, &now);
+	if (sdata->lowlat_got)
+	    last = now;
+	else if (gensio_time_diff_nsecs(&now, &last) >=
+		 (int64_t) sdata->lowlat_poll * 1000)
+	    break;
+    }
+}
+
+static void
+sterm_frame_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+    struct gensio_os_funcs *o = sdata->o;
+    gensio_time now;
+    int64_t idle;
+
+    sterm_lock(sdata);
+    sdata->frame_timer_running = false;
+    if (!sdata->open || !sdata->frame_len)
+	goto out_unlock;
+    if (!sdata->frame_done) {
+	o->get_monotonic_time(o, &now);
+	idle = gensio_time_diff_nsecs(&now, &sdata->frame_last_rx);
+	if (idle < sdata->frame_gap_nsecs) {
+	    /* More data came in, wait for the rest of the gap. */
+	    sterm_frame_start_timer(sdata, sdata->frame_gap_nsecs - idle);
+	    goto out_unlock;
+	}
+	sdata->frame_done = true;
+    }
+    sdata->frame_in_timer = true;
+    sterm_unlock(sdata);
+
+    /*
+     * If the user has reads off, the frame waits until they are
+     * turned on and the fd is readable, or the timer tries again.
+     */
+    if (gensio_fd_ll_can_read_again(sdata->ll))
+	gensio_fd_ll_handle_incoming(sdata->ll, sterm_do_read, NULL, sdata);
+
+    sterm_lock(sdata);
+    sdata->frame_in_timer = false;
+    if (sdata->open && sdata->frame_done && !sdata->frame_timer_running)
+	sterm_frame_start_timer(sdata, sdata->frame_gap_nsecs);
+ out_unlock:
+    sterm_unlock(sdata);
 }
 
 static const struct gensio_fd_ll_ops sterm_fd_ll_ops = {
@@ -1415,6 +2278,36 @@ serialdev_gensio_alloc(const void *gdata, const char * const args[],
 			     GENSIO_DEFAULT_INT, NULL, &sdata->char_drain_wait);
     if (err)
 	goto out_err;
+    err = gensio_get_default(o, "sergensio", "lowlatency", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->lowlatency = ival;
+    err = gensio_get_default(o, "sergensio", "lowlatency_poll", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->lowlat_poll = ival;
+    err = gensio_get_default(o, "serialdev", "lean", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->lean = ival;
+    err = gensio_get_default(o, "serialdev", "modemwait", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->modemwait = ival;
+    err = gensio_get_default(o, "serialdev", "usb_latency", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->usb_latency = ival;
+    err = gensio_get_default(o, "serialdev", "xfer_size", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->xfer_size = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
@@ -1439,6 +2332,34 @@ serialdev_gensio_alloc(const void *gdata, const char * const args[],
 	    }
 	    continue;
 	}
+	if (gensio_check_keybool(args[i], "lowlatency",
+				 &sdata->lowlatency) > 0)
+	    continue;
+	if (gensio_check_keyvalue(args[i], "framegap", &s) > 0) {
+	    double d = strtod(s, &end);
+
+	    if (end == s || *end != '\0' || d < 0 || d > 1000)
+		goto out_inval;
+	    sdata->framegap = d * 10 + .5;
+	    continue;
+	}
+	if (gensio_check_keyuint(args[i], "lowlatency_poll",
+				 &sdata->lowlat_poll) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "lean", &sdata->lean) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "modemwait",
+				 &sdata->modemwait) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "usb_latency",
+				 &sdata->usb_latency) > 0) {
+	    if (sdata->usb_latency > 255)
+		goto out_inval;
+	    continue;
+	}
+	if (gensio_check_keyuint(args[i], "xfer_size",
+				 &sdata->xfer_size) > 0)
+	    continue;
 	if (gensio_check_keybool(args[i], "nouucplock",
 				 &sdata->no_uucp_lock) > 0) {
 	    nouucplock_set = true;
@@ -1456,6 +2377,13 @@ serialdev_gensio_alloc(const void *gdata, const char * const args[],
     if (!sdata->timer)
 	goto out_nomem;
 
+    if (sdata->framegap) {
+	sdata->frame_timer = o->alloc_timer(o, sterm_frame_timeout, sdata);
+	if (!sdata->frame_timer)
+	    goto out_nomem;
+	sdata->frame_size = max_read_size;
+    }
+
     sdata->devname = gensio_strdup(o, devname);
     if (!sdata->devname)
 	goto out_nomem;
@@ -1496,6 +2424,11 @@ serialdev_gensio_alloc(const void *gdata, const char * const args[],
     sdata->deferred_op_runner = o->alloc_runner(o, sterm_deferred_op, sdata);
     if (!sdata->deferred_op_runner)
 	goto out_nomem;
+#if SERIALDEV_MODEMWAIT
+    sdata->drain_runner = o->alloc_runner(o, sterm_drain_done, sdata);
+    if (!sdata->drain_runner)
+	goto out_nomem;
+#endif
 
     sdata->lock = o->alloc_lock(o);
     if (!sdata->lock)
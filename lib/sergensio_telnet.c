@@ -14,6 +14,7 @@
 #include <gensio/sergensio_class.h>
 #include <gensio/gensio_ll_gensio.h>
 #include <gensio/gensio_acc_gensio.h>
+#include <gensio/gensio_time.h>
 
 #include "utils.h"
 #include "telnet.h"
@@ -49,6 +50,18 @@ struct stel_data {
     bool reported_modemstate;
     bool is_client;
 
+    /*
+     * On the server, modemstate reports come no closer together than
+     * this (in milliseconds) so a bouncing line doesn't flood the
+     * client.  Changes in the meantime are merged into
+     * pending_modemstate, the delta bits accumulate.
+     */
+    unsigned int modemstate_holdoff;
+    bool modemstate_sent;
+    gensio_time last_modemstate;
+    bool modemstate_pending;
+    unsigned int pending_modemstate;
+
     struct stel_req *reqs;
 };
 
@@ -352,16 +365,57 @@ stel_send(struct sergensio *sio, unsigned int opt, unsigned int val)
     return 0;
 }
 
+/*
+ * Called with the lock held.  Returns true if a modemstate report can
+ * go out now, otherwise the timer is started to send the pending
+ * report when the holdoff is done.
+ */
+static bool
+stel_modemstate_holdoff_done(struct stel_data *sdata)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    gensio_time now, timeout = { 0, 0 };
+    int64_t elapsed, holdoff;
+
+    o->get_monotonic_time(o, &now);
+    elapsed = gensio_time_diff_nsecs(&now, &sdata->last_modemstate);
+    holdoff = GENSIO_MSECS_TO_NSECS(sdata->modemstate_holdoff);
+    if (!sdata->modemstate_sent || elapsed >= holdoff) {
+	sdata->modemstate_sent = true;
+	sdata->last_modemstate = now;
+	return true;
+    }
+    gensio_time_add_nsecs(&timeout, holdoff - elapsed);
+    sdata->rops->start_timer(sdata->filter, &timeout);
+    return false;
+}
+
 static int
 stel_modemstate(struct sergensio *sio, unsigned int val)
 {
-    unsigned int opt;
+    struct stel_data *sdata = sergensio_get_gensio_data(sio);
 
     if (sergensio_is_client(sio))
-	opt = 11;
-    else
-	opt = 7;
-    return stel_send(sio, opt, val);
+	return stel_send(sio, 11, val);
+    if (!sdata->modemstate_holdoff)
+	return stel_send(sio, 7, val);
+
+    stel_lock(sdata);
+    if (sdata->modemstate_pending) {
+	sdata->pending_modemstate = ((val & 0xf0) |
+				     ((sdata->pending_modemstate | val) & 0x0f));
+	stel_unlock(sdata);
+	return 0;
+    }
+    if (!stel_modemstate_holdoff_done(sdata)) {
+	sdata->modemstate_pending = true;
+	sdata->pending_modemstate = val;
+	stel_unlock(sdata);
+	return 0;
+    }
+    stel_unlock(sdata);
+
+    return stel_send(sio, 7, val);
 }
 
 static int
@@ -872,8 +926,15 @@ static void
 stels_timeout(void *handler_data)
 {
     struct stel_data *sdata = handler_data;
+    bool send_modemstate = false;
+    unsigned int modemstate = 0;
 
     stel_lock(sdata);
+    if (sdata->modemstate_pending && stel_modemstate_holdoff_done(sdata)) {
+	sdata->modemstate_pending = false;
+	modemstate = sdata->pending_modemstate;
+	send_modemstate = true;
+    }
     if (!sdata->reported_modemstate && sdata->do_2217) {
 	struct gensio *io = sdata->io;
 	int val = 255;
@@ -892,6 +953,9 @@ stels_timeout(void *handler_data)
 	}
     }
     stel_unlock(sdata);
+
+    if (send_modemstate)
+	stel_send(sdata->sio, 7, modemstate);
 }
 
 struct gensio_telnet_filter_callbacks sergensio_telnet_server_filter_cbs = {
@@ -911,6 +975,7 @@ stel_setup(const char * const args[], bool default_is_client,
     unsigned int i;
     bool allow_2217 = false;
     bool is_client = default_is_client;
+    unsigned int modemstate_holdoff;
     int err;
     int rv, ival;
 
@@ -919,10 +984,18 @@ stel_setup(const char * const args[], bool default_is_client,
     if (rv)
 	return rv;
     allow_2217 = ival;
+    rv = gensio_get_default(o, "telnet", "modemstate_holdoff", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    modemstate_holdoff = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keybool(args[i], "rfc2217", &allow_2217) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "modemstate_holdoff",
+				 &modemstate_holdoff) > 0)
+	    continue;
 	if (gensio_check_keyboolv(args[i], "mode", "client", "server",
 				  &is_client) > 0)
 	    continue;
@@ -936,6 +1009,7 @@ stel_setup(const char * const args[], bool default_is_client,
     sdata->o = o;
     sdata->allow_2217 = allow_2217;
     sdata->is_client = is_client;
+    sdata->modemstate_holdoff = modemstate_holdoff;
 
     sdata->lock = o->alloc_lock(o);
     if (!sdata->lock)
@@ -993,6 +1067,7 @@ telnet_gensio_alloc(struct gensio *child, const char * const args[],
 	goto out_nomem;
 
     sdata->io = io;
+    base_gensio_set_no_fuse(io);
 
     if (sdata->allow_2217) {
 	err = sergensio_addclass(o, io, sergensio_stel_func, sdata,
@@ -1053,6 +1128,8 @@ struct stela_data {
 
     bool allow_2217;
     bool is_client;
+    bool lean;
+    unsigned int modemstate_holdoff;
 };
 
 static void
@@ -1071,17 +1148,24 @@ stela_alloc_gensio(void *acc_data, const char * const *iargs,
 {
     struct stela_data *stela = acc_data;
     struct gensio_os_funcs *o = stela->o;
-    const char *args[5] = {NULL, NULL, NULL, NULL, NULL};
-    char buf1[50], buf2[50];
+    const char *args[7] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    char buf1[50], buf2[50], buf3[50];
     unsigned int i;
     bool allow_2217 = stela->allow_2217;
     gensiods max_write_size = stela->max_write_size;
     gensiods max_read_size = stela->max_read_size;
     bool is_client = stela->is_client;
+    bool lean = stela->lean;
+    unsigned int modemstate_holdoff = stela->modemstate_holdoff;
 
     for (i = 0; iargs && iargs[i]; i++) {
 	if (gensio_check_keybool(iargs[i], "rfc2217", &allow_2217) > 0)
 	    continue;
+	if (gensio_check_keybool(iargs[i], "lean", &lean) > 0)
+	    continue;
+	if (gensio_check_keyuint(iargs[i], "modemstate_holdoff",
+				 &modemstate_holdoff) > 0)
+	    continue;
 	if (gensio_check_keyds(iargs[i], "writebuf", &max_write_size) > 0)
 	    continue;
 	if (gensio_check_keyds(iargs[i], "readbuf", &max_read_size) > 0)
@@ -1107,6 +1191,9 @@ stela_alloc_gensio(void *acc_data, const char * const *iargs,
     }
     if (!is_client)
 	args[i++] = "mode=server";
+    snprintf(buf3, sizeof(buf3), "modemstate_holdoff=%u", modemstate_holdoff);
+    args[i++] = buf3;
+    args[i++] = lean ? "lean=true" : "lean=false";
 
     return telnet_gensio_alloc(child, args, o, NULL, NULL, rio);
 }
@@ -1119,8 +1206,8 @@ stela_new_child(void *acc_data, void **finish_data,
     struct gensio_os_funcs *o = stela->o;
     struct stel_data *sdata;
     int err;
-    char arg1[25], arg2[25], arg3[25], arg4[25];
-    const char *args[5] = { arg1, arg2, arg3, arg4, NULL };
+    char arg1[25], arg2[25], arg3[25], arg4[25], arg5[40];
+    const char *args[7] = { arg1, arg2, arg3, arg4, arg5, NULL, NULL };
 
     snprintf(arg1, sizeof(arg1), "rfc2217=%d", stela->allow_2217);
     snprintf(arg2, sizeof(arg2), "writebuf=%lu",
@@ -1129,6 +1216,9 @@ stela_new_child(void *acc_data, void **finish_data,
              (unsigned long) stela->max_read_size);
     snprintf(arg4, sizeof(arg4), "mode=%s",
 	     stela->is_client ? "client" : "server");
+    snprintf(arg5, sizeof(arg5), "modemstate_holdoff=%u",
+	     stela->modemstate_holdoff);
+    args[5] = stela->lean ? "lean=true" : "lean=false";
 
     err = stel_setup(args, false, o, &sdata);
     if (err)
@@ -1205,7 +1295,8 @@ telnet_gensio_accepter_alloc(struct gensio_accepter *child,
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
     gensiods max_write_size = GENSIO_DEFAULT_BUF_SIZE;
     bool allow_2217 = false;
-    bool is_client = false;
+    bool is_client = false, lean;
+    unsigned int modemstate_holdoff;
     struct gensio_accepter *accepter = NULL;
     int rv, ival;
 
@@ -1214,10 +1305,25 @@ telnet_gensio_accepter_alloc(struct gensio_accepter *child,
     if (rv)
 	return rv;
     allow_2217 = ival;
+    rv = gensio_get_default(o, "telnet", "modemstate_holdoff", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (rv)
+	return rv;
+    modemstate_holdoff = ival;
+    rv = gensio_get_default(o, "telnet", "lean", false,
+			    GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (rv)
+	return rv;
+    lean = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keybool(args[i], "rfc2217", &allow_2217) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "modemstate_holdoff",
+				 &modemstate_holdoff) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "lean", &lean) > 0)
+	    continue;
 	if (gensio_check_keyds(args[i], "writebuf", &max_write_size) > 0)
 	    continue;
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
@@ -1237,6 +1343,8 @@ telnet_gensio_accepter_alloc(struct gensio_accepter *child,
     stela->max_read_size = max_read_size;
     stela->allow_2217 = allow_2217;
     stela->is_client = is_client;
+    stela->lean = lean;
+    stela->modemstate_holdoff = modemstate_holdoff;
 
     err = gensio_gensio_accepter_alloc(child, o, "telnet",
 				       cb, user_data,
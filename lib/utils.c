@@ -7,6 +7,7 @@
 
 #include "config.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
@@ -788,15 +789,20 @@ gensio_get_log_mask(void)
     return gensio_log_mask;
 }
 
+bool
+gensio_log_enabled(struct gensio_os_funcs *o, enum gensio_log_levels level)
+{
+    return (gensio_log_mask & (1 << level)) && o->vlog;
+}
+
 void
 gensio_vlog(struct gensio_os_funcs *o, enum gensio_log_levels level,
 	    const char *str, va_list args)
 {
-    if (!(gensio_log_mask & (1 << level)))
+    if (!gensio_log_enabled(o, level))
 	return;
 
-    if (o->vlog)
-	o->vlog(o, level, str, args);
+    o->vlog(o, level, str, args);
 }
 
 void
@@ -822,3 +828,180 @@ gensio_log_level_to_str(enum gensio_log_levels level)
     default: return "invalid";
     }
 }
+
+/*
+ * The log ring.  Logs are formatted into the ring by whatever thread
+ * logs them and passed to the real log handler from a runner, so
+ * logging doesn't wait on the user's handler.  There is only one, like
+ * the log mask.
+ */
+#define GENSIO_LOG_RING_MSG_SIZE 256
+
+struct gensio_log_ring_ent {
+    enum gensio_log_levels level;
+    char str[GENSIO_LOG_RING_MSG_SIZE];
+};
+
+struct gensio_log_ring {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    gensio_vlog_func *sink;
+    struct gensio_runner *runner;
+    bool runner_pending;
+    bool free_pending;
+    unsigned int size;
+    unsigned int head; /* Next entry to deliver. */
+    unsigned int count;
+    unsigned int dropped;
+    struct gensio_log_ring_ent *ents;
+};
+
+static struct gensio_log_ring *gensio_log_ring;
+
+static void
+gensio_log_ring_out(struct gensio_log_ring *r, enum gensio_log_levels level,
+		    const char *str, ...)
+{
+    va_list args;
+
+    va_start(args, str);
+    r->sink(r->o, level, str, args);
+    va_end(args);
+}
+
+static void
+gensio_log_ring_free(struct gensio_log_ring *r)
+{
+    struct gensio_os_funcs *o = r->o;
+
+    if (r->runner)
+	o->free_runner(r->runner);
+    if (r->lock)
+	o->free_lock(r->lock);
+    if (r->ents)
+	o->free(o, r->ents);
+    o->free(o, r);
+}
+
+/* Deliver everything in the ring.  Call with the ring lock held. */
+static void
+gensio_log_ring_flush(struct gensio_log_ring *r)
+{
+    struct gensio_log_ring_ent ent;
+    unsigned int dropped;
+
+    while (r->count || r->dropped) {
+	/* The drops happened after everything in the ring. */
+	dropped = 0;
+	if (r->count) {
+	    ent = r->ents[r->head];
+	    r->head = (r->head + 1) % r->size;
+	    r->count--;
+	} else {
+	    dropped = r->dropped;
+	    r->dropped = 0;
+	    ent.level = GENSIO_LOG_WARNING;
+	}
+	r->o->unlock(r->lock);
+	if (dropped)
+	    gensio_log_ring_out(r, ent.level, "%u log messages dropped",
+				dropped);
+	else
+	    gensio_log_ring_out(r, ent.level, "%s", ent.str);
+	r->o->lock(r->lock);
+    }
+}
+
+static void
+gensio_log_ring_runner(struct gensio_runner *runner, void *cb_data)
+{
+    struct gensio_log_ring *r = cb_data;
+
+    r->o->lock(r->lock);
+    gensio_log_ring_flush(r);
+    r->runner_pending = false;
+    if (r->free_pending) {
+	r->o->unlock(r->lock);
+	gensio_log_ring_free(r);
+	return;
+    }
+    r->o->unlock(r->lock);
+}
+
+static void
+gensio_log_ring_vlog(struct gensio_os_funcs *o, enum gensio_log_levels level,
+		     const char *str, va_list args)
+{
+    struct gensio_log_ring *r = gensio_log_ring;
+    struct gensio_log_ring_ent *ent;
+    char buf[GENSIO_LOG_RING_MSG_SIZE];
+
+    /* Format outside the lock, it's the expensive part. */
+    vsnprintf(buf, sizeof(buf), str, args);
+
+    o->lock(r->lock);
+    if (r->count == r->size) {
+	r->dropped++;
+    } else {
+	ent = &r->ents[(r->head + r->count) % r->size];
+	ent->level = level;
+	memcpy(ent->str, buf, sizeof(buf));
+	r->count++;
+    }
+    if (!r->runner_pending) {
+	r->runner_pending = true;
+	o->run(r->runner);
+    }
+    o->unlock(r->lock);
+}
+
+int
+gensio_os_funcs_set_log_ring(struct gensio_os_funcs *o, unsigned int size)
+{
+    struct gensio_log_ring *r = gensio_log_ring;
+
+    if (size == 0) {
+	if (!r || r->o != o)
+	    return GE_NOTFOUND;
+	o->vlog = r->sink;
+	gensio_log_ring = NULL;
+	o->lock(r->lock);
+	gensio_log_ring_flush(r);
+	if (r->runner_pending) {
+	    r->free_pending = true;
+	    o->unlock(r->lock);
+	} else {
+	    o->unlock(r->lock);
+	    gensio_log_ring_free(r);
+	}
+	return 0;
+    }
+
+    if (r)
+	return GE_INUSE;
+    if (!o->vlog)
+	return GE_NOTREADY;
+
+    r = o->zalloc(o, sizeof(*r));
+    if (!r)
+	return GE_NOMEM;
+    r->o = o;
+    r->size = size;
+    r->ents = o->zalloc(o, sizeof(*r->ents) * size);
+    if (!r->ents)
+	goto out_nomem;
+    r->lock = o->alloc_lock(o);
+    if (!r->lock)
+	goto out_nomem;
+    r->runner = o->alloc_runner(o, gensio_log_ring_runner, r);
+    if (!r->runner)
+	goto out_nomem;
+    r->sink = o->vlog;
+    gensio_log_ring = r;
+    o->vlog = gensio_log_ring_vlog;
+    return 0;
+
+ out_nomem:
+    gensio_log_ring_free(r);
+    return GE_NOMEM;
+}
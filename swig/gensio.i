@@ -34,8 +34,32 @@ if os.name != 'nt':
 #include <gensio/gensio_mdns.h>
 #include <gensio/netif.h>
 #include <gensio/gensio_swig.h>
+#ifndef _WIN32
+#include <gensio/gensio_unix.h>
+#endif
 
 static void wake_curr_waiter(void);
+
+/* For running gensio from another event loop, Unix only. */
+static int
+swig_os_funcs_get_poll_fd(struct gensio_os_funcs *o, int *fd)
+{
+#ifdef _WIN32
+    return GE_NOTSUP;
+#else
+    return gensio_unix_funcs_get_poll_fd(o, fd);
+#endif
+}
+
+static int
+swig_os_funcs_next_timeout(struct gensio_os_funcs *o, gensio_time *timeout)
+{
+#ifdef _WIN32
+    return GE_NOTSUP;
+#else
+    return gensio_unix_funcs_next_timeout(o, timeout);
+#endif
+}
 %}
 
 %include "gensio_langinfo.i"
@@ -65,6 +89,17 @@ gensio_key_del(void *data)
     free(data);
 }
 
+/* Each interpreter that imports this module shares the key. */
+static pthread_once_t gensio_thread_key_once = PTHREAD_ONCE_INIT;
+static int gensio_thread_key_err;
+
+static void
+gensio_thread_key_init(void)
+{
+    gensio_thread_key_err = pthread_key_create(&gensio_thread_key,
+					       gensio_key_del);
+}
+
 static struct waiter *
 save_waiter(struct waiter *waiter)
 {
@@ -116,6 +151,16 @@ struct gensio_wait_block {
 
 static DWORD gensio_threadkey_idx;
 
+/* Each interpreter that imports this module shares the index. */
+static INIT_ONCE gensio_threadkey_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK
+gensio_threadkey_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+    gensio_threadkey_idx = TlsAlloc();
+    return TRUE;
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
     struct gensio_wait_block *b;
@@ -327,24 +372,25 @@ static void gensio_mdns_delete_watch_done(struct gensio_mdns_watch *watch,
 
 %init %{
 #ifdef USE_POSIX_THREADS
-    {
-	int err;
-
-	err = pthread_key_create(&gensio_thread_key, gensio_key_del);
-	if (err) {
-	    fprintf(stderr, "Error creating gensio thread key: %s, giving up\n",
-		    strerror(err));
-	    exit(1);
-	}
+    pthread_once(&gensio_thread_key_once, gensio_thread_key_init);
+    if (gensio_thread_key_err) {
+	fprintf(stderr, "Error creating gensio thread key: %s, giving up\n",
+		strerror(gensio_thread_key_err));
+	exit(1);
     }
 #elif defined(USE_WIN32_THREADS)
-    gensio_threadkey_idx = TlsAlloc();
+    InitOnceExecuteOnce(&gensio_threadkey_once, gensio_threadkey_init,
+			NULL, NULL);
     if (gensio_threadkey_idx == TLS_OUT_OF_INDEXES) {
 	fprintf(stderr, "Error creating gensio thread key index\n");
 	exit(1);
     }
 #endif
     gensio_swig_init_lang();
+#ifdef Py_GIL_DISABLED
+    /* gensio objects do their own locking, don't turn the GIL back on. */
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
 %}
 
 %include <typemaps.i>
@@ -364,6 +410,27 @@ struct waiter { };
     ~gensio_os_funcs() {
 	check_os_funcs_free(self);
     }
+
+    %rename(get_poll_fd) get_poll_fdt;
+    int get_poll_fdt() {
+	int fd = -1;
+
+	err_handle("get_poll_fd", swig_os_funcs_get_poll_fd(self, &fd));
+	return fd;
+    }
+
+    /* Milliseconds until service is needed, -1 if nothing pending. */
+    %rename(next_timeout) next_timeoutt;
+    long next_timeoutt() {
+	gensio_time t;
+	int rv = swig_os_funcs_next_timeout(self, &t);
+
+	if (rv == GE_NOTFOUND)
+	    return -1;
+	err_handle("next_timeout", rv);
+	/* Round up so the caller doesn't wake before the timer. */
+	return t.secs * 1000 + ((t.nsecs + 999999) / 1000000);
+    }
 }
 
 %constant int GE_NOTSUP = GE_NOTSUP;
@@ -411,6 +478,15 @@ struct waiter { };
 %constant int GENSIO_CONTROL_REM_AUX_DATA = GENSIO_CONTROL_REM_AUX_DATA;
 %constant int GENSIO_CONTROL_EXTRAINFO = GENSIO_CONTROL_EXTRAINFO;
 %constant int GENSIO_CONTROL_ENABLE_OOB = GENSIO_CONTROL_ENABLE_OOB;
+%constant int GENSIO_CONTROL_READ_BATCH = GENSIO_CONTROL_READ_BATCH;
+%constant int GENSIO_CONTROL_STATS = GENSIO_CONTROL_STATS;
+%constant int GENSIO_CONTROL_TRACE_DUMP = GENSIO_CONTROL_TRACE_DUMP;
+%constant int GENSIO_CONTROL_LATENCY = GENSIO_CONTROL_LATENCY;
+%constant int GENSIO_CONTROL_TX_TSTAMP = GENSIO_CONTROL_TX_TSTAMP;
+%constant int GENSIO_CONTROL_MEMORY = GENSIO_CONTROL_MEMORY;
+%constant int GENSIO_CONTROL_ROUND_TRIPS = GENSIO_CONTROL_ROUND_TRIPS;
+%constant int GENSIO_CONTROL_RELPKT_INFO = GENSIO_CONTROL_RELPKT_INFO;
+%constant int GENSIO_CONTROL_EARLY_DATA = GENSIO_CONTROL_EARLY_DATA;
 
 %constant int GENSIO_NETTYPE_UNSPEC = GENSIO_NETTYPE_UNSPEC;
 %constant int GENSIO_NETTYPE_IPV4 = GENSIO_NETTYPE_IPV4;
@@ -508,12 +584,7 @@ struct waiter { };
 	struct gensio_data *data = (struct gensio_data *)
 	    gensio_get_user_data(self);
 
-	if (data->handler_val)
-	    deref_swig_cb_val(data->handler_val);
-	if (handler)
-	    data->handler_val = ref_swig_cb(handler, read_callback);
-	else
-	    data->handler_val = NULL;
+	gensio_data_set_handler(data, handler);
     }
 
     %rename(open) opent;
@@ -635,6 +706,13 @@ struct waiter { };
 	gensio_set_write_callback_enable(self, enable);
     }
 
+    void set_read_memview(bool enable) {
+	struct gensio_data *data = (struct gensio_data *)
+	    gensio_get_user_data(self);
+
+	data->read_memview = enable;
+    }
+
     %rename(set_sync) set_synct;
     void set_synct() {
 	int rv = gensio_set_sync(self);
@@ -1044,6 +1122,7 @@ struct waiter { };
 
 %constant int GENSIO_ACC_CONTROL_LADDR = GENSIO_ACC_CONTROL_LADDR;
 %constant int GENSIO_ACC_CONTROL_LPORT = GENSIO_ACC_CONTROL_LPORT;
+%constant int GENSIO_ACC_CONTROL_STATS = GENSIO_ACC_CONTROL_STATS;
 
 %extend gensio_accepter {
     gensio_accepter(struct gensio_os_funcs *o, char *str, swig_cb *handler) {
@@ -1076,12 +1155,7 @@ struct waiter { };
 	struct gensio_data *data = (struct gensio_data *)
 	    gensio_acc_get_user_data(self);
 
-	if (data->handler_val)
-	    deref_swig_cb_val(data->handler_val);
-	if (handler)
-	    data->handler_val = ref_swig_cb(handler, read_callback);
-	else
-	    data->handler_val = NULL;
+	gensio_data_set_handler(data, handler);
     }
 
     %newobject str_to_gensio;
@@ -1465,6 +1539,7 @@ struct mdns_service { };
 
 	if (m) {
 	    m->o = o;
+	    m->interp = gensio_python_curr_interp();
 	    m->lock = gensio_os_funcs_alloc_lock(o);
 	    if (!m->lock) {
 		gensio_os_funcs_zfree(o, m);
@@ -1577,6 +1652,7 @@ struct mdns_service { };
 	}
 	if (w) {
 	    w->cb_val = ref_swig_cb(cb, gensio_mdns_cb);
+	    w->interp = gensio_python_curr_interp();
 	    /* Assure w->watch is set for other users. */
 	    gensio_os_funcs_lock(o, w->lock);
 	    rv = gensio_mdns_add_watch(self->mdns,
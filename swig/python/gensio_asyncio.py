@@ -0,0 +1,193 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: LGPL-2.1-only
+#
+
+# Run gensio on an asyncio event loop, with no service threads.
+#
+# The os funcs' poll fd is added as a reader on the loop, and a loop
+# timer follows the os funcs' next timer.  Both call service_now(),
+# so all gensio callbacks run on the loop thread.  Unix only, and
+# the os funcs must use a single selector with epoll or kqueue.
+#
+#   o = gensio.alloc_gensio_selector(None)
+#   aos = gensio_asyncio.AsyncioOsFuncs(o)
+#   g = gensio_asyncio.AsyncGensio(aos, "tcp,localhost,1234")
+#   await g.open()
+#   await g.write(b"hello")
+#   data = await g.read()
+
+import asyncio
+import gensio
+
+class AsyncioOsFuncs:
+    """Attach a gensio_os_funcs to an asyncio event loop."""
+
+    def __init__(self, o, loop = None):
+        if loop is None:
+            loop = asyncio.get_event_loop()
+        self.o = o
+        self.loop = loop
+        self.waiter = gensio.waiter(o)
+        self.fd = o.get_poll_fd()
+        self.timer = None
+        self.kick_pending = False
+        loop.add_reader(self.fd, self._service)
+        self.kick()
+
+    def close(self):
+        """Detach from the event loop."""
+        self.loop.remove_reader(self.fd)
+        if self.timer is not None:
+            self.timer.cancel()
+            self.timer = None
+
+    def kick(self):
+        """Service the os funcs soon.  Starting an operation may
+        schedule work that doesn't show up on the poll fd, so this is
+        called after every operation started from Python."""
+        if not self.kick_pending:
+            self.kick_pending = True
+            self.loop.call_soon(self._service)
+
+    def _service(self):
+        self.kick_pending = False
+        self.waiter.service_now()
+        if self.timer is not None:
+            self.timer.cancel()
+            self.timer = None
+        t = self.o.next_timeout()
+        if t == 0:
+            self.kick()
+        elif t > 0:
+            self.timer = self.loop.call_later(t / 1000.0, self._service)
+
+class AsyncGensio:
+    """A gensio with awaitable open, read, write and close.  Either
+    pass in a gensio string or an existing gensio (from an accepter,
+    for instance) in io."""
+
+    def __init__(self, aos, gensiostr = None, io = None):
+        self.aos = aos
+        self.read_fut = None
+        self.read_max = 0
+        self.write_fut = None
+        self.op_fut = None
+        if io is None:
+            self.io = gensio.gensio(aos.o, gensiostr, self)
+        else:
+            self.io = io
+            io.set_cbs(self)
+
+    def _new_fut(self):
+        return self.aos.loop.create_future()
+
+    async def open(self):
+        self.op_fut = self._new_fut()
+        self.io.open(self)
+        self.aos.kick()
+        await self.op_fut
+
+    async def close(self):
+        self.op_fut = self._new_fut()
+        self.io.close(self)
+        self.aos.kick()
+        await self.op_fut
+
+    async def read(self, maxlen = 65536):
+        """Wait for data and return up to maxlen bytes of it.  Errors,
+        including the remote end closing, raise an exception."""
+        self.read_fut = self._new_fut()
+        self.read_max = maxlen
+        self.io.read_cb_enable(True)
+        self.aos.kick()
+        return await self.read_fut
+
+    async def write(self, data):
+        """Write all of data, which may be any buffer-protocol
+        object."""
+        data = memoryview(data)
+        while True:
+            count = self.io.write(data, None)
+            data = data[count:]
+            if len(data) == 0:
+                break
+            self.write_fut = self._new_fut()
+            self.io.write_cb_enable(True)
+            self.aos.kick()
+            await self.write_fut
+        self.aos.kick()
+
+    # Callbacks from the gensio, these run on the loop thread.
+
+    def open_done(self, io, err):
+        fut, self.op_fut = self.op_fut, None
+        if err:
+            fut.set_exception(Exception("gensio:open: " + err))
+        else:
+            fut.set_result(None)
+
+    def close_done(self, io):
+        fut, self.op_fut = self.op_fut, None
+        fut.set_result(None)
+
+    def read_callback(self, io, err, data, auxdata):
+        io.read_cb_enable(False)
+        fut, self.read_fut = self.read_fut, None
+        if fut is None:
+            return 0
+        if err:
+            fut.set_exception(Exception("gensio:read: " + err))
+            return 0
+        count = min(len(data), self.read_max)
+        fut.set_result(bytes(data[:count]))
+        return count
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+        fut, self.write_fut = self.write_fut, None
+        if fut is not None:
+            fut.set_result(None)
+
+class AsyncAccepter:
+    """A gensio_accepter with an awaitable accept."""
+
+    def __init__(self, aos, gensiostr):
+        self.aos = aos
+        self.pending = []
+        self.accept_fut = None
+        self.acc = gensio.gensio_accepter(aos.o, gensiostr, self)
+
+    def startup(self):
+        self.acc.startup()
+        self.aos.kick()
+
+    async def accept(self):
+        """Wait for a new connection and return it as an open
+        AsyncGensio."""
+        if not self.pending:
+            self.accept_fut = self.aos.loop.create_future()
+            self.acc.set_accept_callback_enable(True)
+            self.aos.kick()
+            await self.accept_fut
+        return AsyncGensio(self.aos, io = self.pending.pop(0))
+
+    async def shutdown(self):
+        self.shutdown_fut = self.aos.loop.create_future()
+        self.acc.shutdown(self)
+        self.aos.kick()
+        await self.shutdown_fut
+
+    # Callbacks from the accepter, these run on the loop thread.
+
+    def new_connection(self, acc, io):
+        self.pending.append(io)
+        fut, self.accept_fut = self.accept_fut, None
+        if fut is not None:
+            acc.set_accept_callback_enable(False)
+            fut.set_result(None)
+
+    def shutdown_done(self, acc):
+        self.shutdown_fut.set_result(None)
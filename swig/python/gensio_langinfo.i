@@ -90,7 +90,8 @@
     $result = add_python_seqresult($result, r);
 }
 
-%typemap(in) (char *bytestr, my_ssize_t len) {
+%typemap(in) (char *bytestr, my_ssize_t len)
+		(Py_buffer view, int got_view = 0) {
     if ($input == Py_None) {
 	$1 = NULL;
 	$2 = 0;
@@ -99,11 +100,23 @@
     } else if (PyByteArray_Check($input)) {
 	$1 = PyByteArray_AsString($input);
 	$2 = PyByteArray_Size($input);
+    } else if (PyObject_CheckBuffer($input)) {
+	/* memoryview, array, numpy, etc.  Used in place, no copy. */
+	if (PyObject_GetBuffer($input, &view, PyBUF_SIMPLE) == -1)
+	    SWIG_fail;
+	got_view = 1;
+	$1 = (char *) view.buf;
+	$2 = view.len;
     } else {
-        PyErr_SetString(PyExc_TypeError, "Must be a byte string or array");
+        PyErr_SetString(PyExc_TypeError,
+			"Must be a byte string or support the buffer protocol");
         SWIG_fail;
     }
 }
+%typemap(freearg) (char *bytestr, my_ssize_t len) {
+    if (got_view$argnum)
+	PyBuffer_Release(&view$argnum);
+}
 
 %typemap(in) const char ** {
     unsigned int i;
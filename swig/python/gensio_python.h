@@ -33,8 +33,11 @@ static void gensio_swig_init_lang(void)
 {
     swig_waiter_wake = wake_curr_waiter;
 }
+#undef OI_PY_STATE
+#undef OI_PY_STATE_GET
+#undef OI_PY_STATE_PUT
 #define OI_PY_STATE int
-#define OI_PY_STATE_GET() 0
+#define OI_PY_STATE_GET(s, interp) ((s) = 0)
 #define OI_PY_STATE_PUT(s) do { } while(s)
 
 /* No threads */
@@ -95,7 +98,7 @@ swig_make_ref_i(void *item, swig_type_info *classt)
     swig_ref    rv;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, NULL);
     rv.val = SWIG_NewPointerObj(item, classt, SWIG_POINTER_OWN);
     OI_PY_STATE_PUT(gstate);
     return rv;
@@ -206,11 +209,19 @@ os_funcs_ref(struct gensio_os_funcs *o)
     os_funcs_unlock(odata);
 }
 
+/*
+ * The refcount and handler are protected by lock, not the GIL, so
+ * this works on free-threaded Python.  Callbacks run in interp, the
+ * interpreter the object was created in.
+ */
 struct gensio_data {
     bool tmpval; /* If true, just ignore this on destroy. */
+    bool read_memview; /* Deliver reads as memoryviews. */
     int refcount;
     swig_cb_val *handler_val;
     struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    PyInterpreterState *interp;
 };
 
 static struct gensio_data *
@@ -221,7 +232,14 @@ alloc_gensio_data(struct gensio_os_funcs *o, swig_cb *handler)
     data = (struct gensio_data *) malloc(sizeof(*data));
     if (!data)
 	return NULL;
+    data->lock = gensio_os_funcs_alloc_lock(o);
+    if (!data->lock) {
+	free(data);
+	return NULL;
+    }
+    data->interp = gensio_python_curr_interp();
     data->tmpval = false;
+    data->read_memview = false;
     data->refcount = 1;
     if (nil_swig_cb(handler))
 	data->handler_val = NULL;
@@ -237,6 +255,7 @@ static void
 free_gensio_data(struct gensio_data *data)
 {
     deref_swig_cb_val(data->handler_val);
+    gensio_os_funcs_free_lock(data->o, data->lock);
     check_os_funcs_free(data->o);
     free(data);
 }
@@ -244,28 +263,22 @@ free_gensio_data(struct gensio_data *data)
 static void
 ref_gensio_data(struct gensio_data *data)
 {
-    struct os_funcs_data *odata = (struct os_funcs_data *)
-	gensio_os_funcs_get_data(data->o);
-
-    os_funcs_lock(odata);
+    gensio_os_funcs_lock(data->o, data->lock);
     data->refcount++;
-    os_funcs_unlock(odata);
+    gensio_os_funcs_unlock(data->o, data->lock);
 }
 
 static void
 deref_gensio_data(struct gensio_data *data, struct gensio *io)
 {
-    struct os_funcs_data *odata = (struct os_funcs_data *)
-	gensio_os_funcs_get_data(data->o);
-
-    os_funcs_lock(odata);
+    gensio_os_funcs_lock(data->o, data->lock);
     data->refcount--;
     if (data->refcount <= 0) {
-	os_funcs_unlock(odata);
+	gensio_os_funcs_unlock(data->o, data->lock);
 	gensio_free(io);
 	free_gensio_data(data);
     } else {
-	os_funcs_unlock(odata);
+	gensio_os_funcs_unlock(data->o, data->lock);
     }
 }
 
@@ -273,20 +286,69 @@ static void
 deref_gensio_accepter_data(struct gensio_data *data,
 			   struct gensio_accepter *acc)
 {
-    struct os_funcs_data *odata = (struct os_funcs_data *)
-	gensio_os_funcs_get_data(data->o);
-
-    os_funcs_lock(odata);
+    gensio_os_funcs_lock(data->o, data->lock);
     data->refcount--;
     if (data->refcount <= 0) {
-	os_funcs_unlock(odata);
+	gensio_os_funcs_unlock(data->o, data->lock);
 	gensio_acc_free(acc);
 	free_gensio_data(data);
     } else {
-	os_funcs_unlock(odata);
+	gensio_os_funcs_unlock(data->o, data->lock);
     }
 }
 
+/*
+ * Another thread may call set_cbs while a callback is running, so a
+ * callback works from its own reference to the handler.  Call this
+ * attached to the interpreter and release it with Py_XDECREF().
+ */
+static swig_cb_val *
+gensio_data_get_handler(struct gensio_data *data)
+{
+    swig_cb_val *handler_val;
+
+    gensio_os_funcs_lock(data->o, data->lock);
+    handler_val = data->handler_val;
+    Py_XINCREF(handler_val);
+    gensio_os_funcs_unlock(data->o, data->lock);
+
+    return handler_val;
+}
+
+static void
+gensio_data_set_handler(struct gensio_data *data, swig_cb *handler)
+{
+    swig_cb_val *old_val, *new_val = NULL;
+
+    if (handler)
+	new_val = ref_swig_cb(handler, read_callback);
+    gensio_os_funcs_lock(data->o, data->lock);
+    old_val = data->handler_val;
+    data->handler_val = new_val;
+    gensio_os_funcs_unlock(data->o, data->lock);
+    deref_swig_cb_val(old_val);
+}
+
+/* The interpreter to run callbacks for io in. */
+static PyInterpreterState *
+gensio_py_interp(struct gensio *io)
+{
+    struct gensio_data *data = (struct gensio_data *) gensio_get_user_data(io);
+
+    if (!data || data->tmpval)
+	return NULL;
+    return data->interp;
+}
+
+static PyInterpreterState *
+gensio_acc_py_interp(struct gensio_accepter *acc)
+{
+    struct gensio_data *data =
+	(struct gensio_data *) gensio_acc_get_user_data(acc);
+
+    return data->interp;
+}
+
 static void
 gensio_pyref(struct gensio *io)
 {
@@ -320,7 +382,7 @@ gensio_open_done(struct gensio *io, int err, void *cb_data) {
     PyObject *args, *o;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, gensio_py_interp(io));
 
     io_ref = swig_make_ref(io, gensio);
     gensio_pyref(io);
@@ -347,7 +409,7 @@ gensio_close_done(struct gensio *io, void *cb_data) {
     PyObject *args;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, gensio_py_interp(io));
 
     io_ref = swig_make_ref(io, gensio);
     args = PyTuple_New(1);
@@ -367,10 +429,12 @@ sgensio_call(struct gensio *io, long val, const char *func)
     swig_ref io_ref;
     PyObject *args, *o;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
-    if (!data->handler_val)
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val)
 	goto out_put;
 
     io_ref = swig_make_ref(io, gensio);
@@ -380,7 +444,8 @@ sgensio_call(struct gensio *io, long val, const char *func)
     o = PyInt_FromLong(val);
     PyTuple_SET_ITEM(args, 1, o);
 
-    swig_finish_call(data->handler_val, func, args, true);
+    swig_finish_call(handler_val, func, args, true);
+    Py_DECREF(handler_val);
 
  out_put:
     OI_PY_STATE_PUT(gstate);
@@ -409,10 +474,12 @@ sgensio_signature(struct gensio *io)
     swig_ref io_ref;
     PyObject *args;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
-    if (!data->handler_val)
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val)
 	goto out_put;
 
     io_ref = swig_make_ref(io, gensio);
@@ -420,7 +487,8 @@ sgensio_signature(struct gensio *io)
     ref_gensio_data(data);
     PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-    swig_finish_call(data->handler_val, "signature", args, true);
+    swig_finish_call(handler_val, "signature", args, true);
+    Py_DECREF(handler_val);
 
  out_put:
     OI_PY_STATE_PUT(gstate);
@@ -433,10 +501,12 @@ sgensio_sync(struct gensio *io)
     swig_ref io_ref;
     PyObject *args;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
-    if (!data->handler_val)
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val)
 	goto out_put;
 
     io_ref = swig_make_ref(io, gensio);
@@ -444,7 +514,8 @@ sgensio_sync(struct gensio *io)
     ref_gensio_data(data);
     PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-    swig_finish_call(data->handler_val, "sync", args, true);
+    swig_finish_call(handler_val, "sync", args, true);
+    Py_DECREF(handler_val);
 
  out_put:
     OI_PY_STATE_PUT(gstate);
@@ -457,10 +528,12 @@ sgensio_flowcontrol_state(struct gensio *io, bool val)
     swig_ref io_ref;
     PyObject *args, *o;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
-    if (!data->handler_val)
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val)
 	goto out_put;
 
     io_ref = swig_make_ref(io, gensio);
@@ -470,7 +543,8 @@ sgensio_flowcontrol_state(struct gensio *io, bool val)
     o = PyBool_FromLong(val);
     PyTuple_SET_ITEM(args, 1, o);
 
-    swig_finish_call(data->handler_val, "flowcontrol_state", args, true);
+    swig_finish_call(handler_val, "flowcontrol_state", args, true);
+    Py_DECREF(handler_val);
 
  out_put:
     OI_PY_STATE_PUT(gstate);
@@ -555,6 +629,41 @@ gensio_py_handle_auxdata(const char *const *auxdata)
     }
 }
 
+/*
+ * Make a read data object.  In memoryview mode this points straight
+ * at the library's buffer, and must be released with
+ * gensio_py_release_read_data() when the callback returns.
+ */
+static PyObject *
+gensio_py_read_data(struct gensio_data *data, const unsigned char *buf,
+		    gensiods len)
+{
+#if PY_VERSION_HEX >= 0x03030000
+    if (data->read_memview)
+	return PyMemoryView_FromMemory((char *) buf, len, PyBUF_READ);
+#endif
+    return PyBytes_FromStringAndSize((const char *) buf, len);
+}
+
+static void
+gensio_py_release_read_data(struct gensio_data *data, PyObject *o)
+{
+#if PY_VERSION_HEX >= 0x03030000
+    PyObject *etype, *evalue, *etb, *r;
+
+    if (!data->read_memview || !PyMemoryView_Check(o))
+	return;
+    /* Don't let the release step on an error from the callback. */
+    PyErr_Fetch(&etype, &evalue, &etb);
+    r = PyObject_CallMethod(o, "release", NULL);
+    if (r)
+	Py_DECREF(r);
+    else
+	PyErr_Clear();
+    PyErr_Restore(etype, evalue, etb);
+#endif
+}
+
 static int
 gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 		   unsigned char *buf, gensiods *buflen,
@@ -564,14 +673,16 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
     swig_ref io_ref, new_con;
     PyObject *args, *o;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
     int rv = 0;
     gensiods rsize;
     struct gensio *io2;
     struct gensio_data *iodata;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
-    if (!data->handler_val) {
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val) {
 	rv = GE_NOTSUP;
 	goto out_put;
     }
@@ -593,20 +704,66 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	PyTuple_SET_ITEM(args, 1, o);
 
 	if (buf) {
-	    o = PyBytes_FromStringAndSize((char *) buf, *buflen);
+	    o = gensio_py_read_data(data, buf, *buflen);
 	} else {
 	    o = Py_None;
 	    Py_INCREF(Py_None);
 	}
+	Py_INCREF(o);
 	PyTuple_SET_ITEM(args, 2, o);
 
 	PyTuple_SET_ITEM(args, 3, gensio_py_handle_auxdata(auxdata));
 
-	rsize = swig_finish_call_rv_gensiods(data->handler_val,
+	rsize = swig_finish_call_rv_gensiods(handler_val,
 					     "read_callback", args, false);
 	if (!PyErr_Occurred() && buflen)
 	    *buflen = rsize;
+	gensio_py_release_read_data(data, o);
+	Py_DECREF(o);
+	break;
+
+    case GENSIO_EVENT_READ_BATCH: {
+	struct gensio_pkt *pkts = (struct gensio_pkt *) buf;
+	PyObject *pkt, *list;
+	gensiods i;
+
+	/* Without a batch handler, fall back to single reads. */
+	if (!PyObject_HasAttrString(handler_val,
+				    "read_batch_callback")) {
+	    rv = GE_NOTSUP;
+	    break;
+	}
+
+	list = PyList_New(*buflen);
+	for (i = 0; i < *buflen; i++) {
+	    pkt = PyTuple_New(2);
+	    PyTuple_SET_ITEM(pkt, 0, gensio_py_read_data(data, pkts[i].buf,
+							 pkts[i].buflen));
+	    PyTuple_SET_ITEM(pkt, 1,
+			     gensio_py_handle_auxdata(pkts[i].auxdata));
+	    PyList_SET_ITEM(list, i, pkt);
+	}
+
+	args = PyTuple_New(2);
+	io_ref = swig_make_ref(io, gensio);
+	ref_gensio_data(data);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+	Py_INCREF(list);
+	PyTuple_SET_ITEM(args, 1, list);
+
+	rsize = swig_finish_call_rv_gensiods(handler_val,
+					     "read_batch_callback", args,
+					     false);
+	if (!PyErr_Occurred() && rsize < *buflen)
+	    *buflen = rsize;
+	for (i = 0; i < (gensiods) PyList_GET_SIZE(list); i++) {
+	    pkt = PyList_GET_ITEM(list, i);
+	    if (PyTuple_Check(pkt) && PyTuple_GET_SIZE(pkt) == 2)
+		gensio_py_release_read_data(data, PyTuple_GET_ITEM(pkt, 0));
+	}
+	Py_DECREF(list);
 	break;
+    }
 
     case GENSIO_EVENT_WRITE_READY:
 	io_ref = swig_make_ref(io, gensio);
@@ -614,12 +771,14 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-	swig_finish_call(data->handler_val, "write_callback", args, false);
+	swig_finish_call(handler_val, "write_callback", args, false);
 	break;
 
     case GENSIO_EVENT_NEW_CHANNEL:
 	io2 = (struct gensio *) buf;
 	iodata = alloc_gensio_data(data->o, NULL);
+	if (iodata)
+	    iodata->interp = data->interp;
 	gensio_set_callback(io2, gensio_child_event, iodata);
 
 	args = PyTuple_New(3);
@@ -634,7 +793,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 
 	PyTuple_SET_ITEM(args, 2, gensio_py_handle_auxdata(auxdata));
 
-	rv = swig_finish_call_rv_int(data->handler_val, "new_channel",
+	rv = swig_finish_call_rv_int(handler_val, "new_channel",
 				     args, false);
 	break;
 
@@ -644,7 +803,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-	swig_finish_call(data->handler_val, "send_break", args, true);
+	swig_finish_call(handler_val, "send_break", args, true);
 	break;
 
     case GENSIO_EVENT_AUTH_BEGIN:
@@ -653,7 +812,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-	rv = swig_finish_call_rv_int(data->handler_val, "auth_begin",
+	rv = swig_finish_call_rv_int(handler_val, "auth_begin",
 				     args, true);
 	break;
 
@@ -663,7 +822,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
 
-	rv = swig_finish_call_rv_int(data->handler_val, "precert_verify",
+	rv = swig_finish_call_rv_int(handler_val, "precert_verify",
 				     args, true);
 	break;
 
@@ -682,7 +841,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	}
 	PyTuple_SET_ITEM(args, 2, o);
 
-	rv = swig_finish_call_rv_int(data->handler_val, "postcert_verify",
+	rv = swig_finish_call_rv_int(handler_val, "postcert_verify",
 				     args, true);
 	break;
 
@@ -698,7 +857,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	o = OI_PI_FromString((const char *) buf);
 	PyTuple_SET_ITEM(args, 1, o);
 
-	rv = swig_finish_call_rv_int(data->handler_val, "password_verify",
+	rv = swig_finish_call_rv_int(handler_val, "password_verify",
 				     args, true);
 	break;
 
@@ -707,7 +866,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	args = PyTuple_New(1);
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
-	o = swig_finish_call_rv(data->handler_val, "request_password",
+	o = swig_finish_call_rv(handler_val, "request_password",
 				args, true);
 	rv = GE_NOTSUP;
 	if (o) {
@@ -738,7 +897,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	o = PyBytes_FromStringAndSize((const char *) buf, *buflen);
 	PyTuple_SET_ITEM(args, 1, o);
 
-	rv = swig_finish_call_rv_int(data->handler_val, "verify_2fa",
+	rv = swig_finish_call_rv_int(handler_val, "verify_2fa",
 				     args, true);
 	break;
 
@@ -747,7 +906,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	args = PyTuple_New(1);
 	ref_gensio_data(data);
 	PyTuple_SET_ITEM(args, 0, io_ref.val);
-	o = swig_finish_call_rv(data->handler_val, "request_2fa",
+	o = swig_finish_call_rv(handler_val, "request_2fa",
 				args, true);
 	rv = GE_NOTSUP;
 	if (o) {
@@ -839,6 +998,7 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	rv = GE_NOTSUP;
 	break;
     }
+    Py_DECREF(handler_val);
 
  out_put:
     OI_PY_STATE_PUT(gstate);
@@ -854,7 +1014,7 @@ gensio_acc_shutdown_done(struct gensio_accepter *accepter, void *cb_data)
     PyObject *args;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, gensio_acc_py_interp(accepter));
 
     acc_ref = swig_make_ref(accepter, gensio_accepter);
     args = PyTuple_New(1);
@@ -875,7 +1035,7 @@ gensio_acc_set_acc_cb_done(struct gensio_accepter *accepter, void *cb_data)
     PyObject *args;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, gensio_acc_py_interp(accepter));
 
     acc_ref = swig_make_ref(accepter, gensio_accepter);
     args = PyTuple_New(1);
@@ -899,11 +1059,17 @@ gensio_acc_io_call_cb(struct gensio_accepter *accepter, struct gensio *io,
     PyObject *args, *o;
     int rv;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
     struct gensio_data tmpdata;
     void *old_user_data = gensio_get_user_data(io);
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, data->interp);
 
+    handler_val = gensio_data_get_handler(data);
+    if (!handler_val) {
+	OI_PY_STATE_PUT(gstate);
+	return GE_NOTSUP;
+    }
 
     /*
      * This is a situation where the gensio has not been reported
@@ -939,8 +1105,9 @@ gensio_acc_io_call_cb(struct gensio_accepter *accepter, struct gensio *io,
 	PyTuple_SET_ITEM(args, 2, o);
     }
 
-    rv = swig_finish_call_rv_int(data->handler_val, func, args, optional);
+    rv = swig_finish_call_rv_int(handler_val, func, args, optional);
     gensio_set_user_data(io, old_user_data);
+    Py_DECREF(handler_val);
 
     OI_PY_STATE_PUT(gstate);
     return rv;
@@ -954,6 +1121,7 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
     swig_ref acc_ref, io_ref;
     PyObject *args, *o;
     OI_PY_STATE gstate;
+    swig_cb_val *handler_val;
     struct gensio_data *iodata;
     struct gensio *io;
     struct gensio_loginfo *i = (struct gensio_loginfo *) cdata;
@@ -966,7 +1134,12 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 
     switch (event) {
     case GENSIO_ACC_EVENT_LOG:
-	gstate = OI_PY_STATE_GET();
+	OI_PY_STATE_GET(gstate, data->interp);
+	handler_val = gensio_data_get_handler(data);
+	if (!handler_val) {
+	    OI_PY_STATE_PUT(gstate);
+	    return GE_NOTSUP;
+	}
 
 	acc_ref = swig_make_ref(accepter, gensio_accepter);
 	args = PyTuple_New(3);
@@ -978,7 +1151,8 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	o = OI_PI_FromString(buf);
 	PyTuple_SET_ITEM(args, 2, o);
 
-	swig_finish_call(data->handler_val, "accepter_log", args, true);
+	swig_finish_call(handler_val, "accepter_log", args, true);
+	Py_DECREF(handler_val);
 
 	OI_PY_STATE_PUT(gstate);
 	return 0;
@@ -986,9 +1160,16 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
     case GENSIO_ACC_EVENT_NEW_CONNECTION:
 	io = (struct gensio *) cdata;
 	iodata = alloc_gensio_data(data->o, NULL);
+	if (iodata)
+	    iodata->interp = data->interp;
 	gensio_set_callback(io, gensio_child_event, iodata);
 
-	gstate = OI_PY_STATE_GET();
+	OI_PY_STATE_GET(gstate, data->interp);
+	handler_val = gensio_data_get_handler(data);
+	if (!handler_val) {
+	    OI_PY_STATE_PUT(gstate);
+	    return GE_NOTSUP;
+	}
 
 	acc_ref = swig_make_ref(accepter, gensio_accepter);
 	gensio_accepter_pyref(accepter);
@@ -997,7 +1178,8 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	PyTuple_SET_ITEM(args, 0, acc_ref.val);
 	PyTuple_SET_ITEM(args, 1, io_ref.val);
 
-	swig_finish_call(data->handler_val, "new_connection", args, false);
+	swig_finish_call(handler_val, "new_connection", args, false);
+	Py_DECREF(handler_val);
 
 	OI_PY_STATE_PUT(gstate);
 	return 0;
@@ -1024,7 +1206,12 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	pwvfy = (struct gensio_acc_password_verify_data *) cdata;
 	io = pwvfy->io;
 
-	gstate = OI_PY_STATE_GET();
+	OI_PY_STATE_GET(gstate, data->interp);
+	handler_val = gensio_data_get_handler(data);
+	if (!handler_val) {
+	    OI_PY_STATE_PUT(gstate);
+	    return GE_NOTSUP;
+	}
 
 	/*
 	 * This is a situation where the gensio has not been reported
@@ -1042,9 +1229,10 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	PyTuple_SET_ITEM(args, 0, acc_ref.val);
 	PyTuple_SET_ITEM(args, 1, io_ref.val);
 
-	o = swig_finish_call_rv(data->handler_val, "request_password",
+	o = swig_finish_call_rv(handler_val, "request_password",
 				args, true);
 	gensio_set_user_data(io, old_user_data);
+	Py_DECREF(handler_val);
 	rv = GE_NOTSUP;
 	if (o) {
 	    if (OI_PI_StringCheck(o)) {
@@ -1072,7 +1260,12 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	pwvfy = (struct gensio_acc_password_verify_data *) cdata;
 	io = pwvfy->io;
 
-	gstate = OI_PY_STATE_GET();
+	OI_PY_STATE_GET(gstate, data->interp);
+	handler_val = gensio_data_get_handler(data);
+	if (!handler_val) {
+	    OI_PY_STATE_PUT(gstate);
+	    return GE_NOTSUP;
+	}
 
 	/*
 	 * This is a situation where the gensio has not been reported
@@ -1090,9 +1283,10 @@ gensio_acc_child_event(struct gensio_accepter *accepter, void *user_data,
 	PyTuple_SET_ITEM(args, 0, acc_ref.val);
 	PyTuple_SET_ITEM(args, 1, io_ref.val);
 
-	o = swig_finish_call_rv(data->handler_val, "request_2fa",
+	o = swig_finish_call_rv(handler_val, "request_2fa",
 				args, true);
 	gensio_set_user_data(io, old_user_data);
+	Py_DECREF(handler_val);
 	rv = GE_NOTSUP;
 	if (o) {
 	    if (OI_PI_BytesCheck(o)) {
@@ -1158,7 +1352,8 @@ sergensio_cb(struct sergensio *sio, int err, unsigned int val, void *cb_data)
     PyObject *o, *args;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate,
+		    gensio_py_interp(sergensio_to_gensio(sio)));
 
     sio_ref = swig_make_ref(sio, sergensio);
     args = PyTuple_New(3);
@@ -1189,7 +1384,8 @@ sergensio_sig_cb(struct sergensio *sio, int err,
     PyObject *args, *o;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate,
+		    gensio_py_interp(sergensio_to_gensio(sio)));
 
     sio_ref = swig_make_ref(sio, sergensio);
     args = PyTuple_New(3);
@@ -1219,6 +1415,7 @@ struct mdns {
     struct gensio_lock *lock;
     struct gensio_mdns *mdns;
     swig_cb_val *done_val;
+    PyInterpreterState *interp;
 };
 
 struct mdns_service {
@@ -1233,6 +1430,7 @@ struct mdns_watch {
     struct gensio_mdns_watch *watch;
     swig_cb_val *done_val;
     swig_cb_val *cb_val;
+    PyInterpreterState *interp;
 };
 
 static void gensio_mdns_free_done(struct gensio_mdns *mdns, void *userdata)
@@ -1241,7 +1439,7 @@ static void gensio_mdns_free_done(struct gensio_mdns *mdns, void *userdata)
     struct gensio_os_funcs *o = m->o;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, m->interp);
 
     swig_finish_call(m->done_val, "mdns_close_done", NULL, false);
 
@@ -1267,7 +1465,7 @@ static void gensio_mdns_remove_watch_done(struct gensio_mdns_watch *watch,
     struct gensio_os_funcs *o = w->o;
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, w->interp);
 
     swig_finish_call(w->done_val, "mdns_close_watch_done", NULL, false);
 
@@ -1302,7 +1500,7 @@ static void gensio_mdns_cb(struct gensio_mdns_watch *watch,
     gensiods len = 0, pos = 0;
     int rv;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, w->interp);
 
     if (state == GENSIO_MDNS_ALL_FOR_NOW) {
 	swig_finish_call(w->cb_val, "mdns_all_for_now", NULL, true);
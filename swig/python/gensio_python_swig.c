@@ -21,12 +21,80 @@
 
 void (*swig_waiter_wake)(void);
 
+#if PY_VERSION_HEX >= 0x03090000
+static PyThreadState *
+gensio_python_curr_tstate(void)
+{
+#if PY_VERSION_HEX >= 0x030d0000
+    return PyThreadState_GetUnchecked();
+#else
+    return _PyThreadState_UncheckedGet();
+#endif
+}
+#endif
+
+/* Returns NULL if the thread is not attached to an interpreter. */
+PyInterpreterState *
+gensio_python_curr_interp(void)
+{
+#if PY_VERSION_HEX >= 0x03090000
+    PyThreadState *tstate = gensio_python_curr_tstate();
+
+    if (tstate)
+	return PyThreadState_GetInterpreter(tstate);
+#endif
+    return NULL;
+}
+
+void
+gensio_python_state_get(PyInterpreterState *interp, struct gensio_py_state *s)
+{
+#if PY_VERSION_HEX >= 0x03090000
+    PyThreadState *curr = gensio_python_curr_tstate();
+#endif
+
+    s->gilstate_used = false;
+    s->tstate = NULL;
+    s->saved = NULL;
+
+#if PY_VERSION_HEX >= 0x03090000
+    if (curr) {
+	if (!interp || PyThreadState_GetInterpreter(curr) == interp)
+	    return;
+	/* A callback into a different interpreter, step out of this one. */
+	s->saved = PyEval_SaveThread();
+    }
+    if (interp && interp != PyInterpreterState_Main()) {
+	s->tstate = PyThreadState_New(interp);
+	PyEval_RestoreThread(s->tstate);
+	return;
+    }
+#endif
+    s->gstate = PyGILState_Ensure();
+    s->gilstate_used = true;
+}
+
+void
+gensio_python_state_put(struct gensio_py_state *s)
+{
+    if (s->gilstate_used) {
+	PyGILState_Release(s->gstate);
+    } else if (s->tstate) {
+#if PY_VERSION_HEX >= 0x03090000
+	PyThreadState_Clear(s->tstate);
+	PyThreadState_DeleteCurrent();
+#endif
+    }
+    if (s->saved)
+	PyEval_RestoreThread(s->saved);
+}
+
 swig_cb_val *
 gensio_python_ref_swig_cb_i(swig_cb *cb)
 {
     OI_PY_STATE gstate;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, NULL);
     Py_INCREF(cb);
     OI_PY_STATE_PUT(gstate);
     return cb;
@@ -38,7 +106,7 @@ gensio_python_deref_swig_cb_val(swig_cb_val *cb)
     OI_PY_STATE gstate;
 
     if (cb) {
-	gstate = OI_PY_STATE_GET();
+	OI_PY_STATE_GET(gstate, NULL);
 	Py_DECREF(cb);
 	OI_PY_STATE_PUT(gstate);
     }
@@ -88,7 +156,7 @@ gensio_do_vlog(struct gensio_os_funcs *o,
     if (!odata->log_handler)
 	return;
 
-    gstate = OI_PY_STATE_GET();
+    OI_PY_STATE_GET(gstate, odata->interp);
 
     va_copy(tmpva, fmtargs);
     len = vsnprintf(buf, 0, fmt, tmpva);
@@ -115,6 +183,64 @@ gensio_do_vlog(struct gensio_os_funcs *o,
 static struct gensio_os_proc_data *proc_data;
 static struct gensio_os_funcs *curr_os_funcs;
 
+#ifdef USE_POSIX_THREADS
+/* Sub-interpreters with their own GIL may set up at the same time. */
+static pthread_mutex_t setup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void os_funcs_setup_lock(void)
+{
+    pthread_mutex_lock(&setup_lock);
+}
+static void os_funcs_setup_unlock(void)
+{
+    pthread_mutex_unlock(&setup_lock);
+}
+static void os_funcs_lock(struct os_funcs_data *odata)
+{
+    pthread_mutex_lock(&odata->lock);
+}
+static void os_funcs_unlock(struct os_funcs_data *odata)
+{
+    pthread_mutex_unlock(&odata->lock);
+}
+#else
+static void os_funcs_setup_lock(void)
+{
+}
+static void os_funcs_setup_unlock(void)
+{
+}
+void os_funcs_lock(struct os_funcs_data *odata)
+{
+}
+void os_funcs_unlock(struct os_funcs_data *odata)
+{
+}
+#endif
+
+static int
+gensio_swig_share_os_funcs(struct gensio_os_funcs *o)
+{
+    struct os_funcs_data *odata = gensio_os_funcs_get_data(o);
+
+    /*
+     * Each sub-interpreter imports the module and allocates the
+     * default os funcs, which is the same one, so let them share it.
+     * The log handler stays with the first interpreter.
+     */
+    if (curr_os_funcs != o)
+	return GE_INUSE;
+    if (!odata->interp || odata->interp == gensio_python_curr_interp())
+	return GE_INUSE;
+
+    os_funcs_lock(odata);
+    odata->refcount++;
+    os_funcs_unlock(odata);
+    /* The reference the caller got is now held by odata. */
+    gensio_os_funcs_free(o);
+    return 0;
+}
+
 int
 gensio_swig_setup_os_funcs(struct gensio_os_funcs *o,
 			   swig_cb *log_handler)
@@ -122,12 +248,17 @@ gensio_swig_setup_os_funcs(struct gensio_os_funcs *o,
     struct os_funcs_data *odata;
     int err;
 
-    if (curr_os_funcs)
-	return GE_INUSE;
+    os_funcs_setup_lock();
+    if (curr_os_funcs) {
+	err = gensio_swig_share_os_funcs(o);
+	os_funcs_setup_unlock();
+	return err;
+    }
 
     odata = malloc(sizeof(*odata));
     assert(odata != NULL);
     odata->refcount = 1;
+    odata->interp = gensio_python_curr_interp();
 #ifdef USE_POSIX_THREADS
     pthread_mutex_init(&odata->lock, NULL);
 #endif
@@ -140,53 +271,55 @@ gensio_swig_setup_os_funcs(struct gensio_os_funcs *o,
 
     err = gensio_os_proc_setup(o, &proc_data);
     if (err) {
+	os_funcs_setup_unlock();
 	free(odata);
 	return err;
     }
     gensio_os_funcs_set_data(o, odata);
     curr_os_funcs = o;
+    os_funcs_setup_unlock();
     return 0;
 }
 
-#ifdef USE_POSIX_THREADS
-static void os_funcs_lock(struct os_funcs_data *odata)
-{
-    pthread_mutex_lock(&odata->lock);
-}
-static void os_funcs_unlock(struct os_funcs_data *odata)
-{
-    pthread_mutex_unlock(&odata->lock);
-}
-#else
-void os_funcs_lock(struct os_funcs_data *odata)
-{
-}
-void os_funcs_unlock(struct os_funcs_data *odata)
-{
-}
-#endif
-
 void
 check_os_funcs_free(struct gensio_os_funcs *o)
 {
     struct os_funcs_data *odata = gensio_os_funcs_get_data(o);
+    OI_PY_STATE gstate;
 
     os_funcs_lock(odata);
-    if (--odata->refcount == 0) {
+    if (--odata->refcount > 0) {
 	os_funcs_unlock(odata);
-	if (odata->log_handler)
-	    gensio_python_deref_swig_cb_val(odata->log_handler);
-#ifdef USE_POSIX_THREADS
-	pthread_mutex_destroy(&odata->lock);
-#endif
-	free(odata);
+	return;
+    }
+    os_funcs_unlock(odata);
 
-	gensio_os_proc_cleanup(proc_data);
-	gensio_os_funcs_free(o);
-	curr_os_funcs = NULL;
-    } else {
+    /*
+     * Another interpreter may have picked it up from curr_os_funcs
+     * before we could clear it, check again under the setup lock.
+     */
+    os_funcs_setup_lock();
+    os_funcs_lock(odata);
+    if (odata->refcount > 0) {
 	os_funcs_unlock(odata);
+	os_funcs_setup_unlock();
+	return;
+    }
+    os_funcs_unlock(odata);
+    curr_os_funcs = NULL;
+    gensio_os_proc_cleanup(proc_data);
+    gensio_os_funcs_free(o);
+    os_funcs_setup_unlock();
+
+    if (odata->log_handler) {
+	OI_PY_STATE_GET(gstate, odata->interp);
+	Py_DECREF(odata->log_handler);
+	OI_PY_STATE_PUT(gstate);
     }
+#ifdef USE_POSIX_THREADS
+    pthread_mutex_destroy(&odata->lock);
+#endif
+    free(odata);
 }
 
 int
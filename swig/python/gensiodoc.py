@@ -25,6 +25,19 @@ class gensio_os_funcs:
     one, you might have to provide a Python/C interface to allocate it.
     """
 
+    def get_poll_fd(self):
+        """Return an fd that becomes readable when the os funcs has fd
+        events to process, for running gensio from another event loop
+        (see gensio_asyncio).  Raises an exception if not supported.
+        """
+        return 0
+
+    def next_timeout(self):
+        """Return the number of milliseconds until timers or runners
+        need servicing, 0 if now, or -1 if nothing is pending.
+        """
+        return 0
+
 def alloc_gensio_selector(h):
     """Allocate a default gensio_os_funcs for your platform.
 
@@ -59,6 +72,27 @@ class EventHandler:
         Return the number of bytes consumed.  THIS IS IMPORTANT.  If
         you return 0, it will assume you did not consume any of the data
         and give you the same data again immediately.
+
+        If set_read_memview(True) was called on the gensio, data is a
+        read-only memoryview of the library's buffer instead of a byte
+        string.  It is released when this returns, copy anything you
+        need to keep.
+        """
+        return 0
+
+    def read_batch_callback(io, pkts):
+        """Optional.  Receive a batch of packets in one call.  This is
+        only used if GENSIO_CONTROL_READ_BATCH has been set on a
+        gensio that supports it (like UDP), otherwise, or if this
+        method doesn't exist, packets go to read_callback() one at a
+        time.  Errors are always reported through read_callback().
+
+        io -- The gensio object reporting the read data.
+        pkts -- A list of (data, auxdata) tuples, one per packet, with
+               data and auxdata as in read_callback().
+
+        Return the number of packets consumed, the rest will be
+        delivered again.
         """
         return 0
 
@@ -494,7 +528,9 @@ class gensio:
     def write(self, bytestr, auxdata):
         """Write the given byte string.
 
-        bytestr -- The data to write.
+        bytestr -- The data to write.  Any object supporting the buffer
+            protocol (bytes, bytearray, memoryview, array, etc.) may be
+            used and is not copied.
         auxdata -- A sequence of strings holding gensio-specific auxiliary
             data.  May be None if it's not applicable.
 
@@ -527,6 +563,16 @@ class gensio:
         """
         return
 
+    def set_read_memview(self, enable):
+        """Deliver read data to read_callback() and read_batch_callback()
+        as memoryviews over the library's buffer instead of copying
+        it to a new byte string.  The memoryview is only valid during
+        the callback.
+
+        enable -- A boolean, whether to use memoryviews
+        """
+        return
+
     def set_sync(self):
         """Enable synchronous I/O on the gensio.  If you call this, then read
         and write events will not go the the event handler (though
@@ -36,11 +36,37 @@ struct os_funcs_data {
 #endif
     unsigned int refcount;
     swig_cb_val *log_handler;
+    PyInterpreterState *interp; /* Where log_handler lives. */
 };
 
-#define OI_PY_STATE PyGILState_STATE
-#define OI_PY_STATE_GET() PyGILState_Ensure()
-#define OI_PY_STATE_PUT(s) PyGILState_Release(s)
+/*
+ * Python thread state for running a callback from gensio.  Objects
+ * remember the interpreter that created them, and callbacks for them
+ * are run in that interpreter.  Sub-interpreters can't use the
+ * PyGILState calls, so for those a thread state is created for the
+ * callback.  If the thread is already attached to the interpreter
+ * (or interp is NULL and it is attached anywhere) nothing is done.
+ */
+struct gensio_py_state {
+    bool gilstate_used;
+    PyGILState_STATE gstate;
+    PyThreadState *tstate; /* Allocated for a sub-interpreter. */
+    PyThreadState *saved; /* Attached to another interpreter before. */
+};
+
+GENSIO_DLL_PUBLIC
+PyInterpreterState *gensio_python_curr_interp(void);
+
+GENSIO_DLL_PUBLIC
+void gensio_python_state_get(PyInterpreterState *interp,
+			     struct gensio_py_state *s);
+
+GENSIO_DLL_PUBLIC
+void gensio_python_state_put(struct gensio_py_state *s);
+
+#define OI_PY_STATE struct gensio_py_state
+#define OI_PY_STATE_GET(s, interp) gensio_python_state_get(interp, &(s))
+#define OI_PY_STATE_PUT(s) gensio_python_state_put(&(s))
 
 GENSIO_DLL_PUBLIC
 swig_cb_val *gensio_python_ref_swig_cb_i(swig_cb *cb);
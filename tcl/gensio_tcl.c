@@ -25,6 +25,11 @@
  * If you really want real threading to work, you put tcl on top of
  * gensio os funcs using Tcl_NotifierProcs.  I leave that as an
  * exercise to the reader.
+ *
+ * gensio timers are restarted constantly, so they are kept in a heap
+ * here and only one tcl timer is run, for the first one to expire.
+ * Changes to the fd handler mask made from inside a file handler are
+ * applied once when the handler returns.
  */
 
 #include "config.h"
@@ -61,6 +66,14 @@ struct gensio_data
     struct gensio_memtrack *mtrack;
     unsigned int refcount;
     struct gensio_os_proc_data *pdata;
+
+    /* Running timers, the tcl timer runs for the first one. */
+    Tcl_Mutex timer_lock;
+    struct gensio_timer **heap;
+    unsigned int heap_len;
+    unsigned int heap_size;
+    Tcl_TimerToken tcl_timer;
+    int64_t tcl_timer_expire;
 };
 
 static void *
@@ -122,6 +135,8 @@ struct gensio_iod_tcl {
     Tcl_Mutex lock;
 
     int mask;
+    int tcl_mask; /* What is currently registered with tcl. */
+    bool in_file_handler;
 
     bool in_clear;
     enum { CL_NOT_CALLED, CL_CALLED, CL_DONE } close_state;
@@ -157,17 +172,46 @@ struct gensio_iod_tcl {
 
 #define i_to_tcl(i) gensio_container_of(i, struct gensio_iod_tcl, r);
 
+static void tcl_file_handler(ClientData data, int mask);
+
+/* Must be called with the iod lock held. */
+static void
+tcl_update_mask(struct gensio_iod_tcl *iod)
+{
+    if (iod->in_file_handler || iod->mask == iod->tcl_mask)
+	return;
+    if (iod->mask == 0)
+	Tcl_DeleteFileHandler(iod->fd);
+    else
+	Tcl_CreateFileHandler(iod->fd, iod->mask, tcl_file_handler, iod);
+    iod->tcl_mask = iod->mask;
+}
+
 static void
 tcl_file_handler(ClientData data, int mask)
 {
     struct gensio_iod_tcl *iod = data;
 
+    Tcl_MutexLock(&iod->lock);
+    /* Handlers may have been disabled but not yet removed from tcl. */
+    mask &= iod->mask;
+    if (iod->in_clear)
+	mask = 0;
+    iod->in_file_handler = true;
+    Tcl_MutexUnlock(&iod->lock);
+
     if (mask & TCL_READABLE)
 	iod->read_handler(&iod->r, iod->cb_data);
     if (mask & TCL_WRITABLE)
 	iod->write_handler(&iod->r, iod->cb_data);
     if (mask & TCL_EXCEPTION)
 	iod->except_handler(&iod->r, iod->cb_data);
+
+    Tcl_MutexLock(&iod->lock);
+    iod->in_file_handler = false;
+    if (!iod->in_clear)
+	tcl_update_mask(iod);
+    Tcl_MutexUnlock(&iod->lock);
 }
 
 static void
@@ -227,8 +271,10 @@ gensio_tcl_clear_fd_handlers(struct gensio_iod *iiod)
     Tcl_MutexLock(&iod->lock);
     if (!iod->handlers_set || iod->in_clear)
 	goto out_unlock;
-    if (iod->mask)
+    if (iod->tcl_mask)
 	Tcl_DeleteFileHandler(iod->fd);
+    iod->mask = 0;
+    iod->tcl_mask = 0;
     iod->in_clear = true;
     Tcl_DoWhenIdle(tcl_cleared_done, iod);
  out_unlock:
@@ -303,10 +349,7 @@ gensio_tcl_set_read_handler(struct gensio_iod *iiod, bool enable)
 	goto out_unlock;
 
     iod->mask = new_mask;
-    if (new_mask == 0)
-	Tcl_DeleteFileHandler(iod->fd);
-    else
-	Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
+    tcl_update_mask(iod);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -339,7 +382,7 @@ gensio_tcl_set_write_handler(struct gensio_iod *iiod, bool enable)
 	goto out_unlock;
 
     iod->mask = new_mask;
-    Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
+    tcl_update_mask(iod);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -364,7 +407,7 @@ gensio_tcl_set_except_handler(struct gensio_iod *iiod, bool enable)
 	goto out_unlock;
 
     iod->mask = new_mask;
-    Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
+    tcl_update_mask(iod);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -376,9 +419,10 @@ struct gensio_timer
     void (*handler)(struct gensio_timer *t, void *cb_data);
     void *cb_data;
 
-    Tcl_Mutex lock;
-
-    Tcl_TimerToken timer_id;
+    /* State below is protected by the os funcs timer_lock. */
+    int64_t expire; /* Monotonic time in microseconds. */
+    unsigned int heap_idx;
+    bool in_heap;
 
     enum {
 	  TCL_TIMER_FREE,
@@ -391,24 +435,173 @@ struct gensio_timer
     void *done_cb_data;
 };
 
+/*
+ * Various time conversion routines.  Note that we always truncate up
+ * to the next time unit.  These are used for timers, and if you don't
+ * you can end up with an early timeout.
+ */
+static unsigned int
+gensio_time_to_ms(gensio_time *t)
+{
+    return t->secs * 1000 + (t->nsecs + 999999) / 1000000;
+}
+
+static int64_t
+gensio_time_to_us(gensio_time *t)
+{
+    return t->secs * 1000000ULL + (t->nsecs + 999) / 1000;
+}
+
+static unsigned int
+us_time_to_ms(int64_t t)
+{
+    return (t + 999) / 1000;
+}
+
+static void
+us_time_to_gensio(int64_t t, gensio_time *gt)
+{
+    gt->secs = t / 1000000;
+    gt->nsecs = t % 1000000 * 1000;
+}
+
+static int64_t
+mono_us_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void
+timer_heap_set(struct gensio_data *d, unsigned int i, struct gensio_timer *t)
+{
+    d->heap[i] = t;
+    t->heap_idx = i;
+}
+
+static void
+timer_heap_up(struct gensio_data *d, unsigned int i)
+{
+    struct gensio_timer *t = d->heap[i];
+
+    while (i > 0 && d->heap[(i - 1) / 2]->expire > t->expire) {
+	timer_heap_set(d, i, d->heap[(i - 1) / 2]);
+	i = (i - 1) / 2;
+    }
+    timer_heap_set(d, i, t);
+}
+
+static void
+timer_heap_down(struct gensio_data *d, unsigned int i)
+{
+    struct gensio_timer *t = d->heap[i];
+    unsigned int c;
+
+    for (;;) {
+	c = i * 2 + 1;
+	if (c >= d->heap_len)
+	    break;
+	if (c + 1 < d->heap_len && d->heap[c + 1]->expire < d->heap[c]->expire)
+	    c++;
+	if (d->heap[c]->expire >= t->expire)
+	    break;
+	timer_heap_set(d, i, d->heap[c]);
+	i = c;
+    }
+    timer_heap_set(d, i, t);
+}
+
+static int
+timer_heap_add(struct gensio_data *d, struct gensio_timer *t)
+{
+    if (d->heap_len == d->heap_size) {
+	unsigned int nsize = d->heap_size ? d->heap_size * 2 : 16;
+	struct gensio_timer **nheap;
+
+	nheap = realloc(d->heap, nsize * sizeof(*nheap));
+	if (!nheap)
+	    return GE_NOMEM;
+	d->heap = nheap;
+	d->heap_size = nsize;
+    }
+    timer_heap_set(d, d->heap_len++, t);
+    t->in_heap = true;
+    timer_heap_up(d, t->heap_idx);
+    return 0;
+}
+
+static void
+timer_heap_remove(struct gensio_data *d, struct gensio_timer *t)
+{
+    unsigned int i = t->heap_idx;
+
+    if (!t->in_heap)
+	return;
+    t->in_heap = false;
+    d->heap_len--;
+    if (i == d->heap_len)
+	return;
+    timer_heap_set(d, i, d->heap[d->heap_len]);
+    if (i > 0 && d->heap[(i - 1) / 2]->expire > d->heap[i]->expire)
+	timer_heap_up(d, i);
+    else
+	timer_heap_down(d, i);
+}
+
+static void gensio_tcl_timeout_handler(ClientData data);
+
+/*
+ * Make sure the tcl timer will go off by the time the first timer
+ * expires.  If it is set to go off before that, it is left alone and
+ * rearmed when it goes off, so stopping and restarting gensio timers
+ * doesn't touch the tcl timer.  Must be called with timer_lock held.
+ */
+static void
+tcl_arm_timer(struct gensio_os_funcs *o)
+{
+    struct gensio_data *d = o->user_data;
+    int64_t expire, now;
+
+    if (d->heap_len == 0)
+	return;
+    expire = d->heap[0]->expire;
+    if (d->tcl_timer && d->tcl_timer_expire <= expire)
+	return;
+    if (d->tcl_timer)
+	Tcl_DeleteTimerHandler(d->tcl_timer);
+    now = mono_us_time();
+    d->tcl_timer = Tcl_CreateTimerHandler(expire > now ?
+					  us_time_to_ms(expire - now) : 0,
+					  gensio_tcl_timeout_handler, o);
+    d->tcl_timer_expire = expire;
+}
+
 static void
 gensio_tcl_timeout_handler(ClientData data)
 {
-    struct gensio_timer *t = data;
-    void (*handler)(struct gensio_timer *t, void *cb_data) = NULL;
+    struct gensio_os_funcs *o = data;
+    struct gensio_data *d = o->user_data;
+    void (*handler)(struct gensio_timer *t, void *cb_data);
+    struct gensio_timer *t;
     void *cb_data;
+    int64_t now = mono_us_time();
 
-    Tcl_MutexLock(&t->lock);
-    if (t->timer_id) {
+    Tcl_MutexLock(&d->timer_lock);
+    d->tcl_timer = NULL;
+    while (d->heap_len && d->heap[0]->expire <= now) {
+	t = d->heap[0];
+	timer_heap_remove(d, t);
+	t->state = TCL_TIMER_STOPPED;
 	handler = t->handler;
 	cb_data = t->cb_data;
-	t->state = TCL_TIMER_STOPPED;
-	t->timer_id = 0;
-    }
-    Tcl_MutexUnlock(&t->lock);
-
-    if (handler)
+	Tcl_MutexUnlock(&d->timer_lock);
 	handler(t, cb_data);
+	Tcl_MutexLock(&d->timer_lock);
+    }
+    tcl_arm_timer(o);
+    Tcl_MutexUnlock(&d->timer_lock);
 }
 
 static struct gensio_timer *
@@ -434,122 +627,72 @@ gensio_tcl_alloc_timer(struct gensio_os_funcs *o,
 static void
 gensio_tcl_free_timer(struct gensio_timer *t)
 {
-    Tcl_MutexLock(&t->lock);
+    struct gensio_data *d = t->o->user_data;
+    bool in_stop;
+
+    Tcl_MutexLock(&d->timer_lock);
     assert(t->state != TCL_TIMER_FREE);
-    if (t->state == TCL_TIMER_RUNNING) {
-	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
-    }
+    timer_heap_remove(d, t);
+    in_stop = t->state == TCL_TIMER_IN_STOP;
     t->state = TCL_TIMER_FREE;
-    Tcl_MutexUnlock(&t->lock);
-    t->o->free(t->o, t);
-}
+    Tcl_MutexUnlock(&d->timer_lock);
 
-/*
- * Various time conversion routines.  Note that we always truncate up
- * to the next time unit.  These are used for timers, and if you don't
- * you can end up with an early timeout.
- */
-static unsigned int
-gensio_time_to_ms(gensio_time *t)
-{
-    return t->secs * 1000 + (t->nsecs + 999999) / 1000000;
-}
-
-static int64_t
-gensio_time_to_us(gensio_time *t)
-{
-    return t->secs * 1000000ULL + (t->nsecs + 999) / 1000;
-}
-
-static unsigned int
-us_time_to_ms(int64_t t)
-{
-    return (t + 999) / 1000;
-}
-
-static void
-us_time_to_gensio(int64_t t, gensio_time *gt)
-{
-    gt->secs = t / 1000000;
-    gt->nsecs = t % 1000000 * 1000;
+    /* If a stop is in progress, the done handler frees it. */
+    if (!in_stop)
+	t->o->free(t->o, t);
 }
 
 static int
-gensio_tcl_start_timer(struct gensio_timer *t, gensio_time *timeout)
+tcl_start_timer(struct gensio_timer *t, int64_t expire)
 {
-    int msec = gensio_time_to_ms(timeout);
+    struct gensio_data *d = t->o->user_data;
     int rv = 0;
 
-    Tcl_MutexLock(&t->lock);
+    Tcl_MutexLock(&d->timer_lock);
     assert(t->state != TCL_TIMER_FREE);
     if (t->state != TCL_TIMER_STOPPED) {
 	rv = GE_INUSE;
     } else {
 	t->done_handler = NULL;
-	t->timer_id = Tcl_CreateTimerHandler(msec, gensio_tcl_timeout_handler,
-					     t);
-	if (!t->timer_id) {
-	    rv = GE_NOMEM;
-	} else {
+	t->expire = expire;
+	rv = timer_heap_add(d, t);
+	if (!rv) {
 	    t->state = TCL_TIMER_RUNNING;
+	    tcl_arm_timer(t->o);
 	}
     }
-    Tcl_MutexUnlock(&t->lock);
+    Tcl_MutexUnlock(&d->timer_lock);
 
     return rv;
 }
 
 static int
-gensio_tcl_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
+gensio_tcl_start_timer(struct gensio_timer *t, gensio_time *timeout)
 {
-    struct timespec ts;
-    int64_t tnsecs, nnsecs;
-    int msec;
-    int rv = 0;
-
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    tnsecs = timeout->secs * 1000000000ULL + timeout->nsecs;
-    nnsecs = ts.tv_sec * 1000000000ULL | ts.tv_nsec;
-    if (tnsecs < nnsecs)
-	tnsecs = 0;
-    else
-	tnsecs -= nnsecs;
-    msec = (tnsecs + 999999ULL) / 1000000;
+    return tcl_start_timer(t, mono_us_time() + gensio_time_to_us(timeout));
+}
 
-    Tcl_MutexLock(&t->lock);
-    assert(t->state != TCL_TIMER_FREE);
-    if (t->state != TCL_TIMER_STOPPED) {
-	rv = GE_INUSE;
-    } else {
-	t->done_handler = NULL;
-	t->timer_id = Tcl_CreateTimerHandler(msec, gensio_tcl_timeout_handler,
-					     t);
-	if (!t->timer_id) {
-	    rv = GE_NOMEM;
-	} else {
-	    t->state = TCL_TIMER_RUNNING;
-	}
-    }
-    Tcl_MutexUnlock(&t->lock);
-    return rv;
+static int
+gensio_tcl_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
+{
+    return tcl_start_timer(t, gensio_time_to_us(timeout));
 }
 
 static int
 gensio_tcl_stop_timer(struct gensio_timer *t)
 {
+    struct gensio_data *d = t->o->user_data;
     int rv = 0;
 
-    Tcl_MutexLock(&t->lock);
+    Tcl_MutexLock(&d->timer_lock);
     assert(t->state != TCL_TIMER_FREE);
     if (t->state != TCL_TIMER_RUNNING) {
 	rv = GE_TIMEDOUT;
     } else {
 	t->state = TCL_TIMER_STOPPED;
-	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
+	timer_heap_remove(d, t);
     }
-    Tcl_MutexUnlock(&t->lock);
+    Tcl_MutexUnlock(&d->timer_lock);
     return rv;
 }
 
@@ -557,20 +700,21 @@ static void
 gensio_tcl_timeout_done(ClientData data)
 {
     struct gensio_timer *t = data;
+    struct gensio_data *d = t->o->user_data;
     void (*done_handler)(struct gensio_timer *t, void *cb_data) = NULL;
     void *done_cb_data;
 
-    Tcl_MutexLock(&t->lock);
+    Tcl_MutexLock(&d->timer_lock);
     if (t->state == TCL_TIMER_FREE) {
-	Tcl_MutexFinalize(&t->lock);
+	Tcl_MutexUnlock(&d->timer_lock);
 	t->o->free(t->o, t);
-    } else {
-	t->state = TCL_TIMER_STOPPED;
-	done_handler = t->done_handler;
-	done_cb_data = t->done_cb_data;
-	t->done_handler = NULL;
+	return;
     }
-    Tcl_MutexUnlock(&t->lock);
+    t->state = TCL_TIMER_STOPPED;
+    done_handler = t->done_handler;
+    done_cb_data = t->done_cb_data;
+    t->done_handler = NULL;
+    Tcl_MutexUnlock(&d->timer_lock);
 
     if (done_handler)
 	done_handler(t, done_cb_data);
@@ -582,9 +726,10 @@ gensio_tcl_stop_timer_with_done(struct gensio_timer *t,
 						      void *cb_data),
 				 void *cb_data)
 {
+    struct gensio_data *d = t->o->user_data;
     int rv = 0;
 
-    Tcl_MutexLock(&t->lock);
+    Tcl_MutexLock(&d->timer_lock);
     if (t->state == TCL_TIMER_IN_STOP) {
 	rv = GE_INUSE;
     } else if (t->state != TCL_TIMER_RUNNING) {
@@ -593,11 +738,10 @@ gensio_tcl_stop_timer_with_done(struct gensio_timer *t,
 	t->state = TCL_TIMER_IN_STOP;
 	t->done_handler = done_handler;
 	t->done_cb_data = cb_data;
-	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
+	timer_heap_remove(d, t);
 	Tcl_DoWhenIdle(gensio_tcl_timeout_done, t);
     }
-    Tcl_MutexUnlock(&t->lock);
+    Tcl_MutexUnlock(&d->timer_lock);
 
     return rv;
 }
@@ -1418,6 +1562,10 @@ gensio_tcl_free_funcs(struct gensio_os_funcs *f)
 	d->refcount--;
 	return;
     }
+    if (d->tcl_timer)
+	Tcl_DeleteTimerHandler(d->tcl_timer);
+    free(d->heap);
+    Tcl_MutexFinalize(&d->timer_lock);
     gensio_memtrack_cleanup(d->mtrack);
     free(d);
     free(f);
@@ -35,6 +35,12 @@ struct gensio_os_funcs *alloc_tcl_os_funcs(swig_cb *log_handler)
 
 %}
 
+%init %{
+#ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
+%}
+
 %nodefaultctor gensio_os_funcs;
 
 struct gensio_os_funcs { };
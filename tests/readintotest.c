@@ -0,0 +1,273 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Test gensio_read_into().  Read some data into a posted buffer, then
+ * post another read and close the remote end.  The posted read must
+ * complete with the ll error and no data.  This is done on a bare tcp
+ * connection (the ll reads straight into the buffer) and through
+ * telnet (base copies from the filter into the buffer).
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_utils.h>
+
+struct rinto_test {
+    struct gensio_os_funcs *o;
+    struct gensio_waiter *waiter;
+    struct gensio *srv;
+    bool done;
+    int err;
+    gensiods count;
+    unsigned char buf[100];
+};
+
+static int
+srv_event(struct gensio *io, void *user_data, int event, int err,
+	  unsigned char *buf, gensiods *buflen,
+	  const char *const *auxdata)
+{
+    return GE_NOTSUP;
+}
+
+static int
+acc_event(struct gensio_accepter *acc, void *user_data, int event,
+	  void *data)
+{
+    struct rinto_test *t = user_data;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    t->srv = data;
+    gensio_set_callback(t->srv, srv_event, t);
+    gensio_os_funcs_wake(t->o, t->waiter);
+    return 0;
+}
+
+static int
+cl_event(struct gensio *io, void *user_data, int event, int err,
+	 unsigned char *buf, gensiods *buflen,
+	 const char *const *auxdata)
+{
+    return GE_NOTSUP;
+}
+
+static void
+read_done(struct gensio *io, int err, gensiods count, void *read_data)
+{
+    struct rinto_test *t = read_data;
+
+    t->done = true;
+    t->err = err;
+    t->count = count;
+    gensio_os_funcs_wake(t->o, t->waiter);
+}
+
+static int
+wait_done(struct rinto_test *t)
+{
+    gensio_time timeout = { 10, 0 };
+    int rv = 0;
+
+    while (!t->done) {
+	rv = gensio_os_funcs_wait_intr(t->o, t->waiter, 1, &timeout);
+	if (rv == GE_INTERRUPTED)
+	    continue;
+	if (rv)
+	    break;
+    }
+    return rv;
+}
+
+static int
+post_read(struct gensio *io, struct rinto_test *t, gensiods offset)
+{
+    struct gensio_sg sg = { t->buf + offset, sizeof(t->buf) - offset };
+
+    t->done = false;
+    t->err = 0;
+    t->count = 0;
+    return gensio_read_into(io, &sg, 1, read_done, t);
+}
+
+static int
+run_test(struct rinto_test *t, const char *accstr, const char *constr)
+{
+    gensio_time timeout = { 10, 0 };
+    struct gensio_accepter *acc = NULL;
+    struct gensio *io = NULL;
+    char port[20], *str = NULL;
+    gensiods size, count, len = 0;
+    int rv;
+
+    printf("Testing %s\n", constr);
+    t->srv = NULL;
+
+    rv = str_to_gensio_accepter(accstr, t->o, acc_event, t, &acc);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate %s: %s\n", accstr,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    rv = gensio_acc_startup(acc);
+    if (rv) {
+	fprintf(stderr, "Unable to start %s: %s\n", accstr,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    size = sizeof(port);
+    strcpy(port, "0");
+    rv = gensio_acc_control(acc, GENSIO_CONTROL_DEPTH_FIRST, true,
+			    GENSIO_ACC_CONTROL_LPORT, port, &size);
+    if (rv) {
+	fprintf(stderr, "Unable to get port: %s\n", gensio_err_to_str(rv));
+	goto out;
+    }
+
+    str = gensio_alloc_sprintf(t->o, "%s%s", constr, port);
+    if (!str) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    rv = str_to_gensio(str, t->o, cl_event, t, &io);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate %s: %s\n", str,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    rv = gensio_open_s(io);
+    if (rv) {
+	fprintf(stderr, "Unable to open %s: %s\n", str,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    while (!t->srv) {
+	rv = gensio_os_funcs_wait_intr(t->o, t->waiter, 1, &timeout);
+	if (rv == GE_INTERRUPTED)
+	    continue;
+	if (rv) {
+	    fprintf(stderr, "No connection: %s\n", gensio_err_to_str(rv));
+	    goto out;
+	}
+    }
+
+    rv = gensio_write(t->srv, &count, "hello", 5, NULL);
+    if (!rv && count != 5)
+	rv = GE_INCONSISTENT;
+    if (rv) {
+	fprintf(stderr, "Server write failed: %s\n", gensio_err_to_str(rv));
+	goto out;
+    }
+
+    while (len < 5) {
+	rv = post_read(io, t, len);
+	if (!rv)
+	    rv = wait_done(t);
+	if (!rv)
+	    rv = t->err;
+	if (rv) {
+	    fprintf(stderr, "Read into failed: %s\n", gensio_err_to_str(rv));
+	    goto out;
+	}
+	len += t->count;
+    }
+    if (len != 5 || memcmp(t->buf, "hello", 5) != 0) {
+	fprintf(stderr, "Read into got the wrong data\n");
+	rv = GE_INCONSISTENT;
+	goto out;
+    }
+
+    /* Now the error case, post a read and close the other end. */
+    rv = post_read(io, t, 0);
+    if (rv) {
+	fprintf(stderr, "Read into post failed: %s\n", gensio_err_to_str(rv));
+	goto out;
+    }
+    gensio_close_s(t->srv);
+    gensio_free(t->srv);
+    t->srv = NULL;
+    rv = wait_done(t);
+    if (rv) {
+	fprintf(stderr, "Read into never completed: %s\n",
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    if (!t->err || t->count != 0) {
+	fprintf(stderr, "Read into after close got err %d count %lu\n",
+		t->err, (unsigned long) t->count);
+	rv = GE_INCONSISTENT;
+	goto out;
+    }
+
+    /* The error sticks, a new read must fail right away. */
+    if (post_read(io, t, 0) == 0) {
+	fprintf(stderr, "Read into after an error succeeded\n");
+	rv = GE_INCONSISTENT;
+	goto out;
+    }
+
+ out:
+    if (io) {
+	gensio_close_s(io);
+	gensio_free(io);
+    }
+    if (t->srv) {
+	gensio_close_s(t->srv);
+	gensio_free(t->srv);
+    }
+    if (acc) {
+	gensio_acc_shutdown_s(acc);
+	gensio_acc_free(acc);
+    }
+    if (str)
+	gensio_os_funcs_zfree(t->o, str);
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct rinto_test t;
+    struct gensio_os_proc_data *proc_data;
+    int rv;
+
+    memset(&t, 0, sizeof(t));
+
+    rv = gensio_default_os_hnd(GENSIO_DEF_WAKE_SIG, &t.o);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    rv = gensio_os_proc_setup(t.o, &proc_data);
+    if (rv) {
+	fprintf(stderr, "Error setting up process data: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    t.waiter = gensio_os_funcs_alloc_waiter(t.o);
+    if (!t.waiter) {
+	fprintf(stderr, "Could not allocate waiter\n");
+	return 1;
+    }
+
+    rv = run_test(&t, "tcp,localhost,0", "tcp,localhost,");
+    if (!rv)
+	rv = run_test(&t, "telnet,tcp,localhost,0", "telnet,tcp,localhost,");
+
+    gensio_os_funcs_free_waiter(t.o, t.waiter);
+    gensio_os_proc_cleanup(proc_data);
+    gensio_os_funcs_free(t.o);
+
+    return rv ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def round_trips(io):
+    return int(io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_ROUND_TRIPS, None))
+
+def fastauth_test(name, conopts, accopts, expected):
+    print("Test certauth " + name)
+    ta = TestAccept(o,
+        "certauth(cert=%s/clientcert.pem,key=%s/clientkey.pem,"
+        "username=testuser,service=myservice%s),ssl(CA=%s/CA.pem),"
+        "tcp,localhost," % (keydir, keydir, conopts, keydir),
+        "certauth(CA=%s/clientcert.pem%s),"
+        "ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,0" %
+        (keydir, accopts, keydir, keydir),
+        do_test, do_close = False)
+    c = round_trips(ta.io1)
+    s = round_trips(ta.io2)
+    if c != expected or s != expected:
+        raise Exception("%s: expected %d round trips, got %d client, "
+                        "%d server" % (name, expected, c, s))
+    ta.close()
+
+# Both ends know fast-auth, it takes one message each way.
+fastauth_test("fast-auth", ",fast-auth", ",fast-auth", 1)
+
+# A server without fast-auth ignores it, like an older server that
+# doesn't know the option, and the full exchange is done.
+fastauth_test("fast-auth client, old server", ",fast-auth", "", 3)
+fastauth_test("old client, fast-auth server", "", ",fast-auth", 3)
+fastauth_test("no fast-auth", "", "", 3)
+
+del o
+test_shutdown()
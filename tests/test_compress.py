@@ -0,0 +1,41 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def do_compressible_test(io1, io2, timeout = 10000):
+    # This compresses, random data is sent raw.
+    data = ("The quick brown fox jumps over the lazy dog %d. " *
+            20000) % tuple(range(20000))
+    print("  testing compressible io1 to io2")
+    test_dataxfer(io1, io2, data, timeout = timeout)
+    print("  testing compressible io2 to io1")
+    test_dataxfer(io2, io1, data, timeout = timeout)
+    print("  Success!")
+
+print("Test compress small")
+TestAccept(o, "compress,tcp,localhost,", "compress,tcp,0", do_small_test)
+
+print("Test compress large")
+TestAccept(o, "compress,tcp,localhost,", "compress,tcp,0", do_large_test)
+
+print("Test compress compressible data")
+TestAccept(o, "compress,tcp,localhost,", "compress,tcp,0",
+           do_compressible_test)
+
+print("Test compress small blocks with a flush time")
+TestAccept(o, "compress(blocksize=1000,flush-time=5),tcp,localhost,",
+           "compress(blocksize=1000,flush-time=5),tcp,0",
+           do_compressible_test)
+
+print("Test compress close during transfer")
+TestAccept(o, "compress,tcp,localhost,", "compress,tcp,0",
+           do_close_xfer_test)
+
+del o
+test_shutdown()
@@ -0,0 +1,36 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# DTLS is packet oriented, each write must fit in one datagram, so
+# the writes are kept under the default mtu.
+conopts = "dtls(CA=%s/CA.pem)" % keydir
+accopts = "dtls(key=%s/key.pem,cert=%s/cert.pem)" % (keydir, keydir)
+
+print("Test dtls udp")
+TestAccept(o, conopts + ",udp,localhost,", accopts + ",udp,localhost,0",
+           do_test, chunksize = 1000)
+
+print("Test dtls relpkt small")
+TestAccept(o, conopts + ",relpkt,udp,localhost,",
+           accopts + ",relpkt,udp,localhost,0", do_small_test,
+           chunksize = 1000)
+
+print("Test dtls relpkt large")
+TestAccept(o, conopts + ",relpkt,udp,localhost,",
+           accopts + ",relpkt,udp,localhost,0", do_large_test,
+           chunksize = 1000)
+
+print("Test dtls relpkt close during transfer")
+TestAccept(o, conopts + ",relpkt,udp,localhost,",
+           accopts + ",relpkt,udp,localhost,0", do_close_xfer_test,
+           chunksize = 1000)
+
+del o
+test_shutdown()
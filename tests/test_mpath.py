@@ -0,0 +1,27 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+print("Test mpath small")
+TestAccept(o, "mpath(paths=3),tcp,localhost,", "mpath,tcp,0", do_small_test)
+
+print("Test mpath large with small frames")
+TestAccept(o, "mpath(paths=4,frame-size=1000),tcp,localhost,", "mpath,tcp,0",
+           do_large_test)
+
+print("Test mux over mpath")
+TestAccept(o, "mux,mpath(paths=4),tcp,localhost,", "mux,mpath,tcp,0",
+           do_large_test)
+
+print("Test mpath close during transfer")
+TestAccept(o, "mpath(paths=3),tcp,localhost,", "mpath,tcp,0",
+           do_close_xfer_test)
+
+del o
+test_shutdown()
@@ -0,0 +1,100 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# Data written to a mux channel before the new channel response comes
+# back is sent as early data to a version 4 peer.  An older peer does
+# not take early data, the write must fail with "not ready" and work
+# once the open finishes.
+
+class EarlyHandler:
+    def __init__(self, o):
+        self.o = o
+        self.waiter = gensio.waiter(o)
+        self.data = b""
+        self.opened = False
+        self.chans = []
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            io.read_cb_enable(False)
+            return 0
+        self.data += buf
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        return
+
+    def new_connection(self, acc, io):
+        self.chans.append(io)
+        io.set_cbs(self)
+        io.read_cb_enable(True)
+        self.waiter.wake()
+
+    def new_channel(self, io1, io2, auxdata):
+        self.new_connection(None, io2)
+        return 0
+
+    def open_done(self, io, err):
+        if err:
+            raise HandlerException("Error opening channel: %s" % err)
+        self.opened = True
+        self.waiter.wake()
+
+    def wait_for(self, check, name):
+        while not check():
+            if self.waiter.wait_timeout(1, 2000) == 0:
+                raise HandlerException("Timeout waiting for " + name)
+
+def early_test(name, conopts, accopts, expect_early):
+    print("Test mux early data " + name)
+    gensios_enabled.check_iostr_gensios("mux,tcp")
+    hacc = EarlyHandler(o)
+    acc = gensio.gensio_accepter(o, "mux%s,tcp,0" % accopts, hacc)
+    acc.startup()
+    port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                       gensio.GENSIO_CONTROL_GET,
+                       gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+    hcl = EarlyHandler(o)
+    muxcl = gensio.gensio(o, "mux%s,tcp,localhost,%s" % (conopts, port),
+                          hcl)
+    muxcl.open_s()
+    hacc.wait_for(lambda: len(hacc.chans) == 1, "first channel")
+
+    chan = muxcl.alloc_channel(None, hcl)
+    chan.open(hcl)
+    early = True
+    try:
+        count = chan.write(b"early", None)
+        if count != 5:
+            raise HandlerException("Early write only wrote %d" % count)
+    except Exception as err:
+        if "not ready" not in str(err):
+            raise
+        early = False
+    if early != expect_early:
+        raise HandlerException("Expected early data %s, got %s" %
+                               (expect_early, early))
+    hcl.wait_for(lambda: hcl.opened, "channel open")
+    if not early:
+        chan.write(b"early", None)
+    hacc.wait_for(lambda: hacc.data == b"early", "early data")
+
+    chan.close_s()
+    muxcl.close_s()
+    for io in hacc.chans:
+        io.close_s()
+    acc.shutdown_s()
+
+early_test("current", "", "", True)
+early_test("old client", "(max_version=3)", "", False)
+early_test("old server", "", "(max_version=3)", False)
+del o
+test_shutdown()
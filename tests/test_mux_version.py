@@ -0,0 +1,24 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# Delayed acks are only used if both ends have protocol version 2 or
+# later.  Make sure a current end still works against a version 1
+# peer in both directions.
+
+def version_test(name, conopts, accopts):
+    print("Test mux version " + name)
+    TestAccept(o, "mux%s,tcp,localhost," % conopts,
+               "mux%s,tcp,0" % accopts, do_large_test, chunksize = 64)
+
+version_test("current", "", "")
+version_test("old client", "(max_version=1)", "")
+version_test("old server", "", "(max_version=1)")
+del o
+test_shutdown()
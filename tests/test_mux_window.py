@@ -0,0 +1,25 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# Receive window tuning needs protocol version 3 on both ends.  Run
+# with tuning on and make sure it falls back to fixed windows against
+# a version 2 peer.
+
+def window_test(name, conopts, accopts):
+    print("Test mux window " + name)
+    TestAccept(o, "mux(window_budget=4000000%s),tcp,localhost," % conopts,
+               "mux(window_budget=4000000%s),tcp,0" % accopts,
+               do_large_test, chunksize = 64)
+
+window_test("tuned", "", "")
+window_test("old client", ",max_version=2", "")
+window_test("old server", "", ",max_version=2")
+del o
+test_shutdown()
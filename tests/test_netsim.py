@@ -0,0 +1,30 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+print("Test netsim small")
+TestAccept(o, "netsim(latency=5),pipe,nstest", "netsim(latency=5),pipe,nstest",
+           do_small_test, get_port = False)
+
+print("Test netsim large with bandwidth and jitter")
+TestAccept(o, "netsim(bandwidth=10000000,latency=2,jitter=2),pipe,nstest",
+           "netsim(bandwidth=10000000,latency=2,jitter=2),pipe,nstest",
+           do_large_test, get_port = False)
+
+print("Test netsim close during transfer")
+TestAccept(o, "netsim(latency=5),pipe,nstest", "netsim(latency=5),pipe,nstest",
+           do_close_xfer_test, get_port = False)
+
+print("Test relpkt over a lossy netsim link")
+TestAccept(o, "relpkt,netsim(loss=2,reorder,jitter=5),pipe,nstest",
+           "relpkt,netsim(loss=2,reorder,jitter=5),pipe,nstest",
+           do_medium_test, get_port = False)
+
+del o
+test_shutdown()
@@ -0,0 +1,41 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+print("Test pipe small")
+TestAccept(o, "pipe,pipetest", "pipe,pipetest", do_small_test,
+           get_port = False)
+
+print("Test pipe large")
+TestAccept(o, "pipe,pipetest", "pipe,pipetest", do_large_test,
+           get_port = False)
+
+print("Test pipe large with small buffers")
+TestAccept(o, "pipe(readbuf=100),pipetest", "pipe(readbuf=100),pipetest",
+           do_large_test, get_port = False)
+
+print("Test pipe close during transfer")
+TestAccept(o, "pipe,pipetest", "pipe,pipetest", do_close_xfer_test,
+           get_port = False)
+
+print("Test pipe with no accepter")
+io = alloc_io(o, "pipe,nosuchpipe", do_open = False)
+try:
+    io.open_s()
+    raise Exception("pipe open with no accepter succeeded")
+except Exception as e:
+    if str(e).find("refused") == -1:
+        raise
+del io.handler.io
+del io.handler
+del io
+print("  Success!")
+
+del o
+test_shutdown()
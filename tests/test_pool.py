@@ -0,0 +1,48 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+print("Test pool small")
+TestAccept(o, "pool(min=0),tcp,localhost,", "tcp,0", do_small_test)
+
+print("Test pool large")
+ta = TestAccept(o, "pool(min=0),tcp,localhost,", "tcp,0", do_large_test,
+                do_close = False)
+port = ta.acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                      gensio.GENSIO_CONTROL_GET,
+                      gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+
+print("Test pool reuse")
+io_close((ta.io1,))
+io3 = alloc_io(o, "pool(min=0),tcp,localhost," + port)
+if ta.wait_timeout(200) != 0:
+    raise Exception("pool opened a new connection instead of reusing one")
+do_small_test(io3, ta.io2)
+
+print("Test pool close with unread data")
+# The child goes back to the pool with data pending, the pool must
+# see that and close it instead of keeping it.
+test_dataxfer(ta.io2, io3, os.urandom(4096))
+ta.io2.handler.set_write_data(os.urandom(4096))
+if ta.io2.handler.wait_timeout(1000) == 0:
+    raise Exception("Timed out waiting for write completion")
+io_close((io3,))
+ta.io2.handler.ignore_input = True
+ta.io2.handler.waiting_rem_close = True
+ta.io2.read_cb_enable(True)
+if ta.io2.handler.wait_timeout(2000) == 0:
+    raise Exception("pool did not close a child with unread data")
+print("  Success!")
+
+ta.acc.shutdown_s()
+io_close((ta.io2,))
+del io3
+del ta
+del o
+test_shutdown()
@@ -0,0 +1,46 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def relpkt_info(io, name):
+    info = io.control(0, gensio.GENSIO_CONTROL_GET,
+                      gensio.GENSIO_CONTROL_RELPKT_INFO, None)
+    for i in info.split():
+        if i.startswith(name + "="):
+            return int(i[len(name) + 1:])
+    raise Exception("No %s in relpkt info: %s" % (name, info))
+
+# With fec on both ends, some lost packets should be rebuilt from
+# parity.  Against a version 1 end fec is off and everything is
+# recovered by resending.  Resends wait for the retransmit timer, so
+# give the transfers plenty of time.
+
+def fec_test(name, conopts, accopts, expect_fec):
+    print("Test relpkt fec " + name)
+    ta = TestAccept(o, "relpkt(fec=4%s),netsim(loss=5),pipe,rpfec" % conopts,
+                    "relpkt(fec=4%s),netsim(loss=5),pipe,rpfec" % accopts,
+                    do_medium_test, get_port = False, do_close = False,
+                    timeout = 60000)
+    block = relpkt_info(ta.io1, "fec_block")
+    recovered = (relpkt_info(ta.io1, "fec_recovered") +
+                 relpkt_info(ta.io2, "fec_recovered"))
+    if expect_fec:
+        if block != 4 or recovered == 0:
+            raise Exception("fec not used: block %d recovered %d" %
+                            (block, recovered))
+    elif block != 0 or recovered != 0:
+        raise Exception("fec used with an old peer: block %d recovered %d" %
+                        (block, recovered))
+    ta.close()
+
+fec_test("current", "", "", True)
+fec_test("old client", ",max_version=1", "", False)
+fec_test("old server", "", ",max_version=1", False)
+del o
+test_shutdown()
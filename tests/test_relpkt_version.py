@@ -0,0 +1,27 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# Version 1 of relpkt has 16-bit sequence numbers and selective acks,
+# version 0 has 8-bit sequence numbers and range resends.  Run over a
+# lossy link so recovery is exercised, with both ends current and
+# with either end limited to version 0.  Resends wait for the
+# retransmit timer, so give the transfers plenty of time.
+
+def version_test(name, conopts, accopts):
+    print("Test relpkt version " + name)
+    TestAccept(o, "relpkt%s,netsim(loss=2),pipe,rpver" % conopts,
+               "relpkt%s,netsim(loss=2),pipe,rpver" % accopts,
+               do_medium_test, get_port = False, timeout = 60000)
+
+version_test("current", "", "")
+version_test("old client", "(max_version=0)", "")
+version_test("old server", "", "(max_version=0)")
+del o
+test_shutdown()
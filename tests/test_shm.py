@@ -0,0 +1,42 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+if not sys.platform.startswith("linux"):
+    print("shm is only available on Linux, test skipped")
+    sys.exit(77)
+
+path = "/tmp/gensio_test_shm.%d" % os.getpid()
+
+print("Test shm small")
+TestAccept(o, "shm," + path, "shm(delsock)," + path, do_small_test,
+           get_port = False)
+
+print("Test shm large")
+TestAccept(o, "shm," + path, "shm(delsock)," + path, do_large_test,
+           get_port = False)
+
+print("Test shm large with small rings")
+TestAccept(o, "shm," + path, "shm(delsock,size=4096)," + path,
+           do_large_test, get_port = False)
+
+print("Test shm packet large")
+TestAccept(o, "shm(packet)," + path, "shm(packet,delsock,size=4096)," + path,
+           do_large_test, get_port = False, chunksize = 1000)
+
+print("Test shm close during transfer")
+TestAccept(o, "shm," + path, "shm(delsock)," + path, do_close_xfer_test,
+           get_port = False)
+
+try:
+    os.remove(path)
+except:
+    pass
+del o
+test_shutdown()
@@ -0,0 +1,46 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+import socket
+
+def tcp_pair():
+    l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    l.bind(("127.0.0.1", 0))
+    l.listen(1)
+    c = socket.create_connection(l.getsockname())
+    s, addr = l.accept()
+    l.close()
+    return (c, s)
+
+def sockfd_pair(socks, tester):
+    # The gensios own the descriptors from here on.
+    io1 = alloc_io(o, "sockfd,%d" % socks[0].detach())
+    io2 = alloc_io(o, "sockfd,%d" % socks[1].detach())
+    tester(io1, io2)
+    io_close((io1, io2))
+
+print("Test sockfd unix large")
+sockfd_pair(socket.socketpair(), do_large_test)
+
+print("Test sockfd tcp large")
+sockfd_pair(tcp_pair(), do_large_test)
+
+print("Test sockfd close during transfer")
+sockfd_pair(socket.socketpair(), do_close_xfer_test)
+
+print("Test sockfd accepter")
+l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+l.bind(("127.0.0.1", 0))
+l.listen(5)
+port = l.getsockname()[1]
+TestAccept(o, "tcp,ipv4,localhost,%d" % port, "sockfd,%d" % l.detach(),
+           do_small_test, get_port = False)
+
+del o
+test_shutdown()
@@ -0,0 +1,86 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+# TLS 1.3 early data only goes out on a resumed session, so connect
+# twice to the same accepter.  The second connection should carry the
+# data as early data if the server allows it.  If the server doesn't,
+# the data must still arrive, just after the handshake.
+
+class EarlyServer:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.io = None
+        self.data = b""
+
+    def new_connection(self, acc, io):
+        self.io = io
+        io.set_cbs(self)
+        io.read_cb_enable(True)
+        self.waiter.wake()
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            io.read_cb_enable(False)
+            return 0
+        self.data += buf
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        return
+
+def early_data(io):
+    return int(io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_EARLY_DATA, None))
+
+def early_test(name, accopts, expected):
+    print("Test ssl early data " + name)
+    gensios_enabled.check_iostr_gensios("ssl,tcp")
+    h = EarlyServer(o)
+    acc = gensio.gensio_accepter(o,
+        "ssl(key=%s/key.pem,cert=%s/cert.pem%s),tcp,localhost,0" %
+        (keydir, keydir, accopts), h)
+    acc.startup()
+    port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                       gensio.GENSIO_CONTROL_GET,
+                       gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+    for i in range(0, 2):
+        h.io = None
+        h.data = b""
+        io = gensio.gensio(o, "ssl(CA=%s/CA.pem,early-data=1000),"
+                           "tcp,localhost,%s" % (keydir, port), None)
+        io.control(0, gensio.GENSIO_CONTROL_SET,
+                   gensio.GENSIO_CONTROL_EARLY_DATA, "hello")
+        io.set_sync()
+        io.open_s()
+        while h.data != b"hello":
+            if h.waiter.wait_timeout(1, 2000) == 0:
+                raise Exception("Timeout waiting for early data, got %s" %
+                                str(h.data))
+        # Get the reply so the client has processed the session ticket.
+        h.io.write("ok", None)
+        (buf, time) = io.read_s(2, 2000)
+        if buf != b"ok":
+            raise Exception("Bad reply: %s" % str(buf))
+        c = early_data(io)
+        s = early_data(h.io)
+        if c != expected[i] or s != expected[i]:
+            raise Exception("Connection %d: expected early data %d, got "
+                            "%d client, %d server" % (i, expected[i], c, s))
+        io.close_s()
+        h.io.close_s()
+    acc.shutdown_s()
+
+# The first connection is a full handshake, only a resumed one can
+# send early data.
+early_test("on both ends", ",early-data=1000", (0, 1))
+early_test("server without early data", "", (0, 0))
+del o
+test_shutdown()
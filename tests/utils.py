@@ -651,11 +651,11 @@ def io_close(ios, timeout = 1000):
     If it does not succeed in timeout milliseconds, raise and exception.
     """
     for io in ios:
-        if not io:
+        if not io or not hasattr(io, "handler"):
             continue
         io.handler.close()
     for io in ios:
-        if not io:
+        if not io or not hasattr(io, "handler"):
             continue
         if (io.handler.wait_timeout(timeout) == 0):
             raise Exception("%s: %s: Timed out waiting for close" %
@@ -748,6 +748,7 @@ class TestAccept:
         self.acc = None
         self.enable_oob = enable_oob
         self.close_timeout = close_timeout;
+        self.chunksize = chunksize
 
         try:
             self.except_on_log = except_on_log
@@ -853,7 +854,9 @@ class TestAccept:
         if self.enable_oob:
             io.control(0, gensio.GENSIO_CONTROL_SET,
                        gensio.GENSIO_CONTROL_ENABLE_OOB, "1")
-        HandleData(self.o, None, io = io, name = self.name)
+        # Packet gensios need both ends to keep their writes small.
+        HandleData(self.o, None, io = io, name = self.name,
+                   chunksize = self.chunksize)
         print("New connection " + self.name);
         self.io2 = io
         self.waiter.wake()
@@ -905,6 +908,27 @@ def do_large_test(io1, io2, timeout = 30000):
     test_dataxfer_simul(io1, io2, rb, timeout = timeout)
     print("  Success!")
 
+def do_close_xfer_test(io1, io2, timeout = 10000):
+    """Close io1 in the middle of sending a lot of data to io2
+
+    io1 must finish its close and io2 must see the remote end close.
+    io1 is already closed when this returns, the closes done after the
+    test skip it.
+    """
+    rb = os.urandom(1048570)
+    io2.handler.ignore_input = True
+    io2.handler.waiting_rem_close = True
+    io2.read_cb_enable(True)
+    io1.handler.set_write_data(rb)
+    # Let the data get going, it's fine if it all went already.
+    io1.handler.wait_timeout(10)
+    print("  closing io1 during a transfer")
+    io_close((io1,), timeout = timeout)
+    if (io2.handler.wait_timeout(timeout) == 0):
+        raise Exception("%s: %s: Timed out waiting for remote close" %
+                        ("do_close_xfer_test", io2.handler.name))
+    print("  Success!")
+
 def do_oob_test(io1, io2):
     rb = os.urandom(512)
     print("  testing io1 to io2")
@@ -0,0 +1,257 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Test tcp zerocopy=.  Push 32 megabytes through a connection with
+ * write sizes that go above and below the zerocopy size, smashing
+ * the data in the user's buffer as soon as it is reported written.
+ * The other end checks that every byte comes through unchanged.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_utils.h>
+
+#define XFER_SIZE 32000000
+
+static const gensiods write_sizes[] = {
+    100000, 3, 70001, 49999, 50000, 250000, 1, 131072, 65535, 777
+};
+#define NUM_WRITE_SIZES (sizeof(write_sizes) / sizeof(write_sizes[0]))
+
+struct zc_test {
+    struct gensio_os_funcs *o;
+    struct gensio_waiter *waiter;
+    struct gensio *srv;
+    unsigned char *data;
+    gensiods wpos;
+    gensiods rpos;
+    unsigned int nr_writes;
+    int err;
+    bool done;
+};
+
+static unsigned char
+zc_data(gensiods pos)
+{
+    return (pos * 7 + pos / 251) & 0xff;
+}
+
+static int
+srv_event(struct gensio *io, void *user_data, int event, int err,
+	  unsigned char *buf, gensiods *buflen,
+	  const char *const *auxdata)
+{
+    struct zc_test *t = user_data;
+    gensiods i;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    if (err) {
+	fprintf(stderr, "Server read error: %s\n", gensio_err_to_str(err));
+	t->err = err;
+    } else {
+	for (i = 0; i < *buflen && !t->err; i++, t->rpos++) {
+	    if (buf[i] != zc_data(t->rpos)) {
+		fprintf(stderr, "Data mismatch at byte %lu\n",
+			(unsigned long) t->rpos);
+		t->err = GE_INCONSISTENT;
+	    }
+	}
+    }
+    if (t->err || t->rpos == XFER_SIZE) {
+	gensio_set_read_callback_enable(io, false);
+	t->done = true;
+	gensio_os_funcs_wake(t->o, t->waiter);
+    }
+    return 0;
+}
+
+static int
+acc_event(struct gensio_accepter *acc, void *user_data, int event,
+	  void *data)
+{
+    struct zc_test *t = user_data;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    t->srv = data;
+    gensio_set_callback(t->srv, srv_event, t);
+    gensio_set_read_callback_enable(t->srv, true);
+    return 0;
+}
+
+static int
+cl_event(struct gensio *io, void *user_data, int event, int err,
+	 unsigned char *buf, gensiods *buflen,
+	 const char *const *auxdata)
+{
+    struct zc_test *t = user_data;
+    gensiods len, count = 0;
+
+    if (event != GENSIO_EVENT_WRITE_READY)
+	return GE_NOTSUP;
+
+    len = write_sizes[t->nr_writes++ % NUM_WRITE_SIZES];
+    if (len > XFER_SIZE - t->wpos)
+	len = XFER_SIZE - t->wpos;
+    err = gensio_write(io, &count, t->data + t->wpos, len, NULL);
+    if (err) {
+	fprintf(stderr, "Client write error: %s\n", gensio_err_to_str(err));
+	t->err = err;
+	t->done = true;
+	gensio_os_funcs_wake(t->o, t->waiter);
+	count = 0;
+    }
+    /* The data is the user's again, make sure nothing still uses it. */
+    memset(t->data + t->wpos, 0xa5, count);
+    t->wpos += count;
+    if (err || t->wpos == XFER_SIZE)
+	gensio_set_write_callback_enable(io, false);
+    return 0;
+}
+
+static int
+run_test(struct zc_test *t, const char *constr)
+{
+    gensio_time timeout = { 30, 0 };
+    struct gensio_accepter *acc = NULL;
+    struct gensio *io = NULL;
+    char port[20], *str = NULL;
+    gensiods i, size;
+    int rv;
+
+    printf("Testing %s\n", constr);
+    t->srv = NULL;
+    t->wpos = 0;
+    t->rpos = 0;
+    t->nr_writes = 0;
+    t->err = 0;
+    t->done = false;
+    for (i = 0; i < XFER_SIZE; i++)
+	t->data[i] = zc_data(i);
+
+    rv = str_to_gensio_accepter("tcp,localhost,0", t->o, acc_event, t, &acc);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate accepter: %s\n",
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    rv = gensio_acc_startup(acc);
+    if (rv) {
+	fprintf(stderr, "Unable to start accepter: %s\n",
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    size = sizeof(port);
+    strcpy(port, "0");
+    rv = gensio_acc_control(acc, GENSIO_CONTROL_DEPTH_FIRST, true,
+			    GENSIO_ACC_CONTROL_LPORT, port, &size);
+    if (rv) {
+	fprintf(stderr, "Unable to get port: %s\n", gensio_err_to_str(rv));
+	goto out;
+    }
+
+    str = gensio_alloc_sprintf(t->o, "%s%s", constr, port);
+    if (!str) {
+	rv = GE_NOMEM;
+	goto out;
+    }
+    rv = str_to_gensio(str, t->o, cl_event, t, &io);
+    if (rv) {
+	fprintf(stderr, "Unable to allocate %s: %s\n", str,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    rv = gensio_open_s(io);
+    if (rv) {
+	fprintf(stderr, "Unable to open %s: %s\n", str,
+		gensio_err_to_str(rv));
+	goto out;
+    }
+    gensio_set_write_callback_enable(io, true);
+
+    while (!t->done) {
+	rv = gensio_os_funcs_wait_intr(t->o, t->waiter, 1, &timeout);
+	if (rv == GE_INTERRUPTED)
+	    continue;
+	if (rv) {
+	    fprintf(stderr, "Transfer stalled at %lu written, %lu read: %s\n",
+		    (unsigned long) t->wpos, (unsigned long) t->rpos,
+		    gensio_err_to_str(rv));
+	    goto out;
+	}
+    }
+    rv = t->err;
+
+ out:
+    if (io) {
+	gensio_close_s(io);
+	gensio_free(io);
+    }
+    if (t->srv) {
+	gensio_close_s(t->srv);
+	gensio_free(t->srv);
+    }
+    if (acc) {
+	gensio_acc_shutdown_s(acc);
+	gensio_acc_free(acc);
+    }
+    if (str)
+	gensio_os_funcs_zfree(t->o, str);
+    return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct zc_test t;
+    struct gensio_os_proc_data *proc_data;
+    int rv;
+
+    memset(&t, 0, sizeof(t));
+
+    rv = gensio_default_os_hnd(GENSIO_DEF_WAKE_SIG, &t.o);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    rv = gensio_os_proc_setup(t.o, &proc_data);
+    if (rv) {
+	fprintf(stderr, "Error setting up process data: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    t.waiter = gensio_os_funcs_alloc_waiter(t.o);
+    if (!t.waiter) {
+	fprintf(stderr, "Could not allocate waiter\n");
+	return 1;
+    }
+    t.data = malloc(XFER_SIZE);
+    if (!t.data) {
+	fprintf(stderr, "Could not allocate data\n");
+	return 1;
+    }
+
+    rv = run_test(&t, "tcp(zerocopy=50000),localhost,");
+    if (!rv)
+	rv = run_test(&t, "tcp(zerocopy=1),localhost,");
+
+    free(t.data);
+    gensio_os_funcs_free_waiter(t.o, t.waiter);
+    gensio_os_proc_cleanup(proc_data);
+    gensio_os_funcs_free(t.o);
+
+    return rv ? 1 : 0;
+}
@@ -52,6 +52,7 @@
 #include "ioinfo.h"
 #include "ser_ioinfo.h"
 #include "utils.h"
+#include "loadgen.h"
 
 unsigned int debug;
 struct gensio_os_proc_data *proc_data;
@@ -363,6 +364,8 @@ struct gtconn_info {
     struct gensio *close_io;
     const char *ios;
     bool close_done;
+    bool ready;
+    struct gensio_pump *pump;
 };
 
 static void
@@ -481,6 +484,14 @@ i_gshutdown(struct ioinfo *ioinfo, enum ioinfo_shutdown_reason reason)
     struct gtinfo *g = gtconn->g;
     int err;
 
+    if (gtconn->pump) {
+	gensio_pump_free(gtconn->pump);
+	gtconn->pump = NULL;
+    }
+    if (ogtconn->pump) {
+	gensio_pump_free(ogtconn->pump);
+	ogtconn->pump = NULL;
+    }
     if (gtconn->io) {
 	ioinfo_set_not_ready(ioinfo);
 	gtconn->close_io = gtconn->io;
@@ -662,6 +673,79 @@ reg_winch(struct ioinfo *ioinfo)
 						winch_ready, ioinfo);
 }
 
+static void
+pump_done(struct gensio_pump *pump, int err, void *cb_data)
+{
+    struct ioinfo *ioinfo = cb_data;
+    struct gtconn_info *gtconn = ioinfo_userdata(ioinfo);
+    struct gtinfo *g = gtconn->g;
+    struct gensio_pump *p;
+
+    gensio_os_funcs_lock(g->o, g->lock);
+    p = gtconn->pump;
+    gtconn->pump = NULL;
+    gensio_os_funcs_unlock(g->o, g->lock);
+    if (p)
+	gensio_pump_free(p);
+
+    if (err && err != GE_REMCLOSE) {
+	ioinfo_err(ioinfo, "transfer error: %s", gensio_err_to_str(err));
+	gshutdown(ioinfo, IOINFO_SHUTDOWN_ERR);
+    } else {
+	gshutdown(ioinfo, IOINFO_SHUTDOWN_REMCLOSE);
+    }
+}
+
+/*
+ * Called when an end finishes opening.  If the user end is just a
+ * file being read (nothing is written to it) and the escape character
+ * is off so nothing needs to look at the data, have the library move
+ * the data.  That does it in the kernel for plain sockets.
+ */
+static void
+i_io_ready(struct ioinfo *ioinfo)
+{
+    struct ioinfo *oioinfo = ioinfo_otherioinfo(ioinfo);
+    struct gtconn_info *gtconn = ioinfo_userdata(ioinfo);
+    struct gtconn_info *ogtconn = ioinfo_userdata(oioinfo);
+    struct gtinfo *g = gtconn->g;
+    char data[20] = "1";
+    gensiods len = sizeof(data);
+    int err;
+
+    gtconn->ready = true;
+    if (!ogtconn->ready || g->escape_char >= 0)
+	return;
+    if (gtconn->io != gtconn->user_io) {
+	ioinfo = oioinfo;
+	ogtconn = gtconn;
+	gtconn = ioinfo_userdata(ioinfo);
+    }
+    if (!gtconn->io || !ogtconn->io || gtconn->pump)
+	return;
+    if (strcmp(gensio_get_type(gtconn->io, 0), "file") != 0)
+	return;
+    err = gensio_control(gtconn->io, 0, GENSIO_CONTROL_GET,
+			 GENSIO_CONTROL_FD, data, &len);
+    if (err != GE_NOTFOUND)
+	return;
+
+    /* On failure just keep going with the normal handling. */
+    gensio_pump_alloc(g->o, gtconn->io, ogtconn->io, pump_done, ioinfo,
+		      &gtconn->pump);
+}
+
+static void
+io_ready(struct ioinfo *ioinfo)
+{
+    struct gtconn_info *gtconn = ioinfo_userdata(ioinfo);
+    struct gtinfo *g = gtconn->g;
+
+    gensio_os_funcs_lock(g->o, g->lock);
+    i_io_ready(ioinfo);
+    gensio_os_funcs_unlock(g->o, g->lock);
+}
+
 static void
 io_open(struct gensio *io, int err, void *open_data)
 {
@@ -678,6 +762,7 @@ io_open(struct gensio *io, int err, void *open_data)
     } else {
 	ioinfo_set_ready(ioinfo, io);
 	reg_winch(ioinfo);
+	io_ready(ioinfo);
     }
 }
 
@@ -711,6 +796,7 @@ io_open_paddr(struct gensio *io, int err, void *open_data)
 	} else {
 	    ioinfo_set_ready(ioinfo, io);
 	    reg_winch(ioinfo);
+	    io_ready(ioinfo);
 	}
     }
 }
@@ -779,6 +865,7 @@ add_io(struct gtinfo *g, struct gensio *io, bool open_finished)
     if (open_finished) {
 	ioinfo_set_ready(ioinfo2, gtconn2->io);
 	reg_winch(ioinfo2);
+	i_io_ready(ioinfo2);
 	if (g->print_laddr)
 	    print_io_addr(io, true);
 	if (g->print_raddr)
@@ -944,6 +1031,20 @@ help(int err)
 	   " the local addresses.\n");
     printf("  -r, --printremaddr - When the connection opens, print out all"
 	   " the remote addresses.\n");
+    printf("  --loadgen <n> - Instead of connecting io1 and io2, make <n>\n"
+	   "    connections with io2 and measure them, see the man page.\n");
+    printf("  --lg-max-open <n> - At most <n> loadgen connections open at"
+	   " once.\n");
+    printf("  --lg-rate <n> - Start at most <n> loadgen connections a"
+	   " second.\n");
+    printf("  --lg-msg-size <n> - Size of loadgen messages, default 64.\n");
+    printf("  --lg-msg-count <n> - Messages per loadgen connection,"
+	   " default 100.\n");
+    printf("  --lg-outstanding <n> - Loadgen messages in flight per"
+	   " connection,\n    default 1.\n");
+    printf("  --lg-think <usecs> - Loadgen wait after a reply before the"
+	   " next send.\n");
+    printf("  --lg-json - Print the loadgen results as JSON.\n");
     printf("  -v, --verbose - Print all gensio logs\n");
     printf("  --signature <sig> - Set the RFC2217 server signature to <sig>\n");
 #ifndef _WIN32
@@ -1023,6 +1124,8 @@ main(int argc, char *argv[])
     struct gensio *io = NULL;
     unsigned int num_extra_threads = 0, i;
     struct gensio_loop_info *loopinfo = NULL;
+    struct loadgen_params lg = { .msg_size = 64, .msg_count = 100,
+				 .outstanding = 1 };
 
     memset(&g, 0, sizeof(g));
     g.escape_char = -1;
@@ -1054,6 +1157,29 @@ main(int argc, char *argv[])
 	    g.print_laddr = true;
 	else if ((rv = cmparg(argc, argv, &arg, "-r", "--printremaddr", NULL)))
 	    g.print_raddr = true;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--loadgen",
+				   &lg.conns)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-max-open",
+				   &lg.max_open)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-rate",
+				   &lg.rate)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-msg-size",
+				   &lg.msg_size)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-msg-count",
+				   &lg.msg_count)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-outstanding",
+				   &lg.outstanding)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--lg-think",
+				   &lg.think)))
+	    ;
+	else if ((rv = cmparg(argc, argv, &arg, NULL, "--lg-json", NULL)))
+	    lg.json = true;
 	else if ((rv = cmparg(argc, argv, &arg, "-v", "--verbose", NULL)))
 	    gensio_set_log_mask(GENSIO_LOG_MASK_ALL);
 	else if ((rv = cmparg_int(argc, argv, &arg, "-e", "--escchar",
@@ -1194,6 +1320,18 @@ main(int argc, char *argv[])
 	rv = GE_NOMEM;
     }
 
+    if (lg.conns) {
+	if (io2_do_acc) {
+	    fprintf(stderr, "--loadgen cannot be used with an accepter\n");
+	    rv = GE_INVAL;
+	} else {
+	    rv = loadgen_run(g.o, proc_data, g.ios2, &lg);
+	    if (rv == GE_INVAL)
+		fprintf(stderr, "Invalid loadgen parameters\n");
+	}
+	goto out_err;
+    }
+
     if (io2_do_acc)
 	rv = str_to_gensio_accepter(g.ios2, g.o, io_acc_event, &g, &g.acc);
     else
@@ -91,7 +91,7 @@ help(const char *progname)
     P("Key handling tool for gtlssh.  Format is:\n");
     P("%s [<option> [<option> [...]]] command <command options>\n", progname);
     P("Options are:\n");
-    P("  --keysize <size> - Create an RSA key with the given number of bits.\n");
+    P("  --keysize <size> - Set the key size in bits for rsa or ec keys.\n");
     P("        default is %u for rsa, %u for ec\n", DEFAULT_RSA_KEYSIZE,
       DEFAULT_EC_KEYSIZE);
     P("        Do not specify for ed25519\n");
@@ -343,6 +343,90 @@ io_close(struct gensio *io, void *close_data)
     gensio_os_funcs_wake(ginfo->o, closewaiter);
 }
 
+/*
+ * Connection sharing.  If a gtlssh is already connected and listening
+ * on the control path, ask it to open a mux channel for our service
+ * instead of making a new connection.  See add_control_port() for the
+ * protocol.
+ */
+static char *control_path;
+static bool have_ports;
+
+static int
+connect_control(struct gensio_os_funcs *o, struct ioinfo *ioinfo,
+		char *service, gensiods service_len,
+		char **rios, struct gensio **rio)
+{
+    struct gensio *io;
+    unsigned char hdr[4];
+    gensio_time timeout = { 10, 0 };
+    gensiods count, pos = 0;
+    char *ios;
+    int err;
+
+    ios = alloc_sprintf("unix,%s", control_path);
+    if (!ios) {
+	fprintf(stderr, "out of memory allocating control string\n");
+	return GE_NOMEM;
+    }
+
+    err = str_to_gensio(ios, o, NULL, ioinfo, &io);
+    if (err) {
+	fprintf(stderr, "Could not allocate %s: %s\n", ios,
+		gensio_err_to_str(err));
+	free(ios);
+	return err;
+    }
+
+    err = gensio_open_s(io);
+    if (err) {
+	/* Nobody is listening, the caller will become the master. */
+	gensio_free(io);
+	free(ios);
+	return GE_NOTFOUND;
+    }
+
+    err = gensio_set_sync(io);
+    if (err)
+	goto out_err;
+
+    hdr[0] = (service_len >> 24) & 0xff;
+    hdr[1] = (service_len >> 16) & 0xff;
+    hdr[2] = (service_len >> 8) & 0xff;
+    hdr[3] = service_len & 0xff;
+    err = gensio_write_s(io, NULL, hdr, sizeof(hdr), NULL);
+    if (!err)
+	err = gensio_write_s(io, NULL, service, service_len, NULL);
+    while (!err && pos < sizeof(hdr)) {
+	err = gensio_read_s(io, &count, hdr + pos, sizeof(hdr) - pos,
+			    &timeout);
+	pos += count;
+    }
+    if (err)
+	goto out_err;
+
+    err = (hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+    if (err) {
+	fprintf(stderr, "Control master on %s could not open session: %s\n",
+		control_path, gensio_err_to_str(err));
+	goto out_close;
+    }
+
+    gensio_clear_sync(io);
+    *rios = ios;
+    *rio = io;
+    return 0;
+
+ out_err:
+    fprintf(stderr, "Error talking to control master on %s: %s\n",
+	    control_path, gensio_err_to_str(err));
+ out_close:
+    gensio_close_s(io);
+    gensio_free(io);
+    free(ios);
+    return err;
+}
+
 static const char *progname;
 static char *io1_default_tty = "stdio(self,raw)";
 /* See the note on muxstr below about the readbuf size. */
@@ -400,6 +484,11 @@ help(int err)
     printf("  -R <accept addr>:<connect addr> - Like -L, except the\n"
 	   "    <accept addr> is on the remote machine and <connect addr> is\n"
 	   "    done from the local machine\n");
+    printf("  --control <path> - Share connections over the unix socket\n"
+	   "    at <path>.  If another gtlssh is listening there, open a\n"
+	   "    new session over its connection.  Otherwise connect\n"
+	   "    normally and listen on <path> for other gtlssh sessions.\n"
+	   "    Defaults to the GTLSSH_CONTROL environment variable.\n");
     printf("  -4 - Do IPv4 only.\n");
     printf("  -6 - Do IPv6 only.\n");
     printf("  --version - Print the version number and exit.\n");
@@ -1750,6 +1839,7 @@ main(int argc, char *argv[])
     const char *transport = "sctp(readbuf=20000)";
     bool user_transport = false, mdns_transport = false;
     bool notcp = false, nosctp = true;
+    bool control_client = false, control_master = false;
     /*
      * The buffer sizes are carefully chosen here to mesh with ssl and
      * mux.  ssl can encrypt up to 16384 bytes at a time, and the
@@ -1900,8 +1990,13 @@ main(int argc, char *argv[])
 	    aux_data.flags |= GTLSSH_AUX_FLAG_PRIVILEGED;
 	} else if ((err = cmparg(argc, argv, &arg, "-L", NULL, &addr))) {
 	    err = handle_port(o, false, addr);
+	    have_ports = true;
 	} else if ((err = cmparg(argc, argv, &arg, "-R", NULL, &addr))) {
 	    err = handle_port(o, true, addr);
+	    have_ports = true;
+	} else if ((err = cmparg(argc, argv, &arg, NULL, "--control",
+				 &cstr))) {
+	    control_path = (char *) cstr;
 	} else if ((err = cmparg(argc, argv, &arg, "-4", NULL, NULL))) {
 	    iptype = "ipv4,";
 	} else if ((err = cmparg(argc, argv, &arg, "-6", NULL, NULL))) {
@@ -1923,6 +2018,12 @@ main(int argc, char *argv[])
 	    return 1;
     }
 
+    if (!control_path) {
+	control_path = getenv("GTLSSH_CONTROL");
+	if (control_path && !*control_path)
+	    control_path = NULL;
+    }
+
     if (nosctp && notcp && !user_transport) {
 	fprintf(stderr, "You cannot disable both TCP and SCTP\n");
 	return 1;
@@ -2086,6 +2187,33 @@ main(int argc, char *argv[])
     userdata1.user_io = userdata1.io;
     userdata2.user_io = userdata1.io;
 
+    if (control_path) {
+	err = connect_control(o, ioinfo2, service, service_len,
+			      &userdata2.ios, &userdata2.io);
+	if (!err) {
+	    if (have_ports)
+		fprintf(stderr, "Port forwards are not done on a shared"
+			" connection, ignoring -L and -R\n");
+	    control_client = true;
+	    userdata2.can_close = true;
+	    goto control_connected;
+	}
+	if (err != GE_NOTFOUND)
+	    return 1;
+
+	/* Only we can use the socket, it carries our credentials. */
+	s = alloc_sprintf("unix(delsock,perm=600),%s", control_path);
+	if (!s) {
+	    fprintf(stderr, "out of memory allocating control string\n");
+	    return 1;
+	}
+	err = add_control_port(locport, s, control_path);
+	free(s);
+	if (err)
+	    return 1;
+	control_master = true;
+    }
+
     err = lookup_certinfo(o, tlssh_dir, username, hostname, port,
 			  &CAspec, &certspec, &keyspec);
     if (err)
@@ -2209,6 +2337,7 @@ main(int argc, char *argv[])
     if (mdns_transport)
 	gensio_os_funcs_zfree(o, (char *) transport);
 
+ control_connected:
     userdata1.can_close = true;
     err = gensio_open_s(userdata1.io);
     if (err) {
@@ -2222,14 +2351,19 @@ main(int argc, char *argv[])
     ioinfo_set_ready(ioinfo1, userdata1.io);
     ioinfo_set_ready(ioinfo2, userdata2.io);
 
-    start_local_ports(locport, userdata2.io);
-    start_remote_ports(ioinfo2);
+    if (!control_client) {
+	start_local_ports(locport, userdata2.io);
+	start_remote_ports(ioinfo2);
+    }
 
     gensio_os_funcs_wait(o, userdata1.waiter, 1, NULL);
 
  closeit:
     free(service);
 
+    if (control_master)
+	remove(control_path);
+
     if (userdata2.can_close) {
 	err = gensio_close(userdata2.io, io_close, closewaiter);
 	if (err)
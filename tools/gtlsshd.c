@@ -31,6 +31,7 @@
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_list.h>
+#include <gensio/gensio_os_funcs.h>
 #include <gensio/argvutils.h>
 
 /* For htonl and friends. */
@@ -47,6 +48,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <pwd.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
@@ -74,6 +76,7 @@
 static const char *progname;
 static unsigned int debug;
 static bool oneshot;
+static unsigned int prefork;
 static bool permit_root = false;
 static bool pw_login = false;
 static bool do_2fa = false;
@@ -2761,6 +2764,267 @@ handle_new_runner(struct gensio_runner *r, void *cb_data)
     handle_new(net_io);
 }
 
+static void
+set_accepts(bool enabled)
+{
+    if (tcp_acc)
+	gensio_acc_set_accept_callback_enable(tcp_acc, enabled);
+    if (sctp_acc)
+	gensio_acc_set_accept_callback_enable(sctp_acc, enabled);
+    if (other_acc)
+	gensio_acc_set_accept_callback_enable(other_acc, enabled);
+}
+
+/*
+ * Pre-forked workers.  Forking and re-initializing the os funcs for
+ * each connection is expensive, so with --prefork a set of worker
+ * processes is forked ahead of time.  Each worker inherits the
+ * accepters.  The parent does not accept, instead it gives one
+ * worker at a time the "turn" by sending it a 'G' over a socketpair.
+ * That worker turns on its accepters, takes one connection, sends
+ * back a 'T', and then handles that connection as if it had been
+ * forked for it.  The parent passes the turn on and forks a new
+ * worker to replace the one that was used.  Switching to the user
+ * still only happens after authentication.
+ *
+ * If no workers can be created, the parent accepts and forks for
+ * each connection like normal.
+ */
+struct prefork_worker {
+    struct gensio_iod *iod;
+    bool has_turn;
+};
+
+static struct prefork_worker *prefork_workers;
+
+/* In a worker, the connection to the parent, or NULL. */
+static struct gensio_iod *prefork_parent_iod;
+
+static void
+prefork_close_iod(struct gensio_iod **iod)
+{
+    struct gensio_os_funcs *o = (*iod)->f;
+
+    o->clear_fd_handlers_norpt(*iod);
+    o->close(iod);
+    *iod = NULL;
+}
+
+/* Close the parent's worker connections, for a newly forked child. */
+static void
+prefork_close_workers(void)
+{
+    unsigned int i;
+
+    for (i = 0; prefork_workers && i < prefork; i++) {
+	if (prefork_workers[i].iod)
+	    prefork_close_iod(&prefork_workers[i].iod);
+    }
+}
+
+static int
+prefork_send(struct gensio_iod *iod, char c)
+{
+    ssize_t rv;
+
+    do {
+	rv = send(iod->f->iod_get_fd(iod), &c, 1, MSG_NOSIGNAL);
+    } while (rv == -1 && errno == EINTR);
+    return rv == 1 ? 0 : -1;
+}
+
+static void
+prefork_give_turn(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < prefork; i++) {
+	if (prefork_workers[i].iod && prefork_workers[i].has_turn)
+	    return;
+    }
+    for (i = 0; i < prefork; i++) {
+	if (prefork_workers[i].iod &&
+		prefork_send(prefork_workers[i].iod, 'G') == 0) {
+	    prefork_workers[i].has_turn = true;
+	    set_accepts(false);
+	    return;
+	}
+    }
+    /* No workers, do it the old way. */
+    set_accepts(true);
+}
+
+static void
+prefork_worker_read(struct gensio_iod *iod, void *cb_data)
+{
+    char c;
+    ssize_t rv;
+
+    rv = recv(iod->f->iod_get_fd(iod), &c, 1, MSG_DONTWAIT);
+    if (rv == -1 && (errno == EAGAIN || errno == EINTR))
+	return;
+    if (rv == 1 && c == 'G') {
+	set_accepts(true);
+	return;
+    }
+    /* The parent went away. */
+    exit(0);
+}
+
+static void
+prefork_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    iod->f->close(&iod);
+}
+
+static bool prefork_spawn(struct gdata *ginfo, struct prefork_worker *w);
+
+static void
+prefork_parent_read(struct gensio_iod *iod, void *cb_data)
+{
+    struct prefork_worker *w = cb_data;
+    struct gdata *ginfo = gensio_os_funcs_get_data(iod->f);
+    char c;
+    ssize_t rv;
+
+    rv = recv(iod->f->iod_get_fd(iod), &c, 1, MSG_DONTWAIT);
+    if (rv == -1 && (errno == EAGAIN || errno == EINTR))
+	return;
+
+    /* Either the worker took a connection or it died, it's done. */
+    iod->f->set_read_handler(iod, false);
+    iod->f->clear_fd_handlers(iod);
+    w->iod = NULL;
+    w->has_turn = false;
+    prefork_give_turn();
+    if (prefork_spawn(ginfo, w))
+	return; /* In the new worker. */
+    prefork_give_turn();
+}
+
+/*
+ * Fork a worker into w.  Returns true in the worker, false in the
+ * parent.  Like a connection, the worker is double forked so the
+ * parent doesn't have to reap it.
+ */
+static bool
+prefork_spawn(struct gdata *ginfo, struct prefork_worker *w)
+{
+    struct gensio_os_funcs *o = ginfo->o;
+    struct gensio_iod *iod;
+    int sv[2], err;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+	log_event(LOG_ERR, "Could not create worker socket: %s",
+		  strerror(errno));
+	return false;
+    }
+
+    switch ((pid = fork())) {
+    case -1:
+	log_event(LOG_ERR, "Could not fork worker: %s", strerror(errno));
+	close(sv[0]);
+	close(sv[1]);
+	return false;
+
+    case 0:
+	err = gensio_os_funcs_handle_fork(o);
+	if (err) {
+	    log_event(LOG_ERR, "Could not fork gensio handler: %s",
+		      gensio_err_to_str(err));
+	    exit(1);
+	}
+	pid_file = NULL; /* Make sure children don't delete this. */
+
+	setsid();
+	switch (fork()) {
+	case -1:
+	    log_event(LOG_ERR, "Could not fork twice: %s", strerror(errno));
+	    exit(1);
+	case 0:
+	    break;
+	default:
+	    exit(0);
+	}
+
+	close(sv[0]);
+	set_accepts(false);
+	prefork_close_workers();
+	err = o->add_iod(o, GENSIO_IOD_SOCKET, sv[1], &prefork_parent_iod);
+	if (!err)
+	    err = o->set_fd_handlers(prefork_parent_iod, NULL,
+				     prefork_worker_read, NULL, NULL, NULL);
+	if (err) {
+	    log_event(LOG_ERR, "Could not set up worker: %s",
+		      gensio_err_to_str(err));
+	    exit(1);
+	}
+	o->set_read_handler(prefork_parent_iod, true);
+	return true;
+
+    default:
+	close(sv[1]);
+	waitpid(pid, NULL, 0);
+	break;
+    }
+
+    err = o->add_iod(o, GENSIO_IOD_SOCKET, sv[0], &iod);
+    if (err) {
+	close(sv[0]);
+	goto out_err;
+    }
+    err = o->set_fd_handlers(iod, w, prefork_parent_read, NULL, NULL,
+			     prefork_cleared);
+    if (err) {
+	o->close(&iod);
+	goto out_err;
+    }
+    o->set_read_handler(iod, true);
+    w->iod = iod;
+    w->has_turn = false;
+    return false;
+
+ out_err:
+    log_event(LOG_ERR, "Could not set up worker connection: %s",
+	      gensio_err_to_str(err));
+    return false;
+}
+
+static void
+prefork_start_runner(struct gensio_runner *r, void *cb_data)
+{
+    struct gdata *ginfo = cb_data;
+    unsigned int i;
+
+    gensio_os_funcs_free_runner(ginfo->o, r);
+    for (i = 0; i < prefork; i++) {
+	if (prefork_spawn(ginfo, &prefork_workers[i]))
+	    return; /* In the new worker. */
+    }
+    prefork_give_turn();
+}
+
+static int
+start_prefork(struct gdata *ginfo)
+{
+    struct gensio_os_funcs *o = ginfo->o;
+    struct gensio_runner *r;
+
+    if (!prefork || oneshot)
+	return 0;
+    prefork_workers = calloc(prefork, sizeof(*prefork_workers));
+    if (!prefork_workers)
+	return GE_NOMEM;
+    set_accepts(false);
+    gensio_os_funcs_set_data(o, ginfo);
+    /* Fork from the main loop, so the workers run it, too. */
+    r = gensio_os_funcs_alloc_runner(o, prefork_start_runner, ginfo);
+    if (!r)
+	return GE_NOMEM;
+    return gensio_os_funcs_run(o, r);
+}
+
 static void
 setup_new_connection(struct gdata *ginfo, struct gensio *io)
 {
@@ -2772,6 +3036,14 @@ setup_new_connection(struct gdata *ginfo, struct gensio *io)
     if (oneshot)
 	goto skip_fork;
 
+    if (prefork_parent_iod) {
+	/* A worker took a connection, let the parent move the turn on. */
+	set_accepts(false);
+	prefork_send(prefork_parent_iod, 'T');
+	prefork_close_iod(&prefork_parent_iod);
+	goto skip_fork;
+    }
+
     switch ((pid = fork())) {
     case -1:
 	log_event(LOG_ERR, "Could not fork: %s", strerror(errno));
@@ -2803,6 +3075,7 @@ setup_new_connection(struct gdata *ginfo, struct gensio *io)
 	default:
 	    exit(0);
 	}
+	prefork_close_workers();
 
     skip_fork:
 	if (tcp_acc) {
@@ -2929,6 +3202,12 @@ setup_new_connection(struct gdata *ginfo, struct gensio *io)
     }
 }
 
+static int
+start_prefork(struct gdata *ginfo)
+{
+    return 0;
+}
+
 static void
 do_daemonize(struct gensio_os_funcs *o)
 {
@@ -3005,6 +3284,10 @@ help(int err)
     printf("  --permit-root - Allow root logins.\n");
     printf("  --allow-password - Allow password-based logins.\n");
     printf("  --oneshot - Do not fork new connections, do one and exit.\n");
+#ifndef _WIN32
+    printf("  --prefork <n> - Keep n worker processes forked and ready\n"
+	   "     to take new connections.\n");
+#endif
     printf("  --nodaemon - Do not daemonize.\n");
     printf("  --nointeractive - Do not do interactive login queries.\n");
     printf("  --sctp - Enable SCTP support.\n");
@@ -3122,6 +3405,11 @@ main(int argc, char *argv[])
 #endif
 	else if ((rv = cmparg(argc, argv, &arg, NULL, "--oneshot", NULL)))
 	    oneshot = true;
+#ifndef _WIN32
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--prefork",
+				   &prefork)))
+	    ;
+#endif
 	else if ((rv = cmparg(argc, argv, &arg, NULL, "--nodaemon", NULL)))
 	    daemonize = false;
 	else if ((rv = cmparg(argc, argv, &arg, NULL, "--nointeractive", NULL)))
@@ -3292,6 +3580,13 @@ main(int argc, char *argv[])
     if (!oneshot && daemonize)
 	do_daemonize(o);
 
+    rv = start_prefork(&ginfo);
+    if (rv) {
+	log_event(LOG_ERR, "Could not start workers: %s\n",
+		  gensio_err_to_str(rv));
+	return 1;
+    }
+
     gensio_os_funcs_wait(o, ginfo.waiter, 1, NULL);
 
     /* FIXME - shutdown threads first. */
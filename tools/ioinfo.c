@@ -23,14 +23,25 @@
  *  release a modified version which carries forward this exception.
  */
 
+#define _GNU_SOURCE /* Get splice(). */
 #include "config.h"
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
 #include <string.h>
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "ioinfo.h"
 
+#ifdef HAVE_SPLICE
+/* How much to splice at a time, and per write ready callback. */
+#define IOINFO_SPLICE_CHUNK	(64 * 1024)
+#define IOINFO_SPLICE_MAX	(1024 * 1024)
+#endif
+
 struct ioinfo {
     struct gensio *io;
     struct ioinfo *otherio;
@@ -53,6 +64,19 @@ struct ioinfo {
 
     struct ioinfo_oob *oob_head;
     struct ioinfo_oob *oob_tail;
+
+    /*
+     * If splicing is set, data read from io is moved to the other
+     * side by the kernel through a pipe.  A read callback is only
+     * used to wait for data, and read_held is set if the gensio still
+     * holds data from it, which must go first.
+     */
+    bool splicing;
+    bool read_held;
+    int rfd;
+    int wfd;
+    int pipefds[2];
+    gensiods pipe_count;
 };
 
 void
@@ -185,6 +209,138 @@ handle_escapechar(struct ioinfo *ioinfo, char c)
     return rv;
 }
 
+#ifdef HAVE_SPLICE
+static void
+ioinfo_splice_fail(struct ioinfo *ioinfo, int err, bool is_write)
+{
+    enum ioinfo_shutdown_reason reason = IOINFO_SHUTDOWN_ERR;
+
+    ioinfo->splicing = false;
+    if (ioinfo->ready)
+	gensio_set_read_callback_enable(ioinfo->io, false);
+    if (err == GE_REMCLOSE)
+	reason = IOINFO_SHUTDOWN_REMCLOSE;
+    else if (is_write)
+	ioinfo_err(ioinfo->otherio, "write error(3): %s",
+		   gensio_err_to_str(err));
+    else
+	ioinfo_err(ioinfo, "read error: %s", gensio_err_to_str(err));
+    gensio_os_funcs_unlock(ioinfo->o, ioinfo->lock);
+    ioinfo->uh->shutdown(ioinfo, reason);
+    gensio_os_funcs_lock(ioinfo->o, ioinfo->lock);
+}
+
+/*
+ * The other side can take data, move data from our fd to the other
+ * side's fd through the pipe.  If there is nothing to read, wait for
+ * data with a normal read callback.  Called with ioinfo->lock held.
+ */
+static void
+ioinfo_splice(struct ioinfo *ioinfo)
+{
+    struct ioinfo *rioinfo = ioinfo->otherio;
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    gensiods total = 0;
+    ssize_t rv;
+
+    if (!ioinfo->ready || !rioinfo->ready)
+	return;
+
+    while (total < IOINFO_SPLICE_MAX) {
+	if (ioinfo->pipe_count == 0) {
+	    rv = splice(ioinfo->rfd, NULL, ioinfo->pipefds[1], NULL,
+			IOINFO_SPLICE_CHUNK, flags);
+	    if (rv == 0) {
+		ioinfo_splice_fail(ioinfo, GE_REMCLOSE, false);
+		return;
+	    }
+	    if (rv < 0) {
+		if (errno == EINTR)
+		    continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		    gensio_set_write_callback_enable(rioinfo->io, false);
+		    gensio_set_read_callback_enable(ioinfo->io, true);
+		    return;
+		}
+		ioinfo_splice_fail(ioinfo,
+				   gensio_os_err_to_err(ioinfo->o, errno),
+				   false);
+		return;
+	    }
+	    ioinfo->pipe_count = rv;
+	}
+
+	rv = splice(ioinfo->pipefds[0], NULL, rioinfo->wfd, NULL,
+		    ioinfo->pipe_count, flags);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    /* The write callback will tell us when there is room. */
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return;
+	    ioinfo_splice_fail(ioinfo, gensio_os_err_to_err(ioinfo->o, errno),
+			       true);
+	    return;
+	}
+	ioinfo->pipe_count -= rv;
+	total += rv;
+    }
+}
+
+static int
+ioinfo_get_fd(struct gensio *io, const char *which, int *fd)
+{
+    char data[20];
+    gensiods len = sizeof(data);
+    int err;
+
+    snprintf(data, sizeof(data), "%s", which);
+    err = gensio_control(io, 0, GENSIO_CONTROL_GET, GENSIO_CONTROL_FD,
+			 data, &len);
+    if (!err)
+	*fd = strtol(data, NULL, 0);
+    return err;
+}
+
+/*
+ * Data from ioinfo can go straight to the other side if nothing needs
+ * to look at it and both ends are plain file descriptors.  Any filter
+ * in either gensio stack keeps GENSIO_CONTROL_FD from working, so the
+ * normal copy is used then.  Called with ioinfo->lock held.
+ */
+static void
+ioinfo_setup_splice(struct ioinfo *ioinfo)
+{
+    struct ioinfo *rioinfo = ioinfo->otherio;
+
+    if (ioinfo->splicing || ioinfo->escape_char >= 0 || ioinfo->uh->oobdata)
+	return;
+    if (ioinfo_get_fd(ioinfo->io, "0", &ioinfo->rfd) ||
+		ioinfo_get_fd(rioinfo->io, "1", &rioinfo->wfd))
+	return;
+    if (ioinfo->pipefds[0] == -1) {
+	if (pipe2(ioinfo->pipefds, O_CLOEXEC) == -1) {
+	    ioinfo->pipefds[0] = -1;
+	    return;
+	}
+	/* Bigger pipe, fewer trips.  Failure is harmless. */
+	fcntl(ioinfo->pipefds[1], F_SETPIPE_SZ, IOINFO_SPLICE_CHUNK);
+    }
+    ioinfo->pipe_count = 0;
+    ioinfo->splicing = true;
+}
+#else
+static void
+ioinfo_splice(struct ioinfo *ioinfo)
+{
+}
+
+static void
+ioinfo_setup_splice(struct ioinfo *ioinfo)
+{
+}
+#endif
+
 static int
 io_event(struct gensio *io, void *user_data, int event, int err,
 	 unsigned char *buf, gensiods *buflen,
@@ -278,10 +434,17 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	}
 	if (count < *buflen) {
 	    *buflen = count;
+	    ioinfo->read_held = true;
 	    if (ioinfo->ready)
 		gensio_set_read_callback_enable(ioinfo->io, false);
 	    if (rioinfo->ready)
 		gensio_set_write_callback_enable(rioinfo->io, true);
+	} else if (ioinfo->splicing && rioinfo->ready) {
+	    /* Got everything out, go back to moving it in the kernel. */
+	    ioinfo->read_held = false;
+	    if (ioinfo->ready)
+		gensio_set_read_callback_enable(ioinfo->io, false);
+	    gensio_set_write_callback_enable(rioinfo->io, true);
 	} else if (escapepos >= 0) {
 	    /*
 	     * Don't do this if we didn't handle all the characters, get
@@ -332,6 +495,17 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	    gensio_os_funcs_unlock(o, ioinfo->lock);
 	    return 0;
 	}
+	gensio_os_funcs_unlock(o, ioinfo->lock);
+
+	gensio_os_funcs_lock(o, rioinfo->lock);
+	if (rioinfo->splicing && !rioinfo->read_held) {
+	    ioinfo_splice(rioinfo);
+	    gensio_os_funcs_unlock(o, rioinfo->lock);
+	    return 0;
+	}
+	gensio_os_funcs_unlock(o, rioinfo->lock);
+
+	gensio_os_funcs_lock(o, ioinfo->lock);
 	if (ioinfo->ready)
 	    gensio_set_write_callback_enable(ioinfo->io, false);
 	gensio_os_funcs_unlock(o, ioinfo->lock);
@@ -392,6 +566,19 @@ ioinfo_set_ready(struct ioinfo *ioinfo, struct gensio *io)
     if (rioinfo->ready)
 	gensio_set_read_callback_enable(rioinfo->io, true);
     gensio_os_funcs_unlock(rioinfo->o, rioinfo->lock);
+
+    /*
+     * Reads stay on until the first data comes in, then the data is
+     * spliced if possible.
+     */
+    if (rioinfo->ready) {
+	gensio_os_funcs_lock(ioinfo->o, ioinfo->lock);
+	ioinfo_setup_splice(ioinfo);
+	gensio_os_funcs_unlock(ioinfo->o, ioinfo->lock);
+	gensio_os_funcs_lock(rioinfo->o, rioinfo->lock);
+	ioinfo_setup_splice(rioinfo);
+	gensio_os_funcs_unlock(rioinfo->o, rioinfo->lock);
+    }
 }
 
 void
@@ -403,6 +590,7 @@ ioinfo_set_not_ready(struct ioinfo *ioinfo)
 	gensio_set_write_callback_enable(ioinfo->io, false);
     }
     ioinfo->ready = false;
+    ioinfo->splicing = false;
     gensio_os_funcs_unlock(ioinfo->o, ioinfo->lock);
 }
 
@@ -435,6 +623,8 @@ alloc_ioinfo(struct gensio_os_funcs *o,
 	    ioinfo->subdata = subdata;
 	    ioinfo->uh = uh;
 	    ioinfo->userdata = userdata;
+	    ioinfo->pipefds[0] = -1;
+	    ioinfo->pipefds[1] = -1;
 	}
     }
     return ioinfo;
@@ -443,6 +633,12 @@ alloc_ioinfo(struct gensio_os_funcs *o,
 void
 free_ioinfo(struct ioinfo *ioinfo)
 {
+#ifdef HAVE_SPLICE
+    if (ioinfo->pipefds[0] != -1) {
+	close(ioinfo->pipefds[0]);
+	close(ioinfo->pipefds[1]);
+    }
+#endif
     gensio_os_funcs_free_lock(ioinfo->o, ioinfo->lock);
     gensio_os_funcs_zfree(ioinfo->o, ioinfo);
 }
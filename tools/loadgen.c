@@ -0,0 +1,618 @@
+/*
+ *  loadgen - Open many gensio connections and measure them
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ *
+ *  In addition, as a special exception, the copyright holders of
+ *  gensio give you permission to combine gensio with free software
+ *  programs or libraries that are released under the GNU LGPL and
+ *  with code included in the standard release of OpenSSL under the
+ *  OpenSSL license (or modified versions of such code, with unchanged
+ *  license). You may copy and distribute such a system following the
+ *  terms of the GNU GPL for gensio and the licenses of the other code
+ *  concerned, provided that you include the source code of that
+ *  other code when and as the GNU GPL requires distribution of source
+ *  code.
+ *
+ *  Note that people who make modified versions of gensio are not
+ *  obligated to grant this special exception for their modified
+ *  versions; it is their choice whether to do so. The GNU General
+ *  Public License gives permission to release a modified version
+ *  without this exception; this exception also makes it possible to
+ *  release a modified version which carries forward this exception.
+ */
+
+/*
+ * Load generation for gensiot.  Many connections are opened over a
+ * compiled gensio template, each with a perf gensio in latency mode
+ * on top doing the message exchange and timing.  perf hands its
+ * results, including its latency histogram, up as JSON when it is
+ * done, and those are merged here with the connect times.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_os_funcs.h>
+
+#include "loadgen.h"
+
+struct lg_conn {
+    struct loadgen *lg;
+    struct gensio_link link;
+    struct gensio *io;
+    uint64_t start;
+    bool opened;
+    bool closing;
+
+    /* perf's results come in here. */
+    char *out;
+    gensiods out_len;
+    gensiods out_size;
+};
+
+struct lg_bucket {
+    uint64_t value; /* Top of the bucket in nsecs. */
+    uint64_t count;
+};
+
+struct loadgen {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_waiter *waiter;
+    struct gensio_timer *timer;
+    bool timer_running;
+    struct gensio_template *tmpl;
+    struct loadgen_params p;
+    struct gensio_list conns;
+    bool in_start;
+    bool stopping;
+    int err;
+
+    unsigned int started;
+    unsigned int active;
+    unsigned int finished;
+    unsigned int open_failed;
+    unsigned int run_failed;
+
+    uint64_t run_start;
+    uint64_t run_end;
+
+    /* Time from the open call to the open completing, in nsecs. */
+    uint64_t *conn_lat;
+    unsigned int conn_lat_count;
+
+    uint64_t write_bytes;
+    uint64_t read_bytes;
+    uint64_t msgs;
+    uint64_t msgs_bad;
+    double lat_min;
+    double lat_max;
+    double lat_sum; /* Sum of each connection's mean times its messages */
+
+    /* The merged perf histograms, sorted by value. */
+    struct lg_bucket *hist;
+    unsigned int hist_len;
+    unsigned int hist_size;
+};
+
+static void lg_start_conns(struct loadgen *lg);
+
+static uint64_t
+lg_now(struct loadgen *lg)
+{
+    gensio_time t;
+
+    gensio_os_funcs_get_monotonic_time(lg->o, &t);
+    return (uint64_t) t.secs * 1000000000 + t.nsecs;
+}
+
+static void
+lg_hist_add(struct loadgen *lg, uint64_t value, uint64_t count)
+{
+    unsigned int lo = 0, hi = lg->hist_len, mid;
+    struct lg_bucket *nh;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (lg->hist[mid].value < value)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo < lg->hist_len && lg->hist[lo].value == value) {
+	lg->hist[lo].count += count;
+	return;
+    }
+    if (lg->hist_len == lg->hist_size) {
+	nh = realloc(lg->hist, (lg->hist_size + 64) * sizeof(*nh));
+	if (!nh) {
+	    lg->err = GE_NOMEM;
+	    return;
+	}
+	lg->hist = nh;
+	lg->hist_size += 64;
+    }
+    memmove(lg->hist + lo + 1, lg->hist + lo,
+	    (lg->hist_len - lo) * sizeof(*lg->hist));
+    lg->hist[lo].value = value;
+    lg->hist[lo].count = count;
+    lg->hist_len++;
+}
+
+static double
+lg_json_num(const char *str, const char *name, bool *found)
+{
+    char key[40];
+    const char *s;
+
+    snprintf(key, sizeof(key), "\"%s\": ", name);
+    s = strstr(str, key);
+    if (!s) {
+	*found = false;
+	return 0;
+    }
+    return strtod(s + strlen(key), NULL);
+}
+
+/* Merge the JSON results from one connection's perf gensio. */
+static bool
+lg_add_results(struct loadgen *lg, struct lg_conn *conn)
+{
+    bool found = true;
+    const char *s;
+    double msgs, min, max, mean;
+    unsigned long long value, count;
+    int n;
+
+    if (!conn->out)
+	return false;
+    lg->write_bytes += lg_json_num(conn->out, "write_bytes", &found);
+    lg->read_bytes += lg_json_num(conn->out, "read_bytes", &found);
+    msgs = lg_json_num(conn->out, "messages", &found);
+    lg->msgs_bad += lg_json_num(conn->out, "bad", &found);
+    min = lg_json_num(conn->out, "min_us", &found);
+    max = lg_json_num(conn->out, "max_us", &found);
+    mean = lg_json_num(conn->out, "mean_us", &found);
+    s = strstr(conn->out, "\"hist\": [");
+    if (!found || !s)
+	return false;
+
+    if (lg->msgs == 0 || min < lg->lat_min)
+	lg->lat_min = min;
+    if (max > lg->lat_max)
+	lg->lat_max = max;
+    lg->lat_sum += mean * msgs;
+    lg->msgs += msgs;
+
+    s += 9;
+    while (sscanf(s, " [%llu, %llu]%n", &value, &count, &n) == 2) {
+	lg_hist_add(lg, value, count);
+	s += n;
+	if (*s == ',')
+	    s++;
+    }
+    return true;
+}
+
+static double
+lg_hist_percentile(struct loadgen *lg, double pct)
+{
+    uint64_t n = 0, want, count = 0;
+    unsigned int i;
+
+    for (i = 0; i < lg->hist_len; i++)
+	n += lg->hist[i].count;
+    if (n == 0)
+	return 0;
+    want = (uint64_t) ((double) n * pct / 100.0 + 0.5);
+    if (want == 0)
+	want = 1;
+    for (i = 0; i < lg->hist_len - 1; i++) {
+	count += lg->hist[i].count;
+	if (count >= want)
+	    break;
+    }
+    if (lg->hist[i].value / 1000.0 > lg->lat_max)
+	return lg->lat_max;
+    return lg->hist[i].value / 1000.0;
+}
+
+static int
+lg_cmp_u64(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+
+    return va < vb ? -1 : va > vb;
+}
+
+/* Connect time percentile in usecs, conn_lat must be sorted. */
+static double
+lg_conn_percentile(struct loadgen *lg, double pct)
+{
+    unsigned int idx;
+
+    if (lg->conn_lat_count == 0)
+	return 0;
+    idx = (unsigned int) ((double) lg->conn_lat_count * pct / 100.0 + 0.5);
+    if (idx > 0)
+	idx--;
+    if (idx >= lg->conn_lat_count)
+	idx = lg->conn_lat_count - 1;
+    return lg->conn_lat[idx] / 1000.0;
+}
+
+static void
+lg_print_results(struct loadgen *lg)
+{
+    double secs = (lg->run_end - lg->run_start) / 1000000000.0;
+    unsigned int ok = lg->finished - lg->open_failed - lg->run_failed;
+
+    if (secs <= 0)
+	secs = 1e-9;
+    qsort(lg->conn_lat, lg->conn_lat_count, sizeof(*lg->conn_lat),
+	  lg_cmp_u64);
+
+    if (lg->p.json) {
+	printf("{\"connections\": %u, \"open_failed\": %u,"
+	       " \"run_failed\": %u, \"secs\": %.6f,"
+	       " \"connects_per_sec\": %.1f,"
+	       " \"connect\": {\"min_us\": %.1f, \"p50_us\": %.1f,"
+	       " \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+	       lg->finished, lg->open_failed, lg->run_failed, secs,
+	       lg->conn_lat_count / secs,
+	       lg_conn_percentile(lg, 0), lg_conn_percentile(lg, 50.0),
+	       lg_conn_percentile(lg, 99.0), lg_conn_percentile(lg, 99.9),
+	       lg_conn_percentile(lg, 100.0));
+	if (lg->p.msg_count)
+	    printf(", \"write_bytes_per_sec\": %.1f,"
+		   " \"read_bytes_per_sec\": %.1f,"
+		   " \"latency\": {\"messages\": %llu, \"msg_size\": %u,"
+		   " \"msgs_per_sec\": %.1f, \"bad\": %llu,"
+		   " \"min_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f,"
+		   " \"p999_us\": %.1f, \"max_us\": %.1f, \"mean_us\": %.1f}",
+		   lg->write_bytes / secs, lg->read_bytes / secs,
+		   (unsigned long long) lg->msgs, lg->p.msg_size,
+		   lg->msgs / secs, (unsigned long long) lg->msgs_bad,
+		   lg->lat_min, lg_hist_percentile(lg, 50.0),
+		   lg_hist_percentile(lg, 99.0), lg_hist_percentile(lg, 99.9),
+		   lg->lat_max, lg->msgs ? lg->lat_sum / lg->msgs : 0.0);
+	printf("}\n");
+	return;
+    }
+
+    printf("LOADGEN: %u connections in %.3f seconds, %u ok, %u failed to"
+	   " open, %u failed after open\n",
+	   lg->finished, secs, ok, lg->open_failed, lg->run_failed);
+    printf("         %.1f connects/sec\n", lg->conn_lat_count / secs);
+    printf("CONNECT: usecs min %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+	   lg_conn_percentile(lg, 0), lg_conn_percentile(lg, 50.0),
+	   lg_conn_percentile(lg, 99.0), lg_conn_percentile(lg, 99.9),
+	   lg_conn_percentile(lg, 100.0));
+    if (!lg->p.msg_count)
+	return;
+    printf("TOTAL:   Wrote %llu, read %llu bytes\n"
+	   "         %.1f write bytes/sec, %.1f read bytes/sec\n",
+	   (unsigned long long) lg->write_bytes,
+	   (unsigned long long) lg->read_bytes,
+	   lg->write_bytes / secs, lg->read_bytes / secs);
+    printf("LATENCY: %llu messages of %u bytes, %.1f msgs/sec, %llu bad\n"
+	   "         usecs min %.1f p50 %.1f p99 %.1f p99.9 %.1f"
+	   " max %.1f mean %.1f\n",
+	   (unsigned long long) lg->msgs, lg->p.msg_size, lg->msgs / secs,
+	   (unsigned long long) lg->msgs_bad,
+	   lg->lat_min, lg_hist_percentile(lg, 50.0),
+	   lg_hist_percentile(lg, 99.0), lg_hist_percentile(lg, 99.9),
+	   lg->lat_max, lg->msgs ? lg->lat_sum / lg->msgs : 0.0);
+}
+
+/* The connection is gone.  Called locked. */
+static void
+lg_conn_finish(struct loadgen *lg, struct lg_conn *conn)
+{
+    gensio_list_rm(&lg->conns, &conn->link);
+    if (conn->io)
+	gensio_free(conn->io);
+    if (conn->out)
+	free(conn->out);
+    free(conn);
+    lg->active--;
+    lg->finished++;
+    lg->run_end = lg_now(lg);
+    lg_start_conns(lg);
+    if (lg->active == 0 && (lg->stopping || lg->started == lg->p.conns))
+	gensio_os_funcs_wake(lg->o, lg->waiter);
+}
+
+static void
+lg_close_done(struct gensio *io, void *close_data)
+{
+    struct lg_conn *conn = close_data;
+    struct loadgen *lg = conn->lg;
+
+    gensio_os_funcs_lock(lg->o, lg->lock);
+    lg_conn_finish(lg, conn);
+    gensio_os_funcs_unlock(lg->o, lg->lock);
+}
+
+/* Called locked. */
+static void
+lg_conn_close(struct loadgen *lg, struct lg_conn *conn)
+{
+    if (conn->closing)
+	return;
+    conn->closing = true;
+    gensio_set_read_callback_enable(conn->io, false);
+    if (gensio_close(conn->io, lg_close_done, conn))
+	lg_conn_finish(lg, conn);
+}
+
+static int
+lg_event(struct gensio *io, void *user_data, int event, int err,
+	 unsigned char *buf, gensiods *buflen, const char *const *auxdata)
+{
+    struct lg_conn *conn = user_data;
+    struct loadgen *lg = conn->lg;
+    gensiods len;
+    char *nout;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    gensio_os_funcs_lock(lg->o, lg->lock);
+    if (err) {
+	/* perf closes with GE_REMCLOSE after it gives its results. */
+	if (!lg_add_results(lg, conn))
+	    lg->run_failed++;
+	lg_conn_close(lg, conn);
+	goto out_unlock;
+    }
+
+    len = *buflen;
+    if (conn->out_len + len + 1 > conn->out_size) {
+	nout = realloc(conn->out, conn->out_len + len + 1024);
+	if (!nout) {
+	    lg->run_failed++;
+	    lg_conn_close(lg, conn);
+	    goto out_unlock;
+	}
+	conn->out = nout;
+	conn->out_size = conn->out_len + len + 1024;
+    }
+    memcpy(conn->out + conn->out_len, buf, len);
+    conn->out_len += len;
+    conn->out[conn->out_len] = '\0';
+
+ out_unlock:
+    gensio_os_funcs_unlock(lg->o, lg->lock);
+    return 0;
+}
+
+static void
+lg_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct lg_conn *conn = open_data;
+    struct loadgen *lg = conn->lg;
+
+    gensio_os_funcs_lock(lg->o, lg->lock);
+    if (err) {
+	lg->open_failed++;
+	lg_conn_finish(lg, conn);
+	goto out_unlock;
+    }
+    conn->opened = true;
+    lg->conn_lat[lg->conn_lat_count++] = lg_now(lg) - conn->start;
+    if (lg->stopping || !lg->p.msg_count)
+	lg_conn_close(lg, conn);
+    else
+	gensio_set_read_callback_enable(io, true);
+ out_unlock:
+    gensio_os_funcs_unlock(lg->o, lg->lock);
+}
+
+/* Called locked. */
+static void
+lg_start_one(struct loadgen *lg)
+{
+    struct lg_conn *conn;
+    int err;
+
+    lg->started++;
+    conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+	lg->err = GE_NOMEM;
+	lg->stopping = true;
+	return;
+    }
+    conn->lg = lg;
+    err = gensio_template_alloc(lg->tmpl, NULL, lg_event, conn, &conn->io);
+    if (err) {
+	free(conn);
+	lg->err = err;
+	lg->stopping = true;
+	return;
+    }
+    gensio_list_add_tail(&lg->conns, &conn->link);
+    lg->active++;
+    conn->start = lg_now(lg);
+    err = gensio_open(conn->io, lg_open_done, conn);
+    if (err) {
+	lg->open_failed++;
+	lg_conn_finish(lg, conn);
+    }
+}
+
+/* Start what connections we can.  Called locked. */
+static void
+lg_start_conns(struct loadgen *lg)
+{
+    uint64_t now, next;
+    gensio_time timeout;
+
+    if (lg->in_start)
+	return; /* A failed start called back in, the loop goes on. */
+    lg->in_start = true;
+    while (!lg->stopping && lg->started < lg->p.conns &&
+	   lg->active < lg->p.max_open) {
+	if (lg->p.rate) {
+	    /* Connection n may start n / rate seconds into the run. */
+	    now = lg_now(lg);
+	    next = lg->run_start + lg->started * 1000000000ULL / lg->p.rate;
+	    if (next > now) {
+		if (!lg->timer_running) {
+		    timeout.secs = (next - now) / 1000000000;
+		    timeout.nsecs = (next - now) % 1000000000;
+		    if (gensio_os_funcs_start_timer(lg->o, lg->timer,
+						    &timeout) == 0)
+			lg->timer_running = true;
+		}
+		break;
+	    }
+	}
+	lg_start_one(lg);
+    }
+    lg->in_start = false;
+}
+
+static void
+lg_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct loadgen *lg = cb_data;
+
+    gensio_os_funcs_lock(lg->o, lg->lock);
+    lg->timer_running = false;
+    lg_start_conns(lg);
+    if (lg->active == 0 && lg->stopping)
+	gensio_os_funcs_wake(lg->o, lg->waiter);
+    gensio_os_funcs_unlock(lg->o, lg->lock);
+}
+
+static void
+lg_term(void *info)
+{
+    struct loadgen *lg = info;
+    struct gensio_link *l, *l2;
+
+    gensio_os_funcs_lock(lg->o, lg->lock);
+    lg->stopping = true;
+    gensio_list_for_each_safe(&lg->conns, l, l2) {
+	struct lg_conn *conn = gensio_container_of(l, struct lg_conn, link);
+
+	/* Ones still opening are closed when the open finishes. */
+	if (conn->opened)
+	    lg_conn_close(lg, conn);
+    }
+    if (lg->active == 0)
+	gensio_os_funcs_wake(lg->o, lg->waiter);
+    gensio_os_funcs_unlock(lg->o, lg->lock);
+}
+
+int
+loadgen_run(struct gensio_os_funcs *o, struct gensio_os_proc_data *proc_data,
+	    const char *str, struct loadgen_params *params)
+{
+    struct loadgen *lg;
+    char *s = NULL;
+    int err = GE_NOMEM;
+
+    if (params->conns == 0 || (params->msg_count &&
+			       (params->msg_size == 0 || !params->outstanding)))
+	return GE_INVAL;
+
+    lg = calloc(1, sizeof(*lg));
+    if (!lg)
+	return GE_NOMEM;
+    lg->o = o;
+    lg->p = *params;
+    if (lg->p.max_open == 0 || lg->p.max_open > lg->p.conns)
+	lg->p.max_open = lg->p.conns;
+    gensio_list_init(&lg->conns);
+
+    lg->conn_lat = calloc(lg->p.conns, sizeof(*lg->conn_lat));
+    if (!lg->conn_lat)
+	goto out;
+    lg->lock = gensio_os_funcs_alloc_lock(o);
+    if (!lg->lock)
+	goto out;
+    lg->waiter = gensio_os_funcs_alloc_waiter(o);
+    if (!lg->waiter)
+	goto out;
+    lg->timer = gensio_os_funcs_alloc_timer(o, lg_timeout, lg);
+    if (!lg->timer)
+	goto out;
+
+    if (lg->p.msg_count) {
+	s = gensio_alloc_sprintf(o, "perf(latency,json,hist,msg_size=%u,"
+				 "msg_count=%u,concurrency=%u,think=%u),%s",
+				 lg->p.msg_size, lg->p.msg_count,
+				 lg->p.outstanding, lg->p.think, str);
+	if (!s)
+	    goto out;
+	str = s;
+    }
+    err = gensio_template_compile(str, o, &lg->tmpl);
+    if (err) {
+	fprintf(stderr, "Could not compile %s: %s\n", str,
+		gensio_err_to_str(err));
+	goto out;
+    }
+
+    err = gensio_os_proc_register_term_handler(proc_data, lg_term, lg);
+    if (err)
+	goto out;
+
+    gensio_os_funcs_lock(o, lg->lock);
+    lg->run_start = lg_now(lg);
+    lg->run_end = lg->run_start;
+    lg_start_conns(lg);
+    if (lg->active == 0 && !lg->timer_running)
+	gensio_os_funcs_wake(o, lg->waiter);
+    gensio_os_funcs_unlock(o, lg->lock);
+
+    gensio_os_funcs_wait(o, lg->waiter, 1, NULL);
+
+    gensio_os_funcs_lock(o, lg->lock);
+    lg->stopping = true;
+    if (lg->timer_running &&
+		gensio_os_funcs_stop_timer(o, lg->timer) == 0)
+	lg->timer_running = false;
+    while (lg->timer_running) {
+	/* The timer is going off, let it finish before freeing it. */
+	gensio_time wait = { 0, 1000000 };
+
+	gensio_os_funcs_unlock(o, lg->lock);
+	gensio_os_funcs_service(o, &wait);
+	gensio_os_funcs_lock(o, lg->lock);
+    }
+    gensio_os_funcs_unlock(o, lg->lock);
+
+    if (lg->err)
+	fprintf(stderr, "Error starting connections: %s\n",
+		gensio_err_to_str(lg->err));
+    lg_print_results(lg);
+    err = lg->err;
+    if (!err && (lg->open_failed || lg->run_failed))
+	err = GE_IOERR;
+
+ out:
+    if (s)
+	gensio_os_funcs_zfree(o, s);
+    if (lg->tmpl)
+	gensio_template_free(lg->tmpl);
+    if (lg->timer)
+	gensio_os_funcs_free_timer(o, lg->timer);
+    if (lg->waiter)
+	gensio_os_funcs_free_waiter(o, lg->waiter);
+    if (lg->lock)
+	gensio_os_funcs_free_lock(o, lg->lock);
+    free(lg->conn_lat);
+    free(lg->hist);
+    free(lg);
+    return err;
+}
@@ -0,0 +1,53 @@
+/*
+ *  loadgen - Open many gensio connections and measure them
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ *
+ *  In addition, as a special exception, the copyright holders of
+ *  gensio give you permission to combine gensio with free software
+ *  programs or libraries that are released under the GNU LGPL and
+ *  with code included in the standard release of OpenSSL under the
+ *  OpenSSL license (or modified versions of such code, with unchanged
+ *  license). You may copy and distribute such a system following the
+ *  terms of the GNU GPL for gensio and the licenses of the other code
+ *  concerned, provided that you include the source code of that
+ *  other code when and as the GNU GPL requires distribution of source
+ *  code.
+ *
+ *  Note that people who make modified versions of gensio are not
+ *  obligated to grant this special exception for their modified
+ *  versions; it is their choice whether to do so. The GNU General
+ *  Public License gives permission to release a modified version
+ *  without this exception; this exception also makes it possible to
+ *  release a modified version which carries forward this exception.
+ */
+
+#ifndef GENSIOTOOL_LOADGEN_H
+#define GENSIOTOOL_LOADGEN_H
+
+#include <stdbool.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+
+struct loadgen_params {
+    unsigned int conns;		/* Total connections to make. */
+    unsigned int max_open;	/* At most this many open at once. */
+    unsigned int rate;		/* New connections per second, 0 is no limit */
+    unsigned int msg_size;
+    unsigned int msg_count;	/* Per connection, 0 to just connect. */
+    unsigned int outstanding;	/* Messages in flight per connection. */
+    unsigned int think;		/* usecs between a reply and the next send. */
+    bool json;
+};
+
+/*
+ * Run connections over the gensio stack str as given by params,
+ * print the results to stdout, and return when they are all done or
+ * on a termination signal.  Other threads may be servicing o.
+ */
+int loadgen_run(struct gensio_os_funcs *o,
+		struct gensio_os_proc_data *proc_data,
+		const char *str, struct loadgen_params *params);
+
+#endif /* GENSIOTOOL_LOADGEN_H */
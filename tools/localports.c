@@ -64,6 +64,18 @@ struct portcon {
     bool io2_open;
     char *id_str;
 
+    /*
+     * For control connections, the service comes from the connection
+     * as a 4-byte network order length followed by the service.
+     */
+    struct ioinfo *ioinfo1;
+    bool is_ctl;
+    unsigned char ctl_hdr[4];
+    gensiods ctl_hdr_pos;
+    char *service;
+    gensiods service_len;
+    gensiods service_pos;
+
     struct gensio_link link;
 };
 
@@ -87,12 +99,15 @@ pshutdown(struct ioinfo *ioinfo1, enum ioinfo_shutdown_reason reason)
 
     ioinfo2 = ioinfo_otherioinfo(ioinfo1);
     gensio_free(pc->io1);
-    gensio_free(pc->io2);
+    if (pc->io2)
+	gensio_free(pc->io2);
     free_ioinfo(ioinfo1);
     free_ioinfo(ioinfo2);
     o->lock(p->lock);
     gensio_list_rm(&p->portcons, &pc->link);
     o->unlock(p->lock);
+    if (pc->service)
+	o->free(o, pc->service);
     p->o->free(p->o, pc);
 }
 
@@ -137,6 +152,17 @@ popen_done(struct gensio *io, int err, void *open_data)
     ioinfo2 = gensio_get_user_data(io);
     ioinfo1 = ioinfo_otherioinfo(ioinfo2);
 
+    if (pc->is_ctl) {
+	unsigned char status[4];
+
+	/* Tell the control client how the open went. */
+	status[0] = (err >> 24) & 0xff;
+	status[1] = (err >> 16) & 0xff;
+	status[2] = (err >> 8) & 0xff;
+	status[3] = err & 0xff;
+	gensio_write(pc->io1, NULL, status, sizeof(status), NULL);
+    }
+
     if (err) {
 	localport_pr(p, "Mux open failed for %s: %s\n",
 		     pc->id_str, gensio_err_to_str(err));
@@ -185,6 +211,7 @@ portcon_setup(struct local_ports *p, struct gensio *io, char *id_str,
     *rioinfo1 = ioinfo1;
     *rioinfo2 = ioinfo2;
     pc->io1 = io;
+    pc->ioinfo1 = ioinfo1;
     return pc;
 
  out_err:
@@ -193,47 +220,137 @@ portcon_setup(struct local_ports *p, struct gensio *io, char *id_str,
     return NULL;
 }
 
-static void
-local_port_new_con(struct local_portinfo *pi, struct gensio *io)
+static int
+portcon_open_channel(struct portcon *pc, struct ioinfo *ioinfo2,
+		     char *service, gensiods service_len)
 {
-    struct local_ports *p = pi->p;
-    struct gensio_os_funcs *o = p->o;
-    struct portcon *pc;
-    struct ioinfo *ioinfo1 = NULL, *ioinfo2 = NULL;
+    struct local_ports *p = pc->p;
     gensiods len;
     int err;
 
-    pc = portcon_setup(p, io, pi->id_str, &ioinfo1, &ioinfo2);
-    if (!pc)
-	goto out_err;
-
     err = gensio_alloc_channel(p->base_io, NULL, NULL, ioinfo2, &pc->io2);
     if (err) {
 	localport_pr(p,
 		     "Unable to alloc local mux channel for %s: %s\n",
-		     pi->id_str, gensio_err_to_str(err));
-	goto out_err;
+		     pc->id_str, gensio_err_to_str(err));
+	return err;
     }
 
     len = 1;
     gensio_control(pc->io2, 0, false, GENSIO_CONTROL_ENABLE_OOB, "1", &len);
 
-    len = strlen(pi->service_str);
+    len = service_len;
     err = gensio_control(pc->io2, 0, GENSIO_CONTROL_SET, GENSIO_CONTROL_SERVICE,
-			 pi->service_str, &len);
+			 service, &len);
     if (err) {
 	localport_pr(p, "Unable to set channel service for %s: %s\n",
-		     pi->id_str, gensio_err_to_str(err));
-	goto out_err;
+		     pc->id_str, gensio_err_to_str(err));
+	return err;
     }
 
     err = gensio_open(pc->io2, popen_done, pc);
     if (err) {
 	localport_pr(p, "Unable to open local mux channel for %s: %s\n",
-		     pi->id_str, gensio_err_to_str(err));
+		     pc->id_str, gensio_err_to_str(err));
+	return err;
+    }
+
+    return 0;
+}
+
+/*
+ * Collect the service header from a control connection, then open a
+ * mux channel with that service.
+ */
+static int
+ctl_event(struct gensio *io, void *user_data, int event, int err,
+	  unsigned char *buf, gensiods *buflen,
+	  const char *const *auxdata)
+{
+    struct portcon *pc = user_data;
+    struct local_ports *p = pc->p;
+    struct gensio_os_funcs *o = p->o;
+    gensiods pos = 0, count;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    if (err)
+	goto out_err;
+
+    while (pc->ctl_hdr_pos < sizeof(pc->ctl_hdr) && pos < *buflen)
+	pc->ctl_hdr[pc->ctl_hdr_pos++] = buf[pos++];
+    if (pc->ctl_hdr_pos < sizeof(pc->ctl_hdr))
+	goto out;
+
+    if (!pc->service) {
+	pc->service_len = (((gensiods) pc->ctl_hdr[0] << 24) |
+			   (pc->ctl_hdr[1] << 16) |
+			   (pc->ctl_hdr[2] << 8) |
+			   pc->ctl_hdr[3]);
+	if (pc->service_len == 0 || pc->service_len > 65536) {
+	    localport_pr(p, "Invalid service length from %s\n", pc->id_str);
+	    goto out_err;
+	}
+	pc->service = o->zalloc(o, pc->service_len);
+	if (!pc->service) {
+	    localport_pr(p, "Out of memory allocating service for %s\n",
+			 pc->id_str);
+	    goto out_err;
+	}
+    }
+
+    count = pc->service_len - pc->service_pos;
+    if (count > *buflen - pos)
+	count = *buflen - pos;
+    memcpy(pc->service + pc->service_pos, buf + pos, count);
+    pc->service_pos += count;
+    pos += count;
+    if (pc->service_pos < pc->service_len)
+	goto out;
+
+    /* Anything after the header is held until the ioinfo is ready. */
+    gensio_set_read_callback_enable(io, false);
+    if (portcon_open_channel(pc, ioinfo_otherioinfo(pc->ioinfo1),
+			     pc->service, pc->service_len))
+	goto out_err;
+
+ out:
+    *buflen = pos;
+    return 0;
+
+ out_err:
+    gensio_set_read_callback_enable(io, false);
+    pshutdown(pc->ioinfo1, IOINFO_SHUTDOWN_ERR);
+    return 0;
+}
+
+static void
+local_port_new_con(struct local_portinfo *pi, struct gensio *io)
+{
+    struct local_ports *p = pi->p;
+    struct gensio_os_funcs *o = p->o;
+    struct portcon *pc;
+    struct ioinfo *ioinfo1 = NULL, *ioinfo2 = NULL;
+
+    pc = portcon_setup(p, io, pi->id_str, &ioinfo1, &ioinfo2);
+    if (!pc)
 	goto out_err;
+
+    if (!pi->service_str) {
+	pc->is_ctl = true;
+	o->lock(p->lock);
+	gensio_list_add_tail(&p->portcons, &pc->link);
+	o->unlock(p->lock);
+	gensio_set_callback(io, ctl_event, pc);
+	gensio_set_read_callback_enable(io, true);
+	return;
     }
 
+    if (portcon_open_channel(pc, ioinfo2, pi->service_str,
+			     strlen(pi->service_str)))
+	goto out_err;
+
     o->lock(p->lock);
     gensio_list_add_tail(&p->portcons, &pc->link);
     o->unlock(p->lock);
@@ -385,8 +502,9 @@ add_local_port(struct local_ports *p,
 	goto out_err;
     }
 
-    pi->service_str = gensio_strdup(o, service_str);
-    if (!pi->service_str) {
+    if (service_str)
+	pi->service_str = gensio_strdup(o, service_str);
+    if (service_str && !pi->service_str) {
 	localport_pr(p, "Out of memory allocating connecter string: %s\n",
 		service_str);
 	goto out_err;
@@ -422,6 +540,13 @@ add_local_port(struct local_ports *p,
     return err;
 }
 
+int
+add_control_port(struct local_ports *p,
+		 const char *gensio_str, const char *id_str)
+{
+    return add_local_port(p, gensio_str, NULL, id_str);
+}
+
 void
 free_local_ports(struct local_ports *p)
 {
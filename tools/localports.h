@@ -45,6 +45,14 @@ int add_local_port(struct local_ports *p,
 		   const char *gensio_str, const char *service_str,
 		   const char *id_str);
 
+/*
+ * Like a local port, but each connection first sends the service to
+ * use for its mux channel, and gets a 4-byte gensio error back once
+ * the channel open completes.  Used for gtlssh connection sharing.
+ */
+int add_control_port(struct local_ports *p,
+		     const char *gensio_str, const char *id_str);
+
 void remote_port_new_con(struct local_ports *p, struct gensio *io,
 			 const char *connecter_str, char *id_str);
 